@@ -7,20 +7,194 @@ set -Eeuo pipefail
 # 1) feedback  - build and run container, install/run Gemini CLI with Prompt 1,
 #                 then (if verification passes) run Prompt 2. Copies verify assets and prompt.
 # 2) verify    - reproduce customer's command sequence on a fresh container using npx Gemini CLI.
-# 3) both      - runs feedback then verify back-to-back with a fresh container for verify.
+# 3) both      - runs feedback then verify back-to-back with a fresh container for verify
+#                 (with --parallel: one image build, then both at once in their own containers).
 
 log_info() { echo "[INFO]  $*"; }
 log_warn() { echo "[WARN]  $*" 1>&2; }
 log_error(){ echo "[ERROR] $*" 1>&2; }
 die()      { log_error "$*"; exit 1; }
 
+# Pipeline gate. With --stage-gate <dir>, announce each stage as
+# "[STAGE] <n> <stage>" and wait for the scheduler to create <dir>/<n>_<stage>
+# before running it. Without it every stage runs immediately. Pipelines that
+# run side by side (both --parallel) set STAGE_GATE_SHARED: they wait at the
+# gate one at a time, holding <dir>/.lock, and number their stages from the
+# counter in <dir>/.seq, so the scheduler still sees one request at a time.
+# A wait gives up, and the run fails, when the gate directory or the process
+# that started the script goes away, or after AUTOBUILD_STAGE_GATE_TIMEOUT
+# seconds when that is set.
+STAGE_GATE_DIR=""
+STAGE_GATE_SEQ=0
+STAGE_GATE_SHARED=""
+STAGE_GATE_TIMEOUT="${AUTOBUILD_STAGE_GATE_TIMEOUT:-0}"
+# gate_wait <interval> <command...>: poll until the command succeeds
+gate_wait() {
+  local interval="$1" start=$SECONDS; shift
+  until "$@" 2>/dev/null; do
+    [ -d "$STAGE_GATE_DIR" ] || { log_error "Stage gate $STAGE_GATE_DIR is gone"; return 1; }
+    kill -0 "$PPID" 2>/dev/null || { log_error "Scheduler (pid $PPID) is gone"; return 1; }
+    if [ "$STAGE_GATE_TIMEOUT" -gt 0 ] && [ $((SECONDS - start)) -ge "$STAGE_GATE_TIMEOUT" ]; then
+      log_error "Stage gate not opened within ${STAGE_GATE_TIMEOUT}s"; return 1
+    fi
+    sleep "$interval"
+  done
+}
+stage_gate() {
+  [ -n "$STAGE_GATE_DIR" ] || return 0
+  if [ -n "$STAGE_GATE_SHARED" ]; then
+    gate_wait 0.2 mkdir "$STAGE_GATE_DIR/.lock" || exit 1
+    STAGE_GATE_SEQ=$(cat "$STAGE_GATE_DIR/.seq" 2>/dev/null || echo 0)
+  fi
+  STAGE_GATE_SEQ=$((STAGE_GATE_SEQ + 1))
+  [ -z "$STAGE_GATE_SHARED" ] || echo "$STAGE_GATE_SEQ" > "$STAGE_GATE_DIR/.seq"
+  echo "[STAGE] $STAGE_GATE_SEQ $1"
+  if ! gate_wait 0.5 test -e "$STAGE_GATE_DIR/${STAGE_GATE_SEQ}_$1"; then
+    [ -z "$STAGE_GATE_SHARED" ] || rmdir "$STAGE_GATE_DIR/.lock" 2>/dev/null || true
+    exit 1
+  fi
+  [ -z "$STAGE_GATE_SHARED" ] || rmdir "$STAGE_GATE_DIR/.lock"
+}
+
+# Phase timing. timed <phase> <command...> runs the command between
+# "[TIMING] begin <phase> <epoch ms>" and "[TIMING] end <phase> <epoch ms>
+# <exit code>" markers on fd 9 (stderr), so a front end can draw where a run
+# spends its time; finished phases also go into the run's catalog entry.
+# Phases do not nest: inside one, timed just runs the command, which is how
+# docker cp/exec (see docker below) are only timed on their own outside the
+# named phases. A phase still open when the script exits is closed by
+# catalog_end.
+exec 9>&2
+TIMING_OPEN=""  # "<phase> <start ms>" of the running phase
+TIMING_FILE="${TMPDIR:-/tmp}/autobuild-timing-$$"
+now_ms() {
+  if [ -n "${EPOCHREALTIME:-}" ]; then local t="${EPOCHREALTIME/[.,]/}"; echo "${t:0:13}"; else echo "$(date +%s)000"; fi
+}
+timing_end() {
+  [ -n "$TIMING_OPEN" ] || return 0
+  local phase="${TIMING_OPEN% *}" start="${TIMING_OPEN##* }" end; end=$(now_ms)
+  TIMING_OPEN=""
+  echo "[TIMING] end $phase $end $1" >&9
+  [ -z "$CATALOG_RUN" ] || printf '{"name":"%s","start":%s,"ms":%s,"exit_code":%s}\n' "$phase" "$start" "$((end - start))" "$1" >> "$TIMING_FILE" 2>/dev/null || true
+}
+timed() {
+  local phase="$1"; shift
+  if [ -n "$TIMING_OPEN" ]; then "$@"; return; fi
+  TIMING_OPEN="$phase $(now_ms)"
+  echo "[TIMING] begin $TIMING_OPEN" >&9
+  # Under errexit a failure exits here and the EXIT trap closes the phase
+  local rc=0
+  "$@"
+  rc=$?
+  timing_end "$rc"
+  return "$rc"
+}
+# Run events. event <kind> <field> <value> prints "[EVENT] <kind> <field>
+# <value>" on fd 9 next to the timing markers, for the front end to keep as
+# typed run state rather than guessing it from log text:
+#   [EVENT] logdir <container name> <dir>   where the run's logs go
+#   [EVENT] container <id> <name>           the run's container is up
+#   [EVENT] image <id> <ref>                the image that container runs
+#   [EVENT] envimage <env hash> <how>       the image of that env hash is on
+#                                           the run's Docker host now: built,
+#                                           cached or pulled
+#   [EVENT] registry <env hash> <repo@digest>
+#                                           that image was pushed to the image
+#                                           registry (see IMAGE_REGISTRY)
+# Phase start/end and exit codes are the [TIMING] markers above.
+event() { echo "[EVENT] $*" >&9; }
+docker() {
+  case "${1:-}" in
+    cp|exec) timed "docker_$1" command docker "$@";;
+    *) command docker "$@";;
+  esac
+}
+
+# Task layout. The GUI and CLI validate the task directory themselves (the
+# GUI keeps that result current while it watches the directory); they pass
+# --validated when it found nothing missing and the env/, verify/ and prompt
+# checks below are skipped. The script takes the caller's word for it and
+# does not check the layout again. Without it every check runs.
+TASK_VALIDATED=""
+
+# Image cache key. The GUI and CLI hash env/ as its Dockerfile reads it (only
+# the files COPY, ADD and bind mounts name) and pass --context-hash <hash>;
+# prepare_image keys the image cache by it instead of env_context_hash, so
+# editing a file the build never reads keeps the cached image.
+CONTEXT_HASH=""
+
+# Build context archives. The GUI and CLI pass --context-tool <exe>, their
+# own executable; "<exe> --context-tar <env_dir> <dir>" writes the part of
+# env/ the Dockerfile reads, less what .dockerignore excludes, as a tar in
+# dir once per content hash and prints its path. build_image streams that
+# archive to docker build instead of sending the whole of env/, so
+# unreferenced data never crosses into the daemon. Without the tool, or
+# when it cannot write the archive, env/ is the context as before.
+CONTEXT_TOOL=""
+CONTEXT_TAR_DIR="${XDG_CACHE_HOME:-$HOME/.cache}/autobuild/contexts"
+
+# Composed prompts. The GUI writes the final Prompt 1, Prompt 2 and audit
+# prompt files itself from the prompts it holds (content-addressed, so an
+# unchanged prompt is not rewritten) and passes them with --prompt1-file,
+# --prompt2-file and --audit-prompt-file; the compose_*_file functions then
+# copy them instead of reading prompts.json. Without them they compose.
+PROMPT1_FILE=""
+PROMPT2_FILE=""
+AUDIT_PROMPT_FILE=""
+
+# Run catalog. Every run appends a "start" and an "end" line (JSON Lines) to
+# <logs root>/catalog.jsonl so the GUI can list runs, results and durations
+# without crawling the log folders. One printf per line keeps concurrent
+# appends from interleaving.
+CATALOG_FILE=""
+CATALOG_RUN=""     # log dir of the run that has started but not ended
+CATALOG_VERIFY=""  # passed/failed once the run's verification has executed
+CATALOG_VERIFY_CACHED=""  # verify cache key when that result was reused
+CATALOG_AUDIT=""          # the audit's Yes/No answers (see audit_verdict)
+CATALOG_AUDIT_CACHED=""   # audit cache key when that outcome was reused
+# json_str <text> [var]: text as a JSON string, printed or stored in var
+json_str() { local s="$1"; s=${s//\\/\\\\}; s=${s//\"/\\\"}; if [ -n "${2:-}" ]; then printf -v "$2" '"%s"' "$s"; else printf '"%s"' "$s"; fi; }
+catalog_append() {
+  [ -n "$CATALOG_FILE" ] || return 0
+  printf '%s\n' "$1" >> "$CATALOG_FILE" 2>/dev/null || log_warn "Could not write run catalog: $CATALOG_FILE"
+}
+catalog_begin() {
+  local mode="$1" task="$2" container="$3" log_dir="$4"
+  [ -n "$CATALOG_FILE" ] || return 0
+  CATALOG_RUN="$log_dir"; CATALOG_VERIFY=""; CATALOG_VERIFY_CACHED=""
+  CATALOG_AUDIT=""; CATALOG_AUDIT_CACHED=""
+  : > "$TIMING_FILE" 2>/dev/null || true
+  catalog_append "{\"event\":\"start\",\"run\":$(json_str "$log_dir"),\"task\":$(json_str "$task"),\"mode\":$(json_str "$mode"),\"container\":$(json_str "$container"),\"started\":$(date +%s)}"
+}
+catalog_end() {
+  local rc="$1"
+  timing_end "$rc"
+  [ -n "$CATALOG_FILE" ] && [ -n "$CATALOG_RUN" ] || return 0
+  local files="" f size name image="" phases="" logs=() i=0
+  for f in "$CATALOG_RUN"/*; do [ ! -f "$f" ] || logs+=("$f"); done
+  # One wc for every file; its lines follow the order of the arguments
+  if [ "${#logs[@]}" -gt 0 ]; then
+    while [ "$i" -lt "${#logs[@]}" ] && read -r size _; do
+      json_str "${logs[$i]##*/}" name
+      files+="${files:+,}$name:${size:-0}"
+      i=$((i + 1))
+    done < <(wc -c "${logs[@]}" 2>/dev/null)
+  fi
+  if [ -n "$RUN_IMAGE" ]; then image=$(docker image inspect --format '{{.Id}}' "$RUN_IMAGE" 2>/dev/null || true); fi
+  [ ! -s "$TIMING_FILE" ] || phases=$(paste -sd, - < "$TIMING_FILE")
+  rm -f "$TIMING_FILE"
+  catalog_append "{\"event\":\"end\",\"run\":$(json_str "$CATALOG_RUN"),\"ended\":$(date +%s),\"exit_code\":$rc,\"verification\":$(json_str "$CATALOG_VERIFY"),\"verify_cached\":$(json_str "$CATALOG_VERIFY_CACHED"),\"audit\":$(json_str "$CATALOG_AUDIT"),\"audit_cached\":$(json_str "$CATALOG_AUDIT_CACHED"),\"image\":$(json_str "$image"),\"files\":{$files},\"phases\":[$phases]}"
+  CATALOG_RUN=""
+}
+
 usage() {
   cat <<EOF
 Usage:
-  $(basename "$0") feedback --task <abs_task_dir> [--image-tag <tag>] [--container-name <name>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug]
-  $(basename "$0") verify   --task <abs_task_dir> [--image-tag <tag>] [--container-name <name>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug]
-  $(basename "$0") both     --task <abs_task_dir> [--image-tag <tag>] [--container-name <base>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug]
-  $(basename "$0") audit    --task <abs_task_dir> [--image-tag <tag>] [--container-name <name>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug]
+  $(basename "$0") feedback --task <abs_task_dir> [--image-tag <tag>] [--container-name <name>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug] [--stage-gate <dir>] [--reuse-image] [--image-cache] [--buildkit] [--build-cache <dir|ref>] [--cli-layer] [--container-pool <n>] [--fan-out <n>] [--cache-volumes <list>] [--package-proxy <auto|url>] [--cpus <n>] [--memory <size>] [--pids-limit <n>] [--workdir-mount <kind>] [--validated] [--context-hash <hash>] [--context-tool <exe>] [--image-registry <repo>] [--checkpoint-image] [--checkpoint-registry <repo>] [--verify-cache] [--verify-shards <n>] [--resume <log_dir>]
+  $(basename "$0") verify   --task <abs_task_dir> [--image-tag <tag>] [--container-name <name>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug] [--stage-gate <dir>] [--reuse-image] [--image-cache] [--buildkit] [--build-cache <dir|ref>] [--cli-layer] [--container-pool <n>] [--fan-out <n>] [--cache-volumes <list>] [--package-proxy <auto|url>] [--cpus <n>] [--memory <size>] [--pids-limit <n>] [--workdir-mount <kind>] [--validated] [--context-hash <hash>] [--context-tool <exe>] [--image-registry <repo>] [--verify-cache] [--verify-shards <n>]
+  $(basename "$0") both     --task <abs_task_dir> [--image-tag <tag>] [--container-name <base>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug] [--stage-gate <dir>] [--reuse-image] [--image-cache] [--buildkit] [--build-cache <dir|ref>] [--cli-layer] [--container-pool <n>] [--fan-out <n>] [--cache-volumes <list>] [--package-proxy <auto|url>] [--cpus <n>] [--memory <size>] [--pids-limit <n>] [--workdir-mount <kind>] [--validated] [--context-hash <hash>] [--context-tool <exe>] [--image-registry <repo>] [--verify-cache] [--verify-shards <n>] [--parallel]
+  $(basename "$0") audit    --task <abs_task_dir> [--image-tag <tag>] [--container-name <name>] [--workdir <path>] [--api-key <key>] [--output-dir <dir>] [--no-cache] [--debug] [--stage-gate <dir>] [--reuse-image] [--image-cache] [--buildkit] [--build-cache <dir|ref>] [--cli-layer] [--container-pool <n>] [--fan-out <n>] [--cache-volumes <list>] [--package-proxy <auto|url>] [--cpus <n>] [--memory <size>] [--pids-limit <n>] [--workdir-mount <kind>] [--validated] [--context-hash <hash>] [--context-tool <exe>] [--image-registry <repo>] [--checkpoint-image] [--checkpoint-registry <repo>] [--audit-cache] [--force-audit]
+  $(basename "$0") build    --task <abs_task_dir> [--image-tag <tag>] [--output-dir <dir>] [--no-cache] [--debug] [--buildkit] [--build-cache <dir|ref>] [--cli-layer] [--context-hash <hash>] [--context-tool <exe>] [--image-registry <repo>] [--package-proxy <auto|url>]
 Arguments:
   --task            Absolute path to task folder containing env/, verify/, prompt (file or directory)
   --image-tag       Docker image tag to build/use (default: autobuild-<task_name>:latest)
@@ -30,14 +204,61 @@ Arguments:
   --output-dir      Directory to save logs/prompts (default: <workspace>/feedback/<task_name>/<timestamp>)
   --no-cache        Force Docker to rebuild without using cache
   --debug           Enable verbose Docker build output with --progress=plain
+  --stage-gate      Wait before each stage until the scheduler releases it (see stage_gate)
+  --reuse-image     Share one build of --image-tag between concurrent runs (see prepare_image)
+  --image-cache     Reuse the image of an identical env/ context instead of rebuilding (see env_context_hash)
+  --buildkit        Build with docker buildx, package manager cache mounts and an exported layer cache (see build_image)
+  --build-cache     BuildKit cache: a local directory or a registry repository; "off" for none
+                    (default: AUTOBUILD_BUILD_CACHE or ~/.cache/autobuild/buildkit)
+  --cli-layer       Run from a cached image layer with the Gemini CLI preinstalled (see bake_cli_layer)
+  --container-pool  Keep up to <n> warm containers per image and take one when available (see pool_checkout)
+  --fan-out         One of a batch of <n> runs sharing the image: the first to reach setup starts all their
+                    containers at once (AUTOBUILD_FANOUT_PARALLEL at a time; see fanout_start)
+  --cpus, --memory, --pids-limit
+                    Limit every task container to these (memory in MiB unless it has a unit; see CONTAINER_CPUS)
+  --workdir-mount   Mount the workdir from tmpfs[:size], volume[:dir] or overlay (default: the task's workdir_mount file,
+                    AUTOBUILD_WORKDIR_MOUNT or overlay) and save it to workdir.tar.gz (see workdir_mount_setup)
+  --cache-volumes   Mount shared package cache volumes (npm,pip,apt; "off" for none) into task containers (see cache_volumes_setup)
+  --package-proxy   Download npm, PyPI and apt packages through a caching proxy: auto[:<port>] for one on this Docker
+                    endpoint, or the http:// URL of another (default: AUTOBUILD_PACKAGE_PROXY; see package_proxy_setup)
+  --validated       The caller already validated the task layout; skip the layout checks (see TASK_VALIDATED)
+  --context-hash    Key the image cache by this hash of the build context instead of hashing env/ (see CONTEXT_HASH)
+  --context-tool    Executable that writes the minimal build context as a cached tar (see CONTEXT_TOOL)
+  --image-registry  Registry repository cached images are pushed to and pulled from by env hash, so hosts
+                    that reach it build each image once (default: AUTOBUILD_IMAGE_REGISTRY; see IMAGE_REGISTRY)
+  --prompt1-file, --prompt2-file, --audit-prompt-file
+                    Send this ready-made prompt file (Prompt 1 including the task prompt) instead of composing it
+                    from prompts.json (see compose_prompt1_file)
+  --verify-cache    Reuse the stored verification result of an identical workspace and verify/ (see verify_cache_key)
+  --verify-shards   Split the verification into up to this many containers when verify/ has shard.sh or tests.list
+                    (default: AUTOBUILD_VERIFY_SHARDS; see verify_sharded)
+  --audit-cache     Reuse the stored outcome of an audit of the same prompts, verify/, Dockerfile and CLI (see audit_cache_key)
+  --force-audit     With --audit-cache, run the audit even when an outcome is stored, and store the new one
+  --checkpoint-image
+                    feedback/audit: start from a committed image of the set-up container when one exists (see checkpoint_lookup)
+  --checkpoint-registry
+                    Registry repository to pull checkpoint images from and push them to; implies --checkpoint-image
+  --resume          feedback only: continue the run logged in <log_dir> in its container from the first
+                    phase its checkpoint does not record as done (see checkpoint)
+  --parallel        both only: build the image once, then run feedback and verify at the same time (see both_parallel)
 
 Notes:
-  - feedback: Installs @google/gemini-cli@0.3.0-preview.1 in the container and runs Prompt 1;
+  - feedback: Installs @google/gemini-cli@0.3.0-preview.1 in the container (or runs from the --cli-layer image) and runs Prompt 1;
               if verification succeeds, runs Prompt 2. Copies verify assets and prompt to workdir.
   - verify:   Runs the exact customer command sequence on a fresh container using npx.
   - both:     Runs feedback then verify back-to-back; verify uses a fresh container.
+              With --parallel the image is built once and both run at the same time, each in its own container.
   - audit:    Runs an audit prompt on the task container.
+  - build:    Only builds (or finds in the image cache) the task's image and its --cli-layer, so runs started later reuse it;
+              implies --image-cache and needs no API key.
   - All outputs are saved under the logs root (default: <workspace>/logs). Override via AUTOBUILD_LOGS_ROOT or --output-dir.
+  - Each run is recorded in <logs root>/catalog.jsonl (see catalog_begin). Set AUTOBUILD_CATALOG=0 to skip it.
+  - With AUTOBUILD_K8S=<context>/<namespace> the run executes as a Kubernetes Job and its logs are copied back (see k8s_run).
+  - With --stage-gate a run fails when the gate directory or its parent process goes away while it waits, or after
+    AUTOBUILD_STAGE_GATE_TIMEOUT seconds (default 0: no limit; see stage_gate).
+  - Phases are timed with "[TIMING] begin|end" markers on stderr and in the catalog entry (see timed).
+  - Rate-limited prompts are retried up to AUTOBUILD_PROMPT_RETRIES (default 4) times with backoff (see rate_limit_delay).
+  - Command output is saved per phase (docker_build.log, gemini_prompt1.log, ...) and echoed; AUTOBUILD_PHASE_OUTPUT=file only saves it.
 EOF
 }
 
@@ -46,40 +267,89 @@ resolve_abs_path() { local p="$1"; if [ -d "$p" ] || [ -f "$p" ]; then echo "$(c
 derive_task_name() { basename "$1"; }
 derive_image_tag() { echo "autobuild-$(basename "$1"):latest"; }
 
-# Convert MSYS2 path to Windows path for Docker on Windows
-# Uses cygpath if available for accurate conversion, otherwise manual conversion
+# Windows paths for docker on MSYS2/Git Bash and Cygwin. to_windows_path
+# <var> <path> stores the Windows form of path in var (path itself on other
+# systems) without forking: drive paths (/c/..., /cygdrive/c/...) and
+# relative paths are rewritten in the shell, and only the Windows directory
+# behind the first component of any other absolute path (/tmp, /home, ...)
+# is asked of cygpath, once per component per run, since mounts decide it.
+WINDOWS_MOUNTS=""  # "|<component>=<windows dir>" for each one asked so far
 to_windows_path() {
-  local path="$1"
-  # Check if running on Windows (MSYS2/Git Bash)
-  if [[ "$OSTYPE" == "msys" || "$OSTYPE" == "cygwin" ]]; then
-    # Try using cygpath for accurate conversion (handles /tmp/, etc.)
-    if command -v cygpath >/dev/null 2>&1; then
-      cygpath -w "$path" 2>/dev/null || echo "$path"
-    else
-      # Fallback: Manual conversion for drive letters
-      if [[ "$path" =~ ^/([a-z])/(.*) ]]; then
-        local drive="${BASH_REMATCH[1]}"
-        local rest="${BASH_REMATCH[2]}"
-        echo "${drive^^}:/${rest}"
-      else
-        echo "$path"
-      fi
+  local var="$1" path="$2"
+  case "$OSTYPE" in
+    msys*|cygwin*) ;;
+    *) printf -v "$var" '%s' "$path"; return 0;;
+  esac
+  if [[ "$path" =~ ^(/cygdrive)?/([A-Za-z])(/.*)?$ ]]; then
+    local rest="${BASH_REMATCH[3]}"
+    path="${BASH_REMATCH[2]^^}:${rest:-/}"
+  elif [[ "$path" == /* ]]; then
+    local top="${path#/}"; top="/${top%%/*}"
+    local known="${WINDOWS_MOUNTS#*|$top=}"
+    if [ "$known" = "$WINDOWS_MOUNTS" ]; then
+      known=$(cygpath -w "$top" 2>/dev/null) || known=""
+      WINDOWS_MOUNTS+="|$top=$known"
     fi
-  else
-    echo "$path"
+    known="${known%%|*}"
+    [ -z "$known" ] || path="$known${path#"$top"}"
   fi
+  printf -v "$var" '%s' "${path//\//\\}"
 }
 
+# Run a command with its output appended to a phase log. The log is announced
+# as "[PHASE_LOG] <logfile>" so a front end can follow it. The output is also
+# copied to stdout unless AUTOBUILD_PHASE_OUTPUT=file, which the GUI sets
+# because it tails the file itself.
 run_and_capture() {
   local logfile="$1"; shift
+  local rc
   mkdir -p "$(dirname "$logfile")"
+  echo "[PHASE_LOG] $logfile"
   set +e
-  "$@" 2>&1 | tee -a "$logfile"
-  local rc=${PIPESTATUS[0]}
+  if [ "${AUTOBUILD_PHASE_OUTPUT:-tee}" = "file" ]; then
+    "$@" >> "$logfile" 2>&1
+    rc=$?
+  else
+    "$@" 2>&1 | tee -a "$logfile"
+    rc=${PIPESTATUS[0]}
+  fi
   set -e
   return $rc
 }
 
+# Attached phases. exec_phase <logfile> <user> <container> <command> runs
+# a shell command in the container with run_and_capture's logging. With a
+# stage gate and AUTOBUILD_PHASE_ATTACH=1 (the GUI sets it for local runs)
+# the front end runs it instead: the script leaves <gate dir>/exec-<id>
+# (container, user, log file, then the command), prints "[EXEC] <id>" and
+# waits for <gate dir>/exec-<id>.rc. The front end reads the exec's output
+# from the Docker API into its log view and the log file, so no docker CLI,
+# tee or pipe sits in between. The .rc file holds the exit code, or
+# "fallback <reason>" when the exec could not start, and the script then
+# runs docker exec itself.
+PHASE_ATTACH="${AUTOBUILD_PHASE_ATTACH:-}"
+EXEC_SEQ=0
+exec_phase() {
+  local logfile="$1" user="$2" container="$3" cmd="$4"
+  if [ -n "$PHASE_ATTACH" ] && [ -n "$STAGE_GATE_DIR" ]; then
+    EXEC_SEQ=$((EXEC_SEQ + 1))
+    # Parallel pipelines share the gate directory
+    local id="$BASHPID-$EXEC_SEQ"
+    local req="$STAGE_GATE_DIR/exec-$id" rc
+    mkdir -p "$(dirname "$logfile")"
+    printf '%s\n' "$container" "$user" "$logfile" "$cmd" > "$req.tmp" && mv "$req.tmp" "$req"
+    echo "[EXEC] $id"
+    gate_wait 0.1 test -e "$req.rc" || exit 1
+    read -r rc < "$req.rc" || true
+    rm -f "$req" "$req.rc"
+    case "$rc" in
+      ''|*[!0-9]*) log_info "Running docker exec (${rc:-no reply})";;
+      *) return "$rc";;
+    esac
+  fi
+  run_and_capture "$logfile" docker exec -u "$user" "$container" bash -lc "$cmd"
+}
+
 parse_workdir_from_dockerfile() {
   local env_dir="$1"; local dockerfile="$env_dir/Dockerfile"
   if [ -f "$dockerfile" ]; then
@@ -122,9 +392,89 @@ read_verification_command_from_path() {
   die "Verification path not found: $verify_path"
 }
 
+# BuildKit. With --buildkit, images are built by `docker buildx build` on a
+# docker-container builder (one per Docker endpoint, created on first use),
+# which can export its layer cache: every build imports and exports
+# --build-cache (AUTOBUILD_BUILD_CACHE), a directory on this host or a
+# registry repository, one cache per image repository. The cache lives with
+# the client, so a task built through one worker is warm on all of them.
+# RUN instructions that call npm, pip or yarn get cache mounts for the
+# package manager's download cache, and --no-cache means "pull the base
+# image again and rebuild every layer" without downloading every dependency
+# again. Without buildx, builds fall back to docker build.
+BUILDKIT=""
+BUILD_CACHE="${AUTOBUILD_BUILD_CACHE:-${XDG_CACHE_HOME:-$HOME/.cache}/autobuild/buildkit}"
+BUILD_CACHE_ARGS=()
+
+# Name of the endpoint's builder, creating it if needed; fails without buildx.
+# With AUTOBUILD_BUILDKIT_ADDR (a Kubernetes run's in-cluster buildkitd, see
+# k8s_run) the builder is that daemon, through buildx's remote driver.
+buildkit_builder() {
+  local name="autobuild${DOCKER_ENDPOINT_KEY:+-$DOCKER_ENDPOINT_KEY}"
+  docker buildx version >/dev/null 2>&1 || return 1
+  if [ -n "${AUTOBUILD_BUILDKIT_ADDR:-}" ]; then
+    name="autobuild-remote"
+    docker buildx inspect "$name" >/dev/null 2>&1 ||
+      docker buildx create --name "$name" --driver remote "$AUTOBUILD_BUILDKIT_ADDR" >/dev/null 2>&1 ||
+      docker buildx inspect "$name" >/dev/null 2>&1 || return 1
+    echo "$name"
+    return 0
+  fi
+  # A concurrent run may create it first; then the second inspect succeeds
+  docker buildx inspect "$name" >/dev/null 2>&1 ||
+    docker buildx create --name "$name" --driver docker-container >/dev/null 2>&1 ||
+    docker buildx inspect "$name" >/dev/null 2>&1 || return 1
+  echo "$name"
+}
+
+# Set BUILD_CACHE_ARGS to import and export the cache of image_tag's repository
+buildkit_cache_args() {
+  local scope; scope=$(printf '%s' "${1%:*}" | tr -c 'A-Za-z0-9_.-' '_')
+  BUILD_CACHE_ARGS=()
+  case "$BUILD_CACHE" in
+    ""|off) ;;
+    /*|./*|../*|~*|[A-Za-z]:*)
+      local dir; to_windows_path dir "$BUILD_CACHE/$scope"
+      mkdir -p "$BUILD_CACHE/$scope"
+      BUILD_CACHE_ARGS=(--cache-from "type=local,src=$dir" --cache-to "type=local,dest=$dir,mode=max");;
+    *)
+      BUILD_CACHE_ARGS=(--cache-from "type=registry,ref=$BUILD_CACHE:$scope" --cache-to "type=registry,ref=$BUILD_CACHE:$scope,mode=max");;
+  esac
+}
+
+# Copy of a Dockerfile with package manager cache mounts on the RUN
+# instructions that use them (instructions already mounting something are
+# left alone; continuation lines are read as part of their instruction)
+add_cache_mounts() {
+  awk '
+    function flush(   mounts) {
+      if (run == "") return
+      mounts = ""
+      if (run ~ /(^|[^A-Za-z0-9_])(npm|npx)[[:space:]]/) mounts = mounts " --mount=type=cache,target=/root/.npm"
+      if (run ~ /(^|[^A-Za-z0-9_])pip3?[[:space:]]/) mounts = mounts " --mount=type=cache,target=/root/.cache/pip"
+      if (run ~ /(^|[^A-Za-z0-9_])yarn[[:space:]]/) mounts = mounts " --mount=type=cache,target=/usr/local/share/.cache/yarn"
+      if (mounts != "") sub(/^[[:space:]]*[Rr][Uu][Nn]/, "&" mounts, first)
+      printf "%s", first
+      run = ""
+    }
+    run != "" {
+      first = first "\n" $0; run = run " " $0
+      if ($0 !~ /\\[[:space:]]*$/) { flush(); printf "\n" }
+      next
+    }
+    /^[[:space:]]*[Rr][Uu][Nn][[:space:]]/ && $0 !~ /--mount/ {
+      first = $0; run = $0
+      if ($0 !~ /\\[[:space:]]*$/) { flush(); printf "\n" }
+      next
+    }
+    { print }
+    END { if (run != "") { flush(); printf "\n" } }
+  ' "$1"
+}
+
 build_image() {
-  local env_dir="$1"; local image_tag="$2"; local logfile="${3:-}"; local no_cache_flag="${4:-}"
-  local env_dir_win="$(to_windows_path "$env_dir")"
+  local env_dir="$1"; local image_tag="$2"; local logfile="${3:-}"; local no_cache_flag="${4:-}"; local debug_flag="${5:-}"
+  local env_dir_win; to_windows_path env_dir_win "$env_dir"
   log_info "Building image: $image_tag from $env_dir"
   
   # If --no-cache is specified, check if we can remove the existing image
@@ -145,10 +495,653 @@ build_image() {
     fi
   fi
   
-  if [ -n "$logfile" ]; then
-    run_and_capture "$logfile" docker build $no_cache_flag -t "$image_tag" "$env_dir_win"
+  local builder="" build=() ctx="" rc=0
+  if [ -n "$BUILDKIT" ]; then
+    builder=$(buildkit_builder) || log_warn "docker buildx is not available; building with docker build"
+  fi
+  if [ -n "$builder" ]; then
+    ctx=$(mktemp -d)
+    add_cache_mounts "$env_dir/Dockerfile" | add_proxy_args > "$ctx/Dockerfile"
+    buildkit_cache_args "$image_tag"
+    log_info "Building with BuildKit ($builder)${BUILD_CACHE_ARGS[0]:+, cache: $BUILD_CACHE}"
+    local dockerfile_win; to_windows_path dockerfile_win "$ctx/Dockerfile"
+    build=(docker buildx build --builder "$builder" --load -f "$dockerfile_win")
+    [ "${#BUILD_CACHE_ARGS[@]}" -eq 0 ] || build+=("${BUILD_CACHE_ARGS[@]}")
+    # Fresh base layers; the cache mounts still hold the downloads
+    [ -z "$no_cache_flag" ] || build+=(--no-cache --pull)
+    [ -z "$debug_flag" ] || build+=(--progress=plain)
+  else
+    build=(docker build)
+    [ -z "$no_cache_flag" ] || build+=("$no_cache_flag")
+    # The stages need to declare the package proxy's arguments too
+    if [ -n "$PROXY_URL" ]; then
+      ctx=$(mktemp -d)
+      add_proxy_args < "$env_dir/Dockerfile" > "$ctx/Dockerfile"
+      local dockerfile_win; to_windows_path dockerfile_win "$ctx/Dockerfile"
+      build+=(-f "$dockerfile_win")
+    fi
+  fi
+  [ "${#PROXY_BUILD_ARGS[@]}" -eq 0 ] || build+=("${PROXY_BUILD_ARGS[@]}")
+  # The classic builder reads a tar context on stdin; buildx is handed
+  # its rewritten Dockerfile apart from the context, so it keeps env/ (as
+  # does the classic builder given a Dockerfile for the package proxy)
+  local context="$env_dir_win" context_tar=""
+  if [ -z "$builder" ] && [ -z "$ctx" ] && [ -n "$CONTEXT_TOOL" ] && mkdir -p "$CONTEXT_TAR_DIR" 2>/dev/null; then
+    context_tar=$("$CONTEXT_TOOL" --context-tar "$env_dir" "$CONTEXT_TAR_DIR" 2>/dev/null) || context_tar=""
+    if [ -n "$context_tar" ] && [ -f "$context_tar" ]; then
+      log_info "Build context: $(du -k "$context_tar" | cut -f1) KiB archive $(basename "$context_tar")"
+      context="-"
+    else
+      context_tar=""
+    fi
+  fi
+  build+=($BUILD_LABEL -t "$image_tag" "$context")
+
+  if [ -n "$context_tar" ]; then
+    if [ -n "$logfile" ]; then
+      run_and_capture "$logfile" "${build[@]}" < "$context_tar" || rc=$?
+    else
+      "${build[@]}" < "$context_tar" || rc=$?
+    fi
+  elif [ -n "$logfile" ]; then
+    run_and_capture "$logfile" "${build[@]}" || rc=$?
+  else
+    "${build[@]}" || rc=$?
+  fi
+  [ -z "$ctx" ] || rm -rf "$ctx"
+  return "$rc"
+}
+
+# Image cache. With --image-cache, images are labelled with a hash of their
+# env/ build context (Dockerfile included) and a run whose context hashes the
+# same reuses that image instead of building. IMAGE_CACHE_DIR holds one file
+# per hash whose mtime records its last use; past AUTOBUILD_IMAGE_CACHE_SIZE
+# hashes the least recently used images are removed.
+IMAGE_CACHE=""
+IMAGE_CACHE_DIR="${XDG_CACHE_HOME:-$HOME/.cache}/autobuild/images"
+# Runs placed on a remote Docker host (DOCKER_HOST or DOCKER_CONTEXT set by
+# the caller) keep that host's cache records and build locks apart, since its
+# images are not the local ones
+DOCKER_ENDPOINT="${DOCKER_HOST:-${DOCKER_CONTEXT:-}}"
+DOCKER_ENDPOINT_KEY=""
+if [ -n "$DOCKER_ENDPOINT" ]; then
+  DOCKER_ENDPOINT_KEY=$(printf '%s' "$DOCKER_ENDPOINT" | tr -c 'A-Za-z0-9_.-' '_')
+  IMAGE_CACHE_DIR="$IMAGE_CACHE_DIR/$DOCKER_ENDPOINT_KEY"
+fi
+IMAGE_CACHE_SIZE="${AUTOBUILD_IMAGE_CACHE_SIZE:-10}"
+IMAGE_HASH_LABEL="autobuild.env-hash"
+
+sha256_cmd() { if command -v sha256sum >/dev/null 2>&1; then sha256sum; else shasum -a 256; fi; }
+
+# Hash of every file under env_dir, paths included, independent of
+# filesystem order
+env_context_hash() {
+  (cd "$1" && find . -type f -print | LC_ALL=C sort | while IFS= read -r f; do
+    printf '%s  ' "$f"; sha256_cmd < "$f"
+  done) | sha256_cmd | cut -c1-32
+}
+
+# Images labelled with an env hash, "<tag> <id>" per line. Gemini CLI layers
+# (tags cli-*) and checkpoint images (ckpt-*) inherit the label from their
+# base image.
+images_for_hash() {
+  docker images --filter "label=$IMAGE_HASH_LABEL=$1" --format '{{.Tag}} {{.ID}}' 2>/dev/null || true
+}
+
+cached_image_for_hash() {
+  images_for_hash "$1" | awk '$1 !~ /^(cli|ckpt)-/ { print $2; exit }'
+}
+
+# Record a use of the cached hash and evict the least recently used hashes
+# past the cache size. Images still used by running containers survive.
+touch_image_cache() {
+  mkdir -p "$IMAGE_CACHE_DIR"
+  touch "$IMAGE_CACHE_DIR/$1"
+  local stale
+  ls -t "$IMAGE_CACHE_DIR" | tail -n +"$((IMAGE_CACHE_SIZE + 1))" | while IFS= read -r stale; do
+    # Checkpoints and CLI layers go before the images they were built on
+    local ids; ids=$(images_for_hash "$stale" | awk '{ print ($1 ~ /^ckpt-/ ? 0 : $1 ~ /^cli-/ ? 1 : 2), $2 }' | sort -u | awk '!seen[$2]++ { print $2 }')
+    if [ -z "$ids" ] || docker rmi -f $ids >/dev/null 2>&1; then
+      log_info "Evicted cached image for env hash $stale"
+      rm -f "$IMAGE_CACHE_DIR/$stale"
+    fi
+  done
+}
+
+# Verification memo. With --verify-cache the outcome and log of every
+# verification are stored under a key of the container's image, the
+# workspace as the prompts left it (a digest of every file under the
+# workdir, taken in the container), the verify/ files and the verification
+# command. A run that reaches the same key reuses them instead of running
+# the command again, and its catalog entry names the key (verify_cached).
+# Only the workdir is hashed: a verify step that depends on what the agent
+# changed elsewhere in the container should not use the cache. The
+# AUTOBUILD_VERIFY_CACHE_SIZE (default 200) most recently used outcomes are
+# kept.
+VERIFY_CACHE=""
+VERIFY_CACHE_DIR="${XDG_CACHE_HOME:-$HOME/.cache}/autobuild/verify"
+VERIFY_CACHE_SIZE="${AUTOBUILD_VERIFY_CACHE_SIZE:-200}"
+VERIFY_INPUTS=""    # hash of the run's verify/ files, set with --verify-cache
+VERIFY_KEY=""       # key of the run's workspace, once verify_cache_key ran
+[ -z "$DOCKER_ENDPOINT_KEY" ] || VERIFY_CACHE_DIR="$VERIFY_CACHE_DIR/$DOCKER_ENDPOINT_KEY"
+
+# verify_inputs_hash <verify path>: the verify/ side of the key
+verify_inputs_hash() {
+  if [ -d "$1" ]; then env_context_hash "$1"; else sha256_cmd < "$1" | cut -c1-32; fi
+}
+
+# verify_cache_key <container> <workdir> <verification command>: sets
+# VERIFY_KEY, or leaves it empty when the workspace cannot be hashed (no
+# sha256sum in the image, say)
+verify_cache_key() {
+  VERIFY_KEY=""; CATALOG_VERIFY_CACHED=""
+  [ -n "$VERIFY_INPUTS" ] || return 0
+  local image workspace
+  image=$(docker inspect -f '{{.Image}}' "$1" 2>/dev/null) || return 0
+  workspace=$(MSYS_NO_PATHCONV=1 command docker exec -u root "$1" sh -c 'cd "$1" && find . -type f -print0 | LC_ALL=C sort -z | xargs -0 sha256sum | sha256sum' _ "$2" 2>/dev/null) || return 0
+  VERIFY_KEY=$(printf '%s\n' "$image" "${workspace%% *}" "$VERIFY_INPUTS" "$3" | sha256_cmd | cut -c1-32)
+}
+
+# verify_cache_lookup <log dir>: on a hit for VERIFY_KEY, copy its log into
+# <log dir> and set VERIFY_CACHED_RC to the stored exit code
+VERIFY_CACHED_RC=""
+verify_cache_lookup() {
+  local entry="$VERIFY_CACHE_DIR/$VERIFY_KEY"
+  [ -n "$VERIFY_KEY" ] && [ -f "$entry/rc" ] || return 1
+  cp "$entry/verification.log" "$1/verification.log" 2>/dev/null || return 1
+  VERIFY_CACHED_RC=$(cat "$entry/rc")
+  touch "$entry"
+  CATALOG_VERIFY_CACHED="$VERIFY_KEY"
+  log_info "Verification reused from the verify cache (key $VERIFY_KEY, exit code $VERIFY_CACHED_RC); not run again"
+}
+
+# verify_cache_store <rc> <log>: remember a verification that ran, then
+# evict the least recently used outcomes past the cache size
+verify_cache_store() {
+  [ -n "$VERIFY_KEY" ] && [ -z "$CATALOG_VERIFY_CACHED" ] || return 0
+  local tmp="$VERIFY_CACHE_DIR/.tmp-$$-$RANDOM"
+  if mkdir -p "$tmp" && cp "$2" "$tmp/verification.log" && echo "$1" > "$tmp/rc"; then
+    rm -rf "${VERIFY_CACHE_DIR:?}/$VERIFY_KEY"
+    mv "$tmp" "$VERIFY_CACHE_DIR/$VERIFY_KEY" 2>/dev/null || rm -rf "$tmp"
+  else
+    rm -rf "$tmp"; log_warn "Could not write the verify cache: $VERIFY_CACHE_DIR"; return 0
+  fi
+  local stale
+  ls -t "$VERIFY_CACHE_DIR" | tail -n +"$((VERIFY_CACHE_SIZE + 1))" | while IFS= read -r stale; do
+    rm -rf "${VERIFY_CACHE_DIR:?}/$stale"
+  done
+}
+
+# Audit cache. An audit only reads its inputs, so with --audit-cache its
+# outcome (gemini_audit.log and the verdict parsed from it) is kept under a
+# hash of them: the audit prompt, the task prompt, the verify/ tree, the
+# Dockerfile and the Gemini CLI package. An audit of unchanged inputs copies
+# the outcome into its log directory and ends before any image build,
+# container or prompt. --force-audit runs it anyway and replaces what is
+# stored. Only answers holding the whole verdict are stored; the least
+# recently used outcomes past AUTOBUILD_AUDIT_CACHE_SIZE are dropped.
+AUDIT_CACHE=""
+AUDIT_FORCE=""
+AUDIT_CACHE_DIR="${XDG_CACHE_HOME:-$HOME/.cache}/autobuild/audit"
+AUDIT_CACHE_SIZE="${AUTOBUILD_AUDIT_CACHE_SIZE:-200}"
+AUDIT_KEY=""
+AUDIT_TAGS="VERIFY_VALID VERIFY_REASON PROMPT_CLEAR PROMPT_REASON OTHER_VALID_SOLUTIONS_OK OTHER_SOLUTIONS_REASON"
+
+# audit_cache_key <audit prompt file> <task dir>: sets AUDIT_KEY
+audit_cache_key() {
+  AUDIT_KEY=""
+  [ -n "$AUDIT_CACHE" ] || return 0
+  local prompt_path; prompt_path=$(get_prompt_path "$2")
+  AUDIT_KEY=$(printf '%s\n' "$(sha256_cmd < "$1")" "$(sha256_cmd < "$prompt_path")" "$(env_context_hash "$2/verify")" "$(sha256_cmd < "$2/env/Dockerfile")" "$GEMINI_CLI_PKG" | sha256_cmd | cut -c1-32)
+}
+
+# audit_verdict <log dir>: write the tags of the audit's answer in
+# gemini_audit.log to audit_verdict.txt as "<TAG> <value>" lines (the last
+# of each, as the prompt itself may be echoed), set CATALOG_AUDIT and print
+# them; false unless every tag was found
+audit_verdict() {
+  local text tag value found=0 total=0
+  text=$(tr '\n' ' ' < "$1/gemini_audit.log" 2>/dev/null) || return 1
+  : > "$1/audit_verdict.txt"
+  CATALOG_AUDIT=""
+  for tag in $AUDIT_TAGS; do
+    total=$((total + 1))
+    value=$(grep -o "<$tag>[^<]*</$tag>" <<< "$text" | tail -n 1 || true)
+    value=${value#"<$tag>"}; value=${value%"</$tag>"}
+    [ -n "$value" ] || continue
+    found=$((found + 1))
+    printf '%s %s\n' "$tag" "$value" >> "$1/audit_verdict.txt"
+    log_info "Audit $tag: $value"
+    case "$tag" in *_REASON) ;; *) CATALOG_AUDIT+="${CATALOG_AUDIT:+ }$tag=$value";; esac
+  done
+  [ "$found" -eq "$total" ]
+}
+
+# audit_cache_lookup <log dir>: on a hit for AUDIT_KEY, copy its outcome
+# into <log dir>
+audit_cache_lookup() {
+  local entry="$AUDIT_CACHE_DIR/$AUDIT_KEY"
+  [ -n "$AUDIT_KEY" ] && [ -z "$AUDIT_FORCE" ] && [ -f "$entry/audit_verdict.txt" ] || return 1
+  cp "$entry/gemini_audit.log" "$1/gemini_audit.log" 2>/dev/null || return 1
+  touch "$entry"
+  CATALOG_AUDIT_CACHED="$AUDIT_KEY"
+  log_info "Audit reused from the audit cache (key $AUDIT_KEY); no image, container or prompt needed"
+  audit_verdict "$1" || true
+}
+
+# audit_cache_store <log dir>
+audit_cache_store() {
+  [ -n "$AUDIT_KEY" ] || return 0
+  local tmp="$AUDIT_CACHE_DIR/.tmp-$$-$RANDOM"
+  if mkdir -p "$tmp" && cp "$1/gemini_audit.log" "$1/audit_verdict.txt" "$tmp/"; then
+    rm -rf "${AUDIT_CACHE_DIR:?}/$AUDIT_KEY"
+    mv "$tmp" "$AUDIT_CACHE_DIR/$AUDIT_KEY" 2>/dev/null || rm -rf "$tmp"
+  else
+    rm -rf "$tmp"; log_warn "Could not write the audit cache: $AUDIT_CACHE_DIR"; return 0
+  fi
+  local stale
+  ls -t "$AUDIT_CACHE_DIR" | tail -n +"$((AUDIT_CACHE_SIZE + 1))" | while IFS= read -r stale; do
+    rm -rf "${AUDIT_CACHE_DIR:?}/$stale"
+  done
+}
+
+# Sharded verification. With --verify-shards <n> (AUTOBUILD_VERIFY_SHARDS)
+# and a verify/ directory that says how its tests split, the verification
+# runs as up to n shards side by side: the run's container, as the prompts
+# left it, is committed to a throwaway image and shards 2..n run in
+# containers started from it, shard 1 in the run's own container. verify/
+# declares the split with either
+#   shard.sh     run as "bash shard.sh <index> <count>" (index from 1)
+#   tests.list   one test per line ("#" comments), dealt out round robin;
+#                each shard runs the verification command with its tests
+#                as arguments
+# Each shard logs to verification.shard-<i>.log, verification.log gets them
+# all after one another, and the verification passes when every shard did.
+# A mounted workdir (see workdir_mount_setup) is not in the committed image,
+# so those runs verify unsharded.
+VERIFY_SHARDS="${AUTOBUILD_VERIFY_SHARDS:-0}"
+VERIFY_SHARD_KIND=""   # shard.sh or tests.list, set by verify_shard_setup
+VERIFY_SHARD_TESTS=()  # the entries of tests.list
+
+# verify_shard_setup <verify path>
+verify_shard_setup() {
+  VERIFY_SHARD_KIND=""; VERIFY_SHARD_TESTS=()
+  case "$VERIFY_SHARDS" in ''|*[!0-9]*|0|1) return 0;; esac
+  [ -d "$1" ] || return 0
+  if [ -f "$1/shard.sh" ]; then
+    VERIFY_SHARD_KIND=shard.sh
+  elif [ -f "$1/tests.list" ]; then
+    mapfile -t VERIFY_SHARD_TESTS < <(grep -v '^[[:space:]]*\(#\|$\)' "$1/tests.list" || true)
+    if [ "${#VERIFY_SHARD_TESTS[@]}" -gt 1 ]; then VERIFY_SHARD_KIND=tests.list; fi
+  fi
+  [ -z "$VERIFY_SHARD_KIND" ] || log_info "Verification runs as up to $VERIFY_SHARDS shards ($VERIFY_SHARD_KIND)"
+}
+
+verify_shardable() { [ -n "$VERIFY_SHARD_KIND" ] && [ -z "$WORKDIR_MOUNTED" ]; }
+
+# verify_shard_cmd <index> <count> <workdir> <verification command>
+verify_shard_cmd() {
+  if [ "$VERIFY_SHARD_KIND" = shard.sh ]; then
+    echo "cd '$3' && bash shard.sh $1 $2"
+    return 0
+  fi
+  local args="" i
+  for ((i = $1 - 1; i < ${#VERIFY_SHARD_TESTS[@]}; i += $2)); do
+    args+=" $(printf '%q' "${VERIFY_SHARD_TESTS[$i]}")"
+  done
+  echo "cd '$3' && chmod +x verify.sh 2>/dev/null || true && $4$args"
+}
+
+# verify_sharded <container> <workdir> <verification command> <log dir>:
+# run the shards and return the verification's exit code (the first failing
+# shard's)
+verify_sharded() {
+  local container="$1" workdir="$2" cmd="$3" log_dir="$4"
+  local count="$VERIFY_SHARDS" image="${RUN_IMAGE%:*}:shard-$$-$RANDOM"
+  if [ "$VERIFY_SHARD_KIND" = tests.list ] && [ "${#VERIFY_SHARD_TESTS[@]}" -lt "$count" ]; then
+    count=${#VERIFY_SHARD_TESTS[@]}
+  fi
+  if ! command docker commit "$container" "$image" >/dev/null; then
+    log_warn "Could not commit $container for the verification shards; running one shard"
+    count=1; image=""
+  fi
+  log_info "Running verification as $count shards: $cmd"
+  local rcdir; rcdir=$(mktemp -d)
+  local i pids=()
+  for ((i = 1; i <= count; i++)); do
+    echo "[PHASE_LOG] $log_dir/verification.shard-$i.log"
+    (
+      target="$container"; rc=0
+      if [ "$i" -gt 1 ]; then
+        target="$container-shard$i"
+        if ! MSYS_NO_PATHCONV=1 command docker run -v /var/run/docker.sock:/var/run/docker.sock "${CACHE_RUN_ARGS[@]+"${CACHE_RUN_ARGS[@]}"}" "${LIMIT_RUN_ARGS[@]+"${LIMIT_RUN_ARGS[@]}"}" --name "$target" -d --entrypoint sleep "$image" infinity >/dev/null; then
+          echo "Could not start shard container $target" > "$log_dir/verification.shard-$i.log"
+          echo 125 > "$rcdir/$i"; exit 0
+        fi
+      fi
+      MSYS_NO_PATHCONV=1 command docker exec -u root "$target" bash -lc "$(verify_shard_cmd "$i" "$count" "$workdir" "$cmd")" > "$log_dir/verification.shard-$i.log" 2>&1 || rc=$?
+      echo "$rc" > "$rcdir/$i"
+    ) &
+    pids+=($!)
+  done
+  wait "${pids[@]}" || true
+  echo "[PHASE_LOG] $log_dir/verification.log"
+  local rc=0 shard_rc
+  for ((i = 1; i <= count; i++)); do
+    shard_rc=$(cat "$rcdir/$i" 2>/dev/null || echo 1)
+    {
+      echo "===== verification shard $i/$count: exit code $shard_rc ====="
+      cat "$log_dir/verification.shard-$i.log" 2>/dev/null || true
+    } >> "$log_dir/verification.log"
+    [ "$shard_rc" -eq 0 ] || [ "$rc" -ne 0 ] || rc="$shard_rc"
+    [ "$i" -eq 1 ] || command docker rm -f -v "$container-shard$i" >/dev/null 2>&1 || true
+  done
+  [ -z "$image" ] || command docker rmi "$image" >/dev/null 2>&1 || true
+  rm -rf "$rcdir"
+  [ "${AUTOBUILD_PHASE_OUTPUT:-tee}" = "file" ] || cat "$log_dir/verification.log"
+  return "$rc"
+}
+
+# Image registry. With --image-cache and --image-registry <repo> (or
+# AUTOBUILD_IMAGE_REGISTRY), an image this run builds is pushed as
+# <repo>:env-<hash> and the digest the registry gave it is reported as a
+# registry event. A run whose env hash has no image here pulls it before
+# building: by AUTOBUILD_IMAGE_DIGEST when the caller passes one (the GUI
+# hands out the digest another host reported, so every host runs the same
+# bytes), else by the env-<hash> tag. The pulled image keeps its env hash
+# label and joins the image cache like a built one.
+IMAGE_REGISTRY="${AUTOBUILD_IMAGE_REGISTRY:-}"
+IMAGE_DIGEST="${AUTOBUILD_IMAGE_DIGEST:-}"
+
+# registry_pull <env hash>: true when the image is here afterwards
+registry_pull() {
+  [ -n "$IMAGE_REGISTRY" ] || return 1
+  local ref
+  for ref in $IMAGE_DIGEST "$IMAGE_REGISTRY:env-$1"; do
+    if timed pull_image command docker pull -q "$ref" >/dev/null 2>&1; then
+      log_info "Pulled the image for env hash $1 from the registry: $ref"
+      return 0
+    fi
+  done
+  return 1
+}
+
+# registry_push <env hash> <image>
+registry_push() {
+  [ -n "$IMAGE_REGISTRY" ] || return 0
+  local remote="$IMAGE_REGISTRY:env-$1" digest
+  if ! docker tag "$2" "$remote" || ! timed push_image command docker push -q "$remote" >/dev/null 2>&1; then
+    log_warn "Could not push the image to the registry: $remote"
+    return 0
+  fi
+  digest=$(docker image inspect -f '{{range .RepoDigests}}{{println .}}{{end}}' "$remote" 2>/dev/null | grep -F "${IMAGE_REGISTRY}@" | head -n 1)
+  log_info "Pushed the image to the registry: ${digest:-$remote}"
+  [ -z "$digest" ] || event registry "$1" "$digest"
+}
+
+# Cross-run lock around building an image, keyed by tag or context hash
+IMAGE_LOCK=""
+image_lock() {
+  IMAGE_LOCK="${TMPDIR:-/tmp}/autobuild-image-${DOCKER_ENDPOINT_KEY:+$DOCKER_ENDPOINT_KEY-}$(printf '%s' "$1" | tr -c 'A-Za-z0-9_.-' '_').lock"
+  until mkdir "$IMAGE_LOCK" 2>/dev/null; do
+    # Break the lock of a run that died while building
+    local holder; holder=$(cat "$IMAGE_LOCK/pid" 2>/dev/null || true)
+    if [ -n "$holder" ] && ! kill -0 "$holder" 2>/dev/null; then rm -rf "$IMAGE_LOCK"; continue; fi
+    sleep 1
+  done
+  echo $$ > "$IMAGE_LOCK/pid"
+}
+image_unlock() { rm -rf "$IMAGE_LOCK"; IMAGE_LOCK=""; }
+
+# Image sharing. With --reuse-image, runs given the same image tag build it
+# once: the first run to take the tag's lock builds, the others wait and
+# reuse the result (with --image-cache the lock covers every run of the same
+# env/ context instead). Shared and cached images are pinned to a
+# content-addressed tag (<repo>:sha-<id>) and RUN_IMAGE names what the
+# container should run, so a later build under the same tag cannot change
+# it underneath a run.
+REUSE_IMAGE=""
+RUN_IMAGE=""
+BUILD_LABEL=""
+prepare_image() {
+  local env_dir="$1"; local image_tag="$2"; local logfile="${3:-}"; local no_cache_flag="${4:-}"; local debug_flag="${5:-}"
+  if [ -z "$REUSE_IMAGE" ] && [ -z "$IMAGE_CACHE" ]; then
+    timed build_image build_image "$env_dir" "$image_tag" "$logfile" "$no_cache_flag" "$debug_flag"
+    RUN_IMAGE="$image_tag"
+    return 0
+  fi
+  local env_hash="" cached="" lock_key="$image_tag" how="cached"
+  if [ -n "$IMAGE_CACHE" ]; then
+    env_hash=${CONTEXT_HASH:-$(env_context_hash "$env_dir")}
+    lock_key="env-$env_hash"
+  fi
+  image_lock "$lock_key"
+  [ -z "$env_hash" ] || cached=$(cached_image_for_hash "$env_hash")
+  if [ -z "$cached" ] && [ -n "$env_hash" ] && registry_pull "$env_hash"; then
+    cached=$(cached_image_for_hash "$env_hash")
+    how="pulled"
+  fi
+  if [ -n "$REUSE_IMAGE" ] && docker image inspect "$image_tag" >/dev/null 2>&1; then
+    log_info "Reusing image built by another run: $image_tag"
+  elif [ -n "$cached" ]; then
+    log_info "Using cached image $cached for unchanged env (hash $env_hash)"
+    docker tag "$cached" "$image_tag"
+  else
+    [ -z "$env_hash" ] || BUILD_LABEL="--label $IMAGE_HASH_LABEL=$env_hash"
+    if ! timed build_image build_image "$env_dir" "$image_tag" "$logfile" "$no_cache_flag" "$debug_flag"; then
+      image_unlock
+      die "Image build failed: $image_tag"
+    fi
+    how="built"
+  fi
+  [ -z "$env_hash" ] || touch_image_cache "$env_hash"
+  image_unlock
+  if [ -n "$env_hash" ]; then
+    [ "$how" != "built" ] || registry_push "$env_hash" "$image_tag"
+    event envimage "$env_hash" "$how"
+  fi
+  local image_id; image_id=$(docker image inspect -f '{{.Id}}' "$image_tag")
+  image_id="${image_id#sha256:}"
+  RUN_IMAGE="${image_tag%:*}:sha-${image_id:0:12}"
+  docker tag "$image_tag" "$RUN_IMAGE"
+  log_info "Pinned image: $RUN_IMAGE"
+}
+
+# Gemini CLI layer. With --cli-layer, RUN_IMAGE is extended once per base
+# image with the pinned CLI installed globally and the npx cache warmed for
+# the image's user, tagged <repo>:cli-<base id>. On success RUN_IMAGE names
+# the derived image and CLI_BAKED is set, so runs skip the in-container
+# install; if the layer cannot be built runs install the CLI as before.
+GEMINI_CLI_PKG="@google/gemini-cli@0.3.0-preview.1"
+CLI_LAYER=""
+CLI_BAKED=""
+bake_cli_layer() {
+  local logfile="$1"
+  [ -n "$CLI_LAYER" ] || return 0
+  local base_id; base_id=$(docker image inspect -f '{{.Id}}' "$RUN_IMAGE")
+  base_id="${base_id#sha256:}"
+  local cli_tag="${RUN_IMAGE%:*}:cli-${base_id:0:12}"
+  image_lock "cli-${base_id:0:12}"
+  if docker image inspect "$cli_tag" >/dev/null 2>&1; then
+    log_info "Using Gemini CLI layer: $cli_tag"
+  else
+    log_info "Building Gemini CLI layer: $cli_tag"
+    local user; user=$(docker image inspect -f '{{.Config.User}}' "$RUN_IMAGE")
+    local ctx; ctx=$(mktemp -d)
+    {
+      echo "FROM $RUN_IMAGE"
+      [ -z "$PROXY_URL" ] || echo "ARG npm_config_registry"
+      echo "USER root"
+      echo "RUN npm install -g $GEMINI_CLI_PKG"
+      [ -z "$user" ] || echo "USER $user"
+      echo "RUN npx --yes $GEMINI_CLI_PKG --version >/dev/null 2>&1 || true"
+    } > "$ctx/Dockerfile"
+    local ctx_win; to_windows_path ctx_win "$ctx"
+    if ! timed build_cli_layer run_and_capture "$logfile" docker build "${PROXY_BUILD_ARGS[@]+"${PROXY_BUILD_ARGS[@]}"}" -t "$cli_tag" "$ctx_win"; then
+      rm -rf "$ctx"
+      image_unlock
+      log_warn "Could not build the Gemini CLI layer; installing the CLI per container"
+      return 0
+    fi
+    rm -rf "$ctx"
+  fi
+  image_unlock
+  RUN_IMAGE="$cli_tag"
+  CLI_BAKED=1
+}
+
+# Checkpoint images. With --checkpoint-image, the container of a feedback or
+# audit run is committed once the Gemini CLI is installed and the run's
+# files (prompts, verify/, _context) are in place, as <repo>:ckpt-<key>; the
+# key hashes the mode, the env/ context, the CLI package and those files. A
+# later run with the same key starts its container from that image and goes
+# straight to the prompt phase. With --checkpoint-registry <repo> the images
+# are named <repo>:ckpt-<key> instead, pulled when missing here and pushed
+# in the background once committed, so every host reaching the registry
+# shares them. A checkpoint image carries the env hash label of its base
+# and leaves the image cache with it.
+CHECKPOINT_IMAGE=""
+CHECKPOINT_REGISTRY=""
+CKPT_TAG=""  # the run's checkpoint image, once checkpoint_lookup ran
+CKPT_HIT=""  # CKPT_TAG exists; RUN_IMAGE names it and the run skips setup
+
+# checkpoint_lookup <mode> <env dir> <stage dir>
+checkpoint_lookup() {
+  CKPT_TAG=""; CKPT_HIT=""
+  [ -n "$CHECKPOINT_IMAGE" ] || return 0
+  local key; key=$(printf '%s\n' "$1" "$(env_context_hash "$2")" "$GEMINI_CLI_PKG" "$(env_context_hash "$3")" "$(cat "$3.segments" 2>/dev/null || true)" | sha256_cmd | cut -c1-32)
+  CKPT_TAG="${CHECKPOINT_REGISTRY:-${RUN_IMAGE%:*}}:ckpt-$key"
+  if docker image inspect "$CKPT_TAG" >/dev/null 2>&1; then
+    CKPT_HIT=1
+  elif [ -n "$CHECKPOINT_REGISTRY" ] && timed pull_checkpoint command docker pull -q "$CKPT_TAG" >/dev/null 2>&1; then
+    CKPT_HIT=1
+  fi
+  [ -n "$CKPT_HIT" ] || return 0
+  log_info "Starting from checkpoint image: $CKPT_TAG"
+  RUN_IMAGE="$CKPT_TAG"
+  CLI_BAKED=1
+}
+
+# checkpoint_commit <container>: commit the container as CKPT_TAG unless
+# the run started from it
+checkpoint_commit() {
+  [ -n "$CKPT_TAG" ] && [ -z "$CKPT_HIT" ] || return 0
+  if ! timed commit_checkpoint command docker commit "$1" "$CKPT_TAG" >/dev/null; then
+    log_warn "Could not commit checkpoint image $CKPT_TAG"
+    return 0
+  fi
+  log_info "Committed checkpoint image: $CKPT_TAG"
+  [ -n "$CHECKPOINT_REGISTRY" ] || return 0
+  log_info "Pushing checkpoint image in the background: $CKPT_TAG"
+  ( command docker push -q "$CKPT_TAG" ) </dev/null >/dev/null 2>&1 &
+}
+
+# Container limits. The GUI's scheduler sizes a resource envelope for each
+# run from the peaks earlier runs of its task reached (see
+# ResourceEnvelopes) and hands it over as AUTOBUILD_CONTAINER_CPUS,
+# AUTOBUILD_CONTAINER_MEMORY (MiB unless it has a unit) and
+# AUTOBUILD_CONTAINER_PIDS; --cpus, --memory and --pids-limit set them by
+# hand. Every container the run starts gets them, and one taken from the
+# warm pool or resumed is updated to them. The memory limit covers swap too,
+# so a runaway is stopped rather than pushing the host into swap.
+CONTAINER_CPUS="${AUTOBUILD_CONTAINER_CPUS:-}"
+CONTAINER_MEMORY="${AUTOBUILD_CONTAINER_MEMORY:-}"
+CONTAINER_PIDS="${AUTOBUILD_CONTAINER_PIDS:-}"
+LIMIT_RUN_ARGS=()   # docker run (and docker update) arguments
+
+container_limits_setup() {
+  LIMIT_RUN_ARGS=()
+  [ -z "$CONTAINER_CPUS" ] || LIMIT_RUN_ARGS+=(--cpus "$CONTAINER_CPUS")
+  if [ -n "$CONTAINER_MEMORY" ]; then
+    case "$CONTAINER_MEMORY" in *[!0-9]*) ;; *) CONTAINER_MEMORY="${CONTAINER_MEMORY}m";; esac
+    LIMIT_RUN_ARGS+=(--memory "$CONTAINER_MEMORY" --memory-swap "$CONTAINER_MEMORY")
+  fi
+  [ -z "$CONTAINER_PIDS" ] || LIMIT_RUN_ARGS+=(--pids-limit "$CONTAINER_PIDS")
+  [ "${#LIMIT_RUN_ARGS[@]}" -eq 0 ] || log_info "Container limits: ${LIMIT_RUN_ARGS[*]}"
+}
+
+# container_limits_apply <container>: this run's limits for a container
+# that was started without them
+container_limits_apply() {
+  [ "${#LIMIT_RUN_ARGS[@]}" -gt 0 ] || return 0
+  docker update "${LIMIT_RUN_ARGS[@]}" "$1" >/dev/null 2>&1 || log_warn "Could not apply container limits to $1"
+}
+
+# Workdir mount. Builds and tests in the container's overlay filesystem are
+# slow where Docker runs in a VM (Docker Desktop on Windows and macOS), so
+# the workdir can be mounted from faster storage instead. --workdir-mount,
+# else a workdir_mount file in the task folder, else
+# AUTOBUILD_WORKDIR_MOUNT picks one of:
+#   tmpfs[:<size>]  a tmpfs of <size> (default AUTOBUILD_WORKDIR_TMPFS_SIZE)
+#   volume          an anonymous volume on the Docker host's own disk; it
+#                   goes when its container is removed (docker rm -v)
+#   volume:<dir>    <dir>/<container> on the host, e.g. on a fast local
+#                   disk; it stays there after the run
+#   overlay         the container's own filesystem (the default)
+# The image's files at the workdir are copied into the mount before the
+# run's prompts and verify files join them, and once the run finished the
+# workdir is saved to workdir.tar.gz in the log dir. A tmpfs does not
+# survive the container stopping, and a commit does not take any mount
+# along, so such runs cannot be resumed, do not use checkpoint images and
+# do not take containers from the warm pool.
+WORKDIR_MOUNT="${AUTOBUILD_WORKDIR_MOUNT:-}"
+WORKDIR_TMPFS_SIZE="${AUTOBUILD_WORKDIR_TMPFS_SIZE:-4g}"
+WORKDIR_RUN_ARGS=()  # docker run arguments mounting the workdir
+WORKDIR_SEED=""      # the mount starts empty, so copy the image's files in
+WORKDIR_MOUNTED=""   # the mount this run's container has
+
+# workdir_mount_setup <workdir> <container>
+workdir_mount_setup() {
+  WORKDIR_RUN_ARGS=(); WORKDIR_SEED=""; WORKDIR_MOUNTED=""
+  local workdir="$1"; local container_name="$2"
+  case "$WORKDIR_MOUNT" in
+    ""|overlay|off) return 0;;
+    tmpfs|tmpfs:*)
+      local size="${WORKDIR_MOUNT#tmpfs}"; size="${size#:}"
+      WORKDIR_RUN_ARGS=(--mount "type=tmpfs,dst=$workdir,tmpfs-size=${size:-$WORKDIR_TMPFS_SIZE},tmpfs-mode=1777")
+      WORKDIR_SEED=1;;
+    volume)
+      # Docker fills a new volume from the image itself
+      WORKDIR_RUN_ARGS=(--mount "type=volume,dst=$workdir");;
+    volume:*)
+      local dir="${WORKDIR_MOUNT#volume:}/$container_name"
+      if ! mkdir -p "$dir"; then
+        log_warn "Could not create workdir mount $dir; using the container's filesystem"
+        return 0
+      fi
+      local dir_win; to_windows_path dir_win "$dir"
+      WORKDIR_RUN_ARGS=(-v "$dir_win:$workdir")
+      WORKDIR_SEED=1;;
+    *) log_warn "Unknown workdir mount '$WORKDIR_MOUNT' (expected tmpfs[:size], volume[:dir] or overlay)"; return 0;;
+  esac
+  WORKDIR_MOUNTED="$WORKDIR_MOUNT"
+  log_info "Workdir $workdir mounted from $WORKDIR_MOUNT"
+  if [ -n "$CHECKPOINT_IMAGE" ]; then
+    log_info "Checkpoint images skipped: they would not hold the mounted workdir"
+    CHECKPOINT_IMAGE=""
+  fi
+}
+
+# workdir_mount_seed <container> <image> <workdir>: copy what the image has
+# at the workdir into the mount that hides it
+workdir_mount_seed() {
+  [ -n "$WORKDIR_SEED" ] || return 0
+  # Never started, so any entrypoint will do
+  local seed; seed=$(docker create --entrypoint true "$2" 2>/dev/null) || { log_warn "Could not copy the image's $3 into the workdir mount"; return 0; }
+  MSYS_NO_PATHCONV=1 docker cp "$seed:$3" - 2>/dev/null | MSYS_NO_PATHCONV=1 docker cp - "$1:$(dirname "$3")" >/dev/null ||
+    log_warn "Nothing copied from the image's $3 into the workdir mount"
+  docker rm -f "$seed" >/dev/null 2>&1 || true
+}
+
+# workdir_mount_snapshot <container> <workdir> <log dir>: keep the mounted
+# workdir's final state with the logs
+workdir_mount_snapshot() {
+  [ -n "$WORKDIR_MOUNTED" ] || return 0
+  if MSYS_NO_PATHCONV=1 docker cp "$1:$2" - | gzip -1 > "$3/workdir.tar.gz"; then
+    log_info "Saved the workdir to $3/workdir.tar.gz"
   else
-    docker build $no_cache_flag -t "$image_tag" "$env_dir_win"
+    log_warn "Could not save the workdir of $1"
+    rm -f "$3/workdir.tar.gz"
   fi
 }
 
@@ -156,19 +1149,477 @@ run_container_keepalive() {
   local image_tag="$1"; local container_name="$2"
   log_info "Starting container: $container_name"
   # Use MSYS_NO_PATHCONV to prevent Windows path conversion on volume mounts
-  MSYS_NO_PATHCONV=1 docker run -v /var/run/docker.sock:/var/run/docker.sock --name "$container_name" -d -i "$image_tag" sleep infinity >/dev/null
+  MSYS_NO_PATHCONV=1 docker run -v /var/run/docker.sock:/var/run/docker.sock "${CACHE_RUN_ARGS[@]+"${CACHE_RUN_ARGS[@]}"}" "${LIMIT_RUN_ARGS[@]+"${LIMIT_RUN_ARGS[@]}"}" "${WORKDIR_RUN_ARGS[@]+"${WORKDIR_RUN_ARGS[@]}"}" --name "$container_name" -d -i "$image_tag" sleep infinity >/dev/null
 }
 
 run_container_customer_exact() {
   local image_tag="$1"; local container_name="$2"
   log_info "Starting container (customer sequence): $container_name"
   # Use MSYS_NO_PATHCONV to prevent Windows path conversion on volume mounts
-  MSYS_NO_PATHCONV=1 docker run -v /var/run/docker.sock:/var/run/docker.sock --name "$container_name" -d -i "$image_tag" >/dev/null || true
+  MSYS_NO_PATHCONV=1 docker run -v /var/run/docker.sock:/var/run/docker.sock "${CACHE_RUN_ARGS[@]+"${CACHE_RUN_ARGS[@]}"}" "${LIMIT_RUN_ARGS[@]+"${LIMIT_RUN_ARGS[@]}"}" "${WORKDIR_RUN_ARGS[@]+"${WORKDIR_RUN_ARGS[@]}"}" --name "$container_name" -d -i "$image_tag" >/dev/null || true
+}
+
+# Warm container pool. With --container-pool N, up to N idle containers per
+# image and start style ("keepalive" or "exact") are kept running, named
+# autobuild-pool-<kind>-<image id>-<epoch>-<n> and labelled with their pool
+# key. A run checks one out by renaming it to its own container name; the
+# rename fails for every run but one, so no container is handed out twice.
+# Each run then tops the pool back up in the background; only shared or
+# cached images (--reuse-image, --image-cache) are pooled. Idle pool
+# containers older than AUTOBUILD_POOL_TTL seconds are removed.
+POOL_SIZE=0
+POOL_TTL="${AUTOBUILD_POOL_TTL:-3600}"
+POOL_LABEL="autobuild.pool"
+
+pool_key() {
+  local image_id; image_id=$(docker image inspect -f '{{.Id}}' "$2")
+  image_id="${image_id#sha256:}"
+  # Containers with other cache volumes mounted, or another package proxy,
+  # are another pool
+  local volumes="${CACHE_VOLUMES//,/.}"
+  [ -z "$PROXY_URL" ] || volumes+=".proxy"
+  echo "$1-${image_id:0:12}${volumes:+.$volumes}"
+}
+
+pool_checkout() {
+  local kind="$1"; local image_tag="$2"; local container_name="$3"
+  [ "$POOL_SIZE" -gt 0 ] || [ "$FANOUT" -gt 1 ] || return 1
+  # Pool containers were started without this run's workdir mount
+  [ -z "$WORKDIR_MOUNTED" ] || return 1
+  local key; key=$(pool_key "$kind" "$image_tag")
+  local name
+  for name in $(docker ps --filter "label=$POOL_LABEL=$key" --format '{{.Names}}' 2>/dev/null | grep '^autobuild-pool-' || true); do
+    if docker rename "$name" "$container_name" >/dev/null 2>&1; then
+      log_info "Starting container: $container_name (from warm pool)"
+      container_limits_apply "$container_name"
+      # Fan-out containers were provisioned when they started
+      case "$name" in *-fanout[0-9]*) FANOUT_PROVISIONED=1;; esac
+      return 0
+    fi
+  done
+  return 1
+}
+
+pool_fill() {
+  local kind="$1"; local image_tag="$2"; local workdir="${3:-}"
+  [ "$POOL_SIZE" -gt 0 ] || return 0
+  [ -z "$WORKDIR_MOUNTED" ] || return 0
+  # Only shared or cached images are run again, so only they get a pool
+  [ -n "$REUSE_IMAGE$IMAGE_CACHE" ] || return 0
+  local key; key=$(pool_key "$kind" "$image_tag")
+  (
+    image_lock "pool-$key"
+    local now; now=$(date +%s)
+    local name epoch
+    for name in $(docker ps -a --filter "name=^autobuild-pool-" --format '{{.Names}}' 2>/dev/null || true); do
+      IFS=- read -r _ _ _ _ epoch _ <<< "$name"
+      case "$epoch" in ''|*[!0-9]*) continue;; esac
+      if [ "$((now - epoch))" -gt "$POOL_TTL" ]; then
+        docker rm -f "$name" >/dev/null 2>&1 || true
+      fi
+    done
+    local count; count=$(docker ps --filter "label=$POOL_LABEL=$key" --format '{{.Names}}' 2>/dev/null | grep -c '^autobuild-pool-' || true)
+    local n=0
+    while [ "${count:-0}" -lt "$POOL_SIZE" ]; do
+      n=$((n + 1))
+      name="autobuild-pool-$key-$now-$$$n"
+      if [ "$kind" = keepalive ]; then
+        MSYS_NO_PATHCONV=1 docker run -v /var/run/docker.sock:/var/run/docker.sock "${CACHE_RUN_ARGS[@]+"${CACHE_RUN_ARGS[@]}"}" "${LIMIT_RUN_ARGS[@]+"${LIMIT_RUN_ARGS[@]}"}" --label "$POOL_LABEL=$key" --name "$name" -d -i "$image_tag" sleep infinity >/dev/null || break
+      else
+        MSYS_NO_PATHCONV=1 docker run -v /var/run/docker.sock:/var/run/docker.sock "${CACHE_RUN_ARGS[@]+"${CACHE_RUN_ARGS[@]}"}" "${LIMIT_RUN_ARGS[@]+"${LIMIT_RUN_ARGS[@]}"}" --label "$POOL_LABEL=$key" --name "$name" -d -i "$image_tag" >/dev/null || break
+      fi
+      [ -z "$workdir" ] || docker exec -u root "$name" bash -lc "mkdir -p '$workdir'" || true
+      count=$((count + 1))
+    done
+    image_unlock
+  ) </dev/null >/dev/null 2>&1 9>&2 &
+}
+
+# Fan-out bring-up. The GUI tells each run of a batch that shares one image
+# (--reuse-image) the batch size with --fan-out <n>. The first of them to
+# reach setup starts the containers of the whole batch at once, into the
+# warm pool under its image's pool key, and every run of the batch, that
+# one included, checks one out with pool_checkout; a run that finds none
+# left starts its own as before. Up to AUTOBUILD_FANOUT_PARALLEL (default 8)
+# `docker run`s go at a time, one `docker events` subscription reports the
+# containers that started (rather than a `docker ps` per container), and
+# each is provisioned (cache volumes, workdir) as soon as it is up, so the
+# runs that check them out go straight to injecting their files. The
+# batch's marker under TMPDIR keeps later runs from starting a second set;
+# idle containers the batch did not take go with the pool's TTL.
+FANOUT=0
+FANOUT_PARALLEL="${AUTOBUILD_FANOUT_PARALLEL:-8}"
+FANOUT_PROVISIONED=""  # this run's container came provisioned from a fan-out
+
+# fanout_start <kind> <image> <workdir> <batch image tag>
+fanout_start() {
+  local kind="$1"; local image_tag="$2"; local workdir="$3"; local batch="$4"
+  [ "$FANOUT" -gt 1 ] && [ -n "$REUSE_IMAGE" ] && [ -z "$WORKDIR_MOUNTED" ] || return 0
+  local tmp="${TMPDIR:-/tmp}"
+  local mark; mark="$tmp/autobuild-fanout-${DOCKER_ENDPOINT_KEY:+$DOCKER_ENDPOINT_KEY-}$(printf '%s' "$batch-$kind" | tr -c 'A-Za-z0-9_.-' '_')"
+  find "$tmp" -maxdepth 1 -name 'autobuild-fanout-*' -mmin +"$(((POOL_TTL + 59) / 60))" -exec rm -rf {} + 2>/dev/null || true
+  local key; key=$(pool_key "$kind" "$image_tag")
+  # The other runs of the batch wait here until the set is up
+  image_lock "pool-$key"
+  if mkdir "$mark" 2>/dev/null; then
+    fanout_bring_up "$kind" "$image_tag" "$workdir" "$key"
+  fi
+  image_unlock
+}
+
+fanout_bring_up() {
+  local kind="$1"; local image_tag="$2"; local workdir="$3"; local key="$4"
+  local count; count=$(docker ps --filter "label=$POOL_LABEL=$key" --format '{{.Names}}' 2>/dev/null | grep -c '^autobuild-pool-' || true)
+  local want=$((FANOUT - ${count:-0}))
+  [ "$want" -gt 0 ] || return 0
+  log_info "Starting $want containers for the batch, $FANOUT_PARALLEL at a time"
+  local tmpdir; tmpdir=$(mktemp -d)
+  # From now on, so no start is missed while the subscription connects
+  local now; now=$(date +%s)
+  command docker events --since "$now" --filter type=container --filter event=start \
+    --filter "label=$POOL_LABEL=$key" --format '{{.Actor.Attributes.name}}' > "$tmpdir/events" 2>/dev/null &
+  local events_pid=$!
+  local run=(); [ "$kind" != keepalive ] || run=(sleep infinity)
+  local i started=0 pids=()
+  for ((i = 1; i <= want; i++)); do
+    if [ "${#pids[@]}" -ge "$FANOUT_PARALLEL" ]; then
+      ! wait "${pids[0]}" || started=$((started + 1))
+      pids=("${pids[@]:1}")
+    fi
+    MSYS_NO_PATHCONV=1 command docker run -v /var/run/docker.sock:/var/run/docker.sock "${CACHE_RUN_ARGS[@]+"${CACHE_RUN_ARGS[@]}"}" "${LIMIT_RUN_ARGS[@]+"${LIMIT_RUN_ARGS[@]}"}" --label "$POOL_LABEL=$key" --name "autobuild-pool-$key-$now-$$-fanout$i" -d -i "$image_tag" "${run[@]+"${run[@]}"}" >/dev/null 2>&1 &
+    pids+=($!)
+  done
+  for i in "${pids[@]+"${pids[@]}"}"; do
+    ! wait "$i" || started=$((started + 1))
+  done
+  # Provision each container as the subscription reports it up
+  local seen=0 name deadline=$((SECONDS + 30)) provision=()
+  while [ "$seen" -lt "$started" ] && [ "$SECONDS" -lt "$deadline" ]; do
+    while read -r name; do
+      seen=$((seen + 1))
+      (
+        [ -z "$CACHE_PREPARE" ] || command docker exec -u root "$name" sh -c "$CACHE_PREPARE"
+        [ -z "$workdir" ] || command docker exec -u root "$name" bash -lc "mkdir -p '$workdir'"
+      ) </dev/null >/dev/null 2>&1 &
+      provision+=($!)
+    done < <(tail -n +"$((seen + 1))" "$tmpdir/events")
+    [ "$seen" -ge "$started" ] || sleep 0.2
+  done
+  kill "$events_pid" 2>/dev/null || true
+  wait "${provision[@]+"${provision[@]}"}" 2>/dev/null || true
+  rm -rf "$tmpdir"
+  log_info "Batch containers up: $seen of $want"
+  [ "$seen" -eq 0 ] || cache_volumes_prune "autobuild-pool-$key-$now-$$-fanout1"
+}
+
+# Package cache volumes. With --cache-volumes <list> (comma separated: npm,
+# pip, apt) every task container mounts the named volume
+# autobuild-cache-<name>, labelled autobuild.cache, where that package
+# manager keeps its downloads: the npm cache (npx and npm install -g), pip's
+# cache and apt's package archives. The first run fills a volume; later
+# runs, in any container, install from local disk. The npm and pip caches
+# are made writable for any user the image runs as, and for apt the
+# docker-clean hook that deletes downloaded packages is disabled.
+# cache_volumes_prune trims a volume past AUTOBUILD_CACHE_VOLUME_MB
+# megabytes, checking each at most every AUTOBUILD_CACHE_PRUNE_INTERVAL
+# seconds.
+CACHE_VOLUMES=""
+CACHE_VOLUME_LABEL="autobuild.cache"
+CACHE_VOLUME_MB="${AUTOBUILD_CACHE_VOLUME_MB:-4096}"
+CACHE_PRUNE_INTERVAL="${AUTOBUILD_CACHE_PRUNE_INTERVAL:-86400}"
+CACHE_PRUNE_DIR="${XDG_CACHE_HOME:-$HOME/.cache}/autobuild/volumes"
+CACHE_RUN_ARGS=()   # docker run arguments mounting the volumes
+CACHE_PATHS=""      # where they are mounted, space separated
+CACHE_PREPARE=""    # shell run as root in each new container
+
+cache_volumes_setup() {
+  CACHE_RUN_ARGS=(); CACHE_PATHS=""; CACHE_PREPARE=""
+  [ -n "$CACHE_VOLUMES" ] && [ "$CACHE_VOLUMES" != off ] || { CACHE_VOLUMES=""; return 0; }
+  local name path env prepare volume used=""
+  for name in ${CACHE_VOLUMES//,/ }; do
+    case ",$used," in *",$name,"*) continue;; esac
+    env=""; prepare=""
+    case "$name" in
+      npm) path=/var/cache/autobuild/npm; env="npm_config_cache=$path"
+           prepare="mkdir -p $path && chmod 1777 $path; ";;
+      pip) path=/var/cache/autobuild/pip; env="PIP_CACHE_DIR=$path"
+           prepare="mkdir -p $path && chmod 1777 $path; ";;
+      apt) path=/var/cache/apt/archives
+           prepare="if [ -d /etc/apt/apt.conf.d ]; then rm -f /etc/apt/apt.conf.d/docker-clean; echo 'Binary::apt::APT::Keep-Downloaded-Packages \"true\";' > /etc/apt/apt.conf.d/80autobuild-keep-archives; fi; ";;
+      *) log_warn "Unknown cache volume '$name' (expected npm, pip or apt)"; continue;;
+    esac
+    volume="autobuild-cache-$name"
+    if ! docker volume inspect "$volume" >/dev/null 2>&1 &&
+       ! docker volume create --label "$CACHE_VOLUME_LABEL=$name" "$volume" >/dev/null; then
+      log_warn "Could not create cache volume $volume; running without it"
+      continue
+    fi
+    CACHE_RUN_ARGS+=(-v "$volume:$path")
+    [ -z "$env" ] || CACHE_RUN_ARGS+=(-e "$env")
+    CACHE_PATHS+="$path "
+    CACHE_PREPARE+="$prepare"
+    used+="$name,"
+  done
+  CACHE_VOLUMES="${used%,}"
+  [ -z "$CACHE_VOLUMES" ] || log_info "Package cache volumes: $CACHE_VOLUMES"
+}
+
+# cache_volumes_prune <container>: in the background, from inside a
+# container that mounts them, drop the files of an over-size cache that were
+# not read for a week, and empty it when that is not enough. Runs at most
+# once per interval per host; package managers treat a missing entry as a
+# cache miss.
+cache_volumes_prune() {
+  [ -n "$CACHE_PATHS" ] || return 0
+  mkdir -p "$CACHE_PRUNE_DIR" 2>/dev/null || return 0
+  local stamp="$CACHE_PRUNE_DIR/last-prune" now last=0
+  now=$(date +%s)
+  [ ! -f "$stamp" ] || read -r last < "$stamp" || true
+  case "$last" in ''|*[!0-9]*) last=0;; esac
+  [ "$((now - last))" -ge "$CACHE_PRUNE_INTERVAL" ] || return 0
+  echo "$now" > "$stamp"
+  local cap=$((CACHE_VOLUME_MB * 1024))
+  ( command docker exec -u root "$1" sh -c '
+      cap=$1; shift
+      for d in "$@"; do
+        kb=$(du -sk "$d" 2>/dev/null | cut -f1)
+        [ "${kb:-0}" -gt "$cap" ] || continue
+        find "$d" -type f -atime +7 -delete 2>/dev/null
+        kb=$(du -sk "$d" 2>/dev/null | cut -f1)
+        [ "${kb:-0}" -le "$cap" ] || find "$d" -mindepth 1 -delete 2>/dev/null
+      done' _ "$cap" $CACHE_PATHS ) </dev/null >/dev/null 2>&1 &
+}
+
+# Package proxy. With --package-proxy (AUTOBUILD_PACKAGE_PROXY) builds and
+# task containers download npm, PyPI and apt packages through a
+# pull-through cache: "auto" runs one on the run's Docker endpoint, the
+# container autobuild-package-proxy (nginx, cache in the volume
+# autobuild-proxy-cache, capped at AUTOBUILD_PROXY_CACHE_MB megabytes),
+# reached from containers on the bridge network as host autobuild-proxy;
+# "auto:<port>" also publishes it on that host port for other hosts, which
+# are given its http:// URL instead. The proxy serves registry.npmjs.org
+# under /npm/ and pypi.org under /pypi/ (with package file links rewritten
+# to come back through it) and is apt's HTTP proxy for any mirror. npm and
+# pip are pointed at it through npm_config_registry and PIP_INDEX_URL, as
+# build arguments each stage of a Dockerfile declares and as container
+# environment; apt through an apt.conf entry in containers and the
+# http_proxy build argument. Every request is logged with its cache status
+# to /var/log/nginx/autobuild.log in the proxy, which the app's metrics
+# endpoint reads.
+PACKAGE_PROXY="${AUTOBUILD_PACKAGE_PROXY:-}"
+PROXY_NAME="autobuild-package-proxy"
+PROXY_IMAGE="${AUTOBUILD_PROXY_IMAGE:-nginx:1.27-alpine}"
+PROXY_CACHE_MB="${AUTOBUILD_PROXY_CACHE_MB:-20480}"
+PROXY_LABEL="autobuild.proxy"
+PROXY_URL=""         # base URL builds and containers use
+PROXY_BUILD_ARGS=()  # docker build arguments pointing package managers at it
+
+# nginx configuration template of the managed proxy (the image substitutes
+# the environment variables in it at start)
+package_proxy_conf() {
+  cat <<'CONF'
+proxy_cache_path /var/cache/nginx/autobuild levels=1:2 keys_zone=autobuild:64m
+                 max_size=${AUTOBUILD_PROXY_CACHE_MB}m inactive=30d use_temp_path=off;
+log_format autobuild '$autobuild_registry $upstream_cache_status';
+resolver ${NGINX_LOCAL_RESOLVERS} ipv6=off valid=300s;
+
+server {
+  listen 80 default_server;
+  client_max_body_size 0;
+  access_log /var/log/nginx/autobuild.log autobuild;
+  set $autobuild_registry apt;
+
+  proxy_cache autobuild;
+  proxy_cache_lock on;
+  proxy_cache_use_stale error timeout updating http_500 http_502 http_503 http_504;
+  proxy_http_version 1.1;
+  proxy_set_header Connection "";
+  proxy_ssl_server_name on;
+  gzip on;
+  gzip_types application/json application/vnd.npm.install-v1+json
+             application/vnd.pypi.simple.v1+json;
+
+  # A request for this proxy's own address that fell through to the apt
+  # location comes back here once; refuse it rather than loop
+  if ($http_x_autobuild_proxy) { return 508; }
+  proxy_set_header X-Autobuild-Proxy 1;
+
+  location = /_autobuild/ping {
+    access_log off;
+    return 200 "ok\n";
+  }
+
+  # Metadata is rewritten, so it is fetched uncompressed; tarballs are
+  # immutable and kept as the registry's headers allow
+  location ^~ /npm/ {
+    set $autobuild_registry npm;
+    proxy_pass https://registry.npmjs.org/;
+    proxy_set_header Host registry.npmjs.org;
+    proxy_set_header Accept-Encoding "";
+    proxy_cache_key $proxy_host$uri$is_args$args$http_accept;
+    proxy_cache_valid 200 10m;
+    sub_filter 'https://registry.npmjs.org/' 'http://$http_host/npm/';
+    sub_filter_once off;
+    sub_filter_types application/json application/vnd.npm.install-v1+json;
+  }
+
+  location ^~ /pypi/ {
+    set $autobuild_registry pypi;
+    proxy_pass https://pypi.org/;
+    proxy_set_header Host pypi.org;
+    proxy_set_header Accept-Encoding "";
+    proxy_cache_key $proxy_host$uri$is_args$args$http_accept;
+    proxy_cache_valid 200 10m;
+    sub_filter 'https://files.pythonhosted.org/' 'http://$http_host/pythonhosted/';
+    sub_filter_once off;
+    sub_filter_types application/vnd.pypi.simple.v1+json
+                     application/vnd.pypi.simple.v1+html;
+  }
+
+  location ^~ /pythonhosted/ {
+    set $autobuild_registry pypi;
+    proxy_pass https://files.pythonhosted.org/;
+    proxy_set_header Host files.pythonhosted.org;
+    proxy_cache_valid 200 30d;
+  }
+
+  # apt's HTTP proxy: requests for any mirror, packages kept for a month
+  # and indexes for as long as the mirror's headers allow (a minute without)
+  location ~ \.(deb|udeb|ddeb)$ {
+    proxy_pass http://$host$request_uri;
+    proxy_cache_valid 200 30d;
+  }
+
+  location / {
+    proxy_pass http://$host$request_uri;
+    proxy_cache_valid 200 1m;
+  }
+}
+CONF
+}
+
+# Start the managed proxy on this endpoint unless it is already up with the
+# same configuration, and print its address on the bridge network;
+# publish is a host port or empty
+package_proxy_start() {
+  local publish="$1" conf hash running ip dir i
+  conf=$(package_proxy_conf)
+  hash=$(printf '%s %s %s %s' "$conf" "$PROXY_IMAGE" "$PROXY_CACHE_MB" "$publish" | sha256_cmd | cut -c1-16)
+  image_lock "package-proxy"
+  running=$(docker inspect -f "{{.State.Running}} {{index .Config.Labels \"$PROXY_LABEL\"}}" "$PROXY_NAME" 2>/dev/null || true)
+  if [ "$running" != "true $hash" ]; then
+    [ -z "$running" ] || docker rm -f "$PROXY_NAME" >/dev/null 2>&1 || true
+    dir=$(mktemp -d)
+    mkdir -p "$dir/templates"
+    printf '%s\n' "$conf" > "$dir/templates/default.conf.template"
+    local dir_win; to_windows_path dir_win "$dir/templates"
+    if ! MSYS_NO_PATHCONV=1 docker create --name "$PROXY_NAME" --label "$PROXY_LABEL=$hash" --restart unless-stopped \
+           -v autobuild-proxy-cache:/var/cache/nginx/autobuild ${publish:+-p "$publish:80"} \
+           -e NGINX_ENTRYPOINT_LOCAL_RESOLVERS=1 -e "AUTOBUILD_PROXY_CACHE_MB=$PROXY_CACHE_MB" \
+           "$PROXY_IMAGE" >/dev/null ||
+       ! MSYS_NO_PATHCONV=1 docker cp "$dir_win" "$PROXY_NAME:/etc/nginx/" >/dev/null ||
+       ! docker start "$PROXY_NAME" >/dev/null; then
+      rm -rf "$dir"
+      docker rm -f "$PROXY_NAME" >/dev/null 2>&1 || true
+      image_unlock
+      return 1
+    fi
+    rm -rf "$dir"
+    log_info "Started the package proxy $PROXY_NAME${publish:+ on port $publish}" >&2
+  fi
+  image_unlock
+  # nginx may still be starting
+  for i in 1 2 3 4 5 6 7 8 9 10; do
+    if docker exec "$PROXY_NAME" wget -q -O /dev/null http://127.0.0.1/_autobuild/ping 2>/dev/null; then
+      ip=$(docker inspect -f '{{range .NetworkSettings.Networks}}{{.IPAddress}} {{end}}' "$PROXY_NAME" 2>/dev/null)
+      ip="${ip%% *}"
+      [ -n "$ip" ] || return 1
+      echo "$ip"
+      return 0
+    fi
+    sleep 0.5
+  done
+  return 1
+}
+
+# Resolve PACKAGE_PROXY and add what points package managers at it to
+# CACHE_RUN_ARGS, CACHE_PREPARE and PROXY_BUILD_ARGS; after
+# cache_volumes_setup, since that resets the first two. A proxy that cannot
+# be started is skipped with a warning.
+package_proxy_setup() {
+  PROXY_URL=""; PROXY_BUILD_ARGS=()
+  local ip="" host
+  case "$PACKAGE_PROXY" in
+    ""|off) return 0;;
+    auto|auto:*)
+      local publish="${PACKAGE_PROXY#auto}"; publish="${publish#:}"
+      case "$publish" in *[!0-9]*) log_warn "Bad package proxy port '$publish'"; return 0;; esac
+      if ! ip=$(package_proxy_start "$publish"); then
+        log_warn "Could not start the package proxy; downloading packages directly"
+        return 0
+      fi
+      # A name rather than the address, so the build arguments (and with
+      # them BuildKit's layer cache) stay the same when the proxy moves
+      PROXY_URL="http://autobuild-proxy"
+      CACHE_RUN_ARGS+=(--add-host "autobuild-proxy:$ip")
+      PROXY_BUILD_ARGS+=(--add-host "autobuild-proxy:$ip");;
+    http://*) PROXY_URL="${PACKAGE_PROXY%/}";;
+    *) log_warn "Unknown package proxy '$PACKAGE_PROXY' (expected auto, auto:<port> or an http:// URL)"; return 0;;
+  esac
+  host="${PROXY_URL#http://}"; host="${host%%/*}"; host="${host%:*}"
+  CACHE_RUN_ARGS+=(-e "npm_config_registry=$PROXY_URL/npm/" -e "PIP_INDEX_URL=$PROXY_URL/pypi/simple/" -e "PIP_TRUSTED_HOST=$host")
+  CACHE_PREPARE+="if [ -d /etc/apt/apt.conf.d ]; then echo 'Acquire::http::Proxy \"$PROXY_URL/\";' > /etc/apt/apt.conf.d/80autobuild-proxy; fi; "
+  PROXY_BUILD_ARGS+=(--build-arg "npm_config_registry=$PROXY_URL/npm/" --build-arg "PIP_INDEX_URL=$PROXY_URL/pypi/simple/"
+                     --build-arg "PIP_TRUSTED_HOST=$host" --build-arg "http_proxy=$PROXY_URL" --build-arg "no_proxy=$host")
+  log_info "Package proxy: $PROXY_URL${ip:+ ($ip)}"
+}
+
+# Copy of a Dockerfile (on stdin) whose stages declare the package proxy's
+# build arguments, so their RUN instructions see them; just the copy
+# without a proxy. http_proxy and no_proxy are predefined. The arguments
+# go after a FROM instruction's last continuation line; FROM only counts
+# at the start of an instruction, not in continuation lines, comments or
+# the bodies of RUN/COPY/ADD heredocs.
+add_proxy_args() {
+  if [ -z "$PROXY_URL" ]; then cat; return 0; fi
+  awk '
+    BEGIN { head = 1 }
+    # Heredoc bodies end at a line holding just their word (tab-indented
+    # for <<-); several heredocs on one instruction follow one another
+    ndoc > 0 && !cont {
+      print
+      line = $0
+      if (dash[head]) sub(/^\t+/, "", line)
+      if (line == word[head]) { head++; ndoc-- }
+      next
+    }
+    {
+      print
+      # Comments and blank lines neither start nor end an instruction
+      if ($0 ~ /^[[:space:]]*(#|$)/) next
+      if (!cont) {
+        from = $0 ~ /^[[:space:]]*[Ff][Rr][Oo][Mm][[:space:]]/
+        heredocs = $0 ~ /^[[:space:]]*([Rr][Uu][Nn]|[Cc][Oo][Pp][Yy]|[Aa][Dd][Dd])[[:space:]]/
+      }
+      rest = heredocs ? $0 : ""
+      while (match(rest, /(^|[^<])<<-?["\047]?[A-Za-z_][A-Za-z0-9_]*/)) {
+        doc = substr(rest, RSTART, RLENGTH); rest = substr(rest, RSTART + RLENGTH)
+        sub(/^[^<]?<</, "", doc)
+        ndoc++; dash[head + ndoc - 1] = sub(/^-/, "", doc)
+        gsub(/["\047]/, "", doc); word[head + ndoc - 1] = doc
+      }
+      cont = $0 ~ /\\[[:space:]]*$/
+      if (from && !cont) {
+        print "ARG npm_config_registry"; print "ARG PIP_INDEX_URL"; print "ARG PIP_TRUSTED_HOST"
+        from = 0
+      }
+    }
+  '
 }
 
 ensure_container_running() {
   local container_name="$1"
-  if ! docker ps --format '{{.Names}}' | grep -qx "$container_name"; then
+  if [ "$(command docker inspect -f '{{.State.Running}}' "$container_name" 2>/dev/null)" != true ]; then
     # Container failed to start or exited - show logs for debugging
     echo "[ERROR] Container $container_name is not running after docker run"
     echo "[ERROR] Container logs:"
@@ -177,27 +1628,143 @@ ensure_container_running() {
     docker ps -a --filter "name=^${container_name}$" --format "table {{.Names}}\t{{.Status}}\t{{.Image}}" || true
     die "Container $container_name failed to start or exited immediately"
   fi
+  if [ -n "$CACHE_PREPARE" ] && [ -z "$FANOUT_PROVISIONED" ]; then
+    docker exec -u root "$container_name" sh -c "$CACHE_PREPARE" >/dev/null 2>&1 || true
+    cache_volumes_prune "$container_name"
+  fi
+  local ids; ids=$(command docker inspect -f '{{.Id}} {{.Image}}' "$container_name" 2>/dev/null || true)
+  if [ -n "$ids" ]; then
+    event container "${ids%% *}" "$container_name"
+    event image "${ids#* }" "${RUN_IMAGE:-unknown}"
+  fi
 }
 
 container_id_of() { local container_name="$1"; docker ps -aqf name="^${container_name}$"; }
 
-copy_prompt_into_container() {
-  local prompt_file="$1"; local container_name="$2"; local workdir="$3"
-  local prompt_win="$(to_windows_path "$prompt_file")"
-  log_info "Copying prompt.txt into container"
-  MSYS_NO_PATHCONV=1 docker cp "$prompt_win" "$container_name:$workdir/prompt.txt"
+# Per-run files go into the container as one tar stream. stage_file and
+# stage_dir lay them out under a host staging directory the way they will
+# sit in the container, and inject_into_container sends the listed container
+# paths with a single `docker cp -`, creating their directories (owned by
+# root) on the way. No host path is handed to docker, so nothing needs
+# converting to a Windows path.
+stage_file() {
+  local stage="$1"; local src="$2"; local dest="$3"
+  mkdir -p "$stage$(dirname "$dest")"
+  cp "$src" "$stage$dest"
 }
 
+stage_dir() {
+  local stage="$1"; local src="$2"; local dest="$3"
+  mkdir -p "$stage$dest"
+  cp -R "$src/." "$stage$dest/"
+}
+
+# Run assets. Runs of one task send the same verify files and _context into
+# their containers and keep the same prompts in their log dirs. Under
+# ASSET_STORE (<logs root>/.assets; AUTOBUILD_ASSET_STORE=off for none)
+# each such log file is stored once by content hash and hard-linked into
+# the log dirs (copied where a log dir is on another filesystem), and each
+# verify tree is packed once, per destination, into a tar segment:
+# stage_tree records it next to the staging directory instead of copying
+# the tree, and inject_into_container streams the segment into the
+# container as it is. Stored files no log dir links to any more, and
+# segments no run used, go after AUTOBUILD_ASSET_TTL seconds.
+ASSET_STORE=""
+ASSET_TTL="${AUTOBUILD_ASSET_TTL:-86400}"
+
+asset_store_setup() {
+  ASSET_STORE="${AUTOBUILD_ASSET_STORE:-$1/.assets}"
+  [ "$ASSET_STORE" != off ] && mkdir -p "$ASSET_STORE/files" "$ASSET_STORE/tars" 2>/dev/null || { ASSET_STORE=""; return 0; }
+  # Pruned in the background, at most once an hour
+  local stamp="$ASSET_STORE/last-prune" minutes=$(((ASSET_TTL + 59) / 60))
+  [ -z "$(find "$stamp" -mmin -60 2>/dev/null)" ] || return 0
+  touch "$stamp"
+  ( find "$ASSET_STORE/files" -type f -links 1 -mmin +"$minutes" -exec rm -f {} + 2>/dev/null
+    find "$ASSET_STORE/tars" -type f -mmin +"$minutes" -exec rm -f {} + 2>/dev/null ) </dev/null >/dev/null 2>&1 &
+}
+
+# asset_link <src> <dest>: give dest the content of src, linked to its
+# stored copy
+asset_link() {
+  local src="$1"; local dest="$2"
+  rm -f "$dest"
+  if [ -n "$ASSET_STORE" ]; then
+    local stored; stored="$ASSET_STORE/files/$(sha256_cmd < "$src" | cut -c1-32)"
+    if [ ! -f "$stored" ]; then
+      cp "$src" "$stored.$$" && mv -f "$stored.$$" "$stored" || rm -f "$stored.$$"
+    fi
+    ln "$stored" "$dest" 2>/dev/null && return 0
+  fi
+  cp "$src" "$dest"
+}
+
+# Hash of the files under a directory and their paths, with one hashing
+# process for all of them
+tree_hash() {
+  local sum=(sha256sum); command -v sha256sum >/dev/null 2>&1 || sum=(shasum -a 256)
+  (cd "$1" && find . -type f -print | LC_ALL=C sort | tr '\n' '\0' | xargs -0 "${sum[@]}") | sha256_cmd | cut -c1-32
+}
+
+# stage_tree <stage> <src dir> <dest>: stage_dir through a cached segment
+stage_tree() {
+  local stage="$1"; local src="$2"; local dest="$3"
+  [ -n "$ASSET_STORE" ] || { stage_dir "$stage" "$src" "$dest"; return 0; }
+  local seg; seg="$ASSET_STORE/tars/$(printf '%s\n' "$(tree_hash "$src")" "$dest" | sha256_cmd | cut -c1-32).tar"
+  if [ ! -f "$seg" ]; then
+    local tmp; tmp=$(mktemp -d)
+    mkdir -p "$tmp$dest"
+    cp -R "$src/." "$tmp$dest/"
+    # 512-byte records, so the archive ends in exactly the two zero blocks
+    # that are cut off to let it run on into the next one
+    local path="${dest#/}" size
+    if tar -b 1 -C "$tmp" -cf "$tmp.tar" "${path:-.}" && size=$(wc -c < "$tmp.tar") &&
+       head -c "$((size - 1024))" "$tmp.tar" > "$seg.$$"; then
+      mv -f "$seg.$$" "$seg"
+    fi
+    rm -rf "$tmp" "$tmp.tar" "$seg.$$"
+    [ -f "$seg" ] || { stage_dir "$stage" "$src" "$dest"; return 0; }
+  else
+    touch "$seg"
+  fi
+  mkdir -p "$stage"
+  printf '%s %s\n' "$dest" "$seg" >> "$stage.segments"
+}
 
-copy_verify_to_container() {
-  local verify_path="$1"; local container_name="$2"; local workdir="$3"
-  local verify_win="$(to_windows_path "$verify_path")"
+inject_into_container() {
+  local container_name="$1"; local stage="$2"; shift 2
+  local paths=() segs=() p dest seg
+  for p in "$@"; do
+    [ ! -e "$stage$p" ] || { p="${p#/}"; paths+=("${p:-.}"); }
+  done
+  # Segments of the staged trees the paths cover, then the staged files
+  # themselves, as one archive
+  if [ -f "$stage.segments" ]; then
+    while read -r dest seg; do
+      for p in "$@"; do
+        case "$dest/" in "${p%/}/"*) segs+=("$seg"); break;; esac
+      done
+    done < "$stage.segments"
+  fi
+  {
+    [ "${#segs[@]}" -eq 0 ] || cat "${segs[@]}"
+    if [ "${#paths[@]}" -gt 0 ]; then tar -C "$stage" -cf - "${paths[@]}"; else head -c 1024 /dev/zero; fi
+  } | MSYS_NO_PATHCONV=1 docker cp - "$container_name:/"
+}
+
+stage_prompt() {
+  local stage="$1"; local prompt_file="$2"; local workdir="$3"
+  log_info "Copying prompt.txt into container"
+  stage_file "$stage" "$prompt_file" "$workdir/prompt.txt"
+}
+
+stage_verify() {
+  local stage="$1"; local verify_path="$2"; local workdir="$3"
   if [ -d "$verify_path" ]; then
     log_info "Copying verify directory into container workdir: $workdir"
-    MSYS_NO_PATHCONV=1 docker cp "$verify_win/." "$container_name:$workdir/"
+    stage_tree "$stage" "$verify_path" "$workdir"
   elif [ -f "$verify_path" ]; then
     log_info "Copying verify file into container workdir: $workdir"
-    MSYS_NO_PATHCONV=1 docker cp "$verify_win" "$container_name:$workdir/"
+    stage_file "$stage" "$verify_path" "$workdir/$(basename "$verify_path")"
   else
     die "Verify path does not exist: $verify_path"
   fi
@@ -219,6 +1786,18 @@ read_prompt_from_json() {
   fi
   
   if [ -n "$prompts_file" ] && [ -f "$prompts_file" ]; then
+    # The GUI also saves each prompt as plain text under prompts.d/; use that
+    # copy unless prompts.json was changed after it (no interpreter needed)
+    local cached="${prompts_file%.json}.d/$key.txt"
+    if [ -f "$cached" ] && [ ! "$prompts_file" -nt "$cached" ]; then
+      local extracted
+      extracted=$(<"$cached")
+      if [ -n "$extracted" ]; then
+        echo "$extracted"
+        return 0
+      fi
+    fi
+
     # Read entire file and extract JSON value properly
     local content
     content=$(cat "$prompts_file")
@@ -314,6 +1893,7 @@ except:
 
 compose_prompt1_file() {
   local src_prompt_file="$1"; local out_file="$2"
+  if [ -n "$PROMPT1_FILE" ] && [ -f "$PROMPT1_FILE" ]; then cp "$PROMPT1_FILE" "$out_file"; return 0; fi
   
   local default_prompt='**Task:** 
 
@@ -342,6 +1922,7 @@ Below is the content of prompt.txt for this task. Treat it as the user request:
 
 compose_prompt2_file() {
   local out_file="$1"
+  if [ -n "$PROMPT2_FILE" ] && [ -f "$PROMPT2_FILE" ]; then cp "$PROMPT2_FILE" "$out_file"; return 0; fi
   
   local default_prompt='**Hypothetical Scenario:** 
 
@@ -360,6 +1941,7 @@ Identify any ambiguities or under-specified elements in either the `prompt.txt`
 # --- build the Minimal Audit Prompt into a file
 compose_audit_prompt_file() {
   local out_file="$1"
+  if [ -n "$AUDIT_PROMPT_FILE" ] && [ -f "$AUDIT_PROMPT_FILE" ]; then cp "$AUDIT_PROMPT_FILE" "$out_file"; return 0; fi
   
   local default_prompt='# Minimal Audit Prompt (for Gemini CLI)
 
@@ -397,35 +1979,327 @@ Constraints:
   echo "$prompt_content" >"$out_file"
 }
 
-# --- copy prompt/verify/Dockerfile into WORKDIR/_context inside container
-# --- copy prompt/verify/Dockerfile into WORKDIR/_context inside container
-copy_context_into_container() {
-  local task_dir="$1"; local container_name="$2"; local workdir="$3"
+# --- stage prompt/verify/Dockerfile for WORKDIR/_context inside container
+stage_context() {
+  local stage="$1"; local task_dir="$2"; local workdir="$3"
   local env_dir="$task_dir/env"
   local verify_dir="$task_dir/verify"
 
   # Resolve files (use existing helper)
   local prompt_path; prompt_path="$(get_prompt_path "$task_dir")"
-  [ -f "$prompt_path" ] || die "Prompt file not found (resolved to: $prompt_path)"
-  [ -d "$verify_dir" ] || die "Missing $verify_dir directory"
-  [ -f "$verify_dir/verify.sh" ] || die "Missing $verify_dir/verify.sh"
-  [ -f "$env_dir/Dockerfile" ]  || die "Missing $env_dir/Dockerfile"
+  if [ -z "$TASK_VALIDATED" ]; then
+    [ -f "$prompt_path" ] || die "Prompt file not found (resolved to: $prompt_path)"
+    [ -d "$verify_dir" ] || die "Missing $verify_dir directory"
+    [ -f "$verify_dir/verify.sh" ] || die "Missing $verify_dir/verify.sh"
+    [ -f "$env_dir/Dockerfile" ]  || die "Missing $env_dir/Dockerfile"
+  fi
 
   log_info "Using PROMPT:     $prompt_path"
   log_info "Using VERIFY DIR: $verify_dir"
   log_info "Using DOCKERFILE: $env_dir/Dockerfile"
 
-  docker exec -u root "$container_name" bash -lc "mkdir -p '$workdir/_context/verify'"
+  stage_file "$stage" "$prompt_path"        "$workdir/_context/prompt.txt"
+  stage_tree "$stage" "$verify_dir"         "$workdir/_context/verify"
+  stage_file "$stage" "$env_dir/Dockerfile" "$workdir/_context/Dockerfile"
+}
 
-  local prompt_win="$(to_windows_path "$prompt_path")"
-  local verify_dir_win="$(to_windows_path "$verify_dir")"
-  local dockerfile_win="$(to_windows_path "$env_dir/Dockerfile")"
-  
-  MSYS_NO_PATHCONV=1 docker cp "$prompt_win"      "$container_name:$workdir/_context/prompt.txt"
-  MSYS_NO_PATHCONV=1 docker cp "$verify_dir_win/." "$container_name:$workdir/_context/verify/"
-  MSYS_NO_PATHCONV=1 docker cp "$dockerfile_win"  "$container_name:$workdir/_context/Dockerfile"
+
+# Gemini API rate limits. A prompt that fails with a 429 (RESOURCE_EXHAUSTED,
+# quota exceeded) is retried in the same container, up to
+# AUTOBUILD_PROMPT_RETRIES times, instead of failing the run. Each retry is
+# announced as "[RATE_LIMIT] <retry after s> <attempt>" on fd 9; with
+# --stage-gate the scheduler then paces the key and holds the retry at its
+# prompt gate, otherwise the script backs off itself, exponentially from 2 s
+# with jitter and never for less than the API's Retry-After.
+PROMPT_RETRIES="${AUTOBUILD_PROMPT_RETRIES:-4}"
+
+# Seconds the API asked to wait (0 when it did not say) if the prompt
+# output on stdin shows a rate limit; fails otherwise
+rate_limit_delay() {
+  local hits s
+  hits=$(grep -iE '(^|[^0-9])429([^0-9]|$)|RESOURCE_EXHAUSTED|rate.?limit|quota exceeded|retry-after|retrydelay|retry in [0-9]' || true)
+  printf '%s\n' "$hits" | grep -qiE '(^|[^0-9])429([^0-9]|$)|RESOURCE_EXHAUSTED|rate.?limit|quota exceeded' || return 1
+  s=$(printf '%s\n' "$hits" | grep -oiE 'retry-after"?:? *"?[0-9]+|retrydelay"?: *"?[0-9]+|retry in [0-9]+' | tail -n 1 | grep -oE '[0-9]+$' || true)
+  echo "${s:-0}"
+}
+
+# Announce a rate limit and wait until the prompt may be retried
+rate_limit_backoff() {
+  local retry_after="$1" attempt="$2"
+  log_warn "Gemini API rate limit; retrying the prompt (attempt $attempt of $PROMPT_RETRIES)"
+  echo "[RATE_LIMIT] $retry_after $attempt" >&9
+  if [ -n "$STAGE_GATE_DIR" ]; then stage_gate prompt; return; fi
+  local wait=$((2 << (attempt - 1)))
+  [ "$wait" -le 120 ] || wait=120
+  [ "$retry_after" -le "$wait" ] || wait="$retry_after"
+  wait=$((wait + RANDOM % (wait / 2 + 1)))
+  log_info "Backing off for ${wait}s"
+  sleep "$wait"
+}
+
+# timed/run_and_capture for a prompt phase, retried after rate limits
+prompt_phase() {
+  local phase="$1" logfile="$2"; shift 2
+  local attempt=0 rc before delay
+  while :; do
+    before=$(wc -c 2>/dev/null < "$logfile" || echo 0)
+    rc=0; timed "$phase" run_and_capture "$logfile" "$@" || rc=$?
+    [ "$rc" -ne 0 ] || return 0
+    attempt=$((attempt + 1))
+    [ "$attempt" -le "$PROMPT_RETRIES" ] || return "$rc"
+    delay=$(tail -c +"$((before + 1))" "$logfile" | rate_limit_delay) || return "$rc"
+    rate_limit_backoff "$delay" "$attempt"
+  done
+}
+
+# Checkpoints. A feedback run records in <log dir>/checkpoint the container
+# it runs in, its workdir and every phase that finished ("done <phase>"),
+# and its container is left behind; feedback --resume <log dir> continues
+# the run in that container from the first phase not done (RESUME_FROM), so
+# a run cut short after Prompt 1 goes straight to verification instead of
+# rebuilding, reinstalling and prompting again.
+CHECKPOINT_FILE=""
+RESUME_FROM=""
+FEEDBACK_PHASES="npm_install gemini_prompt1 verification gemini_prompt2"
+checkpoint() {
+  [ -n "$CHECKPOINT_FILE" ] || return 0
+  printf '%s\n' "$*" >> "$CHECKPOINT_FILE" 2>/dev/null || log_warn "Could not write checkpoint: $CHECKPOINT_FILE"
+}
+checkpoint_value() { sed -n "s/^$2 //p" "$1" 2>/dev/null | tail -n 1; }
+# First feedback phase the checkpoint has not recorded as done (empty: none)
+resume_point() {
+  local p
+  for p in $FEEDBACK_PHASES; do grep -qx "done $p" "$1" 2>/dev/null || { echo "$p"; return 0; }; done
+}
+# Whether a phase runs: the ones before RESUME_FROM already did
+phase_due() { [ "$RESUME_FROM" != "$1" ] || RESUME_FROM=""; [ -z "$RESUME_FROM" ]; }
+gemini_install_cmd() { echo "which npm >/dev/null 2>&1 || (echo 'npm is required in the image' >&2; exit 1); npm install -g $GEMINI_CLI_PKG"; }
+
+# In-container phase agent. feedback sends it into the container with the
+# run's files and drives the install, Prompt 1, verification and Prompt 2
+# phases through one attached docker exec rather than an exec per phase.
+# Everything the agent prints is phase output, except lines starting with
+# the token the host picked:
+#   <token> begin <phase> <log>   a phase starts; its output goes to <log>
+#   <token> end <phase> <rc>      the phase exited with <rc>
+#   <token> gate <stage>          the agent waits for a line on stdin, which
+#                                 the host sends once stage_gate lets <stage> run;
+#                                 "cached <rc>" for verify reuses a stored result
+#   <token> ratelimit <s> <n>     a prompt was rate limited; the agent retries
+#                                 it once the host replies (see rate_limit_backoff)
+#   <token> warn <message>
+# Phases run with stdin from /dev/null, so stdin only carries gate replies.
+# The agent exits with the code of a failed install or prompt, and 0 when
+# only verification failed. Given a resume phase it skips the phases before
+# it (see phase_due).
+write_phase_agent() {
+  {
+    cat <<'AGENT'
+#!/usr/bin/env bash
+# autobuild_agent.sh <token> <workdir> <install command> <verification command> <prompt retries> [<resume phase>]
+token="$1"; workdir="$2"; install="$3"; verification="$4"; retries="${5:-0}"; RESUME_FROM="${6:-}"
+key="${GEMINI_API_KEY:-}"; unset GEMINI_API_KEY
+set -o pipefail
+AGENT
+    declare -f rate_limit_delay phase_due
+    cat <<'AGENT'
+frame() { printf '%s %s\n' "$token" "$*"; }
+# A phase's output also goes to /tmp/autobuild_phase.out, for rate limits
+phase() {
+  local name="$1" log="$2" rc=0; shift 2
+  frame begin "$name" "$log"
+  "$@" </dev/null 2>&1 | tee /tmp/autobuild_phase.out || rc=$?
+  frame end "$name" "$rc"
+  return "$rc"
+}
+gate() { frame gate "$1"; reply=""; read -r reply || true; }
+gemini_prompt() {
+  GEMINI_API_KEY="$key" bash -lc 'cd "$1" && PROMPT=$(cat "$2") && gemini --debug -y --prompt "$PROMPT"' _ "$workdir" "$1"
+}
+# prompt <phase> <log> <prompt file>, retried after rate limits
+prompt() {
+  local attempt=0 rc delay
+  while :; do
+    rc=0; phase "$1" "$2" gemini_prompt "$3" || rc=$?
+    [ "$rc" -ne 0 ] || return 0
+    attempt=$((attempt + 1))
+    [ "$attempt" -le "$retries" ] || return "$rc"
+    delay=$(rate_limit_delay < /tmp/autobuild_phase.out) || return "$rc"
+    frame ratelimit "$delay" "$attempt"
+    read -r _ || true
+  done
+}
+cd "$workdir" || exit 1
+# Some verify steps clean the workdir; keep Prompt 2 where they do not look
+[ ! -f prompt2.txt ] || cp prompt2.txt /tmp/autobuild_prompt2.txt
+if phase_due npm_install && [ -n "$install" ]; then
+  phase npm_install gemini_install.log bash -lc "$install" || exit
+fi
+if phase_due gemini_prompt1; then
+  gate prompt
+  prompt gemini_prompt1 gemini_prompt1.log prompt1.txt || exit
+fi
+if phase_due verification; then
+  gate verify
+  case "$reply" in
+    "cached "*)
+      frame begin verification verification.log
+      frame end verification "${reply#cached }"
+      [ "${reply#cached }" = 0 ] || exit 0
+      ;;
+    shard)
+      # The script runs the shards (see verify_sharded) and replies with
+      # their exit code
+      frame begin verification verification.log
+      frame shard
+      read -r reply || true
+      frame end verification "$reply"
+      [ "$reply" = 0 ] || exit 0
+      ;;
+    *) phase verification verification.log bash -lc "cd '$workdir' && chmod +x verify.sh 2>/dev/null || true && $verification" || exit 0;;
+  esac
+fi
+phase_due gemini_prompt2
+gate prompt
+if [ ! -f prompt2.txt ]; then
+  frame warn "prompt2.txt missing in container; re-copying before Prompt 2"
+  cp /tmp/autobuild_prompt2.txt prompt2.txt
+fi
+prompt gemini_prompt2 gemini_prompt2.log prompt2.txt
+AGENT
+  } > "$1"
 }
 
+# Run the phase agent in a container and turn its frames back into what the
+# per-phase execs produced: [TIMING] markers, [PHASE_LOG] announcements, the
+# phase logs, stage gates, checkpoints and the verification result in
+# CATALOG_VERIFY
+run_phase_agent() {
+  local container_name="$1"; local workdir="$2"; local gemini_api_key="$3"; local log_dir="$4"; local install_cmd="$5"; local verification_cmd="$6"
+  local token="@@autobuild-$$-$RANDOM"
+  local line name arg log="" rc=0
+  coproc AGENT { MSYS_NO_PATHCONV=1 command docker exec -i -u root -e GEMINI_API_KEY="$gemini_api_key" "$container_name" bash /tmp/autobuild_agent.sh "$token" "$workdir" "$install_cmd" "$verification_cmd" "$PROMPT_RETRIES" "$RESUME_FROM" 2>&1; }
+  local agent_out="${AGENT[0]}" agent_in="${AGENT[1]}" agent_pid="$AGENT_PID"
+  while IFS= read -r line <&"$agent_out" || [ -n "$line" ]; do
+    case "$line" in
+      "$token begin "*)
+        read -r name arg <<< "${line#"$token begin "}"
+        case "$name" in
+          npm_install) log_info "Installing Gemini CLI inside container";;
+          gemini_prompt1) log_info "Running Prompt 1 with gemini CLI";;
+          verification) log_info "Running verification: $verification_cmd";;
+          gemini_prompt2) log_info "Verification passed; running Prompt 2";;
+        esac
+        log="$log_dir/$arg"
+        echo "[PHASE_LOG] $log"
+        exec 8>>"$log"
+        TIMING_OPEN="$name $(now_ms)"
+        echo "[TIMING] begin $TIMING_OPEN" >&9
+        ;;
+      "$token end "*)
+        read -r name arg <<< "${line#"$token end "}"
+        timing_end "$arg"
+        exec 8>&-
+        log=""
+        [ "$arg" -ne 0 ] || checkpoint done "$name"
+        if [ "$name" = verification ]; then
+          verify_cache_store "$arg" "$log_dir/verification.log"
+          if [ "$arg" -eq 0 ]; then CATALOG_VERIFY=passed; else CATALOG_VERIFY=failed; log_warn "Verification failed; skipping Prompt 2. Exit code: $arg"; fi
+        fi
+        ;;
+      "$token gate "*)
+        name="${line#"$token gate "}"
+        stage_gate "$name"
+        if [ "$name" = verify ]; then verify_cache_key "$container_name" "$workdir" "$verification_cmd"; fi
+        if [ "$name" = verify ] && verify_cache_lookup "$log_dir"; then
+          echo "cached $VERIFY_CACHED_RC" >&"$agent_in"
+        elif [ "$name" = verify ] && verify_shardable; then
+          echo shard >&"$agent_in"
+        else
+          echo go >&"$agent_in"
+        fi
+        ;;
+      "$token ratelimit "*)
+        read -r name arg <<< "${line#"$token ratelimit "}"
+        rate_limit_backoff "$name" "$arg"
+        echo go >&"$agent_in"
+        ;;
+      "$token shard")
+        arg=0
+        verify_sharded "$container_name" "$workdir" "$verification_cmd" "$log_dir" || arg=$?
+        echo "$arg" >&"$agent_in"
+        ;;
+      "$token warn "*) log_warn "${line#"$token warn "}";;
+      *)
+        if [ -z "$log" ]; then printf '%s\n' "$line"; continue; fi
+        printf '%s\n' "$line" >&8
+        [ "${AUTOBUILD_PHASE_OUTPUT:-tee}" = "file" ] || printf '%s\n' "$line"
+        ;;
+    esac
+    line=""
+  done
+  wait "$agent_pid" || rc=$?
+  if [ -n "$log" ]; then exec 8>&-; fi
+  timing_end "$rc"
+  return "$rc"
+}
+
+# Feedback phases with one docker exec each, for images whose default user
+# is not root (the phase agent runs everything as root)
+feedback_phases_per_exec() {
+  local container_name="$1"; local workdir="$2"; local gemini_api_key="$3"; local log_dir="$4"; local install_cmd="$5"; local verification_cmd="$6"; local p2_file="$7"
+  # Install Gemini CLI globally inside the container
+  if phase_due npm_install && [ -n "$install_cmd" ]; then
+    log_info "Installing Gemini CLI inside container"
+    timed npm_install exec_phase "$log_dir/gemini_install.log" root "$container_name" "$install_cmd"
+    checkpoint done npm_install
+  fi
+
+  # Run Prompt 1
+  if phase_due gemini_prompt1; then
+    stage_gate prompt
+    log_info "Running Prompt 1 with gemini CLI"
+    prompt_phase gemini_prompt1 "$log_dir/gemini_prompt1.log" docker exec -i -e GEMINI_API_KEY="$gemini_api_key" "$container_name" bash -lc "cd '$workdir' && PROMPT=\$(cat prompt1.txt) && gemini --debug -y --prompt \"\$PROMPT\""
+    checkpoint done gemini_prompt1
+  fi
+
+  # Run verification
+  local verify_rc=0
+  if phase_due verification; then
+    stage_gate verify
+    verify_cache_key "$container_name" "$workdir" "$verification_cmd"
+    if verify_cache_lookup "$log_dir"; then
+      verify_rc="$VERIFY_CACHED_RC"
+    else
+      set +e
+      if verify_shardable; then
+        timed verification verify_sharded "$container_name" "$workdir" "$verification_cmd" "$log_dir"
+      else
+        log_info "Running verification: $verification_cmd"
+        timed verification exec_phase "$log_dir/verification.log" root "$container_name" "cd '$workdir' && chmod +x verify.sh 2>/dev/null || true && $verification_cmd"
+      fi
+      verify_rc=$?
+      set -e
+      verify_cache_store "$verify_rc" "$log_dir/verification.log"
+    fi
+    if [ "$verify_rc" -eq 0 ]; then CATALOG_VERIFY=passed; checkpoint done verification; else CATALOG_VERIFY=failed; fi
+  fi
+
+  if [ "$verify_rc" -eq 0 ]; then
+    stage_gate prompt
+    log_info "Verification passed; running Prompt 2"
+    # Defensively ensure prompt2.txt exists in the container workdir (some verify steps may clean files)
+    if ! docker exec -u root "$container_name" bash -lc "test -f '$workdir/prompt2.txt'"; then
+      log_warn "prompt2.txt missing in container; re-copying before Prompt 2"
+      local p2_win; to_windows_path p2_win "$p2_file"
+      MSYS_NO_PATHCONV=1 docker cp "$p2_win" "$container_name:$workdir/prompt2.txt"
+    fi
+    prompt_phase gemini_prompt2 "$log_dir/gemini_prompt2.log" docker exec -i -e GEMINI_API_KEY="$gemini_api_key" "$container_name" bash -lc "cd '$workdir' && PROMPT=\$(cat prompt2.txt) && gemini --debug -y --prompt \"\$PROMPT\""
+    checkpoint done gemini_prompt2
+  else
+    log_warn "Verification failed; skipping Prompt 2. Exit code: $verify_rc"
+  fi
+}
 
 feedback() {
   local task_dir="$1"; local image_tag="$2"; local container_name="$3"; local workdir="$4"; local gemini_api_key="$5"; local log_dir="$6"; local no_cache_flag="${7:-}"; local debug_flag="${8:-}"
@@ -434,7 +2308,7 @@ feedback() {
   local verify_file_candidate="$task_dir/command"
   local prompt_path; prompt_path=$(get_prompt_path "$task_dir")
 
-  [ -d "$env_dir" ] || die "Missing env directory: $env_dir"
+  [ -n "$TASK_VALIDATED" ] || [ -d "$env_dir" ] || die "Missing env directory: $env_dir"
 
   local verify_path=""
   if [ -d "$verify_dir_candidate" ] || [ -f "$verify_dir_candidate" ]; then
@@ -444,60 +2318,130 @@ feedback() {
   else
     die "Missing verify path: expected $verify_dir_candidate (dir or file) or $verify_file_candidate (file)"
   fi
+  [ -z "$VERIFY_CACHE" ] || VERIFY_INPUTS=$(verify_inputs_hash "$verify_path")
+  verify_shard_setup "$verify_path"
 
   mkdir -p "$log_dir"
+  log_info "Logs for container $container_name: $log_dir"
+  event logdir "$container_name" "$log_dir"
+  CHECKPOINT_FILE="$log_dir/checkpoint"
+  if [ -n "$RESUME_FROM" ] && [ -z "$(container_id_of "$container_name")" ]; then
+    log_warn "Container $container_name of the checkpoint is gone; running feedback from the start"
+    RESUME_FROM=""
+  fi
+  # A stopped container's tmpfs workdir is gone with the work in it
+  local mount; mount=$(checkpoint_value "$CHECKPOINT_FILE" mount)
+  if [ -n "$RESUME_FROM" ] && [ "${mount%%:*}" = tmpfs ] &&
+     [ "$(docker inspect -f '{{.State.Running}}' "$container_name" 2>/dev/null)" != true ]; then
+    log_warn "The tmpfs workdir of $container_name went when it stopped; running feedback from the start"
+    docker rm -f -v "$container_name" >/dev/null 2>&1 || true
+    RESUME_FROM=""
+  fi
+  if [ -n "$RESUME_FROM" ]; then
+    feedback_resume "$container_name" "$gemini_api_key" "$log_dir"
+    return
+  fi
+  : > "$CHECKPOINT_FILE" 2>/dev/null || true
 
-  build_image "$env_dir" "$image_tag" "$log_dir/docker_build.log" "$no_cache_flag" "$debug_flag"
+  if [ -z "$IMAGE_PREPARED" ]; then
+    stage_gate build
+    prepare_image "$env_dir" "$image_tag" "$log_dir/docker_build.log" "$no_cache_flag" "$debug_flag"
+    bake_cli_layer "$log_dir/gemini_layer.log"
+  fi
   if [ -z "$workdir" ]; then workdir=$(parse_workdir_from_dockerfile "$env_dir"); log_info "Using WORKDIR from Dockerfile: $workdir"; fi
+  workdir_mount_setup "$workdir" "$container_name"
 
-  run_container_keepalive "$image_tag" "$container_name"; ensure_container_running "$container_name"
-  docker exec -u root "$container_name" bash -lc "mkdir -p '$workdir'"
-
-  copy_verify_to_container "$verify_path" "$container_name" "$workdir"
-  copy_prompt_into_container "$prompt_path" "$container_name" "$workdir"
-
-  # Prepare prompts on host and copy into container and logs
+  # Prepare prompts on host for the logs, then send verify files and every
+  # prompt into the workdir in one go
   local tmpdir; tmpdir=$(mktemp -d)
   compose_prompt1_file "$prompt_path" "$tmpdir/prompt1.txt"
   compose_prompt2_file "$tmpdir/prompt2.txt"
   # Remove existing files to avoid conflicts
   rm -f "$log_dir/prompt1.txt" "$log_dir/prompt2.txt"
-  cp "$tmpdir/prompt1.txt" "$log_dir/prompt1.txt"
-  cp "$tmpdir/prompt2.txt" "$log_dir/prompt2.txt"
-  local p1_win="$(to_windows_path "$tmpdir/prompt1.txt")"
-  local p2_win="$(to_windows_path "$tmpdir/prompt2.txt")"
-  MSYS_NO_PATHCONV=1 docker cp "$p1_win" "$container_name:$workdir/prompt1.txt"
-  MSYS_NO_PATHCONV=1 docker cp "$p2_win" "$container_name:$workdir/prompt2.txt"
-
-  # Install Gemini CLI globally inside the container
-  log_info "Installing Gemini CLI inside container"
-  run_and_capture "$log_dir/gemini_install.log" docker exec -u root "$container_name" bash -lc "which npm >/dev/null 2>&1 || (echo 'npm is required in the image' >&2; exit 1); npm install -g @google/gemini-cli@0.3.0-preview.1"
-
-  # Run Prompt 1
-  log_info "Running Prompt 1 with gemini CLI"
-  run_and_capture "$log_dir/gemini_prompt1.log" docker exec -i -e GEMINI_API_KEY="$gemini_api_key" "$container_name" bash -lc "cd '$workdir' && PROMPT=\$(cat prompt1.txt) && gemini --debug -y --prompt \"\$PROMPT\""
-
-  # Run verification
-  local verification_cmd; verification_cmd=$(read_verification_command_from_path "$verify_path")
-  printf '%s' "$verification_cmd" > "$log_dir/verification_command.txt"
-  log_info "Running verification: $verification_cmd"
-  set +e
-  run_and_capture "$log_dir/verification.log" docker exec -u root "$container_name" bash -lc "cd '$workdir' && chmod +x verify.sh 2>/dev/null || true && $verification_cmd"
-  local verify_rc=$?
-  set -e
-
-  if [ "$verify_rc" -eq 0 ]; then
-    log_info "Verification passed; running Prompt 2"
-    # Defensively ensure prompt2.txt exists in the container workdir (some verify steps may clean files)
-    if ! docker exec -u root "$container_name" bash -lc "test -f '$workdir/prompt2.txt'"; then
-      log_warn "prompt2.txt missing in container; re-copying before Prompt 2"
-      MSYS_NO_PATHCONV=1 docker cp "$p2_win" "$container_name:$workdir/prompt2.txt"
+  asset_link "$tmpdir/prompt1.txt" "$log_dir/prompt1.txt"
+  asset_link "$tmpdir/prompt2.txt" "$log_dir/prompt2.txt"
+  local stage="$tmpdir/stage"
+  stage_verify "$stage" "$verify_path" "$workdir"
+  stage_prompt "$stage" "$prompt_path" "$workdir"
+  stage_file "$stage" "$tmpdir/prompt1.txt" "$workdir/prompt1.txt"
+  stage_file "$stage" "$tmpdir/prompt2.txt" "$workdir/prompt2.txt"
+  write_phase_agent "$tmpdir/autobuild_agent.sh"
+  stage_file "$stage" "$tmpdir/autobuild_agent.sh" /tmp/autobuild_agent.sh
+  checkpoint_lookup feedback "$env_dir" "$stage"
+
+  stage_gate setup
+  fanout_start keepalive "$RUN_IMAGE" "$workdir" "$image_tag"
+  pool_checkout keepalive "$RUN_IMAGE" "$container_name" || timed run_container_keepalive run_container_keepalive "$RUN_IMAGE" "$container_name"
+  ensure_container_running "$container_name"
+  workdir_mount_seed "$container_name" "$RUN_IMAGE" "$workdir"
+  pool_fill keepalive "$RUN_IMAGE" "$workdir"
+  if [ -z "$CKPT_HIT" ]; then
+    inject_into_container "$container_name" "$stage" "$workdir" /tmp/autobuild_agent.sh
+    # A checkpoint holds the CLI too, so install it before committing
+    if [ -n "$CKPT_TAG" ] && [ -z "$CLI_BAKED" ]; then
+      log_info "Installing Gemini CLI inside container"
+      timed npm_install exec_phase "$log_dir/gemini_install.log" root "$container_name" "$(gemini_install_cmd)"
+      CLI_BAKED=1
     fi
-    run_and_capture "$log_dir/gemini_prompt2.log" docker exec -i -e GEMINI_API_KEY="$gemini_api_key" "$container_name" bash -lc "cd '$workdir' && PROMPT=\$(cat prompt2.txt) && gemini --debug -y --prompt \"\$PROMPT\""
+    checkpoint_commit "$container_name"
+  fi
+  checkpoint container "$container_name"
+  checkpoint workdir "$workdir"
+  [ -z "$WORKDIR_MOUNTED" ] || checkpoint mount "$WORKDIR_MOUNTED"
+
+  # Install Gemini CLI globally inside the container (skipped when baked in)
+  local install_cmd=""
+  if [ -n "$CLI_BAKED" ]; then
+    log_info "Gemini CLI preinstalled in image"
+    checkpoint done npm_install
   else
-    log_warn "Verification failed; skipping Prompt 2. Exit code: $verify_rc"
+    install_cmd=$(gemini_install_cmd)
   fi
+  local verification_cmd; verification_cmd=$(read_verification_command_from_path "$verify_path")
+  printf '%s' "$verification_cmd" > "$log_dir/verification_command.txt"
 
+  feedback_phases "$container_name" "$workdir" "$gemini_api_key" "$log_dir" "$install_cmd" "$verification_cmd" "$tmpdir/prompt2.txt"
+  workdir_mount_snapshot "$container_name" "$workdir" "$log_dir"
+  log_info "Feedback step complete. Container left running: $container_name"
+}
+
+# The install, prompt and verification phases, through the phase agent or,
+# for images whose default user is not root, one docker exec each
+feedback_phases() {
+  local container_name="$1"; local workdir="$2"; local gemini_api_key="$3"; local log_dir="$4"; local install_cmd="$5"; local verification_cmd="$6"; local p2_file="$7"
+  local exec_user; exec_user=$(docker inspect -f '{{.Config.User}}' "$container_name" 2>/dev/null || true)
+  case "$exec_user" in
+    ""|root|0|root:*|0:*) run_phase_agent "$container_name" "$workdir" "$gemini_api_key" "$log_dir" "$install_cmd" "$verification_cmd";;
+    *) feedback_phases_per_exec "$container_name" "$workdir" "$gemini_api_key" "$log_dir" "$install_cmd" "$verification_cmd" "$p2_file";;
+  esac
+}
+
+# Continue a checkpointed feedback run in its container from RESUME_FROM.
+# The container (stopped when the run was killed) is started again and gets
+# a fresh phase agent; the prompts and verify files are still in its workdir.
+feedback_resume() {
+  local container_name="$1"; local gemini_api_key="$2"; local log_dir="$3"
+  local workdir; workdir=$(checkpoint_value "$CHECKPOINT_FILE" workdir)
+  [ -n "$workdir" ] || die "Checkpoint has no workdir: $CHECKPOINT_FILE"
+  log_info "Resuming feedback in container $container_name at $RESUME_FROM"
+
+  stage_gate setup
+  log_info "Starting container: $container_name (resumed)"
+  docker start "$container_name" >/dev/null
+  container_limits_apply "$container_name"
+  ensure_container_running "$container_name"
+
+  local tmpdir; tmpdir=$(mktemp -d)
+  local stage="$tmpdir/stage"
+  write_phase_agent "$tmpdir/autobuild_agent.sh"
+  stage_file "$stage" "$tmpdir/autobuild_agent.sh" /tmp/autobuild_agent.sh
+  stage_file "$stage" "$log_dir/prompt2.txt" /tmp/autobuild_prompt2.txt
+  inject_into_container "$container_name" "$stage" /tmp/autobuild_agent.sh /tmp/autobuild_prompt2.txt
+
+  local verification_cmd; verification_cmd=$(cat "$log_dir/verification_command.txt")
+  feedback_phases "$container_name" "$workdir" "$gemini_api_key" "$log_dir" "$(gemini_install_cmd)" "$verification_cmd" "$log_dir/prompt2.txt"
+  WORKDIR_MOUNTED=$(checkpoint_value "$CHECKPOINT_FILE" mount)
+  workdir_mount_snapshot "$container_name" "$workdir" "$log_dir"
   log_info "Feedback step complete. Container left running: $container_name"
 }
 
@@ -508,7 +2452,7 @@ verify() {
   local verify_file_candidate="$task_dir/command"
   local prompt_path; prompt_path=$(get_prompt_path "$task_dir")
 
-  [ -d "$env_dir" ] || die "Missing env directory: $env_dir"
+  [ -n "$TASK_VALIDATED" ] || [ -d "$env_dir" ] || die "Missing env directory: $env_dir"
 
   local verify_path=""
   if [ -d "$verify_dir_candidate" ] || [ -f "$verify_dir_candidate" ]; then
@@ -518,43 +2462,73 @@ verify() {
   else
     die "Missing verify path: expected $verify_dir_candidate (dir or file) or $verify_file_candidate (file)"
   fi
+  [ -z "$VERIFY_CACHE" ] || VERIFY_INPUTS=$(verify_inputs_hash "$verify_path")
+  verify_shard_setup "$verify_path"
 
   mkdir -p "$log_dir"
+  log_info "Logs for container $container_name: $log_dir"
+  event logdir "$container_name" "$log_dir"
 
   # Read RAW prompt content only (no additional instructions) and log it
   local prompt_raw; prompt_raw=$(cat "$prompt_path")
   printf '%s' "$prompt_raw" > "$log_dir/prompt_raw.txt"
 
-  build_image "$env_dir" "$image_tag" "$log_dir/docker_build.log" "$no_cache_flag" "$debug_flag"
-  run_container_customer_exact "$image_tag" "$container_name"; ensure_container_running "$container_name"
+  if [ -z "$IMAGE_PREPARED" ]; then
+    stage_gate build
+    prepare_image "$env_dir" "$image_tag" "$log_dir/docker_build.log" "$no_cache_flag" "$debug_flag"
+    bake_cli_layer "$log_dir/gemini_layer.log"
+  fi
+  if [ -z "$workdir" ]; then workdir=$(parse_workdir_from_dockerfile "$env_dir"); log_info "Using WORKDIR from Dockerfile: $workdir"; fi
+  workdir_mount_setup "$workdir" "$container_name"
+  stage_gate setup
+  fanout_start exact "$RUN_IMAGE" "" "$image_tag"
+  pool_checkout exact "$RUN_IMAGE" "$container_name" || timed run_container_customer_exact run_container_customer_exact "$RUN_IMAGE" "$container_name"
+  ensure_container_running "$container_name"
+  workdir_mount_seed "$container_name" "$RUN_IMAGE" "$workdir"
+  pool_fill exact "$RUN_IMAGE"
 
   # Copy prompt to container to avoid path conversion issues with MSYS2
   local tmpdir; tmpdir=$(mktemp -d)
+  local stage="$tmpdir/stage"
   printf '%s' "$prompt_raw" > "$tmpdir/prompt_raw.txt"
-  local praw_win="$(to_windows_path "$tmpdir/prompt_raw.txt")"
-  MSYS_NO_PATHCONV=1 docker cp "$praw_win" "$container_name:/tmp/prompt_raw.txt"
-  rm -rf "$tmpdir"
+  stage_file "$stage" "$tmpdir/prompt_raw.txt" /tmp/prompt_raw.txt
+  inject_into_container "$container_name" "$stage" /tmp/prompt_raw.txt
 
+  stage_gate prompt
   log_info "Running Gemini via npx in container (customer sequence)"
-  run_and_capture "$log_dir/gemini_npx.log" docker exec -i -e GEMINI_API_KEY="$gemini_api_key" "$container_name" \
+  prompt_phase gemini_npx "$log_dir/gemini_npx.log" docker exec -i -e GEMINI_API_KEY="$gemini_api_key" "$container_name" \
     bash -c 'npx --yes @google/gemini-cli@0.3.0-preview.1 --yolo --debug --prompt "$(cat /tmp/prompt_raw.txt)"'
 
   local cid; cid=$(container_id_of "$container_name")
   log_info "docker inspect $cid"
   docker inspect "$cid" > "$log_dir/docker_inspect.json"
 
-  if [ -z "$workdir" ]; then workdir=$(parse_workdir_from_dockerfile "$env_dir"); log_info "Using WORKDIR from Dockerfile: $workdir"; fi
-  docker exec -u root "$cid" bash -lc "mkdir -p '$workdir'"
+  local verification_cmd; verification_cmd=$(read_verification_command_from_path "$verify_path")
+  # The workspace as Gemini left it, before the verify files join it
+  verify_cache_key "$cid" "$workdir" "$verification_cmd"
 
   # Copy verify files only AFTER Gemini run to avoid leaking hints to the agent
-  copy_verify_to_container "$verify_path" "$container_name" "$workdir"
+  stage_verify "$stage" "$verify_path" "$workdir"
   # Also provide the raw prompt to the container for any verification scripts that expect prompt.txt
-  copy_prompt_into_container "$prompt_path" "$container_name" "$workdir"
+  stage_prompt "$stage" "$prompt_path" "$workdir"
+  inject_into_container "$cid" "$stage" "$workdir"
+  rm -rf "$tmpdir"
 
-  local verification_cmd; verification_cmd=$(read_verification_command_from_path "$verify_path")
   printf '%s' "$verification_cmd" > "$log_dir/verification_command.txt"
-  log_info "Executing verification in container: $verification_cmd"
-  run_and_capture "$log_dir/verification.log" docker exec -u root "$cid" bash -lc "cd '$workdir' && chmod +x verify.sh 2>/dev/null || true && $verification_cmd"
+  stage_gate verify
+  local verify_rc=0
+  if verify_cache_lookup "$log_dir"; then
+    verify_rc="$VERIFY_CACHED_RC"
+  elif verify_shardable; then
+    timed verification verify_sharded "$cid" "$workdir" "$verification_cmd" "$log_dir" || verify_rc=$?
+    verify_cache_store "$verify_rc" "$log_dir/verification.log"
+  else
+    log_info "Executing verification in container: $verification_cmd"
+    timed verification exec_phase "$log_dir/verification.log" root "$cid" "cd '$workdir' && chmod +x verify.sh 2>/dev/null || true && $verification_cmd" || verify_rc=$?
+    verify_cache_store "$verify_rc" "$log_dir/verification.log"
+  fi
+  workdir_mount_snapshot "$cid" "$workdir" "$log_dir"
+  if [ "$verify_rc" -eq 0 ]; then CATALOG_VERIFY=passed; else CATALOG_VERIFY=failed; return "$verify_rc"; fi
 
   log_info "Verify step complete. Container left running: $container_name"
 }
@@ -564,51 +2538,322 @@ audit() {
   local workdir="$4";  local gemini_api_key="$5"; local log_dir="$6"; local no_cache_flag="${7:-}"; local debug_flag="${8:-}"
   local env_dir="$task_dir/env"
 
-  [ -d "$env_dir" ] || die "Missing env directory: $env_dir"
+  [ -n "$TASK_VALIDATED" ] || [ -d "$env_dir" ] || die "Missing env directory: $env_dir"
   mkdir -p "$log_dir"
+  log_info "Logs for container $container_name: $log_dir"
+  event logdir "$container_name" "$log_dir"
+
+  # Emit the audit prompt (host + container); an unchanged audit ends here
+  local tmpdir; tmpdir=$(mktemp -d)
+  compose_audit_prompt_file "$tmpdir/audit_prompt.txt"
+  asset_link "$tmpdir/audit_prompt.txt" "$log_dir/audit_prompt.txt"
+  audit_cache_key "$tmpdir/audit_prompt.txt" "$task_dir"
+  if audit_cache_lookup "$log_dir"; then
+    rm -rf "$tmpdir"
+    log_info "Audit complete. Logs at: $log_dir"
+    return 0
+  fi
 
   # Build image (adjust if your Dockerfile needs the task root as context)
-  build_image "$env_dir" "$image_tag" "$log_dir/docker_build.log" "$no_cache_flag" "$debug_flag"
+  stage_gate build
+  prepare_image "$env_dir" "$image_tag" "$log_dir/docker_build.log" "$no_cache_flag" "$debug_flag"
+  bake_cli_layer "$log_dir/gemini_layer.log"
   if [ -z "$workdir" ]; then
     workdir=$(parse_workdir_from_dockerfile "$env_dir")
     log_info "Using WORKDIR from Dockerfile: $workdir"
   fi
+  workdir_mount_setup "$workdir" "$container_name"
 
-  run_container_keepalive "$image_tag" "$container_name"
-  ensure_container_running "$container_name"
-  docker exec -u root "$container_name" bash -lc "mkdir -p '$workdir'"
-
-  # Copy prompt/verify/Dockerfile into _context
-  copy_context_into_container "$task_dir" "$container_name" "$workdir"
+  # The audit prompt goes into _context together with prompt/verify/Dockerfile
+  local stage="$tmpdir/stage"
+  stage_context "$stage" "$task_dir" "$workdir"
+  stage_file "$stage" "$tmpdir/audit_prompt.txt" "$workdir/_context/audit_prompt.txt"
+  checkpoint_lookup audit "$env_dir" "$stage"
 
-  # Emit the audit prompt (host + container)
-  local tmpdir; tmpdir=$(mktemp -d)
-  compose_audit_prompt_file "$tmpdir/audit_prompt.txt"
-  cp "$tmpdir/audit_prompt.txt" "$log_dir/audit_prompt.txt"
-  local audit_win="$(to_windows_path "$tmpdir/audit_prompt.txt")"
-  MSYS_NO_PATHCONV=1 docker cp "$audit_win" "$container_name:$workdir/_context/audit_prompt.txt"
+  stage_gate setup
+  fanout_start keepalive "$RUN_IMAGE" "$workdir" "$image_tag"
+  pool_checkout keepalive "$RUN_IMAGE" "$container_name" || timed run_container_keepalive run_container_keepalive "$RUN_IMAGE" "$container_name"
+  ensure_container_running "$container_name"
+  workdir_mount_seed "$container_name" "$RUN_IMAGE" "$workdir"
+  pool_fill keepalive "$RUN_IMAGE" "$workdir"
+  [ -n "$CKPT_HIT" ] || inject_into_container "$container_name" "$stage" "$workdir"
 
   # Ensure Gemini CLI
-  log_info "Installing Gemini CLI in container (global)"
-  run_and_capture "$log_dir/gemini_install.log" docker exec -u root "$container_name" bash -lc \
-    "command -v npm >/dev/null 2>&1 || { echo 'npm is required'; exit 1; }; npm install -g @google/gemini-cli@0.3.0-preview.1"
+  if [ -n "$CLI_BAKED" ]; then
+    log_info "Gemini CLI preinstalled in image"
+  else
+    log_info "Installing Gemini CLI in container (global)"
+    timed npm_install exec_phase "$log_dir/gemini_install.log" root "$container_name" \
+      "command -v npm >/dev/null 2>&1 || { echo 'npm is required'; exit 1; }; npm install -g $GEMINI_CLI_PKG"
+  fi
+  checkpoint_commit "$container_name"
 
   # Run audit and capture to log
+  stage_gate prompt
   log_info "Running audit prompt"
-  run_and_capture "$log_dir/gemini_audit.log" docker exec -e GEMINI_API_KEY="$gemini_api_key" "$container_name" \
+  prompt_phase gemini_audit "$log_dir/gemini_audit.log" docker exec -e GEMINI_API_KEY="$gemini_api_key" "$container_name" \
     bash -lc "cd '$workdir/_context' && gemini --debug -y --prompt \"\$(cat audit_prompt.txt)\""
+  workdir_mount_snapshot "$container_name" "$workdir" "$log_dir"
+  if audit_verdict "$log_dir"; then
+    audit_cache_store "$log_dir"
+  elif [ -n "$AUDIT_KEY" ]; then
+    log_warn "The audit's answer did not hold the whole verdict; not cached"
+  fi
 
   log_info "Audit complete. Logs at: $log_dir"
 }
 
+# Parallel both. The image (and CLI layer) is built once, into feedback's
+# log dir, then feedback and verify run at the same time, each in a
+# subshell with its own container and its own catalog entry; their stage
+# gates are shared (see stage_gate). The run's wall time is the longer of
+# the two. Returns non-zero if either failed.
+IMAGE_PREPARED=""  # RUN_IMAGE is ready; feedback and verify skip the build
+both_parallel() {
+  local task_dir="$1"; local image_tag="$2"; local cname_fb="$3"; local cname_v="$4"; local workdir="$5"; local api_key="$6"; local out_fb="$7"; local out_v="$8"; local no_cache_flag="${9:-}"; local debug_flag="${10:-}"
+  local task_name; task_name=$(derive_task_name "$task_dir")
+  [ -n "$TASK_VALIDATED" ] || [ -d "$task_dir/env" ] || die "Missing env directory: $task_dir/env"
+  # The build is timed into feedback's entry, which the feedback subshell
+  # then owns
+  catalog_begin feedback "$task_name" "$cname_fb" "$out_fb"
+  stage_gate build
+  prepare_image "$task_dir/env" "$image_tag" "$out_fb/docker_build.log" "$no_cache_flag" "$debug_flag"
+  bake_cli_layer "$out_fb/gemini_layer.log"
+  IMAGE_PREPARED=1
+  STAGE_GATE_SHARED=1
+  [ -z "$STAGE_GATE_DIR" ] || echo "$STAGE_GATE_SEQ" > "$STAGE_GATE_DIR/.seq"
+  log_info "Running feedback and verify in parallel"
+
+  (
+    [ -z "$CATALOG_FILE" ] || trap 'catalog_end $?' EXIT
+    feedback "$task_dir" "$image_tag" "$cname_fb" "$workdir" "$api_key" "$out_fb" "$no_cache_flag" "$debug_flag"
+  ) &
+  local fb_pid=$!
+  CATALOG_RUN=""
+  (
+    TIMING_FILE="$TIMING_FILE-verify"
+    [ -z "$CATALOG_FILE" ] || trap 'catalog_end $?' EXIT
+    catalog_begin verify "$task_name" "$cname_v" "$out_v"
+    verify "$task_dir" "$image_tag" "$cname_v" "$workdir" "$api_key" "$out_v" "$no_cache_flag" "$debug_flag"
+  ) &
+  local v_pid=$!
+  local fb_rc=0 v_rc=0
+  wait "$fb_pid" || fb_rc=$?
+  wait "$v_pid" || v_rc=$?
+  log_info "Parallel both finished (feedback exit $fb_rc, verify exit $v_rc)"
+  [ "$fb_rc" -eq 0 ] || return "$fb_rc"
+  return "$v_rc"
+}
+
+# Kubernetes runs. With AUTOBUILD_K8S=<context>/<namespace> (the GUI sets it
+# for a k8s://<context>/<namespace> worker; an empty context is kubectl's
+# current one) a run goes to the cluster instead of a Docker endpoint. Its
+# Job has one pod: a runner container (bash, tar and the docker CLI;
+# AUTOBUILD_K8S_RUNNER_IMAGE) that runs this script, and a Docker-in-Docker
+# sidecar (AUTOBUILD_K8S_DIND_IMAGE) the run's containers live in, which
+# requests the run's --cpus/--memory, else AUTOBUILD_K8S_CPUS and
+# AUTOBUILD_K8S_MEMORY (MiB). With AUTOBUILD_K8S_BUILDKIT (a buildkitd
+# address such as tcp://buildkitd.autobuild:1234) images are built by the
+# in-cluster BuildKit. The task folder, prompt files and this script go in
+# through kubectl exec; the run's output streams back through the API
+# server with pod paths mapped to the local log dir, stage gates are
+# relayed to the local scheduler (see k8s_relay), and at the end the log dir
+# and its catalog entries are copied into the local logs root. The Job is
+# deleted when the run ends; a pod whose caller stopped refreshing its
+# heartbeat ends itself, and AUTOBUILD_K8S_DEADLINE (seconds) bounds it.
+K8S_ARGS=()
+K8S_JOB=""
+K8S_POD=""
+K8S_HEARTBEAT=""
+k8s() { kubectl "${K8S_ARGS[@]}" "$@"; }
+k8s_cleanup() {
+  [ -z "$K8S_HEARTBEAT" ] || kill "$K8S_HEARTBEAT" 2>/dev/null || true
+  [ -n "$K8S_JOB" ] || return 0
+  k8s delete job "$K8S_JOB" --wait=false --ignore-not-found >/dev/null 2>&1 || true
+  K8S_JOB=""
+}
+# Docker memory sizes (4096, 512m, 4g) as Kubernetes quantities
+k8s_memory() {
+  case "$1" in
+    *[!0-9]*) local n="${1%?}" unit="${1: -1}"
+              case "$unit" in k|K) echo "${n}Ki";; m|M) echo "${n}Mi";; g|G) echo "${n}Gi";; *) echo "$1";; esac;;
+    *) echo "${1}Mi";;
+  esac
+}
+k8s_manifest() {
+  local job="$1" mode="$2" cpus="$3" memory="$4"
+  cat <<YAML
+apiVersion: batch/v1
+kind: Job
+metadata:
+  name: $job
+  labels: {app.kubernetes.io/name: autobuild, autobuild/mode: $mode}
+spec:
+  backoffLimit: 0
+  activeDeadlineSeconds: ${AUTOBUILD_K8S_DEADLINE:-21600}
+  ttlSecondsAfterFinished: 600
+  template:
+    metadata:
+      labels: {app.kubernetes.io/name: autobuild, autobuild/mode: $mode}
+    spec:
+      restartPolicy: Never
+      containers:
+      - name: runner
+        image: ${AUTOBUILD_K8S_RUNNER_IMAGE:-docker:27-cli}
+        command:
+        - sh
+        - -c
+        - |
+          command -v bash >/dev/null || apk add --no-cache bash coreutils >/dev/null 2>&1
+          touch /work/heartbeat
+          until [ -e /work/done ]; do
+            sleep 5
+            [ -z "\$(find /work/heartbeat -mmin +5)" ] || exit 1
+          done
+        env: [{name: DOCKER_HOST, value: "tcp://127.0.0.1:2375"}]
+        resources: {requests: {cpu: 100m, memory: 256Mi}}
+        volumeMounts: [{name: work, mountPath: /work}]
+      - name: docker
+        image: ${AUTOBUILD_K8S_DIND_IMAGE:-docker:27-dind}
+        args: [--host=tcp://127.0.0.1:2375]
+        env: [{name: DOCKER_TLS_CERTDIR, value: ""}]
+        securityContext: {privileged: true}
+        resources:
+          requests: {cpu: "$cpus", memory: "$memory"}
+          limits: {cpu: "$cpus", memory: "$memory"}
+        volumeMounts: [{name: work, mountPath: /work}, {name: docker, mountPath: /var/lib/docker}]
+      volumes: [{name: work, emptyDir: {}}, {name: docker, emptyDir: {}}]
+YAML
+}
+# Pass the pod's output on as this run's: pod paths become local ones,
+# [PHASE_LOG] lines are dropped (the pod copies phase output to stdout
+# instead; the files arrive with the logs at the end) and each stage the
+# pod waits at is announced here and opened in the pod once the local
+# gate opens
+k8s_relay() {
+  local out="$1" line gate
+  while IFS= read -r line; do
+    line="${line//\/work\/out/$out}"
+    case "$line" in
+      "[PHASE_LOG] "*) continue;;
+      "[STAGE] "*)
+        echo "$line"
+        [ -n "$STAGE_GATE_DIR" ] || continue
+        gate="${line#\[STAGE\] }"; gate="${gate/ /_}"
+        gate_wait 0.5 test -e "$STAGE_GATE_DIR/$gate" || exit 1
+        k8s exec "$K8S_POD" -c runner -- touch "/work/gate/$gate" >/dev/null 2>&1 || log_warn "Could not open stage $gate in $K8S_POD";;
+      *) printf '%s\n' "$line";;
+    esac
+  done
+}
+# pack <dir> <name> | k8s_unpack <pod dir>
+k8s_unpack() { k8s exec -i "$K8S_POD" -c runner -- sh -c "mkdir -p '$1' && tar -C '$1' -xf -"; }
+k8s_upload() {
+  local task_dir="$1" script_dir="$2"; shift 2
+  tar -C "$(dirname "$task_dir")" -cf - "$(basename "$task_dir")" | k8s_unpack /work/task || return 1
+  tar -C "$script_dir" -cf - autobuild.sh | k8s_unpack /work/scripts || return 1
+  local i=0 f
+  for f in "$@"; do
+    i=$((i + 1))
+    tar -C "$(dirname "$f")" -cf - "$(basename "$f")" | k8s_unpack "/work/prompts/$i" || return 1
+  done
+  k8s exec "$K8S_POD" -c runner -- mkdir -p /work/gate /work/out /work/logs
+}
+k8s_run() {
+  local mode="$1" task_dir="$2" output_dir="$3" timestamp="$4"; shift 4
+  require_cmd kubectl
+  local context="${AUTOBUILD_K8S%%/*}" namespace="${AUTOBUILD_K8S#*/}"
+  [ "$namespace" != "$AUTOBUILD_K8S" ] && [ -n "$namespace" ] || namespace=default
+  K8S_ARGS=()
+  [ -z "$context" ] || K8S_ARGS+=(--context "$context")
+  K8S_ARGS+=(-n "$namespace")
+  local name; name=$(basename "$task_dir")
+  local script_dir; script_dir=$(cd "$(dirname "$0")" && pwd -P)
+
+  # The pod's own paths for the task, its log dir, prompt files and gates
+  local args=() files=()
+  while [ $# -gt 0 ]; do
+    case "$1" in
+      --task) args+=(--task "/work/task/$name"); shift 2;;
+      --output-dir|--stage-gate) shift 2;;
+      --prompt1-file|--prompt2-file|--audit-prompt-file)
+        files+=("$2"); args+=("$1" "/work/prompts/${#files[@]}/$(basename "$2")"); shift 2;;
+      --build-cache)
+        # A local cache directory stays here; a registry is reachable
+        case "$2" in /*|./*|../*|~*|[A-Za-z]:*) ;; *) args+=("$1" "$2");; esac
+        shift 2;;
+      --resume) die "--resume is not supported for Kubernetes runs";;
+      *) args+=("$1"); shift;;
+    esac
+  done
+  [ -z "$STAGE_GATE_DIR" ] || args+=(--stage-gate /work/gate)
+  [ -z "${AUTOBUILD_K8S_BUILDKIT:-}" ] || args+=(--buildkit)
+  local env=(AUTOBUILD_LOGS_ROOT=/work/logs AUTOBUILD_PHASE_OUTPUT=tee "AUTOBUILD_CATALOG=${AUTOBUILD_CATALOG:-1}")
+  [ -z "${AUTOBUILD_K8S_BUILDKIT:-}" ] || env+=("AUTOBUILD_BUILDKIT_ADDR=$AUTOBUILD_K8S_BUILDKIT")
+  [ -z "${AUTOBUILD_WORKDIR_MOUNT:-}" ] || env+=("AUTOBUILD_WORKDIR_MOUNT=$AUTOBUILD_WORKDIR_MOUNT")
+  [ -z "${AUTOBUILD_PROMPT_RETRIES:-}" ] || env+=("AUTOBUILD_PROMPT_RETRIES=$AUTOBUILD_PROMPT_RETRIES")
+
+  local job; job="ab-$(printf '%s' "$name-$mode" | tr 'A-Z' 'a-z' | tr -c 'a-z0-9-' '-' | cut -c1-40)-${timestamp//_/}"
+  local cpus="${CONTAINER_CPUS:-${AUTOBUILD_K8S_CPUS:-2}}"
+  local memory; memory=$(k8s_memory "${CONTAINER_MEMORY:-${AUTOBUILD_K8S_MEMORY:-4096}}")
+  trap 'k8s_cleanup' EXIT
+  trap 'exit 143' TERM
+  trap 'exit 130' INT
+  trap 'exit 129' HUP
+  log_info "Kubernetes job: $job (namespace $namespace${context:+, context $context}; $cpus CPUs, $memory)"
+  k8s_manifest "$job" "$mode" "$cpus" "$memory" | k8s apply -f - >/dev/null || die "Could not create Kubernetes job $job"
+  K8S_JOB="$job"
+
+  # Pending until the cluster has room for it
+  local waited=0 limit="${AUTOBUILD_K8S_SCHEDULE_TIMEOUT:-1800}"
+  TIMING_OPEN="k8s_schedule $(now_ms)"; echo "[TIMING] begin $TIMING_OPEN" >&9
+  until K8S_POD=$(k8s get pods -l "job-name=$job" -o name 2>/dev/null | head -n 1) && [ -n "$K8S_POD" ] &&
+        k8s wait --for=condition=Ready "$K8S_POD" --timeout=10s >/dev/null 2>&1; do
+    waited=$((waited + 15))
+    [ "$waited" -lt "$limit" ] || { timing_end 1; die "Kubernetes job $job was not scheduled within ${limit}s"; }
+    sleep 5
+  done
+  timing_end 0
+  log_info "Kubernetes pod: ${K8S_POD#pod/}"
+  timed k8s_upload k8s_upload "$task_dir" "$script_dir" "${files[@]}" || die "Could not copy the task into ${K8S_POD#pod/}"
+  ( while sleep 60; do k8s exec "$K8S_POD" -c runner -- touch /work/heartbeat >/dev/null 2>&1 || true; done ) </dev/null >/dev/null 2>&1 &
+  K8S_HEARTBEAT=$!
+
+  local rc=0
+  set +e
+  k8s exec "$K8S_POD" -c runner -- env "${env[@]}" bash -c '
+    n=0
+    until docker info >/dev/null 2>&1; do
+      n=$((n + 1)); [ "$n" -lt 120 ] || { echo "[ERROR] Docker in the pod did not start" >&2; exit 1; }
+      sleep 1
+    done
+    exec bash /work/scripts/autobuild.sh "$@"' autobuild "$mode" "${args[@]}" --output-dir /work/out 2>&1 | k8s_relay "$output_dir"
+  rc=${PIPESTATUS[0]}
+  set -e
+
+  mkdir -p "$output_dir"
+  k8s exec "$K8S_POD" -c runner -- tar -C /work/out -cf - . | tar -C "$output_dir" -xf - ||
+    log_warn "Could not copy the run's logs back from ${K8S_POD#pod/}"
+  if [ -n "$CATALOG_FILE" ]; then
+    local line
+    while IFS= read -r line; do
+      catalog_append "${line//\/work\/out/$output_dir}"
+    done < <(k8s exec "$K8S_POD" -c runner -- cat /work/logs/catalog.jsonl 2>/dev/null || true)
+  fi
+  log_info "Kubernetes job $job finished with exit code $rc"
+  return "$rc"
+}
+
 
 main() {
-  local mode="" task_dir="" image_tag="" container_name="" workdir="" api_key="${GEMINI_API_KEY:-}" output_dir="" no_cache="" debug_mode=""
+  local mode="" task_dir="" image_tag="" container_name="" workdir="" api_key="${GEMINI_API_KEY:-}" output_dir="" no_cache="" debug_mode="" resume_dir="" parallel="" workdir_mount_set=""
   [ $# -ge 1 ] || { usage; exit 1; }
   mode="$1"; shift || true
-  
-  # Require docker for all modes
-  require_cmd docker
+  # As given, for a Kubernetes run to pass on (see k8s_run)
+  local run_args=("$@")
+
+  # Require docker for all modes; Kubernetes runs use the pod's
+  [ -n "${AUTOBUILD_K8S:-}" ] || require_cmd docker
   while [ $# -gt 0 ]; do
     case "$1" in
       --task)            task_dir="$(resolve_abs_path "$2")"; shift 2;;
@@ -619,46 +2864,118 @@ main() {
       --output-dir)      output_dir="$2"; shift 2;;
       --no-cache)        no_cache="--no-cache"; shift 1;;
       --debug)           debug_mode="--debug"; shift 1;;
+      --stage-gate)      STAGE_GATE_DIR="$2"; shift 2;;
+      --reuse-image)     REUSE_IMAGE=1; shift 1;;
+      --image-cache)     IMAGE_CACHE=1; shift 1;;
+      --buildkit)        BUILDKIT=1; shift 1;;
+      --build-cache)     BUILD_CACHE="$2"; shift 2;;
+      --cli-layer)       CLI_LAYER=1; shift 1;;
+      --container-pool)  POOL_SIZE="$2"; shift 2;;
+      --fan-out)         FANOUT="$2"; shift 2;;
+      --validated)       TASK_VALIDATED=1; shift;;
+      --context-hash)    CONTEXT_HASH="$2"; shift 2;;
+      --context-tool)    CONTEXT_TOOL="$2"; shift 2;;
+      --image-registry)  IMAGE_REGISTRY="$2"; shift 2;;
+      --verify-shards)   VERIFY_SHARDS="$2"; shift 2;;
+      --cache-volumes)   CACHE_VOLUMES="$2"; shift 2;;
+      --package-proxy)   PACKAGE_PROXY="$2"; shift 2;;
+      --cpus)            CONTAINER_CPUS="$2"; shift 2;;
+      --memory)          CONTAINER_MEMORY="$2"; shift 2;;
+      --pids-limit)      CONTAINER_PIDS="$2"; shift 2;;
+      --workdir-mount)   WORKDIR_MOUNT="$2"; workdir_mount_set=1; shift 2;;
+      --prompt1-file)    PROMPT1_FILE="$2"; shift 2;;
+      --prompt2-file)    PROMPT2_FILE="$2"; shift 2;;
+      --audit-prompt-file) AUDIT_PROMPT_FILE="$2"; shift 2;;
+      --verify-cache)    VERIFY_CACHE=1; shift 1;;
+      --audit-cache)     AUDIT_CACHE=1; shift 1;;
+      --force-audit)     AUDIT_FORCE=1; shift 1;;
+      --checkpoint-image) CHECKPOINT_IMAGE=1; shift 1;;
+      --checkpoint-registry) CHECKPOINT_IMAGE=1; CHECKPOINT_REGISTRY="$2"; shift 2;;
+      --resume)          resume_dir="$(resolve_abs_path "$2")"; shift 2;;
+      --parallel)        parallel=1; shift 1;;
       -h|--help)         usage; exit 0;;
       *)                 log_error "Unknown arg: $1"; usage; exit 1;;
     esac
   done
 
   [ -n "$task_dir" ] || die "--task is required"; [ -d "$task_dir" ] || die "Task dir not found: $task_dir"
+  [ -z "$TASK_VALIDATED" ] || log_info "Task layout validated by the caller; skipping the layout checks"
+  [ -z "$DOCKER_ENDPOINT" ] || [ -n "${AUTOBUILD_K8S:-}" ] || log_info "Docker endpoint: $DOCKER_ENDPOINT"
+  if [ "$mode" != build ] && [ -z "${AUTOBUILD_K8S:-}" ]; then cache_volumes_setup; container_limits_setup; fi
+  [ -n "${AUTOBUILD_K8S:-}" ] || package_proxy_setup
+  if [ -z "$workdir_mount_set" ] && [ -f "$task_dir/workdir_mount" ]; then
+    read -r WORKDIR_MOUNT < "$task_dir/workdir_mount" || true
+    WORKDIR_MOUNT="${WORKDIR_MOUNT%$'\r'}"
+  fi
   local task_name; task_name=$(derive_task_name "$task_dir")
   if [ -z "$image_tag" ]; then image_tag=$(derive_image_tag "$task_name"); fi
   if [ -z "$container_name" ]; then container_name="$task_name"; fi
-  if [ -z "$api_key" ]; then die "Gemini API Key is required (use --api-key or GEMINI_API_KEY env)"; fi
+  if [ -z "$api_key" ] && [ "$mode" != build ]; then die "Gemini API Key is required (use --api-key or GEMINI_API_KEY env)"; fi
 
   # Determine default output directory at workspace level: <workspace>/logs/<task_name>/<timestamp>
   local script_dir; script_dir=$(cd "$(dirname "$0")" && pwd -P)
   local workspace_root; workspace_root=$(cd "$script_dir/.." && pwd -P)
   local base_logs_dir="${AUTOBUILD_LOGS_ROOT:-$workspace_root/logs}"
+  [ "$mode" = build ] || asset_store_setup "$base_logs_dir"
   
   # Generate timestamp once for both logs and container names
   # Use microsecond precision to avoid conflicts when multiple tasks start simultaneously
   local timestamp; timestamp="$(date +%Y%m%d_%H%M%S_%N | cut -c1-19)"
+  if [ -n "$resume_dir" ]; then
+    [ "$mode" = feedback ] || die "--resume only applies to feedback runs"
+    [ -f "$resume_dir/checkpoint" ] || die "No checkpoint in $resume_dir"
+    output_dir=$(dirname "$resume_dir")
+  fi
   if [ -z "$output_dir" ]; then output_dir="$base_logs_dir/$task_name/$timestamp"; fi
   mkdir -p "$output_dir"
+  if [ "${AUTOBUILD_CATALOG:-1}" != "0" ] && mkdir -p "$base_logs_dir" 2>/dev/null; then
+    CATALOG_FILE="$base_logs_dir/catalog.jsonl"
+    trap 'catalog_end $?' EXIT
+  fi
+  if [ -n "${AUTOBUILD_K8S:-}" ]; then
+    [ "$mode" != build ] || die "Image builds for Kubernetes runs happen in the cluster, with the run"
+    k8s_run "$mode" "$task_dir" "$output_dir" "$timestamp" "${run_args[@]}"
+    return
+  fi
 
   case "$mode" in
     feedback)
       local cname_fb="${container_name}-feedback-${timestamp}"
-      local out_fb="$output_dir/feedback"; mkdir -p "$out_fb"
+      local out_fb="$output_dir/feedback"
+      if [ -n "$resume_dir" ]; then
+        out_fb="$resume_dir"
+        RESUME_FROM=$(resume_point "$out_fb/checkpoint")
+        [ -n "$RESUME_FROM" ] || { log_info "Every feedback phase in $out_fb finished; nothing to resume"; exit 0; }
+        local resumed; resumed=$(checkpoint_value "$out_fb/checkpoint" container)
+        if [ -n "$resumed" ]; then cname_fb="$resumed"; else log_warn "Checkpoint names no container; running feedback from the start"; RESUME_FROM=""; fi
+      fi
+      mkdir -p "$out_fb"
+      catalog_begin feedback "$task_name" "$cname_fb" "$out_fb"
       feedback "$task_dir" "$image_tag" "$cname_fb" "$workdir" "$api_key" "$out_fb" "$no_cache" "$debug_mode"
+      catalog_end 0
       ;;
     verify)
       local cname_v="${container_name}-verify-${timestamp}"
       local out_v="$output_dir/verify"; mkdir -p "$out_v"
+      catalog_begin verify "$task_name" "$cname_v" "$out_v"
       verify   "$task_dir" "$image_tag" "$cname_v" "$workdir" "$api_key" "$out_v" "$no_cache" "$debug_mode"
+      catalog_end 0
       ;;
     both)
       local out_fb="$output_dir/feedback"; mkdir -p "$out_fb"
       local out_v="$output_dir/verify"; mkdir -p "$out_v"
       local cname_fb="${container_name}-feedback-${timestamp}"
       local cname_v="${container_name}-verify-${timestamp}"
+      if [ -n "$parallel" ]; then
+        both_parallel "$task_dir" "$image_tag" "$cname_fb" "$cname_v" "$workdir" "$api_key" "$out_fb" "$out_v" "$no_cache" "$debug_mode"
+        return
+      fi
+      catalog_begin feedback "$task_name" "$cname_fb" "$out_fb"
       feedback "$task_dir" "$image_tag" "$cname_fb" "$workdir" "$api_key" "$out_fb" "$no_cache" "$debug_mode"
+      catalog_end 0
+      catalog_begin verify "$task_name" "$cname_v" "$out_v"
       verify   "$task_dir" "$image_tag" "$cname_v" "$workdir" "$api_key" "$out_v" "$no_cache" "$debug_mode"
+      catalog_end 0
       ;;
     audit)
       local base="$(basename "$task_dir")"
@@ -672,10 +2989,22 @@ main() {
         out="$base_logs_dir/$base/$timestamp/audit"
       fi
       mkdir -p "$out"
+      catalog_begin audit "$base" "$cname" "$out"
       audit "$task_dir" "$img" "$cname" "$workdir" "$api_key" "$out" "$no_cache" "$debug_mode"
+      catalog_end 0
+      ;;
+    build)
+      # Builds ahead of the runs that need the image (see ImageBuildFarm in
+      # the engine); they find it through the image cache
+      local out_b="$output_dir/build"; mkdir -p "$out_b"
+      [ -d "$task_dir/env" ] || die "Missing env directory: $task_dir/env"
+      IMAGE_CACHE=1
+      prepare_image "$task_dir/env" "$image_tag" "$out_b/docker_build.log" "$no_cache" "$debug_mode"
+      bake_cli_layer "$out_b/gemini_layer.log"
+      log_info "Image ready: $RUN_IMAGE"
       ;;
     *)
-      log_error "Unknown mode: $mode (valid modes: feedback, verify, both, audit)"; usage; exit 1;;
+      log_error "Unknown mode: $mode (valid modes: feedback, verify, both, audit, build)"; usage; exit 1;;
   esac
 }
 
@@ -0,0 +1,756 @@
+// Microbenchmarks for the log pipeline and UI hot paths (Google Benchmark).
+// Run autobuild_bench --benchmark_filter=<regex> to pick a subset. With
+// ImGui available the suite also times a headless frame that lays out N
+// task log views of M lines each, the way the Logs tab does.
+// AUTOBUILD_BENCH_LOG=<file> replaces the built-in sample output with a
+// captured log (the PGO training run passes a synthetic load task's).
+// AUTOBUILD_BENCH_RECORDING=<file> gives BM_ReplayIngest a run recorded
+// with the GUI's "Record run output" (a StreamRecorder file) to replay.
+
+#include "autobuild_engine.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef AUTOBUILD_BENCH_IMGUI
+#include "imgui.h"
+#endif
+
+#ifdef AUTOBUILD_BENCH_GLM
+#include "splash_transforms.h"
+#endif
+
+// The AUTOBUILD_BENCH_LOG file's contents, or empty without one
+static const std::string &CapturedOutput() {
+  static const std::string captured = [] {
+    const char *path = getenv("AUTOBUILD_BENCH_LOG");
+    std::ifstream in(path ? path : "", std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+  }();
+  return captured;
+}
+
+// Output that looks like a docker build or Gemini run: mostly plain lines,
+// some colored, a few progress-bar overwrites. A captured log is repeated
+// to the same size instead when there is one.
+static std::string SyntheticOutput(size_t bytes) {
+  std::string out;
+  const std::string &captured = CapturedOutput();
+  if (!captured.empty()) {
+    out.reserve(bytes + captured.size());
+    while (out.size() < bytes)
+      out += captured;
+    size_t end = out.rfind('\n', bytes);
+    out.resize(end == std::string::npos ? bytes : end + 1);
+    return out;
+  }
+  static const char *kLines[] = {
+      "#12 [build 4/9] RUN npm ci --no-audit --no-fund\n",
+      "\033[32m[INFO]\033[0m Container started: autobuild-task-1234\n",
+      "npm WARN deprecated inflight@1.0.6: This module is not supported\n",
+      "Downloading 34%\rDownloading 67%\rDownloading 100%\n",
+      "\033[1;31mERROR\033[0m verify.sh: test_parse_args failed (exit 1)\n",
+      "    at Object.<anonymous> (/workspace/src/index.test.js:42:17)\n",
+  };
+  out.reserve(bytes + 128);
+  for (size_t i = 0; out.size() < bytes; i++)
+    out += kLines[i % (sizeof(kLines) / sizeof(kLines[0]))];
+  return out;
+}
+
+// A prompt-sized text of n lines and a copy with every 7th line edited, one
+// in 13 removed and a line added every 17
+static void SyntheticPromptPair(int n, std::string &a, std::string &b) {
+  a.clear();
+  b.clear();
+  for (int i = 0; i < n; i++) {
+    std::string line = "Step " + std::to_string(i) +
+                       ": read the prompt file and run verify.sh for task " +
+                       std::to_string(i * 31 % 97);
+    a += line + "\n";
+    if (i % 13 == 5)
+      continue;
+    if (i % 7 == 3)
+      line += " (and report the exit code)";
+    b += line + "\n";
+    if (i % 17 == 0)
+      b += "Added note " + std::to_string(i) + "\n";
+  }
+}
+
+static void BM_StripAnsiPlain(benchmark::State &state) {
+  std::string line(120, 'x');
+  std::string buf;
+  for (auto _ : state) {
+    buf = line;
+    benchmark::DoNotOptimize(StripAnsiInPlace(&buf[0], buf.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)line.size());
+}
+BENCHMARK(BM_StripAnsiPlain);
+
+static void BM_StripAnsiColored(benchmark::State &state) {
+  std::string line = "\033[1;32m[ OK ]\033[0m step \033[36mbuild_image"
+                     "\033[0m finished in \033[33m12.4s\033[0m\033]0;title\a";
+  std::string buf;
+  for (auto _ : state) {
+    buf = line;
+    benchmark::DoNotOptimize(StripAnsiInPlace(&buf[0], buf.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)line.size());
+}
+BENCHMARK(BM_StripAnsiColored);
+
+// Pipe reads of 4 KiB through the splitter, ANSI stripping on
+static void BM_LineSplitter(benchmark::State &state) {
+  std::string data = SyntheticOutput(1 << 20);
+  for (auto _ : state) {
+    LineSplitter splitter(true);
+    size_t lines = 0;
+    for (size_t pos = 0; pos < data.size(); pos += 4096) {
+      size_t n = std::min<size_t>(4096, data.size() - pos);
+      splitter.Append(data.data() + pos, n);
+      splitter.Drain([&](std::string_view) { lines++; });
+    }
+    splitter.Finish([&](std::string_view) { lines++; });
+    benchmark::DoNotOptimize(lines);
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_LineSplitter);
+
+// One second of output at Arg(0) MB/s through the whole pipeline: splitter,
+// the reactor-to-render ring and the capped, timestamped scrollback.
+// Staying well under a second per iteration means the rate is sustainable.
+static void BM_LogIngest(benchmark::State &state) {
+  const size_t rate = (size_t)state.range(0) << 20;
+  std::string chunk = SyntheticOutput(1 << 20);
+  for (auto _ : state) {
+    LineSplitter splitter(true);
+    LogLineRing ring;
+    LogArena arena(100000, LogArena::kTimestamps);
+    for (size_t fed = 0; fed < rate; fed += chunk.size()) {
+      for (size_t pos = 0; pos < chunk.size(); pos += 4096) {
+        size_t n = std::min<size_t>(4096, chunk.size() - pos);
+        splitter.Append(chunk.data() + pos, n);
+        splitter.Drain(
+            [&](std::string_view line) { ring.Push(line, 0, MonotonicMs()); });
+        // The render thread drains about once a frame; draining whenever
+        // the ring runs low keeps nothing from being dropped
+        if (ring.Free() < 1024)
+          ring.Drain([&](std::string_view line, uint8_t tag, int64_t ms) {
+            arena.Append(line, tag, ms);
+          });
+      }
+    }
+    ring.Drain([&](std::string_view line, uint8_t tag, int64_t ms) {
+      arena.Append(line, tag, ms);
+    });
+    benchmark::DoNotOptimize(arena.TotalAppended());
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)rate);
+}
+BENCHMARK(BM_LogIngest)->Arg(1)->Arg(10)->Arg(100)->Unit(
+    benchmark::kMillisecond);
+
+// The AUTOBUILD_BENCH_RECORDING run's reads, or without one SyntheticOutput
+// cut into reads of uneven size: quiet stretches of small reads 5 ms apart
+// and bursts of full 4 KiB reads with no gap, as a build's output comes
+static const std::vector<RecordedChunk> &ReplayChunks() {
+  static const std::vector<RecordedChunk> chunks = [] {
+    std::vector<RecordedChunk> out;
+    const char *path = getenv("AUTOBUILD_BENCH_RECORDING");
+    if (path && ReadStreamRecording(path, out) && !out.empty())
+      return out;
+    out.clear();
+    static const size_t kSizes[] = {37, 512, 4096, 4096, 4096, 4096, 1500};
+    std::string data = SyntheticOutput(8 << 20);
+    for (size_t pos = 0, i = 0; pos < data.size(); i++) {
+      bool burst = (i / 64) % 4 == 3;
+      size_t n = std::min(burst ? 4096 : kSizes[i % 7], data.size() - pos);
+      RecordedChunk chunk;
+      chunk.delay_us = burst ? 0 : 5000;
+      chunk.bytes.assign(data, pos, n);
+      out.push_back(std::move(chunk));
+      pos += n;
+    }
+    return out;
+  }();
+  return chunks;
+}
+
+// A recorded run replayed as fast as possible through what the GUI does
+// with a task's reads: splitter, severity, the ingest throttle at Arg(0)
+// lines/s (0 = off), the ring and the scrollback. Time is the recording's
+// own, so the throttle's windows and the once-a-frame (16 ms) ring drains
+// fall on the same lines every iteration and runs compare across builds.
+static void BM_ReplayIngest(benchmark::State &state) {
+  const std::vector<RecordedChunk> &chunks = ReplayChunks();
+  const int rate = (int)state.range(0);
+  const std::vector<LogSeverityRule> rules = {
+      {LogSeverity::Error, "[ERROR]"}, {LogSeverity::Error, "ERROR"},
+      {LogSeverity::Warning, "WARN"},  {LogSeverity::Info, "[INFO]"}};
+  LogClassifier classifier(rules, std::vector<std::string>());
+  int64_t bytes = 0;
+  for (const RecordedChunk &chunk : chunks)
+    bytes += (int64_t)chunk.bytes.size();
+  uint64_t skipped = 0;
+  for (auto _ : state) {
+    LineSplitter splitter(true);
+    LogLineRing ring;
+    IngestThrottle ingest;
+    LogArena arena(100000, LogArena::kTimestamps);
+    std::string marker;
+    auto drain = [&] {
+      ring.Drain([&](std::string_view line, uint8_t tag, int64_t ms) {
+        arena.Append(line, tag, ms);
+      });
+    };
+    auto on_line = [&](std::string_view line, int64_t ms) {
+      uint8_t tag = (uint8_t)classifier.Classify(line);
+      if (!ingest.Admit(rate, tag, ms, marker))
+        return;
+      if (!marker.empty())
+        ring.Push(marker, IngestThrottle::kMarkerTag, ms);
+      ring.Push(line, tag, ms);
+    };
+    int64_t us = 0, frame_ms = 0;
+    for (const RecordedChunk &chunk : chunks) {
+      us += chunk.delay_us;
+      int64_t ms = us / 1000;
+      if (ms - frame_ms >= 16 || ring.Free() < 1024) {
+        drain();
+        frame_ms = ms;
+      }
+      splitter.Append(chunk.bytes.data(), chunk.bytes.size());
+      splitter.Drain([&](std::string_view line) { on_line(line, ms); });
+    }
+    splitter.Finish([&](std::string_view line) { on_line(line, us / 1000); });
+    drain();
+    skipped = ingest.Skipped();
+    benchmark::DoNotOptimize(arena.TotalAppended());
+  }
+  state.counters["skipped"] = (double)skipped;
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_ReplayIngest)->Arg(0)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+// A task's history through the on-disk spool: 1 MiB of lines appended,
+// then the log view's window of 60 lines read back from the middle
+static void BM_LogSpool(benchmark::State &state) {
+  std::vector<std::string> lines;
+  LineSplitter splitter(true);
+  std::string data = SyntheticOutput(1 << 20);
+  splitter.Append(data.data(), data.size());
+  splitter.Finish([&](std::string_view line) { lines.emplace_back(line); });
+  const std::string path = "autobuild_bench_spool.log";
+  for (auto _ : state) {
+    LogSpool spool;
+    if (!spool.Open(path)) {
+      state.SkipWithError("cannot create the spool file");
+      break;
+    }
+    for (const auto &line : lines)
+      spool.Append(line);
+    size_t bytes = 0;
+    spool.ReadLines(lines.size() / 2, 60,
+                    [&](std::string_view line) { bytes += line.size(); });
+    benchmark::DoNotOptimize(bytes);
+  }
+  std::remove(path.c_str());
+  state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_LogSpool)->Unit(benchmark::kMillisecond);
+
+#ifndef _WIN32
+// A task's output through the shared process reactor: one child printing
+// the lines 1..N, from the spawn to its exit callback
+static void BM_ProcessReactor(benchmark::State &state) {
+  static ProcessReactor reactor;
+  const std::string args = std::to_string(state.range(0));
+  size_t lines = 0;
+  for (auto _ : state) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    std::atomic<bool> stop{false};
+    ProcessReactor::ProcessHandle handle;
+    auto on_line = [&](std::string_view) { lines++; };
+    auto on_exit = [&](int, bool) {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+      cv.notify_all();
+    };
+    if (!reactor.Spawn("seq", args, on_line, on_exit, &stop, handle)) {
+      state.SkipWithError("cannot start seq");
+      break;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return done; });
+  }
+  state.SetItemsProcessed((int64_t)lines);
+}
+BENCHMARK(BM_ProcessReactor)
+    ->Arg(100000)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+#endif
+
+// What a DevLog call costs the thread making it: 1000 messages queued to the
+// debug logger, whose own thread formats them and writes them to a temporary
+// file while the timer is paused between bursts. Messages the full queue had
+// to drop anyway are reported as a counter.
+static void BM_AsyncLogger(benchmark::State &state) {
+  FILE *out = std::tmpfile();
+  if (!out) {
+    state.SkipWithError("cannot create a temporary file");
+    return;
+  }
+  uint64_t dropped = 0;
+  {
+    AsyncLogger logger(200, out);
+    const std::string message =
+        "ID STACK CHANGE: 3 -> 4 in window ##Tasks/Task Output";
+    for (auto _ : state) {
+      for (int i = 0; i < 1000; ++i)
+        logger.Log(message, AsyncLogger::kConsole | AsyncLogger::kOverlay);
+      state.PauseTiming();
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      state.ResumeTiming();
+    }
+    logger.Stop();
+    dropped = logger.Dropped();
+  }
+  std::fclose(out);
+  state.counters["dropped"] = (double)dropped;
+  state.SetItemsProcessed(state.iterations() * 1000);
+}
+BENCHMARK(BM_AsyncLogger);
+
+// Severity classification of every output line; with Arg 1 the classifier
+// also flags the failure detectors' triggers and the lines go through a
+// FailureScanner, as task output does
+static void BM_ClassifyLines(benchmark::State &state) {
+  std::vector<std::string> lines;
+  LineSplitter splitter(true);
+  std::string data = SyntheticOutput(1 << 20);
+  splitter.Append(data.data(), data.size());
+  splitter.Finish([&](std::string_view line) { lines.emplace_back(line); });
+  const std::vector<LogSeverityRule> rules = {
+      {LogSeverity::Error, "[ERROR]"},   {LogSeverity::Error, "error:"},
+      {LogSeverity::Error, "Error"},     {LogSeverity::Error, "failed"},
+      {LogSeverity::Success, "success"}, {LogSeverity::Warning, "[WARN]"},
+      {LogSeverity::Warning, "warning:"}, {LogSeverity::Info, "[INFO]"}};
+  bool scan = state.range(0) != 0;
+  LogClassifier classifier(rules, scan ? FailureScanner().Triggers()
+                                       : std::vector<std::string>());
+  for (auto _ : state) {
+    FailureScanner scanner;
+    size_t errors = 0;
+    for (const auto &line : lines) {
+      uint32_t hits = 0;
+      LogSeverity severity = classifier.Classify(line, scan ? &hits : nullptr);
+      if (scan)
+        scanner.Feed(line, severity, hits);
+      errors += severity == LogSeverity::Error;
+    }
+    benchmark::DoNotOptimize(errors);
+    benchmark::DoNotOptimize(scanner.summary().failed_test_count);
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_ClassifyLines)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// BuildKit plain progress output of a 40 step build, its RUN steps
+// printing 50 lines each
+static void BM_BuildStepParser(benchmark::State &state) {
+  std::vector<std::string> lines;
+  for (int step = 1; step <= 40; step++) {
+    std::string id = "#" + std::to_string(step) + " ";
+    lines.push_back(id + "[builder " + std::to_string(step) + "/40] RUN make");
+    for (int i = 0; i < 50; i++)
+      lines.push_back(id + std::to_string(i) + ".123 compiling unit " +
+                      std::to_string(i));
+    lines.push_back(id + "DONE 1.5s");
+  }
+  for (auto _ : state) {
+    BuildStepParser parser;
+    uint64_t seq = 0;
+    for (const auto &line : lines) {
+      seq++;
+      parser.Feed(line, (int64_t)seq, seq);
+    }
+    benchmark::DoNotOptimize(parser.steps().data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)lines.size());
+}
+BENCHMARK(BM_BuildStepParser);
+
+static void BM_ComputeLineDiff(benchmark::State &state) {
+  std::string a, b;
+  SyntheticPromptPair((int)state.range(0), a, b);
+  for (auto _ : state) {
+    LineDiff diff = ComputeLineDiff(a, b);
+    benchmark::DoNotOptimize(diff.lines.data());
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          (int64_t)(a.size() + b.size()));
+}
+BENCHMARK(BM_ComputeLineDiff)->Arg(100)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMicrosecond);
+
+// Intra-line refinement dominates when every line changed a little
+static void BM_ComputeLineDiffAllModified(benchmark::State &state) {
+  std::string a, b;
+  for (int i = 0; i < state.range(0); i++) {
+    a += "value_" + std::to_string(i) + " = compute(alpha, beta, gamma);\n";
+    b += "value_" + std::to_string(i) + " = compute(alpha, delta, gamma);\n";
+  }
+  for (auto _ : state) {
+    LineDiff diff = ComputeLineDiff(a, b);
+    benchmark::DoNotOptimize(diff.lines.data());
+  }
+}
+BENCHMARK(BM_ComputeLineDiffAllModified)->Arg(1000)->Unit(
+    benchmark::kMicrosecond);
+
+static void BM_ParseShellCommand(benchmark::State &state) {
+  std::string command =
+      "bash '/opt/autobuild/scripts/autobuild.sh' --mode both "
+      "--task \"/home/user/tasks/task 42\" --output \"/tmp/out dir\" "
+      "--gemini-args \"--model gemini-2.5-pro --yolo\" --cache\\ dir x";
+  for (auto _ : state)
+    benchmark::DoNotOptimize(ParseShellCommand(command));
+}
+BENCHMARK(BM_ParseShellCommand);
+
+// A batch/settings line with quotes, backslashes, control characters and
+// UTF-8, written compact as for JSON Lines events
+static void BM_JsonEscape(benchmark::State &state) {
+  std::string text = "path \"C:\\tasks\\task 1\"\tline\nnext \x01 caf\xc3\xa9 ";
+  for (int i = 0; i < 4; i++)
+    text += text;
+  for (auto _ : state) {
+    JsonWriter writer(true);
+    writer.String("line", text).Number("run", 7);
+    benchmark::DoNotOptimize(writer.Finish());
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)text.size());
+}
+BENCHMARK(BM_JsonEscape);
+
+static void BM_JsonUnescape(benchmark::State &state) {
+  std::string text = "path \"C:\\tasks\\task 1\"\tline\nnext \x01 caf\xc3\xa9 ";
+  for (int i = 0; i < 4; i++)
+    text += text;
+  JsonWriter writer(true);
+  writer.String("line", text).Number("run", 7);
+  std::string json = writer.Finish();
+  for (auto _ : state) {
+    JsonValue value;
+    JsonParser parser(json);
+    benchmark::DoNotOptimize(parser.Parse(value));
+    benchmark::DoNotOptimize(value.items.data());
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)json.size());
+}
+BENCHMARK(BM_JsonUnescape);
+
+#ifdef AUTOBUILD_BENCH_GLM
+// The splash's per-frame transforms; build with and without
+// AUTOBUILD_GLM_SIMD to compare glm's scalar and SIMD paths. The single
+// shape is one rotate; the full MVP product is what the GPU then computes
+// per vertex.
+static void BM_SplashShapeTransform(benchmark::State &state) {
+  glm::mat4 view = SplashView();
+  glm::mat4 projection = SplashProjection(800, 528);
+  float angle = 0.0f;
+  for (auto _ : state) {
+    angle += 0.8f;
+    glm::mat4 mvp = projection * view * SplashShapeModel(angle);
+    benchmark::DoNotOptimize(&mvp);
+  }
+}
+BENCHMARK(BM_SplashShapeTransform);
+
+// Arg(0) models of the --shapes field, as RenderShapeField builds them
+static void BM_SplashFieldTransforms(benchmark::State &state) {
+  const int count = (int)state.range(0);
+  std::vector<glm::vec3> positions(count), axes(count);
+  for (int i = 0; i < count; i++) {
+    positions[i] = glm::vec3(i % 17 * 0.25f - 2.0f, i / 17 * 0.25f - 1.5f,
+                             -(i % 5) * 0.3f);
+    axes[i] = glm::normalize(glm::vec3(i % 3 - 1.0f, 1.0f, i % 7 * 0.1f));
+  }
+  std::vector<glm::mat4> models(count);
+  float time = 0.0f;
+  for (auto _ : state) {
+    time += 1.0f / 60.0f;
+    for (int i = 0; i < count; i++)
+      models[i] = SplashFieldModel(positions[i], axes[i],
+                                   (30.0f + i % 90) * time, 0.1f);
+    benchmark::DoNotOptimize(models.data());
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_SplashFieldTransforms)->Arg(200)->Arg(4096);
+
+// Arg(0) points through one mat4 as AoS glm::vec4, one at a time: the
+// baseline for BM_TransformSoA (cf. glm/test/perf/perf_matrix_mul_vector)
+static void BM_TransformAoS(benchmark::State &state) {
+  const size_t n = (size_t)state.range(0);
+  std::vector<glm::vec4> in(n), out(n);
+  for (size_t i = 0; i < n; i++)
+    in[i] = glm::vec4((float)i, (float)(i % 7), (float)(i % 13), 1.0f);
+  glm::mat4 m = SplashProjection(800, 528) * SplashView() *
+                SplashShapeModel(30.0f);
+  for (auto _ : state) {
+    for (size_t i = 0; i < n; i++)
+      out[i] = m * in[i];
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)n);
+}
+BENCHMARK(BM_TransformAoS)->Arg(4096)->Arg(65536);
+#endif
+
+// Arg(1) points through one mat4 as SoA arrays, with the kernel Arg(0)
+// (a SimdPath); kernels this CPU lacks are skipped
+static void BM_TransformSoA(benchmark::State &state) {
+  const SimdPath path = (SimdPath)state.range(0);
+  const size_t n = (size_t)state.range(1);
+  if (!SimdPathSupported(path)) {
+    state.SkipWithError("kernel not supported on this CPU");
+    return;
+  }
+  state.SetLabel(SimdPathName(path));
+  std::vector<float> in(n * 3), out(n * 4);
+  for (size_t i = 0; i < n; i++) {
+    in[i] = (float)i;
+    in[n + i] = (float)(i % 7);
+    in[2 * n + i] = (float)(i % 13);
+  }
+  SoAVec4 src, dst;
+  src.x = in.data();
+  src.y = in.data() + n;
+  src.z = in.data() + 2 * n;
+  dst.x = out.data();
+  dst.y = out.data() + n;
+  dst.z = out.data() + 2 * n;
+  dst.w = out.data() + 3 * n;
+  // A perspective MVP, so every row of the matrix is used
+  const float m[16] = {1.3f, 0, 0, 0,  0, 1.7f, 0, 0,
+                       0.2f, 0.1f, -1.0f, -1.0f, 0.5f, -0.3f, 2.8f, 3.0f};
+  for (auto _ : state) {
+    TransformSoA(path, m, src, dst, n);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)n);
+}
+BENCHMARK(BM_TransformSoA)->Apply([](benchmark::internal::Benchmark *b) {
+  for (int path = 0; path <= (int)SimdPath::kNeon; path++)
+    for (int n : {4096, 65536})
+      b->Args({path, n});
+});
+
+// The text kernels of every SimdPath on random input, next to the scalar
+// ones: lengths across the vector widths and their tails, bytes drawn
+// mostly from the ones the kernels look for and their neighbours
+static bool TextKernelsMatchScalar(SimdPath path) {
+  static const char kBytes[] = "\n\r\"\\\x1f \x7f\x80\xff@AZ[`az{e[";
+  uint32_t seed = 0x2545F491;
+  auto next = [&]() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  };
+  std::string text, lower, expected;
+  for (int round = 0; round < 2000; round++) {
+    text.resize(next() % 200);
+    for (char &c : text)
+      c = next() % 4 == 0 ? (char)next()
+                          : kBytes[next() % (sizeof(kBytes) - 1)];
+    const char *p = text.data();
+    size_t n = text.size();
+    ByteSet set;
+    for (unsigned k = next() % 20; k > 0; k--)
+      set.Add((unsigned char)kBytes[next() % (sizeof(kBytes) - 1)]);
+    lower.assign(n, '\0');
+    expected.assign(n, '\0');
+    FoldAsciiLower(path, p, &lower[0], n);
+    FoldAsciiLower(SimdPath::kScalar, p, &expected[0], n);
+    if (FindEither(path, p, n, '\n', '\r') !=
+            FindEither(SimdPath::kScalar, p, n, '\n', '\r') ||
+        FindJsonEscape(path, p, n) !=
+            FindJsonEscape(SimdPath::kScalar, p, n) ||
+        FindAnyOf(path, p, n, set) !=
+            FindAnyOf(SimdPath::kScalar, p, n, set) ||
+        lower != expected)
+      return false;
+  }
+  return true;
+}
+
+// Skips a text kernel benchmark whose path Arg(0) this CPU lacks or that
+// disagrees with the scalar kernels
+static bool TextKernelPath(benchmark::State &state, SimdPath &path) {
+  path = (SimdPath)state.range(0);
+  if (!SimdPathSupported(path)) {
+    state.SkipWithError("kernel not supported on this CPU");
+    return false;
+  }
+  if (!TextKernelsMatchScalar(path)) {
+    state.SkipWithError("kernel disagrees with the scalar kernel");
+    return false;
+  }
+  state.SetLabel(SimdPathName(path));
+  return true;
+}
+
+static void TextKernelPaths(benchmark::internal::Benchmark *b) {
+  for (int path = 0; path <= (int)SimdPath::kNeon; path++)
+    b->Arg(path);
+}
+
+// Line breaks of a chunk of output, as LineSplitter::Drain finds them
+static void BM_FindLineBreaks(benchmark::State &state) {
+  SimdPath path;
+  if (!TextKernelPath(state, path))
+    return;
+  std::string data = SyntheticOutput(1 << 16);
+  for (auto _ : state) {
+    size_t lines = 0;
+    for (size_t pos = 0; pos < data.size(); pos++, lines++)
+      pos += FindEither(path, data.data() + pos, data.size() - pos, '\n',
+                        '\r');
+    benchmark::DoNotOptimize(lines);
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_FindLineBreaks)->Apply(TextKernelPaths);
+
+// Bytes of a chunk of output a JSON string escapes, as JsonWriter finds
+// them
+static void BM_FindJsonEscapes(benchmark::State &state) {
+  SimdPath path;
+  if (!TextKernelPath(state, path))
+    return;
+  std::string data = SyntheticOutput(1 << 16);
+  for (auto _ : state) {
+    size_t escapes = 0;
+    for (size_t pos = 0; pos < data.size(); pos++, escapes++)
+      pos += FindJsonEscape(path, data.data() + pos, data.size() - pos);
+    benchmark::DoNotOptimize(escapes);
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_FindJsonEscapes)->Apply(TextKernelPaths);
+
+// The lowercase shadow of a chunk of output, as the log views and search
+// keep it
+static void BM_FoldAsciiLower(benchmark::State &state) {
+  SimdPath path;
+  if (!TextKernelPath(state, path))
+    return;
+  std::string data = SyntheticOutput(1 << 16), lower(data.size(), '\0');
+  for (auto _ : state) {
+    FoldAsciiLower(path, data.data(), &lower[0], data.size());
+    benchmark::DoNotOptimize(lower.data());
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_FoldAsciiLower)->Apply(TextKernelPaths);
+
+// Starts of the default severity rules in a chunk of output, as the
+// classifier skips between them
+static void BM_FindAnyOf(benchmark::State &state) {
+  SimdPath path;
+  if (!TextKernelPath(state, path))
+    return;
+  std::string data = SyntheticOutput(1 << 16);
+  ByteSet starts;
+  for (char c : std::string("[eEfsPw"))
+    starts.Add((unsigned char)c);
+  for (auto _ : state) {
+    size_t found = 0;
+    for (size_t pos = 0; pos < data.size(); pos++, found++)
+      pos += FindAnyOf(path, data.data() + pos, data.size() - pos, starts);
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetBytesProcessed(state.iterations() * (int64_t)data.size());
+}
+BENCHMARK(BM_FindAnyOf)->Apply(TextKernelPaths);
+
+#ifdef AUTOBUILD_BENCH_IMGUI
+// Headless ImGui frames with Arg(0) task windows of Arg(1) log lines each:
+// clipped scrollback layout plus ImGui::Render, no GPU upload
+static void BM_ImGuiLogFrame(benchmark::State &state) {
+  const int tasks = (int)state.range(0);
+  const int lines = (int)state.range(1);
+  std::vector<LogArena> logs(tasks);
+  std::string data = SyntheticOutput(256 * 1024);
+  for (auto &log : logs) {
+    LineSplitter splitter(true);
+    while ((int)log.size() < lines) {
+      splitter.Append(data.data(), data.size());
+      splitter.Drain([&](std::string_view line) {
+        if ((int)log.size() < lines)
+          log.Append(line);
+      });
+    }
+  }
+
+  ImGui::CreateContext();
+  ImGuiIO &io = ImGui::GetIO();
+  io.IniFilename = nullptr;
+  io.DisplaySize = ImVec2(1920, 1080);
+  io.DeltaTime = 1.0f / 60.0f;
+  unsigned char *pixels = nullptr;
+  int width = 0, height = 0;
+  io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+
+  for (auto _ : state) {
+    ImGui::NewFrame();
+    for (int t = 0; t < tasks; t++) {
+      char title[32];
+      snprintf(title, sizeof(title), "Task %d", t);
+      float cell = 1920.0f / 5;
+      ImGui::SetNextWindowPos(ImVec2((t % 5) * cell, (t / 5) * 270.0f));
+      ImGui::SetNextWindowSize(ImVec2(cell, 270.0f));
+      ImGui::Begin(title);
+      ImGui::BeginChild("log");
+      ImGuiListClipper clipper;
+      clipper.Begin((int)logs[t].size());
+      while (clipper.Step())
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+          std::string_view line = logs[t][i];
+          ImGui::TextUnformatted(line.data(), line.data() + line.size());
+        }
+      ImGui::SetScrollHereY(1.0f); // following the tail
+      ImGui::EndChild();
+      ImGui::End();
+    }
+    ImGui::Render();
+    benchmark::DoNotOptimize(ImGui::GetDrawData()->TotalVtxCount);
+  }
+  ImGui::DestroyContext();
+}
+BENCHMARK(BM_ImGuiLogFrame)
+    ->Args({1, 10000})
+    ->Args({20, 10000})
+    ->Args({20, 100000})
+    ->Unit(benchmark::kMicrosecond);
+#endif
+
+BENCHMARK_MAIN();
@@ -0,0 +1,1028 @@
+// Headless batch runner for CI and servers: runs autobuild.sh for every task
+// of a manifest with the GUI's concurrency limit and log layout, and reports
+// progress on stdout as JSON Lines (one object per line). It needs no SDL,
+// ImGui or display; only autobuild_engine.
+//
+// Usage:
+//   autobuild_cli [--settings <file>] [--jobs <n>] [--logs-root <dir>]
+//                 [--script <path>] [--metrics-port <n>] [--verbose]
+//                 [--k8s <context>/<namespace>] [--dry-run] <manifest.json>
+//
+// The manifest is a JSON object:
+//   "tasks"     task directories to run
+//   "root"      a parent folder; every subfolder of it is a task (as the
+//               GUI's Batch Import)
+//   "feedback", "verify", "both", "audit"
+//               runs per task for each mode (default: one feedback run)
+// and may override any of these GUI settings: "max_concurrent_tasks",
+// "api_key", "use_docker_no_cache", "use_image_cache", "use_verify_cache",
+// "use_audit_cache", "use_cli_layer", "use_checkpoint_image",
+// "checkpoint_registry", "use_cache_volumes", "cache_volumes", "workdir_mount",
+// "package_proxy", "package_proxy_url", "container_pool_size",
+// "verify_shards", "max_image_builds", "max_image_pulls", "parallel_both",
+// "logs_root", "host_lease_dir", the "log_staging" and "log_object_store"
+// settings, and name a Kubernetes cluster as "k8s" (as --k8s). Settings are
+// read from the GUI's settings file (or --settings) first, so both share
+// their limits.
+// A logs root on a network filesystem is staged as the GUI stages it (see
+// LogStager): runs write their logs to a local directory, which is shipped
+// to the root in the background, and queued runs wait while the unshipped
+// backlog is over log_staging_backlog_mb. Before it exits the runner waits
+// up to kLogShipFlushSec for the backlog to drain; what is left is shipped
+// by the next runner or GUI that stages the root.
+// With host_lease_dir every run and image build also leases a host-wide slot
+// there (see HostLeasePool), shared with the GUIs and other runners of the
+// host, and waits while those are all taken. The base images
+// of all tasks are pulled up front, max_image_pulls at a time and in
+// manifest order (see BaseImagePuller). With the image cache on, the images
+// of all tasks are built up front, max_image_builds at a time and once per
+// distinct env/ context (see ImageBuildFarm), and each run waits for its
+// task's image.
+// With parallel_both (the default) a "both" run builds its image once and
+// runs feedback and verify at the same time.
+//
+// Events: "plan", "skip" (a task that cannot run a mode), "start", "log"
+// (script output, with --verbose), "phase" (a timed phase of a run that
+// finished: name, ms, exit_code), "container" (a run's container is up:
+// id, name), "image" (the image it runs: id, ref), "end" and a final
+// "staging" (before the summary when the logs root was staged: shipped,
+// backlog bytes and error) and a final "summary". The exit
+// status is 0 when every run succeeded, 1 when any failed and 2 when the
+// manifest or arguments are unusable.
+//
+// With --k8s (or "k8s") every run goes to that cluster as a Kubernetes Job
+// (see k8s_run in autobuild.sh; an empty context is kubectl's current one)
+// and builds its image there, so no images are pulled or built up front.
+// Instead of --jobs, runs start as the cluster has room for their pods, up
+// to kMaxClusterRuns at once (see ClusterGate).
+//
+// With --metrics-port the runner also serves OpenMetrics text at /metrics
+// on that port while it works (running/queued runs, results, run and phase
+// durations, lines and bytes of output, image cache hits), as the GUI does.
+//
+//   autobuild_cli --export-catalog <catalog.jsonl> <out.parquet>
+// appends the runs of a logs root's catalog that finished since the last
+// export to a Parquet file (see ExportRunCatalog) and prints an "export"
+// event with the rows it added; the GUI does the same in the background.
+//
+//   autobuild_cli --follow-log <name> [--new]
+// follows a run's shared-memory log ring (the GUI's share_log_rings; see
+// SharedLogRing) from its oldest line kept, or only new lines with --new:
+// a "line" event per line (text, tag, ms since the epoch), "gap" when the
+// writer overwrote lines before they were read, and "end" once the run is
+// over or its process is gone.
+
+#include "autobuild_engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#else
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+static const char *const kModes[] = {"feedback", "verify", "both", "audit"};
+
+// GUI limits the headless runner shares (see LoadConfig in autobuild_gui.cpp)
+static const int kMaxConcurrentTasks = 20;
+static const int kMaxContainerPool = 8;
+// Runs a cluster takes at once at most, whatever room it has
+static const int kMaxClusterRuns = 512;
+// How long a reading of the cluster's capacity is used
+static const int kClusterProbeSeconds = 10;
+// How long the runner waits at the end for staged logs to be shipped
+static const int kLogShipFlushSec = 5 * 60;
+
+struct CliOptions {
+  std::string settings_path;
+  std::string manifest_path;
+  std::string script = "autobuild/scripts/autobuild.sh";
+  std::string logs_root;
+  std::string api_key;
+  int jobs = 3;
+  int runs[4] = {1, 0, 0, 0};
+  int container_pool_size = 0;
+  int verify_shards = 0;
+  int max_image_builds = 0;
+  int max_image_pulls = 0;
+  bool no_cache = false;
+  bool image_cache = false;
+  bool verify_cache = false;
+  bool audit_cache = false;
+  bool cli_layer = false;
+  std::string cache_volumes = "npm"; // package cache volumes, "" for none
+  std::string workdir_mount;         // tmpfs:<size> or volume; "" for none
+  std::string package_proxy;         // --package-proxy, "" for none
+  bool checkpoint_image = false;
+  std::string checkpoint_registry;
+  bool parallel_both = true;
+  std::string k8s; // "<context>/<namespace>", "" to run on Docker here
+  std::string host_lease_dir; // host-wide slots, "" for none
+  // The GUI's defaults; dir "" = next to the settings file
+  LogStagingSettings staging{LogStaging::Network, "", 2048ull << 20};
+  int metrics_port = 0;
+  bool verbose = false;
+  bool dry_run = false;
+  // This executable, which writes build context archives for the script
+  // (see CONTEXT_TOOL in autobuild.sh); "" when it cannot be located
+  std::string self;
+};
+
+struct CliRun {
+  int id = 0;
+  int mode = 0;
+  std::string task;
+  std::string command;
+};
+
+// Totals behind --metrics-port, updated by the workers
+struct CliMetrics {
+  struct Total {
+    double seconds = 0.0;
+    uint64_t count = 0;
+  };
+  std::atomic<int> running{0};
+  std::atomic<int> queued{0};
+  std::atomic<uint64_t> lines{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> image_cache_hits{0};
+  std::atomic<uint64_t> image_cache_misses{0};
+  std::mutex mutex; // guards the rest
+  uint64_t passed = 0;
+  uint64_t failed = 0;
+  std::map<std::string, Total> run_seconds;   // by mode
+  std::map<std::string, Total> phase_seconds; // by timed phase
+};
+
+static CliMetrics g_metrics;
+
+static std::string RenderMetrics() {
+  MetricsWriter out;
+  out.Family("autobuild_tasks_running", "gauge", "Runs in progress")
+      .Sample("", g_metrics.running.load());
+  out.Family("autobuild_tasks_queued", "gauge", "Runs waiting for a slot")
+      .Sample("", g_metrics.queued.load());
+  {
+    std::lock_guard<std::mutex> lock(g_metrics.mutex);
+    out.Family("autobuild_runs", "counter", "Finished runs by result")
+        .Sample("_total", (double)g_metrics.passed,
+                MetricLabel("result", "pass"))
+        .Sample("_total", (double)g_metrics.failed,
+                MetricLabel("result", "fail"));
+    out.Family("autobuild_run_duration_seconds", "summary",
+               "Wall time of finished runs by mode");
+    for (const auto &kv : g_metrics.run_seconds) {
+      std::string label = MetricLabel("mode", kv.first);
+      out.Sample("_sum", kv.second.seconds, label)
+          .Sample("_count", (double)kv.second.count, label);
+    }
+    out.Family("autobuild_phase_duration_seconds", "summary",
+               "Time spent in each timed phase of finished runs");
+    for (const auto &kv : g_metrics.phase_seconds) {
+      std::string label = MetricLabel("phase", kv.first);
+      out.Sample("_sum", kv.second.seconds, label)
+          .Sample("_count", (double)kv.second.count, label);
+    }
+  }
+  out.Family("autobuild_log_lines", "counter", "Output lines ingested")
+      .Sample("_total", (double)g_metrics.lines.load());
+  out.Family("autobuild_log_bytes", "counter", "Output bytes ingested")
+      .Sample("_total", (double)g_metrics.bytes.load());
+  out.Family("autobuild_image_cache_hits", "counter",
+             "Runs that reused a built or cached image")
+      .Sample("_total", (double)g_metrics.image_cache_hits.load());
+  out.Family("autobuild_image_cache_misses", "counter",
+             "Runs that had to build their image")
+      .Sample("_total", (double)g_metrics.image_cache_misses.load());
+  return out.Finish();
+}
+
+// stdout is shared by every worker; one event per line, written whole
+static std::mutex g_emit_mutex;
+
+static void Emit(JsonWriter &json) {
+  std::string line = json.Finish();
+  std::lock_guard<std::mutex> lock(g_emit_mutex);
+  fwrite(line.data(), 1, line.size(), stdout);
+  fflush(stdout);
+}
+
+static void Fail(const std::string &message) {
+  JsonWriter json(true);
+  Emit(json.String("event", "error").String("message", message));
+}
+
+static bool ReadJson(const std::string &path, JsonValue &root) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  root = JsonValue();
+  return JsonParser(content).Parse(root) && root.type == JsonValue::Object;
+}
+
+// Where the GUI keeps its settings (see GetConfigFilePath); installed
+// builds only, a development build next to its executable is not searched
+static std::string DefaultSettingsPath() {
+#ifdef _WIN32
+  const char *appdata = getenv("APPDATA");
+  return appdata ? std::string(appdata) + "\\Autobuild\\autobuild_gui.json"
+                 : std::string();
+#elif defined(__APPLE__)
+  const char *home = getenv("HOME");
+  return home ? std::string(home) +
+                    "/Library/Application Support/Autobuild/autobuild_gui.json"
+              : std::string();
+#else
+  const char *xdg_config = getenv("XDG_CONFIG_HOME");
+  if (xdg_config && xdg_config[0] != '\0')
+    return std::string(xdg_config) + "/autobuild/autobuild_gui.json";
+  const char *home = getenv("HOME");
+  return home ? std::string(home) + "/.config/autobuild/autobuild_gui.json"
+              : std::string();
+#endif
+}
+
+// Settings shared with the GUI, from its settings file or a manifest
+static void ApplySettings(const JsonValue &root, CliOptions &opts) {
+  opts.jobs = std::max(
+      1, std::min(kMaxConcurrentTasks,
+                  root.GetInt("max_concurrent_tasks", opts.jobs)));
+  int pool = root.GetInt("container_pool_size", opts.container_pool_size);
+  opts.container_pool_size = std::max(0, std::min(kMaxContainerPool, pool));
+  opts.verify_shards = std::max(
+      0, std::min(16, root.GetInt("verify_shards", opts.verify_shards)));
+  opts.max_image_builds = std::max(
+      0, std::min(64, root.GetInt("max_image_builds", opts.max_image_builds)));
+  opts.max_image_pulls = std::max(
+      0, std::min(16, root.GetInt("max_image_pulls", opts.max_image_pulls)));
+  opts.no_cache = root.GetBool("use_docker_no_cache", opts.no_cache);
+  opts.image_cache = root.GetBool("use_image_cache", opts.image_cache);
+  opts.verify_cache = root.GetBool("use_verify_cache", opts.verify_cache);
+  opts.audit_cache = root.GetBool("use_audit_cache", opts.audit_cache);
+  opts.cli_layer = root.GetBool("use_cli_layer", opts.cli_layer);
+  // Switching the volumes back on without a list means the npm cache
+  bool cache_volumes =
+      root.GetBool("use_cache_volumes", !opts.cache_volumes.empty());
+  std::string volumes = root.GetString("cache_volumes");
+  if (!volumes.empty())
+    opts.cache_volumes = volumes;
+  else if (cache_volumes && opts.cache_volumes.empty())
+    opts.cache_volumes = "npm";
+  if (!cache_volumes)
+    opts.cache_volumes.clear();
+  std::string mount = root.GetString("workdir_mount");
+  if (!mount.empty())
+    opts.workdir_mount = mount;
+  // Runs go to this host's Docker, which starts the proxy for either mode
+  if (root.Find("package_proxy"))
+    opts.package_proxy =
+        PackageProxySpec(root.GetInt("package_proxy", 0),
+                         root.GetString("package_proxy_url"), true);
+  opts.checkpoint_image =
+      root.GetBool("use_checkpoint_image", opts.checkpoint_image);
+  std::string registry = root.GetString("checkpoint_registry");
+  if (!registry.empty())
+    opts.checkpoint_registry = registry;
+  opts.parallel_both = root.GetBool("parallel_both", opts.parallel_both);
+  std::string api_key = root.GetString("api_key");
+  if (!api_key.empty())
+    opts.api_key = api_key;
+  std::string k8s = root.GetString("k8s");
+  if (!k8s.empty())
+    opts.k8s = k8s;
+  std::string lease_dir = root.GetString("host_lease_dir");
+  if (!lease_dir.empty())
+    opts.host_lease_dir = lease_dir;
+  std::string logs_root = root.GetString("logs_root");
+  std::vector<std::string> folders = root.GetStrings("log_folder_paths");
+  int selected = root.GetInt("selected_log_folder", 0);
+  if (logs_root.empty() && !folders.empty())
+    logs_root = folders[selected >= 0 && selected < (int)folders.size()
+                            ? selected
+                            : 0];
+  if (!logs_root.empty())
+    opts.logs_root = logs_root;
+  std::string staging = root.GetString("log_staging");
+  if (!staging.empty())
+    opts.staging.mode = staging == "off"      ? LogStaging::Off
+                        : staging == "always" ? LogStaging::Always
+                                              : LogStaging::Network;
+  std::string staging_dir = root.GetString("log_staging_dir");
+  if (!staging_dir.empty())
+    opts.staging.dir = staging_dir;
+  int backlog_mb = root.GetInt("log_staging_backlog_mb",
+                               (int)(opts.staging.backlog_limit >> 20));
+  opts.staging.backlog_limit =
+      (uint64_t)std::max(0, std::min(1 << 20, backlog_mb)) << 20;
+  if (root.Find("log_object_store"))
+    opts.staging.object_store = root.GetString("log_object_store");
+  if (root.Find("log_object_store_endpoint"))
+    opts.staging.endpoint = root.GetString("log_object_store_endpoint");
+  if (root.Find("log_object_store_region"))
+    opts.staging.region = root.GetString("log_object_store_region");
+}
+
+// One shell word, quoted for the shell popen runs the command with
+static std::string ShellQuote(const std::string &s) {
+#ifdef _WIN32
+  return "\"" + s + "\"";
+#else
+  std::string out = "'";
+  for (char c : s)
+    out += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  return out + "'";
+#endif
+}
+
+// Task directories of the manifest: "tasks" as listed, then every
+// subfolder of "root" in name order
+static std::vector<std::string> ManifestTasks(const JsonValue &manifest) {
+  std::vector<std::string> tasks = manifest.GetStrings("tasks");
+  std::string root = manifest.GetString("root");
+  while (root.size() > 1 && (root.back() == '/' || root.back() == '\\'))
+    root.pop_back();
+  if (root.empty())
+    return tasks;
+  std::vector<std::string> names;
+  DIR *d = opendir(root.c_str());
+  if (d) {
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+      if (e->d_name[0] != '.' && IsDirectory(root + "/" + e->d_name))
+        names.push_back(e->d_name);
+    }
+    closedir(d);
+  }
+  std::sort(names.begin(), names.end());
+  for (const auto &name : names)
+    tasks.push_back(root + "/" + name);
+  return tasks;
+}
+
+// What the Dockerfile analysis found: the image cache key and, for a run,
+// the container workdir (the script's own guess only reads WORKDIR lines);
+// and the tool that narrows the build context to what the Dockerfile reads
+static void AppendDockerfileArgs(const CliOptions &opts,
+                                 const TaskValidation &task, bool run,
+                                 std::string &cmd) {
+  if (!opts.self.empty())
+    cmd += " --context-tool " + ShellQuote(opts.self);
+  if (task.context_hash != 0) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             (unsigned long long)task.context_hash);
+    cmd += std::string(" --context-hash ") + hash;
+  }
+  if (run && !task.workdir.empty())
+    cmd += " --workdir " + ShellQuote(task.workdir);
+}
+
+static std::string BuildRunCommand(const CliOptions &opts,
+                                   const TaskValidation &task, int mode,
+                                   bool share_image) {
+  std::string cmd;
+  // As the GUI does: the environment, so a task's workdir_mount file wins
+  if (!opts.workdir_mount.empty())
+    cmd = "AUTOBUILD_WORKDIR_MOUNT=" + ShellQuote(opts.workdir_mount) + " ";
+  // The requests ClusterGate counts runs by
+  if (!opts.k8s.empty()) {
+    char cpus[32];
+    snprintf(cpus, sizeof(cpus), "%g", kClusterRunCpus);
+    cmd += "AUTOBUILD_K8S=" + ShellQuote(opts.k8s) + " AUTOBUILD_K8S_CPUS=" +
+           cpus + " AUTOBUILD_K8S_MEMORY=" + std::to_string(kClusterRunMib) +
+           " ";
+  }
+  cmd += "bash " + ShellQuote(opts.script) + " " + kModes[mode];
+  cmd += " --task " + ShellQuote(task.task_dir);
+  // Both: feedback and verify side by side from one image build
+  if (mode == 2 && opts.parallel_both)
+    cmd += " --parallel";
+  if (!opts.api_key.empty())
+    cmd += " --api-key " + ShellQuote(opts.api_key);
+  if (opts.no_cache)
+    cmd += " --no-cache";
+  // Runs of one task build the same image; build it once between them
+  if (share_image)
+    cmd += " --reuse-image";
+  if (opts.image_cache)
+    cmd += " --image-cache";
+  if (opts.verify_cache && mode != 3)
+    cmd += " --verify-cache";
+  if (opts.audit_cache && mode == 3)
+    cmd += " --audit-cache";
+  if (opts.verify_shards > 1 && mode != 3)
+    cmd += " --verify-shards " + std::to_string(opts.verify_shards);
+  if (opts.cli_layer)
+    cmd += " --cli-layer";
+  if (!opts.cache_volumes.empty())
+    cmd += " --cache-volumes " + ShellQuote(opts.cache_volumes);
+  if (!opts.package_proxy.empty())
+    cmd += " --package-proxy " + ShellQuote(opts.package_proxy);
+  // Verify runs start from the plain image, as the customer's would
+  if (opts.checkpoint_image && mode != 1) {
+    if (opts.checkpoint_registry.empty())
+      cmd += " --checkpoint-image";
+    else
+      cmd += " --checkpoint-registry " + ShellQuote(opts.checkpoint_registry);
+  }
+  if (opts.container_pool_size > 0)
+    cmd += " --container-pool " + std::to_string(opts.container_pool_size);
+  if (task.missing_items.empty())
+    cmd += " --validated";
+  AppendDockerfileArgs(opts, task, true, cmd);
+  return cmd + " 2>&1";
+}
+
+// autobuild.sh build for a task: its image (and CLI layer) alone, for the
+// build farm
+static std::string BuildImageCommand(const CliOptions &opts,
+                                     const TaskValidation &task) {
+  std::string cmd = "bash " + ShellQuote(opts.script) + " build";
+  cmd += " --task " + ShellQuote(task.task_dir);
+  if (opts.no_cache)
+    cmd += " --no-cache";
+  if (opts.cli_layer)
+    cmd += " --cli-layer";
+  if (!opts.package_proxy.empty())
+    cmd += " --package-proxy " + ShellQuote(opts.package_proxy);
+  AppendDockerfileArgs(opts, task, false, cmd);
+  return cmd + " 2>&1";
+}
+
+// Tally what a script line says about the image cache
+static void CountImageCacheLine(const std::string &line) {
+  if (line.find("Reusing image built by another run:") != std::string::npos ||
+      line.find("Using cached image") != std::string::npos)
+    g_metrics.image_cache_hits++;
+  else if (line.find("Building image:") != std::string::npos)
+    g_metrics.image_cache_misses++;
+}
+
+// Build farm side of a build: run the command, keeping only the image cache
+// counts of its output
+static bool ExecuteBuild(const std::string &command) {
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe)
+    return false;
+  char buf[4096];
+  std::string line;
+  while (fgets(buf, sizeof(buf), pipe)) {
+    line += buf;
+    if (line.back() != '\n')
+      continue;
+    CountImageCacheLine(line);
+    line.clear();
+  }
+  return pclose(pipe) == 0;
+}
+
+// Base puller side of a pull: nothing to do when the image is already here
+static bool ExecutePull(const std::string &image) {
+  std::string quoted = ShellQuote(image);
+  std::string cmd = "docker image inspect " + quoted +
+                    " >/dev/null 2>&1 || docker pull -q " + quoted +
+                    " >/dev/null 2>&1";
+  return system(cmd.c_str()) == 0;
+}
+
+// Run one script to completion, reporting its timed phases as "phase"
+// events, its container and image events as they are, and forwarding the
+// rest of its output as "log" events when verbose; returns its exit status
+// (-1 when it could not be started)
+static int ExecuteRun(const CliRun &run, bool verbose) {
+  FILE *pipe = popen(run.command.c_str(), "r");
+  if (!pipe)
+    return -1;
+  char buf[4096];
+  std::string line;
+  std::vector<PhaseTiming> timeline;
+  ScriptEvent event;
+  while (fgets(buf, sizeof(buf), pipe)) {
+    line += buf;
+    if (line.back() != '\n')
+      continue;
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+      line.pop_back();
+    g_metrics.lines++;
+    g_metrics.bytes += line.size();
+    CountImageCacheLine(line);
+    // Phases do not nest, so an end marker closes the newest open phase
+    int open = -1;
+    for (int i = (int)timeline.size() - 1; i >= 0 && open < 0; i--)
+      if (timeline[i].end_ms == 0)
+        open = i;
+    if (ApplyTimingMarker(line, timeline)) {
+      if (open >= 0 && timeline[open].end_ms != 0) {
+        const PhaseTiming &phase = timeline[open];
+        {
+          std::lock_guard<std::mutex> lock(g_metrics.mutex);
+          CliMetrics::Total &total = g_metrics.phase_seconds[phase.name];
+          total.seconds += (phase.end_ms - phase.start_ms) / 1000.0;
+          total.count++;
+        }
+        JsonWriter json(true);
+        Emit(json.String("event", "phase")
+                 .Number("run", run.id)
+                 .String("name", phase.name)
+                 .Number("ms", phase.end_ms - phase.start_ms)
+                 .Number("exit_code", phase.exit_code));
+      }
+    } else if (ParseScriptEvent(line, event)) {
+      if (event.kind == "container" || event.kind == "image") {
+        JsonWriter json(true);
+        Emit(json.String("event", event.kind)
+                 .Number("run", run.id)
+                 .String("id", event.field)
+                 .String(event.kind == "image" ? "ref" : "name",
+                         event.value));
+      }
+    } else if (verbose) {
+      JsonWriter json(true);
+      Emit(json.String("event", "log").Number("run", run.id).String("line",
+                                                                    line));
+    }
+    line.clear();
+  }
+  int status = pclose(pipe);
+#ifdef _WIN32
+  return status;
+#else
+  if (status == -1)
+    return -1;
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+#endif
+}
+
+// Parse the JSON a command prints; false when it fails or prints none
+static bool ReadCommandJson(const std::string &command, JsonValue &out) {
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe)
+    return false;
+  std::string text;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0)
+    text.append(buf, n);
+  int status = pclose(pipe);
+  out = JsonValue();
+  return status == 0 && JsonParser(text).Parse(out) &&
+         out.type == JsonValue::Object;
+}
+
+// Admission of runs to the --k8s cluster: a run starts once the cluster's
+// nodes have room for its pod (see ClusterFreeRuns). The capacity is read
+// again at most every kClusterProbeSeconds, and the runs started since a
+// reading are counted against it. A cluster kubectl cannot read admits
+// every run; their Jobs then wait in the cluster and the scripts report it.
+class ClusterGate {
+public:
+  explicit ClusterGate(const KubeTarget &target) : target_(target) {}
+
+  void Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      auto now = std::chrono::steady_clock::now();
+      if (!read_ ||
+          now - read_at_ >= std::chrono::seconds(kClusterProbeSeconds)) {
+        JsonValue nodes, pods;
+        ClusterCapacity capacity;
+        bool ok = ReadCommandJson(KubeNodesCommand(target_), nodes) &&
+                  ReadCommandJson(KubePodsCommand(target_), pods) &&
+                  ReadClusterCapacity(nodes, pods, capacity);
+        if (!ok && (!read_ || ok_))
+          Fail("Cannot read the capacity of cluster " +
+               KubeScriptTarget(target_) + "; starting runs regardless");
+        ok_ = ok;
+        free_ = ok ? ClusterFreeRuns(capacity, kClusterRunCpus,
+                                     kClusterRunMib)
+                   : 0;
+        started_ = 0;
+        read_ = true;
+        read_at_ = now;
+      }
+      if (!ok_ || started_ < free_) {
+        started_++;
+        return;
+      }
+      lock.unlock();
+      std::this_thread::sleep_for(std::chrono::seconds(2));
+      lock.lock();
+    }
+  }
+
+private:
+  KubeTarget target_;
+  std::mutex mutex_;
+  bool read_ = false;
+  bool ok_ = false;
+  std::chrono::steady_clock::time_point read_at_;
+  int free_ = 0;    // runs the last reading had room for
+  int started_ = 0; // since then
+};
+
+static void Usage() {
+  fprintf(stderr,
+          "Usage: autobuild_cli [--settings <file>] [--jobs <n>] "
+          "[--logs-root <dir>] [--script <path>] [--metrics-port <n>] "
+          "[--verbose] [--k8s <context>/<namespace>] [--dry-run] "
+          "<manifest.json>\n"
+          "       autobuild_cli --export-catalog <catalog.jsonl> "
+          "<out.parquet>\n"
+          "       autobuild_cli --follow-log <name> [--new]\n");
+}
+
+// --follow-log: the lines of a shared log ring as events, a batch of them
+// per write
+static int FollowLogRing(const std::string &name, bool from_start) {
+  SharedLogReader reader;
+  if (!reader.Open(name, from_start)) {
+    Fail("No log ring named " + name);
+    return 1;
+  }
+  uint64_t missed = 0;
+#ifndef _WIN32
+  auto checked = std::chrono::steady_clock::now();
+#endif
+  std::string batch;
+  for (;;) {
+    size_t lines = reader.Poll([&](std::string_view text, uint8_t tag,
+                                   int64_t ms) {
+      JsonWriter json(true);
+      batch += json.String("event", "line")
+                   .String("text", std::string(text))
+                   .Number("tag", tag)
+                   .Number("ms", (long long)ms)
+                   .Finish();
+    });
+    if (reader.Missed() != missed) {
+      JsonWriter json(true);
+      batch += json.String("event", "gap")
+                   .Number("lines", (long long)(reader.Missed() - missed))
+                   .Finish();
+      missed = reader.Missed();
+    }
+    if (!batch.empty()) {
+      std::lock_guard<std::mutex> lock(g_emit_mutex);
+      fwrite(batch.data(), 1, batch.size(), stdout);
+      fflush(stdout);
+      batch.clear();
+    }
+    if (reader.Done())
+      break;
+    if (lines > 0)
+      continue;
+#ifndef _WIN32
+    // A writer that died never closes its ring
+    auto now = std::chrono::steady_clock::now();
+    if (now - checked >= std::chrono::seconds(1)) {
+      checked = now;
+      if (kill((pid_t)reader.WriterPid(), 0) != 0 && errno == ESRCH)
+        break;
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  JsonWriter json(true);
+  Emit(json.String("event", "end").Number("missed", (long long)missed));
+  return 0;
+}
+
+static bool ParseArgs(int argc, char **argv, CliOptions &opts, int &jobs,
+                      std::string &logs_root, std::string &k8s) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--settings" && has_value) {
+      opts.settings_path = argv[++i];
+    } else if (arg == "--jobs" && has_value) {
+      jobs = atoi(argv[++i]);
+    } else if (arg == "--logs-root" && has_value) {
+      logs_root = argv[++i];
+    } else if (arg == "--script" && has_value) {
+      opts.script = argv[++i];
+    } else if (arg == "--metrics-port" && has_value) {
+      opts.metrics_port = atoi(argv[++i]);
+    } else if (arg == "--k8s" && has_value) {
+      k8s = argv[++i];
+    } else if (arg == "--verbose") {
+      opts.verbose = true;
+    } else if (arg == "--dry-run") {
+      opts.dry_run = true;
+    } else if (arg[0] != '-' && opts.manifest_path.empty()) {
+      opts.manifest_path = arg;
+    } else {
+      return false;
+    }
+  }
+  return !opts.manifest_path.empty();
+}
+
+int main(int argc, char **argv) {
+  // Called back by autobuild.sh (see CONTEXT_TOOL there)
+  if (argc == 4 && strcmp(argv[1], "--context-tar") == 0) {
+    std::string tar = CacheDockerContextTar(argv[2], argv[3]);
+    if (tar.empty())
+      return 1;
+    printf("%s\n", tar.c_str());
+    return 0;
+  }
+  if ((argc == 3 || (argc == 4 && strcmp(argv[3], "--new") == 0)) &&
+      strcmp(argv[1], "--follow-log") == 0)
+    return FollowLogRing(argv[2], argc == 3);
+  if (argc == 4 && strcmp(argv[1], "--export-catalog") == 0) {
+    long long now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+    CatalogExportResult result;
+    if (!ExportRunCatalog(argv[2], argv[3], now, result)) {
+      Fail(result.error);
+      return 1;
+    }
+    JsonWriter json(true);
+    Emit(json.String("event", "export")
+             .Number("rows", (long long)result.rows)
+             .Number("total_rows", (long long)result.total_rows));
+    return 0;
+  }
+
+  CliOptions opts;
+  int jobs = 0;
+  std::string logs_root, k8s;
+  if (!ParseArgs(argc, argv, opts, jobs, logs_root, k8s)) {
+    Usage();
+    return 2;
+  }
+
+  JsonValue settings;
+  std::string settings_path =
+      opts.settings_path.empty() ? DefaultSettingsPath() : opts.settings_path;
+  if (!settings_path.empty() && ReadJson(settings_path, settings)) {
+    ApplySettings(settings, opts);
+  } else if (!opts.settings_path.empty()) {
+    Fail("Cannot read settings file: " + opts.settings_path);
+    return 2;
+  }
+
+  JsonValue manifest;
+  if (!ReadJson(opts.manifest_path, manifest)) {
+    Fail("Cannot read manifest: " + opts.manifest_path);
+    return 2;
+  }
+  ApplySettings(manifest, opts);
+  for (int mode = 0; mode < 4; mode++)
+    opts.runs[mode] = std::max(0, manifest.GetInt(kModes[mode],
+                                                  mode == 0 ? 1 : 0));
+  // The command line has the last word
+  if (jobs > 0)
+    opts.jobs = std::min(jobs, kMaxConcurrentTasks);
+  if (!logs_root.empty())
+    opts.logs_root = logs_root;
+  if (!k8s.empty())
+    opts.k8s = k8s;
+#ifndef _WIN32
+  if (char *self = realpath("/proc/self/exe", nullptr)) {
+    opts.self = self;
+    free(self);
+  } else if (char *path = realpath(argv[0], nullptr)) {
+    // No /proc; argv[0] is a path when the runner was not found on PATH
+    if (strchr(argv[0], '/'))
+      opts.self = path;
+    free(path);
+  }
+#endif
+  KubeTarget cluster;
+  if (!opts.k8s.empty() &&
+      !ParseKubeEndpoint(std::string(kKubeScheme) + opts.k8s, cluster)) {
+    Fail("Unusable Kubernetes target: " + opts.k8s);
+    return 2;
+  }
+  // Runs write a network root's logs locally; stager ships them
+  LogStager stager;
+  std::string run_logs_root = opts.logs_root;
+  bool staged = false;
+  if (!opts.logs_root.empty() && !opts.dry_run &&
+      opts.staging.mode != LogStaging::Off) {
+    if (opts.staging.dir.empty() && !settings_path.empty()) {
+      size_t slash = settings_path.find_last_of("/\\");
+      opts.staging.dir = (slash == std::string::npos
+                              ? std::string()
+                              : settings_path.substr(0, slash + 1)) +
+                         "log_staging";
+    }
+    stager.Configure(opts.staging);
+    run_logs_root = stager.Stage(opts.logs_root);
+    staged = run_logs_root != opts.logs_root;
+  }
+  if (!run_logs_root.empty()) {
+#ifdef _WIN32
+    _putenv_s("AUTOBUILD_LOGS_ROOT", run_logs_root.c_str());
+#else
+    setenv("AUTOBUILD_LOGS_ROOT", run_logs_root.c_str(), 1);
+#endif
+  }
+
+  // Validate every task up front, on as many threads as runs may start
+  std::vector<std::string> dirs = ManifestTasks(manifest);
+  std::vector<TaskValidation> tasks(dirs.size());
+  {
+    std::atomic<size_t> next{0};
+    auto work = [&]() {
+      size_t i;
+      while ((i = next++) < dirs.size())
+        tasks[i] = ValidateTaskDirectory(dirs[i]);
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < std::min<int>(opts.jobs, (int)dirs.size()); i++)
+      pool.emplace_back(work);
+    work();
+    for (auto &t : pool)
+      t.join();
+  }
+
+  std::vector<CliRun> runs;
+  int skipped = 0;
+  for (const auto &task : tasks) {
+    int total = 0;
+    for (int mode = 0; mode < 4; mode++)
+      total += TaskRunnable(task, mode) ? opts.runs[mode] : 0;
+    for (int mode = 0; mode < 4; mode++) {
+      if (opts.runs[mode] <= 0)
+        continue;
+      if (!TaskRunnable(task, mode)) {
+        JsonWriter json(true);
+        Emit(json.String("event", "skip")
+                 .String("task", task.task_dir)
+                 .String("mode", kModes[mode])
+                 .StringArray("missing", task.missing_items));
+        skipped++;
+        continue;
+      }
+      for (int i = 0; i < opts.runs[mode]; i++) {
+        CliRun run;
+        run.id = (int)runs.size() + 1;
+        run.mode = mode;
+        run.task = task.task_dir;
+        run.command = BuildRunCommand(opts, task, mode, total > 1);
+        runs.push_back(std::move(run));
+      }
+    }
+  }
+  {
+    JsonWriter json(true);
+    Emit(json.String("event", "plan")
+             .Number("tasks", (long long)tasks.size())
+             .Number("runs", (long long)runs.size())
+             .Number("skipped", skipped)
+             .Number("jobs", opts.k8s.empty() ? opts.jobs : kMaxClusterRuns)
+             .String("logs_root", opts.logs_root)
+             .String("k8s", opts.k8s)
+             .Bool("dry_run", opts.dry_run));
+  }
+
+  MetricsServer metrics;
+  if (opts.metrics_port > 0 &&
+      !metrics.Start(opts.metrics_port, RenderMetrics)) {
+    Fail("Cannot listen on metrics port " +
+         std::to_string(opts.metrics_port));
+    return 2;
+  }
+  g_metrics.queued = (int)runs.size();
+
+  // Pull every task's base images ahead of its build, first task first
+  BaseImagePuller puller([](const std::string &image, std::atomic<bool> &) {
+    return ExecutePull(image);
+  });
+  if (!opts.dry_run && opts.k8s.empty()) {
+    std::vector<std::string> dirs;
+    for (const auto &task : tasks)
+      if (TaskRunnable(task, 3))
+        dirs.push_back(task.task_dir);
+    puller.Configure(opts.max_image_pulls);
+    puller.Schedule(dirs);
+  }
+
+  // The host-wide slots of runs and image builds on this Docker host; a run
+  // holds its slot through all of its stages
+  HostLeasePool host_runs("runs"), host_builds("build");
+  if (opts.k8s.empty()) {
+    host_runs.Configure(opts.host_lease_dir, opts.jobs);
+    host_builds.Configure(opts.host_lease_dir, opts.max_image_builds);
+  }
+
+  // Build every task's image ahead of its runs; builds are not interrupted,
+  // the runner always works through the whole manifest
+  ImageBuildFarm farm(
+      [&host_builds](const std::string &command, std::atomic<bool> &) {
+        HostLease lease;
+        host_builds.Acquire(lease);
+        return ExecuteBuild(command);
+      });
+  if (opts.image_cache && !opts.dry_run && opts.k8s.empty()) {
+    farm.Configure(opts.max_image_builds);
+    for (const auto &task : tasks) {
+      if (TaskRunnable(task, 3))
+        farm.Request(task.task_dir, BuildImageCommand(opts, task));
+    }
+  }
+
+  // Up to jobs runs at once (or as many as the cluster has room for),
+  // started in manifest order
+  ClusterGate gate(cluster);
+  std::atomic<size_t> next{0};
+  std::atomic<int> failed{0};
+  auto worker = [&]() {
+    size_t i;
+    while ((i = next++) < runs.size()) {
+      const CliRun &run = runs[i];
+      if (!opts.dry_run && !opts.k8s.empty())
+        gate.Acquire();
+      {
+        JsonWriter json(true);
+        json.String("event", "start")
+            .Number("run", run.id)
+            .String("task", run.task)
+            .String("mode", kModes[run.mode]);
+        if (opts.dry_run)
+          json.String("command", run.command);
+        Emit(json);
+      }
+      g_metrics.queued--;
+      if (opts.dry_run)
+        continue;
+      // A failed build is left to the run, which reports it
+      farm.Wait(run.task);
+      while (stager.Backlogged())
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+      HostLease lease;
+      host_runs.Acquire(lease);
+      g_metrics.running++;
+      auto started = std::chrono::steady_clock::now();
+      int status = ExecuteRun(run, opts.verbose);
+      double elapsed = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - started)
+                           .count();
+      long long seconds = (long long)elapsed;
+      g_metrics.running--;
+      if (status != 0)
+        failed++;
+      {
+        std::lock_guard<std::mutex> lock(g_metrics.mutex);
+        (status == 0 ? g_metrics.passed : g_metrics.failed)++;
+        CliMetrics::Total &total = g_metrics.run_seconds[kModes[run.mode]];
+        total.seconds += elapsed;
+        total.count++;
+      }
+      JsonWriter json(true);
+      Emit(json.String("event", "end")
+               .Number("run", run.id)
+               .String("task", run.task)
+               .String("mode", kModes[run.mode])
+               .Number("exit_code", status)
+               .Number("seconds", seconds));
+    }
+  };
+  std::vector<std::thread> pool;
+  int workers = opts.k8s.empty() ? opts.jobs : kMaxClusterRuns;
+  for (int i = 0; i < std::min<int>(workers, (int)runs.size()); i++)
+    pool.emplace_back(worker);
+  for (auto &t : pool)
+    t.join();
+
+  if (staged) {
+    bool shipped = stager.Flush(kLogShipFlushSec * 1000);
+    LogStager::Status status = stager.GetStatus();
+    JsonWriter json(true);
+    Emit(json.String("event", "staging")
+             .Bool("shipped", shipped)
+             .Number("backlog", (long long)status.backlog)
+             .String("error", status.error));
+  }
+
+  JsonWriter json(true);
+  Emit(json.String("event", "summary")
+           .Number("runs", (long long)runs.size())
+           .Number("failed", failed.load())
+           .Number("skipped", skipped));
+  return failed > 0 ? 1 : 0;
+}
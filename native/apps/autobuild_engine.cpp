@@ -0,0 +1,16243 @@
+// UI-independent parts of autobuild; see autobuild_engine.h
+
+#include "autobuild_engine.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <dirent.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||          \
+    defined(_M_IX86)
+#define AUTOBUILD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define AUTOBUILD_NEON 1
+#include <arm_neon.h>
+#endif
+#ifdef _WIN32
+#include <direct.h>
+#include <winsock2.h>
+#include <afunix.h>
+#include <io.h>
+#include <windows.h>
+#include <tlhelp32.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#elif defined(__APPLE__)
+#include <CoreServices/CoreServices.h>
+#include <libproc.h>
+#include <mach/mach.h>
+#include <sys/event.h>
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#endif
+#endif
+
+// Optional zstd for the dashboard's compressed event stream
+#ifdef AUTOBUILD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                          JSON                         //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+bool JsonParser::Parse(JsonValue &out) {
+  if (!Value(out, 0))
+    return false;
+  SkipSpace();
+  return pos_ == s_.size();
+}
+
+void JsonParser::SkipSpace() {
+  while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' ||
+                              s_[pos_] == '\n' || s_[pos_] == '\r'))
+    pos_++;
+}
+
+bool JsonParser::Literal(const char *word) {
+  size_t n = strlen(word);
+  if (s_.compare(pos_, n, word) != 0)
+    return false;
+  pos_ += n;
+  return true;
+}
+
+bool JsonParser::Hex4(unsigned &out) {
+  if (pos_ + 4 > s_.size())
+    return false;
+  out = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = s_[pos_++];
+    out <<= 4;
+    if (c >= '0' && c <= '9')
+      out |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      out |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      out |= c - 'A' + 10;
+    else
+      return false;
+  }
+  return true;
+}
+
+void JsonParser::AppendUtf8(std::string &out, unsigned cp) {
+  if (cp < 0x80) {
+    out += (char)cp;
+  } else if (cp < 0x800) {
+    out += (char)(0xC0 | (cp >> 6));
+    out += (char)(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += (char)(0xE0 | (cp >> 12));
+    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  } else {
+    out += (char)(0xF0 | (cp >> 18));
+    out += (char)(0x80 | ((cp >> 12) & 0x3F));
+    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  }
+}
+
+bool JsonParser::StringBody(std::string &out) {
+  pos_++; // opening quote
+  while (pos_ < s_.size()) {
+    // Copy the run up to the next quote or escape in one go
+    size_t run =
+        pos_ + FindEither(s_.data() + pos_, s_.size() - pos_, '"', '\\');
+    out.append(s_.data() + pos_, run - pos_);
+    pos_ = run;
+    if (pos_ >= s_.size())
+      return false;
+    char c = s_[pos_++];
+    if (c == '"')
+      return true;
+    if (pos_ >= s_.size())
+      return false;
+    char e = s_[pos_++];
+    switch (e) {
+    case '"':
+    case '\\':
+    case '/':
+      out += e;
+      break;
+    case 'b':
+      out += '\b';
+      break;
+    case 'f':
+      out += '\f';
+      break;
+    case 'n':
+      out += '\n';
+      break;
+    case 'r':
+      out += '\r';
+      break;
+    case 't':
+      out += '\t';
+      break;
+    case 'u': {
+      unsigned cp = 0;
+      if (!Hex4(cp))
+        return false;
+      // A high surrogate must be followed by a low one; anything else,
+      // a lone low surrogate included, is not a code point
+      if (cp >= 0xDC00 && cp < 0xE000)
+        return false;
+      if (cp >= 0xD800 && cp < 0xDC00) {
+        if (s_.compare(pos_, 2, "\\u") != 0)
+          return false;
+        pos_ += 2;
+        unsigned lo = 0;
+        if (!Hex4(lo) || lo < 0xDC00 || lo >= 0xE000)
+          return false;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+      }
+      AppendUtf8(out, cp);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  return false;
+}
+
+bool JsonParser::Value(JsonValue &out, int depth) {
+  if (depth > 64)
+    return false;
+  SkipSpace();
+  if (pos_ >= s_.size())
+    return false;
+  char c = s_[pos_];
+  if (c == '{') {
+    out.type = JsonValue::Object;
+    pos_++;
+    SkipSpace();
+    if (pos_ < s_.size() && s_[pos_] == '}') {
+      pos_++;
+      return true;
+    }
+    while (true) {
+      SkipSpace();
+      if (pos_ >= s_.size() || s_[pos_] != '"')
+        return false;
+      std::string key;
+      if (!StringBody(key))
+        return false;
+      SkipSpace();
+      if (pos_ >= s_.size() || s_[pos_] != ':')
+        return false;
+      pos_++;
+      out.keys.push_back(std::move(key));
+      out.items.emplace_back();
+      if (!Value(out.items.back(), depth + 1))
+        return false;
+      SkipSpace();
+      if (pos_ < s_.size() && s_[pos_] == ',') {
+        pos_++;
+        continue;
+      }
+      if (pos_ < s_.size() && s_[pos_] == '}') {
+        pos_++;
+        return true;
+      }
+      return false;
+    }
+  }
+  if (c == '[') {
+    out.type = JsonValue::Array;
+    pos_++;
+    SkipSpace();
+    if (pos_ < s_.size() && s_[pos_] == ']') {
+      pos_++;
+      return true;
+    }
+    while (true) {
+      out.items.emplace_back();
+      if (!Value(out.items.back(), depth + 1))
+        return false;
+      SkipSpace();
+      if (pos_ < s_.size() && s_[pos_] == ',') {
+        pos_++;
+        continue;
+      }
+      if (pos_ < s_.size() && s_[pos_] == ']') {
+        pos_++;
+        return true;
+      }
+      return false;
+    }
+  }
+  if (c == '"') {
+    out.type = JsonValue::String;
+    return StringBody(out.str);
+  }
+  if (c == 't' || c == 'f') {
+    out.type = JsonValue::Bool;
+    out.boolean = (c == 't');
+    return Literal(out.boolean ? "true" : "false");
+  }
+  if (c == 'n') {
+    out.type = JsonValue::Null;
+    return Literal("null");
+  }
+  size_t start = pos_;
+  while (pos_ < s_.size() && strchr("+-0123456789.eE", s_[pos_]) != nullptr)
+    pos_++;
+  if (pos_ == start)
+    return false;
+  std::string num(s_.substr(start, pos_ - start));
+  char *end = nullptr;
+  out.type = JsonValue::Number;
+  out.number = strtod(num.c_str(), &end);
+  return end && *end == '\0';
+}
+
+std::string JsonWriter::Finish() {
+  if (compact_)
+    out_ += out_.empty() ? "{}\n" : "}\n";
+  else
+    out_ += out_.empty() ? "{}\n" : "\n}\n";
+  return std::move(out_);
+}
+
+void JsonWriter::Key(const char *key) {
+  if (compact_)
+    out_ += out_.empty() ? "{\"" : ", \"";
+  else
+    out_ += out_.empty() ? "{\n  \"" : ",\n  \"";
+  out_ += key;
+  out_ += "\": ";
+}
+
+void JsonWriter::Quoted(std::string_view s) {
+  static const char *hex = "0123456789abcdef";
+  out_ += '"';
+  size_t run = 0;
+  for (size_t i = 0; i < s.size(); i++) {
+    // Skip to the next byte that needs escaping
+    i += FindJsonEscape(s.data() + i, s.size() - i);
+    if (i == s.size())
+      break;
+    unsigned char c = (unsigned char)s[i];
+    out_.append(s.data() + run, i - run);
+    run = i + 1;
+    out_ += '\\';
+    switch (c) {
+    case '"':
+    case '\\':
+      out_ += (char)c;
+      break;
+    case '\n':
+      out_ += 'n';
+      break;
+    case '\r':
+      out_ += 'r';
+      break;
+    case '\t':
+      out_ += 't';
+      break;
+    default:
+      out_ += "u00";
+      out_ += hex[c >> 4];
+      out_ += hex[c & 0xF];
+    }
+  }
+  out_.append(s.data() + run, s.size() - run);
+  out_ += '"';
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                   TASK VALIDATION                     //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+bool FileExists(const std::string &path) {
+  struct stat buffer;
+  return (stat(path.c_str(), &buffer) == 0);
+}
+
+bool IsDirectory(const std::string &path) {
+  struct stat buffer;
+  if (stat(path.c_str(), &buffer) != 0)
+    return false;
+  return S_ISDIR(buffer.st_mode);
+}
+
+bool DirectoryExists(const std::string &path) {
+  if (path.empty())
+    return false;
+  return IsDirectory(path);
+}
+
+bool CreateDirectoryRecursive(const std::string &path) {
+#ifdef _WIN32
+  // Create all intermediate directories
+  std::string current_path;
+  size_t pos = 0;
+  while ((pos = path.find_first_of("\\/", pos)) != std::string::npos) {
+    current_path = path.substr(0, pos);
+    if (!current_path.empty() && !DirectoryExists(current_path)) {
+      if (!CreateDirectoryA(current_path.c_str(), NULL)) {
+        DWORD error = GetLastError();
+        if (error != ERROR_ALREADY_EXISTS) {
+          return false;
+        }
+      }
+    }
+    pos++;
+  }
+  // Create the final directory
+  if (!DirectoryExists(path)) {
+    return CreateDirectoryA(path.c_str(), NULL) != 0;
+  }
+  return true;
+#else
+  // Use system mkdir -p
+  std::string cmd = "mkdir -p \"" + path + "\"";
+  return system(cmd.c_str()) == 0;
+#endif
+}
+
+bool RemoveDirectoryRecursive(const std::string &path) {
+  if (!DirectoryExists(path))
+    return false;
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return false;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+    std::string child = path + "/" + ent->d_name;
+    if (IsDirectory(child)) {
+      RemoveDirectoryRecursive(child);
+    } else {
+      remove(child.c_str());
+    }
+  }
+  closedir(dir);
+  // Remove the now-empty directory
+  int rc = rmdir(path.c_str());
+  return rc == 0;
+}
+
+std::vector<std::string> ListDirectory(const std::string &path, bool files) {
+  std::vector<std::string> names;
+  DIR *d = opendir(path.c_str());
+  if (!d)
+    return names;
+  struct dirent *e;
+  struct stat st{};
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.')
+      continue;
+    std::string p = path + "/" + e->d_name;
+    if (stat(p.c_str(), &st) != 0)
+      continue;
+    if (files ? S_ISREG(st.st_mode) : S_ISDIR(st.st_mode))
+      names.push_back(e->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+uint64_t Fnv1a(uint64_t h, const void *data, size_t size) {
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++)
+    h = (h ^ p[i]) * 1099511628211ULL;
+  return h;
+}
+
+// Per file and per task, how much content HashTaskLayout reads; beyond that
+// only names, sizes and modification times are hashed
+static const size_t kTaskHashFileBytes = 1024 * 1024;
+static const size_t kTaskHashTotalBytes = 8 * 1024 * 1024;
+
+// Hash the validation result together with the entries it looked at: the
+// files directly inside env/, verify/ and prompt/ and the prompt file. Any
+// change to what the script would check changes the hash.
+static uint64_t HashTaskLayout(const std::string &task_dir,
+                               const TaskValidation &val) {
+  uint64_t h = kFnvOffset;
+  for (const auto *items : {&val.found_items, &val.missing_items}) {
+    for (const auto &item : *items)
+      h = Fnv1a(h, item.c_str(), item.size() + 1);
+  }
+  size_t budget = kTaskHashTotalBytes;
+  std::vector<char> buf;
+  auto hash_file = [&](const std::string &path, const std::string &name) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      return;
+    h = Fnv1a(h, name.c_str(), name.size() + 1);
+    uint64_t meta[2] = {(uint64_t)st.st_size, (uint64_t)st.st_mtime};
+    h = Fnv1a(h, meta, sizeof(meta));
+    size_t want = std::min(std::min((size_t)st.st_size, kTaskHashFileBytes),
+                           budget);
+    if (want == 0)
+      return;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      return;
+    buf.resize(want);
+    size_t n = fread(buf.data(), 1, want, f);
+    fclose(f);
+    h = Fnv1a(h, buf.data(), n);
+    budget -= n;
+  };
+  for (const char *sub : {"env", "verify", "prompt"}) {
+    std::string dir = task_dir + "/" + sub;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+      continue;
+    std::vector<std::string> names;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+      if (e->d_name[0] != '.')
+        names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    for (const auto &name : names)
+      hash_file(dir + "/" + name, std::string(sub) + "/" + name);
+  }
+  for (const char *name : {"prompt", "prompt.txt"})
+    hash_file(task_dir + "/" + name, name);
+  return h;
+}
+
+TaskValidation ValidateTaskDirectory(const std::string &task_dir) {
+  TaskValidation val;
+  val.task_dir = task_dir;
+  val.missing_items.clear();
+  val.found_items.clear();
+
+  if (task_dir.empty())
+    return val;
+
+  // Check env/ directory
+  std::string env_dir = task_dir + "/env";
+  if (IsDirectory(env_dir)) {
+    val.has_env_dir = true;
+    val.found_items.push_back("[OK] env/ directory");
+
+    // Check for Dockerfile in env/ (accept both cases)
+    std::string dockerfile_upper = env_dir + "/Dockerfile";
+    std::string dockerfile_lower = env_dir + "/dockerfile";
+
+    std::string dockerfile;
+    if (FileExists(dockerfile_upper)) {
+      val.has_dockerfile = true;
+      val.found_items.push_back("[OK] env/Dockerfile");
+      dockerfile = dockerfile_upper;
+    } else if (FileExists(dockerfile_lower)) {
+      val.has_dockerfile = true;
+      val.found_items.push_back("[OK] env/dockerfile");
+      dockerfile = dockerfile_lower;
+    } else {
+      val.missing_items.push_back("[X] env/Dockerfile or env/dockerfile");
+    }
+
+    if (val.has_dockerfile) {
+      std::shared_ptr<const DockerfileInfo> info =
+          AnalyzeDockerfile(dockerfile);
+      if (info && !info->error.empty()) {
+        val.missing_items.push_back("[!] env/" +
+                                    dockerfile.substr(env_dir.size() + 1) +
+                                    ": " + info->error);
+      } else if (info) {
+        val.workdir = info->Workdir();
+        val.base_images = info->BaseImages();
+      }
+      val.context_hash = HashDockerContext(env_dir);
+    }
+  } else {
+    val.missing_items.push_back("[X] env/ directory");
+    val.missing_items.push_back("[X] env/Dockerfile");
+  }
+
+  // Check verify/ directory
+  std::string verify_dir = task_dir + "/verify";
+  if (IsDirectory(verify_dir)) {
+    val.has_verify_dir = true;
+    val.found_items.push_back("[OK] verify/ directory");
+
+    // Check for verify.sh
+    std::string verify_sh = verify_dir + "/verify.sh";
+    if (FileExists(verify_sh)) {
+      val.has_verify_sh = true;
+      val.found_items.push_back("[OK] verify/verify.sh");
+    } else {
+      val.missing_items.push_back("[X] verify/verify.sh");
+    }
+
+    // Check for verification_command (optional)
+    std::string verify_cmd = verify_dir + "/verification_command";
+    if (FileExists(verify_cmd)) {
+      val.found_items.push_back("[OK] verify/verification_command (optional)");
+    }
+
+    // List additional files in verify/ (exclude verify.sh and command files)
+    DIR *vdir = opendir(verify_dir.c_str());
+    if (vdir) {
+      struct dirent *entry;
+      while ((entry = readdir(vdir)) != NULL) {
+        const char *name = entry->d_name;
+        if (!name || name[0] == '.')
+          continue;
+        std::string base(name);
+        if (base == "verify.sh" || base == "command" ||
+            base == "verification_command")
+          continue;
+        std::string full_path = verify_dir + "/" + base;
+        struct stat st{};
+        if (stat(full_path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+          val.found_items.push_back(std::string("[OK] verify/") + base +
+                                    " (extra)");
+        }
+      }
+      closedir(vdir);
+    }
+  } else {
+    val.missing_items.push_back("[X] verify/ directory");
+    val.missing_items.push_back("[X] verify/verify.sh");
+  }
+
+  // Check for prompt (file or directory)
+  std::string prompt_file = task_dir + "/prompt";
+  std::string prompt_txt = task_dir + "/prompt.txt";
+  std::string prompt_dir = task_dir + "/prompt";
+
+  if (FileExists(prompt_file) && !IsDirectory(prompt_file)) {
+    val.has_prompt = true;
+    val.prompt_location = "prompt (file)";
+    val.found_items.push_back("[OK] prompt (file)");
+  } else if (FileExists(prompt_txt)) {
+    val.has_prompt = true;
+    val.prompt_location = "prompt.txt";
+    val.found_items.push_back("[OK] prompt.txt");
+  } else if (IsDirectory(prompt_dir)) {
+    val.has_prompt = true;
+    val.prompt_location = "prompt/ (directory)";
+    val.found_items.push_back("[OK] prompt/ directory");
+
+    // Check if prompt/ contains at least one file
+    DIR *dir = opendir(prompt_dir.c_str());
+    bool has_files = false;
+    if (dir) {
+      struct dirent *entry;
+      while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+          has_files = true;
+          break;
+        }
+      }
+      closedir(dir);
+    }
+    if (!has_files) {
+      val.missing_items.push_back("[!] prompt/ directory is empty");
+    }
+  } else {
+    val.missing_items.push_back("[X] prompt or prompt.txt or prompt/");
+  }
+
+  val.content_hash = HashTaskLayout(task_dir, val);
+  // Files deeper in env/ that the Dockerfile copies count too
+  val.content_hash = Fnv1a(val.content_hash, &val.context_hash,
+                           sizeof(val.context_hash));
+  return val;
+}
+
+bool TaskRunnable(const TaskValidation &val, int mode) {
+  if (!val.has_env_dir || !val.has_dockerfile)
+    return false;
+  return mode == 3 ||
+         (val.has_verify_dir && val.has_verify_sh && val.has_prompt);
+}
+
+std::string TaskPromptFile(const std::string &task_dir) {
+  // The order of get_prompt_path in autobuild.sh
+  std::string path = task_dir + "/prompt";
+  if (IsDirectory(path)) {
+    path += "/prompt.txt";
+    return FileExists(path) ? path : std::string();
+  }
+  if (FileExists(path))
+    return path;
+  path = task_dir + "/prompt.txt";
+  return FileExists(path) ? path : std::string();
+}
+
+std::string ComposePromptText(std::string_view prompt) {
+  // echo "$(...)": the substitution drops every trailing newline and echo
+  // writes one
+  while (!prompt.empty() && prompt.back() == '\n')
+    prompt.remove_suffix(1);
+  std::string out(prompt);
+  out += '\n';
+  return out;
+}
+
+bool ComposePrompt1Text(std::string_view prompt,
+                        const std::string &task_prompt_file, std::string &out) {
+  FILE *f = fopen(task_prompt_file.c_str(), "rb");
+  if (!f)
+    return false;
+  out = ComposePromptText(prompt);
+  out += '\n';
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out.append(buf, n);
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+std::string CachePromptFile(const std::string &dir, const char *name,
+                            const std::string &text) {
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx",
+           (unsigned long long)Fnv1a(kFnvOffset, text.data(), text.size()));
+  std::string path = dir + "/" + name + "-" + hash + ".txt";
+  if (FileExists(path))
+    return path;
+  // Callers on different threads may compose the same text at once
+  static std::atomic<unsigned> serial{0};
+  std::string tmp = path + ".tmp" + std::to_string(serial++);
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f)
+    return std::string();
+  bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+  ok = fclose(f) == 0 && ok;
+  // rename does not replace an existing file on Windows; then the other
+  // writer's copy, with the same contents, is the one kept
+  if (ok && std::rename(tmp.c_str(), path.c_str()) != 0)
+    ok = FileExists(path);
+  std::remove(tmp.c_str());
+  return ok ? path : std::string();
+}
+
+// How often the validator looks for change notifications, and how often it
+// rescans when there are none (unsupported, or the directory is missing)
+static const int kTaskValidatePollMs = 250;
+static const int kTaskValidateRescanMs = 2000;
+
+void TaskValidator::Poll(const std::string &task_dir, TaskValidation &out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (task_dir != dir_) {
+    dir_ = task_dir;
+    cv_.notify_one();
+  }
+  if (!thread_.joinable() && !stop_)
+    thread_ = std::thread([this]() {
+      if (hooks_.thread_start)
+        hooks_.thread_start();
+      Run();
+    });
+  if (result_.task_dir == task_dir &&
+      (seen_ != generation_ || out.task_dir != task_dir)) {
+    out = result_;
+    seen_ = generation_;
+  } else if (out.task_dir != task_dir && !out.task_dir.empty()) {
+    out = TaskValidation();
+  }
+}
+
+void TaskValidator::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_one();
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void TaskValidator::Run() {
+  std::string dir;
+  bool scanned = false;
+  auto last_scan = std::chrono::steady_clock::now();
+  while (true) {
+    std::string wanted;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_for(lock, std::chrono::milliseconds(kTaskValidatePollMs),
+                   [&] { return stop_ || !scanned || dir_ != dir; });
+      if (stop_)
+        break;
+      wanted = dir_;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool moved = !scanned || wanted != dir;
+    bool rescan = moved || PollWatcher();
+    if (!rescan && !Watching() &&
+        now - last_scan >= std::chrono::milliseconds(kTaskValidateRescanMs))
+      rescan = true;
+    if (!rescan)
+      continue;
+    dir = wanted;
+    scanned = true;
+    last_scan = now;
+
+    // Watch again before validating, so changes made during the scan (or
+    // subdirectories that appeared since) are not missed
+    CloseWatcher();
+    if (!dir.empty())
+      OpenWatcher(dir);
+    TaskValidation val = ValidateTaskDirectory(dir);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!moved && val.content_hash == result_.content_hash)
+        continue;
+      result_ = std::move(val);
+      generation_++;
+    }
+    if (hooks_.validated)
+      hooks_.validated(dir);
+  }
+  CloseWatcher();
+}
+
+#if defined(_WIN32)
+bool TaskValidator::Watching() const {
+  return change_ != INVALID_HANDLE_VALUE;
+}
+
+void TaskValidator::OpenWatcher(const std::string &dir) {
+  change_ = FindFirstChangeNotificationA(
+      dir.c_str(), TRUE,
+      FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+          FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+}
+
+bool TaskValidator::PollWatcher() {
+  return Watching() && WaitForSingleObject(change_, 0) == WAIT_OBJECT_0;
+}
+
+void TaskValidator::CloseWatcher() {
+  if (Watching())
+    FindCloseChangeNotification(change_);
+  change_ = INVALID_HANDLE_VALUE;
+}
+#elif defined(__APPLE__)
+bool TaskValidator::Watching() const {
+  return false;
+}
+
+void TaskValidator::OpenWatcher(const std::string &) {}
+
+bool TaskValidator::PollWatcher() {
+  return false;
+}
+
+void TaskValidator::CloseWatcher() {}
+#else
+bool TaskValidator::Watching() const {
+  return watching_;
+}
+
+void TaskValidator::OpenWatcher(const std::string &dir) {
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0)
+    return;
+  const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                        IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF |
+                        IN_ONLYDIR;
+  watching_ = inotify_add_watch(inotify_fd_, dir.c_str(), mask) >= 0;
+  for (const char *sub : {"env", "verify", "prompt"})
+    inotify_add_watch(inotify_fd_, (dir + "/" + sub).c_str(), mask);
+}
+
+bool TaskValidator::PollWatcher() {
+  if (inotify_fd_ < 0)
+    return false;
+  alignas(struct inotify_event) char buf[4096];
+  bool changed = false;
+  while (read(inotify_fd_, buf, sizeof(buf)) > 0)
+    changed = true;
+  return changed;
+}
+
+void TaskValidator::CloseWatcher() {
+  if (inotify_fd_ >= 0)
+    close(inotify_fd_);
+  inotify_fd_ = -1;
+  watching_ = false;
+}
+#endif
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                  DOCKERFILE ANALYSIS                  //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+namespace {
+
+using DockerVars = std::map<std::string, std::string>;
+
+std::string Upper(std::string s) {
+  for (char &c : s)
+    c = (char)toupper((unsigned char)c);
+  return s;
+}
+
+std::string Lower(std::string s) {
+  FoldAsciiLower(s.data(), s.data(), s.size());
+  return s;
+}
+
+std::string_view TrimSpace(std::string_view s) {
+  while (!s.empty() && isspace((unsigned char)s.front()))
+    s.remove_prefix(1);
+  while (!s.empty() && isspace((unsigned char)s.back()))
+    s.remove_suffix(1);
+  return s;
+}
+
+bool IsVarChar(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// Substitute $NAME, ${NAME}, ${NAME:-word} and ${NAME:+word} from vars, as
+// docker build does for FROM, ARG, ENV, WORKDIR, COPY and ADD. A variable
+// vars lacks becomes empty and clears known. The escape character keeps a
+// following $ literal.
+std::string ExpandDockerVars(std::string_view word, const DockerVars &vars,
+                             char escape, bool &known) {
+  std::string out;
+  for (size_t i = 0; i < word.size(); i++) {
+    char c = word[i];
+    if (c == escape && i + 1 < word.size() && word[i + 1] == '$') {
+      out += '$';
+      i++;
+      continue;
+    }
+    if (c != '$' || i + 1 >= word.size()) {
+      out += c;
+      continue;
+    }
+    std::string name, modifier, alt;
+    size_t end;
+    if (word[i + 1] == '{') {
+      size_t close = word.find('}', i + 2);
+      if (close == std::string_view::npos) {
+        out += c;
+        continue;
+      }
+      std::string_view inner = word.substr(i + 2, close - i - 2);
+      size_t colon = inner.find(':');
+      name = std::string(inner.substr(0, colon));
+      if (colon != std::string_view::npos && colon + 1 < inner.size()) {
+        modifier = std::string(1, inner[colon + 1]);
+        alt = std::string(inner.substr(colon + 2));
+      }
+      end = close + 1;
+    } else {
+      end = i + 1;
+      while (end < word.size() && IsVarChar(word[end]))
+        end++;
+      if (end == i + 1) {
+        out += c;
+        continue;
+      }
+      name = std::string(word.substr(i + 1, end - i - 1));
+    }
+    auto it = vars.find(name);
+    bool set = it != vars.end() && !it->second.empty();
+    if (modifier == "-") {
+      out += set ? it->second : ExpandDockerVars(alt, vars, escape, known);
+    } else if (modifier == "+") {
+      if (set)
+        out += ExpandDockerVars(alt, vars, escape, known);
+    } else if (it != vars.end()) {
+      out += it->second;
+    } else {
+      known = false;
+    }
+    i = end - 1;
+  }
+  return out;
+}
+
+// Arguments of an instruction: a JSON array of strings, or words split at
+// whitespace
+std::vector<std::string> InstructionArgs(std::string_view rest) {
+  std::vector<std::string> args;
+  if (!rest.empty() && rest.front() == '[') {
+    JsonValue list;
+    if (JsonParser(rest).Parse(list) && list.type == JsonValue::Array) {
+      bool strings = true;
+      for (const auto &item : list.items)
+        strings = strings && item.type == JsonValue::String;
+      if (strings) {
+        for (const auto &item : list.items)
+          args.push_back(item.str);
+        return args;
+      }
+    }
+  }
+  size_t i = 0;
+  while (i < rest.size()) {
+    while (i < rest.size() && isspace((unsigned char)rest[i]))
+      i++;
+    size_t start = i;
+    while (i < rest.size() && !isspace((unsigned char)rest[i]))
+      i++;
+    if (i > start)
+      args.emplace_back(rest.substr(start, i - start));
+  }
+  return args;
+}
+
+// NAME=value pairs of ARG and ENV (ENV NAME value in the old form), quotes
+// removed; a bare ARG NAME has no value (second.first false)
+std::vector<std::pair<std::string, std::pair<bool, std::string>>>
+KeyValueArgs(std::string_view rest, bool env, char escape) {
+  std::vector<std::string> words;
+  std::string word;
+  bool in_word = false;
+  char quote = 0;
+  for (size_t i = 0; i < rest.size(); i++) {
+    char c = rest[i];
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else if (c == escape && quote == '"' && i + 1 < rest.size())
+        word += rest[++i];
+      else
+        word += c;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+      in_word = true;
+    } else if (c == escape && i + 1 < rest.size()) {
+      // Kept for ExpandDockerVars to see when it guards a $
+      if (rest[i + 1] == '$')
+        word += c;
+      word += rest[++i];
+      in_word = true;
+    } else if (isspace((unsigned char)c)) {
+      if (in_word)
+        words.push_back(word);
+      word.clear();
+      in_word = false;
+    } else {
+      word += c;
+      in_word = true;
+    }
+  }
+  if (in_word)
+    words.push_back(word);
+
+  std::vector<std::pair<std::string, std::pair<bool, std::string>>> pairs;
+  if (env && !words.empty() && words[0].find('=') == std::string::npos) {
+    // ENV NAME value with spaces
+    std::string value;
+    for (size_t i = 1; i < words.size(); i++)
+      value += (i > 1 ? " " : "") + words[i];
+    pairs.push_back({words[0], {true, value}});
+    return pairs;
+  }
+  for (const auto &w : words) {
+    size_t eq = w.find('=');
+    if (eq == std::string::npos)
+      pairs.push_back({w, {false, std::string()}});
+    else
+      pairs.push_back({w.substr(0, eq), {true, w.substr(eq + 1)}});
+  }
+  return pairs;
+}
+
+// A context path as the build sees it: no leading "./" or "/", no trailing
+// "/". False for the whole context or a path that leaves it.
+bool NormalizeContextPath(std::string &path) {
+  for (;;) {
+    if (path.compare(0, 2, "./") == 0)
+      path.erase(0, 2);
+    else if (!path.empty() && path[0] == '/')
+      path.erase(0, 1);
+    else
+      break;
+  }
+  while (!path.empty() && path.back() == '/')
+    path.pop_back();
+  if (path.empty() || path == "." || path == ".." ||
+      path.compare(0, 3, "../") == 0 ||
+      path.find("/../") != std::string::npos)
+    return false;
+  return true;
+}
+
+// filepath.Match for one pattern against one path: * and ? stop at "/"
+bool ContextGlobMatch(const char *p, const char *s) {
+  for (; *p; p++, s++) {
+    switch (*p) {
+    case '*':
+      while (p[1] == '*')
+        p++;
+      for (;; s++) {
+        if (ContextGlobMatch(p + 1, s))
+          return true;
+        if (*s == '\0' || *s == '/')
+          return false;
+      }
+    case '?':
+      if (*s == '\0' || *s == '/')
+        return false;
+      break;
+    case '[': {
+      if (*s == '\0' || *s == '/')
+        return false;
+      const char *q = p + 1;
+      bool negate = *q == '^' || *q == '!';
+      if (negate)
+        q++;
+      bool match = false;
+      for (bool first = true; *q && (first || *q != ']'); first = false) {
+        char lo = *q++;
+        char hi = lo;
+        if (*q == '-' && q[1] && q[1] != ']') {
+          hi = q[1];
+          q += 2;
+        }
+        match = match || (*s >= lo && *s <= hi);
+      }
+      if (*q != ']')
+        return false; // unterminated class: nothing matches
+      if (match == negate)
+        return false;
+      p = q;
+      break;
+    }
+    case '\\':
+      if (p[1])
+        p++;
+      // fall through
+    default:
+      if (*p != *s)
+        return false;
+    }
+  }
+  return *s == '\0';
+}
+
+// Whether the context file rel is read through source: the file itself, or
+// under a directory the source names or matches
+bool SourceCovers(const std::string &source, const std::string &rel) {
+  if (source.find_first_of("*?[\\") == std::string::npos)
+    return rel == source ||
+           (rel.size() > source.size() && rel[source.size()] == '/' &&
+            rel.compare(0, source.size(), source) == 0);
+  for (size_t end = rel.find('/');; end = rel.find('/', end + 1)) {
+    std::string prefix = rel.substr(0, end);
+    if (ContextGlobMatch(source.c_str(), prefix.c_str()))
+      return true;
+    if (end == std::string::npos)
+      return false;
+  }
+}
+
+// Regular files under env_dir, relative to it and sorted
+std::vector<std::string> ListContextFiles(const std::string &env_dir) {
+  std::vector<std::string> files;
+  std::vector<std::string> pending(1);
+  while (!pending.empty()) {
+    std::string rel = pending.back();
+    pending.pop_back();
+    std::string dir = rel.empty() ? env_dir : env_dir + "/" + rel;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+      continue;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+      if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+        continue;
+      std::string path = rel.empty() ? e->d_name : rel + "/" + e->d_name;
+      struct stat st{};
+#ifdef _WIN32
+      if (stat((env_dir + "/" + path).c_str(), &st) != 0)
+#else
+      // Symlinked directories are not followed, as docker build does not
+      if (lstat((env_dir + "/" + path).c_str(), &st) != 0)
+#endif
+        continue;
+      if (S_ISDIR(st.st_mode))
+        pending.push_back(path);
+      else if (S_ISREG(st.st_mode))
+        files.push_back(path);
+    }
+    closedir(d);
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+// Patterns of env_dir's .dockerignore, cleaned the way docker cleans them;
+// exceptions keep their leading "!"
+std::vector<std::string> ReadDockerignore(const std::string &env_dir) {
+  std::vector<std::string> patterns;
+  FILE *f = fopen((env_dir + "/.dockerignore").c_str(), "rb");
+  if (!f)
+    return patterns;
+  char buf[4096];
+  while (fgets(buf, sizeof(buf), f)) {
+    std::string line(buf);
+    while (!line.empty() && isspace((unsigned char)line.back()))
+      line.pop_back();
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line[start] == '#')
+      continue;
+    line.erase(0, start);
+    bool negate = line[0] == '!';
+    std::string path = line.substr(negate ? 1 : 0);
+    // Cleaned like a COPY source; a pattern for the root matches nothing
+    if (!NormalizeContextPath(path))
+      continue;
+    patterns.push_back((negate ? "!" : "") + path);
+  }
+  fclose(f);
+  return patterns;
+}
+
+// A .dockerignore pattern against a path, one "/" separated segment at a
+// time: "**" spans any number of segments, the rest is ContextGlobMatch
+bool IgnoreGlobMatch(const std::vector<std::string> &pat, size_t p,
+                     const std::vector<std::string> &path, size_t s) {
+  if (p == pat.size())
+    return s == path.size();
+  if (pat[p] == "**") {
+    for (size_t k = s; k <= path.size(); k++)
+      if (IgnoreGlobMatch(pat, p + 1, path, k))
+        return true;
+    return false;
+  }
+  return s < path.size() && ContextGlobMatch(pat[p].c_str(), path[s].c_str()) &&
+         IgnoreGlobMatch(pat, p + 1, path, s + 1);
+}
+
+std::vector<std::string> SplitSegments(const std::string &path) {
+  std::vector<std::string> parts;
+  std::stringstream in(path);
+  std::string part;
+  while (std::getline(in, part, '/'))
+    if (!part.empty())
+      parts.push_back(part);
+  return parts;
+}
+
+// Whether patterns exclude the context file rel: the last pattern that
+// matches rel, or a directory above it, decides
+bool DockerIgnored(const std::vector<std::string> &patterns,
+                   const std::string &rel) {
+  std::vector<std::string> path = SplitSegments(rel);
+  bool ignored = false;
+  for (const auto &pattern : patterns) {
+    bool negate = pattern[0] == '!';
+    std::vector<std::string> pat =
+        SplitSegments(negate ? pattern.substr(1) : pattern);
+    bool match = false;
+    for (size_t n = 1; !match && n <= path.size(); n++) {
+      std::vector<std::string> prefix(path.begin(), path.begin() + n);
+      match = IgnoreGlobMatch(pat, 0, prefix, 0);
+    }
+    if (match)
+      ignored = !negate;
+  }
+  return ignored;
+}
+
+// Fold each file's relative path, contents and size into h
+uint64_t HashContextFiles(uint64_t h, const std::string &env_dir,
+                          const std::vector<std::string> &files) {
+  std::vector<char> buf(64 * 1024);
+  for (const auto &rel : files) {
+    h = Fnv1a(h, rel.c_str(), rel.size() + 1);
+    FILE *f = fopen((env_dir + "/" + rel).c_str(), "rb");
+    if (!f)
+      continue;
+    uint64_t size = 0;
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), f)) > 0) {
+      h = Fnv1a(h, buf.data(), n);
+      size += n;
+    }
+    fclose(f);
+    h = Fnv1a(h, &size, sizeof(size)); // where one file ends
+  }
+  return h;
+}
+
+} // namespace
+
+std::string DockerfileInfo::Workdir() const {
+  if (stages.empty() || !stages.back().workdir_known)
+    return std::string();
+  return stages.back().workdir;
+}
+
+std::vector<std::string> DockerfileInfo::BaseImages() const {
+  std::vector<std::string> images;
+  for (const auto &stage : stages) {
+    if (stage.parent >= 0 || !stage.base_known || stage.base.empty() ||
+        Lower(stage.base) == "scratch")
+      continue;
+    if (std::find(images.begin(), images.end(), stage.base) == images.end())
+      images.push_back(stage.base);
+  }
+  return images;
+}
+
+DockerfileInfo ParseDockerfile(std::string_view text) {
+  DockerfileInfo info;
+  std::vector<std::string_view> lines;
+  for (size_t start = 0; start <= text.size();) {
+    size_t eol = text.find('\n', start);
+    if (eol == std::string_view::npos)
+      eol = text.size();
+    std::string_view line = text.substr(start, eol - start);
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    lines.push_back(line);
+    start = eol + 1;
+  }
+
+  char escape = '\\';
+  DockerVars globals;     // ARGs before the first FROM
+  DockerVars vars;        // what the current stage can substitute
+  std::vector<DockerVars> envs; // ENV of each stage, for stages built on it
+  bool directives = true; // parser directives only come first
+  for (size_t i = 0; i < lines.size();) {
+    int line_no = (int)i + 1;
+    std::string_view line = TrimSpace(lines[i++]);
+    if (line.empty()) {
+      directives = false;
+      continue;
+    }
+    if (line[0] == '#') {
+      if (directives) {
+        std::string_view d = TrimSpace(line.substr(1));
+        size_t eq = d.find('=');
+        if (eq != std::string_view::npos &&
+            Lower(std::string(TrimSpace(d.substr(0, eq)))) == "escape") {
+          std::string_view value = TrimSpace(d.substr(eq + 1));
+          if (value == "`" || value == "\\")
+            escape = value[0];
+          continue;
+        }
+      }
+      directives = false;
+      continue;
+    }
+    directives = false;
+
+    // Join continued lines; comment and blank lines inside are dropped
+    std::string logical(line);
+    while (!logical.empty() && logical.back() == escape && i < lines.size()) {
+      logical.pop_back();
+      std::string_view next;
+      while (i < lines.size() && next.empty()) {
+        next = TrimSpace(lines[i++]);
+        if (!next.empty() && next[0] == '#')
+          next = std::string_view();
+      }
+      logical += ' ';
+      logical += next;
+    }
+
+    std::string_view rest = TrimSpace(logical);
+    size_t space = 0;
+    while (space < rest.size() && !isspace((unsigned char)rest[space]))
+      space++;
+    std::string keyword = Upper(std::string(rest.substr(0, space)));
+    rest = TrimSpace(rest.substr(space));
+
+    // Heredoc bodies (RUN <<EOF, COPY <<EOF dest) are not instructions
+    std::vector<std::string> args = InstructionArgs(rest);
+    DockerfileStep step;
+    step.keyword = keyword;
+    step.text = std::string(TrimSpace(logical));
+    step.line = line_no;
+    if (keyword == "RUN" || keyword == "COPY" || keyword == "ADD") {
+      for (const auto &arg : args) {
+        if (arg.compare(0, 2, "<<") != 0 || arg.size() < 3)
+          continue;
+        std::string word = arg.substr(2);
+        bool strip_tabs = word[0] == '-';
+        if (strip_tabs)
+          word.erase(0, 1);
+        if (word.size() >= 2 && (word[0] == '"' || word[0] == '\'') &&
+            word.back() == word[0])
+          word = word.substr(1, word.size() - 2);
+        while (i < lines.size()) {
+          std::string_view body = lines[i++];
+          if (strip_tabs)
+            while (!body.empty() && body.front() == '\t')
+              body.remove_prefix(1);
+          if (body == word)
+            break;
+          step.text += '\n';
+          step.text += body;
+        }
+      }
+    }
+
+    bool known = true;
+    DockerfileStage *stage =
+        info.stages.empty() ? nullptr : &info.stages.back();
+    if (stage && (keyword == "RUN" || keyword == "COPY" ||
+                  keyword == "ADD" || keyword == "WORKDIR"))
+      stage->steps.push_back(step);
+    if (keyword == "FROM") {
+      size_t a = 0;
+      while (a < args.size() && args[a].compare(0, 2, "--") == 0)
+        a++;
+      if (a >= args.size()) {
+        info.error = "FROM without an image";
+        return info;
+      }
+      DockerfileStage next;
+      next.steps.push_back(step);
+      next.base = ExpandDockerVars(args[a], globals, escape, known);
+      next.base_known = known;
+      if (a + 2 < args.size() && Upper(args[a + 1]) == "AS")
+        next.name = Lower(args[a + 2]);
+      std::string base = Lower(next.base);
+      for (size_t s = 0; s < info.stages.size(); s++) {
+        if (!info.stages[s].name.empty() && info.stages[s].name == base)
+          next.parent = (int)s;
+      }
+      // ENV of a parent stage carries over; its ARGs have to be declared
+      // again
+      vars.clear();
+      if (next.parent >= 0) {
+        const DockerfileStage &parent = info.stages[next.parent];
+        next.workdir = parent.workdir;
+        next.workdir_known = parent.workdir_known;
+        vars = envs[next.parent];
+      }
+      info.stages.push_back(next);
+      envs.push_back(vars);
+      continue;
+    }
+    if (keyword == "ARG") {
+      for (const auto &kv : KeyValueArgs(rest, false, escape)) {
+        std::string value;
+        if (kv.second.first) {
+          value = ExpandDockerVars(kv.second.second, stage ? vars : globals,
+                                   escape, known);
+        } else if (stage && globals.count(kv.first)) {
+          value = globals[kv.first];
+        }
+        if (stage) {
+          vars[kv.first] = value;
+        } else {
+          globals[kv.first] = value;
+          info.args.push_back({kv.first, value});
+        }
+      }
+      continue;
+    }
+    if (!stage)
+      continue; // only ARG and parser directives may come before FROM
+    if (keyword == "ENV") {
+      for (const auto &kv : KeyValueArgs(rest, true, escape)) {
+        std::string value =
+            ExpandDockerVars(kv.second.second, vars, escape, known);
+        vars[kv.first] = value;
+        envs.back()[kv.first] = value;
+      }
+      continue;
+    }
+    if (keyword == "WORKDIR") {
+      std::string dir = ExpandDockerVars(rest, vars, escape, known);
+      if (dir.empty())
+        continue;
+      bool absolute = dir[0] == '/' || (dir.size() > 1 && dir[1] == ':');
+      if (!absolute) {
+        std::string base = stage->workdir.empty() ? "/" : stage->workdir;
+        dir = base + (base.back() == '/' ? "" : "/") + dir;
+      }
+      while (dir.size() > 1 && dir.back() == '/')
+        dir.pop_back();
+      stage->workdir = dir;
+      // A relative WORKDIR is only as known as the one it extends
+      stage->workdir_known = known && (absolute || stage->workdir_known);
+      continue;
+    }
+    if (keyword == "COPY" || keyword == "ADD") {
+      size_t a = 0;
+      bool from_stage = false;
+      for (; a < args.size() && args[a].compare(0, 2, "--") == 0; a++)
+        from_stage = from_stage || args[a].compare(0, 7, "--from=") == 0;
+      if (from_stage || args.size() < a + 2)
+        continue;
+      for (size_t s = a; s + 1 < args.size(); s++) {
+        const std::string &src = args[s];
+        if (src.compare(0, 2, "<<") == 0)
+          continue; // heredoc: the text is in the Dockerfile
+        if (keyword == "ADD" && (src.find("://") != std::string::npos ||
+                                 src.compare(0, 4, "git@") == 0)) {
+          stage->steps.back().remote = true;
+          continue; // fetched, not read from the context
+        }
+        bool source_known = true;
+        std::string path = ExpandDockerVars(src, vars, escape, source_known);
+        if (!source_known || !NormalizeContextPath(path)) {
+          info.whole_context = true;
+          path = ".";
+        } else {
+          stage->sources.push_back(path);
+        }
+        stage->steps.back().sources.push_back(path);
+      }
+      continue;
+    }
+    if (keyword == "RUN") {
+      for (size_t a = 0; a < args.size() && args[a].compare(0, 2, "--") == 0;
+           a++) {
+        if (args[a].compare(0, 8, "--mount=") != 0)
+          continue;
+        std::string type = "bind", source, from;
+        std::stringstream fields(args[a].substr(8));
+        std::string field;
+        while (std::getline(fields, field, ',')) {
+          size_t eq = field.find('=');
+          std::string key = field.substr(0, eq);
+          std::string value =
+              eq == std::string::npos ? std::string() : field.substr(eq + 1);
+          if (key == "type")
+            type = value;
+          else if (key == "source" || key == "src")
+            source = value;
+          else if (key == "from")
+            from = value;
+        }
+        if (type != "bind" || !from.empty())
+          continue;
+        if (!NormalizeContextPath(source))
+          info.whole_context = true;
+        else
+          stage->sources.push_back(source);
+      }
+    }
+  }
+  if (info.stages.empty())
+    info.error = "no FROM instruction";
+  return info;
+}
+
+std::shared_ptr<const DockerfileInfo>
+AnalyzeDockerfile(const std::string &path) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return nullptr;
+  std::string text;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    text.append(buf, n);
+  bool ok = !ferror(f);
+  fclose(f);
+  if (!ok)
+    return nullptr;
+
+  static std::mutex mutex;
+  static std::unordered_map<uint64_t, std::shared_ptr<const DockerfileInfo>>
+      cache;
+  uint64_t key = Fnv1a(kFnvOffset, text.data(), text.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(key);
+    if (it != cache.end())
+      return it->second;
+  }
+  auto info = std::make_shared<const DockerfileInfo>(ParseDockerfile(text));
+  std::lock_guard<std::mutex> lock(mutex);
+  if (cache.size() >= 256)
+    cache.clear(); // old versions of edited Dockerfiles
+  cache.emplace(key, info);
+  return info;
+}
+
+// DockerContextFiles, and whether that left out any file of env_dir
+static std::vector<std::string> NarrowContextFiles(const std::string &env_dir,
+                                                   bool &narrowed) {
+  std::string name = "Dockerfile";
+  if (!FileExists(env_dir + "/" + name))
+    name = "dockerfile";
+  std::shared_ptr<const DockerfileInfo> info =
+      AnalyzeDockerfile(env_dir + "/" + name);
+  bool whole = !info || !info->error.empty() || info->whole_context;
+  std::vector<std::string> sources;
+  if (!whole)
+    for (const auto &stage : info->stages)
+      sources.insert(sources.end(), stage.sources.begin(),
+                     stage.sources.end());
+  std::vector<std::string> ignore = ReadDockerignore(env_dir);
+  std::vector<std::string> all = ListContextFiles(env_dir);
+  std::vector<std::string> files;
+  for (const auto &rel : all) {
+    bool read = rel == name || rel == ".dockerignore";
+    if (!read) {
+      read = whole;
+      for (size_t i = 0; !read && i < sources.size(); i++)
+        read = SourceCovers(sources[i], rel);
+      read = read && !DockerIgnored(ignore, rel);
+    }
+    if (read)
+      files.push_back(rel);
+  }
+  narrowed = files.size() != all.size();
+  return files;
+}
+
+std::vector<std::string> DockerContextFiles(const std::string &env_dir) {
+  bool narrowed = false;
+  return NarrowContextFiles(env_dir, narrowed);
+}
+
+uint64_t HashDockerContext(const std::string &env_dir) {
+  bool narrowed = false;
+  std::vector<std::string> files = NarrowContextFiles(env_dir, narrowed);
+  if (!narrowed)
+    return HashEnvContext(env_dir);
+  // Seeded apart from HashEnvContext, so a narrowed hash never equals the
+  // whole-context hash of some other directory
+  static const char kSeed[] = "dockerfile-sources";
+  return HashContextFiles(Fnv1a(kFnvOffset, kSeed, sizeof(kSeed)), env_dir,
+                          files);
+}
+
+// Drop all but the kContextTarKeep newest archives of cache_dir, and
+// copies some writer left behind
+static void PruneContextTars(const std::string &cache_dir) {
+  std::vector<std::pair<long long, std::string>> tars;
+  DIR *d = opendir(cache_dir.c_str());
+  if (!d)
+    return;
+  long long now = (long long)time(nullptr);
+  while (struct dirent *e = readdir(d)) {
+    std::string name = e->d_name;
+    std::string path = cache_dir + "/" + name;
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (name.find(".tar.tmp") != std::string::npos) {
+      if (now - (long long)st.st_mtime > 3600)
+        std::remove(path.c_str());
+    } else if (name.size() > 4 &&
+               name.compare(name.size() - 4, 4, ".tar") == 0) {
+      tars.push_back({(long long)st.st_mtime, path});
+    }
+  }
+  closedir(d);
+  if (tars.size() <= kContextTarKeep)
+    return;
+  std::sort(tars.begin(), tars.end(), std::greater<>());
+  for (size_t i = kContextTarKeep; i < tars.size(); i++)
+    std::remove(tars[i].second.c_str());
+}
+
+std::string CacheDockerContextTar(const std::string &env_dir,
+                                  const std::string &cache_dir) {
+  std::vector<std::string> files = DockerContextFiles(env_dir);
+  std::vector<struct stat> stats(files.size());
+  static const char kSeed[] = "context-tar";
+  uint64_t h = HashContextFiles(Fnv1a(kFnvOffset, kSeed, sizeof(kSeed)),
+                                env_dir, files);
+  for (size_t i = 0; i < files.size(); i++) {
+    if (stat((env_dir + "/" + files[i]).c_str(), &stats[i]) != 0)
+      return std::string();
+    unsigned mode = (unsigned)stats[i].st_mode & 07777;
+    h = Fnv1a(h, &mode, sizeof(mode));
+  }
+  char name[24];
+  snprintf(name, sizeof(name), "%016llx.tar", (unsigned long long)h);
+  std::string path = cache_dir + "/" + name;
+  if (FileExists(path))
+    return path;
+
+  // Callers on different threads or processes may write the same archive
+  static std::atomic<unsigned> serial{0};
+#ifdef _WIN32
+  unsigned long long pid = GetCurrentProcessId();
+#else
+  unsigned long long pid = (unsigned long long)getpid();
+#endif
+  std::string tmp = path + ".tmp" + std::to_string(pid) + "_" +
+                    std::to_string(serial++);
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (!out)
+    return std::string();
+  std::vector<char> buf(64 * 1024);
+  bool ok = true;
+  for (size_t i = 0; ok && i < files.size(); i++) {
+    char header[kTarBlock];
+    uint64_t size = (uint64_t)stats[i].st_size;
+    if (!TarFileHeader(files[i], size, (long long)stats[i].st_mtime, header,
+                       (unsigned)stats[i].st_mode)) {
+      ok = false;
+      break;
+    }
+    FILE *in = fopen((env_dir + "/" + files[i]).c_str(), "rb");
+    if (!in) {
+      ok = false;
+      break;
+    }
+    ok = fwrite(header, 1, kTarBlock, out) == kTarBlock;
+    uint64_t copied = 0;
+    size_t n;
+    while (ok && (n = fread(buf.data(), 1, buf.size(), in)) > 0) {
+      ok = copied + n <= size && fwrite(buf.data(), 1, n, out) == n;
+      copied += n;
+    }
+    fclose(in);
+    // A file that changed size meanwhile would break the archive
+    ok = ok && copied == size;
+    static const char kZeros[kTarBlock] = {};
+    size_t pad = TarPadding(size);
+    ok = ok && fwrite(kZeros, 1, pad, out) == pad;
+  }
+  static const char kEnd[2 * kTarBlock] = {};
+  ok = ok && fwrite(kEnd, 1, sizeof(kEnd), out) == sizeof(kEnd);
+  ok = fclose(out) == 0 && ok;
+  // rename does not replace an existing file on Windows; then the other
+  // writer's copy, with the same contents, is the one kept
+  if (ok && std::rename(tmp.c_str(), path.c_str()) != 0)
+    ok = FileExists(path);
+  std::remove(tmp.c_str());
+  if (!ok)
+    return std::string();
+  PruneContextTars(cache_dir);
+  return path;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                   IMAGE BUILD FARM                    //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+uint64_t HashEnvContext(const std::string &env_dir) {
+  return HashContextFiles(kFnvOffset, env_dir, ListContextFiles(env_dir));
+}
+
+void ImageBuildFarm::Configure(int max_builds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopping_)
+    return;
+  limit_ = max_builds > 0 ? max_builds : kDefaultBuilds;
+  // Workers past a lowered limit idle rather than exit
+  while ((int)workers_.size() < limit_)
+    workers_.emplace_back(&ImageBuildFarm::Work, this, (int)workers_.size());
+  cv_.notify_all();
+}
+
+void ImageBuildFarm::Request(const std::string &task_dir,
+                             const std::string &command, bool speculative) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopping_)
+    return;
+  auto known = dirs_.find(task_dir);
+  if (known != dirs_.end()) {
+    if (!speculative && known->second.speculative) {
+      known->second.speculative = false;
+      if (known->second.hashed)
+        PromoteLocked(known->second.hash);
+      cv_.notify_all();
+    }
+    return;
+  }
+  Dir &dir = dirs_[task_dir];
+  dir.command = command;
+  dir.speculative = speculative;
+  unhashed_.push_back(task_dir);
+  cv_.notify_all();
+}
+
+void ImageBuildFarm::PromoteLocked(uint64_t hash) {
+  auto build = builds_.find(hash);
+  if (build == builds_.end() || !build->second.speculative)
+    return;
+  build->second.speculative = false;
+  auto it = std::find(speculative_.begin(), speculative_.end(), hash);
+  if (it != speculative_.end()) {
+    speculative_.erase(it);
+    queued_.push_back(hash);
+  }
+}
+
+void ImageBuildFarm::Retain(const std::vector<std::string> &task_dirs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (dirs_.empty())
+    return;
+  std::vector<std::string> keep = task_dirs;
+  std::sort(keep.begin(), keep.end());
+  auto kept = [&](const std::string &dir) {
+    return std::binary_search(keep.begin(), keep.end(), dir);
+  };
+  std::vector<uint64_t> used;
+  for (auto it = dirs_.begin(); it != dirs_.end();) {
+    if (!kept(it->first)) {
+      it = dirs_.erase(it);
+      continue;
+    }
+    if (it->second.hashed)
+      used.push_back(it->second.hash);
+    ++it;
+  }
+  unhashed_.erase(std::remove_if(unhashed_.begin(), unhashed_.end(),
+                                 [&](const std::string &dir) {
+                                   return !kept(dir);
+                                 }),
+                  unhashed_.end());
+  std::sort(used.begin(), used.end());
+  for (auto it = builds_.begin(); it != builds_.end();) {
+    bool unused = !std::binary_search(used.begin(), used.end(), it->first);
+    if (unused && it->second.state == State::Building &&
+        it->second.speculative)
+      it->second.stop->store(true); // nobody is waiting for it
+    if (unused && it->second.state != State::Building)
+      it = builds_.erase(it);
+    else
+      ++it;
+  }
+  auto gone = [&](uint64_t hash) { return !builds_.count(hash); };
+  queued_.erase(std::remove_if(queued_.begin(), queued_.end(), gone),
+                queued_.end());
+  speculative_.erase(
+      std::remove_if(speculative_.begin(), speculative_.end(), gone),
+      speculative_.end());
+}
+
+ImageBuildFarm::State
+ImageBuildFarm::StateLocked(const std::string &task_dir) const {
+  auto dir = dirs_.find(task_dir);
+  if (dir == dirs_.end())
+    return State::Unknown;
+  if (!dir->second.hashed)
+    return State::Queued;
+  auto build = builds_.find(dir->second.hash);
+  return build == builds_.end() ? State::Unknown : build->second.state;
+}
+
+ImageBuildFarm::State ImageBuildFarm::StateOf(const std::string &task_dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return StateLocked(task_dir);
+}
+
+ImageBuildFarm::State ImageBuildFarm::Wait(const std::string &task_dir) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  State state;
+  cv_.wait(lock, [&] {
+    state = StateLocked(task_dir);
+    return stopping_ ||
+           (state != State::Queued && state != State::Building);
+  });
+  return state;
+}
+
+int ImageBuildFarm::Building() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return building_;
+}
+
+void ImageBuildFarm::Stop() {
+  std::vector<std::thread> workers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    for (auto &build : builds_)
+      build.second.stop->store(true);
+    workers.swap(workers_);
+  }
+  cv_.notify_all();
+  for (auto &t : workers)
+    t.join();
+}
+
+// A worker hashes new directories first, so duplicates are found before
+// their builds start, then takes the oldest queued build; a speculative one
+// only when no other build is queued or running
+void ImageBuildFarm::Work(int index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto idle = [&] { return queued_.empty() && building_ == 0; };
+  while (true) {
+    cv_.wait(lock, [&] {
+      return stopping_ ||
+             (index < limit_ &&
+              (!unhashed_.empty() || !queued_.empty() ||
+               (!speculative_.empty() && idle())));
+    });
+    if (stopping_)
+      return;
+    if (!unhashed_.empty()) {
+      std::string task_dir = unhashed_.front();
+      unhashed_.pop_front();
+      lock.unlock();
+      uint64_t hash = HashDockerContext(task_dir + "/env");
+      lock.lock();
+      auto dir = dirs_.find(task_dir);
+      if (dir == dirs_.end())
+        continue; // forgotten meanwhile
+      dir->second.hashed = true;
+      dir->second.hash = hash;
+      if (!builds_.count(hash)) {
+        Build &build = builds_[hash];
+        build.command = dir->second.command;
+        build.speculative = dir->second.speculative;
+        (build.speculative ? speculative_ : queued_).push_back(hash);
+      } else if (!dir->second.speculative) {
+        PromoteLocked(hash);
+      }
+      cv_.notify_all();
+      continue;
+    }
+    std::deque<uint64_t> &from = queued_.empty() ? speculative_ : queued_;
+    uint64_t hash = from.front();
+    from.pop_front();
+    auto build = builds_.find(hash);
+    if (build == builds_.end())
+      continue;
+    build->second.state = State::Building;
+    building_++;
+    std::string command = build->second.command;
+    std::shared_ptr<std::atomic<bool>> stop = build->second.stop;
+    lock.unlock();
+    bool ok = build_(command, *stop);
+    lock.lock();
+    building_--;
+    // Retain keeps builds in progress, so the entry is still there
+    Build &done = builds_[hash];
+    if (*stop && !stopping_) {
+      // A speculative build Retain stopped: it starts over if some
+      // directory has asked for it again since, or is forgotten
+      bool wanted = false;
+      for (const auto &dir : dirs_)
+        wanted |= dir.second.hashed && dir.second.hash == hash;
+      if (wanted) {
+        done.state = State::Queued;
+        done.stop = std::make_shared<std::atomic<bool>>(false);
+        (done.speculative ? speculative_ : queued_).push_back(hash);
+      } else {
+        builds_.erase(hash);
+      }
+    } else {
+      done.state = ok ? State::Ready : State::Failed;
+    }
+    cv_.notify_all();
+  }
+}
+
+void BaseImagePuller::Configure(int max_pulls) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopping_)
+    return;
+  limit_ = max_pulls > 0 ? max_pulls : kDefaultPulls;
+  // Workers past a lowered limit idle rather than exit
+  while ((int)workers_.size() < limit_)
+    workers_.emplace_back(&BaseImagePuller::Work, this, (int)workers_.size());
+  cv_.notify_all();
+}
+
+void BaseImagePuller::Schedule(const std::vector<std::string> &task_dirs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopping_ || task_dirs == dirs_)
+    return;
+  dirs_ = task_dirs;
+  rescheduled_ = true;
+  cv_.notify_all();
+}
+
+BaseImagePuller::State BaseImagePuller::StateOf(const std::string &image) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = images_.find(image);
+  return it == images_.end() ? State::Unknown : it->second;
+}
+
+int BaseImagePuller::Pulling() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pulling_;
+}
+
+int BaseImagePuller::Pulled() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pulled_;
+}
+
+void BaseImagePuller::Stop() {
+  std::vector<std::thread> workers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    stop_ = true;
+    workers.swap(workers_);
+  }
+  cv_.notify_all();
+  for (auto &t : workers)
+    t.join();
+}
+
+// One worker at a time reads the Dockerfiles of a new schedule and orders
+// the queue by it; the others keep pulling meanwhile
+void BaseImagePuller::Work(int index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [&] {
+      return stopping_ ||
+             (index < limit_ &&
+              ((rescheduled_ && !analyzing_) || !queued_.empty()));
+    });
+    if (stopping_)
+      return;
+    if (rescheduled_ && !analyzing_) {
+      rescheduled_ = false;
+      analyzing_ = true;
+      std::vector<std::string> dirs = dirs_;
+      std::map<std::string, std::vector<std::string>> bases;
+      std::vector<std::string> unread;
+      for (const auto &dir : dirs) {
+        auto it = bases_.find(dir);
+        if (it != bases_.end())
+          bases[dir] = it->second;
+        else
+          unread.push_back(dir);
+      }
+      lock.unlock();
+      for (const auto &dir : unread) {
+        std::string env = dir + "/env/";
+        std::shared_ptr<const DockerfileInfo> info =
+            AnalyzeDockerfile(env + "Dockerfile");
+        if (!info)
+          info = AnalyzeDockerfile(env + "dockerfile");
+        bases[dir] = info ? info->BaseImages() : std::vector<std::string>();
+      }
+      lock.lock();
+      analyzing_ = false;
+      bases_ = std::move(bases);
+
+      std::deque<std::string> queued;
+      std::set<std::string> wanted;
+      for (const auto &dir : dirs) {
+        for (const auto &image : bases_[dir]) {
+          if (!wanted.insert(image).second)
+            continue;
+          State &state = images_[image];
+          if (state == State::Unknown || state == State::Queued) {
+            state = State::Queued;
+            queued.push_back(image);
+          }
+        }
+      }
+      for (const auto &image : queued_)
+        if (!wanted.count(image))
+          images_.erase(image);
+      queued_.swap(queued);
+      cv_.notify_all();
+      continue;
+    }
+    std::string image = queued_.front();
+    queued_.pop_front();
+    images_[image] = State::Pulling;
+    pulling_++;
+    lock.unlock();
+    bool ok = pull_(image, stop_);
+    lock.lock();
+    pulling_--;
+    pulled_ += ok;
+    images_[image] = ok ? State::Ready : State::Failed;
+    cv_.notify_all();
+  }
+}
+
+void ImageDirectory::Record(const std::string &hash,
+                            const std::string &endpoint) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Touch(hash).hosts.insert(endpoint);
+}
+
+void ImageDirectory::RecordDigest(const std::string &hash,
+                                  const std::string &ref) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Touch(hash).digest = ref;
+}
+
+bool ImageDirectory::Holds(const std::string &endpoint,
+                           const std::string &hash) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(hash);
+  return it != entries_.end() && it->second.hosts.count(endpoint) != 0;
+}
+
+std::string ImageDirectory::Digest(const std::string &hash) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(hash);
+  return it != entries_.end() ? it->second.digest : std::string();
+}
+
+ImageDirectory::Entry &ImageDirectory::Touch(const std::string &hash) {
+  Entry &entry = entries_[hash];
+  entry.used = ++clock_;
+  if (entries_.size() > kHashes) {
+    auto oldest = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it)
+      if (it->second.used < oldest->second.used)
+        oldest = it;
+    entries_.erase(oldest);
+  }
+  return entry;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                  GEMINI API GOVERNOR                  //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+void ApiGovernor::Configure(int starts_per_minute, int max_running) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  per_second_ = std::max(0, starts_per_minute) / 60.0;
+  max_running_ = std::max(1, max_running);
+  for (auto &kv : keys_) {
+    kv.second.window = std::min(kv.second.window, (double)max_running_);
+    kv.second.tokens = std::min(kv.second.tokens, Burst());
+  }
+}
+
+void ApiGovernor::ConfigureQuota(int prompts_per_day, int reset_hour_utc) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (reset_hour_utc != quota_reset_hour_) {
+    for (auto &kv : keys_)
+      kv.second.quota_used = 0; // the days are another set of hours now
+  }
+  quota_per_day_ = std::max(0, prompts_per_day);
+  quota_reset_hour_ = std::max(0, std::min(23, reset_hour_utc));
+}
+
+int64_t ApiGovernor::QuotaDay(time_t now) const {
+  int64_t since = (int64_t)now - quota_reset_hour_ * 3600;
+  return since >= 0 ? since / 86400 : (since - 86399) / 86400;
+}
+
+// Ten seconds of quota may start at once, within the concurrency limit
+double ApiGovernor::Burst() const {
+  return std::max(1.0, std::min((double)max_running_, per_second_ * 10.0));
+}
+
+ApiGovernor::Key &ApiGovernor::KeyLocked(uint64_t key, Clock::time_point now) {
+  auto it = keys_.find(key);
+  if (it == keys_.end()) {
+    Key &k = keys_[key];
+    k.tokens = Burst();
+    k.window = max_running_;
+    k.refilled = now;
+    return k;
+  }
+  return it->second;
+}
+
+bool ApiGovernor::TryStart(uint64_t key, int running, Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Key &k = KeyLocked(key, now);
+  if (now < k.paused_until || running >= (int)k.window)
+    return false;
+  if (per_second_ > 0.0) {
+    double elapsed = std::chrono::duration<double>(now - k.refilled).count();
+    k.tokens = std::min(Burst(), k.tokens + elapsed * per_second_);
+    k.refilled = now;
+    if (k.tokens < 1.0)
+      return false;
+    k.tokens -= 1.0;
+  }
+  int64_t day = QuotaDay(time(nullptr));
+  if (day != k.quota_day) {
+    k.quota_day = day;
+    k.quota_used = 0;
+  }
+  k.quota_used++;
+  return true;
+}
+
+void ApiGovernor::RateLimited(uint64_t key, double retry_after_s, int attempt,
+                              Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Key &k = KeyLocked(key, now);
+  k.rate_limits++;
+  // Several runs report the same limit; only the first in a pause narrows
+  // the window
+  if (now >= k.paused_until)
+    k.window = std::max(1.0, k.window / 2.0);
+  k.tokens = 0.0;
+  k.refilled = now;
+  // Exponential backoff from 2 s, never shorter than what the API asked
+  // for, stretched by up to half again so paused runs do not retry in step
+  double backoff = std::min(
+      kMaxBackoffSec, 2.0 * (double)(1ULL << std::min(std::max(attempt, 1) - 1,
+                                                      16)));
+  backoff = std::max(backoff, retry_after_s);
+  rng_ ^= rng_ << 13;
+  rng_ ^= rng_ >> 7;
+  rng_ ^= rng_ << 17;
+  backoff *= 1.0 + 0.5 * (double)(rng_ >> 11) / (double)(1ULL << 53);
+  Clock::time_point until =
+      now + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(backoff));
+  k.paused_until = std::max(k.paused_until, until);
+}
+
+void ApiGovernor::Succeeded(uint64_t key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Key &k = KeyLocked(key, Clock::now());
+  k.window = std::min((double)max_running_, k.window + 1.0 / k.window);
+}
+
+ApiGovernor::Status ApiGovernor::StatusOf(uint64_t key,
+                                          Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Status status;
+  auto it = keys_.find(key);
+  if (it == keys_.end()) {
+    status.window = max_running_;
+    return status;
+  }
+  status.window = it->second.window;
+  status.rate_limits = it->second.rate_limits;
+  if (now < it->second.paused_until)
+    status.paused_s =
+        std::chrono::duration<double>(it->second.paused_until - now).count();
+  return status;
+}
+
+ApiGovernor::Quota ApiGovernor::QuotaOf(uint64_t key, time_t now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Quota quota;
+  quota.limit = quota_per_day_;
+  int64_t day = QuotaDay(now);
+  quota.reset_in_s = (double)((day + 1) * 86400 + quota_reset_hour_ * 3600 -
+                              (int64_t)now);
+  auto it = keys_.find(key);
+  if (it != keys_.end() && it->second.quota_day == day)
+    quota.used = it->second.quota_used;
+  return quota;
+}
+
+bool QuotaAllowsStart(const ApiGovernor::Quota &quota, const QuotaPlan &plan,
+                      BatchUrgency urgency, int prompts, int committed,
+                      double must_start_in_s) {
+  if (quota.limit <= 0 || urgency == BatchUrgency::High)
+    return true;
+  double until_offpeak = quota.reset_in_s - plan.offpeak_s;
+  if (urgency == BatchUrgency::Low) {
+    // Waiting for the off-peak window would miss the deadline
+    if (must_start_in_s >= 0.0 && must_start_in_s < until_offpeak)
+      urgency = BatchUrgency::Normal;
+    else if (until_offpeak > 0.0)
+      return false;
+  }
+  double reserve = quota.limit * plan.reserve;
+  if (until_offpeak < 0.0 && plan.offpeak_s > 0.0)
+    reserve *= quota.reset_in_s / plan.offpeak_s;
+  int left = quota.limit - quota.used - committed;
+  return left - prompts >= reserve;
+}
+
+void PassRateInterval(int passed, int total, double &low, double &high) {
+  if (total <= 0) {
+    low = 0.0;
+    high = 1.0;
+    return;
+  }
+  const double z = 1.96;
+  double n = total;
+  double p = passed / n;
+  double denom = 1.0 + z * z / n;
+  double centre = (p + z * z / (2.0 * n)) / denom;
+  double half = z * std::sqrt(p * (1.0 - p) / n + z * z / (4.0 * n * n)) /
+                denom;
+  low = std::max(0.0, centre - half);
+  high = std::min(1.0, centre + half);
+}
+
+std::string BatchStopReason(const BatchPolicy &policy, int passed,
+                            int failed) {
+  if (policy.max_failures > 0 && failed >= policy.max_failures)
+    return std::to_string(failed) + (failed == 1 ? " failure" : " failures");
+  if (policy.target_passes > 0 && passed >= policy.target_passes)
+    return std::to_string(passed) + " passed";
+  if (policy.ci_half_width > 0.0 && passed + failed > 0) {
+    double low, high;
+    PassRateInterval(passed, passed + failed, low, high);
+    if ((high - low) / 2.0 <= policy.ci_half_width) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "pass rate %.0f-%.0f%%", low * 100.0,
+               high * 100.0);
+      return buf;
+    }
+  }
+  return "";
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                      HOST LEASES                      //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+HostLease &HostLease::operator=(HostLease &&other) noexcept {
+  if (this != &other) {
+    Release();
+    pool_ = other.pool_;
+    slot_ = other.slot_;
+    other.pool_ = nullptr;
+    other.slot_ = -1;
+  }
+  return *this;
+}
+
+void HostLease::Release() {
+  if (!pool_)
+    return;
+  pool_->Return(slot_);
+  pool_ = nullptr;
+  slot_ = -1;
+}
+
+HostLeasePool::~HostLeasePool() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CloseSlotsLocked();
+}
+
+void HostLeasePool::Configure(const std::string &dir, int capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = std::max(0, std::min(kMaxSlots, capacity));
+  if (dir == dir_)
+    return;
+  // Slots leased from the old directory stay leased until they are given
+  // back; the rest are let go at once
+  for (size_t i = 0; i < slots_.size(); i++) {
+    if (!slots_[i].held)
+      UnlockSlotLocked((int)i);
+  }
+  dir_ = dir;
+  limits_read_ = false;
+  file_capacity_ = -1;
+  if (dir_.empty())
+    return;
+#ifdef _WIN32
+  CreateDirectoryA(dir_.c_str(), NULL);
+#else
+  // Shared by every user of the host, like /tmp
+  if (mkdir(dir_.c_str(), 0777) == 0)
+    chmod(dir_.c_str(), 01777);
+#endif
+}
+
+int HostLeasePool::CapacityLocked() {
+  if (dir_.empty())
+    return 0;
+  auto now = std::chrono::steady_clock::now();
+  if (!limits_read_ ||
+      now - limits_read_at_ >= std::chrono::seconds(kLimitsRecheckSec)) {
+    limits_read_ = true;
+    limits_read_at_ = now;
+    file_capacity_ = -1;
+    FILE *f = fopen((dir_ + "/limits.json").c_str(), "rb");
+    if (f) {
+      std::string text;
+      char buf[4096];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+      fclose(f);
+      JsonValue limits;
+      int value = JsonParser(text).Parse(limits)
+                      ? limits.GetInt(pool_.c_str(), -1)
+                      : -1;
+      if (value >= 0)
+        file_capacity_ = std::min(kMaxSlots, value);
+    }
+  }
+  return file_capacity_ >= 0 ? file_capacity_ : capacity_;
+}
+
+bool HostLeasePool::LockSlotLocked(int slot) {
+  if ((int)slots_.size() <= slot)
+    slots_.resize(slot + 1);
+  Slot &s = slots_[slot];
+  std::string path = dir_ + "/" + pool_ + "." + std::to_string(slot) + ".lock";
+#ifdef _WIN32
+  if (s.file == -1) {
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+      return false;
+    s.file = (intptr_t)h;
+  }
+  OVERLAPPED at{};
+  return LockFileEx((HANDLE)s.file,
+                    LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1,
+                    0, &at) != 0;
+#else
+  if (s.file == -1) {
+    int fd = open(path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return false;
+    s.file = fd;
+  }
+  return flock((int)s.file, LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+// Unlocking closes the file too, so a slot file is only held open while it
+// is leased or being tried
+void HostLeasePool::UnlockSlotLocked(int slot) {
+  Slot &s = slots_[slot];
+  s.held = false;
+  if (s.file == -1)
+    return;
+#ifdef _WIN32
+  CloseHandle((HANDLE)s.file);
+#else
+  close((int)s.file);
+#endif
+  s.file = -1;
+}
+
+void HostLeasePool::CloseSlotsLocked() {
+  for (size_t i = 0; i < slots_.size(); i++)
+    UnlockSlotLocked((int)i);
+}
+
+bool HostLeasePool::TryAcquire(HostLease &lease) {
+  lease.Release();
+  std::lock_guard<std::mutex> lock(mutex_);
+  int capacity = CapacityLocked();
+  if (capacity == 0)
+    return true;
+  for (int i = 0; i < capacity; i++) {
+    if (i < (int)slots_.size() && slots_[i].held)
+      continue;
+    if (LockSlotLocked(i)) {
+      slots_[i].held = true;
+      lease.pool_ = this;
+      lease.slot_ = i;
+      return true;
+    }
+    UnlockSlotLocked(i);
+  }
+  return false;
+}
+
+bool HostLeasePool::Acquire(HostLease &lease, const std::atomic<bool> *stop) {
+  while (!TryAcquire(lease)) {
+    for (int i = 0; i < 10; i++) {
+      if (stop && stop->load())
+        return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+  return true;
+}
+
+int HostLeasePool::Leased() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int capacity = CapacityLocked();
+  int leased = 0;
+  for (int i = 0; i < capacity; i++) {
+    if (i < (int)slots_.size() && slots_[i].held) {
+      leased++;
+      continue;
+    }
+    if (!LockSlotLocked(i))
+      leased++;
+    UnlockSlotLocked(i);
+  }
+  return leased;
+}
+
+int HostLeasePool::Capacity() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return CapacityLocked();
+}
+
+void HostLeasePool::Return(int slot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (slot >= 0 && slot < (int)slots_.size())
+    UnlockSlotLocked(slot);
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                     RUN DISPATCH                      //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+int TaskTypePriority(const std::string &task_type, BatchUrgency urgency) {
+  int base = task_type == "Verify" ? 0 : task_type == "Audit" ? 2 : 1;
+  if (urgency == BatchUrgency::High)
+    return base - 10;
+  return urgency == BatchUrgency::Low ? base + 10 : base;
+}
+
+size_t
+PickQueuedTask(const std::vector<QueuedTask> &queue,
+               const std::map<std::string, uint64_t> &group_last_dispatch,
+               QueueOrder order, const std::vector<double> &expected) {
+  std::vector<double> rank;
+  if (order != QueueOrder::Fair && expected.size() == queue.size()) {
+    double sum = 0.0;
+    int known = 0;
+    for (double seconds : expected) {
+      if (seconds >= 0.0) {
+        sum += seconds;
+        known++;
+      }
+    }
+    if (known > 0) {
+      rank = expected;
+      for (double &seconds : rank) {
+        if (seconds < 0.0)
+          seconds = sum / known;
+        if (order == QueueOrder::LongestFirst)
+          seconds = -seconds;
+      }
+    }
+  }
+  // No deadline sorts after every deadline
+  auto deadline = [](const QueuedTask &job) {
+    return job.deadline != 0 ? (uint64_t)job.deadline : UINT64_MAX;
+  };
+  size_t best = queue.size();
+  uint64_t best_turn = 0;
+  for (size_t i = 0; i < queue.size(); i++) {
+    if (queue[i].deferred)
+      continue;
+    auto it = group_last_dispatch.find(queue[i].group);
+    uint64_t turn = it != group_last_dispatch.end() ? it->second : 0;
+    if (best == queue.size()) {
+      best = i;
+      best_turn = turn;
+      continue;
+    }
+    const QueuedTask &a = queue[i];
+    const QueuedTask &b = queue[best];
+    bool ranked = !rank.empty() && rank[i] != rank[best];
+    if ((ranked && rank[i] < rank[best]) ||
+        (!ranked &&
+         (a.priority < b.priority ||
+          (a.priority == b.priority &&
+           (deadline(a) < deadline(b) ||
+            (deadline(a) == deadline(b) &&
+             (turn < best_turn ||
+              (turn == best_turn && a.seq < b.seq)))))))) {
+      best = i;
+      best_turn = turn;
+    }
+  }
+  return best;
+}
+
+int PlaceQueuedTask(const std::vector<PlacementHost> &hosts, bool by_image) {
+  if (by_image) {
+    for (size_t i = 0; i < hosts.size(); i++)
+      if (hosts[i].holds_image && hosts[i].free > 0)
+        return (int)i;
+  }
+  for (size_t i = 1; i < hosts.size(); i++)
+    if (hosts[i].last_of_group && hosts[i].free > 0)
+      return (int)i;
+  if (!hosts.empty() && hosts[0].free > 0)
+    return 0;
+  int best = -1;
+  int best_free = 0;
+  for (size_t i = 1; i < hosts.size(); i++) {
+    if (hosts[i].free > best_free) {
+      best_free = hosts[i].free;
+      best = (int)i;
+    }
+  }
+  return best;
+}
+
+void SampleHostLoad(HostLoadSample &out) {
+  out.cpus = std::max(1u, std::thread::hardware_concurrency());
+#ifdef _WIN32
+  MEMORYSTATUSEX mem{};
+  mem.dwLength = sizeof(mem);
+  if (GlobalMemoryStatusEx(&mem)) {
+    out.mem_total = mem.ullTotalPhys;
+    out.mem_available = mem.ullAvailPhys;
+  }
+  // No load average on Windows: busy cores since the previous sample
+  static ULONGLONG prev_idle = 0, prev_total = 0;
+  FILETIME idle_ft, kernel_ft, user_ft;
+  if (GetSystemTimes(&idle_ft, &kernel_ft, &user_ft)) {
+    auto ticks = [](const FILETIME &ft) {
+      return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    };
+    ULONGLONG idle = ticks(idle_ft);
+    ULONGLONG total = ticks(kernel_ft) + ticks(user_ft); // kernel has idle
+    if (prev_total != 0 && total > prev_total) {
+      double busy = 1.0 - (double)(idle - prev_idle) / (total - prev_total);
+      out.load = std::max(0.0, busy) * out.cpus;
+    }
+    prev_idle = idle;
+    prev_total = total;
+  }
+#elif defined(__APPLE__)
+  double load = 0.0;
+  if (getloadavg(&load, 1) == 1)
+    out.load = load;
+  uint64_t memsize = 0;
+  size_t len = sizeof(memsize);
+  if (sysctlbyname("hw.memsize", &memsize, &len, NULL, 0) == 0)
+    out.mem_total = memsize;
+  vm_statistics64_data_t vm{};
+  mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+  if (host_statistics64(mach_host_self(), HOST_VM_INFO64,
+                        (host_info64_t)&vm, &count) == KERN_SUCCESS) {
+    out.mem_available =
+        (uint64_t)(vm.free_count + vm.inactive_count) * vm_page_size;
+  }
+#else
+  if (FILE *f = fopen("/proc/loadavg", "r")) {
+    double load = 0.0;
+    if (fscanf(f, "%lf", &load) == 1)
+      out.load = load;
+    fclose(f);
+  }
+  if (FILE *f = fopen("/proc/meminfo", "r")) {
+    char line[128];
+    unsigned long long kb = 0;
+    while (fgets(line, sizeof(line), f)) {
+      if (sscanf(line, "MemTotal: %llu kB", &kb) == 1)
+        out.mem_total = kb * 1024;
+      else if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1)
+        out.mem_available = kb * 1024;
+    }
+    fclose(f);
+  }
+#endif
+}
+
+int AdaptiveBuildBudget(int max_build_tasks, int cpus) {
+  if (max_build_tasks > 0)
+    return max_build_tasks;
+  return std::max(1, cpus / kCoresPerBuild);
+}
+
+const char *AdaptiveHoldReason(const AdmissionLoad &load) {
+  if (load.running == 0)
+    return nullptr; // an idle app always starts something
+  if (load.running >= load.task_limit)
+    return "all build and prompt slots in use";
+  if (load.heavy >= load.build_budget)
+    return "build slots in use";
+  if (!load.host_fresh)
+    return "measuring host load";
+  const HostLoadSample &host = load.host;
+  if (host.load >= 0.0 && host.load >= host.cpus * kMaxLoadPerCore)
+    return "host CPU is saturated";
+  if (host.mem_total != 0 && host.mem_available < kBuildMemoryReserve)
+    return "host memory is low";
+  // Runs that have not reached their usual peak yet will take more
+  if (host.mem_total != 0 &&
+      (load.expected_mib << 20) + kBuildMemoryReserve >= host.mem_total)
+    return "running tasks are expected to fill host memory";
+  if (host.containers >= 0 &&
+      host.containers >= host.cpus * kMaxContainersPerCore)
+    return "Docker is running many containers";
+  return nullptr;
+}
+
+void SmoothTaskTypeEstimate(std::map<std::string, double> &estimates,
+                            const std::string &task_type, double value) {
+  auto it = estimates.find(task_type);
+  if (it == estimates.end())
+    estimates[task_type] = value;
+  else
+    it->second = 0.7 * it->second + 0.3 * value;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//               PHASE TIMING & RUN EVENTS               //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Next space-separated word of line, consumed
+static std::string_view NextWord(std::string_view &line) {
+  size_t start = line.find_first_not_of(' ');
+  if (start == std::string_view::npos) {
+    line = std::string_view();
+    return line;
+  }
+  line.remove_prefix(start);
+  size_t end = std::min(line.find(' '), line.size());
+  std::string_view word = line.substr(0, end);
+  line.remove_prefix(end);
+  return word;
+}
+
+static bool ParseInteger(std::string_view word, long long &out) {
+  bool negative = !word.empty() && word.front() == '-';
+  if (negative)
+    word.remove_prefix(1);
+  if (word.empty() || word.size() > 18)
+    return false;
+  long long value = 0;
+  for (char c : word) {
+    if (c < '0' || c > '9')
+      return false;
+    value = value * 10 + (c - '0');
+  }
+  out = negative ? -value : value;
+  return true;
+}
+
+bool ApplyTimingMarker(std::string_view line,
+                       std::vector<PhaseTiming> &timeline) {
+  static const std::string_view kPrefix = "[TIMING] ";
+  if (line.substr(0, kPrefix.size()) != kPrefix)
+    return false;
+  line.remove_prefix(kPrefix.size());
+  while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+    line.remove_suffix(1);
+  std::string_view kind = NextWord(line);
+  std::string_view name = NextWord(line);
+  long long ms = 0;
+  if (name.empty() || !ParseInteger(NextWord(line), ms) || ms <= 0)
+    return false;
+  if (kind == "begin") {
+    PhaseTiming phase;
+    phase.name = std::string(name);
+    phase.start_ms = ms;
+    timeline.push_back(std::move(phase));
+    return true;
+  }
+  long long exit_code = 0;
+  if (kind != "end" || !ParseInteger(NextWord(line), exit_code))
+    return false;
+  // The latest unfinished phase of that name
+  for (auto it = timeline.rbegin(); it != timeline.rend(); ++it) {
+    if (it->end_ms == 0 && it->name == name) {
+      it->end_ms = std::max(ms, it->start_ms);
+      it->exit_code = (int)exit_code;
+      break;
+    }
+  }
+  return true;
+}
+
+bool ParseScriptEvent(std::string_view line, ScriptEvent &event) {
+  static const std::string_view kPrefix = "[EVENT] ";
+  if (line.substr(0, kPrefix.size()) != kPrefix)
+    return false;
+  line.remove_prefix(kPrefix.size());
+  while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+    line.remove_suffix(1);
+  std::string_view kind = NextWord(line);
+  std::string_view field = NextWord(line);
+  size_t start = line.find_first_not_of(' ');
+  if (field.empty() || start == std::string_view::npos)
+    return false;
+  event.kind = std::string(kind);
+  event.field = std::string(field);
+  event.value = std::string(line.substr(start));
+  return true;
+}
+
+// "12.3s" as seconds; -1 if it is not a decimal number of seconds
+static double ParseSeconds(std::string_view word) {
+  if (word.size() < 2 || word.back() != 's')
+    return -1.0;
+  word.remove_suffix(1);
+  double value = 0.0, scale = 0.0;
+  for (char c : word) {
+    if (c == '.' && scale == 0.0) {
+      scale = 1.0;
+    } else if (c >= '0' && c <= '9') {
+      value = value * 10 + (c - '0');
+      scale *= 10;
+    } else {
+      return -1.0;
+    }
+  }
+  return scale > 0.0 ? value / scale : value;
+}
+
+// Stage and position of a Dockerfile step from its bracketed prefix:
+// "[builder 2/4]", "[2/4]" (the unnamed stage) or "[internal]"
+static void ParseStepName(BuildStep &step) {
+  std::string_view name = step.name;
+  size_t close = name.find(']');
+  if (name.empty() || name.front() != '[' || close == std::string_view::npos)
+    return;
+  std::string_view inside = name.substr(1, close - 1);
+  size_t space = inside.rfind(' ');
+  std::string_view position =
+      space == std::string_view::npos ? inside : inside.substr(space + 1);
+  size_t slash = position.find('/');
+  long long index = 0, count = 0;
+  if (slash != std::string_view::npos &&
+      ParseInteger(position.substr(0, slash), index) &&
+      ParseInteger(position.substr(slash + 1), count) && index > 0 &&
+      count >= index) {
+    step.index = (int)index;
+    step.count = (int)count;
+    inside = space == std::string_view::npos ? std::string_view()
+                                             : inside.substr(0, space);
+  }
+  step.stage = std::string(inside);
+}
+
+void BuildStepParser::Clear() {
+  steps_.clear();
+  by_id_.clear();
+  build_ = 0;
+  build_start_ = 0;
+}
+
+void BuildStepParser::StartBuild() {
+  if (steps_.size() == build_start_)
+    return; // nothing of the current build yet
+  build_++;
+  build_start_ = steps_.size();
+  by_id_.clear();
+}
+
+bool BuildStepParser::Feed(std::string_view line, int64_t ms, uint64_t seq) {
+  if (line.size() < 2 || line[0] != '#' || line[1] < '0' || line[1] > '9')
+    return false;
+  size_t end = 1;
+  long long id = 0;
+  while (end < line.size() && line[end] >= '0' && line[end] <= '9')
+    end++;
+  if ((end < line.size() && line[end] != ' ') ||
+      !ParseInteger(line.substr(1, end - 1), id) || id > 1000000)
+    return false;
+  std::string_view text = line.substr(end);
+  while (!text.empty() && text.front() == ' ')
+    text.remove_prefix(1);
+  while (!text.empty() && (text.back() == '\r' || text.back() == ' '))
+    text.remove_suffix(1);
+  // #0 is the builder's banner, which starts every build
+  if (id == 0) {
+    StartBuild();
+    return true;
+  }
+  // A build without the banner following a finished one
+  if (id == 1 && by_id_.size() > 1 && by_id_[1] >= 0 &&
+      steps_[by_id_[1]].Finished() && text == steps_[by_id_[1]].name)
+    StartBuild();
+  if ((size_t)id >= by_id_.size())
+    by_id_.resize((size_t)id + 1, -1);
+  if (by_id_[id] < 0) {
+    if (text.empty())
+      return true;
+    by_id_[id] = (int)steps_.size();
+    steps_.emplace_back();
+    BuildStep &step = steps_.back();
+    step.id = (int)id;
+    step.build = build_;
+    step.name = std::string(text);
+    step.start_ms = step.end_ms = ms;
+    step.first_line = step.last_line = seq;
+    ParseStepName(step);
+    return true;
+  }
+  BuildStep &step = steps_[by_id_[id]];
+  step.end_ms = std::max(step.end_ms, ms);
+  step.last_line = std::max(step.last_line, seq);
+  if (text == step.name)
+    return true; // the header again, as output switches back to the step
+  std::string_view rest = text;
+  std::string_view word = NextWord(rest);
+  if (word == "DONE") {
+    step.state = BuildStep::Done;
+    step.seconds = ParseSeconds(NextWord(rest));
+  } else if (word == "CACHED" && rest.empty()) {
+    step.state = BuildStep::Cached;
+  } else if (word == "CANCELED" && rest.empty()) {
+    step.state = BuildStep::Canceled;
+  } else if (word == "ERROR" || word == "ERROR:") {
+    step.state = BuildStep::Error;
+    size_t start = rest.find_first_not_of(' ');
+    if (start != std::string_view::npos)
+      step.error = std::string(rest.substr(start));
+  } else {
+    step.output_lines++;
+  }
+  return true;
+}
+
+std::vector<std::vector<double>>
+DockerfileStepSeconds(const DockerfileInfo &info,
+                      const std::vector<BuildStep> &steps) {
+  std::vector<std::vector<double>> seconds(info.stages.size());
+  for (size_t s = 0; s < info.stages.size(); s++)
+    seconds[s].assign(info.stages[s].steps.size(), -1.0);
+  for (const BuildStep &step : steps) {
+    if (step.state != BuildStep::Done || step.count == 0)
+      continue;
+    size_t close = step.name.find("] ");
+    if (close == std::string::npos)
+      continue;
+    std::string_view rest = std::string_view(step.name).substr(close + 2);
+    std::string keyword = Upper(std::string(NextWord(rest)));
+    // "[linux/arm64 builder 2/4]" when building for another platform
+    std::string label = Lower(step.stage.substr(step.stage.rfind(' ') + 1));
+    for (size_t s = 0; s < info.stages.size(); s++) {
+      const DockerfileStage &stage = info.stages[s];
+      // BuildKit calls unnamed stages stage-N, or nothing in a build of one
+      std::string name = !stage.name.empty()      ? stage.name
+                         : info.stages.size() > 1 ? "stage-" + std::to_string(s)
+                                                  : std::string();
+      if (name != label || (int)stage.steps.size() != step.count ||
+          stage.steps[step.index - 1].keyword != keyword)
+        continue;
+      seconds[s][step.index - 1] = step.DurationMs(step.end_ms) / 1000.0;
+      break;
+    }
+  }
+  return seconds;
+}
+
+namespace {
+
+// Whether a RUN command refreshes or installs system or language packages
+bool RunInstalls(const std::string &command) {
+  static const char *const kInstalls[] = {
+      "apt-get install", "apt install",    "apk add",        "yum install",
+      "dnf install",     "microdnf install", "zypper install", "pip install",
+      "pip3 install",    "pipenv install", "poetry install", "uv sync",
+      "uv pip install",  "conda install",  "npm install",    "npm ci",
+      "yarn install",    "pnpm install",   "go mod download", "cargo fetch",
+      "bundle install",  "gem install",    "composer install"};
+  for (const char *install : kInstalls)
+    if (command.find(install) != std::string::npos)
+      return true;
+  return false;
+}
+
+bool RunUpdatesIndex(const std::string &command) {
+  static const char *const kUpdates[] = {"apt-get update", "apt update",
+                                         "apk update", "yum makecache",
+                                         "dnf makecache", "zypper refresh"};
+  for (const char *update : kUpdates)
+    if (command.find(update) != std::string::npos)
+      return true;
+  return false;
+}
+
+// Whether a COPY source only names files package managers read to resolve
+// dependencies, the ones worth copying ahead of an install
+bool DependencyManifest(const std::string &source) {
+  static const char *const kManifests[] = {
+      "package.json",   "package-lock.json", "npm-shrinkwrap.json",
+      "yarn.lock",      "pnpm-lock.yaml",    "requirements*.txt",
+      "constraints*.txt", "Pipfile",         "Pipfile.lock",
+      "pyproject.toml", "poetry.lock",       "uv.lock",
+      "setup.cfg",      "environment.yml",   "go.mod",
+      "go.sum",         "Cargo.toml",        "Cargo.lock",
+      "Gemfile",        "Gemfile.lock",      "composer.json",
+      "composer.lock",  "*.csproj",          "pom.xml",
+      "build.gradle",   "build.gradle.kts",  "settings.gradle"};
+  std::string base = source.substr(source.rfind('/') + 1);
+  for (const char *manifest : kManifests)
+    if (ContextGlobMatch(manifest, base.c_str()))
+      return true;
+  return false;
+}
+
+// What a build pays for steps of a stage: -1 when none was timed
+double StepsSeconds(const std::vector<std::vector<double>> &step_seconds,
+                    int stage, const std::vector<int> &steps) {
+  double total = -1.0;
+  for (int step : steps) {
+    if ((size_t)stage >= step_seconds.size() ||
+        (size_t)step >= step_seconds[stage].size() ||
+        step_seconds[stage][step] < 0.0)
+      continue;
+    total = std::max(total, 0.0) + step_seconds[stage][step];
+  }
+  return total;
+}
+
+} // namespace
+
+std::vector<DockerfileFinding>
+LintDockerfile(const DockerfileInfo &info,
+               const std::vector<std::vector<double>> &step_seconds) {
+  std::vector<DockerfileFinding> findings;
+  for (size_t s = 0; s < info.stages.size(); s++) {
+    const std::vector<DockerfileStep> &steps = info.stages[s].steps;
+    std::vector<std::string> commands(steps.size());
+    for (size_t i = 0; i < steps.size(); i++)
+      if (steps[i].keyword == "RUN")
+        commands[i] = Lower(steps[i].text);
+    for (size_t i = 0; i < steps.size(); i++) {
+      const DockerfileStep &step = steps[i];
+      DockerfileFinding finding;
+      finding.stage = (int)s;
+      finding.step = (int)i;
+      finding.line = step.line;
+      if (step.keyword == "COPY" || step.keyword == "ADD") {
+        bool manifests_only = !step.sources.empty();
+        for (const auto &source : step.sources)
+          manifests_only = manifests_only && DependencyManifest(source);
+        if (!step.sources.empty() && !manifests_only) {
+          for (size_t j = i + 1; j < steps.size(); j++)
+            if (RunInstalls(commands[j]))
+              finding.reruns.push_back((int)j);
+        }
+        if (!finding.reruns.empty()) {
+          finding.rule = "copy-before-install";
+          finding.message =
+              step.keyword + " at line " + std::to_string(step.line) +
+              " comes before the install at line " +
+              std::to_string(steps[finding.reruns[0]].line) +
+              ", so editing any file it copies reinstalls packages; install "
+              "from the dependency manifests first and copy the rest after";
+        } else if (step.remote) {
+          finding.rule = "remote-add";
+          finding.reruns.push_back((int)i);
+          finding.message =
+              "ADD at line " + std::to_string(step.line) +
+              " downloads its URL on every build; fetch it in a RUN with a "
+              "pinned version, or ADD --checksum";
+        }
+      } else if (step.keyword == "RUN" && RunUpdatesIndex(commands[i]) &&
+                 !RunInstalls(commands[i])) {
+        finding.rule = "update-alone";
+        finding.message =
+            "RUN at line " + std::to_string(step.line) +
+            " refreshes the package index in a layer of its own, which "
+            "stays cached while later installs change; update and install "
+            "in one RUN";
+      }
+      if (finding.rule.empty())
+        continue;
+      finding.seconds = StepsSeconds(step_seconds, (int)s, finding.reruns);
+      findings.push_back(std::move(finding));
+    }
+  }
+  std::stable_sort(findings.begin(), findings.end(),
+                   [](const DockerfileFinding &a, const DockerfileFinding &b) {
+                     return a.seconds > b.seconds;
+                   });
+  return findings;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                      LOG PIPELINE                     //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+std::vector<std::string> ParseShellCommand(const std::string &command) {
+  std::vector<std::string> tokens;
+  std::string current_token;
+  bool in_single_quote = false;
+  bool in_double_quote = false;
+  bool escaped = false;
+
+  for (size_t i = 0; i < command.length(); ++i) {
+    char c = command[i];
+
+    if (escaped) {
+      current_token += c;
+      escaped = false;
+    } else if (c == '\\') {
+      escaped = true;
+    } else if (c == '\'' && !in_double_quote) {
+      in_single_quote = !in_single_quote;
+    } else if (c == '"' && !in_single_quote) {
+      in_double_quote = !in_double_quote;
+    } else if (c == ' ' && !in_single_quote && !in_double_quote) {
+      if (!current_token.empty()) {
+        tokens.push_back(current_token);
+        current_token.clear();
+      }
+    } else {
+      current_token += c;
+    }
+  }
+
+  if (!current_token.empty()) {
+    tokens.push_back(current_token);
+  }
+
+  return tokens;
+}
+
+size_t StripAnsiInPlace(char *p, size_t n) {
+  char *end = p + n;
+  char *src = (char *)memchr(p, '\033', n);
+  if (src == nullptr)
+    return n;
+  char *dst = src;
+  while (src < end) {
+    // src is at an ESC byte
+    char *q = src + 1;
+    if (q < end && *q == '[') {
+      q++;
+      while (q < end && *q != '\033' && !(*q >= 0x40 && *q <= 0x7E))
+        q++;
+      if (q >= end)
+        break;
+      if (*q != '\033') // an ESC aborts the sequence and starts the next
+        q++;
+    } else if (q < end && *q == ']') {
+      q++;
+      while (q < end && *q != '\a' &&
+             !(*q == '\033' && q + 1 < end && q[1] == '\\'))
+        q++;
+      if (q >= end)
+        break;
+      q += (*q == '\a') ? 1 : 2;
+    } else {
+      while (q < end && *q >= 0x20 && *q <= 0x2F)
+        q++;
+      if (q < end)
+        q++;
+    }
+
+    // Keep the plain text up to the next escape
+    char *next = (char *)memchr(q, '\033', end - q);
+    if (next == nullptr)
+      next = end;
+    memmove(dst, q, next - q);
+    dst += next - q;
+    src = next;
+  }
+  return dst - p;
+}
+
+std::vector<LogSeverityRule> DefaultLogSeverityRules() {
+  return {{LogSeverity::Error, "[ERROR]"},
+          {LogSeverity::Error, "error:"},
+          {LogSeverity::Error, "Error"},
+          {LogSeverity::Error, "failed"},
+          {LogSeverity::Success, "[SUCCESS]"},
+          {LogSeverity::Success, "success"},
+          {LogSeverity::Success, "Passed"},
+          {LogSeverity::Warning, "[WARN]"},
+          {LogSeverity::Warning, "warning:"},
+          {LogSeverity::Info, "[INFO]"},
+          {LogSeverity::Stopped, "[STOPPED]"}};
+}
+
+const char *LogSeverityName(LogSeverity severity) {
+  switch (severity) {
+  case LogSeverity::Error:
+    return "error";
+  case LogSeverity::Success:
+    return "success";
+  case LogSeverity::Warning:
+    return "warning";
+  case LogSeverity::Info:
+    return "info";
+  case LogSeverity::Stopped:
+    return "stopped";
+  default:
+    return "none";
+  }
+}
+
+std::string FormatLogSeverityRule(const LogSeverityRule &rule) {
+  return std::string(LogSeverityName(rule.severity)) + ":" + rule.pattern;
+}
+
+bool ParseLogSeverityRule(const std::string &text, LogSeverityRule &rule) {
+  size_t colon = text.find(':');
+  if (colon == std::string::npos || colon + 1 >= text.size())
+    return false;
+  std::string name = text.substr(0, colon);
+  for (size_t i = 1; i < kLogSeverityCount; i++) {
+    if (name == LogSeverityName((LogSeverity)i)) {
+      rule.severity = (LogSeverity)i;
+      rule.pattern = text.substr(colon + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+LogClassifier::LogClassifier(const std::vector<LogSeverityRule> &rules,
+                             const std::vector<std::string> &triggers) {
+  next_.assign(256, -1);
+  out_.push_back(0);
+  std::vector<uint32_t> hits(1, 0);
+  // State reached at the end of pattern, adding the states it needs
+  auto insert = [&](const std::string &pattern) {
+    int32_t s = 0;
+    for (unsigned char c : pattern) {
+      if (next_[(size_t)s * 256 + c] < 0) {
+        next_[(size_t)s * 256 + c] = (int32_t)out_.size();
+        out_.push_back(0);
+        hits.push_back(0);
+        next_.resize(next_.size() + 256, -1);
+      }
+      s = next_[(size_t)s * 256 + c];
+    }
+    return s;
+  };
+  for (const auto &rule : rules) {
+    if (rule.pattern.empty())
+      continue;
+    int32_t s = insert(rule.pattern);
+    out_[s] = std::max(out_[s], (uint8_t)rule.severity);
+    top_ = std::max(top_, (uint8_t)rule.severity);
+  }
+  for (size_t i = 0; i < triggers.size() && i < kMaxLogTriggers; i++)
+    if (!triggers[i].empty())
+      hits[insert(triggers[i])] |= 1u << i;
+
+  // Breadth-first pass: resolve failure links into a full transition
+  // table and fold each state's suffix matches into its output
+  std::vector<int32_t> fail(out_.size(), 0);
+  std::deque<int32_t> queue;
+  for (int c = 0; c < 256; c++) {
+    int32_t s = next_[c];
+    if (s < 0) {
+      next_[c] = 0;
+    } else {
+      queue.push_back(s);
+    }
+  }
+  while (!queue.empty()) {
+    int32_t r = queue.front();
+    queue.pop_front();
+    out_[r] = std::max(out_[r], out_[fail[r]]);
+    hits[r] |= hits[fail[r]];
+    for (int c = 0; c < 256; c++) {
+      int32_t s = next_[(size_t)r * 256 + c];
+      int32_t f = next_[(size_t)fail[r] * 256 + c];
+      if (s < 0) {
+        next_[(size_t)r * 256 + c] = f;
+      } else {
+        fail[s] = f;
+        queue.push_back(s);
+      }
+    }
+  }
+  if (!triggers.empty())
+    hits_ = std::move(hits);
+  for (int c = 0; c < 256; c++)
+    if (next_[c] != 0)
+      start_.Add((unsigned char)c);
+  skip_ = start_.size() <= ByteSet::kSimdMax;
+}
+
+// An octal number in a width-byte header field, NUL terminated
+static void TarOctal(char *field, size_t width, uint64_t value) {
+  for (size_t i = width - 1; i-- > 0;) {
+    field[i] = (char)('0' + (value & 7));
+    value >>= 3;
+  }
+  field[width - 1] = '\0';
+}
+
+bool TarFileHeader(const std::string &name, uint64_t size, long long mtime,
+                   char header[kTarBlock], unsigned mode) {
+  memset(header, 0, kTarBlock);
+  size_t split = 0; // name[0, split) goes into the prefix field
+  if (name.size() > 100) {
+    split = name.rfind('/', 155);
+    if (split == std::string::npos || split == 0 ||
+        name.size() - split - 1 > 100)
+      return false;
+  }
+  if (split > 0) {
+    memcpy(header + 345, name.data(), split);
+    memcpy(header, name.data() + split + 1, name.size() - split - 1);
+  } else {
+    memcpy(header, name.data(), name.size());
+  }
+  TarOctal(header + 100, 8, mode & 07777);
+  TarOctal(header + 108, 8, 0);    // uid
+  TarOctal(header + 116, 8, 0);    // gid
+  if (size < (1ULL << 33)) {
+    TarOctal(header + 124, 12, size);
+  } else {
+    header[124] = (char)0x80; // base-256, big endian
+    for (int i = 11; i > 0; i--, size >>= 8)
+      header[124 + i] = (char)(size & 0xff);
+  }
+  TarOctal(header + 136, 12, (uint64_t)std::max(0LL, mtime));
+  header[156] = '0'; // regular file
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+  // The checksum is summed with its own field as spaces
+  memset(header + 148, ' ', 8);
+  unsigned sum = 0;
+  for (size_t i = 0; i < kTarBlock; i++)
+    sum += (unsigned char)header[i];
+  TarOctal(header + 148, 7, sum);
+  header[155] = ' ';
+  return true;
+}
+
+const char *LinePool::Intern(std::string_view line) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(line);
+  if (it == entries_.end()) {
+    Entry entry;
+    entry.text.reset(new char[line.size()]);
+    memcpy(entry.text.get(), line.data(), line.size());
+    std::string_view key(entry.text.get(), line.size());
+    it = entries_.emplace(key, std::move(entry)).first;
+    text_bytes_ += line.size();
+  }
+  it->second.refs++;
+  return it->second.text.get();
+}
+
+void LinePool::Release(std::string_view line) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(line);
+  if (it == entries_.end() || --it->second.refs > 0)
+    return;
+  text_bytes_ -= line.size();
+  entries_.erase(it);
+}
+
+size_t LinePool::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t LinePool::MemoryBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // A node holds the key, the entry, the cached hash and the next pointer
+  size_t node = sizeof(std::string_view) + sizeof(Entry) + 2 * sizeof(void *);
+  return text_bytes_ + entries_.size() * node +
+         entries_.bucket_count() * sizeof(void *);
+}
+
+void LogArena::ReleaseShared(size_t n) {
+  if (!pool_)
+    return;
+  n = std::min(n, shared_.size());
+  for (size_t i = 0; i < n; i++) {
+    if (shared_[i])
+      pool_->Release(std::string_view(shared_[i], spans_[i].length));
+  }
+  shared_.erase(shared_.begin(), shared_.begin() + n);
+}
+
+size_t LogArena::StampRow(char *p, int64_t ms) {
+  if (total_appended_ == 0)
+    first_ms_ = last_ms_ = back_ms_ = ms;
+  // Stored times only move forward, whatever the caller passed
+  uint64_t quiet = ms > last_ms_ ? (uint64_t)(ms - last_ms_) : 0;
+  size_t n = PutVarint(p, quiet);
+  if (spans_.empty()) {
+    front_quiet_ms_ = (int64_t)quiet;
+  } else if (spans_.back().repeats > 0) {
+    n += PutVarint(p + n, (uint64_t)(last_ms_ - back_ms_));
+  }
+  ms = last_ms_ + (int64_t)quiet;
+  if (spans_.empty())
+    front_ms_ = ms;
+  if (total_appended_ % kTimeStride == 0) {
+    if (checkpoints_.empty())
+      checkpoint_base_ = total_appended_ / kTimeStride;
+    checkpoints_.push_back(ms);
+  }
+  back_ms_ = last_ms_ = ms;
+  return n;
+}
+
+void LogArena::RowDeltas(size_t i, uint64_t &quiet, uint64_t &run) const {
+  const Span &sp = spans_[i];
+  const char *p = blocks_[sp.block - first_block_].data.get() + sp.offset;
+  if (!pool_ || !shared_[i])
+    p += sp.length;
+  p = GetVarint(p, quiet);
+  run = 0;
+  if (i > 0 && spans_[i - 1].repeats > 0)
+    GetVarint(p, run);
+}
+
+int64_t LogArena::Time(size_t i) const {
+  if (!(flags_ & kTimestamps) || i >= spans_.size())
+    return 0;
+  uint64_t first_seq = total_appended_ - spans_.size();
+  uint64_t k = (first_seq + i) / kTimeStride;
+  size_t row = 0;
+  int64_t ms = front_ms_;
+  if (k >= checkpoint_base_ && k - checkpoint_base_ < checkpoints_.size() &&
+      k * kTimeStride > first_seq) {
+    row = (size_t)(k * kTimeStride - first_seq);
+    ms = checkpoints_[(size_t)(k - checkpoint_base_)];
+  }
+  for (size_t r = row + 1; r <= i; r++) {
+    uint64_t quiet, run;
+    RowDeltas(r, quiet, run);
+    ms += (int64_t)(run + quiet);
+  }
+  return ms;
+}
+
+int64_t LogArena::TimeAfter(size_t i, int64_t time_i) const {
+  if (!(flags_ & kTimestamps) || i + 1 >= spans_.size())
+    return time_i;
+  uint64_t quiet, run;
+  RowDeltas(i + 1, quiet, run);
+  return time_i + (int64_t)(run + quiet);
+}
+
+int64_t LogArena::QuietBefore(size_t i) const {
+  if (!(flags_ & kTimestamps) || i >= spans_.size())
+    return 0;
+  if (i == 0)
+    return front_quiet_ms_;
+  uint64_t quiet, run;
+  RowDeltas(i, quiet, run);
+  return (int64_t)quiet;
+}
+
+// Alignment of a mapping's file offset
+static uint64_t MapGranularity() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwAllocationGranularity;
+#else
+  return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+bool LogSpool::Open(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+#ifdef _WIN32
+  write_handle_ = CreateFileA(path.c_str(), GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  return write_handle_ != INVALID_HANDLE_VALUE;
+#else
+  write_fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+  return write_fd_ >= 0;
+#endif
+}
+
+bool LogSpool::Reopen(const std::string &path, int64_t ms) {
+  FILE *in = fopen(path.c_str(), "rb");
+  if (!in)
+    return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+  last_ms_ = ms;
+  char buf[65536];
+  size_t n;
+  bool at_start = true;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    const char *p = buf;
+    const char *end = buf + n;
+    while (p < end) {
+      if (at_start) {
+        if (lines_ % kIndexStride == 0) {
+          index_.push_back(written_ + (uint64_t)(p - buf));
+          index_ms_.push_back(ms);
+          index_times_.push_back(times_.size());
+        }
+        times_ += '\0'; // no time since the line before
+        at_start = false;
+      }
+      const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+      if (!nl)
+        break;
+      lines_++;
+      at_start = true;
+      p = nl + 1;
+    }
+    written_ += n;
+  }
+  fclose(in);
+  flushed_lines_ = lines_;
+#ifdef _WIN32
+  write_handle_ = CreateFileA(path.c_str(), FILE_APPEND_DATA,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+  write_fd_ = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+#endif
+  if (!IsOpenLocked())
+    return false;
+  if (!at_start) {
+    pending_ = "\n";
+    lines_++;
+    FlushLocked();
+  }
+  return true;
+}
+
+void LogSpool::Append(std::string_view line, int64_t ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (failed_ || !IsOpenLocked())
+    return;
+  if (lines_ == 0)
+    last_ms_ = ms;
+  ms = std::max(ms, last_ms_);
+  if (lines_ % kIndexStride == 0) {
+    index_.push_back(written_ + pending_.size());
+    index_ms_.push_back(ms);
+    index_times_.push_back(times_.size());
+  }
+  char delta[kMaxVarint];
+  times_.append(delta, PutVarint(delta, (uint64_t)(ms - last_ms_)));
+  last_ms_ = ms;
+  pending_.append(line.data(), line.size());
+  pending_ += '\n';
+  lines_++;
+  if (pending_.size() >= kFlushBytes)
+    FlushLocked();
+}
+
+void LogSpool::Flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FlushLocked();
+}
+
+uint64_t LogSpool::LineCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_ ? flushed_lines_ : lines_;
+}
+
+bool LogSpool::ReadLine(uint64_t n, std::string_view &out) {
+  uint64_t pos;
+  uint64_t file_end;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (n >= flushed_lines_)
+      FlushLocked();
+    if (n >= flushed_lines_)
+      return false;
+    pos = index_[n / kIndexStride];
+    file_end = written_;
+  }
+  if (!OpenReaderOnce())
+    return false;
+  uint64_t next = 0;
+  return WalkTo(pos, n % kIndexStride, file_end, out, next);
+}
+
+uint64_t LogSpool::ReadLines(uint64_t first, uint64_t count,
+                             const std::function<void(std::string_view)> &fn) {
+  uint64_t pos;
+  uint64_t file_end;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FlushLocked();
+    if (first >= flushed_lines_)
+      return 0;
+    count = std::min(count, flushed_lines_ - first);
+    pos = index_[first / kIndexStride];
+    file_end = written_;
+  }
+  if (count == 0 || !OpenReaderOnce())
+    return 0;
+  uint64_t skip = first % kIndexStride;
+  uint64_t done = 0;
+  std::string_view line;
+  while (done < count && WalkTo(pos, skip, file_end, line, pos)) {
+    fn(line);
+    done++;
+    // A line cut off at the window end continues up to the next newline
+    skip = line.data() + line.size() == map_data_ + map_length_ ? 1 : 0;
+  }
+  return done;
+}
+
+uint64_t LogSpool::LineTimes(uint64_t first, uint64_t count,
+                             std::vector<int64_t> &out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (first >= lines_)
+    return 0;
+  count = std::min(count, lines_ - first);
+  size_t entry = (size_t)(first / kIndexStride);
+  int64_t ms = index_ms_[entry];
+  const char *p = times_.data() + index_times_[entry];
+  uint64_t delta;
+  p = GetVarint(p, delta); // the entry's own, already in ms
+  for (uint64_t n = entry * kIndexStride; n < first; n++) {
+    p = GetVarint(p, delta);
+    ms += (int64_t)delta;
+  }
+  out.reserve(out.size() + (size_t)count);
+  out.push_back(ms);
+  for (uint64_t i = 1; i < count; i++) {
+    p = GetVarint(p, delta);
+    ms += (int64_t)delta;
+    out.push_back(ms);
+  }
+  return count;
+}
+
+void LogSpool::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FlushLocked();
+#ifdef _WIN32
+    if (write_handle_ != INVALID_HANDLE_VALUE)
+      CloseHandle(write_handle_);
+    write_handle_ = INVALID_HANDLE_VALUE;
+#else
+    if (write_fd_ >= 0)
+      close(write_fd_);
+    write_fd_ = -1;
+#endif
+  }
+  Unmap();
+#ifdef _WIN32
+  if (read_handle_ != INVALID_HANDLE_VALUE)
+    CloseHandle(read_handle_);
+  read_handle_ = INVALID_HANDLE_VALUE;
+#else
+  if (read_fd_ >= 0)
+    close(read_fd_);
+  read_fd_ = -1;
+#endif
+}
+
+bool LogSpool::IsOpenLocked() const {
+#ifdef _WIN32
+  return write_handle_ != INVALID_HANDLE_VALUE;
+#else
+  return write_fd_ >= 0;
+#endif
+}
+
+bool LogSpool::WalkTo(uint64_t pos, uint64_t skip, uint64_t file_end,
+                      std::string_view &out, uint64_t &next) {
+  // Walk forward from pos, moving the window as needed
+  while (true) {
+    if (map_data_ == nullptr || pos < map_offset_ ||
+        pos >= map_offset_ + map_length_) {
+      if (!MapAt(pos, file_end))
+        return false;
+    }
+    const char *p = map_data_ + (pos - map_offset_);
+    size_t avail = (size_t)(map_offset_ + map_length_ - pos);
+    const char *nl = (const char *)memchr(p, '\n', avail);
+    if (nl == nullptr) {
+      if (map_offset_ + map_length_ >= file_end)
+        return false;
+      if (map_offset_ == AlignDown(pos) && map_length_ == kMapWindow) {
+        // A single line longer than the window: show what fits, or keep
+        // scanning for its end when skipping over it
+        if (skip == 0) {
+          out = std::string_view(p, avail);
+          next = map_offset_ + map_length_;
+          return true;
+        }
+        pos = map_offset_ + map_length_;
+        continue;
+      }
+      if (!MapAt(pos, file_end))
+        return false;
+      continue;
+    }
+    if (skip == 0) {
+      out = std::string_view(p, (size_t)(nl - p));
+      next = pos + (uint64_t)(nl - p) + 1;
+      return true;
+    }
+    skip--;
+    pos += (uint64_t)(nl - p) + 1;
+  }
+}
+
+void LogSpool::FlushLocked() {
+  if (pending_.empty() || failed_ || !IsOpenLocked())
+    return;
+  size_t done = 0;
+  while (done < pending_.size()) {
+#ifdef _WIN32
+    DWORD n = 0;
+    if (!WriteFile(write_handle_, pending_.data() + done,
+                   (DWORD)(pending_.size() - done), &n, NULL) ||
+        n == 0) {
+      failed_ = true;
+      return;
+    }
+#else
+    ssize_t n = write(write_fd_, pending_.data() + done,
+                      pending_.size() - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      failed_ = true;
+      return;
+    }
+#endif
+    done += (size_t)n;
+  }
+  written_ += pending_.size();
+  flushed_lines_ = lines_;
+  pending_.clear();
+}
+
+uint64_t LogSpool::AlignDown(uint64_t pos) {
+  static const uint64_t gran = MapGranularity();
+  return pos - pos % gran;
+}
+
+bool LogSpool::OpenReaderOnce() {
+#ifdef _WIN32
+  if (read_handle_ == INVALID_HANDLE_VALUE)
+    read_handle_ = CreateFileA(path_.c_str(), GENERIC_READ,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  return read_handle_ != INVALID_HANDLE_VALUE;
+#else
+  if (read_fd_ < 0)
+    read_fd_ = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  return read_fd_ >= 0;
+#endif
+}
+
+bool LogSpool::MapAt(uint64_t pos, uint64_t file_end) {
+  Unmap();
+  uint64_t offset = AlignDown(pos);
+  uint64_t length = std::min<uint64_t>(kMapWindow, file_end - offset);
+  if (length == 0)
+    return false;
+#ifdef _WIN32
+  map_handle_ = CreateFileMappingA(read_handle_, NULL, PAGE_READONLY,
+                                   (DWORD)(file_end >> 32),
+                                   (DWORD)(file_end & 0xFFFFFFFF), NULL);
+  if (map_handle_ == NULL)
+    return false;
+  void *view = MapViewOfFile(map_handle_, FILE_MAP_READ,
+                             (DWORD)(offset >> 32),
+                             (DWORD)(offset & 0xFFFFFFFF), (SIZE_T)length);
+  if (view == NULL) {
+    CloseHandle(map_handle_);
+    map_handle_ = NULL;
+    return false;
+  }
+#else
+  void *view =
+      mmap(nullptr, (size_t)length, PROT_READ, MAP_SHARED, read_fd_,
+           (off_t)offset);
+  if (view == MAP_FAILED)
+    return false;
+#endif
+  map_data_ = (const char *)view;
+  map_offset_ = offset;
+  map_length_ = length;
+  return true;
+}
+
+void LogSpool::Unmap() {
+  if (map_data_ == nullptr)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(map_data_);
+  CloseHandle(map_handle_);
+  map_handle_ = NULL;
+#else
+  munmap((void *)map_data_, (size_t)map_length_);
+#endif
+  map_data_ = nullptr;
+  map_offset_ = 0;
+  map_length_ = 0;
+}
+
+bool StreamRecorder::Open(const std::string &path) {
+  Close();
+  out_ = fopen(path.c_str(), "wb");
+  if (!out_)
+    return false;
+  fputs(kStreamRecordingMagic, out_);
+  last_ = std::chrono::steady_clock::now();
+  bytes_ = 0;
+  return true;
+}
+
+void StreamRecorder::Write(const char *data, size_t n) {
+  if (!out_ || n == 0)
+    return;
+  auto now = std::chrono::steady_clock::now();
+  int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                   now - last_)
+                   .count();
+  last_ = now;
+  char head[2 * kMaxVarint];
+  size_t len = PutVarint(head, (uint64_t)std::max<int64_t>(us, 0));
+  len += PutVarint(head + len, (uint64_t)n);
+  if (fwrite(head, 1, len, out_) != len || fwrite(data, 1, n, out_) != n) {
+    Close();
+    return;
+  }
+  bytes_ += n;
+}
+
+void StreamRecorder::Close() {
+  if (out_)
+    fclose(out_);
+  out_ = nullptr;
+}
+
+// GetVarint that stops at end; false if the varint runs past it
+static bool GetVarintBounded(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t b = (uint8_t)*p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool ReadStreamRecording(const std::string &path,
+                         std::vector<RecordedChunk> &chunks) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  std::string data;
+  char buf[65536];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.append(buf, got);
+  bool ok = !ferror(f);
+  fclose(f);
+  if (!ok)
+    return false;
+  size_t magic = sizeof(kStreamRecordingMagic) - 1;
+  if (data.compare(0, magic, kStreamRecordingMagic) != 0)
+    return false;
+  const char *p = data.data() + magic;
+  const char *end = data.data() + data.size();
+  while (p < end) {
+    uint64_t us, n;
+    if (!GetVarintBounded(p, end, us) || !GetVarintBounded(p, end, n) ||
+        n > (uint64_t)(end - p))
+      break;
+    RecordedChunk chunk;
+    chunk.delay_us = (int64_t)us;
+    chunk.bytes.assign(p, (size_t)n);
+    chunks.push_back(std::move(chunk));
+    p += n;
+  }
+  return true;
+}
+
+uint64_t ReplayStreamRecording(const std::vector<RecordedChunk> &chunks,
+                               double speed, FILE *out,
+                               const std::atomic<bool> *should_stop) {
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point start = Clock::now();
+  double due_us = 0;
+  uint64_t written = 0;
+  for (const RecordedChunk &chunk : chunks) {
+    if (should_stop && should_stop->load(std::memory_order_relaxed))
+      break;
+    if (speed > 0) {
+      // Against the start rather than chunk to chunk, so sleeping late
+      // never adds up
+      due_us += chunk.delay_us / speed;
+      std::this_thread::sleep_until(
+          start + std::chrono::microseconds((int64_t)due_us));
+    }
+    if (fwrite(chunk.bytes.data(), 1, chunk.bytes.size(), out) !=
+            chunk.bytes.size() ||
+        fflush(out) != 0)
+      break;
+    written += chunk.bytes.size();
+  }
+  return written;
+}
+
+// Append "[HH:MM:SS.mmm] message\n", reusing clock (the "HH:MM:SS" of
+// second) while the second stays the same
+static void FormatLogLine(int64_t ms, std::string_view message,
+                          int64_t &second, char (&clock)[16],
+                          std::string &out) {
+  if (ms / 1000 != second) {
+    second = ms / 1000;
+    time_t secs = (time_t)second;
+    struct tm tm_buf;
+#ifdef _WIN32
+    localtime_s(&tm_buf, &secs);
+#else
+    localtime_r(&secs, &tm_buf);
+#endif
+    strftime(clock, sizeof(clock), "%H:%M:%S", &tm_buf);
+  }
+  char millis[8];
+  snprintf(millis, sizeof(millis), ".%03d] ", (int)(ms % 1000));
+  out += '[';
+  out += clock;
+  out += millis;
+  out.append(message.data(), message.size());
+  out += '\n';
+}
+
+AsyncLogger::AsyncLogger(size_t overlay_lines, FILE *out)
+    : out_(out), overlay_(overlay_lines) {
+  for (size_t i = 0; i < kCapacity; i++)
+    slots_[i].seq.store(i, std::memory_order_relaxed);
+}
+
+void AsyncLogger::Log(std::string_view message, uint8_t sinks) {
+  int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+                   .count();
+  if (stopped_.load(std::memory_order_acquire)) {
+    if (sinks & kConsole) {
+      std::string line;
+      int64_t second = -1;
+      char clock[16];
+      FormatLogLine(ms, message, second, clock, line);
+      fwrite(line.data(), 1, line.size(), out_);
+      fflush(out_);
+    }
+    if (sinks & kOverlay) {
+      std::lock_guard<std::mutex> lock(overlay_mutex_);
+      overlay_.Append(message);
+    }
+    return;
+  }
+  std::call_once(started_, [this]() {
+    thread_ = std::thread([this]() { Run(); });
+  });
+  // Claim the slot at head: free for position pos when its seq is pos
+  uint64_t pos = head_.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true) {
+    slot = &slots_[pos & kMask];
+    uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    int64_t lag = (int64_t)(seq - pos);
+    if (lag == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed))
+        break;
+    } else if (lag < 0) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return; // a full ring behind
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->ms = ms;
+  slot->sinks = sinks;
+  slot->text.assign(message.data(), message.size());
+  slot->seq.store(pos + 1, std::memory_order_release);
+  // Pairs with the fence in Run: either it sees this message or this sees
+  // it sleeping. The wake is sent without its mutex, so it can still land
+  // just before the wait blocks; the wait's timeout bounds that delay.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed))
+    wake_.notify_one();
+}
+
+void AsyncLogger::Stop() {
+  std::call_once(started_, []() {}); // no thread from here on
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    stopped_.store(true, std::memory_order_release);
+  }
+  wake_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void AsyncLogger::Run() {
+  std::string batch;
+  auto ready = [this]() {
+    return slots_[tail_ & kMask].seq.load(std::memory_order_acquire) ==
+           tail_ + 1;
+  };
+  while (true) {
+    bool stopping = stopped_.load(std::memory_order_acquire);
+    while (ready()) {
+      Slot &slot = slots_[tail_ & kMask];
+      if (slot.sinks & kConsole)
+        FormatLogLine(slot.ms, slot.text, last_second_, clock_, batch);
+      if (slot.sinks & kOverlay) {
+        std::lock_guard<std::mutex> lock(overlay_mutex_);
+        overlay_.Append(slot.text);
+      }
+      slot.seq.store(tail_ + kCapacity, std::memory_order_release);
+      tail_++;
+      if (batch.size() >= kPipeReadChunk * 16) {
+        fwrite(batch.data(), 1, batch.size(), out_);
+        batch.clear();
+      }
+    }
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped_) {
+      int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+      FormatLogLine(now,
+                    "(" + std::to_string(dropped - reported_dropped_) +
+                        " debug messages dropped, the log queue was full)",
+                    last_second_, clock_, batch);
+      reported_dropped_ = dropped;
+    }
+    if (!batch.empty()) {
+      fwrite(batch.data(), 1, batch.size(), out_);
+      fflush(out_);
+      batch.clear();
+    }
+    if (stopping)
+      break;
+    sleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      std::unique_lock<std::mutex> lock(wake_mutex_);
+      wake_.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+        return stopped_.load(std::memory_order_acquire) || ready();
+      });
+    }
+    sleeping_.store(false, std::memory_order_relaxed);
+  }
+}
+
+constexpr char SharedLogRingHeader::kMagic[8];
+
+namespace {
+
+size_t SharedLogHeaderBytes() {
+  return (sizeof(SharedLogRingHeader) + 63) & ~(size_t)63;
+}
+
+uint64_t SharedLogRecordBytes(size_t length) {
+  return (sizeof(SharedLogRecord) + length + 7) & ~(uint64_t)7;
+}
+
+#ifndef _WIN32
+std::string ShmPath(const std::string &name) { return "/" + name; }
+#endif
+
+unsigned long long ThisProcessId() {
+#ifdef _WIN32
+  return GetCurrentProcessId();
+#else
+  return (unsigned long long)getpid();
+#endif
+}
+
+} // namespace
+
+std::string SharedLogRing::NameFor(int task_id) {
+  return "autobuild-" + std::to_string(ThisProcessId()) + "-" +
+         std::to_string(task_id);
+}
+
+bool SharedLogRing::Create(int task_id, size_t data_bytes) {
+  Close();
+  uint64_t ring = 4096;
+  while (ring < data_bytes)
+    ring <<= 1;
+  size_t header_bytes = SharedLogHeaderBytes();
+  size_t total = header_bytes + (size_t)ring;
+  name_ = NameFor(task_id);
+  void *view = nullptr;
+#ifdef _WIN32
+  HANDLE mapping = CreateFileMappingA(
+      INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      (DWORD)((uint64_t)total >> 32), (DWORD)total,
+      ("Local\\" + name_).c_str());
+  if (!mapping) {
+    name_.clear();
+    return false;
+  }
+  view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, total);
+  if (!view) {
+    CloseHandle(mapping);
+    name_.clear();
+    return false;
+  }
+  mapping_ = mapping;
+#else
+  std::string path = ShmPath(name_);
+  shm_unlink(path.c_str());
+  // Only this user's processes, as the submission socket
+  int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    name_.clear();
+    return false;
+  }
+  if (ftruncate(fd, (off_t)total) == 0)
+    view = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (!view || view == MAP_FAILED) {
+    shm_unlink(path.c_str());
+    name_.clear();
+    return false;
+  }
+#endif
+  mapped_bytes_ = total;
+  header_ = new (view) SharedLogRingHeader{};
+  header_->version = SharedLogRingHeader::kVersion;
+  header_->header_bytes = (uint32_t)header_bytes;
+  header_->data_bytes = ring;
+  header_->writer_pid = ThisProcessId();
+  header_->task_id = (uint64_t)task_id;
+  header_->epoch_offset_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count() -
+      MonotonicMs();
+  data_ = (char *)view + header_bytes;
+  mask_ = ring - 1;
+  head_ = tail_ = seq_ = 0;
+  // The magic last: a reader that sees it sees the rest
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header_->magic, SharedLogRingHeader::kMagic, sizeof(header_->magic));
+  return true;
+}
+
+void SharedLogRing::ReclaimTo(uint64_t end) {
+  uint64_t ring = mask_ + 1;
+  if (tail_ + ring >= end)
+    return;
+  while (tail_ + ring < end) {
+    const SharedLogRecord *rec =
+        (const SharedLogRecord *)(data_ + (tail_ & mask_));
+    tail_ += rec->bytes;
+  }
+  header_->tail.store(tail_, std::memory_order_relaxed);
+  // Readers that copy what is overwritten next see the new tail
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedLogRing::Append(std::string_view line, uint8_t tag, int64_t ms) {
+  if (!header_)
+    return;
+  uint64_t ring = mask_ + 1;
+  size_t length = std::min<size_t>(line.size(), (size_t)(ring / 4));
+  uint64_t bytes = SharedLogRecordBytes(length);
+  uint64_t rest = ring - (head_ & mask_);
+  uint64_t pos = head_;
+  if (bytes > rest) {
+    ReclaimTo(pos + rest);
+    SharedLogRecord *pad = (SharedLogRecord *)(data_ + (pos & mask_));
+    pad->bytes = (uint32_t)rest;
+    pad->length = kSharedLogPad;
+    pos += rest;
+  }
+  ReclaimTo(pos + bytes);
+  SharedLogRecord *rec = (SharedLogRecord *)(data_ + (pos & mask_));
+  rec->bytes = (uint32_t)bytes;
+  rec->length = (uint32_t)length;
+  rec->seq = seq_++;
+  rec->ms = ms;
+  rec->tag = tag;
+  memcpy(rec + 1, line.data(), length);
+  head_ = pos + bytes;
+  header_->lines.store(seq_, std::memory_order_relaxed);
+  header_->head.store(head_, std::memory_order_release);
+}
+
+void SharedLogRing::Finish() {
+  if (header_)
+    header_->closed.store(1, std::memory_order_release);
+}
+
+void SharedLogRing::Close() {
+  if (!header_)
+    return;
+  Finish();
+#ifdef _WIN32
+  UnmapViewOfFile(header_);
+  CloseHandle((HANDLE)mapping_);
+  mapping_ = nullptr;
+#else
+  munmap(header_, mapped_bytes_);
+  shm_unlink(ShmPath(name_).c_str());
+#endif
+  header_ = nullptr;
+  data_ = nullptr;
+  name_.clear();
+}
+
+void SharedLogRing::RemoveStale() {
+#ifdef __linux__
+  DIR *d = opendir("/dev/shm");
+  if (!d)
+    return;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    unsigned long long pid = 0;
+    int task = 0;
+    if (sscanf(e->d_name, "autobuild-%llu-%d", &pid, &task) != 2 ||
+        pid == 0)
+      continue;
+    if (kill((pid_t)pid, 0) != 0 && errno == ESRCH)
+      shm_unlink(ShmPath(e->d_name).c_str());
+  }
+  closedir(d);
+#endif
+}
+
+bool SharedLogReader::Open(const std::string &name, bool from_start) {
+  Close();
+  const void *view = nullptr;
+  size_t total = 0;
+#ifdef _WIN32
+  HANDLE mapping =
+      OpenFileMappingA(FILE_MAP_READ, FALSE, ("Local\\" + name).c_str());
+  if (!mapping)
+    return false;
+  view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  MEMORY_BASIC_INFORMATION info{};
+  if (!view || !VirtualQuery(view, &info, sizeof(info))) {
+    if (view)
+      UnmapViewOfFile(view);
+    CloseHandle(mapping);
+    return false;
+  }
+  total = info.RegionSize;
+  mapping_ = mapping;
+#else
+  int fd = shm_open(ShmPath(name).c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  struct stat st{};
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size > SharedLogHeaderBytes()) {
+    total = (size_t)st.st_size;
+    view = mmap(nullptr, total, PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+      view = nullptr;
+  }
+  close(fd);
+  if (!view)
+    return false;
+#endif
+  mapped_bytes_ = total;
+  header_ = (const SharedLogRingHeader *)view;
+  bool valid = memcmp(header_->magic, SharedLogRingHeader::kMagic,
+                      sizeof(header_->magic)) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t ring = valid ? header_->data_bytes : 0;
+  if (!valid || header_->version != SharedLogRingHeader::kVersion ||
+      ring == 0 || (ring & (ring - 1)) != 0 ||
+      header_->header_bytes + ring > total) {
+    Close();
+    return false;
+  }
+  data_ = (const char *)view + header_->header_bytes;
+  mask_ = ring - 1;
+  pos_ = from_start ? header_->tail.load(std::memory_order_acquire)
+                    : header_->head.load(std::memory_order_acquire);
+  // Lines lost before the first one read count as missed where it is known
+  // which comes first: the very first line, or the next one appended
+  seq_known_ = !from_start || pos_ == 0;
+  next_seq_ = from_start ? 0 : header_->lines.load(std::memory_order_relaxed);
+  missed_ = 0;
+  return true;
+}
+
+void SharedLogReader::Close() {
+  if (!header_)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(header_);
+  CloseHandle((HANDLE)mapping_);
+  mapping_ = nullptr;
+#else
+  munmap((void *)header_, mapped_bytes_);
+#endif
+  header_ = nullptr;
+  data_ = nullptr;
+}
+
+bool SharedLogReader::Next(SharedLogRecord &rec) {
+  if (!header_)
+    return false;
+  uint64_t ring = mask_ + 1;
+  for (;;) {
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+    if (pos_ >= head)
+      return false;
+    uint64_t tail = header_->tail.load(std::memory_order_acquire);
+    if (pos_ < tail)
+      pos_ = tail; // lapped; the seq read next tells how far
+    uint64_t offset = pos_ & mask_;
+    memcpy(&rec, data_ + offset, sizeof(rec.bytes) + sizeof(rec.length));
+    bool pad = rec.length == kSharedLogPad;
+    bool sane = pad ? rec.bytes == ring - offset
+                    : rec.bytes >= sizeof(rec) &&
+                          rec.bytes <= ring - offset &&
+                          rec.length <= rec.bytes - sizeof(rec);
+    if (sane && !pad) {
+      memcpy(&rec, data_ + offset, sizeof(rec));
+      text_.assign(data_ + offset + sizeof(rec), rec.length);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->tail.load(std::memory_order_relaxed) > pos_)
+      continue; // overwritten while it was copied
+    if (!sane) {
+      // Not torn, so not a record boundary either: start over at tail, or
+      // give up on what is there when that is where it already was
+      uint64_t oldest = header_->tail.load(std::memory_order_acquire);
+      pos_ = oldest <= pos_ ? head : oldest;
+      continue;
+    }
+    pos_ += rec.bytes;
+    if (pad)
+      continue;
+    if (seq_known_ && rec.seq > next_seq_)
+      missed_ += rec.seq - next_seq_;
+    next_seq_ = rec.seq + 1;
+    seq_known_ = true;
+    return true;
+  }
+}
+
+bool SharedLogReader::Done() const {
+  return header_ && header_->closed.load(std::memory_order_acquire) != 0 &&
+         pos_ >= header_->head.load(std::memory_order_acquire);
+}
+
+void LogTailer::Follow(Source source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_.push_back(std::move(source));
+  if (!thread_.joinable()) {
+    stop_ = false;
+    thread_ = std::thread([this]() { Loop(); });
+  }
+}
+
+void LogTailer::Stop() {
+  stop_ = true;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void LogTailer::Loop() {
+  if (hooks_.thread_start)
+    hooks_.thread_start();
+#if defined(__linux__)
+  notify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#elif defined(__APPLE__)
+  notify_fd_ = kqueue();
+#endif
+  std::vector<File> files;
+  std::vector<char> buf(kLogTailChunk);
+  while (!stop_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto &source : pending_) {
+        files.emplace_back();
+        files.back().source = std::move(source);
+      }
+      pending_.clear();
+    }
+    for (size_t i = 0; i < files.size();) {
+      File &f = files[i];
+      // Read the flag first: once it is set every write has landed
+      bool finished = f.source.finished();
+      bool caught_up = !OpenFile(f) || ReadNew(f, buf);
+      if (finished && caught_up) {
+        if (!f.partial.empty())
+          PushLine(f, f.partial);
+        CloseFile(f);
+        f.source.drained();
+        files.erase(files.begin() + i);
+        continue;
+      }
+      i++;
+    }
+    if (hooks_.pass)
+      hooks_.pass();
+    Wait();
+  }
+  for (File &f : files)
+    CloseFile(f);
+#ifndef _WIN32
+  if (notify_fd_ >= 0)
+    close(notify_fd_);
+  notify_fd_ = -1;
+#endif
+}
+
+void LogTailer::Wait() {
+#if defined(__linux__)
+  if (notify_fd_ >= 0) {
+    struct pollfd pfd = {notify_fd_, POLLIN, 0};
+    if (poll(&pfd, 1, kLogTailPollMs) > 0) {
+      // Which file changed does not matter; every file gets checked
+      char events[4096];
+      while (read(notify_fd_, events, sizeof(events)) > 0) {
+      }
+    }
+    return;
+  }
+#elif defined(__APPLE__)
+  if (notify_fd_ >= 0) {
+    struct kevent events[16];
+    struct timespec timeout = {0, kLogTailPollMs * 1000000L};
+    kevent(notify_fd_, nullptr, 0, events, 16, &timeout);
+    return;
+  }
+#endif
+  std::this_thread::sleep_for(std::chrono::milliseconds(kLogTailPollMs));
+}
+
+bool LogTailer::OpenFile(File &f) {
+#ifdef _WIN32
+  if (f.handle == INVALID_HANDLE_VALUE)
+    f.handle = CreateFileA(f.source.path.c_str(), GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  return f.handle != INVALID_HANDLE_VALUE;
+#else
+  if (f.fd >= 0)
+    return true;
+  f.fd = open(f.source.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (f.fd < 0)
+    return false;
+#if defined(__linux__)
+  if (notify_fd_ >= 0)
+    f.watch = inotify_add_watch(notify_fd_, f.source.path.c_str(), IN_MODIFY);
+#elif defined(__APPLE__)
+  if (notify_fd_ >= 0) {
+    struct kevent ev;
+    EV_SET(&ev, f.fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+           NOTE_WRITE | NOTE_EXTEND, 0, nullptr);
+    kevent(notify_fd_, &ev, 1, nullptr, 0, nullptr);
+  }
+#endif
+  return true;
+#endif
+}
+
+void LogTailer::CloseFile(File &f) {
+#ifdef _WIN32
+  if (f.handle != INVALID_HANDLE_VALUE)
+    CloseHandle(f.handle);
+  f.handle = INVALID_HANDLE_VALUE;
+#else
+#if defined(__linux__)
+  if (f.watch >= 0 && notify_fd_ >= 0)
+    inotify_rm_watch(notify_fd_, f.watch);
+#endif
+  f.watch = -1;
+  if (f.fd >= 0)
+    close(f.fd); // also drops its kqueue registration
+  f.fd = -1;
+#endif
+}
+
+long long LogTailer::ReadAt(File &f, std::vector<char> &buf) {
+#ifdef _WIN32
+  OVERLAPPED ov = {};
+  ov.Offset = (DWORD)(f.offset & 0xFFFFFFFF);
+  ov.OffsetHigh = (DWORD)(f.offset >> 32);
+  DWORD n = 0;
+  if (!ReadFile(f.handle, buf.data(), (DWORD)buf.size(), &n, &ov))
+    return 0;
+  return (long long)n;
+#else
+  while (true) {
+    ssize_t n = pread(f.fd, buf.data(), buf.size(), (off_t)f.offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n < 0 ? 0 : (long long)n;
+  }
+#endif
+}
+
+void LogTailer::PushLine(File &f, std::string_view line) {
+  f.source.line(++f.lines, line);
+}
+
+bool LogTailer::ReadNew(File &f, std::vector<char> &buf) {
+  while (true) {
+    long long n = ReadAt(f, buf);
+    if (n <= 0)
+      return true;
+    const char *p = buf.data();
+    const char *end = p + n;
+    while (p < end) {
+      const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+      if (nl == nullptr) {
+        f.partial.append(p, (size_t)(end - p));
+        break;
+      }
+      if (f.source.room() == 0) {
+        // Resume from this line once the receiver caught up
+        f.offset += (uint64_t)(p - buf.data());
+        return false;
+      }
+      if (f.partial.empty()) {
+        PushLine(f, std::string_view(p, (size_t)(nl - p)));
+      } else {
+        f.partial.append(p, (size_t)(nl - p));
+        PushLine(f, f.partial);
+        f.partial.clear();
+      }
+      p = nl + 1;
+    }
+    f.offset += (uint64_t)n;
+  }
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                      JOB SYSTEM                       //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Most compute workers a pool starts, whatever the core count
+static const unsigned kMaxComputeWorkers = 8;
+
+// The pool and worker index of the current thread, so a job submitted from
+// a compute worker lands on that worker's own deque
+static thread_local const JobSystem *t_job_system = nullptr;
+static thread_local size_t t_job_worker = 0;
+
+JobSystem::JobSystem(unsigned compute_workers, unsigned io_workers)
+    : compute_count_(compute_workers), io_count_(std::max(1u, io_workers)) {
+  if (compute_count_ == 0)
+    compute_count_ = std::max(
+        1u, std::min(kMaxComputeWorkers, std::thread::hardware_concurrency()));
+}
+
+void JobSystem::Start() {
+  for (unsigned i = 0; i < compute_count_; i++)
+    workers_.push_back(std::make_unique<Worker>());
+  for (unsigned i = 0; i < compute_count_; i++)
+    threads_.emplace_back([this, i]() { ComputeLoop(i); });
+  for (unsigned i = 0; i < io_count_; i++)
+    threads_.emplace_back([this]() { IoLoop(); });
+}
+
+CancelToken JobSystem::Submit(JobLane lane, JobPriority priority, Job job,
+                              CancelToken token) {
+  std::call_once(started_, [this]() { Start(); });
+  int p = (int)priority;
+  if (lane == JobLane::Io) {
+    {
+      std::lock_guard<std::mutex> lock(io_mutex_);
+      if (!stop_) {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        io_queue_[p].push_back({std::move(job), token});
+        io_cv_.notify_one();
+        return token;
+      }
+    }
+    token.Cancel();
+    return token;
+  }
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    if (!stop_) {
+      size_t target = t_job_system == this
+                          ? t_job_worker
+                          : next_worker_.fetch_add(1) % workers_.size();
+      {
+        std::lock_guard<std::mutex> wlock(workers_[target]->mutex);
+        workers_[target]->queue[p].push_back({std::move(job), token});
+      }
+      compute_queued_++;
+      pending_.fetch_add(1, std::memory_order_relaxed);
+      idle_cv_.notify_one();
+      return token;
+    }
+  }
+  token.Cancel();
+  return token;
+}
+
+bool JobSystem::TakeCompute(size_t self, Item &out) {
+  size_t n = workers_.size();
+  for (int p = 0; p < kJobPriorities; p++) {
+    {
+      Worker &own = *workers_[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.queue[p].empty()) {
+        out = std::move(own.queue[p].back());
+        own.queue[p].pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < n; i++) {
+      Worker &victim = *workers_[(self + i) % n];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.queue[p].empty()) {
+        out = std::move(victim.queue[p].front());
+        victim.queue[p].pop_front();
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void JobSystem::Run(Item &item) {
+  if (!item.token.Cancelled())
+    item.job(item.token);
+  item.job = nullptr; // release captures before the job counts as done
+  pending_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void JobSystem::ComputeLoop(size_t self) {
+  t_job_system = this;
+  t_job_worker = self;
+  while (true) {
+    Item item;
+    if (TakeCompute(self, item)) {
+      {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        compute_queued_--;
+      }
+      Run(item);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_cv_.wait(lock, [this]() { return stop_ || compute_queued_ > 0; });
+    if (stop_)
+      return;
+  }
+}
+
+void JobSystem::IoLoop() {
+  std::unique_lock<std::mutex> lock(io_mutex_);
+  while (true) {
+    Item item;
+    io_cv_.wait(lock, [this, &item]() {
+      if (stop_)
+        return true;
+      for (auto &queue : io_queue_) {
+        if (!queue.empty()) {
+          item = std::move(queue.front());
+          queue.pop_front();
+          return true;
+        }
+      }
+      return false;
+    });
+    if (stop_)
+      return;
+    lock.unlock();
+    Run(item);
+    lock.lock();
+  }
+}
+
+void JobSystem::Post(std::function<void()> fn) {
+  std::function<void()> wake;
+  {
+    std::lock_guard<std::mutex> lock(done_mutex_);
+    done_.push_back(std::move(fn));
+    wake = wake_;
+  }
+  if (wake)
+    wake();
+}
+
+size_t JobSystem::RunCompletions() {
+  std::vector<std::function<void()>> done;
+  {
+    std::lock_guard<std::mutex> lock(done_mutex_);
+    done.swap(done_);
+  }
+  for (auto &fn : done)
+    fn();
+  return done.size();
+}
+
+void JobSystem::SetWake(std::function<void()> wake) {
+  std::lock_guard<std::mutex> lock(done_mutex_);
+  wake_ = std::move(wake);
+}
+
+void JobSystem::Stop() {
+  std::call_once(started_, []() {}); // no threads from here on
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    std::lock_guard<std::mutex> io_lock(io_mutex_);
+    stop_ = true;
+  }
+  idle_cv_.notify_all();
+  io_cv_.notify_all();
+  for (auto &t : threads_)
+    if (t.joinable())
+      t.join();
+  threads_.clear();
+  auto drop = [this](std::deque<Item> &queue) {
+    for (auto &item : queue) {
+      item.token.Cancel();
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    queue.clear();
+  };
+  for (auto &worker : workers_)
+    for (auto &queue : worker->queue)
+      drop(queue);
+  for (auto &queue : io_queue_)
+    drop(queue);
+  compute_queued_ = 0;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                        TRASH                          //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// A directory entry that is itself a directory; symbolic links are not
+// followed, so a purge never reaches outside the tree it was given
+static bool IsRealDirectory(const std::string &path) {
+#ifdef _WIN32
+  return IsDirectory(path);
+#else
+  struct stat st{};
+  return lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// Entries of the tree at path, path included, counted into count
+static void CountTree(const std::string &path, const CancelToken &token,
+                      std::atomic<size_t> &count) {
+  count++;
+  if (token.Cancelled() || !IsRealDirectory(path))
+    return;
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return;
+  while (struct dirent *ent = readdir(dir)) {
+    if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+      CountTree(path + "/" + ent->d_name, token, count);
+  }
+  closedir(dir);
+}
+
+// Remove the tree at path, hidden files included, counting each entry
+// removed into removed
+static void PurgeTree(const std::string &path, const CancelToken &token,
+                      std::atomic<size_t> &removed) {
+  if (token.Cancelled())
+    return;
+  if (IsRealDirectory(path)) {
+    if (DIR *dir = opendir(path.c_str())) {
+      while (struct dirent *ent = readdir(dir)) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+          PurgeTree(path + "/" + ent->d_name, token, removed);
+      }
+      closedir(dir);
+    }
+    if (rmdir(path.c_str()) == 0)
+      removed++;
+  } else if (remove(path.c_str()) == 0) {
+    removed++;
+  }
+}
+
+bool TrashBin::Trash(const std::string &root, const std::string &path,
+                     std::string &error) {
+  if (root.empty() || path.rfind(root + "/", 0) != 0) {
+    error = "Not inside the logs folder: " + path;
+    return false;
+  }
+  std::string trash = root + "/.trash";
+  bool first = purged_roots_.insert(root).second;
+  if (first)
+    PurgeLeftovers(trash);
+  CreateDirectoryRecursive(trash);
+  size_t slash = path.find_last_of("/\\");
+  std::string name =
+      slash == std::string::npos ? path : path.substr(slash + 1);
+  Item item;
+  item.id = ++next_id_;
+  item.original = path;
+  item.trashed = trash + "/" + std::to_string((long long)time(nullptr)) +
+                 "_" + std::to_string(item.id) + "_" + name;
+  item.at = std::chrono::steady_clock::now();
+  if (rename(path.c_str(), item.trashed.c_str()) != 0) {
+    error = "Cannot move " + path + " to the trash: " + strerror(errno);
+    return false;
+  }
+  items_.push_back(std::move(item));
+  return true;
+}
+
+bool TrashBin::Undo(uint64_t id, std::string &error) {
+  for (auto it = items_.begin(); it != items_.end(); ++it) {
+    if (it->id != id || it->purging)
+      continue;
+    if (rename(it->trashed.c_str(), it->original.c_str()) != 0) {
+      error = "Cannot restore " + it->original + ": " + strerror(errno);
+      return false;
+    }
+    items_.erase(it);
+    return true;
+  }
+  return false;
+}
+
+void TrashBin::Poll() {
+  auto now = std::chrono::steady_clock::now();
+  for (auto &item : items_) {
+    if (!item.purging && now - item.at >= std::chrono::seconds(kUndoSeconds))
+      Purge(item);
+  }
+}
+
+void TrashBin::Purge(Item &item) {
+  item.purging = true;
+  item.total = std::make_shared<std::atomic<size_t>>(0);
+  item.removed = std::make_shared<std::atomic<size_t>>(0);
+  uint64_t id = item.id;
+  std::string path = item.trashed;
+  auto total = item.total;
+  auto removed = item.removed;
+  jobs_.Submit(JobLane::Io, JobPriority::Housekeeping,
+               [this, id, path, total, removed](const CancelToken &token) {
+                 CountTree(path, token, *total);
+                 PurgeTree(path, token, *removed);
+                 jobs_.Post([this, id]() { Finished(id); });
+               });
+}
+
+void TrashBin::Finished(uint64_t id) {
+  items_.erase(std::remove_if(items_.begin(), items_.end(),
+                              [id](const Item &item) {
+                                return item.id == id;
+                              }),
+               items_.end());
+}
+
+void TrashBin::PurgeLeftovers(const std::string &trash) {
+  DIR *dir = opendir(trash.c_str());
+  if (!dir)
+    return;
+  while (struct dirent *ent = readdir(dir)) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+      continue;
+    Item item;
+    item.id = ++next_id_;
+    item.trashed = trash + "/" + ent->d_name;
+    item.original = item.trashed;
+    items_.push_back(std::move(item));
+    Purge(items_.back());
+  }
+  closedir(dir);
+}
+
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                    SETTINGS FILES                     //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// How long the settings watcher waits for a change notification before
+// checking for Stop, and how often it compares modification times where
+// there are no notifications
+static const int kSettingsWatchMs = 500;
+static const int kSettingsRescanMs = 2000;
+// Contents hashes the app itself wrote, kept per file so reading them back
+// is not taken for an outside change
+static const size_t kSettingsOwnWrites = 4;
+
+void SettingsWatcher::Watch(const std::string &config_path,
+                            const std::string &prompts_path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (thread_.joinable() || stop_)
+    return;
+  files_[kConfig].path = config_path;
+  files_[kPrompts].path = prompts_path;
+  thread_ = std::thread([this]() {
+    if (hooks_.thread_start)
+      hooks_.thread_start();
+    Run();
+  });
+}
+
+void SettingsWatcher::Writing(const std::string &path,
+                              const std::string &contents) {
+  uint64_t hash = Fnv1a(kFnvOffset, contents.data(), contents.size());
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &f : files_) {
+    if (f.path != path)
+      continue;
+    f.own.push_back(hash);
+    if (f.own.size() > kSettingsOwnWrites)
+      f.own.pop_front();
+  }
+}
+
+std::shared_ptr<const JsonValue> SettingsWatcher::Take(Which which) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::move(files_[which].changed);
+}
+
+void SettingsWatcher::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_one();
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void SettingsWatcher::Check(File &f, bool force) {
+  bool first = !f.primed;
+  f.primed = true;
+  struct stat st {};
+  if (stat(f.path.c_str(), &st) != 0)
+    return;
+  if (!force && (long long)st.st_mtime == f.mtime &&
+      (long long)st.st_size == f.size)
+    return;
+  f.mtime = (long long)st.st_mtime;
+  f.size = (long long)st.st_size;
+  std::ifstream in(f.path, std::ios::binary);
+  if (!in.is_open())
+    return;
+  std::string content((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+  uint64_t hash = Fnv1a(kFnvOffset, content.data(), content.size());
+  if (hash == f.hash)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool own = std::find(f.own.begin(), f.own.end(), hash) != f.own.end();
+    if (first || own) {
+      f.hash = hash; // what was loaded at startup, or written here
+      return;
+    }
+  }
+  auto root = std::make_shared<JsonValue>();
+  if (!JsonParser(content).Parse(*root) || root->type != JsonValue::Object) {
+    // Probably caught mid-write; the write's own notification (or the
+    // next time it looks) reads it again
+    f.mtime = -1;
+    return;
+  }
+  f.hash = hash;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    f.changed = std::move(root);
+  }
+  if (hooks_.changed)
+    hooks_.changed(f.path);
+}
+
+std::string SettingsWatcher::DirOf(const std::string &path) {
+  size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? std::string(".")
+                                    : path.substr(0, slash);
+}
+
+void SettingsWatcher::Run() {
+  for (auto &f : files_)
+    Check(f, true); // the contents loaded at startup
+#if defined(_WIN32)
+  HANDLE handles[kFileCount];
+  for (int i = 0; i < kFileCount; i++)
+    handles[i] = FindFirstChangeNotificationA(
+        DirOf(files_[i].path).c_str(), FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+  while (!stop_) {
+    DWORD n = 0;
+    HANDLE wait[kFileCount];
+    int index[kFileCount];
+    for (int i = 0; i < kFileCount; i++) {
+      if (handles[i] != INVALID_HANDLE_VALUE) {
+        index[n] = i;
+        wait[n++] = handles[i];
+      }
+    }
+    DWORD r = WAIT_TIMEOUT;
+    if (n > 0) {
+      r = WaitForMultipleObjects(n, wait, FALSE, kSettingsWatchMs);
+    } else {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_for(lock, std::chrono::milliseconds(kSettingsRescanMs),
+                   [this]() { return stop_.load(); });
+    }
+    if (r >= WAIT_OBJECT_0 && r < WAIT_OBJECT_0 + n) {
+      int i = index[r - WAIT_OBJECT_0];
+      FindNextChangeNotification(handles[i]);
+      // The directories may be one and the same
+      for (auto &f : files_)
+        if (DirOf(f.path) == DirOf(files_[i].path))
+          Check(f, false);
+    } else if (n == 0) {
+      for (auto &f : files_)
+        Check(f, false);
+    }
+  }
+  for (HANDLE h : handles)
+    if (h != INVALID_HANDLE_VALUE)
+      FindCloseChangeNotification(h);
+#elif defined(__linux__)
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  int watches[kFileCount];
+  for (int i = 0; i < kFileCount; i++)
+    watches[i] = fd < 0 ? -1
+                        : inotify_add_watch(fd, DirOf(files_[i].path).c_str(),
+                                            IN_CLOSE_WRITE | IN_MOVED_TO);
+  alignas(struct inotify_event) char buf[4096];
+  while (!stop_) {
+    if (fd < 0) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_for(lock, std::chrono::milliseconds(kSettingsRescanMs),
+                   [this]() { return stop_.load(); });
+      for (auto &f : files_)
+        Check(f, false);
+      continue;
+    }
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, kSettingsWatchMs) <= 0)
+      continue;
+    bool touched[kFileCount] = {};
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+      for (char *e = buf; e < buf + len;) {
+        const struct inotify_event *ev = (const struct inotify_event *)e;
+        for (int i = 0; i < kFileCount; i++) {
+          const std::string &path = files_[i].path;
+          if (ev->len > 0 && ev->wd == watches[i] &&
+              path.compare(path.find_last_of('/') + 1, std::string::npos,
+                           ev->name) == 0)
+            touched[i] = true;
+        }
+        e += sizeof(struct inotify_event) + ev->len;
+      }
+    }
+    for (int i = 0; i < kFileCount; i++)
+      if (touched[i])
+        Check(files_[i], true);
+  }
+  if (fd >= 0)
+    close(fd);
+#else
+  // No notifications: compare modification times now and then
+  while (!stop_) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_for(lock, std::chrono::milliseconds(kSettingsRescanMs),
+                   [this]() { return stop_.load(); });
+    }
+    for (auto &f : files_)
+      Check(f, false);
+  }
+#endif
+}
+
+// Quiet period before a submitted file is written; a newer submission for
+// the same file within it replaces the pending contents
+static const int kSaveQuietMs = 500;
+
+void FileSaver::Submit(const std::string &path, std::string contents) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Pending &p = pending_[path];
+  p.contents = std::move(contents);
+  p.due = std::chrono::steady_clock::now() +
+          std::chrono::milliseconds(kSaveQuietMs);
+  if (!thread_.joinable() && !stop_)
+    thread_ = std::thread([this]() {
+      if (hooks_.thread_start)
+        hooks_.thread_start();
+      Run();
+    });
+  cv_.notify_one();
+}
+
+void FileSaver::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!thread_.joinable())
+    return;
+  flush_ = true;
+  cv_.notify_one();
+  idle_cv_.wait(lock, [this]() { return pending_.empty() && !writing_; });
+}
+
+void FileSaver::Stop() {
+  Flush();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_one();
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void FileSaver::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    if (pending_.empty()) {
+      flush_ = false;
+      idle_cv_.notify_all();
+      if (stop_)
+        return;
+      cv_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+      continue;
+    }
+    auto next = pending_.begin();
+    for (auto it = pending_.begin(); it != pending_.end(); ++it)
+      if (it->second.due < next->second.due)
+        next = it;
+    if (!flush_ && !stop_ &&
+        next->second.due > std::chrono::steady_clock::now()) {
+      cv_.wait_until(lock, next->second.due);
+      continue; // the entry may have been replaced meanwhile
+    }
+    std::string path = next->first;
+    std::string contents = std::move(next->second.contents);
+    pending_.erase(next);
+    writing_ = true;
+    lock.unlock();
+    WriteReplacing(path, contents);
+    lock.lock();
+    writing_ = false;
+  }
+}
+
+bool FileSaver::WriteReplacing(const std::string &path,
+                               const std::string &contents) {
+  if (hooks_.writing)
+    hooks_.writing(path, contents);
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  bool ok = f != nullptr;
+  if (f) {
+    ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+    ok = fflush(f) == 0 && ok;
+#ifndef _WIN32
+    ok = fsync(fileno(f)) == 0 && ok;
+#endif
+    ok = fclose(f) == 0 && ok;
+  }
+  if (ok) {
+#ifdef _WIN32
+    ok = MoveFileExA(tmp.c_str(), path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    ok = rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+  }
+  if (!ok)
+    remove(tmp.c_str());
+  if (hooks_.saved)
+    hooks_.saved(path, contents.size(), ok);
+  return ok;
+}
+
+std::string SerializeAppSettings(const AppSettings &s) {
+  std::vector<std::string> rules;
+  for (const auto &rule : s.log_severity_rules)
+    rules.push_back(FormatLogSeverityRule(rule));
+  std::vector<std::string> workers;
+  for (const auto &worker : s.docker_workers)
+    workers.push_back(FormatDockerWorker(worker));
+  JsonWriter json;
+  json.StringArray("log_folder_paths", s.log_folder_paths)
+      .Number("selected_log_folder", s.selected_log_folder)
+      .String("task_directory", s.task_directory)
+      .String("build_dir", s.build_dir)
+      .String("api_key", s.api_key)
+      .Bool("auto_lowercase_names", s.auto_lowercase_names)
+      .Number("max_concurrent_tasks", s.max_concurrent_tasks)
+      .String("queue_order",
+              s.queue_order == QueueOrder::ShortestFirst  ? "shortest"
+              : s.queue_order == QueueOrder::LongestFirst ? "longest"
+                                                          : "fair")
+      .Bool("adaptive_concurrency", s.adaptive_concurrency)
+      .Bool("use_container_limits", s.use_container_limits)
+      .Number("tree_cpu_percent", s.tree_cpu_percent)
+      .Number("tree_memory_mb", s.tree_memory_mb)
+      .Bool("background_builds", s.background_builds)
+      .Bool("raise_gui_priority", s.raise_gui_priority)
+      .Number("max_build_tasks", s.max_build_tasks)
+      .Number("max_api_tasks", s.max_api_tasks)
+      .Number("max_image_builds", s.max_image_builds)
+      .Number("max_image_pulls", s.max_image_pulls)
+      .Number("max_verify_tasks", s.max_verify_tasks)
+      .Number("api_prompts_per_min", s.api_prompts_per_min)
+      .Number("api_daily_quota", s.api_daily_quota)
+      .Number("api_quota_reset_utc", s.api_quota_reset_utc)
+      .Number("api_quota_reserve_pct", s.api_quota_reserve_pct)
+      .Number("api_offpeak_hours", s.api_offpeak_hours)
+      .Number("container_pool_size", s.container_pool_size)
+      .Number("verify_shards", s.verify_shards)
+      .Number("log_archive_days", s.log_archive_days)
+      .Bool("export_catalog", s.export_catalog)
+      .String("log_staging",
+              s.log_staging == LogStaging::Off      ? "off"
+              : s.log_staging == LogStaging::Always ? "always"
+                                                    : "network")
+      .String("log_staging_dir", s.log_staging_dir)
+      .Number("log_staging_backlog_mb", s.log_staging_backlog_mb)
+      .String("log_object_store", s.log_object_store)
+      .String("log_object_store_endpoint", s.log_object_store_endpoint)
+      .String("log_object_store_region", s.log_object_store_region)
+      .Number("log_memory_mb", s.log_memory_mb)
+      .Number("log_ingest_lines_per_sec", s.log_ingest_lines_per_sec)
+      .Number("compact_after_minutes", s.compact_after_minutes)
+      .Number("stall_minutes", s.stall_minutes)
+      .Number("stall_prompt_minutes", s.stall_prompt_minutes)
+      .Number("stall_retries", s.stall_retries)
+      .Bool("speculative_backups", s.speculative_backups)
+      .Number("log_gap_seconds", s.log_gap_seconds)
+      .Number("docker_gc_keep", s.docker_gc_keep)
+      .Number("docker_gc_ttl_hours", s.docker_gc_ttl_hours)
+      .Number("docker_gc_disk_gb", s.docker_gc_disk_gb)
+      .Number("metrics_port", s.metrics_port)
+      .Number("dashboard_port", s.dashboard_port)
+      .Bool("use_docker_no_cache", s.use_docker_no_cache)
+      .Bool("build_once_for_multiple", s.build_once_for_multiple)
+      .Bool("parallel_both", s.parallel_both)
+      .Bool("use_image_cache", s.use_image_cache)
+      .Bool("speculative_build", s.speculative_build)
+      .Bool("use_verify_cache", s.use_verify_cache)
+      .Bool("use_audit_cache", s.use_audit_cache)
+      .Bool("use_buildkit", s.use_buildkit)
+      .String("build_cache", s.build_cache)
+      .String("image_registry", s.image_registry)
+      .Bool("use_cache_volumes", s.use_cache_volumes)
+      .String("cache_volumes", s.cache_volumes)
+      .Number("package_proxy", s.package_proxy)
+      .String("package_proxy_url", s.package_proxy_url)
+      .String("workdir_mount", s.workdir_mount)
+      .Bool("attach_phase_output", s.attach_phase_output)
+      .Bool("pty_capture", s.pty_capture)
+      .Bool("use_wsl", s.use_wsl)
+      .String("wsl_distro", s.wsl_distro)
+      .String("submit_socket", s.submit_socket)
+      .Bool("share_log_rings", s.share_log_rings)
+      .Bool("wsl_mirror_tasks", s.wsl_mirror_tasks)
+      .Bool("use_cli_layer", s.use_cli_layer)
+      .Bool("use_checkpoint_image", s.use_checkpoint_image)
+      .String("checkpoint_registry", s.checkpoint_registry)
+      .String("host_lease_dir", s.host_lease_dir)
+      .Bool("use_docker_debug", s.use_docker_debug)
+      .Number("feedback_count", s.feedback_count)
+      .Number("verify_count", s.verify_count)
+      .Number("both_count", s.both_count)
+      .Number("audit_count", s.audit_count)
+      .Number("batch_max_failures", s.batch_max_failures)
+      .Number("batch_target_passes", s.batch_target_passes)
+      .Number("batch_ci_pct", s.batch_ci_pct)
+      .Number("batch_urgency", s.batch_urgency)
+      .Number("batch_deadline_hours", s.batch_deadline_hours)
+      .Number("matrix_reps", s.matrix_reps)
+      .Number("matrix_mode", s.matrix_mode)
+      .StringArray("log_severity_rules", rules)
+      .StringArray("docker_workers", workers);
+  return json.Finish();
+}
+
+void ApplyAppSettings(const JsonValue &root, AppSettings &s,
+                      std::vector<std::string> &ignored) {
+  for (size_t i = 0; i < root.keys.size(); i++) {
+    const std::string &key = root.keys[i];
+    const JsonValue &item = root.items[i];
+    if (item.type == JsonValue::Array) {
+      if (key == "log_folder_paths") {
+        s.log_folder_paths = root.GetStrings("log_folder_paths");
+      } else if (key == "log_severity_rules") {
+        s.log_severity_rules.clear();
+        for (const auto &text : root.GetStrings("log_severity_rules")) {
+          LogSeverityRule rule;
+          if (ParseLogSeverityRule(text, rule)) {
+            s.log_severity_rules.push_back(rule);
+          } else {
+            ignored.push_back("Ignoring log severity rule: " + text);
+          }
+        }
+      } else if (key == "docker_workers") {
+        s.docker_workers.clear();
+        for (const auto &text : root.GetStrings("docker_workers")) {
+          DockerWorker worker;
+          if (ParseDockerWorker(text, worker)) {
+            s.docker_workers.push_back(worker);
+          } else {
+            ignored.push_back("Ignoring Docker worker: " + text);
+          }
+        }
+      }
+    } else if (item.type == JsonValue::Number) {
+      int value = (int)item.number;
+      if (key == "selected_log_folder") {
+        s.selected_log_folder = value;
+      } else if (key == "max_concurrent_tasks") {
+        s.max_concurrent_tasks = value;
+        if (s.max_concurrent_tasks < 1)
+          s.max_concurrent_tasks = 1;
+        if (s.max_concurrent_tasks > 20)
+          s.max_concurrent_tasks = 20;
+      } else if (key == "max_build_tasks") {
+        s.max_build_tasks = std::max(0, std::min(64, value));
+      } else if (key == "tree_cpu_percent") {
+        s.tree_cpu_percent = std::max(0, std::min(100, value));
+      } else if (key == "package_proxy") {
+        s.package_proxy = std::max(0, std::min(2, value));
+      } else if (key == "tree_memory_mb") {
+        s.tree_memory_mb = std::max(0, value);
+      } else if (key == "max_api_tasks") {
+        s.max_api_tasks = std::max(1, std::min(64, value));
+      } else if (key == "max_image_builds") {
+        s.max_image_builds = std::max(0, std::min(64, value));
+      } else if (key == "max_image_pulls") {
+        s.max_image_pulls = std::max(0, std::min(16, value));
+      } else if (key == "max_verify_tasks") {
+        s.max_verify_tasks = std::max(0, std::min(64, value));
+      } else if (key == "api_prompts_per_min") {
+        s.api_prompts_per_min = std::max(0, std::min(600, value));
+      } else if (key == "api_daily_quota") {
+        s.api_daily_quota = std::max(0, std::min(1000000, value));
+      } else if (key == "api_quota_reset_utc") {
+        s.api_quota_reset_utc = std::max(0, std::min(23, value));
+      } else if (key == "api_quota_reserve_pct") {
+        s.api_quota_reserve_pct = std::max(0, std::min(90, value));
+      } else if (key == "api_offpeak_hours") {
+        s.api_offpeak_hours = std::max(1, std::min(24, value));
+      } else if (key == "container_pool_size") {
+        s.container_pool_size = std::max(0, std::min(8, value));
+      } else if (key == "verify_shards") {
+        s.verify_shards = std::max(0, std::min(16, value));
+      } else if (key == "log_archive_days") {
+        s.log_archive_days = std::max(0, std::min(90, value));
+      } else if (key == "log_staging_backlog_mb") {
+        s.log_staging_backlog_mb = std::max(0, std::min(1 << 20, value));
+      } else if (key == "compact_after_minutes") {
+        s.compact_after_minutes = std::max(0, std::min(10080, value));
+      } else if (key == "stall_minutes") {
+        s.stall_minutes = std::max(0, std::min(1440, value));
+      } else if (key == "stall_prompt_minutes") {
+        s.stall_prompt_minutes = std::max(0, std::min(1440, value));
+      } else if (key == "stall_retries") {
+        s.stall_retries = std::max(0, std::min(5, value));
+      } else if (key == "log_memory_mb") {
+        s.log_memory_mb = std::max(16, std::min(16384, value));
+      } else if (key == "log_ingest_lines_per_sec") {
+        s.log_ingest_lines_per_sec = std::max(0, std::min(1000000, value));
+      } else if (key == "log_gap_seconds") {
+        s.log_gap_seconds = std::max(0, std::min(86400, value));
+      } else if (key == "docker_gc_keep") {
+        s.docker_gc_keep = std::max(0, std::min(100, value));
+      } else if (key == "docker_gc_ttl_hours") {
+        s.docker_gc_ttl_hours = std::max(0, std::min(720, value));
+      } else if (key == "docker_gc_disk_gb") {
+        s.docker_gc_disk_gb = std::max(0, std::min(100000, value));
+      } else if (key == "metrics_port") {
+        s.metrics_port = std::max(0, std::min(65535, value));
+      } else if (key == "dashboard_port") {
+        s.dashboard_port = std::max(0, std::min(65535, value));
+      } else if (key == "feedback_count") {
+        s.feedback_count = std::max(1, value);
+      } else if (key == "verify_count") {
+        s.verify_count = std::max(1, value);
+      } else if (key == "both_count") {
+        s.both_count = std::max(1, value);
+      } else if (key == "audit_count") {
+        s.audit_count = std::max(1, value);
+      } else if (key == "batch_max_failures") {
+        s.batch_max_failures = std::max(0, std::min(100, value));
+      } else if (key == "batch_target_passes") {
+        s.batch_target_passes = std::max(0, std::min(100, value));
+      } else if (key == "batch_ci_pct") {
+        s.batch_ci_pct = std::max(0, std::min(50, value));
+      } else if (key == "batch_urgency") {
+        s.batch_urgency = std::max(0, std::min(2, value));
+      } else if (key == "batch_deadline_hours") {
+        s.batch_deadline_hours = std::max(0, std::min(168, value));
+      } else if (key == "matrix_reps") {
+        s.matrix_reps = std::max(1, std::min(20, value));
+      } else if (key == "matrix_mode") {
+        s.matrix_mode = value == 2 ? 2 : 0;
+      }
+    } else if (item.type == JsonValue::Bool) {
+      bool bool_value = item.boolean;
+      if (key == "auto_lowercase_names") {
+        s.auto_lowercase_names = bool_value;
+      } else if (key == "use_docker_no_cache") {
+        s.use_docker_no_cache = bool_value;
+      } else if (key == "use_docker_debug") {
+        s.use_docker_debug = bool_value;
+      } else if (key == "adaptive_concurrency") {
+        s.adaptive_concurrency = bool_value;
+      } else if (key == "use_container_limits") {
+        s.use_container_limits = bool_value;
+      } else if (key == "background_builds") {
+        s.background_builds = bool_value;
+      } else if (key == "raise_gui_priority") {
+        s.raise_gui_priority = bool_value;
+      } else if (key == "attach_phase_output") {
+        s.attach_phase_output = bool_value;
+      } else if (key == "pty_capture") {
+        s.pty_capture = bool_value;
+      } else if (key == "use_wsl") {
+        s.use_wsl = bool_value;
+      } else if (key == "wsl_mirror_tasks") {
+        s.wsl_mirror_tasks = bool_value;
+      } else if (key == "build_once_for_multiple") {
+        s.build_once_for_multiple = bool_value;
+      } else if (key == "parallel_both") {
+        s.parallel_both = bool_value;
+      } else if (key == "use_image_cache") {
+        s.use_image_cache = bool_value;
+      } else if (key == "speculative_build") {
+        s.speculative_build = bool_value;
+      } else if (key == "use_verify_cache") {
+        s.use_verify_cache = bool_value;
+      } else if (key == "export_catalog") {
+        s.export_catalog = bool_value;
+      } else if (key == "speculative_backups") {
+        s.speculative_backups = bool_value;
+      } else if (key == "share_log_rings") {
+        s.share_log_rings = bool_value;
+      } else if (key == "use_audit_cache") {
+        s.use_audit_cache = bool_value;
+      } else if (key == "use_buildkit") {
+        s.use_buildkit = bool_value;
+      } else if (key == "use_cache_volumes") {
+        s.use_cache_volumes = bool_value;
+      } else if (key == "use_cli_layer") {
+        s.use_cli_layer = bool_value;
+      } else if (key == "use_checkpoint_image") {
+        s.use_checkpoint_image = bool_value;
+      }
+    } else if (item.type == JsonValue::String) {
+      // task_directory is never loaded from cache - always start fresh
+      if (key == "build_dir") {
+        s.build_dir = item.str;
+      } else if (key == "api_key") {
+        s.api_key = item.str;
+      } else if (key == "build_cache") {
+        s.build_cache = item.str;
+      } else if (key == "image_registry") {
+        s.image_registry = item.str;
+      } else if (key == "cache_volumes") {
+        s.cache_volumes = item.str;
+      } else if (key == "package_proxy_url") {
+        s.package_proxy_url = item.str;
+      } else if (key == "workdir_mount") {
+        s.workdir_mount = item.str;
+      } else if (key == "queue_order") {
+        s.queue_order = item.str == "shortest" ? QueueOrder::ShortestFirst
+                        : item.str == "longest"  ? QueueOrder::LongestFirst
+                                                 : QueueOrder::Fair;
+      } else if (key == "checkpoint_registry") {
+        s.checkpoint_registry = item.str;
+      } else if (key == "host_lease_dir") {
+        s.host_lease_dir = item.str;
+      } else if (key == "log_staging") {
+        s.log_staging = item.str == "off"      ? LogStaging::Off
+                        : item.str == "always" ? LogStaging::Always
+                                               : LogStaging::Network;
+      } else if (key == "log_staging_dir") {
+        s.log_staging_dir = item.str;
+      } else if (key == "log_object_store") {
+        s.log_object_store = item.str;
+      } else if (key == "log_object_store_endpoint") {
+        s.log_object_store_endpoint = item.str;
+      } else if (key == "log_object_store_region") {
+        s.log_object_store_region = item.str;
+      } else if (key == "wsl_distro") {
+        s.wsl_distro = item.str;
+      } else if (key == "submit_socket") {
+        s.submit_socket = item.str;
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                   COROUTINE REACTOR                   //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// The coroutine Spawn wraps a task in: it starts at once, awaits the task
+// and frees its own frame on return
+struct AsyncSpawned {
+  struct promise_type {
+    AsyncSpawned get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+
+  static AsyncSpawned Run(AsyncReactor *reactor, Async<void> task) {
+    co_await task;
+    reactor->in_flight_.fetch_sub(1, std::memory_order_relaxed);
+  }
+};
+
+void AsyncReactor::EnsureStarted() {
+  std::call_once(started_, [this]() {
+#ifndef _WIN32
+    if (!CreateCloexecPipe(wake_pipe_))
+      return;
+    fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+#endif
+    thread_ = std::thread([this]() { Run(); });
+  });
+}
+
+void AsyncReactor::Spawn(Async<void> task) {
+  in_flight_.fetch_add(1, std::memory_order_relaxed);
+  // The lambda must be copyable for std::function; the task moves to the
+  // heap until the reactor thread takes it
+  auto held = std::make_shared<Async<void>>(std::move(task));
+  Post([this, held]() { AsyncSpawned::Run(this, std::move(*held)); });
+}
+
+void AsyncReactor::Post(std::function<void()> fn) {
+  EnsureStarted();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_)
+      return;
+    posted_.push_back(std::move(fn));
+  }
+  Wake();
+}
+
+void AsyncReactor::Wake() {
+#ifdef _WIN32
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    woken_ = true;
+  }
+  wake_cv_.notify_one();
+#else
+  if (wake_pipe_[1] >= 0) {
+    char c = 1;
+    (void)!write(wake_pipe_[1], &c, 1);
+  }
+#endif
+}
+
+void AsyncReactor::Stop() {
+  std::call_once(started_, []() {}); // no thread from here on
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  Wake();
+  if (thread_.joinable())
+    thread_.join();
+#ifndef _WIN32
+  for (int &fd : wake_pipe_) {
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+#endif
+}
+
+void AsyncReactor::AddWaiter(Wait *wait, std::coroutine_handle<> handle) {
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (wait->timeout_ms >= 0)
+    deadline = std::chrono::steady_clock::now() +
+               std::chrono::milliseconds(wait->timeout_ms);
+  waiters_.push_back({wait, handle, deadline});
+}
+
+void AsyncReactor::Run() {
+  using Clock = std::chrono::steady_clock;
+  std::vector<std::function<void()>> posted;
+  std::vector<Waiter> ready;
+#ifndef _WIN32
+  std::vector<struct pollfd> fds;
+  std::vector<size_t> fd_waiter; // waiters_ index of fds[i + 1]
+#endif
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_)
+        return;
+      posted.swap(posted_);
+    }
+    for (auto &fn : posted)
+      fn();
+    posted.clear();
+
+    // How long to sleep: until the nearest deadline, and no longer than
+    // kCancelPollMs while a wait can be cancelled
+    Clock::time_point now = Clock::now();
+    Clock::time_point until = Clock::time_point::max();
+    for (const Waiter &w : waiters_) {
+      until = std::min(until, w.deadline);
+      if (w.wait->cancel)
+        until = std::min(until, now + std::chrono::milliseconds(kCancelPollMs));
+    }
+    int timeout_ms = -1;
+    if (until != Clock::time_point::max())
+      timeout_ms = (int)std::max<int64_t>(
+          0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                 until - now + std::chrono::microseconds(999))
+                 .count());
+
+#ifdef _WIN32
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto woke = [this]() { return woken_ || stop_ || !posted_.empty(); };
+      if (timeout_ms < 0)
+        wake_cv_.wait(lock, woke);
+      else
+        wake_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), woke);
+      woken_ = false;
+    }
+#else
+    fds.assign(1, {wake_pipe_[0], POLLIN, 0});
+    fd_waiter.clear();
+    for (size_t i = 0; i < waiters_.size(); i++) {
+      if (waiters_[i].wait->fd < 0)
+        continue;
+      fds.push_back({waiters_[i].wait->fd, waiters_[i].wait->events, 0});
+      fd_waiter.push_back(i);
+    }
+    int n = poll(fds.data(), (nfds_t)fds.size(), timeout_ms);
+    if (n < 0 && errno != EINTR)
+      return;
+    if (n > 0 && fds[0].revents) {
+      char buf[64];
+      while (read(wake_pipe_[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+    for (size_t f = 1; n > 0 && f < fds.size(); f++) {
+      if (fds[f].revents)
+        waiters_[fd_waiter[f - 1]].wait->result = true;
+    }
+#endif
+
+    // Take out every wait that is over before resuming any, as resuming
+    // adds the coroutine's next wait
+    now = Clock::now();
+    for (size_t i = 0; i < waiters_.size();) {
+      Waiter &w = waiters_[i];
+      bool cancelled = w.wait->cancel && w.wait->cancel->Cancelled();
+      bool due = now >= w.deadline;
+      if (!w.wait->result && !cancelled && !due) {
+        i++;
+        continue;
+      }
+      if (cancelled)
+        w.wait->result = false;
+      else if (due && w.wait->fd < 0)
+        w.wait->result = true; // a timer that ran out
+      ready.push_back(w);
+      w = waiters_.back();
+      waiters_.pop_back();
+    }
+    for (Waiter &w : ready)
+      w.handle.resume();
+    ready.clear();
+  }
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                   FAILURE SIGNATURES                  //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Longest line a summary keeps, and how many lines an error block holds
+static const size_t kMaxSummaryLine = 300;
+static const size_t kErrorBlockLines = 8;
+static const size_t kMaxExitCodes = 8;
+static const size_t kMaxApiErrors = 6;
+
+static bool StartsWith(std::string_view s, std::string_view prefix) {
+  return s.substr(0, prefix.size()) == prefix;
+}
+
+static std::string_view TrimSpaces(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t' ||
+                        s.back() == '\r'))
+    s.remove_suffix(1);
+  return s;
+}
+
+// line trimmed and cut to kMaxSummaryLine bytes, not inside a UTF-8
+// sequence
+static std::string SummaryLine(std::string_view line) {
+  line = TrimSpaces(line);
+  if (line.size() <= kMaxSummaryLine)
+    return std::string(line);
+  size_t n = kMaxSummaryLine;
+  while (n > 0 && ((unsigned char)line[n] & 0xC0) == 0x80)
+    n--;
+  return std::string(line.substr(0, n)) + "...";
+}
+
+std::string FailureSummary::Headline() const {
+  if (!failed_tests.empty()) {
+    if (failed_test_count == 1)
+      return "failed test " + failed_tests.front();
+    return std::to_string(failed_test_count) + " failed tests, first " +
+           failed_tests.front();
+  }
+  if (!api_errors.empty())
+    return api_errors.front();
+  if (!error_block.empty())
+    return error_block.front();
+  if (!exit_codes.empty())
+    return "exit code " + std::to_string(exit_codes.front());
+  return std::string();
+}
+
+void FailureSummary::Merge(const FailureSummary &other) {
+  if (error_block.empty())
+    error_block = other.error_block;
+  int known = 0;
+  for (const auto &name : other.failed_tests) {
+    if (std::find(failed_tests.begin(), failed_tests.end(), name) !=
+        failed_tests.end())
+      known++;
+    else if (failed_tests.size() < kMaxFailedTests)
+      failed_tests.push_back(name);
+  }
+  failed_test_count += other.failed_test_count - known;
+  for (int code : other.exit_codes)
+    if (exit_codes.size() < kMaxExitCodes &&
+        std::find(exit_codes.begin(), exit_codes.end(), code) ==
+            exit_codes.end())
+      exit_codes.push_back(code);
+  // Entries start with their kind, so one of each is kept
+  for (const auto &error : other.api_errors) {
+    std::string_view kind(error.data(), std::min(error.find(':'),
+                                                 error.size()));
+    bool seen = std::any_of(
+        api_errors.begin(), api_errors.end(),
+        [&](const std::string &e) { return StartsWith(e, kind); });
+    if (!seen && api_errors.size() < kMaxApiErrors)
+      api_errors.push_back(error);
+  }
+}
+
+void FailureSummary::Write(JsonWriter &json) const {
+  json.StringArray("error_block", error_block)
+      .StringArray("failed_tests", failed_tests)
+      .Number("failed_test_count", failed_test_count)
+      .BeginArray("exit_codes");
+  for (int code : exit_codes)
+    json.Item((long long)code);
+  json.EndArray().StringArray("api_errors", api_errors);
+}
+
+void FailureSummary::Read(const JsonValue &object) {
+  error_block = object.GetStrings("error_block");
+  failed_tests = object.GetStrings("failed_tests");
+  failed_test_count =
+      std::max((int)failed_tests.size(),
+               object.GetInt("failed_test_count", 0));
+  exit_codes.clear();
+  if (const JsonValue *codes = object.Find("exit_codes"))
+    for (const auto &item : codes->items)
+      if (item.type == JsonValue::Number)
+        exit_codes.push_back((int)item.number);
+  api_errors = object.GetStrings("api_errors");
+}
+
+namespace {
+
+// The first line the classifier marked as an error and the lines after it
+class ErrorBlockDetector : public FailureDetector {
+public:
+  bool WantsLine(LogSeverity severity) const override {
+    return state_ == Open ||
+           (state_ == Waiting && severity == LogSeverity::Error);
+  }
+  void Feed(std::string_view line, LogSeverity severity, uint32_t hits,
+            FailureSummary &summary) override {
+    (void)hits;
+    if (!WantsLine(severity))
+      return;
+    summary.error_block.push_back(SummaryLine(line));
+    state_ = summary.error_block.size() >= kErrorBlockLines ? Closed : Open;
+  }
+
+private:
+  enum { Waiting, Open, Closed } state_ = Waiting;
+};
+
+// Names of failed tests from the report lines of common test runners
+class FailedTestDetector : public FailureDetector {
+public:
+  enum Trigger {
+    kGoogleTest, // "[  FAILED  ] Suite.Name (12 ms)"
+    kPytest,     // "FAILED tests/test_x.py::test_y - AssertionError"
+    kGo,         // "--- FAIL: TestFoo (0.00s)"
+    kUnittest,   // "FAIL: test_foo (module.Class)"
+    kUnittestError, // "ERROR: test_foo (module.Class)"
+    kRust,       // "test module::name ... FAILED"
+    kCTest,      // "1/3 Test #1: name ......***Failed  0.01 sec"
+    kJest,       // "✕ renders the page (5 ms)"
+    kTap,        // "not ok 3 - name"
+    kTriggerCount
+  };
+
+  std::vector<std::string> Triggers() const override {
+    return {"[  FAILED  ] ", "FAILED ",    "--- FAIL: ",
+            "FAIL: ",        "ERROR: ",    "... FAILED",
+            "***Failed",     "\xE2\x9C\x95 ", "not ok "};
+  }
+
+  void Feed(std::string_view line, LogSeverity severity, uint32_t hits,
+            FailureSummary &summary) override {
+    (void)severity;
+    std::string_view name;
+    for (int t = 0; t < kTriggerCount && name.empty(); t++)
+      if (hits & (1u << t))
+        name = TestName((Trigger)t, TrimSpaces(line));
+    name = TrimSpaces(name);
+    if (name.empty() || !seen_.insert(std::string(name)).second)
+      return;
+    summary.failed_test_count++;
+    if (summary.failed_tests.size() < kMaxFailedTests)
+      summary.failed_tests.push_back(SummaryLine(name));
+  }
+
+private:
+  // "test_foo (module.Class)": a word, then its class in parentheses
+  static bool UnittestName(std::string_view name) {
+    size_t open = name.find(" (");
+    return open != std::string_view::npos && open > 0 &&
+           name.back() == ')' &&
+           name.substr(0, open).find(' ') == std::string_view::npos;
+  }
+
+  static std::string_view Word(std::string_view s) {
+    return s.substr(0, std::min(s.find(' '), s.size()));
+  }
+
+  static std::string_view TestName(Trigger t, std::string_view line) {
+    static const std::string_view kPatterns[] = {
+        "[  FAILED  ] ", "FAILED ",  "--- FAIL: ", "FAIL: ",  "ERROR: ",
+        " ... FAILED",   "***Failed", "\xE2\x9C\x95 ", "not ok "};
+    std::string_view pattern = kPatterns[t];
+    size_t at = line.find(pattern);
+    if (at == std::string_view::npos)
+      return {};
+    std::string_view rest = line.substr(at + pattern.size());
+    switch (t) {
+    case kGoogleTest:
+      // The "[  FAILED  ] 2 tests, listed below:" count line names none
+      if (rest.empty() || (rest[0] >= '0' && rest[0] <= '9'))
+        return {};
+      return Word(rest);
+    case kPytest:
+      if (at != 0)
+        return {};
+      return rest.substr(0, std::min(rest.find(" - "), rest.size()));
+    case kGo:
+      return Word(rest);
+    case kUnittest:
+    case kUnittestError:
+      return at == 0 && UnittestName(rest) ? rest : std::string_view();
+    case kRust:
+      if (!StartsWith(line, "test "))
+        return {};
+      return line.substr(5, at - 5);
+    case kCTest: {
+      size_t test = line.find("Test #");
+      size_t colon = line.find(": ", test);
+      if (test == std::string_view::npos || colon == std::string_view::npos)
+        return {};
+      return Word(line.substr(colon + 2));
+    }
+    case kJest: {
+      size_t time = rest.rfind(" (");
+      return time != std::string_view::npos && rest.back() == ')'
+                 ? rest.substr(0, time)
+                 : rest;
+    }
+    case kTap: {
+      if (at != 0)
+        return {};
+      size_t dash = rest.find(" - ");
+      if (dash != std::string_view::npos)
+        rest = rest.substr(dash + 3);
+      return rest.substr(0, std::min(rest.find(" # "), rest.size()));
+    }
+    default:
+      return {};
+    }
+  }
+
+  std::set<std::string> seen_;
+};
+
+// Non-zero exit codes a line reports ("exit code: 2", "exit status 1",
+// "make: *** [all] Error 2")
+class ExitCodeDetector : public FailureDetector {
+public:
+  std::vector<std::string> Triggers() const override {
+    return {"exit code", "Exit code", "exit status", "exited with code",
+            "*** ["};
+  }
+
+  void Feed(std::string_view line, LogSeverity severity, uint32_t hits,
+            FailureSummary &summary) override {
+    (void)severity;
+    static const std::string_view kMake = "] Error ";
+    std::vector<std::string> triggers = Triggers();
+    for (size_t t = 0; t < triggers.size(); t++) {
+      if (!(hits & (1u << t)))
+        continue;
+      std::string_view pattern =
+          t + 1 == triggers.size() ? kMake : std::string_view(triggers[t]);
+      size_t at = line.find(pattern);
+      if (at == std::string_view::npos)
+        continue;
+      std::string_view rest = line.substr(at + pattern.size());
+      while (!rest.empty() && (rest[0] == ' ' || rest[0] == ':' ||
+                               rest[0] == '=' || rest[0] == '('))
+        rest.remove_prefix(1);
+      size_t digits = 0;
+      while (digits < rest.size() && digits < 9 && rest[digits] >= '0' &&
+             rest[digits] <= '9')
+        digits++;
+      if (digits == 0)
+        continue;
+      int code = atoi(std::string(rest.substr(0, digits)).c_str());
+      if (code != 0 && summary.exit_codes.size() < kMaxExitCodes &&
+          std::find(summary.exit_codes.begin(), summary.exit_codes.end(),
+                    code) == summary.exit_codes.end())
+        summary.exit_codes.push_back(code);
+      return;
+    }
+  }
+};
+
+// Gemini API errors by kind: the google.rpc status names the API replies
+// with, plus a rejected key and the script's rate limit notices
+class ApiErrorDetector : public FailureDetector {
+public:
+  std::vector<std::string> Triggers() const override {
+    std::vector<std::string> triggers(std::begin(kKinds), std::end(kKinds));
+    triggers.insert(triggers.end(), {"API key not valid", "Quota exceeded",
+                                     "[RATE_LIMIT] ", "[API Error"});
+    return triggers;
+  }
+
+  void Feed(std::string_view line, LogSeverity severity, uint32_t hits,
+            FailureSummary &summary) override {
+    (void)severity;
+    static const char *const kOtherKinds[] = {
+        "API_KEY_INVALID", "RESOURCE_EXHAUSTED", "RATE_LIMITED", "API_ERROR"};
+    const size_t statuses = std::size(kKinds);
+    std::string kind;
+    for (size_t t = 0; t < statuses + std::size(kOtherKinds) && kind.empty();
+         t++)
+      if (hits & (1u << t))
+        kind = t < statuses ? kKinds[t] : kOtherKinds[t - statuses];
+    if (kind.empty() || summary.api_errors.size() >= kMaxApiErrors)
+      return;
+    for (const auto &error : summary.api_errors)
+      if (StartsWith(error, kind + ":"))
+        return;
+    summary.api_errors.push_back(kind + ": " + SummaryLine(line));
+  }
+
+private:
+  static constexpr const char *kKinds[] = {
+      "RESOURCE_EXHAUSTED", "PERMISSION_DENIED", "UNAUTHENTICATED",
+      "INVALID_ARGUMENT", "DEADLINE_EXCEEDED", "UNAVAILABLE"};
+};
+
+} // namespace
+
+FailureScanner::FailureScanner() {
+  Add(std::make_unique<ErrorBlockDetector>());
+  Add(std::make_unique<FailedTestDetector>());
+  Add(std::make_unique<ExitCodeDetector>());
+  Add(std::make_unique<ApiErrorDetector>());
+}
+
+void FailureScanner::Add(std::unique_ptr<FailureDetector> detector) {
+  Slot slot;
+  size_t n = detector->Triggers().size();
+  // Triggers that would not fit in the classifier's hits are left out
+  if (bits_ + n > kMaxLogTriggers)
+    n = 0;
+  slot.shift = bits_;
+  slot.mask = n == 0 ? 0 : (uint32_t)(((uint64_t)1 << n) - 1);
+  bits_ += (int)n;
+  slot.detector = std::move(detector);
+  slots_.push_back(std::move(slot));
+  hungry_ = hungry_ || slots_.back().detector->WantsLine(LogSeverity::Error);
+}
+
+std::vector<std::string> FailureScanner::Triggers() const {
+  std::vector<std::string> triggers;
+  for (const auto &slot : slots_) {
+    if (slot.mask == 0)
+      continue;
+    std::vector<std::string> mine = slot.detector->Triggers();
+    triggers.insert(triggers.end(), mine.begin(), mine.end());
+  }
+  return triggers;
+}
+
+void FailureScanner::Dispatch(std::string_view line, LogSeverity severity,
+                              uint32_t hits) {
+  hungry_ = waiting_ = false;
+  for (auto &slot : slots_) {
+    uint32_t mine = slot.mask == 0 ? 0 : (hits >> slot.shift) & slot.mask;
+    FailureDetector &detector = *slot.detector;
+    if (mine != 0 || detector.WantsLine(severity))
+      detector.Feed(line, severity, mine, summary_);
+    hungry_ = hungry_ || detector.WantsLine(LogSeverity::Error);
+    waiting_ = waiting_ || detector.WantsLine(LogSeverity::None);
+  }
+}
+
+void GeminiCallStats::Merge(const GeminiCallStats &other) {
+  retries += other.retries;
+  throttled += other.throttled;
+  errors += other.errors;
+  response_bytes += other.response_bytes;
+}
+
+namespace {
+
+// Whether line names a rate or quota limit
+bool Throttling(std::string_view line) {
+  static const char *const kMarkers[] = {"429", "RESOURCE_EXHAUSTED",
+                                         "Quota exceeded", "quota exceeded",
+                                         "rate limit", "Rate limit"};
+  for (const char *marker : kMarkers)
+    if (line.find(marker) != std::string_view::npos)
+      return true;
+  return false;
+}
+
+// The number right after marker in line, scaled; -1 when there is none
+double NumberAfter(std::string_view line, std::string_view marker,
+                   double scale) {
+  size_t at = line.find(marker);
+  if (at == std::string_view::npos)
+    return -1.0;
+  at += marker.size();
+  while (at < line.size() &&
+         (line[at] == '"' || line[at] == ':' || line[at] == ' '))
+    at++;
+  double value = 0.0;
+  size_t digits = 0;
+  for (; at < line.size() && line[at] >= '0' && line[at] <= '9'; at++) {
+    value = value * 10.0 + (line[at] - '0');
+    digits++;
+  }
+  return digits != 0 ? value * scale : -1.0;
+}
+
+} // namespace
+
+bool GeminiCallParser::Feed(std::string_view line, double &retry_after_s) {
+  // Logging the CLI does around a request, not part of the answer
+  static const char *const kLogging[] = {
+      "[DEBUG]", "Loaded cached credentials", "Data collection is disabled",
+      "Flushing log events", "(node:"};
+  retry_after_s = 0.0;
+  std::string_view text = TrimSpaces(line);
+  bool retry = StartsWith(text, "Attempt ") &&
+               text.find(" failed") != std::string_view::npos;
+  bool error = StartsWith(text, "[API Error");
+  if (!retry && !error) {
+    for (const char *prefix : kLogging)
+      if (StartsWith(text, prefix))
+        return false;
+    stats_.response_bytes += line.size() + 1;
+    return false;
+  }
+  if (retry)
+    stats_.retries++;
+  else
+    stats_.errors++;
+  if (!Throttling(text))
+    return false;
+  stats_.throttled++;
+  for (double delay : {NumberAfter(text, "delay of ", 0.001),
+                       NumberAfter(text, "retryDelay", 1.0),
+                       NumberAfter(text, "retry in ", 1.0)}) {
+    if (delay >= 0.0) {
+      retry_after_s = delay;
+      break;
+    }
+  }
+  return true;
+}
+
+std::vector<GeminiCallSummary>
+SummarizeGeminiCalls(const std::vector<PhaseTiming> &timeline,
+                     const std::map<std::string, GeminiCallStats> &log_stats) {
+  std::vector<GeminiCallSummary> calls;
+  for (const auto &phase : timeline) {
+    if (phase.end_ms == 0 || !StartsWith(phase.name, "gemini_"))
+      continue;
+    auto it = std::find_if(calls.begin(), calls.end(),
+                           [&](const GeminiCallSummary &call) {
+                             return call.phase == phase.name;
+                           });
+    if (it == calls.end()) {
+      calls.emplace_back();
+      it = calls.end() - 1;
+      it->phase = phase.name;
+      auto stats = log_stats.find(phase.name);
+      if (stats != log_stats.end())
+        it->stats = stats->second;
+    }
+    long long ms = phase.end_ms - phase.start_ms;
+    it->calls++;
+    it->ms += ms;
+    it->max_ms = std::max(it->max_ms, ms);
+    it->exit_code = phase.exit_code;
+  }
+  return calls;
+}
+
+namespace {
+
+const long long kDayMs = 24LL * 3600 * 1000;
+const char *const kQuerySeverityNames[kLogSeverityCount] = {
+    "none", "stopped", "info", "warning", "success", "error"};
+
+// One word of a query: an optional '-', then a quoted phrase or a run of
+// non-space bytes in which key:"value" may quote its value
+bool NextQueryWord(std::string_view &rest, bool &negated, std::string &word,
+                   bool &quoted) {
+  while (!rest.empty() && isspace((unsigned char)rest.front()))
+    rest.remove_prefix(1);
+  if (rest.empty())
+    return false;
+  negated = rest.size() > 1 && rest[0] == '-' &&
+            !isspace((unsigned char)rest[1]);
+  if (negated)
+    rest.remove_prefix(1);
+  word.clear();
+  quoted = false;
+  while (!rest.empty() && !isspace((unsigned char)rest.front())) {
+    if (rest.front() != '"') {
+      word += rest.front();
+      rest.remove_prefix(1);
+      continue;
+    }
+    size_t close = rest.find('"', 1);
+    if (close == std::string_view::npos)
+      close = rest.size();
+    quoted = quoted || word.empty();
+    word.append(rest.substr(1, close - 1));
+    rest.remove_prefix(std::min(rest.size(), close + 1));
+  }
+  return true;
+}
+
+// "HH", "HH:MM" or "HH:MM:SS" as ms since midnight
+bool ParseTimeOfDay(const std::string &text, long long &ms) {
+  int h = 0, m = 0, s = 0;
+  char tail = 0;
+  int n = sscanf(text.c_str(), "%d:%d:%d%c", &h, &m, &s, &tail);
+  if (n < 1 || n > 3 || h < 0 || h > 23 || m < 0 || m > 59 || s < 0 ||
+      s > 59)
+    return false;
+  ms = ((h * 60LL + m) * 60 + s) * 1000;
+  return true;
+}
+
+// "<n>s", "<n>m", "<n>h" or "<n>d" as ms
+bool ParseAge(const std::string &text, long long &ms) {
+  char *end = nullptr;
+  long long n = strtoll(text.c_str(), &end, 10);
+  if (end == text.c_str() || n < 0 || strlen(end) != 1)
+    return false;
+  static const char units[] = "smhd";
+  static const long long unit_ms[] = {1000, 60000, 3600000, kDayMs};
+  const char *unit = strchr(units, *end);
+  if (!unit)
+    return false;
+  ms = n * unit_ms[unit - units];
+  return true;
+}
+
+} // namespace
+
+bool LogQuery::Compile(const std::string &text, long long now_ms,
+                       std::string *error) {
+  *this = LogQuery();
+  text_ = text;
+  time_t secs = (time_t)(now_ms / 1000);
+  struct tm tm_buf;
+#ifdef _WIN32
+  localtime_s(&tm_buf, &secs);
+#else
+  localtime_r(&secs, &tm_buf);
+#endif
+  long long local_ms =
+      ((tm_buf.tm_hour * 60LL + tm_buf.tm_min) * 60 + tm_buf.tm_sec) * 1000;
+  utc_offset_ms_ = (local_ms - now_ms % kDayMs + kDayMs) % kDayMs;
+  if (utc_offset_ms_ > kDayMs / 2)
+    utc_offset_ms_ -= kDayMs;
+
+  std::string_view rest(text);
+  std::string word, problem;
+  bool negated = false, quoted = false;
+  while (problem.empty() && NextQueryWord(rest, negated, word, quoted)) {
+    Term term;
+    term.negated = negated;
+    term.kind = Kind::Text;
+    size_t colon = quoted ? std::string::npos : word.find(':');
+    std::string key =
+        colon == std::string::npos ? "" : Lower(word.substr(0, colon));
+    std::string value =
+        colon == std::string::npos ? "" : Lower(word.substr(colon + 1));
+    if (!value.empty() && key == "sev") {
+      term.kind = Kind::Severity;
+      size_t at = 0;
+      while (at <= value.size()) {
+        size_t comma = std::min(value.find(',', at), value.size());
+        std::string name = value.substr(at, comma - at);
+        uint32_t bits = 0;
+        for (size_t i = 0; i < kLogSeverityCount && !name.empty(); i++) {
+          if (StartsWith(kQuerySeverityNames[i], name))
+            bits |= 1u << i;
+        }
+        if (bits == 0)
+          problem = "unknown severity \"" + name + "\"";
+        term.severities |= bits;
+        at = comma + 1;
+      }
+      uses_severity_ = true;
+    } else if (!value.empty() && (key == "after" || key == "before")) {
+      term.kind = key == "after" ? Kind::After : Kind::Before;
+      if (!ParseTimeOfDay(value, term.value))
+        problem = key + ": takes a time of day, e.g. 14:30";
+    } else if (!value.empty() && key == "since") {
+      term.kind = Kind::Since;
+      if (!ParseAge(value, term.value))
+        problem = "since: takes an age, e.g. 30m, 2h or 1d";
+      term.value = now_ms - term.value;
+    } else if (!value.empty() && key == "status") {
+      term.kind = Kind::Status;
+      for (const char *status : {"passed", "failed", "running"}) {
+        if (StartsWith(status, value))
+          term.text = status;
+      }
+      if (term.text.empty())
+        problem = "status: is passed, failed or running";
+    } else if (!value.empty() &&
+               (key == "task" || key == "mode" || key == "phase")) {
+      term.kind = key == "task"   ? Kind::Task
+                  : key == "mode" ? Kind::Mode
+                                  : Kind::Phase;
+      term.text = value;
+    } else {
+      term.text = Lower(word);
+      if (term.text.empty())
+        continue;
+    }
+    terms_.push_back(std::move(term));
+  }
+  if (!problem.empty()) {
+    if (error)
+      *error = problem;
+    std::string kept = text_;
+    *this = LogQuery();
+    text_ = kept;
+    return false;
+  }
+
+  // Cheapest terms first; among substrings the longest, which is the most
+  // likely to rule a line out
+  std::stable_sort(terms_.begin(), terms_.end(),
+                   [](const Term &a, const Term &b) {
+                     if (a.kind != b.kind)
+                       return a.kind < b.kind;
+                     return a.kind == Kind::Text &&
+                            a.text.size() > b.text.size();
+                   });
+  for (const auto &term : terms_) {
+    if (term.kind == Kind::Text && !term.negated)
+      needles_.push_back(term.text);
+    if (term.kind == Kind::After || term.kind == Kind::Before ||
+        term.kind == Kind::Since || term.kind == Kind::Phase)
+      uses_time_ = true;
+  }
+  return true;
+}
+
+bool LogQuery::Refines(const LogQuery &prev) const {
+  for (const auto &want : prev.terms_) {
+    bool implied = std::any_of(
+        terms_.begin(), terms_.end(), [&want](const Term &have) {
+          if (have.kind != want.kind || have.negated != want.negated)
+            return false;
+          switch (want.kind) {
+          case Kind::Text:
+            // "abc" implies "ab"; "-ab" implies "-abc"
+            return want.negated
+                       ? want.text.find(have.text) != std::string::npos
+                       : have.text.find(want.text) != std::string::npos;
+          case Kind::Severity:
+            return !want.negated &&
+                   (have.severities & ~want.severities) == 0;
+          default:
+            return have.value == want.value && have.text == want.text &&
+                   have.severities == want.severities;
+          }
+        });
+    if (!implied)
+      return false;
+  }
+  return true;
+}
+
+bool LogQuery::TimeMatches(const Term &term, long long ms) const {
+  if (term.kind == Kind::Since)
+    return ms >= term.value;
+  long long of_day = ((ms + utc_offset_ms_) % kDayMs + kDayMs) % kDayMs;
+  return term.kind == Kind::After ? of_day >= term.value
+                                  : of_day < term.value;
+}
+
+bool LogQuery::PhaseMatches(const std::string &want,
+                            const std::string &name) {
+  if (name.find(want) != std::string::npos)
+    return true;
+  return want == "verify" && name.find("verification") != std::string::npos;
+}
+
+bool LogQuery::MatchLine(const LogQueryLine &line) const {
+  for (const auto &term : terms_) {
+    bool match;
+    switch (term.kind) {
+    case Kind::Severity:
+      match = (term.severities >> (unsigned)line.severity) & 1;
+      break;
+    case Kind::After:
+    case Kind::Before:
+    case Kind::Since:
+      if (line.ms == 0)
+        continue;
+      match = TimeMatches(term, line.ms);
+      break;
+    case Kind::Task:
+      if (!line.source)
+        continue;
+      match = line.source->find(term.text) != std::string::npos;
+      break;
+    case Kind::Phase:
+      if (!line.phases || line.ms == 0)
+        continue;
+      match = std::any_of(
+          line.phases->begin(), line.phases->end(),
+          [&](const PhaseTiming &phase) {
+            return phase.start_ms <= line.ms &&
+                   (phase.end_ms == 0 || line.ms <= phase.end_ms) &&
+                   PhaseMatches(term.text, phase.name);
+          });
+      break;
+    case Kind::Text:
+      match = line.lower.find(term.text) != std::string_view::npos;
+      break;
+    default:
+      continue; // mode and status say nothing about one line
+    }
+    if (match == term.negated)
+      return false;
+  }
+  return true;
+}
+
+bool LogQuery::MatchFile(const std::string &lower_label,
+                         long long mtime_ms) const {
+  size_t slash = lower_label.rfind('/');
+  std::string file = slash == std::string::npos
+                         ? lower_label
+                         : lower_label.substr(slash + 1);
+  for (const auto &term : terms_) {
+    bool match;
+    switch (term.kind) {
+    case Kind::Since:
+      match = mtime_ms >= term.value;
+      break;
+    case Kind::Task:
+    case Kind::Mode:
+      match = lower_label.find(term.text) != std::string::npos;
+      break;
+    case Kind::Phase:
+      match = PhaseMatches(term.text, file);
+      break;
+    default:
+      continue; // decided per line, or unknown for a file
+    }
+    if (match == term.negated)
+      return false;
+  }
+  return true;
+}
+
+bool LogQuery::MatchRun(const LogQueryRun &run) const {
+  for (const auto &term : terms_) {
+    bool match;
+    switch (term.kind) {
+    case Kind::After:
+    case Kind::Before:
+    case Kind::Since:
+      match = run.started_ms > 0 && TimeMatches(term, run.started_ms);
+      break;
+    case Kind::Task:
+      match = run.name.find(term.text) != std::string::npos;
+      break;
+    case Kind::Mode:
+      match = std::any_of(run.modes.begin(), run.modes.end(),
+                          [&](const std::string &mode) {
+                            return mode.find(term.text) != std::string::npos;
+                          });
+      break;
+    case Kind::Status:
+      match = run.status == term.text;
+      break;
+    case Kind::Phase:
+      match = std::any_of(run.phases.begin(), run.phases.end(),
+                          [&](const PhaseTiming &phase) {
+                            return PhaseMatches(term.text, phase.name);
+                          });
+      break;
+    case Kind::Text:
+      match = run.name.find(term.text) != std::string::npos ||
+              run.failure.find(term.text) != std::string::npos;
+      break;
+    default:
+      continue; // severity is a property of lines
+    }
+    if (match == term.negated)
+      return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                    PROCESS LAUNCHER                   //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+extern char **environ; // not declared by every libc's headers
+
+bool CreateCloexecPipe(int fds[2]) {
+#if defined(__linux__)
+  return pipe2(fds, O_CLOEXEC) == 0;
+#else
+  if (pipe(fds) == -1)
+    return false;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+#endif
+}
+
+std::vector<std::string>
+SpawnEnvironment(const std::vector<std::string> &overrides) {
+  auto name_of = [](std::string_view entry) {
+    return entry.substr(0, entry.find('='));
+  };
+  std::vector<std::string> entries;
+  for (char **e = environ; e && *e; ++e) {
+    std::string_view entry(*e);
+    bool overridden = false;
+    for (const auto &o : overrides)
+      if (name_of(o) == name_of(entry))
+        overridden = true;
+    if (!overridden)
+      entries.emplace_back(entry);
+  }
+  entries.insert(entries.end(), overrides.begin(), overrides.end());
+  return entries;
+}
+
+// Master side of a new pseudo-terminal sized cols x rows, and the path of
+// its slave side; -1 with errno set on failure
+static int OpenPseudoTerminal(unsigned short cols, unsigned short rows,
+                              std::string &slave_path) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0)
+    return -1;
+  fcntl(master, F_SETFD, FD_CLOEXEC);
+  // ptsname uses a static buffer
+  static std::mutex ptsname_mutex;
+  const char *name = nullptr;
+  if (grantpt(master) == 0 && unlockpt(master) == 0) {
+    std::lock_guard<std::mutex> lock(ptsname_mutex);
+    name = ptsname(master);
+    if (name)
+      slave_path = name;
+  }
+  if (!name) {
+    int saved = errno;
+    close(master);
+    errno = saved;
+    return -1;
+  }
+  struct winsize ws{};
+  ws.ws_col = cols;
+  ws.ws_row = rows;
+  ioctl(master, TIOCSWINSZ, &ws);
+  return master;
+}
+
+bool SpawnProcess(const std::string &file,
+                  const std::vector<std::string> &argv,
+                  const SpawnOptions &opts, SpawnedProcess &out) {
+  out = SpawnedProcess();
+  int out_pipe[2] = {-1, -1}, err_pipe[2] = {-1, -1};
+  std::string slave_path;
+  if (opts.pty) {
+    // Only the read end is used; the child opens the slave by name so it
+    // becomes its controlling terminal
+    out_pipe[0] = OpenPseudoTerminal(opts.pty_cols, opts.pty_rows,
+                                     slave_path);
+    if (out_pipe[0] < 0)
+      return false;
+  } else if (!CreateCloexecPipe(out_pipe)) {
+    return false;
+  }
+  if (!opts.pty && opts.stderr_mode == SpawnStderr::Pipe &&
+      !CreateCloexecPipe(err_pipe)) {
+    int saved = errno;
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    errno = saved;
+    return false;
+  }
+
+  std::vector<char *> args;
+  for (const auto &a : argv)
+    args.push_back(const_cast<char *>(a.c_str()));
+  args.push_back(nullptr);
+  std::vector<std::string> env = SpawnEnvironment(opts.env);
+  std::vector<char *> envp;
+  for (auto &entry : env)
+    envp.push_back(const_cast<char *>(entry.c_str()));
+  envp.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  if (opts.pty) {
+    // stderr shares the terminal
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                     slave_path.c_str(), O_RDWR, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+  } else {
+    // dup2 onto 1 and 2 clears close-on-exec on the copies only
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    if (opts.stderr_mode == SpawnStderr::Pipe)
+      posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+    else if (opts.stderr_mode == SpawnStderr::Merge)
+      posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDERR_FILENO);
+  }
+#if defined(__APPLE__)
+  if (!opts.pty && opts.stderr_mode == SpawnStderr::Inherit)
+    posix_spawn_file_actions_addinherit_np(&actions, STDERR_FILENO);
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+  posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  bool own_group = opts.new_process_group || opts.pty;
+#ifdef POSIX_SPAWN_SETSID
+  // A new session (and so a new process group) whose first terminal
+  // opened, the pty, becomes its controlling one
+  if (opts.pty) {
+    flags |= POSIX_SPAWN_SETSID;
+    own_group = false;
+  }
+#endif
+  if (own_group) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attr, 0);
+  }
+#if defined(__APPLE__)
+  // Everything not named in the file actions is closed in the child
+  flags |= POSIX_SPAWN_CLOEXEC_DEFAULT;
+#endif
+  posix_spawnattr_setflags(&attr, flags);
+  sigset_t none, defaults;
+  sigemptyset(&none);
+  posix_spawnattr_setsigmask(&attr, &none);
+  // Whatever this process ignores (SIGPIPE around socket writes) is reset
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  sigaddset(&defaults, SIGINT);
+  sigaddset(&defaults, SIGTERM);
+  sigaddset(&defaults, SIGHUP);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+
+  pid_t pid = -1;
+  int err = posix_spawnp(&pid, file.c_str(), &actions, &attr, args.data(),
+                         envp.data());
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (out_pipe[1] != -1)
+    close(out_pipe[1]);
+  if (err_pipe[1] != -1)
+    close(err_pipe[1]);
+  if (err != 0) {
+    close(out_pipe[0]);
+    if (err_pipe[0] != -1)
+      close(err_pipe[0]);
+    errno = err;
+    return false;
+  }
+  out.pid = pid;
+  out.out_fd = out_pipe[0];
+  out.err_fd = err_pipe[0];
+  return true;
+}
+#endif
+
+#ifdef _WIN32
+std::wstring Widen(const std::string &narrow) {
+  if (narrow.empty())
+    return std::wstring();
+  int len = MultiByteToWideChar(CP_UTF8, 0, narrow.c_str(), (int)narrow.size(),
+                                NULL, 0);
+  std::wstring wide(len, L'\0');
+  MultiByteToWideChar(CP_UTF8, 0, narrow.c_str(), (int)narrow.size(), &wide[0],
+                      len);
+  return wide;
+}
+#endif
+
+// ProcessReactor: how often stop flags are looked at without a Wake(), how
+// long a stopped or exited tree gets before it is killed or its pipe given
+// up, and the most a single read takes from a pipe
+static const int kReactorStopCheckMs = 250;
+static const int kReactorTermGraceMs = 100;
+static const size_t kReactorChunkSize = 64 * 1024;
+
+#ifdef _WIN32
+// Anonymous pipes do not support overlapped I/O, so the child's stdout/stderr
+// goes through a uniquely named pipe whose read end is opened overlapped and
+// can be bound to the reactor's completion port.
+static bool CreateOverlappedPipe(HANDLE &out_read, HANDLE &out_write,
+                                 SECURITY_ATTRIBUTES *write_sa) {
+  static std::atomic<unsigned long> pipe_serial{0};
+  char name[128];
+  snprintf(name, sizeof(name), "\\\\.\\pipe\\autobuild.%lu.%lu",
+           (unsigned long)GetCurrentProcessId(), pipe_serial.fetch_add(1));
+
+  out_read = CreateNamedPipeA(
+      name, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED |
+                FILE_FLAG_FIRST_PIPE_INSTANCE,
+      PIPE_TYPE_BYTE | PIPE_WAIT, 1, (DWORD)kReactorChunkSize,
+      (DWORD)kReactorChunkSize, 0, NULL);
+  if (out_read == INVALID_HANDLE_VALUE) {
+    out_read = NULL;
+    return false;
+  }
+  out_write = CreateFileA(name, GENERIC_WRITE, 0, write_sa, OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL, NULL);
+  if (out_write == INVALID_HANDLE_VALUE) {
+    CloseHandle(out_read);
+    out_read = NULL;
+    out_write = NULL;
+    return false;
+  }
+  return true;
+}
+
+// Terminate a process and its direct children (Docker CLI, bash, ...).
+// Only used for a child that could not be put in a job object.
+static void TerminateProcessTree(HANDLE process) {
+  HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (hSnapshot != INVALID_HANDLE_VALUE) {
+    PROCESSENTRY32W pe32;
+    pe32.dwSize = sizeof(pe32);
+
+    if (Process32FirstW(hSnapshot, &pe32)) {
+      DWORD parent_pid = GetProcessId(process);
+      do {
+        if (pe32.th32ParentProcessID == parent_pid) {
+          HANDLE hChild =
+              OpenProcess(PROCESS_TERMINATE, FALSE, pe32.th32ProcessID);
+          if (hChild) {
+            TerminateProcess(hChild, 1);
+            CloseHandle(hChild);
+          }
+        }
+      } while (Process32NextW(hSnapshot, &pe32));
+    }
+    CloseHandle(hSnapshot);
+  }
+
+  // Finally terminate the parent process
+  TerminateProcess(process, 1);
+}
+#else
+// Exit notification for the reactor. On Linux a pidfd becomes readable when
+// the child exits, so it can sit in the same poll() set as the output pipes.
+// Where pidfds are unavailable (macOS, older kernels) the reactor falls back
+// to a waitpid(WNOHANG) sweep on each stop-check timeout.
+static int OpenChildExitFd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+#endif
+
+// Background priority for a run's process tree. On Windows the job object
+// carries a priority class for all its processes, so the whole tree goes
+// to below normal and back as the phase changes; Windows has no way to put
+// another process's I/O in background mode, so only CPU priority follows.
+// On POSIX an unprivileged process cannot take a nice value back down, so
+// the script itself is never lowered: the reactor lowers what it has
+// started every kPrioritySweepMs while the phase is a background one, and
+// what a later prompt phase starts runs at the script's normal priority.
+static const int kBackgroundNice = 10;
+static const int kPrioritySweepMs = 1000;
+
+#ifdef _WIN32
+// False when the system refused the priority class
+static bool SetJobBackground(HANDLE job, bool background) {
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION info{};
+  if (!QueryInformationJobObject(job, JobObjectExtendedLimitInformation,
+                                 &info, sizeof(info), NULL))
+    return false;
+  // Dropping the limit would leave the processes where they are, so going
+  // back to normal is a limit of its own
+  info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_PRIORITY_CLASS;
+  info.BasicLimitInformation.PriorityClass =
+      background ? BELOW_NORMAL_PRIORITY_CLASS : NORMAL_PRIORITY_CLASS;
+  return SetInformationJobObject(job, JobObjectExtendedLimitInformation, &info,
+                                 sizeof(info)) != 0;
+}
+#else
+// Renice root's descendants (not root) to kBackgroundNice above this
+// process. Linux keeps nice and I/O priority per thread, so every thread of
+// each descendant is lowered, and its I/O goes to the lowest best-effort
+// level; the tree is walked through /proc/<pid>/task/<tid>/children. macOS
+// renices the members of root's process group.
+static void LowerProcessTree(pid_t root) {
+  errno = 0;
+  int base = getpriority(PRIO_PROCESS, 0);
+  int nice = std::min(19, (errno ? 0 : base) + kBackgroundNice);
+#if defined(__linux__)
+  std::vector<pid_t> pending{root};
+  while (!pending.empty()) {
+    pid_t pid = pending.back();
+    pending.pop_back();
+    std::string task_dir = "/proc/" + std::to_string(pid) + "/task/";
+    DIR *dir = opendir(task_dir.c_str());
+    if (!dir)
+      continue;
+    while (struct dirent *entry = readdir(dir)) {
+      if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+        continue;
+      if (pid != root) {
+        int tid = atoi(entry->d_name);
+        setpriority(PRIO_PROCESS, (id_t)tid, nice);
+#ifdef SYS_ioprio_set
+        // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_BE level 7
+        syscall(SYS_ioprio_set, 1, tid, (2 << 13) | 7);
+#endif
+      }
+      std::string children = task_dir + entry->d_name + "/children";
+      if (FILE *f = fopen(children.c_str(), "r")) {
+        long child = 0;
+        while (fscanf(f, "%ld", &child) == 1)
+          pending.push_back((pid_t)child);
+        fclose(f);
+      }
+    }
+    closedir(dir);
+  }
+#elif defined(__APPLE__)
+  std::vector<pid_t> pids(256);
+  int bytes = proc_listpids(PROC_PGRP_ONLY, (uint32_t)root, pids.data(),
+                            (int)(pids.size() * sizeof(pid_t)));
+  for (int i = 0; i < bytes / (int)sizeof(pid_t); i++) {
+    if (pids[i] > 0 && pids[i] != root)
+      setpriority(PRIO_PROCESS, (id_t)pids[i], nice);
+  }
+#else
+  (void)root;
+  (void)nice;
+#endif
+}
+#endif
+
+struct ReactorChild {
+  ProcessReactor::LineFn on_line;
+  ProcessReactor::ExitFn on_exit;
+  std::atomic<bool> *should_stop = nullptr;
+  bool stop_sent = false;
+  const std::atomic<bool> *background = nullptr;
+  std::unique_ptr<StreamRecorder> recorder; // null unless recording
+#ifdef _WIN32
+  bool lowered = false; // the job's priority class is below normal
+  HANDLE iocp = NULL; // the reactor's port, for the exit notification
+  ULONG_PTR key = 0;
+  HANDLE process = NULL;
+  // Job object holding the process tree (kill on close), or NULL when
+  // the process could not be assigned to one
+  HANDLE job = NULL;
+  // Pseudo-console the process writes to, and the write end of its
+  // (unused) input; NULL when output comes over the pipe directly
+  void *pty = NULL;
+  HANDLE pty_input = NULL;
+  HANDLE read = NULL;
+  HANDLE exit_wait = NULL;
+  OVERLAPPED ov{};
+  LineSplitter lines{true};
+  bool read_pending = false;
+  bool pipe_open = true;
+  bool exited = false;
+  bool cancel_sent = false;
+  std::chrono::steady_clock::time_point grace_until;
+#else
+  pid_t pid = -1;
+  int out_fd = -1;
+  int err_fd = -1;
+  int exit_fd = -1;
+  // stdout and stderr keep separate partial-line buffers so interleaved
+  // writes never splice two half lines together
+  LineSplitter out_lines{true};
+  LineSplitter err_lines{true};
+  bool exited = false;
+  int status = 0;
+  bool kill_sent = false;
+  std::chrono::steady_clock::time_point kill_at;
+  std::chrono::steady_clock::time_point sweep_at; // next LowerProcessTree
+#endif
+};
+
+ProcessReactor::ProcessReactor() = default;
+ProcessReactor::~ProcessReactor() = default;
+
+bool ProcessReactor::EnsureStarted() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (started_)
+    return true;
+#ifdef _WIN32
+  iocp_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+  if (!iocp_)
+    return false;
+#else
+  if (!CreateCloexecPipe(wake_pipe_))
+    return false;
+  fcntl(wake_pipe_[0], F_SETFL, fcntl(wake_pipe_[0], F_GETFL, 0) | O_NONBLOCK);
+  fcntl(wake_pipe_[1], F_SETFL, fcntl(wake_pipe_[1], F_GETFL, 0) | O_NONBLOCK);
+#endif
+  // Lives for the whole program, like the other background workers
+  std::thread([this]() { Run(); }).detach();
+  started_ = true;
+  return true;
+}
+
+void ProcessReactor::Wake() {
+#ifdef _WIN32
+  if (iocp_)
+    PostQueuedCompletionStatus(iocp_, 0, 0, NULL);
+#else
+  if (wake_pipe_[1] >= 0) {
+    char b = 1;
+    ssize_t ignored = write(wake_pipe_[1], &b, 1);
+    (void)ignored; // pipe full means a wakeup is already pending
+  }
+#endif
+}
+
+void ProcessReactor::Finish(ReactorChild &child) {
+  bool stopped = child.should_stop && child.should_stop->load();
+  int exit_code = 1;
+#ifdef _WIN32
+  child.lines.Finish(child.on_line);
+  DWORD code = 1;
+  if (GetExitCodeProcess(child.process, &code))
+    exit_code = (int)code;
+  ReportJobUsage(child);
+#else
+  child.out_lines.Finish(child.on_line);
+  child.err_lines.Finish(child.on_line);
+  if (WIFEXITED(child.status))
+    exit_code = WEXITSTATUS(child.status);
+  if (Debug()) {
+    hooks_.log("[DEBUG][Mac/Linux] Process " + std::to_string(child.pid) +
+               " finished with exit code: " + std::to_string(exit_code));
+  }
+#endif
+  // Complete on disk by the time the exit is reported
+  if (child.recorder)
+    child.recorder->Close();
+  if (stopped)
+    child.on_line("[STOPPED] Task was terminated by user");
+  child.on_exit(exit_code, stopped);
+
+#ifdef _WIN32
+  // Blocks until a running OnProcessExit callback has returned
+  if (child.exit_wait)
+    UnregisterWaitEx(child.exit_wait, INVALID_HANDLE_VALUE);
+  ClosePseudoConsole(child);
+  CloseHandle(child.read);
+  CloseHandle(child.process);
+  // Kill on close: takes down whatever the tree left running
+  if (child.job)
+    CloseHandle(child.job);
+#else
+  if (child.exit_fd >= 0)
+    close(child.exit_fd);
+  if (child.out_fd >= 0)
+    close(child.out_fd);
+  if (child.err_fd >= 0)
+    close(child.err_fd);
+#endif
+  std::lock_guard<std::mutex> lock(mutex_);
+  active_count_--;
+}
+
+#ifdef _WIN32
+// A job object that kills its processes when closed, with the requested
+// limits; NULL if the system refuses one
+void *ProcessReactor::CreateTreeJob(const ProcessOptions &limits) {
+  HANDLE job = CreateJobObjectW(NULL, NULL);
+  if (!job)
+    return NULL;
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION info{};
+  info.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+  if (limits.memory_mb > 0) {
+    info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+    info.JobMemoryLimit = (SIZE_T)(limits.memory_mb << 20);
+  }
+  if (!SetInformationJobObject(job, JobObjectExtendedLimitInformation, &info,
+                               sizeof(info))) {
+    CloseHandle(job);
+    return NULL;
+  }
+  if (limits.cpu_percent > 0 && limits.cpu_percent < 100) {
+    // CpuRate is in hundredths of a percent of all processors
+    JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate{};
+    rate.ControlFlags = JOB_OBJECT_CPU_RATE_CONTROL_ENABLE |
+                        JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+    rate.CpuRate = (DWORD)limits.cpu_percent * 100;
+    if (!SetInformationJobObject(job, JobObjectCpuRateControlInformation,
+                                 &rate, sizeof(rate)) &&
+        Debug())
+      hooks_.log("[WARN] CPU rate limit not applied to the process tree");
+  }
+  return job;
+}
+
+// ConPTY entry points, looked up at run time since they only exist from
+// Windows 10 1809 on
+typedef HRESULT(WINAPI *CreatePseudoConsoleFn)(COORD, HANDLE, HANDLE, DWORD,
+                                               void **);
+typedef void(WINAPI *ClosePseudoConsoleFn)(void *);
+static CreatePseudoConsoleFn g_create_pseudo_console = nullptr;
+static ClosePseudoConsoleFn g_close_pseudo_console = nullptr;
+#ifndef PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE
+#define PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE 0x00020016
+#endif
+
+// A kPtyColumns x kPtyRows pseudo-console writing to output, or NULL when
+// ConPTY is unavailable; input_write receives the write end of its input
+static void *OpenPseudoConsole(HANDLE output, HANDLE &input_write) {
+  static std::once_flag resolved;
+  std::call_once(resolved, []() {
+    HMODULE kernel = GetModuleHandleW(L"kernel32.dll");
+    if (!kernel)
+      return;
+    g_create_pseudo_console = (CreatePseudoConsoleFn)(void (*)())
+        GetProcAddress(kernel, "CreatePseudoConsole");
+    g_close_pseudo_console = (ClosePseudoConsoleFn)(void (*)())
+        GetProcAddress(kernel, "ClosePseudoConsole");
+  });
+  input_write = NULL;
+  if (!g_create_pseudo_console || !g_close_pseudo_console)
+    return NULL;
+  HANDLE input_read = NULL;
+  if (!CreatePipe(&input_read, &input_write, NULL, 0))
+    return NULL;
+  COORD size = {(SHORT)kPtyColumns, (SHORT)kPtyRows};
+  void *pty = NULL;
+  HRESULT hr = g_create_pseudo_console(size, input_read, output, 0, &pty);
+  CloseHandle(input_read);
+  if (FAILED(hr)) {
+    CloseHandle(input_write);
+    input_write = NULL;
+    return NULL;
+  }
+  return pty;
+}
+
+// Close a child's pseudo-console so the console host writes what it still
+// holds and lets go of the pipe. That can block until the pipe is read, so
+// it runs on the job pool rather than the reactor thread.
+void ProcessReactor::ClosePseudoConsole(ReactorChild &child) {
+  if (!child.pty)
+    return;
+  void *pty = child.pty;
+  HANDLE input = child.pty_input;
+  child.pty = NULL;
+  child.pty_input = NULL;
+  auto close_pty = [pty, input](const CancelToken &) {
+    g_close_pseudo_console(pty);
+    CloseHandle(input);
+  };
+  if (hooks_.jobs)
+    hooks_.jobs->Submit(JobLane::Io, JobPriority::Normal, close_pty);
+  else
+    close_pty(CancelToken());
+}
+
+// Log what the whole process tree used, from the job's accounting
+static void ReportJobUsage(ReactorChild &child) {
+  if (!child.job)
+    return;
+  JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION acct{};
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION ext{};
+  if (!QueryInformationJobObject(child.job,
+                                 JobObjectBasicAndIoAccountingInformation,
+                                 &acct, sizeof(acct), NULL))
+    return;
+  QueryInformationJobObject(child.job, JobObjectExtendedLimitInformation,
+                            &ext, sizeof(ext), NULL);
+  // Times are in 100 ns units
+  char line[200];
+  snprintf(line, sizeof(line),
+           "[INFO] Process tree: %lu processes, CPU %.1fs user %.1fs "
+           "kernel, read %.0f MiB, wrote %.0f MiB, peak memory %.0f MiB",
+           (unsigned long)acct.BasicInfo.TotalProcesses,
+           acct.BasicInfo.TotalUserTime.QuadPart / 1e7,
+           acct.BasicInfo.TotalKernelTime.QuadPart / 1e7,
+           acct.IoInfo.ReadTransferCount / 1048576.0,
+           acct.IoInfo.WriteTransferCount / 1048576.0,
+           ext.PeakJobMemoryUsed / 1048576.0);
+  child.on_line(line);
+}
+
+bool ProcessReactor::Spawn(const std::string &exe, const std::string &args,
+                           LineFn on_line, ExitFn on_exit,
+                           std::atomic<bool> *should_stop,
+                           ProcessHandle &out_handle,
+                           const std::vector<std::string> &env,
+                           const ProcessOptions &options) {
+  out_handle = NULL;
+  if (!EnsureStarted())
+    return false;
+
+  SECURITY_ATTRIBUTES sa{};
+  sa.nLength = sizeof(sa);
+  sa.bInheritHandle = TRUE;
+  sa.lpSecurityDescriptor = NULL;
+  HANDLE hRead = NULL, hWrite = NULL;
+  if (!CreateOverlappedPipe(hRead, hWrite, &sa))
+    return false;
+
+  // With a pseudo-console the output reaches the pipe through the console
+  // host, and nothing is inherited; without one (not asked for, or ConPTY
+  // missing) stdout and stderr are the pipe itself
+  HANDLE pty_input = NULL;
+  void *pty = options.pty ? OpenPseudoConsole(hWrite, pty_input) : NULL;
+  STARTUPINFOEXW si{};
+  si.StartupInfo.cb = sizeof(si.StartupInfo);
+  si.StartupInfo.dwFlags = STARTF_USESHOWWINDOW;
+  si.StartupInfo.wShowWindow = SW_HIDE;
+  DWORD create_flags = CREATE_SUSPENDED;
+  std::vector<char> attributes;
+  if (pty) {
+    SIZE_T size = 0;
+    InitializeProcThreadAttributeList(NULL, 1, 0, &size);
+    attributes.resize(size);
+    si.lpAttributeList = (LPPROC_THREAD_ATTRIBUTE_LIST)attributes.data();
+    if (InitializeProcThreadAttributeList(si.lpAttributeList, 1, 0, &size) &&
+        UpdateProcThreadAttribute(si.lpAttributeList, 0,
+                                  PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE, pty,
+                                  sizeof(pty), NULL, NULL)) {
+      si.StartupInfo.cb = sizeof(si);
+      create_flags |= EXTENDED_STARTUPINFO_PRESENT;
+    } else {
+      DeleteProcThreadAttributeList(si.lpAttributeList);
+      si.lpAttributeList = NULL;
+      g_close_pseudo_console(pty);
+      CloseHandle(pty_input);
+      pty = NULL;
+      pty_input = NULL;
+    }
+  }
+  if (!pty) {
+    si.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+    si.StartupInfo.hStdOutput = hWrite;
+    si.StartupInfo.hStdError = hWrite;
+    create_flags |= CREATE_NO_WINDOW;
+  }
+
+  PROCESS_INFORMATION pi{};
+
+  // Environment block: this process's variables minus the overridden ones,
+  // then the overrides (names compare case-insensitively on Windows)
+  std::wstring env_block;
+  if (!env.empty()) {
+    std::vector<std::wstring> overrides;
+    for (const auto &entry : env)
+      overrides.push_back(Widen(entry));
+    auto name_of = [](const std::wstring &entry) {
+      size_t eq = entry.find(L'=', 1); // "=C:" style entries start with '='
+      return entry.substr(0, eq);
+    };
+    LPWCH current = GetEnvironmentStringsW();
+    for (LPWCH p = current; p && *p; p += wcslen(p) + 1) {
+      std::wstring entry(p);
+      std::wstring name = name_of(entry);
+      bool overridden = false;
+      for (const auto &o : overrides)
+        if (_wcsicmp(name_of(o).c_str(), name.c_str()) == 0)
+          overridden = true;
+      if (!overridden)
+        env_block += entry + L'\0';
+    }
+    if (current)
+      FreeEnvironmentStringsW(current);
+    for (const auto &o : overrides)
+      env_block += o + L'\0';
+    env_block += L'\0';
+  }
+
+  // The process starts suspended so it is in its job before it can start
+  // children of its own; stopping it is then one TerminateJobObject for
+  // the whole tree
+  HANDLE job = CreateTreeJob(options);
+  std::wstring wExe = Widen(exe);
+  std::wstring wCmdLine = Widen(std::string("\"") + exe + "\" " + args);
+  BOOL ok = CreateProcessW(
+      wExe.c_str(), &wCmdLine[0], NULL, NULL, pty ? FALSE : TRUE,
+      create_flags | (env_block.empty() ? 0 : CREATE_UNICODE_ENVIRONMENT),
+      env_block.empty() ? NULL : &env_block[0], NULL, &si.StartupInfo, &pi);
+  if (si.lpAttributeList)
+    DeleteProcThreadAttributeList(si.lpAttributeList);
+  CloseHandle(hWrite);
+  if (!ok) {
+    CloseHandle(hRead);
+    if (job)
+      CloseHandle(job);
+    if (pty) {
+      g_close_pseudo_console(pty);
+      CloseHandle(pty_input);
+    }
+    return false;
+  }
+  if (job && !AssignProcessToJobObject(job, pi.hProcess)) {
+    if (Debug())
+      hooks_.log("[WARN] Cannot assign process to a job object (error " +
+                 std::to_string(GetLastError()) + ")");
+    CloseHandle(job);
+    job = NULL;
+  }
+  ResumeThread(pi.hThread);
+  CloseHandle(pi.hThread);
+
+  auto child = std::make_unique<ReactorChild>();
+  child->iocp = iocp_;
+  child->on_line = std::move(on_line);
+  child->on_exit = std::move(on_exit);
+  child->should_stop = should_stop;
+  child->background = options.background;
+  if (!options.record_path.empty()) {
+    child->recorder = std::make_unique<StreamRecorder>();
+    if (!child->recorder->Open(options.record_path))
+      child->recorder.reset();
+  }
+  child->process = pi.hProcess;
+  child->job = job;
+  child->pty = pty;
+  child->pty_input = pty_input;
+  child->read = hRead;
+  out_handle = pi.hProcess;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    child->key = next_key_++;
+    pending_.push_back(std::move(child));
+    active_count_++;
+  }
+  Wake();
+  return true;
+}
+
+static VOID CALLBACK OnProcessExit(PVOID context, BOOLEAN) {
+  ReactorChild *child = static_cast<ReactorChild *>(context);
+  PostQueuedCompletionStatus(child->iocp, 0, child->key, NULL);
+}
+
+void ProcessReactor::IssueRead(ReactorChild &child) {
+  if (!child.pipe_open || child.read_pending)
+    return;
+  ZeroMemory(&child.ov, sizeof(child.ov));
+  // Synchronous completions still queue a packet on the port, so both
+  // outcomes are handled by the completion loop
+  if (ReadFile(child.read, child.lines.Prepare(kReactorChunkSize),
+               (DWORD)kReactorChunkSize, NULL, &child.ov) ||
+      GetLastError() == ERROR_IO_PENDING) {
+    child.read_pending = true;
+  } else {
+    child.pipe_open = false; // ERROR_BROKEN_PIPE: all writers closed
+  }
+}
+
+void ProcessReactor::Run() {
+  if (hooks_.thread_start)
+    hooks_.thread_start();
+  std::map<ULONG_PTR, std::unique_ptr<ReactorChild>> children;
+
+  for (;;) {
+    if (hooks_.before_wait)
+      hooks_.before_wait();
+
+    // Adopt newly spawned processes on this thread so no completion packet
+    // can arrive for a child the loop does not know about yet
+    {
+      std::vector<std::unique_ptr<ReactorChild>> adopted;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        adopted.swap(pending_);
+      }
+      for (auto &c : adopted) {
+        ReactorChild &child = *c;
+        CreateIoCompletionPort(child.read, iocp_, child.key, 0);
+        RegisterWaitForSingleObject(&child.exit_wait, child.process,
+                                    &OnProcessExit, &child,
+                                    INFINITE, WT_EXECUTEONLYONCE);
+        IssueRead(child);
+        children[child.key] = std::move(c);
+      }
+    }
+
+    // Apply stop requests and retire finished children
+    auto now = std::chrono::steady_clock::now();
+    bool in_grace = false;
+    for (auto it = children.begin(); it != children.end();) {
+      ReactorChild &child = *it->second;
+      if (!child.stop_sent && child.should_stop && child.should_stop->load()) {
+        child.stop_sent = true;
+        if (!child.job || !TerminateJobObject(child.job, 1))
+          TerminateProcessTree(child.process);
+      }
+      bool background = child.background && child.background->load();
+      if (child.job && background != child.lowered) {
+        child.lowered = background;
+        if (!SetJobBackground(child.job, background) && Debug())
+          hooks_.log("[WARN] Priority class not applied to the process tree");
+      }
+      // Once the process is gone, detached grandchildren that still hold
+      // the write end get a short grace period before the read is
+      // cancelled
+      if (child.exited && child.pipe_open && now >= child.grace_until &&
+          child.read_pending && !child.cancel_sent) {
+        child.cancel_sent = true;
+        CancelIoEx(child.read, &child.ov);
+      }
+      if (child.exited && !child.read_pending &&
+          (!child.pipe_open || child.cancel_sent)) {
+        Finish(child);
+        it = children.erase(it);
+        continue;
+      }
+      if (child.exited)
+        in_grace = true;
+      ++it;
+    }
+
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED *ov = NULL;
+    BOOL got = GetQueuedCompletionStatus(
+        iocp_, &bytes, &key, &ov,
+        in_grace ? kReactorTermGraceMs : kReactorStopCheckMs);
+    if (!ov) {
+      // Wake(), timeout, or a process exit notification
+      if (key != 0) {
+        auto it = children.find(key);
+        if (it != children.end()) {
+          it->second->exited = true;
+          it->second->grace_until =
+              std::chrono::steady_clock::now() +
+              std::chrono::milliseconds(kReactorTermGraceMs);
+          // The console host holds the pipe open until it is closed
+          ClosePseudoConsole(*it->second);
+        }
+      }
+      continue;
+    }
+
+    auto it = children.find(key);
+    if (it == children.end())
+      continue;
+    ReactorChild &child = *it->second;
+    child.read_pending = false;
+    if (!got) {
+      child.pipe_open = false; // broken pipe or cancelled read
+      continue;
+    }
+    if (child.recorder) // what the read filled, before Commit moves on
+      child.recorder->Write(child.lines.Prepare(bytes), bytes);
+    child.lines.Commit(bytes);
+    child.lines.Drain(child.on_line);
+    if (!child.cancel_sent)
+      IssueRead(child);
+    else
+      child.pipe_open = false;
+  }
+}
+#else
+bool ProcessReactor::Spawn(const std::string &exe, const std::string &args,
+                           LineFn on_line, ExitFn on_exit,
+                           std::atomic<bool> *should_stop,
+                           ProcessHandle &out_handle,
+                           const std::vector<std::string> &env,
+                           const ProcessOptions &options) {
+  out_handle = 0;
+  if (!EnsureStarted())
+    return false;
+
+  if (Debug()) {
+    hooks_.log("[DEBUG][Mac/Linux] ProcessReactor::Spawn exe='" + exe +
+               "' args='" + args + "'");
+  }
+
+  // Own process group for group-wide termination, environment overrides
+  // applied on top of ours
+  SpawnOptions opts;
+  opts.new_process_group = true;
+  opts.env = env;
+  opts.pty = options.pty;
+  opts.pty_cols = kPtyColumns;
+  opts.pty_rows = kPtyRows;
+  SpawnedProcess spawned;
+  if (!SpawnProcess(exe, ParseShellCommand(exe + " " + args), opts,
+                    spawned)) {
+    if (Debug()) {
+      hooks_.log("[ERROR][Mac/Linux] posix_spawn failed: " +
+                 std::string(strerror(errno)));
+    }
+    return false;
+  }
+  pid_t pid = spawned.pid;
+
+  if (Debug()) {
+    hooks_.log("[DEBUG][Mac/Linux] Spawned process PID: " +
+               std::to_string(pid));
+  }
+
+  // Non-blocking so each wakeup can drain a pipe completely
+  fcntl(spawned.out_fd, F_SETFL,
+        fcntl(spawned.out_fd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(spawned.err_fd, F_SETFL,
+        fcntl(spawned.err_fd, F_GETFL, 0) | O_NONBLOCK);
+
+  auto child = std::make_unique<ReactorChild>();
+  child->on_line = std::move(on_line);
+  child->on_exit = std::move(on_exit);
+  child->should_stop = should_stop;
+  child->background = options.background;
+  if (!options.record_path.empty()) {
+    child->recorder = std::make_unique<StreamRecorder>();
+    if (!child->recorder->Open(options.record_path))
+      child->recorder.reset();
+  }
+  child->pid = pid;
+  child->out_fd = spawned.out_fd;
+  child->err_fd = spawned.err_fd;
+  child->exit_fd = OpenChildExitFd(pid);
+  out_handle = pid;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(std::move(child));
+    active_count_++;
+  }
+  Wake();
+  return true;
+}
+
+// Read until EAGAIN; returns false once the pipe has reached EOF
+bool ProcessReactor::Drain(int fd, LineSplitter &lines, ReactorChild &child) {
+  for (;;) {
+    char *buf = lines.Prepare(kReactorChunkSize);
+    ssize_t n = read(fd, buf, kReactorChunkSize);
+    if (n > 0) {
+      if (child.recorder)
+        child.recorder->Write(buf, (size_t)n);
+      lines.Commit((size_t)n);
+      lines.Drain(child.on_line);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+}
+
+void ProcessReactor::Run() {
+  if (hooks_.thread_start)
+    hooks_.thread_start();
+  std::vector<std::unique_ptr<ReactorChild>> children;
+  std::vector<struct pollfd> fds;
+  // For each pollfd after the wake pipe: owning child index and which fd
+  // (0 = stdout, 1 = stderr, 2 = exit)
+  std::vector<std::pair<size_t, int>> fd_owner;
+
+  for (;;) {
+    if (hooks_.before_wait)
+      hooks_.before_wait();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto &c : pending_)
+        children.push_back(std::move(c));
+      pending_.clear();
+    }
+
+    // Apply stop requests: SIGTERM to the process group, SIGKILL if it is
+    // still around after the grace period
+    auto now = std::chrono::steady_clock::now();
+    int timeout_ms = -1;
+    for (auto &c : children) {
+      ReactorChild &child = *c;
+      if (!child.stop_sent && child.should_stop && child.should_stop->load()) {
+        child.stop_sent = true;
+        child.kill_at = now + std::chrono::milliseconds(kReactorTermGraceMs);
+        if (Debug()) {
+          hooks_.log("[DEBUG][Mac/Linux] Sending SIGTERM to process group " +
+                     std::to_string(child.pid));
+        }
+        if (killpg(child.pid, SIGTERM) != 0 && Debug()) {
+          hooks_.log("[ERROR][Mac/Linux] killpg(SIGTERM) failed: " +
+                     std::string(strerror(errno)));
+        }
+      }
+      if (child.stop_sent && !child.kill_sent) {
+        if (now >= child.kill_at) {
+          child.kill_sent = true;
+          if (Debug()) {
+            hooks_.log("[DEBUG][Mac/Linux] Process still running, sending "
+                       "SIGKILL to group " +
+                       std::to_string(child.pid));
+          }
+          killpg(child.pid, SIGKILL);
+        } else {
+          int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                         child.kill_at - now)
+                         .count() +
+                     1;
+          if (timeout_ms < 0 || left < timeout_ms)
+            timeout_ms = left;
+        }
+      }
+      // Processes the script started since the last sweep are lowered too
+      if (child.background && child.background->load() && !child.exited &&
+          now >= child.sweep_at) {
+        LowerProcessTree(child.pid);
+        child.sweep_at = now + std::chrono::milliseconds(kPrioritySweepMs);
+      }
+      // Without a pidfd, exits are found by the waitpid sweep below
+      if (child.exit_fd < 0 &&
+          (timeout_ms < 0 || timeout_ms > kReactorStopCheckMs))
+        timeout_ms = kReactorStopCheckMs;
+    }
+    // Stop flags set without Wake() are still honoured eventually
+    if (!children.empty() &&
+        (timeout_ms < 0 || timeout_ms > kReactorStopCheckMs))
+      timeout_ms = kReactorStopCheckMs;
+
+    fds.clear();
+    fd_owner.clear();
+    fds.push_back({wake_pipe_[0], POLLIN, 0});
+    for (size_t i = 0; i < children.size(); i++) {
+      ReactorChild &child = *children[i];
+      if (child.out_fd >= 0) {
+        fds.push_back({child.out_fd, POLLIN, 0});
+        fd_owner.push_back({i, 0});
+      }
+      if (child.err_fd >= 0) {
+        fds.push_back({child.err_fd, POLLIN, 0});
+        fd_owner.push_back({i, 1});
+      }
+      if (child.exit_fd >= 0) {
+        fds.push_back({child.exit_fd, POLLIN, 0});
+        fd_owner.push_back({i, 2});
+      }
+    }
+
+    int ready = poll(fds.data(), (nfds_t)fds.size(), timeout_ms);
+    if (ready < 0 && errno != EINTR) {
+      if (Debug()) {
+        hooks_.log("[ERROR][Mac/Linux] poll() failed: " +
+                   std::string(strerror(errno)));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+
+    if (fds[0].revents) {
+      char sink[64];
+      while (read(wake_pipe_[0], sink, sizeof(sink)) > 0) {
+      }
+    }
+
+    std::vector<bool> check_exit(children.size(), false);
+    for (size_t f = 1; ready > 0 && f < fds.size(); f++) {
+      if (!fds[f].revents)
+        continue;
+      ReactorChild &child = *children[fd_owner[f - 1].first];
+      switch (fd_owner[f - 1].second) {
+      case 0:
+        if (!Drain(child.out_fd, child.out_lines, child)) {
+          close(child.out_fd);
+          child.out_fd = -1;
+        }
+        break;
+      case 1:
+        if (!Drain(child.err_fd, child.err_lines, child)) {
+          close(child.err_fd);
+          child.err_fd = -1;
+        }
+        break;
+      default:
+        check_exit[fd_owner[f - 1].first] = true;
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < children.size(); i++) {
+      ReactorChild &child = *children[i];
+      bool pipes_closed = child.out_fd < 0 && child.err_fd < 0;
+      if (check_exit[i] || child.exit_fd < 0 || pipes_closed) {
+        if (waitpid(child.pid, &child.status, WNOHANG) == child.pid)
+          child.exited = true;
+      }
+    }
+
+    // Retire exited children after collecting what is already buffered,
+    // even if a detached grandchild still holds the write ends open
+    for (auto it = children.begin(); it != children.end();) {
+      ReactorChild &child = **it;
+      if (!child.exited) {
+        ++it;
+        continue;
+      }
+      if (child.out_fd >= 0)
+        Drain(child.out_fd, child.out_lines, child);
+      if (child.err_fd >= 0)
+        Drain(child.err_fd, child.err_lines, child);
+      Finish(child);
+      it = children.erase(it);
+    }
+  }
+}
+#endif
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                    SHELL COMMANDS                     //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+// Utility: check file existence (Windows only)
+static bool FileExistsWin(const std::string &path) {
+  DWORD attrs = GetFileAttributesA(path.c_str());
+  return (attrs != INVALID_FILE_ATTRIBUTES) &&
+         !(attrs & FILE_ATTRIBUTE_DIRECTORY);
+}
+#endif
+
+// Find bash.exe: PATH, Git for Windows, MSYS2 typical locations
+// Cache the result to avoid repeated file system operations
+static std::string g_cached_bash_path;
+static bool g_bash_path_cached = false;
+
+#ifdef _WIN32
+// Windows version
+std::string FindBash() {
+  // Return cached result if available
+  if (g_bash_path_cached) {
+    return g_cached_bash_path;
+  }
+
+  // Prefer Git for Windows / MSYS2 locations first
+  char *pf = getenv("ProgramFiles");
+  char *pf86 = getenv("ProgramFiles(x86)");
+  const char *candidates[] = {"%PF%/Git/bin/bash.exe",
+                              "%PF%/Git/usr/bin/bash.exe",
+                              "%PF86%/Git/bin/bash.exe",
+                              "%PF86%/Git/usr/bin/bash.exe",
+                              "C:/msys64/usr/bin/bash.exe",
+                              "C:/Program Files/Git/bin/bash.exe",
+                              "C:/Program Files/Git/usr/bin/bash.exe",
+                              "C:/Program Files (x86)/Git/bin/bash.exe",
+                              "C:/Program Files (x86)/Git/usr/bin/bash.exe"};
+  for (auto cand : candidates) {
+    std::string p(cand);
+    if (pf) {
+      size_t pos = p.find("%PF%");
+      if (pos != std::string::npos)
+        p.replace(pos, 4, pf);
+    }
+    if (pf86) {
+      size_t pos = p.find("%PF86%");
+      if (pos != std::string::npos)
+        p.replace(pos, 6, pf86);
+    }
+    for (char &c : p)
+      if (c == '\\')
+        c = '/';
+    if (FileExistsWin(p)) {
+      g_cached_bash_path = p;
+      g_bash_path_cached = true;
+      return p;
+    }
+  }
+  // As a fallback, try PATH but skip the WSL stub in System32
+  char buf[MAX_PATH] = {0};
+  if (SearchPathA(NULL, "bash.exe", NULL, MAX_PATH, buf, NULL)) {
+    std::string found(buf);
+    std::string lower = found;
+    for (char &c : lower)
+      c = (char)tolower(c);
+    if (lower.find("windows/system32/bash.exe") == std::string::npos &&
+        FileExistsWin(found)) {
+      g_cached_bash_path = found;
+      g_bash_path_cached = true;
+      return found;
+    }
+  }
+
+  // Cache empty result to avoid repeated searches
+  g_cached_bash_path = std::string();
+  g_bash_path_cached = true;
+  return std::string();
+}
+
+static std::mutex g_exec_backend_mutex;
+static ExecBackend g_exec_backend;
+// $WSL_DISTRO_NAME as the WSL session reported it, for mapping Linux paths
+// back to \\wsl.localhost\<distro> when the default distro is used
+static std::string g_wsl_distro_name;
+
+ExecBackend CurrentExecBackend() {
+  std::lock_guard<std::mutex> lock(g_exec_backend_mutex);
+  return g_exec_backend;
+}
+
+// Commands started after this use the new backend; the helper co-processes
+// restart on their next command (see BashCoprocess)
+void SetExecBackend(bool wsl, const std::string &distro) {
+  std::lock_guard<std::mutex> lock(g_exec_backend_mutex);
+  if (g_exec_backend.distro != distro)
+    g_wsl_distro_name.clear();
+  g_exec_backend.wsl = wsl;
+  g_exec_backend.distro = distro;
+}
+
+std::string WslDistroName() {
+  std::lock_guard<std::mutex> lock(g_exec_backend_mutex);
+  return g_exec_backend.distro.empty() ? g_wsl_distro_name
+                                       : g_exec_backend.distro;
+}
+
+// wsl.exe in System32, empty if WSL is not installed
+std::string FindWsl() {
+  static const std::string path = [] {
+    char dir[MAX_PATH] = {0};
+    UINT len = GetSystemDirectoryA(dir, MAX_PATH);
+    if (len == 0 || len >= MAX_PATH)
+      return std::string();
+    std::string exe = std::string(dir, len) + "\\wsl.exe";
+    return FileExistsWin(exe) ? exe : std::string();
+  }();
+  return path;
+}
+
+// wsl.exe arguments ahead of the Linux command: the distro, then -e so the
+// command runs without the distro's default shell parsing it
+std::string WslArguments(const ExecBackend &backend) {
+  if (backend.distro.empty())
+    return "-e";
+  return "-d \"" + backend.distro + "\" -e";
+}
+#else
+// macOS/Linux version
+std::string FindBash() {
+  // Return cached result if available
+  if (g_bash_path_cached) {
+    return g_cached_bash_path;
+  }
+
+  // Common bash locations on macOS/Linux
+  const char *candidates[] = {"/bin/bash", "/usr/bin/bash",
+                              "/usr/local/bin/bash", "/opt/homebrew/bin/bash",
+                              "/usr/local/opt/bash/bin/bash"};
+
+  for (auto cand : candidates) {
+    if (access(cand, X_OK) == 0) {
+      g_cached_bash_path = std::string(cand);
+      g_bash_path_cached = true;
+      return g_cached_bash_path;
+    }
+  }
+
+  // Try which command as fallback
+  std::string path;
+  int code = 0;
+  SpawnOptions opts;
+  opts.stderr_mode = SpawnStderr::Inherit;
+  if (RunSpawned(
+          "which", {"which", "bash"}, opts,
+          [&path](std::string_view ln) {
+            if (path.empty())
+              path = std::string(ln);
+          },
+          code) &&
+      !path.empty() && access(path.c_str(), X_OK) == 0) {
+    g_cached_bash_path = path;
+    g_bash_path_cached = true;
+    return g_cached_bash_path;
+  }
+
+  // Cache empty result to avoid repeated searches
+  g_cached_bash_path = std::string();
+  g_bash_path_cached = true;
+  return std::string();
+}
+#endif
+
+// Run a command hidden (no console) and capture stdout/stderr into lines
+#ifdef _WIN32
+bool RunHiddenCapture(const std::string &command,
+                      std::vector<std::string> &out_lines,
+                      DWORD &out_exit_code) {
+  out_lines.clear();
+  out_exit_code = 0;
+
+  SECURITY_ATTRIBUTES sa{};
+  sa.nLength = sizeof(sa);
+  sa.bInheritHandle = TRUE;
+  sa.lpSecurityDescriptor = NULL;
+  HANDLE hRead = NULL, hWrite = NULL;
+  if (!CreatePipe(&hRead, &hWrite, &sa, 0))
+    return false;
+  SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
+
+  STARTUPINFOW si{};
+  si.cb = sizeof(si);
+  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+  si.wShowWindow = SW_HIDE;
+  si.hStdOutput = hWrite;
+  si.hStdError = hWrite;
+
+  PROCESS_INFORMATION pi{};
+
+  std::wstring fullCmd = L"cmd.exe /C " + Widen(command);
+  BOOL ok = CreateProcessW(NULL, &fullCmd[0], NULL, NULL, TRUE,
+                           CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+  if (!ok) {
+    CloseHandle(hRead);
+    CloseHandle(hWrite);
+    return false;
+  }
+  CloseHandle(hWrite);
+
+  LineSplitter splitter;
+  auto add_line = [&out_lines](std::string_view ln) {
+    out_lines.emplace_back(ln);
+  };
+  DWORD bytes = 0;
+  for (;;) {
+    BOOL r = ReadFile(hRead, splitter.Prepare(kPipeReadChunk),
+                      (DWORD)kPipeReadChunk, &bytes, NULL);
+    if (!r || bytes == 0)
+      break;
+    splitter.Commit(bytes);
+    splitter.Drain(add_line);
+  }
+  splitter.Finish(add_line);
+
+  // Wait for process with timeout to prevent GUI freezing
+  DWORD wait_result =
+      WaitForSingleObject(pi.hProcess, 5000); // 5 second timeout
+  if (wait_result == WAIT_TIMEOUT) {
+    // Process is taking too long, terminate it
+    TerminateProcess(pi.hProcess, 1);
+    out_exit_code = 1;
+  } else {
+    GetExitCodeProcess(pi.hProcess, &out_exit_code);
+  }
+  CloseHandle(pi.hThread);
+  CloseHandle(pi.hProcess);
+  CloseHandle(hRead);
+  return true;
+}
+#else
+// macOS/Linux version: /bin/sh -c command, stdout and stderr both captured
+bool RunHiddenCapture(const std::string &command,
+                      std::vector<std::string> &out_lines,
+                      int &out_exit_code) {
+  out_lines.clear();
+  out_exit_code = 0;
+  return RunSpawned(
+      "/bin/sh", {"sh", "-c", command}, SpawnOptions(),
+      [&out_lines](std::string_view ln) { out_lines.emplace_back(ln); },
+      out_exit_code);
+}
+#endif
+
+// Run specific executable with args hidden; avoids cmd.exe quoting pitfalls
+#ifdef _WIN32
+bool RunHiddenCaptureExe(const std::string &exe, const std::string &args,
+                         std::vector<std::string> &out_lines,
+                         DWORD &out_exit_code) {
+  out_lines.clear();
+  out_exit_code = 0;
+
+  SECURITY_ATTRIBUTES sa{};
+  sa.nLength = sizeof(sa);
+  sa.bInheritHandle = TRUE;
+  sa.lpSecurityDescriptor = NULL;
+  HANDLE hRead = NULL, hWrite = NULL;
+  if (!CreatePipe(&hRead, &hWrite, &sa, 0))
+    return false;
+  SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
+
+  STARTUPINFOW si{};
+  si.cb = sizeof(si);
+  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+  si.wShowWindow = SW_HIDE;
+  si.hStdOutput = hWrite;
+  si.hStdError = hWrite;
+
+  PROCESS_INFORMATION pi{};
+
+  std::wstring wExe = Widen(exe);
+  std::wstring wCmdLine = Widen(std::string("\"") + exe + "\" " + args);
+  BOOL ok = CreateProcessW(wExe.c_str(), &wCmdLine[0], NULL, NULL, TRUE,
+                           CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+  if (!ok) {
+    CloseHandle(hRead);
+    CloseHandle(hWrite);
+    return false;
+  }
+  CloseHandle(hWrite);
+
+  LineSplitter splitter;
+  auto add_line = [&out_lines](std::string_view ln) {
+    out_lines.emplace_back(ln);
+  };
+  DWORD bytes = 0;
+  for (;;) {
+    BOOL r = ReadFile(hRead, splitter.Prepare(kPipeReadChunk),
+                      (DWORD)kPipeReadChunk, &bytes, NULL);
+    if (!r || bytes == 0)
+      break;
+    splitter.Commit(bytes);
+    splitter.Drain(add_line);
+  }
+  splitter.Finish(add_line);
+
+  // Wait for process with timeout to prevent GUI freezing
+  DWORD wait_result =
+      WaitForSingleObject(pi.hProcess, 5000); // 5 second timeout
+  if (wait_result == WAIT_TIMEOUT) {
+    // Process is taking too long, terminate it
+    TerminateProcess(pi.hProcess, 1);
+    out_exit_code = 1;
+  } else {
+    GetExitCodeProcess(pi.hProcess, &out_exit_code);
+  }
+  CloseHandle(pi.hThread);
+  CloseHandle(pi.hProcess);
+  CloseHandle(hRead);
+  return true;
+}
+#else
+// macOS/Linux version: exe looked up on PATH, args split like a shell would
+// but never run through one
+bool RunHiddenCaptureExe(const std::string &exe, const std::string &args,
+                         std::vector<std::string> &out_lines,
+                         int &out_exit_code) {
+  out_lines.clear();
+  out_exit_code = 0;
+  return RunSpawned(
+      exe, ParseShellCommand(exe + " " + args), SpawnOptions(),
+      [&out_lines](std::string_view ln) { out_lines.emplace_back(ln); },
+      out_exit_code);
+}
+#endif
+
+// Stream variant: emits each line via callback as soon as it's available
+#ifdef _WIN32
+bool
+RunHiddenStreamExe(const std::string &exe, const std::string &args,
+                   const std::function<void(const std::string &)> &onLine,
+                   DWORD &out_exit_code) {
+  out_exit_code = 0;
+
+  SECURITY_ATTRIBUTES sa{};
+  sa.nLength = sizeof(sa);
+  sa.bInheritHandle = TRUE;
+  sa.lpSecurityDescriptor = NULL;
+  HANDLE hRead = NULL, hWrite = NULL;
+  if (!CreatePipe(&hRead, &hWrite, &sa, 0))
+    return false;
+  SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
+
+  STARTUPINFOW si{};
+  si.cb = sizeof(si);
+  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+  si.wShowWindow = SW_HIDE;
+  si.hStdOutput = hWrite;
+  si.hStdError = hWrite;
+
+  PROCESS_INFORMATION pi{};
+
+  std::wstring wExe = Widen(exe);
+  std::wstring wCmdLine = Widen(std::string("\"") + exe + "\" " + args);
+  BOOL ok = CreateProcessW(wExe.c_str(), &wCmdLine[0], NULL, NULL, TRUE,
+                           CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+  if (!ok) {
+    CloseHandle(hRead);
+    CloseHandle(hWrite);
+    return false;
+  }
+  CloseHandle(hWrite);
+
+  LineSplitter splitter;
+  auto emit_line = [&onLine](std::string_view ln) { onLine(std::string(ln)); };
+  DWORD bytes = 0;
+  for (;;) {
+    BOOL r = ReadFile(hRead, splitter.Prepare(kPipeReadChunk),
+                      (DWORD)kPipeReadChunk, &bytes, NULL);
+    if (!r || bytes == 0)
+      break;
+    splitter.Commit(bytes);
+    splitter.Drain(emit_line);
+  }
+  splitter.Finish(emit_line);
+
+  // Wait for process with timeout to prevent GUI freezing
+  DWORD wait_result =
+      WaitForSingleObject(pi.hProcess, 5000); // 5 second timeout
+  if (wait_result == WAIT_TIMEOUT) {
+    // Process is taking too long, terminate it
+    TerminateProcess(pi.hProcess, 1);
+    out_exit_code = 1;
+  } else {
+    GetExitCodeProcess(pi.hProcess, &out_exit_code);
+  }
+  CloseHandle(pi.hThread);
+  CloseHandle(pi.hProcess);
+  CloseHandle(hRead);
+  return true;
+}
+#else
+// macOS/Linux version: the same argument handling as RunHiddenCaptureExe;
+// stderr is interleaved with stdout as the lines arrive
+bool
+RunHiddenStreamExe(const std::string &exe, const std::string &args,
+                   const std::function<void(const std::string &)> &onLine,
+                   int &out_exit_code) {
+  out_exit_code = 0;
+  SpawnOptions opts;
+  opts.stderr_mode = SpawnStderr::Merge;
+  return RunSpawned(
+      exe, ParseShellCommand(exe + " " + args), opts,
+      [&onLine](std::string_view ln) { onLine(std::string(ln)); },
+      out_exit_code);
+}
+#endif
+
+#ifdef _WIN32
+// Convert Windows path to MSYS2/Unix path format
+std::string ConvertToUnixPath(const std::string &winPath) {
+  std::string unixPath = winPath;
+
+  // Replace backslashes with forward slashes
+  for (size_t i = 0; i < unixPath.length(); i++) {
+    if (unixPath[i] == '\\') {
+      unixPath[i] = '/';
+    }
+  }
+
+  if (CurrentExecBackend().wsl) {
+    // \\wsl$\<distro>\p and \\wsl.localhost\<distro>\p are the distro's
+    // own /p
+    for (const char *prefix : {"//wsl$/", "//wsl.localhost/"}) {
+      size_t len = strlen(prefix);
+      std::string head = unixPath.substr(0, len);
+      for (char &c : head)
+        c = (char)tolower((unsigned char)c);
+      if (head == prefix) {
+        size_t slash = unixPath.find('/', len);
+        return slash == std::string::npos ? "/" : unixPath.substr(slash);
+      }
+    }
+    // Windows drives are mounted under /mnt
+    if (unixPath.length() >= 2 && unixPath[1] == ':') {
+      char drive = tolower(unixPath[0]);
+      unixPath = "/mnt/" + std::string(1, drive) + "/" +
+                 (unixPath.length() > 3 ? unixPath.substr(3) : "");
+    }
+    return unixPath;
+  }
+
+  // Convert C: to /c/
+  if (unixPath.length() >= 2 && unixPath[1] == ':') {
+    char drive = tolower(unixPath[0]);
+    unixPath = "/" + std::string(1, drive) + "/" + unixPath.substr(3);
+  }
+
+  return unixPath;
+}
+
+// Convert an MSYS2/Unix path printed by the script back to Windows form
+std::string ConvertFromUnixPath(const std::string &unixPath) {
+  std::string winPath = unixPath;
+  if (CurrentExecBackend().wsl) {
+    // /mnt/c/x is C:\x; anything else is on the distro's filesystem
+    if (winPath.compare(0, 5, "/mnt/") == 0 && winPath.length() >= 6 &&
+        isalpha((unsigned char)winPath[5]) &&
+        (winPath.length() == 6 || winPath[6] == '/')) {
+      winPath = std::string(1, (char)toupper(winPath[5])) + ":" +
+                (winPath.length() == 6 ? "/" : winPath.substr(6));
+    } else if (!winPath.empty() && winPath[0] == '/') {
+      std::string distro = WslDistroName();
+      if (!distro.empty())
+        winPath = "//wsl.localhost/" + distro + winPath;
+    }
+  } else if (winPath.length() >= 3 && winPath[0] == '/' &&
+             winPath[2] == '/' && isalpha((unsigned char)winPath[1])) {
+    winPath = std::string(1, (char)toupper(winPath[1])) + ":" +
+              winPath.substr(2);
+  }
+  for (char &c : winPath)
+    if (c == '/')
+      c = '\\';
+  return winPath;
+}
+#endif
+
+#ifdef _WIN32
+// PATH every Manage tab helper command runs with: Docker Desktop's CLI and
+// the MSYS2/Git Bash tools ahead of the inherited PATH
+static const char *kBashHelperPath =
+    "/c/Program\\ Files/Docker/Docker/resources/bin:/mingw64/bin:/usr/bin";
+
+// A long-lived `bash -l` that runs RunShellLines commands fed to its stdin,
+// so Git Bash / MSYS2 startup, profile parsing and DLL initialization are
+// paid once instead of on every call. Each command runs in a subshell (no
+// cd or export leaks into the next one) through eval, so even a syntax
+// error cannot swallow what follows, and is followed by a sentinel line
+// with a per-process nonce carrying its exit status; its output ends there.
+// With the WSL backend it is a `bash -l` session in the distro, which also
+// keeps the distro's VM running between tasks.
+class BashCoprocess {
+public:
+  ~BashCoprocess() { Stop(); }
+
+  // Run sh and collect its stdout and stderr lines. False if bash could
+  // not be started or died mid-command; the next call starts a new one.
+  bool Run(const std::string &sh, std::vector<std::string> &out_lines,
+           int &out_exit_code) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return RunLocked(sh, out_lines, out_exit_code);
+  }
+
+  // Like Run, but sets busy and returns at once if a command is running
+  bool TryRun(const std::string &sh, std::vector<std::string> &out_lines,
+              int &out_exit_code, bool &busy) {
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    busy = !lock.owns_lock();
+    return !busy && RunLocked(sh, out_lines, out_exit_code);
+  }
+
+  void Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Close();
+  }
+
+private:
+  bool RunLocked(const std::string &sh, std::vector<std::string> &out_lines,
+                 int &out_exit_code) {
+    out_lines.clear();
+    out_exit_code = 0;
+    ExecBackend backend = CurrentExecBackend();
+    if (process_ &&
+        (backend.wsl != backend_.wsl || backend.distro != backend_.distro))
+      Close(); // the backend changed in the Settings
+    if (!process_ && !Start(backend))
+      return false;
+    if (!Send(sh, out_lines, out_exit_code)) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  bool Start(const ExecBackend &backend) {
+    std::string bash = backend.wsl ? FindWsl() : FindBash();
+    if (bash.empty())
+      return false;
+    SECURITY_ATTRIBUTES sa{};
+    sa.nLength = sizeof(sa);
+    sa.bInheritHandle = TRUE;
+    HANDLE in_read = NULL, out_write = NULL;
+    if (!CreatePipe(&in_read, &stdin_, &sa, 0))
+      return false;
+    if (!CreatePipe(&stdout_, &out_write, &sa, 0)) {
+      CloseHandle(in_read);
+      CloseHandle(stdin_);
+      stdin_ = NULL;
+      return false;
+    }
+    SetHandleInformation(stdin_, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(stdout_, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOW si{};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+    si.wShowWindow = SW_HIDE;
+    si.hStdInput = in_read;
+    si.hStdOutput = out_write;
+    si.hStdError = out_write;
+    PROCESS_INFORMATION pi{};
+    std::wstring exe = Widen(bash);
+    std::wstring cmdline =
+        Widen("\"" + bash + "\" " +
+              (backend.wsl ? WslArguments(backend) + " bash -l" : "-l"));
+    BOOL ok = CreateProcessW(exe.c_str(), &cmdline[0], NULL, NULL, TRUE,
+                             CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
+    CloseHandle(in_read);
+    CloseHandle(out_write);
+    if (!ok) {
+      Close();
+      return false;
+    }
+    CloseHandle(pi.hThread);
+    process_ = pi.hProcess;
+    backend_ = backend;
+    char nonce[32];
+    snprintf(nonce, sizeof(nonce), "%lu_%llu", (unsigned long)pi.dwProcessId,
+             (unsigned long long)GetTickCount64());
+    sentinel_ = std::string("__autobuild_done_") + nonce + "__ ";
+    splitter_ = LineSplitter();
+
+    // Whatever the profile printed is read and dropped with this command.
+    // WSL needs no PATH of its own, but reports the distro it runs in.
+    std::vector<std::string> ignored;
+    int code = 0;
+    if (!Send(backend.wsl ? std::string("printf '%s\\n' \"$WSL_DISTRO_NAME\"")
+                          : std::string("export PATH=") + kBashHelperPath +
+                                ":$PATH",
+              ignored, code, false)) {
+      Close();
+      return false;
+    }
+    if (backend.wsl && !ignored.empty() && !ignored.back().empty()) {
+      std::lock_guard<std::mutex> lock(g_exec_backend_mutex);
+      g_wsl_distro_name = ignored.back();
+    }
+    return true;
+  }
+
+  // Write one framed command and read up to its sentinel line
+  bool Send(const std::string &sh, std::vector<std::string> &out_lines,
+            int &out_exit_code, bool subshell = true) {
+    std::string quoted;
+    for (char c : sh) {
+      if (c == '\'')
+        quoted += "'\\''";
+      else
+        quoted += c;
+    }
+    std::string script =
+        subshell ? "(eval '" + quoted + "') </dev/null 2>&1\n"
+                 : "eval '" + quoted + "' </dev/null 2>&1\n";
+    script += "printf '\\n" + sentinel_ + "%d\\n' $?\n";
+    DWORD written = 0;
+    if (!WriteFile(stdin_, script.data(), (DWORD)script.size(), &written,
+                   NULL) ||
+        written != script.size())
+      return false;
+
+    bool done = false;
+    auto on_line = [&](std::string_view ln) {
+      if (ln.size() > sentinel_.size() &&
+          ln.compare(0, sentinel_.size(), sentinel_) == 0) {
+        out_exit_code = atoi(std::string(ln.substr(sentinel_.size())).c_str());
+        done = true;
+        return;
+      }
+      out_lines.emplace_back(ln);
+    };
+    while (!done) {
+      DWORD bytes = 0;
+      if (!ReadFile(stdout_, splitter_.Prepare(kPipeReadChunk),
+                    (DWORD)kPipeReadChunk, &bytes, NULL) ||
+          bytes == 0)
+        return false; // bash exited
+      splitter_.Commit(bytes);
+      splitter_.Drain(on_line);
+    }
+    return true;
+  }
+
+  void Close() {
+    if (stdin_)
+      CloseHandle(stdin_); // EOF: bash exits after the current command
+    if (process_ && WaitForSingleObject(process_, 200) == WAIT_TIMEOUT)
+      TerminateProcess(process_, 1);
+    if (stdout_)
+      CloseHandle(stdout_);
+    if (process_)
+      CloseHandle(process_);
+    stdin_ = stdout_ = process_ = NULL;
+  }
+
+  std::mutex mutex_;
+  ExecBackend backend_; // what the running bash was started with
+  HANDLE process_ = NULL;
+  HANDLE stdin_ = NULL;  // write end of bash's stdin
+  HANDLE stdout_ = NULL; // read end of bash's stdout and stderr
+  std::string sentinel_;
+  LineSplitter splitter_;
+};
+
+// Co-processes shared by RunShellLines; a second one lets the Docker
+// refresh thread and a UI action run at the same time
+static const int kBashPoolSize = 2;
+static BashCoprocess g_bash_pool[kBashPoolSize];
+
+// Run sh on an idle co-process, or wait for the first one
+static bool RunOnBashPool(const std::string &sh,
+                          std::vector<std::string> &out_lines,
+                          int &out_exit_code) {
+  for (auto &bash : g_bash_pool) {
+    bool busy = false;
+    bool ok = bash.TryRun(sh, out_lines, out_exit_code, busy);
+    if (!busy)
+      return ok;
+  }
+  return g_bash_pool[0].Run(sh, out_lines, out_exit_code);
+}
+
+void StopBashPool() {
+  for (auto &bash : g_bash_pool)
+    bash.Stop();
+}
+#endif
+
+// Helpers for Manage tab
+std::vector<std::string> RunShellLines(const std::string &sh) {
+#ifdef _WIN32
+  ExecBackend backend = CurrentExecBackend();
+  std::string bash = backend.wsl ? FindWsl() : FindBash();
+  std::vector<std::string> lines;
+#ifdef _WIN32
+  DWORD code = 0;
+#else
+  int code = 0;
+#endif
+  if (bash.empty()) {
+    lines.push_back(backend.wsl ? "[ERROR] wsl.exe not found. Install WSL2 "
+                                  "or turn off Run in WSL."
+                                : "[ERROR] Bash not found. Install Git for "
+                                  "Windows or MSYS2.");
+    return lines;
+  }
+  int pooled_code = 0;
+  if (RunOnBashPool(sh, lines, pooled_code))
+    return lines;
+  // No co-process: a one-off login shell, as before the pool
+  std::string args =
+      backend.wsl ? WslArguments(backend) + " bash -lc \"" + sh + "\""
+                  : std::string("-lc \"export PATH=") + kBashHelperPath +
+                        ":$PATH && " + sh + "\"";
+  RunHiddenCaptureExe(bash, args, lines, code);
+  return lines;
+#else
+  // stdout only, as the callers parse it; stderr goes where ours does
+  std::vector<std::string> lines;
+  SpawnOptions opts;
+  opts.stderr_mode = SpawnStderr::Inherit;
+  int code = 0;
+  RunSpawned(
+      "/bin/sh", {"sh", "-c", sh}, opts,
+      [&lines](std::string_view ln) { lines.emplace_back(ln); }, code);
+  return lines;
+#endif
+}
+
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                   DOCKER ENGINE API                   //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// The request line, headers and body of a Docker Engine API request
+static std::string DockerRequestText(const std::string &method,
+                                     const std::string &path,
+                                     const std::string &body) {
+  std::string req = method + " " + path +
+                    " HTTP/1.1\r\nHost: docker\r\n"
+                    "User-Agent: autobuild\r\n";
+  if (!body.empty())
+    req += "Content-Type: application/json\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\n";
+  else if (method != "GET")
+    req += "Content-Length: 0\r\n";
+  req += "\r\n";
+  req += body;
+  return req;
+}
+
+// The status of an HTTP status line, or -1 if line is not one
+static int HttpStatus(const std::string &line) {
+  if (line.compare(0, 5, "HTTP/") != 0)
+    return -1;
+  size_t sp = line.find(' ');
+  return sp == std::string::npos ? 0 : atoi(line.c_str() + sp + 1);
+}
+
+// What a response header line says about how its body is framed
+static void ApplyHttpHeader(const std::string &line,
+                            long long &content_length, bool &chunked,
+                            bool &keep_alive) {
+  size_t colon = line.find(':');
+  if (colon == std::string::npos)
+    return;
+  std::string name = line.substr(0, colon);
+  std::string value = line.substr(colon + 1);
+  for (char &c : name)
+    c = (char)tolower((unsigned char)c);
+  for (char &c : value)
+    c = (char)tolower((unsigned char)c);
+  if (name == "content-length")
+    content_length = atoll(value.c_str());
+  else if (name == "transfer-encoding")
+    chunked = value.find("chunked") != std::string::npos;
+  else if (name == "connection")
+    keep_alive = value.find("close") == std::string::npos;
+}
+
+bool DockerApiClient::Request(const std::string &method,
+                              const std::string &path, Response &out,
+                              const DataCallback &on_data,
+                              const std::string &body) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string req = DockerRequestText(method, path, body);
+  // A kept-alive connection may have been closed by the daemon while
+  // idle; retry once on a fresh one
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    bool fresh = !IsOpen();
+    if (fresh && !Open())
+      return false;
+    bool keep_alive = true;
+    out = Response();
+    if (Send(req) && ReadResponse(out, keep_alive, on_data)) {
+      if (!keep_alive)
+        Close();
+      return true;
+    }
+    Close();
+    if (fresh)
+      return false;
+  }
+  return false;
+}
+
+std::vector<std::string> DockerApiClient::SocketPaths() {
+  std::vector<std::string> paths;
+  const char *host = getenv("DOCKER_HOST");
+  if (host && *host) {
+    std::string h = host;
+#ifdef _WIN32
+    if (h.rfind("npipe://", 0) == 0) {
+      std::string p = h.substr(8);
+      for (char &c : p)
+        if (c == '/')
+          c = '\\';
+      paths.push_back(p);
+    }
+#else
+    if (h.rfind("unix://", 0) == 0)
+      paths.push_back(h.substr(7));
+#endif
+    return paths;
+  }
+#ifdef _WIN32
+  paths.push_back("\\\\.\\pipe\\docker_engine");
+#else
+  paths.push_back("/var/run/docker.sock");
+  const char *home = getenv("HOME");
+  if (home && *home) {
+    // Docker Desktop without the privileged /var/run symlink
+    paths.push_back(std::string(home) + "/.docker/run/docker.sock");
+  }
+#endif
+  return paths;
+}
+
+#ifdef _WIN32
+bool DockerApiClient::IsOpen() const {
+  return pipe_ != INVALID_HANDLE_VALUE;
+}
+
+bool DockerApiClient::Open() {
+  for (const auto &path : SocketPaths()) {
+    for (int i = 0; i < 2; ++i) {
+      pipe_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                          NULL, OPEN_EXISTING, 0, NULL);
+      if (pipe_ != INVALID_HANDLE_VALUE)
+        return true;
+      if (GetLastError() != ERROR_PIPE_BUSY ||
+          !WaitNamedPipeA(path.c_str(), 2000))
+        break;
+    }
+  }
+  return false;
+}
+
+void DockerApiClient::Close() {
+  if (pipe_ != INVALID_HANDLE_VALUE)
+    CloseHandle(pipe_);
+  pipe_ = INVALID_HANDLE_VALUE;
+  in_.clear();
+}
+
+bool DockerApiClient::Send(const std::string &data) {
+  size_t off = 0;
+  while (off < data.size()) {
+    DWORD n = 0;
+    if (!WriteFile(pipe_, data.data() + off, (DWORD)(data.size() - off), &n,
+                   NULL) ||
+        n == 0)
+      return false;
+    off += n;
+  }
+  return true;
+}
+
+bool DockerApiClient::Fill() {
+  char buf[16384];
+  DWORD n = 0;
+  if (!ReadFile(pipe_, buf, sizeof(buf), &n, NULL) || n == 0)
+    return false;
+  in_.append(buf, n);
+  return true;
+}
+#else
+bool DockerApiClient::IsOpen() const { return fd_ >= 0; }
+
+bool DockerApiClient::Open() {
+  for (const auto &path : SocketPaths()) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+      continue;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      continue;
+    }
+    // A wedged daemon must not hang the refresh thread forever
+    struct timeval tv = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    fd_ = fd;
+    return true;
+  }
+  return false;
+}
+
+void DockerApiClient::Close() {
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+  in_.clear();
+}
+
+bool DockerApiClient::Send(const std::string &data) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  size_t off = 0;
+  while (off < data.size()) {
+    ssize_t n = send(fd_, data.data() + off, data.size() - off, flags);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    off += (size_t)n;
+  }
+  return true;
+}
+
+bool DockerApiClient::Fill() {
+  char buf[16384];
+  ssize_t n;
+  do {
+    n = recv(fd_, buf, sizeof(buf), 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return false;
+  in_.append(buf, (size_t)n);
+  return true;
+}
+#endif
+
+bool DockerApiClient::ReadLine(std::string &line) {
+  size_t eol;
+  while ((eol = in_.find("\r\n")) == std::string::npos) {
+    if (!Fill())
+      return false;
+  }
+  line = in_.substr(0, eol);
+  in_.erase(0, eol + 2);
+  return true;
+}
+
+bool DockerApiClient::ReadBytes(size_t n, std::string &out) {
+  while (in_.size() < n) {
+    if (!Fill())
+      return false;
+  }
+  out.append(in_, 0, n);
+  in_.erase(0, n);
+  return true;
+}
+
+bool DockerApiClient::ReadResponse(Response &out, bool &keep_alive,
+                                   const DataCallback &on_data) {
+  std::string line;
+  if (!ReadLine(line) || (out.status = HttpStatus(line)) < 0)
+    return false;
+
+  long long content_length = -1;
+  bool chunked = false;
+  while (true) {
+    if (!ReadLine(line))
+      return false;
+    if (line.empty())
+      break;
+    ApplyHttpHeader(line, content_length, chunked, keep_alive);
+  }
+
+  if (chunked) {
+    while (true) {
+      if (!ReadLine(line))
+        return false;
+      size_t size = strtoul(line.c_str(), nullptr, 16);
+      if (size == 0)
+        break;
+      std::string chunk, crlf;
+      if (!ReadBytes(size, chunk) || !ReadBytes(2, crlf))
+        return false;
+      if (on_data)
+        on_data(chunk.data(), chunk.size());
+      else
+        out.body += chunk;
+    }
+    // Skip trailers up to the terminating blank line
+    do {
+      if (!ReadLine(line))
+        return false;
+    } while (!line.empty());
+    return true;
+  }
+  if (content_length >= 0)
+    return ReadBytes((size_t)content_length, out.body);
+  if (out.status == 204 || out.status == 304)
+    return true;
+  // No framing: the body runs until the daemon closes the connection, as
+  // a hijacked exec stream does
+  keep_alive = false;
+  if (!on_data) {
+    while (Fill()) {
+    }
+    out.body += in_;
+    in_.clear();
+    return true;
+  }
+  do {
+    if (!in_.empty())
+      on_data(in_.data(), in_.size());
+    in_.clear();
+  } while (Fill());
+  return true;
+}
+
+void DockerStreamDemuxer::Feed(const char *data, size_t n,
+                               const PayloadFn &on_payload) {
+  while (n > 0) {
+    if (remaining_ == 0) {
+      size_t take = std::min(n, sizeof(header_) - header_len_);
+      memcpy(header_ + header_len_, data, take);
+      header_len_ += take;
+      data += take;
+      n -= take;
+      if (header_len_ < sizeof(header_))
+        return;
+      header_len_ = 0;
+      stream_ = header_[0];
+      remaining_ = (size_t)header_[4] << 24 | (size_t)header_[5] << 16 |
+                   (size_t)header_[6] << 8 | (size_t)header_[7];
+      continue;
+    }
+    size_t take = std::min(n, remaining_);
+    on_payload(stream_, std::string_view(data, take));
+    remaining_ -= take;
+    data += take;
+    n -= take;
+  }
+}
+
+bool DockerExecAttached(
+    DockerApiClient &conn, const DockerExecSpec &spec,
+    const std::function<void(int stream, std::string_view data)> &on_output,
+    int &exit_code, std::string &error) {
+  exit_code = -1;
+  JsonWriter create(true);
+  create.Bool("AttachStdout", true).Bool("AttachStderr", true);
+  if (!spec.user.empty())
+    create.String("User", spec.user);
+  create.StringArray("Cmd", spec.cmd);
+  DockerApiClient::Response resp;
+  if (!conn.Request("POST",
+                    "/containers/" + spec.container + "/exec",
+                    resp, nullptr, create.Finish())) {
+    error = "Docker API unreachable";
+    return false;
+  }
+  JsonValue created;
+  if (resp.status != 201 || !JsonParser(resp.body).Parse(created) ||
+      created.GetString("Id").empty()) {
+    error = "exec create failed (HTTP " + std::to_string(resp.status) + ")";
+    return false;
+  }
+  std::string id = created.GetString("Id");
+
+  DockerStreamDemuxer demux;
+  bool started = false;
+  JsonWriter start(true);
+  start.Bool("Detach", false).Bool("Tty", false);
+  bool ok = conn.Request(
+      "POST", "/exec/" + id + "/start", resp,
+      [&](const char *data, size_t n) {
+        started = true;
+        demux.Feed(data, n, on_output);
+      },
+      start.Finish());
+  if (!ok || resp.status != 200) {
+    if (started)
+      return true; // ran, but its end was not seen
+    error = "exec start failed (HTTP " + std::to_string(resp.status) + ")";
+    return false;
+  }
+  // The stream can close a moment before the daemon records the exit
+  for (int attempt = 0; attempt < 50; attempt++) {
+    JsonValue info;
+    if (!conn.Request("GET", "/exec/" + id + "/json", resp) ||
+        resp.status != 200 || !JsonParser(resp.body).Parse(info))
+      break;
+    const JsonValue *code = info.Find("ExitCode");
+    if (!info.GetBool("Running", false) && code &&
+        code->type == JsonValue::Number) {
+      exit_code = (int)code->number;
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  return true;
+}
+
+#ifndef _WIN32
+bool AsyncDockerClient::Open() {
+  for (const auto &path : DockerApiClient::SocketPaths()) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+      continue;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    // A local socket connects at once; only the talking waits
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      continue;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    fd_ = fd;
+    return true;
+  }
+  return false;
+}
+
+void AsyncDockerClient::Close() {
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+  in_.clear();
+  framing_ = Framing::None;
+}
+
+Async<bool> AsyncDockerClient::Send(const std::string &data) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  size_t off = 0;
+  while (off < data.size()) {
+    ssize_t n = send(fd_, data.data() + off, data.size() - off, flags);
+    if (n > 0) {
+      off += (size_t)n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) ||
+        !co_await reactor_.Writable(fd_, kTimeoutMs, cancel_))
+      co_return false;
+  }
+  co_return true;
+}
+
+Async<bool> AsyncDockerClient::Fill(bool timed) {
+  static const size_t kReadChunk = 16384;
+  while (fd_ >= 0) {
+    size_t had = in_.size();
+    in_.resize(had + kReadChunk);
+    ssize_t n = recv(fd_, &in_[had], kReadChunk, 0);
+    in_.resize(had + (n > 0 ? (size_t)n : 0));
+    if (n > 0)
+      co_return true;
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) ||
+        !co_await reactor_.Readable(fd_, timed ? kTimeoutMs : -1, cancel_))
+      break;
+  }
+  co_return false;
+}
+
+Async<bool> AsyncDockerClient::ReadLine(std::string &line) {
+  size_t eol;
+  while ((eol = in_.find("\r\n")) == std::string::npos) {
+    if (!co_await Fill(true))
+      co_return false;
+  }
+  line.assign(in_, 0, eol);
+  in_.erase(0, eol + 2);
+  co_return true;
+}
+
+Async<bool> AsyncDockerClient::Begin(const std::string &method,
+                                     const std::string &path, int &status,
+                                     const std::string &body) {
+  std::string req = DockerRequestText(method, path, body);
+  broken_ = false;
+  if (framing_ != Framing::None) // the last body was not read to its end
+    Close();
+  // A kept-alive connection may have been closed by the daemon while
+  // idle; retry once on a fresh one
+  std::string line;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    bool fresh = fd_ < 0;
+    if (fresh && !Open())
+      co_return false;
+    if (co_await Send(req) && co_await ReadLine(line) &&
+        (status = HttpStatus(line)) >= 0)
+      break;
+    Close();
+    if (fresh || attempt == 1)
+      co_return false;
+  }
+
+  long long content_length = -1;
+  bool chunked = false;
+  keep_alive_ = true;
+  while (true) {
+    if (!co_await ReadLine(line)) {
+      Close();
+      co_return false;
+    }
+    if (line.empty())
+      break;
+    ApplyHttpHeader(line, content_length, chunked, keep_alive_);
+  }
+  remaining_ = 0;
+  chunk_crlf_ = false;
+  if (chunked) {
+    framing_ = Framing::Chunked;
+  } else if (content_length >= 0) {
+    framing_ = Framing::Length;
+    remaining_ = (uint64_t)content_length;
+  } else if (status == 204 || status == 304) {
+    framing_ = Framing::Length;
+  } else {
+    // No framing: the body runs until the daemon closes the connection, as
+    // a hijacked exec stream does
+    framing_ = Framing::UntilClose;
+    keep_alive_ = false;
+  }
+  co_return true;
+}
+
+void AsyncDockerClient::TakeBody(std::string &piece) {
+  size_t n = (size_t)std::min<uint64_t>(in_.size(), remaining_);
+  piece.assign(in_, 0, n);
+  in_.erase(0, n);
+  remaining_ -= n;
+}
+
+void AsyncDockerClient::EndBody() {
+  framing_ = Framing::None;
+  if (!keep_alive_)
+    Close();
+}
+
+Async<bool> AsyncDockerClient::ReadBody(std::string &piece) {
+  piece.clear();
+  switch (framing_) {
+  case Framing::None:
+    co_return false;
+  case Framing::Length:
+    if (remaining_ == 0) {
+      EndBody();
+      co_return false;
+    }
+    if (in_.empty() && !co_await Fill(true))
+      break;
+    TakeBody(piece);
+    co_return true;
+  case Framing::Chunked: {
+    std::string line;
+    if (remaining_ == 0) {
+      if (chunk_crlf_ && !co_await ReadLine(line))
+        break;
+      if (!co_await ReadLine(line))
+        break;
+      remaining_ = strtoull(line.c_str(), nullptr, 16);
+      chunk_crlf_ = true;
+      if (remaining_ == 0) {
+        // Skip trailers up to the terminating blank line
+        do {
+          if (!co_await ReadLine(line))
+            break;
+        } while (!line.empty());
+        if (!line.empty())
+          break;
+        EndBody();
+        co_return false;
+      }
+    }
+    if (in_.empty() && !co_await Fill(true))
+      break;
+    TakeBody(piece);
+    co_return true;
+  }
+  case Framing::UntilClose:
+    if (in_.empty() && !co_await Fill(false)) {
+      // The close was the end, unless it was cancelled first
+      broken_ = cancel_ && cancel_->Cancelled();
+      Close();
+      co_return false;
+    }
+    piece.swap(in_);
+    in_.clear();
+    co_return true;
+  }
+  broken_ = true;
+  Close();
+  co_return false;
+}
+
+Async<bool> AsyncDockerClient::Request(const std::string &method,
+                                       const std::string &path,
+                                       DockerApiClient::Response &out,
+                                       const std::string &body) {
+  out = DockerApiClient::Response();
+  if (!co_await Begin(method, path, out.status, body))
+    co_return false;
+  std::string piece;
+  while (co_await ReadBody(piece))
+    out.body += piece;
+  co_return !broken_;
+}
+
+Async<bool> AsyncDockerExec::Start(const DockerExecSpec &spec,
+                                   std::string &error) {
+  JsonWriter create(true);
+  create.Bool("AttachStdout", true).Bool("AttachStderr", true);
+  if (!spec.user.empty())
+    create.String("User", spec.user);
+  create.StringArray("Cmd", spec.cmd);
+  DockerApiClient::Response resp;
+  if (!co_await stream_.Request("POST",
+                                "/containers/" + spec.container + "/exec",
+                                resp, create.Finish())) {
+    error = "Docker API unreachable";
+    co_return false;
+  }
+  JsonValue created;
+  if (resp.status != 201 || !JsonParser(resp.body).Parse(created) ||
+      created.GetString("Id").empty()) {
+    error = "exec create failed (HTTP " + std::to_string(resp.status) + ")";
+    co_return false;
+  }
+  id_ = created.GetString("Id");
+
+  JsonWriter start(true);
+  start.Bool("Detach", false).Bool("Tty", false);
+  int status = 0;
+  if (!co_await stream_.Begin("POST", "/exec/" + id_ + "/start", status,
+                              start.Finish()) ||
+      status != 200) {
+    error = "exec start failed (HTTP " + std::to_string(status) + ")";
+    co_return false;
+  }
+  co_return true;
+}
+
+Async<bool> AsyncDockerExec::Read(int &stream, std::string &data) {
+  while (output_.empty()) {
+    if (!co_await stream_.ReadBody(piece_))
+      co_return false;
+    demux_.Feed(piece_.data(), piece_.size(),
+                [this](int s, std::string_view payload) {
+                  if (!output_.empty() && output_.back().first == s)
+                    output_.back().second.append(payload);
+                  else
+                    output_.emplace_back(s, std::string(payload));
+                });
+  }
+  stream = output_.front().first;
+  data.swap(output_.front().second);
+  output_.pop_front();
+  co_return true;
+}
+
+Async<int> AsyncDockerExec::Wait() {
+  // The start connection was taken over by the stream
+  AsyncDockerClient conn(reactor_, cancel_);
+  // The stream can close a moment before the daemon records the exit
+  for (int attempt = 0; attempt < 50; attempt++) {
+    DockerApiClient::Response resp;
+    if (!co_await conn.Request("GET", "/exec/" + id_ + "/json", resp))
+      break;
+    JsonValue info;
+    if (resp.status != 200 || !JsonParser(resp.body).Parse(info))
+      break;
+    const JsonValue *code = info.Find("ExitCode");
+    if (!info.GetBool("Running", false) && code &&
+        code->type == JsonValue::Number)
+      co_return (int)code->number;
+    if (!co_await reactor_.Sleep(20, cancel_))
+      break;
+  }
+  co_return -1;
+}
+#endif
+
+bool PhaseOutputWriter::Open(const std::string &path) {
+  Close(nullptr);
+  path_ = path;
+  log_ = fopen(path.c_str(), "ab");
+  if (log_)
+    setvbuf(log_, nullptr, _IOFBF, kBufferBytes);
+  return log_ != nullptr;
+}
+
+void PhaseOutputWriter::Write(int stream, std::string_view data,
+                              const LineFn &on_line) {
+  int s = stream == 1 ? 0 : 1;
+  std::string &partial = partial_[s];
+  while (!data.empty()) {
+    size_t nl = data.find('\n');
+    if (nl == std::string_view::npos) {
+      partial.append(data);
+      return;
+    }
+    if (partial.empty()) {
+      Line(s + 1, data.substr(0, nl), on_line);
+    } else {
+      partial.append(data.substr(0, nl));
+      Line(s + 1, partial, on_line);
+      partial.clear();
+    }
+    data.remove_prefix(nl + 1);
+  }
+}
+
+void PhaseOutputWriter::Line(int stream, std::string_view line,
+                             const LineFn &on_line) {
+  if (log_) {
+    fwrite(line.data(), 1, line.size(), log_);
+    fputc('\n', log_);
+  }
+  if (stream != 1) {
+    if (!err_ && !path_.empty()) {
+      std::string err_path = path_;
+      if (err_path.size() > 4 &&
+          err_path.compare(err_path.size() - 4, 4, ".log") == 0)
+        err_path.resize(err_path.size() - 4);
+      err_ = fopen((err_path + ".stderr.log").c_str(), "ab");
+      if (err_)
+        setvbuf(err_, nullptr, _IOFBF, kBufferBytes);
+      else
+        path_.clear(); // do not retry every line
+    }
+    if (err_) {
+      fwrite(line.data(), 1, line.size(), err_);
+      fputc('\n', err_);
+    }
+  }
+  if (on_line)
+    on_line(stream, line);
+}
+
+void PhaseOutputWriter::Close(const LineFn &on_line) {
+  for (int s = 0; s < 2; s++) {
+    if (!partial_[s].empty()) {
+      std::string line;
+      line.swap(partial_[s]);
+      Line(s + 1, line, on_line);
+    }
+  }
+  if (log_)
+    fclose(log_);
+  if (err_)
+    fclose(err_);
+  log_ = err_ = nullptr;
+  path_.clear();
+}
+
+bool DockerHealth::Available() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    State state = state_.load();
+    if (state != kUnknown && (probing_ ||
+                              std::chrono::steady_clock::now() < next_probe_))
+      return state == kUp;
+    if (!probing_)
+      break;
+    cv_.wait(lock); // the first probe: nothing to answer with yet
+  }
+  probing_ = true;
+  lock.unlock();
+  bool up = probe_ && probe_();
+  probes_++;
+  lock.lock();
+  Settle(up);
+  probing_ = false;
+  cv_.notify_all();
+  return up;
+}
+
+void DockerHealth::ReportFailure() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (state_.load() == kUp)
+    next_probe_ = std::chrono::steady_clock::time_point{};
+}
+
+void DockerHealth::ReportUp() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Settle(true);
+}
+
+void DockerHealth::Settle(bool up) {
+  auto now = std::chrono::steady_clock::now();
+  if (up) {
+    state_ = kUp;
+    retry_ms_ = kRetryMinMs;
+    next_probe_ = now + std::chrono::milliseconds(kUpMs);
+    return;
+  }
+  state_ = kDown;
+  next_probe_ = now + std::chrono::milliseconds(retry_ms_);
+  retry_ms_ = std::min(retry_ms_ * 2, kRetryMaxMs);
+}
+
+// Whether a history entry is an instruction that only sets image metadata
+static bool MetadataInstruction(const std::string &created_by) {
+  static const char *const kMetadata[] = {
+      "ENV",    "LABEL",      "CMD",        "ENTRYPOINT", "EXPOSE",
+      "ARG",    "USER",       "VOLUME",     "STOPSIGNAL", "HEALTHCHECK",
+      "SHELL",  "ONBUILD",    "MAINTAINER"};
+  if (created_by.find("#(nop)") != std::string::npos)
+    return created_by.find("#(nop) COPY") == std::string::npos &&
+           created_by.find("#(nop) ADD") == std::string::npos;
+  std::string keyword = created_by.substr(0, created_by.find(' '));
+  for (const char *metadata : kMetadata)
+    if (keyword == metadata)
+      return true;
+  return false;
+}
+
+ImageLayers ImageLayersFromApi(const std::string &id, const JsonValue &inspect,
+                               const JsonValue &history) {
+  ImageLayers out;
+  out.id = id;
+  std::vector<std::string> diff_ids;
+  if (const JsonValue *rootfs = inspect.Find("RootFS"))
+    diff_ids = rootfs->GetStrings("Layers");
+  std::vector<const JsonValue *> entries; // oldest first
+  if (history.type == JsonValue::Array)
+    for (size_t i = history.items.size(); i-- > 0;)
+      entries.push_back(&history.items[i]);
+  size_t sized = 0;
+  for (const JsonValue *e : entries)
+    sized += e->GetNumber("Size") > 0.0;
+
+  uint64_t chain = kFnvOffset;
+  size_t layer = 0;
+  for (size_t i = 0; i < entries.size() && layer < diff_ids.size(); i++) {
+    double bytes = entries[i]->GetNumber("Size");
+    size_t needed = diff_ids.size() - layer;
+    bool makes_layer =
+        bytes > 0.0 || entries.size() - i <= needed ||
+        (needed > sized &&
+         !MetadataInstruction(entries[i]->GetString("CreatedBy")));
+    if (bytes > 0.0)
+      sized--;
+    if (!makes_layer)
+      continue;
+    const std::string &diff = diff_ids[layer++];
+    chain = Fnv1a(chain, diff.data(), diff.size() + 1);
+    out.layers.emplace_back(chain, bytes);
+  }
+  // Layers history does not account for (an image imported without it)
+  for (; layer < diff_ids.size(); layer++) {
+    const std::string &diff = diff_ids[layer];
+    chain = Fnv1a(chain, diff.data(), diff.size() + 1);
+    out.layers.emplace_back(chain, 0.0);
+  }
+  return out;
+}
+
+LayerUsage::LayerUsage(std::vector<ImageLayers> images)
+    : images_(std::move(images)) {
+  for (const auto &image : images_) {
+    for (const auto &layer : image.layers) {
+      Layer &l = layers_[layer.first];
+      if (l.users++ == 0) {
+        l.bytes = layer.second;
+        total_ += layer.second;
+      }
+    }
+  }
+}
+
+// How many of images hold each layer they use; duplicates and indices out
+// of range are skipped
+static std::unordered_map<uint64_t, uint32_t>
+LayerHolders(const std::vector<ImageLayers> &all,
+             const std::vector<size_t> &images) {
+  std::unordered_map<uint64_t, uint32_t> holders;
+  std::vector<bool> seen(all.size(), false);
+  for (size_t image : images) {
+    if (image >= all.size() || seen[image])
+      continue;
+    seen[image] = true;
+    for (const auto &layer : all[image].layers)
+      holders[layer.first]++;
+  }
+  return holders;
+}
+
+double LayerUsage::BytesOf(const std::vector<size_t> &images) const {
+  double bytes = 0.0;
+  for (const auto &kv : LayerHolders(images_, images))
+    bytes += layers_.at(kv.first).bytes;
+  return bytes;
+}
+
+double LayerUsage::FreedBy(const std::vector<size_t> &images) const {
+  double bytes = 0.0;
+  for (const auto &kv : LayerHolders(images_, images)) {
+    const Layer &l = layers_.at(kv.first);
+    if (kv.second == l.users)
+      bytes += l.bytes;
+  }
+  return bytes;
+}
+
+int LayerUsage::BaseOf(size_t image) const {
+  const auto &layers = images_[image].layers;
+  int best = -1;
+  size_t best_depth = 0;
+  for (size_t i = 0; i < images_.size(); i++) {
+    const auto &other = images_[i].layers;
+    // Chain keys cover everything below, so the top layer decides
+    if (i == image || other.empty() || other.size() >= layers.size() ||
+        other.size() <= best_depth ||
+        layers[other.size() - 1].first != other.back().first)
+      continue;
+    best = (int)i;
+    best_depth = other.size();
+  }
+  return best;
+}
+
+std::string UrlEncode(const std::string &s, bool keep_path) {
+  static const char *hex = "0123456789ABCDEF";
+  std::string out;
+  for (unsigned char c : s) {
+    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' ||
+        (keep_path && (c == '/' || c == ':'))) {
+      out += (char)c;
+    } else {
+      out += '%';
+      out += hex[c >> 4];
+      out += hex[c & 0xF];
+    }
+  }
+  return out;
+}
+
+// Whether the last probe reached the daemon over its socket rather than
+// through the CLI
+static std::atomic<bool> g_docker_socket_up{false};
+
+// Does the daemon answer: a /_ping over the socket, or without one (a
+// DOCKER_HOST or context the socket client does not speak) the server
+// version the CLI prints. Neither depends on the language of the CLI's
+// error messages.
+static bool ProbeDockerDaemon() {
+  DockerApiClient::Response resp;
+  bool socket = SharedDockerApi().Request("GET", "/_ping", resp);
+  g_docker_socket_up = socket && resp.status == 200;
+  if (socket)
+    return resp.status == 200;
+  std::vector<std::string> lines =
+      RunShellLines("docker version --format '{{.Server.Version}}' "
+                    "2>/dev/null");
+  return !lines.empty() && !lines[0].empty() &&
+         isdigit((unsigned char)lines[0][0]);
+}
+
+DockerApiClient &SharedDockerApi() {
+  static DockerApiClient client;
+  return client;
+}
+
+DockerHealth &DockerDaemonHealth() {
+  static DockerHealth health(ProbeDockerDaemon);
+  return health;
+}
+
+DockerApiStats &DockerApiCallStats() {
+  static DockerApiStats stats;
+  return stats;
+}
+
+bool DockerApiCall(const std::string &method, const std::string &path,
+                   int &status, JsonValue &body, DockerApiClient &client) {
+  DockerApiClient::Response resp;
+  auto start = std::chrono::steady_clock::now();
+  bool ok = client.Request(method, path, resp);
+  DockerApiStats &stats = DockerApiCallStats();
+  stats.calls++;
+  stats.us +=
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  if (!ok) {
+    // The socket answered the last probe: the daemon may have gone away
+    if (g_docker_socket_up)
+      DockerDaemonHealth().ReportFailure();
+    return false;
+  }
+  status = resp.status;
+  body = JsonValue();
+  if (!resp.body.empty() && !JsonParser(resp.body).Parse(body))
+    body = JsonValue();
+  return true;
+}
+
+std::string ShortImageId(std::string id) {
+  if (id.rfind("sha256:", 0) == 0)
+    id.erase(0, 7);
+  return id.substr(0, 12);
+}
+
+std::string NormalizeImageRef(const std::string &ref) {
+  size_t slash = ref.rfind('/');
+  size_t colon = ref.find(':', slash == std::string::npos ? 0 : slash);
+  return colon == std::string::npos ? ref + ":latest" : ref;
+}
+
+bool ContainerImageIs(const std::string &container_image,
+                      const std::string &container_image_id,
+                      const DockerImageRef &image) {
+  if (!container_image_id.empty() &&
+      ShortImageId(container_image_id) == image.id)
+    return true;
+  if (ShortImageId(container_image) == image.id)
+    return true;
+  std::string ref = NormalizeImageRef(container_image);
+  for (const auto &tag : image.tags)
+    if (NormalizeImageRef(tag) == ref)
+      return true;
+  return false;
+}
+
+bool DockerContainersUsingImages(
+    const std::vector<DockerImageRef> &images,
+    std::map<std::string, std::vector<std::string>> &out) {
+  out.clear();
+  auto add = [&](const std::string &image, const std::string &image_id,
+                 const std::string &row) {
+    for (const auto &ref : images)
+      if (ContainerImageIs(image, image_id, ref))
+        out[ref.id].push_back(row);
+  };
+  if (!DockerDaemonHealth().Available())
+    return false;
+
+  int status = 0;
+  JsonValue body;
+  if (DockerApiCall("GET", "/containers/json?all=1", status, body) &&
+      status == 200 && body.type == JsonValue::Array) {
+    for (const auto &c : body.items) {
+      std::string name;
+      const JsonValue *names = c.Find("Names");
+      if (names && names->type == JsonValue::Array && !names->items.empty())
+        name = names->items[0].str;
+      if (!name.empty() && name[0] == '/')
+        name.erase(0, 1);
+      add(c.GetString("Image"), c.GetString("ImageID"),
+          c.GetString("Id") + "|" + name + "|" + c.GetString("Status"));
+    }
+    return true;
+  }
+
+  std::vector<std::string> lines =
+      RunShellLines("docker ps -a --no-trunc --format "
+                    "'{{.ID}}|{{.Names}}|{{.Status}}|{{.Image}}' 2>&1");
+  for (const auto &line : lines) {
+    if (line.find("Error") != std::string::npos ||
+        line.find("Cannot connect") != std::string::npos)
+      return false;
+  }
+  for (const auto &line : lines) {
+    size_t bar = line.rfind('|');
+    if (bar == std::string::npos)
+      continue;
+    add(line.substr(bar + 1), std::string(), line.substr(0, bar));
+  }
+  return true;
+}
+
+std::string ImageInUseMessage(const std::string &image_id,
+                              const std::vector<std::string> &users) {
+  std::string message = "Cannot delete image " + image_id +
+                        " - it is being used by " +
+                        std::to_string(users.size()) + " container(s).\n\n";
+  message += "Containers using this image:\n";
+  for (const auto &container : users) {
+    // Parse the container data (ID|Names|Status)
+    std::istringstream ss(container);
+    std::string id, name, status;
+    std::getline(ss, id, '|');
+    std::getline(ss, name, '|');
+    std::getline(ss, status, '|');
+
+    if (!name.empty()) {
+      message += "  - " + name + " (" + id.substr(0, 12) + ") - " + status +
+                 "\n";
+    } else {
+      message += "  - " + id.substr(0, 12) + " - " + status + "\n";
+    }
+  }
+  message += "\nPlease stop and remove these containers first.";
+  return message;
+}
+
+void RemoveImagesCli(const std::vector<const DockerImageRef *> &images,
+                     std::vector<std::string *> &errors) {
+  std::string cmd = "docker rmi";
+  for (const DockerImageRef *image : images)
+    cmd += " " + image->id;
+  std::vector<std::string> lines = RunShellLines(cmd + " 2>&1");
+  auto names = [](const std::string &line, const DockerImageRef &image) {
+    if (line.find(image.id) != std::string::npos)
+      return true;
+    for (const auto &tag : image.tags)
+      if (line.find(tag) != std::string::npos)
+        return true;
+    return false;
+  };
+  std::string general;
+  for (const auto &line : lines) {
+    if (line.find("Error") == std::string::npos &&
+        line.find("conflict") == std::string::npos &&
+        line.find("unable to remove") == std::string::npos)
+      continue;
+    bool matched = false;
+    for (size_t i = 0; i < images.size(); i++) {
+      if (names(line, *images[i])) {
+        *errors[i] += (errors[i]->empty() ? "" : "\n") + line;
+        matched = true;
+      }
+    }
+    if (!matched)
+      general += (general.empty() ? "" : "\n") + line;
+  }
+  if (general.empty())
+    return;
+  for (size_t i = 0; i < images.size(); i++) {
+    bool deleted = false;
+    for (const auto &line : lines)
+      if (line.rfind("Deleted: sha256:" + images[i]->id, 0) == 0)
+        deleted = true;
+    if (!deleted && errors[i]->empty())
+      *errors[i] = general;
+  }
+}
+
+bool DeleteImageApi(const DockerImageRef &image, std::string &error,
+                    DockerApiClient &client) {
+  int status = 0;
+  JsonValue body;
+  if (!DockerApiCall("DELETE", "/images/" + UrlEncode(image.id, true),
+                     status, body, client))
+    return false;
+  if (status != 200) {
+    std::string detail = body.GetString("message");
+    if (detail.empty())
+      detail = "HTTP status " + std::to_string(status);
+    error = "Failed to delete image " + image.id + ":\n" + detail;
+  }
+  return true;
+}
+
+size_t SafeDeleteImages(const std::vector<DockerImageRef> &images,
+                        std::vector<std::string> &errors) {
+  errors.assign(images.size(), std::string());
+  if (!DockerDaemonHealth().Available()) {
+    for (size_t i = 0; i < images.size(); i++)
+      errors[i] = "Failed to delete image " + images[i].id +
+                  ":\nDocker is not running";
+    return 0;
+  }
+  std::map<std::string, std::vector<std::string>> users;
+  bool listed = DockerContainersUsingImages(images, users);
+
+  std::vector<const DockerImageRef *> cli;
+  std::vector<std::string *> cli_errors;
+  bool use_api = true;
+  for (size_t i = 0; i < images.size(); i++) {
+    const DockerImageRef &image = images[i];
+    auto it = users.find(image.id);
+    if (listed && it != users.end()) {
+      errors[i] = ImageInUseMessage(image.id, it->second);
+      continue;
+    }
+    if (use_api && DeleteImageApi(image, errors[i]))
+      continue;
+    use_api = false; // unreachable: the rest go through the CLI
+    cli.push_back(&image);
+    cli_errors.push_back(&errors[i]);
+  }
+
+  for (size_t first = 0; first < cli.size(); first += kDockerCliBatch) {
+    size_t last = std::min(cli.size(), first + kDockerCliBatch);
+    std::vector<const DockerImageRef *> batch(cli.begin() + first,
+                                              cli.begin() + last);
+    std::vector<std::string *> batch_errors(cli_errors.begin() + first,
+                                            cli_errors.begin() + last);
+    RemoveImagesCli(batch, batch_errors);
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (!batch_errors[i]->empty())
+        *batch_errors[i] = "Failed to delete image " + batch[i]->id + ":\n" +
+                           *batch_errors[i];
+    }
+  }
+
+  size_t deleted = 0;
+  for (const auto &e : errors)
+    deleted += e.empty() ? 1 : 0;
+  return deleted;
+}
+
+bool RemoveContainerApi(const std::string &container,
+                        std::string &error,
+                        DockerApiClient &client) {
+  int status = 0;
+  JsonValue body;
+  if (!DockerApiCall("DELETE",
+                     "/containers/" + UrlEncode(container, true) +
+                         "?force=1&v=1",
+                     status, body, client))
+    return false;
+  if (status != 204 && status != 404) {
+    std::string detail = body.GetString("message");
+    if (detail.empty())
+      detail = "HTTP status " + std::to_string(status);
+    error = "Failed to remove container " + container + ": " + detail;
+  }
+  return true;
+}
+
+void RemoveContainers(const std::vector<std::string> &containers) {
+  if (!DockerDaemonHealth().Available())
+    return;
+  std::vector<std::string> cli;
+  bool use_api = true;
+  for (const auto &c : containers) {
+    std::string error;
+    if (use_api && RemoveContainerApi(c, error))
+      continue;
+    use_api = false;
+    cli.push_back(c);
+  }
+  for (size_t first = 0; first < cli.size(); first += kDockerCliBatch) {
+    std::string cmd = "docker rm -f -v";
+    for (size_t i = first; i < std::min(cli.size(), first + kDockerCliBatch);
+         i++)
+      cmd += " " + cli[i];
+    RunShellLines(cmd + " >/dev/null 2>&1 || true");
+  }
+}
+
+std::vector<ImageLayers>
+ImageLayerCache::Get(const std::vector<std::string> &ids,
+                     DockerApiClient &client) {
+  std::vector<std::string> missing;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &id : ids)
+      if (!cache_.count(id))
+        missing.push_back(id);
+  }
+  std::vector<ImageLayers> fetched;
+  for (const auto &id : missing) {
+    int status = 0;
+    JsonValue inspect, history;
+    if (!DockerApiCall("GET", "/images/" + id + "/json", status, inspect,
+                       client) ||
+        status != 200 ||
+        !DockerApiCall("GET", "/images/" + id + "/history", status,
+                       history, client) ||
+        status != 200)
+      continue;
+    fetched.push_back(ImageLayersFromApi(id, inspect, history));
+  }
+  std::vector<ImageLayers> out;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &layers : fetched)
+    cache_[layers.id] = std::move(layers);
+  std::unordered_map<std::string, ImageLayers> kept;
+  for (const auto &id : ids) {
+    auto it = cache_.find(id);
+    if (it == cache_.end()) {
+      out.push_back(ImageLayers{id, {}});
+      continue;
+    }
+    out.push_back(it->second);
+    kept.emplace(id, it->second);
+  }
+  cache_ = std::move(kept);
+  return out;
+}
+
+void ContainerLogIndex::Record(const std::string &name,
+                               const std::string &dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  reported_[name] = dir;
+}
+
+bool ContainerLogIndex::Lookup(const std::string &name,
+                               const std::string &roots, std::string &dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = reported_.find(name);
+  if (it != reported_.end()) {
+    dir = it->second;
+    return true;
+  }
+  if (roots != roots_) {
+    resolved_.clear();
+    roots_ = roots;
+    return false;
+  }
+  it = resolved_.find(name);
+  if (it == resolved_.end())
+    return false;
+  dir = it->second;
+  return true;
+}
+
+void ContainerLogIndex::Remember(const std::string &name,
+                                 const std::string &roots,
+                                 const std::string &dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (roots == roots_)
+    resolved_[name] = dir;
+}
+
+void DockerDiskAnalysis::Start() {
+  if (busy_.exchange(true))
+    return;
+  jobs_.Submit(JobLane::Io, JobPriority::Interactive,
+               [this](const CancelToken &) {
+                 std::shared_ptr<const DockerDiskReport> report = Analyze();
+                 {
+                   std::lock_guard<std::mutex> lock(mutex_);
+                   report_ = report;
+                 }
+                 busy_ = false;
+                 if (done_)
+                   done_();
+               });
+}
+
+std::shared_ptr<const DockerDiskReport> DockerDiskAnalysis::Report() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return report_;
+}
+
+std::shared_ptr<const DockerDiskReport> DockerDiskAnalysis::Analyze() {
+  auto report = std::make_shared<DockerDiskReport>();
+  report->taken = time(nullptr);
+  int status = 0;
+  JsonValue df;
+  if (!DockerDaemonHealth().Available() ||
+      !DockerApiCall("GET", "/system/df", status, df, client_) ||
+      status != 200) {
+    report->error = "The Docker Engine API is not reachable";
+    return report;
+  }
+  report->layer_bytes = df.GetNumber("LayersSize");
+  if (const JsonValue *containers = df.Find("Containers"))
+    for (const auto &c : containers->items) {
+      double bytes = c.GetNumber("SizeRw");
+      report->container_bytes += bytes;
+      if (c.GetString("State") != "running")
+        report->stopped_container_bytes += bytes;
+    }
+  if (const JsonValue *cache = df.Find("BuildCache"))
+    for (const auto &record : cache->items) {
+      if (record.GetBool("Shared", false))
+        continue; // counted with the record that owns it
+      double bytes = record.GetNumber("Size");
+      report->cache_bytes += bytes;
+      if (!record.GetBool("InUse", false))
+        report->cache_reclaimable += bytes;
+    }
+
+  std::vector<std::string> ids, names;
+  std::vector<size_t> unused;
+  std::map<std::string, std::vector<size_t>> repositories;
+  std::vector<long long> created;
+  if (const JsonValue *images = df.Find("Images"))
+    for (const auto &img : images->items) {
+      size_t i = ids.size();
+      ids.push_back(ShortImageId(img.GetString("Id")));
+      created.push_back((long long)img.GetNumber("Created"));
+      std::string tag;
+      for (const auto &t : img.GetStrings("RepoTags"))
+        if (t != "<none>:<none>") {
+          tag = t;
+          break;
+        }
+      names.push_back(tag.empty() ? ids.back() : tag);
+      size_t slash = tag.rfind('/');
+      size_t colon =
+          tag.find(':', slash == std::string::npos ? 0 : slash);
+      repositories[tag.empty() ? "<none>" : tag.substr(0, colon)]
+          .push_back(i);
+      if (img.GetInt("Containers", -1) == 0)
+        unused.push_back(i);
+    }
+  LayerUsage layers(layers_.Get(ids, client_));
+  report->shared_bytes = layers.TotalBytes();
+  for (size_t i = 0; i < ids.size(); i++)
+    report->shared_bytes -= layers.FreedBy({i});
+  report->unused_image_bytes = layers.FreedBy(unused);
+
+  for (const auto &kv : repositories) {
+    DockerDiskReport::Repository repo;
+    repo.name = kv.first;
+    repo.images = (int)kv.second.size();
+    repo.freed_bytes = layers.FreedBy(kv.second);
+    repo.shared_bytes = layers.BytesOf(kv.second) - repo.freed_bytes;
+    size_t newest = kv.second.front();
+    for (size_t i : kv.second)
+      if (created[i] > created[newest])
+        newest = i;
+    int base = layers.BaseOf(newest);
+    for (int depth = 0; base >= 0 && depth < 8; depth++) {
+      repo.lineage += (repo.lineage.empty() ? "" : " <- ") + names[base];
+      base = layers.BaseOf((size_t)base);
+    }
+    report->repositories.push_back(std::move(repo));
+  }
+  std::sort(report->repositories.begin(), report->repositories.end(),
+            [](const DockerDiskReport::Repository &a,
+               const DockerDiskReport::Repository &b) {
+              return a.freed_bytes > b.freed_bytes;
+            });
+  return report;
+}
+
+// How often the collector sweeps, and how old an object must be before any
+// rule applies to it (long enough for a freshly built image to get its
+// container)
+static const int kDockerGcSweepMs = 15 * 60 * 1000;
+static const time_t kDockerGcGraceSec = 30 * 60;
+
+// Seconds since the epoch for the "2024-05-01 12:00:00 +0200 CEST" form of
+// docker's CreatedAt column; 0 when it does not parse
+static time_t ParseDockerCreatedAt(const std::string &text) {
+  int y = 0, mo = 0, d = 0, h = 0, mi = 0, s = 0, off = 0;
+  char sign = '+';
+  if (sscanf(text.c_str(), "%d-%d-%d %d:%d:%d %c%4d", &y, &mo, &d, &h, &mi,
+             &s, &sign, &off) < 6)
+    return 0;
+  // Days from 1970-01-01 to the civil date (proleptic Gregorian calendar)
+  y -= mo <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long long days = (long long)era * 146097 + doe - 719468;
+  long long offset = (off / 100) * 3600 + (off % 100) * 60;
+  return (time_t)(days * 86400 + h * 3600 + mi * 60 + s -
+                  (sign == '-' ? -offset : offset));
+}
+
+// Bytes for a size as docker images and docker system df print it ("1.23GB",
+// "512kB", "1.2GB (40%)"); 0 when it does not parse
+static double ParseDockerListSize(const std::string &text) {
+  static const char *units[] = {"B", "kB", "MB", "GB", "TB", "PB"};
+  char *end = nullptr;
+  double value = strtod(text.c_str(), &end);
+  if (end == text.c_str())
+    return 0.0;
+  std::string unit(end);
+  size_t space = unit.find(' ');
+  if (space != std::string::npos)
+    unit.erase(space);
+  double scale = 1.0;
+  for (const char *u : units) {
+    if (unit == u || (unit.size() == 2 && unit[0] == 'K' && u[0] == 'k' &&
+                      unit[1] == u[1]))
+      return value * scale;
+    scale *= 1000.0;
+  }
+  return value;
+}
+
+void DockerGarbageCollector::Configure(const DockerGcPolicy &policy) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (policy == policy_)
+    return;
+  policy_ = policy;
+  changed_ = true;
+  cv_.notify_one();
+  if (!thread_.joinable() && policy.Enabled() && !stop_)
+    thread_ = std::thread([this]() {
+      if (hooks_.thread_start)
+        hooks_.thread_start();
+      Run();
+    });
+}
+
+void DockerGarbageCollector::SweepNow() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  changed_ = true;
+  cv_.notify_one();
+}
+
+void DockerGarbageCollector::Protect(std::function<std::string()> container) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  protected_.push_back(std::move(container));
+}
+
+std::string DockerGarbageCollector::Status() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+void DockerGarbageCollector::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_one();
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void DockerGarbageCollector::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    changed_ = false;
+    DockerGcPolicy policy = policy_;
+    std::vector<std::string> active = ActiveContainersLocked();
+    lock.unlock();
+    std::string status;
+    if (policy.Enabled())
+      status = Sweep(policy, active);
+    lock.lock();
+    if (!status.empty())
+      status_ = status;
+    cv_.wait_for(lock, std::chrono::milliseconds(kDockerGcSweepMs),
+                 [this]() { return stop_ || changed_; });
+  }
+}
+
+std::vector<std::string> DockerGarbageCollector::ActiveContainersLocked() {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < protected_.size();) {
+    std::string name = protected_[i]();
+    if (name.empty()) {
+      protected_.erase(protected_.begin() + i);
+      continue;
+    }
+    names.push_back(name);
+    i++;
+  }
+  return names;
+}
+
+DockerGarbageCollector::Container
+DockerGarbageCollector::ContainerFromApi(const JsonValue &c) {
+  Container out;
+  out.id = c.GetString("Id");
+  const JsonValue *names = c.Find("Names");
+  if (names && names->type == JsonValue::Array && !names->items.empty())
+    out.name = names->items[0].str;
+  if (!out.name.empty() && out.name[0] == '/')
+    out.name.erase(0, 1);
+  out.image = c.GetString("Image");
+  out.image_id = c.GetString("ImageID");
+  out.created = (time_t)c.GetNumber("Created");
+  out.running = c.GetString("State") == "running";
+  const JsonValue *labels = c.Find("Labels");
+  out.pool = labels && labels->Find("autobuild.pool");
+  return out;
+}
+
+DockerGarbageCollector::Image
+DockerGarbageCollector::ImageFromApi(const JsonValue &img) {
+  Image out;
+  out.ref.id = ShortImageId(img.GetString("Id"));
+  const JsonValue *tags = img.Find("RepoTags");
+  if (tags && tags->type == JsonValue::Array)
+    for (const auto &t : tags->items)
+      if (t.type == JsonValue::String && t.str != "<none>:<none>")
+        out.ref.tags.push_back(t.str);
+  out.created = (time_t)img.GetNumber("Created");
+  double shared = img.GetNumber("SharedSize");
+  out.bytes = img.GetNumber("Size") - (shared > 0 ? shared : 0.0);
+  return out;
+}
+
+bool DockerGarbageCollector::ListApi(bool with_usage, Inventory &inv) {
+  int status = 0;
+  JsonValue body;
+  if (with_usage) {
+    if (!DockerApiCall("GET", "/system/df", status, body))
+      return false;
+    if (status != 200)
+      return true;
+    inv.disk_bytes = body.GetNumber("LayersSize");
+    const JsonValue *containers = body.Find("Containers");
+    if (containers && containers->type == JsonValue::Array)
+      for (const auto &c : containers->items) {
+        inv.containers.push_back(ContainerFromApi(c));
+        inv.disk_bytes += c.GetNumber("SizeRw");
+      }
+    const JsonValue *images = body.Find("Images");
+    if (images && images->type == JsonValue::Array)
+      for (const auto &img : images->items)
+        inv.images.push_back(ImageFromApi(img));
+    return true;
+  }
+  if (!DockerApiCall("GET", "/containers/json?all=1", status, body))
+    return false;
+  if (status == 200 && body.type == JsonValue::Array)
+    for (const auto &c : body.items)
+      inv.containers.push_back(ContainerFromApi(c));
+  if (DockerApiCall("GET", "/images/json", status, body) && status == 200 &&
+      body.type == JsonValue::Array)
+    for (const auto &img : body.items)
+      inv.images.push_back(ImageFromApi(img));
+  return true;
+}
+
+bool DockerGarbageCollector::ListCli(bool with_usage, Inventory &inv) {
+  auto failed = [](const std::vector<std::string> &lines) {
+    for (const auto &line : lines)
+      if (line.find("Cannot connect") != std::string::npos ||
+          line.find("error during connect") != std::string::npos)
+        return true;
+    return false;
+  };
+  std::vector<std::string> lines = RunShellLines(
+      "docker ps -a --no-trunc --format '{{.ID}}|{{.Names}}|{{.Image}}|"
+      "{{.State}}|{{.CreatedAt}}|{{.Label \"autobuild.pool\"}}' 2>&1");
+  if (failed(lines))
+    return false;
+  for (const auto &line : lines) {
+    std::vector<std::string> f;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, '|'))
+      f.push_back(field);
+    if (f.size() < 5)
+      continue;
+    Container c;
+    c.id = f[0];
+    c.name = f[1];
+    c.image = f[2];
+    c.running = f[3] == "running";
+    c.created = ParseDockerCreatedAt(f[4]);
+    c.pool = f.size() > 5 && !f[5].empty();
+    inv.containers.push_back(c);
+  }
+
+  lines = RunShellLines("docker images --no-trunc --format "
+                        "'{{.ID}}|{{.Repository}}:{{.Tag}}|{{.CreatedAt}}|"
+                        "{{.Size}}' 2>&1");
+  std::map<std::string, size_t> by_id;
+  for (const auto &line : lines) {
+    std::vector<std::string> f;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, '|'))
+      f.push_back(field);
+    if (f.size() < 4)
+      continue;
+    std::string id = ShortImageId(f[0]);
+    auto it = by_id.find(id);
+    if (it == by_id.end()) {
+      it = by_id.emplace(id, inv.images.size()).first;
+      Image img;
+      img.ref.id = id;
+      img.created = ParseDockerCreatedAt(f[2]);
+      img.bytes = ParseDockerListSize(f[3]);
+      inv.images.push_back(img);
+    }
+    if (f[1] != "<none>:<none>")
+      inv.images[it->second].ref.tags.push_back(f[1]);
+  }
+
+  if (with_usage) {
+    for (const auto &line :
+         RunShellLines("docker system df --format '{{.Type}}|{{.Size}}' "
+                       "2>/dev/null")) {
+      size_t bar = line.find('|');
+      if (bar == std::string::npos)
+        continue;
+      std::string type = line.substr(0, bar);
+      if (type == "Images" || type == "Containers")
+        inv.disk_bytes += ParseDockerListSize(line.substr(bar + 1));
+    }
+  }
+  return true;
+}
+
+std::string DockerGarbageCollector::ContainerKey(const DockerGcPolicy &policy,
+                                                 const Container &c) {
+  if (c.pool || c.name.rfind("autobuild-pool-", 0) == 0)
+    return "";
+  size_t from = c.name.find("_from_");
+  if (from != std::string::npos)
+    return c.name.substr(0, from);
+  for (const char *mode : {"-feedback-", "-verify-", "-audit-"}) {
+    size_t at = c.name.find(mode);
+    if (at != std::string::npos)
+      return c.name.substr(0, at + strlen(mode) - 1);
+  }
+  if (!policy.container_prefix.empty() &&
+      c.name.rfind(policy.container_prefix, 0) == 0)
+    return policy.container_prefix;
+  return "";
+}
+
+std::string DockerGarbageCollector::ImageKey(const DockerGcPolicy &policy,
+                                             const Image &img) {
+  for (const auto &tag : img.ref.tags) {
+    size_t colon = tag.rfind(':');
+    std::string repo =
+        colon == std::string::npos ? tag : tag.substr(0, colon);
+    if (repo.rfind("autobuild-", 0) == 0 ||
+        (!policy.image_repo.empty() && repo == policy.image_repo))
+      return repo;
+  }
+  return "";
+}
+
+void DockerGarbageCollector::ApplyRetention(
+    const DockerGcPolicy &policy, time_t now,
+    std::map<std::string, std::vector<size_t>> &groups,
+    const std::function<time_t(size_t)> &created,
+    const std::function<bool(size_t)> &removable,
+    std::vector<std::pair<size_t, const char *>> &out) {
+  for (auto &kv : groups) {
+    std::vector<size_t> &members = kv.second;
+    std::sort(members.begin(), members.end(), [&](size_t a, size_t b) {
+      return created(a) > created(b);
+    });
+    for (size_t rank = 0; rank < members.size(); rank++) {
+      size_t i = members[rank];
+      time_t age = now - created(i);
+      if (age < kDockerGcGraceSec || !removable(i))
+        continue;
+      if (policy.keep_per_task > 0 && rank >= (size_t)policy.keep_per_task)
+        out.push_back({i, "keep"});
+      else if (policy.ttl_hours > 0 &&
+               age > (time_t)policy.ttl_hours * 60 * 60)
+        out.push_back({i, "ttl"});
+    }
+  }
+}
+
+std::string DockerGarbageCollector::LogDir(const DockerGcPolicy &policy,
+                                           const std::string &container) const {
+  return hooks_.log_dir ? hooks_.log_dir(policy.log_roots, container) : "";
+}
+
+std::string
+DockerGarbageCollector::Sweep(const DockerGcPolicy &policy,
+                              const std::vector<std::string> &active) {
+  if (!DockerDaemonHealth().Available())
+    return "Docker is not reachable";
+  bool with_usage = policy.disk_gb > 0;
+  Inventory inv;
+  if (!ListApi(with_usage, inv)) {
+    inv = Inventory();
+    if (!ListCli(with_usage, inv))
+      return "Docker is not reachable";
+  }
+  time_t now = time(nullptr);
+  std::vector<Victim> removed;
+
+  // Containers first, so the images they held can go in the same sweep
+  std::map<std::string, std::vector<size_t>> groups;
+  for (size_t i = 0; i < inv.containers.size(); i++) {
+    std::string key = ContainerKey(policy, inv.containers[i]);
+    if (!key.empty())
+      groups[key].push_back(i);
+  }
+  std::vector<std::pair<size_t, const char *>> picked;
+  ApplyRetention(
+      policy, now, groups,
+      [&](size_t i) { return inv.containers[i].created; },
+      [&](size_t i) {
+        const Container &c = inv.containers[i];
+        return std::find(active.begin(), active.end(), c.name) ==
+               active.end();
+      },
+      picked);
+  std::vector<bool> container_gone(inv.containers.size(), false);
+  std::vector<std::string> names;
+  for (const auto &p : picked) {
+    const Container &c = inv.containers[p.first];
+    container_gone[p.first] = true;
+    names.push_back(c.name);
+    removed.push_back({"container", c.name, c.id.substr(0, 12), p.second,
+                       LogDir(policy, c.name)});
+  }
+  if (!names.empty())
+    RemoveContainers(names);
+
+  // Images no remaining container uses
+  auto in_use = [&](const Image &img) {
+    for (size_t i = 0; i < inv.containers.size(); i++)
+      if (!container_gone[i] &&
+          ContainerImageIs(inv.containers[i].image,
+                           inv.containers[i].image_id, img.ref))
+        return true;
+    return false;
+  };
+  groups.clear();
+  for (size_t i = 0; i < inv.images.size(); i++) {
+    std::string key = ImageKey(policy, inv.images[i]);
+    if (!key.empty())
+      groups[key].push_back(i);
+  }
+  std::vector<bool> newest(inv.images.size(), false);
+  picked.clear();
+  ApplyRetention(
+      policy, now, groups, [&](size_t i) { return inv.images[i].created; },
+      [&](size_t i) { return !in_use(inv.images[i]); }, picked);
+  for (const auto &kv : groups)
+    newest[kv.second.front()] = true;
+  std::vector<bool> image_picked(inv.images.size(), false);
+  std::vector<size_t> victims;
+  for (const auto &p : picked) {
+    image_picked[p.first] = true;
+    victims.push_back(p.first);
+  }
+  // Usage once the victims are gone: layers only they hold go with them
+  std::vector<std::string> ids;
+  for (const auto &img : inv.images)
+    ids.push_back(img.ref.id);
+  LayerUsage layers(with_usage ? layers_.Get(ids)
+                               : std::vector<ImageLayers>());
+  auto usage_after = [&]() {
+    double freed = layers.FreedBy(victims);
+    for (size_t i : victims)
+      if (i >= layers.images().size() || layers.images()[i].layers.empty())
+        freed += inv.images[i].bytes;
+    return inv.disk_bytes - freed;
+  };
+  double usage = usage_after();
+
+  // Above the watermark, the oldest remaining images but the newest of
+  // each repository go until the estimate is under it
+  double watermark = (double)policy.disk_gb * 1e9;
+  if (with_usage && usage > watermark) {
+    std::vector<size_t> oldest;
+    for (const auto &kv : groups)
+      for (size_t i : kv.second)
+        if (!image_picked[i] && !newest[i] &&
+            now - inv.images[i].created >= kDockerGcGraceSec &&
+            !in_use(inv.images[i]))
+          oldest.push_back(i);
+    std::sort(oldest.begin(), oldest.end(), [&](size_t a, size_t b) {
+      return inv.images[a].created < inv.images[b].created;
+    });
+    for (size_t i : oldest) {
+      if (usage <= watermark)
+        break;
+      picked.push_back({i, "disk"});
+      victims.push_back(i);
+      usage = usage_after();
+    }
+  }
+
+  std::vector<DockerImageRef> images;
+  std::vector<Victim> image_victims;
+  for (const auto &p : picked) {
+    const Image &img = inv.images[p.first];
+    // The run an image belonged to is the one of a container made from it
+    std::string log_dir;
+    for (const auto &c : inv.containers)
+      if (ContainerImageIs(c.image, c.image_id, img.ref) &&
+          !ContainerKey(policy, c).empty()) {
+        log_dir = LogDir(policy, c.name);
+        break;
+      }
+    images.push_back(img.ref);
+    image_victims.push_back(
+        {"image", img.ref.tags.empty() ? img.ref.id : img.ref.tags.front(),
+         img.ref.id, p.second, log_dir});
+  }
+  size_t images_deleted = 0;
+  std::string freed;
+  if (!images.empty()) {
+    std::vector<std::string> errors;
+    images_deleted = SafeDeleteImages(images, errors);
+    victims.clear();
+    for (size_t i = 0; i < images.size(); i++)
+      if (errors[i].empty()) {
+        removed.push_back(image_victims[i]);
+        victims.push_back(picked[i].first);
+      }
+    if (with_usage && images_deleted > 0)
+      freed = " (" + FormatDockerSize(inv.disk_bytes - usage_after()) +
+              " freed)";
+  }
+
+  Record(removed, now);
+  char when[32] = "";
+  strftime(when, sizeof(when), "%H:%M", std::localtime(&now));
+  return std::string("Last run ") + when + ": removed " +
+         std::to_string(names.size()) + " container(s) and " +
+         std::to_string(images_deleted) + " image(s)" + freed;
+}
+
+void DockerGarbageCollector::Record(const std::vector<Victim> &removed,
+                                    time_t now) {
+  if (removed.empty())
+    return;
+  std::string lines;
+  for (const auto &v : removed) {
+    lines += JsonWriter(true)
+                 .Number("time", (long long)now)
+                 .String("kind", v.kind)
+                 .String("name", v.name)
+                 .String("id", v.id)
+                 .String("reason", v.reason)
+                 .String("log_dir", v.log_dir)
+                 .Finish();
+    if (hooks_.removed)
+      hooks_.removed(v.kind, v.name, v.reason);
+  }
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    path = policy_.record_path;
+  }
+  if (path.empty())
+    return;
+  std::ofstream out(path, std::ios::binary | std::ios::app);
+  out << lines;
+}
+
+void DockerBulkOps::RemoveContainers(std::vector<std::string> names,
+                                     Hooks hooks) {
+  auto list =
+      std::make_shared<const std::vector<std::string>>(std::move(names));
+  auto removed = hooks.removed;
+  auto run = [list, removed](size_t i, DockerApiClient &client) {
+    const std::string &c = (*list)[i];
+    std::string error;
+    if (!DockerDaemonHealth().Available())
+      return "Failed to remove container " + c + ": Docker is not running";
+    if (!RemoveContainerApi(c, error, client)) {
+      for (const auto &line : RunShellLines("docker rm -f -v " + c + " 2>&1"))
+        if (line.find("Error") != std::string::npos &&
+            line.find("No such container") == std::string::npos)
+          error += (error.empty() ? "" : " ") + line;
+      if (!error.empty())
+        error = "Failed to remove container " + c + ": " + error;
+    }
+    if (error.empty() && removed)
+      removed(c);
+    return error;
+  };
+  Launch(Kind::Containers, list->size(), run, nullptr, std::move(hooks));
+}
+
+void DockerBulkOps::DeleteImages(std::vector<DockerImageRef> images,
+                                 Hooks hooks) {
+  auto list =
+      std::make_shared<const std::vector<DockerImageRef>>(std::move(images));
+  auto users =
+      std::make_shared<std::map<std::string, std::vector<std::string>>>();
+  auto listed = std::make_shared<bool>(false);
+  auto prepare = [list, users, listed]() {
+    *listed = DockerContainersUsingImages(*list, *users);
+  };
+  auto removed = hooks.removed;
+  auto run = [list, users, listed, removed](size_t i,
+                                            DockerApiClient &client) {
+    const DockerImageRef &image = (*list)[i];
+    std::string error;
+    auto it = users->find(image.id);
+    if (!DockerDaemonHealth().Available()) {
+      error = "Failed to delete image " + image.id + ":\nDocker is not running";
+    } else if (*listed && it != users->end()) {
+      error = ImageInUseMessage(image.id, it->second);
+    } else if (!DeleteImageApi(image, error, client)) {
+      std::vector<const DockerImageRef *> one{&image};
+      std::vector<std::string *> one_error{&error};
+      RemoveImagesCli(one, one_error);
+      if (!error.empty())
+        error = "Failed to delete image " + image.id + ":\n" + error;
+    }
+    if (error.empty()) {
+      if (removed)
+        removed(image.id);
+    } else if (list->size() > 1) {
+      error = "Image " +
+              (image.tags.empty() ? std::string("<none>:<none>")
+                                  : image.tags.front()) +
+              " (" + image.id + "):\n" + error;
+    }
+    return error;
+  };
+  Launch(Kind::Images, list->size(), run, prepare, std::move(hooks));
+}
+
+void DockerBulkOps::Cancel(uint64_t id) {
+  for (auto &op : ops_)
+    if (op.id == id)
+      op.progress->cancelled = true;
+}
+
+bool DockerBulkOps::Busy(Kind kind) const {
+  for (const auto &op : ops_)
+    if (op.kind == kind)
+      return true;
+  return false;
+}
+
+void DockerBulkOps::Launch(Kind kind, size_t total, ItemFn run,
+                           std::function<void()> prepare, Hooks hooks) {
+  if (total == 0)
+    return;
+  Op op;
+  op.id = ++next_id_;
+  op.kind = kind;
+  op.total = total;
+  op.progress = std::make_shared<Progress>();
+  ops_.push_back(op);
+  uint64_t id = op.id;
+  auto progress = op.progress;
+  auto finished = std::make_shared<const Hooks>(std::move(hooks));
+  // The lanes take the next item from a shared counter. Their jobs get
+  // tokens of their own: one dropped unstarted would never report back.
+  auto lane = [this, id, total, run, progress, finished](
+                  std::shared_ptr<std::atomic<size_t>> next) {
+    DockerApiClient client;
+    for (;;) {
+      size_t i = (*next)++;
+      if (i >= total || progress->cancelled)
+        break;
+      std::string error = run(i, client);
+      if (!error.empty()) {
+        std::lock_guard<std::mutex> lock(progress->mutex);
+        progress->errors.push_back(std::move(error));
+        progress->failed++;
+      }
+      progress->done++;
+    }
+    if (--progress->lanes == 0)
+      jobs_.Post([this, id, finished]() { Finished(id, *finished); });
+  };
+  size_t lanes = std::min(kParallel, total);
+  progress->lanes = lanes;
+  jobs_.Submit(JobLane::Io, JobPriority::Normal,
+               [this, lane, lanes, prepare](const CancelToken &) {
+                 if (prepare)
+                   prepare();
+                 auto next = std::make_shared<std::atomic<size_t>>(0);
+                 for (size_t l = 1; l < lanes; l++)
+                   jobs_.Submit(JobLane::Io, JobPriority::Normal,
+                                [lane, next](const CancelToken &) {
+                                  lane(next);
+                                });
+                 lane(next);
+               });
+}
+
+void DockerBulkOps::Finished(uint64_t id, const Hooks &hooks) {
+  auto it = std::find_if(ops_.begin(), ops_.end(),
+                         [id](const Op &op) { return op.id == id; });
+  if (it == ops_.end())
+    return;
+  Op op = *it;
+  ops_.erase(it);
+  std::string errors;
+  {
+    std::lock_guard<std::mutex> lock(op.progress->mutex);
+    for (const auto &e : op.progress->errors)
+      errors += (errors.empty() ? "" : op.kind == Kind::Images ? "\n\n"
+                                                               : "\n") +
+                e;
+  }
+  if (hooks.finished)
+    hooks.finished(op, errors);
+}
+
+
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                       LINE DIFF                       //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Myers' edit cost past which a region is shown as a plain replacement;
+// keeps the trace at most kDiffMaxCost^2 entries
+static const int kDiffMaxCost = 1024;
+// Changed runs of words up to this many bytes per side are refined to
+// characters
+static const size_t kDiffCharRefineBytes = 80;
+
+class LineDiffer {
+public:
+  // '=' keeps a[a] as b[b], '-' removes a[a], '+' inserts b[b]
+  struct Op {
+    char kind;
+    int a, b;
+  };
+
+  LineDiffer(const std::vector<int> &a, const std::vector<int> &b)
+      : a_(a), b_(b) {}
+
+  std::vector<Op> Run() {
+    ops_.clear();
+    Range(0, (int)a_.size(), 0, (int)b_.size());
+    return std::move(ops_);
+  }
+
+private:
+  void Range(int a0, int a1, int b0, int b1) {
+    int head = 0;
+    while (a0 + head < a1 && b0 + head < b1 && a_[a0 + head] == b_[b0 + head])
+      head++;
+    int tail = 0;
+    while (a1 - tail > a0 + head && b1 - tail > b0 + head &&
+           a_[a1 - 1 - tail] == b_[b1 - 1 - tail])
+      tail++;
+    for (int i = 0; i < head; i++)
+      ops_.push_back({'=', a0 + i, b0 + i});
+    Middle(a0 + head, a1 - tail, b0 + head, b1 - tail);
+    for (int i = tail; i > 0; i--)
+      ops_.push_back({'=', a1 - i, b1 - i});
+  }
+
+  void Middle(int a0, int a1, int b0, int b1) {
+    if (a0 == a1 || b0 == b1) {
+      Replace(a0, a1, b0, b1);
+      return;
+    }
+    std::vector<std::pair<int, int>> anchors = Anchors(a0, a1, b0, b1);
+    if (anchors.empty()) {
+      Myers(a0, a1, b0, b1);
+      return;
+    }
+    for (const auto &anchor : anchors) {
+      Range(a0, anchor.first, b0, anchor.second);
+      ops_.push_back({'=', anchor.first, anchor.second});
+      a0 = anchor.first + 1;
+      b0 = anchor.second + 1;
+    }
+    Range(a0, a1, b0, b1);
+  }
+
+  void Replace(int a0, int a1, int b0, int b1) {
+    for (int i = a0; i < a1; i++)
+      ops_.push_back({'-', i, -1});
+    for (int j = b0; j < b1; j++)
+      ops_.push_back({'+', -1, j});
+  }
+
+  // Lines unique to both ranges, in the longest order-preserving subset
+  std::vector<std::pair<int, int>> Anchors(int a0, int a1, int b0, int b1) {
+    struct Seen {
+      int a_count = 0, b_count = 0, a_pos = 0, b_pos = 0;
+    };
+    std::unordered_map<int, Seen> seen;
+    for (int i = a0; i < a1; i++) {
+      Seen &s = seen[a_[i]];
+      s.a_count++;
+      s.a_pos = i;
+    }
+    for (int j = b0; j < b1; j++) {
+      auto it = seen.find(b_[j]);
+      if (it != seen.end()) {
+        it->second.b_count++;
+        it->second.b_pos = j;
+      }
+    }
+    std::vector<std::pair<int, int>> pairs;
+    for (int i = a0; i < a1; i++) {
+      const Seen &s = seen[a_[i]];
+      if (s.a_count == 1 && s.b_count == 1)
+        pairs.push_back({i, s.b_pos});
+    }
+    // Longest increasing run of b positions (patience sorting)
+    std::vector<int> tails, prev(pairs.size(), -1);
+    for (int i = 0; i < (int)pairs.size(); i++) {
+      auto it = std::lower_bound(tails.begin(), tails.end(), i,
+                                 [&](int t, int cur) {
+                                   return pairs[t].second < pairs[cur].second;
+                                 });
+      if (it != tails.begin())
+        prev[i] = *(it - 1);
+      if (it == tails.end())
+        tails.push_back(i);
+      else
+        *it = i;
+    }
+    std::vector<std::pair<int, int>> anchors;
+    for (int i = tails.empty() ? -1 : tails.back(); i >= 0; i = prev[i])
+      anchors.push_back(pairs[i]);
+    std::reverse(anchors.begin(), anchors.end());
+    return anchors;
+  }
+
+  void Myers(int a0, int a1, int b0, int b1) {
+    const int n = a1 - a0, m = b1 - b0, max = n + m;
+    std::vector<int> v(2 * max + 2, 0);
+    std::vector<std::vector<int>> trace; // trace[d][k + d]: x after step d
+    int cost = -1;
+    for (int d = 0; d <= std::min(max, kDiffMaxCost) && cost < 0; d++) {
+      for (int k = -d; k <= d; k += 2) {
+        int x = (k == -d || (k != d && v[max + k - 1] < v[max + k + 1]))
+                    ? v[max + k + 1]
+                    : v[max + k - 1] + 1;
+        int y = x - k;
+        while (x < n && y < m && a_[a0 + x] == b_[b0 + y]) {
+          x++;
+          y++;
+        }
+        v[max + k] = x;
+        if (x >= n && y >= m)
+          cost = d;
+      }
+      trace.emplace_back(v.begin() + max - d, v.begin() + max + d + 1);
+    }
+    if (cost < 0) {
+      Replace(a0, a1, b0, b1); // too costly to align
+      return;
+    }
+    std::vector<Op> path;
+    int x = n, y = m;
+    for (int d = cost; d > 0; d--) {
+      const std::vector<int> &pv = trace[d - 1];
+      int k = x - y;
+      auto at = [&](int kk) { return pv[kk + d - 1]; };
+      bool down = k == -d || (k != d && at(k - 1) < at(k + 1));
+      int pk = down ? k + 1 : k - 1;
+      int px = at(pk), py = px - pk;
+      while (x > px + (down ? 0 : 1) && y > py + (down ? 1 : 0)) {
+        x--;
+        y--;
+        path.push_back({'=', a0 + x, b0 + y});
+      }
+      if (down)
+        path.push_back({'+', -1, b0 + py});
+      else
+        path.push_back({'-', a0 + px, -1});
+      x = px;
+      y = py;
+    }
+    while (x > 0 && y > 0) {
+      x--;
+      y--;
+      path.push_back({'=', a0 + x, b0 + y});
+    }
+    ops_.insert(ops_.end(), path.rbegin(), path.rend());
+  }
+
+  const std::vector<int> &a_;
+  const std::vector<int> &b_;
+  std::vector<Op> ops_;
+};
+
+static void AddDiffSpan(std::vector<DiffSpan> &spans, size_t start,
+                        size_t length, bool changed) {
+  if (length == 0)
+    return;
+  if (!spans.empty() && spans.back().changed == changed &&
+      spans.back().start + spans.back().length == start) {
+    spans.back().length += (uint32_t)length;
+    return;
+  }
+  spans.push_back({(uint32_t)start, (uint32_t)length, changed});
+}
+
+// Character diff of a[a0, a1) against b[b0, b1). When less than half of
+// the longer side survives, the whole run is marked instead: scattered
+// single letters in common read worse than a changed word.
+static void DiffCharSpans(const std::string &a, size_t a0, size_t a1,
+                          const std::string &b, size_t b0, size_t b1,
+                          std::vector<DiffSpan> &a_spans,
+                          std::vector<DiffSpan> &b_spans) {
+  std::vector<int> ca(a.begin() + a0, a.begin() + a1);
+  std::vector<int> cb(b.begin() + b0, b.begin() + b1);
+  std::vector<LineDiffer::Op> ops = LineDiffer(ca, cb).Run();
+  size_t same = 0;
+  for (const auto &op : ops)
+    same += op.kind == '=';
+  if (same * 2 < std::max(a1 - a0, b1 - b0)) {
+    AddDiffSpan(a_spans, a0, a1 - a0, true);
+    AddDiffSpan(b_spans, b0, b1 - b0, true);
+    return;
+  }
+  for (const auto &op : ops) {
+    if (op.kind != '+')
+      AddDiffSpan(a_spans, a0 + op.a, 1, op.kind == '-');
+    if (op.kind != '-')
+      AddDiffSpan(b_spans, b0 + op.b, 1, op.kind == '+');
+  }
+}
+
+// Intra-line diff of a modified line pair: words (and runs of spaces, and
+// single punctuation characters) are diffed first, then short changed runs
+// are refined to characters
+static void DiffLineSpans(const std::string &a, const std::string &b,
+                          std::vector<DiffSpan> &a_spans,
+                          std::vector<DiffSpan> &b_spans) {
+  auto tokenize = [](const std::string &s, std::vector<size_t> &starts) {
+    for (size_t i = 0; i < s.size();) {
+      starts.push_back(i);
+      unsigned char c = (unsigned char)s[i++];
+      if (isalnum(c) || c == '_' || c >= 0x80) {
+        while (i < s.size() && (isalnum((unsigned char)s[i]) || s[i] == '_' ||
+                                (unsigned char)s[i] >= 0x80))
+          i++;
+      } else if (c == ' ' || c == '\t') {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t'))
+          i++;
+      }
+    }
+    starts.push_back(s.size());
+  };
+  std::vector<size_t> ta, tb; // token start offsets, plus the end
+  tokenize(a, ta);
+  tokenize(b, tb);
+  std::unordered_map<std::string_view, int> ids;
+  auto intern = [&ids](const std::string &s, const std::vector<size_t> &t) {
+    std::vector<int> out;
+    for (size_t i = 0; i + 1 < t.size(); i++) {
+      std::string_view token(s.data() + t[i], t[i + 1] - t[i]);
+      out.push_back(ids.emplace(token, (int)ids.size()).first->second);
+    }
+    return out;
+  };
+  std::vector<int> ia = intern(a, ta), ib = intern(b, tb);
+  std::vector<LineDiffer::Op> ops = LineDiffer(ia, ib).Run();
+
+  for (size_t i = 0; i < ops.size();) {
+    if (ops[i].kind == '=') {
+      AddDiffSpan(a_spans, ta[ops[i].a], ta[ops[i].a + 1] - ta[ops[i].a],
+                  false);
+      AddDiffSpan(b_spans, tb[ops[i].b], tb[ops[i].b + 1] - tb[ops[i].b],
+                  false);
+      i++;
+      continue;
+    }
+    // Removed and added tokens of a run are contiguous on their side
+    int ra0 = -1, ra1 = -1, rb0 = -1, rb1 = -1;
+    for (; i < ops.size() && ops[i].kind != '='; i++) {
+      if (ops[i].kind == '-') {
+        ra0 = ra0 < 0 ? ops[i].a : ra0;
+        ra1 = ops[i].a + 1;
+      } else {
+        rb0 = rb0 < 0 ? ops[i].b : rb0;
+        rb1 = ops[i].b + 1;
+      }
+    }
+    size_t a0 = ra0 < 0 ? 0 : ta[ra0], a1 = ra0 < 0 ? 0 : ta[ra1];
+    size_t b0 = rb0 < 0 ? 0 : tb[rb0], b1 = rb0 < 0 ? 0 : tb[rb1];
+    if (ra0 >= 0 && rb0 >= 0 && a1 - a0 <= kDiffCharRefineBytes &&
+        b1 - b0 <= kDiffCharRefineBytes) {
+      DiffCharSpans(a, a0, a1, b, b0, b1, a_spans, b_spans);
+    } else {
+      AddDiffSpan(a_spans, a0, a1 - a0, true);
+      AddDiffSpan(b_spans, b0, b1 - b0, true);
+    }
+  }
+}
+
+static DiffLine MakeDiffLine(DiffLine::Type type, std::string orig_text,
+                             std::string mod_text, int orig_line_num,
+                             int mod_line_num) {
+  DiffLine line;
+  line.type = type;
+  line.orig_text = std::move(orig_text);
+  line.mod_text = std::move(mod_text);
+  line.orig_line_num = orig_line_num;
+  line.mod_line_num = mod_line_num;
+  return line;
+}
+
+static std::vector<std::string> SplitDiffLines(const std::string &text) {
+  std::vector<std::string> lines;
+  std::istringstream stream(text);
+  std::string line;
+  while (std::getline(stream, line)) {
+    size_t end = line.find_last_not_of(" \t\r\n");
+    line.resize(end == std::string::npos ? 0 : end + 1);
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+LineDiff ComputeLineDiff(const std::string &original,
+                         const std::string &modified) {
+  std::vector<std::string> a = SplitDiffLines(original);
+  std::vector<std::string> b = SplitDiffLines(modified);
+
+  // Compare lines by id so the diff never touches the text again
+  std::unordered_map<std::string_view, int> ids;
+  std::vector<int> a_ids, b_ids;
+  for (const auto &line : a)
+    a_ids.push_back(ids.emplace(line, (int)ids.size()).first->second);
+  for (const auto &line : b)
+    b_ids.push_back(ids.emplace(line, (int)ids.size()).first->second);
+  std::vector<LineDiffer::Op> ops = LineDiffer(a_ids, b_ids).Run();
+
+  LineDiff diff;
+  for (size_t i = 0; i < ops.size();) {
+    if (ops[i].kind == '=') {
+      diff.lines.push_back(MakeDiffLine(DiffLine::UNCHANGED, a[ops[i].a],
+                                        b[ops[i].b], ops[i].a + 1,
+                                        ops[i].b + 1));
+      i++;
+      continue;
+    }
+    // A run of changes: pair removed with added lines as modifications
+    std::vector<int> gone, come;
+    for (; i < ops.size() && ops[i].kind != '='; i++) {
+      if (ops[i].kind == '-')
+        gone.push_back(ops[i].a);
+      else
+        come.push_back(ops[i].b);
+    }
+    DiffHunk hunk;
+    hunk.orig_start = gone.empty() ? (i < ops.size() ? ops[i].a : (int)a.size())
+                                   : gone.front();
+    hunk.orig_count = (int)gone.size();
+    hunk.mod_start = come.empty() ? (i < ops.size() ? ops[i].b : (int)b.size())
+                                  : come.front();
+    hunk.mod_count = (int)come.size();
+    diff.hunks.push_back(hunk);
+    size_t pairs = std::min(gone.size(), come.size());
+    for (size_t p = 0; p < pairs; p++) {
+      diff.lines.push_back(MakeDiffLine(DiffLine::MODIFIED, a[gone[p]],
+                                        b[come[p]], gone[p] + 1, come[p] + 1));
+      DiffLine &line = diff.lines.back();
+      DiffLineSpans(line.orig_text, line.mod_text, line.orig_spans,
+                    line.mod_spans);
+    }
+    for (size_t p = pairs; p < gone.size(); p++)
+      diff.lines.push_back(
+          MakeDiffLine(DiffLine::REMOVED, a[gone[p]], "", gone[p] + 1, -1));
+    for (size_t p = pairs; p < come.size(); p++)
+      diff.lines.push_back(
+          MakeDiffLine(DiffLine::ADDED, "", b[come[p]], -1, come[p] + 1));
+    diff.modified += (int)pairs;
+    diff.removed += (int)(gone.size() - pairs);
+    diff.added += (int)(come.size() - pairs);
+  }
+  return diff;
+}
+
+// A log file mapped read-only for ComputeLogDiff
+class MappedLogFile {
+public:
+  MappedLogFile() = default;
+  ~MappedLogFile() {
+#ifdef _WIN32
+    if (data_ != nullptr)
+      UnmapViewOfFile(data_);
+    if (map_ != NULL)
+      CloseHandle(map_);
+    if (file_ != INVALID_HANDLE_VALUE)
+      CloseHandle(file_);
+#else
+    if (data_ != nullptr)
+      munmap((void *)data_, size_);
+    if (fd_ >= 0)
+      close(fd_);
+#endif
+  }
+  MappedLogFile(const MappedLogFile &) = delete;
+  MappedLogFile &operator=(const MappedLogFile &) = delete;
+
+  bool Open(const std::string &path) {
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE |
+                            FILE_SHARE_DELETE,
+                        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size))
+      return false;
+    size_ = (size_t)size.QuadPart;
+    if (size_ == 0)
+      return true;
+    map_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map_ == NULL)
+      return false;
+    data_ = (const char *)MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0);
+    return data_ != nullptr;
+#else
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0)
+      return false;
+    size_ = (size_t)st.st_size;
+    if (size_ == 0)
+      return true;
+    void *view = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (view == MAP_FAILED)
+      return false;
+    data_ = (const char *)view;
+    madvise(view, size_, MADV_SEQUENTIAL);
+    return true;
+#endif
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Drop the pages before offset from memory; they are read back from the
+  // file should anything before it be looked at again
+  void Release(size_t offset) {
+#ifndef _WIN32
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end = offset / page * page;
+    if (data_ != nullptr && end > released_) {
+      madvise((void *)(data_ + released_), end - released_, MADV_DONTNEED);
+      released_ = end;
+    }
+#else
+    (void)offset;
+#endif
+  }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  size_t released_ = 0;
+#ifdef _WIN32
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE map_ = NULL;
+#else
+  int fd_ = -1;
+#endif
+};
+
+// Volatile tokens longer than this are not looked for
+static const size_t kVolatileTokenMax = 64;
+// How far past a window ComputeLogDiff looks for where the other side's
+// window went
+static const long long kLogDiffProbeLines = 16LL * kLogDiffWindow;
+
+// Length of the volatile token at s[i] (i the start of a word), 0 when
+// there is none: a run of digits and time/date punctuation holding a ':'
+// or two '-' or '/' (10:04:31.250, 2025-03-01T10:04:31Z), or a run of hex
+// digits and '-' holding at least 8 hex digits and a decimal one
+// (container ids, hashes, UUIDs, epoch times)
+static size_t VolatileTokenLength(const char *s, size_t i, size_t n) {
+  size_t cap = std::min(n, i + kVolatileTokenMax);
+  auto word = [](char c) { return isalnum((unsigned char)c) || c == '_'; };
+  size_t time_end = i, colons = 0, dashes = 0;
+  if (isdigit((unsigned char)s[i])) {
+    auto punct = [](char c) {
+      return c == ':' || c == '.' || c == ',' || c == '-' || c == '/' ||
+             c == 'T' || c == 'Z';
+    };
+    while (time_end < cap &&
+           (isdigit((unsigned char)s[time_end]) || punct(s[time_end]))) {
+      colons += s[time_end] == ':';
+      dashes += s[time_end] == '-' || s[time_end] == '/';
+      time_end++;
+    }
+    if ((colons > 0 || dashes >= 2) && (time_end == n || !word(s[time_end])))
+      return time_end - i;
+  }
+  size_t hex_end = i, hex = 0, digits = 0;
+  while (hex_end < cap &&
+         (isxdigit((unsigned char)s[hex_end]) || s[hex_end] == '-')) {
+    hex += s[hex_end] != '-';
+    digits += isdigit((unsigned char)s[hex_end]) != 0;
+    hex_end++;
+  }
+  if (hex >= 8 && digits > 0 && (hex_end == n || !word(s[hex_end])))
+    return hex_end - i;
+  return 0;
+}
+
+// End of the log line data[begin, end) without its newline and trailing
+// blanks
+static size_t TrimLogLine(const char *data, size_t begin, size_t end) {
+  while (end > begin && (data[end - 1] == ' ' || data[end - 1] == '\t' ||
+                         data[end - 1] == '\r' || data[end - 1] == '\n'))
+    end--;
+  return end;
+}
+
+// What a log line is compared by: its text without trailing whitespace,
+// with volatile tokens standing in as one placeholder each
+static uint64_t LogLineKey(const char *s, size_t n, bool ignore_volatile) {
+  uint64_t h = 1469598103934665603ULL; // FNV-1a
+  auto mix = [&h](unsigned char c) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  };
+  for (size_t i = 0; i < n;) {
+    bool start = i == 0 || !(isalnum((unsigned char)s[i - 1]) ||
+                             s[i - 1] == '_');
+    size_t skip = ignore_volatile && start ? VolatileTokenLength(s, i, n) : 0;
+    if (skip > 0) {
+      mix(1);
+      i += skip;
+    } else {
+      mix((unsigned char)s[i++]);
+    }
+  }
+  return h;
+}
+
+// Collects the diff of ComputeLogDiff op by op: unchanged lines only keep
+// as much text as the context around changes needs, changed lines wait
+// for the end of their run to be paired up
+class LogDiffBuilder {
+public:
+  struct Line {
+    const char *text;
+    size_t size;
+    long long num; // 0-based
+  };
+
+  explicit LogDiffBuilder(LogDiffResult &out) : out_(out) {}
+
+  bool Full() const { return out_.truncated; }
+
+  void Same(const Line &a, const Line &b) {
+    FlushChange();
+    next_ = {a.num + 1, b.num + 1};
+    if (same_count_ == 0)
+      same_first_ = {a.num, b.num};
+    if (same_head_.size() < kHead)
+      same_head_.push_back({a, b});
+    same_tail_.push_back({a, b});
+    if (same_tail_.size() > kContext)
+      same_tail_.pop_front();
+    same_count_++;
+  }
+  void Gone(const Line &a) {
+    FlushSame(false);
+    gone_.push_back(a);
+    if (gone_.size() + come_.size() >= kLogDiffMaxLines)
+      FlushChange();
+  }
+  void Come(const Line &b) {
+    FlushSame(false);
+    come_.push_back(b);
+    if (gone_.size() + come_.size() >= kLogDiffMaxLines)
+      FlushChange();
+  }
+  void Finish() {
+    FlushChange();
+    FlushSame(true);
+  }
+
+private:
+  // Unchanged lines shown around a change, and the fewest left out
+  static constexpr size_t kContext = 3;
+  static constexpr size_t kHead = 2 * kContext + 4;
+
+  std::string Text(const Line &line) const {
+    return std::string(line.text,
+                       std::min(line.size, kLogDiffMaxLineBytes));
+  }
+
+  bool Room() {
+    if (out_.diff.lines.size() < kLogDiffMaxLines)
+      return true;
+    out_.truncated = true;
+    return false;
+  }
+
+  void PushSame(const std::pair<Line, Line> &p) {
+    if (Room())
+      out_.diff.lines.push_back(MakeDiffLine(
+          DiffLine::UNCHANGED, Text(p.first), Text(p.second),
+          (int)p.first.num + 1, (int)p.second.num + 1));
+  }
+
+  // The pending unchanged run, ending the diff when at_end
+  void FlushSame(bool at_end) {
+    if (same_count_ == 0)
+      return;
+    bool at_start = out_.diff.lines.empty();
+    if (same_count_ <= kHead) {
+      for (const auto &p : same_head_)
+        PushSame(p);
+    } else {
+      size_t head = at_start ? 0 : kContext;
+      size_t tail = at_end ? 0 : kContext;
+      for (size_t i = 0; i < head; i++)
+        PushSame(same_head_[i]);
+      if (Room()) {
+        DiffLine skipped = MakeDiffLine(
+            DiffLine::UNCHANGED, "", "", (int)(same_first_.first + head) + 1,
+            (int)(same_first_.second + head) + 1);
+        skipped.skipped = (int)(same_count_ - head - tail);
+        out_.diff.lines.push_back(std::move(skipped));
+      }
+      for (size_t i = kContext - tail; i < same_tail_.size(); i++)
+        PushSame(same_tail_[i]);
+    }
+    same_count_ = 0;
+    same_head_.clear();
+    same_tail_.clear();
+  }
+
+  void FlushChange() {
+    if (gone_.empty() && come_.empty())
+      return;
+    LineDiff &diff = out_.diff;
+    DiffHunk hunk;
+    hunk.orig_start = (int)(gone_.empty() ? next_.first : gone_.front().num);
+    hunk.orig_count = (int)gone_.size();
+    hunk.mod_start = (int)(come_.empty() ? next_.second : come_.front().num);
+    hunk.mod_count = (int)come_.size();
+    diff.hunks.push_back(hunk);
+    size_t pairs = std::min(gone_.size(), come_.size());
+    for (size_t p = 0; p < pairs && Room(); p++) {
+      diff.lines.push_back(MakeDiffLine(DiffLine::MODIFIED, Text(gone_[p]),
+                                        Text(come_[p]), (int)gone_[p].num + 1,
+                                        (int)come_[p].num + 1));
+      DiffLine &line = diff.lines.back();
+      DiffLineSpans(line.orig_text, line.mod_text, line.orig_spans,
+                    line.mod_spans);
+      diff.modified++;
+    }
+    for (size_t p = pairs; p < gone_.size() && Room(); p++) {
+      diff.lines.push_back(MakeDiffLine(DiffLine::REMOVED, Text(gone_[p]), "",
+                                        (int)gone_[p].num + 1, -1));
+      diff.removed++;
+    }
+    for (size_t p = pairs; p < come_.size() && Room(); p++) {
+      diff.lines.push_back(MakeDiffLine(DiffLine::ADDED, "", Text(come_[p]), -1,
+                                        (int)come_[p].num + 1));
+      diff.added++;
+    }
+    if (!gone_.empty())
+      next_.first = gone_.back().num + 1;
+    if (!come_.empty())
+      next_.second = come_.back().num + 1;
+    gone_.clear();
+    come_.clear();
+  }
+
+  LogDiffResult &out_;
+  size_t same_count_ = 0;
+  std::pair<long long, long long> same_first_;
+  std::vector<std::pair<Line, Line>> same_head_;
+  std::deque<std::pair<Line, Line>> same_tail_;
+  std::vector<Line> gone_, come_;
+  // Lines after the last one committed, where a change with nothing on
+  // one side sits on that side
+  std::pair<long long, long long> next_ = {0, 0};
+};
+
+bool ComputeLogDiff(const std::string &orig_path, const std::string &mod_path,
+                    bool ignore_volatile, const CancelToken &token,
+                    LogDiffResult &out, std::atomic<int> *progress) {
+  out = LogDiffResult();
+  MappedLogFile files[2];
+  const std::string *paths[2] = {&orig_path, &mod_path};
+  for (int f = 0; f < 2; f++) {
+    if (!files[f].Open(*paths[f])) {
+      out.error = "Cannot read " + *paths[f] + ": " + strerror(errno);
+      return false;
+    }
+  }
+
+  // One side's window: the next lines from pos, their starts (plus the end
+  // of the last), keys and line ids shared with the other side
+  struct Side {
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+    long long line = 0;
+    std::vector<size_t> starts;
+    std::vector<uint64_t> keys;
+    std::vector<int> ids;
+    bool eof = false;
+  } sides[2];
+  for (int f = 0; f < 2; f++) {
+    sides[f].data = files[f].data();
+    sides[f].size = files[f].size();
+  }
+  LogDiffBuilder builder(out);
+  // Text of line i of a window, without the newline and trailing blanks
+  auto text = [](const Side &side, int i) {
+    size_t b = side.starts[i];
+    size_t e = TrimLogLine(side.data, b, side.starts[i + 1]);
+    return LogDiffBuilder::Line{side.data + b, e - b, side.line + i};
+  };
+
+  // Lines from the start of side's window to the first line past it that
+  // occurs once in the other window, -1 when none does within
+  // kLogDiffProbeLines
+  auto probe = [ignore_volatile](const Side &side, const Side &other) {
+    std::unordered_map<uint64_t, int> count;
+    for (uint64_t key : other.keys)
+      count[key]++;
+    size_t pos = side.starts.back();
+    for (long long n = 0; pos < side.size && n < kLogDiffProbeLines; n++) {
+      const char *nl =
+          (const char *)memchr(side.data + pos, '\n', side.size - pos);
+      size_t end = nl ? (size_t)(nl - side.data) + 1 : side.size;
+      size_t e = TrimLogLine(side.data, pos, end);
+      auto it =
+          count.find(LogLineKey(side.data + pos, e - pos, ignore_volatile));
+      if (it != count.end() && it->second == 1)
+        return (long long)side.ids.size() + n;
+      pos = end;
+    }
+    return -1LL;
+  };
+
+  std::unordered_map<uint64_t, int> ids;
+  while (!builder.Full()) {
+    if (token.Cancelled()) {
+      out.error = "Cancelled";
+      return false;
+    }
+    ids.clear();
+    for (Side &side : sides) {
+      side.starts.clear();
+      side.ids.clear();
+      size_t pos = side.pos;
+      while (pos < side.size && side.ids.size() < (size_t)kLogDiffWindow) {
+        const char *nl = (const char *)memchr(side.data + pos, '\n',
+                                              side.size - pos);
+        size_t end = nl ? (size_t)(nl - side.data) + 1 : side.size;
+        side.starts.push_back(pos);
+        side.ids.push_back(0);
+        pos = end;
+      }
+      side.starts.push_back(pos);
+      side.eof = pos == side.size;
+      side.keys.resize(side.ids.size());
+      for (size_t i = 0; i < side.ids.size(); i++) {
+        LogDiffBuilder::Line line = text(side, (int)i);
+        side.keys[i] = LogLineKey(line.text, line.size, ignore_volatile);
+        side.ids[i] =
+            ids.emplace(side.keys[i], (int)ids.size()).first->second;
+      }
+    }
+    Side &a = sides[0], &b = sides[1];
+    int na = (int)a.ids.size(), nb = (int)b.ids.size();
+    if (na == 0 && nb == 0)
+      break;
+    std::vector<LineDiffer::Op> ops = LineDiffer(a.ids, b.ids).Run();
+
+    // Commit through the last common line far enough from the end of both
+    // windows that more lines could not align it differently, else the
+    // first common line
+    size_t commit = ops.size();
+    int used_a = na, used_b = nb;
+    if (!a.eof || !b.eof) {
+      int limit_a = a.eof ? na : na - na / 4;
+      int limit_b = b.eof ? nb : nb - nb / 4;
+      size_t last = ops.size(), first = ops.size();
+      for (size_t i = 0; i < ops.size(); i++) {
+        if (ops[i].kind != '=')
+          continue;
+        if (first == ops.size())
+          first = i;
+        if (ops[i].a < limit_a && ops[i].b < limit_b)
+          last = i;
+      }
+      size_t at = last < ops.size() ? last : first;
+      if (at < ops.size()) {
+        commit = at + 1;
+        used_a = ops[at].a + 1;
+        used_b = ops[at].b + 1;
+      } else {
+        // Nothing in common: when one side's window shows up further on in
+        // the other, what lies before it there was inserted
+        long long in_a = probe(a, b), in_b = probe(b, a);
+        if (in_a >= 0 && (in_b < 0 || in_a <= in_b)) {
+          used_b = 0;
+        } else if (in_b >= 0) {
+          used_a = 0;
+        } else {
+          used_a = a.eof ? 0 : std::max(1, na / 2);
+          used_b = b.eof ? 0 : std::max(1, nb / 2);
+        }
+      }
+    }
+    for (size_t i = 0; i < commit && !builder.Full(); i++) {
+      const LineDiffer::Op &op = ops[i];
+      if (op.kind == '=')
+        builder.Same(text(a, op.a), text(b, op.b));
+      else if (op.kind == '-' && op.a < used_a)
+        builder.Gone(text(a, op.a));
+      else if (op.kind == '+' && op.b < used_b)
+        builder.Come(text(b, op.b));
+    }
+    a.pos = a.starts[used_a];
+    b.pos = b.starts[used_b];
+    a.line += used_a;
+    b.line += used_b;
+    files[0].Release(a.pos);
+    files[1].Release(b.pos);
+    if (progress) {
+      double total = (double)a.size + (double)b.size;
+      double done = (double)a.pos + (double)b.pos;
+      progress->store(total > 0 ? (int)(done * 1000 / total) : 1000,
+                      std::memory_order_relaxed);
+    }
+    if (a.eof && b.eof && used_a == na && used_b == nb)
+      break;
+  }
+  builder.Finish();
+  out.orig_lines = sides[0].line;
+  out.mod_lines = sides[1].line;
+  return true;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                     RESOURCE USAGE                    //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+bool ParseDockerStats(const JsonValue &stats, DockerStatsReading &out) {
+  const JsonValue *mem = stats.Find("memory_stats");
+  if (!mem || !mem->Find("usage"))
+    return false;
+  out = DockerStatsReading();
+  // Same working set as `docker stats`: usage less the inactive page cache
+  // (cgroup v2 reports inactive_file, v1 total_inactive_file)
+  out.mem_bytes = mem->GetNumber("usage");
+  if (const JsonValue *detail = mem->Find("stats")) {
+    double cache = detail->Find("inactive_file")
+                       ? detail->GetNumber("inactive_file")
+                       : detail->GetNumber("total_inactive_file");
+    if (cache < out.mem_bytes)
+      out.mem_bytes -= cache;
+  }
+  if (const JsonValue *cpu = stats.Find("cpu_stats")) {
+    if (const JsonValue *usage = cpu->Find("cpu_usage"))
+      out.cpu_total = usage->GetNumber("total_usage");
+    out.cpu_system = cpu->GetNumber("system_cpu_usage");
+    out.online_cpus = std::max(1, cpu->GetInt("online_cpus", 1));
+  }
+  if (const JsonValue *nets = stats.Find("networks")) {
+    for (const auto &net : nets->items) {
+      out.net_rx_bytes += net.GetNumber("rx_bytes");
+      out.net_tx_bytes += net.GetNumber("tx_bytes");
+    }
+  }
+  const JsonValue *blkio = stats.Find("blkio_stats");
+  const JsonValue *io =
+      blkio ? blkio->Find("io_service_bytes_recursive") : nullptr;
+  if (io && io->type == JsonValue::Array) {
+    for (const auto &entry : io->items) {
+      std::string op = entry.GetString("op");
+      if (op == "read" || op == "Read")
+        out.blk_read_bytes += entry.GetNumber("value");
+      else if (op == "write" || op == "Write")
+        out.blk_write_bytes += entry.GetNumber("value");
+    }
+  }
+  return true;
+}
+
+double DockerCpuPercent(const DockerStatsReading &prev,
+                        const DockerStatsReading &cur) {
+  double cpu = cur.cpu_total - prev.cpu_total;
+  double system = cur.cpu_system - prev.cpu_system;
+  if (cpu <= 0.0 || system <= 0.0)
+    return 0.0;
+  return cpu / system * cur.online_cpus * 100.0;
+}
+
+double ParseDockerSize(std::string_view text) {
+  while (!text.empty() && text.front() == ' ')
+    text.remove_prefix(1);
+  while (!text.empty() && text.back() == ' ')
+    text.remove_suffix(1);
+  std::string number;
+  size_t i = 0;
+  while (i < text.size() && (isdigit((unsigned char)text[i]) || text[i] == '.'))
+    number += text[i++];
+  if (number.empty())
+    return -1.0;
+  std::string_view unit = text.substr(i);
+  static const struct {
+    const char *unit;
+    double scale;
+  } kUnits[] = {
+      {"B", 1.0},   {"kB", 1e3},    {"KB", 1e3},
+      {"MB", 1e6},  {"GB", 1e9},    {"TB", 1e12},
+      {"KiB", 0x1p10}, {"MiB", 0x1p20}, {"GiB", 0x1p30}, {"TiB", 0x1p40}};
+  for (const auto &u : kUnits)
+    if (unit == u.unit)
+      return atof(number.c_str()) * u.scale;
+  return -1.0;
+}
+
+std::string FormatDockerSize(double bytes) {
+  static const char *units[] = {"B", "kB", "MB", "GB", "TB", "PB"};
+  int u = 0;
+  while (bytes >= 1000.0 && u < 5) {
+    bytes /= 1000.0;
+    u++;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3g%s", bytes, units[u]);
+  return buf;
+}
+
+bool ParseDockerStatsRow(std::string_view row, ResourceSample &sample) {
+  std::string_view fields[4];
+  for (int i = 0; i < 4; i++) {
+    size_t bar = i < 3 ? row.find('|') : row.size();
+    if (bar == std::string_view::npos)
+      return false;
+    fields[i] = row.substr(0, bar);
+    row.remove_prefix(std::min(row.size(), bar + 1));
+  }
+  // "a / b" pairs: memory is used / limit, the I/O fields are in / out
+  double pair[3][2];
+  for (int i = 0; i < 3; i++) {
+    std::string_view text = fields[i + 1];
+    size_t slash = text.find('/');
+    if (slash == std::string_view::npos)
+      return false;
+    pair[i][0] = ParseDockerSize(text.substr(0, slash));
+    pair[i][1] = ParseDockerSize(text.substr(slash + 1));
+    if (pair[i][0] < 0 || pair[i][1] < 0)
+      return false;
+  }
+  const double mib = 1024.0 * 1024.0;
+  sample.cpu_pct = (float)atof(std::string(fields[0]).c_str());
+  sample.mem_mib = (float)(pair[0][0] / mib);
+  sample.net_rx_mib = (float)(pair[1][0] / mib);
+  sample.net_tx_mib = (float)(pair[1][1] / mib);
+  sample.blk_read_mib = (float)(pair[2][0] / mib);
+  sample.blk_write_mib = (float)(pair[2][1] / mib);
+  return true;
+}
+
+std::string PackageProxySpec(int mode, const std::string &fleet_url,
+                             bool local) {
+  if (mode == 1)
+    return "auto";
+  if (mode != 2)
+    return std::string();
+  if (!local) {
+    // Only a plain URL; the script is handed it as one word
+    if (fleet_url.compare(0, 7, "http://") != 0 ||
+        fleet_url.find_first_of(" \t'\"\\$`") != std::string::npos)
+      return std::string();
+    return fleet_url;
+  }
+  // The port in http://host:port[/...], 80 without one
+  size_t host = fleet_url.compare(0, 7, "http://") == 0 ? 7 : 0;
+  size_t end = fleet_url.find('/', host);
+  std::string authority = fleet_url.substr(host, end - host);
+  size_t colon = authority.rfind(':');
+  int port = 80;
+  if (colon != std::string::npos && authority.find(']', colon) ==
+                                         std::string::npos) {
+    port = atoi(authority.c_str() + colon + 1);
+    if (port <= 0 || port > 65535)
+      port = 80;
+  }
+  return "auto:" + std::to_string(port);
+}
+
+bool ParseProxyCacheCount(std::string_view row, ProxyCacheCount &out) {
+  std::string_view fields[3];
+  for (auto &field : fields) {
+    size_t start = row.find_first_not_of(" \t");
+    if (start == std::string_view::npos)
+      return false;
+    row.remove_prefix(start);
+    size_t end = std::min(row.find_first_of(" \t"), row.size());
+    field = row.substr(0, end);
+    row.remove_prefix(end);
+  }
+  if (fields[0].find_first_not_of("0123456789") != std::string_view::npos)
+    return false;
+  out.requests = strtoull(std::string(fields[0]).c_str(), nullptr, 10);
+  out.registry = std::string(fields[1]);
+  out.status = std::string(fields[2]);
+  return true;
+}
+
+bool ProxyCacheHit(std::string_view status) {
+  return status == "HIT" || status == "STALE" || status == "UPDATING" ||
+         status == "REVALIDATED";
+}
+
+void ResourceEnvelopes::Record(const std::string &key, const std::string &run,
+                               float peak_cpu_pct, float peak_mem_mib) {
+  if (peak_cpu_pct <= 0.0f && peak_mem_mib <= 0.0f)
+    return; // never sampled
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::deque<Peak> &peaks = peaks_[key];
+  for (auto &p : peaks) {
+    if (p.run == run) {
+      p.cpu_pct = peak_cpu_pct;
+      p.mem_mib = peak_mem_mib;
+      return;
+    }
+  }
+  peaks.push_back({run, peak_cpu_pct, peak_mem_mib});
+  if (peaks.size() > kHistory)
+    peaks.pop_front();
+}
+
+ResourceEnvelope ResourceEnvelopes::For(const std::string &key, int cpus,
+                                        uint64_t mem_total_mib) {
+  ResourceEnvelope env;
+  env.pids = kPidsLimit;
+  double max_cpus = std::max(1.0, cpus / 2.0);
+  uint64_t max_mib = 0; // unlimited when the host size is unknown
+  if (mem_total_mib != 0) {
+    uint64_t spare = mem_total_mib > kHostReserveMib
+                         ? mem_total_mib - kHostReserveMib
+                         : 0;
+    max_mib = std::max(kMinMemoryMib, std::min(mem_total_mib / 2, spare));
+  }
+  float cpu_pct = 0.0f, mem_mib = 0.0f;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = peaks_.find(key);
+    if (it != peaks_.end()) {
+      for (const auto &p : it->second) {
+        cpu_pct = std::max(cpu_pct, p.cpu_pct);
+        mem_mib = std::max(mem_mib, p.mem_mib);
+      }
+    }
+  }
+  env.cpus = max_cpus;
+  if (cpu_pct > 0.0f) {
+    // To a tenth of a core, which is what docker run --cpus reads cleanly
+    double want = std::ceil(cpu_pct / 100.0 * kHeadroom * 10.0) / 10.0;
+    env.cpus = std::min(max_cpus, std::max(1.0, want));
+  }
+  env.memory_mib = max_mib;
+  if (mem_mib > 0.0f) {
+    env.expected_mib = (uint64_t)std::ceil(mem_mib);
+    uint64_t want = (uint64_t)std::ceil(mem_mib * kHeadroom);
+    env.memory_mib = std::max(kMinMemoryMib, want);
+    if (max_mib != 0)
+      env.memory_mib = std::min(env.memory_mib, max_mib);
+  }
+  return env;
+}
+
+void DurationModel::Average::Add(double value) {
+  seconds = runs == 0 ? value : seconds + kWeight * (value - seconds);
+  runs++;
+}
+
+void DurationModel::Add(Estimate &estimate, double seconds,
+                        const std::map<std::string, double> &phases) {
+  estimate.run.Add(seconds);
+  for (const auto &phase : phases)
+    estimate.phases[phase.first].Add(phase.second);
+}
+
+void DurationModel::Record(const std::string &task, const std::string &mode,
+                           const std::string &run, double seconds,
+                           const std::vector<PhaseTiming> &phases) {
+  if (seconds <= 0.0)
+    return;
+  // A phase the script timed more than once counts with its total
+  std::map<std::string, double> totals;
+  for (const auto &phase : phases)
+    if (phase.end_ms >= phase.start_ms && phase.end_ms != 0)
+      totals[phase.name] += (phase.end_ms - phase.start_ms) / 1000.0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!seen_.insert(run).second)
+    return;
+  Add(tasks_[task + "|" + mode], seconds, totals);
+  Add(modes_[mode], seconds, totals);
+}
+
+double DurationModel::Expected(const std::string &task,
+                               const std::string &mode) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = tasks_.find(task + "|" + mode);
+  if (it != tasks_.end())
+    return it->second.run.seconds;
+  auto m = modes_.find(mode);
+  return m != modes_.end() ? m->second.run.seconds : -1.0;
+}
+
+double DurationModel::ExpectedPhase(const std::string &task,
+                                    const std::string &mode,
+                                    const std::string &phase) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto *estimates : {&tasks_, &modes_}) {
+    auto it = estimates->find(estimates == &tasks_ ? task + "|" + mode : mode);
+    if (it == estimates->end())
+      continue;
+    auto p = it->second.phases.find(phase);
+    if (p != it->second.phases.end())
+      return p->second.seconds;
+  }
+  return -1.0;
+}
+
+void DurationSketch::Add(double ms) {
+  // Bucket i holds (kGrowth^(i-1), kGrowth^i]; up to a millisecond is 0
+  double index = ms > 1.0 ? ceil(log(ms) / log(kGrowth)) : 0.0;
+  uint16_t i = (uint16_t)std::min(index, 65535.0);
+  auto it = std::lower_bound(
+      buckets_.begin(), buckets_.end(), i,
+      [](const std::pair<uint16_t, uint32_t> &b, uint16_t v) {
+        return b.first < v;
+      });
+  if (it != buckets_.end() && it->first == i)
+    it->second++;
+  else
+    buckets_.insert(it, {i, 1});
+  count_++;
+}
+
+void DurationSketch::Merge(const DurationSketch &other) {
+  if (other.count_ == 0)
+    return;
+  std::vector<std::pair<uint16_t, uint32_t>> merged;
+  merged.reserve(buckets_.size() + other.buckets_.size());
+  auto a = buckets_.cbegin(), b = other.buckets_.cbegin();
+  while (a != buckets_.end() || b != other.buckets_.end()) {
+    if (b == other.buckets_.end() ||
+        (a != buckets_.end() && a->first < b->first)) {
+      merged.push_back(*a++);
+    } else if (a == buckets_.end() || b->first < a->first) {
+      merged.push_back(*b++);
+    } else {
+      merged.push_back({a->first, a->second + b->second});
+      a++;
+      b++;
+    }
+  }
+  buckets_ = std::move(merged);
+  count_ += other.count_;
+}
+
+double DurationSketch::Quantile(double q) const {
+  if (count_ == 0)
+    return 0.0;
+  // The sample of rank ceil(q * count), at its bucket's midpoint
+  uint64_t rank = (uint64_t)std::max(1.0, ceil(q * count_));
+  uint64_t seen = 0;
+  for (const auto &bucket : buckets_) {
+    seen += bucket.second;
+    if (seen >= rank)
+      return bucket.first == 0
+                 ? 1.0
+                 : 2.0 * pow(kGrowth, bucket.first) / (kGrowth + 1.0);
+  }
+  return 2.0 * pow(kGrowth, buckets_.back().first) / (kGrowth + 1.0);
+}
+
+std::vector<std::string> FailureSignatures(const FailureSummary &summary) {
+  static const size_t kMaxSignature = 120;
+  std::vector<std::string> out;
+  for (const auto &name : summary.failed_tests)
+    out.push_back("test " + name);
+  for (const auto &error : summary.api_errors)
+    out.push_back(error);
+  if (out.empty() && !summary.error_block.empty()) {
+    const std::string &line = summary.error_block.front();
+    std::string masked;
+    for (size_t i = 0; i < line.size() && masked.size() < kMaxSignature;) {
+      size_t j = i;
+      bool digits = false, letters = false;
+      for (; j < line.size() && isxdigit((unsigned char)line[j]); j++) {
+        if (isdigit((unsigned char)line[j]))
+          digits = true;
+        else
+          letters = true;
+      }
+      // A number, or a hex id (a hash, container or image id)
+      if (digits && (!letters || j - i >= 8)) {
+        masked += '#';
+        i = j;
+      } else if (j > i) {
+        masked.append(line, i, j - i);
+        i = j;
+      } else {
+        masked += line[i++];
+      }
+    }
+    out.push_back("error: " + masked);
+  }
+  if (out.empty() && !summary.exit_codes.empty())
+    out.push_back("exit code " + std::to_string(summary.exit_codes.front()));
+  return out;
+}
+
+void RunAnalytics::RecordRun(const std::string &run, const RunRecord &rec) {
+  if (rec.ended <= 0)
+    return;
+  bool passed = rec.exit_code == 0 && rec.verification != "failed";
+  double seconds =
+      rec.started > 0 ? (double)std::max(0LL, rec.ended - rec.started) : 0.0;
+  std::map<std::string, double> phase_ms; // a phase timed twice counts once
+  for (const auto &phase : rec.phases)
+    if (phase.end_ms >= phase.start_ms && phase.end_ms != 0)
+      phase_ms[phase.name] += (double)(phase.end_ms - phase.start_ms);
+  auto phase_seconds = [&](const char *prefix) {
+    double total = 0.0;
+    for (const auto &phase : phase_ms)
+      if (phase.first.compare(0, strlen(prefix), prefix) == 0)
+        total += phase.second / 1000.0;
+    return total;
+  };
+  bool built = phase_ms.count("build_image") != 0;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!runs_seen_.insert(run).second)
+    return;
+  for (Bucket *bucket : {&days_[rec.ended / 86400], &all_}) {
+    TaskStats &task = bucket->tasks[{rec.task, rec.mode}];
+    task.runs++;
+    task.passed += passed;
+    task.seconds += seconds;
+    if (!passed)
+      task.failed_seconds += seconds;
+    if (seconds > 0.0)
+      task.durations.Add(seconds * 1000.0);
+    for (const auto &phase : phase_ms) {
+      PhaseStats &stats = bucket->phases[phase.first];
+      stats.seconds += phase.second / 1000.0;
+      stats.durations.Add(phase.second);
+    }
+    // A run with an image that it did not build found it cached
+    if (built || !rec.image.empty()) {
+      CacheRow &image = bucket->caches[kImageCache];
+      image.lookups++;
+      image.hits += !built;
+      image.miss_seconds += phase_seconds("build_image");
+    }
+    if (!rec.verification.empty()) {
+      CacheRow &verify = bucket->caches[kVerifyCache];
+      verify.lookups++;
+      verify.hits += !rec.verify_cached.empty();
+      if (rec.verify_cached.empty())
+        verify.miss_seconds += phase_seconds("verification");
+    }
+    if (!rec.audit.empty()) {
+      CacheRow &audit = bucket->caches[kAuditCache];
+      audit.lookups++;
+      audit.hits += !rec.audit_cached.empty();
+      if (rec.audit_cached.empty())
+        audit.miss_seconds += phase_seconds("gemini_audit");
+    }
+  }
+  version_++;
+}
+
+void RunAnalytics::RecordFailure(const std::string &run,
+                                 const RunRecord &rec) {
+  if (rec.ended <= 0)
+    return;
+  std::vector<std::string> signatures = FailureSignatures(rec.failure);
+  if (signatures.empty())
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!failures_seen_.insert(run).second)
+    return;
+  for (Bucket *bucket : {&days_[rec.ended / 86400], &all_}) {
+    for (const auto &signature : signatures) {
+      FailureStats &stats = bucket->failures[signature];
+      stats.runs++;
+      stats.last = std::max(stats.last, rec.ended);
+      stats.tasks.insert(rec.task);
+    }
+  }
+  version_++;
+}
+
+void RunAnalytics::Merge(Bucket &into, const Bucket &from) {
+  for (const auto &task : from.tasks) {
+    TaskStats &stats = into.tasks[task.first];
+    stats.runs += task.second.runs;
+    stats.passed += task.second.passed;
+    stats.seconds += task.second.seconds;
+    stats.failed_seconds += task.second.failed_seconds;
+    stats.durations.Merge(task.second.durations);
+  }
+  for (const auto &phase : from.phases) {
+    PhaseStats &stats = into.phases[phase.first];
+    stats.seconds += phase.second.seconds;
+    stats.durations.Merge(phase.second.durations);
+  }
+  for (const auto &failure : from.failures) {
+    FailureStats &stats = into.failures[failure.first];
+    stats.runs += failure.second.runs;
+    stats.last = std::max(stats.last, failure.second.last);
+    stats.tasks.insert(failure.second.tasks.begin(),
+                       failure.second.tasks.end());
+  }
+  for (int i = 0; i < kCacheCount; i++) {
+    into.caches[i].lookups += from.caches[i].lookups;
+    into.caches[i].hits += from.caches[i].hits;
+    into.caches[i].miss_seconds += from.caches[i].miss_seconds;
+  }
+}
+
+RunAnalytics::Report RunAnalytics::Query(int days, long long now) const {
+  Report report;
+  Bucket window;
+  const Bucket *source = &all_;
+  std::lock_guard<std::mutex> lock(mutex_);
+  report.version = version_.load();
+  if (days > 0) {
+    long long today = now / 86400;
+    for (auto it = days_.lower_bound(today - days + 1); it != days_.end();
+         ++it)
+      Merge(window, it->second);
+    source = &window;
+  }
+  for (const auto &task : source->tasks) {
+    TaskRow row;
+    row.task = task.first.first;
+    row.mode = task.first.second;
+    row.runs = task.second.runs;
+    row.passed = task.second.passed;
+    row.seconds = task.second.seconds;
+    row.failed_seconds = task.second.failed_seconds;
+    row.p50_s = task.second.durations.Quantile(0.5) / 1000.0;
+    row.p95_s = task.second.durations.Quantile(0.95) / 1000.0;
+    report.runs += row.runs;
+    report.passed += row.passed;
+    report.seconds += row.seconds;
+    report.tasks.push_back(std::move(row));
+  }
+  for (const auto &phase : source->phases) {
+    PhaseRow row;
+    row.name = phase.first;
+    row.runs = (int)phase.second.durations.count();
+    row.seconds = phase.second.seconds;
+    row.p50_s = phase.second.durations.Quantile(0.5) / 1000.0;
+    row.p95_s = phase.second.durations.Quantile(0.95) / 1000.0;
+    report.phases.push_back(std::move(row));
+  }
+  for (const auto &failure : source->failures) {
+    FailureRow row;
+    row.signature = failure.first;
+    row.runs = failure.second.runs;
+    row.tasks = (int)failure.second.tasks.size();
+    row.last = failure.second.last;
+    report.failures.push_back(std::move(row));
+  }
+  for (int i = 0; i < kCacheCount; i++)
+    report.caches[i] = source->caches[i];
+  std::sort(report.tasks.begin(), report.tasks.end(),
+            [](const TaskRow &a, const TaskRow &b) {
+              return a.failed_seconds != b.failed_seconds
+                         ? a.failed_seconds > b.failed_seconds
+                         : a.seconds > b.seconds;
+            });
+  std::sort(report.phases.begin(), report.phases.end(),
+            [](const PhaseRow &a, const PhaseRow &b) {
+              return a.seconds > b.seconds;
+            });
+  std::sort(report.failures.begin(), report.failures.end(),
+            [](const FailureRow &a, const FailureRow &b) {
+              return a.runs != b.runs ? a.runs > b.runs : a.last > b.last;
+            });
+  return report;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                      KUBERNETES                       //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+bool ParseKubeEndpoint(const std::string &endpoint, KubeTarget &target) {
+  size_t scheme = strlen(kKubeScheme);
+  if (endpoint.compare(0, scheme, kKubeScheme) != 0)
+    return false;
+  std::string rest = endpoint.substr(scheme);
+  size_t slash = rest.find('/');
+  target.context = rest.substr(0, slash);
+  target.ns =
+      slash == std::string::npos ? std::string() : rest.substr(slash + 1);
+  while (!target.ns.empty() && target.ns.back() == '/')
+    target.ns.pop_back();
+  if (target.ns.empty())
+    target.ns = "default";
+  return true;
+}
+
+std::string KubeScriptTarget(const KubeTarget &target) {
+  return target.context + "/" + target.ns;
+}
+
+bool IsClusterWorker(const std::string &endpoint) {
+  KubeTarget target;
+  return ParseKubeEndpoint(endpoint, target);
+}
+
+std::string FormatDockerWorker(const DockerWorker &worker) {
+  return std::to_string(worker.slots) + ":" + worker.endpoint;
+}
+
+bool ParseDockerWorker(const std::string &text, DockerWorker &worker) {
+  size_t colon = text.find(':');
+  if (colon == 0 || colon == std::string::npos || colon + 1 >= text.size())
+    return false;
+  int slots = 0;
+  for (size_t i = 0; i < colon; i++) {
+    if (text[i] < '0' || text[i] > '9' || slots > kClusterWorkerMaxSlots)
+      return false;
+    slots = slots * 10 + (text[i] - '0');
+  }
+  std::string endpoint = text.substr(colon + 1);
+  int max_slots = IsClusterWorker(endpoint) ? kClusterWorkerMaxSlots
+                                            : kDockerWorkerMaxSlots;
+  if (slots < 1 || slots > max_slots)
+    return false;
+  worker.slots = slots;
+  worker.endpoint = endpoint;
+  return true;
+}
+
+std::vector<std::string>
+DockerWorkerEnvironment(const std::string &endpoint) {
+  if (endpoint.empty())
+    return {};
+  KubeTarget target;
+  if (ParseKubeEndpoint(endpoint, target)) {
+    char cpus[32];
+    snprintf(cpus, sizeof(cpus), "%g", kClusterRunCpus);
+    return {"AUTOBUILD_K8S=" + KubeScriptTarget(target),
+            std::string("AUTOBUILD_K8S_CPUS=") + cpus,
+            "AUTOBUILD_K8S_MEMORY=" + std::to_string(kClusterRunMib)};
+  }
+  if (endpoint.find("://") != std::string::npos)
+    return {"DOCKER_HOST=" + endpoint};
+  return {"DOCKER_HOST=", "DOCKER_CONTEXT=" + endpoint};
+}
+
+std::string DockerWorkerPrefix(const std::string &endpoint) {
+  std::string cmd;
+  for (const auto &var : DockerWorkerEnvironment(endpoint)) {
+    size_t eq = var.find('=');
+    cmd += var.substr(0, eq + 1) + "'" + var.substr(eq + 1) + "' ";
+  }
+  return cmd;
+}
+
+static std::string KubectlPrefix(const KubeTarget &target) {
+  std::string cmd = "kubectl";
+  if (!target.context.empty())
+    cmd += " --context '" + target.context + "'";
+  return cmd;
+}
+
+std::string KubeNodesCommand(const KubeTarget &target) {
+  return KubectlPrefix(target) + " get nodes -o json";
+}
+
+// Pods of every namespace count: they all take from the same nodes
+std::string KubePodsCommand(const KubeTarget &target) {
+  return KubectlPrefix(target) +
+         " get pods --all-namespaces --field-selector="
+         "status.phase!=Succeeded,status.phase!=Failed -o json";
+}
+
+double ParseKubeQuantity(std::string_view text) {
+  text = TrimSpace(text);
+  size_t i = 0;
+  while (i < text.size() &&
+         (isdigit((unsigned char)text[i]) || text[i] == '.'))
+    i++;
+  if (i == 0)
+    return -1.0;
+  double value = atof(std::string(text.substr(0, i)).c_str());
+  std::string_view unit = text.substr(i);
+  // A decimal exponent ("1e3") rather than the exa suffix ("1E")
+  if (unit.size() >= 2 && (unit[0] == 'e' || unit[0] == 'E') &&
+      (isdigit((unsigned char)unit[1]) || unit[1] == '-' || unit[1] == '+')) {
+    char *end = nullptr;
+    std::string exponent(unit.substr(1));
+    long e = strtol(exponent.c_str(), &end, 10);
+    if (*end != '\0')
+      return -1.0;
+    return value * std::pow(10.0, (double)e);
+  }
+  static const struct {
+    const char *unit;
+    double scale;
+  } kUnits[] = {{"", 1.0},        {"n", 1e-9},     {"u", 1e-6},
+                {"m", 1e-3},      {"k", 1e3},      {"M", 1e6},
+                {"G", 1e9},       {"T", 1e12},     {"P", 1e15},
+                {"E", 1e18},      {"Ki", 0x1p10},  {"Mi", 0x1p20},
+                {"Gi", 0x1p30},   {"Ti", 0x1p40},  {"Pi", 0x1p50},
+                {"Ei", 0x1p60}};
+  for (const auto &u : kUnits)
+    if (unit == u.unit)
+      return value * u.scale;
+  return -1.0;
+}
+
+// CPU (cores) and memory (bytes) of a resources.requests or
+// status.allocatable object; absent or unreadable figures are 0
+static void KubeResources(const JsonValue *resources, double &cpus,
+                          double &bytes) {
+  cpus = bytes = 0.0;
+  if (!resources)
+    return;
+  cpus = std::max(0.0, ParseKubeQuantity(resources->GetString("cpu")));
+  bytes = std::max(0.0, ParseKubeQuantity(resources->GetString("memory")));
+}
+
+// What a pod holds on its node: its containers together, or its largest
+// init container if that is more (init containers run one at a time)
+static void KubePodRequests(const JsonValue &pod, double &cpus,
+                            double &bytes) {
+  cpus = bytes = 0.0;
+  const JsonValue *spec = pod.Find("spec");
+  if (!spec)
+    return;
+  auto requests = [](const JsonValue &container, double &c, double &b) {
+    const JsonValue *res = container.Find("resources");
+    KubeResources(res ? res->Find("requests") : nullptr, c, b);
+  };
+  if (const JsonValue *containers = spec->Find("containers")) {
+    for (const auto &container : containers->items) {
+      double c, b;
+      requests(container, c, b);
+      cpus += c;
+      bytes += b;
+    }
+  }
+  if (const JsonValue *inits = spec->Find("initContainers")) {
+    for (const auto &container : inits->items) {
+      double c, b;
+      requests(container, c, b);
+      cpus = std::max(cpus, c);
+      bytes = std::max(bytes, b);
+    }
+  }
+}
+
+bool ReadClusterCapacity(const JsonValue &nodes, const JsonValue &pods,
+                         ClusterCapacity &capacity) {
+  capacity = ClusterCapacity();
+  const JsonValue *node_items = nodes.Find("items");
+  if (!node_items || node_items->type != JsonValue::Array)
+    return false;
+  std::map<std::string, size_t> by_name;
+  for (const auto &node : node_items->items) {
+    const JsonValue *spec = node.Find("spec");
+    const JsonValue *status = node.Find("status");
+    if (!status || (spec && spec->GetBool("unschedulable", false)))
+      continue;
+    bool ready = false;
+    if (const JsonValue *conditions = status->Find("conditions"))
+      for (const auto &condition : conditions->items)
+        if (condition.GetString("type") == "Ready")
+          ready = condition.GetString("status") == "True";
+    if (!ready)
+      continue;
+    double cpus, bytes;
+    KubeResources(status->Find("allocatable"), cpus, bytes);
+    ClusterCapacity::Node entry;
+    entry.cpus = cpus;
+    entry.mib = (uint64_t)(bytes / 0x1p20);
+    const JsonValue *metadata = node.Find("metadata");
+    by_name[metadata ? metadata->GetString("name") : std::string()] =
+        capacity.nodes.size();
+    capacity.nodes.push_back(entry);
+  }
+  const JsonValue *pod_items = pods.Find("items");
+  if (!pod_items)
+    return true;
+  for (const auto &pod : pod_items->items) {
+    double cpus, bytes;
+    KubePodRequests(pod, cpus, bytes);
+    const JsonValue *spec = pod.Find("spec");
+    std::string node = spec ? spec->GetString("nodeName") : std::string();
+    uint64_t mib = (uint64_t)std::ceil(bytes / 0x1p20);
+    if (node.empty()) {
+      capacity.pending_cpus += cpus;
+      capacity.pending_mib += mib;
+      continue;
+    }
+    auto it = by_name.find(node);
+    if (it == by_name.end())
+      continue; // on a node that takes no new pods
+    capacity.nodes[it->second].requested_cpus += cpus;
+    capacity.nodes[it->second].requested_mib += mib;
+  }
+  return true;
+}
+
+int ClusterFreeRuns(const ClusterCapacity &capacity, double cpus,
+                    uint64_t mib) {
+  double run_cpus = cpus + kClusterRunnerCpus;
+  double run_mib = (double)(mib + kClusterRunnerMib);
+  long long runs = 0;
+  // A pod fits on one node or not at all
+  for (const auto &node : capacity.nodes) {
+    double free_cpus = node.cpus - node.requested_cpus;
+    double free_mib = (double)node.mib - (double)node.requested_mib;
+    if (free_cpus < run_cpus || free_mib < run_mib)
+      continue;
+    runs += (long long)std::min(std::floor(free_cpus / run_cpus),
+                                std::floor(free_mib / run_mib));
+  }
+  // Pending pods take their share first (as runs' worth, rounded up)
+  runs -= (long long)std::max(std::ceil(capacity.pending_cpus / run_cpus),
+                              std::ceil(capacity.pending_mib / run_mib));
+  return (int)std::max(0LL, std::min(runs, (long long)INT32_MAX));
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                        METRICS                        //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+MetricsWriter &MetricsWriter::Family(const char *name, const char *type,
+                                     const char *help) {
+  name_ = name;
+  out_ += "# TYPE ";
+  out_ += name;
+  out_ += ' ';
+  out_ += type;
+  out_ += "\n# HELP ";
+  out_ += name;
+  out_ += ' ';
+  out_ += help;
+  out_ += '\n';
+  return *this;
+}
+
+MetricsWriter &MetricsWriter::Sample(const char *suffix, double value,
+                                     std::string_view labels) {
+  out_ += name_;
+  out_ += suffix;
+  if (!labels.empty()) {
+    out_ += '{';
+    out_.append(labels.data(), labels.size());
+    out_ += '}';
+  }
+  char buf[32];
+  // Integral values print without an exponent or fraction
+  if (value == (double)(long long)value && value < 1e15 && value > -1e15)
+    snprintf(buf, sizeof(buf), " %lld\n", (long long)value);
+  else
+    snprintf(buf, sizeof(buf), " %.6g\n", value);
+  out_ += buf;
+  return *this;
+}
+
+std::string MetricsWriter::Finish() {
+  out_ += "# EOF\n";
+  return std::move(out_);
+}
+
+std::string MetricLabel(const char *key, std::string_view value) {
+  std::string out = key;
+  out += "=\"";
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      out += '\\';
+    if (c == '\n') {
+      out += "\\n";
+      continue;
+    }
+    out += c;
+  }
+  out += '"';
+  return out;
+}
+
+#ifdef _WIN32
+using MetricsSocket = SOCKET;
+static const MetricsSocket kNoSocket = INVALID_SOCKET;
+static void CloseMetricsSocket(MetricsSocket s) { closesocket(s); }
+#else
+using MetricsSocket = int;
+static const MetricsSocket kNoSocket = -1;
+static void CloseMetricsSocket(MetricsSocket s) { close(s); }
+#endif
+
+// How often the accept loop checks for Stop(), and how long a client gets
+// to send its request
+static const int kMetricsPollMs = 250;
+static const int kMetricsRequestMs = 2000;
+
+// A socket listening on port on all interfaces, or kNoSocket
+static MetricsSocket ListenTcp(int port) {
+#ifdef _WIN32
+  WSADATA wsa;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+    return kNoSocket;
+#endif
+  MetricsSocket fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == kNoSocket)
+    return kNoSocket;
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons((unsigned short)port);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 8) != 0) {
+    CloseMetricsSocket(fd);
+    return kNoSocket;
+  }
+  return fd;
+}
+
+bool MetricsServer::Start(int port, RenderFn render) {
+  Stop();
+  if (port <= 0)
+    return true;
+  MetricsSocket fd = ListenTcp(port);
+  if (fd == kNoSocket)
+    return false;
+  render_ = std::move(render);
+  port_ = port;
+  stop_ = false;
+  thread_ = std::thread([this, fd]() { Run((intptr_t)fd); });
+  return true;
+}
+
+void MetricsServer::Stop() {
+  stop_ = true;
+  if (thread_.joinable())
+    thread_.join();
+  port_ = 0;
+}
+
+// Wait up to ms for fd to become readable
+static bool WaitReadable(MetricsSocket fd, int ms) {
+#ifdef _WIN32
+  WSAPOLLFD p = {fd, POLLRDNORM, 0};
+  return WSAPoll(&p, 1, ms) > 0;
+#else
+  struct pollfd p = {fd, POLLIN, 0};
+  return poll(&p, 1, ms) > 0;
+#endif
+}
+
+void MetricsServer::Run(intptr_t listen_fd) {
+  MetricsSocket fd = (MetricsSocket)listen_fd;
+  while (!stop_) {
+    if (!WaitReadable(fd, kMetricsPollMs))
+      continue;
+    MetricsSocket client = accept(fd, nullptr, nullptr);
+    if (client == kNoSocket)
+      continue;
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    // Read the request head; only its first line matters
+    std::string request;
+    char buf[1024];
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(kMetricsRequestMs);
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           request.size() < 8192 &&
+           std::chrono::steady_clock::now() < deadline &&
+           WaitReadable(client, kMetricsPollMs)) {
+      int n = (int)recv(client, buf, sizeof(buf), 0);
+      if (n <= 0)
+        break;
+      request.append(buf, n);
+    }
+    std::string status = "404 Not Found";
+    std::string type = "text/plain; charset=utf-8";
+    std::string body = "Not found; metrics are at /metrics\n";
+    if (request.compare(0, 13, "GET /metrics ") == 0 ||
+        request.compare(0, 13, "GET /metrics?") == 0) {
+      status = "200 OK";
+      type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+      body = render_();
+    }
+    std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: " +
+                           type + "\r\nContent-Length: " +
+                           std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body;
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL; // a client gone early is no SIGPIPE
+#else
+    const int flags = 0;
+#endif
+    size_t sent = 0;
+    while (sent < response.size()) {
+      int n = (int)send(client, response.data() + sent,
+                        (int)(response.size() - sent), flags);
+      if (n <= 0)
+        break;
+      sent += n;
+    }
+    CloseMetricsSocket(client);
+  }
+  CloseMetricsSocket(fd);
+}
+
+// How long the dashboard waits in poll, and so how soon a published line
+// reaches the browsers, and how often it takes a new snapshot
+static const int kDashboardTickMs = 100;
+static const int kDashboardStateMs = 1000;
+// Bytes of lines sent to one client per pass, so ring_mutex_ is only held
+// briefly however far behind the client is
+static const size_t kDashboardPumpBytes = 256 * 1024;
+static const size_t kDashboardMaxClients = 32;
+
+static const char kDashboardPage[] = R"HTML(<!doctype html>
+<html><head><meta charset="utf-8"><title>autobuild</title>
+<style>
+body{font:13px system-ui,sans-serif;margin:0;background:#1e1f22;color:#ddd}
+header{padding:8px 12px;background:#2b2d31}
+table{border-collapse:collapse;width:100%}
+td,th{padding:4px 12px;text-align:left;border-bottom:1px solid #333}
+tbody tr{cursor:pointer}
+tr.sel{background:#35373c}
+.bar{display:flex;width:240px;height:10px;background:#2b2d31}
+.bar span{height:10px;margin-right:1px;background:#5865f2}
+.bar .open{background:#3ba55d}
+.bar .fail,.err{color:#ed4245;background:#ed4245}
+.err{background:none}
+pre{margin:0;padding:8px 12px;height:50vh;overflow:auto;background:#111;
+font:12px monospace;white-space:pre-wrap}
+</style></head><body>
+<header><b>autobuild</b> &middot; <span id="status">connecting</span></header>
+<table><thead><tr><th>#</th><th>Task</th><th>Mode</th><th>Phase</th>
+<th>Status</th><th>Time</th><th>Phases</th></tr></thead>
+<tbody id="tasks"></tbody></table>
+<pre id="log"></pre>
+<script>
+const kTail = 1000; // lines kept per task
+let head = {}, tasks = [], logs = {}, selected = 0;
+const $ = id => document.getElementById(id);
+function esc(s) {
+  const named = {'&': '&amp;', '<': '&lt;', '>': '&gt;', '"': '&quot;'};
+  return String(s).replace(/[&<>"]/g, c => named[c]);
+}
+function fmt(ms) {
+  const s = Math.floor(ms / 1000);
+  return (s >= 3600 ? Math.floor(s / 3600) + 'h ' : '') +
+         (s >= 60 ? Math.floor(s / 60) % 60 + 'm ' : '') + s % 60 + 's';
+}
+function bar(t) {
+  if (!t.steps || !t.steps.length) return '';
+  const now = Date.now(), from = t.start[0];
+  let to = from + 1;
+  t.start.forEach((s, i) => to = Math.max(to, t.end[i] || now));
+  return '<div class="bar">' + t.steps.map((name, i) => {
+    const end = t.end[i] || now;
+    const cls = !t.end[i] ? 'open' : t.exit_codes[i] ? 'fail' : '';
+    return '<span class="' + cls + '" title="' + esc(name) + ' ' +
+           fmt(end - t.start[i]) + '" style="flex:' +
+           Math.max(end - t.start[i], 1) / (to - from) + '"></span>';
+  }).join('') + '</div>';
+}
+function drawTasks() {
+  $('status').textContent = (head.running || 0) + ' running, ' +
+                            (head.queued || 0) + ' queued';
+  if (!selected && tasks.length) selected = tasks[tasks.length - 1].id;
+  $('tasks').innerHTML = tasks.map(t =>
+    '<tr data-id="' + t.id + '"' + (t.id == selected ? ' class="sel"' : '') +
+    '><td>' + t.id + '</td><td>' + esc(t.name) + '</td><td>' +
+    esc(t.type) + '</td><td>' + esc(t.phase) + '</td><td' +
+    (!t.running && t.exit ? ' class="err"' : '') + '>' +
+    (t.running ? 'running' : 'exit ' + t.exit) + '</td><td>' +
+    fmt(t.ms) + '</td><td>' + bar(t) + '</td></tr>').join('');
+}
+function drawLog() {
+  const log = $('log');
+  const follow = log.scrollTop + log.clientHeight >= log.scrollHeight - 4;
+  log.innerHTML = (logs[selected] || []).map(esc).join('\n');
+  if (follow) log.scrollTop = log.scrollHeight;
+}
+let pending = false;
+function redrawLog() {
+  if (!pending) {
+    pending = true;
+    requestAnimationFrame(() => { pending = false; drawLog(); });
+  }
+}
+$('tasks').onclick = e => {
+  const row = e.target.closest('tr');
+  if (row) { selected = +row.dataset.id; drawTasks(); drawLog(); }
+};
+function append(task, text) {
+  const lines = logs[task] || (logs[task] = []);
+  lines.push(text);
+  if (lines.length > kTail) lines.splice(0, lines.length - kTail);
+  if (task == selected) redrawLog();
+}
+const events = new EventSource('events');
+events.onopen = () => { logs = {}; drawLog(); };
+events.onerror = () => { $('status').textContent = 'reconnecting'; };
+events.addEventListener('state', e => {
+  const rows = e.data.split('\n').filter(Boolean).map(r => JSON.parse(r));
+  head = rows.shift() || {};
+  tasks = rows;
+  drawTasks();
+});
+events.addEventListener('line', e => {
+  const l = JSON.parse(e.data);
+  append(l.task, l.log ? '[' + l.log + '] ' + l.text : l.text);
+});
+events.addEventListener('gap', e => {
+  const n = JSON.parse(e.data).lines;
+  for (const task in logs) append(task, '... ' + n + ' lines skipped ...');
+});
+</script></body></html>
+)HTML";
+
+// "event: <name>", a "data: " line per line of payload and the blank line
+// that ends the event
+static void AppendSseEvent(std::string &out, const char *name,
+                           std::string_view payload) {
+  out += "event: ";
+  out += name;
+  out += '\n';
+  while (!payload.empty()) {
+    size_t nl = payload.find('\n');
+    out += "data: ";
+    out.append(payload.data(), std::min(nl, payload.size()));
+    out += '\n';
+    payload.remove_prefix(nl == std::string_view::npos ? payload.size()
+                                                       : nl + 1);
+  }
+  out += '\n';
+}
+
+static bool SetNonBlocking(MetricsSocket fd) {
+#ifdef _WIN32
+  u_long on = 1;
+  return ioctlsocket(fd, FIONBIO, &on) == 0;
+#else
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Whether the socket call that just failed would only have blocked
+static bool SocketWouldBlock() {
+#ifdef _WIN32
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// Bytes of data a non-blocking socket took: 0 when it is full, -1 when the
+// connection is gone
+static long SendSome(MetricsSocket fd, const char *data, size_t size) {
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  long n = (long)send(fd, data, (int)std::min(size, (size_t)1 << 20), flags);
+  if (n >= 0)
+    return n;
+  return SocketWouldBlock() ? 0 : -1;
+}
+
+// Whether the Accept-Encoding line of a request head lists encoding
+static bool AcceptsEncoding(const std::string &head, const char *encoding) {
+  std::string lower(head);
+  for (char &ch : lower)
+    ch = (char)std::tolower((unsigned char)ch);
+  size_t at = lower.find("\r\naccept-encoding:");
+  if (at == std::string::npos)
+    return false;
+  size_t end = lower.find("\r\n", at + 2);
+  std::string_view line = std::string_view(lower).substr(
+      at, end == std::string::npos ? std::string_view::npos : end - at);
+  return line.find(encoding) != std::string_view::npos;
+}
+
+#ifdef AUTOBUILD_HAVE_ZSTD
+// Compress plain onto packed and flush, so the receiver can decode all of
+// it now; the stream's window carries over to the next call
+static bool PackZstd(ZSTD_CCtx *cctx, std::string_view plain,
+                     std::string &packed) {
+  ZSTD_inBuffer in = {plain.data(), plain.size(), 0};
+  size_t left = 0;
+  do {
+    size_t at = packed.size();
+    packed.resize(at + ZSTD_CStreamOutSize());
+    ZSTD_outBuffer out = {&packed[at], packed.size() - at, 0};
+    left = ZSTD_compressStream2(cctx, &out, &in, ZSTD_e_flush);
+    packed.resize(at + out.pos);
+    if (ZSTD_isError(left))
+      return false;
+  } while (left != 0 || in.pos < in.size);
+  return true;
+}
+#endif
+
+struct DashboardServer::Client {
+  MetricsSocket fd = kNoSocket;
+  std::string request; // head of the request, until it is answered
+  std::chrono::steady_clock::time_point deadline;
+  bool answered = false;
+  bool streaming = false; // on /events
+  // The response (head or whole page) and gap notices, sent before anything
+  // else queued
+  std::string out;
+  size_t out_sent = 0;
+  // "state" event being sent and the number of the last one taken
+  std::shared_ptr<const std::string> state;
+  size_t state_sent = 0;
+  uint64_t state_version = 0;
+  // Next ring line and how much of it went out
+  uint64_t cursor = 0;
+  size_t offset = 0;
+#ifdef AUTOBUILD_HAVE_ZSTD
+  // A browser taking the stream as Content-Encoding: zstd (null for one
+  // that does not); packed is what of it is yet to be sent, starting with
+  // the plain response head
+  ZSTD_CCtx *zstd = nullptr;
+  std::string packed;
+  size_t packed_sent = 0;
+  ~Client() { ZSTD_freeCCtx(zstd); }
+#endif
+};
+
+bool DashboardServer::Start(int port, SnapshotFn snapshot) {
+  Stop();
+  if (port <= 0)
+    return true;
+  MetricsSocket fd = ListenTcp(port);
+  if (fd == kNoSocket)
+    return false;
+  snapshot_ = std::move(snapshot);
+  port_ = port;
+  stop_ = false;
+  serving_ = true;
+  thread_ = std::thread([this, fd]() { Run((intptr_t)fd); });
+  return true;
+}
+
+void DashboardServer::Stop() {
+  stop_ = true;
+  if (thread_.joinable())
+    thread_.join();
+  serving_ = false;
+  port_ = 0;
+  std::lock_guard<std::mutex> lock(ring_mutex_);
+  ring_.Clear();
+}
+
+void DashboardServer::Publish(int task, std::string_view log,
+                              std::string_view line) {
+  if (!serving_.load(std::memory_order_relaxed))
+    return;
+  JsonWriter json(true);
+  json.Number("task", task);
+  if (!log.empty())
+    json.String("log", log);
+  json.String("text", line);
+  std::string event = "event: line\ndata: " + json.Finish(); // ends in \n
+  event += '\n';
+  std::lock_guard<std::mutex> lock(ring_mutex_);
+  ring_.Append(event);
+}
+
+bool DashboardServer::HasOutput(const Client &c) {
+  if (c.out_sent < c.out.size())
+    return true;
+#ifdef AUTOBUILD_HAVE_ZSTD
+  if (c.packed_sent < c.packed.size())
+    return true;
+#endif
+  if (!c.streaming)
+    return false;
+  if ((c.state && c.state_sent < c.state->size()) ||
+      (state_ && c.state_version != state_version_))
+    return true;
+  std::lock_guard<std::mutex> lock(ring_mutex_);
+  return c.cursor < ring_.TotalAppended();
+}
+
+bool DashboardServer::Pump(Client &c) {
+#ifdef AUTOBUILD_HAVE_ZSTD
+  if (c.zstd)
+    return PumpPacked(c);
+#endif
+  size_t budget = kDashboardPumpBytes;
+  while (true) {
+    if (c.out_sent < c.out.size()) {
+      long n = SendSome(c.fd, c.out.data() + c.out_sent,
+                        c.out.size() - c.out_sent);
+      if (n < 0)
+        return false;
+      c.out_sent += (size_t)n;
+      if (c.out_sent < c.out.size())
+        return true;
+      c.out.clear();
+      c.out_sent = 0;
+    }
+    if (!c.streaming)
+      return false; // the page or an error went out
+    if (c.state && c.state_sent < c.state->size()) {
+      long n = SendSome(c.fd, c.state->data() + c.state_sent,
+                        c.state->size() - c.state_sent);
+      if (n < 0)
+        return false;
+      c.state_sent += (size_t)n;
+      if (c.state_sent < c.state->size())
+        return true;
+    }
+    // A newer snapshot goes out between two lines, never inside one
+    if (state_ && c.state_version != state_version_ && c.offset == 0) {
+      c.state = state_;
+      c.state_sent = 0;
+      c.state_version = state_version_;
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(ring_mutex_);
+    uint64_t total = ring_.TotalAppended();
+    uint64_t first = total - ring_.size();
+    if (c.cursor < first) {
+      // The ring moved past this client; end the event it was in the middle
+      // of, if any, and say how much it missed
+      if (c.offset > 0)
+        c.out = "\n\n";
+      AppendSseEvent(c.out, "gap",
+                     "{\"lines\": " + std::to_string(first - c.cursor) + "}");
+      c.cursor = first;
+      c.offset = 0;
+      continue;
+    }
+    while (c.cursor < total && budget > 0) {
+      std::string_view event = ring_[(size_t)(c.cursor - first)];
+      long n = SendSome(c.fd, event.data() + c.offset, event.size() - c.offset);
+      if (n < 0)
+        return false;
+      c.offset += (size_t)n;
+      budget -= std::min(budget, (size_t)n);
+      if (c.offset < event.size())
+        return true;
+      c.cursor++;
+      c.offset = 0;
+    }
+    return true;
+  }
+}
+
+#ifdef AUTOBUILD_HAVE_ZSTD
+// Pump for a client taking the stream compressed. What it has queued (gap
+// notices, a newer snapshot and up to kDashboardPumpBytes of lines) is
+// taken whole as one batch, compressed and flushed, so each tick's lines
+// leave in one zstd block that decodes as soon as it arrives.
+bool DashboardServer::PumpPacked(Client &c) {
+  std::string plain;
+  while (true) {
+    if (c.packed_sent < c.packed.size()) {
+      long n = SendSome(c.fd, c.packed.data() + c.packed_sent,
+                        c.packed.size() - c.packed_sent);
+      if (n < 0)
+        return false;
+      c.packed_sent += (size_t)n;
+      if (c.packed_sent < c.packed.size())
+        return true;
+      c.packed.clear();
+      c.packed_sent = 0;
+    }
+    if (!c.streaming)
+      return false; // the page went out
+    plain.swap(c.out);
+    if (state_ && c.state_version != state_version_) {
+      plain += *state_;
+      c.state_version = state_version_;
+    }
+    {
+      std::lock_guard<std::mutex> lock(ring_mutex_);
+      uint64_t total = ring_.TotalAppended();
+      uint64_t first = total - ring_.size();
+      if (c.cursor < first) {
+        AppendSseEvent(plain, "gap",
+                       "{\"lines\": " + std::to_string(first - c.cursor) +
+                           "}");
+        c.cursor = first;
+      }
+      while (c.cursor < total && plain.size() < kDashboardPumpBytes) {
+        std::string_view event = ring_[(size_t)(c.cursor - first)];
+        plain.append(event.data(), event.size());
+        c.cursor++;
+      }
+    }
+    if (plain.empty())
+      return true;
+    if (!PackZstd(c.zstd, plain, c.packed))
+      return false;
+    plain.clear();
+  }
+}
+#endif
+
+void DashboardServer::Run(intptr_t listen_fd) {
+  MetricsSocket fd = (MetricsSocket)listen_fd;
+  std::vector<std::unique_ptr<Client>> clients;
+#ifdef _WIN32
+  std::vector<WSAPOLLFD> fds;
+#else
+  std::vector<struct pollfd> fds;
+#endif
+  std::string snapshot;
+  auto next_state = std::chrono::steady_clock::now();
+  while (!stop_) {
+    auto now = std::chrono::steady_clock::now();
+    if (clients_ > 0 && now >= next_state) {
+      std::string next = snapshot_();
+      if (next != snapshot || !state_) {
+        snapshot = std::move(next);
+        auto event = std::make_shared<std::string>();
+        AppendSseEvent(*event, "state", snapshot);
+        state_ = std::move(event);
+        state_version_++;
+      }
+      next_state = now + std::chrono::milliseconds(kDashboardStateMs);
+    }
+
+    fds.clear();
+    fds.push_back({fd, POLLIN, 0});
+    for (const auto &c : clients) {
+      short events = POLLIN;
+      if (c->answered && HasOutput(*c))
+        events |= POLLOUT;
+      fds.push_back({c->fd, events, 0});
+    }
+#ifdef _WIN32
+    WSAPoll(fds.data(), (ULONG)fds.size(), kDashboardTickMs);
+#else
+    poll(fds.data(), (nfds_t)fds.size(), kDashboardTickMs);
+#endif
+    now = std::chrono::steady_clock::now();
+
+    size_t polled = clients.size();
+    if (fds[0].revents & POLLIN) {
+      MetricsSocket s = accept(fd, nullptr, nullptr);
+      if (s != kNoSocket) {
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        if (clients.size() >= kDashboardMaxClients || !SetNonBlocking(s)) {
+          CloseMetricsSocket(s);
+        } else {
+          clients.emplace_back(new Client);
+          clients.back()->fd = s;
+          clients.back()->deadline =
+              now + std::chrono::milliseconds(kMetricsRequestMs);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < clients.size();) {
+      Client &c = *clients[i];
+      short revents = i < polled ? fds[i + 1].revents : 0;
+      bool keep = !(revents & (POLLERR | POLLNVAL));
+      if (keep && (revents & (POLLIN | POLLHUP))) {
+        char buf[1024];
+        int n = (int)recv(c.fd, buf, sizeof(buf), 0);
+        if (n == 0 || (n < 0 && !SocketWouldBlock()))
+          keep = false; // closed, or the connection failed
+        else if (n > 0 && !c.answered)
+          c.request.append(buf, n);
+      }
+      if (keep && !c.answered &&
+          (c.request.find("\r\n\r\n") != std::string::npos ||
+           c.request.size() >= 8192)) {
+        c.answered = true;
+        bool zstd = AcceptsEncoding(c.request, "zstd");
+        if (c.request.compare(0, 12, "GET /events ") == 0) {
+          const char *head =
+              "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+              "Cache-Control: no-cache\r\n";
+          c.out = std::string(head) + "\r\nretry: 2000\n\n";
+#ifdef AUTOBUILD_HAVE_ZSTD
+          if (zstd && (c.zstd = ZSTD_createCCtx()) != nullptr) {
+            c.packed = std::string(head) +
+                       "Content-Encoding: zstd\r\nVary: Accept-Encoding"
+                       "\r\n\r\n";
+            c.out = "retry: 2000\n\n";
+          }
+#endif
+          c.streaming = true;
+          std::lock_guard<std::mutex> lock(ring_mutex_);
+          c.cursor = ring_.TotalAppended() - ring_.size();
+          clients_++;
+          next_state = now; // its first snapshot without waiting a tick
+        } else {
+          bool page = c.request.compare(0, 6, "GET / ") == 0 ||
+                      c.request.compare(0, 16, "GET /index.html ") == 0;
+          std::string body = page ? std::string(kDashboardPage)
+                                  : std::string("Not found\n");
+          const char *encoding = "";
+#ifdef AUTOBUILD_HAVE_ZSTD
+          if (page && zstd) {
+            std::string packed(ZSTD_compressBound(body.size()), '\0');
+            size_t n = ZSTD_compress(&packed[0], packed.size(), body.data(),
+                                     body.size(), ZSTD_CLEVEL_DEFAULT);
+            if (!ZSTD_isError(n)) {
+              packed.resize(n);
+              body.swap(packed);
+              encoding =
+                  "Content-Encoding: zstd\r\nVary: Accept-Encoding\r\n";
+            }
+          }
+#endif
+          c.out = std::string("HTTP/1.1 ") +
+                  (page ? "200 OK" : "404 Not Found") + "\r\nContent-Type: " +
+                  (page ? "text/html" : "text/plain") +
+                  "; charset=utf-8\r\n" + encoding + "Content-Length: " +
+                  std::to_string(body.size()) +
+                  "\r\nConnection: close\r\n\r\n" + body;
+        }
+        c.request.clear();
+        c.request.shrink_to_fit();
+      }
+      if (keep && !c.answered && now >= c.deadline)
+        keep = false;
+      if (keep && c.answered && (revents & POLLOUT))
+        keep = Pump(c);
+      if (keep) {
+        i++;
+        continue;
+      }
+      if (c.streaming)
+        clients_--;
+      CloseMetricsSocket(c.fd);
+      clients.erase(clients.begin() + i);
+      if (i < polled) {
+        fds.erase(fds.begin() + 1 + i);
+        polled--;
+      }
+    }
+  }
+  for (const auto &c : clients)
+    CloseMetricsSocket(c->fd);
+  clients_ = 0;
+  state_.reset();
+  CloseMetricsSocket(fd);
+}
+
+// How soon the submission server hands answers and followed output to
+// its clients, how much of a request line it waits for, and how many
+// clients it serves at once
+static const int kSubmitTickMs = 50;
+static const size_t kSubmitMaxRequest = 64 * 1024;
+static const size_t kSubmitMaxClients = 64;
+
+// A Unix socket listening at path, only open to this user, or kNoSocket.
+// A socket file left behind is replaced; one another process still
+// listens on is not.
+static MetricsSocket ListenUnix(const std::string &path) {
+#ifdef _WIN32
+  WSADATA wsa;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+    return kNoSocket;
+#endif
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    return kNoSocket;
+  memcpy(addr.sun_path, path.data(), path.size());
+  MetricsSocket probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe == kNoSocket)
+    return kNoSocket;
+  bool live = connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  CloseMetricsSocket(probe);
+  if (live)
+    return kNoSocket;
+#ifdef _WIN32
+  DeleteFileA(path.c_str());
+#else
+  unlink(path.c_str());
+#endif
+  MetricsSocket fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == kNoSocket)
+    return kNoSocket;
+  // Nobody can connect before listen, so the mode is set in time
+  bool ok = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+#ifndef _WIN32
+  ok = ok && chmod(path.c_str(), 0600) == 0;
+#endif
+  if (!ok || listen(fd, 16) != 0 || !SetNonBlocking(fd)) {
+    CloseMetricsSocket(fd);
+    return kNoSocket;
+  }
+  return fd;
+}
+
+struct SubmissionServer::Client {
+  MetricsSocket fd = kNoSocket;
+  uint64_t id = 0;
+  std::string in; // start of a request line
+  std::string out;
+  size_t out_sent = 0;
+  int pending = 0;     // requests not answered yet
+  bool eof = false;    // the client sent all it will; close once answered
+  uint64_t follow = 0; // run whose output it streams
+  uint64_t cursor = 0; // next ring entry for it
+};
+
+bool SubmissionServer::Start(const std::string &path) {
+  Stop();
+  if (path.empty())
+    return true;
+  MetricsSocket fd = ListenUnix(path);
+  if (fd == kNoSocket)
+    return false;
+  path_ = path;
+  stop_ = false;
+  thread_ = std::thread([this, fd]() { Run((intptr_t)fd); });
+  return true;
+}
+
+void SubmissionServer::Stop() {
+  stop_ = true;
+  if (thread_.joinable())
+    thread_.join();
+  if (!path_.empty()) {
+#ifdef _WIN32
+    DeleteFileA(path_.c_str());
+#else
+    unlink(path_.c_str());
+#endif
+  }
+  path_.clear();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests_.clear();
+    answers_.clear();
+  }
+  std::lock_guard<std::mutex> lock(ring_mutex_);
+  ring_.clear();
+  following_ = 0;
+}
+
+void SubmissionServer::Poll(const HandlerFn &handler) {
+  std::vector<Request> requests;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (requests_.empty())
+      return;
+    requests.swap(requests_);
+  }
+  std::vector<Answer> answers;
+  for (auto &request : requests) {
+    Answer answer{request.client, request.cursor, std::string(), 0};
+    JsonValue value;
+    if (!JsonParser(request.text).Parse(value) ||
+        value.type != JsonValue::Object) {
+      answer.text = JsonWriter(true)
+                        .Bool("ok", false)
+                        .String("error", "request is not a JSON object")
+                        .Finish();
+    } else {
+      // Counted first, so an end the handler just missed is still kept
+      following_++;
+      answer.text = handler(value, answer.follow);
+      if (answer.follow == 0)
+        following_--;
+    }
+    if (answer.text.empty() || answer.text.back() != '\n')
+      answer.text += '\n';
+    answers.push_back(std::move(answer));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &answer : answers)
+    answers_.push_back(std::move(answer));
+}
+
+void SubmissionServer::Append(uint64_t run, bool end, std::string event) {
+  std::lock_guard<std::mutex> lock(ring_mutex_);
+  ring_.push_back(Entry{run, end, std::move(event)});
+  if (ring_.size() > kRingLines)
+    ring_.pop_front();
+  appended_++;
+}
+
+void SubmissionServer::Publish(uint64_t run, std::string_view line) {
+  if (following_.load(std::memory_order_relaxed) == 0)
+    return;
+  Append(run, false,
+         JsonWriter(true)
+             .Number("run", (long long)run)
+             .String("text", line)
+             .Finish());
+}
+
+void SubmissionServer::Ended(uint64_t run, int exit_code) {
+  if (following_.load(std::memory_order_relaxed) == 0)
+    return;
+  Append(run, true,
+         JsonWriter(true)
+             .Number("run", (long long)run)
+             .Number("exit_code", exit_code)
+             .Finish());
+}
+
+void SubmissionServer::Fill(Client &c) {
+  std::lock_guard<std::mutex> lock(ring_mutex_);
+  uint64_t first = appended_ - ring_.size();
+  if (c.cursor < first) {
+    c.out += "{\"gap\": " + std::to_string(first - c.cursor) + "}\n";
+    c.cursor = first;
+  }
+  while (c.follow != 0 && c.cursor < appended_ &&
+         c.out.size() < kDashboardPumpBytes) {
+    const Entry &entry = ring_[(size_t)(c.cursor - first)];
+    c.cursor++;
+    if (entry.run != c.follow)
+      continue;
+    c.out += entry.event;
+    if (entry.end) {
+      c.follow = 0;
+      following_--;
+    }
+  }
+}
+
+void SubmissionServer::Run(intptr_t listen_fd) {
+  MetricsSocket fd = (MetricsSocket)listen_fd;
+  std::vector<std::unique_ptr<Client>> clients;
+  uint64_t next_id = 1;
+#ifdef _WIN32
+  std::vector<WSAPOLLFD> fds;
+#else
+  std::vector<struct pollfd> fds;
+#endif
+  while (!stop_) {
+    std::vector<Answer> answers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      answers.swap(answers_);
+    }
+    for (auto &answer : answers) {
+      auto it = std::find_if(clients.begin(), clients.end(),
+                             [&](const std::unique_ptr<Client> &c) {
+                               return c->id == answer.client;
+                             });
+      if (it == clients.end()) {
+        if (answer.follow != 0)
+          following_--;
+        continue;
+      }
+      Client &c = **it;
+      c.pending--;
+      c.out += answer.text;
+      if (answer.follow != 0) {
+        if (c.follow != 0)
+          following_--;
+        c.follow = answer.follow;
+        c.cursor = answer.cursor;
+      }
+    }
+    for (auto &c : clients)
+      if (c->follow != 0)
+        Fill(*c);
+
+    fds.clear();
+    fds.push_back({fd, POLLIN, 0});
+    for (const auto &c : clients) {
+      short events = c->eof ? 0 : POLLIN;
+      if (c->out_sent < c->out.size())
+        events |= POLLOUT;
+      fds.push_back({c->fd, events, 0});
+    }
+#ifdef _WIN32
+    WSAPoll(fds.data(), (ULONG)fds.size(), kSubmitTickMs);
+#else
+    poll(fds.data(), (nfds_t)fds.size(), kSubmitTickMs);
+#endif
+
+    size_t polled = clients.size();
+    if (fds[0].revents & POLLIN) {
+      MetricsSocket s = accept(fd, nullptr, nullptr);
+      if (s != kNoSocket) {
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        if (clients.size() >= kSubmitMaxClients || !SetNonBlocking(s)) {
+          CloseMetricsSocket(s);
+        } else {
+          clients.emplace_back(new Client);
+          clients.back()->fd = s;
+          clients.back()->id = next_id++;
+        }
+      }
+    }
+
+    std::vector<Request> requests;
+    for (size_t i = 0; i < clients.size();) {
+      Client &c = *clients[i];
+      short revents = i < polled ? fds[i + 1].revents : 0;
+      bool keep = !(revents & (POLLERR | POLLNVAL)) &&
+                  !(c.eof && (revents & POLLHUP)); // gone both ways
+      if (keep && !c.eof && (revents & (POLLIN | POLLHUP))) {
+        char buf[4096];
+        int n = (int)recv(c.fd, buf, sizeof(buf), 0);
+        if (n == 0) {
+          c.eof = true;
+        } else if (n < 0) {
+          keep = SocketWouldBlock();
+        } else {
+          c.in.append(buf, n);
+          uint64_t cursor;
+          {
+            std::lock_guard<std::mutex> lock(ring_mutex_);
+            cursor = appended_;
+          }
+          size_t start = 0, nl;
+          while ((nl = c.in.find('\n', start)) != std::string::npos) {
+            std::string line = c.in.substr(start, nl - start);
+            start = nl + 1;
+            if (!line.empty() && line.back() == '\r')
+              line.pop_back();
+            if (line.find_first_not_of(" \t") == std::string::npos)
+              continue;
+            requests.push_back(Request{c.id, cursor, std::move(line)});
+            c.pending++;
+          }
+          c.in.erase(0, start);
+          if (c.in.size() > kSubmitMaxRequest)
+            keep = false;
+        }
+      }
+      if (keep && c.out_sent < c.out.size() && (revents & POLLOUT)) {
+        long n = SendSome(c.fd, c.out.data() + c.out_sent,
+                          c.out.size() - c.out_sent);
+        if (n < 0) {
+          keep = false;
+        } else {
+          c.out_sent += (size_t)n;
+          if (c.out_sent == c.out.size()) {
+            c.out.clear();
+            c.out_sent = 0;
+          }
+        }
+      }
+      // A client that has said all it will is done once it has every answer
+      // and the end of the run it follows
+      if (keep && c.eof && c.pending == 0 && c.follow == 0 && c.out.empty())
+        keep = false;
+      if (keep) {
+        i++;
+        continue;
+      }
+      if (c.follow != 0)
+        following_--;
+      CloseMetricsSocket(c.fd);
+      clients.erase(clients.begin() + i);
+      if (i < polled) {
+        fds.erase(fds.begin() + 1 + i);
+        polled--;
+      }
+    }
+    if (!requests.empty()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto &request : requests)
+        requests_.push_back(std::move(request));
+    }
+  }
+  for (const auto &c : clients)
+    CloseMetricsSocket(c->fd);
+  CloseMetricsSocket(fd);
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                      RUN JOURNAL                      //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+static JournalRun *FindJournalRun(std::vector<JournalRun> &runs,
+                                  long long run) {
+  for (auto &r : runs)
+    if (r.run == run)
+      return &r;
+  return nullptr;
+}
+
+// Fold one journal line into runs
+static void ApplyJournalLine(std::string_view line,
+                             std::vector<JournalRun> &runs) {
+  JsonValue record;
+  if (!JsonParser(line).Parse(record) || record.type != JsonValue::Object)
+    return; // cut short by a crash
+  std::string event = record.GetString("event");
+  long long run = (long long)record.GetNumber("run");
+  if (event == "start") {
+    JournalRun r;
+    r.run = run;
+    r.name = record.GetString("name");
+    r.task_type = record.GetString("task_type");
+    r.group = record.GetString("group");
+    r.worker = record.GetString("worker");
+    r.spool = record.GetString("spool");
+    r.started_ms = (long long)record.GetNumber("started_ms");
+    if (JournalRun *old = FindJournalRun(runs, run))
+      *old = std::move(r);
+    else
+      runs.push_back(std::move(r));
+    return;
+  }
+  JournalRun *r = FindJournalRun(runs, run);
+  if (!r)
+    return;
+  if (event == "end") {
+    runs.erase(runs.begin() + (r - runs.data()));
+    return;
+  }
+  if (event != "set")
+    return;
+  std::string key = record.GetString("key");
+  std::string value = record.GetString("value");
+  if (key == "container")
+    r->container = value;
+  else if (key == "container_id")
+    r->container_id = value;
+  else if (key == "log_dir")
+    r->log_dir = value;
+  else if (key == "phase_log" &&
+           std::find(r->phase_logs.begin(), r->phase_logs.end(), value) ==
+               r->phase_logs.end())
+    r->phase_logs.push_back(value);
+}
+
+bool RunJournal::Open(const std::string &path,
+                      std::vector<JournalRun> &unfinished) {
+  Close();
+  unfinished.clear();
+  if (FILE *in = fopen(path.c_str(), "rb")) {
+    std::string text;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+      text.append(buf, n);
+    fclose(in);
+    std::string_view rest(text);
+    while (!rest.empty()) {
+      size_t nl = rest.find('\n');
+      ApplyJournalLine(rest.substr(0, nl), unfinished);
+      rest.remove_prefix(nl == std::string_view::npos ? rest.size() : nl + 1);
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_ = fopen(path.c_str(), "wb");
+  return file_ != nullptr;
+}
+
+void RunJournal::Close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_)
+    fclose(file_);
+  file_ = nullptr;
+}
+
+void RunJournal::Write(const std::string &line) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_)
+    return;
+  fwrite(line.data(), 1, line.size(), file_);
+  fflush(file_);
+}
+
+void RunJournal::Started(const JournalRun &run) {
+  Write(JsonWriter(true)
+            .String("event", "start")
+            .Number("run", run.run)
+            .String("name", run.name)
+            .String("task_type", run.task_type)
+            .String("group", run.group)
+            .String("worker", run.worker)
+            .String("spool", run.spool)
+            .Number("started_ms", run.started_ms)
+            .Finish());
+  if (!run.container.empty())
+    Set(run.run, "container", run.container);
+  if (!run.container_id.empty())
+    Set(run.run, "container_id", run.container_id);
+  if (!run.log_dir.empty())
+    Set(run.run, "log_dir", run.log_dir);
+  for (const auto &log : run.phase_logs)
+    Set(run.run, "phase_log", log);
+}
+
+void RunJournal::Set(long long run, const char *key, std::string_view value) {
+  Write(JsonWriter(true)
+            .String("event", "set")
+            .Number("run", run)
+            .String("key", key)
+            .String("value", value)
+            .Finish());
+}
+
+void RunJournal::Ended(long long run) {
+  Write(JsonWriter(true).String("event", "end").Number("run", run).Finish());
+}
+
+int ContainerRunning(const std::string &worker,
+                     const std::string &container_id) {
+  std::vector<std::string> out = RunShellLines(
+      DockerWorkerPrefix(worker) + "docker inspect -f '{{.State.Running}}' '" +
+      container_id + "' 2>&1");
+  std::string first = out.empty() ? std::string() : out.front();
+  if (first == "true")
+    return 1;
+  if (first == "false" || first.find("No such") != std::string::npos)
+    return 0;
+  return -1;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                     LOG STAGING                       //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Log staging: runs whose logs root is on a network filesystem write to a
+// local directory instead, and LogStager ships what they write to the real
+// root in the background. Interval between passes and the longest wait
+// after failures, the largest read and write, how long a file other than a
+// log must go unwritten before it is copied, how long a finished run stays
+// staged, and when a run the catalog never ends is given up on
+static const int kLogShipPassMs = 2000;
+static const int kLogShipMaxBackoffMs = 60 * 1000;
+static const size_t kLogShipChunk = 4 << 20;
+static const int kLogShipQuietSec = 2;
+static const int kLogStageLingerSec = 10 * 60;
+static const int kLogStageIdleSec = 24 * 60 * 60;
+// Object store parts: S3 wants 5 MiB or more in every part but the last
+static const uint64_t kObjectPartBytes = 8 << 20;
+
+
+bool IsNetworkFilesystem(std::string path) {
+#ifdef _WIN32
+  if (path.size() >= 2 && (path[0] == '\\' || path[0] == '/') &&
+      (path[1] == '\\' || path[1] == '/'))
+    return true; // UNC path
+  if (path.size() < 2 || path[1] != ':')
+    return false;
+  std::string drive = path.substr(0, 2) + "\\";
+  return GetDriveTypeA(drive.c_str()) == DRIVE_REMOTE;
+#else
+  while (!IsDirectory(path)) {
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos || path == "/")
+      return false;
+    path.resize(slash == 0 ? 1 : slash);
+  }
+  struct statfs fs{};
+  if (statfs(path.c_str(), &fs) != 0)
+    return false;
+#ifdef __APPLE__
+  return (fs.f_flags & MNT_LOCAL) == 0;
+#else
+  switch ((uint32_t)fs.f_type) {
+  case 0x6969:     // NFS
+  case 0x517B:     // SMB
+  case 0xFF534D42: // CIFS
+  case 0xFE534D42: // SMB2
+  case 0x5346414F: // AFS
+  case 0x00C36400: // Ceph
+  case 0x01021997: // 9P (WSL's view of Windows drives)
+    return true;
+  default:
+    return false;
+  }
+#endif
+#endif
+}
+
+bool PathWithin(const std::string &path, const std::string &dir) {
+  if (dir.empty() || path.size() < dir.size())
+    return false;
+  for (size_t i = 0; i < dir.size(); i++) {
+    char a = path[i], b = dir[i];
+    if ((a == '/' || a == '\\') && (b == '/' || b == '\\'))
+      continue;
+#ifdef _WIN32
+    a = (char)tolower((unsigned char)a);
+    b = (char)tolower((unsigned char)b);
+#endif
+    if (a != b)
+      return false;
+  }
+  return path.size() == dir.size() || path[dir.size()] == '/' ||
+         path[dir.size()] == '\\';
+}
+
+void LogStager::Configure(const LogStagingSettings &settings) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (settings == settings_ && configured_)
+    return;
+  settings_ = settings;
+  configured_ = true;
+  changed_ = true;
+  cv_.notify_one();
+  if (!thread_.joinable() && !stop_)
+    thread_ = std::thread([this]() {
+      if (hooks_.thread_start)
+        hooks_.thread_start();
+      Run();
+    });
+}
+
+std::string LogStager::Stage(const std::string &root) {
+  LogStagingSettings settings;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings = settings_;
+    if (settings.mode == LogStaging::Off || settings.dir.empty() ||
+        root.empty() || PathWithin(root, settings.dir))
+      return root;
+    for (const auto &staged : roots_)
+      if (staged.root == root)
+        return staged.staged;
+  }
+  if (settings.mode == LogStaging::Network &&
+      settings.object_store.empty() && !IsNetworkFilesystem(root))
+    return root;
+  std::string name = root;
+  while (!name.empty() && (name.back() == '/' || name.back() == '\\'))
+    name.pop_back();
+  size_t slash = name.find_last_of("/\\:");
+  if (slash != std::string::npos)
+    name = name.substr(slash + 1);
+  for (char &c : name)
+    if (!isalnum((unsigned char)c) && c != '-' && c != '_')
+      c = '_';
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx",
+           (unsigned long long)Fnv1a(kFnvOffset, root.data(), root.size()));
+  std::string staged =
+      settings.dir + kSeparator + name + "-" + std::string(hash, 8);
+  if (!CreateDirectoryRecursive(staged))
+    return root;
+  std::string marker = staged + "/.root";
+  if (!FileExists(marker)) {
+    std::ofstream out(marker, std::ios::binary);
+    out << root << "\n";
+    if (!out.flush())
+      return root;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  AddRootLocked(root, staged);
+  cv_.notify_one();
+  return staged;
+}
+
+std::string LogStager::Resolve(const std::string &path) {
+  if (path.empty() || FileExists(path))
+    return path;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &staged : roots_)
+    if (PathWithin(path, staged.staged))
+      return staged.root + path.substr(staged.staged.size());
+  return path;
+}
+
+LogStager::Status LogStager::GetStatus() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Status status = status_;
+  status.roots = roots_.size();
+  return status;
+}
+
+bool LogStager::Flush(int timeout_ms) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t after = passes_started_;
+  changed_ = true;
+  cv_.notify_one();
+  return pass_cv_.wait_until(lock, deadline, [&]() {
+    return stop_ || (passes_done_ > after && status_.backlog == 0 &&
+                     status_.error.empty());
+  }) && !stop_;
+}
+
+void LogStager::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_one();
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void LogStager::AddRootLocked(const std::string &root,
+                              const std::string &staged) {
+  for (const auto &known : roots_)
+    if (known.staged == staged)
+      return;
+  roots_.push_back({root, staged});
+}
+
+void LogStager::Discover(const std::string &dir) {
+  for (const auto &name : ListDirectory(dir, false)) {
+    std::string staged = dir + kSeparator + name;
+    std::ifstream in(staged + "/.root", std::ios::binary);
+    std::string root;
+    if (!std::getline(in, root) || root.empty())
+      continue;
+    std::lock_guard<std::mutex> lock(mutex_);
+    AddRootLocked(root, staged);
+  }
+}
+
+void LogStager::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::string discovered;
+  int backoff_ms = 0;
+  while (!stop_) {
+    changed_ = false;
+    passes_started_++;
+    LogStagingSettings settings = settings_;
+    lock.unlock();
+    if (settings.dir != discovered) {
+      Discover(settings.dir);
+      discovered = settings.dir;
+    }
+    lock.lock();
+    std::vector<StagedRoot> roots = roots_;
+    lock.unlock();
+
+    Status status;
+    bool ok = true;
+    for (const auto &root : roots) {
+      if (stop_)
+        break;
+      if (!ShipRoot(settings, root, shipping_[root.staged], status))
+        ok = false;
+    }
+    backlogged_ = settings.backlog_limit > 0 &&
+                  status.backlog > settings.backlog_limit;
+    backoff_ms = ok ? 0
+                    : std::min(kLogShipMaxBackoffMs,
+                               std::max(kLogShipPassMs, backoff_ms * 2));
+    if (hooks_.passed)
+      hooks_.passed();
+
+    lock.lock();
+    status_ = status;
+    passes_done_++;
+    pass_cv_.notify_all();
+    cv_.wait_for(lock,
+                 std::chrono::milliseconds(backoff_ms ? backoff_ms
+                                                      : kLogShipPassMs),
+                 [this]() { return stop_ || changed_; });
+  }
+}
+
+void LogStager::Collect(const std::string &staged, const std::string &prefix,
+                        std::vector<Entry> &out) {
+  std::string dir = prefix.empty() ? staged : staged + "/" + prefix;
+  bool spool = prefix == "spool";
+  for (const auto &name : ListDirectory(dir, true)) {
+    if (prefix.empty() && name == "catalog.jsonl")
+      continue;
+    struct stat st{};
+    std::string rel = prefix.empty() ? name : prefix + "/" + name;
+    if (stat((staged + "/" + rel).c_str(), &st) != 0)
+      continue;
+    auto ends = [&name](const char *suffix) {
+      size_t n = strlen(suffix);
+      return name.size() > n &&
+             name.compare(name.size() - n, n, suffix) == 0;
+    };
+    bool log = spool || ends(".log") || ends(".jsonl") || ends(".txt");
+    out.push_back({rel, (uint64_t)st.st_size, (long long)st.st_mtime, log,
+                   spool});
+  }
+  if (spool)
+    return;
+  for (const auto &name : ListDirectory(dir, false))
+    Collect(staged, prefix.empty() ? name : prefix + "/" + name, out);
+}
+
+std::string LogStager::RunKeyOf(const std::string &rel) {
+  size_t slash = 0;
+  for (int i = 0; i < 3; i++) {
+    slash = rel.find('/', slash);
+    if (slash == std::string::npos)
+      return "";
+    slash++;
+  }
+  return rel.substr(0, slash - 1);
+}
+
+uint64_t LogStager::SizeOf(const std::string &path) {
+  struct stat st{};
+  return stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+std::string LogStager::Parent(const std::string &path) {
+  size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? std::string() : path.substr(0, slash);
+}
+
+bool LogStager::CopyRange(const std::string &src, const std::string &dst,
+                          uint64_t from, uint64_t to) {
+  std::ifstream in(src, std::ios::binary);
+  std::fstream out(dst, from > 0
+                            ? std::ios::binary | std::ios::in | std::ios::out
+                            : std::ios::binary | std::ios::out |
+                                  std::ios::trunc);
+  if (!in || !out)
+    return false;
+  in.seekg((std::streamoff)from);
+  out.seekp((std::streamoff)from);
+  buffer_.resize(kLogShipChunk);
+  while (from < to && !stop_) {
+    size_t n = (size_t)std::min<uint64_t>(kLogShipChunk, to - from);
+    in.read(buffer_.data(), (std::streamsize)n);
+    if ((size_t)in.gcount() != n)
+      return false;
+    if (!out.write(buffer_.data(), (std::streamsize)n))
+      return false;
+    from += n;
+  }
+  return (bool)out.flush() && from == to;
+}
+
+bool LogStager::ShipFile(const std::string &root, const std::string &staged,
+                         const Entry &e, FileState &fs, time_t now,
+                         std::string &error) {
+  std::string src = staged + "/" + e.rel, dst = root + "/" + e.rel;
+  if (e.log) {
+    if (!fs.known) {
+      fs.created = FileExists(dst);
+      fs.shipped = fs.created ? SizeOf(dst) : 0;
+      fs.known = true;
+    }
+    if (fs.shipped > e.size)
+      fs.shipped = 0; // replaced by a shorter file
+    if (fs.created && fs.shipped == e.size)
+      return true;
+    if (!fs.created && !CreateDirectoryRecursive(Parent(dst))) {
+      error = "Could not create " + Parent(dst);
+      return false;
+    }
+    if (!CopyRange(src, dst, fs.shipped, e.size)) {
+      fs.known = false; // look at the destination again next time
+      error = "Could not write " + dst;
+      return false;
+    }
+    fs.created = true;
+    fs.shipped = e.size;
+    return true;
+  }
+  if (fs.size == e.size && fs.mtime == e.mtime)
+    return true;
+  if (now - e.mtime < kLogShipQuietSec)
+    return true; // still being written
+  std::string tmp = dst + ".part";
+  if ((!fs.created && !CreateDirectoryRecursive(Parent(dst))) ||
+      !CopyRange(src, tmp, 0, e.size)) {
+    remove(tmp.c_str());
+    error = "Could not write " + dst;
+    return false;
+  }
+#ifdef _WIN32
+  bool moved = MoveFileExA(tmp.c_str(), dst.c_str(),
+                           MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  bool moved = rename(tmp.c_str(), dst.c_str()) == 0;
+#endif
+  if (!moved) {
+    remove(tmp.c_str());
+    error = "Could not replace " + dst;
+    return false;
+  }
+  fs.created = true;
+  fs.size = e.size;
+  fs.mtime = e.mtime;
+  return true;
+}
+
+bool LogStager::Shipped(const Entry &e, const FileState &fs) {
+  return e.log ? fs.created && fs.shipped == e.size
+               : fs.size == e.size && fs.mtime == e.mtime;
+}
+
+std::string LogStager::ObjectUrl(const LogStagingSettings &s,
+                                 const std::string &key) {
+  std::string bucket = s.object_store.substr(5); // after s3://
+  std::string prefix;
+  size_t slash = bucket.find('/');
+  if (slash != std::string::npos) {
+    prefix = bucket.substr(slash + 1);
+    bucket.resize(slash);
+  }
+  while (!prefix.empty() && prefix.back() == '/')
+    prefix.pop_back();
+  std::string path = UrlEncode(prefix.empty() ? key : prefix + "/" + key,
+                               true);
+  if (!s.endpoint.empty()) {
+    std::string endpoint = s.endpoint;
+    while (!endpoint.empty() && endpoint.back() == '/')
+      endpoint.pop_back();
+    return endpoint + "/" + bucket + "/" + path; // path-style
+  }
+  return "https://" + bucket + ".s3." + Region(s) + ".amazonaws.com/" +
+         path;
+}
+
+std::string LogStager::Region(const LogStagingSettings &s) {
+  if (!s.region.empty())
+    return s.region;
+  for (const char *name : {"AWS_REGION", "AWS_DEFAULT_REGION"})
+    if (const char *v = getenv(name))
+      if (*v)
+        return v;
+  return "us-east-1";
+}
+
+bool LogStager::Curl(const LogStagingSettings &s, std::vector<std::string> args,
+                     std::vector<std::string> &out, std::string &error) {
+  const char *key = getenv("AWS_ACCESS_KEY_ID");
+  const char *secret = getenv("AWS_SECRET_ACCESS_KEY");
+  if (!key || !secret || !*key || !*secret) {
+    error = "Object store: AWS_ACCESS_KEY_ID and AWS_SECRET_ACCESS_KEY "
+            "are not set";
+    return false;
+  }
+  std::string config = "user = \"" + std::string(key) + ":" + secret +
+                       "\"\n";
+  if (const char *token = getenv("AWS_SESSION_TOKEN"))
+    if (*token)
+      config += "header = \"x-amz-security-token: " + std::string(token) +
+                "\"\n";
+  std::string config_path = s.dir + "/.curlrc";
+  if (config != curl_config_) {
+    std::ofstream f(config_path, std::ios::binary | std::ios::trunc);
+    f << config;
+    if (!f.flush()) {
+      error = "Could not write " + config_path;
+      return false;
+    }
+#ifndef _WIN32
+    chmod(config_path.c_str(), 0600);
+#endif
+    curl_config_ = config;
+  }
+  args.insert(args.begin(),
+              {"-sS", "-i", "--fail", "-K", config_path, "--aws-sigv4",
+               "aws:amz:" + Region(s) + ":s3"});
+#ifdef _WIN32
+  const char *system_root = getenv("SystemRoot");
+  std::string exe =
+      std::string(system_root ? system_root : "C:\\Windows") +
+      "\\System32\\curl.exe";
+  std::string line;
+  for (const auto &arg : args)
+    line += (line.empty() ? "\"" : " \"") + arg + "\"";
+  DWORD code = 0;
+  bool ran = RunHiddenCaptureExe(exe, line, out, code);
+#else
+  args.insert(args.begin(), "curl");
+  out.clear();
+  int code = 0;
+  bool ran = RunSpawned(
+      "curl", args, SpawnOptions(),
+      [&out](std::string_view ln) { out.emplace_back(ln); }, code);
+#endif
+  if (ran && code == 0)
+    return true;
+  error = "Object store: ";
+  error += !ran ? "curl could not be run"
+           : out.empty() ? "curl exited with " + std::to_string(code)
+                         : out.back();
+  return false;
+}
+
+std::string LogStager::HeaderValue(const std::vector<std::string> &out,
+                                   const char *name) {
+  size_t n = strlen(name);
+  for (const auto &line : out) {
+    if (line.size() > n && line[n] == ':' &&
+        StartsWithNoCase(line, name)) {
+      std::string value = line.substr(n + 1);
+      while (!value.empty() && isspace((unsigned char)value.front()))
+        value.erase(0, 1);
+      while (!value.empty() && isspace((unsigned char)value.back()))
+        value.pop_back();
+      return value;
+    }
+  }
+  return "";
+}
+
+bool LogStager::StartsWithNoCase(const std::string &s, const char *prefix) {
+  for (size_t i = 0; prefix[i]; i++)
+    if (i >= s.size() || tolower((unsigned char)s[i]) !=
+                             tolower((unsigned char)prefix[i]))
+      return false;
+  return true;
+}
+
+std::string LogStager::XmlValue(const std::vector<std::string> &out,
+                                const std::string &tag) {
+  std::string open = "<" + tag + ">", close = "</" + tag + ">";
+  for (const auto &line : out) {
+    size_t a = line.find(open);
+    if (a == std::string::npos)
+      continue;
+    size_t b = line.find(close, a);
+    if (b != std::string::npos)
+      return line.substr(a + open.size(), b - a - open.size());
+  }
+  return "";
+}
+
+bool LogStager::UploadPart(const LogStagingSettings &s, const std::string &src,
+                           const std::string &url, FileState &fs, uint64_t to,
+                           std::string &error) {
+  std::vector<std::string> out;
+  if (fs.upload_id.empty()) {
+    if (!Curl(s, {"-X", "POST", "-d", "", url + "?uploads"}, out, error))
+      return false;
+    fs.upload_id = XmlValue(out, "UploadId");
+    fs.etags.clear();
+    fs.uploaded = 0;
+    if (fs.upload_id.empty()) {
+      error = "Object store: no UploadId for " + url;
+      return false;
+    }
+  }
+  std::string part = s.dir + "/.part";
+  if (!CopyPart(src, part, fs.uploaded, to)) {
+    error = "Could not write " + part;
+    return false;
+  }
+  std::string query = "?partNumber=" + std::to_string(fs.etags.size() + 1) +
+                      "&uploadId=" + UrlEncode(fs.upload_id);
+  bool ok = Curl(s, {"-T", part, url + query}, out, error);
+  remove(part.c_str());
+  std::string etag = ok ? HeaderValue(out, "ETag") : std::string();
+  if (ok && etag.empty()) {
+    error = "Object store: no ETag for a part of " + url;
+    ok = false;
+  }
+  if (!ok)
+    return false;
+  fs.etags.push_back(etag);
+  fs.uploaded = to;
+  return true;
+}
+
+bool LogStager::CopyPart(const std::string &src, const std::string &part,
+                         uint64_t from, uint64_t to) {
+  std::ifstream in(src, std::ios::binary);
+  std::ofstream out(part, std::ios::binary | std::ios::trunc);
+  if (!in || !out)
+    return false;
+  in.seekg((std::streamoff)from);
+  buffer_.resize(kLogShipChunk);
+  while (from < to) {
+    size_t n = (size_t)std::min<uint64_t>(kLogShipChunk, to - from);
+    in.read(buffer_.data(), (std::streamsize)n);
+    if ((size_t)in.gcount() != n || !out.write(buffer_.data(), n))
+      return false;
+    from += n;
+  }
+  return (bool)out.flush();
+}
+
+bool LogStager::StoreFile(const LogStagingSettings &s,
+                          const std::string &staged, const Entry &e,
+                          FileState &fs, bool final, std::string &error) {
+  if (fs.stored == (long long)e.size)
+    return true;
+  std::string src = staged + "/" + e.rel, url = ObjectUrl(s, e.rel);
+  if (fs.uploaded > e.size) {
+    fs.upload_id.clear(); // the file was replaced; start over
+    fs.uploaded = 0;
+  }
+  if (e.log) {
+    while (e.size - fs.uploaded >= kObjectPartBytes && !stop_) {
+      if (!UploadPart(s, src, url, fs, fs.uploaded + kObjectPartBytes,
+                      error))
+        return false;
+    }
+  }
+  if (!final || stop_)
+    return true;
+  std::vector<std::string> out;
+  if (fs.upload_id.empty()) {
+    if (!Curl(s, {"-T", src, url}, out, error))
+      return false;
+  } else {
+    if (e.size > fs.uploaded &&
+        !UploadPart(s, src, url, fs, e.size, error))
+      return false;
+    std::string xml = "<CompleteMultipartUpload>";
+    for (size_t i = 0; i < fs.etags.size(); i++)
+      xml += "<Part><PartNumber>" + std::to_string(i + 1) +
+             "</PartNumber><ETag>" + fs.etags[i] + "</ETag></Part>";
+    xml += "</CompleteMultipartUpload>";
+    std::string body = s.dir + "/.complete";
+    {
+      std::ofstream f(body, std::ios::binary | std::ios::trunc);
+      f << xml;
+    }
+    bool ok = Curl(s,
+                   {"-X", "POST", "-H", "Content-Type: application/xml",
+                    "--data-binary", "@" + body,
+                    url + "?uploadId=" + UrlEncode(fs.upload_id)},
+                   out, error);
+    remove(body.c_str());
+    if (!ok)
+      return false;
+    // An error can come back with a 200 once the upload was accepted
+    if (XmlValue(out, "Code").size()) {
+      error = "Object store: " + XmlValue(out, "Code") + " completing " +
+              url;
+      fs.upload_id.clear();
+      fs.uploaded = 0;
+      return false;
+    }
+    fs.upload_id.clear();
+    fs.etags.clear();
+    fs.uploaded = 0;
+  }
+  fs.stored = (long long)e.size;
+  std::ofstream record(staged + "/.stored", std::ios::binary | std::ios::app);
+  record << e.rel << "\t" << e.size << "\n";
+  return true;
+}
+
+std::string LogStager::RewriteCatalogLine(std::string line,
+                                          const StagedRoot &root) {
+  auto escape = [](const std::string &s) {
+    std::string out;
+    for (char c : s) {
+      if (c == '\\' || c == '"')
+        out += '\\';
+      out += c;
+    }
+    return out;
+  };
+  std::vector<std::pair<std::string, std::string>> spellings = {
+      {root.staged, root.root}};
+#ifdef _WIN32
+  spellings.push_back(
+      {ConvertToUnixPath(root.staged), ConvertToUnixPath(root.root)});
+#endif
+  for (const auto &spelling : spellings) {
+    std::string from = "\"" + escape(spelling.first);
+    std::string to = "\"" + escape(spelling.second);
+    for (size_t at = line.find(from); at != std::string::npos;
+         at = line.find(from, at + to.size()))
+      line.replace(at, from.size(), to);
+  }
+  return line;
+}
+
+void LogStager::TrackRuns(Shipping &sh, const std::string &text, time_t now) {
+  size_t start = 0, eol;
+  while ((eol = text.find('\n', start)) != std::string::npos) {
+    JsonValue ev;
+    if (JsonParser(std::string_view(text.data() + start, eol - start))
+            .Parse(ev)) {
+      std::string key = RunCatalogKey(ev.GetString("run"));
+      std::string event = ev.GetString("event");
+      if (!key.empty() && event == "end")
+        sh.ended[key] = now;
+      else if (!key.empty() && event == "start")
+        sh.ended.erase(key); // begun again by a resume
+    }
+    start = eol + 1;
+  }
+}
+
+void LogStager::Load(const StagedRoot &root, Shipping &sh, time_t now) {
+  sh.loaded = true;
+  std::ifstream offset(root.staged + "/.catalog_shipped");
+  offset >> sh.catalog_shipped;
+  std::ifstream stored(root.staged + "/.stored", std::ios::binary);
+  std::string line;
+  while (std::getline(stored, line)) {
+    size_t tab = line.rfind('\t');
+    if (tab != std::string::npos)
+      sh.stored[line.substr(0, tab)] =
+          std::atoll(line.c_str() + tab + 1);
+  }
+  std::ifstream catalog(root.staged + "/catalog.jsonl", std::ios::binary);
+  std::string text(sh.catalog_shipped, '\0');
+  catalog.read(&text[0], (std::streamsize)text.size());
+  text.resize((size_t)catalog.gcount());
+  TrackRuns(sh, text, now);
+}
+
+bool LogStager::ShipCatalog(const StagedRoot &root, Shipping &sh, uint64_t end,
+                            time_t now, std::string &error) {
+  if (end <= sh.catalog_shipped)
+    return true;
+  std::ifstream in(root.staged + "/catalog.jsonl", std::ios::binary);
+  in.seekg((std::streamoff)sh.catalog_shipped);
+  std::string text((size_t)(end - sh.catalog_shipped), '\0');
+  in.read(&text[0], (std::streamsize)text.size());
+  text.resize((size_t)in.gcount());
+  text.resize(text.rfind('\n') + 1); // whole lines only (npos + 1 == 0)
+  if (text.empty())
+    return true;
+  std::string shipped;
+  size_t start = 0, eol;
+  while ((eol = text.find('\n', start)) != std::string::npos) {
+    shipped += RewriteCatalogLine(text.substr(start, eol - start + 1),
+                                  root);
+    start = eol + 1;
+  }
+  std::string path = root.root + "/catalog.jsonl";
+  // One write, as the script appends, so other writers' lines stay whole
+  FILE *f = fopen(path.c_str(), "ab");
+  bool ok = f && fwrite(shipped.data(), 1, shipped.size(), f) ==
+                     shipped.size();
+  ok = f && fclose(f) == 0 && ok;
+  if (!ok) {
+    error = "Could not write " + path;
+    return false;
+  }
+  sh.catalog_shipped += text.size();
+  std::ofstream(root.staged + "/.catalog_shipped", std::ios::trunc)
+      << sh.catalog_shipped;
+  TrackRuns(sh, text, now);
+  if (hooks_.touched)
+    hooks_.touched(root.root);
+  return true;
+}
+
+bool LogStager::ShipRoot(const LogStagingSettings &s, const StagedRoot &root,
+                         Shipping &sh, Status &status) {
+  time_t now = time(nullptr);
+  if (!sh.loaded)
+    Load(root, sh, now);
+  // Only catalog lines already written are shipped after the files
+  uint64_t catalog_end = SizeOf(root.staged + "/catalog.jsonl");
+  std::vector<Entry> entries;
+  Collect(root.staged, "", entries);
+  bool store = s.object_store.compare(0, 5, "s3://") == 0;
+
+  // Per run: whether all of it was shipped, and when it was last written
+  struct RunState {
+    bool done = true;
+    long long newest = 0;
+  };
+  std::map<std::string, RunState> runs;
+  std::set<std::string> touched;
+  std::map<std::string, FileState> files;
+  std::string error;
+  bool ok = true;
+  for (const auto &e : entries) {
+    FileState fs;
+    auto it = sh.files.find(e.rel);
+    if (it != sh.files.end()) {
+      fs = std::move(it->second);
+    } else {
+      auto stored = sh.stored.find(e.rel);
+      if (stored != sh.stored.end())
+        fs.stored = stored->second;
+    }
+    std::string key = e.spool ? std::string() : RunKeyOf(e.rel);
+    bool was_shipped = Shipped(e, fs);
+    if (ok && !stop_) {
+      ok = ShipFile(root.root, root.staged, e, fs, now, error);
+      if (ok && !was_shipped && Shipped(e, fs))
+        touched.insert(Parent(root.root + "/" + e.rel));
+    }
+    if (ok && !stop_ && store && !e.spool) {
+      auto ended = sh.ended.find(key);
+      bool final = now - e.mtime >= kLogShipQuietSec &&
+                   (ended != sh.ended.end() ||
+                    now - e.mtime >= kLogStageIdleSec);
+      ok = StoreFile(s, root.staged, e, fs, final, error);
+    }
+    bool done = Shipped(e, fs) && (!store || e.spool ||
+                                   fs.stored == (long long)e.size);
+    if (e.log)
+      status.backlog += e.size - std::min(e.size, fs.shipped);
+    else if (!Shipped(e, fs))
+      status.backlog += e.size;
+    if (store && !e.spool && fs.stored != (long long)e.size)
+      status.backlog += e.size - std::min(e.size, fs.uploaded);
+    if (!key.empty()) {
+      RunState &run = runs[key];
+      run.done = run.done && done;
+      run.newest = std::max(run.newest, e.mtime);
+    } else if (e.spool && done && e.mtime < started_) {
+      // The GUI's spool files of earlier sessions
+      if (remove((root.staged + "/" + e.rel).c_str()) == 0)
+        continue;
+    }
+    files[e.rel] = std::move(fs);
+  }
+  sh.files = std::move(files); // forgets files that went away
+  if (catalog_end > sh.catalog_shipped)
+    status.backlog += catalog_end - sh.catalog_shipped;
+  if (ok && !stop_)
+    ok = ShipCatalog(root, sh, catalog_end, now, error);
+  for (const auto &dir : touched)
+    if (hooks_.touched)
+      hooks_.touched(dir);
+
+  // Drop runs that ended a while ago (or were abandoned) and are shipped
+  for (const auto &kv : runs) {
+    const std::string &key = kv.first;
+    auto ended = sh.ended.find(key);
+    bool over = ended != sh.ended.end()
+                    ? now - ended->second >= kLogStageLingerSec
+                    : now - kv.second.newest >= kLogStageIdleSec;
+    if (!kv.second.done || !over)
+      continue;
+    std::string dir = root.staged + "/" + key;
+    if (!RemoveDirectoryRecursive(dir))
+      continue;
+    for (int up = 0; up < 2; up++) {
+      dir = Parent(dir);
+      if (!ListDirectory(dir, false).empty() ||
+          !ListDirectory(dir, true).empty() || rmdir(dir.c_str()) != 0)
+        break;
+    }
+    if (ended != sh.ended.end())
+      sh.ended.erase(ended);
+    for (auto it = sh.files.lower_bound(key + "/");
+         it != sh.files.end() && it->first.compare(0, key.size() + 1,
+                                                   key + "/") == 0;)
+      it = sh.files.erase(it);
+    if (hooks_.unstaged)
+      hooks_.unstaged(root.root + "/" + key);
+  }
+  if (!ok && status.error.empty())
+    status.error = error;
+  return ok;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                  RUN CATALOG EXPORT                   //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+std::string RunCatalogKey(const std::string &dir) {
+  std::vector<std::string> parts;
+  std::string part;
+  for (char c : dir + "/") {
+    if (c == '/' || c == '\\') {
+      if (!part.empty())
+        parts.push_back(part);
+      part.clear();
+    } else {
+      part += c;
+    }
+  }
+  if (parts.size() < 3)
+    return "";
+  size_t n = parts.size();
+  return parts[n - 3] + "/" + parts[n - 2] + "/" + parts[n - 1];
+}
+
+void ApplyRunEvent(RunRecord &rec, const JsonValue &ev) {
+  std::string event = ev.GetString("event");
+  if (event == "start") {
+    rec = RunRecord();
+    rec.task = ev.GetString("task");
+    rec.mode = ev.GetString("mode");
+    rec.container = ev.GetString("container");
+    rec.started = (long long)ev.GetNumber("started");
+  } else if (event == "end") {
+    rec.ended = (long long)ev.GetNumber("ended");
+    rec.exit_code = (int)ev.GetNumber("exit_code");
+    rec.verification = ev.GetString("verification");
+    rec.verify_cached = ev.GetString("verify_cached");
+    rec.audit = ev.GetString("audit");
+    rec.audit_cached = ev.GetString("audit_cached");
+    rec.image = ev.GetString("image");
+    rec.files.clear();
+    if (const JsonValue *files = ev.Find("files")) {
+      for (size_t i = 0; i < files->keys.size(); i++)
+        rec.files.emplace_back(files->keys[i],
+                               (long long)files->items[i].number);
+    }
+    rec.phases.clear();
+    if (const JsonValue *phases = ev.Find("phases")) {
+      for (const auto &item : phases->items) {
+        PhaseTiming phase;
+        phase.name = item.GetString("name");
+        phase.start_ms = (long long)item.GetNumber("start");
+        phase.end_ms = phase.start_ms + (long long)item.GetNumber("ms");
+        phase.exit_code = item.GetInt("exit_code", 0);
+        if (!phase.name.empty())
+          rec.phases.push_back(std::move(phase));
+      }
+    }
+  } else if (event == "summary") {
+    rec.failure.Read(ev);
+  } else if (event == "api") {
+    GeminiCallSummary call;
+    call.phase = ev.GetString("phase");
+    call.calls = ev.GetInt("calls", 0);
+    call.ms = (long long)ev.GetNumber("ms");
+    call.max_ms = (long long)ev.GetNumber("max_ms");
+    call.exit_code = ev.GetInt("exit_code", 0);
+    call.stats.retries = ev.GetInt("retries", 0);
+    call.stats.throttled = ev.GetInt("throttled", 0);
+    call.stats.errors = ev.GetInt("errors", 0);
+    call.stats.response_bytes = (uint64_t)ev.GetNumber("response_bytes");
+    if (!call.phase.empty())
+      rec.gemini.push_back(std::move(call));
+  } else if (event == "resources") {
+    rec.cpu_peak_pct =
+        std::max(rec.cpu_peak_pct, (float)ev.GetNumber("cpu_pct"));
+    rec.mem_peak_mib =
+        std::max(rec.mem_peak_mib, (float)ev.GetNumber("mem_mib"));
+  }
+}
+
+namespace {
+
+// The Parquet file is written by hand: PLAIN values, uncompressed, one
+// data page per column chunk, and the metadata in Thrift's compact
+// protocol. Field ids are those of parquet.thrift (apache/parquet-format).
+enum : uint8_t {
+  kThriftTrue = 1,
+  kThriftFalse = 2,
+  kThriftByte = 3,
+  kThriftI16 = 4,
+  kThriftI32 = 5,
+  kThriftI64 = 6,
+  kThriftDouble = 7,
+  kThriftBinary = 8,
+  kThriftList = 9,
+  kThriftSet = 10,
+  kThriftMap = 11,
+  kThriftStruct = 12,
+};
+
+class ThriftWriter {
+public:
+  // Writes a struct; End closes it
+  explicit ThriftWriter(std::string &out) : out_(out) { last_.push_back(0); }
+
+  ThriftWriter &I32(int id, int64_t v) {
+    Field(id, kThriftI32);
+    Int(v);
+    return *this;
+  }
+  ThriftWriter &I64(int id, int64_t v) {
+    Field(id, kThriftI64);
+    Int(v);
+    return *this;
+  }
+  ThriftWriter &Binary(int id, std::string_view v) {
+    Field(id, kThriftBinary);
+    Bytes(v);
+    return *this;
+  }
+  // A list field of n elements, which follow as Int, Bytes or Begin..End
+  ThriftWriter &List(int id, uint8_t type, size_t n) {
+    Field(id, kThriftList);
+    if (n < 15) {
+      out_ += (char)(n << 4 | type);
+    } else {
+      out_ += (char)(0xF0 | type);
+      Varint(n);
+    }
+    return *this;
+  }
+  ThriftWriter &Struct(int id) {
+    Field(id, kThriftStruct);
+    return Begin();
+  }
+  ThriftWriter &Begin() {
+    last_.push_back(0);
+    return *this;
+  }
+  ThriftWriter &End() {
+    out_ += '\0';
+    last_.pop_back();
+    return *this;
+  }
+  void Int(int64_t v) { Varint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); }
+  void Bytes(std::string_view v) {
+    Varint(v.size());
+    out_.append(v.data(), v.size());
+  }
+
+private:
+  void Varint(uint64_t v) {
+    char buf[10];
+    out_.append(buf, PutVarint(buf, v));
+  }
+  void Field(int id, uint8_t type) {
+    int delta = id - last_.back();
+    if (delta > 0 && delta <= 15) {
+      out_ += (char)(delta << 4 | type);
+    } else {
+      out_ += (char)type;
+      Int(id);
+    }
+    last_.back() = id;
+  }
+
+  std::string &out_;
+  std::vector<int> last_; // field id last written, per open struct
+};
+
+// Bounds-checked reader of the same; any malformed input makes ok() false
+class ThriftReader {
+public:
+  // Reads a struct; Next returns false at its end
+  explicit ThriftReader(std::string_view in) : in_(in) { last_.push_back(0); }
+
+  size_t pos() const { return pos_; }
+  bool ok() const { return ok_; }
+
+  // The next field of the struct being read; false at its end, which
+  // leaves it, or on malformed input
+  bool Next(int &id, uint8_t &type) {
+    uint8_t b;
+    if (last_.empty() || !Byte(b))
+      return Fail();
+    if (b == 0) {
+      last_.pop_back();
+      return false;
+    }
+    type = b & 0x0F;
+    if (b >> 4) {
+      id = last_.back() + (b >> 4);
+    } else {
+      int64_t v;
+      if (!Int(v))
+        return false;
+      id = (int)v;
+    }
+    last_.back() = id;
+    return true;
+  }
+  // Enter a struct element of a list
+  void Begin() { last_.push_back(0); }
+  bool Int(int64_t &v) {
+    uint64_t u;
+    if (!Varint(u))
+      return false;
+    v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return true;
+  }
+  bool Bytes(std::string_view &v) {
+    uint64_t n;
+    if (!Varint(n) || n > in_.size() - pos_)
+      return Fail();
+    v = in_.substr(pos_, (size_t)n);
+    pos_ += (size_t)n;
+    return true;
+  }
+  bool ListHeader(uint8_t &type, size_t &n) {
+    uint8_t b;
+    if (!Byte(b))
+      return false;
+    type = b & 0x0F;
+    uint64_t count = b >> 4;
+    if (count == 15 && !Varint(count))
+      return false;
+    // Every element takes a byte at least
+    if (count > in_.size() - pos_)
+      return Fail();
+    n = (size_t)count;
+    return true;
+  }
+  // Step over a value; a bool field's is in its header, a bool element's
+  // is a byte
+  bool Skip(uint8_t type, bool element = false, int depth = 0) {
+    if (depth > 32)
+      return Fail();
+    uint64_t v;
+    uint8_t b;
+    switch (type) {
+    case kThriftTrue:
+    case kThriftFalse:
+      return !element || Byte(b);
+    case kThriftByte:
+      return Byte(b);
+    case kThriftI16:
+    case kThriftI32:
+    case kThriftI64:
+      return Varint(v);
+    case kThriftDouble:
+      if (in_.size() - pos_ < 8)
+        return Fail();
+      pos_ += 8;
+      return true;
+    case kThriftBinary: {
+      std::string_view s;
+      return Bytes(s);
+    }
+    case kThriftList:
+    case kThriftSet: {
+      size_t n;
+      if (!ListHeader(b, n))
+        return false;
+      for (size_t i = 0; i < n; i++)
+        if (!Skip(b, true, depth + 1))
+          return false;
+      return true;
+    }
+    case kThriftMap: {
+      if (!Varint(v) || v > in_.size() - pos_)
+        return Fail();
+      if (v == 0)
+        return true;
+      if (!Byte(b))
+        return false;
+      for (uint64_t i = 0; i < v; i++)
+        if (!Skip(b >> 4, true, depth + 1) || !Skip(b & 0x0F, true, depth + 1))
+          return false;
+      return true;
+    }
+    case kThriftStruct: {
+      Begin();
+      int id;
+      while (Next(id, b))
+        if (!Skip(b, false, depth + 1))
+          return false;
+      return ok_;
+    }
+    default:
+      return Fail();
+    }
+  }
+
+private:
+  bool Fail() {
+    ok_ = false;
+    return false;
+  }
+  bool Byte(uint8_t &b) {
+    if (pos_ >= in_.size())
+      return Fail();
+    b = (uint8_t)in_[pos_++];
+    return true;
+  }
+  bool Varint(uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t b;
+      if (!Byte(b))
+        return false;
+      v |= (uint64_t)(b & 0x7F) << shift;
+      if (b < 0x80)
+        return true;
+    }
+    return Fail();
+  }
+
+  std::string_view in_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+  std::vector<int> last_;
+};
+
+// Physical types, repetitions and converted types of parquet.thrift
+enum : int8_t {
+  kPqGroup = -1,
+  kPqBoolean = 0,
+  kPqInt32 = 1,
+  kPqInt64 = 2,
+  kPqFloat = 4,
+  kPqDouble = 5,
+  kPqByteArray = 6,
+};
+enum : int8_t { kPqRequired = 0, kPqOptional = 1, kPqRepeated = 2 };
+enum : int8_t { kPqNone = -1, kPqUtf8 = 0, kPqList = 3, kPqTimestampMs = 9 };
+
+// One node of the schema; a group's children follow it, depth first
+struct ParquetNode {
+  const char *name;
+  int8_t type;
+  int8_t repetition;
+  int8_t converted;
+  int children;
+};
+
+// A row per run. Lists are the standard three levels, so DuckDB, pandas
+// and Spark read them as lists of strings or of structs.
+const ParquetNode kRunSchema[] = {
+    {"schema", kPqGroup, kPqRequired, kPqNone, 22},
+    {"run", kPqByteArray, kPqRequired, kPqUtf8, 0}, // "<task>/<run>/<mode>"
+    {"task", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"mode", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"container", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"image", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"started", kPqInt64, kPqRequired, kPqTimestampMs, 0},
+    {"ended", kPqInt64, kPqOptional, kPqTimestampMs, 0}, // null: never ended
+    {"duration_s", kPqDouble, kPqOptional, kPqNone, 0},
+    {"exit_code", kPqInt32, kPqOptional, kPqNone, 0},
+    {"verification", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"verify_cached", kPqBoolean, kPqRequired, kPqNone, 0},
+    {"audit", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"audit_cached", kPqBoolean, kPqRequired, kPqNone, 0},
+    {"log_bytes", kPqInt64, kPqRequired, kPqNone, 0},
+    {"cpu_peak_pct", kPqFloat, kPqOptional, kPqNone, 0},
+    {"mem_peak_mib", kPqFloat, kPqOptional, kPqNone, 0},
+    {"failure", kPqByteArray, kPqRequired, kPqUtf8, 0}, // headline
+    {"failed_test_count", kPqInt32, kPqRequired, kPqNone, 0},
+    {"failed_tests", kPqGroup, kPqRequired, kPqList, 1},
+    {"list", kPqGroup, kPqRepeated, kPqNone, 1},
+    {"element", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"api_errors", kPqGroup, kPqRequired, kPqList, 1},
+    {"list", kPqGroup, kPqRepeated, kPqNone, 1},
+    {"element", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"phases", kPqGroup, kPqRequired, kPqList, 1},
+    {"list", kPqGroup, kPqRepeated, kPqNone, 1},
+    {"element", kPqGroup, kPqRequired, kPqNone, 4},
+    {"name", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"start", kPqInt64, kPqRequired, kPqTimestampMs, 0},
+    {"ms", kPqInt64, kPqRequired, kPqNone, 0},
+    {"exit_code", kPqInt32, kPqRequired, kPqNone, 0},
+    {"gemini", kPqGroup, kPqRequired, kPqList, 1},
+    {"list", kPqGroup, kPqRepeated, kPqNone, 1},
+    {"element", kPqGroup, kPqRequired, kPqNone, 9},
+    {"phase", kPqByteArray, kPqRequired, kPqUtf8, 0},
+    {"calls", kPqInt32, kPqRequired, kPqNone, 0},
+    {"ms", kPqInt64, kPqRequired, kPqNone, 0},
+    {"max_ms", kPqInt64, kPqRequired, kPqNone, 0},
+    {"exit_code", kPqInt32, kPqRequired, kPqNone, 0},
+    {"retries", kPqInt32, kPqRequired, kPqNone, 0},
+    {"throttled", kPqInt32, kPqRequired, kPqNone, 0},
+    {"errors", kPqInt32, kPqRequired, kPqNone, 0},
+    {"response_bytes", kPqInt64, kPqRequired, kPqNone, 0},
+};
+
+// Rows per row group, row groups before a file is written over in full
+// (each export appends one or more), and the age of an export's lock at
+// which a crashed one is assumed to have left it
+const size_t kRowGroupRows = 8192;
+const size_t kMaxRowGroups = 256;
+const long long kExportLockStaleSec = 600;
+// A run that never ended is exported this long after it started
+const long long kExportStaleRunMs = 24LL * 3600 * 1000;
+// The footer's key-value metadata: the catalog offset the next export
+// reads from, the runs that start past it but were already exported, and
+// a hash of the catalog's first line to tell a replaced catalog
+const char kKeyOffset[] = "autobuild.catalog_offset";
+const char kKeyExported[] = "autobuild.catalog_exported";
+const char kKeyHead[] = "autobuild.catalog_head";
+
+void PutLittleEndian(std::string &out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    out += (char)(v >> (8 * i));
+}
+
+// One leaf column of a row group as it fills: its levels and values
+struct ParquetColumn {
+  std::vector<std::string> path;
+  int8_t type = kPqByteArray;
+  int max_def = 0;
+  int max_rep = 0;
+  std::vector<uint8_t> defs;
+  std::vector<uint8_t> reps;
+  std::string values; // PLAIN encoded
+  size_t count = 0;   // values and nulls
+  size_t nulls = 0;
+  size_t bits = 0; // booleans, packed eight to a byte
+  bool ranged = false;
+  int64_t min_int = 0, max_int = 0;
+  double min_real = 0.0, max_real = 0.0;
+
+  // rep is 1 for a list's elements after its first
+  void Levels(int rep, bool present) {
+    if (max_rep)
+      reps.push_back((uint8_t)rep);
+    if (max_def)
+      defs.push_back((uint8_t)(present ? max_def : max_def - 1));
+    count++;
+    if (!present)
+      nulls++;
+  }
+  // A null, or for a list column an empty list
+  void Null() { Levels(0, false); }
+  void String(std::string_view v, int rep = 0) {
+    Levels(rep, true);
+    PutLittleEndian(values, v.size(), 4);
+    values.append(v.data(), v.size());
+  }
+  void Bool(bool v, int rep = 0) {
+    Levels(rep, true);
+    if (bits % 8 == 0)
+      values += '\0';
+    if (v)
+      values.back() = (char)(values.back() | (1 << (bits % 8)));
+    bits++;
+  }
+  void Int32(int32_t v, int rep = 0) {
+    Levels(rep, true);
+    PutLittleEndian(values, (uint32_t)v, 4);
+    Range(v, 0.0);
+  }
+  void Int64(int64_t v, int rep = 0) {
+    Levels(rep, true);
+    PutLittleEndian(values, (uint64_t)v, 8);
+    Range(v, 0.0);
+  }
+  void Float(float v) {
+    Levels(0, true);
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    PutLittleEndian(values, u, 4);
+    Range(0, v);
+  }
+  void Double(double v) {
+    Levels(0, true);
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    PutLittleEndian(values, u, 8);
+    Range(0, v);
+  }
+  void Range(int64_t i, double d) {
+    if (!ranged || i < min_int)
+      min_int = i;
+    if (!ranged || i > max_int)
+      max_int = i;
+    if (!ranged || d < min_real)
+      min_real = d;
+    if (!ranged || d > max_real)
+      max_real = d;
+    ranged = true;
+  }
+  // A statistics bound as the column's PLAIN value
+  std::string Bound(bool max) const {
+    std::string out;
+    int64_t i = max ? max_int : min_int;
+    float f = (float)(max ? max_real : min_real);
+    double d = max ? max_real : min_real;
+    uint32_t u32;
+    uint64_t u64;
+    switch (type) {
+    case kPqInt32:
+      PutLittleEndian(out, (uint32_t)i, 4);
+      break;
+    case kPqInt64:
+      PutLittleEndian(out, (uint64_t)i, 8);
+      break;
+    case kPqFloat:
+      memcpy(&u32, &f, sizeof(u32));
+      PutLittleEndian(out, u32, 4);
+      break;
+    default:
+      memcpy(&u64, &d, sizeof(u64));
+      PutLittleEndian(out, u64, 8);
+      break;
+    }
+    return out;
+  }
+};
+
+// kRunSchema's leaves with the levels their paths imply
+std::vector<ParquetColumn> RunColumns() {
+  struct Group {
+    int left; // children not seen yet
+    int def;
+    int rep;
+  };
+  std::vector<Group> groups = {{kRunSchema[0].children, 0, 0}};
+  std::vector<std::string> path;
+  std::vector<ParquetColumn> cols;
+  for (size_t i = 1; i < std::size(kRunSchema); i++) {
+    const ParquetNode &node = kRunSchema[i];
+    groups.back().left--;
+    int def = groups.back().def + (node.repetition != kPqRequired);
+    int rep = groups.back().rep + (node.repetition == kPqRepeated);
+    if (node.type == kPqGroup) {
+      path.push_back(node.name);
+      groups.push_back({node.children, def, rep});
+      continue;
+    }
+    ParquetColumn col;
+    col.path = path;
+    col.path.push_back(node.name);
+    col.type = node.type;
+    col.max_def = def;
+    col.max_rep = rep;
+    cols.push_back(std::move(col));
+    while (groups.size() > 1 && groups.back().left == 0) {
+      groups.pop_back();
+      path.pop_back();
+    }
+  }
+  return cols;
+}
+
+void StringList(ParquetColumn &col, const std::vector<std::string> &items) {
+  if (items.empty())
+    col.Null();
+  for (size_t i = 0; i < items.size(); i++)
+    col.String(items[i], i ? 1 : 0);
+}
+
+// Append rec as a row, its values in kRunSchema's order
+void AddRunRow(std::vector<ParquetColumn> &cols, const std::string &key,
+               const RunRecord &rec) {
+  ParquetColumn *c = cols.data();
+  (c++)->String(key);
+  (c++)->String(rec.task);
+  (c++)->String(rec.mode);
+  (c++)->String(rec.container);
+  (c++)->String(rec.image);
+  (c++)->Int64(rec.started * 1000);
+  bool ended = rec.ended > 0;
+  if (ended)
+    (c++)->Int64(rec.ended * 1000);
+  else
+    (c++)->Null();
+  if (ended && rec.started > 0 && rec.ended >= rec.started)
+    (c++)->Double((double)(rec.ended - rec.started));
+  else
+    (c++)->Null();
+  if (ended)
+    (c++)->Int32(rec.exit_code);
+  else
+    (c++)->Null();
+  (c++)->String(rec.verification);
+  (c++)->Bool(!rec.verify_cached.empty());
+  (c++)->String(rec.audit);
+  (c++)->Bool(!rec.audit_cached.empty());
+  long long log_bytes = 0;
+  for (const auto &file : rec.files)
+    log_bytes += file.second;
+  (c++)->Int64(log_bytes);
+  for (float peak : {rec.cpu_peak_pct, rec.mem_peak_mib}) {
+    if (peak > 0.0f)
+      (c++)->Float(peak);
+    else
+      (c++)->Null();
+  }
+  (c++)->String(rec.failure.Headline());
+  (c++)->Int32(rec.failure.failed_test_count);
+  StringList(*c++, rec.failure.failed_tests);
+  StringList(*c++, rec.failure.api_errors);
+
+  ParquetColumn *p = c;
+  c += 4;
+  if (rec.phases.empty())
+    for (int j = 0; j < 4; j++)
+      p[j].Null();
+  for (size_t i = 0; i < rec.phases.size(); i++) {
+    const PhaseTiming &phase = rec.phases[i];
+    int rep = i ? 1 : 0;
+    p[0].String(phase.name, rep);
+    p[1].Int64(phase.start_ms, rep);
+    p[2].Int64(phase.end_ms ? phase.end_ms - phase.start_ms : 0, rep);
+    p[3].Int32(phase.exit_code, rep);
+  }
+
+  ParquetColumn *g = c;
+  if (rec.gemini.empty())
+    for (int j = 0; j < 9; j++)
+      g[j].Null();
+  for (size_t i = 0; i < rec.gemini.size(); i++) {
+    const GeminiCallSummary &call = rec.gemini[i];
+    int rep = i ? 1 : 0;
+    g[0].String(call.phase, rep);
+    g[1].Int32(call.calls, rep);
+    g[2].Int64(call.ms, rep);
+    g[3].Int64(call.max_ms, rep);
+    g[4].Int32(call.exit_code, rep);
+    g[5].Int32(call.stats.retries, rep);
+    g[6].Int32(call.stats.throttled, rep);
+    g[7].Int32(call.stats.errors, rep);
+    g[8].Int64((int64_t)call.stats.response_bytes, rep);
+  }
+}
+
+// Levels in the RLE/bit-packing hybrid, as RLE runs only, after the
+// 4-byte length a v1 data page puts before them
+void PutLevels(std::string &out, const std::vector<uint8_t> &levels,
+               int max) {
+  int width = 0;
+  while ((1 << width) <= max)
+    width++;
+  std::string runs;
+  char buf[10];
+  for (size_t i = 0; i < levels.size();) {
+    size_t j = i;
+    while (j < levels.size() && levels[j] == levels[i])
+      j++;
+    runs.append(buf, PutVarint(buf, (uint64_t)(j - i) << 1));
+    for (int b = 0; b < (width + 7) / 8; b++)
+      runs += (char)(levels[i] >> (8 * b));
+    i = j;
+  }
+  PutLittleEndian(out, runs.size(), 4);
+  out += runs;
+}
+
+// col as one data page; appends its ColumnChunk, at is where it goes
+void EncodeColumnChunk(const ParquetColumn &col, uint64_t at,
+                       std::string &page, std::string &chunk) {
+  std::string body;
+  if (col.max_rep)
+    PutLevels(body, col.reps, col.max_rep);
+  if (col.max_def)
+    PutLevels(body, col.defs, col.max_def);
+  body += col.values;
+  page.clear();
+  ThriftWriter header(page);
+  header.I32(1, 0) // DATA_PAGE
+      .I32(2, (int64_t)body.size())
+      .I32(3, (int64_t)body.size())
+      .Struct(5)
+      .I32(1, (int64_t)col.count)
+      .I32(2, 0)  // PLAIN
+      .I32(3, 3)  // RLE definition levels
+      .I32(4, 3)  // and repetition levels
+      .End()
+      .End();
+  page += body;
+
+  ThriftWriter meta(chunk);
+  meta.Begin().I64(2, (int64_t)at).Struct(3).I32(1, col.type);
+  meta.List(2, kThriftI32, 2);
+  meta.Int(0);
+  meta.Int(3);
+  meta.List(3, kThriftBinary, col.path.size());
+  for (const auto &name : col.path)
+    meta.Bytes(name);
+  meta.I32(4, 0) // UNCOMPRESSED
+      .I64(5, (int64_t)col.count)
+      .I64(6, (int64_t)page.size())
+      .I64(7, (int64_t)page.size())
+      .I64(9, (int64_t)at);
+  if (col.max_rep == 0 && col.type != kPqByteArray &&
+      col.type != kPqBoolean) {
+    meta.Struct(12).I64(3, (int64_t)col.nulls);
+    if (col.ranged)
+      meta.Binary(5, col.Bound(true)).Binary(6, col.Bound(false));
+    meta.End();
+  }
+  meta.End().End();
+}
+
+// version and schema, the start of every footer this writes
+void WriteRunSchema(ThriftWriter &w) {
+  w.I32(1, 1).List(2, kThriftStruct, std::size(kRunSchema));
+  for (size_t i = 0; i < std::size(kRunSchema); i++) {
+    const ParquetNode &node = kRunSchema[i];
+    w.Begin();
+    if (node.type != kPqGroup)
+      w.I32(1, node.type);
+    if (i > 0)
+      w.I32(3, node.repetition);
+    w.Binary(4, node.name);
+    if (node.type == kPqGroup)
+      w.I32(5, node.children);
+    if (node.converted != kPqNone)
+      w.I32(6, node.converted);
+    w.End();
+  }
+}
+
+struct ParquetFooter {
+  uint64_t data_end = 0; // where the footer starts
+  int64_t num_rows = 0;
+  std::vector<std::string> row_groups; // RowGroup structs, encoded
+  std::map<std::string, std::string> metadata;
+};
+
+bool SeekFile(FILE *f, uint64_t at) {
+#ifdef _WIN32
+  return _fseeki64(f, (__int64)at, SEEK_SET) == 0;
+#else
+  return fseeko(f, (off_t)at, SEEK_SET) == 0;
+#endif
+}
+
+// The footer of a file this wrote; false for any other file
+bool ReadRunFooter(FILE *f, uint64_t size, ParquetFooter &footer) {
+  char tail[8];
+  if (size < 12 || !SeekFile(f, 0) || fread(tail, 1, 4, f) != 4 ||
+      memcmp(tail, "PAR1", 4) != 0 || !SeekFile(f, size - 8) ||
+      fread(tail, 1, 8, f) != 8 || memcmp(tail + 4, "PAR1", 4) != 0)
+    return false;
+  uint32_t len = (uint32_t)(unsigned char)tail[0] |
+                 (uint32_t)(unsigned char)tail[1] << 8 |
+                 (uint32_t)(unsigned char)tail[2] << 16 |
+                 (uint32_t)(unsigned char)tail[3] << 24;
+  if (len > size - 12)
+    return false;
+  footer.data_end = size - 8 - len;
+  std::string meta(len, '\0');
+  if (!SeekFile(f, footer.data_end) || fread(&meta[0], 1, len, f) != len)
+    return false;
+  std::string schema;
+  ThriftWriter w(schema);
+  WriteRunSchema(w);
+  if (meta.compare(0, schema.size(), schema) != 0)
+    return false;
+
+  ThriftReader r(meta);
+  int id, sub;
+  uint8_t type, elem;
+  size_t n;
+  while (r.Next(id, type)) {
+    if (id == 3 && type == kThriftI64) {
+      r.Int(footer.num_rows);
+    } else if (id == 4 && type == kThriftList) {
+      if (!r.ListHeader(elem, n) || elem != kThriftStruct)
+        return false;
+      for (size_t i = 0; i < n; i++) {
+        size_t at = r.pos();
+        if (!r.Skip(elem, true))
+          return false;
+        footer.row_groups.push_back(meta.substr(at, r.pos() - at));
+      }
+    } else if (id == 5 && type == kThriftList) {
+      if (!r.ListHeader(elem, n) || elem != kThriftStruct)
+        return false;
+      for (size_t i = 0; i < n; i++) {
+        std::string_view key, value;
+        r.Begin();
+        while (r.Next(sub, type)) {
+          if (sub == 1 && type == kThriftBinary)
+            r.Bytes(key);
+          else if (sub == 2 && type == kThriftBinary)
+            r.Bytes(value);
+          else
+            r.Skip(type);
+        }
+        footer.metadata[std::string(key)] = std::string(value);
+      }
+    } else if (!r.Skip(type)) {
+      return false;
+    }
+  }
+  return r.ok() && r.pos() == meta.size();
+}
+
+// Hex FNV-1a of the catalog's first line; "" until it has one
+std::string CatalogHead(FILE *in) {
+  char buf[65536];
+  if (!SeekFile(in, 0))
+    return "";
+  size_t n = fread(buf, 1, sizeof(buf), in);
+  const char *nl = (const char *)memchr(buf, '\n', n);
+  if (!nl)
+    return "";
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx",
+           (unsigned long long)Fnv1a(kFnvOffset, buf, (size_t)(nl - buf)));
+  return hex;
+}
+
+// A run as this export has seen it
+struct ExportRun {
+  RunRecord rec;
+  uint64_t first = 0; // catalog offset of its start (or first) event
+  uint64_t last = 0;  // and of its last
+  bool seen = false;
+  bool ready = false; // a row of this export
+};
+
+bool LockExport(const std::string &path) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h != INVALID_HANDLE_VALUE) {
+      CloseHandle(h);
+      return true;
+    }
+#else
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+      close(fd);
+      return true;
+    }
+#endif
+    struct stat st{};
+    if (stat(path.c_str(), &st) == 0 &&
+        (long long)time(nullptr) - (long long)st.st_mtime <
+            kExportLockStaleSec)
+      return false;
+    std::remove(path.c_str());
+  }
+  return false;
+}
+
+bool ExportLocked(const std::string &catalog_path,
+                  const std::string &parquet_path, long long now_ms,
+                  CatalogExportResult &result) {
+  FILE *in = fopen(catalog_path.c_str(), "rb");
+  if (!in) {
+    result.error = "cannot read " + catalog_path;
+    return false;
+  }
+  struct stat st{};
+  uint64_t catalog_size = fstat(fileno(in), &st) == 0 ? st.st_size : 0;
+  std::string head = CatalogHead(in);
+
+  // Carry on from where the file's last export stopped, unless the file
+  // or the catalog is not the one it was
+  ParquetFooter old;
+  FILE *out = fopen(parquet_path.c_str(), "r+b");
+  bool append = out && stat(parquet_path.c_str(), &st) == 0 &&
+                ReadRunFooter(out, (uint64_t)st.st_size, old) &&
+                old.row_groups.size() < kMaxRowGroups;
+  uint64_t offset =
+      append ? strtoull(old.metadata[kKeyOffset].c_str(), nullptr, 10) : 0;
+  if (append && (offset > catalog_size || old.metadata[kKeyHead] != head))
+    append = false;
+  if (!append) {
+    old = ParquetFooter();
+    offset = 0;
+  }
+  std::set<std::string, std::less<>> exported;
+  std::string_view list = old.metadata[kKeyExported];
+  while (!list.empty()) {
+    size_t nl = std::min(list.find('\n'), list.size());
+    exported.emplace(list.substr(0, nl));
+    list.remove_prefix(std::min(nl + 1, list.size()));
+  }
+
+  // Fold the complete lines since offset
+  std::map<std::string, ExportRun, std::less<>> runs;
+  uint64_t end = offset;
+  bool read_ok = SeekFile(in, offset);
+  std::string partial;
+  char buf[65536];
+  size_t n;
+  while (read_ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    partial.append(buf, n);
+    size_t start = 0, eol;
+    while ((eol = partial.find('\n', start)) != std::string::npos) {
+      uint64_t line_at = end + start;
+      JsonValue ev;
+      std::string key;
+      if (JsonParser(std::string_view(partial.data() + start, eol - start))
+              .Parse(ev))
+        key = RunCatalogKey(ev.GetString("run"));
+      start = eol + 1;
+      if (key.empty())
+        continue;
+      ExportRun &run = runs[key];
+      run.last = line_at;
+      if (exported.count(key))
+        continue;
+      if (!run.seen || ev.GetString("event") == "start")
+        run.first = line_at;
+      run.seen = true;
+      ApplyRunEvent(run.rec, ev);
+    }
+    partial.erase(0, start);
+    end += start;
+  }
+  read_ok = read_ok && !ferror(in);
+  fclose(in);
+  if (!read_ok) {
+    if (out)
+      fclose(out);
+    result.error = "cannot read " + catalog_path;
+    return false;
+  }
+
+  // Rows for the runs that are done; the next export starts at the first
+  // event of the earliest run that is not
+  typedef std::pair<const std::string, ExportRun> Run;
+  std::vector<const Run *> ready;
+  uint64_t next_offset = end;
+  for (auto &entry : runs) {
+    const RunRecord &rec = entry.second.rec;
+    if (exported.count(entry.first) || (rec.started == 0 && rec.ended == 0))
+      continue;
+    entry.second.ready =
+        rec.ended > 0 ? rec.ended * 1000 + kExportSettleMs <= now_ms
+                      : rec.started * 1000 + kExportStaleRunMs <= now_ms;
+    if (entry.second.ready)
+      ready.push_back(&entry);
+    else
+      next_offset = std::min(next_offset, entry.second.first);
+  }
+  // In the order the runs ended
+  auto done_at = [](const Run *run) {
+    const RunRecord &rec = run->second.rec;
+    return rec.ended > 0 ? rec.ended : rec.started;
+  };
+  std::sort(ready.begin(), ready.end(),
+            [&](const Run *a, const Run *b) {
+              return done_at(a) != done_at(b) ? done_at(a) < done_at(b)
+                                              : a->first < b->first;
+            });
+  std::string next_exported;
+  for (const auto &entry : runs) {
+    bool done = entry.second.ready || exported.count(entry.first);
+    if (done && entry.second.last >= next_offset)
+      next_exported += entry.first + "\n";
+  }
+  if (!next_exported.empty())
+    next_exported.pop_back();
+  result.total_rows = (size_t)old.num_rows + ready.size();
+  if (append && ready.empty() && next_offset == offset &&
+      next_exported == old.metadata[kKeyExported]) {
+    fclose(out);
+    return true;
+  }
+
+  if (!append) {
+    if (out)
+      fclose(out);
+    out = fopen(parquet_path.c_str(), "wb");
+    if (!out) {
+      result.error = "cannot write " + parquet_path;
+      return false;
+    }
+  }
+  // New row groups go over the old footer; if writing fails half way the
+  // file no longer reads as one of ours and the next export starts over
+  uint64_t at = append ? old.data_end : 4;
+  bool ok = SeekFile(out, append ? at : 0) &&
+            (append || fwrite("PAR1", 1, 4, out) == 4);
+  std::vector<std::string> row_groups = std::move(old.row_groups);
+  std::string page;
+  for (size_t first = 0; ok && first < ready.size(); first += kRowGroupRows) {
+    size_t last = std::min(ready.size(), first + kRowGroupRows);
+    std::vector<ParquetColumn> cols = RunColumns();
+    for (size_t i = first; i < last; i++)
+      AddRunRow(cols, ready[i]->first, ready[i]->second.rec);
+    std::string group;
+    ThriftWriter w(group);
+    w.List(1, kThriftStruct, cols.size());
+    uint64_t group_start = at;
+    for (const auto &col : cols) {
+      EncodeColumnChunk(col, at, page, group);
+      ok = ok && fwrite(page.data(), 1, page.size(), out) == page.size();
+      at += page.size();
+    }
+    w.I64(2, (int64_t)(at - group_start)).I64(3, (int64_t)(last - first));
+    w.End();
+    row_groups.push_back(std::move(group));
+  }
+
+  std::string meta;
+  ThriftWriter w(meta);
+  WriteRunSchema(w);
+  w.I64(3, (int64_t)result.total_rows);
+  w.List(4, kThriftStruct, row_groups.size());
+  for (const auto &group : row_groups)
+    meta += group;
+  std::pair<const char *, std::string> metadata[] = {
+      {kKeyOffset, std::to_string(next_offset)},
+      {kKeyExported, next_exported},
+      {kKeyHead, head}};
+  w.List(5, kThriftStruct, std::size(metadata));
+  for (const auto &kv : metadata)
+    w.Begin().Binary(1, kv.first).Binary(2, kv.second).End();
+  w.Binary(6, "autobuild").End();
+  PutLittleEndian(meta, meta.size(), 4);
+  meta += "PAR1";
+  ok = ok && fwrite(meta.data(), 1, meta.size(), out) == meta.size();
+  ok = ok && fflush(out) == 0;
+  at += meta.size();
+#ifdef _WIN32
+  ok = ok && _chsize_s(_fileno(out), (__int64)at) == 0;
+#else
+  ok = ok && ftruncate(fileno(out), (off_t)at) == 0;
+#endif
+  ok = fclose(out) == 0 && ok;
+  if (!ok) {
+    result.error = "cannot write " + parquet_path;
+    return false;
+  }
+  result.rows = ready.size();
+  return true;
+}
+
+} // namespace
+
+bool ExportRunCatalog(const std::string &catalog_path,
+                      const std::string &parquet_path, long long now_ms,
+                      CatalogExportResult &result) {
+  result = CatalogExportResult();
+  std::string lock = parquet_path + ".lock";
+  if (!LockExport(lock)) {
+    result.error = "another export is writing " + parquet_path;
+    return false;
+  }
+  bool ok = ExportLocked(catalog_path, parquet_path, now_ms, result);
+  std::remove(lock.c_str());
+  return ok;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                       LOGS INDEX                      //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Poll interval of the indexer thread, and how often a root is fully
+// rescanned when no change notifications are available or it is missing
+static const int kLogsIndexPollMs = 250;
+static const int kLogsIndexRescanMs = 5000;
+
+struct LogsIndexer::Watcher {
+#if defined(_WIN32)
+  // One recursive watch on the root
+  bool Watching() const { return dir_ != INVALID_HANDLE_VALUE; }
+
+  void Open(const std::string &root) {
+    watch_root_ = root;
+    dir_ = CreateFileA(root.c_str(), FILE_LIST_DIRECTORY,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       NULL, OPEN_EXISTING,
+                       FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (dir_ == INVALID_HANDLE_VALUE)
+      return;
+    memset(&overlapped_, 0, sizeof(overlapped_));
+    overlapped_.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!Arm())
+      Close();
+  }
+
+  bool Arm() {
+    ResetEvent(overlapped_.hEvent);
+    return ReadDirectoryChangesW(dir_, notify_buf_, sizeof(notify_buf_), TRUE,
+                                 FILE_NOTIFY_CHANGE_FILE_NAME |
+                                     FILE_NOTIFY_CHANGE_DIR_NAME,
+                                 NULL, &overlapped_, NULL) != 0;
+  }
+
+  void Watch(const std::string &) {}
+
+  bool Poll(std::vector<std::string> &dirty) {
+    if (!Watching() ||
+        WaitForSingleObject(overlapped_.hEvent, 0) != WAIT_OBJECT_0)
+      return true;
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(dir_, &overlapped_, &bytes, FALSE) ||
+        bytes == 0) {
+      Arm();
+      return false; // buffer overflow: changes were lost
+    }
+    const char *p = (const char *)notify_buf_;
+    while (true) {
+      const FILE_NOTIFY_INFORMATION *info =
+          (const FILE_NOTIFY_INFORMATION *)p;
+      int wlen = (int)(info->FileNameLength / sizeof(WCHAR));
+      int len = WideCharToMultiByte(CP_UTF8, 0, info->FileName, wlen, NULL,
+                                    0, NULL, NULL);
+      std::string rel(len, '\0');
+      WideCharToMultiByte(CP_UTF8, 0, info->FileName, wlen, &rel[0], len,
+                          NULL, NULL);
+      size_t slash = rel.find_last_of('\\');
+      dirty.push_back(slash == std::string::npos
+                          ? watch_root_
+                          : watch_root_ + "/" + rel.substr(0, slash));
+      if (info->NextEntryOffset == 0)
+        break;
+      p += info->NextEntryOffset;
+    }
+    if (!Arm())
+      Close();
+    return true;
+  }
+
+  void Close() {
+    if (dir_ != INVALID_HANDLE_VALUE) {
+      CancelIo(dir_);
+      CloseHandle(dir_);
+      dir_ = INVALID_HANDLE_VALUE;
+    }
+    if (overlapped_.hEvent) {
+      CloseHandle(overlapped_.hEvent);
+      overlapped_.hEvent = NULL;
+    }
+  }
+
+  HANDLE dir_ = INVALID_HANDLE_VALUE;
+  OVERLAPPED overlapped_ = {};
+  DWORD notify_buf_[16384];
+  std::string watch_root_;
+#elif defined(__APPLE__)
+  // One FSEvents stream on the root, delivered on a private dispatch queue
+  bool Watching() const { return stream_ != nullptr; }
+
+  static void OnEvents(ConstFSEventStreamRef, void *info, size_t count,
+                       void *paths, const FSEventStreamEventFlags flags[],
+                       const FSEventStreamEventId[]) {
+    Watcher *self = (Watcher *)info;
+    std::lock_guard<std::mutex> lock(self->events_mutex_);
+    for (size_t i = 0; i < count; ++i) {
+      if (flags[i] & (kFSEventStreamEventFlagMustScanSubDirs |
+                      kFSEventStreamEventFlagRootChanged))
+        self->events_lost_ = true;
+      std::string p = ((char **)paths)[i];
+      while (p.size() > 1 && p.back() == '/')
+        p.pop_back();
+      self->events_.push_back(p);
+    }
+  }
+
+  void Open(const std::string &root) {
+    // FSEvents reports resolved paths; map them back onto root
+    char real[PATH_MAX];
+    real_root_ = realpath(root.c_str(), real) ? std::string(real) : root;
+    watch_root_ = root;
+    CFStringRef path = CFStringCreateWithCString(NULL, root.c_str(),
+                                                 kCFStringEncodingUTF8);
+    CFArrayRef paths =
+        CFArrayCreate(NULL, (const void **)&path, 1, &kCFTypeArrayCallBacks);
+    FSEventStreamContext ctx = {0, this, NULL, NULL, NULL};
+    stream_ = FSEventStreamCreate(NULL, &Watcher::OnEvents, &ctx, paths,
+                                  kFSEventStreamEventIdSinceNow, 0.2,
+                                  kFSEventStreamCreateFlagNone);
+    CFRelease(paths);
+    CFRelease(path);
+    if (!stream_)
+      return;
+    queue_ = dispatch_queue_create("autobuild.logs-index", NULL);
+    FSEventStreamSetDispatchQueue(stream_, queue_);
+    if (!FSEventStreamStart(stream_))
+      Close();
+  }
+
+  void Watch(const std::string &) {}
+
+  bool Poll(std::vector<std::string> &dirty) {
+    std::lock_guard<std::mutex> lock(events_mutex_);
+    bool ok = !events_lost_;
+    events_lost_ = false;
+    for (auto &p : events_) {
+      if (p.compare(0, real_root_.size(), real_root_) == 0)
+        p = watch_root_ + p.substr(real_root_.size());
+      dirty.push_back(std::move(p));
+    }
+    events_.clear();
+    return ok;
+  }
+
+  void Close() {
+    if (stream_) {
+      FSEventStreamStop(stream_);
+      FSEventStreamInvalidate(stream_);
+      FSEventStreamRelease(stream_);
+      stream_ = nullptr;
+    }
+    if (queue_) {
+      dispatch_release(queue_);
+      queue_ = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(events_mutex_);
+    events_.clear();
+    events_lost_ = false;
+  }
+
+  FSEventStreamRef stream_ = nullptr;
+  dispatch_queue_t queue_ = nullptr;
+  std::mutex events_mutex_;
+  std::vector<std::string> events_;
+  bool events_lost_ = false;
+  std::string watch_root_;
+  std::string real_root_;
+#else
+  // One inotify watch per indexed directory
+  bool Watching() const { return inotify_fd_ >= 0 && !watch_limit_hit_; }
+
+  void Open(const std::string &) {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  }
+
+  void Watch(const std::string &path) {
+    if (inotify_fd_ < 0)
+      return;
+    int wd = inotify_add_watch(inotify_fd_, path.c_str(),
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_ONLYDIR);
+    if (wd >= 0)
+      watches_[wd] = path;
+    else if (errno == ENOSPC)
+      watch_limit_hit_ = true; // fall back to periodic rescans
+  }
+
+  bool Poll(std::vector<std::string> &dirty) {
+    if (inotify_fd_ < 0)
+      return true;
+    alignas(struct inotify_event) char buf[16384];
+    bool ok = true;
+    ssize_t n;
+    while ((n = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+      for (char *p = buf; p < buf + n;) {
+        struct inotify_event *ev = (struct inotify_event *)p;
+        if (ev->mask & IN_Q_OVERFLOW) {
+          ok = false;
+        } else if (ev->mask & IN_IGNORED) {
+          watches_.erase(ev->wd);
+        } else {
+          auto it = watches_.find(ev->wd);
+          if (it != watches_.end())
+            dirty.push_back(it->second);
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+      }
+    }
+    return ok;
+  }
+
+  void Close() {
+    if (inotify_fd_ >= 0)
+      close(inotify_fd_);
+    inotify_fd_ = -1;
+    watches_.clear();
+    watch_limit_hit_ = false;
+  }
+
+  int inotify_fd_ = -1;
+  bool watch_limit_hit_ = false;
+  std::map<int, std::string> watches_;
+#endif
+
+  ~Watcher() { Close(); }
+};
+
+LogsIndexer::LogsIndexer(Hooks hooks)
+    : hooks_(std::move(hooks)), watcher_(std::make_unique<Watcher>()) {}
+
+LogsIndexer::~LogsIndexer() { Stop(); }
+
+std::shared_ptr<const LogsTreeSnapshot>
+LogsIndexer::Get(const std::string &root) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (root != root_) {
+    root_ = root;
+    cv_.notify_one();
+  }
+  if (!thread_.joinable() && !stop_)
+    thread_ = std::thread([this]() {
+      if (hooks_.thread_start)
+        hooks_.thread_start();
+      Run();
+    });
+  return snapshot_;
+}
+
+void LogsIndexer::Touch(const std::string &dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  touched_.push_back(dir);
+  cv_.notify_one();
+}
+
+void LogsIndexer::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_one();
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void LogsIndexer::Run() {
+  std::string root;
+  auto last_full = std::chrono::steady_clock::now();
+  while (true) {
+    std::vector<std::string> dirty;
+    std::string wanted;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_for(lock, std::chrono::milliseconds(kLogsIndexPollMs), [&] {
+        return stop_ || root_ != root || !touched_.empty();
+      });
+      if (stop_)
+        break;
+      wanted = root_;
+      dirty.swap(touched_);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool full = wanted != root;
+    if (!full && (!exists_ || !watcher_->Watching()) &&
+        now - last_full >= std::chrono::milliseconds(kLogsIndexRescanMs))
+      full = true;
+    if (!full && !watcher_->Poll(dirty))
+      full = true; // notifications overflowed
+    if (full) {
+      root = wanted;
+      last_full = now;
+      if (root != catalog_root_)
+        ResetCatalog(root);
+      PollCatalog();
+      Rebuild(root);
+      continue;
+    }
+    bool catalog_changed = PollCatalog();
+    if (dirty.empty()) {
+      if (catalog_changed && exists_)
+        Publish(root);
+      continue;
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    for (const auto &dir : dirty) {
+      if (!exists_ && dir == root) {
+        Rebuild(root);
+        break;
+      }
+      Refresh(root, dir);
+    }
+    if (exists_)
+      Publish(root);
+  }
+  watcher_->Close();
+}
+
+void LogsIndexer::Scan(const std::string &path, int depth, Node &node) {
+  watcher_->Watch(path);
+  if (depth >= kFileDepth) {
+    node.files = List(path, true);
+    return;
+  }
+  std::map<std::string, Node> dirs;
+  for (const auto &name : List(path, false)) {
+    auto old = node.dirs.find(name);
+    if (old != node.dirs.end()) {
+      dirs[name] = std::move(old->second);
+    } else {
+      Scan(path + "/" + name, depth + 1, dirs[name]);
+    }
+  }
+  node.dirs = std::move(dirs);
+}
+
+void LogsIndexer::Rebuild(const std::string &root) {
+  watcher_->Close();
+  tree_ = Node();
+  exists_ = !root.empty() && DirectoryExists(root);
+  if (exists_) {
+    watcher_->Open(root);
+    Scan(root, 0, tree_);
+  }
+  Publish(root);
+}
+
+void LogsIndexer::Refresh(const std::string &root, const std::string &dir) {
+  if (dir.compare(0, root.size(), root) != 0)
+    return;
+  std::string rel = dir.substr(root.size());
+  Node *node = &tree_;
+  std::string path = root;
+  int depth = 0;
+  size_t pos = 0;
+  while (depth < kFileDepth) {
+    while (pos < rel.size() && (rel[pos] == '/' || rel[pos] == '\\'))
+      pos++;
+    if (pos >= rel.size())
+      break;
+    size_t end = rel.find_first_of("/\\", pos);
+    std::string name = rel.substr(pos, end - pos);
+    auto it = node->dirs.find(name);
+    if (it == node->dirs.end())
+      break;
+    node = &it->second;
+    path += "/" + name;
+    depth++;
+    pos = end;
+  }
+  Scan(path, depth, *node);
+}
+
+void LogsIndexer::ResetCatalog(const std::string &root) {
+  catalog_root_ = root;
+  catalog_offset_ = 0;
+  catalog_partial_.clear();
+  catalog_ = std::make_shared<const RunCatalog>();
+}
+
+bool LogsIndexer::PollCatalog() {
+  if (catalog_root_.empty())
+    return false;
+  std::string path = catalog_root_ + "/catalog.jsonl";
+  struct stat st{};
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+  if ((long long)st.st_size < catalog_offset_)
+    ResetCatalog(catalog_root_); // truncated or replaced
+  if ((long long)st.st_size == catalog_offset_)
+    return false;
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  in.seekg(catalog_offset_);
+  std::string chunk((size_t)(st.st_size - catalog_offset_), '\0');
+  in.read(&chunk[0], (std::streamsize)chunk.size());
+  chunk.resize((size_t)in.gcount());
+  catalog_offset_ += (long long)chunk.size();
+  catalog_partial_ += chunk;
+
+  auto next = std::make_shared<RunCatalog>(*catalog_);
+  size_t start = 0, eol;
+  while ((eol = catalog_partial_.find('\n', start)) != std::string::npos) {
+    JsonValue ev;
+    if (JsonParser(std::string_view(catalog_partial_.data() + start,
+                                    eol - start))
+            .Parse(ev))
+      ApplyCatalogEvent(*next, ev);
+    start = eol + 1;
+  }
+  catalog_partial_.erase(0, start); // keep an unterminated last line
+  catalog_ = std::move(next);
+  return true;
+}
+
+void LogsIndexer::ApplyCatalogEvent(RunCatalog &catalog, const JsonValue &ev) {
+  std::string dir = ev.GetString("run");
+  std::string key = RunCatalogKey(dir);
+  if (key.empty())
+    return;
+  RunRecord &rec = catalog[key];
+  ApplyRunEvent(rec, ev);
+  if (hooks_.catalog_event)
+    hooks_.catalog_event(key, dir, rec, ev);
+}
+
+void LogsIndexer::Publish(const std::string &root) {
+  auto snap = std::make_shared<LogsTreeSnapshot>();
+  snap->root = root;
+  snap->exists = exists_;
+  snap->catalog = catalog_;
+  for (const auto &t : tree_.dirs) {
+    LogsTreeSnapshot::Task task{t.first, {}};
+    for (const auto &r : t.second.dirs) {
+      LogsTreeSnapshot::Run run{r.first, {}};
+      std::vector<std::pair<long long, long long>> spans;
+      for (const auto &m : r.second.dirs) {
+        run.modes.push_back(LogsTreeSnapshot::Mode{m.first, m.second.files});
+        auto rec = catalog_->find(t.first + "/" + r.first + "/" + m.first);
+        if (rec == catalog_->end())
+          continue;
+        const RunRecord &rr = rec->second;
+        if (rr.ended == 0) {
+          run.status = RunStatus::Running;
+          continue;
+        }
+        spans.emplace_back(rr.started, std::max(rr.started, rr.ended));
+        if (run.failure.empty())
+          run.failure = rr.failure.Headline();
+        if (rr.exit_code != 0 || rr.verification == "failed")
+          run.status = RunStatus::Failed;
+        else if (run.status == RunStatus::Unknown)
+          run.status = RunStatus::Passed;
+      }
+      std::sort(spans.begin(), spans.end());
+      long long covered_to = LLONG_MIN;
+      for (const auto &span : spans) {
+        long long from = std::max(span.first, covered_to);
+        if (span.second > from)
+          run.seconds += span.second - from;
+        covered_to = std::max(covered_to, span.second);
+      }
+      task.runs.push_back(std::move(run));
+    }
+    snap->tasks.push_back(std::move(task));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  snapshot_ = std::move(snap);
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                     NAME SERVICE                      //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+bool NameService::Open(const std::string &path) {
+  uint64_t mark = 0;
+  if (FILE *in = fopen(path.c_str(), "rb")) {
+    unsigned long long saved = 0;
+    if (fscanf(in, "%llu", &saved) == 1)
+      mark = saved;
+    fclose(in);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+  uint64_t last = last_.load();
+  while (last < mark && !last_.compare_exchange_weak(last, mark)) {
+  }
+  // The next id issued saves a new mark
+  reserved_ = std::max(mark, last_.load());
+  return SaveMark(reserved_);
+}
+
+uint64_t NameService::NextId() {
+  uint64_t now = (uint64_t)std::chrono::duration_cast<
+                     std::chrono::milliseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count()
+                 << 16;
+  uint64_t last = last_.load();
+  uint64_t id;
+  do {
+    id = std::max(last + 1, now);
+  } while (!last_.compare_exchange_weak(last, id));
+  if (id >= reserved_.load()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Also when the mark cannot be saved: retrying on every id would not
+    // help
+    if (id >= reserved_.load()) {
+      SaveMark(id + kReserve);
+      reserved_ = id + kReserve;
+    }
+  }
+  return id;
+}
+
+std::string NameService::Encode(uint64_t id) {
+  static const char kDigits[] = "0123456789abcdefghjkmnpqrstvwxyz";
+  char out[13];
+  for (int i = 12; i >= 0; i--, id >>= 5)
+    out[i] = kDigits[id & 31];
+  return std::string(out, sizeof(out));
+}
+
+bool NameService::SaveMark(uint64_t mark) {
+  if (path_.empty())
+    return true;
+  std::string tmp = path_ + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = fprintf(f, "%llu\n", (unsigned long long)mark) > 0;
+  ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+  // rename does not replace an existing file on Windows
+  std::remove(path_.c_str());
+#endif
+  ok = ok && std::rename(tmp.c_str(), path_.c_str()) == 0;
+  if (!ok)
+    std::remove(tmp.c_str());
+  return ok;
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                    BATCH TRANSFORM                    //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// GCC and Clang compile a kernel for a wider ISA than the build targets
+// through a per-function target; MSVC accepts the intrinsics as they are
+#if defined(AUTOBUILD_X86) && !defined(_MSC_VER)
+#define AUTOBUILD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define AUTOBUILD_TARGET_AVX2
+#endif
+
+#if defined(AUTOBUILD_X86) &&                                                  \
+    (defined(__SSE2__) || defined(_M_X64) ||                                   \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define AUTOBUILD_HAVE_SSE2 1
+#endif
+
+// Points [from, n) one at a time; also the tail of the SIMD kernels
+static void TransformSoAScalar(const float m[16], const SoAVec4 &in,
+                               const SoAVec4 &out, size_t from, size_t n) {
+  for (size_t i = from; i < n; i++) {
+    float x = in.x[i], y = in.y[i], z = in.z[i];
+    float w = in.w ? in.w[i] : 1.0f;
+    float ox = m[0] * x + m[4] * y + m[8] * z + m[12] * w;
+    float oy = m[1] * x + m[5] * y + m[9] * z + m[13] * w;
+    float oz = m[2] * x + m[6] * y + m[10] * z + m[14] * w;
+    float ow = m[3] * x + m[7] * y + m[11] * z + m[15] * w;
+    out.x[i] = ox;
+    out.y[i] = oy;
+    out.z[i] = oz;
+    if (out.w)
+      out.w[i] = ow;
+  }
+}
+
+#ifdef AUTOBUILD_HAVE_SSE2
+static void TransformSoASse2(const float m[16], const SoAVec4 &in,
+                             const SoAVec4 &out, size_t n) {
+  __m128 c[16];
+  for (int k = 0; k < 16; k++)
+    c[k] = _mm_set1_ps(m[k]);
+  const __m128 one = _mm_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_loadu_ps(in.x + i), y = _mm_loadu_ps(in.y + i);
+    __m128 z = _mm_loadu_ps(in.z + i);
+    __m128 w = in.w ? _mm_loadu_ps(in.w + i) : one;
+    __m128 r[4];
+    for (int row = 0; row < 4; row++)
+      r[row] = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(c[row], x), _mm_mul_ps(c[4 + row], y)),
+          _mm_add_ps(_mm_mul_ps(c[8 + row], z), _mm_mul_ps(c[12 + row], w)));
+    _mm_storeu_ps(out.x + i, r[0]);
+    _mm_storeu_ps(out.y + i, r[1]);
+    _mm_storeu_ps(out.z + i, r[2]);
+    if (out.w)
+      _mm_storeu_ps(out.w + i, r[3]);
+  }
+  TransformSoAScalar(m, in, out, i, n);
+}
+#endif
+
+#ifdef AUTOBUILD_X86
+AUTOBUILD_TARGET_AVX2 static void TransformSoAAvx2(const float m[16],
+                                                   const SoAVec4 &in,
+                                                   const SoAVec4 &out,
+                                                   size_t n) {
+  __m256 c[16];
+  for (int k = 0; k < 16; k++)
+    c[k] = _mm256_set1_ps(m[k]);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(in.x + i), y = _mm256_loadu_ps(in.y + i);
+    __m256 z = _mm256_loadu_ps(in.z + i);
+    __m256 w = in.w ? _mm256_loadu_ps(in.w + i) : one;
+    __m256 r[4];
+    // Two short FMA chains per row rather than one long one
+    for (int row = 0; row < 4; row++) {
+      __m256 xy = _mm256_fmadd_ps(c[row], x, _mm256_mul_ps(c[4 + row], y));
+      __m256 zw = _mm256_fmadd_ps(c[8 + row], z, _mm256_mul_ps(c[12 + row], w));
+      r[row] = _mm256_add_ps(xy, zw);
+    }
+    _mm256_storeu_ps(out.x + i, r[0]);
+    _mm256_storeu_ps(out.y + i, r[1]);
+    _mm256_storeu_ps(out.z + i, r[2]);
+    if (out.w)
+      _mm256_storeu_ps(out.w + i, r[3]);
+  }
+  TransformSoAScalar(m, in, out, i, n);
+}
+
+// AVX2 and FMA on the CPU, and AVX state enabled by the OS
+static bool CpuHasAvx2Fma() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  bool fma = (info[2] & (1 << 12)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!fma || !osxsave || (_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+#ifdef AUTOBUILD_NEON
+static void TransformSoANeon(const float m[16], const SoAVec4 &in,
+                             const SoAVec4 &out, size_t n) {
+  float32x4_t c[16];
+  for (int k = 0; k < 16; k++)
+    c[k] = vdupq_n_f32(m[k]);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t x = vld1q_f32(in.x + i), y = vld1q_f32(in.y + i);
+    float32x4_t z = vld1q_f32(in.z + i);
+    float32x4_t w = in.w ? vld1q_f32(in.w + i) : one;
+    float32x4_t r[4];
+    for (int row = 0; row < 4; row++) {
+      float32x4_t acc = vmulq_f32(c[12 + row], w);
+      acc = vmlaq_f32(acc, c[8 + row], z);
+      acc = vmlaq_f32(acc, c[4 + row], y);
+      r[row] = vmlaq_f32(acc, c[row], x);
+    }
+    vst1q_f32(out.x + i, r[0]);
+    vst1q_f32(out.y + i, r[1]);
+    vst1q_f32(out.z + i, r[2]);
+    if (out.w)
+      vst1q_f32(out.w + i, r[3]);
+  }
+  TransformSoAScalar(m, in, out, i, n);
+}
+#endif
+
+bool SimdPathSupported(SimdPath path) {
+  switch (path) {
+  case SimdPath::kScalar:
+    return true;
+  case SimdPath::kSse2:
+#ifdef AUTOBUILD_HAVE_SSE2
+    return true;
+#else
+    return false;
+#endif
+  case SimdPath::kAvx2: {
+#ifdef AUTOBUILD_X86
+    static const bool avx2 = CpuHasAvx2Fma();
+    return avx2;
+#else
+    return false;
+#endif
+  }
+  case SimdPath::kNeon:
+#ifdef AUTOBUILD_NEON
+    return true;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+SimdPath DetectSimdPath() {
+  for (SimdPath path : {SimdPath::kAvx2, SimdPath::kNeon, SimdPath::kSse2})
+    if (SimdPathSupported(path))
+      return path;
+  return SimdPath::kScalar;
+}
+
+const char *SimdPathName(SimdPath path) {
+  switch (path) {
+  case SimdPath::kScalar:
+    return "scalar";
+  case SimdPath::kSse2:
+    return "sse2";
+  case SimdPath::kAvx2:
+    return "avx2";
+  case SimdPath::kNeon:
+    return "neon";
+  }
+  return "?";
+}
+
+void TransformSoA(SimdPath path, const float m[16], const SoAVec4 &in,
+                  const SoAVec4 &out, size_t n) {
+  switch (path) {
+#ifdef AUTOBUILD_HAVE_SSE2
+  case SimdPath::kSse2:
+    TransformSoASse2(m, in, out, n);
+    return;
+#endif
+#ifdef AUTOBUILD_X86
+  case SimdPath::kAvx2:
+    TransformSoAAvx2(m, in, out, n);
+    return;
+#endif
+#ifdef AUTOBUILD_NEON
+  case SimdPath::kNeon:
+    TransformSoANeon(m, in, out, n);
+    return;
+#endif
+  default:
+    TransformSoAScalar(m, in, out, 0, n);
+    return;
+  }
+}
+
+void TransformSoA(const float m[16], const SoAVec4 &in, const SoAVec4 &out,
+                  size_t n) {
+  static const SimdPath path = DetectSimdPath();
+  TransformSoA(path, m, in, out, n);
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//                     TEXT KERNELS                      //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Index of the lowest set bit of a nonzero mask
+static inline unsigned LowestBit(uint64_t mask) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return (unsigned)index;
+#elif defined(_MSC_VER)
+  unsigned index = 0;
+  for (; !(mask & 1); mask >>= 1)
+    index++;
+  return index;
+#else
+  return (unsigned)__builtin_ctzll(mask);
+#endif
+}
+
+// Scalar kernels, from index from on; also the tails of the SIMD ones
+static size_t FindEitherScalar(const char *p, size_t from, size_t n, char a,
+                               char b) {
+  for (size_t i = from; i < n; i++)
+    if (p[i] == a || p[i] == b)
+      return i;
+  return n;
+}
+
+static size_t FindJsonEscapeScalar(const char *p, size_t from, size_t n) {
+  for (size_t i = from; i < n; i++) {
+    unsigned char c = (unsigned char)p[i];
+    if (c < 0x20 || c == '"' || c == '\\')
+      return i;
+  }
+  return n;
+}
+
+static void FoldAsciiLowerScalar(const char *src, char *dst, size_t from,
+                                 size_t n) {
+  for (size_t i = from; i < n; i++) {
+    char c = src[i];
+    dst[i] = (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+  }
+}
+
+static size_t FindAnyOfScalar(const char *p, size_t from, size_t n,
+                              const ByteSet &set) {
+  for (size_t i = from; i < n; i++)
+    if (set.Has((unsigned char)p[i]))
+      return i;
+  return n;
+}
+
+#ifdef AUTOBUILD_HAVE_SSE2
+static size_t FindEitherSse2(const char *p, size_t n, char a, char b) {
+  const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    int m = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)));
+    if (m)
+      return i + LowestBit((uint64_t)(unsigned)m);
+  }
+  return FindEitherScalar(p, i, n, a, b);
+}
+
+static size_t FindJsonEscapeSse2(const char *p, size_t n) {
+  const __m128i quote = _mm_set1_epi8('"'), slash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, slash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(x, control), x)); // x <= 0x1F
+    int m = _mm_movemask_epi8(hit);
+    if (m)
+      return i + LowestBit((uint64_t)(unsigned)m);
+  }
+  return FindJsonEscapeScalar(p, i, n);
+}
+
+// 'A'..'Z' compare as positive signed bytes; bytes from 0x80 up are
+// negative, so UTF-8 never falls in the range
+static void FoldAsciiLowerSse2(const char *src, char *dst, size_t n) {
+  const __m128i below = _mm_set1_epi8('A' - 1), above = _mm_set1_epi8('Z' + 1);
+  const __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, below),
+                                  _mm_cmpgt_epi8(above, x));
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_add_epi8(x, _mm_and_si128(upper, bit)));
+  }
+  FoldAsciiLowerScalar(src, dst, i, n);
+}
+
+static size_t FindAnyOfSse2(const char *p, size_t n, const ByteSet &set) {
+  size_t k = set.size();
+  // Common bytes tend to come up within a few: look the first 16 up
+  // before setting up the compares
+  size_t head = std::min<size_t>(n, 16);
+  size_t found = FindAnyOfScalar(p, 0, head, set);
+  if (found < head || head == n)
+    return found;
+  if (k == 0 || k > ByteSet::kSimdMax)
+    return FindAnyOfScalar(p, head, n, set);
+  __m128i want[ByteSet::kSimdMax];
+  for (size_t j = 0; j < k; j++)
+    want[j] = _mm_set1_epi8(set.bytes()[j]);
+  size_t i = head;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i hit = _mm_cmpeq_epi8(x, want[0]);
+    for (size_t j = 1; j < k; j++)
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, want[j]));
+    int m = _mm_movemask_epi8(hit);
+    if (m)
+      return i + LowestBit((uint64_t)(unsigned)m);
+  }
+  return FindAnyOfScalar(p, i, n, set);
+}
+#endif
+
+#ifdef AUTOBUILD_X86
+AUTOBUILD_TARGET_AVX2 static size_t FindEitherAvx2(const char *p, size_t n,
+                                                   char a, char b) {
+  const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    unsigned m = (unsigned)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)));
+    if (m)
+      return i + LowestBit(m);
+  }
+  return FindEitherScalar(p, i, n, a, b);
+}
+
+AUTOBUILD_TARGET_AVX2 static size_t FindJsonEscapeAvx2(const char *p,
+                                                       size_t n) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i slash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, quote),
+                        _mm256_cmpeq_epi8(x, slash)),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(x, control), x));
+    unsigned m = (unsigned)_mm256_movemask_epi8(hit);
+    if (m)
+      return i + LowestBit(m);
+  }
+  return FindJsonEscapeScalar(p, i, n);
+}
+
+AUTOBUILD_TARGET_AVX2 static void FoldAsciiLowerAvx2(const char *src,
+                                                     char *dst, size_t n) {
+  const __m256i below = _mm256_set1_epi8('A' - 1);
+  const __m256i above = _mm256_set1_epi8('Z' + 1);
+  const __m256i bit = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(x, below),
+                                     _mm256_cmpgt_epi8(above, x));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_add_epi8(x, _mm256_and_si256(upper, bit)));
+  }
+  FoldAsciiLowerScalar(src, dst, i, n);
+}
+
+AUTOBUILD_TARGET_AVX2 static size_t FindAnyOfAvx2(const char *p, size_t n,
+                                                  const ByteSet &set) {
+  size_t k = set.size();
+  // Common bytes tend to come up within a few: look the first 16 up
+  // before setting up the compares
+  size_t head = std::min<size_t>(n, 16);
+  size_t found = FindAnyOfScalar(p, 0, head, set);
+  if (found < head || head == n)
+    return found;
+  if (k == 0 || k > ByteSet::kSimdMax)
+    return FindAnyOfScalar(p, head, n, set);
+  __m256i want[ByteSet::kSimdMax];
+  for (size_t j = 0; j < k; j++)
+    want[j] = _mm256_set1_epi8(set.bytes()[j]);
+  size_t i = head;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i hit = _mm256_cmpeq_epi8(x, want[0]);
+    for (size_t j = 1; j < k; j++)
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, want[j]));
+    unsigned m = (unsigned)_mm256_movemask_epi8(hit);
+    if (m)
+      return i + LowestBit(m);
+  }
+  return FindAnyOfScalar(p, i, n, set);
+}
+#endif
+
+#ifdef AUTOBUILD_NEON
+// Four bits per byte of a compare result; the first hit is at the lowest
+// set bit / 4
+static inline uint64_t NeonMask(uint8x16_t hit) {
+  return vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+}
+
+static size_t FindEitherNeon(const char *p, size_t n, char a, char b) {
+  const uint8x16_t va = vdupq_n_u8((uint8_t)a), vb = vdupq_n_u8((uint8_t)b);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t x = vld1q_u8((const uint8_t *)p + i);
+    uint64_t m = NeonMask(vorrq_u8(vceqq_u8(x, va), vceqq_u8(x, vb)));
+    if (m)
+      return i + LowestBit(m) / 4;
+  }
+  return FindEitherScalar(p, i, n, a, b);
+}
+
+static size_t FindJsonEscapeNeon(const char *p, size_t n) {
+  const uint8x16_t quote = vdupq_n_u8('"'), slash = vdupq_n_u8('\\');
+  const uint8x16_t space = vdupq_n_u8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t x = vld1q_u8((const uint8_t *)p + i);
+    uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(x, quote), vceqq_u8(x, slash)),
+                              vcltq_u8(x, space));
+    uint64_t m = NeonMask(hit);
+    if (m)
+      return i + LowestBit(m) / 4;
+  }
+  return FindJsonEscapeScalar(p, i, n);
+}
+
+static void FoldAsciiLowerNeon(const char *src, char *dst, size_t n) {
+  const uint8x16_t first = vdupq_n_u8('A'), last = vdupq_n_u8('Z');
+  const uint8x16_t bit = vdupq_n_u8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t x = vld1q_u8((const uint8_t *)src + i);
+    uint8x16_t upper = vandq_u8(vcgeq_u8(x, first), vcleq_u8(x, last));
+    vst1q_u8((uint8_t *)dst + i, vaddq_u8(x, vandq_u8(upper, bit)));
+  }
+  FoldAsciiLowerScalar(src, dst, i, n);
+}
+
+static size_t FindAnyOfNeon(const char *p, size_t n, const ByteSet &set) {
+  size_t k = set.size();
+  // Common bytes tend to come up within a few: look the first 16 up
+  // before setting up the compares
+  size_t head = std::min<size_t>(n, 16);
+  size_t found = FindAnyOfScalar(p, 0, head, set);
+  if (found < head || head == n)
+    return found;
+  if (k == 0 || k > ByteSet::kSimdMax)
+    return FindAnyOfScalar(p, head, n, set);
+  uint8x16_t want[ByteSet::kSimdMax];
+  for (size_t j = 0; j < k; j++)
+    want[j] = vdupq_n_u8((uint8_t)set.bytes()[j]);
+  size_t i = head;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t x = vld1q_u8((const uint8_t *)p + i);
+    uint8x16_t hit = vceqq_u8(x, want[0]);
+    for (size_t j = 1; j < k; j++)
+      hit = vorrq_u8(hit, vceqq_u8(x, want[j]));
+    uint64_t m = NeonMask(hit);
+    if (m)
+      return i + LowestBit(m) / 4;
+  }
+  return FindAnyOfScalar(p, i, n, set);
+}
+#endif
+
+// The path the kernels without a SimdPath argument run
+static SimdPath TextKernelPath() {
+  static const SimdPath path = DetectSimdPath();
+  return path;
+}
+
+size_t FindEither(SimdPath path, const char *p, size_t n, char a, char b) {
+  switch (path) {
+#ifdef AUTOBUILD_HAVE_SSE2
+  case SimdPath::kSse2:
+    return FindEitherSse2(p, n, a, b);
+#endif
+#ifdef AUTOBUILD_X86
+  case SimdPath::kAvx2:
+    return FindEitherAvx2(p, n, a, b);
+#endif
+#ifdef AUTOBUILD_NEON
+  case SimdPath::kNeon:
+    return FindEitherNeon(p, n, a, b);
+#endif
+  default:
+    return FindEitherScalar(p, 0, n, a, b);
+  }
+}
+
+size_t FindEither(const char *p, size_t n, char a, char b) {
+  return FindEither(TextKernelPath(), p, n, a, b);
+}
+
+size_t FindJsonEscape(SimdPath path, const char *p, size_t n) {
+  switch (path) {
+#ifdef AUTOBUILD_HAVE_SSE2
+  case SimdPath::kSse2:
+    return FindJsonEscapeSse2(p, n);
+#endif
+#ifdef AUTOBUILD_X86
+  case SimdPath::kAvx2:
+    return FindJsonEscapeAvx2(p, n);
+#endif
+#ifdef AUTOBUILD_NEON
+  case SimdPath::kNeon:
+    return FindJsonEscapeNeon(p, n);
+#endif
+  default:
+    return FindJsonEscapeScalar(p, 0, n);
+  }
+}
+
+size_t FindJsonEscape(const char *p, size_t n) {
+  return FindJsonEscape(TextKernelPath(), p, n);
+}
+
+void FoldAsciiLower(SimdPath path, const char *src, char *dst, size_t n) {
+  switch (path) {
+#ifdef AUTOBUILD_HAVE_SSE2
+  case SimdPath::kSse2:
+    FoldAsciiLowerSse2(src, dst, n);
+    return;
+#endif
+#ifdef AUTOBUILD_X86
+  case SimdPath::kAvx2:
+    FoldAsciiLowerAvx2(src, dst, n);
+    return;
+#endif
+#ifdef AUTOBUILD_NEON
+  case SimdPath::kNeon:
+    FoldAsciiLowerNeon(src, dst, n);
+    return;
+#endif
+  default:
+    FoldAsciiLowerScalar(src, dst, 0, n);
+    return;
+  }
+}
+
+void FoldAsciiLower(const char *src, char *dst, size_t n) {
+  FoldAsciiLower(TextKernelPath(), src, dst, n);
+}
+
+size_t FindAnyOf(SimdPath path, const char *p, size_t n, const ByteSet &set) {
+  switch (path) {
+#ifdef AUTOBUILD_HAVE_SSE2
+  case SimdPath::kSse2:
+    return FindAnyOfSse2(p, n, set);
+#endif
+#ifdef AUTOBUILD_X86
+  case SimdPath::kAvx2:
+    return FindAnyOfAvx2(p, n, set);
+#endif
+#ifdef AUTOBUILD_NEON
+  case SimdPath::kNeon:
+    return FindAnyOfNeon(p, n, set);
+#endif
+  default:
+    return FindAnyOfScalar(p, 0, n, set);
+  }
+}
+
+size_t FindAnyOf(const char *p, size_t n, const ByteSet &set) {
+  return FindAnyOf(TextKernelPath(), p, n, set);
+}
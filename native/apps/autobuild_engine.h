@@ -0,0 +1,5290 @@
+#ifndef AUTOBUILD_ENGINE_H
+#define AUTOBUILD_ENGINE_H
+
+// The parts of autobuild that need no UI: JSON for the settings files and batch
+// manifests, task directory validation, the log pipeline (splitting, ANSI
+// stripping, the in-memory store and the on-disk spool of process output, the
+// tailing of log files still being written, the index of the logs tree and its
+// run catalog), the process launcher, the shell command helpers and the reactor
+// that runs task processes, the Docker Engine API client and the image and
+// container helpers over it, the Docker garbage collector, the image build
+// farm, the Gemini API governor, the prompt line diff, container resource
+// usage, the metrics endpoint, batch point transforms, the background job pool,
+// the trash for deleted log folders, the staging of logs roots on network
+// filesystems, the settings file's fields and codec and the coroutine reactor.
+// Shared by the GUI (autobuild_main), the headless runner (autobuild_cli) and
+// the benchmarks (autobuild_bench).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifndef _WIN32
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Minimal JSON value, enough to decode Docker Engine API responses and the
+// settings files. Object members keep their order: keys[i] names items[i].
+struct JsonValue {
+  enum Type { Null, Bool, Number, String, Array, Object };
+  Type type = Null;
+  bool boolean = false;
+  double number = 0.0;
+  std::string str;
+  std::vector<std::string> keys;
+  std::vector<JsonValue> items;
+
+  const JsonValue *Find(const char *key) const {
+    if (type != Object)
+      return nullptr;
+    for (size_t i = 0; i < keys.size(); ++i)
+      if (keys[i] == key)
+        return &items[i];
+    return nullptr;
+  }
+  std::string GetString(const char *key) const {
+    const JsonValue *v = Find(key);
+    return (v && v->type == String) ? v->str : std::string();
+  }
+  double GetNumber(const char *key) const {
+    const JsonValue *v = Find(key);
+    return (v && v->type == Number) ? v->number : 0.0;
+  }
+  int GetInt(const char *key, int fallback) const {
+    const JsonValue *v = Find(key);
+    return (v && v->type == Number) ? (int)v->number : fallback;
+  }
+  bool GetBool(const char *key, bool fallback) const {
+    const JsonValue *v = Find(key);
+    return (v && v->type == Bool) ? v->boolean : fallback;
+  }
+  // The string elements of an array member; anything else is skipped
+  std::vector<std::string> GetStrings(const char *key) const {
+    std::vector<std::string> out;
+    const JsonValue *v = Find(key);
+    if (v && v->type == Array)
+      for (const auto &item : v->items)
+        if (item.type == String)
+          out.push_back(item.str);
+    return out;
+  }
+};
+
+class JsonParser {
+public:
+  explicit JsonParser(std::string_view text) : s_(text) {}
+
+  bool Parse(JsonValue &out);
+
+private:
+  void SkipSpace();
+  bool Literal(const char *word);
+  bool Hex4(unsigned &out);
+  static void AppendUtf8(std::string &out, unsigned cp);
+  bool StringBody(std::string &out);
+  bool Value(JsonValue &out, int depth);
+
+  std::string_view s_;
+  size_t pos_ = 0;
+};
+
+// Writer for the flat objects the settings files hold: one member per line,
+// arrays of strings kept on the member's line. A compact writer puts the
+// whole object on one line instead (for JSON Lines output).
+class JsonWriter {
+public:
+  explicit JsonWriter(bool compact = false) : compact_(compact) {}
+
+  JsonWriter &String(const char *key, std::string_view value) {
+    Key(key);
+    Quoted(value);
+    return *this;
+  }
+  JsonWriter &Number(const char *key, long long value) {
+    Key(key);
+    out_ += std::to_string(value);
+    return *this;
+  }
+  JsonWriter &Bool(const char *key, bool value) {
+    Key(key);
+    out_ += value ? "true" : "false";
+    return *this;
+  }
+  JsonWriter &StringArray(const char *key,
+                          const std::vector<std::string> &values) {
+    BeginArray(key);
+    for (const auto &value : values)
+      Item(value);
+    return EndArray();
+  }
+  // Arrays of mixed items: BeginArray, any number of Item calls, EndArray
+  JsonWriter &BeginArray(const char *key) {
+    Key(key);
+    out_ += '[';
+    first_item_ = true;
+    return *this;
+  }
+  JsonWriter &Item(std::string_view value) {
+    Separate();
+    Quoted(value);
+    return *this;
+  }
+  JsonWriter &Item(long long value) {
+    Separate();
+    out_ += std::to_string(value);
+    return *this;
+  }
+  JsonWriter &EndArray() {
+    out_ += ']';
+    return *this;
+  }
+  std::string Finish();
+
+private:
+  void Key(const char *key);
+  void Separate() {
+    if (!first_item_)
+      out_ += ", ";
+    first_item_ = false;
+  }
+  void Quoted(std::string_view s);
+
+  std::string out_;
+  bool compact_ = false;
+  bool first_item_ = true;
+};
+
+bool FileExists(const std::string &path);
+bool IsDirectory(const std::string &path);
+bool DirectoryExists(const std::string &path);
+// Create directory recursively if it doesn't exist
+bool CreateDirectoryRecursive(const std::string &path);
+// Recursively delete a directory and its contents
+bool RemoveDirectoryRecursive(const std::string &path);
+// List a directory: subdirectories, or regular files when files is set;
+// dot entries are skipped and the names come sorted
+std::vector<std::string> ListDirectory(const std::string &path, bool files);
+
+// FNV-1a over size bytes of data, continuing from h (start from kFnvOffset)
+constexpr uint64_t kFnvOffset = 14695981039346656037ULL;
+uint64_t Fnv1a(uint64_t h, const void *data, size_t size);
+
+// What a task directory holds, as checked before a run: env/Dockerfile,
+// verify/verify.sh and a prompt (file or directory)
+struct TaskValidation {
+  bool has_env_dir = false;
+  bool has_dockerfile = false;
+  bool has_verify_dir = false;
+  bool has_verify_sh = false;
+  bool has_prompt = false;
+  std::string prompt_location;
+  std::vector<std::string> missing_items;
+  std::vector<std::string> found_items;
+  std::string task_dir;      // directory this result describes
+  uint64_t content_hash = 0; // layout and contents (see HashTaskLayout)
+  // From env/Dockerfile (see AnalyzeDockerfile): the WORKDIR of the stage
+  // docker build builds ("" when it sets none or it cannot be resolved),
+  // the images it starts from, and the hash of the build context as that
+  // Dockerfile reads it (see HashDockerContext; 0 without a Dockerfile)
+  std::string workdir;
+  std::vector<std::string> base_images;
+  uint64_t context_hash = 0;
+};
+
+TaskValidation ValidateTaskDirectory(const std::string &task_dir);
+
+// Whether a validated task has everything mode needs (0 feedback, 1 verify,
+// 2 both, 3 audit; an audit only builds env/)
+bool TaskRunnable(const TaskValidation &val, int mode);
+
+// Keeps the validation of the selected task directory current on a
+// background thread. The directory is validated once when it is selected,
+// then again only when change notifications (inotify, or a change handle on
+// Windows) report something in it or in env/, verify/ and prompt/; without
+// notifications it is rescanned periodically. Results whose content hash
+// changed wake the main loop, and the UI only copies the cached result.
+class TaskValidator {
+public:
+  struct Hooks {
+    std::function<void()> thread_start;
+    // A new result for dir is in; on the validator thread
+    std::function<void(const std::string &dir)> validated;
+  };
+
+  explicit TaskValidator(Hooks hooks = {}) : hooks_(std::move(hooks)) {}
+  ~TaskValidator() { Stop(); }
+
+  // Validate task_dir from now on and copy its latest result into out when
+  // out does not hold it yet. Until the first result for a new directory is
+  // in, out is left empty (and describes no directory).
+  void Poll(const std::string &task_dir, TaskValidation &out);
+
+  void Stop();
+
+private:
+  void Run();
+
+  // Change notifications of the directory: one recursive change handle on
+  // Windows, inotify watches on the directory and the subdirectories it
+  // checks on Linux, none on macOS (periodic rescans only). The handle is
+  // reopened by the rescan, so it is not re-armed by PollWatcher; any event
+  // (or an overflow) means the result may be stale.
+  bool Watching() const;
+  void OpenWatcher(const std::string &dir);
+  bool PollWatcher();
+  void CloseWatcher();
+
+#if defined(_WIN32)
+  void *change_ = (void *)(intptr_t)-1; // INVALID_HANDLE_VALUE
+#else
+  int inotify_fd_ = -1;
+  bool watching_ = false;
+#endif
+
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  std::string dir_;
+  TaskValidation result_;
+  uint64_t generation_ = 0;
+  uint64_t seen_ = 0; // last generation copied out by Poll (UI thread)
+  bool stop_ = false;
+};
+
+// The file autobuild.sh sends as a task's prompt: prompt, prompt/prompt.txt
+// or prompt.txt. "" when there is none, or when prompt/ holds no prompt.txt
+// and the script would pick whichever file it lists first.
+std::string TaskPromptFile(const std::string &task_dir);
+
+// The final prompt texts of a run, byte for byte what autobuild.sh's
+// compose_*_file functions write for them: trailing newlines of prompt
+// trimmed to one and, for Prompt 1, a blank line and the task's prompt file
+// after it. False when that file cannot be read.
+std::string ComposePromptText(std::string_view prompt);
+bool ComposePrompt1Text(std::string_view prompt,
+                        const std::string &task_prompt_file, std::string &out);
+
+// Write text to <dir>/<name>-<content hash>.txt, an existing directory,
+// unless that file is there already, and return its path; "" when it cannot
+// be written. Files appear complete (written aside, then renamed), so a
+// script may read any path returned here at once.
+std::string CachePromptFile(const std::string &dir, const char *name,
+                            const std::string &text);
+
+// A Dockerfile as far as the runs care: its stages, where each one works
+// and which parts of the build context it reads. Parser directives (escape),
+// line continuations, comments, heredocs and ${VAR} substitution with the
+// :- and :+ forms are handled the way docker build does; variables only the
+// base image defines are unknown here.
+
+// An instruction docker build runs as a step of its stage: FROM, RUN, COPY,
+// ADD and WORKDIR, in the order BuildKit's progress output numbers them
+// ("[builder 2/4] RUN make" is steps[1] of a stage with four)
+struct DockerfileStep {
+  std::string keyword; // upper case
+  // The instruction, continuation lines joined; heredoc bodies follow it
+  // on lines of their own
+  std::string text;
+  int line = 0; // of its first line in the Dockerfile, from 1
+  // Build-context paths COPY and ADD read, "." when one reads all of it
+  std::vector<std::string> sources;
+  bool remote = false; // ADD of a URL or git repository
+};
+
+struct DockerfileStage {
+  std::string base;    // FROM image, build arguments substituted
+  std::string name;    // AS name, lowercased; "" when unnamed
+  int parent = -1;     // earlier stage that FROM names, -1 for an image
+  std::string workdir; // WORKDIR at the end of the stage, parents included
+  bool workdir_known = true; // false when it uses an unknown variable
+  bool base_known = true;    // false when FROM uses an unknown variable
+  // Build-context paths or patterns that COPY, ADD and RUN --mount=type=bind
+  // read, without a leading "./" or "/"
+  std::vector<std::string> sources;
+  std::vector<DockerfileStep> steps;
+};
+
+struct DockerfileInfo {
+  std::vector<std::pair<std::string, std::string>> args; // before any FROM
+  std::vector<DockerfileStage> stages;
+  // Some instruction reads the context in a way that cannot be narrowed to
+  // paths (COPY . or a source with an unknown variable)
+  bool whole_context = false;
+  std::string error; // "" when the file parsed
+
+  // WORKDIR of the last stage, the one docker build builds by default; ""
+  // when none is set or it cannot be resolved
+  std::string Workdir() const;
+  // Distinct images the stages start from, other stages, scratch and
+  // images named by unknown variables aside
+  std::vector<std::string> BaseImages() const;
+};
+
+DockerfileInfo ParseDockerfile(std::string_view text);
+
+// ParseDockerfile of the file at path, cached by content hash so every
+// caller (validator, build farm, ...) shares one parse per version of the
+// file; null when it cannot be read
+std::shared_ptr<const DockerfileInfo>
+AnalyzeDockerfile(const std::string &path);
+
+// Hash of the part of env_dir (a task's Docker build context) its Dockerfile
+// reads: the Dockerfile, .dockerignore and the files COPY, ADD and bind
+// mounts name. Editing a file no instruction references leaves it alone.
+// Falls back to HashEnvContext when the Dockerfile is missing, does not
+// parse or reads the whole context.
+uint64_t HashDockerContext(const std::string &env_dir);
+
+// The part of env_dir docker build needs: the files HashDockerContext
+// hashes (every file when the Dockerfile cannot narrow them) less those
+// .dockerignore excludes, the Dockerfile and .dockerignore always kept.
+// Relative to env_dir and sorted.
+std::vector<std::string> DockerContextFiles(const std::string &env_dir);
+
+// Context archives kept in a cache directory, most recently written first
+static const size_t kContextTarKeep = 16;
+
+// DockerContextFiles of env_dir as a tar archive that docker build can
+// read from stdin, file modes kept. It is written into cache_dir (which
+// must exist) once, named by a hash of the files' paths, modes and
+// contents, and reused while they stay the same. Returns its path; "" when
+// it cannot be written, e.g. a name too long for ustar or a file that
+// changed while it was copied.
+std::string CacheDockerContextTar(const std::string &env_dir,
+                                  const std::string &cache_dir);
+
+// Hash of every file under env_dir (a task's Docker build context), relative
+// paths included and independent of directory order, so two contexts that
+// would build the same image hash the same
+uint64_t HashEnvContext(const std::string &env_dir);
+
+// Builds the env/ images of queued runs ahead of their dispatch, so a run
+// finds its image in autobuild.sh's image cache when its slot opens instead
+// of building it then. Requests are keyed by task directory; directories
+// whose env/ hashes the same (HashDockerContext) share one build, and at
+// most max_builds run at once. Running a build is the caller's:
+// build(command, stop) runs command to completion and returns true when the
+// image is ready, giving up early once stop is set. A speculative request,
+// for a task nobody has queued yet, only builds while the farm has nothing
+// else to do, is stopped when Retain forgets it, and becomes an ordinary
+// one when a run asks for the same image.
+class ImageBuildFarm {
+public:
+  enum class State { Unknown, Queued, Building, Ready, Failed };
+  using BuildFn =
+      std::function<bool(const std::string &command, std::atomic<bool> &stop)>;
+
+  explicit ImageBuildFarm(BuildFn build) : build_(std::move(build)) {}
+  ~ImageBuildFarm() { Stop(); }
+
+  // Concurrent builds when no limit is set; a daemon gains little from more
+  // since every build competes for the same disk and network
+  static constexpr int kDefaultBuilds = 2;
+
+  // Run up to max_builds builds at once (kDefaultBuilds when 0)
+  void Configure(int max_builds);
+  // Build task_dir's image with command unless it is already known
+  void Request(const std::string &task_dir, const std::string &command,
+               bool speculative = false);
+  // Forget every directory not in task_dirs, so a later request hashes its
+  // env/ again; builds in progress keep running
+  void Retain(const std::vector<std::string> &task_dirs);
+  State StateOf(const std::string &task_dir);
+  // Block until task_dir's image is neither queued nor building
+  State Wait(const std::string &task_dir);
+  // Builds running now
+  int Building();
+  // Stop the builds in progress and the workers for good
+  void Stop();
+
+private:
+  struct Build {
+    std::string command;
+    State state = State::Queued;
+    bool speculative = false;
+    // Handed to build_; set by Stop, or by Retain for a speculative build
+    std::shared_ptr<std::atomic<bool>> stop =
+        std::make_shared<std::atomic<bool>>(false);
+  };
+  struct Dir {
+    std::string command;
+    bool speculative = false;
+    bool hashed = false;
+    uint64_t hash = 0; // of env/, once hashed
+  };
+
+  void Work(int index);
+  State StateLocked(const std::string &task_dir) const;
+  // Make a queued speculative build an ordinary one
+  void PromoteLocked(uint64_t hash);
+
+  BuildFn build_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+  int limit_ = 0;
+  int building_ = 0;
+  bool stopping_ = false;
+  std::map<std::string, Dir> dirs_;  // by task directory
+  std::deque<std::string> unhashed_; // task directories to hash
+  std::map<uint64_t, Build> builds_; // by env hash
+  std::deque<uint64_t> queued_;      // env hashes waiting for a worker
+  std::deque<uint64_t> speculative_; // the same, taken only when idle
+};
+
+// Which Docker hosts hold the image of an env hash, and the registry digest
+// it was pushed as, from the envimage and registry events of runs and farm
+// builds. The dispatcher sends a run to a host that already has its image
+// and hands the digest to runs anywhere else, so they pull the same bytes
+// rather than build (AUTOBUILD_IMAGE_DIGEST). Hosts are endpoints, "" for
+// this one. It can go stale when a host drops an image, which only costs
+// that run a pull or build. Memory only: after a restart the script's pull
+// by env-<hash> tag stands in for the digest.
+class ImageDirectory {
+public:
+  void Record(const std::string &hash, const std::string &endpoint);
+
+  void RecordDigest(const std::string &hash, const std::string &ref);
+
+  bool Holds(const std::string &endpoint, const std::string &hash) const;
+
+  // <repo>@sha256:... of the hash's image, "" if none was pushed
+  std::string Digest(const std::string &hash) const;
+
+private:
+  static const size_t kHashes = 1024; // least recently recorded go first
+
+  struct Entry {
+    std::set<std::string> hosts;
+    std::string digest;
+    uint64_t used = 0;
+  };
+
+  Entry &Touch(const std::string &hash);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+  uint64_t clock_ = 0;
+};
+
+// Pulls the base images of queued runs (the FROM images of their env/
+// Dockerfiles, see DockerfileInfo::BaseImages) ahead of their builds, so
+// builds that start together do not each stall pulling the same image. Each
+// image is pulled once, in the order of the first scheduled task that needs
+// it, at most max_pulls at a time. Pulling is the caller's: pull(image,
+// stop) makes image local (at once when it already is) and returns false on
+// failure, giving up early once stop is set. A failed pull is not retried;
+// the build pulls again and reports the error.
+class BaseImagePuller {
+public:
+  enum class State { Unknown, Queued, Pulling, Ready, Failed };
+  using PullFn =
+      std::function<bool(const std::string &image, std::atomic<bool> &stop)>;
+
+  explicit BaseImagePuller(PullFn pull) : pull_(std::move(pull)) {}
+  ~BaseImagePuller() { Stop(); }
+
+  // Concurrent pulls when no limit is set; more only split the bandwidth
+  static constexpr int kDefaultPulls = 2;
+
+  // Run up to max_pulls pulls at once (kDefaultPulls when 0)
+  void Configure(int max_pulls);
+  // Pull the base images of task_dirs, earlier directories first. Queued
+  // images none of them needs any more are dropped; pulls in progress keep
+  // running.
+  void Schedule(const std::vector<std::string> &task_dirs);
+  State StateOf(const std::string &image);
+  // Pulls running now and images pulled so far
+  int Pulling();
+  int Pulled();
+  // Stop the pulls in progress and the workers for good
+  void Stop();
+
+private:
+  void Work(int index);
+
+  PullFn pull_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::thread> workers_;
+  int limit_ = 0;
+  int pulling_ = 0;
+  int pulled_ = 0;
+  bool stopping_ = false;
+  std::atomic<bool> stop_{false}; // handed to pull_
+  std::vector<std::string> dirs_; // as last scheduled
+  bool rescheduled_ = false;      // dirs_ changed since it was analyzed
+  bool analyzing_ = false;
+  std::map<std::string, std::vector<std::string>> bases_; // by task dir
+  std::map<std::string, State> images_;
+  std::deque<std::string> queued_; // images waiting for a worker
+};
+
+// Paces the prompt phases (Prompt 1 and 2, the audit prompt and the npx
+// verify run) of runs sharing a Gemini API key. Each key has a token bucket
+// of prompt starts per minute (unlimited at 0) and a concurrency window. A
+// rate limit reported by a run halves the window and pauses the key for the
+// API's Retry-After, or for an exponential backoff with jitter when it gave
+// none; every prompt that finishes cleanly widens the window by 1/window
+// again, up to max_running. Runs so settle just under the key's quota rather
+// than swinging between idle and rate limited. With a daily quota set, the
+// prompt starts each key was granted are also counted per quota day, which
+// starts at a fixed UTC hour, for the dispatcher to plan against (see
+// QuotaAllowsStart); only this instance's starts are counted, so other
+// users of the key take from the same quota unseen.
+class ApiGovernor {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Longest pause a rate limit without Retry-After causes
+  static constexpr double kMaxBackoffSec = 120.0;
+
+  struct Status {
+    double window = 0.0;   // prompts the key may have running
+    double paused_s = 0.0; // until prompts may start again
+    uint64_t rate_limits = 0;
+  };
+
+  // A key's quota day
+  struct Quota {
+    int limit = 0; // prompt starts per day, 0 without a daily quota
+    int used = 0;  // granted since the day began
+    double reset_in_s = 0.0;
+  };
+
+  void Configure(int starts_per_minute, int max_running);
+  // prompts_per_day of 0 turns the daily quota off
+  void ConfigureQuota(int prompts_per_day, int reset_hour_utc);
+  // Whether another prompt on key may start now, with running of its
+  // prompts in progress; takes a token from the bucket when it may
+  bool TryStart(uint64_t key, int running, Clock::time_point now);
+  // A prompt on key was rate limited. retry_after_s is the delay the API
+  // asked for (0 when none); attempt counts the run's retries from 1.
+  void RateLimited(uint64_t key, double retry_after_s, int attempt,
+                   Clock::time_point now);
+  // A prompt on key finished without being rate limited
+  void Succeeded(uint64_t key);
+  Status StatusOf(uint64_t key, Clock::time_point now);
+  Quota QuotaOf(uint64_t key, time_t now);
+
+private:
+  struct Key {
+    double tokens = 0.0;
+    double window = 0.0;
+    Clock::time_point refilled;
+    Clock::time_point paused_until;
+    uint64_t rate_limits = 0;
+    int64_t quota_day = 0; // QuotaDay the count is of
+    int quota_used = 0;
+  };
+
+  Key &KeyLocked(uint64_t key, Clock::time_point now);
+  double Burst() const;
+  int64_t QuotaDay(time_t now) const;
+
+  std::mutex mutex_;
+  std::map<uint64_t, Key> keys_;
+  double per_second_ = 0.0; // bucket refill, 0 for no rate limit
+  int max_running_ = 1;
+  int quota_per_day_ = 0;
+  int quota_reset_hour_ = 0;
+  uint64_t rng_ = 0x9e3779b97f4a7c15ULL; // jitter
+};
+
+// How urgent the runs of a batch are where the daily API quota is short:
+// High runs start whenever a slot is free, Normal ones while the quota
+// keeps its reserve, Low ones only off-peak (see QuotaAllowsStart)
+enum class BatchUrgency : uint8_t { Low, Normal, High };
+
+// The dispatcher's use of a key's quota day: reserve is the share of the
+// daily quota kept for High runs, and the off-peak window is the last
+// offpeak_s seconds of the day, whose quota is lost if it goes unused. The
+// reserve shrinks linearly to nothing over the off-peak window.
+struct QuotaPlan {
+  double reserve = 0.2;
+  double offpeak_s = 6 * 3600.0;
+};
+
+// Whether a run expected to make prompts prompt starts may start now, with
+// committed more expected from the runs already going. A Low run whose
+// deadline would pass before the off-peak window, must_start_in_s being
+// how long it can still wait (negative without a deadline), plans as a
+// Normal one. Always true without a daily quota.
+bool QuotaAllowsStart(const ApiGovernor::Quota &quota, const QuotaPlan &plan,
+                      BatchUrgency urgency, int prompts, int committed,
+                      double must_start_in_s);
+
+// Host-wide slots of one kind (runs, image builds, prompts, verifications),
+// leased by every engine instance on the host that names the same lease
+// directory: the GUIs of several users and headless runs next to them, which
+// otherwise each apply their own limits to one Docker daemon. Slot n is the
+// file <dir>/<pool>.<n>.lock, leased for as long as the pool holds an
+// exclusive lock on it, so the slots of a process that dies are free again
+// with its open files and no lease goes stale. The capacity is the <pool>
+// entry of <dir>/limits.json when that file sets one, the host's real
+// capacity in one place, else the instance's own limit.
+class HostLeasePool;
+
+// A leased slot, given back by Release or on destruction
+class HostLease {
+public:
+  HostLease() = default;
+  HostLease(HostLease &&other) noexcept { *this = std::move(other); }
+  HostLease &operator=(HostLease &&other) noexcept;
+  HostLease(const HostLease &) = delete;
+  HostLease &operator=(const HostLease &) = delete;
+  ~HostLease() { Release(); }
+
+  bool Held() const { return pool_ != nullptr; }
+  void Release();
+
+private:
+  friend class HostLeasePool;
+  HostLeasePool *pool_ = nullptr;
+  int slot_ = -1;
+};
+
+class HostLeasePool {
+public:
+  // Seconds between reads of limits.json
+  static constexpr int kLimitsRecheckSec = 5;
+  // Slots a pool can have, whatever limits.json says
+  static constexpr int kMaxSlots = 256;
+
+  explicit HostLeasePool(std::string pool) : pool_(std::move(pool)) {}
+  ~HostLeasePool();
+
+  // Lease from dir (created when missing) with capacity slots unless
+  // limits.json says otherwise; 0 is no limit of this instance's. An empty
+  // dir turns host-wide leasing off.
+  void Configure(const std::string &dir, int capacity);
+  // Lease a free slot into lease. True without one when leasing is off or
+  // the pool has no limit; false when every slot is taken.
+  bool TryAcquire(HostLease &lease);
+  // TryAcquire every second until it succeeds; false once stop is set
+  bool Acquire(HostLease &lease, const std::atomic<bool> *stop = nullptr);
+  // Slots the instances of the host hold now (probes every slot), and the
+  // capacity; both 0 when leasing is off or unlimited
+  int Leased();
+  int Capacity();
+
+private:
+  friend class HostLease;
+  struct Slot {
+    intptr_t file = -1; // descriptor, or HANDLE on Windows
+    bool held = false;
+  };
+
+  int CapacityLocked();
+  bool LockSlotLocked(int slot);
+  void UnlockSlotLocked(int slot);
+  void CloseSlotsLocked();
+  void Return(int slot);
+
+  std::mutex mutex_;
+  std::string pool_;
+  std::string dir_;
+  int capacity_ = 0;       // the instance's
+  int file_capacity_ = -1; // limits.json's, -1 when it sets none
+  bool limits_read_ = false;
+  std::chrono::steady_clock::time_point limits_read_at_;
+  std::vector<Slot> slots_;
+};
+
+// Early stop rules for a batch of runs of one task and mode (the GUI's Run
+// Multiple, a manifest's runs per mode in the headless runner). Each rule is
+// off at 0: stop after max_failures failed runs, once target_passes runs
+// passed, or once the 95% Wilson score interval on the pass rate reaches
+// within ci_half_width (a fraction, 0.1 = 10 points) of its centre.
+struct BatchPolicy {
+  int max_failures = 0;
+  int target_passes = 0;
+  double ci_half_width = 0.0;
+
+  bool Active() const {
+    return max_failures > 0 || target_passes > 0 || ci_half_width > 0.0;
+  }
+};
+
+// 95% Wilson score interval on a pass rate of passed out of total runs
+void PassRateInterval(int passed, int total, double &low, double &high);
+
+// Why a batch with these results is done ("3 failures", ...), or "" while
+// its remaining runs should go on
+std::string BatchStopReason(const BatchPolicy &policy, int passed,
+                            int failed);
+
+// How the dispatcher chooses among queued runs: task directories taking
+// turns, or by expected run time, which packs a batch of runs of mixed
+// length onto the slots with less idle time at its end
+enum class QueueOrder : uint8_t { Fair, ShortestFirst, LongestFirst };
+
+// A run waiting for a free concurrency slot. Lower priority values are
+// dispatched first, then earlier deadlines; within those, task directories
+// take turns and each directory's runs start in the order they were queued.
+// Runs the quota has no room for yet are deferred and not dispatched.
+struct QueuedTask {
+  uint64_t seq = 0; // enqueue order
+  std::string name;
+  std::string command;
+  std::string task_type; // Feedback / Verify / Both / Audit
+  std::string group;     // task directory the run belongs to
+  std::string gate_dir;  // passed to the script as --stage-gate
+  std::string context_hash; // command's --context-hash, for placement
+  uint64_t api_key_id = 0; // ApiKeyId of the key in command
+  int priority = 1;
+  uint64_t batch = 0; // RunBatch it belongs to (0 = none)
+  int retry = 0;      // times a stalled run of it was queued again
+  int backup_of = 0;  // id of the run it is a speculative backup of
+  BatchUrgency urgency = BatchUrgency::Normal; // its batch's
+  time_t deadline = 0; // its batch's, 0 for none
+  bool deferred = false;
+};
+
+// Dispatch priority per task type (lower starts first): verification runs
+// go ahead of full feedback runs and audits go last. High runs go ahead of
+// all others and Low ones after them.
+int TaskTypePriority(const std::string &task_type,
+                     BatchUrgency urgency = BatchUrgency::Normal);
+
+// Index of the queued run to start next, queue.size() when every run is
+// deferred: lowest priority value, then the earliest deadline, then the
+// task directory served longest ago (group_last_dispatch holds the dispatch
+// count it was last served at), then the oldest run. Shortest- and
+// longest-first order rank by expected seconds (per queue index, -1 where
+// unknown, which counts as the mean of the known ones) before that, and
+// fall back to fair order while nothing is known.
+size_t
+PickQueuedTask(const std::vector<QueuedTask> &queue,
+               const std::map<std::string, uint64_t> &group_last_dispatch,
+               QueueOrder order = QueueOrder::Fair,
+               const std::vector<double> &expected = {});
+
+// A host the next run could be placed on, as the dispatcher sees it
+struct PlacementHost {
+  int free = 0;               // slots it has free
+  bool holds_image = false;   // has the image of the run's context hash
+  bool last_of_group = false; // the run's task directory last ran here
+};
+
+// Where the next run goes, hosts[0] being this host and the rest remote
+// workers in configured order: a host holding its image while it has room
+// (when by_image, i.e. the run has a context hash), this one first; else
+// the worker its task directory last ran on while it has room (its image
+// is likely cached there), else this host, else the worker with the most
+// free slots. -1 when every host is full.
+int PlaceQueuedTask(const std::vector<PlacementHost> &hosts, bool by_image);
+
+// One reading of host load for the adaptive scheduler. Unknown values are
+// negative (or zero for the memory sizes).
+struct HostLoadSample {
+  int cpus = 1;
+  double load = -1.0; // 1-minute load average (busy cores on Windows)
+  uint64_t mem_total = 0;
+  uint64_t mem_available = 0;
+  int containers = -1; // running Docker containers
+};
+
+// Read load average and memory figures for the host; containers is left
+// to the caller. Fields that cannot be read on this platform keep their
+// unknown values.
+void SampleHostLoad(HostLoadSample &out);
+
+// Adaptive scheduler tuning: cores a docker build can keep busy, memory to
+// keep free before starting another run, and host limits past which queued
+// runs wait
+static const int kCoresPerBuild = 2;
+static const uint64_t kBuildMemoryReserve = 2ull << 30;
+static const double kMaxLoadPerCore = 1.0;
+static const int kMaxContainersPerCore = 2;
+
+// Concurrent builds, container setups and verifications the adaptive
+// scheduler allows: max_build_tasks when set, else one per kCoresPerBuild
+int AdaptiveBuildBudget(int max_build_tasks, int cpus);
+
+// What the adaptive scheduler weighs before it starts a run on this host.
+// Runs placed on remote workers use their own slots and are not counted.
+struct AdmissionLoad {
+  int running = 0;           // runs on this host
+  int heavy = 0;             // of those, not in their prompt phase
+  uint64_t expected_mib = 0; // memory those runs usually peak at together
+  int task_limit = 0;        // build budget plus prompt slots
+  int build_budget = 0;      // see AdaptiveBuildBudget
+  bool host_fresh = false;   // host was sampled since the last admission
+  HostLoadSample host;
+};
+
+// Why the adaptive scheduler should not start another run now, or nullptr
+// if it may. A new run begins with its image build, so it needs a build
+// slot, and the host must have room for one more. Only one run starts per
+// host sample so each admission shows up in the load figures before the
+// next.
+const char *AdaptiveHoldReason(const AdmissionLoad &load);
+
+// Fold a finished run's figure (its seconds, its prompt starts) into the
+// smoothed estimate for its task type that queue ETAs and quota planning
+// use: the first run of a type sets it, later ones move it 30% of the way
+void SmoothTaskTypeEstimate(std::map<std::string, double> &estimates,
+                            const std::string &task_type, double value);
+
+// One phase of a run as timed by autobuild.sh, which prints
+// "[TIMING] begin <phase> <epoch ms>" and
+// "[TIMING] end <phase> <epoch ms> <exit code>" around its image build,
+// container start, CLI install, each prompt, the verification and every
+// docker cp/exec outside those
+struct PhaseTiming {
+  std::string name;
+  long long start_ms = 0;
+  long long end_ms = 0; // 0 while the phase runs
+  int exit_code = 0;
+};
+
+// Fold an output line into timeline when it is a timing marker; returns
+// false and leaves timeline alone for any other line
+bool ApplyTimingMarker(std::string_view line,
+                       std::vector<PhaseTiming> &timeline);
+
+// A run event autobuild.sh prints as "[EVENT] <kind> <field> <value>", the
+// value taking the rest of the line:
+//   logdir <container name> <dir>   where the run's logs go
+//   container <id> <name>           the run's container is up
+//   image <id> <ref>                the image that container runs
+struct ScriptEvent {
+  std::string kind;
+  std::string field;
+  std::string value;
+};
+
+// Parse an output line into event; returns false for any other line
+bool ParseScriptEvent(std::string_view line, ScriptEvent &event);
+
+// One step of a BuildKit build as its plain progress output reports it:
+// "#5 [builder 2/4] RUN make" opens step 5, "#5 0.532 ..." lines are its
+// output and "#5 DONE 12.3s", "#5 CACHED", "#5 ERROR: ..." or
+// "#5 CANCELED" close it
+struct BuildStep {
+  enum State : uint8_t { Running, Done, Cached, Error, Canceled };
+  int id = 0;     // the #N, unique within one build
+  int build = 0;  // which build of the output, from 0
+  std::string name;  // "[builder 2/4] RUN make"
+  std::string stage; // "builder"; "" for an unnamed stage or no brackets
+  int index = 0, count = 0; // 2 and 4 above; 0 for non-Dockerfile steps
+  State state = Running;
+  std::string error; // the ERROR line's message
+  // Read times of the step's first and last line, and BuildKit's own
+  // duration from its DONE line (-1 when it reported none)
+  int64_t start_ms = 0, end_ms = 0;
+  double seconds = -1.0;
+  // Line numbers of the step's first and last line, and how many of the
+  // lines in between are its output
+  uint64_t first_line = 0, last_line = 0;
+  uint32_t output_lines = 0;
+
+  bool Finished() const { return state != Running; }
+  // BuildKit's duration when reported, else the span of the step's lines
+  int64_t DurationMs(int64_t now_ms) const {
+    if (seconds >= 0.0)
+      return (int64_t)(seconds * 1000.0 + 0.5);
+    return std::max<int64_t>(0, (Finished() ? end_ms : now_ms) - start_ms);
+  }
+};
+
+// Builds the step list from BuildKit plain progress output (what
+// `docker build` prints when its output is not a terminal, or with
+// --progress=plain), one line at a time. Steps are kept in the order they
+// start. Output that interleaves several steps is fine, and a log holding
+// several builds ("#0 building with ..." or a finished #1 reopening)
+// numbers them apart.
+class BuildStepParser {
+public:
+  // Fold in one line read at ms, the seq'th line of the output. Returns
+  // false for lines that are not BuildKit progress lines; those are
+  // rejected on their first byte.
+  bool Feed(std::string_view line, int64_t ms, uint64_t seq);
+
+  const std::vector<BuildStep> &steps() const { return steps_; }
+  int builds() const { return steps_.empty() ? 0 : build_ + 1; }
+  void Clear();
+
+private:
+  void StartBuild();
+
+  std::vector<BuildStep> steps_;
+  std::vector<int> by_id_; // steps_ index of each #N of the current build
+  int build_ = 0;
+  size_t build_start_ = 0; // first step of the current build
+};
+
+// Seconds each step of info took the last time it ran, from the BuildKit
+// steps of earlier builds of that Dockerfile given oldest first:
+// [stage][step], -1 for a step that never ran uncached. Steps match by
+// stage name, "i/n" position and keyword, so after an edit only the stages
+// whose step lists kept their shape are timed.
+std::vector<std::vector<double>>
+DockerfileStepSeconds(const DockerfileInfo &info,
+                      const std::vector<BuildStep> &steps);
+
+// An instruction that defeats layer caching, as LintDockerfile reports it
+struct DockerfileFinding {
+  // "copy-before-install": COPY or ADD of more than dependency manifests
+  //   ahead of a RUN in the same stage that installs packages, so editing
+  //   any file it copies reinstalls them
+  // "update-alone": a RUN that refreshes the package index without
+  //   installing; its layer stays cached while the installs after it
+  //   change, which then read a stale index
+  // "remote-add": ADD of a URL, fetched again by every build
+  std::string rule;
+  std::string message; // one line, with the fix
+  int stage = 0, step = 0; // DockerfileInfo::stages[stage].steps[step]
+  int line = 0;
+  // Steps of the stage that rerun because of it and would stay cached
+  // without it, and what a build pays for them: the sum of their
+  // step_seconds, -1 when none was timed
+  std::vector<int> reruns;
+  double seconds = -1.0;
+};
+
+// Cache-busting instructions of info, costliest first (findings without an
+// estimate last, in Dockerfile order). step_seconds is what
+// DockerfileStepSeconds measured; empty leaves every estimate at -1.
+std::vector<DockerfileFinding>
+LintDockerfile(const DockerfileInfo &info,
+               const std::vector<std::vector<double>> &step_seconds = {});
+
+// Split a command line into words, honouring single and double quotes and
+// backslash escapes
+std::vector<std::string> ParseShellCommand(const std::string &command);
+
+// Kernel sets of the SIMD code paths: scalar, SSE2 and AVX2+FMA on x86,
+// NEON on ARM. The widest one the CPU supports is picked once at runtime.
+enum class SimdPath { kScalar, kSse2, kAvx2, kNeon };
+
+SimdPath DetectSimdPath();
+bool SimdPathSupported(SimdPath path);
+const char *SimdPathName(SimdPath path);
+
+// Text kernels the log pipeline, the search shadows and JSON share: byte
+// scans that look at 16 or 32 bytes per step instead of one. Each has a
+// scalar version every SIMD path must agree with byte for byte; the
+// overloads taking a SimdPath run one path, which must be supported (for
+// benchmarks and for checking the paths agree).
+//
+// Index of the first a or b in p[0, n), or n
+size_t FindEither(const char *p, size_t n, char a, char b);
+size_t FindEither(SimdPath path, const char *p, size_t n, char a, char b);
+// Index of the first byte a JSON string has to escape ('"', '\\' or a
+// control character below 0x20) in p[0, n), or n
+size_t FindJsonEscape(const char *p, size_t n);
+size_t FindJsonEscape(SimdPath path, const char *p, size_t n);
+// dst[i] = ASCII lowercase of src[i]; other bytes, UTF-8 included, are
+// copied as they are. dst may be src.
+void FoldAsciiLower(const char *src, char *dst, size_t n);
+void FoldAsciiLower(SimdPath path, const char *src, char *dst, size_t n);
+
+// A set of bytes to scan for, such as the first bytes of a set of
+// patterns. Up to kSimdMax distinct bytes are compared a vector at a time;
+// a larger set falls back to a table lookup per byte.
+class ByteSet {
+public:
+  static constexpr size_t kSimdMax = 16;
+
+  void Add(unsigned char c) {
+    if (table_[c])
+      return;
+    table_[c] = true;
+    if (count_ < kSimdMax)
+      bytes_[count_] = (char)c;
+    count_++;
+  }
+  bool Has(unsigned char c) const { return table_[c]; }
+  size_t size() const { return count_; }
+  const char *bytes() const { return bytes_; } // first min(size, kSimdMax)
+
+private:
+  bool table_[256] = {};
+  char bytes_[kSimdMax] = {};
+  size_t count_ = 0;
+};
+
+// Index of the first byte of p[0, n) in set, or n
+size_t FindAnyOf(const char *p, size_t n, const ByteSet &set);
+size_t FindAnyOf(SimdPath path, const char *p, size_t n, const ByteSet &set);
+
+// Remove ANSI escape sequences from p[0, n) in place and return the new
+// length. CSI (ESC [ ... final byte) and OSC (ESC ] ... BEL or ESC \)
+// sequences are dropped along with short escapes such as ESC ( B; an
+// unterminated sequence drops the rest of the line. ESC bytes are located
+// with memchr, which the C runtimes vectorize (SSE2/AVX2/NEON picked at
+// runtime), so lines without escapes cost a single scan and no copy.
+size_t StripAnsiInPlace(char *p, size_t n);
+
+// Log bundles are tar archives: a 512-byte ustar header per file, its
+// bytes, zero padding to the next block and two zero blocks at the end.
+// TarFileHeader fills header for a regular file of size bytes at name,
+// which may be up to 255 bytes when it can be split at a '/' into the
+// prefix field; sizes past the octal field's 8 GiB use the GNU base-256
+// form. Returns false for a name that does not fit.
+static const size_t kTarBlock = 512;
+bool TarFileHeader(const std::string &name, uint64_t size, long long mtime,
+                   char header[kTarBlock], unsigned mode = 0644);
+inline size_t TarPadding(uint64_t size) {
+  return (size_t)((kTarBlock - size % kTarBlock) % kTarBlock);
+}
+
+// Severity tag stored with every log line. Higher values win when a line
+// matches rules of several severities.
+enum class LogSeverity : uint8_t {
+  None = 0,
+  Stopped,
+  Info,
+  Warning,
+  Success,
+  Error
+};
+static const size_t kLogSeverityCount = 6;
+
+struct LogSeverityRule {
+  LogSeverity severity;
+  std::string pattern; // case-sensitive substring
+};
+
+// Rules matching the markers the log viewer has always colored
+std::vector<LogSeverityRule> DefaultLogSeverityRules();
+
+// "error", "warning", ...; "none" for LogSeverity::None
+const char *LogSeverityName(LogSeverity severity);
+
+// Rules are written to the config as "<severity>:<pattern>", e.g.
+// "error:[ERROR]". The pattern is everything after the first colon.
+std::string FormatLogSeverityRule(const LogSeverityRule &rule);
+bool ParseLogSeverityRule(const std::string &text, LogSeverityRule &rule);
+
+// Multi-pattern line classifier (Aho-Corasick). All rule patterns are
+// compiled into one byte-indexed automaton, so a line is classified in a
+// single pass over its bytes no matter how many rules there are. Triggers
+// are further patterns that only get reported: bit i of Classify's hits is
+// set when the line contains triggers[i], found in that same pass.
+// Immutable once built, so it can be shared across threads.
+static const size_t kMaxLogTriggers = 32;
+
+class LogClassifier {
+public:
+  explicit LogClassifier(const std::vector<LogSeverityRule> &rules,
+                         const std::vector<std::string> &triggers = {});
+
+  LogSeverity Classify(std::string_view line, uint32_t *hits = nullptr) const {
+    return skip_ ? Scan<true>(line, hits) : Scan<false>(line, hits);
+  }
+
+private:
+  template <bool kSkip>
+  LogSeverity Scan(std::string_view line, uint32_t *hits) const {
+    uint8_t best = 0;
+    int32_t s = 0;
+    const char *p = line.data();
+    size_t n = line.size();
+    if (hits != nullptr && !hits_.empty()) {
+      uint32_t found = 0;
+      for (size_t i = 0; i < n; i++) {
+        if (kSkip && s == 0 && (i += FindAnyOf(p + i, n - i, start_)) == n)
+          break;
+        s = next_[(size_t)s * 256 + (unsigned char)p[i]];
+        best = std::max(best, out_[s]);
+        found |= hits_[s];
+      }
+      *hits = found;
+      return (LogSeverity)best;
+    }
+    if (hits != nullptr)
+      *hits = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (kSkip && s == 0 && (i += FindAnyOf(p + i, n - i, start_)) == n)
+        break;
+      s = next_[(size_t)s * 256 + (unsigned char)p[i]];
+      if (out_[s] > best) {
+        best = out_[s];
+        if (best == top_)
+          break; // nothing can outrank it
+      }
+    }
+    return (LogSeverity)best;
+  }
+
+  std::vector<int32_t> next_; // 256 transitions per state
+  std::vector<uint8_t> out_;  // highest severity matched on reaching a state
+  std::vector<uint32_t> hits_; // triggers matched on reaching a state
+  uint8_t top_ = 0;
+  // Bytes that leave the root. The root matches nothing and stays put on
+  // every other byte, so from it a line is skipped ahead to the next one
+  // of these; only when there are few enough to compare a vector at a time
+  ByteSet start_;
+  bool skip_ = false;
+};
+
+// What a run's output says about how it failed, pulled out as the output
+// is read so triage does not mean reading the log
+struct FailureSummary {
+  // The first error line and the few lines after it
+  std::vector<std::string> error_block;
+  // Names of failed tests, each once; the first kMaxFailedTests are kept
+  // but failed_test_count counts all of them
+  std::vector<std::string> failed_tests;
+  int failed_test_count = 0;
+  std::vector<int> exit_codes; // non-zero codes reported, each once
+  // Gemini API errors, one line per kind (RESOURCE_EXHAUSTED, ...)
+  std::vector<std::string> api_errors;
+
+  bool Empty() const {
+    return error_block.empty() && failed_test_count == 0 &&
+           exit_codes.empty() && api_errors.empty();
+  }
+  // One line for lists: the first failed test, else the first API error,
+  // else the first error line
+  std::string Headline() const;
+  // Fold in what another output of the same run found
+  void Merge(const FailureSummary &other);
+  // As fields of a JSON object, and back
+  void Write(JsonWriter &json) const;
+  void Read(const JsonValue &object);
+};
+
+static const size_t kMaxFailedTests = 20;
+
+// One kind of failure signature. The scanner calls Feed for lines that
+// hold one of its triggers (bit i of hits is Triggers()[i]) and for those
+// WantsLine asks for, such as the lines after an error.
+class FailureDetector {
+public:
+  virtual ~FailureDetector() {}
+  virtual std::vector<std::string> Triggers() const { return {}; }
+  virtual bool WantsLine(LogSeverity severity) const {
+    (void)severity;
+    return false;
+  }
+  virtual void Feed(std::string_view line, LogSeverity severity,
+                    uint32_t hits, FailureSummary &summary) = 0;
+};
+
+// The detector set run over one output: the first error block, failed test
+// names (GoogleTest, pytest, unittest, Go, Rust, CTest, Jest, TAP), exit
+// codes and Gemini API errors. The LogClassifier that tags the output must
+// be built with Triggers(), so detectors only look at lines the one
+// classification pass flagged for them. Not thread-safe; one per reader.
+class FailureScanner {
+public:
+  FailureScanner(); // with the default detectors
+  void Add(std::unique_ptr<FailureDetector> detector);
+
+  // Every detector's triggers, for LogClassifier
+  std::vector<std::string> Triggers() const;
+
+  void Feed(std::string_view line, LogSeverity severity, uint32_t hits) {
+    if (hits == 0 && !waiting_ && (severity != LogSeverity::Error || !hungry_))
+      return;
+    Dispatch(line, severity, hits);
+  }
+
+  const FailureSummary &summary() const { return summary_; }
+
+private:
+  void Dispatch(std::string_view line, LogSeverity severity, uint32_t hits);
+
+  struct Slot {
+    std::unique_ptr<FailureDetector> detector;
+    int shift = 0;
+    uint32_t mask = 0;
+  };
+  std::vector<Slot> slots_;
+  int bits_ = 0;
+  bool hungry_ = false;  // some detector wants error lines
+  bool waiting_ = false; // some detector wants the next line, whatever it is
+  FailureSummary summary_;
+};
+
+// What a prompt phase log (gemini_prompt1.log, ...) says about the API
+// requests behind it, as read by GeminiCallParser
+struct GeminiCallStats {
+  int retries = 0;   // requests the CLI retried itself ("Attempt N failed")
+  int throttled = 0; // failed requests that were rate or quota limits
+  int errors = 0;    // API errors the CLI gave up on ("[API Error: ...]")
+  uint64_t response_bytes = 0; // output other than the CLI's own logging
+
+  void Merge(const GeminiCallStats &other);
+};
+
+// Reads the Gemini CLI's --debug output one line at a time. Its logging
+// ("[DEBUG] ...", retry warnings, credential and telemetry notices, API
+// errors) is told apart from the model's answer, so response_bytes is
+// roughly what the API sent back. Not thread-safe; one per log.
+class GeminiCallParser {
+public:
+  // Fold in one line. True when it reports a rate or quota limited
+  // request; retry_after_s is then the delay it names (0 when none).
+  bool Feed(std::string_view line, double &retry_after_s);
+
+  const GeminiCallStats &stats() const { return stats_; }
+
+private:
+  GeminiCallStats stats_;
+};
+
+// One prompt phase of a run: every time the script ran the CLI for it,
+// from the [TIMING] markers, and what its log said about the API
+struct GeminiCallSummary {
+  std::string phase;    // gemini_prompt1, gemini_prompt2, gemini_audit, ...
+  int calls = 0;        // CLI runs; the script retries rate limited prompts
+  long long ms = 0;     // their wall time together
+  long long max_ms = 0; // the slowest
+  int exit_code = 0;    // of the last
+  GeminiCallStats stats;
+};
+
+// The finished gemini_* phases of timeline, in order of first start, each
+// joined with the stats of its log (log_stats is keyed by phase name, the
+// log's file name without ".log")
+std::vector<GeminiCallSummary>
+SummarizeGeminiCalls(const std::vector<PhaseTiming> &timeline,
+                     const std::map<std::string, GeminiCallStats> &log_stats);
+
+// One run (a mode directory) as recorded by autobuild.sh in
+// <logs root>/catalog.jsonl
+struct RunRecord {
+  std::string task;
+  std::string mode;
+  std::string container;
+  std::string image;        // image ID the run's containers started from
+  std::string verification; // "passed", "failed" or empty
+  std::string verify_cached; // verify cache key when that result was reused
+  std::string audit;        // the audit's Yes/No answers, "TAG=Yes ..."
+  std::string audit_cached; // audit cache key when that outcome was reused
+  long long started = 0;
+  long long ended = 0; // 0 while the run is in progress
+  int exit_code = 0;
+  std::vector<std::pair<std::string, long long>> files; // name, bytes
+  std::vector<PhaseTiming> phases;                      // timed phases
+  FailureSummary failure; // from the GUI's "summary" event, if any
+  std::vector<GeminiCallSummary> gemini; // from the GUI's "api" events
+  float cpu_peak_pct = 0.0f; // highest of its "resources" events
+  float mem_peak_mib = 0.0f;
+};
+
+// Catalog key of a mode directory: its last three path components,
+// "<task>/<run>/<mode>"; empty when it has fewer
+std::string RunCatalogKey(const std::string &dir);
+
+// Fold one catalog event (start, end, summary, api, resources) into rec;
+// a start resets it
+void ApplyRunEvent(RunRecord &rec, const JsonValue &ev);
+
+// Keyed by "<task>/<run>/<mode>", the mode directory relative to the root;
+// std::less<> so a frame can look one up by a string_view
+typedef std::map<std::string, RunRecord, std::less<>> RunCatalog;
+
+enum class RunStatus : uint8_t { Unknown, Running, Passed, Failed };
+
+// Immutable view of a logs root for the Logs Browser (see LogsIndexer):
+// <root>/<task>/<run>/<mode>/<file>, every level sorted by name
+struct LogsTreeSnapshot {
+  struct Mode {
+    std::string name;
+    std::vector<std::string> files;
+  };
+  struct Run {
+    std::string name;
+    std::vector<Mode> modes;
+    RunStatus status = RunStatus::Unknown; // from the catalog
+    std::string failure = {}; // headline of a failed mode's failure summary
+    // Time its finished modes ran, counting modes that ran side by side
+    // (both --parallel) once
+    long long seconds = 0;
+  };
+  struct Task {
+    std::string name;
+    std::vector<Run> runs;
+  };
+  std::string root;
+  bool exists = false;
+  std::vector<Task> tasks;
+  std::shared_ptr<const RunCatalog> catalog;
+};
+
+// Maintains the logs tree on a background thread. The tree is scanned once
+// per root; afterwards only directories reported by change notifications
+// (inotify, FSEvents or ReadDirectoryChangesW) are listed again. The UI
+// thread draws from the last published snapshot and never touches the
+// filesystem. Events read from the root's catalog.jsonl are folded into
+// the snapshot's run catalog as they arrive.
+class LogsIndexer {
+public:
+  // Called from the indexer thread
+  struct Hooks {
+    std::function<void()> thread_start;
+    // Each catalog.jsonl event once it is folded into rec, the record of
+    // the mode directory dir (as the script wrote it) under key
+    std::function<void(const std::string &key, const std::string &dir,
+                       const RunRecord &rec, const JsonValue &ev)>
+        catalog_event;
+  };
+
+  explicit LogsIndexer(Hooks hooks = {});
+  ~LogsIndexer();
+
+  // Latest snapshot; switches the index to root when it changed. The
+  // snapshot may still describe the previous root (or be null) until the
+  // first scan of a new root completes.
+  std::shared_ptr<const LogsTreeSnapshot> Get(const std::string &root);
+
+  // Re-list dir soon, e.g. after the browser deleted something inside it
+  void Touch(const std::string &dir);
+
+  void Stop();
+
+  // List a directory: subdirectories, or regular files when files is set
+  static std::vector<std::string> List(const std::string &path, bool files) {
+    return ListDirectory(path, files);
+  }
+
+private:
+  // Mutable tree owned by the indexer thread; depth 0 is the root, depth 3
+  // a mode directory holding files
+  struct Node {
+    std::map<std::string, Node> dirs;
+    std::vector<std::string> files;
+  };
+  static const int kFileDepth = 3;
+  // Change notifications for the indexed tree: inotify, FSEvents or
+  // ReadDirectoryChangesW, whichever the platform has
+  struct Watcher;
+
+  void Run();
+
+  // (Re)list one directory; new subdirectories are scanned in full, known
+  // ones are kept as they are
+  void Scan(const std::string &path, int depth, Node &node);
+
+  void Rebuild(const std::string &root);
+
+  // Re-list dir, or its nearest ancestor known to the tree
+  void Refresh(const std::string &root, const std::string &dir);
+
+  void ResetCatalog(const std::string &root);
+
+  // Read lines appended to catalog.jsonl since the last poll. Returns true
+  // when the catalog changed.
+  bool PollCatalog();
+
+  void ApplyCatalogEvent(RunCatalog &catalog, const JsonValue &ev);
+
+  void Publish(const std::string &root);
+
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::string root_;
+  std::vector<std::string> touched_;
+  std::shared_ptr<const LogsTreeSnapshot> snapshot_;
+  std::thread thread_;
+  bool stop_ = false;
+
+  // Indexer thread only
+  Node tree_;
+  bool exists_ = false;
+  std::string catalog_root_;
+  long long catalog_offset_ = 0;
+  std::string catalog_partial_;
+  std::shared_ptr<const RunCatalog> catalog_ =
+      std::make_shared<const RunCatalog>();
+  std::unique_ptr<Watcher> watcher_;
+};
+
+// Export of a catalog.jsonl to a Parquet file for analytics tools (DuckDB,
+// pandas, Spark): one row per run, appended as row groups as runs finish.
+// A run is written once it ended kExportSettleMs ago, so the GUI's late
+// summary and api events are in; one that never ended is written a day
+// after it started. The file's footer remembers how far into the catalog
+// it got, so each call reads only what was appended since; when the
+// catalog was replaced or the file is not one this wrote, it starts over.
+struct CatalogExportResult {
+  size_t rows = 0;       // rows appended by this call
+  size_t total_rows = 0; // rows in the file
+  std::string error;     // empty on success
+};
+
+static const long long kExportSettleMs = 60 * 1000;
+
+bool ExportRunCatalog(const std::string &catalog_path,
+                      const std::string &parquet_path, long long now_ms,
+                      CatalogExportResult &result);
+
+// Filter query of the log views, the Logs Browser and the logs search, e.g.
+//   sev:error phase:verify "timed out" -npm
+// Terms are ANDed and a leading '-' negates one. A bare word or quoted
+// phrase is a case-insensitive substring of the line. Operators:
+//   sev:<name>[,<name>...]  the line's severity tag, by name or its prefix
+//   phase:<name>            read while a timed phase whose name contains
+//                           <name> ran (verify stands for verification)
+//   task:<text>             the task, run or file name contains <text>
+//   mode:<name>             the run ran in that mode (feedback, verify, ...)
+//   status:<s>              the run passed, failed or is running
+//   after:/before:HH:MM[:SS] local time of day, since:<n>[smhd] the last n
+// A word whose key is none of these (http://..., error:) is plain text.
+// Compiled once into a plan that tests the cheap one-byte and time terms
+// before any substring, so a view can run it on every line as it arrives.
+struct LogQueryLine {
+  std::string_view lower; // the line, lowercased
+  LogSeverity severity = LogSeverity::None;
+  long long ms = 0; // epoch ms the line was read; 0 when not known
+  // Timeline of the line's run; null when phases are not known per line
+  // (phase terms were then decided for the file, see MatchFile)
+  const std::vector<PhaseTiming> *phases = nullptr;
+  // Lowercase name of the task or file the line is from; null when not
+  // known (task terms were then decided elsewhere)
+  const std::string *source = nullptr;
+};
+
+// A run as the Logs Browser lists it, for LogQuery::MatchRun
+struct LogQueryRun {
+  std::string name;    // "<task>/<run>", lowercased
+  std::string failure; // failure headline, lowercased
+  std::string status;  // "passed", "failed", "running" or ""
+  std::vector<std::string> modes; // mode directories, lowercased
+  std::vector<PhaseTiming> phases;
+  long long started_ms = 0; // epoch ms; 0 when not known
+};
+
+class LogQuery {
+public:
+  // Compile text; false (with a message, leaving a query that matches
+  // everything) when an operator's value does not parse. now_ms is the
+  // epoch ms since: counts back from and that time of day is taken at.
+  bool Compile(const std::string &text, long long now_ms,
+               std::string *error = nullptr);
+
+  const std::string &text() const { return text_; }
+  bool empty() const { return terms_.empty(); }
+  bool UsesSeverity() const { return uses_severity_; }
+  // Whether it has time or phase terms, which need each line's read time
+  bool UsesTime() const { return uses_time_; }
+
+  // Lowercase substrings every matching line contains, longest first; for
+  // an index to rule out files and a scan to find candidate lines
+  const std::vector<std::string> &Needles() const { return needles_; }
+
+  // True when every line this query matches is also matched by prev, so a
+  // view can narrow prev's results in place instead of starting over
+  bool Refines(const LogQuery &prev) const;
+
+  bool MatchLine(const LogQueryLine &line) const;
+  // The per-file part of a logs search: task terms against the file's
+  // label, phase terms against its name (a phase log is named after its
+  // phase) and time terms against when it was last written
+  bool MatchFile(const std::string &lower_label, long long mtime_ms) const;
+  // Line-only terms (text, sev) are tested against the run's name and
+  // failure headline, or left out
+  bool MatchRun(const LogQueryRun &run) const;
+
+private:
+  enum class Kind : uint8_t {
+    Severity, After, Before, Since, Task, Mode, Status, Phase, Text
+  };
+  struct Term {
+    Kind kind;
+    bool negated = false;
+    uint32_t severities = 0; // Severity: bit per LogSeverity
+    long long value = 0;     // After, Before: ms of day; Since: epoch ms
+    std::string text;        // lowercase
+  };
+
+  bool TimeMatches(const Term &term, long long ms) const;
+  static bool PhaseMatches(const std::string &want, const std::string &name);
+
+  std::string text_;
+  std::vector<Term> terms_; // in Kind order, cheapest first
+  std::vector<std::string> needles_;
+  long long utc_offset_ms_ = 0; // local time minus UTC at compile time
+  bool uses_severity_ = false;
+  bool uses_time_ = false;
+};
+
+// Incremental line splitter for pipe output, shared by every process runner.
+// Reads land directly in the splitter's buffer (Prepare/Commit) and complete
+// lines are handed out as string_views into it, so a line is not copied on
+// its way to the callback. Consumed bytes are reclaimed lazily, only when a
+// read needs room, instead of shifting the tail after every read. LF and
+// CR LF end a line; a CR followed by anything else is a progress-bar style
+// overwrite, so the text before it is dropped and only the final state of
+// the line is emitted. Empty lines are skipped.
+class LineSplitter {
+public:
+  explicit LineSplitter(bool strip_ansi = false) : strip_ansi_(strip_ansi) {}
+
+  // Writable space for at least n bytes; fill it, then Commit what was read
+  char *Prepare(size_t n) {
+    if (buf_.size() - end_ < n) {
+      if (begin_ > 0) {
+        memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        scan_ -= begin_;
+        begin_ = 0;
+      }
+      if (buf_.size() - end_ < n)
+        buf_.resize(std::max(buf_.size() * 2, end_ + n));
+    }
+    return buf_.data() + end_;
+  }
+  void Commit(size_t n) { end_ += n; }
+
+  void Append(const char *data, size_t n) {
+    memcpy(Prepare(n), data, n);
+    Commit(n);
+  }
+
+  // Hand every complete line to fn(std::string_view). The view points into
+  // the splitter and is only valid during the call.
+  template <typename Fn> void Drain(Fn &&fn) {
+    char *p = buf_.data();
+    while (scan_ < end_) {
+      size_t nl = scan_ + FindEither(p + scan_, end_ - scan_, '\n', '\r');
+      if (nl == end_) {
+        scan_ = end_;
+        return;
+      }
+      if (p[nl] == '\n') {
+        Emit(fn, begin_, nl);
+        begin_ = scan_ = nl + 1;
+      } else if (nl + 1 == end_) {
+        scan_ = nl; // CR at the end: wait to see if LF follows
+        return;
+      } else if (p[nl + 1] == '\n') {
+        Emit(fn, begin_, nl);
+        begin_ = scan_ = nl + 2;
+      } else {
+        begin_ = scan_ = nl + 1; // overwritten by what follows
+      }
+    }
+  }
+
+  // End of stream: emit the last line even without a terminator
+  template <typename Fn> void Finish(Fn &&fn) {
+    Drain(fn);
+    size_t stop = end_;
+    if (stop > begin_ && buf_[stop - 1] == '\r')
+      stop--;
+    Emit(fn, begin_, stop);
+    begin_ = scan_ = end_ = 0;
+  }
+
+private:
+  template <typename Fn> void Emit(Fn &fn, size_t from, size_t to) {
+    size_t len = to - from;
+    if (strip_ansi_ && len > 0)
+      len = StripAnsiInPlace(buf_.data() + from, len);
+    if (len > 0)
+      fn(std::string_view(buf_.data() + from, len));
+  }
+
+  std::vector<char> buf_;
+  size_t begin_ = 0; // start of the current partial line
+  size_t scan_ = 0;  // bytes before this hold no terminator
+  size_t end_ = 0;   // end of committed data
+  bool strip_ansi_;
+};
+
+// Milliseconds on a monotonic clock, which log lines are stamped with as
+// they are read; only differences between two readings mean anything. On
+// Linux the coarse clock is read (a few ms resolution, but no timer read
+// per line), elsewhere the steady clock.
+inline int64_t MonotonicMs() {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// LEB128 varints for the per-line time deltas: 7 bits a byte, low bits
+// first, so a delta under 128 ms takes one byte
+static const size_t kMaxVarint = 10;
+
+inline size_t PutVarint(char *p, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (char)v;
+  return n;
+}
+
+inline const char *GetVarint(const char *p, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned char b = (unsigned char)*p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (b < 0x80)
+      break;
+  }
+  return p;
+}
+
+// Line texts shared by many LogArenas, so the runs of parallel copies of a
+// task, whose build and install output is mostly the same, hold each
+// distinct line once. Every arena row using a text is one reference; the
+// text is freed with its last. Texts never move, so rows read them without
+// the lock, which only guards interning and releasing.
+class LinePool {
+public:
+  // Shorter lines stay in the arena's own blocks, where they cost less than
+  // an entry here
+  static constexpr size_t kMinLength = 24;
+
+  // Stable copy of line, holding one more reference to it
+  const char *Intern(std::string_view line);
+  // Drop a reference Intern handed out for line
+  void Release(std::string_view line);
+
+  size_t size() const;
+  // Heap held by the texts and their index
+  size_t MemoryBytes() const;
+
+private:
+  struct Entry {
+    std::unique_ptr<char[]> text;
+    size_t refs = 0;
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string_view, Entry> entries_; // keys view text
+  size_t text_bytes_ = 0;
+};
+
+// Append-only log text store. Line text is packed into 64 KiB blocks and
+// each line is an offset/length span, so appending costs no per-line heap
+// allocation and lines are read back as string_views into the blocks. With a
+// line cap, the oldest spans are trimmed and blocks no longer referenced by
+// any span are released, which keeps memory per log predictable. Each line
+// also carries a one-byte tag (its LogSeverity for task logs).
+// With kCollapseRepeats, a line identical to the last one (same text and
+// tag) is not stored again but counted on that row, the way a pager folds
+// a run of repeated lines; rows, not lines, then make up size() and
+// TotalAppended().
+// With kTimestamps, every row records when its first line was read, as a
+// varint right after its text: the quiet time since the line before it
+// and, after a folded row, how long that row's run of repeats lasted.
+// Absolute times are kept every kTimeStride rows so a row's time is never
+// more than that many deltas away.
+// With a LinePool, lines of at least LinePool::kMinLength bytes are interned
+// there instead and the row keeps a pointer to the shared text; its
+// timestamp deltas stay in the blocks. MemoryBytes() then leaves the shared
+// texts out, as the pool holds them for every arena using it.
+class LogArena {
+public:
+  static constexpr size_t kBlockSize = 64 * 1024;
+  // Lines one row can stand for before the next copy starts a new row
+  static constexpr uint32_t kMaxRepeats = 65536;
+  static constexpr size_t kTimeStride = 64;
+
+  enum Flags : unsigned {
+    kCollapseRepeats = 1,
+    kTimestamps = 2,
+  };
+
+  explicit LogArena(size_t max_lines = 0, unsigned flags = 0,
+                    LinePool *pool = nullptr)
+      : max_lines_(max_lines), flags_(flags), pool_(pool) {}
+  ~LogArena() { ReleaseShared(spans_.size()); }
+  LogArena(const LogArena &) = delete;
+  LogArena &operator=(const LogArena &) = delete;
+
+  // ms is the line's MonotonicMs() reading, kept with kTimestamps. Returns
+  // false when the line was folded into the last row.
+  bool Append(std::string_view line, uint8_t tag = 0, int64_t ms = 0) {
+    if ((flags_ & kCollapseRepeats) && !spans_.empty()) {
+      Span &last = spans_.back();
+      if (last.tag == tag && (uint32_t)last.repeats + 1 < kMaxRepeats &&
+          back() == line) {
+        last.repeats++;
+        last_ms_ = std::max(last_ms_, ms);
+        return false;
+      }
+    }
+    const char *text = nullptr;
+    if (pool_ && line.size() >= LinePool::kMinLength)
+      text = pool_->Intern(line);
+    size_t stored = text ? 0 : line.size();
+    size_t need = stored + ((flags_ & kTimestamps) ? 2 * kMaxVarint : 0);
+    if (blocks_.empty() || block_used_ + need > block_capacity_) {
+      // Oversized lines get a block of their own
+      block_capacity_ = std::max(kBlockSize, need);
+      blocks_.push_back({std::unique_ptr<char[]>(new char[block_capacity_]),
+                         block_capacity_});
+      block_bytes_ += block_capacity_;
+      block_used_ = 0;
+    }
+    char *dst = blocks_.back().data.get() + block_used_;
+    if (stored > 0)
+      memcpy(dst, line.data(), stored);
+    size_t used = stored;
+    if (flags_ & kTimestamps)
+      used += StampRow(dst + stored, ms);
+    spans_.push_back({first_block_ + blocks_.size() - 1, tag, 0,
+                      (uint32_t)block_used_, (uint32_t)line.size()});
+    if (pool_)
+      shared_.push_back(text);
+    block_used_ += used;
+    total_appended_++;
+    if (max_lines_ > 0 && spans_.size() > max_lines_)
+      TrimFront(spans_.size() - max_lines_);
+    return true;
+  }
+
+  // Drop the n oldest lines, releasing blocks they no longer share
+  void TrimFront(size_t n) {
+    n = std::min(n, spans_.size());
+    if ((flags_ & kTimestamps) && n > 0 && n < spans_.size()) {
+      front_ms_ = Time(n);
+      front_quiet_ms_ = QuietBefore(n);
+    }
+    ReleaseShared(n);
+    spans_.erase(spans_.begin(), spans_.begin() + n);
+    uint64_t keep_from = spans_.empty() ? first_block_ + blocks_.size() - 1
+                                        : spans_.front().block;
+    while (first_block_ < keep_from && blocks_.size() > 1) {
+      block_bytes_ -= blocks_.front().size;
+      blocks_.pop_front();
+      first_block_++;
+    }
+    // Checkpoints at or before the front row are covered by front_ms_
+    uint64_t first_seq = total_appended_ - spans_.size();
+    while (!checkpoints_.empty() &&
+           checkpoint_base_ * kTimeStride <= first_seq) {
+      checkpoints_.pop_front();
+      checkpoint_base_++;
+    }
+  }
+
+  void Clear() {
+    ReleaseShared(spans_.size());
+    spans_.clear();
+    blocks_.clear();
+    block_bytes_ = 0;
+    first_block_ = 0;
+    block_used_ = 0;
+    block_capacity_ = 0;
+    checkpoints_.clear();
+  }
+
+  size_t size() const { return spans_.size(); }
+  bool empty() const { return spans_.empty(); }
+
+  std::string_view operator[](size_t i) const {
+    const Span &sp = spans_[i];
+    if (pool_ && shared_[i])
+      return std::string_view(shared_[i], sp.length);
+    return std::string_view(
+        blocks_[sp.block - first_block_].data.get() + sp.offset, sp.length);
+  }
+  std::string_view back() const { return (*this)[spans_.size() - 1]; }
+  uint8_t Tag(size_t i) const { return (uint8_t)spans_[i].tag; }
+  // How many consecutive lines row i stands for (1 unless folded)
+  uint32_t Count(size_t i) const { return (uint32_t)spans_[i].repeats + 1; }
+
+  // With kTimestamps: when row i's first line was read (MonotonicMs), and
+  // how long no line at all had been read before it (0 for the first row
+  // ever appended)
+  int64_t Time(size_t i) const;
+  int64_t QuietBefore(size_t i) const;
+  // Time(i + 1) given time_i = Time(i): one row's deltas decoded instead of
+  // up to kTimeStride, for walking rows in order
+  int64_t TimeAfter(size_t i, int64_t time_i) const;
+  // Read time of the first line ever appended, the origin of relative
+  // times; 0 before any
+  int64_t FirstTime() const { return first_ms_; }
+
+  // Lines ever appended; the line at index i has sequence number
+  // TotalAppended() - size() + i
+  uint64_t TotalAppended() const { return total_appended_; }
+  // Heap held by the text blocks and the line index
+  size_t MemoryBytes() const {
+    return block_bytes_ + spans_.size() * sizeof(Span) +
+           shared_.size() * sizeof(const char *) +
+           checkpoints_.size() * sizeof(int64_t);
+  }
+
+private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+  struct Span {
+    uint64_t block : 40; // absolute block number
+    uint64_t tag : 8;
+    uint64_t repeats : 16; // copies folded into this row
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  // Write the deltas of a new row read at ms to p; returns their size
+  size_t StampRow(char *p, int64_t ms);
+  // The deltas stored after row i's text (or in its place, when the text
+  // is shared)
+  void RowDeltas(size_t i, uint64_t &quiet, uint64_t &run) const;
+  // Hand the shared texts of the n front rows back to the pool
+  void ReleaseShared(size_t n);
+
+  size_t max_lines_;
+  unsigned flags_;
+  std::deque<Block> blocks_;
+  size_t block_bytes_ = 0;
+  uint64_t first_block_ = 0; // absolute number of blocks_.front()
+  size_t block_used_ = 0;
+  size_t block_capacity_ = 0;
+  std::deque<Span> spans_;
+  uint64_t total_appended_ = 0;
+  // With a pool: each row's shared text, null where it is in the blocks
+  LinePool *pool_;
+  std::deque<const char *> shared_;
+
+  // Timestamps: the newest line's time (the last copy of a folded row),
+  // the newest row's, the first line's, the front row's, and the absolute
+  // time of row seq k * kTimeStride at checkpoints_[k - checkpoint_base_]
+  int64_t last_ms_ = 0;
+  int64_t back_ms_ = 0;
+  int64_t first_ms_ = 0;
+  int64_t front_ms_ = 0;
+  int64_t front_quiet_ms_ = 0;
+  std::deque<int64_t> checkpoints_;
+  uint64_t checkpoint_base_ = 0;
+};
+
+// Fixed-capacity single-producer/single-consumer queue carrying a task's
+// output lines to the render thread without locking. The producer is
+// whichever thread currently feeds the task (the starter thread before
+// launch, the process reactor afterwards); the consumer is the render thread.
+// head/tail are monotonic sequence numbers, so a slot index is seq & kMask.
+class LogLineRing {
+public:
+  static constexpr size_t kCapacity = 4096; // power of two
+
+  // Producer side. When the consumer is a full ring behind the line is
+  // dropped (and counted) rather than blocking the reactor. Slots are
+  // assigned in place, so once warmed up they reuse their capacity instead
+  // of allocating per line. ms is when the line was read (MonotonicMs).
+  bool Push(std::string_view line, uint8_t tag = 0, int64_t ms = 0) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= kCapacity) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slots_[head & kMask].assign(line.data(), line.size());
+    tags_[head & kMask] = tag;
+    times_[head & kMask] = ms;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: hand every line published since the last call to fn (as
+  // a string_view valid only during the call, plus its tag and read time)
+  // and release the slots.
+  // Returns the number of lines drained.
+  template <typename Fn> size_t Drain(Fn &&fn) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    for (uint64_t seq = tail; seq != head; ++seq)
+      fn(std::string_view(slots_[seq & kMask]), tags_[seq & kMask],
+         times_[seq & kMask]);
+    tail_.store(head, std::memory_order_release);
+    return (size_t)(head - tail);
+  }
+
+  // Producer side: slots a Push can fill without dropping
+  size_t Free() const {
+    return kCapacity - (size_t)(head_.load(std::memory_order_relaxed) -
+                                tail_.load(std::memory_order_acquire));
+  }
+
+  // Total lines ever published (the next line's sequence number)
+  uint64_t Published() const { return head_.load(std::memory_order_acquire); }
+  uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr size_t kMask = kCapacity - 1;
+  std::unique_ptr<std::string[]> slots_{new std::string[kCapacity]};
+  std::unique_ptr<uint8_t[]> tags_{new uint8_t[kCapacity]};
+  std::unique_ptr<int64_t[]> times_{new int64_t[kCapacity]};
+  // Separate cache lines so producer and consumer do not false-share
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+// Overload policy for a task's or phase log's in-memory windows, applied by
+// the producer ahead of LogLineRing::Push; the spool file (or the phase log
+// itself) keeps every line whatever it decides. Within each second the
+// first lines_per_sec lines all go through. Past that it samples, letting
+// one line in kSampleEvery through and every warning and error. Past
+// kSummaryFactor times the rate it only summarizes, letting nothing more
+// through that second. Once a second at most, the first line of a second
+// let through in full after lines were skipped is preceded by a marker line
+// saying how many, tagged kMarkerTag. Nothing here waits, so the child is
+// never held up. The consumer folds the skipped lines into its severity
+// counts with Collect.
+class IngestThrottle {
+public:
+  static constexpr uint8_t kMarkerTag = 0x80;
+  static constexpr int kSampleEvery = 10;
+  static constexpr int kSummaryFactor = 10;
+
+  // Producer side: whether the line, of severity tag and read at ms, goes
+  // to the windows (always with lines_per_sec 0). When a marker is due,
+  // marker receives the line to push ahead of it; it is cleared otherwise.
+  bool Admit(int lines_per_sec, uint8_t tag, int64_t ms, std::string &marker) {
+    marker.clear();
+    if (ms - window_ms_ >= 1000) {
+      window_ms_ = ms;
+      window_lines_ = 0;
+    }
+    uint64_t n = window_lines_++;
+    bool admit = lines_per_sec <= 0 || n < (uint64_t)lines_per_sec;
+    if (!admit) {
+      over_ms_.store(ms, std::memory_order_relaxed);
+      uint64_t over = n - (uint64_t)lines_per_sec;
+      admit = over < (uint64_t)lines_per_sec * (kSummaryFactor - 1) &&
+              (over % kSampleEvery == 0 ||
+               tag == (uint8_t)LogSeverity::Warning ||
+               tag == (uint8_t)LogSeverity::Error);
+      if (!admit) {
+        skipped_[tag < kLogSeverityCount ? tag : 0].fetch_add(
+            1, std::memory_order_relaxed);
+        total_skipped_.fetch_add(1, std::memory_order_relaxed);
+        gap_++;
+        gap_rate_ = lines_per_sec;
+      }
+      return admit;
+    }
+    if (gap_ > 0) {
+      marker = "[... " + std::to_string(gap_) +
+               " lines skipped: output over " + std::to_string(gap_rate_) +
+               " lines/s, the log file has every line ...]";
+      gap_ = 0;
+    }
+    return true;
+  }
+
+  // Consumer side: add the lines skipped since the last call to counts, per
+  // severity, and return how many there were
+  uint64_t Collect(uint64_t *counts) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < kLogSeverityCount; i++) {
+      uint64_t n = skipped_[i].exchange(0, std::memory_order_relaxed);
+      counts[i] += n;
+      total += n;
+    }
+    return total;
+  }
+
+  // Whether lines were over the rate within the last two seconds
+  bool Overloaded(int64_t now_ms) const {
+    int64_t over = over_ms_.load(std::memory_order_relaxed);
+    return over != 0 && now_ms - over < 2000;
+  }
+  uint64_t Skipped() const {
+    return total_skipped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  // Producer only
+  int64_t window_ms_ = 0;
+  uint64_t window_lines_ = 0;
+  uint64_t gap_ = 0; // lines skipped since the last marker
+  int gap_rate_ = 0;
+  std::atomic<int64_t> over_ms_{0};
+  std::atomic<uint64_t> skipped_[kLogSeverityCount] = {};
+  std::atomic<uint64_t> total_skipped_{0};
+};
+
+// A task's output lines in a named shared-memory segment, so other
+// processes (tailers, the dashboard, editor plugins) can follow many tasks
+// at full rate without re-reading log files. One writer appends; any number
+// of readers map the segment read-only and never delay it.
+//
+// The segment is "autobuild-<pid>-<task id>" (POSIX shm_open name with a
+// leading '/', "Local\" on Windows): a SharedLogRingHeader, then a ring of
+// data_bytes (a power of two) holding records. A record is a
+// SharedLogRecord, its text and padding to 8 bytes, never split across the
+// end of the ring: where one would not fit, a pad record (length
+// kSharedLogPad) fills the rest and the record starts over at offset 0.
+// Positions are byte counts since the segment was created; the byte at
+// position p is at data + (p & (data_bytes - 1)).
+//
+// The writer publishes a record by storing head (release) past it. Before
+// writing over older records it moves tail past them, then issues a release
+// fence. A reader keeps its own position pos, starting at tail (the oldest
+// line kept) or head (new lines only), and while pos < head:
+//   1. if pos < tail (acquire), it was lapped: skip ahead to tail;
+//   2. copy the record at pos (and its text, unless it is a pad);
+//   3. acquire fence, then load tail; if tail > pos now the copy may be torn:
+//      drop it and go to 1, else use it and advance pos by its bytes.
+// Sequence numbers count records from 0, so a lapped reader learns how many
+// lines it missed from the first seq it reads next. closed is set once the
+// run is over and head will not move again. SharedLogReader implements the
+// protocol.
+struct SharedLogRingHeader {
+  static constexpr char kMagic[8] = {'A', 'B', 'L', 'R', 'I', 'N', 'G', '1'};
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t header_bytes; // offset of the ring from the segment's start
+  uint64_t data_bytes;
+  uint64_t writer_pid;
+  uint64_t task_id;
+  // Add to a record's ms for milliseconds since the Unix epoch
+  int64_t epoch_offset_ms;
+  alignas(64) std::atomic<uint64_t> head; // end of the newest record
+  std::atomic<uint64_t> tail;             // start of the oldest record
+  std::atomic<uint64_t> lines;            // records written, pads aside
+  std::atomic<uint32_t> closed;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shared log rings need lock-free 64-bit atomics");
+
+struct SharedLogRecord {
+  uint32_t bytes;  // of the whole record, padding included
+  uint32_t length; // of its text, or kSharedLogPad
+  uint64_t seq;
+  int64_t ms; // read time, MonotonicMs
+  uint8_t tag; // the log severity it was classified as
+  uint8_t reserved[7];
+};
+static constexpr uint32_t kSharedLogPad = 0xffffffffu;
+
+// Writer side
+class SharedLogRing {
+public:
+  static constexpr size_t kDefaultBytes = 1 << 20;
+
+  ~SharedLogRing() { Close(); }
+
+  // Segment name for a task of this process
+  static std::string NameFor(int task_id);
+  // Create the segment (replacing a stale one of the same name) with a ring
+  // of data_bytes, rounded up to a power of two; false if it cannot be
+  // created
+  bool Create(int task_id, size_t data_bytes = kDefaultBytes);
+  // Single producer, as LogLineRing::Push; lines longer than a quarter of
+  // the ring are cut to that
+  void Append(std::string_view line, uint8_t tag, int64_t ms);
+  // The run is over; readers see closed once they reach head
+  void Finish();
+  // Unmap and remove the segment; readers that mapped it keep their view
+  void Close();
+  // Remove the segments of processes that are no longer running (Linux,
+  // where /dev/shm lists them)
+  static void RemoveStale();
+
+  bool Open() const { return header_ != nullptr; }
+  const std::string &name() const { return name_; }
+
+private:
+  // Move tail past every record the bytes up to end would overwrite
+  void ReclaimTo(uint64_t end);
+
+  std::string name_;
+  SharedLogRingHeader *header_ = nullptr;
+  char *data_ = nullptr;
+  uint64_t mask_ = 0;
+  uint64_t head_ = 0; // the writer's copies
+  uint64_t tail_ = 0;
+  uint64_t seq_ = 0;
+  size_t mapped_bytes_ = 0;
+#ifdef _WIN32
+  void *mapping_ = nullptr;
+#endif
+};
+
+// Reader side of a SharedLogRing, in any process
+class SharedLogReader {
+public:
+  ~SharedLogReader() { Close(); }
+
+  // Map the segment name (as SharedLogRing::NameFor gives it); from_start
+  // reads the oldest line kept first, else only lines appended after this.
+  // False when it does not exist or is not a log ring.
+  bool Open(const std::string &name, bool from_start = true);
+  void Close();
+  // Hand every complete line past the last call to fn(text, tag, epoch ms),
+  // text valid only during the call; returns the lines handed over.
+  // Lines the writer overwrote first are counted in Missed.
+  template <typename Fn> size_t Poll(Fn &&fn) {
+    size_t n = 0;
+    SharedLogRecord rec;
+    while (Next(rec)) {
+      fn(std::string_view(text_), rec.tag, rec.ms + header_->epoch_offset_ms);
+      n++;
+    }
+    return n;
+  }
+  uint64_t Missed() const { return missed_; }
+  // The writer finished and every line was read
+  bool Done() const;
+  uint64_t WriterPid() const { return header_ ? header_->writer_pid : 0; }
+
+private:
+  // The next valid record into rec and its text into text_
+  bool Next(SharedLogRecord &rec);
+
+  const SharedLogRingHeader *header_ = nullptr;
+  const char *data_ = nullptr;
+  uint64_t mask_ = 0;
+  uint64_t pos_ = 0;
+  uint64_t next_seq_ = 0;
+  bool seq_known_ = false;
+  uint64_t missed_ = 0;
+  std::string text_;
+  size_t mapped_bytes_ = 0;
+#ifdef _WIN32
+  void *mapping_ = nullptr;
+#endif
+};
+
+// Debug log behind ConsoleLog and DevLog. Log neither formats nor writes:
+// it copies the message and its time into a slot of a bounded lock-free
+// multi-producer queue (Vyukov's sequence-numbered ring) and returns, so
+// reader threads and the render loop never wait on the console. One
+// background thread, started by the first Log, stamps "[HH:MM:SS.mmm] ",
+// writes whatever has queued up with a single flush, and keeps the last
+// overlay_lines overlay messages for the dev overlay. A full queue drops
+// the message; the console is told how many were dropped. After Stop, Log
+// writes synchronously.
+class AsyncLogger {
+public:
+  enum : uint8_t { kConsole = 1, kOverlay = 2 }; // sinks of a message
+  static constexpr size_t kCapacity = 4096;       // power of two
+
+  explicit AsyncLogger(size_t overlay_lines, FILE *out = stdout);
+  ~AsyncLogger() { Stop(); }
+
+  // Any thread
+  void Log(std::string_view message, uint8_t sinks);
+  // Write everything queued and stop the thread
+  void Stop();
+  uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  // fn(const LogArena &) with the overlay messages, under their lock
+  template <typename Fn> void ReadOverlay(Fn &&fn) {
+    std::lock_guard<std::mutex> lock(overlay_mutex_);
+    fn((const LogArena &)overlay_);
+  }
+  void ClearOverlay() {
+    std::lock_guard<std::mutex> lock(overlay_mutex_);
+    overlay_.Clear();
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0}; // position it is free for, or filled at + 1
+    int64_t ms = 0;                // epoch milliseconds
+    uint8_t sinks = 0;
+    std::string text; // keeps its capacity from message to message
+  };
+
+  void Run();
+  // Append "[HH:MM:SS.mmm] message\n" to out
+  void Format(int64_t ms, std::string_view message, std::string &out);
+
+  static constexpr size_t kMask = kCapacity - 1;
+  std::unique_ptr<Slot[]> slots_{new Slot[kCapacity]};
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) uint64_t tail_ = 0; // consumer thread only
+  std::atomic<uint64_t> dropped_{0};
+  uint64_t reported_dropped_ = 0; // consumer thread only
+  std::atomic<bool> sleeping_{false};
+  std::atomic<bool> stopped_{false};
+  std::once_flag started_;
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+  FILE *out_;
+  // Time prefix of the last second formatted (consumer thread)
+  int64_t last_second_ = -1;
+  char clock_[16] = {};
+  std::mutex overlay_mutex_;
+  LogArena overlay_;
+};
+
+// Cancellation flag shared by a job and whoever submitted it. Copies refer
+// to the same flag; a default-constructed token has its own.
+class CancelToken {
+public:
+  CancelToken() : flag_(std::make_shared<std::atomic<bool>>(false)) {}
+  // A flag owned elsewhere, e.g. aliasing a run's stop flag to its run
+  explicit CancelToken(std::shared_ptr<std::atomic<bool>> flag)
+      : flag_(std::move(flag)) {}
+
+  void Cancel() const { flag_->store(true, std::memory_order_relaxed); }
+  bool Cancelled() const { return flag_->load(std::memory_order_relaxed); }
+
+private:
+  std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+// Order in which queued jobs are picked up: what the user is waiting on,
+// then ordinary background work, then sweeps nobody is looking at
+enum class JobPriority { Interactive, Normal, Housekeeping };
+static constexpr int kJobPriorities = 3;
+
+// Compute jobs keep a CPU busy; I/O jobs mostly wait on the disk, a socket
+// or a child process and get threads of their own so they never hold up
+// the compute workers
+enum class JobLane { Compute, Io };
+
+// Shared background job pool. Compute jobs run on one worker per core
+// (capped), each with a deque per priority: a job submitted from a worker
+// goes on that worker's own deque and is taken back from the newest end,
+// idle workers steal the oldest job of the others, and every worker looks
+// at all deques of a higher priority before any of a lower one. I/O jobs
+// share one priority queue served by a few threads. A job whose token is
+// cancelled before it starts is dropped; a running one is expected to poll
+// its token. Results meant for the UI go through Post, and the UI thread
+// runs them in RunCompletions, so no job touches UI state directly.
+// Threads start on the first Submit; Stop drops what is still queued and
+// waits for the running jobs.
+class JobSystem {
+public:
+  using Job = std::function<void(const CancelToken &)>;
+
+  explicit JobSystem(unsigned compute_workers = 0, unsigned io_workers = 4);
+  ~JobSystem() { Stop(); }
+
+  // Any thread; returns the token the job sees (token, or a new one)
+  CancelToken Submit(JobLane lane, JobPriority priority, Job job,
+                     CancelToken token = CancelToken());
+  // Queue fn for the UI thread and call the wake callback
+  void Post(std::function<void()> fn);
+  // UI thread: run the posted completions; returns how many ran
+  size_t RunCompletions();
+  // Called after each Post (e.g. to wake an idle render loop)
+  void SetWake(std::function<void()> wake);
+  void Stop();
+
+  // Jobs queued or running
+  size_t Pending() const { return pending_.load(std::memory_order_relaxed); }
+
+private:
+  struct Item {
+    Job job;
+    CancelToken token;
+  };
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Item> queue[kJobPriorities];
+  };
+
+  void Start();
+  void ComputeLoop(size_t self);
+  void IoLoop();
+  bool TakeCompute(size_t self, Item &out);
+  void Run(Item &item);
+
+  unsigned compute_count_, io_count_;
+  std::once_flag started_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_{0};
+  std::atomic<size_t> pending_{0};
+  // Compute jobs queued; workers sleep on idle_cv_ while it is zero
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+  size_t compute_queued_ = 0;
+  // I/O lane, under io_mutex_
+  std::mutex io_mutex_;
+  std::condition_variable io_cv_;
+  std::deque<Item> io_queue_[kJobPriorities];
+  bool stop_ = false; // under both idle_mutex_ and io_mutex_
+  std::vector<std::thread> threads_;
+  std::mutex done_mutex_;
+  std::vector<std::function<void()>> done_;
+  std::function<void()> wake_;
+};
+
+// Deletes from the Logs Browser. Trash renames the target into the hidden
+// <logs root>/.trash folder, a single rename however big the tree, so the
+// render thread never waits on the disk. kUndoSeconds later a job on the
+// I/O lane purges it with progress; until then Undo renames it back.
+// Whatever an earlier session left in a trash folder is purged when that
+// root is next trashed into. Called on the thread running the job
+// system's completions.
+class TrashBin {
+public:
+  static constexpr int kUndoSeconds = 15;
+
+  struct Item {
+    uint64_t id = 0;
+    std::string original; // where it was
+    std::string trashed;  // where it is now
+    std::chrono::steady_clock::time_point at;
+    bool purging = false;
+    std::shared_ptr<std::atomic<size_t>> total, removed;
+  };
+
+  // Purges run as Housekeeping jobs on jobs' I/O lane
+  explicit TrashBin(JobSystem &jobs) : jobs_(jobs) {}
+
+  // Move path (inside root) to the trash; false with error when it could
+  // not be renamed
+  bool Trash(const std::string &root, const std::string &path,
+             std::string &error);
+  // Put an item back where it was; false when it is already being purged
+  // or its place has been taken since
+  bool Undo(uint64_t id, std::string &error);
+  // Purge the items whose undo time is up; call every frame
+  void Poll();
+
+  const std::vector<Item> &items() const { return items_; }
+
+private:
+  void Purge(Item &item);
+  void Finished(uint64_t id);
+  // A previous session's trash, purged in the background as one item
+  // nobody can undo
+  void PurgeLeftovers(const std::string &trash);
+
+  JobSystem &jobs_;
+  std::vector<Item> items_;
+  std::set<std::string> purged_roots_;
+  uint64_t next_id_ = 0;
+};
+
+// Follows the config and prompts files for changes made by other programs
+// (provisioning tools, a second checkout, an editor) on a background thread:
+// inotify on Linux, change handles on Windows, modification times every
+// kSettingsRescanMs elsewhere. A file whose contents changed, and are not
+// what FileSaver wrote, is read and parsed there; the render thread Takes
+// the parsed document and applies it (see ReloadChangedSettings).
+class SettingsWatcher {
+public:
+  enum Which { kConfig, kPrompts, kFileCount };
+
+  struct Hooks {
+    std::function<void()> thread_start;
+    // A file changed on disk and its parsed contents wait to be Taken; on
+    // the watcher thread
+    std::function<void(const std::string &path)> changed;
+  };
+
+  explicit SettingsWatcher(Hooks hooks = {}) : hooks_(std::move(hooks)) {}
+  ~SettingsWatcher() { Stop(); }
+
+  void Watch(const std::string &config_path, const std::string &prompts_path);
+
+  // FileSaver: contents is about to replace path
+  void Writing(const std::string &path, const std::string &contents);
+
+  // Render thread: the latest outside change to a file since the last call,
+  // or null
+  std::shared_ptr<const JsonValue> Take(Which which);
+
+  void Stop();
+
+private:
+  struct File {
+    std::string path;
+    long long mtime = -1;
+    long long size = -1;
+    uint64_t hash = 0; // of the contents last read
+    bool primed = false; // read once, at the start
+    std::deque<uint64_t> own;
+    std::shared_ptr<const JsonValue> changed;
+  };
+
+  // Read the file if it may have changed (always when force) and keep a
+  // parsed copy when its contents are new and were not written here
+  void Check(File &f, bool force);
+
+  static std::string DirOf(const std::string &path);
+
+  void Run();
+
+  const Hooks hooks_;
+  std::mutex mutex_; // guards own and changed of files_, and stop_
+  std::condition_variable cv_;
+  std::thread thread_;
+  File files_[kFileCount];
+  std::atomic<bool> stop_{false};
+};
+
+// Writes the settings files off the render thread. SaveConfig and
+// SavePrompts only serialize into memory and Submit the result; the writer
+// thread waits until a file has had no new contents for kSaveQuietMs (so a
+// slider drag costs one write, not one per frame), writes it next to the
+// target and renames it into place, so a crash or a full disk never leaves
+// a half-written file behind. Flush writes whatever is pending right away
+// and waits for it (used on exit).
+class FileSaver {
+public:
+  struct Hooks {
+    std::function<void()> thread_start;
+    // contents is about to replace path; on the writer thread
+    std::function<void(const std::string &path, const std::string &contents)>
+        writing;
+    // path was written (ok) or could not be
+    std::function<void(const std::string &path, size_t bytes, bool ok)> saved;
+  };
+
+  explicit FileSaver(Hooks hooks = {}) : hooks_(std::move(hooks)) {}
+  ~FileSaver() { Stop(); }
+
+  void Submit(const std::string &path, std::string contents);
+
+  void Flush();
+
+  void Stop();
+
+private:
+  struct Pending {
+    std::string contents;
+    std::chrono::steady_clock::time_point due;
+  };
+
+  void Run();
+
+  // Write contents to path + ".tmp", sync it and rename it over path
+  bool WriteReplacing(const std::string &path, const std::string &contents);
+
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::condition_variable cv_, idle_cv_;
+  std::map<std::string, Pending> pending_; // keyed by target path
+  bool flush_ = false;
+  bool writing_ = false;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+// What an Async<T> coroutine hands back: the value of its co_return
+template <typename T> struct AsyncResult {
+  T value{};
+  void return_value(T v) { value = std::move(v); }
+  T Take() { return std::move(value); }
+};
+template <> struct AsyncResult<void> {
+  void return_void() {}
+  void Take() {}
+};
+
+// A coroutine returning T (default constructible), for flows that would
+// otherwise hold a blocked thread from start to end. It starts when it is
+// first awaited, runs on the awaiting coroutine's thread and resumes it
+// when done, without growing the stack however many are chained. The
+// frame belongs to the Async object, so it is awaited right away while the
+// arguments it takes by reference are still alive; AsyncReactor::Spawn
+// starts one nobody awaits. The library throws no exceptions, and one
+// escaping a coroutine ends the program as it would on a thread.
+template <typename T = void> class [[nodiscard]] Async {
+public:
+  struct promise_type : AsyncResult<T> {
+    std::coroutine_handle<> awaiting;
+
+    struct FinalAwaiter {
+      bool await_ready() const noexcept { return false; }
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<promise_type> self) noexcept {
+        std::coroutine_handle<> next = self.promise().awaiting;
+        return next ? next : std::noop_coroutine();
+      }
+      void await_resume() const noexcept {}
+    };
+
+    Async get_return_object() {
+      return Async(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+
+  Async(Async &&other) noexcept : handle_(other.handle_) {
+    other.handle_ = nullptr;
+  }
+  Async &operator=(Async &&) = delete;
+  ~Async() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    handle_.promise().awaiting = awaiting;
+    return handle_;
+  }
+  T await_resume() { return handle_.promise().Take(); }
+
+private:
+  explicit Async(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// One thread that runs any number of Async coroutines: each runs until it
+// waits (a timer, a socket, a job on a JobSystem lane) and is resumed here
+// when the wait is over, so a flow that spends minutes streaming a
+// container's output costs a coroutine frame and its buffers instead of a
+// thread and its stack. Waits are poll()ed together on POSIX; on Windows
+// only timers and jobs can be waited for. A wait given a CancelToken ends
+// within kCancelPollMs of the token being cancelled, or at once after
+// Wake. The thread starts with the first Spawn or Post; Stop ends it and
+// abandons the coroutines still waiting where they are, as the end of the
+// process would.
+class AsyncReactor {
+public:
+  static constexpr int kCancelPollMs = 100;
+
+  AsyncReactor() = default;
+  ~AsyncReactor() { Stop(); }
+  AsyncReactor(const AsyncReactor &) = delete;
+  AsyncReactor &operator=(const AsyncReactor &) = delete;
+
+  // Any thread: run task on the reactor thread; its frame goes once it
+  // returns
+  void Spawn(Async<void> task);
+  // Any thread: run fn on the reactor thread
+  void Post(std::function<void()> fn);
+  // Any thread: look at the waits' cancel tokens now
+  void Wake();
+  void Stop();
+
+  // Spawned coroutines that have not returned yet
+  size_t InFlight() const { return in_flight_.load(std::memory_order_relaxed); }
+
+  // Awaited by a coroutine on the reactor thread; resumes it there with
+  // true when what it waits for happened, false on timeout or cancel
+  struct Wait {
+    AsyncReactor *reactor;
+    int fd;       // -1 for a timer
+    short events; // POLLIN / POLLOUT
+    int64_t timeout_ms; // < 0: none
+    const CancelToken *cancel;
+    bool result = false;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      reactor->AddWaiter(this, handle);
+    }
+    bool await_resume() const noexcept { return result; }
+  };
+
+  // True after ms, false when cancel was cancelled first
+  Wait Sleep(int64_t ms, const CancelToken *cancel = nullptr) {
+    return Wait{this, -1, 0, ms, cancel};
+  }
+#ifndef _WIN32
+  // True once fd is readable (or at its end, or failed); false after
+  // timeout_ms (< 0: no limit) or on cancel
+  Wait Readable(int fd, int64_t timeout_ms,
+                const CancelToken *cancel = nullptr) {
+    return Wait{this, fd, POLLIN, timeout_ms, cancel};
+  }
+  Wait Writable(int fd, int64_t timeout_ms,
+                const CancelToken *cancel = nullptr) {
+    return Wait{this, fd, POLLOUT, timeout_ms, cancel};
+  }
+#endif
+
+  // Run fn (returning a default constructible value) on a jobs thread of
+  // lane and resume with its result on the reactor thread: for blocking
+  // calls, such as file I/O on a share, a coroutine must not make itself
+  template <typename Fn> struct OffloadWait {
+    AsyncReactor *reactor;
+    JobSystem *jobs;
+    JobLane lane;
+    Fn fn;
+    decltype(std::declval<Fn &>()()) result{};
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      jobs->Submit(lane, JobPriority::Normal,
+                   [this, handle](const CancelToken &) {
+                     result = fn();
+                     reactor->Post([handle]() { handle.resume(); });
+                   });
+    }
+    decltype(std::declval<Fn &>()()) await_resume() {
+      return std::move(result);
+    }
+  };
+  template <typename Fn>
+  OffloadWait<Fn> Offload(JobSystem &jobs, JobLane lane, Fn fn) {
+    return OffloadWait<Fn>{this, &jobs, lane, std::move(fn)};
+  }
+
+private:
+  struct Waiter {
+    Wait *wait;
+    std::coroutine_handle<> handle;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  void EnsureStarted();
+  void Run();
+  void AddWaiter(Wait *wait, std::coroutine_handle<> handle);
+  friend struct AsyncSpawned;
+
+  std::once_flag started_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::vector<std::function<void()>> posted_; // under mutex_
+  bool stop_ = false;                         // under mutex_
+#ifdef _WIN32
+  std::condition_variable wake_cv_;
+  bool woken_ = false; // under mutex_
+#else
+  int wake_pipe_[2] = {-1, -1};
+#endif
+  std::vector<Waiter> waiters_; // reactor thread only
+  std::atomic<size_t> in_flight_{0};
+};
+
+// Append-only on-disk copy of a task's complete output, one line per '\n'.
+// Any thread may append; text is buffered and written out in chunks. The
+// render thread reads lines back through a memory-mapped window that moves
+// with the region being viewed, so the whole history stays reachable while
+// RAM holds only that window and a sparse index (the file offset of every
+// kIndexStride-th line). Each line's read time stays in RAM as a varint
+// delta from the line before it, with the absolute time at every index
+// entry.
+class LogSpool {
+public:
+  static constexpr size_t kIndexStride = 256;
+  static constexpr size_t kFlushBytes = 64 * 1024;
+  static constexpr uint64_t kMapWindow = 8 * 1024 * 1024;
+
+  LogSpool() = default;
+  ~LogSpool() { Close(); }
+  LogSpool(const LogSpool &) = delete;
+  LogSpool &operator=(const LogSpool &) = delete;
+
+  // Create (or truncate) the spool file for writing
+  bool Open(const std::string &path);
+  // Instead of Open: go on with an existing spool file, indexing the lines
+  // it has, which all get read time ms. An unterminated last line is ended.
+  bool Reopen(const std::string &path, int64_t ms);
+  // ms is when the line was read (MonotonicMs)
+  void Append(std::string_view line, int64_t ms = 0);
+  void Flush();
+
+  // Lines appended so far (including ones not yet written out)
+  uint64_t LineCount() const;
+
+  const std::string &path() const { return path_; }
+
+  // Render thread: line n (0-based) as a view into the mapped window, valid
+  // until the next ReadLine. Returns false if the line cannot be read.
+  bool ReadLine(uint64_t n, std::string_view &out);
+
+  // Render thread: fn(line) for lines [first, first + count) in order, in
+  // one pass over the file rather than one index lookup per line. Returns
+  // how many lines were read.
+  uint64_t ReadLines(uint64_t first, uint64_t count,
+                     const std::function<void(std::string_view)> &fn);
+
+  // Read times of lines [first, first + count), appended to out; any
+  // thread. Returns how many there were.
+  uint64_t LineTimes(uint64_t first, uint64_t count,
+                     std::vector<int64_t> &out) const;
+
+  void Close();
+
+private:
+  bool IsOpenLocked() const;
+  // The line skip lines after the one starting at pos, as a view into the
+  // mapped window; next is where the line after it starts
+  bool WalkTo(uint64_t pos, uint64_t skip, uint64_t file_end,
+              std::string_view &out, uint64_t &next);
+  void FlushLocked();
+  static uint64_t AlignDown(uint64_t pos);
+  bool OpenReaderOnce();
+  // Map up to kMapWindow bytes of [AlignDown(pos), file_end)
+  bool MapAt(uint64_t pos, uint64_t file_end);
+  void Unmap();
+
+  // Writer state, guarded by mutex_
+  mutable std::mutex mutex_;
+  std::string path_;
+#ifdef _WIN32
+  void *write_handle_ = (void *)(intptr_t)-1; // INVALID_HANDLE_VALUE
+#else
+  int write_fd_ = -1;
+#endif
+  std::string pending_;
+  std::vector<uint64_t> index_;
+  // Per line read times: varint ms since the line before, and for every
+  // index entry its absolute time and where its delta starts in times_
+  std::string times_;
+  std::vector<int64_t> index_ms_;
+  std::vector<uint64_t> index_times_;
+  int64_t last_ms_ = 0;
+  uint64_t lines_ = 0;
+  uint64_t flushed_lines_ = 0;
+  uint64_t written_ = 0;
+  bool failed_ = false;
+
+  // Reader state, render thread only
+#ifdef _WIN32
+  void *read_handle_ = (void *)(intptr_t)-1; // INVALID_HANDLE_VALUE
+  void *map_handle_ = nullptr;
+#else
+  int read_fd_ = -1;
+#endif
+  const char *map_data_ = nullptr;
+  uint64_t map_offset_ = 0;
+  uint64_t map_length_ = 0;
+};
+
+// How often followed files are checked when no change notification
+// arrives (the only check on Windows), and how much is read per call
+constexpr int kLogTailPollMs = 250;
+constexpr size_t kLogTailChunk = 64 * 1024;
+
+// Follows log files that are still being written (the phase logs of running
+// tasks). Each file is read on from the offset reached so far, so a write
+// costs only its new bytes, and each complete line goes to the source's line
+// callback. While the source has no room the offset simply stays put until
+// its reader has caught up, so no line is lost. Writes are noticed through
+// inotify (Linux) or kqueue (macOS); every file is also checked each
+// kLogTailPollMs. Writers only ever append to these files.
+class LogTailer {
+public:
+  // Called from the tail thread
+  struct Hooks {
+    std::function<void()> thread_start;
+    // After each pass over the followed files
+    std::function<void()> pass;
+  };
+
+  // A followed file and where its lines go; every callback runs on the
+  // tail thread
+  struct Source {
+    std::string path;
+    // Lines the receiver can take now; reading pauses at 0
+    std::function<size_t()> room;
+    // line_no counts the file's lines from 1
+    std::function<void(uint64_t line_no, std::string_view line)> line;
+    // Set once the writer is done: what is left is read, then drained runs
+    // and the file is let go
+    std::function<bool()> finished;
+    std::function<void()> drained;
+  };
+
+  explicit LogTailer(Hooks hooks = {}) : hooks_(std::move(hooks)) {}
+
+  void Follow(Source source);
+
+  void Stop();
+
+private:
+  struct File {
+    Source source;
+    void *handle = (void *)(intptr_t)-1; // INVALID_HANDLE_VALUE (Windows)
+    int fd = -1;
+    int watch = -1; // inotify watch descriptor
+    uint64_t offset = 0;
+    uint64_t lines = 0;  // lines pushed so far
+    std::string partial; // start of a line whose end is not written yet
+  };
+
+  void Loop();
+
+  // Sleep until a followed file changes or kLogTailPollMs passes
+  void Wait();
+
+  // Open the file (it appears once its command starts writing) and register
+  // it for change notification
+  bool OpenFile(File &f);
+
+  void CloseFile(File &f);
+
+  // Up to buf.size() bytes at the file's offset; 0 at the end of the file
+  long long ReadAt(File &f, std::vector<char> &buf);
+
+  void PushLine(File &f, std::string_view line);
+
+  // Hand every complete line written since the last call to the source.
+  // Returns false if it ran out of room before the end of the file.
+  bool ReadNew(File &f, std::vector<char> &buf);
+
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::vector<Source> pending_; // guarded by mutex_
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  int notify_fd_ = -1; // inotify or kqueue descriptor, tail thread only
+};
+
+// A child's raw output as it was read, for replaying it later: after the
+// kStreamRecordingMagic line, every read is a varint of the microseconds
+// since the read before it (since Open for the first), a varint length
+// and the bytes. The stream is what the reader got, stdout and stderr
+// interleaved by arrival, escape sequences and partial lines included.
+static const char kStreamRecordingMagic[] = "ABREC1\n";
+
+class StreamRecorder {
+public:
+  StreamRecorder() = default;
+  ~StreamRecorder() { Close(); }
+  StreamRecorder(const StreamRecorder &) = delete;
+  StreamRecorder &operator=(const StreamRecorder &) = delete;
+
+  // Create (or truncate) the recording; the clock starts here
+  bool Open(const std::string &path);
+  // One read of n bytes, timed now. Stops recording after a write error.
+  void Write(const char *data, size_t n);
+  void Close();
+
+  uint64_t Bytes() const { return bytes_; }
+
+private:
+  FILE *out_ = nullptr;
+  std::chrono::steady_clock::time_point last_;
+  uint64_t bytes_ = 0;
+};
+
+struct RecordedChunk {
+  int64_t delay_us = 0; // since the chunk before
+  std::string bytes;
+};
+
+// Load a StreamRecorder file; false if it is missing or not a recording. A
+// chunk cut off by a crash ends the recording there.
+bool ReadStreamRecording(const std::string &path,
+                         std::vector<RecordedChunk> &chunks);
+
+// Write the chunks to out with their recorded gaps divided by speed: 1 is
+// as recorded, 10 ten times faster, 0 (or less) as fast as out takes
+// them. Stops when *should_stop is set or out fails; returns the bytes
+// written.
+uint64_t ReplayStreamRecording(const std::vector<RecordedChunk> &chunks,
+                               double speed, FILE *out,
+                               const std::atomic<bool> *should_stop = nullptr);
+
+// Bytes requested per pipe read by the blocking process runners
+static const size_t kPipeReadChunk = 4096;
+
+#ifndef _WIN32
+// pipe() with both ends close-on-exec, so one task's pipes never leak into
+// another task's child and hold its EOF open
+bool CreateCloexecPipe(int fds[2]);
+
+// Where a spawned child's stderr goes
+enum class SpawnStderr {
+  Pipe,    // its own pipe, SpawnedProcess::err_fd
+  Merge,   // the stdout pipe
+  Inherit, // this process's stderr, like popen()
+};
+
+struct SpawnOptions {
+  SpawnStderr stderr_mode = SpawnStderr::Pipe;
+  bool new_process_group = false; // for group-wide termination
+  // NAME=value entries replacing or adding to this process's environment
+  std::vector<std::string> env;
+  // Give the child a pseudo-terminal of pty_cols x pty_rows for stdout and
+  // stderr instead of pipes (stderr_mode is ignored), so it keeps line
+  // buffering and its progress output; out_fd is the terminal's master
+  // side, which reports EIO rather than EOF once the child is gone. The
+  // child leads a session of its own, so new_process_group is implied.
+  bool pty = false;
+  unsigned short pty_cols = 160;
+  unsigned short pty_rows = 50;
+};
+
+// A child started by SpawnProcess: its pid and the read ends of its output
+// pipes (-1 when not piped) or its terminal, all close-on-exec
+struct SpawnedProcess {
+  pid_t pid = -1;
+  int out_fd = -1;
+  int err_fd = -1;
+};
+
+// This process's environment with overrides applied, as NAME=value entries
+std::vector<std::string>
+SpawnEnvironment(const std::vector<std::string> &overrides);
+
+// The single POSIX process launcher. Starts file (searched on PATH when it
+// has no slash) with argv through posix_spawnp, which glibc and macOS
+// implement without copying the parent's address space, so the cost does
+// not grow with the caller's heap or thread count. stdin is /dev/null,
+// stdout (and stderr, per opts) go to fresh close-on-exec pipes, and no
+// other descriptor of this process is inherited where the platform can
+// promise that. The environment is always passed explicitly. Returns false,
+// with errno set, if the pipes or the process could not be created.
+bool SpawnProcess(const std::string &file,
+                  const std::vector<std::string> &argv,
+                  const SpawnOptions &opts, SpawnedProcess &out);
+
+// Read a spawned child's pipes until both reach EOF, passing each line to
+// on_line (stdout and stderr keep separate partial lines), then reap it.
+// Returns the exit status, or 128 + the signal that killed it.
+template <typename LineFn>
+int CollectSpawnedProcess(SpawnedProcess &child, LineFn &&on_line) {
+  LineSplitter splitters[2];
+  struct pollfd fds[2];
+  int open = 0;
+  for (int fd : {child.out_fd, child.err_fd}) {
+    if (fd != -1)
+      fds[open++] = {fd, POLLIN, 0};
+  }
+  while (open > 0) {
+    if (poll(fds, (nfds_t)open, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int i = 0; i < open;) {
+      if (fds[i].revents == 0) {
+        i++;
+        continue;
+      }
+      LineSplitter &lines = splitters[fds[i].fd == child.out_fd ? 0 : 1];
+      ssize_t n = read(fds[i].fd, lines.Prepare(kPipeReadChunk),
+                       kPipeReadChunk);
+      if (n > 0) {
+        lines.Commit((size_t)n);
+        lines.Drain(on_line);
+        i++;
+        continue;
+      }
+      if (n < 0 && errno == EINTR) {
+        i++;
+        continue;
+      }
+      fds[i] = fds[--open]; // EOF (or a broken pipe)
+    }
+  }
+  for (LineSplitter &lines : splitters)
+    lines.Finish(on_line);
+  if (child.out_fd != -1)
+    close(child.out_fd);
+  if (child.err_fd != -1)
+    close(child.err_fd);
+  child.out_fd = child.err_fd = -1;
+
+  int status = 0;
+  pid_t r;
+  do {
+    r = waitpid(child.pid, &status, 0);
+  } while (r == -1 && errno == EINTR);
+  child.pid = -1;
+  if (r == -1)
+    return 1;
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+}
+
+// Run file with argv to completion, passing each output line to on_line;
+// false if it could not be started
+template <typename LineFn>
+bool RunSpawned(const std::string &file, const std::vector<std::string> &argv,
+                const SpawnOptions &opts, LineFn &&on_line,
+                int &out_exit_code) {
+  SpawnedProcess child;
+  if (!SpawnProcess(file, argv, opts, child))
+    return false;
+  out_exit_code = CollectSpawnedProcess(child, on_line);
+  return true;
+}
+#endif
+
+#ifdef _WIN32
+// UTF-8 to UTF-16, for the wide Windows APIs
+std::wstring Widen(const std::string &narrow);
+#endif
+
+// How the reactor runs a process. The limits apply to the process and
+// everything it starts, enforced through its job object on Windows (0 =
+// none); other platforms ignore them, the containers there being limited
+// by Docker. With pty the output is read from a pseudo-terminal of
+// kPtyColumns x kPtyRows (a pty pair on POSIX, a ConPTY on Windows 10 1809
+// and later) instead of pipes, so tools that block-buffer or drop their
+// progress output when not on a terminal write as they go; the escape
+// sequences that come with it are handled by the log store. background,
+// when set, is read by the reactor on every pass; while it is true the tree
+// runs as background work (see kBackgroundNice). record_path, when set,
+// gets every read of the output as it arrived (StreamRecorder), for
+// replaying the run with --replay.
+struct ProcessOptions {
+  int cpu_percent = 0;    // share of the whole machine, hard capped
+  uint64_t memory_mb = 0; // committed memory of the tree together
+  bool pty = false;
+  const std::atomic<bool> *background = nullptr;
+  std::string record_path;
+};
+
+static const unsigned short kPtyColumns = 160;
+static const unsigned short kPtyRows = 50;
+
+// Shared I/O reactor for task processes
+//
+// One thread services the output pipes and exit notifications of every
+// running task instead of each task blocking its own worker thread in a read
+// loop. It sleeps until some child writes output or exits and drains
+// everything available on each wakeup. Stop requests are picked up when
+// Wake() is called; the timeout only bounds how long a stop flag set without
+// a Wake() can go unnoticed. Callbacks run on the reactor thread.
+struct ReactorChild; // one process the reactor owns
+class ProcessReactor {
+public:
+  // Lines arrive as views into the reader's buffer, valid during the call
+  using LineFn = std::function<void(std::string_view)>;
+  // exit_code is the process exit status; stopped is true when the process
+  // was terminated because its stop flag was set
+  using ExitFn = std::function<void(int exit_code, bool stopped)>;
+#ifdef _WIN32
+  using ProcessHandle = void *; // HANDLE
+#else
+  using ProcessHandle = int;
+#endif
+
+  // What the embedding program hooks in, set before the first Spawn.
+  // thread_start runs first on the reactor thread. before_wait runs there
+  // ahead of every wait, after the callbacks of the pass before it (so a UI
+  // can be woken once for all the lines a pass delivered). Debug messages
+  // about spawns, stops and exits go to log while *debug is true. jobs, when
+  // set, closes pseudo-consoles (Windows) off the reactor thread, since that
+  // can block until their output has been read.
+  struct Hooks {
+    std::function<void()> thread_start;
+    std::function<void()> before_wait;
+    std::function<void(const std::string &)> log;
+    const bool *debug = nullptr;
+    JobSystem *jobs = nullptr;
+  };
+
+  ProcessReactor();
+  ~ProcessReactor();
+  ProcessReactor(const ProcessReactor &) = delete;
+  ProcessReactor &operator=(const ProcessReactor &) = delete;
+
+  void SetHooks(Hooks hooks) { hooks_ = std::move(hooks); }
+
+  // Launch exe with args and hand it to the reactor thread. Returns false
+  // (and runs no callbacks) if the process could not be started.
+  // out_handle receives the process handle/PID; the reactor owns it. env
+  // holds "NAME=value" entries set in the child on top of this process's
+  // environment.
+  bool Spawn(const std::string &exe, const std::string &args, LineFn on_line,
+             ExitFn on_exit, std::atomic<bool> *should_stop,
+             ProcessHandle &out_handle,
+             const std::vector<std::string> &env = {},
+             const ProcessOptions &options = ProcessOptions());
+
+  // Re-examine stop flags now instead of at the next timeout
+  void Wake();
+
+  // Number of processes currently owned by the reactor
+  size_t ActiveCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_count_;
+  }
+
+private:
+  bool EnsureStarted();
+  void Run();
+  void Finish(ReactorChild &child);
+  bool Debug() const { return hooks_.log && hooks_.debug && *hooks_.debug; }
+#ifdef _WIN32
+  void *CreateTreeJob(const ProcessOptions &limits);
+  void ClosePseudoConsole(ReactorChild &child);
+  void IssueRead(ReactorChild &child);
+  void *iocp_ = nullptr;
+  uintptr_t next_key_ = 1; // 0 is reserved for Wake()
+#else
+  bool Drain(int fd, LineSplitter &lines, ReactorChild &child);
+  int wake_pipe_[2] = {-1, -1};
+#endif
+
+  Hooks hooks_;
+  std::mutex mutex_;
+  bool started_ = false;
+  size_t active_count_ = 0;
+  // Spawned but not yet adopted by the reactor thread
+  std::vector<std::unique_ptr<ReactorChild>> pending_;
+};
+
+// How far a stopped run's teardown got (see TeardownCoordinator)
+enum class TeardownStage : uint8_t {
+  None,      // not being stopped
+  Signalled, // its process group was told to stop
+  Exited,    // the process is gone
+  Killing,   // its container is being killed
+  Done,
+};
+
+// Teardown of stopped runs, off the caller's thread. The caller flags the
+// runs, whose process groups the reactor then stops (SIGTERM, then
+// SIGKILL), and hands them here. One thread waits until the processes of
+// everything handed over so far have exited, or deadline_ms, and then
+// passes them all to the kill hook, which kills their containers together.
+// Run has a std::atomic<TeardownStage> teardown, Signalled when it is added
+// and moved to Exited by whoever sees its process go; this takes it from
+// there to Killing and Done. Pending counts the runs not done yet.
+template <typename Run> class TeardownCoordinator {
+public:
+  using Batch = std::vector<std::shared_ptr<Run>>;
+  // thread_start runs first on the teardown thread; kill gets each batch
+  // of runs whose containers are to go, and done runs after each batch
+  struct Hooks {
+    std::function<void()> thread_start;
+    std::function<void(const Batch &)> kill;
+    std::function<void()> done;
+  };
+
+  TeardownCoordinator(int deadline_ms, Hooks hooks)
+      : deadline_ms_(deadline_ms), hooks_(std::move(hooks)) {}
+  ~TeardownCoordinator() { Stop(); }
+  TeardownCoordinator(const TeardownCoordinator &) = delete;
+  TeardownCoordinator &operator=(const TeardownCoordinator &) = delete;
+
+  void Add(const Batch &runs) {
+    if (runs.empty())
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_)
+      return;
+    queue_.insert(queue_.end(), runs.begin(), runs.end());
+    pending_ += (int)runs.size();
+    if (!thread_.joinable())
+      thread_ = std::thread([this]() {
+        if (hooks_.thread_start)
+          hooks_.thread_start();
+        Loop();
+      });
+    cv_.notify_one();
+  }
+
+  int Pending() const { return pending_.load(); }
+
+  // Finish what was handed over, then end the thread (at shutdown)
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+private:
+  void Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty())
+        return;
+      Batch batch;
+      batch.swap(queue_);
+      lock.unlock();
+      Teardown(batch);
+      pending_ -= (int)batch.size();
+      if (hooks_.done)
+        hooks_.done();
+      lock.lock();
+    }
+  }
+
+  void Teardown(const Batch &batch) {
+    // A run can announce its container until its script is gone, so the
+    // containers are looked up once the processes have exited
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(deadline_ms_);
+    while (std::chrono::steady_clock::now() < deadline &&
+           std::any_of(batch.begin(), batch.end(),
+                       [](const std::shared_ptr<Run> &r) {
+                         return r->teardown == TeardownStage::Signalled;
+                       }))
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (const auto &run : batch)
+      run->teardown = TeardownStage::Killing;
+    if (hooks_.kill)
+      hooks_.kill(batch);
+    for (const auto &run : batch)
+      run->teardown = TeardownStage::Done;
+  }
+
+  const int deadline_ms_;
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  Batch queue_;
+  std::atomic<int> pending_{0};
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+#ifdef _WIN32
+using ShellExitCode = unsigned long; // DWORD
+#else
+using ShellExitCode = int;
+#endif
+
+// Run a command hidden (no console) and capture stdout/stderr into lines:
+// through cmd.exe /C on Windows, /bin/sh -c elsewhere
+bool RunHiddenCapture(const std::string &command,
+                      std::vector<std::string> &out_lines,
+                      ShellExitCode &out_exit_code);
+// Run specific executable with args hidden; avoids cmd.exe quoting pitfalls.
+// Elsewhere exe is looked up on PATH and args are split like a shell would
+// but never run through one.
+bool RunHiddenCaptureExe(const std::string &exe, const std::string &args,
+                         std::vector<std::string> &out_lines,
+                         ShellExitCode &out_exit_code);
+// Stream variant: emits each line via callback as soon as it's available
+bool RunHiddenStreamExe(const std::string &exe, const std::string &args,
+                        const std::function<void(const std::string &)> &onLine,
+                        ShellExitCode &out_exit_code);
+
+// bash.exe from Git for Windows or MSYS2 (never the WSL stub in System32),
+// or bash in the usual macOS/Linux locations or on PATH; "" when there is
+// none. Cached after the first call.
+std::string FindBash();
+
+#ifdef _WIN32
+// Where the script and the Manage tab helpers run: Git Bash / MSYS2, or a
+// WSL2 distro (the use_wsl setting), where docker, rsync and the script run
+// as native Linux processes and task folders may live on the distro's own
+// filesystem
+struct ExecBackend {
+  bool wsl = false;
+  std::string distro; // "" for the default distro
+};
+ExecBackend CurrentExecBackend();
+// Commands started after this use the new backend; the helper co-processes
+// restart on their next command
+void SetExecBackend(bool wsl, const std::string &distro);
+// The distro commands run in, as configured or as the WSL session reported
+// it; "" before the session has answered
+std::string WslDistroName();
+// wsl.exe in System32, empty if WSL is not installed
+std::string FindWsl();
+// wsl.exe arguments ahead of the Linux command: the distro, then -e so the
+// command runs without the distro's default shell parsing it
+std::string WslArguments(const ExecBackend &backend);
+// Convert Windows path to MSYS2/Unix path format (or the WSL distro's)
+std::string ConvertToUnixPath(const std::string &winPath);
+// Convert an MSYS2/Unix path printed by the script back to Windows form
+std::string ConvertFromUnixPath(const std::string &unixPath);
+// End the long-lived bash sessions RunShellLines runs its commands in
+void StopBashPool();
+#endif
+
+// Run sh and return its output lines: on Windows through a pooled bash
+// session (Git Bash / MSYS2, or the WSL distro) with stderr included,
+// elsewhere through /bin/sh -c with stdout only
+std::vector<std::string> RunShellLines(const std::string &sh);
+
+// HTTP/1.1 client for the Docker Engine API on the local daemon socket
+// (/var/run/docker.sock, or the docker_engine named pipe on Windows). One
+// keep-alive connection is reused for every request, so refreshing the
+// Docker tab no longer forks a CLI process per query. Requests are
+// serialized by the client's mutex.
+class DockerApiClient {
+public:
+  struct Response {
+    int status = 0;
+    std::string body;
+  };
+
+  ~DockerApiClient() { Close(); }
+
+  // Chunks of a streamed (chunked) body, delivered as they arrive
+  using DataCallback = std::function<void(const char *, size_t)>;
+
+  // Returns false when the daemon cannot be reached over the socket (for
+  // example DOCKER_HOST points at tcp:// or ssh://); callers then fall back
+  // to the docker CLI. With on_data set, a chunked or unframed body is
+  // handed to the callback piece by piece instead of being collected in
+  // out.body. A non-empty body is sent as JSON.
+  bool Request(const std::string &method, const std::string &path,
+               Response &out, const DataCallback &on_data = nullptr,
+               const std::string &body = std::string());
+
+  // Socket candidates in the order they are tried; empty when DOCKER_HOST
+  // names a transport this client does not speak
+  static std::vector<std::string> SocketPaths();
+
+private:
+  bool IsOpen() const;
+  bool Open();
+  void Close();
+  bool Send(const std::string &data);
+  bool Fill();
+  bool ReadLine(std::string &line);
+  bool ReadBytes(size_t n, std::string &out);
+  bool ReadResponse(Response &out, bool &keep_alive,
+                    const DataCallback &on_data);
+
+#ifdef _WIN32
+  void *pipe_ = (void *)(intptr_t)-1; // INVALID_HANDLE_VALUE
+#else
+  int fd_ = -1;
+#endif
+  std::mutex mutex_;
+  std::string in_; // bytes received but not yet consumed
+};
+
+// Splits the multiplexed stream of a non-TTY attach or exec (frames of an
+// 8-byte header, its first byte the stream: 1 stdout, 2 stderr, and a
+// big-endian payload length in the last four) back into its streams. Only
+// a header cut between two reads is buffered; payloads are handed on as
+// views into the data fed in, a frame cut between reads in two pieces.
+class DockerStreamDemuxer {
+public:
+  using PayloadFn = std::function<void(int stream, std::string_view data)>;
+
+  void Feed(const char *data, size_t n, const PayloadFn &on_payload);
+
+private:
+  unsigned char header_[8] = {};
+  size_t header_len_ = 0;
+  size_t remaining_ = 0; // payload bytes of the current frame still to come
+  int stream_ = 0;
+};
+
+// A shell command DockerExecAttached runs in a container
+struct DockerExecSpec {
+  std::string container; // name or ID
+  std::string user;      // "" for the image's user
+  std::vector<std::string> cmd;
+};
+
+// Run spec through the Docker Engine API (/containers/<id>/exec, then
+// /exec/<id>/start attached) on conn, which the start request takes over,
+// so it should be a connection of its own. The output is demultiplexed
+// and handed to on_output as it arrives. Returns false with error set when
+// the exec could not be started, and callers may still run it another way;
+// once started, exit_code is the command's, or -1 when the stream broke
+// off or the daemon did not report one.
+bool DockerExecAttached(
+    DockerApiClient &conn, const DockerExecSpec &spec,
+    const std::function<void(int stream, std::string_view data)> &on_output,
+    int &exit_code, std::string &error);
+
+#ifndef _WIN32
+// DockerApiClient's requests as coroutines on an AsyncReactor, each client
+// with a non-blocking connection of its own, so thousands of them can wait
+// on the daemon without a thread apiece. Begin sends a request and reads
+// the head of the response; ReadBody then hands out the body as it
+// arrives, which is how a hijacked exec stream is followed. Every wait
+// ends when cancel is cancelled, and gives up after kTimeoutMs except in
+// an unframed body, which can stay quiet as long as its command does.
+class AsyncDockerClient {
+public:
+  static constexpr int kTimeoutMs = 10000;
+
+  explicit AsyncDockerClient(AsyncReactor &reactor,
+                             const CancelToken *cancel = nullptr)
+      : reactor_(reactor), cancel_(cancel) {}
+  ~AsyncDockerClient() { Close(); }
+  AsyncDockerClient(const AsyncDockerClient &) = delete;
+  AsyncDockerClient &operator=(const AsyncDockerClient &) = delete;
+
+  // False when the daemon cannot be reached or did not answer in HTTP. A
+  // non-empty body is sent as JSON.
+  Async<bool> Begin(const std::string &method, const std::string &path,
+                    int &status, const std::string &body = std::string());
+  // The next piece of the body into piece; false at its end, or when the
+  // connection broke off first (then Broken)
+  Async<bool> ReadBody(std::string &piece);
+  // Begin, then the whole body into out
+  Async<bool> Request(const std::string &method, const std::string &path,
+                      DockerApiClient::Response &out,
+                      const std::string &body = std::string());
+  bool Broken() const { return broken_; }
+
+private:
+  enum class Framing { None, Length, Chunked, UntilClose };
+
+  bool Open();
+  void Close();
+  Async<bool> Send(const std::string &data);
+  // Receive what is there, waiting for it (with kTimeoutMs when timed)
+  Async<bool> Fill(bool timed);
+  Async<bool> ReadLine(std::string &line);
+  // Move up to remaining_ buffered body bytes into piece
+  void TakeBody(std::string &piece);
+  // The body is over: the connection is kept for the next request or
+  // closed
+  void EndBody();
+
+  AsyncReactor &reactor_;
+  const CancelToken *cancel_;
+  int fd_ = -1;
+  std::string in_; // bytes received but not yet consumed
+  Framing framing_ = Framing::None;
+  uint64_t remaining_ = 0; // of the body, or of the current chunk
+  bool chunk_crlf_ = false; // a chunk's data is done, its CRLF is next
+  bool keep_alive_ = true;
+  bool broken_ = false;
+};
+
+// DockerExecAttached as coroutines: Start creates spec's exec and starts
+// it attached on a connection of its own, Read hands out the
+// demultiplexed output as it arrives, and Wait asks the daemon for the
+// exit code once the output has ended.
+class AsyncDockerExec {
+public:
+  explicit AsyncDockerExec(AsyncReactor &reactor,
+                           const CancelToken *cancel = nullptr)
+      : reactor_(reactor), cancel_(cancel), stream_(reactor, cancel) {}
+
+  // False with error set when the exec could not be started, and callers
+  // may still run it another way
+  Async<bool> Start(const DockerExecSpec &spec, std::string &error);
+  // The next piece of output of stream (1 stdout, 2 stderr) into data;
+  // false once the output has ended or broken off
+  Async<bool> Read(int &stream, std::string &data);
+  // The command's exit code, or -1 when the daemon did not report one
+  Async<int> Wait();
+
+private:
+  AsyncReactor &reactor_;
+  const CancelToken *cancel_;
+  AsyncDockerClient stream_;
+  std::string id_;
+  DockerStreamDemuxer demux_;
+  std::deque<std::pair<int, std::string>> output_;
+  std::string piece_;
+};
+#endif
+
+// The log file of a phase whose output the front end reads itself (see
+// DockerExecAttached). stdout and stderr are cut into lines separately, so
+// a line of one is never split by the other; each complete line is
+// appended to the log and handed to on_line, and stderr lines also go to
+// <name>.stderr.log beside it. Both files are written through large stdio
+// buffers and reach the disk as those fill and on Close.
+class PhaseOutputWriter {
+public:
+  using LineFn = std::function<void(int stream, std::string_view line)>;
+
+  ~PhaseOutputWriter() { Close(nullptr); }
+
+  // Append to the log at path; false if it cannot be opened
+  bool Open(const std::string &path);
+  // Output of stream (1 stdout, anything else stderr)
+  void Write(int stream, std::string_view data, const LineFn &on_line);
+  // End the unterminated last lines and close the files
+  void Close(const LineFn &on_line);
+
+private:
+  static constexpr size_t kBufferBytes = 64 * 1024;
+  void Line(int stream, std::string_view line, const LineFn &on_line);
+
+  std::string path_;
+  FILE *log_ = nullptr;
+  FILE *err_ = nullptr; // opened with the first stderr line
+  std::string partial_[2]; // stdout, stderr
+};
+
+// Cached health of the Docker daemon, consulted by everything that talks to
+// Docker before it sends a request or spawns a docker process, so nothing
+// waits on a timeout or forks a CLI just to learn the daemon is down.
+// Available() answers from the cache; when the answer is due for a re-check
+// one caller runs the probe while callers arriving meanwhile get the last
+// answer (they wait only for the very first probe). A daemon found down is
+// probed again after a backoff doubling from kRetryMinMs to kRetryMaxMs;
+// one found up is trusted for kUpMs or until a caller reports a failure.
+class DockerHealth {
+public:
+  enum State { kUnknown, kUp, kDown };
+  using ProbeFn = std::function<bool()>;
+
+  static constexpr int kRetryMinMs = 500;
+  static constexpr int kRetryMaxMs = 8000;
+  static constexpr int kUpMs = 30000;
+
+  explicit DockerHealth(ProbeFn probe) : probe_(std::move(probe)) {}
+
+  bool Available();
+  // A request that should have reached the daemon did not: probe again on
+  // the next call. Has no effect while the daemon is already known down.
+  void ReportFailure();
+  // The daemon answered (the event stream came back, say): up at once
+  // instead of at the end of the backoff
+  void ReportUp();
+
+  State state() const { return state_.load(); }
+  uint64_t probes() const { return probes_.load(); }
+
+private:
+  void Settle(bool up);
+
+  ProbeFn probe_;
+  std::mutex mutex_; // guards probing_, next_probe_ and retry_ms_
+  std::condition_variable cv_;
+  std::atomic<State> state_{kUnknown};
+  std::atomic<uint64_t> probes_{0};
+  bool probing_ = false;
+  std::chrono::steady_clock::time_point next_probe_{};
+  int retry_ms_ = kRetryMinMs;
+};
+
+// An image as its layers make it up, bottom first. A layer is keyed by its
+// chain (its diff ID and every one below it, the way the daemon stores
+// it), so images built on the same base share the base's keys.
+struct ImageLayers {
+  std::string id; // short image ID
+  std::vector<std::pair<uint64_t, double>> layers; // chain key, bytes
+};
+
+// Layers of image id from its /images/<id>/json (RootFS.Layers) and
+// /images/<id>/history responses. History lists every instruction, newest
+// first, and only some of them made a layer: entries with bytes did, as do
+// the ones needed to account for every diff ID; metadata instructions
+// (ENV, LABEL, classic builder "#(nop)" steps, ...) are the ones left out.
+ImageLayers ImageLayersFromApi(const std::string &id, const JsonValue &inspect,
+                               const JsonValue &history);
+
+// Disk use of a set of images counted by layer: a layer several images
+// share is stored once, and deleting images frees only the layers no
+// remaining image uses
+class LayerUsage {
+public:
+  explicit LayerUsage(std::vector<ImageLayers> images);
+
+  const std::vector<ImageLayers> &images() const { return images_; }
+  // Every distinct layer once
+  double TotalBytes() const { return total_; }
+  // Bytes of the distinct layers of images (indices into images()), and
+  // the part of them deleting all of those images frees
+  double BytesOf(const std::vector<size_t> &images) const;
+  double FreedBy(const std::vector<size_t> &images) const;
+  // The image this one was built on: the one whose layers are the longest
+  // proper prefix of its own; -1 when there is none
+  int BaseOf(size_t image) const;
+
+private:
+  struct Layer {
+    double bytes = 0.0;
+    uint32_t users = 0; // images holding it
+  };
+
+  std::vector<ImageLayers> images_;
+  std::unordered_map<uint64_t, Layer> layers_;
+  double total_ = 0.0;
+};
+
+// Percent-encode a URL component; '/' and ':' survive when encoding an image
+// reference used as a path segment
+std::string UrlEncode(const std::string &s, bool keep_path = false);
+
+// Docker Engine API requests made through DockerApiCall and the time they
+// took, for the metrics overlay
+struct DockerApiStats {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> us{0};
+};
+
+// The process-wide API client (connection), the daemon health behind it and
+// the request counters
+DockerApiClient &SharedDockerApi();
+DockerHealth &DockerDaemonHealth();
+DockerApiStats &DockerApiCallStats();
+
+// Issue a Docker Engine API request and decode the JSON body (left Null if the
+// body is empty or not JSON). Returns false when the daemon socket is
+// unreachable, in which case callers fall back to the docker CLI. Work that
+// runs requests side by side passes a client (connection) of its own.
+bool DockerApiCall(const std::string &method, const std::string &path,
+                   int &status, JsonValue &body,
+                   DockerApiClient &client = SharedDockerApi());
+
+// An image as the Manage tab lists it: short ID and the repo:tag names it is
+// listed under
+struct DockerImageRef {
+  std::string id;
+  std::vector<std::string> tags;
+};
+
+// Targets per docker rm / docker rmi process in the CLI fallback, well
+// inside any command line limit
+constexpr size_t kDockerCliBatch = 50;
+
+// The 12-digit form docker prints for an image ID
+std::string ShortImageId(std::string id);
+
+// "repo:tag" for an image reference, adding the :latest docker assumes for
+// a bare repository name
+std::string NormalizeImageRef(const std::string &ref);
+
+// True when a container's image (an ID or a name, as docker reports it) is
+// the given image
+bool ContainerImageIs(const std::string &container_image,
+                      const std::string &container_image_id,
+                      const DockerImageRef &image);
+
+// The containers (running or stopped) of every image, as ID|Names|Status
+// rows keyed by image ID, from a single container listing: one API request,
+// or one `docker ps -a --format` process without the API. A container
+// counts for the image it was created from, not for that image's parents;
+// the daemon still refuses to delete those. Returns false when neither
+// answered.
+bool DockerContainersUsingImages(
+    const std::vector<DockerImageRef> &images,
+    std::map<std::string, std::vector<std::string>> &out);
+
+// "Cannot delete image ..." with the containers that use it
+std::string ImageInUseMessage(const std::string &image_id,
+                              const std::vector<std::string> &users);
+
+// docker rmi for a batch of images in one process; errors[i] gets the
+// daemon's complaint about images[i]. An error line is matched to the
+// image whose ID or tag it names; one naming none fails every image of the
+// batch that was not reported deleted.
+void RemoveImagesCli(const std::vector<const DockerImageRef *> &images,
+                     std::vector<std::string *> &errors);
+
+// DELETE one image over the API; false when the socket is unreachable.
+// error stays empty when the image was deleted.
+bool DeleteImageApi(const DockerImageRef &image, std::string &error,
+                    DockerApiClient &client = SharedDockerApi());
+
+// Delete many images with one container lookup for all of them, then one
+// API request per image, or one docker rmi per kDockerCliBatch images
+// without the API. Images that containers still use are left alone.
+// errors[i] is empty when images[i] was deleted and holds the reason
+// otherwise; returns the number deleted.
+size_t SafeDeleteImages(const std::vector<DockerImageRef> &images,
+                        std::vector<std::string> &errors);
+
+// Force-remove one container (name or ID) and its anonymous volumes over
+// the API; false when the socket is unreachable. error stays empty when
+// the container is gone.
+bool RemoveContainerApi(const std::string &container,
+                        std::string &error,
+                        DockerApiClient &client = SharedDockerApi());
+
+// docker rm -f -v for many containers (names or IDs), with their anonymous
+// volumes (a "volume" workdir mount): one API request each, or one docker rm
+// per kDockerCliBatch containers without the API
+void RemoveContainers(const std::vector<std::string> &containers);
+
+// Container name -> log directory. Runs started here report their
+// directory as they start; any other container is resolved once from the
+// logs roots and remembered, so a Docker refresh is a lookup per container
+// rather than a walk of every logs tree.
+class ContainerLogIndex {
+public:
+  void Record(const std::string &name, const std::string &dir);
+
+  // roots identifies the configured logs roots; resolved entries are
+  // dropped when they change
+  bool Lookup(const std::string &name, const std::string &roots,
+              std::string &dir);
+
+  void Remember(const std::string &name, const std::string &roots,
+                const std::string &dir);
+
+private:
+  std::mutex mutex_;
+  std::map<std::string, std::string> reported_; // from task output
+  std::map<std::string, std::string> resolved_; // searched for, may be ""
+  std::string roots_;
+};
+
+// Layers of the daemon's images (see ImageLayersFromApi), read once per
+// image: an image ID names the same layers for as long as it exists.
+// Shared by the Docker GC and the Manage tab's disk usage analysis.
+class ImageLayerCache {
+public:
+  // Layers of each of ids, in order; an image that cannot be read comes
+  // back without layers. Images not in ids are forgotten.
+  std::vector<ImageLayers> Get(const std::vector<std::string> &ids,
+                               DockerApiClient &client = SharedDockerApi());
+
+private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, ImageLayers> cache_;
+};
+
+// What the Manage tab's disk usage section shows: docker system df and the
+// images' layers (see LayerUsage)
+struct DockerDiskReport {
+  time_t taken = 0;
+  std::string error; // the analysis could not run
+  double layer_bytes = 0.0;  // every image layer once
+  double shared_bytes = 0.0; // layers more than one image holds
+  double unused_image_bytes = 0.0; // freed by deleting unused images
+  double container_bytes = 0.0, stopped_container_bytes = 0.0;
+  double cache_bytes = 0.0, cache_reclaimable = 0.0; // build cache
+  // Images of one repository: what deleting them all frees, what of
+  // their layers other images keep, and the images the newest one was
+  // built on, nearest first
+  struct Repository {
+    std::string name;
+    int images = 0;
+    double freed_bytes = 0.0, shared_bytes = 0.0;
+    std::string lineage;
+  };
+  std::vector<Repository> repositories; // most bytes freed first
+};
+
+// Runs the disk usage analysis on jobs' I/O lane when asked, over a
+// connection of its own: /system/df sizes every layer and can take a while.
+// done runs on the job's thread once the new report is in.
+class DockerDiskAnalysis {
+public:
+  DockerDiskAnalysis(JobSystem &jobs, ImageLayerCache &layers,
+                     std::function<void()> done)
+      : jobs_(jobs), layers_(layers), done_(std::move(done)) {}
+
+  void Start();
+  bool Busy() const { return busy_; }
+  std::shared_ptr<const DockerDiskReport> Report();
+
+private:
+  std::shared_ptr<const DockerDiskReport> Analyze();
+
+  JobSystem &jobs_;
+  ImageLayerCache &layers_;
+  std::function<void()> done_;
+  DockerApiClient client_;
+  std::atomic<bool> busy_{false};
+  std::mutex mutex_;
+  std::shared_ptr<const DockerDiskReport> report_;
+};
+
+// Docker garbage collection: every run leaves its container (and often a
+// uniquely tagged image) behind, so a background sweep removes the ones the
+// policy no longer keeps and appends what it removed, with the log run each
+// object belonged to, to the policy's record file (docker_gc.jsonl next to
+// the GUI's settings)
+
+struct DockerGcPolicy {
+  int keep_per_task = 0; // newest runs kept per task (0 = any number)
+  int ttl_hours = 0;     // remove runs older than this (0 = never)
+  int disk_gb = 0;       // remove old images above this usage (0 = never)
+  std::vector<std::string> log_roots;
+  std::string image_repo;       // batch image tag, without its :tag
+  std::string container_prefix; // batch container name
+  std::string record_path;      // docker_gc.jsonl; "" records nothing
+
+  bool Enabled() const {
+    return keep_per_task > 0 || ttl_hours > 0 || disk_gb > 0;
+  }
+  bool operator==(const DockerGcPolicy &o) const {
+    return keep_per_task == o.keep_per_task && ttl_hours == o.ttl_hours &&
+           disk_gb == o.disk_gb && log_roots == o.log_roots &&
+           image_repo == o.image_repo &&
+           container_prefix == o.container_prefix &&
+           record_path == o.record_path;
+  }
+  bool operator!=(const DockerGcPolicy &o) const { return !(*this == o); }
+};
+
+// Background removal of the containers and images autobuild runs leave
+// behind. Only objects autobuild's runs create are considered: containers
+// named <task>-<mode>-<time>, *_from_<suffix> or after the batch container
+// name, and images tagged autobuild-* or after the batch image tag. Warm
+// pool containers, the containers of runs still in progress and anything
+// younger than kDockerGcGraceSec are never touched. Removal goes through
+// the batched Docker helpers (RemoveContainers, SafeDeleteImages), so an
+// image some container still uses stays. Above the disk watermark images
+// are counted by the bytes deleting them frees (see LayerUsage), so
+// layers a kept image shares do not count toward the target.
+class DockerGarbageCollector {
+public:
+  // Called from the collector's thread
+  struct Hooks {
+    std::function<void()> thread_start;
+    // Log directory of the run a container belonged to, "" if unknown
+    std::function<std::string(const std::vector<std::string> &roots,
+                              const std::string &container)>
+        log_dir;
+    // After each recorded removal; reason is keep, ttl or disk
+    std::function<void(const std::string &kind, const std::string &name,
+                       const std::string &reason)>
+        removed;
+  };
+
+  explicit DockerGarbageCollector(ImageLayerCache &layers, Hooks hooks = {})
+      : layers_(layers), hooks_(std::move(hooks)) {}
+  ~DockerGarbageCollector() { Stop(); }
+
+  // Apply the policy; sweeps right away when it changed
+  void Configure(const DockerGcPolicy &policy);
+
+  // Sweep now, whatever is left of the interval
+  void SweepNow();
+
+  // Keep the container of a running task: container names it, and returns
+  // "" once the task stopped, which drops it
+  void Protect(std::function<std::string()> container);
+
+  // What the last sweep did, for the Settings tab
+  std::string Status();
+
+  void Stop();
+
+private:
+  struct Container {
+    std::string id, name, image, image_id;
+    time_t created = 0;
+    bool running = false;
+    bool pool = false;
+  };
+  struct Image {
+    DockerImageRef ref;
+    time_t created = 0;
+    // Freed by deleting it alone, as far as docker tells; stands in for
+    // its layers when those cannot be read
+    double bytes = 0.0;
+  };
+  struct Inventory {
+    std::vector<Container> containers;
+    std::vector<Image> images;
+    double disk_bytes = 0.0; // image layers plus container layers
+  };
+  struct Victim {
+    std::string kind, name, id, reason, log_dir;
+  };
+
+  void Run();
+
+  std::vector<std::string> ActiveContainersLocked();
+
+  static Container ContainerFromApi(const JsonValue &c);
+
+  static Image ImageFromApi(const JsonValue &img);
+
+  // One /system/df request when disk use matters (it sizes every layer),
+  // the two plain listings otherwise; false when the daemon socket is
+  // unreachable
+  static bool ListApi(bool with_usage, Inventory &inv);
+
+  // The same through docker ps, docker images and docker system df
+  static bool ListCli(bool with_usage, Inventory &inv);
+
+  // Task key of a container the runs create ("" for any other container):
+  // runs of one task share it, so the newest few can be kept per task
+  static std::string ContainerKey(const DockerGcPolicy &policy,
+                                  const Container &c);
+
+  // Repository of an image the runs create ("" for any other image)
+  static std::string ImageKey(const DockerGcPolicy &policy,
+                              const Image &img);
+
+  // Pick the members of each group beyond its newest keep_per_task, and the
+  // ones older than the TTL; groups are sorted newest first on the way
+  static void ApplyRetention(
+      const DockerGcPolicy &policy, time_t now,
+      std::map<std::string, std::vector<size_t>> &groups,
+      const std::function<time_t(size_t)> &created,
+      const std::function<bool(size_t)> &removable,
+      std::vector<std::pair<size_t, const char *>> &out);
+
+  std::string LogDir(const DockerGcPolicy &policy,
+                     const std::string &container) const;
+
+  std::string Sweep(const DockerGcPolicy &policy,
+                    const std::vector<std::string> &active);
+
+  void Record(const std::vector<Victim> &removed, time_t now);
+
+  ImageLayerCache &layers_;
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  DockerGcPolicy policy_;
+  std::vector<std::function<std::string()>> protected_;
+  std::string status_;
+  bool changed_ = false;
+  std::atomic<bool> stop_{false};
+};
+
+// Container removals and image deletions run off the caller's thread. An
+// operation works through its items on up to kParallel I/O jobs, each with
+// an API connection of its own (the shared client serializes requests), and
+// falls back to the CLI item by item. Failures are collected per item and
+// reported when the operation ends. The caller's thread (the one running
+// jobs' completions), apart from the Progress the jobs share.
+class DockerBulkOps {
+public:
+  static constexpr size_t kParallel = 2;
+  enum class Kind { Containers, Images };
+
+  struct Progress {
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<size_t> lanes{0}; // jobs still working
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex;
+    std::vector<std::string> errors; // under mutex
+  };
+  struct Op {
+    uint64_t id = 0;
+    Kind kind = Kind::Containers;
+    size_t total = 0;
+    std::shared_ptr<Progress> progress;
+  };
+  struct Hooks {
+    // An item is gone (the container name or ID, the image ID); on the
+    // job that removed it
+    std::function<void(const std::string &)> removed;
+    // The operation ended, with its failures joined; on the thread running
+    // jobs' completions
+    std::function<void(const Op &, const std::string &errors)> finished;
+  };
+
+  explicit DockerBulkOps(JobSystem &jobs) : jobs_(jobs) {}
+
+  // Force-remove containers (names or IDs) with their anonymous volumes
+  void RemoveContainers(std::vector<std::string> names, Hooks hooks);
+  // Delete images, leaving alone those containers still use (one listing
+  // of the containers for all of them, taken before the first delete)
+  void DeleteImages(std::vector<DockerImageRef> images, Hooks hooks);
+
+  // Stop picking up items; those in flight still finish
+  void Cancel(uint64_t id);
+  bool Busy(Kind kind) const;
+
+  const std::vector<Op> &ops() const { return ops_; }
+
+private:
+  using ItemFn = std::function<std::string(size_t, DockerApiClient &)>;
+
+  void Launch(Kind kind, size_t total, ItemFn run,
+              std::function<void()> prepare, Hooks hooks);
+  void Finished(uint64_t id, const Hooks &hooks);
+
+  JobSystem &jobs_;
+  std::vector<Op> ops_;
+  uint64_t next_id_ = 0;
+};
+
+
+// A byte range of a line, highlighted when changed
+struct DiffSpan {
+  uint32_t start, length;
+  bool changed;
+};
+
+// Line diff for the prompt diff view. Lines are compared with trailing
+// whitespace trimmed. Common leading and trailing lines are split off
+// first, then lines that occur exactly once on each side anchor the rest
+// (patience diff) and what lies between anchors is diffed with Myers'
+// O(ND) algorithm.
+struct DiffLine {
+  enum Type { UNCHANGED, ADDED, REMOVED, MODIFIED } type = UNCHANGED;
+  std::string orig_text;
+  std::string mod_text;
+  int orig_line_num = -1; // 1-based, -1 when the line is only on the other side
+  int mod_line_num = -1;
+  // MODIFIED only: what changed within the line, covering all of its text
+  std::vector<DiffSpan> orig_spans, mod_spans;
+  // An UNCHANGED line with no text standing for this many unchanged lines
+  // a bounded diff left out (ComputeLogDiff), from the line numbers on
+  int skipped = 0;
+};
+
+// One run of changed lines, as 0-based line ranges in both texts
+struct DiffHunk {
+  int orig_start, orig_count;
+  int mod_start, mod_count;
+};
+
+struct LineDiff {
+  std::vector<DiffLine> lines; // REMOVED/ADDED pairs in a run are MODIFIED
+  std::vector<DiffHunk> hunks;
+  int added = 0, removed = 0, modified = 0;
+};
+
+LineDiff ComputeLineDiff(const std::string &original,
+                         const std::string &modified);
+
+// Line diff of two log files of any size, for comparing runs. Both files
+// are memory-mapped and diffed kLogDiffWindow lines at a time like
+// ComputeLineDiff, each window committed up to its last common line well
+// inside both sides; a window with nothing in common is shown as half of
+// it replaced. With ignore_volatile, timestamps, dates and hex ids (8 or
+// more hex digits with a digit among them: container ids, hashes, UUIDs,
+// long numbers) do not count as differences. Memory stays bounded: long
+// unchanged stretches become skipped lines, line texts are cut at
+// kLogDiffMaxLineBytes, and the diff stops at kLogDiffMaxLines lines.
+static constexpr int kLogDiffWindow = 1 << 16;
+static constexpr size_t kLogDiffMaxLineBytes = 4096;
+static constexpr size_t kLogDiffMaxLines = 200000;
+
+struct LogDiffResult {
+  LineDiff diff;
+  long long orig_lines = 0, mod_lines = 0; // lines compared
+  bool truncated = false;                  // stopped at kLogDiffMaxLines
+  std::string error;
+};
+
+// False with out.error set when a file cannot be read or token is
+// cancelled. progress, when given, is updated to the fraction (0 to 1000)
+// of both files compared so far.
+bool ComputeLogDiff(const std::string &orig_path, const std::string &mod_path,
+                    bool ignore_volatile, const CancelToken &token,
+                    LogDiffResult &out,
+                    std::atomic<int> *progress = nullptr);
+
+// Container resource usage at one point of a run. CPU is summed over cores
+// (200 = two busy cores); memory is the working set; the I/O figures are
+// cumulative since the container started, in MiB to keep samples small.
+struct ResourceSample {
+  float t = 0.0f; // seconds since the run started
+  float cpu_pct = 0.0f;
+  float mem_mib = 0.0f;
+  float net_rx_mib = 0.0f;
+  float net_tx_mib = 0.0f;
+  float blk_read_mib = 0.0f;
+  float blk_write_mib = 0.0f;
+};
+
+// Bounded time series of a run's samples. When full, neighbouring samples
+// are merged in pairs (CPU and memory averaged, I/O counters keep the later
+// value) and later samples are merged the same number at a time, so a run of
+// any length covers the whole run at an even, coarser step. Peaks are kept
+// separately since averaging would flatten them.
+class ResourceSeries {
+public:
+  static constexpr size_t kMaxSamples = 240; // even
+
+  void Add(const ResourceSample &s) {
+    peak_cpu_pct_ = std::max(peak_cpu_pct_, s.cpu_pct);
+    peak_mem_mib_ = std::max(peak_mem_mib_, s.mem_mib);
+    Merge(pending_, s, pending_count_);
+    if (++pending_count_ < stride_)
+      return;
+    samples_.push_back(pending_);
+    pending_count_ = 0;
+    if (samples_.size() < kMaxSamples)
+      return;
+    for (size_t i = 0; i < kMaxSamples / 2; i++) {
+      ResourceSample merged = samples_[2 * i];
+      Merge(merged, samples_[2 * i + 1], 1);
+      samples_[i] = merged;
+    }
+    samples_.resize(kMaxSamples / 2);
+    stride_ *= 2;
+  }
+
+  void Clear() { *this = ResourceSeries(); }
+
+  const std::vector<ResourceSample> &samples() const { return samples_; }
+  bool empty() const { return samples_.empty() && pending_count_ == 0; }
+  float PeakCpuPct() const { return peak_cpu_pct_; }
+  float PeakMemMib() const { return peak_mem_mib_; }
+  // The newest sample, including one still being merged
+  ResourceSample Last() const {
+    if (pending_count_ > 0)
+      return pending_;
+    return samples_.empty() ? ResourceSample() : samples_.back();
+  }
+
+private:
+  // Fold s into acc, which already averages n samples
+  static void Merge(ResourceSample &acc, const ResourceSample &s, size_t n) {
+    float w = 1.0f / (float)(n + 1);
+    acc.cpu_pct += (s.cpu_pct - acc.cpu_pct) * w;
+    acc.mem_mib += (s.mem_mib - acc.mem_mib) * w;
+    acc.t = s.t;
+    acc.net_rx_mib = s.net_rx_mib;
+    acc.net_tx_mib = s.net_tx_mib;
+    acc.blk_read_mib = s.blk_read_mib;
+    acc.blk_write_mib = s.blk_write_mib;
+  }
+
+  std::vector<ResourceSample> samples_;
+  ResourceSample pending_;
+  size_t pending_count_ = 0;
+  size_t stride_ = 1; // input samples per stored sample
+  float peak_cpu_pct_ = 0.0f;
+  float peak_mem_mib_ = 0.0f;
+};
+
+// Raw counters from one Docker Engine API /containers/<id>/stats reading.
+// CPU use needs two readings; see DockerCpuPercent.
+struct DockerStatsReading {
+  double cpu_total = 0.0;  // container CPU time, ns
+  double cpu_system = 0.0; // host CPU time, ns
+  int online_cpus = 1;
+  double mem_bytes = 0.0;
+  double net_rx_bytes = 0.0;
+  double net_tx_bytes = 0.0;
+  double blk_read_bytes = 0.0;
+  double blk_write_bytes = 0.0;
+};
+
+// Decode a stats body; false when it has no memory figures, as for a
+// container that is not running
+bool ParseDockerStats(const JsonValue &stats, DockerStatsReading &out);
+
+// CPU use between two readings of the same container, summed over cores
+double DockerCpuPercent(const DockerStatsReading &prev,
+                        const DockerStatsReading &cur);
+
+// Bytes in a docker CLI size such as "12.5MiB", "1.2kB" or "0B" (binary
+// and decimal units both appear in `docker stats` output); -1 if unreadable
+double ParseDockerSize(std::string_view text);
+
+// Render a byte count the way `docker images` does (decimal units, three
+// significant digits)
+std::string FormatDockerSize(double bytes);
+
+// Fill sample (except t) from a `docker stats --no-stream` row formatted as
+// "{{.CPUPerc}}|{{.MemUsage}}|{{.NetIO}}|{{.BlockIO}}"
+bool ParseDockerStatsRow(std::string_view row, ResourceSample &sample);
+
+// Package proxy (see package_proxy_setup in autobuild.sh). mode is the
+// GUI's package_proxy setting: 0 off, 1 a managed proxy on every Docker
+// endpoint, 2 one on this host that the whole fleet shares, published on
+// the port of fleet_url, the http:// URL other hosts reach it at. Value of
+// AUTOBUILD_PACKAGE_PROXY for a run on this host (local) or another; ""
+// for none.
+std::string PackageProxySpec(int mode, const std::string &fleet_url,
+                             bool local);
+
+// One row of `sort | uniq -c` over the proxy's request log, whose lines
+// are "<registry> <cache status>": "  12 npm HIT"
+struct ProxyCacheCount {
+  std::string registry; // npm, pypi or apt
+  std::string status;   // nginx's $upstream_cache_status, "-" if uncached
+  uint64_t requests = 0;
+};
+
+bool ParseProxyCacheCount(std::string_view row, ProxyCacheCount &out);
+
+// Whether a cache status was served without a full download upstream
+bool ProxyCacheHit(std::string_view status);
+
+// Container limits of one run (docker run --cpus, --memory, --pids-limit);
+// zero fields stay unlimited. expected_mib is the memory the run is
+// expected to peak at, 0 without history.
+struct ResourceEnvelope {
+  double cpus = 0.0;
+  uint64_t memory_mib = 0;
+  int pids = 0;
+  uint64_t expected_mib = 0;
+};
+
+// Sizes each run's envelope from the peaks earlier runs of the same key
+// (task and run type) reached, so a runaway container is held near what its
+// task normally needs instead of taking the host from the runs beside it.
+// Peaks are recorded per run, so the same run seen again (a catalog read
+// twice) replaces its entry; the newest kHistory runs per key are kept.
+class ResourceEnvelopes {
+public:
+  static constexpr size_t kHistory = 8;
+  static constexpr double kHeadroom = 1.5; // over the largest peak seen
+  static constexpr uint64_t kMinMemoryMib = 512;
+  static constexpr uint64_t kHostReserveMib = 2048; // never handed out
+  static constexpr int kPidsLimit = 4096;
+
+  void Record(const std::string &key, const std::string &run,
+              float peak_cpu_pct, float peak_mem_mib);
+  // The next run of key on a host with cpus cores and mem_total_mib of
+  // memory (0 when unknown): kHeadroom over the largest recent peaks, at
+  // least one core and kMinMemoryMib, at most half the host and never into
+  // kHostReserveMib. Without history the ceilings themselves.
+  ResourceEnvelope For(const std::string &key, int cpus,
+                       uint64_t mem_total_mib);
+
+private:
+  struct Peak {
+    std::string run;
+    float cpu_pct;
+    float mem_mib;
+  };
+
+  std::mutex mutex_;
+  std::map<std::string, std::deque<Peak>> peaks_;
+};
+
+// Expected durations of runs and of their phases, learned from finished
+// runs: per task and mode an exponentially weighted average that gives the
+// newest run kWeight, and the same per mode for tasks without history of
+// their own. A run (named by its log directory) counts once however often
+// its record is read.
+class DurationModel {
+public:
+  static constexpr double kWeight = 0.3;
+
+  void Record(const std::string &task, const std::string &mode,
+              const std::string &run, double seconds,
+              const std::vector<PhaseTiming> &phases);
+  // Seconds a run of mode for task is expected to take: its task's average,
+  // else its mode's; -1 before any such run finished
+  double Expected(const std::string &task, const std::string &mode) const;
+  // The same for one of the run's phases (a name of its timeline)
+  double ExpectedPhase(const std::string &task, const std::string &mode,
+                       const std::string &phase) const;
+
+private:
+  struct Average {
+    double seconds = 0.0;
+    int runs = 0;
+    void Add(double value);
+  };
+  struct Estimate {
+    Average run;
+    std::map<std::string, Average> phases;
+  };
+  static void Add(Estimate &estimate, double seconds,
+                  const std::map<std::string, double> &phases);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Estimate> tasks_; // "<task>|<mode>"
+  std::map<std::string, Estimate> modes_;
+  std::set<std::string> seen_;
+};
+
+// Durations in logarithmic buckets, each kGrowth times as wide as the one
+// before, so a quantile is within a few percent of the exact one however
+// many samples there are. Sparse, so a sketch of a few runs holds a few
+// entries; sketches of disjoint samples merge exactly.
+class DurationSketch {
+public:
+  static constexpr double kGrowth = 1.05;
+
+  void Add(double ms);
+  void Merge(const DurationSketch &other);
+  // Milliseconds at quantile q (0..1); 0 when empty
+  double Quantile(double q) const;
+  uint32_t count() const { return count_; }
+
+private:
+  std::vector<std::pair<uint16_t, uint32_t>> buckets_; // index, samples
+  uint32_t count_ = 0;
+};
+
+// The failure kinds a summary names, for counting them across runs: each
+// failed test, each kind of API error, else its first error line with
+// numbers and hex ids masked so reruns of one failure compare equal, else
+// its exit code
+std::vector<std::string> FailureSignatures(const FailureSummary &summary);
+
+// Rolling aggregates of finished runs for the Run Analytics window: pass
+// rates per task and mode, phase duration quantiles, failure signatures and
+// cache hit rates. Each run updates them once, as its catalog events are
+// folded, in the bucket of the day it ended and in an all-time total, so a
+// report merges at most one bucket per day of its window and never
+// revisits runs.
+class RunAnalytics {
+public:
+  enum Cache { kImageCache, kVerifyCache, kAuditCache, kCacheCount };
+
+  // A run that ended; run names it (its catalog key), so a catalog read
+  // twice counts it once
+  void RecordRun(const std::string &run, const RunRecord &rec);
+  // Its failure summary, which the GUI appends after the end
+  void RecordFailure(const std::string &run, const RunRecord &rec);
+
+  struct TaskRow {
+    std::string task;
+    std::string mode;
+    int runs = 0;
+    int passed = 0;
+    double seconds = 0.0;        // all its runs together
+    double failed_seconds = 0.0; // of those that failed
+    double p50_s = 0.0;
+    double p95_s = 0.0;
+  };
+  struct PhaseRow {
+    std::string name;
+    int runs = 0;
+    double seconds = 0.0;
+    double p50_s = 0.0;
+    double p95_s = 0.0;
+  };
+  struct FailureRow {
+    std::string signature;
+    int runs = 0;
+    int tasks = 0;     // distinct tasks it hit
+    long long last = 0; // epoch seconds the latest of its runs ended
+  };
+  struct CacheRow {
+    int lookups = 0;
+    int hits = 0;
+    double miss_seconds = 0.0; // in the phase a hit skips
+  };
+  // Tasks by time lost to failed runs, phases by time spent and failures
+  // by runs, each the first place tuning pays off
+  struct Report {
+    uint64_t version = 0;
+    int runs = 0;
+    int passed = 0;
+    double seconds = 0.0;
+    std::vector<TaskRow> tasks;
+    std::vector<PhaseRow> phases;
+    std::vector<FailureRow> failures;
+    CacheRow caches[kCacheCount];
+  };
+  // The runs that ended in the days days up to now (epoch seconds; days 0
+  // for all of them)
+  Report Query(int days, long long now) const;
+  // Changes with every run recorded, for a view to tell a report is stale
+  uint64_t version() const { return version_.load(); }
+
+private:
+  struct TaskStats {
+    int runs = 0;
+    int passed = 0;
+    double seconds = 0.0;
+    double failed_seconds = 0.0;
+    DurationSketch durations;
+  };
+  struct PhaseStats {
+    double seconds = 0.0;
+    DurationSketch durations;
+  };
+  struct FailureStats {
+    int runs = 0;
+    long long last = 0;
+    std::set<std::string> tasks;
+  };
+  struct Bucket {
+    std::map<std::pair<std::string, std::string>, TaskStats> tasks;
+    std::map<std::string, PhaseStats> phases;
+    std::map<std::string, FailureStats> failures;
+    CacheRow caches[kCacheCount];
+  };
+  static void Merge(Bucket &into, const Bucket &from);
+
+  mutable std::mutex mutex_;
+  std::map<long long, Bucket> days_; // by the day since the epoch runs ended
+  Bucket all_;
+  std::set<std::string> runs_seen_;
+  std::set<std::string> failures_seen_;
+  std::atomic<uint64_t> version_{0};
+};
+
+// Kubernetes runs. A Docker worker endpoint "k8s://<context>/<namespace>"
+// (an empty context is kubectl's current one, no namespace "default")
+// sends its runs to the cluster as Jobs (see k8s_run in autobuild.sh). Each
+// run's pod requests kClusterRunCpus and kClusterRunMib for its Docker
+// daemon plus kClusterRunnerCpus and kClusterRunnerMib for the runner.
+constexpr const char *kKubeScheme = "k8s://";
+constexpr double kClusterRunCpus = 2.0;
+constexpr uint64_t kClusterRunMib = 4096;
+constexpr double kClusterRunnerCpus = 0.1;
+constexpr uint64_t kClusterRunnerMib = 256;
+
+struct KubeTarget {
+  std::string context; // "" for kubectl's current context
+  std::string ns;
+};
+
+// False for an endpoint that is not a k8s:// one
+bool ParseKubeEndpoint(const std::string &endpoint, KubeTarget &target);
+
+// AUTOBUILD_K8S for the script: "<context>/<namespace>"
+std::string KubeScriptTarget(const KubeTarget &target);
+
+// A remote Docker host the scheduler can place runs on, next to the local
+// one. The endpoint is a DOCKER_HOST URL (tcp://, ssh://) or the name of a
+// Docker context; slots is how many runs it takes at once. A
+// k8s://<context>/<namespace> endpoint is a Kubernetes cluster instead:
+// its runs become Jobs there, and slots caps what ClusterMonitor finds
+// room for.
+struct DockerWorker {
+  std::string endpoint;
+  int slots = 4;
+};
+
+constexpr int kDockerWorkerMaxSlots = 64;
+constexpr int kClusterWorkerMaxSlots = 1024;
+
+// True for a k8s:// endpoint
+bool IsClusterWorker(const std::string &endpoint);
+
+// Workers are written to the config as "<slots>:<endpoint>", e.g.
+// "8:ssh://build@host1". The endpoint is everything after the first colon.
+std::string FormatDockerWorker(const DockerWorker &worker);
+bool ParseDockerWorker(const std::string &text, DockerWorker &worker);
+
+// Variables that point the docker CLI in a run's script at endpoint. A
+// context only applies while DOCKER_HOST is unset, so it is cleared. A
+// cluster gets the script's AUTOBUILD_K8S and the requests ClusterMonitor
+// counts runs by.
+std::vector<std::string>
+DockerWorkerEnvironment(const std::string &endpoint);
+
+// Shell assignments that point a docker command at endpoint, each followed
+// by a space ("" for this host)
+std::string DockerWorkerPrefix(const std::string &endpoint);
+
+// Shell commands printing, as JSON, the target cluster's nodes or its pods
+// that have not finished, for ReadClusterCapacity
+std::string KubeNodesCommand(const KubeTarget &target);
+std::string KubePodsCommand(const KubeTarget &target);
+
+// Kubernetes quantity ("500m", "2", "1.5", "4Gi", "512M", "1e3") in base
+// units (cores, bytes); -1 if unreadable
+double ParseKubeQuantity(std::string_view text);
+
+// What a cluster can still take: per Ready, schedulable node its
+// allocatable CPU and memory and what the pods placed on it request, and
+// what the pods still waiting for a node request
+struct ClusterCapacity {
+  struct Node {
+    double cpus = 0.0;
+    double requested_cpus = 0.0;
+    uint64_t mib = 0;
+    uint64_t requested_mib = 0;
+  };
+  std::vector<Node> nodes;
+  double pending_cpus = 0.0;
+  uint64_t pending_mib = 0;
+};
+
+// Fill capacity from the output of KubeNodesCommand and KubePodsCommand;
+// false when nodes is not a node list
+bool ReadClusterCapacity(const JsonValue &nodes, const JsonValue &pods,
+                         ClusterCapacity &capacity);
+
+// Further runs requesting cpus and mib (and the runner's share) that fit on
+// the cluster's nodes once the pending pods have been placed
+int ClusterFreeRuns(const ClusterCapacity &capacity, double cpus,
+                    uint64_t mib);
+
+// OpenMetrics text for the metrics endpoint. Declare a family, then add its
+// samples; counters take the "_total" suffix and summaries "_sum" and
+// "_count". labels is a comma-separated list built with MetricLabel.
+class MetricsWriter {
+public:
+  // type is "gauge", "counter" or "summary"
+  MetricsWriter &Family(const char *name, const char *type, const char *help);
+  MetricsWriter &Sample(const char *suffix, double value,
+                        std::string_view labels = std::string_view());
+  // Adds the closing "# EOF"
+  std::string Finish();
+
+private:
+  std::string out_;
+  std::string name_;
+};
+
+// key="value" with the value escaped for a label set
+std::string MetricLabel(const char *key, std::string_view value);
+
+// Serves GET /metrics over HTTP on a TCP port, on all interfaces, from a
+// background thread. render builds the body for every scrape and is called
+// on that thread, so it must take whatever locks the data needs.
+class MetricsServer {
+public:
+  using RenderFn = std::function<std::string()>;
+
+  ~MetricsServer() { Stop(); }
+
+  // (Re)start on port; 0 stops. Returns false if the port cannot be bound.
+  bool Start(int port, RenderFn render);
+  void Stop();
+  int port() const { return port_; }
+
+private:
+  void Run(intptr_t listen_fd);
+
+  RenderFn render_;
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  int port_ = 0;
+};
+
+// Live dashboard for watching runs from another machine: serves a page at /
+// and a Server-Sent Events stream at /events, on all interfaces, from a
+// background thread. The stream carries "state" events, the text snapshot()
+// returns (a JSON object per line), whenever it changes, and "line" events
+// for the output lines handed to Publish. Published lines are formatted
+// once into a ring every client reads from its own cursor through a
+// non-blocking socket: a slow browser falls behind, and is told how many
+// lines it missed once the ring has moved past it, but never holds up
+// Publish or the other clients. Built with zstd, a browser that accepts it
+// gets the page and the stream as Content-Encoding: zstd; the stream is
+// flushed after every batch the server sends, so compression adds no wait
+// to the live view.
+class DashboardServer {
+public:
+  using SnapshotFn = std::function<std::string()>;
+  static constexpr size_t kRingLines = 8192;
+
+  ~DashboardServer() { Stop(); }
+
+  // (Re)start on port; 0 stops. Returns false if the port cannot be bound.
+  // snapshot is called on the server thread while clients are connected.
+  bool Start(int port, SnapshotFn snapshot);
+  void Stop();
+  int port() const { return port_; }
+  size_t Clients() const { return clients_.load(std::memory_order_relaxed); }
+
+  // Any thread: a line of output from log (a name such as a phase log file;
+  // empty for the task output) of task. A no-op while the server is off.
+  void Publish(int task, std::string_view log, std::string_view line);
+
+private:
+  struct Client;
+
+  void Run(intptr_t listen_fd);
+  // Send what client has queued until its socket would block; false once
+  // the connection is done
+  bool Pump(Client &client);
+  // The same for a client taking the stream zstd-compressed (built with
+  // AUTOBUILD_HAVE_ZSTD only)
+  bool PumpPacked(Client &client);
+  bool HasOutput(const Client &client);
+
+  SnapshotFn snapshot_;
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> serving_{false};
+  std::atomic<size_t> clients_{0};
+  int port_ = 0;
+  // Formatted "line" events, oldest first
+  std::mutex ring_mutex_;
+  LogArena ring_{kRingLines};
+  // Current "state" event and its number, server thread only
+  std::shared_ptr<const std::string> state_;
+  uint64_t state_version_ = 0;
+};
+
+// Local endpoint other programs (CI jobs, scripts) hand runs to, so they
+// share the running instance's scheduler, image cache and containers. It
+// listens on a Unix socket (AF_UNIX, which Windows 10 also has), only open
+// to this user, and speaks newline-delimited JSON: a client writes one
+// object per request and reads one object per answer, in order.
+//
+//   {"op": "submit", "task": "<dir>", "mode": "Verify", "runs": 2}
+//   {"op": "status"} or {"op": "status", "run": 7}
+//   {"op": "cancel", "run": 7}
+//   {"op": "logs", "run": 7}
+//
+// Requests are answered by the handler passed to Poll, on the thread that
+// calls it, so it may use state no other thread touches. A handler that
+// sets follow to a run turns the connection, after its answer, into a
+// stream of the run's output from the time of the request: {"run": 7,
+// "text": "..."} per line, ending with {"run": 7, "exit_code": n} once the
+// run is over. A client too slow for the ring is told how many lines it
+// missed ({"gap": n}).
+class SubmissionServer {
+public:
+  using HandlerFn =
+      std::function<std::string(const JsonValue &request, uint64_t &follow)>;
+  static constexpr size_t kRingLines = 8192;
+
+  ~SubmissionServer() { Stop(); }
+
+  // (Re)start on the socket at path (replacing a stale one); "" stops.
+  // Returns false if it cannot be created.
+  bool Start(const std::string &path);
+  void Stop();
+  const std::string &path() const { return path_; }
+
+  // Answer the requests that came in since the last call
+  void Poll(const HandlerFn &handler);
+
+  // Any thread: a line of output of run, and its end. No-ops while nobody
+  // follows a run.
+  void Publish(uint64_t run, std::string_view line);
+  void Ended(uint64_t run, int exit_code);
+
+private:
+  struct Client;
+  struct Request {
+    uint64_t client;
+    uint64_t cursor; // ring position when it came in
+    std::string text;
+  };
+  struct Answer {
+    uint64_t client;
+    uint64_t cursor;
+    std::string text;
+    uint64_t follow; // run to stream, 0 when none
+  };
+  struct Entry {
+    uint64_t run;
+    bool end;
+    std::string event; // JSON line
+  };
+
+  void Run(intptr_t listen_fd);
+  void Append(uint64_t run, bool end, std::string event);
+  // Queue what of the ring client follows, up to a pass's worth
+  void Fill(Client &client);
+
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  std::atomic<int> following_{0};
+  std::string path_;
+  // Requests for Poll and its answers for the server thread
+  std::mutex mutex_;
+  std::vector<Request> requests_;
+  std::vector<Answer> answers_;
+  // Events of followed runs, oldest first, and how many were ever appended
+  std::mutex ring_mutex_;
+  std::deque<Entry> ring_;
+  uint64_t appended_ = 0;
+};
+
+// Journal of the runs a front end has in flight, so the next instance can
+// pick up what a crash or restart left behind: the runs' containers keep
+// going and their phase logs keep growing without it. Each change is one
+// JSON line appended and flushed at once (a run started, announced its
+// container, log directory or a phase log, or ended); reading the journal
+// back folds them into the runs that never ended.
+struct JournalRun {
+  long long run = 0; // the front end's id for it
+  std::string name;
+  std::string task_type;
+  std::string group;  // task directory
+  std::string worker; // Docker endpoint ("" for this host)
+  std::string spool;  // file holding its output so far
+  long long started_ms = 0; // epoch
+  std::string container;
+  std::string container_id;
+  std::string log_dir;
+  std::vector<std::string> phase_logs;
+};
+
+class RunJournal {
+public:
+  ~RunJournal() { Close(); }
+
+  // Open the journal at path (created if missing) and return the runs it
+  // holds that never ended; the file then starts over empty, so the caller
+  // records again those it keeps following. False if it cannot be written.
+  bool Open(const std::string &path, std::vector<JournalRun> &unfinished);
+  void Close();
+
+  // Any thread; no-ops while closed. Set records key ("container",
+  // "container_id", "log_dir", or "phase_log", which adds one) of run.
+  void Started(const JournalRun &run);
+  void Set(long long run, const char *key, std::string_view value);
+  void Ended(long long run);
+
+private:
+  void Write(const std::string &line);
+
+  std::mutex mutex_;
+  FILE *file_ = nullptr;
+};
+
+// How often the containers of reattached runs are checked
+constexpr int kReattachPollMs = 5000;
+
+// 1 while container_id runs on the Docker endpoint worker ("" for this
+// host), 0 once it stopped or is gone, -1 when Docker cannot tell
+int ContainerRunning(const std::string &worker,
+                     const std::string &container_id);
+
+// Runs brought back from the journal whose container was still up. Their
+// scripts went with the old instance (their output pipe closed), but the
+// phase running in the container carries on and keeps writing its log. A
+// thread asks Docker about each container every kReattachPollMs; once one
+// has stopped (or is gone) the stopped hook finishes the run's phase logs
+// and closes its journal entry. Run has the std::string worker and
+// container_id its container is found by.
+template <typename Run> class ReattachWatcher {
+public:
+  // thread_start runs first on the watcher thread; stopped gets each run
+  // whose container is done, there, and done runs after a pass that
+  // stopped any
+  struct Hooks {
+    std::function<void()> thread_start;
+    std::function<void(Run &)> stopped;
+    std::function<void()> done;
+  };
+
+  explicit ReattachWatcher(Hooks hooks) : hooks_(std::move(hooks)) {}
+  ~ReattachWatcher() { Stop(); }
+  ReattachWatcher(const ReattachWatcher &) = delete;
+  ReattachWatcher &operator=(const ReattachWatcher &) = delete;
+
+  void Watch(const std::shared_ptr<Run> &run) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_)
+      return;
+    runs_.push_back(run);
+    if (!thread_.joinable())
+      thread_ = std::thread([this]() {
+        if (hooks_.thread_start)
+          hooks_.thread_start();
+        Loop();
+      });
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+private:
+  void Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      std::vector<std::shared_ptr<Run>> runs = runs_;
+      lock.unlock();
+      std::vector<std::shared_ptr<Run>> done;
+      for (const auto &run : runs) {
+        if (ContainerRunning(run->worker, run->container_id) != 0)
+          continue;
+        if (hooks_.stopped)
+          hooks_.stopped(*run);
+        done.push_back(run);
+      }
+      if (!done.empty() && hooks_.done)
+        hooks_.done();
+      lock.lock();
+      runs_.erase(std::remove_if(runs_.begin(), runs_.end(),
+                                 [&](const std::shared_ptr<Run> &r) {
+                                   return std::find(done.begin(), done.end(),
+                                                    r) != done.end();
+                                 }),
+                  runs_.end());
+      cv_.wait_for(lock, std::chrono::milliseconds(kReattachPollMs),
+                   [this]() { return stop_; });
+    }
+  }
+
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  std::vector<std::shared_ptr<Run>> runs_;
+  bool stop_ = false;
+};
+
+// Which logs roots runs write to a local staging directory first (see
+// LogStager): none, those on a network filesystem, or every one
+enum class LogStaging : uint8_t { Off, Network, Always };
+
+// Whether path (or its nearest existing parent) is on a network filesystem
+bool IsNetworkFilesystem(std::string path);
+
+// Whether path is dir or lies inside it; either separator matches either
+bool PathWithin(const std::string &path, const std::string &dir);
+
+// Where runs write instead of a network logs root, and where the shipped
+// copies go: the configured root, and optionally an S3-compatible object
+// store in addition
+struct LogStagingSettings {
+  LogStaging mode = LogStaging::Network;
+  std::string dir; // local staging directory
+  uint64_t backlog_limit = 0; // unshipped bytes that hold launches (0 = none)
+  std::string object_store;   // s3://bucket/prefix, or ""
+  std::string endpoint;       // S3-compatible endpoint URL ("" = AWS)
+  std::string region;
+
+  bool operator==(const LogStagingSettings &o) const {
+    return mode == o.mode && dir == o.dir &&
+           backlog_limit == o.backlog_limit &&
+           object_store == o.object_store && endpoint == o.endpoint &&
+           region == o.region;
+  }
+  bool operator!=(const LogStagingSettings &o) const { return !(*this == o); }
+};
+
+// Ships staged logs roots to their destinations on a background thread.
+// Each staged root is <staging dir>/<name>-<hash> with a .root file naming
+// the real root, so staged runs left by an earlier session are shipped too.
+// Logs (.log, .jsonl, .txt) and spool files only grow and are shipped from
+// where the destination copy ends, in large sequential writes; other files
+// are copied whole through a temporary file once they stop changing. The
+// catalog is shipped last, only up to where it ended before the pass, so
+// the root's catalog never names files the root does not have yet, and
+// with staged paths in its lines rewritten to the root's. A run's staged
+// copy is removed a while after the catalog records its end and everything
+// in it was shipped; until then the run's view of its files stays local.
+//
+// With an object store set, every file of a run is also uploaded under
+// <prefix>/<task>/<run>/<mode>/: logs as multipart uploads whose parts go
+// up while the run still writes them, completed when the run ends, and
+// other files with one PUT. Uploads run curl (--aws-sigv4, 7.75 or later)
+// with the AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY and AWS_SESSION_TOKEN
+// of the environment.
+class LogStager {
+public:
+  struct Hooks {
+    std::function<void()> thread_start;
+    // After every pass over the staged roots
+    std::function<void()> passed;
+    // A directory of a real root got files (the root itself for catalog
+    // lines)
+    std::function<void(const std::string &)> touched;
+    // The staged copy of a shipped run (its directory under the real root)
+    // was removed
+    std::function<void(const std::string &)> unstaged;
+  };
+
+  struct Status {
+    uint64_t backlog = 0; // bytes not shipped yet
+    size_t roots = 0;     // staged roots
+    std::string error;    // why the last pass stopped, "" when it did not
+  };
+
+  explicit LogStager(Hooks hooks = {}) : hooks_(std::move(hooks)) {}
+  ~LogStager() { Stop(); }
+
+  void Configure(const LogStagingSettings &settings);
+
+  // Directory a run should use as its logs root in place of root: a
+  // staging directory when root is staged, else root itself
+  std::string Stage(const std::string &root);
+
+  // path while it exists; a staged path that was shipped and removed maps
+  // to the same place under the real root
+  std::string Resolve(const std::string &path);
+
+  Status GetStatus();
+
+  // The unshipped backlog is over the limit; queued runs wait
+  bool Backlogged() const { return backlogged_.load(); }
+
+  // Run passes until one that began after the call leaves nothing to ship;
+  // false when timeout_ms ran out (or the stager stopped) first
+  bool Flush(int timeout_ms);
+
+  void Stop();
+
+private:
+  // Staged roots are named the platform's way, as the script's paths come
+  // back (see ConvertFromUnixPath), so catalog lines can be matched
+#ifdef _WIN32
+  static constexpr const char *kSeparator = "\\";
+#else
+  static constexpr const char *kSeparator = "/";
+#endif
+
+  struct StagedRoot {
+    std::string root, staged;
+  };
+
+  // What was shipped of one staged file; stager thread only
+  struct FileState {
+    bool known = false;   // shipped was taken from the destination copy
+    bool created = false; // the destination copy exists
+    uint64_t shipped = 0; // bytes of a log the destination has
+    uint64_t size = 0;     // size and mtime of the copy of any other file
+    long long mtime = -1;
+    // Object store: an upload in progress, its parts and what they cover
+    std::string upload_id;
+    std::vector<std::string> etags;
+    uint64_t uploaded = 0;
+    long long stored = -1; // size the stored object has (-1 = none)
+  };
+
+  // Stager thread state of one staged root
+  struct Shipping {
+    std::map<std::string, FileState> files; // by path under the root
+    bool loaded = false;
+    uint64_t catalog_shipped = 0;
+    std::map<std::string, time_t> ended; // run keys by when their end shipped
+    std::map<std::string, long long> stored; // from <staged>/.stored
+  };
+
+  struct Entry {
+    std::string rel; // with '/' separators
+    uint64_t size;
+    long long mtime;
+    bool log, spool;
+  };
+
+  void AddRootLocked(const std::string &root, const std::string &staged);
+
+  // Staged roots an earlier session left under dir
+  void Discover(const std::string &dir);
+
+  void Run();
+
+  // Files under dir (relative to the staged root, prefix), without the
+  // catalog, dot entries and the spool's gate directories
+  static void Collect(const std::string &staged, const std::string &prefix,
+                      std::vector<Entry> &out);
+
+  // Run key (<task>/<run>/<mode>) of a path under the staged root; "" for
+  // files above a mode directory
+  static std::string RunKeyOf(const std::string &rel);
+
+  static uint64_t SizeOf(const std::string &path);
+
+  static std::string Parent(const std::string &path);
+
+  // Copy [from, to) of src to the same place in dst; dst is created (or
+  // cut off) when from is 0
+  bool CopyRange(const std::string &src, const std::string &dst,
+                 uint64_t from, uint64_t to);
+
+  // Bring the destination copy of one file up to date
+  bool ShipFile(const std::string &root, const std::string &staged,
+                const Entry &e, FileState &fs, time_t now,
+                std::string &error);
+
+  static bool Shipped(const Entry &e, const FileState &fs);
+
+  // URL of key in the object store
+  static std::string ObjectUrl(const LogStagingSettings &s,
+                               const std::string &key);
+
+  static std::string Region(const LogStagingSettings &s);
+
+  // curl against the object store with the environment's credentials
+  // (kept out of the command line in a private config file); out gets the
+  // response headers and body. True on a 2xx answer.
+  bool Curl(const LogStagingSettings &s, std::vector<std::string> args,
+            std::vector<std::string> &out, std::string &error);
+
+  // Value of a response header, or of an XML element in the body
+  static std::string HeaderValue(const std::vector<std::string> &out,
+                                 const char *name);
+  static bool StartsWithNoCase(const std::string &s, const char *prefix);
+  static std::string XmlValue(const std::vector<std::string> &out,
+                              const std::string &tag);
+
+  // Upload [fs.uploaded, to) of src as the next part of its upload
+  bool UploadPart(const LogStagingSettings &s, const std::string &src,
+                  const std::string &url, FileState &fs, uint64_t to,
+                  std::string &error);
+
+  // [from, to) of src into the empty file part
+  bool CopyPart(const std::string &src, const std::string &part,
+                uint64_t from, uint64_t to);
+
+  // Upload what the object store does not have of one file yet; final
+  // when the run ended and the file will not change again
+  bool StoreFile(const LogStagingSettings &s, const std::string &staged,
+                 const Entry &e, FileState &fs, bool final,
+                 std::string &error);
+
+  // A catalog line with the staged root's paths replaced by the root's,
+  // in both the GUI's and the script's spelling
+  static std::string RewriteCatalogLine(std::string line,
+                                        const StagedRoot &root);
+
+  // Note run starts and ends from catalog lines
+  static void TrackRuns(Shipping &sh, const std::string &text, time_t now);
+
+  // The shipped part of the catalog and what a former session uploaded
+  void Load(const StagedRoot &root, Shipping &sh, time_t now);
+
+  // Ship the catalog lines in [sh.catalog_shipped, end)
+  bool ShipCatalog(const StagedRoot &root, Shipping &sh, uint64_t end,
+                   time_t now, std::string &error);
+
+  // One pass over a staged root; false when something could not be shipped
+  bool ShipRoot(const LogStagingSettings &s, const StagedRoot &root,
+                Shipping &sh, Status &status);
+
+  const Hooks hooks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable pass_cv_; // a pass ended
+  std::thread thread_;
+  uint64_t passes_started_ = 0, passes_done_ = 0;
+  LogStagingSettings settings_;
+  bool configured_ = false;
+  std::vector<StagedRoot> roots_;
+  Status status_;
+  bool changed_ = false;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> backlogged_{false};
+  // Stager thread only
+  std::map<std::string, Shipping> shipping_; // by staged root
+  std::vector<char> buffer_;
+  std::string curl_config_;
+  const time_t started_ = time(nullptr);
+};
+
+// What the GUI keeps in its settings file (autobuild_gui.json). AppState
+// in the GUI derives from it; SerializeAppSettings and ApplyAppSettings are
+// the file's codec, and FileSaver and SettingsWatcher write and watch it.
+struct AppSettings {
+  // Logs roots, and the one the Logs tab shows
+  std::vector<std::string> log_folder_paths;
+  int selected_log_folder = 0;
+  // Saved but never loaded: each session starts without a task
+  std::string task_directory;
+  std::string build_dir = "native/build";
+  std::string api_key;
+  // Automatically convert image/container names to lowercase
+  bool auto_lowercase_names = true;
+
+  int max_concurrent_tasks = 3; // 1 to 20
+  QueueOrder queue_order = QueueOrder::Fair;
+  // Adaptive concurrency: instead of max_concurrent_tasks, runs start while
+  // the host has room. Builds and prompt runs have separate budgets; a zero
+  // build budget is derived from the core count.
+  bool adaptive_concurrency = true;
+  // Give each local run's containers CPU, memory and process limits sized
+  // from the run history (see ResourceEnvelopes)
+  bool use_container_limits = true;
+  // Windows: CPU share (percent of the machine) and committed memory (MiB)
+  // allowed to each run's whole process tree through its job object; 0 is
+  // no limit
+  int tree_cpu_percent = 0;
+  int tree_memory_mb = 0;
+  // Run each run's processes at background priority outside its prompt
+  // phases, and raise the render thread's own priority
+  bool background_builds = true;
+  bool raise_gui_priority = false;
+  int max_build_tasks = 0;
+  int max_api_tasks = 8;
+  // Per-stage limits enforced at the script's stage gates (0 = none); the
+  // prompt stage uses max_api_tasks
+  int max_image_builds = 0;
+  int max_verify_tasks = 0;
+  // Base images pulled at once ahead of queued builds (0 = the default of
+  // BaseImagePuller)
+  int max_image_pulls = 0;
+  // Directory of the host-wide slots shared with the other instances on
+  // this host ("" = this instance's limits only); see HostLeasePool
+  std::string host_lease_dir;
+  // Remote Docker hosts; runs that do not fit on this host go to the one
+  // with the most free slots
+  std::vector<DockerWorker> docker_workers;
+
+  // Prompt starts per minute per Gemini API key (0 = no rate limit); see
+  // ApiGovernor
+  int api_prompts_per_min = 0;
+  // Daily prompt quota per API key (0 = none), the UTC hour its day starts,
+  // the share of it kept for High batches and how many hours before the
+  // reset count as off-peak; see QuotaAllowsStart
+  int api_daily_quota = 0;
+  int api_quota_reset_utc = 8;
+  int api_quota_reserve_pct = 20;
+  int api_offpeak_hours = 6;
+
+  // Warm containers kept per image for runs to take (0 = no pool)
+  int container_pool_size = 0;
+  // Containers a verification is split over when verify/ has shard.sh or
+  // tests.list (0 or 1 = one container)
+  int verify_shards = 0;
+  // Compress run logs older than this many days (0 = keep them as they are)
+  int log_archive_days = 0;
+  // Keep <root>/catalog.parquet of every logs root up to date
+  bool export_catalog = false;
+  // Write-behind staging of logs roots: which ones, where ("" = next to the
+  // settings file), the unshipped backlog in MB that holds launches (0 = no
+  // limit), and an optional s3:// object store that gets a copy of every run
+  LogStaging log_staging = LogStaging::Network;
+  std::string log_staging_dir;
+  int log_staging_backlog_mb = 2048;
+  std::string log_object_store;
+  std::string log_object_store_endpoint;
+  std::string log_object_store_region;
+  // Memory all task and phase log windows may hold together, in MB
+  int log_memory_mb = 256;
+  // Output lines a second each task and phase log window takes in full
+  // before it samples (0 = no limit); see IngestThrottle
+  int log_ingest_lines_per_sec = 5000;
+  // Silence, in seconds, after which the log views mark the next line
+  // (0 = off)
+  int log_gap_seconds = 60;
+  // Task log severity rules
+  std::vector<LogSeverityRule> log_severity_rules = DefaultLogSeverityRules();
+
+  // Minutes after the end of a run that its task is compacted into a
+  // summary (0 = never)
+  int compact_after_minutes = 30;
+  // Stall watchdog: minutes without output or container CPU use after which
+  // a run is ended, outside its prompts and in them (0 = never), and how
+  // often a stalled run is queued again
+  int stall_minutes = 30;
+  int stall_prompt_minutes = 30;
+  int stall_retries = 1;
+  // Back up stragglers of audits and verify trials once the queue is empty
+  bool speculative_backups = false;
+  // Docker garbage collection of finished runs' containers and images:
+  // newest runs kept per task, age limit in hours and disk use in GB
+  // (0 = rule off)
+  int docker_gc_keep = 0;
+  int docker_gc_ttl_hours = 0;
+  int docker_gc_disk_gb = 0;
+  // TCP ports of the OpenMetrics endpoint and the live web dashboard
+  // (0 = off)
+  int metrics_port = 0;
+  int dashboard_port = 0;
+  // Unix socket runs are submitted through ("" = off)
+  std::string submit_socket;
+  // Publish each run's output in a shared-memory ring (see SharedLogRing)
+  bool share_log_rings = false;
+
+  bool use_docker_no_cache = true; // Always use --no-cache for Docker builds
+  // Enable Docker build debug mode with verbose output
+  bool use_docker_debug = false;
+  // Runs started together build their image once and share it
+  bool build_once_for_multiple = true;
+  // Both runs build the image once, then feedback and verify side by side
+  bool parallel_both = true;
+  // Reuse the image of an unchanged env/ directory instead of rebuilding
+  bool use_image_cache = true;
+  // Build the selected task's image in the background as soon as it
+  // validates, before any run is queued (needs use_image_cache)
+  bool speculative_build = false;
+  // Registry repository cached images are pushed to and pulled from by env
+  // hash, so each is built on one host ("" = none; needs use_image_cache)
+  std::string image_registry;
+  // Reuse the stored verification result of an unchanged workspace and
+  // verify/ instead of running verify.sh again
+  bool use_verify_cache = false;
+  // Reuse the stored outcome of an audit of unchanged inputs
+  bool use_audit_cache = false;
+  // Build through BuildKit with cache mounts and an exported layer cache in
+  // build_cache (a directory or registry repository; empty = the script's
+  // default directory)
+  bool use_buildkit = true;
+  std::string build_cache;
+  // Mount shared package cache volumes (cache_volumes: npm, pip, apt) into
+  // task containers, so installs after the first come from local disk
+  bool use_cache_volumes = true;
+  std::string cache_volumes = "npm";
+  // Download npm, PyPI and apt packages in builds and task containers
+  // through a pull-through cache (see PackageProxySpec): 0 off, 1 one per
+  // Docker host, 2 one on this host for the whole fleet, which the workers
+  // reach at package_proxy_url
+  int package_proxy = 0;
+  std::string package_proxy_url;
+  // Where run containers keep their workdir: "" for the container's own
+  // filesystem, "tmpfs:<size>" or "volume" (see workdir_mount_setup in
+  // autobuild.sh); a task's workdir_mount file overrides it
+  std::string workdir_mount;
+  // Run install and verification commands of local runs through the Docker
+  // API and read their output directly
+  bool attach_phase_output = true;
+  // Read run output from a pseudo-terminal instead of pipes, so the script
+  // and the tools it starts write unbuffered (see ProcessOptions)
+  bool pty_capture = false;
+  // Windows: run the script and the Manage tab helpers in a WSL2 distro
+  // (wsl_distro, "" for the default one) instead of Git Bash / MSYS2, and
+  // optionally mirror task folders on Windows drives into the distro's
+  // filesystem
+  bool use_wsl = false;
+  std::string wsl_distro;
+  bool wsl_mirror_tasks = true;
+  // Run from a cached layer with the Gemini CLI preinstalled
+  bool use_cli_layer = true;
+  // Feedback and audit runs start from a committed image of their set-up
+  // container when one exists, shared through checkpoint_registry if set
+  bool use_checkpoint_image = false;
+  std::string checkpoint_registry;
+
+  // Runs of each mode queued by Run Multiple
+  int feedback_count = 1;
+  int verify_count = 1;
+  int both_count = 1;
+  int audit_count = 1;
+  // Stop rules for Run Multiple batches (see BatchPolicy; 0 = rule off):
+  // failed runs, passed runs and pass rate interval half width in points
+  int batch_max_failures = 0;
+  int batch_target_passes = 0;
+  int batch_ci_pct = 0;
+  // Urgency (BatchUrgency) and deadline in hours (0 = none) of the next
+  // batch queued
+  int batch_urgency = (int)BatchUrgency::Normal;
+  int batch_deadline_hours = 0;
+  // Prompt matrix of the batch import: runs of each variant on every ready
+  // task folder, in which mode (0 = Feedback, 2 = Both)
+  int matrix_reps = 3;
+  int matrix_mode = 0;
+};
+
+// s as the settings file's JSON document
+std::string SerializeAppSettings(const AppSettings &s);
+
+// The settings in a settings file's document, each clamped to its range;
+// keys it does not have keep their current values. Log severity rules and
+// Docker workers that do not parse are skipped, and each is described in
+// ignored.
+void ApplyAppSettings(const JsonValue &root, AppSettings &s,
+                      std::vector<std::string> &ignored);
+
+// Names unique across every run of the program without asking Docker:
+// ULID-style ids, the epoch milliseconds in the high 48 bits and a
+// sequence in the low 16, that only ever increase and come from an atomic
+// counter. A high-water mark kReserve ids ahead of the last one issued is
+// kept on disk, so after a restart, or with the clock set back, numbering
+// resumes above anything handed out before; the file is rewritten only
+// when the issued ids catch up with it.
+class NameService {
+public:
+  static constexpr uint64_t kReserve = uint64_t(60000) << 16; // a minute
+
+  // Start above the mark saved at path (which need not exist yet); false
+  // when it cannot be written. Without Open ids are still unique within
+  // this process.
+  bool Open(const std::string &path);
+
+  // Any thread
+  uint64_t NextId();
+  // NextId as 13 lowercase Crockford base32 digits, which sort like the ids
+  std::string Next() { return Encode(NextId()); }
+  static std::string Encode(uint64_t id);
+
+private:
+  bool SaveMark(uint64_t mark); // under mutex_
+
+  std::atomic<uint64_t> last_{0};
+  std::atomic<uint64_t> reserved_{0};
+  std::mutex mutex_;
+  std::string path_;
+};
+
+// Batch point transforms for visualizations and instanced geometry. Points
+// are held as separate x/y/z/w arrays (structure of arrays), so a SIMD
+// kernel fills every lane instead of issuing one vec4 at a time. The
+// widest kernel the CPU supports is picked once at runtime (see SimdPath):
+// AVX2+FMA (8 points per step) or SSE2 on x86, NEON on ARM, scalar
+// otherwise.
+
+// Four parallel arrays of n floats. An input w may be null, meaning w = 1
+// (points); an output w may be null, meaning it is not written.
+struct SoAVec4 {
+  float *x = nullptr;
+  float *y = nullptr;
+  float *z = nullptr;
+  float *w = nullptr;
+};
+
+// out[i] = m * in[i] for n points; m is a column-major 4x4 matrix, as
+// glm::value_ptr gives it. in and out may be the same arrays.
+void TransformSoA(const float m[16], const SoAVec4 &in, const SoAVec4 &out,
+                  size_t n);
+// Same with an explicit kernel, which must be supported (for benchmarks)
+void TransformSoA(SimdPath path, const float m[16], const SoAVec4 &in,
+                  const SoAVec4 &out, size_t n);
+
+#endif // AUTOBUILD_ENGINE_H
@@ -11,13 +11,25 @@
 //                                                       //
 ////////////////////////////////////////////////////////////
 
+#include "autobuild_engine.h"
 #include "fontawesome_icons.h"
 #include "imgui.h"
 #include "imgui_impl_sdl2.h"
-#include "imgui_impl_sdlrenderer2.h"
 #include "imgui_internal.h"
 #include <SDL.h>
 
+// AUTOBUILD_GUI_OPENGL draws ImGui through its OpenGL 3 backend on a GL
+// context loaded with glad (the splash's loader) instead of SDL_Renderer:
+// each draw list is uploaded once and drawn with one scissored call per
+// command, with no SDL geometry batching in between.
+#ifdef AUTOBUILD_GUI_OPENGL
+#include "imgui_impl_opengl3.h"
+#include <glad/glad.h>
+#include "gpu_timer.h"
+#else
+#include "imgui_impl_sdlrenderer2.h"
+#endif
+
 
 ////////////////////////////////////////////////////////////
 //                                                       //
@@ -34,28 +46,39 @@ bool g_fonts_loaded = false;
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <climits>
 #include <cmath>
+#include <condition_variable>
 #include <csignal>
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <exception>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iomanip>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <queue>
+#include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 
 // Platform-specific includes
 #ifdef _WIN32
 #include <direct.h>
+#include <fcntl.h>
 #include <io.h>
 #include <process.h>
 #include <windows.h>
@@ -63,27 +86,286 @@ bool g_fonts_loaded = false;
 #elif defined(__APPLE__)
 #include <fcntl.h>
 #include <libproc.h>
+#include <CoreServices/CoreServices.h>
 #include <mach-o/dyld.h>
+#include <mach/mach.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <spawn.h>
+#include <sys/event.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/sysctl.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #else
 #include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/vfs.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #endif
 
+// Optional zstd support for archived logs (see CompressLogSeekable)
+#ifdef AUTOBUILD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Optional Tracy instrumentation (AUTOBUILD_TRACY): zones on the worker
+// threads and the main loop, and lock contention on the AppState mutexes.
+// Built without it every macro expands to nothing and TracedMutex is a
+// plain std::mutex.
+#ifdef AUTOBUILD_TRACY
+#include <tracy/Tracy.hpp>
+#define TRACE_ZONE(name) ZoneScopedN(name)
+#define TRACE_THREAD(name) tracy::SetThreadName(name)
+#define TRACE_FRAME() FrameMark
+#define TRACED_MUTEX(var) TracyLockableN(std::mutex, var, #var)
+using TracedMutex = LockableBase(std::mutex);
+#else
+#define TRACE_ZONE(name)
+#define TRACE_THREAD(name)
+#define TRACE_FRAME()
+#define TRACED_MUTEX(var) std::mutex var
+using TracedMutex = std::mutex;
+#endif
+
 // IM_ASSERT override is handled in imgui.h when IMGUI_ASSERT_OVERRIDE is
 // defined
 
+////////////////////////////////////////////////////////////
+//                                                       //
+//                   HEAP ACCOUNTING                     //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Global operator new/delete and ImGui's allocator go through HeapAlloc
+// and HeapFree, which put a 16-byte header in front of every block: its
+// size, the subsystem (HeapTag) current on the allocating thread and that
+// thread's slot. The per-thread allocation count the Frame Profiler shows
+// is always kept. Byte accounting is opt-in from the Dev overlay: while it
+// is on, allocations, bytes, live and peak heap are counted per tag and
+// per thread slot; blocks made while it was off are not counted when freed
+// either, so live stays consistent.
+enum HeapTag : uint16_t {
+  kHeapOther,
+  kHeapUi,
+  kHeapImGui,
+  kHeapLogs,
+  kHeapTasks,
+  kHeapDocker,
+  kHeapSearch,
+  kHeapTagCount,
+  kHeapUncounted = 0xFFFF // block made with accounting off
+};
+static const char *const kHeapTagNames[kHeapTagCount] = {
+    "other", "ui", "imgui", "logs", "tasks", "docker", "search"};
+
+// Thread slots, by thread name; threads of one name share a slot and
+// unnamed threads (or names past the last slot) count in slot 0
+static const size_t kHeapThreadSlots = 16;
+
+struct HeapCounters {
+  std::atomic<uint64_t> allocs{0};
+  std::atomic<uint64_t> frees{0};
+  std::atomic<uint64_t> bytes{0}; // allocated in total
+  std::atomic<int64_t> live{0};   // bytes
+  std::atomic<int64_t> blocks{0}; // live blocks
+  std::atomic<int64_t> peak{0};   // highest live
+};
+
+struct HeapHeader {
+  uint64_t size;
+  uint16_t tag;
+  uint16_t slot;
+  uint32_t unused;
+};
+static_assert(sizeof(HeapHeader) == 16, "keeps blocks 16-byte aligned");
+
+static std::atomic<bool> g_heap_accounting{false};
+static HeapCounters g_heap_total;
+static HeapCounters g_heap_tags[kHeapTagCount];
+static HeapCounters g_heap_threads[kHeapThreadSlots];
+static std::atomic<const char *> g_heap_thread_names[kHeapThreadSlots];
+static std::mutex g_heap_thread_mutex; // assigning slots
+
+static thread_local uint64_t t_heap_allocs = 0;
+static thread_local uint16_t t_heap_tag = kHeapOther;
+static thread_local uint16_t t_heap_slot = 0;
+
+static uint64_t HeapAllocCount() { return t_heap_allocs; }
+
+static void HeapCount(HeapCounters &c, int64_t bytes) {
+  if (bytes >= 0) {
+    c.allocs.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add((uint64_t)bytes, std::memory_order_relaxed);
+    c.blocks.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    c.frees.fetch_add(1, std::memory_order_relaxed);
+    c.blocks.fetch_sub(1, std::memory_order_relaxed);
+  }
+  int64_t live = c.live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  int64_t peak = c.peak.load(std::memory_order_relaxed);
+  while (live > peak && !c.peak.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+static void HeapCountBlock(const HeapHeader &h, int64_t bytes) {
+  HeapCount(g_heap_total, bytes);
+  HeapCount(g_heap_tags[h.tag], bytes);
+  HeapCount(g_heap_threads[h.slot], bytes);
+}
+
+static void *HeapAlloc(size_t size, uint16_t tag) {
+  t_heap_allocs++;
+  if (size > SIZE_MAX - sizeof(HeapHeader))
+    return nullptr;
+  HeapHeader *h = (HeapHeader *)malloc(sizeof(HeapHeader) + size);
+  if (h == nullptr)
+    return nullptr;
+  h->size = size;
+  h->slot = t_heap_slot;
+  h->tag = kHeapUncounted;
+  if (g_heap_accounting.load(std::memory_order_relaxed)) {
+    h->tag = tag;
+    HeapCountBlock(*h, (int64_t)size);
+  }
+  return h + 1;
+}
+
+static void HeapFree(void *p) {
+  if (p == nullptr)
+    return;
+  HeapHeader *h = (HeapHeader *)p - 1;
+  if (h->tag != kHeapUncounted)
+    HeapCountBlock(*h, -(int64_t)h->size);
+  free(h);
+}
+
+// Every replaceable form but the aligned ones, which keep the library's
+// own pair: a runtime (a sanitizer, say) may route any of them straight to
+// its allocator instead of through the plain form
+void *operator new(size_t size) {
+  if (void *p = HeapAlloc(size ? size : 1, t_heap_tag))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return HeapAlloc(size ? size : 1, t_heap_tag);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return HeapAlloc(size ? size : 1, t_heap_tag);
+}
+void operator delete(void *p) noexcept { HeapFree(p); }
+void operator delete[](void *p) noexcept { HeapFree(p); }
+void operator delete(void *p, size_t) noexcept { HeapFree(p); }
+void operator delete[](void *p, size_t) noexcept { HeapFree(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { HeapFree(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  HeapFree(p);
+}
+
+static void *CountedImGuiAlloc(size_t size, void *) {
+  return HeapAlloc(size, kHeapImGui);
+}
+
+static void CountedImGuiFree(void *p, void *) { HeapFree(p); }
+
+// Names the calling thread's slot (a string literal) and the tag its
+// allocations get outside any HeapScope
+static void HeapThread(const char *name, HeapTag tag) {
+  t_heap_tag = tag;
+  std::lock_guard<std::mutex> lock(g_heap_thread_mutex);
+  for (size_t i = 1; i < kHeapThreadSlots; i++) {
+    const char *slot = g_heap_thread_names[i].load();
+    if (slot == nullptr)
+      g_heap_thread_names[i] = slot = name;
+    if (strcmp(slot, name) == 0) {
+      t_heap_slot = (uint16_t)i;
+      return;
+    }
+  }
+}
+
+// Tags the calling thread's allocations for the enclosing scope
+class HeapScope {
+public:
+  explicit HeapScope(HeapTag tag) : saved_(t_heap_tag) { t_heap_tag = tag; }
+  ~HeapScope() { t_heap_tag = saved_; }
+  HeapScope(const HeapScope &) = delete;
+  HeapScope &operator=(const HeapScope &) = delete;
+
+private:
+  uint16_t saved_;
+};
+
+// Live instances of the types a leak would show up as, for the snapshot
+// diff: a LiveObject<kind> member counts its owner
+enum LiveObjectKind { kLiveTaskInstance, kLivePhaseLog, kLiveObjectKinds };
+static const char *const kLiveObjectNames[kLiveObjectKinds] = {
+    "TaskInstance", "PhaseLog"};
+static std::atomic<int64_t> g_live_objects[kLiveObjectKinds];
+
+template <LiveObjectKind kKind> struct LiveObject {
+  LiveObject() { g_live_objects[kKind]++; }
+  LiveObject(const LiveObject &) { g_live_objects[kKind]++; }
+  LiveObject &operator=(const LiveObject &) = default;
+  ~LiveObject() { g_live_objects[kKind]--; }
+};
+
+// Live bytes and blocks per tag and thread slot and live objects at one
+// moment; the Heap window shows the growth since one was taken
+struct HeapSnapshot {
+  bool taken = false;
+  std::chrono::steady_clock::time_point when;
+  int64_t tag_live[kHeapTagCount] = {};
+  int64_t tag_blocks[kHeapTagCount] = {};
+  int64_t thread_live[kHeapThreadSlots] = {};
+  int64_t thread_blocks[kHeapThreadSlots] = {};
+  int64_t objects[kLiveObjectKinds] = {};
+
+  void Take() {
+    taken = true;
+    when = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kHeapTagCount; i++) {
+      tag_live[i] = g_heap_tags[i].live.load();
+      tag_blocks[i] = g_heap_tags[i].blocks.load();
+    }
+    for (size_t i = 0; i < kHeapThreadSlots; i++) {
+      thread_live[i] = g_heap_threads[i].live.load();
+      thread_blocks[i] = g_heap_threads[i].blocks.load();
+    }
+    for (size_t i = 0; i < kLiveObjectKinds; i++)
+      objects[i] = g_live_objects[i].load();
+  }
+};
+
+static HeapSnapshot g_heap_snapshot;
+
 ////////////////////////////////////////////////////////////
 //                                                       //
 //              DATA STRUCTURES & CLASSES                //
@@ -145,9 +427,27 @@ struct Animation {
   }
 };
 
-// Animation manager
+// Animations are addressed by a 32-bit hash of their name. AnimationKey is
+// constexpr, so literal names hash at compile time; seed appends to an
+// existing key, i.e. AnimationKey("_hover", AnimationKey(id)) is the key of
+// id + "_hover" without building that string.
+typedef uint32_t AnimationId;
+
+constexpr AnimationId AnimationKey(const char *name,
+                                   AnimationId seed = 2166136261u) {
+  AnimationId h = seed; // FNV-1a
+  for (; *name; name++)
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  return h;
+}
+
+// Animation manager: a flat open-addressing table (linear probing) from key
+// to a slot in a pool of tracks. Only live tracks are visited by Update();
+// a track that finished, was stopped, or loops but was not asked about for
+// a frame (its widget is no longer drawn) goes back to the free list, so
+// nothing keeps the loop awake once it is off screen. Track references stay
+// valid until the next Update().
 struct AnimationManager {
-  std::map<std::string, Animation> animations;
   float delta_time = 0.0f;
   std::chrono::high_resolution_clock::time_point last_frame_time;
 
@@ -158,33 +458,188 @@ struct AnimationManager {
     }
     last_frame_time = now;
 
-    for (auto &[name, anim] : animations) {
-      anim.Update(delta_time);
+    for (size_t i = 0; i < live_.size();) {
+      Track &t = tracks_[live_[i]];
+      t.anim.Update(delta_time);
+      bool stale = t.anim.loop && frame_ - t.used_frame > 1;
+      if (!t.anim.is_playing || stale) {
+        Unlink(t.key);
+        free_.push_back(live_[i]);
+        live_[i] = live_.back();
+        live_.pop_back();
+        continue;
+      }
+      i++;
     }
+    frame_++;
   }
 
-  Animation &GetAnimation(const std::string &name) { return animations[name]; }
+  Animation &GetAnimation(AnimationId key) { return Find(key, true)->anim; }
 
-  void StartAnimation(const std::string &name, float duration = 1.0f,
+  void StartAnimation(AnimationId key, float duration = 1.0f,
                       bool loop = false) {
-    animations[name].Start(duration, loop);
+    Find(key, true)->anim.Start(duration, loop);
+  }
+
+  void StopAnimation(AnimationId key) {
+    if (Track *t = Find(key, false))
+      t->anim.Stop();
+  }
+
+  bool IsAnimationPlaying(AnimationId key) {
+    Track *t = Find(key, false);
+    return t && t->anim.is_playing;
   }
 
-  void StopAnimation(const std::string &name) {
-    if (animations.find(name) != animations.end()) {
-      animations[name].Stop();
+  // Whether any animation still needs frames
+  bool AnyPlaying() const { return !live_.empty(); }
+
+private:
+  struct Track {
+    AnimationId key = 0;
+    uint64_t used_frame = 0;
+    Animation anim;
+  };
+  static const uint32_t kEmpty = 0;
+
+  static uint32_t Slot(AnimationId key, size_t mask) {
+    return (key * 2654435761u) & (uint32_t)mask;
+  }
+
+  // Track for key, marked as used this frame; created when missing if create
+  // is set. Key 0 marks empty table slots, so it is folded into 1.
+  Track *Find(AnimationId key, bool create) {
+    if (key == kEmpty)
+      key = 1;
+    if (!table_.empty()) {
+      size_t mask = table_.size() - 1;
+      for (uint32_t s = Slot(key, mask);; s = (s + 1) & mask) {
+        if (table_[s].key == kEmpty)
+          break;
+        if (table_[s].key == key) {
+          Track &t = tracks_[table_[s].track];
+          t.used_frame = frame_;
+          return &t;
+        }
+      }
     }
+    if (!create)
+      return nullptr;
+    if ((live_.size() + 1) * 2 > table_.size())
+      Grow();
+    uint32_t index;
+    if (!free_.empty()) {
+      index = free_.back();
+      free_.pop_back();
+    } else {
+      index = (uint32_t)tracks_.size();
+      tracks_.emplace_back();
+    }
+    Track &t = tracks_[index];
+    t.key = key;
+    t.used_frame = frame_;
+    t.anim = Animation();
+    live_.push_back(index);
+    Insert(key, index);
+    return &t;
+  }
+
+  void Insert(AnimationId key, uint32_t track) {
+    size_t mask = table_.size() - 1;
+    uint32_t s = Slot(key, mask);
+    while (table_[s].key != kEmpty)
+      s = (s + 1) & mask;
+    table_[s] = {key, track};
+  }
+
+  // Remove key, shifting later entries of its probe run back so lookups
+  // never need tombstones
+  void Unlink(AnimationId key) {
+    size_t mask = table_.size() - 1;
+    uint32_t s = Slot(key, mask);
+    while (table_[s].key != key)
+      s = (s + 1) & mask;
+    for (uint32_t next = (s + 1) & mask; table_[next].key != kEmpty;
+         next = (next + 1) & mask) {
+      uint32_t home = Slot(table_[next].key, mask);
+      // Move next into the hole unless its home lies in (s, next]
+      if (((next - home) & mask) >= ((next - s) & mask)) {
+        table_[s] = table_[next];
+        s = next;
+      }
+    }
+    table_[s].key = kEmpty;
   }
 
-  bool IsAnimationPlaying(const std::string &name) const {
-    auto it = animations.find(name);
-    return it != animations.end() && it->second.is_playing;
+  void Grow() {
+    std::vector<Entry> old;
+    old.swap(table_);
+    table_.assign(std::max<size_t>(64, old.size() * 2), Entry());
+    for (const Entry &e : old)
+      if (e.key != kEmpty)
+        Insert(e.key, e.track);
   }
+
+  struct Entry {
+    AnimationId key = kEmpty;
+    uint32_t track = 0;
+  };
+  std::vector<Entry> table_;   // power-of-two size, at most half full
+  std::deque<Track> tracks_;   // pool; a deque keeps references stable
+  std::vector<uint32_t> live_; // indices into tracks_
+  std::vector<uint32_t> free_;
+  uint64_t frame_ = 0;
 };
 
 // Global animation manager
 AnimationManager g_animation_manager;
 
+// Fixed animations, keyed at compile time
+static const AnimationId kWindowFadeAnim = AnimationKey("window_fade");
+static const AnimationId kAdvancedOptionsAnim =
+    AnimationKey("advanced_options");
+
+// Custom SDL event that wakes the main loop out of its idle wait (see
+// FrameWaitMs). Registered once at startup, before any thread can post it.
+static Uint32 g_wake_event = (Uint32)-1;
+static std::atomic<bool> g_wake_pending{false};
+
+// Callable from any thread; wakeups coalesce until the loop has seen one
+static void WakeMainLoop() {
+  if (g_wake_event == (Uint32)-1 || g_wake_pending.exchange(true))
+    return;
+  SDL_Event ev{};
+  ev.type = g_wake_event;
+  SDL_PushEvent(&ev);
+}
+
+// Shared pool for the GUI's one-off background work: Docker refreshes and
+// probes, batch scans, log search, bundle exports and prompt diffs. Jobs
+// hand results that touch UI state to g_jobs.Post, which runs them at the
+// top of the next frame. Long-lived watchers (log tailing, Docker events,
+// change notifications) keep their own threads.
+static JobSystem g_jobs;
+
+// Coroutines that would each hold a thread for as long as they wait: the
+// attached phases streaming their output through the Docker API. Blocking
+// steps in them go to g_jobs through Offload.
+static AsyncReactor g_async;
+
+// Bumped for every output line queued for the render thread (task and phase
+// logs). Producers call WakeMainLoop once per batch of lines rather than per
+// line, and the main loop drains the log rings only when this moved.
+static std::atomic<uint64_t> g_log_seq{0};
+
+// Producer side: wake the main loop if lines were queued since the last
+// call; posted is the caller's own record of what it already announced
+static void WakeForNewLogs(uint64_t &posted) {
+  uint64_t seq = g_log_seq.load(std::memory_order_relaxed);
+  if (seq == posted)
+    return;
+  posted = seq;
+  WakeMainLoop();
+}
+
 // Helper function to draw a spinning icon
 static void DrawSpinningIcon(const char *icon_text, float radius_scale = 1.0f) {
   ImVec2 pos = ImGui::GetCursorScreenPos();
@@ -285,7 +740,6 @@ static bool Splitter(const char *label, float *size1, float *size2,
 #define NOMINMAX 1
 #endif
 #include <shellapi.h>
-#include <tlhelp32.h> // For process tree enumeration
 #include <windows.h>
 
 #define popen _popen
@@ -299,8 +753,6 @@ static bool Splitter(const char *label, float *size1, float *size2,
 #include <stdlib.h>
 #endif
 
-// Forward declaration
-static std::vector<std::string> RunShellLines(const std::string &sh);
 // Forward declare AppState for dev logging helper
 struct AppState;
 
@@ -338,1117 +790,1664 @@ struct TitleBarState {
 // Forward declaration for the renderer implemented later in the file
 static bool RenderCustomTitleBarSimple(SDL_Window *window, TitleBarState &tb);
 
-// Helper function to parse shell command with proper quote handling
-static std::vector<std::string> ParseShellCommand(const std::string &command) {
-  std::vector<std::string> tokens;
-  std::string current_token;
-  bool in_single_quote = false;
-  bool in_double_quote = false;
-  bool escaped = false;
-
-  for (size_t i = 0; i < command.length(); ++i) {
-    char c = command[i];
-
-    if (escaped) {
-      current_token += c;
-      escaped = false;
-    } else if (c == '\\') {
-      escaped = true;
-    } else if (c == '\'' && !in_double_quote) {
-      in_single_quote = !in_single_quote;
-    } else if (c == '"' && !in_single_quote) {
-      in_double_quote = !in_double_quote;
-    } else if (c == ' ' && !in_single_quote && !in_double_quote) {
-      if (!current_token.empty()) {
-        tokens.push_back(current_token);
-        current_token.clear();
-      }
-    } else {
-      current_token += c;
-    }
-  }
-
-  if (!current_token.empty()) {
-    tokens.push_back(current_token);
-  }
+// Counters behind the metrics endpoint (see RenderAppMetrics): bumped
+// lock-free from the reactor, the Docker client and the render loop; the
+// per-mode and per-phase totals are folded in when a finished run is
+// recorded.
+struct AppMetrics {
+  std::atomic<uint64_t> lines{0};
+  std::atomic<uint64_t> lines_skipped{0}; // kept from the log windows
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> image_cache_hits{0};
+  std::atomic<uint64_t> image_cache_misses{0};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> frame_us{0};
+
+  struct Total {
+    double seconds = 0.0;
+    uint64_t count = 0;
+  };
+  std::mutex mutex; // guards the maps
+  std::map<std::string, Total> run_seconds;   // by task type
+  std::map<std::string, Total> phase_seconds; // by timed phase
+  std::map<std::string, uint64_t> results;    // pass / fail / stopped
+  // Gemini CLI runs of finished runs' prompt phases, by phase (see
+  // RecordGeminiCalls)
+  struct GeminiTotal {
+    uint64_t calls = 0;
+    double seconds = 0.0;
+    GeminiCallStats stats;
+  };
+  std::map<std::string, GeminiTotal> gemini;
+};
 
-  return tokens;
+static AppMetrics g_metrics;
+static MetricsServer g_metrics_server;
+// Live dashboard for watching runs from other machines (settings port)
+static DashboardServer g_dashboard;
+static SubmissionServer g_submissions;
+static RunJournal g_run_journal;
+// Suffixes of image tags, container names and log directories
+static NameService g_names;
+
+// base_name with a tag no other image has: one issued by g_names in place
+// of a missing or :latest tag. Any other tag carries a run suffix from
+// g_names already, so Docker never has to be asked.
+static std::string GenerateUniqueImageName(const std::string &base_name) {
+  size_t slash = base_name.rfind('/');
+  size_t colon = base_name.rfind(':');
+  if (colon == std::string::npos ||
+      (slash != std::string::npos && colon < slash))
+    return base_name + ":" + g_names.Next();
+  if (base_name.compare(colon + 1, std::string::npos, "latest") == 0)
+    return base_name.substr(0, colon + 1) + g_names.Next();
+  return base_name;
 }
 
-// Helper function to check if a Docker image exists
-static bool DockerImageExists(const std::string &image_name) {
-  std::string cmd =
-      "docker images --format '{{.Repository}}:{{.Tag}}' | grep -x \"" +
-      image_name + "\"";
-  auto result = RunShellLines(cmd);
-  return !result.empty();
+// Full path of the current executable, empty if it cannot be found
+static std::string GetExecutablePath() {
+#ifdef _WIN32
+  char path[MAX_PATH];
+  DWORD len = GetModuleFileNameA(NULL, path, MAX_PATH);
+  if (len == 0 || len == MAX_PATH)
+    return std::string();
+  return std::string(path, len);
+#elif defined(__APPLE__)
+  char path[1024];
+  uint32_t size = sizeof(path);
+  if (_NSGetExecutablePath(path, &size) == 0)
+    return std::string(path);
+  return std::string();
+#else
+  char buf[4096];
+  ssize_t n = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+  if (n > 0)
+    return std::string(buf, n);
+  return std::string();
+#endif
 }
 
-// Helper function to generate a unique image name by adding a timestamp suffix
-static std::string GenerateUniqueImageName(const std::string &base_name) {
-  std::string unique_name = base_name;
+// Return directory of the current executable
+static std::string GetExecutableDir() {
+  std::string p = GetExecutablePath();
+  size_t pos = p.find_last_of("\\/");
+  return (pos != std::string::npos) ? p.substr(0, pos) : std::string(".");
+}
 
-  // If image doesn't exist, return as-is
-  if (!DockerImageExists(unique_name)) {
-    return unique_name;
+// Convert a possibly relative path to an absolute path
+static std::string ToAbsolutePath(const std::string &path) {
+#ifdef _WIN32
+  char full[_MAX_PATH];
+  if (_fullpath(full, path.c_str(), _MAX_PATH))
+    return std::string(full);
+  return path;
+#else
+  // Use realpath for absolute path resolution
+  char *resolved = realpath(path.c_str(), nullptr);
+  if (resolved) {
+    std::string result(resolved);
+    free(resolved);
+    return result;
   }
+  // If realpath fails (e.g., path doesn't exist yet), return as-is
+  return path;
+#endif
+}
 
-  // Generate high-precision timestamp suffix with microseconds for better
-  // uniqueness
-  auto now = std::chrono::high_resolution_clock::now();
-  auto system_now = std::chrono::system_clock::now();
-  auto time_t = std::chrono::system_clock::to_time_t(system_now);
-  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
-                now.time_since_epoch()) %
-            1000000;
-
-  std::stringstream ss;
-  ss << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S");
-  ss << "_" << std::setfill('0') << std::setw(6) << us.count();
-
-  std::string timestamp = ss.str();
+// Compute the default logs directory as an absolute path to project
+// autobuild/logs
+static std::string ResolveDefaultLogsPath() {
+  std::string exe_dir = GetExecutableDir();
 
-  // Try different suffixes until we find a unique name
-  for (int attempt = 1; attempt <= 100; ++attempt) {
-    if (attempt == 1) {
-      unique_name = base_name + ":" + timestamp;
-    } else {
-      unique_name = base_name + ":" + timestamp + "_" + std::to_string(attempt);
+#ifdef _WIN32
+  // Check if we're running from a Program Files installation (MSI)
+  if (exe_dir.find("Program Files") != std::string::npos) {
+    // For MSI installations, use %APPDATA%\Autobuild\logs
+    const char *appdata = getenv("APPDATA");
+    if (appdata != nullptr) {
+      std::string logs_path = std::string(appdata) + "\\Autobuild\\logs";
+      return ToAbsolutePath(logs_path);
     }
-
-    if (!DockerImageExists(unique_name)) {
-      return unique_name;
+    // Fallback to Documents if APPDATA fails
+    const char *documents = getenv("USERPROFILE");
+    if (documents != nullptr) {
+      std::string logs_path =
+          std::string(documents) + "\\Documents\\Autobuild\\logs";
+      return ToAbsolutePath(logs_path);
     }
   }
-
-  // Fallback: use random number if timestamp approach fails
-  srand(static_cast<unsigned int>(time(nullptr)));
-  unique_name =
-      base_name + ":" + timestamp + "_" + std::to_string(rand() % 10000);
-
-  return unique_name;
-}
-
-#ifdef _WIN32
-// Utility: UTF-16 conversion (Windows only)
-static std::wstring Widen(const std::string &narrow) {
-  if (narrow.empty())
-    return std::wstring();
-  int len = MultiByteToWideChar(CP_UTF8, 0, narrow.c_str(), (int)narrow.size(),
-                                NULL, 0);
-  std::wstring wide(len, L'\0');
-  MultiByteToWideChar(CP_UTF8, 0, narrow.c_str(), (int)narrow.size(), &wide[0],
-                      len);
-  return wide;
-}
-
-// Utility: check file existence (Windows only)
-static bool FileExistsWin(const std::string &path) {
-  DWORD attrs = GetFileAttributesA(path.c_str());
-  return (attrs != INVALID_FILE_ATTRIBUTES) &&
-         !(attrs & FILE_ATTRIBUTE_DIRECTORY);
-}
-#endif
-
-// Utility: strip ANSI escape sequences from strings
-static std::string stripAnsiCodes(const std::string &str) {
-  std::string result;
-  result.reserve(str.size());
-
-  for (size_t i = 0; i < str.size(); ++i) {
-    if (str[i] == '\033' && i + 1 < str.size() && str[i + 1] == '[') {
-      // Found ANSI escape sequence, skip until terminator
-      size_t j = i + 2;
-      while (j < str.size()) {
-        char c = str[j];
-        // ANSI escape sequence terminators
-        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '@' ||
-            c == '`') {
-          i = j; // Skip the entire escape sequence including the terminator
-          break;
-        }
-        ++j;
-      }
-      if (j >= str.size()) {
-        break; // Incomplete escape sequence at end of string
-      }
-    } else {
-      result += str[i];
+#elif defined(__APPLE__)
+  // Check if we're running from an installed app bundle
+  if (exe_dir.find(".app/Contents/MacOS") != std::string::npos) {
+    // For installed app bundles, use ~/Library/Application
+    // Support/Autobuild/logs
+    const char *home = getenv("HOME");
+    if (home) {
+      std::string logs_path =
+          std::string(home) + "/Library/Application Support/Autobuild/logs";
+      return ToAbsolutePath(logs_path);
+    }
+    // Fallback to ~/.autobuild/logs
+    const char *home_fallback = getenv("HOME");
+    if (home_fallback) {
+      std::string logs_path = std::string(home_fallback) + "/.autobuild/logs";
+      return ToAbsolutePath(logs_path);
+    }
+  }
+#elif defined(__linux__)
+  // Check if we're running from a system installation
+  if (exe_dir.find("/usr/bin") != std::string::npos ||
+      exe_dir.find("/usr/local/bin") != std::string::npos ||
+      exe_dir.find("/opt") != std::string::npos) {
+    // For system installations, use ~/.local/share/autobuild/logs
+    const char *home = getenv("HOME");
+    if (home) {
+      std::string logs_path =
+          std::string(home) + "/.local/share/autobuild/logs";
+      return ToAbsolutePath(logs_path);
+    }
+    // Fallback to ~/.autobuild/logs
+    const char *home_fallback = getenv("HOME");
+    if (home_fallback) {
+      std::string logs_path = std::string(home_fallback) + "/.autobuild/logs";
+      return ToAbsolutePath(logs_path);
     }
   }
+#endif
 
-  return result;
+  // Development layout: native/build-gui/autobuild_gui.exe -> repo_root =
+  // exe_dir/../..
+  std::string candidate = exe_dir + "/../../autobuild/logs";
+  return ToAbsolutePath(candidate);
 }
 
-// Docker error handling utilities
-static bool IsImageInUse(const std::string &image_id) {
-  // Check if any containers (running or stopped) are using this image
-  std::string cmd =
-      "docker ps -a --filter \"ancestor=" + image_id + "\" --format '{{.ID}}'";
-  std::string output = JoinShellOutput(RunShellLines(cmd));
-  return !output.empty() && output.find("Error") == std::string::npos;
+enum class DropTarget {
+  None,
+  TaskDirectory,
+  OutputDirectory,
+  WorkingDirectory,
+  BuildDirectory,
+  NewLogPath,
+  BatchDirectory
+};
+
+#ifdef AUTOBUILD_HAVE_ZSTD
+// Archived logs use the zstd seekable format: independent frames of about
+// kArchiveFrameBytes, followed by a skippable frame holding the seek table
+// (compressed and decompressed size of every frame) and a footer. Any frame
+// can be decompressed on its own, and a plain `zstd -d` still restores the
+// original file because it ignores skippable frames.
+static const size_t kArchiveFrameBytes = 1024 * 1024;
+static const int kArchiveLevel = 9;
+static const uint32_t kZstdSkippableMagic = 0x184D2A5E;
+static const uint32_t kZstdSeekableMagic = 0x8F92EAB1;
+
+static uint32_t ReadLE32(const char *p) {
+  const unsigned char *b = (const unsigned char *)p;
+  return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) |
+         ((uint32_t)b[3] << 24);
 }
 
-static std::vector<std::string>
-GetContainersUsingImage(const std::string &image_id) {
-  std::vector<std::string> containers;
-  std::string cmd = "docker ps -a --filter \"ancestor=" + image_id +
-                    "\" --format '{{.ID}}|{{.Names}}|{{.Status}}'";
-  std::string output = JoinShellOutput(RunShellLines(cmd));
+static void AppendLE32(std::string &out, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    out += (char)((v >> (8 * i)) & 0xFF);
+}
 
-  if (output.empty() || output.find("Error") != std::string::npos) {
-    return containers;
-  }
+struct ZstdSeekFrame {
+  uint64_t c_offset, c_size; // within the archive
+  uint64_t d_offset, d_size; // within the original text
+};
 
-  std::istringstream stream(output);
-  std::string line;
-  while (std::getline(stream, line)) {
-    if (!line.empty()) {
-      containers.push_back(line);
-    }
-  }
-
-  return containers;
-}
-
-static bool SafeDeleteImage(const std::string &image_id,
-                            std::string &error_message) {
-  // First check if image is in use
-  if (IsImageInUse(image_id)) {
-    auto containers = GetContainersUsingImage(image_id);
-    error_message = "Cannot delete image " + image_id +
-                    " - it is being used by " +
-                    std::to_string(containers.size()) + " container(s).\n\n";
-    error_message += "Containers using this image:\n";
-    for (const auto &container : containers) {
-      // Parse the container data (ID|Names|Status)
-      std::istringstream ss(container);
-      std::string id, name, status;
-      std::getline(ss, id, '|');
-      std::getline(ss, name, '|');
-      std::getline(ss, status, '|');
-
-      if (!name.empty()) {
-        error_message += "  " + std::string(ICON_FA_CUBE) + " " + name + " (" +
-                         id.substr(0, 12) + ") - " + status + "\n";
-      } else {
-        error_message += "  " + std::string(ICON_FA_CUBE) + " " +
-                         id.substr(0, 12) + " - " + status + "\n";
-      }
-    }
-    error_message += "\nPlease stop and remove these containers first.";
+// Read the seek table at the end of a seekable archive of size bytes
+static bool ParseZstdSeekTable(const char *data, uint64_t size,
+                               std::vector<ZstdSeekFrame> &frames) {
+  frames.clear();
+  if (size < 17 || ReadLE32(data + size - 4) != kZstdSeekableMagic)
     return false;
-  }
-
-  // Try to delete the image
-  std::string cmd = "docker rmi \"" + image_id + "\" 2>&1";
-  std::string output = JoinShellOutput(RunShellLines(cmd));
+  uint64_t count = ReadLE32(data + size - 9);
+  uint64_t entry = (data[size - 5] & 0x80) ? 12 : 8; // with checksums
+  uint64_t table = count * entry + 9;
+  if (table + 8 > size)
+    return false;
+  const char *header = data + size - table - 8;
+  if (ReadLE32(header) != kZstdSkippableMagic || ReadLE32(header + 4) != table)
+    return false;
+  uint64_t c_offset = 0, d_offset = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    const char *e = header + 8 + i * entry;
+    ZstdSeekFrame f = {c_offset, ReadLE32(e), d_offset, ReadLE32(e + 4)};
+    frames.push_back(f);
+    c_offset += f.c_size;
+    d_offset += f.d_size;
+  }
+  return c_offset == size - table - 8;
+}
 
-  if (output.find("Error") != std::string::npos ||
-      output.find("conflict") != std::string::npos ||
-      output.find("unable to remove") != std::string::npos) {
-    error_message = "Failed to delete image " + image_id + ":\n" + output;
+// Compress a log into a seekable archive at dst. Frames end at a line break
+// where there is one, so lines rarely span frames. The archive is written to
+// a temporary file and renamed into place; returns false (removing any
+// partial output) on error or once cancel is set.
+static bool CompressLogSeekable(const std::string &src, const std::string &dst,
+                                const std::atomic<bool> &cancel) {
+  FILE *in = fopen(src.c_str(), "rb");
+  if (!in)
+    return false;
+  std::string tmp = dst + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (!out) {
+    fclose(in);
     return false;
   }
-
-  return true;
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  std::string pending, packed, table;
+  uint32_t frames = 0;
+  bool eof = false;
+  bool ok = cctx != nullptr;
+  while (ok) {
+    if (cancel) {
+      ok = false;
+      break;
+    }
+    while (!eof && pending.size() < kArchiveFrameBytes) {
+      size_t old = pending.size();
+      pending.resize(old + kArchiveFrameBytes);
+      size_t n = fread(&pending[old], 1, kArchiveFrameBytes, in);
+      pending.resize(old + n);
+      if (n == 0) {
+        eof = true;
+        ok = !ferror(in);
+      }
+    }
+    if (!ok || pending.empty())
+      break;
+    size_t cut = std::min(pending.size(), kArchiveFrameBytes);
+    if (cut < pending.size()) {
+      size_t nl = pending.rfind('\n', cut - 1);
+      if (nl != std::string::npos)
+        cut = nl + 1;
+    }
+    packed.resize(ZSTD_compressBound(cut));
+    size_t c = ZSTD_compressCCtx(cctx, &packed[0], packed.size(),
+                                 pending.data(), cut, kArchiveLevel);
+    if (ZSTD_isError(c) || fwrite(packed.data(), 1, c, out) != c) {
+      ok = false;
+      break;
+    }
+    AppendLE32(table, (uint32_t)c);
+    AppendLE32(table, (uint32_t)cut);
+    frames++;
+    pending.erase(0, cut);
+  }
+  ZSTD_freeCCtx(cctx);
+  fclose(in);
+
+  if (ok) {
+    AppendLE32(table, frames);
+    table += '\0'; // descriptor: no checksums
+    AppendLE32(table, kZstdSeekableMagic);
+    std::string header;
+    AppendLE32(header, kZstdSkippableMagic);
+    AppendLE32(header, (uint32_t)table.size());
+    ok = fwrite(header.data(), 1, header.size(), out) == header.size() &&
+         fwrite(table.data(), 1, table.size(), out) == table.size();
+  }
+  ok = fclose(out) == 0 && ok;
+  if (ok) {
+    remove(dst.c_str());
+    ok = rename(tmp.c_str(), dst.c_str()) == 0;
+  }
+  if (!ok)
+    remove(tmp.c_str());
+  return ok;
 }
+#endif
 
-// Find bash.exe: PATH, Git for Windows, MSYS2 typical locations
-// Cache the result to avoid repeated file system operations
-static std::string g_cached_bash_path;
-static bool g_bash_path_cached = false;
-
+// Read-only view of a finished log file for the built-in viewer. The whole
+// file is memory-mapped on open, so nothing is read up front; a worker thread
+// then builds the line-offset index in kIndexChunk steps and publishes each
+// step, so the first screen is readable while the rest is still being
+// scanned. The same worker runs searches (case-insensitive, over every line)
+// and publishes matching line numbers as it goes. Archived logs (".zst",
+// see CompressLogSeekable) work the same way on their decompressed text:
+// each step is one frame, and reading a line decompresses only the frame
+// holding it. Lines read back stay valid until the next ReadLine.
+class LogFileView {
+public:
+  static constexpr uint64_t kIndexChunk = 4 * 1024 * 1024;
+  static constexpr uint64_t kSearchBatch = 64 * 1024; // lines per publish
+
+  LogFileView() = default;
+  ~LogFileView() { Close(); }
+  LogFileView(const LogFileView &) = delete;
+  LogFileView &operator=(const LogFileView &) = delete;
+
+  bool Open(const std::string &path) {
+    Close();
+    path_ = path;
 #ifdef _WIN32
-// Windows version
-static std::string FindBash() {
-  // Return cached result if available
-  if (g_bash_path_cached) {
-    return g_cached_bash_path;
-  }
-
-  // Prefer Git for Windows / MSYS2 locations first
-  char *pf = getenv("ProgramFiles");
-  char *pf86 = getenv("ProgramFiles(x86)");
-  const char *candidates[] = {"%PF%/Git/bin/bash.exe",
-                              "%PF%/Git/usr/bin/bash.exe",
-                              "%PF86%/Git/bin/bash.exe",
-                              "%PF86%/Git/usr/bin/bash.exe",
-                              "C:/msys64/usr/bin/bash.exe",
-                              "C:/Program Files/Git/bin/bash.exe",
-                              "C:/Program Files/Git/usr/bin/bash.exe",
-                              "C:/Program Files (x86)/Git/bin/bash.exe",
-                              "C:/Program Files (x86)/Git/usr/bin/bash.exe"};
-  for (auto cand : candidates) {
-    std::string p(cand);
-    if (pf) {
-      size_t pos = p.find("%PF%");
-      if (pos != std::string::npos)
-        p.replace(pos, 4, pf);
+    file_handle_ = CreateFileA(path.c_str(), GENERIC_READ,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                   FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+    if (file_handle_ == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_handle_, &size))
+      return false;
+    size_ = (uint64_t)size.QuadPart;
+    if (size_ > 0) {
+      map_handle_ =
+          CreateFileMappingA(file_handle_, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (map_handle_ == NULL)
+        return false;
+      data_ =
+          (const char *)MapViewOfFile(map_handle_, FILE_MAP_READ, 0, 0, 0);
+      if (data_ == nullptr)
+        return false;
     }
-    if (pf86) {
-      size_t pos = p.find("%PF86%");
-      if (pos != std::string::npos)
-        p.replace(pos, 6, pf86);
+#else
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+      return false;
+    size_ = (uint64_t)st.st_size;
+    if (size_ > 0) {
+      void *view =
+          mmap(nullptr, (size_t)size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (view == MAP_FAILED)
+        return false;
+      data_ = (const char *)view;
+      madvise(view, (size_t)size_, MADV_SEQUENTIAL);
     }
-    for (char &c : p)
-      if (c == '\\')
-        c = '/';
-    if (FileExistsWin(p)) {
-      g_cached_bash_path = p;
-      g_bash_path_cached = true;
-      return p;
-    }
-  }
-  // As a fallback, try PATH but skip the WSL stub in System32
-  char buf[MAX_PATH] = {0};
-  if (SearchPathA(NULL, "bash.exe", NULL, MAX_PATH, buf, NULL)) {
-    std::string found(buf);
-    std::string lower = found;
-    for (char &c : lower)
-      c = (char)tolower(c);
-    if (lower.find("windows/system32/bash.exe") == std::string::npos &&
-        FileExistsWin(found)) {
-      g_cached_bash_path = found;
-      g_bash_path_cached = true;
-      return found;
-    }
-  }
-
-  // Cache empty result to avoid repeated searches
-  g_cached_bash_path = std::string();
-  g_bash_path_cached = true;
-  return std::string();
-}
+#endif
+    text_size_ = size_;
+    if (IsArchivePath(path)) {
+#ifdef AUTOBUILD_HAVE_ZSTD
+      if (!ParseZstdSeekTable(data_, size_, frames_))
+        return false;
+      text_size_ = frames_.empty()
+                       ? 0
+                       : frames_.back().d_offset + frames_.back().d_size;
 #else
-// macOS/Linux version
-static std::string FindBash() {
-  // Return cached result if available
-  if (g_bash_path_cached) {
-    return g_cached_bash_path;
+      return false; // built without zstd
+#endif
+    }
+    stop_ = false;
+    worker_ = std::thread([this]() {
+      HeapThread("Log file view", kHeapLogs);
+      Worker();
+    });
+    return true;
   }
 
-  // Common bash locations on macOS/Linux
-  const char *candidates[] = {"/bin/bash", "/usr/bin/bash",
-                              "/usr/local/bin/bash", "/opt/homebrew/bin/bash",
-                              "/usr/local/opt/bash/bin/bash"};
-
-  for (auto cand : candidates) {
-    if (access(cand, X_OK) == 0) {
-      g_cached_bash_path = std::string(cand);
-      g_bash_path_cached = true;
-      return g_cached_bash_path;
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
     }
+    cv_.notify_all();
+    if (worker_.joinable())
+      worker_.join();
+#ifdef _WIN32
+    if (data_ != nullptr)
+      UnmapViewOfFile(data_);
+    if (map_handle_ != NULL)
+      CloseHandle(map_handle_);
+    if (file_handle_ != INVALID_HANDLE_VALUE)
+      CloseHandle(file_handle_);
+    map_handle_ = NULL;
+    file_handle_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_ != nullptr)
+      munmap((void *)data_, (size_t)size_);
+    if (fd_ >= 0)
+      close(fd_);
+    fd_ = -1;
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    text_size_ = 0;
+#ifdef AUTOBUILD_HAVE_ZSTD
+    frames_.clear();
+#endif
+    read_cache_ = TextCache();
+    starts_.clear();
+    last_end_ = 0;
+    matches_.clear();
+    indexed_ = false;
+    searching_ = false;
   }
 
-  // Try which command as fallback
-  FILE *pipe = popen("which bash", "r");
-  if (pipe) {
-    char buffer[256];
-    if (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-      std::string path(buffer);
-      // Remove trailing newline
-      if (!path.empty() && path.back() == '\n') {
-        path.pop_back();
-      }
-      if (access(path.c_str(), X_OK) == 0) {
-        g_cached_bash_path = path;
-        g_bash_path_cached = true;
-        pclose(pipe);
-        return g_cached_bash_path;
-      }
-    }
-    pclose(pipe);
+  static bool IsArchivePath(const std::string &path) {
+    return path.size() > 4 && path.compare(path.size() - 4, 4, ".zst") == 0;
   }
 
-  // Cache empty result to avoid repeated searches
-  g_cached_bash_path = std::string();
-  g_bash_path_cached = true;
-  return std::string();
-}
-#endif
-
-// Run a command hidden (no console) and capture stdout/stderr into lines
-#ifdef _WIN32
-static bool RunHiddenCapture(const std::string &command,
-                             std::vector<std::string> &out_lines,
-                             DWORD &out_exit_code) {
-  out_lines.clear();
-  out_exit_code = 0;
-
-  SECURITY_ATTRIBUTES sa{};
-  sa.nLength = sizeof(sa);
-  sa.bInheritHandle = TRUE;
-  sa.lpSecurityDescriptor = NULL;
-  HANDLE hRead = NULL, hWrite = NULL;
-  if (!CreatePipe(&hRead, &hWrite, &sa, 0))
-    return false;
-  SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
-
-  STARTUPINFOW si{};
-  si.cb = sizeof(si);
-  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
-  si.wShowWindow = SW_HIDE;
-  si.hStdOutput = hWrite;
-  si.hStdError = hWrite;
+  const std::string &path() const { return path_; }
+  // Size of the text; for an archive, FileSize() is what it takes on disk
+  uint64_t Size() const { return text_size_; }
+  uint64_t FileSize() const { return size_; }
+  bool Archived() const { return IsArchivePath(path_); }
+  bool Indexed() const { return indexed_; }
 
-  PROCESS_INFORMATION pi{};
+  // Lines indexed so far; final once Indexed() is true
+  uint64_t LineCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return starts_.size();
+  }
 
-  std::wstring fullCmd = L"cmd.exe /C " + Widen(command);
-  BOOL ok = CreateProcessW(NULL, &fullCmd[0], NULL, NULL, TRUE,
-                           CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
-  if (!ok) {
-    CloseHandle(hRead);
-    CloseHandle(hWrite);
-    return false;
+  // Render thread: line n (0-based) without its line ending
+  bool ReadLine(uint64_t n, std::string_view &out) const {
+    uint64_t begin, end;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (n >= starts_.size())
+        return false;
+      begin = starts_[n];
+      end = n + 1 < starts_.size() ? starts_[n + 1] - 1 : last_end_;
+    }
+    const char *p = Text(begin, end, read_cache_);
+    if (p == nullptr)
+      return false;
+    size_t len = (size_t)(end - begin);
+    if (len > 0 && p[len - 1] == '\r')
+      len--;
+    out = std::string_view(p, len);
+    return true;
   }
-  CloseHandle(hWrite);
 
-  std::string buffer;
-  buffer.reserve(4096);
-  char chunk[512];
-  DWORD bytes = 0;
-  for (;;) {
-    BOOL r = ReadFile(hRead, chunk, sizeof(chunk), &bytes, NULL);
-    if (!r || bytes == 0)
-      break;
-    buffer.append(chunk, chunk + bytes);
-    size_t pos = 0;
-    size_t nl;
-    while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-      if (nl > pos)
-        out_lines.emplace_back(buffer.substr(pos, nl - pos));
-      size_t next = nl + 1;
-      if (next < buffer.size() &&
-          ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-           (buffer[nl] == '\n' && buffer[next] == '\r')))
-        next++;
-      pos = next;
-    }
-    if (pos > 0)
-      buffer.erase(0, pos);
-  }
-  if (!buffer.empty())
-    out_lines.emplace_back(buffer);
-
-  // Wait for process with timeout to prevent GUI freezing
-  DWORD wait_result =
-      WaitForSingleObject(pi.hProcess, 5000); // 5 second timeout
-  if (wait_result == WAIT_TIMEOUT) {
-    // Process is taking too long, terminate it
-    TerminateProcess(pi.hProcess, 1);
-    out_exit_code = 1;
-  } else {
-    GetExitCodeProcess(pi.hProcess, &out_exit_code);
+  // Start a search for a lowercase needle, replacing any earlier one. An
+  // empty needle just cancels.
+  void Search(const std::string &needle) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      needle_ = needle;
+      search_gen_++;
+      matches_.clear();
+      searching_ = !needle.empty();
+    }
+    cv_.notify_all();
   }
-  CloseHandle(pi.hThread);
-  CloseHandle(pi.hProcess);
-  CloseHandle(hRead);
-  return true;
-}
-#else
-// macOS/Linux version - proper implementation
-static bool RunHiddenCapture(const std::string &command,
-                             std::vector<std::string> &out_lines,
-                             int &out_exit_code) {
-  out_lines.clear();
-  out_exit_code = 0;
-
-  // Create pipes for stdout/stderr
-  int pipe_stdout[2], pipe_stderr[2];
-  if (pipe(pipe_stdout) == -1 || pipe(pipe_stderr) == -1) {
-    return false;
+
+  bool Searching() const { return searching_; }
+
+  uint64_t MatchCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return matches_.size();
   }
 
-  // Fork the process
-  pid_t pid = fork();
-  if (pid == -1) {
-    close(pipe_stdout[0]);
-    close(pipe_stdout[1]);
-    close(pipe_stderr[0]);
-    close(pipe_stderr[1]);
-    return false;
+  // Line number of the i-th match
+  bool MatchLine(uint64_t i, uint64_t &line) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (i >= matches_.size())
+      return false;
+    line = matches_[i];
+    return true;
   }
 
-  if (pid == 0) {
-    // Child process
-    close(pipe_stdout[0]); // Close read end
-    close(pipe_stderr[0]); // Close read end
+private:
+  // Decoded text one thread is reading: the last frame it decompressed, and
+  // a copy of a range that spans frames
+  struct TextCache {
+    size_t frame = SIZE_MAX;
+    std::string data;
+    std::string joined;
+  };
+
+  // Text bytes [begin, end), valid until cache is used again; null if an
+  // archive frame cannot be decompressed
+  const char *Text(uint64_t begin, uint64_t end, TextCache &cache) const {
+#ifdef AUTOBUILD_HAVE_ZSTD
+    if (!frames_.empty()) {
+      size_t i = FrameAt(begin);
+      const ZstdSeekFrame *f = &frames_[i];
+      if (end <= f->d_offset + f->d_size) {
+        if (!LoadFrame(i, cache))
+          return nullptr;
+        return cache.data.data() + (begin - f->d_offset);
+      }
+      cache.joined.clear();
+      for (; i < frames_.size() && frames_[i].d_offset < end; i++) {
+        f = &frames_[i];
+        if (!LoadFrame(i, cache))
+          return nullptr;
+        uint64_t from = std::max(begin, f->d_offset) - f->d_offset;
+        uint64_t to = std::min(end, f->d_offset + f->d_size) - f->d_offset;
+        cache.joined.append(cache.data, (size_t)from, (size_t)(to - from));
+      }
+      return cache.joined.data();
+    }
+#endif
+    (void)end;
+    (void)cache;
+    return data_ + begin;
+  }
 
-    // Redirect stdout and stderr to pipes
-    dup2(pipe_stdout[1], STDOUT_FILENO);
-    dup2(pipe_stderr[1], STDERR_FILENO);
-    close(pipe_stdout[1]);
-    close(pipe_stderr[1]);
+  // End of the indexing step that starts at pos
+  uint64_t StepEnd(uint64_t pos) const {
+#ifdef AUTOBUILD_HAVE_ZSTD
+    if (!frames_.empty()) {
+      const ZstdSeekFrame &f = frames_[FrameAt(pos)];
+      return f.d_offset + f.d_size;
+    }
+#endif
+    return std::min(text_size_, pos + kIndexChunk);
+  }
 
-    // Execute the command using shell
-    execl("/bin/sh", "sh", "-c", command.c_str(), (char *)nullptr);
-    exit(1); // If execl fails
-  } else {
-    // Parent process
-    close(pipe_stdout[1]); // Close write end
-    close(pipe_stderr[1]); // Close write end
+#ifdef AUTOBUILD_HAVE_ZSTD
+  // Frame holding text offset pos
+  size_t FrameAt(uint64_t pos) const {
+    size_t lo = 0, hi = frames_.size();
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (frames_[mid].d_offset <= pos)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    return lo;
+  }
 
-    std::string buffer;
-    buffer.reserve(4096);
-    char chunk[512];
-    int bytes = 0;
-    int status;
+  bool LoadFrame(size_t i, TextCache &cache) const {
+    if (cache.frame == i)
+      return true;
+    const ZstdSeekFrame &f = frames_[i];
+    cache.frame = SIZE_MAX;
+    cache.data.resize((size_t)f.d_size);
+    size_t n = ZSTD_decompress(&cache.data[0], cache.data.size(),
+                               data_ + f.c_offset, (size_t)f.c_size);
+    if (ZSTD_isError(n) || n != f.d_size)
+      return false;
+    cache.frame = i;
+    return true;
+  }
+#endif
 
-    // Read from both stdout and stderr
-    while (true) {
-      // Check if process is still running
-      int wait_result = waitpid(pid, &status, WNOHANG);
-      if (wait_result == pid) {
-        // Process exited
-        break;
+  void Worker() {
+    // Index the file one step at a time. A line is published once its end
+    // has been scanned; the line still open at the end of a step carries
+    // over into the next one.
+    TextCache cache;
+    std::vector<uint64_t> starts;
+    uint64_t line_start = 0;
+    uint64_t line_end = 0;
+    uint64_t pos = 0;
+    while (pos < text_size_) {
+      uint64_t end = StepEnd(pos);
+      starts.clear();
+      const char *base = Text(pos, end, cache);
+      if (base == nullptr)
+        break; // damaged archive: keep the lines indexed so far
+      const char *p = base;
+      const char *stop = base + (end - pos);
+      while (p < stop) {
+        const char *nl = (const char *)memchr(p, '\n', (size_t)(stop - p));
+        if (nl == nullptr)
+          break;
+        starts.push_back(line_start);
+        line_end = pos + (uint64_t)(nl - base);
+        line_start = line_end + 1;
+        p = nl + 1;
       }
-
-      // Read from stdout
-      bytes = read(pipe_stdout[0], chunk, sizeof(chunk));
-      if (bytes > 0) {
-        buffer.append(chunk, bytes);
+      // A last line without a newline ends at the end of the file
+      if (end == text_size_ && line_start < text_size_) {
+        starts.push_back(line_start);
+        line_end = text_size_;
       }
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_)
+        return;
+      starts_.insert(starts_.end(), starts.begin(), starts.end());
+      last_end_ = line_end;
+      pos = end;
+    }
+    indexed_ = true;
 
-      // Read from stderr
-      bytes = read(pipe_stderr[0], chunk, sizeof(chunk));
-      if (bytes > 0) {
-        buffer.append(chunk, bytes);
+    // Searches: starts_ is complete now and only this thread writes it, so
+    // it is read without the lock. Each batch of lines is lowercased in one
+    // go and searched as a block; a hit is mapped back to its line and the
+    // scan resumes at the next line.
+    std::string lower;
+    while (true) {
+      std::string needle;
+      uint64_t gen;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock,
+                 [this]() { return stop_ || search_gen_ != done_gen_; });
+        if (stop_)
+          return;
+        needle = needle_;
+        gen = search_gen_;
+        done_gen_ = gen;
       }
-
-      // Process complete lines
-      size_t pos = 0;
-      size_t nl;
-      while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-        if (nl > pos) {
-          out_lines.emplace_back(buffer.substr(pos, nl - pos));
+      if (needle.empty())
+        continue;
+      std::boyer_moore_horspool_searcher<std::string::const_iterator>
+          searcher(needle.begin(), needle.end());
+      uint64_t count = starts_.size();
+      std::vector<uint64_t> found;
+      for (uint64_t first = 0; first < count; first += kSearchBatch) {
+        uint64_t last = std::min(count, first + kSearchBatch);
+        uint64_t begin = starts_[first];
+        uint64_t end = last < count ? starts_[last] : last_end_;
+        const char *text = Text(begin, end, cache);
+        if (text == nullptr)
+          break;
+        lower.resize((size_t)(end - begin));
+        FoldAsciiLower(text, &lower[0], lower.size());
+        auto it = lower.cbegin();
+        while (true) {
+          it = std::search(it, lower.cend(), searcher);
+          if (it == lower.cend())
+            break;
+          uint64_t off = begin + (uint64_t)(it - lower.cbegin());
+          uint64_t line = (uint64_t)(std::upper_bound(starts_.begin() + first,
+                                                      starts_.begin() + last,
+                                                      off) -
+                                     starts_.begin()) -
+                          1;
+          found.push_back(line);
+          if (line + 1 >= last)
+            break;
+          it = lower.cbegin() + (starts_[line + 1] - begin);
         }
-        size_t next = nl + 1;
-        if (next < buffer.size() &&
-            ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-             (buffer[nl] == '\n' && buffer[next] == '\r')))
-          next++;
-        pos = next;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_ || search_gen_ != gen)
+          break;
+        matches_.insert(matches_.end(), found.begin(), found.end());
+        found.clear();
       }
-      if (pos > 0)
-        buffer.erase(0, pos);
-
-      // Small delay to prevent busy waiting
-      usleep(10000); // 10ms
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (search_gen_ == gen)
+        searching_ = false;
     }
+  }
 
-    // Read remaining output
-    while (true) {
-      bytes = read(pipe_stdout[0], chunk, sizeof(chunk));
-      if (bytes <= 0)
-        break;
-      buffer.append(chunk, bytes);
-    }
+  std::string path_;
+#ifdef _WIN32
+  HANDLE file_handle_ = INVALID_HANDLE_VALUE;
+  HANDLE map_handle_ = NULL;
+#else
+  int fd_ = -1;
+#endif
+  const char *data_ = nullptr;
+  uint64_t size_ = 0;
+  uint64_t text_size_ = 0;
+#ifdef AUTOBUILD_HAVE_ZSTD
+  std::vector<ZstdSeekFrame> frames_; // archives only
+#endif
+  mutable TextCache read_cache_; // render thread
+  std::thread worker_;
+
+  // Guarded by mutex_
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::vector<uint64_t> starts_; // byte offset of each indexed line
+  uint64_t last_end_ = 0;        // end of the last indexed line
+  std::string needle_;
+  uint64_t search_gen_ = 0;
+  uint64_t done_gen_ = 0;
+  std::vector<uint64_t> matches_;
+  std::atomic<bool> indexed_{false};
+  std::atomic<bool> searching_{false};
+};
 
-    while (true) {
-      bytes = read(pipe_stderr[0], chunk, sizeof(chunk));
-      if (bytes <= 0)
-        break;
-      buffer.append(chunk, bytes);
+// Classifier used for newly started tasks. Each task keeps the classifier
+// it started with, so swapping rules never races with its output. It also
+// flags the lines the failure detectors want, in the same pass.
+static std::mutex g_log_classifier_mutex;
+static std::shared_ptr<const LogClassifier> g_log_classifier =
+    std::make_shared<const LogClassifier>(DefaultLogSeverityRules(),
+                                          FailureScanner().Triggers());
+
+static void SetLogSeverityRules(const std::vector<LogSeverityRule> &rules) {
+  auto classifier = std::make_shared<const LogClassifier>(
+      rules, FailureScanner().Triggers());
+  std::lock_guard<std::mutex> lock(g_log_classifier_mutex);
+  g_log_classifier = classifier;
+}
+
+static std::shared_ptr<const LogClassifier> CurrentLogClassifier() {
+  std::lock_guard<std::mutex> lock(g_log_classifier_mutex);
+  return g_log_classifier;
+}
+
+// Lines kept in a task's scrollback. What all tasks keep together is
+// bounded by the log memory budget (see EnforceLogBudget).
+static const size_t kTaskLogMaxLines = 100000;
+// Lines kept in the legacy single-command log and in the dev log
+static const size_t kLegacyLogMaxLines = 1000;
+static const size_t kDevLogMaxLines = 200;
+
+// Runs kept by a GlyphRunCache before those not drawn in the last frame are
+// dropped; a few screens of rows
+static const size_t kGlyphRunCacheMax = 2048;
+
+// Laid-out text of recently drawn rows, for the log and diff views. A row's
+// glyph quads are placed once, the way ImFont::RenderText places them, and
+// replayed straight into the draw list as vertices on later frames, so
+// neither UTF-8 decoding, glyph lookup nor word wrapping runs per frame.
+// Runs are keyed by an id the caller guarantees names the same text (a log
+// sequence number, a diff line); Reset whenever that stops being true. A
+// change of font, font size or wrap width drops every run.
+class GlyphRunCache {
+public:
+  // Draw text with its top-left corner at pos, wrapped at wrap_width (0: not
+  // wrapped), each glyph in color_at(byte offset of the glyph in text);
+  // offsets only increase along a run. Returns the size of the laid-out
+  // text, as ImGui::CalcTextSize measures it.
+  template <typename ColorAt>
+  ImVec2 Draw(ImDrawList *draw, uint64_t id, std::string_view text,
+              ImVec2 pos, float wrap_width, ColorAt color_at) {
+    const Run &run = Get(id, text, wrap_width);
+    int count = (int)run.glyphs.size();
+    if (count == 0)
+      return run.size;
+    ImVec2 origin(IM_TRUNC(pos.x), IM_TRUNC(pos.y));
+    ImVec2 clip_min = draw->GetClipRectMin();
+    ImVec2 clip_max = draw->GetClipRectMax();
+    // Written through local pointers like ImFont::RenderText does; going
+    // through PrimRectUV per glyph costs as much as the layout saved
+    draw->PrimReserve(count * 6, count * 4);
+    ImDrawVert *vtx = draw->_VtxWritePtr;
+    ImDrawIdx *idx = draw->_IdxWritePtr;
+    unsigned int base = draw->_VtxCurrentIdx;
+    for (const Glyph &g : run.glyphs) {
+      float x0 = origin.x + g.p0.x, y0 = origin.y + g.p0.y;
+      float x1 = origin.x + g.p1.x, y1 = origin.y + g.p1.y;
+      if (x1 < clip_min.x || x0 > clip_max.x || y1 < clip_min.y ||
+          y0 > clip_max.y)
+        continue;
+      ImU32 color = color_at(g.offset);
+      if (g.colored)
+        color |= ~IM_COL32_A_MASK;
+      vtx[0] = {ImVec2(x0, y0), g.uv0, color};
+      vtx[1] = {ImVec2(x1, y0), ImVec2(g.uv1.x, g.uv0.y), color};
+      vtx[2] = {ImVec2(x1, y1), g.uv1, color};
+      vtx[3] = {ImVec2(x0, y1), ImVec2(g.uv0.x, g.uv1.y), color};
+      idx[0] = (ImDrawIdx)base;
+      idx[1] = (ImDrawIdx)(base + 1);
+      idx[2] = (ImDrawIdx)(base + 2);
+      idx[3] = (ImDrawIdx)base;
+      idx[4] = (ImDrawIdx)(base + 2);
+      idx[5] = (ImDrawIdx)(base + 3);
+      vtx += 4;
+      idx += 6;
+      base += 4;
     }
+    int unused = count - (int)(vtx - draw->_VtxWritePtr) / 4;
+    draw->_VtxWritePtr = vtx;
+    draw->_IdxWritePtr = idx;
+    draw->_VtxCurrentIdx = base;
+    draw->PrimUnreserve(unused * 6, unused * 4);
+    return run.size;
+  }
 
-    // Process any remaining lines
-    size_t pos = 0;
-    size_t nl;
-    while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-      if (nl > pos) {
-        out_lines.emplace_back(buffer.substr(pos, nl - pos));
-      }
-      size_t next = nl + 1;
-      if (next < buffer.size() &&
-          ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-           (buffer[nl] == '\n' && buffer[next] == '\r')))
-        next++;
-      pos = next;
-    }
-    if (pos < buffer.size()) {
-      out_lines.emplace_back(buffer.substr(pos));
-    }
-
-    // Wait for process with timeout
-    int timeout_count = 0;
-    while (timeout_count < 500) { // 5 second timeout (500 * 10ms)
-      int wait_result = waitpid(pid, &status, WNOHANG);
-      if (wait_result == pid) {
-        // Process finished
-        if (WIFEXITED(status)) {
-          out_exit_code = WEXITSTATUS(status);
-        } else {
-          out_exit_code = 1;
-        }
-        break;
+  ImVec2 Draw(ImDrawList *draw, uint64_t id, std::string_view text,
+              ImVec2 pos, float wrap_width, ImU32 color) {
+    return Draw(draw, id, text, pos, wrap_width,
+                [color](uint32_t) { return color; });
+  }
+
+  void Reset() { runs_.clear(); }
+
+private:
+  struct Glyph {
+    ImVec2 p0, p1; // relative to the run's top-left corner
+    ImVec2 uv0, uv1;
+    uint32_t offset;
+    bool colored;
+  };
+  struct Run {
+    std::vector<Glyph> glyphs;
+    ImVec2 size;
+    int last_frame = 0;
+  };
+
+  const Run &Get(uint64_t id, std::string_view text, float wrap_width) {
+    ImFont *font = ImGui::GetFont();
+    float font_size = ImGui::GetFontSize();
+    if (font != font_ || font_size != font_size_ ||
+        wrap_width != wrap_width_) {
+      runs_.clear();
+      font_ = font;
+      font_size_ = font_size;
+      wrap_width_ = wrap_width;
+    }
+    int frame = ImGui::GetFrameCount();
+    auto it = runs_.find(id);
+    if (it == runs_.end()) {
+      if (runs_.size() >= kGlyphRunCacheMax) {
+        for (auto e = runs_.begin(); e != runs_.end();)
+          e = e->second.last_frame < frame - 1 ? runs_.erase(e) : std::next(e);
       }
-      usleep(10000); // 10ms
-      timeout_count++;
+      it = runs_.emplace(id, Layout(font, font_size, text, wrap_width)).first;
     }
-
-    if (timeout_count >= 500) {
-      // Timeout - kill the process
-      kill(pid, SIGKILL);
-      out_exit_code = 1;
+    it->second.last_frame = frame;
+    return it->second;
+  }
+
+  // Glyph placement of ImFont::RenderText, without the clipping
+  static Run Layout(ImFont *font, float font_size, std::string_view text,
+                    float wrap_width) {
+    Run run;
+    float scale = font_size / font->FontSize;
+    float line_height = font->FontSize * scale;
+    const char *begin = text.data();
+    const char *end = begin + text.size();
+    const char *s = begin;
+    const char *wrap_eol = nullptr;
+    float x = 0.0f, y = 0.0f, width = 0.0f;
+    while (s < end) {
+      if (wrap_width > 0.0f) {
+        if (!wrap_eol)
+          wrap_eol = font->CalcWordWrapPositionA(scale, s, end, wrap_width - x);
+        if (s >= wrap_eol) {
+          width = std::max(width, x);
+          x = 0.0f;
+          y += line_height;
+          wrap_eol = nullptr;
+          while (s < end && (*s == ' ' || *s == '\t'))
+            s++;
+          if (s < end && *s == '\n')
+            s++;
+          continue;
+        }
+      }
+      const char *at = s;
+      unsigned int c = (unsigned char)*s;
+      if (c < 0x80)
+        s++;
+      else
+        s += ImTextCharFromUtf8(&c, s, end);
+      if (c == '\n') {
+        width = std::max(width, x);
+        x = 0.0f;
+        y += line_height;
+        continue;
+      }
+      if (c == '\r')
+        continue;
+      const ImFontGlyph *glyph = font->FindGlyph((ImWchar)c);
+      if (!glyph)
+        continue;
+      if (glyph->Visible)
+        run.glyphs.push_back(
+            {ImVec2(x + glyph->X0 * scale, y + glyph->Y0 * scale),
+             ImVec2(x + glyph->X1 * scale, y + glyph->Y1 * scale),
+             ImVec2(glyph->U0, glyph->V0), ImVec2(glyph->U1, glyph->V1),
+             (uint32_t)(at - begin), glyph->Colored != 0});
+      x += glyph->AdvanceX * scale;
     }
-
-    close(pipe_stdout[0]);
-    close(pipe_stderr[0]);
-    return true;
+    width = std::max(width, x);
+    if (x > 0.0f || y == 0.0f)
+      y += line_height; // a trailing break adds no line
+    run.size = ImVec2(IM_TRUNC(width + 0.99999f), y);
+    return run;
   }
-}
-#endif
 
-// Run specific executable with args hidden; avoids cmd.exe quoting pitfalls
-#ifdef _WIN32
-static bool RunHiddenCaptureExe(const std::string &exe, const std::string &args,
-                                std::vector<std::string> &out_lines,
-                                DWORD &out_exit_code) {
-  out_lines.clear();
-  out_exit_code = 0;
-
-  SECURITY_ATTRIBUTES sa{};
-  sa.nLength = sizeof(sa);
-  sa.bInheritHandle = TRUE;
-  sa.lpSecurityDescriptor = NULL;
-  HANDLE hRead = NULL, hWrite = NULL;
-  if (!CreatePipe(&hRead, &hWrite, &sa, 0))
-    return false;
-  SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
+  ImFont *font_ = nullptr;
+  float font_size_ = 0.0f;
+  float wrap_width_ = -1.0f;
+  std::unordered_map<uint64_t, Run> runs_;
+};
 
-  STARTUPINFOW si{};
-  si.cb = sizeof(si);
-  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
-  si.wShowWindow = SW_HIDE;
-  si.hStdOutput = hWrite;
-  si.hStdError = hWrite;
+// Render-thread row index for the virtualized task log view. rows holds the
+// sequence numbers of the lines that match the search query (the cached
+// match list, in log order) and row_top their
+// running y offsets (row i spans row_top[i]..row_top[i + 1] relative to
+// row_top.front()), measured for one wrap width. New lines are measured once
+// as they arrive; trimmed lines just pop off the front.
+struct LogViewLayout {
+  float wrap_width = -1.0f; // <= 0 when lines are not wrapped
+  float line_height = 0.0f;
+  float row_gap = 0.0f;
+  std::string filter; // query text, compiled into query
+  LogQuery query;
+  std::string filter_error; // why the query did not compile
+  uint64_t next_seq = 0; // first log sequence number not yet measured
+  std::deque<uint64_t> rows;
+  std::deque<float> row_top; // rows.size() + 1 entries once built
+  // Search navigation: the current match (a log sequence number) and a
+  // pending request to scroll it into view
+  bool has_cursor = false;
+  uint64_t cursor_seq = 0;
+  bool scroll_to_cursor = false;
+  // Laid-out text of the visible rows, keyed by sequence number
+  GlyphRunCache glyphs;
+};
 
-  PROCESS_INFORMATION pi{};
+// Line texts the task and phase log windows share: parallel copies of a task
+// print mostly the same build and install output, which is then held once
+static LinePool g_line_pool;
+
+// One per-phase log file of a task (docker_build.log, gemini_prompt1.log,
+// ...), followed by g_log_tail while the task runs. The ring carries new
+// lines from the tail thread; the rest is the render thread's view of the
+// file, kept the same way as the task's own log.
+struct PhaseLog {
+  LiveObject<kLivePhaseLog> live;
+  int task_id = 0;  // TaskInstance::id of the run writing it
+  std::string name; // file name
+  std::string path;
+  std::shared_ptr<const LogClassifier> classifier;
+  LogLineRing ring;
+  IngestThrottle ingest; // ahead of the ring (tail thread)
+  // Set when the task exits: the tail thread reads what is left and stops
+  std::atomic<bool> finished{false};
+  LogArena log_output{kTaskLogMaxLines,
+                      LogArena::kCollapseRepeats | LogArena::kTimestamps,
+                      &g_line_pool};
+  LogArena log_lower{kTaskLogMaxLines, 0, &g_line_pool};
+  // Arenas released to the log memory budget; reloaded from the file when
+  // the task's tab is selected again
+  bool evicted = false;
+  uint64_t lines = 0; // lines read so far, including ones not held in RAM
+  uint64_t severity_counts[kLogSeverityCount] = {};
+  LogViewLayout log_view;
+  // BuildKit steps of the docker build output in the file, parsed by the
+  // tail thread as lines are read
+  std::mutex steps_mutex;
+  BuildStepParser build_steps;
+  // Failure signatures of the file's lines (tail thread), read once drained
+  // is set: the tail thread has read the whole file and let it go
+  FailureScanner failures;
+  std::atomic<bool> drained{false};
+  // MonotonicMs of the last line read, for the stall watchdog
+  std::atomic<int64_t> last_line_ms{0};
+  // Prompt phase logs (gemini_*.log): the API requests their lines report
+  // (tail thread, read once drained), and the key they were made with
+  bool prompt = false;
+  GeminiCallParser gemini;
+  uint64_t api_key_id = 0;
+};
 
-  std::wstring wExe = Widen(exe);
-  std::wstring wCmdLine = Widen(std::string("\"") + exe + "\" " + args);
-  BOOL ok = CreateProcessW(wExe.c_str(), &wCmdLine[0], NULL, NULL, TRUE,
-                           CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
-  if (!ok) {
-    CloseHandle(hRead);
-    CloseHandle(hWrite);
-    return false;
-  }
-  CloseHandle(hWrite);
+// Stage of autobuild.sh a task is in, followed from its output. Prompt runs
+// mostly wait on the Gemini API; every other phase competes for host cores
+// and memory.
+enum class TaskPhase : uint8_t {
+  Starting, // launched, no phase marker seen yet
+  Build,    // docker build
+  Setup,    // container start, Gemini CLI install
+  Prompt,   // Gemini prompt run
+  Verify,   // verification command in the container
+};
+static const int kTaskPhaseCount = 5;
 
-  std::string buffer;
-  buffer.reserve(4096);
-  char chunk[512];
-  DWORD bytes = 0;
-  for (;;) {
-    BOOL r = ReadFile(hRead, chunk, sizeof(chunk), &bytes, NULL);
-    if (!r || bytes == 0)
-      break;
-    buffer.append(chunk, chunk + bytes);
-    size_t pos = 0;
-    size_t nl;
-    while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-      if (nl > pos)
-        out_lines.emplace_back(buffer.substr(pos, nl - pos));
-      size_t next = nl + 1;
-      if (next < buffer.size() &&
-          ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-           (buffer[nl] == '\n' && buffer[next] == '\r')))
-        next++;
-      pos = next;
-    }
-    if (pos > 0)
-      buffer.erase(0, pos);
-  }
-  if (!buffer.empty())
-    out_lines.emplace_back(buffer);
-
-  // Wait for process with timeout to prevent GUI freezing
-  DWORD wait_result =
-      WaitForSingleObject(pi.hProcess, 5000); // 5 second timeout
-  if (wait_result == WAIT_TIMEOUT) {
-    // Process is taking too long, terminate it
-    TerminateProcess(pi.hProcess, 1);
-    out_exit_code = 1;
-  } else {
-    GetExitCodeProcess(pi.hProcess, &out_exit_code);
-  }
-  CloseHandle(pi.hThread);
-  CloseHandle(pi.hProcess);
-  CloseHandle(hRead);
-  return true;
-}
+// TaskInstance::phase_pane of the Timeline pane in the Logs tab
+static const int kTimelinePane = -2;
+// ... and of the Resources pane
+static const int kResourcesPane = -3;
+// ... and of the Build Steps pane
+static const int kBuildStepsPane = -4;
+
+// Task instance representing one running audit/build
+struct TaskInstance {
+  LiveObject<kLiveTaskInstance> live;
+  int id;
+  std::string name;
+  std::string command;
+  // New output lines on their way to the render thread, held to
+  // g_log_ingest_rate by ingest
+  LogLineRing log_ring;
+  IngestThrottle ingest;
+  // Render-thread view of the log (most recent kTaskLogMaxLines lines); only
+  // the render thread touches it, after DrainTaskLogs. Runs of a repeated
+  // line share one row; every row has its read time.
+  LogArena log_output{kTaskLogMaxLines,
+                      LogArena::kCollapseRepeats | LogArena::kTimestamps,
+                      &g_line_pool};
+  // Lowercase copy of log_output, one row per row of it, for search
+  LogArena log_lower{kTaskLogMaxLines, 0, &g_line_pool};
+  // Complete output on disk (null if the spool file could not be created)
+  std::unique_ptr<LogSpool> spool;
+  // Where the process's raw output is recorded (StreamRecorder), next to
+  // the spool; empty unless record_task_streams was on when it started
+  std::string record_path;
+  // The same for other processes to follow, with share_log_rings (null
+  // otherwise, or when the segment could not be created)
+  std::unique_ptr<SharedLogRing> shared_log;
+  // log_output and log_lower were released to the log memory budget and are
+  // reloaded from the spool when the tab is selected; last_viewed_frame is
+  // the frame the tab was last drawn in (render thread)
+  bool log_evicted = false;
+  int last_viewed_frame = 0;
+  // Classifies output lines as they are read; fixed for the task's lifetime
+  std::shared_ptr<const LogClassifier> classifier;
+  // Lines seen per severity, counted as they are drained (render thread)
+  uint64_t severity_counts[kLogSeverityCount] = {};
+  // Failure signatures of the output, fed where it is classified; read once
+  // the run has ended
+  FailureScanner failures;
+  bool summary_recorded = false; // written to the run catalog
+  FailureSummary failure; // what it found in a failed run (render thread)
+  std::atomic<bool> is_running{false};
+  std::atomic<bool> should_stop{false};
+  std::atomic<TeardownStage> teardown{TeardownStage::None};
+  // Set by the script's container event (see ApplyTaskEvent)
+  std::atomic<bool> container_created{false};
+  // Set when the Docker event stream reported that container dead while the
+  // script still ran (see ApplyTaskContainerEvent); the run is then stopped
+  // but counts as failed
+  std::atomic<bool> container_lost{false};
+  std::string task_type; // Feedback / Verify / Both / Audit
+  std::string group;     // task directory the run belongs to
+  std::string worker;    // Docker endpoint the run was placed on (empty: local)
+  std::string context_hash; // its --context-hash ("" if none)
+  std::atomic<TaskPhase> phase{TaskPhase::Starting}; // set by the reactor
+  // Stage gate the script is waiting at: gate_seq is its number (0 when not
+  // waiting) and gate_phase the stage it wants to enter
+  std::string gate_dir;
+  std::atomic<int> gate_seq{0};
+  uint64_t api_key_id = 0; // Gemini API key the run's prompts are paced by
+  uint64_t batch = 0;      // RunBatch it belongs to (0 = none)
+  std::atomic<TaskPhase> gate_phase{TaskPhase::Starting};
+  // Host-wide slots it holds: its run slot on this host, and one of the
+  // stage it was let into (guarded by tasks_mutex; see HostLeasePool)
+  HostLease run_lease;
+  HostLease stage_lease;
+  std::chrono::steady_clock::time_point started_at;
+  // Wall time of the finished run (set on exit, -1 while running)
+  std::atomic<double> run_seconds{-1.0};
+  std::atomic<int> exit_code{0};
+  // QueuedTask::seq it was started from, which the submission socket knows
+  // it by
+  uint64_t queue_seq = 0;
+  // Run time expected at launch (ExpectedRunSecondsLocked), -1 if unknown
+  double expected_seconds = -1.0;
+  // Brought back from the run journal after a restart with its container
+  // still up (see ReattachWatcher)
+  std::atomic<bool> orphan_live{false};
+  bool stats_recorded = false; // run_seconds folded into the ETA averages
+  // Stall watchdog (see CheckStalledRunsLocked): MonotonicMs of the last
+  // output line and of the last container sample that showed CPU use, and
+  // whether any sample came at all. A run quiet on both for too long is
+  // stalled: its diagnostics are captured (diagnosed is set once they are
+  // in, at stalled_ms + kStallCaptureMs at the latest), then it is ended
+  // and, when requeue is set, queued again.
+  std::atomic<int64_t> last_output_ms{0};
+  std::atomic<int64_t> last_busy_ms{0};
+  std::atomic<bool> cpu_sampled{false};
+  std::atomic<bool> stalled{false};
+  std::atomic<bool> stall_diagnosed{false};
+  int64_t stalled_ms = 0;
+  bool stall_requeue = false;
+  int retry = 0; // QueuedTask::retry it was started from
+  // Speculative backups (see QueueBackupRunsLocked): the run this one backs
+  // up (QueuedTask::backup_of), or whether it has a backup of its own
+  int backup_of = 0;
+  bool backed_up = false;
+  int prompt_starts = 0; // prompts its stage gate let start
+#ifdef _WIN32
+  HANDLE process_handle = NULL; // Windows process handle for termination
 #else
-// macOS/Linux version - proper implementation
-static bool RunHiddenCaptureExe(const std::string &exe, const std::string &args,
-                                std::vector<std::string> &out_lines,
-                                int &out_exit_code) {
-  out_lines.clear();
-  out_exit_code = 0;
-
-  // Create pipes for stdout/stderr
-  int pipe_stdout[2], pipe_stderr[2];
-  if (pipe(pipe_stdout) == -1 || pipe(pipe_stderr) == -1) {
-    return false;
-  }
+  int process_handle = 0; // Unix process handle for termination
+#endif
+  std::string log_search_filter;
+  LogViewLayout log_view; // render thread only
+  // Phase log files announced by the script, in order of first use, and the
+  // one shown in the Logs tab (-1 for the task output; render thread only)
+  std::mutex phase_logs_mutex;
+  std::vector<std::shared_ptr<PhaseLog>> phase_logs;
+  int phase_pane = -1; // or kTimelinePane
+  int select_pane = -1; // phase log whose tab is brought up next (-1: none)
+  // Phases timed by the script's [TIMING] markers, in start order
+  std::mutex timeline_mutex;
+  std::vector<PhaseTiming> timeline;
+  // Container the script announced (name, id and the id of its image), and
+  // its CPU, memory and I/O as sampled by g_resource_sampler while the run
+  // is up
+  std::mutex resources_mutex;
+  std::string container;
+  std::string container_id;
+  std::string image_id;
+  std::string container_lost_reason; // "ran out of memory", ...
+  ResourceSeries resources;
+  // Limits the scheduler gave the run's containers (see ResourceEnvelopes);
+  // set before launch
+  ResourceEnvelope envelope;
+  std::string workdir_mount; // AppState::workdir_mount at launch
+  std::string package_proxy; // PackageProxySpec for where it was placed
+  bool attach_exec = false;  // the script hands its phases to RunAttachedExec
+  // Windows: limits on the task's process tree (see ProcessOptions)
+  int tree_cpu_percent = 0;
+  int tree_memory_mb = 0;
+  bool pty = false; // AppState::pty_capture at launch
+  // AppState::background_builds at launch, and whether the current phase
+  // runs the process tree as background work (everything but prompts;
+  // see ProcessOptions::background), kept up to date by the reactor
+  bool background_builds = false;
+  std::atomic<bool> background{false};
+  // Log directory the script announced (under resources_mutex), and the
+  // phase its checkpoint resumes at, read once the run has ended ("" if
+  // none; render thread only)
+  std::string log_dir;
+  bool resume_checked = false;
+  std::string resume_phase;
 
-  // Fork the process
-  pid_t pid = fork();
-  if (pid == -1) {
-    close(pipe_stdout[0]);
-    close(pipe_stdout[1]);
-    close(pipe_stderr[0]);
-    close(pipe_stderr[1]);
-    return false;
-  }
+  TaskInstance(int task_id, const std::string &task_name,
+               const std::string &cmd)
+      : id(task_id), name(task_name), command(cmd) {}
+};
 
-  if (pid == 0) {
-    // Child process
-    close(pipe_stdout[0]); // Close read end
-    close(pipe_stderr[0]); // Close read end
+typedef std::vector<std::shared_ptr<TaskInstance>> TaskList;
 
-    // Redirect stdout and stderr to pipes
-    dup2(pipe_stdout[1], STDOUT_FILENO);
-    dup2(pipe_stderr[1], STDERR_FILENO);
-    close(pipe_stdout[1]);
-    close(pipe_stderr[1]);
+// What is kept of a finished task once it is compacted out of the task list
+// (see CompactFinishedTasksLocked): enough to list it and to open it again
+// as a tab, with its output read back from the spool file
+struct TaskSummary {
+  int id = 0;
+  std::string name;
+  std::string task_type;
+  std::string group;
+  std::string worker;
+  uint64_t queue_seq = 0;
+  uint64_t batch = 0;
+  int exit_code = 0;
+  bool stopped = false;
+  double run_seconds = 0.0;
+  long long ended_ms = 0; // EpochMs
+  std::string spool;      // spool file path ("" if it had none)
+  std::string log_dir;
+  std::vector<std::string> phase_logs;
+  FailureSummary failure;
+  uint64_t severity_counts[kLogSeverityCount] = {};
+};
 
-    // Build command array with proper shell parsing
-    std::string full_command = exe + " " + args;
-    std::vector<std::string> tokens = ParseShellCommand(full_command);
+// Compacted tasks kept; the oldest go first
+static const size_t kMaxTaskSummaries = 2000;
 
-    // Convert to char* array
-    std::vector<char *> argv;
-    for (auto &t : tokens) {
-      argv.push_back(const_cast<char *>(t.c_str()));
-    }
-    argv.push_back(nullptr);
+// Runs whose process is up, across every task list; kept by SetTaskRunning
+static std::atomic<int> g_running_tasks{0};
 
-    // Execute the command
-    execvp(exe.c_str(), argv.data());
-    exit(1); // If execvp fails
-  } else {
-    // Parent process
-    close(pipe_stdout[1]); // Close write end
-    close(pipe_stderr[1]); // Close write end
+// The only place is_running changes, so g_running_tasks stays exact however
+// often a run is marked stopped (RemoveTask, then its exit)
+static void SetTaskRunning(TaskInstance &task, bool running) {
+  if (task.is_running.exchange(running) != running)
+    g_running_tasks += running ? 1 : -1;
+}
 
-    std::string buffer;
-    buffer.reserve(4096);
-    char chunk[512];
-    int bytes = 0;
-    int status;
+// A Run Multiple batch with a stop rule, and how its runs went so far
+struct RunBatch {
+  std::string name;
+  BatchPolicy policy;
+  int runs = 0; // runs queued for it
+  int passed = 0;
+  int failed = 0;
+  int cancelled = 0;       // queued or running runs its stop rule ended
+  std::string stop_reason; // set once a stop rule ended it
+  BatchUrgency urgency = BatchUrgency::Normal;
+  time_t deadline = 0; // when its runs should be done by, 0 for none
+};
 
-    // Read from both stdout and stderr
-    while (true) {
-      // Check if process is still running
-      int wait_result = waitpid(pid, &status, WNOHANG);
-      if (wait_result == pid) {
-        // Process exited
-        break;
-      }
+// A saved pair of Prompt 1 and Prompt 2 texts to try against others on a
+// set of tasks (see QueuePromptMatrix); kept in prompts.json
+struct PromptVariant {
+  std::string name;
+  std::string prompt1;
+  std::string prompt2;
+  bool in_matrix = true; // picked for the next prompt matrix
+};
 
-      // Read from stdout
-      bytes = read(pipe_stdout[0], chunk, sizeof(chunk));
-      if (bytes > 0) {
-        buffer.append(chunk, bytes);
-      }
+// Synthetic load task (dev mode stress test): the app re-runs itself with
+// --synthetic-load as the task's process, which prints build-like output
+// (ANSI colors, progress bars) at a fixed rate, with optional bursts and
+// long lines, through the same queue, reactor and log path as a real run.
+struct SyntheticLoad {
+  int lines_per_sec = 2000;
+  int seconds = 60;
+  int burst_lines = 0;     // extra lines printed at once every burst_every_s
+  int burst_every_s = 5;
+  int long_line_pct = 1;   // share of lines that are kSyntheticLongLine long
+};
 
-      // Read from stderr
-      bytes = read(pipe_stderr[0], chunk, sizeof(chunk));
-      if (bytes > 0) {
-        buffer.append(chunk, bytes);
-      }
+static const int kSyntheticMaxRate = 200000;
+static const size_t kSyntheticLongLine = 16 * 1024;
+
+// How long a cluster's capacity reading is used before it is read again
+static const int kClusterProbeMs = 15000;
+
+// Room on the Kubernetes workers' clusters, read with kubectl on the job
+// system's I/O lane (see ReadClusterCapacity). The scheduler asks before
+// each placement; a reading older than kClusterProbeMs is refreshed in the
+// background meanwhile. Runs started since a reading was taken are counted
+// against it, as their pods may not have been there yet.
+class ClusterMonitor {
+public:
+  // Further runs endpoint's cluster has room for, with running of ours on
+  // it now; 0 until the first reading, -1 when it could not be read (the
+  // worker's slots then decide). Caller holds state.tasks_mutex.
+  int FreeRuns(const std::string &endpoint, int running) {
+    KubeTarget target;
+    if (!ParseKubeEndpoint(endpoint, target))
+      return -1;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Cluster &cluster = clusters_[endpoint];
+    auto now = std::chrono::steady_clock::now();
+    if (!cluster.probing &&
+        (!cluster.read || now - cluster.read_at >=
+                              std::chrono::milliseconds(kClusterProbeMs))) {
+      cluster.probing = true;
+      g_jobs.Submit(JobLane::Io, JobPriority::Housekeeping,
+                    [this, endpoint, target, running](const CancelToken &) {
+                      Probe(endpoint, target, running);
+                    });
+    }
+    if (!cluster.read)
+      return 0;
+    if (!cluster.ok)
+      return -1;
+    return std::max(0, cluster.free - std::max(0, running - cluster.running));
+  }
+
+  // The last reading of endpoint for the Settings: false before one
+  bool Describe(const std::string &endpoint, bool &ok, int &free,
+                double &cpus, double &requested_cpus) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = clusters_.find(endpoint);
+    if (it == clusters_.end() || !it->second.read)
+      return false;
+    ok = it->second.ok;
+    free = it->second.free;
+    cpus = it->second.cpus;
+    requested_cpus = it->second.requested_cpus;
+    return true;
+  }
 
-      // Process complete lines
-      size_t pos = 0;
-      size_t nl;
-      while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-        if (nl > pos) {
-          out_lines.emplace_back(buffer.substr(pos, nl - pos));
-        }
-        size_t next = nl + 1;
-        if (next < buffer.size() &&
-            ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-             (buffer[nl] == '\n' && buffer[next] == '\r')))
-          next++;
-        pos = next;
-      }
-      if (pos > 0)
-        buffer.erase(0, pos);
+private:
+  struct Cluster {
+    bool read = false; // a probe has finished
+    bool ok = false;   // and kubectl answered
+    bool probing = false;
+    std::chrono::steady_clock::time_point read_at;
+    int free = 0;    // ClusterFreeRuns at the reading
+    int running = 0; // our runs on it when the reading was asked for
+    double cpus = 0.0;
+    double requested_cpus = 0.0;
+  };
 
-      // Small delay to prevent busy waiting
-      usleep(10000); // 10ms
+  static bool ReadJson(const std::string &command, JsonValue &out) {
+    std::string text;
+    for (const auto &line : RunShellLines(command + " 2>/dev/null"))
+      text += line + "\n";
+    out = JsonValue();
+    return JsonParser(text).Parse(out) && out.type == JsonValue::Object;
+  }
+
+  void Probe(const std::string &endpoint, const KubeTarget &target,
+             int running) {
+    JsonValue nodes, pods;
+    ClusterCapacity capacity;
+    bool ok = ReadJson(KubeNodesCommand(target), nodes) &&
+              ReadJson(KubePodsCommand(target), pods) &&
+              ReadClusterCapacity(nodes, pods, capacity);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Cluster &cluster = clusters_[endpoint];
+    cluster.read = true;
+    cluster.ok = ok;
+    cluster.probing = false;
+    cluster.read_at = std::chrono::steady_clock::now();
+    cluster.running = running;
+    cluster.free = ok ? ClusterFreeRuns(capacity, kClusterRunCpus,
+                                        kClusterRunMib)
+                      : 0;
+    cluster.cpus = cluster.requested_cpus = 0.0;
+    for (const auto &node : capacity.nodes) {
+      cluster.cpus += node.cpus;
+      cluster.requested_cpus += node.requested_cpus;
     }
+  }
 
-    // Read remaining output
-    while (true) {
-      bytes = read(pipe_stdout[0], chunk, sizeof(chunk));
-      if (bytes <= 0)
-        break;
-      buffer.append(chunk, bytes);
+  std::mutex mutex_;
+  std::map<std::string, Cluster> clusters_;
+};
+
+static ClusterMonitor g_clusters;
+
+// How often running containers are sampled
+static const int kResourceSampleMs = 2000;
+// CPU use (percent of one core) below which a sample counts as idle for
+// the stall watchdog
+static const float kStallCpuPct = 1.0f;
+
+// Background sampling of each running task's container. Local containers
+// are read with one-shot Docker API stats requests (falling back to the
+// CLI); containers on a remote worker go through `docker stats`, one call
+// per worker for all of its containers. A task is dropped once it stops.
+class ResourceSampler {
+public:
+  ~ResourceSampler() { Stop(); }
+
+  void Watch(const std::shared_ptr<TaskInstance> &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_)
+      return;
+    watched_.push_back({task, DockerStatsReading(), false});
+    if (!thread_.joinable())
+      thread_ = std::thread([this]() {
+        HeapThread("Resource sampler", kHeapDocker);
+        Run();
+      });
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      cv_.notify_one();
     }
+    if (thread_.joinable())
+      thread_.join();
+  }
 
-    while (true) {
-      bytes = read(pipe_stderr[0], chunk, sizeof(chunk));
-      if (bytes <= 0)
+private:
+  struct Watched {
+    std::weak_ptr<TaskInstance> task;
+    DockerStatsReading last; // previous API reading, for CPU use
+    bool have_last;
+  };
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      cv_.wait_for(lock, std::chrono::milliseconds(kResourceSampleMs),
+                   [this]() { return stop_; });
+      if (stop_)
         break;
-      buffer.append(chunk, bytes);
+      std::vector<Watched> watched;
+      watched.swap(watched_);
+      lock.unlock();
+      SampleAll(watched);
+      lock.lock();
+      // Keep tasks that were added while sampling
+      watched.insert(watched.end(), watched_.begin(), watched_.end());
+      watched_.swap(watched);
     }
+  }
 
-    // Process any remaining lines
-    size_t pos = 0;
-    size_t nl;
-    while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-      if (nl > pos) {
-        out_lines.emplace_back(buffer.substr(pos, nl - pos));
-      }
-      size_t next = nl + 1;
-      if (next < buffer.size() &&
-          ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-           (buffer[nl] == '\n' && buffer[next] == '\r')))
-        next++;
-      pos = next;
-    }
-    if (pos < buffer.size()) {
-      out_lines.emplace_back(buffer.substr(pos));
-    }
-
-    // Wait for process with timeout
-    int timeout_count = 0;
-    while (timeout_count < 500) { // 5 second timeout (500 * 10ms)
-      int wait_result = waitpid(pid, &status, WNOHANG);
-      if (wait_result == pid) {
-        // Process finished
-        if (WIFEXITED(status)) {
-          out_exit_code = WEXITSTATUS(status);
-        } else {
-          out_exit_code = 1;
-        }
-        break;
+  void SampleAll(std::vector<Watched> &watched) {
+    TRACE_ZONE("ResourceSampler");
+    // Tasks left for `docker stats`, by worker endpoint
+    std::map<std::string, std::vector<std::shared_ptr<TaskInstance>>> cli;
+    // Workers have daemons of their own
+    bool local_up = DockerDaemonHealth().Available();
+    for (size_t i = 0; i < watched.size();) {
+      std::shared_ptr<TaskInstance> task = watched[i].task.lock();
+      if (!task || !task->is_running) {
+        watched.erase(watched.begin() + i);
+        continue;
+      }
+      // A cluster run's containers are in its pod's own daemon
+      if ((task->worker.empty() && !local_up) ||
+          IsClusterWorker(task->worker)) {
+        i++;
+        continue;
       }
-      usleep(10000); // 10ms
-      timeout_count++;
+      if (!task->worker.empty() || !SampleApi(*task, watched[i]))
+        cli[task->worker].push_back(task);
+      i++;
     }
+    for (const auto &kv : cli)
+      SampleCli(kv.first, kv.second);
+  }
+
+  static std::string Container(TaskInstance &task) {
+    std::lock_guard<std::mutex> lock(task.resources_mutex);
+    return task.container;
+  }
+
+  static void Record(TaskInstance &task, ResourceSample sample) {
+    sample.t = std::chrono::duration<float>(
+                   std::chrono::steady_clock::now() - task.started_at)
+                   .count();
+    task.cpu_sampled = true;
+    if (sample.cpu_pct >= kStallCpuPct)
+      task.last_busy_ms = MonotonicMs();
+    std::lock_guard<std::mutex> lock(task.resources_mutex);
+    task.resources.Add(sample);
+  }
+
+  // False when the daemon socket is unreachable
+  static bool SampleApi(TaskInstance &task, Watched &w) {
+    int status = 0;
+    JsonValue body;
+    std::string path = "/containers/" + UrlEncode(Container(task), true) +
+                       "/stats?stream=false&one-shot=true";
+    if (!DockerApiCall("GET", path, status, body))
+      return false;
+    DockerStatsReading reading;
+    if (status != 200 || !ParseDockerStats(body, reading))
+      return true; // not running (yet or any more)
+    const double mib = 1024.0 * 1024.0;
+    ResourceSample sample;
+    sample.cpu_pct =
+        w.have_last ? (float)DockerCpuPercent(w.last, reading) : 0.0f;
+    sample.mem_mib = (float)(reading.mem_bytes / mib);
+    sample.net_rx_mib = (float)(reading.net_rx_bytes / mib);
+    sample.net_tx_mib = (float)(reading.net_tx_bytes / mib);
+    sample.blk_read_mib = (float)(reading.blk_read_bytes / mib);
+    sample.blk_write_mib = (float)(reading.blk_write_bytes / mib);
+    w.last = reading;
+    w.have_last = true;
+    Record(task, sample);
+    return true;
+  }
 
-    if (timeout_count >= 500) {
-      // Timeout - kill the process
-      kill(pid, SIGKILL);
-      out_exit_code = 1;
+  static void
+  SampleCli(const std::string &endpoint,
+            const std::vector<std::shared_ptr<TaskInstance>> &tasks) {
+    std::string cmd;
+    for (const auto &var : DockerWorkerEnvironment(endpoint)) {
+      size_t eq = var.find('=');
+      cmd += var.substr(0, eq + 1) + "'" + var.substr(eq + 1) + "' ";
+    }
+    cmd += "docker stats --no-stream --format "
+           "'{{.Name}}|{{.CPUPerc}}|{{.MemUsage}}|{{.NetIO}}|{{.BlockIO}}'";
+    std::map<std::string, TaskInstance *> by_name;
+    for (const auto &task : tasks) {
+      std::string name = Container(*task);
+      by_name[name] = task.get();
+      cmd += " '" + name + "'";
+    }
+    cmd += " 2>/dev/null";
+    for (const auto &row : RunShellLines(cmd)) {
+      size_t bar = row.find('|');
+      ResourceSample sample;
+      if (bar == std::string::npos ||
+          !ParseDockerStatsRow(std::string_view(row).substr(bar + 1), sample))
+        continue;
+      auto it = by_name.find(row.substr(0, bar));
+      if (it != by_name.end())
+        Record(*it->second, sample);
     }
-
-    close(pipe_stdout[0]);
-    close(pipe_stderr[0]);
-    return true;
   }
-}
-#endif
 
-// Stream variant: emits each line via callback as soon as it's available
-#ifdef _WIN32
-static bool
-RunHiddenStreamExe(const std::string &exe, const std::string &args,
-                   const std::function<void(const std::string &)> &onLine,
-                   DWORD &out_exit_code) {
-  out_exit_code = 0;
-
-  SECURITY_ATTRIBUTES sa{};
-  sa.nLength = sizeof(sa);
-  sa.bInheritHandle = TRUE;
-  sa.lpSecurityDescriptor = NULL;
-  HANDLE hRead = NULL, hWrite = NULL;
-  if (!CreatePipe(&hRead, &hWrite, &sa, 0))
-    return false;
-  SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  std::vector<Watched> watched_;
+  bool stop_ = false;
+};
 
-  STARTUPINFOW si{};
-  si.cb = sizeof(si);
-  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
-  si.wShowWindow = SW_HIDE;
-  si.hStdOutput = hWrite;
-  si.hStdError = hWrite;
+static ResourceSampler g_resource_sampler;
 
-  PROCESS_INFORMATION pi{};
+// Container limits per task and run type, from the peaks earlier runs
+// reached: g_resource_sampler's for runs of this session, the run catalog's
+// "resources" events for older ones (see LogsIndex)
+static ResourceEnvelopes g_resource_envelopes;
 
-  std::wstring wExe = Widen(exe);
-  std::wstring wCmdLine = Widen(std::string("\"") + exe + "\" " + args);
-  BOOL ok = CreateProcessW(wExe.c_str(), &wCmdLine[0], NULL, NULL, TRUE,
-                           CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
-  if (!ok) {
-    CloseHandle(hRead);
-    CloseHandle(hWrite);
-    return false;
-  }
-  CloseHandle(hWrite);
+// How long runs of each task and mode took, learned from the passed runs of
+// the run catalog (see LogsIndex); the queue orders and ETAs rest on it
+static DurationModel g_durations;
 
-  std::string buffer;
-  buffer.reserve(4096);
-  char chunk[512];
-  DWORD bytes = 0;
-  for (;;) {
-    BOOL r = ReadFile(hRead, chunk, sizeof(chunk), &bytes, NULL);
-    if (!r || bytes == 0)
-      break;
-    buffer.append(chunk, chunk + bytes);
-    size_t pos = 0;
-    size_t nl;
-    while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-      if (nl > pos)
-        onLine(buffer.substr(pos, nl - pos));
-      size_t next = nl + 1;
-      if (next < buffer.size() &&
-          ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-           (buffer[nl] == '\n' && buffer[next] == '\r')))
-        next++;
-      pos = next;
-    }
-    if (pos > 0)
-      buffer.erase(0, pos);
-  }
-  if (!buffer.empty())
-    onLine(buffer);
-
-  // Wait for process with timeout to prevent GUI freezing
-  DWORD wait_result =
-      WaitForSingleObject(pi.hProcess, 5000); // 5 second timeout
-  if (wait_result == WAIT_TIMEOUT) {
-    // Process is taking too long, terminate it
-    TerminateProcess(pi.hProcess, 1);
-    out_exit_code = 1;
-  } else {
-    GetExitCodeProcess(pi.hProcess, &out_exit_code);
-  }
-  CloseHandle(pi.hThread);
-  CloseHandle(pi.hProcess);
-  CloseHandle(hRead);
-  return true;
-}
-#else
-// macOS/Linux version
-static bool
-RunHiddenStreamExe(const std::string &exe, const std::string &args,
-                   const std::function<void(const std::string &)> &onLine,
-                   int &out_exit_code) {
-  out_exit_code = 0;
-
-  std::string command = exe + " " + args;
-  FILE *pipe = popen(command.c_str(), "r");
-  if (!pipe)
-    return false;
+// Rolling aggregates of the catalog's finished runs for the Run Analytics
+// window, updated as the Logs Browser folds each run's events
+static RunAnalytics g_run_analytics;
 
-  char buffer[128];
-  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-    std::string line(buffer);
-    if (!line.empty() && line.back() == '\n') {
-      line.pop_back();
-    }
-    onLine(line);
-  }
+static std::string EnvelopeKey(const std::string &task_dir,
+                               const std::string &task_type) {
+  return task_dir + "|" + task_type;
+}
 
-  out_exit_code = pclose(pipe);
-  return true;
+// Length of the common prefix of a and b, and of the common suffix of what
+// is left after it
+static void CommonAffixes(const std::string &a, const std::string &b,
+                          size_t &prefix, size_t &suffix) {
+  size_t n = std::min(a.size(), b.size());
+  prefix = 0;
+  while (prefix < n && a[prefix] == b[prefix])
+    prefix++;
+  suffix = 0;
+  while (suffix < n - prefix &&
+         a[a.size() - 1 - suffix] == b[b.size() - 1 - suffix])
+    suffix++;
 }
-#endif
 
-#ifdef _WIN32
-// Convert Windows path to MSYS2/Unix path format
-std::string ConvertToUnixPath(const std::string &winPath) {
-  std::string unixPath = winPath;
+// Undo steps kept per prompt; older steps fold into the base snapshot
+static const size_t kPromptHistoryMax = 2000;
+
+// Undo/redo history of one prompt: the oldest kept text plus one edit per
+// step, in a ring buffer. An edit replaces the middle that differs from the
+// previous text, so a keystroke in a multi-KB prompt costs a few bytes and
+// pushing, undoing and redoing cost O(edit) rather than O(history). The
+// text at the current step is kept materialized.
+class PromptHistory {
+public:
+  // Replace the text at pos: `removed` going forward, `inserted` going back
+  struct Edit {
+    size_t pos = 0;
+    std::string removed;
+    std::string inserted;
+  };
 
-  // Replace backslashes with forward slashes
-  for (size_t i = 0; i < unixPath.length(); i++) {
-    if (unixPath[i] == '\\') {
-      unixPath[i] = '/';
+  // Number of states (steps + 1), 0 before the first push
+  size_t size() const { return index_ < 0 ? 0 : count_ + 1; }
+  bool empty() const { return index_ < 0; }
+  int index() const { return index_; }
+  const std::string &current() const { return current_; }
+  const std::string &base() const { return base_; }
+  size_t edit_count() const { return count_; }
+  const Edit &edit(size_t i) const { return ring_[(head_ + i) % ring_.size()]; }
+
+  bool CanUndo() const { return index_ > 0; }
+  bool CanRedo() const { return index_ >= 0 && (size_t)index_ < count_; }
+
+  // Record value as the newest state, dropping anything that could be redone
+  void Push(const std::string &value) {
+    if (index_ < 0) {
+      base_ = current_ = value;
+      index_ = 0;
+      count_ = 0;
+      return;
     }
+    count_ = (size_t)index_;
+    if (count_ == kPromptHistoryMax) {
+      Apply(base_, At(0), true);
+      head_ = (head_ + 1) % ring_.size();
+      count_--;
+      index_--;
+    }
+    if (count_ == ring_.size())
+      ring_.emplace_back(); // grows only until the ring first fills
+    size_t prefix = 0, suffix = 0;
+    CommonAffixes(current_, value, prefix, suffix);
+    Edit &e = At(count_);
+    e.pos = prefix;
+    e.removed.assign(current_, prefix, current_.size() - prefix - suffix);
+    e.inserted.assign(value, prefix, value.size() - prefix - suffix);
+    count_++;
+    index_++;
+    current_ = value;
+  }
+
+  const std::string &Undo() {
+    if (CanUndo())
+      Apply(current_, At((size_t)--index_), false);
+    return current_;
+  }
+
+  const std::string &Redo() {
+    if (CanRedo())
+      Apply(current_, At((size_t)index_++), true);
+    return current_;
+  }
+
+  // Forget the newest state, stepping back first if it is the current one
+  void DropNewest() {
+    if (size() < 2)
+      return;
+    if ((size_t)index_ == count_)
+      Undo();
+    count_--;
+  }
+
+  void Clear() {
+    ring_.clear();
+    head_ = count_ = 0;
+    index_ = -1;
+    base_.clear();
+    current_.clear();
+  }
+
+  // Rebuild from a saved base and edits, positioned at index. Fails (leaving
+  // the history empty) when an edit does not apply to the text before it.
+  bool Restore(const std::string &base, std::vector<Edit> edits, int index) {
+    Clear();
+    size_t skip = edits.size() > kPromptHistoryMax
+                      ? edits.size() - kPromptHistoryMax
+                      : 0;
+    base_ = current_ = base;
+    index_ = 0;
+    for (size_t i = 0; i < edits.size(); i++) {
+      Edit &e = edits[i];
+      if (e.pos > current_.size() ||
+          current_.compare(e.pos, e.removed.size(), e.removed) != 0) {
+        Clear();
+        return false;
+      }
+      Apply(current_, e, true);
+      if (i < skip)
+        base_ = current_;
+      else
+        ring_.push_back(std::move(e));
+    }
+    count_ = ring_.size();
+    index_ = (int)count_;
+    index -= (int)skip;
+    while (index_ > std::max(0, index))
+      Undo();
+    return true;
   }
 
-  // Convert C: to /c/
-  if (unixPath.length() >= 2 && unixPath[1] == ':') {
-    char drive = tolower(unixPath[0]);
-    unixPath = "/" + std::string(1, drive) + "/" + unixPath.substr(3);
-  }
-
-  return unixPath;
-}
-#endif
+private:
+  Edit &At(size_t i) { return ring_[(head_ + i) % ring_.size()]; }
 
-// Return directory of the current executable
-static std::string GetExecutableDir() {
-#ifdef _WIN32
-  char path[MAX_PATH];
-  DWORD len = GetModuleFileNameA(NULL, path, MAX_PATH);
-  if (len == 0 || len == MAX_PATH)
-    return ".";
-  std::string p(path, len);
-  size_t pos = p.find_last_of("\\/");
-  return (pos != std::string::npos) ? p.substr(0, pos) : std::string(".");
-#elif defined(__APPLE__)
-  char path[1024];
-  uint32_t size = sizeof(path);
-  if (_NSGetExecutablePath(path, &size) == 0) {
-    std::string p(path);
-    size_t pos = p.find_last_of('/');
-    return (pos != std::string::npos) ? p.substr(0, pos) : std::string(".");
+  static void Apply(std::string &text, const Edit &e, bool forward) {
+    const std::string &from = forward ? e.removed : e.inserted;
+    const std::string &to = forward ? e.inserted : e.removed;
+    text.replace(e.pos, from.size(), to);
   }
-  return ".";
-#else
-  char buf[4096];
-  ssize_t n = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
-  if (n > 0) {
-    buf[n] = 0;
-    std::string p(buf);
-    size_t pos = p.find_last_of('/');
-    return (pos != std::string::npos) ? p.substr(0, pos) : std::string(".");
-  }
-  return ".";
-#endif
-}
 
-// Convert a possibly relative path to an absolute path
-static std::string ToAbsolutePath(const std::string &path) {
-#ifdef _WIN32
-  char full[_MAX_PATH];
-  if (_fullpath(full, path.c_str(), _MAX_PATH))
-    return std::string(full);
-  return path;
-#else
-  // Use realpath for absolute path resolution
-  char *resolved = realpath(path.c_str(), nullptr);
-  if (resolved) {
-    std::string result(resolved);
-    free(resolved);
-    return result;
-  }
-  // If realpath fails (e.g., path doesn't exist yet), return as-is
-  return path;
-#endif
-}
-
-// Compute the default logs directory as an absolute path to project
-// autobuild/logs
-static std::string ResolveDefaultLogsPath() {
-  std::string exe_dir = GetExecutableDir();
-
-#ifdef _WIN32
-  // Check if we're running from a Program Files installation (MSI)
-  if (exe_dir.find("Program Files") != std::string::npos) {
-    // For MSI installations, use %APPDATA%\Autobuild\logs
-    const char *appdata = getenv("APPDATA");
-    if (appdata != nullptr) {
-      std::string logs_path = std::string(appdata) + "\\Autobuild\\logs";
-      return ToAbsolutePath(logs_path);
-    }
-    // Fallback to Documents if APPDATA fails
-    const char *documents = getenv("USERPROFILE");
-    if (documents != nullptr) {
-      std::string logs_path =
-          std::string(documents) + "\\Documents\\Autobuild\\logs";
-      return ToAbsolutePath(logs_path);
-    }
-  }
-#elif defined(__APPLE__)
-  // Check if we're running from an installed app bundle
-  if (exe_dir.find(".app/Contents/MacOS") != std::string::npos) {
-    // For installed app bundles, use ~/Library/Application
-    // Support/Autobuild/logs
-    const char *home = getenv("HOME");
-    if (home) {
-      std::string logs_path =
-          std::string(home) + "/Library/Application Support/Autobuild/logs";
-      return ToAbsolutePath(logs_path);
-    }
-    // Fallback to ~/.autobuild/logs
-    const char *home_fallback = getenv("HOME");
-    if (home_fallback) {
-      std::string logs_path = std::string(home_fallback) + "/.autobuild/logs";
-      return ToAbsolutePath(logs_path);
-    }
-  }
-#elif defined(__linux__)
-  // Check if we're running from a system installation
-  if (exe_dir.find("/usr/bin") != std::string::npos ||
-      exe_dir.find("/usr/local/bin") != std::string::npos ||
-      exe_dir.find("/opt") != std::string::npos) {
-    // For system installations, use ~/.local/share/autobuild/logs
-    const char *home = getenv("HOME");
-    if (home) {
-      std::string logs_path =
-          std::string(home) + "/.local/share/autobuild/logs";
-      return ToAbsolutePath(logs_path);
-    }
-    // Fallback to ~/.autobuild/logs
-    const char *home_fallback = getenv("HOME");
-    if (home_fallback) {
-      std::string logs_path = std::string(home_fallback) + "/.autobuild/logs";
-      return ToAbsolutePath(logs_path);
-    }
-  }
-#endif
-
-  // Development layout: native/build-gui/autobuild_gui.exe -> repo_root =
-  // exe_dir/../..
-  std::string candidate = exe_dir + "/../../autobuild/logs";
-  return ToAbsolutePath(candidate);
-}
-
-enum class DropTarget {
-  None,
-  TaskDirectory,
-  OutputDirectory,
-  WorkingDirectory,
-  BuildDirectory,
-  NewLogPath
-};
-
-struct TaskValidation {
-  bool has_env_dir = false;
-  bool has_dockerfile = false;
-  bool has_verify_dir = false;
-  bool has_verify_sh = false;
-  bool has_prompt = false;
-  std::string prompt_location;
-  std::vector<std::string> missing_items;
-  std::vector<std::string> found_items;
-};
-
-// Task instance representing one running audit/build
-struct TaskInstance {
-  int id;
-  std::string name;
-  std::string command;
-  std::vector<std::string> log_output;
-  std::mutex log_mutex;
-  std::thread worker_thread;
-  std::atomic<bool> is_running{false};
-  std::atomic<bool> should_stop{false};
-  std::atomic<bool> container_created{
-      false}; // Track if Docker container has been created
-#ifdef _WIN32
-  HANDLE process_handle = NULL; // Windows process handle for termination
-#else
-  int process_handle = 0; // Unix process handle for termination
-#endif
-  std::string log_search_filter;
-
-  TaskInstance(int task_id, const std::string &task_name,
-               const std::string &cmd)
-      : id(task_id), name(task_name), command(cmd) {}
+  std::vector<Edit> ring_;
+  size_t head_ = 0;  // oldest edit
+  size_t count_ = 0; // edits kept; state i is base + edits [0, i)
+  int index_ = -1;   // current state
+  std::string base_, current_;
 };
 
-struct AppState {
-  std::string task_directory;
-  std::string api_key;
+struct AppState : AppSettings {
   std::string image_tag;
   std::string container_name;
   std::string workdir;
   std::string output_dir;
-  std::string build_dir = "native/build";
-  std::vector<std::string> log_folder_paths; // Multiple log folder paths
-  int selected_log_folder = 0;               // Currently selected log folder
   std::string new_log_path_input; // Input buffer for adding new paths
   int selected_mode = 0;          // 0=feedback, 1=verify, 2=both, 3=audit
-  std::vector<std::string>
-      log_output; // Legacy single log output (kept for compatibility)
+  LogArena log_output{
+      kLegacyLogMaxLines}; // Legacy single log output (kept for compatibility)
   std::atomic<bool> is_running{false}; // Legacy single running flag
   bool show_logs = false;
   std::string pending_drop_file;
@@ -1457,12 +2456,10 @@ struct AppState {
   TaskValidation validation;
   std::string log_search_filter; // Search filter for logs
   bool show_api_key = false;     // Toggle to show/hide API key
-  bool auto_lowercase_names =
-      true; // Automatically convert image/container names to lowercase
   bool should_clear_focus = false;   // Clear input focus when drag begins
   bool switch_to_logs_tab = false;   // Request to switch to Logs tab
   bool switch_to_manage_tab = false; // Request to switch to Manage tab
-  std::mutex log_mutex;       // Protect log_output from concurrent access
+  TRACED_MUTEX(log_mutex);    // Protect log_output from concurrent access
   std::thread command_thread; // Background thread for command execution
   // Docker management state
   struct DockerContainer {
@@ -1477,22 +2474,85 @@ struct AppState {
     std::string repo_tag;
     std::string id;
     std::string size;
+    double bytes = 0.0; // size, for sorting
   };
-  std::vector<DockerContainer> containers;
-  std::vector<DockerImage> images;
+  // The daemon's containers and images as last listed, published whole
+  // under docker_state_mutex (see PublishDockerStateLocked): readers keep
+  // the snapshot they loaded, and its version tells them when what they
+  // derived from it is stale
+  struct DockerSnapshot {
+    uint64_t version = 0;
+    std::vector<DockerContainer> containers;
+    std::vector<DockerImage> images;
+  };
+  std::shared_ptr<const DockerSnapshot> docker_snapshot =
+      std::make_shared<const DockerSnapshot>();
+  // Rows a Manage tab table shows, in order: indices into the snapshot's
+  // list that match the filter, sorted by the chosen column. Rebuilt only
+  // when the snapshot version, the filter or the order changes (render
+  // thread).
+  struct DockerTableView {
+    char filter[128] = "";
+    int sort = 0;
+    uint64_t built_version = 0;
+    std::string built_filter;
+    int built_sort = -1;
+    std::vector<uint32_t> rows;
+  };
+  DockerTableView container_view;
+  DockerTableView image_view;
   bool docker_loaded = false;
   bool docker_unavailable =
       false; // Set to true when Docker is not running/accessible
   std::atomic<bool> docker_refreshing{
-      false};                        // Set to true when refresh is in progress
-  std::thread docker_refresh_thread; // Background thread for Docker refresh
-  std::mutex docker_state_mutex; // Protect docker containers and images from
-                                 // concurrent access
+      false};                       // Set to true when refresh is in progress
+  std::thread docker_events_thread; // Docker /events watcher
+  std::atomic<bool> docker_events_live{false}; // Deltas are being applied
+  std::atomic<bool> docker_events_stop{false};
+  TRACED_MUTEX(docker_state_mutex); // Protect docker containers and images
+                                    // from concurrent access
   // Manage Logs state
   int selected_task_index = -1;
   int selected_run_index = -1;
+  std::string logs_browser_query; // LogQuery over the runs listed
   bool show_confirm_delete = false;
-  std::string pending_delete_path;
+  std::vector<std::string> pending_delete_paths;
+  // Task and run folders Ctrl+clicked for a bulk delete, and why the last
+  // delete or undo failed
+  std::set<std::string, std::less<>> logs_marked;
+  std::string delete_error;
+  // Built-in log file viewer (null when closed). log_viewer_cursor is the
+  // current search match (-1 for none); log_viewer_line is a line marked in
+  // the unfiltered view, e.g. a hit of the logs search.
+  std::unique_ptr<LogFileView> log_viewer;
+  std::shared_ptr<const LogClassifier> log_viewer_classifier;
+  std::string log_viewer_search;
+  int64_t log_viewer_cursor = -1;
+  int64_t log_viewer_line = -1;
+  bool log_viewer_scroll = false;
+  // Search across all logs
+  bool show_log_search = false;
+  std::string log_search_query;
+  // Run Analytics window and its time window (see RenderRunAnalytics)
+  bool show_run_analytics = false;
+  int run_analytics_window = 1;
+  // Log Diff window (see RenderLogDiff): a task of a logs root, a file as
+  // "<mode>/<name>" and the base and compared run
+  bool show_log_diff = false;
+  std::string log_diff_root, log_diff_task, log_diff_file;
+  std::string log_diff_run_a, log_diff_run_b;
+  bool log_diff_ignore_volatile = true;
+  // Batch import: every task folder under task_batch_root, with the runs to
+  // queue per task for each mode
+  bool show_task_batch = false;
+  std::string task_batch_root;
+  int task_batch_runs[4] = {1, 0, 0, 0};
+  std::string task_batch_status;
+  // Prompt matrix of the batch import: the saved prompt variants (kept in
+  // prompts.json; see matrix_reps)
+  std::vector<PromptVariant> prompt_variants;
+  std::string prompt_variant_name;
+  int prompt_variant_step = 0; // Prompt 1 history step to save as a variant
 
   // History deletion confirmation popups
   bool show_confirm_clear_all_history = false;
@@ -1502,21 +2562,67 @@ struct AppState {
                                        // with manual history operations
 
   // NEW: Multi-task support
-  std::vector<std::shared_ptr<TaskInstance>> tasks;
-  std::mutex tasks_mutex;
+  TaskList tasks;
+  TRACED_MUTEX(tasks_mutex);
+  // Copy-on-write view of tasks for the render thread: every change to the
+  // list publishes a fresh immutable copy (PublishTasksLocked), which
+  // readers load atomically without taking tasks_mutex (TasksView)
+  std::shared_ptr<const TaskList> tasks_view =
+      std::make_shared<const TaskList>();
+  std::atomic<int> queued_tasks{0}; // task_queue.size(), for readers
+  // Finished tasks compacted out of tasks, oldest first (tasks_mutex; see
+  // compact_after_minutes)
+  std::deque<TaskSummary> task_summaries;
+  std::atomic<int> task_summary_count{0};
+  int select_task_tab = 0; // id of the task tab brought up next (render)
+  // Tasks with a tab of their own in the Logs tab, oldest first; the rest
+  // are reached from the task navigator (render thread)
+  std::vector<int> pinned_task_tabs;
   int next_task_id = 1;
-  int max_concurrent_tasks = 3; // Configurable limit
+  // Runs waiting for a slot (guarded by tasks_mutex); ScheduleQueuedTasks
+  // starts them as running tasks finish
+  std::vector<QueuedTask> task_queue;
+  uint64_t next_queue_seq = 0;
+  // Batches with a stop rule, by id (tasks_mutex); dropped once none of
+  // their runs is queued or shown any more
+  std::map<uint64_t, RunBatch> run_batches;
+  std::atomic<int> run_batch_count{0}; // run_batches.size(), for readers
+  uint64_t next_batch_id = 1;
+  uint64_t dispatch_count = 0;
+  std::map<std::string, uint64_t> group_last_dispatch;
+  // Where each task directory last ran among docker_workers, as its image
+  // is likely cached there (tasks_mutex; see PlaceQueuedTaskLocked)
+  std::map<std::string, std::string> group_worker;
+  std::string new_worker_input; // Settings input for adding a worker
+  int new_worker_slots = 4;
+  // Smoothed run time per task type in seconds, for queue ETAs when the
+  // duration model knows nothing of a task
+  std::map<std::string, double> task_type_seconds;
+  // Smoothed prompt starts per run by task type, for planning against the
+  // daily API quota (see DeferForQuotaLocked)
+  std::map<std::string, double> task_type_prompts;
+  // The OS refused raise_gui_priority (see ApplyGuiThreadPriority)
+  bool gui_priority_denied = false;
+  HostLoadSample host_load; // guarded by tasks_mutex
+  bool host_load_fresh = false; // no run admitted since the last sample
+  const char *scheduler_hold = nullptr; // why queued runs are waiting
+  std::chrono::steady_clock::time_point host_sampled_at;
+  std::chrono::steady_clock::time_point docker_sampled_at;
+  std::atomic<int> docker_containers{-1};
+  std::atomic<bool> docker_probe_running{false};
   int run_multiple_count =
       1; // How many tasks to run when "Run Multiple" is clicked
-  bool use_docker_no_cache = true; // Always use --no-cache for Docker builds
-  bool use_docker_debug =
-      false; // Enable Docker build debug mode with verbose output
+  // Run audits anyway and replace what use_audit_cache stored (this session
+  // only)
+  bool force_reaudit = false;
+  // How applying metrics_port, dashboard_port and submit_socket went
+  std::string metrics_status;
+  std::string dashboard_status;
+  std::string submit_status;
   int selected_task_tab = 0; // Currently selected task tab in logs view
 
   // Developer diagnostics
   bool dev_mode = false;             // Toggle dev diagnostic UI
-  std::vector<std::string> dev_logs; // Recent diagnostic messages
-  std::mutex dev_logs_mutex;
 
   // Additional debugging features
   bool show_debug_console = false; // Show debug console window
@@ -1527,18 +2633,33 @@ struct AppState {
   bool bring_front_metrics = false;
   bool bring_front_style = false;
   bool bring_front_demo = false;
+  // Frame Profiler window: the frame shown in the flame chart (-1 for the
+  // newest) and the result of the last trace export
+  bool show_profiler = false;
+  bool profiler_paused = false;
+  int profiler_frame = -1;
+  std::string profiler_status;
+  bool show_heap = false; // Heap window (HEAP ACCOUNTING)
 
   // Popup flags
   bool show_cannot_close_popup = false;
 
-  // NEW: Individual task type counters
-  int feedback_count = 1;
-  int verify_count = 1;
-  int both_count = 1;
-  int audit_count = 1;
+  // Dev mode synthetic load runs (not saved)
+  SyntheticLoad synthetic_load;
+  int synthetic_count = 4;
+  // Dev mode recording of runs' output and replaying it (not saved):
+  // replay_speed 1 is as recorded, N is N times faster, 0 as fast as the
+  // reader takes it
+  bool record_task_streams = false;
+  std::string replay_path;
+  int replay_speed = 1;
+  int replay_count = 1;
 
   // Docker error handling
   std::string image_delete_error;
+  // Containers a removal from the Manage tab could not remove, one line
+  // each (shown under the containers table until dismissed)
+  std::string container_remove_error;
 
   // Prompt Editor state
   bool show_prompt_editor = false;
@@ -1550,6 +2671,9 @@ struct AppState {
   std::string audit_prompt_modified;
   bool prompts_loaded = false;
   bool prompts_modified = false;
+  // Which of Prompt1, Prompt2 and Audit differ from their defaults;
+  // prompts_modified is any of them (see UpdatePromptModified)
+  bool prompt_differs[3] = {false, false, false};
   int selected_prompt_tab = 0; // 0=Prompt1, 1=Prompt2, 2=Audit
   bool show_diff_view = true;
   bool diff_split_view = true;  // true=split, false=unified
@@ -1557,11 +2681,6 @@ struct AppState {
   float diff_editor_splitter_height = 300.0f; // Height of diff view (resizable)
 
   // Undo/Redo history for each prompt separately
-  struct PromptHistory {
-    std::vector<std::string> history;
-    int current_index = -1;
-    int max_size = 50;
-  };
   PromptHistory prompt1_history;
   PromptHistory prompt2_history;
   PromptHistory audit_prompt_history;
@@ -1574,10 +2693,20 @@ struct AppState {
 const char *modes[] = {"Feedback", "Verify", "Both", "Audit"};
 
 // Forward declarations
-// Optional override lets callers specify a mode without mutating state
+// Optional overrides let callers specify a mode, or another (already
+// validated) task directory, without mutating state; resume_dir continues
+// the checkpointed feedback run logged there, prompts replaces the Prompt 1
+// and Prompt 2 being edited, and fan_out is how many runs share
+// shared_image_suffix (see FanOutSize)
 std::string BuildCommand(const AppState &state,
                          const std::string &unique_suffix = "",
-                         int selected_mode_override = -1);
+                         int selected_mode_override = -1,
+                         const std::string &stage_gate_dir = "",
+                         const std::string &shared_image_suffix = "",
+                         const TaskValidation *task = nullptr,
+                         const std::string &resume_dir = "",
+                         const PromptVariant *prompts = nullptr,
+                         int fan_out = 0);
 
 #include <dirent.h>
 #include <sys/stat.h>
@@ -1591,72 +2720,19 @@ std::string BuildCommand(const AppState &state,
 //                                                       //
 ////////////////////////////////////////////////////////////
 
-bool FileExists(const std::string &path) {
-  struct stat buffer;
-  return (stat(path.c_str(), &buffer) == 0);
-}
-
-bool IsDirectory(const std::string &path) {
-  struct stat buffer;
-  if (stat(path.c_str(), &buffer) != 0)
-    return false;
-  return S_ISDIR(buffer.st_mode);
-}
-
-bool DirectoryExists(const std::string &path) {
-  if (path.empty())
-    return false;
-  return IsDirectory(path);
-}
-
-// Create directory recursively if it doesn't exist
-static bool CreateDirectoryRecursive(const std::string &path) {
-#ifdef _WIN32
-  // Create all intermediate directories
-  std::string current_path;
-  size_t pos = 0;
-  while ((pos = path.find_first_of("\\/", pos)) != std::string::npos) {
-    current_path = path.substr(0, pos);
-    if (!current_path.empty() && !DirectoryExists(current_path)) {
-      if (!CreateDirectoryA(current_path.c_str(), NULL)) {
-        DWORD error = GetLastError();
-        if (error != ERROR_ALREADY_EXISTS) {
-          return false;
-        }
-      }
-    }
-    pos++;
-  }
-  // Create the final directory
-  if (!DirectoryExists(path)) {
-    return CreateDirectoryA(path.c_str(), NULL) != 0;
-  }
-  return true;
-#else
-  // Use system mkdir -p
-  std::string cmd = "mkdir -p \"" + path + "\"";
-  return system(cmd.c_str()) == 0;
-#endif
-}
-
 // Global debug flag for console output
 static bool g_show_debug_console = false;
 // Height of custom title bar so content can be offset
 static float g_titlebar_height = 0.0f;
 
+// Debug console and dev log overlay messages. Callers on any thread only
+// queue the message; the logger's thread formats and writes it, so logging
+// never blocks on the terminal.
+static AsyncLogger g_debug_log{kDevLogMaxLines};
+
 // Console output helper for critical messages
 static void ConsoleLog(const std::string &msg) {
-  auto now = std::chrono::system_clock::now();
-  auto time_t = std::chrono::system_clock::to_time_t(now);
-  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                now.time_since_epoch()) %
-            1000;
-
-  char time_buffer[32];
-  std::strftime(time_buffer, sizeof(time_buffer), "%H:%M:%S",
-                std::localtime(&time_t));
-  printf("[%s.%03d] %s\n", time_buffer, (int)ms.count(), msg.c_str());
-  fflush(stdout);
+  g_debug_log.Log(msg, AsyncLogger::kConsole);
 }
 
 // Override abort function to prevent program termination (only if enabled via
@@ -1759,27 +2835,10 @@ static void CustomAssertHandler(const char *file, int line,
   // Don't call abort() - just log and continue
 }
 
-// DevLog helper (defined after AppState)
-static void DevLog(AppState &state, const std::string &msg) {
-  std::lock_guard<std::mutex> lock(state.dev_logs_mutex);
-  state.dev_logs.push_back(msg);
-  if (state.dev_logs.size() > 200)
-    state.dev_logs.erase(state.dev_logs.begin());
-
-  // Also output to console if debug mode is enabled
-  if (g_show_debug_console) {
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                  now.time_since_epoch()) %
-              1000;
-
-    char time_buffer[32];
-    std::strftime(time_buffer, sizeof(time_buffer), "%H:%M:%S",
-                  std::localtime(&time_t));
-    printf("[%s.%03d] %s\n", time_buffer, (int)ms.count(), msg.c_str());
-    fflush(stdout);
-  }
+// Dev log overlay message, also echoed to the console in debug mode
+static void DevLog(const std::string &msg) {
+  g_debug_log.Log(msg, AsyncLogger::kOverlay |
+                           (g_show_debug_console ? AsyncLogger::kConsole : 0));
 }
 
 // Validate ImGui state and log any issues
@@ -1792,38 +2851,288 @@ static void ValidateImGuiState(AppState &state) {
 
   // Check for common ID stack issues
   if (w && w->IDStack.Size < 1) {
-    DevLog(state,
-           "WARNING: IDStack.Size < 1, this may cause assertion failures");
+    DevLog("WARNING: IDStack.Size < 1, this may cause assertion failures");
   }
 
   // Check for stack imbalances
   if (g.ColorStack.Size < 0) {
-    DevLog(state,
-           "ERROR: ColorStack.Size < 0, PushStyleColor/PopStyleColor mismatch");
+    DevLog("ERROR: ColorStack.Size < 0, PushStyleColor/PopStyleColor mismatch");
   }
   if (g.StyleVarStack.Size < 0) {
-    DevLog(state,
-           "ERROR: StyleVarStack.Size < 0, PushStyleVar/PopStyleVar mismatch");
+    DevLog("ERROR: StyleVarStack.Size < 0, PushStyleVar/PopStyleVar mismatch");
   }
   if (g.FontStack.Size < 0) {
-    DevLog(state, "ERROR: FontStack.Size < 0, PushFont/PopFont mismatch");
+    DevLog("ERROR: FontStack.Size < 0, PushFont/PopFont mismatch");
   }
 
   // Check for window issues
   if (g.Windows.Size == 0) {
-    DevLog(state, "WARNING: No windows in context");
+    DevLog("WARNING: No windows in context");
   }
 
   // Additional ID stack debugging
   if (w) {
-    DevLog(state,
-           "IDStack debug: Size=" + std::to_string(w->IDStack.Size) +
+    DevLog("IDStack debug: Size=" + std::to_string(w->IDStack.Size) +
                ", ColorStack=" + std::to_string(g.ColorStack.Size) +
                ", StyleVarStack=" + std::to_string(g.StyleVarStack.Size) +
                ", FontStack=" + std::to_string(g.FontStack.Size));
   }
 }
 
+// Frames kept by the dev mode profiler, and zones recorded per frame
+static const size_t kProfileFrames = 300;
+static const size_t kProfileMaxZones = 512;
+
+// Scope profiler for dev mode. ProfileZone marks a scope on the render
+// thread; every frame's zones go into a ring of recent frames, which the
+// Frame Profiler window draws as a flame chart and can export as Chrome
+// trace JSON (chrome://tracing, ui.perfetto.dev). While disabled a zone
+// costs one branch.
+class FrameProfiler {
+public:
+  struct Zone {
+    const char *name; // string literal
+    int depth;
+    int64_t start_us; // since the start of the frame
+    int64_t end_us;
+    uint64_t allocs; // heap allocations made inside the zone
+  };
+  struct Frame {
+    int64_t start_us = 0; // since the profiler was created
+    int64_t total_us = 0;
+    uint64_t allocs = 0;
+    std::vector<Zone> zones;
+  };
+
+  // Recording starts with the next frame and stops after the current one
+  void SetEnabled(bool enabled) { enabled_ = enabled; }
+
+  void BeginFrame() {
+    if (!enabled_)
+      return;
+    current_.zones.clear();
+    current_.zones.reserve(kProfileMaxZones); // so Push does not allocate
+    current_.start_us = Now();
+    current_.allocs = HeapAllocCount();
+    depth_ = 0;
+    in_frame_ = true;
+  }
+
+  void EndFrame() {
+    if (!in_frame_)
+      return;
+    in_frame_ = false;
+    current_.total_us = Now() - current_.start_us;
+    current_.allocs = HeapAllocCount() - current_.allocs;
+    std::swap(frames_[next_ % kProfileFrames], current_);
+    next_++;
+  }
+
+  // Index of the opened zone, or -1 when nothing is recorded
+  int Push(const char *name) {
+    if (!in_frame_ || current_.zones.size() >= kProfileMaxZones)
+      return -1;
+    current_.zones.push_back(
+        {name, depth_++, Now() - current_.start_us, 0, HeapAllocCount()});
+    return (int)current_.zones.size() - 1;
+  }
+
+  void Pop(int index) {
+    if (index < 0 || !in_frame_)
+      return;
+    Zone &zone = current_.zones[index];
+    zone.end_us = Now() - current_.start_us;
+    zone.allocs = HeapAllocCount() - zone.allocs;
+    depth_--;
+  }
+
+  size_t FrameCount() const { return std::min(next_, kProfileFrames); }
+  // Kept frames by age: 0 is the oldest
+  const Frame &GetFrame(size_t i) const {
+    return frames_[(next_ - FrameCount() + i) % kProfileFrames];
+  }
+
+  // Frame time percentile (0-100) over the kept frames, in milliseconds
+  double FramePercentileMs(double percentile) const {
+    size_t n = FrameCount();
+    if (n == 0)
+      return 0.0;
+    std::vector<int64_t> totals;
+    totals.reserve(n);
+    for (size_t i = 0; i < n; i++)
+      totals.push_back(GetFrame(i).total_us);
+    size_t k = std::min(n - 1, (size_t)(percentile / 100.0 * n));
+    std::nth_element(totals.begin(), totals.begin() + k, totals.end());
+    return totals[k] / 1000.0;
+  }
+
+  // Write the kept frames as Chrome trace events: one "X" event per frame
+  // and per zone, nested by time. Returns false if the file cannot be
+  // written.
+  bool ExportChromeTrace(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto event = [&](const char *name, int64_t ts, int64_t dur) {
+      out << (first ? "\n" : ",\n") << "{\"name\":\"" << name
+          << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << ts
+          << ",\"dur\":" << dur << "}";
+      first = false;
+    };
+    for (size_t i = 0; i < FrameCount(); i++) {
+      const Frame &frame = GetFrame(i);
+      event("Frame", frame.start_us, frame.total_us);
+      for (const auto &zone : frame.zones)
+        event(zone.name, frame.start_us + zone.start_us,
+              zone.end_us - zone.start_us);
+    }
+    out << "\n]}\n";
+    return (bool)out;
+  }
+
+private:
+  int64_t Now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - epoch_)
+        .count();
+  }
+
+  bool enabled_ = false;
+  bool in_frame_ = false;
+  int depth_ = 0;
+  Frame current_;
+  std::vector<Frame> frames_{kProfileFrames};
+  size_t next_ = 0;
+  std::chrono::steady_clock::time_point epoch_ =
+      std::chrono::steady_clock::now();
+};
+
+static FrameProfiler g_frame_profiler;
+
+#ifdef AUTOBUILD_GUI_OPENGL
+// GPU time of the ImGui draw pass, shown in the Frame Profiler next to the
+// CPU frame times
+static GpuPassTimers g_gpu_timers;
+static int g_gpu_imgui_pass = -1;
+#endif
+
+// Records the enclosing scope as a zone of the current frame
+class ProfileZone {
+public:
+  explicit ProfileZone(const char *name)
+      : index_(g_frame_profiler.Push(name)) {}
+  ~ProfileZone() { g_frame_profiler.Pop(index_); }
+  ProfileZone(const ProfileZone &) = delete;
+  ProfileZone &operator=(const ProfileZone &) = delete;
+
+private:
+  int index_;
+};
+
+// Scratch memory for one frame: widget labels, IDs and formatted text that
+// only have to live until ImGui has drawn them. Allocating is a pointer
+// bump, and Reset at the start of a frame rewinds it. A frame that
+// overflows the block gets more; the next Reset folds them into one block
+// that size, so once the arena has grown to a frame's peak it stops going
+// to the heap. Render thread only.
+class FrameArena {
+public:
+  char *Alloc(size_t n) {
+    if (n > cap_ - used_)
+      Grow(n);
+    char *p = block_ + used_;
+    used_ += n;
+    return p;
+  }
+
+  // printf into the arena, NUL terminated
+  const char *Format(const char *fmt, ...) IM_FMTARGS(2) {
+    va_list args;
+    va_start(args, fmt);
+    const char *text = FormatV(fmt, args);
+    va_end(args);
+    return text;
+  }
+
+  const char *FormatV(const char *fmt, va_list args) {
+    va_list retry;
+    va_copy(retry, args);
+    int len = vsnprintf(block_ + used_, cap_ - used_, fmt, args);
+    if (len < 0)
+      len = 0;
+    if ((size_t)len >= cap_ - used_) {
+      Grow((size_t)len + 1);
+      vsnprintf(block_ + used_, cap_ - used_, fmt, retry);
+    }
+    va_end(retry);
+    char *text = block_ + used_;
+    used_ += (size_t)len + 1;
+    return text;
+  }
+
+  // The parts one after another, NUL terminated
+  const char *Concat(std::initializer_list<std::string_view> parts) {
+    size_t len = 0;
+    for (std::string_view part : parts)
+      len += part.size();
+    char *text = Alloc(len + 1);
+    char *out = text;
+    for (std::string_view part : parts) {
+      memcpy(out, part.data(), part.size());
+      out += part.size();
+    }
+    *out = '\0';
+    return text;
+  }
+
+  void Reset() {
+    if (blocks_.size() > 1) {
+      size_t peak = retired_ + used_;
+      blocks_.clear();
+      retired_ = used_ = cap_ = 0;
+      Grow(peak);
+    }
+    used_ = 0;
+  }
+
+private:
+  static constexpr size_t kMinBlock = 64 * 1024;
+
+  void Grow(size_t n) {
+    retired_ += used_;
+    size_t size = std::max({n, kMinBlock, cap_ * 2});
+    blocks_.emplace_back(new char[size]);
+    block_ = blocks_.back().get();
+    cap_ = size;
+    used_ = 0;
+  }
+
+  std::vector<std::unique_ptr<char[]>> blocks_; // the current one is last
+  char *block_ = nullptr;
+  size_t cap_ = 0;
+  size_t used_ = 0;
+  size_t retired_ = 0; // bytes used in this frame's earlier blocks
+};
+
+static FrameArena g_frame_arena;
+
+// Text that lives until the next frame, for labels and IDs built from
+// values: FrameText("Delete##%d", i), FrameConcat({ICON_FA_COG " ", name})
+static const char *FrameText(const char *fmt, ...) IM_FMTARGS(1);
+static const char *FrameText(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  const char *text = g_frame_arena.FormatV(fmt, args);
+  va_end(args);
+  return text;
+}
+
+static const char *FrameConcat(std::initializer_list<std::string_view> parts) {
+  return g_frame_arena.Concat(parts);
+}
+
 // Forward declaration for helper used by overlay buttons
 static void FixImGuiIDStack(AppState &state);
 
@@ -1869,18 +3178,38 @@ static void RenderDevOverlay(AppState &state, ImGuiIO &io) {
       ImGui::Text("HoveredID: 0x%08X", g.HoveredId);
       ImGui::Separator();
 
+      // Last frame's time and allocations, and the heap when counted
+      if (size_t frames = g_frame_profiler.FrameCount()) {
+        const FrameProfiler::Frame &last =
+            g_frame_profiler.GetFrame(frames - 1);
+        ImGui::Text("Frame: %.2f ms, %llu allocations",
+                    last.total_us / 1000.0, (unsigned long long)last.allocs);
+      }
+      if (g_heap_accounting.load())
+        ImGui::Text("Heap: %.1f MB live, %.1f MB peak",
+                    g_heap_total.live.load() / 1e6,
+                    g_heap_total.peak.load() / 1e6);
+      bool accounting = g_heap_accounting.load();
+      if (ImGui::Checkbox("Count heap bytes", &accounting))
+        g_heap_accounting = accounting;
+      ImGui::SameLine();
+      if (ImGui::Button(state.show_heap ? "Hide Heap" : "Show Heap"))
+        state.show_heap = !state.show_heap;
+      ImGui::Separator();
+
       {
-        std::lock_guard<std::mutex> lock(state.dev_logs_mutex);
-        for (int i = (int)state.dev_logs.size() - 1;
-             i >= 0 && i >= (int)state.dev_logs.size() - 10; --i) {
-          ImGui::TextWrapped("%s", state.dev_logs[i].c_str());
-        }
+        g_debug_log.ReadOverlay([](const LogArena &dev_logs) {
+          for (int i = (int)dev_logs.size() - 1;
+               i >= 0 && i >= (int)dev_logs.size() - 10; --i) {
+            std::string_view entry = dev_logs[i];
+            ImGui::TextWrapped("%.*s", (int)entry.size(), entry.data());
+          }
+        });
       }
 
       ImGui::Separator();
       if (ImGui::Button("Clear Logs")) {
-        std::lock_guard<std::mutex> lock(state.dev_logs_mutex);
-        state.dev_logs.clear();
+        g_debug_log.ClearOverlay();
       }
       ImGui::SameLine();
       if (ImGui::Button("Force ID Stack Check")) {
@@ -1893,8 +3222,8 @@ static void RenderDevOverlay(AppState &state, ImGuiIO &io) {
         state.show_metrics = !state.show_metrics;
         if (state.show_metrics)
           state.bring_front_metrics = true;
-        DevLog(state, state.show_metrics ? "Metrics window opened"
-                                         : "Metrics window closed");
+        DevLog(state.show_metrics ? "Metrics window opened"
+                                  : "Metrics window closed");
       }
       ImGui::SameLine();
       if (ImGui::Button(state.show_style_editor ? "Hide Style Editor"
@@ -1902,17 +3231,24 @@ static void RenderDevOverlay(AppState &state, ImGuiIO &io) {
         state.show_style_editor = !state.show_style_editor;
         if (state.show_style_editor)
           state.bring_front_style = true;
-        DevLog(state, state.show_style_editor ? "Style editor opened"
-                                              : "Style editor closed");
+        DevLog(state.show_style_editor ? "Style editor opened"
+                                       : "Style editor closed");
+      }
+      ImGui::SameLine();
+      if (ImGui::Button(state.show_profiler ? "Hide Profiler"
+                                            : "Show Profiler")) {
+        state.show_profiler = !state.show_profiler;
+        DevLog(state.show_profiler ? "Profiler opened" : "Profiler closed");
       }
+#ifndef IMGUI_DISABLE_DEMO_WINDOWS
       ImGui::SameLine();
       if (ImGui::Button(state.show_demo ? "Hide Demo" : "Show Demo")) {
         state.show_demo = !state.show_demo;
         if (state.show_demo)
           state.bring_front_demo = true;
-        DevLog(state,
-               state.show_demo ? "Demo window opened" : "Demo window closed");
+        DevLog(state.show_demo ? "Demo window opened" : "Demo window closed");
       }
+#endif
 
       ImGui::TextDisabled(
           "(Window is draggable - Use Ctrl+D to toggle dev mode)");
@@ -1922,12 +3258,12 @@ static void RenderDevOverlay(AppState &state, ImGuiIO &io) {
     // No close button: overlay is controlled only by Ctrl+D
   } catch (const std::exception &e) {
     std::string error_msg = "EXCEPTION in dev window: " + std::string(e.what());
-    DevLog(state, error_msg);
+    DevLog(error_msg);
     if (g_show_debug_console)
       ConsoleLog("ERROR: " + error_msg);
   } catch (...) {
     std::string error_msg = "UNKNOWN EXCEPTION in dev window";
-    DevLog(state, error_msg);
+    DevLog(error_msg);
     if (g_show_debug_console)
       ConsoleLog("ERROR: " + error_msg);
   }
@@ -1942,12 +3278,11 @@ static void FixImGuiIDStack(AppState &state) {
   ImGuiWindow *w = g.CurrentWindow;
   if (w) {
     if (w->IDStack.Size <= 1) {
-      DevLog(state,
-             "FIXING: IDStack.Size <= 1 observed (no mutation performed)");
-      DevLog(state, "DEBUG: Current window: " +
-                        std::string(w->Name ? w->Name : "NULL"));
-      DevLog(state, "DEBUG: Window flags: " + std::to_string(w->Flags));
-      DevLog(state, "DEBUG: Window ID: " + std::to_string(w->ID));
+      DevLog("FIXING: IDStack.Size <= 1 observed (no mutation performed)");
+      DevLog("DEBUG: Current window: " +
+                 std::string(w->Name ? w->Name : "NULL"));
+      DevLog("DEBUG: Window flags: " + std::to_string(w->Flags));
+      DevLog("DEBUG: Window ID: " + std::to_string(w->ID));
     }
   }
 }
@@ -1973,13 +3308,12 @@ static void TrackIDStackChanges(AppState &state) {
   if (w) {
     int current_size = w->IDStack.Size;
     if (last_id_stack_size != -1 && current_size != last_id_stack_size) {
-      DevLog(state, "ID STACK CHANGE: " + std::to_string(last_id_stack_size) +
-                        " -> " + std::to_string(current_size));
+      DevLog("ID STACK CHANGE: " + std::to_string(last_id_stack_size) +
+                 " -> " + std::to_string(current_size));
       if (current_size < last_id_stack_size) {
-        DevLog(state,
-               "WARNING: ID stack decreased - possible PopID without PushID");
+        DevLog("WARNING: ID stack decreased - possible PopID without PushID");
       } else {
-        DevLog(state, "INFO: ID stack increased - PushID called");
+        DevLog("INFO: ID stack increased - PushID called");
       }
     }
     last_id_stack_size = current_size;
@@ -2012,24 +3346,24 @@ struct ImGuiStateTracker {
 
       // Check for stack imbalances
       if (w && w->IDStack.Size != initial_id_stack_size) {
-        DevLog(state, "WARNING: IDStack size changed from " +
-                          std::to_string(initial_id_stack_size) + " to " +
-                          std::to_string(w->IDStack.Size));
+        DevLog("WARNING: IDStack size changed from " +
+                   std::to_string(initial_id_stack_size) + " to " +
+                   std::to_string(w->IDStack.Size));
       }
       if (g.ColorStack.Size != initial_color_stack_size) {
-        DevLog(state, "WARNING: ColorStack size changed from " +
-                          std::to_string(initial_color_stack_size) + " to " +
-                          std::to_string(g.ColorStack.Size));
+        DevLog("WARNING: ColorStack size changed from " +
+                   std::to_string(initial_color_stack_size) + " to " +
+                   std::to_string(g.ColorStack.Size));
       }
       if (g.StyleVarStack.Size != initial_style_var_stack_size) {
-        DevLog(state, "WARNING: StyleVarStack size changed from " +
-                          std::to_string(initial_style_var_stack_size) +
-                          " to " + std::to_string(g.StyleVarStack.Size));
+        DevLog("WARNING: StyleVarStack size changed from " +
+                   std::to_string(initial_style_var_stack_size) +
+                   " to " + std::to_string(g.StyleVarStack.Size));
       }
       if (g.FontStack.Size != initial_font_stack_size) {
-        DevLog(state, "WARNING: FontStack size changed from " +
-                          std::to_string(initial_font_stack_size) + " to " +
-                          std::to_string(g.FontStack.Size));
+        DevLog("WARNING: FontStack size changed from " +
+                   std::to_string(initial_font_stack_size) + " to " +
+                   std::to_string(g.FontStack.Size));
       }
     }
   }
@@ -2085,6 +3419,20 @@ struct ImGuiTabItemScope {
   operator bool() const { return began; }
 };
 
+// RAII for Combo
+struct ImGuiComboScope {
+  bool began{false};
+  ImGuiComboScope(const char *label, const char *preview,
+                  ImGuiComboFlags flags = 0) {
+    began = ImGui::BeginCombo(label, preview, flags);
+  }
+  ~ImGuiComboScope() {
+    if (began)
+      ImGui::EndCombo();
+  }
+  operator bool() const { return began; }
+};
+
 // RAII for Popup modal
 struct ImGuiPopupModalScope {
   bool began{false};
@@ -2161,6 +3509,15 @@ struct ImGuiTextWrapScope {
   }
 };
 
+// RAII for an ID stack entry; list rows push their index or id, which
+// needs no label string per row
+struct ImGuiIDScope {
+  explicit ImGuiIDScope(int id) { ImGui::PushID(id); }
+  ~ImGuiIDScope() { ImGui::PopID(); }
+  ImGuiIDScope(const ImGuiIDScope &) = delete;
+  ImGuiIDScope &operator=(const ImGuiIDScope &) = delete;
+};
+
 ////////////////////////////////////////////////////////////
 //                                                       //
 //              ANIMATION & UI COMPONENTS                //
@@ -2172,13 +3529,14 @@ bool AnimatedButton(const char *label, const ImVec2 &size = ImVec2(0, 0),
                     const char *animation_id = nullptr) {
   if (!animation_id)
     animation_id = label;
+  AnimationId base_key = AnimationKey(animation_id);
+  AnimationId hover_key = AnimationKey("_hover", base_key);
+  AnimationId click_key = AnimationKey("_click", base_key);
 
   // Get hover animation value
   float hover_scale = 1.0f;
-  if (g_animation_manager.IsAnimationPlaying(std::string(animation_id) +
-                                             "_hover")) {
-    auto &anim =
-        g_animation_manager.GetAnimation(std::string(animation_id) + "_hover");
+  if (g_animation_manager.IsAnimationPlaying(hover_key)) {
+    auto &anim = g_animation_manager.GetAnimation(hover_key);
     anim.start_value = 1.0f;
     anim.end_value = 1.05f;
     hover_scale = anim.GetValue();
@@ -2199,20 +3557,15 @@ bool AnimatedButton(const char *label, const ImVec2 &size = ImVec2(0, 0),
   bool hovered = ImGui::IsItemHovered();
 
   // Start hover animation
-  if (hovered && !g_animation_manager.IsAnimationPlaying(
-                     std::string(animation_id) + "_hover")) {
-    g_animation_manager.StartAnimation(std::string(animation_id) + "_hover",
-                                       0.2f);
-  } else if (!hovered && g_animation_manager.IsAnimationPlaying(
-                             std::string(animation_id) + "_hover")) {
-    g_animation_manager.StopAnimation(std::string(animation_id) + "_hover");
+  if (hovered && !g_animation_manager.IsAnimationPlaying(hover_key)) {
+    g_animation_manager.StartAnimation(hover_key, 0.2f);
+  } else if (!hovered && g_animation_manager.IsAnimationPlaying(hover_key)) {
+    g_animation_manager.StopAnimation(hover_key);
   }
 
   // Start click animation
-  if (clicked && !g_animation_manager.IsAnimationPlaying(
-                     std::string(animation_id) + "_click")) {
-    g_animation_manager.StartAnimation(std::string(animation_id) + "_click",
-                                       0.1f);
+  if (clicked && !g_animation_manager.IsAnimationPlaying(click_key)) {
+    g_animation_manager.StartAnimation(click_key, 0.1f);
   }
 
   return clicked;
@@ -2224,30 +3577,27 @@ void AnimatedProgressBar(float fraction, const ImVec2 &size = ImVec2(-1, 0),
                          const char *animation_id = nullptr) {
   if (!animation_id)
     animation_id = "progress";
+  AnimationId base_key = AnimationKey(animation_id);
+  AnimationId pulse_key = AnimationKey("_pulse", base_key);
+  AnimationId text_key = AnimationKey("_text", base_key);
 
   // Start pulsing animation for active progress
   if (fraction > 0.0f && fraction < 1.0f) {
-    if (!g_animation_manager.IsAnimationPlaying(std::string(animation_id) +
-                                                "_pulse")) {
-      g_animation_manager.StartAnimation(std::string(animation_id) + "_pulse",
-                                         1.0f, true);
+    if (!g_animation_manager.IsAnimationPlaying(pulse_key)) {
+      g_animation_manager.StartAnimation(pulse_key, 1.0f, true);
     }
-    if (!g_animation_manager.IsAnimationPlaying(std::string(animation_id) +
-                                                "_text")) {
-      g_animation_manager.StartAnimation(std::string(animation_id) + "_text",
-                                         2.0f, true);
+    if (!g_animation_manager.IsAnimationPlaying(text_key)) {
+      g_animation_manager.StartAnimation(text_key, 2.0f, true);
     }
   } else {
-    g_animation_manager.StopAnimation(std::string(animation_id) + "_pulse");
-    g_animation_manager.StopAnimation(std::string(animation_id) + "_text");
+    g_animation_manager.StopAnimation(pulse_key);
+    g_animation_manager.StopAnimation(text_key);
   }
 
   // Get pulse animation value
   float pulse_alpha = 1.0f;
-  if (g_animation_manager.IsAnimationPlaying(std::string(animation_id) +
-                                             "_pulse")) {
-    auto &anim =
-        g_animation_manager.GetAnimation(std::string(animation_id) + "_pulse");
+  if (g_animation_manager.IsAnimationPlaying(pulse_key)) {
+    auto &anim = g_animation_manager.GetAnimation(pulse_key);
     anim.start_value = 0.7f;
     anim.end_value = 1.0f;
     pulse_alpha = anim.GetValue();
@@ -2255,11 +3605,8 @@ void AnimatedProgressBar(float fraction, const ImVec2 &size = ImVec2(-1, 0),
 
   // Get text animation value for moving dots
   std::string animated_overlay = overlay ? overlay : "";
-  if (g_animation_manager.IsAnimationPlaying(std::string(animation_id) +
-                                             "_text") &&
-      overlay) {
-    auto &text_anim =
-        g_animation_manager.GetAnimation(std::string(animation_id) + "_text");
+  if (g_animation_manager.IsAnimationPlaying(text_key) && overlay) {
+    auto &text_anim = g_animation_manager.GetAnimation(text_key);
     text_anim.start_value = 0.0f;
     text_anim.end_value = 1.0f;
     float text_progress = text_anim.GetValue();
@@ -2350,27 +3697,25 @@ void AnimatedStatusIndicator(const char *text, ImVec4 color,
                              const char *animation_id = nullptr) {
   if (!animation_id)
     animation_id = "status";
+  AnimationId pulse_key = AnimationKey("_pulse", AnimationKey(animation_id));
 
   ImVec4 display_color = color;
 
   if (is_active) {
     // Start pulsing animation for active status
-    if (!g_animation_manager.IsAnimationPlaying(std::string(animation_id) +
-                                                "_pulse")) {
-      g_animation_manager.StartAnimation(std::string(animation_id) + "_pulse",
-                                         1.5f, true);
+    if (!g_animation_manager.IsAnimationPlaying(pulse_key)) {
+      g_animation_manager.StartAnimation(pulse_key, 1.5f, true);
     }
 
     // Get pulse animation value
-    auto &anim =
-        g_animation_manager.GetAnimation(std::string(animation_id) + "_pulse");
+    auto &anim = g_animation_manager.GetAnimation(pulse_key);
     anim.start_value = 0.6f;
     anim.end_value = 1.0f;
     float pulse_alpha = anim.GetValue();
 
     display_color = ImVec4(color.x, color.y, color.z, color.w * pulse_alpha);
   } else {
-    g_animation_manager.StopAnimation(std::string(animation_id) + "_pulse");
+    g_animation_manager.StopAnimation(pulse_key);
   }
 
   ImGui::TextColored(display_color, "%s", text);
@@ -2383,17 +3728,15 @@ void AnimatedLoadingSpinner(const char *label = "Loading...",
                             float speed = 2.0f) {
   if (!animation_id)
     animation_id = "spinner";
+  AnimationId spin_key = AnimationKey("_spin", AnimationKey(animation_id));
 
   // Start spinning animation with custom speed
-  if (!g_animation_manager.IsAnimationPlaying(std::string(animation_id) +
-                                              "_spin")) {
-    g_animation_manager.StartAnimation(std::string(animation_id) + "_spin",
-                                       speed, true);
+  if (!g_animation_manager.IsAnimationPlaying(spin_key)) {
+    g_animation_manager.StartAnimation(spin_key, speed, true);
   }
 
   // Get rotation value
-  auto &anim =
-      g_animation_manager.GetAnimation(std::string(animation_id) + "_spin");
+  auto &anim = g_animation_manager.GetAnimation(spin_key);
   anim.start_value = 0.0f;
   anim.end_value = 360.0f;
   float rotation = anim.GetValue();
@@ -2423,29 +3766,7 @@ void AnimatedLoadingSpinner(const char *label = "Loading...",
   ImGui::Text("%s", label);
 }
 
-// Recursively delete a directory and its contents
-static bool RemoveDirectoryRecursive(const std::string &path) {
-  if (!DirectoryExists(path))
-    return false;
-  DIR *dir = opendir(path.c_str());
-  if (!dir)
-    return false;
-  struct dirent *ent;
-  while ((ent = readdir(dir)) != NULL) {
-    if (ent->d_name[0] == '.')
-      continue;
-    std::string child = path + "/" + ent->d_name;
-    if (IsDirectory(child)) {
-      RemoveDirectoryRecursive(child);
-    } else {
-      remove(child.c_str());
-    }
-  }
-  closedir(dir);
-  // Remove the now-empty directory
-  int rc = rmdir(path.c_str());
-  return rc == 0;
-}
+static TrashBin g_trash{g_jobs};
 
 // Config file management with JSON format
 // Get platform-specific config file path
@@ -2469,12 +3790,32 @@ static std::string GetPromptsFilePath() {
 #endif
 }
 
+// Recompute whether prompt index (0=Prompt1, 1=Prompt2, 2=Audit) differs
+// from its default. A keystroke compares only the prompt being edited: ImGui
+// reports that the text changed but not where, so an incremental hash would
+// need its own pass over the text, and one memcmp of a prompt costs less
+// than ImGui's own relayout of it after the edit.
+static void UpdatePromptModified(AppState &state, int index) {
+  const std::string *texts[3][2] = {
+      {&state.prompt1_modified, &state.prompt1_original},
+      {&state.prompt2_modified, &state.prompt2_original},
+      {&state.audit_prompt_modified, &state.audit_prompt_original}};
+  state.prompt_differs[index] = *texts[index][0] != *texts[index][1];
+  state.prompts_modified = state.prompt_differs[0] ||
+                           state.prompt_differs[1] || state.prompt_differs[2];
+}
+
+static void UpdatePromptsModified(AppState &state) {
+  for (int i = 0; i < 3; i++)
+    UpdatePromptModified(state, i);
+}
+
 static void InitializeDefaultPrompts(AppState &state) {
   if (state.prompts_loaded) {
     return; // Already initialized
   }
 
-  DevLog(state, "InitializeDefaultPrompts: Setting default prompts");
+  DevLog("InitializeDefaultPrompts: Setting default prompts");
 
   state.prompt1_original = R"(**Task:** 
 
@@ -2535,14 +3876,14 @@ Constraints:
   state.prompt2_modified = state.prompt2_original;
   state.audit_prompt_modified = state.audit_prompt_original;
   state.prompts_loaded = true;
-  state.prompts_modified = false;
-
-  DevLog(state, "InitializeDefaultPrompts: Prompt1 length=" +
-                    std::to_string(state.prompt1_original.length()));
-  DevLog(state, "InitializeDefaultPrompts: Prompt2 length=" +
-                    std::to_string(state.prompt2_original.length()));
-  DevLog(state, "InitializeDefaultPrompts: Audit length=" +
-                    std::to_string(state.audit_prompt_original.length()));
+  UpdatePromptsModified(state);
+
+  DevLog("InitializeDefaultPrompts: Prompt1 length=" +
+             std::to_string(state.prompt1_original.length()));
+  DevLog("InitializeDefaultPrompts: Prompt2 length=" +
+             std::to_string(state.prompt2_original.length()));
+  DevLog("InitializeDefaultPrompts: Audit length=" +
+             std::to_string(state.audit_prompt_original.length()));
 }
 
 static std::string GetConfigFilePath() {
@@ -2599,510 +3940,257 @@ static std::string GetConfigFilePath() {
 #endif
 }
 
-// Simple JSON escape function
-std::string JsonEscape(const std::string &str) {
-  std::string escaped;
-  for (char c : str) {
-    if (c == '"')
-      escaped += "\\\"";
-    else if (c == '\\')
-      escaped += "\\\\";
-    else if (c == '\n')
-      escaped += "\\n";
-    else if (c == '\r')
-      escaped += "\\r";
-    else if (c == '\t')
-      escaped += "\\t";
-    else
-      escaped += c;
-  }
-  return escaped;
-}
-
-// Simple JSON unescape function
-std::string JsonUnescape(const std::string &str) {
-  std::string unescaped;
-  bool escaping = false;
-  for (char c : str) {
-    if (escaping) {
-      if (c == 'n')
-        unescaped += '\n';
-      else if (c == 'r')
-        unescaped += '\r';
-      else if (c == 't')
-        unescaped += '\t';
-      else
-        unescaped += c;
-      escaping = false;
-    } else if (c == '\\') {
-      escaping = true;
-    } else {
-      unescaped += c;
-    }
-  }
-  return unescaped;
-}
-
 ////////////////////////////////////////////////////////////
 //                                                       //
 //              CONFIGURATION & FILE I/O                 //
 //                                                       //
 ////////////////////////////////////////////////////////////
 
+static SettingsWatcher g_settings_watcher{
+    {[]() { HeapThread("Settings watcher", kHeapOther); },
+     [](const std::string &path) {
+       WakeMainLoop();
+       if (g_show_debug_console) {
+         ConsoleLog("[INFO] Settings file changed on disk: " + path);
+       }
+     }}};
+
+static FileSaver g_file_saver{
+    {[]() { HeapThread("File saver", kHeapOther); },
+     [](const std::string &path, const std::string &contents) {
+       g_settings_watcher.Writing(path, contents);
+     },
+     [](const std::string &path, size_t bytes, bool ok) {
+       if (!g_show_debug_console)
+         return;
+       if (!ok)
+         ConsoleLog("[ERROR] Could not save " + path);
+       else
+         ConsoleLog("[DEBUG] Saved " + path + " (" + std::to_string(bytes) +
+                    " bytes)");
+     }}};
+
+// Parse the settings file at path into root. Returns false when the file
+// is missing or does not hold a JSON object; a malformed file is reported
+// on the debug console.
+static bool ReadJsonFile(const std::string &path, JsonValue &root) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  root = JsonValue();
+  if (!JsonParser(content).Parse(root) || root.type != JsonValue::Object) {
+    if (g_show_debug_console) {
+      ConsoleLog("[ERROR] Ignoring malformed settings file: " + path);
+    }
+    root = JsonValue();
+    return false;
+  }
+  return true;
+}
+
 void SaveConfig(const AppState &state) {
-  std::string config_path = GetConfigFilePath();
+  // The path lookup creates the config directory; do that once
+  static const std::string config_path = GetConfigFilePath();
   if (g_show_debug_console) {
     ConsoleLog("[DEBUG] Saving config to: " + config_path);
   }
-  std::ofstream file(config_path);
-  if (file.is_open()) {
-    file << "{\n";
-
-    // Save log folder paths as JSON array
-    file << "  \"log_folder_paths\": [";
-    for (size_t i = 0; i < state.log_folder_paths.size(); i++) {
-      file << "\"" << JsonEscape(state.log_folder_paths[i]) << "\"";
-      if (i < state.log_folder_paths.size() - 1)
-        file << ", ";
-    }
-    file << "],\n";
-
-    file << "  \"selected_log_folder\": " << state.selected_log_folder << ",\n";
-    file << "  \"task_directory\": \"" << JsonEscape(state.task_directory)
-         << "\",\n";
-    file << "  \"build_dir\": \"" << JsonEscape(state.build_dir) << "\",\n";
-    file << "  \"api_key\": \"" << JsonEscape(state.api_key) << "\",\n";
-    file << "  \"auto_lowercase_names\": "
-         << (state.auto_lowercase_names ? "true" : "false") << ",\n";
-    file << "  \"max_concurrent_tasks\": " << state.max_concurrent_tasks
-         << ",\n";
-    file << "  \"use_docker_no_cache\": "
-         << (state.use_docker_no_cache ? "true" : "false") << ",\n";
-    file << "  \"use_docker_debug\": "
-         << (state.use_docker_debug ? "true" : "false") << ",\n";
-    file << "  \"feedback_count\": " << state.feedback_count << ",\n";
-    file << "  \"verify_count\": " << state.verify_count << ",\n";
-    file << "  \"both_count\": " << state.both_count << ",\n";
-    file << "  \"audit_count\": " << state.audit_count << "\n";
-    file << "}\n";
-    file.close();
-  }
+  g_file_saver.Submit(config_path, SerializeAppSettings(state));
 }
 
-void SavePrompts(const AppState &state) {
-  std::string prompts_path = GetPromptsFilePath();
-  DevLog(const_cast<AppState &>(state), "Saving prompts to: " + prompts_path);
+// The prompt texts are also written one per file under prompts.d/ next to
+// prompts.json, so autobuild.sh can read them without a JSON parser
+static const char *const kPromptKeys[] = {"prompt1", "prompt2",
+                                          "audit_prompt"};
+
+// A prompt's history is saved as <prefix>_base (the oldest kept text),
+// <prefix>_edits (flat [pos, removed, inserted, ...] triples) and
+// <prefix>_index (the current step)
+static void WritePromptHistory(JsonWriter &json, const std::string &prefix,
+                               const PromptHistory &history) {
+  json.String((prefix + "_base").c_str(), history.base());
+  json.BeginArray((prefix + "_edits").c_str());
+  for (size_t i = 0; i < history.edit_count(); i++) {
+    const PromptHistory::Edit &e = history.edit(i);
+    json.Item((long long)e.pos).Item(e.removed).Item(e.inserted);
+  }
+  json.EndArray();
+  json.Number((prefix + "_index").c_str(), history.index());
+}
 
-  // Create directory if it doesn't exist
-  size_t last_slash = prompts_path.find_last_of("/\\");
-  if (last_slash != std::string::npos) {
-    std::string dir = prompts_path.substr(0, last_slash);
-    CreateDirectoryRecursive(dir);
+static void ReadPromptHistory(const JsonValue &root, const std::string &prefix,
+                              PromptHistory &history) {
+  int index = root.GetInt((prefix + "_index").c_str(), -1);
+  if (index < 0)
+    return;
+  const JsonValue *base = root.Find((prefix + "_base").c_str());
+  const JsonValue *edits = root.Find((prefix + "_edits").c_str());
+  if (base && base->type == JsonValue::String && edits &&
+      edits->type == JsonValue::Array) {
+    std::vector<PromptHistory::Edit> list;
+    const std::vector<JsonValue> &items = edits->items;
+    for (size_t i = 0; i + 2 < items.size(); i += 3) {
+      if (items[i].type != JsonValue::Number || items[i].number < 0 ||
+          items[i + 1].type != JsonValue::String ||
+          items[i + 2].type != JsonValue::String)
+        return;
+      PromptHistory::Edit e;
+      e.pos = (size_t)items[i].number;
+      e.removed = items[i + 1].str;
+      e.inserted = items[i + 2].str;
+      list.push_back(std::move(e));
+    }
+    history.Restore(base->str, std::move(list), index);
+    return;
   }
+  // Files from older versions hold every state in full under <prefix>
+  for (const auto &text : root.GetStrings(prefix.c_str()))
+    history.Push(text);
+  while (history.index() > index)
+    history.Undo();
+}
 
-  std::ofstream file(prompts_path);
-  if (!file.is_open()) {
-    DevLog(const_cast<AppState &>(state),
-           "ERROR: Failed to open prompts file for writing: " + prompts_path);
-    return;
+void SavePrompts(const AppState &state) {
+  // The path lookups create the prompts directories; do that once
+  static const std::string prompts_path = GetPromptsFilePath();
+  static const std::string cache_dir =
+      prompts_path.substr(0, prompts_path.size() - 5) + ".d";
+  static const bool cache_ok = CreateDirectoryRecursive(cache_dir);
+  DevLog("Saving prompts to: " + prompts_path);
+
+  JsonWriter json;
+  json.String("prompt1", state.prompt1_modified)
+      .String("prompt2", state.prompt2_modified)
+      .String("audit_prompt", state.audit_prompt_modified);
+  WritePromptHistory(json, "prompt1_history", state.prompt1_history);
+  WritePromptHistory(json, "prompt2_history", state.prompt2_history);
+  WritePromptHistory(json, "audit_history", state.audit_prompt_history);
+  // Flat [name, prompt1, prompt2, in_matrix, ...] quadruples
+  json.BeginArray("prompt_variants");
+  for (const auto &variant : state.prompt_variants) {
+    json.Item(variant.name).Item(variant.prompt1).Item(variant.prompt2);
+    json.Item((long long)variant.in_matrix);
+  }
+  json.EndArray();
+
+  // Written (and reported on the debug console) by the saver thread, in
+  // submission order: the script trusts a cached prompt only when it is not
+  // older than prompts.json
+  g_file_saver.Submit(prompts_path, json.Finish());
+  if (cache_ok) {
+    const std::string *texts[] = {&state.prompt1_modified,
+                                  &state.prompt2_modified,
+                                  &state.audit_prompt_modified};
+    for (size_t i = 0; i < 3; i++)
+      g_file_saver.Submit(cache_dir + "/" + kPromptKeys[i] + ".txt",
+                          *texts[i]);
   }
+}
 
-  file << "{\n";
-  file << "  \"prompt1\": \"" << JsonEscape(state.prompt1_modified) << "\",\n";
-  file << "  \"prompt2\": \"" << JsonEscape(state.prompt2_modified) << "\",\n";
-  file << "  \"audit_prompt\": \"" << JsonEscape(state.audit_prompt_modified)
-       << "\",\n";
+static void ApplyPrompts(AppState &state, const JsonValue &root);
 
-  // Save history stacks
-  file << "  \"prompt1_history\": [";
-  for (size_t i = 0; i < state.prompt1_history.history.size(); i++) {
-    if (i > 0)
-      file << ", ";
-    file << "\"" << JsonEscape(state.prompt1_history.history[i]) << "\"";
-  }
-  file << "],\n";
-  file << "  \"prompt1_history_index\": " << state.prompt1_history.current_index
-       << ",\n";
-
-  file << "  \"prompt2_history\": [";
-  for (size_t i = 0; i < state.prompt2_history.history.size(); i++) {
-    if (i > 0)
-      file << ", ";
-    file << "\"" << JsonEscape(state.prompt2_history.history[i]) << "\"";
-  }
-  file << "],\n";
-  file << "  \"prompt2_history_index\": " << state.prompt2_history.current_index
-       << ",\n";
-
-  file << "  \"audit_history\": [";
-  for (size_t i = 0; i < state.audit_prompt_history.history.size(); i++) {
-    if (i > 0)
-      file << ", ";
-    file << "\"" << JsonEscape(state.audit_prompt_history.history[i]) << "\"";
-  }
-  file << "],\n";
-  file << "  \"audit_history_index\": "
-       << state.audit_prompt_history.current_index << "\n";
-
-  file << "}\n";
-
-  file.close();
-
-  // Verify file was written
-  std::ifstream verify(prompts_path);
-  if (verify.is_open()) {
-    verify.seekg(0, std::ios::end);
-    size_t file_size = verify.tellg();
-    verify.close();
-    DevLog(const_cast<AppState &>(state),
-           "Prompts saved successfully (file size: " +
-               std::to_string(file_size) + " bytes)");
-  } else {
-    DevLog(const_cast<AppState &>(state), "ERROR: Could not verify saved file");
-  }
-}
-
-void LoadPrompts(AppState &state) {
-  if (!state.prompts_loaded) {
-    InitializeDefaultPrompts(state);
+void LoadPrompts(AppState &state) {
+  if (!state.prompts_loaded) {
+    InitializeDefaultPrompts(state);
   }
 
   std::string prompts_path = GetPromptsFilePath();
-  DevLog(state, "Loading prompts from: " + prompts_path);
+  DevLog("Loading prompts from: " + prompts_path);
 
-  std::ifstream file(prompts_path);
-  if (!file.is_open()) {
-    DevLog(state, "Prompts file not found, using defaults: " + prompts_path);
+  JsonValue root;
+  if (!ReadJsonFile(prompts_path, root)) {
+    DevLog("Prompts file not found, using defaults: " + prompts_path);
     return;
   }
+  ApplyPrompts(state, root);
+}
 
-  // Read entire file into a string
-  std::string content((std::istreambuf_iterator<char>(file)),
-                      std::istreambuf_iterator<char>());
-  file.close();
-
-  // Simple JSON parsing for each key
-  auto extractValue = [&content](const std::string &key) -> std::string {
-    std::string search = "\"" + key + "\": \"";
-    size_t start = content.find(search);
-    if (start == std::string::npos) {
-      return "";
-    }
-    start += search.length();
-
-    // Find the closing quote, handling escaped quotes
-    size_t end = start;
-    while (end < content.length()) {
-      if (content[end] == '\"' && (end == 0 || content[end - 1] != '\\')) {
-        break;
-      }
-      end++;
-    }
-
-    if (end >= content.length()) {
-      return "";
-    }
-
-    std::string escaped_value = content.substr(start, end - start);
-    return JsonUnescape(escaped_value);
-  };
-
-  auto extractInt = [&content](const std::string &key) -> int {
-    std::string search = "\"" + key + "\": ";
-    size_t start = content.find(search);
-    if (start == std::string::npos) {
-      return -1;
-    }
-    start += search.length();
-
-    size_t end = start;
-    while (end < content.length() &&
-           (std::isdigit(content[end]) || content[end] == '-')) {
-      end++;
-    }
-
-    if (end == start)
-      return -1;
-
-    try {
-      return std::stoi(content.substr(start, end - start));
-    } catch (...) {
-      return -1;
-    }
-  };
-
-  auto extractArray =
-      [&content](const std::string &key) -> std::vector<std::string> {
-    std::vector<std::string> result;
-    std::string search = "\"" + key + "\": [";
-    size_t start = content.find(search);
-    if (start == std::string::npos) {
-      return result;
-    }
-    start += search.length();
-
-    size_t end = content.find(']', start);
-    if (end == std::string::npos) {
-      return result;
-    }
-
-    std::string array_content = content.substr(start, end - start);
-    size_t pos = 0;
-
-    while (pos < array_content.length()) {
-      // Find opening quote
-      size_t quote_start = array_content.find('\"', pos);
-      if (quote_start == std::string::npos)
-        break;
-      quote_start++;
-
-      // Find closing quote, handling escapes
-      size_t quote_end = quote_start;
-      while (quote_end < array_content.length()) {
-        if (array_content[quote_end] == '\"' &&
-            (quote_end == 0 || array_content[quote_end - 1] != '\\')) {
-          break;
-        }
-        quote_end++;
-      }
-
-      if (quote_end >= array_content.length())
-        break;
-
-      std::string value =
-          array_content.substr(quote_start, quote_end - quote_start);
-      result.push_back(JsonUnescape(value));
-      pos = quote_end + 1;
-    }
-
-    return result;
-  };
-
-  std::string loaded_prompt1 = extractValue("prompt1");
-  std::string loaded_prompt2 = extractValue("prompt2");
-  std::string loaded_audit = extractValue("audit_prompt");
+// The prompt texts and undo histories of a prompts.json document; at startup
+// and when the file is changed by something else (see SettingsWatcher)
+static void ApplyPrompts(AppState &state, const JsonValue &root) {
+  std::string loaded_prompt1 = root.GetString("prompt1");
+  std::string loaded_prompt2 = root.GetString("prompt2");
+  std::string loaded_audit = root.GetString("audit_prompt");
 
   // Only update if values were found
   if (!loaded_prompt1.empty()) {
     state.prompt1_modified = loaded_prompt1;
-    DevLog(state, "  Loaded Prompt1, length=" +
-                      std::to_string(loaded_prompt1.length()));
+    DevLog("  Loaded Prompt1, length=" +
+               std::to_string(loaded_prompt1.length()));
   }
   if (!loaded_prompt2.empty()) {
     state.prompt2_modified = loaded_prompt2;
-    DevLog(state, "  Loaded Prompt2, length=" +
-                      std::to_string(loaded_prompt2.length()));
+    DevLog("  Loaded Prompt2, length=" +
+               std::to_string(loaded_prompt2.length()));
   }
   if (!loaded_audit.empty()) {
     state.audit_prompt_modified = loaded_audit;
-    DevLog(state,
-           "  Loaded Audit, length=" + std::to_string(loaded_audit.length()));
+    DevLog("  Loaded Audit, length=" + std::to_string(loaded_audit.length()));
   }
 
   // Load history stacks
-  auto loadHistory = [&](AppState::PromptHistory &history,
-                         const std::string &array_key,
-                         const std::string &index_key,
-                         const std::string &name) {
-    std::vector<std::string> history_data = extractArray(array_key);
-    int history_index = extractInt(index_key);
-
-    if (!history_data.empty() && history_index >= 0) {
-      history.history = history_data;
-      history.current_index =
-          std::min(history_index, (int)history_data.size() - 1);
-      DevLog(state,
-             "  Loaded " + name +
-                 " history: " + std::to_string(history.history.size()) +
-                 " entries, index=" + std::to_string(history.current_index));
+  auto loadHistory = [&](PromptHistory &history, const std::string &prefix,
+                         const std::string &text, const std::string &name) {
+    ReadPromptHistory(root, prefix, history);
+    if (history.empty())
+      return;
+    // Validate history consistency
+    if (history.current() != text) {
+      DevLog("  WARNING: " + name + " history inconsistent, resetting");
+      history.Clear();
+      return;
     }
+    DevLog("  Loaded " + name +
+               " history: " + std::to_string(history.size()) +
+               " entries, index=" + std::to_string(history.index()));
   };
 
-  loadHistory(state.prompt1_history, "prompt1_history", "prompt1_history_index",
+  loadHistory(state.prompt1_history, "prompt1_history", state.prompt1_modified,
               "Prompt1");
-  loadHistory(state.prompt2_history, "prompt2_history", "prompt2_history_index",
+  loadHistory(state.prompt2_history, "prompt2_history", state.prompt2_modified,
               "Prompt2");
   loadHistory(state.audit_prompt_history, "audit_history",
-              "audit_history_index", "Audit");
-
-  // Validate history consistency
-  if (!state.prompt1_history.history.empty() &&
-      state.prompt1_history.current_index >= 0 &&
-      state.prompt1_history.current_index <
-          (int)state.prompt1_history.history.size()) {
-    if (state.prompt1_history.history[state.prompt1_history.current_index] !=
-        state.prompt1_modified) {
-      DevLog(state, "  WARNING: Prompt1 history inconsistent, resetting");
-      state.prompt1_history.history.clear();
-      state.prompt1_history.current_index = -1;
-    }
-  }
-
-  if (!state.prompt2_history.history.empty() &&
-      state.prompt2_history.current_index >= 0 &&
-      state.prompt2_history.current_index <
-          (int)state.prompt2_history.history.size()) {
-    if (state.prompt2_history.history[state.prompt2_history.current_index] !=
-        state.prompt2_modified) {
-      DevLog(state, "  WARNING: Prompt2 history inconsistent, resetting");
-      state.prompt2_history.history.clear();
-      state.prompt2_history.current_index = -1;
-    }
-  }
-
-  if (!state.audit_prompt_history.history.empty() &&
-      state.audit_prompt_history.current_index >= 0 &&
-      state.audit_prompt_history.current_index <
-          (int)state.audit_prompt_history.history.size()) {
-    if (state.audit_prompt_history
-            .history[state.audit_prompt_history.current_index] !=
-        state.audit_prompt_modified) {
-      DevLog(state, "  WARNING: Audit history inconsistent, resetting");
-      state.audit_prompt_history.history.clear();
-      state.audit_prompt_history.current_index = -1;
+              state.audit_prompt_modified, "Audit");
+
+  const JsonValue *variants = root.Find("prompt_variants");
+  if (variants && variants->type == JsonValue::Array) {
+    state.prompt_variants.clear();
+    const std::vector<JsonValue> &items = variants->items;
+    for (size_t i = 0; i + 3 < items.size(); i += 4) {
+      if (items[i].type != JsonValue::String ||
+          items[i + 1].type != JsonValue::String ||
+          items[i + 2].type != JsonValue::String)
+        break;
+      PromptVariant variant;
+      variant.name = items[i].str;
+      variant.prompt1 = items[i + 1].str;
+      variant.prompt2 = items[i + 2].str;
+      variant.in_matrix = items[i + 3].number != 0;
+      state.prompt_variants.push_back(std::move(variant));
     }
   }
 
   // Check if modified prompts differ from originals
-  state.prompts_modified =
-      (state.prompt1_modified != state.prompt1_original) ||
-      (state.prompt2_modified != state.prompt2_original) ||
-      (state.audit_prompt_modified != state.audit_prompt_original);
+  UpdatePromptsModified(state);
 
-  DevLog(state, "Prompts loaded successfully. Modified: " +
-                    std::string(state.prompts_modified ? "Yes" : "No"));
+  DevLog("Prompts loaded successfully. Modified: " +
+             std::string(state.prompts_modified ? "Yes" : "No"));
 }
 
+static void ApplyConfig(AppState &state, const JsonValue &root);
+
 void LoadConfig(AppState &state) {
   std::string config_path = GetConfigFilePath();
   if (g_show_debug_console) {
     ConsoleLog("[DEBUG] Loading config from: " + config_path);
   }
-  std::ifstream file(config_path);
-  if (file.is_open()) {
-    std::string line;
-    bool in_array = false;
-    while (std::getline(file, line)) {
-      // Handle log_folder_paths array
-      if (line.find("\"log_folder_paths\"") != std::string::npos) {
-        in_array = true;
-        state.log_folder_paths.clear();
-
-        // Parse array on same line or next lines
-        size_t bracket_start = line.find('[');
-        size_t bracket_end = line.find(']');
-        if (bracket_start != std::string::npos &&
-            bracket_end != std::string::npos) {
-          std::string array_content =
-              line.substr(bracket_start + 1, bracket_end - bracket_start - 1);
-          size_t pos = 0;
-          while (pos < array_content.length()) {
-            size_t start = array_content.find('"', pos);
-            if (start == std::string::npos)
-              break;
-            size_t end = array_content.find('"', start + 1);
-            if (end == std::string::npos)
-              break;
-            std::string path = array_content.substr(start + 1, end - start - 1);
-            state.log_folder_paths.push_back(JsonUnescape(path));
-            pos = end + 1;
-          }
-          in_array = false;
-        }
-        continue;
-      }
-
-      // Simple JSON parsing (key-value pairs)
-      size_t colon_pos = line.find(':');
-      if (colon_pos != std::string::npos) {
-        // Extract key
-        size_t key_start = line.find('"');
-        size_t key_end = line.find('"', key_start + 1);
-        if (key_start == std::string::npos || key_end == std::string::npos)
-          continue;
-        std::string key = line.substr(key_start + 1, key_end - key_start - 1);
-
-        if (key == "selected_log_folder" || key == "max_concurrent_tasks" ||
-            key == "feedback_count" || key == "verify_count" ||
-            key == "both_count" || key == "audit_count") {
-          // Extract numeric value
-          size_t num_start = line.find(':', colon_pos) + 1;
-          std::string num_str = line.substr(num_start);
-          int value = std::atoi(num_str.c_str());
-          if (key == "selected_log_folder") {
-            state.selected_log_folder = value;
-          } else if (key == "max_concurrent_tasks") {
-            state.max_concurrent_tasks = value;
-            if (state.max_concurrent_tasks < 1)
-              state.max_concurrent_tasks = 1;
-            if (state.max_concurrent_tasks > 20)
-              state.max_concurrent_tasks = 20;
-          } else if (key == "feedback_count") {
-            state.feedback_count = value;
-            if (state.feedback_count < 1)
-              state.feedback_count = 1;
-          } else if (key == "verify_count") {
-            state.verify_count = value;
-            if (state.verify_count < 1)
-              state.verify_count = 1;
-          } else if (key == "both_count") {
-            state.both_count = value;
-            if (state.both_count < 1)
-              state.both_count = 1;
-          } else if (key == "audit_count") {
-            state.audit_count = value;
-            if (state.audit_count < 1)
-              state.audit_count = 1;
-          }
-        } else if (key == "auto_lowercase_names" ||
-                   key == "use_docker_no_cache" || key == "use_docker_debug") {
-          // Extract boolean value
-          bool bool_value = (line.find("true") != std::string::npos);
-          if (key == "auto_lowercase_names") {
-            state.auto_lowercase_names = bool_value;
-          } else if (key == "use_docker_no_cache") {
-            state.use_docker_no_cache = bool_value;
-          } else if (key == "use_docker_debug") {
-            state.use_docker_debug = bool_value;
-          }
-        } else {
-          // Extract string value
-          size_t val_start = line.find('"', colon_pos);
-          size_t val_end = line.rfind('"');
-          if (val_start == std::string::npos || val_end == std::string::npos ||
-              val_start >= val_end)
-            continue;
-          std::string value =
-              line.substr(val_start + 1, val_end - val_start - 1);
-          value = JsonUnescape(value);
-
-          if (key == "task_directory") {
-            // Never load task_directory from cache - always start fresh
-            // state.task_directory = value;  // Commented out
-          } else if (key == "build_dir") {
-            state.build_dir = value;
-          } else if (key == "api_key") {
-            state.api_key = value;
-          }
-        }
-      }
-    }
-    file.close();
-
-    // If no log paths loaded, add absolute default
-    if (state.log_folder_paths.empty()) {
-      std::string default_logs_path = ResolveDefaultLogsPath();
-      state.log_folder_paths.push_back(default_logs_path);
-      // Ensure the default logs directory exists
-      CreateDirectoryRecursive(default_logs_path);
-    }
+  JsonValue root;
+  if (ReadJsonFile(config_path, root))
+    ApplyConfig(state, root);
 
-    // Ensure selected index is valid
-    if (state.selected_log_folder >= (int)state.log_folder_paths.size()) {
-      state.selected_log_folder = 0;
-    }
-  } else {
-    // Default log path if no config file
+  // Default log path if none were configured
+  if (state.log_folder_paths.empty()) {
     std::string default_logs_path = ResolveDefaultLogsPath();
     state.log_folder_paths.push_back(default_logs_path);
     // Ensure the default logs directory exists
@@ -3110,6 +4198,27 @@ void LoadConfig(AppState &state) {
   }
 }
 
+// The settings in a config document (see ApplyAppSettings), then what
+// depends on them in the GUI
+static void ApplyConfig(AppState &state, const JsonValue &root) {
+  std::vector<std::string> ignored;
+  ApplyAppSettings(root, state, ignored);
+  if (g_show_debug_console) {
+    for (const auto &message : ignored)
+      ConsoleLog("[WARN] " + message);
+  }
+#ifdef _WIN32
+  SetExecBackend(state.use_wsl, state.wsl_distro);
+#endif
+
+  // Ensure selected index is valid
+  if (state.selected_log_folder >= (int)state.log_folder_paths.size()) {
+    state.selected_log_folder = 0;
+  }
+
+  SetLogSeverityRules(state.log_severity_rules);
+}
+
 // Validate Dockerfile name (lowercase, proper conventions)
 bool ValidateDockerfileName(const std::string &filename) {
   // Check if filename contains uppercase letters
@@ -3132,125 +4241,139 @@ bool ValidateDockerfileName(const std::string &filename) {
   return false;
 }
 
-TaskValidation ValidateTaskDirectory(const std::string &task_dir) {
-  TaskValidation val;
-  val.missing_items.clear();
-  val.found_items.clear();
-
-  if (task_dir.empty())
-    return val;
-
-  // Check env/ directory
-  std::string env_dir = task_dir + "/env";
-  if (IsDirectory(env_dir)) {
-    val.has_env_dir = true;
-    val.found_items.push_back("[OK] env/ directory");
+static TaskValidator g_task_validator{
+    {[]() { HeapThread("Task validator", kHeapTasks); },
+     [](const std::string &dir) {
+       WakeMainLoop();
+       if (g_show_debug_console && !dir.empty()) {
+         ConsoleLog("[DEBUG] Validated task directory: " + dir);
+       }
+     }}};
+
+// Validates every subdirectory of a parent folder as a task directory on
+// the job pool: an I/O job lists the folder and each subdirectory then gets
+// a compute job of its own. The results (sorted by folder name) are
+// published on the UI thread once the last one is in; starting another
+// scan cancels the current one.
+class TaskBatchScanner {
+public:
+  void Scan(const std::string &parent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_)
+      return;
+    if (batch_)
+      batch_->token.Cancel();
+    batch_ = std::make_shared<Batch>();
+    batch_->parent = parent;
+    parent_ = parent;
+    results_.reset();
+    scanning_ = true;
+    std::shared_ptr<Batch> batch = batch_;
+    g_jobs.Submit(
+        JobLane::Io, JobPriority::Interactive,
+        [this, batch](const CancelToken &) { List(batch); }, batch->token);
+  }
 
-    // Check for Dockerfile in env/ (accept both cases)
-    std::string dockerfile_upper = env_dir + "/Dockerfile";
-    std::string dockerfile_lower = env_dir + "/dockerfile";
+  bool Scanning() const { return scanning_; }
 
-    if (FileExists(dockerfile_upper)) {
-      val.has_dockerfile = true;
-      val.found_items.push_back("[OK] env/Dockerfile");
-    } else if (FileExists(dockerfile_lower)) {
-      val.has_dockerfile = true;
-      val.found_items.push_back("[OK] env/dockerfile");
-    } else {
-      val.missing_items.push_back("[X] env/Dockerfile or env/dockerfile");
-    }
-  } else {
-    val.missing_items.push_back("[X] env/ directory");
-    val.missing_items.push_back("[X] env/Dockerfile");
+  void Progress(size_t &done, size_t &total) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done = batch_ ? batch_->done.load() : 0;
+    total = batch_ ? batch_->total.load() : 0;
   }
 
-  // Check verify/ directory
-  std::string verify_dir = task_dir + "/verify";
-  if (IsDirectory(verify_dir)) {
-    val.has_verify_dir = true;
-    val.found_items.push_back("[OK] verify/ directory");
-
-    // Check for verify.sh
-    std::string verify_sh = verify_dir + "/verify.sh";
-    if (FileExists(verify_sh)) {
-      val.has_verify_sh = true;
-      val.found_items.push_back("[OK] verify/verify.sh");
-    } else {
-      val.missing_items.push_back("[X] verify/verify.sh");
-    }
+  // Parent folder of the last scan and its results (null until complete)
+  std::string Parent() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return parent_;
+  }
+  std::shared_ptr<const std::vector<TaskValidation>> Results() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return results_;
+  }
 
-    // Check for verification_command (optional)
-    std::string verify_cmd = verify_dir + "/verification_command";
-    if (FileExists(verify_cmd)) {
-      val.found_items.push_back("[OK] verify/verification_command (optional)");
-    }
+  void Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    if (batch_)
+      batch_->token.Cancel();
+  }
+
+private:
+  struct Batch {
+    std::string parent;
+    std::vector<std::string> names;
+    std::vector<TaskValidation> results;
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> total{0};
+    CancelToken token;
+  };
 
-    // List additional files in verify/ (exclude verify.sh and command files)
-    DIR *vdir = opendir(verify_dir.c_str());
-    if (vdir) {
-      struct dirent *entry;
-      while ((entry = readdir(vdir)) != NULL) {
-        const char *name = entry->d_name;
-        if (!name || name[0] == '.')
-          continue;
-        std::string base(name);
-        if (base == "verify.sh" || base == "command" ||
-            base == "verification_command")
-          continue;
-        std::string full_path = verify_dir + "/" + base;
-        struct stat st{};
-        if (stat(full_path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
-          val.found_items.push_back(std::string("[OK] verify/") + base +
-                                    " (extra)");
-        }
-      }
-      closedir(vdir);
-    }
-  } else {
-    val.missing_items.push_back("[X] verify/ directory");
-    val.missing_items.push_back("[X] verify/verify.sh");
-  }
-
-  // Check for prompt (file or directory)
-  std::string prompt_file = task_dir + "/prompt";
-  std::string prompt_txt = task_dir + "/prompt.txt";
-  std::string prompt_dir = task_dir + "/prompt";
-
-  if (FileExists(prompt_file) && !IsDirectory(prompt_file)) {
-    val.has_prompt = true;
-    val.prompt_location = "prompt (file)";
-    val.found_items.push_back("[OK] prompt (file)");
-  } else if (FileExists(prompt_txt)) {
-    val.has_prompt = true;
-    val.prompt_location = "prompt.txt";
-    val.found_items.push_back("[OK] prompt.txt");
-  } else if (IsDirectory(prompt_dir)) {
-    val.has_prompt = true;
-    val.prompt_location = "prompt/ (directory)";
-    val.found_items.push_back("[OK] prompt/ directory");
-
-    // Check if prompt/ contains at least one file
-    DIR *dir = opendir(prompt_dir.c_str());
-    bool has_files = false;
-    if (dir) {
-      struct dirent *entry;
-      while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] != '.') {
-          has_files = true;
-          break;
-        }
+  void List(const std::shared_ptr<Batch> &batch) {
+    std::string parent = batch->parent;
+    while (parent.size() > 1 &&
+           (parent.back() == '/' || parent.back() == '\\'))
+      parent.pop_back();
+    std::vector<std::string> names;
+    DIR *d = opendir(parent.c_str());
+    if (d) {
+      struct dirent *e;
+      while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] != '.' && IsDirectory(parent + "/" + e->d_name))
+          names.push_back(e->d_name);
       }
-      closedir(dir);
+      closedir(d);
     }
-    if (!has_files) {
-      val.missing_items.push_back("[!] prompt/ directory is empty");
+    std::sort(names.begin(), names.end());
+    batch->parent = parent;
+    batch->names = std::move(names);
+    batch->results.resize(batch->names.size());
+    batch->total = batch->names.size();
+    if (batch->names.empty()) {
+      Finish(batch);
+      return;
     }
-  } else {
-    val.missing_items.push_back("[X] prompt or prompt.txt or prompt/");
+    for (size_t i = 0; i < batch->names.size(); i++)
+      g_jobs.Submit(
+          JobLane::Compute, JobPriority::Interactive,
+          [this, batch, i](const CancelToken &) {
+            batch->results[i] =
+                ValidateTaskDirectory(batch->parent + "/" + batch->names[i]);
+            size_t done = ++batch->done;
+            if (done == batch->total)
+              Finish(batch);
+            else if (done % 32 == 0)
+              WakeMainLoop();
+          },
+          batch->token);
+  }
+
+  // Last folder validated: publish on the UI thread unless superseded
+  void Finish(const std::shared_ptr<Batch> &batch) {
+    g_jobs.Post([this, batch]() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (batch != batch_ || batch->token.Cancelled())
+        return;
+      results_ = std::make_shared<const std::vector<TaskValidation>>(
+          std::move(batch->results));
+      scanning_ = false;
+      if (g_show_debug_console) {
+        ConsoleLog("[DEBUG] Validated " +
+                   std::to_string(batch->names.size()) +
+                   " task folder(s) under " + batch->parent);
+      }
+    });
   }
 
-  return val;
-}
+  std::mutex mutex_;
+  std::shared_ptr<Batch> batch_;
+  std::string parent_;
+  std::shared_ptr<const std::vector<TaskValidation>> results_;
+  std::atomic<bool> scanning_{false};
+  bool stop_ = false;
+};
+
+static TaskBatchScanner g_task_batch;
 
 void SetModernStyle() {
   ImGuiStyle &style = ImGui::GetStyle();
@@ -3321,456 +4444,640 @@ void SetModernStyle() {
   style.WindowPadding = ImVec2(12, 12);
 }
 
-// NEW: Enhanced streaming with process handle capture for termination
+// Raise the calling (render) thread's priority per state.raise_gui_priority,
+// or put it back. Linux needs CAP_SYS_NICE or an RLIMIT_NICE allowance to
+// go below nice 0; gui_priority_denied records a refusal, in which case the
+// backgrounded runs are what keeps the render thread ahead.
+static void ApplyGuiThreadPriority(AppState &state) {
+  bool raised = state.raise_gui_priority;
 #ifdef _WIN32
-static bool RunHiddenStreamExeWithHandle(
-    const std::string &exe, const std::string &args,
-    const std::function<void(const std::string &)> &onLine,
-    DWORD &out_exit_code, HANDLE &out_process_handle,
-    std::atomic<bool> &should_stop) {
-  out_exit_code = 0;
-  out_process_handle = NULL;
-
-  SECURITY_ATTRIBUTES sa{};
-  sa.nLength = sizeof(sa);
-  sa.bInheritHandle = TRUE;
-  sa.lpSecurityDescriptor = NULL;
-  HANDLE hRead = NULL, hWrite = NULL;
-  if (!CreatePipe(&hRead, &hWrite, &sa, 0))
-    return false;
-  SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
+  bool ok = SetThreadPriority(GetCurrentThread(),
+                              raised ? THREAD_PRIORITY_ABOVE_NORMAL
+                                     : THREAD_PRIORITY_NORMAL) != 0;
+#elif defined(__APPLE__)
+  bool ok = pthread_set_qos_class_self_np(raised ? QOS_CLASS_USER_INTERACTIVE
+                                                 : QOS_CLASS_DEFAULT,
+                                          0) == 0;
+#elif defined(__linux__)
+  bool ok = setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid),
+                        raised ? -5 : 0) == 0;
+#else
+  bool ok = !raised;
+#endif
+  state.gui_priority_denied = raised && !ok;
+  if (state.gui_priority_denied && g_show_debug_console)
+    ConsoleLog("[WARN] The OS refused a raised GUI thread priority");
+}
 
-  STARTUPINFOW si{};
-  si.cb = sizeof(si);
-  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
-  si.wShowWindow = SW_HIDE;
-  si.hStdOutput = hWrite;
-  si.hStdError = hWrite;
+// Runs every task process; hooked up to the debug console, the heap and
+// trace thread names and the log wakeups in main
+static ProcessReactor g_process_reactor;
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//              TASK MANAGEMENT & EXECUTION              //
+//                                                       //
+////////////////////////////////////////////////////////////
 
-  PROCESS_INFORMATION pi{};
+// Output lines a second a window takes in full, from
+// AppState::log_ingest_lines_per_sec
+static std::atomic<int> g_log_ingest_rate{5000};
+
+// Hand a line to the task's in-memory windows and live followers
+static void PublishTaskLine(TaskInstance &task, std::string_view line,
+                            uint8_t tag, int64_t ms) {
+  task.log_ring.Push(line, tag, ms);
+  if (tag == IngestThrottle::kMarkerTag)
+    tag = (uint8_t)LogSeverity::None;
+  if (task.shared_log)
+    task.shared_log->Append(line, tag, ms);
+  g_dashboard.Publish(task.id, std::string_view(), line);
+  if (task.queue_seq != 0)
+    g_submissions.Publish(task.queue_seq, line);
+}
 
-  std::wstring wExe = Widen(exe);
-  std::wstring wCmdLine = Widen(std::string("\"") + exe + "\" " + args);
-  BOOL ok = CreateProcessW(wExe.c_str(), &wCmdLine[0], NULL, NULL, TRUE,
-                           CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
-  if (!ok) {
-    CloseHandle(hRead);
-    CloseHandle(hWrite);
-    return false;
+// Record one line of task output: appended to the task's spool file and
+// queued for the render thread, tagged with its severity by the task's
+// classifier. The child's own output is throttled (see IngestThrottle);
+// the app's status lines always go through.
+static void PushTaskLog(TaskInstance &task, std::string_view line,
+                        bool throttled = false) {
+  uint32_t hits = 0;
+  LogSeverity severity = task.classifier
+                             ? task.classifier->Classify(line, &hits)
+                             : LogSeverity::None;
+  task.failures.Feed(line, severity, hits);
+  uint8_t tag = (uint8_t)severity;
+  int64_t ms = MonotonicMs();
+  if (task.spool)
+    task.spool->Append(line, ms);
+  task.last_output_ms.store(ms, std::memory_order_relaxed);
+  g_metrics.lines.fetch_add(1, std::memory_order_relaxed);
+  g_metrics.bytes.fetch_add(line.size(), std::memory_order_relaxed);
+  std::string marker;
+  int rate = throttled ? g_log_ingest_rate.load(std::memory_order_relaxed) : 0;
+  if (!task.ingest.Admit(rate, tag, ms, marker)) {
+    g_metrics.lines_skipped.fetch_add(1, std::memory_order_relaxed);
+    return;
   }
-  CloseHandle(hWrite);
-
-  out_process_handle = pi.hProcess;
+  if (!marker.empty())
+    PublishTaskLine(task, marker, IngestThrottle::kMarkerTag, ms);
+  PublishTaskLine(task, line, tag, ms);
+  g_log_seq.fetch_add(1, std::memory_order_release);
+}
 
-  std::string buffer;
-  buffer.reserve(4096);
-  char chunk[512];
-  DWORD bytes = 0;
-  while (!should_stop) {
-    DWORD wait_result = WaitForSingleObject(
-        pi.hProcess, 10); // Check every 10ms for maximum responsiveness
-    if (wait_result == WAIT_OBJECT_0)
-      break; // Process exited
+// autobuild.sh progress lines ("[INFO]  ...") that open each task phase
+static const struct {
+  const char *marker;
+  TaskPhase phase;
+} kTaskPhaseMarkers[] = {
+    {"Building image:", TaskPhase::Build},
+    {"Starting container", TaskPhase::Setup},
+    {"Installing Gemini CLI", TaskPhase::Setup},
+    {"Running Prompt 1", TaskPhase::Prompt},
+    {"running Prompt 2", TaskPhase::Prompt},
+    {"Running Gemini via npx", TaskPhase::Prompt},
+    {"Running audit prompt", TaskPhase::Prompt},
+    {"Running verification:", TaskPhase::Verify},
+    {"Executing verification", TaskPhase::Verify},
+};
 
-    BOOL r = ReadFile(hRead, chunk, sizeof(chunk), &bytes, NULL);
-    if (!r || bytes == 0)
-      continue;
-    buffer.append(chunk, chunk + bytes);
-    size_t pos = 0;
-    size_t nl;
-    while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-      if (nl > pos) {
-        std::string line = buffer.substr(pos, nl - pos);
-        // Strip ANSI escape sequences
-        line = stripAnsiCodes(line);
-        onLine(line);
-      }
-      size_t next = nl + 1;
-      if (next < buffer.size() &&
-          ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-           (buffer[nl] == '\n' && buffer[next] == '\r')))
-        next++;
-      pos = next;
-    }
-    if (pos > 0)
-      buffer.erase(0, pos);
-  }
-
-  if (should_stop) {
-    // Terminate the entire process tree, not just the immediate process
-    // This ensures Docker and all child processes are stopped
-    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-    if (hSnapshot != INVALID_HANDLE_VALUE) {
-      PROCESSENTRY32W pe32;
-      pe32.dwSize = sizeof(pe32);
-
-      if (Process32FirstW(hSnapshot, &pe32)) {
-        DWORD parent_pid = GetProcessId(pi.hProcess);
-        do {
-          if (pe32.th32ParentProcessID == parent_pid) {
-            HANDLE hChild =
-                OpenProcess(PROCESS_TERMINATE, FALSE, pe32.th32ProcessID);
-            if (hChild) {
-              TerminateProcess(hChild, 1);
-              CloseHandle(hChild);
-            }
-          }
-        } while (Process32NextW(hSnapshot, &pe32));
-      }
-      CloseHandle(hSnapshot);
+// Advance the task's phase if line is one of the script's phase markers
+static void TrackTaskPhase(TaskInstance &task, std::string_view line) {
+  if (line.size() < 6 || line.compare(0, 6, "[INFO]") != 0)
+    return;
+  for (const auto &m : kTaskPhaseMarkers) {
+    if (line.find(m.marker) != std::string_view::npos) {
+      task.phase = m.phase;
+      return;
     }
-
-    // Finally terminate the parent process
-    TerminateProcess(pi.hProcess, 1);
-    onLine("[STOPPED] Task was terminated by user");
   }
+}
 
-  // Read remaining output
-  while (true) {
-    BOOL r = ReadFile(hRead, chunk, sizeof(chunk), &bytes, NULL);
-    if (!r || bytes == 0)
-      break;
-    buffer.append(chunk, chunk + bytes);
-    size_t pos = 0;
-    size_t nl;
-    while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-      if (nl > pos) {
-        std::string line = buffer.substr(pos, nl - pos);
-        // Strip ANSI escape sequences
-        line = stripAnsiCodes(line);
-        onLine(line);
-      }
-      size_t next = nl + 1;
-      if (next < buffer.size() &&
-          ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-           (buffer[nl] == '\n' && buffer[next] == '\r')))
-        next++;
-      pos = next;
-    }
-    if (pos > 0)
-      buffer.erase(0, pos);
-  }
-  if (!buffer.empty())
-    onLine(buffer);
-
-  // Wait for process with timeout to prevent GUI freezing
-  DWORD wait_result =
-      WaitForSingleObject(pi.hProcess, 5000); // 5 second timeout
-  if (wait_result == WAIT_TIMEOUT) {
-    // Process is taking too long, terminate it
-    TerminateProcess(pi.hProcess, 1);
-    out_exit_code = 1;
-  } else {
-    GetExitCodeProcess(pi.hProcess, &out_exit_code);
+static const char *TaskPhaseName(TaskPhase phase) {
+  switch (phase) {
+  case TaskPhase::Starting:
+    return "Starting";
+  case TaskPhase::Build:
+    return "Building image";
+  case TaskPhase::Setup:
+    return "Setting up container";
+  case TaskPhase::Prompt:
+    return "Running prompt";
+  case TaskPhase::Verify:
+    return "Verifying";
   }
-  CloseHandle(pi.hThread);
-  CloseHandle(hRead);
-  return true;
+  return "";
 }
-#else
-// macOS/Linux version
-static bool RunHiddenStreamExeWithHandle(
-    const std::string &exe, const std::string &args,
-    const std::function<void(const std::string &)> &onLine, int &out_exit_code,
-    int &out_process_handle, std::atomic<bool> &should_stop) {
-  out_exit_code = 0;
-  out_process_handle = 0;
 
-  if (g_show_debug_console) {
-    ConsoleLog("[DEBUG][Mac/Linux] RunHiddenStreamExeWithHandle exe='" + exe +
-               "' args='" + args + "'");
-  }
+static ContainerLogIndex g_container_logs;
 
-  // Create pipes for stdout/stderr
-  int pipe_stdout[2], pipe_stderr[2];
-  if (pipe(pipe_stdout) == -1 || pipe(pipe_stderr) == -1) {
-    if (g_show_debug_console) {
-      ConsoleLog("[ERROR][Mac/Linux] Failed to create pipes: " +
-                 std::string(strerror(errno)));
-    }
-    return false;
-  }
+// Shared by the Docker GC and the Manage tab's disk usage analysis
+static ImageLayerCache g_image_layers;
 
-  // Fork the process
-  pid_t pid = fork();
-  if (pid == -1) {
-    if (g_show_debug_console) {
-      ConsoleLog("[ERROR][Mac/Linux] fork() failed: " +
-                 std::string(strerror(errno)));
-    }
-    close(pipe_stdout[0]);
-    close(pipe_stdout[1]);
-    close(pipe_stderr[0]);
-    close(pipe_stderr[1]);
-    return false;
-  }
+static std::string GuessLogPathForContainer(
+    const std::vector<std::string> &roots, const std::string &name);
 
-  if (pid == 0) {
-    // Child process
-    close(pipe_stdout[0]); // Close read end
-    close(pipe_stderr[0]); // Close read end
+// Path of the collector's record of removed objects
+static std::string DockerGcRecordPath() {
+  std::string config = GetConfigFilePath();
+  size_t slash = config.find_last_of("/\\");
+  return (slash == std::string::npos ? std::string()
+                                     : config.substr(0, slash + 1)) +
+         "docker_gc.jsonl";
+}
 
-    // Create new process group for proper termination
-    setpgid(0, 0);
+static DockerGarbageCollector g_docker_gc{
+    g_image_layers,
+    {[]() { HeapThread("Docker gc", kHeapDocker); },
+     [](const std::vector<std::string> &roots, const std::string &name) {
+       return GuessLogPathForContainer(roots, name);
+     },
+     [](const std::string &kind, const std::string &name,
+        const std::string &reason) {
+       if (g_show_debug_console)
+         ConsoleLog("[DEBUG] Docker GC removed " + kind + " " + name + " (" +
+                    reason + ")");
+     }}};
+
+// Hand the cleanup settings, logs roots and batch names to the collector
+static void ConfigureDockerGc(const AppState &state) {
+  DockerGcPolicy policy;
+  policy.keep_per_task = state.docker_gc_keep;
+  policy.ttl_hours = state.docker_gc_ttl_hours;
+  policy.disk_gb = state.docker_gc_disk_gb;
+  policy.log_roots = state.log_folder_paths;
+  std::string image = state.image_tag, container = state.container_name;
+  if (state.auto_lowercase_names) {
+    std::transform(image.begin(), image.end(), image.begin(), ::tolower);
+    std::transform(container.begin(), container.end(), container.begin(),
+                   ::tolower);
+  }
+  size_t slash = image.rfind('/');
+  size_t colon = image.find(':', slash == std::string::npos ? 0 : slash);
+  policy.image_repo = image.substr(0, colon);
+  policy.container_prefix = container;
+  policy.record_path = DockerGcRecordPath();
+  g_docker_gc.Configure(policy);
+}
 
-    // Redirect stdout and stderr to pipes
-    dup2(pipe_stdout[1], STDOUT_FILENO);
-    dup2(pipe_stderr[1], STDERR_FILENO);
-    close(pipe_stdout[1]);
-    close(pipe_stderr[1]);
+// Prompt pacing per Gemini API key, shared by every run (see ApiGovernor).
+// Runs are told apart by key without keeping the key itself.
+static ApiGovernor g_api_governor;
+
+// Hand one line of a phase log to its ring, failure scanner, BuildKit step
+// parser, Gemini call parser and the dashboard; line_no counts the log's
+// lines from 1. A request the CLI retries after a rate limit pauses its key
+// for every run, though the CLI itself may yet get through.
+static void PublishPhaseLine(PhaseLog &log, uint64_t line_no,
+                             std::string_view line) {
+  if (!line.empty() && line.back() == '\r')
+    line.remove_suffix(1);
+  uint32_t hits = 0;
+  LogSeverity severity = log.classifier ? log.classifier->Classify(line, &hits)
+                                        : LogSeverity::None;
+  log.failures.Feed(line, severity, hits);
+  double retry_after = 0.0;
+  if (log.prompt && log.gemini.Feed(line, retry_after)) {
+    g_api_governor.RateLimited(log.api_key_id, retry_after,
+                               log.gemini.stats().throttled,
+                               std::chrono::steady_clock::now());
+    WakeMainLoop(); // a gate may be waiting on the pause
+  }
+  int64_t ms = MonotonicMs();
+  if (!line.empty() && line[0] == '#') {
+    std::lock_guard<std::mutex> lock(log.steps_mutex);
+    log.build_steps.Feed(line, ms, line_no);
+  }
+  log.last_line_ms.store(ms, std::memory_order_relaxed);
+  std::string marker;
+  if (!log.ingest.Admit(g_log_ingest_rate.load(std::memory_order_relaxed),
+                        (uint8_t)severity, ms, marker)) {
+    g_metrics.lines_skipped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (!marker.empty()) {
+    log.ring.Push(marker, IngestThrottle::kMarkerTag, ms);
+    g_dashboard.Publish(log.task_id, log.name, marker);
+  }
+  log.ring.Push(line, (uint8_t)severity, ms);
+  g_dashboard.Publish(log.task_id, log.name, line);
+  g_log_seq.fetch_add(1, std::memory_order_release);
+}
 
-    // Build command array with proper shell parsing
-    std::string full_command = exe + " " + args;
-    std::vector<std::string> tokens = ParseShellCommand(full_command);
+static LogTailer g_log_tail{
+    {[]() {
+       TRACE_THREAD("Log tailer");
+       HeapThread("Log tailer", kHeapLogs);
+     },
+     [posted = uint64_t(0)]() mutable { WakeForNewLogs(posted); }}};
+
+// Follow log's file while its task runs, its lines going to
+// PublishPhaseLine; the ring's free space holds the tailer back
+static void FollowPhaseLog(const std::shared_ptr<PhaseLog> &log) {
+  LogTailer::Source source;
+  source.path = log->path;
+  source.room = [log]() { return log->ring.Free(); };
+  source.line = [log](uint64_t line_no, std::string_view line) {
+    PublishPhaseLine(*log, line_no, line);
+  };
+  source.finished = [log]() { return log->finished.load(); };
+  source.drained = [log]() { log->drained = true; };
+  g_log_tail.Follow(std::move(source));
+}
 
-    // Convert to char* array
-    std::vector<char *> argv;
-    for (auto &t : tokens) {
-      argv.push_back(const_cast<char *>(t.c_str()));
-    }
-    argv.push_back(nullptr);
+// A new PhaseLog of task for the file at path; null when the task already
+// has one for it (appended to again by a later command)
+static std::shared_ptr<PhaseLog> AddPhaseLog(TaskInstance &task,
+                                             const std::string &path) {
+  std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+  for (const auto &log : task.phase_logs) {
+    if (log->path == path)
+      return nullptr;
+  }
+  auto log = std::make_shared<PhaseLog>();
+  size_t slash = path.find_last_of("/\\");
+  log->name = slash == std::string::npos ? path : path.substr(slash + 1);
+  log->path = path;
+  log->task_id = task.id;
+  log->classifier = task.classifier;
+  log->prompt = log->name.compare(0, 7, "gemini_") == 0;
+  log->api_key_id = task.api_key_id;
+  task.phase_logs.push_back(log);
+  g_run_journal.Set(task.id, "phase_log", path);
+  return log;
+}
 
-    // Execute the command
-    execvp(exe.c_str(), argv.data());
-    exit(1); // If execvp fails
-  } else {
-    // Parent process
-    if (g_show_debug_console) {
-      ConsoleLog("[DEBUG][Mac/Linux] Forked process PID: " +
-                 std::to_string(pid));
-    }
-
-    close(pipe_stdout[1]); // Close write end
-    close(pipe_stderr[1]); // Close write end
-
-    out_process_handle = pid;
-
-    // Set pipes to non-blocking
-    int flags = fcntl(pipe_stdout[0], F_GETFL, 0);
-    fcntl(pipe_stdout[0], F_SETFL, flags | O_NONBLOCK);
-    flags = fcntl(pipe_stderr[0], F_GETFL, 0);
-    fcntl(pipe_stderr[0], F_SETFL, flags | O_NONBLOCK);
-
-    std::string buffer;
-    buffer.reserve(4096);
-    char chunk[512];
-    int bytes = 0;
-    int status;
-
-    while (!should_stop) {
-      // Check if process is still running
-      int wait_result = waitpid(pid, &status, WNOHANG);
-      if (wait_result == pid) {
-        // Process exited
-        if (g_show_debug_console) {
-          if (WIFEXITED(status)) {
-            ConsoleLog(
-                "[DEBUG][Mac/Linux] Process " + std::to_string(pid) +
-                " exited with code: " + std::to_string(WEXITSTATUS(status)));
-          } else if (WIFSIGNALED(status)) {
-            ConsoleLog(
-                "[DEBUG][Mac/Linux] Process " + std::to_string(pid) +
-                " terminated by signal: " + std::to_string(WTERMSIG(status)));
-          }
-        }
-        break;
-      }
+// Parse "[PHASE_LOG] <file>", printed by autobuild.sh's run_and_capture
+// before a command's output goes to that file, and start following it
+static void TrackPhaseLog(TaskInstance &task, std::string_view line) {
+  static const std::string_view kMarker = "[PHASE_LOG] ";
+  if (line.size() <= kMarker.size() ||
+      line.compare(0, kMarker.size(), kMarker) != 0)
+    return;
+  std::string path(line.substr(kMarker.size()));
+  while (!path.empty() && (path.back() == '\r' || path.back() == ' '))
+    path.pop_back();
+  if (path.empty())
+    return;
+#ifdef _WIN32
+  path = ConvertFromUnixPath(path);
+#endif
+  std::shared_ptr<PhaseLog> log = AddPhaseLog(task, path);
+  if (log)
+    FollowPhaseLog(log);
+}
 
-      // Read from stdout
-      bytes = read(pipe_stdout[0], chunk, sizeof(chunk));
-      if (bytes > 0) {
-        buffer.append(chunk, bytes);
-        size_t pos = 0;
-        size_t nl;
-        while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-          if (nl > pos) {
-            std::string line = buffer.substr(pos, nl - pos);
-            // Strip ANSI escape sequences
-            line = stripAnsiCodes(line);
-            onLine(line);
-          }
-          size_t next = nl + 1;
-          if (next < buffer.size() &&
-              ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-               (buffer[nl] == '\n' && buffer[next] == '\r')))
-            next++;
-          pos = next;
-        }
-        if (pos > 0)
-          buffer.erase(0, pos);
-      }
-
-      // Read from stderr
-      bytes = read(pipe_stderr[0], chunk, sizeof(chunk));
-      if (bytes > 0) {
-        buffer.append(chunk, bytes);
-        size_t pos = 0;
-        size_t nl;
-        while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-          if (nl > pos) {
-            std::string line = buffer.substr(pos, nl - pos);
-            // Strip ANSI escape sequences
-            line = stripAnsiCodes(line);
-            onLine(line);
-          }
-          size_t next = nl + 1;
-          if (next < buffer.size() &&
-              ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-               (buffer[nl] == '\n' && buffer[next] == '\r')))
-            next++;
-          pos = next;
-        }
-        if (pos > 0)
-          buffer.erase(0, pos);
-      }
+// The task's process has exited: its phase logs get no more writes
+static void FinishPhaseLogs(TaskInstance &task) {
+  std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+  for (const auto &log : task.phase_logs)
+    log->finished = true;
+}
 
-      // Small delay to prevent busy waiting
-      usleep(10000); // 10ms
-    }
+// Attached phases (see exec_phase in autobuild.sh). The script leaves the
+// request <gate dir>/exec-<id> (container, user, log file, then the shell
+// command), prints "[EXEC] <id>" and waits for <gate dir>/exec-<id>.rc.
+// The command runs through the Docker API: its stdout and stderr frames go
+// straight into a PhaseLog and, through a PhaseOutputWriter, into the log
+// file, with no docker CLI, redirect or tail in between. The .rc file gets
+// the exit code, or "fallback <why>" when the exec could not start and the
+// script should run docker exec. On POSIX every exec is an AttachedExec
+// coroutine on g_async; Windows, whose daemon pipe the reactor cannot wait
+// on, gives each a RunAttachedExec thread.
+struct AttachedExecRequest {
+  std::string path; // exec-<id>
+  std::string container, user, log_path, command;
+};
 
-    if (should_stop) {
-      // Terminate the entire process tree
-      // First try to kill the process group
-      if (g_show_debug_console) {
-        ConsoleLog("[DEBUG][Mac/Linux] Sending SIGTERM to process group " +
-                   std::to_string(pid));
-      }
-      int result = killpg(pid, SIGTERM);
-      if (result != 0 && g_show_debug_console) {
-        ConsoleLog("[ERROR][Mac/Linux] killpg(SIGTERM) failed: " +
-                   std::string(strerror(errno)));
-      }
+static AttachedExecRequest ReadAttachedExecRequest(const std::string &path) {
+  AttachedExecRequest req;
+  req.path = path;
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::getline(in, req.container);
+    std::getline(in, req.user);
+    std::getline(in, req.log_path);
+    std::stringstream rest;
+    rest << in.rdbuf();
+    req.command = rest.str();
+  }
+  while (!req.command.empty() && req.command.back() == '\n')
+    req.command.pop_back();
+#ifdef _WIN32
+  req.log_path = ConvertFromUnixPath(req.log_path);
+#endif
+  return req;
+}
 
-      // Wait a bit for graceful termination
-      usleep(100000); // 100ms
+// Open the phase log for req; null with why set when the exec should fall
+// back to the script's docker exec
+static std::shared_ptr<PhaseLog>
+OpenAttachedExecLog(TaskInstance &task, const AttachedExecRequest &req,
+                    PhaseOutputWriter &writer, std::string &why) {
+  // The request reaches the API as a URL path and JSON strings
+  if (req.container.empty() || req.command.empty() ||
+      req.container.find_first_not_of(
+          "abcdefghijklmnopqrstuvwxyz"
+          "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.-") != std::string::npos) {
+    why = "unreadable request";
+    return nullptr;
+  }
+  if (!writer.Open(req.log_path)) {
+    why = "cannot write " + req.log_path;
+    return nullptr;
+  }
+  std::shared_ptr<PhaseLog> log = AddPhaseLog(task, req.log_path);
+  if (!log)
+    why = "log already followed";
+  return log;
+}
 
-      // Check if still running and force kill
-      int wait_result = waitpid(pid, &status, WNOHANG);
-      if (wait_result == 0) {
-        // Still running, force kill
-        if (g_show_debug_console) {
-          ConsoleLog("[DEBUG][Mac/Linux] Process still running, sending "
-                     "SIGKILL to group " +
-                     std::to_string(pid));
-        }
-        killpg(pid, SIGKILL);
-      }
+// The exec is over; started says whether it ran at all
+static void CloseAttachedExecLog(TaskInstance &task,
+                                 std::shared_ptr<PhaseLog> &log,
+                                 PhaseOutputWriter &writer, bool started,
+                                 const PhaseOutputWriter::LineFn &on_line) {
+  writer.Close(started ? on_line : nullptr);
+  log->finished = true;
+  log->drained = true;
+  if (started)
+    return;
+  {
+    // Let the script's docker exec log it through the tailer instead
+    std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+    auto &logs = task.phase_logs;
+    logs.erase(std::remove(logs.begin(), logs.end(), log), logs.end());
+  }
+  log.reset();
+}
 
-      onLine("[STOPPED] Task was terminated by user");
-    }
+static bool WriteAttachedExecResult(const std::string &path, bool ran,
+                                    int exit_code, const std::string &why) {
+  std::string rc;
+  if (!ran)
+    rc = "fallback " + why;
+  else // 125: docker's own code for a failure of the daemon, not the command
+    rc = std::to_string(exit_code < 0 ? 125 : exit_code);
+  std::string tmp = path + ".rc.tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out << rc << "\n";
+  }
+  return std::rename(tmp.c_str(), (path + ".rc").c_str()) == 0;
+}
 
-    // Read remaining output
-    while (true) {
-      bytes = read(pipe_stdout[0], chunk, sizeof(chunk));
-      if (bytes <= 0)
-        break;
-      buffer.append(chunk, bytes);
-      size_t pos = 0;
-      size_t nl;
-      while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-        if (nl > pos) {
-          std::string line = buffer.substr(pos, nl - pos);
-          // Strip ANSI escape sequences
-          line = stripAnsiCodes(line);
-          onLine(line);
-        }
-        size_t next = nl + 1;
-        if (next < buffer.size() &&
-            ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-             (buffer[nl] == '\n' && buffer[next] == '\r')))
-          next++;
-        pos = next;
-      }
-      if (pos > 0)
-        buffer.erase(0, pos);
-    }
-
-    // Read remaining stderr
-    while (true) {
-      bytes = read(pipe_stderr[0], chunk, sizeof(chunk));
-      if (bytes <= 0)
-        break;
-      buffer.append(chunk, bytes);
-      size_t pos = 0;
-      size_t nl;
-      while ((nl = buffer.find_first_of("\r\n", pos)) != std::string::npos) {
-        if (nl > pos) {
-          std::string line = buffer.substr(pos, nl - pos);
-          // Strip ANSI escape sequences
-          line = stripAnsiCodes(line);
-          onLine(line);
-        }
-        size_t next = nl + 1;
-        if (next < buffer.size() &&
-            ((buffer[nl] == '\r' && buffer[next] == '\n') ||
-             (buffer[nl] == '\n' && buffer[next] == '\r')))
-          next++;
-        pos = next;
-      }
-      if (pos > 0)
-        buffer.erase(0, pos);
-    }
-
-    if (!buffer.empty())
-      onLine(buffer);
-
-    // Wait for process with timeout
-    int timeout_count = 0;
-    while (timeout_count < 500) { // 5 second timeout (500 * 10ms)
-      int wait_result = waitpid(pid, &status, WNOHANG);
-      if (wait_result == pid) {
-        // Process finished
-        if (WIFEXITED(status)) {
-          out_exit_code = WEXITSTATUS(status);
-          if (g_show_debug_console) {
-            ConsoleLog("[DEBUG][Mac/Linux] Process finished with exit code: " +
-                       std::to_string(out_exit_code));
-          }
-        } else {
-          out_exit_code = 1;
-          if (g_show_debug_console) {
-            ConsoleLog("[DEBUG][Mac/Linux] Process terminated abnormally");
+#ifdef _WIN32
+static void RunAttachedExec(std::shared_ptr<TaskInstance> task,
+                            std::string req_path) {
+  TRACE_THREAD("Attached exec");
+  HeapThread("Attached exec", kHeapTasks);
+  AttachedExecRequest req = ReadAttachedExecRequest(req_path);
+  PhaseOutputWriter writer;
+  std::string why;
+  int exit_code = -1;
+  std::shared_ptr<PhaseLog> log = OpenAttachedExecLog(*task, req, writer, why);
+  if (log) {
+    uint64_t lines = 0;
+    auto on_line = [&](int, std::string_view line) {
+      // Hold the stream while the render thread is a full ring behind
+      while (log->ring.Free() == 0 && !task->should_stop)
+        std::this_thread::sleep_for(std::chrono::milliseconds(kLogTailPollMs));
+      PublishPhaseLine(*log, ++lines, line);
+      WakeMainLoop();
+    };
+    DockerApiClient conn;
+    DockerExecSpec spec;
+    spec.container = req.container;
+    spec.user = req.user;
+    spec.cmd = {"bash", "-lc", req.command};
+    bool started = DockerExecAttached(
+        conn, spec,
+        [&](int stream, std::string_view data) {
+          writer.Write(stream, data, on_line);
+        },
+        exit_code, why);
+    CloseAttachedExecLog(*task, log, writer, started, on_line);
+  }
+  WriteAttachedExecResult(req_path, log != nullptr, exit_code, why);
+}
+#else
+static Async<void> AttachedExec(std::shared_ptr<TaskInstance> task,
+                                std::string req_path) {
+  // The gate directory sits with the logs, which may be on a share
+  AttachedExecRequest req = co_await g_async.Offload(
+      g_jobs, JobLane::Io,
+      [req_path]() { return ReadAttachedExecRequest(req_path); });
+  PhaseOutputWriter writer;
+  std::string why;
+  int exit_code = -1;
+  std::shared_ptr<PhaseLog> log = OpenAttachedExecLog(*task, req, writer, why);
+  if (log) {
+    // Stopping the run ends the stream; the flag is the task's own
+    CancelToken stop(
+        std::shared_ptr<std::atomic<bool>>(task, &task->should_stop));
+    uint64_t lines = 0;
+    // Lines the ring had no room for, published as it drains
+    std::deque<std::string> held;
+    PhaseOutputWriter::LineFn on_line = [&](int, std::string_view line) {
+      if (held.empty() && log->ring.Free() > 0)
+        PublishPhaseLine(*log, ++lines, line);
+      else
+        held.emplace_back(line);
+    };
+    AsyncDockerExec exec(g_async, &stop);
+    DockerExecSpec spec;
+    spec.container = req.container;
+    spec.user = req.user;
+    spec.cmd = {"bash", "-lc", req.command};
+    bool started = co_await exec.Start(spec, why);
+    if (started) {
+      int stream = 0;
+      std::string data;
+      while (co_await exec.Read(stream, data)) {
+        writer.Write(stream, data, on_line);
+        // Hold the stream while the render thread is a full ring behind
+        for (;;) {
+          while (!held.empty() && log->ring.Free() > 0) {
+            PublishPhaseLine(*log, ++lines, held.front());
+            held.pop_front();
           }
+          if (held.empty())
+            break;
+          if (!co_await g_async.Sleep(kLogTailPollMs, &stop))
+            break;
         }
-        break;
-      }
-      usleep(10000); // 10ms
-      timeout_count++;
-    }
-
-    if (timeout_count >= 500) {
-      // Timeout - kill the process
-      if (g_show_debug_console) {
-        ConsoleLog(
-            "[DEBUG][Mac/Linux] Process timeout, sending SIGKILL to group " +
-            std::to_string(pid));
+        WakeMainLoop();
+        if (stop.Cancelled())
+          break;
       }
-      killpg(pid, SIGKILL);
-      out_exit_code = 1;
-    }
-
-    close(pipe_stdout[0]);
-    close(pipe_stderr[0]);
-
-    if (g_show_debug_console) {
-      ConsoleLog("[DEBUG][Mac/Linux] Process cleanup complete for PID " +
-                 std::to_string(pid));
+      if (!stop.Cancelled())
+        exit_code = co_await exec.Wait();
     }
-    return true;
+    CloseAttachedExecLog(*task, log, writer, started, on_line);
   }
+  co_await g_async.Offload(g_jobs, JobLane::Io, [&]() {
+    return WriteAttachedExecResult(req_path, log != nullptr, exit_code, why);
+  });
 }
 #endif
 
-////////////////////////////////////////////////////////////
-//                                                       //
-//              TASK MANAGEMENT & EXECUTION              //
-//                                                       //
-////////////////////////////////////////////////////////////
+// Parse "[EXEC] <id>" (see RunAttachedExec) and start the exec it asks for
+static bool TrackAttachedExec(const std::shared_ptr<TaskInstance> &task,
+                              std::string_view line) {
+  static const std::string_view kMarker = "[EXEC] ";
+  if (line.size() <= kMarker.size() ||
+      line.compare(0, kMarker.size(), kMarker) != 0)
+    return false;
+  std::string id(line.substr(kMarker.size()));
+  while (!id.empty() && (id.back() == '\r' || id.back() == ' '))
+    id.pop_back();
+  if (id.empty() || task->gate_dir.empty() ||
+      id.find_first_not_of("0123456789-") != std::string::npos)
+    return false;
+#ifdef _WIN32
+  const char *sep = "\\";
+#else
+  const char *sep = "/";
+#endif
+  std::string req_path = task->gate_dir + sep + "exec-" + id;
+#ifdef _WIN32
+  std::thread(RunAttachedExec, task, req_path).detach();
+#else
+  g_async.Spawn(AttachedExec(task, req_path));
+#endif
+  return true;
+}
+
+// Stage names used by autobuild.sh's stage_gate, indexed by TaskPhase
+static const char *const kTaskStageNames[kTaskPhaseCount] = {
+    "", "build", "setup", "prompt", "verify"};
+
+// Parse "[STAGE] <n> <stage>", printed by autobuild.sh when it waits at a
+// stage gate, and record the request for the scheduler
+static bool TrackStageGate(TaskInstance &task, std::string_view line) {
+  if (line.size() < 8 || line.compare(0, 8, "[STAGE] ") != 0)
+    return false;
+  line.remove_prefix(8);
+  int seq = 0;
+  while (!line.empty() && line.front() >= '0' && line.front() <= '9') {
+    seq = seq * 10 + (line.front() - '0');
+    line.remove_prefix(1);
+  }
+  if (seq <= 0 || line.empty() || line.front() != ' ')
+    return false;
+  line.remove_prefix(1);
+  for (int p = 1; p < kTaskPhaseCount; p++) {
+    if (line == kTaskStageNames[p]) {
+      task.gate_phase = (TaskPhase)p;
+      task.gate_seq = seq; // published last; the scheduler reads it first
+      return true;
+    }
+  }
+  return false;
+}
+
+static ImageDirectory g_image_directory;
+
+// Note an envimage or registry event of a run or build on endpoint
+static void RecordImageEvent(const ScriptEvent &event,
+                             const std::string &endpoint) {
+  if (event.kind == "envimage")
+    g_image_directory.Record(event.field, endpoint);
+  else if (event.kind == "registry")
+    g_image_directory.RecordDigest(event.field, event.value);
+}
+
+// Fold one of autobuild.sh's run events (see ParseScriptEvent) into the
+// task's state; returns false for any other line
+static bool ApplyTaskEvent(const std::shared_ptr<TaskInstance> &task,
+                           std::string_view line) {
+  ScriptEvent event;
+  if (!ParseScriptEvent(line, event))
+    return false;
+  if (event.kind == "logdir") {
+    std::string dir = event.value;
+#ifdef _WIN32
+    dir = ConvertFromUnixPath(dir);
+#endif
+    g_container_logs.Record(event.field, dir);
+    g_run_journal.Set(task->id, "log_dir", dir);
+    std::lock_guard<std::mutex> lock(task->resources_mutex);
+    task->log_dir = dir;
+  } else if (event.kind == "container") {
+    // A run can move to a fresh container; the sampler follows the name
+    bool first;
+    {
+      std::lock_guard<std::mutex> lock(task->resources_mutex);
+      first = task->container.empty();
+      task->container = event.value;
+      task->container_id = event.field;
+    }
+    g_run_journal.Set(task->id, "container", event.value);
+    g_run_journal.Set(task->id, "container_id", event.field);
+    task->container_created = true;
+    if (first) {
+      g_resource_sampler.Watch(task);
+      g_docker_gc.Protect([weak = std::weak_ptr<TaskInstance>(task)]() {
+        std::shared_ptr<TaskInstance> t = weak.lock();
+        if (!t || !t->is_running)
+          return std::string();
+        std::lock_guard<std::mutex> lock(t->resources_mutex);
+        return t->container;
+      });
+    }
+  } else if (event.kind == "image") {
+    std::lock_guard<std::mutex> lock(task->resources_mutex);
+    task->image_id = event.field;
+  } else if (event.kind == "envimage" || event.kind == "registry") {
+    RecordImageEvent(event, task->worker);
+  }
+  return true;
+}
+
+
+static uint64_t ApiKeyId(const std::string &api_key) {
+  return Fnv1a(kFnvOffset, api_key.data(), api_key.size());
+}
 
-// NEW: Thread function for TaskInstance
-void ExecuteTaskThread(std::shared_ptr<TaskInstance> task) {
+static void ConfigureApiGovernor(const AppState &state) {
+  g_api_governor.Configure(state.api_prompts_per_min, state.max_api_tasks);
+  g_api_governor.ConfigureQuota(state.api_daily_quota,
+                                state.api_quota_reset_utc);
+}
+
+// Feed the governor from the script's output: "[RATE_LIMIT] <retry after s>
+// <attempt>" when a prompt was rate limited, and the end marker of every
+// prompt phase that exited cleanly
+static void TrackApiPacing(const TaskInstance &task, std::string_view line) {
+  static const char kRateLimit[] = "[RATE_LIMIT] ";
+  static const char kPromptEnd[] = "[TIMING] end gemini_";
+  if (line.compare(0, sizeof(kRateLimit) - 1, kRateLimit) == 0) {
+    double retry_after = 0.0;
+    int attempt = 1;
+    std::string rest(line.substr(sizeof(kRateLimit) - 1));
+    sscanf(rest.c_str(), "%lf %d", &retry_after, &attempt);
+    g_api_governor.RateLimited(task.api_key_id, retry_after, attempt,
+                               std::chrono::steady_clock::now());
+    WakeMainLoop(); // a gate may be waiting on the pause
+  } else if (line.compare(0, sizeof(kPromptEnd) - 1, kPromptEnd) == 0 &&
+             line.size() > 2 && line.substr(line.size() - 2) == " 0") {
+    g_api_governor.Succeeded(task.api_key_id);
+  }
+}
+
+// Start a BuildCommand command line on the shared reactor. On Windows the
+// (quoted) executable is launched directly, falling back to cmd.exe /C; on
+// macOS and Linux the line runs through bash -c so its exports and quoting
+// behave the same on every platform.
+static bool SpawnCommandLine(const std::string &cmd,
+                             ProcessReactor::LineFn on_line,
+                             ProcessReactor::ExitFn on_exit,
+                             std::atomic<bool> *should_stop,
+                             ProcessReactor::ProcessHandle &handle,
+                             const std::vector<std::string> &env,
+                             const ProcessOptions &options = {}) {
 #ifdef _WIN32
-  std::string cmd = task->command;
   std::string exe;
   std::string args;
   if (!cmd.empty() && cmd[0] == '"') {
@@ -3796,173 +5103,338 @@ void ExecuteTaskThread(std::shared_ptr<TaskInstance> task) {
     if (c == '/')
       c = '\\';
 
-#ifdef _WIN32
-  DWORD code = 0;
-#else
-  int code = 0;
-#endif
-  auto onLine = [&](const std::string &ln) {
-    std::lock_guard<std::mutex> lock(task->log_mutex);
-    task->log_output.push_back(ln);
-    if (task->log_output.size() > 1000)
-      task->log_output.erase(task->log_output.begin());
-
-    // Check if container has been created by looking for specific log messages
-    if (!task->container_created.load()) {
-      if (ln.find("Starting container:") != std::string::npos ||
-          ln.find("Container") != std::string::npos &&
-              ln.find("started") != std::string::npos ||
-          ln.find("docker run") != std::string::npos &&
-              ln.find("--name") != std::string::npos) {
-        task->container_created.store(true);
-      }
-    }
-  };
   if (g_show_debug_console) {
-    ConsoleLog(std::string("[DEBUG] ExecuteTaskThread original cmd: ") + cmd);
+    ConsoleLog(std::string("[DEBUG] SpawnCommandLine original cmd: ") + cmd);
     ConsoleLog(std::string("[DEBUG] parsed exe='") + exe + "' args='" + args +
                "'");
   }
-  bool ok = RunHiddenStreamExeWithHandle(
-      exe, args, onLine, code, task->process_handle, task->should_stop);
-  if (!ok) {
-    // Fallback: try via cmd.exe /C <original cmd>
-    std::string fb_exe = "cmd.exe";
-    std::string fb_args = std::string("/C ") + cmd;
-    if (g_show_debug_console) {
-      ConsoleLog("[WARN] Direct exec failed, trying fallback via cmd.exe");
-      ConsoleLog(std::string("[DEBUG] fallback exe='") + fb_exe + "' args='" +
-                 fb_args + "'");
-    }
-    ok = RunHiddenStreamExeWithHandle(fb_exe, fb_args, onLine, code,
-                                      task->process_handle, task->should_stop);
+  if (g_process_reactor.Spawn(exe, args, on_line, on_exit, should_stop, handle,
+                              env, options))
+    return true;
+  // Fallback: try via cmd.exe /C <original cmd>
+  std::string fb_exe = "cmd.exe";
+  std::string fb_args = std::string("/C ") + cmd;
+  if (g_show_debug_console) {
+    ConsoleLog("[WARN] Direct exec failed, trying fallback via cmd.exe");
+    ConsoleLog(std::string("[DEBUG] fallback exe='") + fb_exe + "' args='" +
+               fb_args + "'");
   }
-  if (!ok) {
-    std::lock_guard<std::mutex> lock(task->log_mutex);
-    task->log_output.push_back("[ERROR] Failed to execute command");
-    task->is_running = false;
-    return;
+  return g_process_reactor.Spawn(fb_exe, fb_args, on_line, on_exit,
+                                 should_stop, handle, env, options);
+#else
+  if (g_show_debug_console) {
+    ConsoleLog("[DEBUG][Mac/Linux] SpawnCommandLine command: " + cmd);
   }
-  {
-    std::lock_guard<std::mutex> lock(task->log_mutex);
-    if (task->should_stop) {
-      task->log_output.push_back("[STOPPED] Task terminated");
-    } else if (code == 0) {
-      task->log_output.push_back("[SUCCESS] Command completed successfully");
+
+  // Single quotes inside the command are escaped for the single-quoted
+  // argument
+  std::string cmd_escaped;
+  cmd_escaped.reserve(cmd.size() + 8);
+  for (char c : cmd) {
+    if (c == '\'') {
+      cmd_escaped += "'\"'\"'"; // close ', insert literal ', reopen '
     } else {
-      task->log_output.push_back("[ERROR] Command failed with exit code: " +
-                                 std::to_string(code));
+      cmd_escaped += c;
     }
   }
-#else
+  std::string shell_args = "-c '" + cmd_escaped + "'";
+
   if (g_show_debug_console) {
-    ConsoleLog("[DEBUG][Mac/Linux] ExecuteTaskThread command: " +
-               task->command);
+    ConsoleLog("[DEBUG][Mac/Linux] Final shell command: bash " + shell_args);
   }
 
-  // On macOS, use shell execution for better compatibility
-  std::string shell_cmd;
-#ifdef __APPLE__
-  // Use bash explicitly for macOS
-  // Properly escape single quotes inside the command for safe single-quoted
-  // bash -c
-  {
-    std::string cmd_escaped;
-    cmd_escaped.reserve(task->command.size() + 8);
-    for (char c : task->command) {
-      if (c == '\'') {
-        cmd_escaped += "'\"'\"'"; // close ', insert literal ', reopen '
-      } else {
-        cmd_escaped += c;
-      }
-    }
-    shell_cmd = "bash -c '" + cmd_escaped + "'";
+  bool ok = g_process_reactor.Spawn("bash", shell_args, on_line, on_exit,
+                                    should_stop, handle, env, options);
+  if (!ok && g_show_debug_console) {
+    ConsoleLog("[ERROR][Mac/Linux] Failed to launch: " +
+               std::string(strerror(errno)));
   }
-#else
-  shell_cmd = task->command;
+  return ok;
 #endif
+}
 
-  if (g_show_debug_console) {
-    ConsoleLog("[DEBUG][Mac/Linux] Final shell command: " + shell_cmd);
-  }
+// NEW: Start a TaskInstance's process on the shared reactor. Output lines and
+// the final status are delivered from the reactor thread; no per-task thread
+// is created. Returns false if the process could not be launched.
+static bool LaunchTaskProcess(std::shared_ptr<TaskInstance> task) {
+  // The script reads prompts.json itself; give it the latest edits
+  g_file_saver.Flush();
 
-  FILE *pipe = popen(shell_cmd.c_str(), "r");
-  if (!pipe) {
-    if (g_show_debug_console) {
-      ConsoleLog("[ERROR][Mac/Linux] popen failed: " +
-                 std::string(strerror(errno)));
+  auto onLine = [task](std::string_view ln) {
+    // Run events become task state instead of log lines
+    if (ApplyTaskEvent(task, ln))
+      return;
+    TrackApiPacing(*task, ln);
+    {
+      // Timing markers feed the timeline instead of the log
+      std::lock_guard<std::mutex> lock(task->timeline_mutex);
+      if (ApplyTimingMarker(ln, task->timeline))
+        return;
     }
-    std::lock_guard<std::mutex> lock(task->log_mutex);
-    task->log_output.push_back("[ERROR] Failed to execute command: " +
-                               std::string(strerror(errno)));
-    task->is_running = false;
-    return;
-  }
-  if (g_show_debug_console) {
-    ConsoleLog("[DEBUG][Mac/Linux] Task started successfully");
-  }
-  char buffer[256];
-  while (fgets(buffer, sizeof(buffer), pipe) && !task->should_stop) {
-    std::lock_guard<std::mutex> lock(task->log_mutex);
-    task->log_output.push_back(std::string(buffer));
-    if (task->log_output.size() > 1000)
-      task->log_output.erase(task->log_output.begin());
-  }
-  int ret = pclose(pipe);
-  int exit_code = WEXITSTATUS(ret);
+    if (TrackAttachedExec(task, ln))
+      return;
+    if (!TrackStageGate(*task, ln))
+      TrackTaskPhase(*task, ln);
+    if (task->background_builds)
+      task->background.store(task->phase.load() != TaskPhase::Prompt,
+                             std::memory_order_relaxed);
+    if (ln.find("Reusing image built by another run:") !=
+            std::string_view::npos ||
+        ln.find("Using cached image") != std::string_view::npos)
+      g_metrics.image_cache_hits++;
+    else if (ln.find("Building image:") != std::string_view::npos)
+      g_metrics.image_cache_misses++;
+    TrackPhaseLog(*task, ln);
+    PushTaskLog(*task, ln, true);
+  };
 
-  {
-    std::lock_guard<std::mutex> lock(task->log_mutex);
-    if (task->should_stop) {
+  auto onExit = [task](int exit_code, bool stopped) {
+    FinishPhaseLogs(*task);
+    g_run_journal.Ended(task->id);
+    if (task->container_lost) {
+      // Stopped for its dead container, not by hand
+      std::string container, reason;
+      {
+        std::lock_guard<std::mutex> lock(task->resources_mutex);
+        container = task->container;
+        reason = task->container_lost_reason;
+      }
+      PushTaskLog(*task, "[ERROR] Container " + container + " " + reason +
+                             "; the run was ended");
+      stopped = false;
+      task->should_stop = false;
+      if (exit_code == 0)
+        exit_code = 1;
+    } else if (task->stalled) {
+      // Ended by the stall watchdog; one it queues again says nothing about
+      // the pass rate, so it stays stopped for the batch and ETA figures
+      PushTaskLog(*task, task->stall_requeue
+                             ? "[ERROR] Ended by the stall watchdog"
+                             : "[ERROR] Ended by the stall watchdog; no "
+                               "retries left");
+      stopped = false;
+      if (!task->stall_requeue)
+        task->should_stop = false;
+      if (exit_code == 0)
+        exit_code = 1;
+    }
+    task->exit_code = exit_code;
+    if (stopped) {
       if (g_show_debug_console) {
-        ConsoleLog("[DEBUG][Mac/Linux] Task stopped by user");
+        ConsoleLog("[DEBUG] Task stopped by user: " + task->name);
       }
-      task->log_output.push_back("[STOPPED] Task terminated");
+      PushTaskLog(*task, "[STOPPED] Task terminated");
     } else if (exit_code == 0) {
       if (g_show_debug_console) {
-        ConsoleLog("[DEBUG][Mac/Linux] Task completed successfully");
+        ConsoleLog("[DEBUG] Task completed successfully: " + task->name);
       }
-      task->log_output.push_back("[SUCCESS] Command completed successfully");
+      PushTaskLog(*task, "[SUCCESS] Command completed successfully");
     } else {
       if (g_show_debug_console) {
-        ConsoleLog("[ERROR][Mac/Linux] Task failed with exit code: " +
-                   std::to_string(exit_code) +
-                   " (raw pclose: " + std::to_string(ret) + ")");
+        ConsoleLog("[ERROR] Task failed with exit code: " +
+                   std::to_string(exit_code));
       }
-      task->log_output.push_back("[ERROR] Command failed with exit code: " +
-                                 std::to_string(exit_code));
-
+      PushTaskLog(*task, "[ERROR] Command failed with exit code: " +
+                             std::to_string(exit_code));
+#ifndef _WIN32
       // Add more detailed error information for common issues
       if (exit_code == 127) {
-        task->log_output.push_back("[ERROR] Command not found - check if bash "
-                                   "and script paths are correct");
+        PushTaskLog(*task, "[ERROR] Command not found - check if bash and "
+                           "script paths are correct");
       } else if (exit_code == 126) {
-        task->log_output.push_back(
+        PushTaskLog(
+            *task,
             "[ERROR] Command is not executable - check script permissions");
       } else if (exit_code == 1) {
-        task->log_output.push_back(
+        PushTaskLog(
+            *task,
             "[ERROR] General error - check script execution and dependencies");
       }
-    }
-  }
 #endif
-  task->is_running = false;
+    }
+    if (task->spool)
+      task->spool->Flush();
+    if (task->shared_log)
+      task->shared_log->Finish();
+    task->run_seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - task->started_at)
+                            .count();
+    // The reactor owns and closes the process handle after this returns
 #ifdef _WIN32
-  if (task->process_handle) {
-    CloseHandle(task->process_handle);
     task->process_handle = NULL;
-  }
 #else
-  // On Unix, process_handle is a PID (int), no cleanup needed
-  // The process is already terminated by pclose() in the Unix branch above
-  if (g_show_debug_console && task->process_handle > 0) {
-    ConsoleLog("[DEBUG][Mac/Linux] Cleaning up process handle for PID: " +
-               std::to_string(task->process_handle));
+    task->process_handle = 0;
+#endif
+    TeardownStage signalled = TeardownStage::Signalled;
+    task->teardown.compare_exchange_strong(signalled, TeardownStage::Exited);
+    SetTaskRunning(*task, false);
+    WakeMainLoop();
+  };
+
+  std::vector<std::string> env = DockerWorkerEnvironment(task->worker);
+  const ResourceEnvelope &envelope = task->envelope;
+  if (envelope.cpus > 0.0) {
+    char cpus[32];
+    snprintf(cpus, sizeof(cpus), "%.1f", envelope.cpus);
+    env.push_back(std::string("AUTOBUILD_CONTAINER_CPUS=") + cpus);
+  }
+  if (envelope.memory_mib != 0)
+    env.push_back("AUTOBUILD_CONTAINER_MEMORY=" +
+                  std::to_string(envelope.memory_mib));
+  if (envelope.pids != 0)
+    env.push_back("AUTOBUILD_CONTAINER_PIDS=" + std::to_string(envelope.pids));
+  // The environment rather than --workdir-mount, so the task's own
+  // workdir_mount file still wins
+  if (!task->workdir_mount.empty())
+    env.push_back("AUTOBUILD_WORKDIR_MOUNT=" + task->workdir_mount);
+  // Placement decides whether the run starts a proxy or uses the fleet's
+  if (!task->package_proxy.empty())
+    env.push_back("AUTOBUILD_PACKAGE_PROXY=" + task->package_proxy);
+  if (task->attach_exec)
+    env.push_back("AUTOBUILD_PHASE_ATTACH=1");
+  // Pull the image another host pushed, by digest, before building it
+  std::string digest = task->context_hash.empty()
+                           ? std::string()
+                           : g_image_directory.Digest(task->context_hash);
+  if (!digest.empty())
+    env.push_back("AUTOBUILD_IMAGE_DIGEST=" + digest);
+  ProcessOptions options;
+  options.cpu_percent = task->tree_cpu_percent;
+  options.memory_mb = (uint64_t)task->tree_memory_mb;
+  options.pty = task->pty;
+  options.background = &task->background;
+  options.record_path = task->record_path;
+  if (task->pty)
+    env.push_back("TERM=xterm-256color");
+#ifdef _WIN32
+  // wsl.exe hands a Linux command only the variables WSLENV names; Git
+  // Bash ignores it
+  if (!env.empty()) {
+    const char *inherited = getenv("WSLENV");
+    std::string wslenv = inherited ? inherited : "";
+    for (const std::string &entry : env) {
+      if (!wslenv.empty())
+        wslenv += ':';
+      wslenv += entry.substr(0, entry.find('='));
+    }
+    env.push_back("WSLENV=" + wslenv);
   }
-  task->process_handle = 0;
 #endif
+  if (!SpawnCommandLine(task->command, onLine, onExit, &task->should_stop,
+                        task->process_handle, env, options)) {
+#ifdef _WIN32
+    PushTaskLog(*task, "[ERROR] Failed to execute command");
+#else
+    PushTaskLog(*task, "[ERROR] Failed to execute command: " +
+                           std::string(strerror(errno)));
+#endif
+    SetTaskRunning(*task, false);
+    return false;
+  }
+  return true;
+}
+
+// Run command on the shared reactor to completion, its output discarded
+// but for the debug console (under tag) and on_output, if given; true when
+// it exited with 0. A set stop kills it.
+static bool RunDetached(const std::string &command, std::atomic<bool> &stop,
+                        const char *tag,
+                        ProcessReactor::LineFn on_output = nullptr) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  bool ok = false;
+  ProcessReactor::ProcessHandle handle{};
+  auto on_line = [tag, on_output](std::string_view ln) {
+    if (on_output)
+      on_output(ln);
+    if (g_show_debug_console)
+      ConsoleLog(std::string(tag) + " " + std::string(ln));
+  };
+  auto on_exit = [&](int exit_code, bool stopped) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ok = exit_code == 0 && !stopped;
+    done = true;
+    cv.notify_all();
+  };
+  if (!SpawnCommandLine(command, on_line, on_exit, &stop, handle, {}))
+    return false;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!cv.wait_for(lock, std::chrono::milliseconds(100),
+                      [&] { return done; })) {
+    if (stop)
+      g_process_reactor.Wake();
+  }
+  return ok;
+}
+
+// Host-wide slots shared with the other engine instances on this host that
+// use the same lease directory (see HostLeasePool)
+static HostLeasePool g_host_runs("runs");
+static HostLeasePool g_host_builds("build");
+static HostLeasePool g_host_prompts("prompt");
+static HostLeasePool g_host_verifications("verify");
+
+// Point the host-wide pools at the settings' directory and limits. Without
+// a limits.json each instance leases only the first slots of its own limit,
+// so together they stay within the highest limit among them.
+static void ConfigureHostLeases(const AppState &state) {
+  const std::string &dir = state.host_lease_dir;
+  g_host_runs.Configure(dir, state.max_concurrent_tasks);
+  g_host_builds.Configure(dir, state.max_image_builds);
+  g_host_prompts.Configure(dir, state.max_api_tasks);
+  g_host_verifications.Configure(dir, state.max_verify_tasks);
+}
+
+// Image builds for queued runs (see ImageBuildFarm): "autobuild.sh build"
+// on the shared reactor, output discarded (the script keeps it in the run's
+// docker_build.log). Only this host is built for; runs placed on a remote
+// worker pull the image from the image registry when one is set (its
+// events go to g_image_directory), else share the BuildKit layer cache.
+static bool RunFarmBuild(const std::string &command, std::atomic<bool> &stop) {
+  // A slot of the host's builds, which the other instances' builds share
+  HostLease lease;
+  if (!g_host_builds.Acquire(lease, &stop))
+    return false;
+  bool ok = RunDetached(command, stop, "[BUILD]", [](std::string_view ln) {
+    ScriptEvent event;
+    if (ParseScriptEvent(ln, event))
+      RecordImageEvent(event, std::string());
+  });
+  // Runs held at their build gate for this image can go on
+  WakeMainLoop();
+  return ok;
 }
 
+static ImageBuildFarm g_build_farm(RunFarmBuild);
+
+// Base images for queued runs (see BaseImagePuller), pulled into this host
+// ahead of their builds. References are from the Dockerfile, so anything
+// but the reference characters is refused before it reaches a command line.
+static bool PullBaseImage(const std::string &image, std::atomic<bool> &stop) {
+  if (!DockerDaemonHealth().Available())
+    return false;
+  if (image.empty() || image[0] == '-' ||
+      image.find_first_not_of("abcdefghijklmnopqrstuvwxyz"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                              "0123456789._-/:@") != std::string::npos)
+    return false;
+  int status = 0;
+  JsonValue body;
+  if (DockerApiCall("GET", "/images/" + UrlEncode(image, true) + "/json",
+                    status, body) &&
+      status == 200)
+    return true;
+  // The CLI, not the API, so registry credentials and mirrors apply
+  bool ok = RunDetached("docker pull -q " + image, stop, "[PULL]");
+  if (!ok && !stop)
+    ConsoleLog("[WARN] Pre-pulling base image " + image +
+               " failed; its build will pull it");
+  return ok;
+}
+
+static BaseImagePuller g_base_puller(PullBaseImage);
+
 // Thread function to execute command asynchronously (LEGACY - kept for
 // compatibility)
 void ExecuteCommandThread(const std::string cmd, AppState *state) {
@@ -3999,10 +5471,11 @@ void ExecuteCommandThread(const std::string cmd, AppState *state) {
   int code = 0;
 #endif
   auto onLine = [&](const std::string &ln) {
-    std::lock_guard<std::mutex> lock(state->log_mutex);
-    state->log_output.push_back(ln);
-    if (state->log_output.size() > 1000)
-      state->log_output.erase(state->log_output.begin());
+    {
+      std::lock_guard<TracedMutex> lock(state->log_mutex);
+      state->log_output.Append(ln);
+    }
+    WakeMainLoop();
   };
   if (g_show_debug_console) {
     ConsoleLog(std::string("[DEBUG] ExecuteCommandThread original cmd: ") +
@@ -4021,45 +5494,51 @@ void ExecuteCommandThread(const std::string cmd, AppState *state) {
     ok = RunHiddenStreamExe(fb_exe, fb_args, onLine, code);
   }
   if (!ok) {
-    std::lock_guard<std::mutex> lock(state->log_mutex);
-    state->log_output.push_back("[ERROR] Failed to execute command");
+    std::lock_guard<TracedMutex> lock(state->log_mutex);
+    state->log_output.Append("[ERROR] Failed to execute command");
     state->is_running = false;
     return;
   }
   {
-    std::lock_guard<std::mutex> lock(state->log_mutex);
+    std::lock_guard<TracedMutex> lock(state->log_mutex);
     if (code == 0)
-      state->log_output.push_back("[SUCCESS] Command completed successfully");
+      state->log_output.Append("[SUCCESS] Command completed successfully");
     else
-      state->log_output.push_back("[ERROR] Command failed with exit code: " +
-                                  std::to_string(code));
+      state->log_output.Append("[ERROR] Command failed with exit code: " +
+                               std::to_string(code));
   }
 #else
-  FILE *pipe = popen(cmd.c_str(), "r");
-  if (!pipe) {
-    std::lock_guard<std::mutex> lock(state->log_mutex);
-    state->log_output.push_back("[ERROR] Failed to execute command");
+  // The command line is shell syntax; its stderr is shown with its stdout
+  SpawnOptions opts;
+  opts.stderr_mode = SpawnStderr::Merge;
+  int ret = 0;
+  bool ok = RunSpawned(
+      "/bin/sh", {"sh", "-c", cmd}, opts,
+      [state](std::string_view ln) {
+        {
+          std::lock_guard<TracedMutex> lock(state->log_mutex);
+          state->log_output.Append(ln);
+        }
+        WakeMainLoop(); // coalesced: at most one wakeup queued at a time
+      },
+      ret);
+  if (!ok) {
+    std::lock_guard<TracedMutex> lock(state->log_mutex);
+    state->log_output.Append("[ERROR] Failed to execute command");
     state->is_running = false;
     return;
   }
-  char buffer[256];
-  while (fgets(buffer, sizeof(buffer), pipe)) {
-    std::lock_guard<std::mutex> lock(state->log_mutex);
-    state->log_output.push_back(std::string(buffer));
-    if (state->log_output.size() > 1000)
-      state->log_output.erase(state->log_output.begin());
-  }
-  int ret = pclose(pipe);
   {
-    std::lock_guard<std::mutex> lock(state->log_mutex);
+    std::lock_guard<TracedMutex> lock(state->log_mutex);
     if (ret == 0)
-      state->log_output.push_back("[SUCCESS] Command completed successfully");
+      state->log_output.Append("[SUCCESS] Command completed successfully");
     else
-      state->log_output.push_back("[ERROR] Command failed with exit code: " +
-                                  std::to_string(ret));
+      state->log_output.Append("[ERROR] Command failed with exit code: " +
+                               std::to_string(ret));
   }
 #endif
   state->is_running = false;
+  WakeMainLoop();
 }
 
 void ExecuteCommand(const std::string &cmd, AppState &state) {
@@ -4070,9 +5549,9 @@ void ExecuteCommand(const std::string &cmd, AppState &state) {
 
   // Clear logs and set running flag
   {
-    std::lock_guard<std::mutex> lock(state.log_mutex);
-    state.log_output.clear();
-    state.log_output.push_back("[INFO] Executing: " + cmd);
+    std::lock_guard<TracedMutex> lock(state.log_mutex);
+    state.log_output.Clear();
+    state.log_output.Append("[INFO] Executing: " + cmd);
   }
   state.is_running = true;
   state.show_logs = true;
@@ -4081,72 +5560,590 @@ void ExecuteCommand(const std::string &cmd, AppState &state) {
   state.command_thread = std::thread(ExecuteCommandThread, cmd, &state);
 }
 
+// Milliseconds since the epoch, the clock of the script's timing markers
+static long long EpochMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Local staging of logs roots (see LogStager): the directory runs write to
+// in place of a root, where a staged path is once it was shipped, and
+// whether the unshipped backlog holds launches
+static std::string StagedLogsRoot(const std::string &root);
+static std::string ResolveStagedPath(const std::string &path);
+static bool LogShippingBacklogged();
+
 // NEW: Task management functions
-void StartTask(AppState &state, const std::string &task_name,
-               const std::string &cmd) {
-  std::lock_guard<std::mutex> lock(state.tasks_mutex);
+// Spool file for a task's full output:
+// <logs root>/spool/task_<timestamp>_<id>.log
+static std::string TaskSpoolPath(const AppState &state, int task_id) {
+  std::string root = StagedLogsRoot(
+      state.log_folder_paths.empty()
+          ? ResolveDefaultLogsPath()
+          : state.log_folder_paths[std::max(0, state.selected_log_folder)]);
+#ifdef _WIN32
+  std::string dir = root + "\\spool";
+  const char *sep = "\\";
+#else
+  std::string dir = root + "/spool";
+  const char *sep = "/";
+#endif
+  CreateDirectoryRecursive(dir);
+  auto time_t = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now());
+  std::stringstream ss;
+  ss << dir << sep << "task_"
+     << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S") << "_"
+     << task_id << ".log";
+  return ss.str();
+}
 
-  // Check if we've reached the concurrent task limit
-  int running_count = 0;
+// Stage gate directory for a run, next to the spool files. The scheduler
+// releases each stage of the run's script by creating a file in it.
+static std::string TaskStageGatePath(const AppState &state,
+                                     const std::string &unique_suffix) {
+  std::string root = StagedLogsRoot(
+      state.log_folder_paths.empty()
+          ? ResolveDefaultLogsPath()
+          : state.log_folder_paths[std::max(0, state.selected_log_folder)]);
+#ifdef _WIN32
+  return root + "\\spool\\gate_" + unique_suffix;
+#else
+  return root + "/spool/gate_" + unique_suffix;
+#endif
+}
+
+// How often the adaptive scheduler samples the host and asks Docker
+static const auto kHostSampleInterval = std::chrono::seconds(2);
+static const auto kDockerSampleInterval = std::chrono::seconds(6);
+
+// Count running Docker containers in the background; the result lands in
+// state.docker_containers (-1 when the daemon cannot be reached)
+static void ProbeDockerContainers(AppState &state) {
+  if (state.docker_probe_running.exchange(true))
+    return;
+  auto probe = [&state](const CancelToken &) {
+    if (!DockerDaemonHealth().Available()) {
+      state.docker_containers = -1;
+      state.docker_probe_running = false;
+      return;
+    }
+    int status = 0;
+    JsonValue body;
+    if (DockerApiCall("GET", "/containers/json", status, body)) {
+      state.docker_containers =
+          (status == 200 && body.type == JsonValue::Array)
+              ? (int)body.items.size()
+              : -1;
+      state.docker_probe_running = false;
+      return;
+    }
+    std::vector<std::string> lines = RunShellLines("docker ps -q 2>&1");
+    int count = 0;
+    for (const auto &line : lines) {
+      if (line.empty())
+        continue;
+      if (line.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        count = -1; // an error message rather than container IDs
+        break;
+      }
+      count++;
+    }
+    state.docker_containers = count;
+    state.docker_probe_running = false;
+  };
+  g_jobs.Submit(JobLane::Io, JobPriority::Housekeeping, probe);
+}
+
+// Concurrent builds, container setups and verifications allowed by the
+// adaptive scheduler
+static int AdaptiveBuildBudget(const AppState &state) {
+  return AdaptiveBuildBudget(state.max_build_tasks, state.host_load.cpus);
+}
+
+// Publish state.tasks to the render thread after changing it, and the queue
+// length after changing task_queue. Caller holds state.tasks_mutex.
+static void PublishTasksLocked(AppState &state) {
+  std::atomic_store(&state.tasks_view,
+                    std::make_shared<const TaskList>(state.tasks));
+}
+
+static void PublishQueueLocked(AppState &state) {
+  state.queued_tasks = (int)state.task_queue.size();
+}
+
+// The task list as last published; never blocks on tasks_mutex
+static std::shared_ptr<const TaskList> TasksView(const AppState &state) {
+  return std::atomic_load(&state.tasks_view);
+}
+
+// Upper bound on running tasks: with adaptive concurrency every run is either
+// in a build-type phase or waiting on a prompt
+static int TaskLimitLocked(const AppState &state) {
+  if (!state.adaptive_concurrency)
+    return state.max_concurrent_tasks;
+  return AdaptiveBuildBudget(state) + state.max_api_tasks;
+}
+
+// Runs the remote Docker workers take at once, on top of TaskLimitLocked
+static int RemoteSlotsLocked(const AppState &state) {
+  int slots = 0;
+  for (const auto &worker : state.docker_workers)
+    slots += worker.slots;
+  return slots;
+}
+
+// Why the adaptive scheduler should not start another run now, or nullptr if
+// it may (see AdaptiveHoldReason). Caller holds state.tasks_mutex.
+static const char *AdaptiveHoldReasonLocked(const AppState &state) {
+  AdmissionLoad load;
   for (const auto &task : state.tasks) {
-    if (task->is_running)
-      running_count++;
-  }
+    if (!task->is_running || !task->worker.empty())
+      continue;
+    load.running++;
+    if (task->phase.load() != TaskPhase::Prompt)
+      load.heavy++;
+    load.expected_mib += task->envelope.expected_mib;
+  }
+  load.task_limit = TaskLimitLocked(state);
+  load.build_budget = AdaptiveBuildBudget(state);
+  load.host_fresh = state.host_load_fresh;
+  load.host = state.host_load;
+  return AdaptiveHoldReason(load);
+}
+
+// Last path component of a task directory
+static std::string TaskBaseName(const std::string &task_dir) {
+  size_t last_slash = task_dir.find_last_of("/\\");
+  return last_slash != std::string::npos ? task_dir.substr(last_slash + 1)
+                                         : task_dir;
+}
+
+// Catalog mode of a task type ("feedback", "verify", "audit"; "both" has
+// no runs of its own there)
+static std::string CatalogMode(const std::string &task_type) {
+  std::string mode = task_type;
+  std::transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
+  return mode;
+}
+
+// Seconds a run of task_type in task_dir is expected to take: what the
+// duration model learned for its task (a Both run adds up its feedback and
+// verify parts, or overlaps them when they run in parallel), else this
+// session's average for the type; -1 when neither knows. Caller holds
+// state.tasks_mutex.
+static double ExpectedRunSecondsLocked(const AppState &state,
+                                       const std::string &task_dir,
+                                       const std::string &task_type) {
+  std::string task = TaskBaseName(task_dir);
+  double seconds = -1.0;
+  if (task_type == "Both") {
+    double feedback = g_durations.Expected(task, "feedback");
+    double verify = g_durations.Expected(task, "verify");
+    if (feedback >= 0.0 && verify >= 0.0)
+      seconds = state.parallel_both ? std::max(feedback, verify)
+                                    : feedback + verify;
+  } else if (!task_type.empty()) {
+    seconds = g_durations.Expected(task, CatalogMode(task_type));
+  }
+  if (seconds >= 0.0)
+    return seconds;
+  auto it = state.task_type_seconds.find(task_type);
+  return it != state.task_type_seconds.end() ? it->second : -1.0;
+}
+
+// Prompt starts a run of task_type is expected to make: this session's
+// average for the type, else 2 (one prompt each for Prompt 1 and Prompt 2).
+// Caller holds state.tasks_mutex.
+static int ExpectedRunPromptsLocked(const AppState &state,
+                                    const std::string &task_type) {
+  auto it = state.task_type_prompts.find(task_type);
+  return it != state.task_type_prompts.end() ? (int)std::lround(it->second)
+                                             : 2;
+}
+
+// Expected seconds of every queued run, by queue index. Caller holds
+// state.tasks_mutex.
+static std::vector<double>
+ExpectedQueueSecondsLocked(const AppState &state,
+                           const std::vector<QueuedTask> &queue) {
+  std::vector<double> expected;
+  expected.reserve(queue.size());
+  for (const auto &job : queue)
+    expected.push_back(
+        ExpectedRunSecondsLocked(state, job.group, job.task_type));
+  return expected;
+}
+
+// Where the next run of group goes, given whether this host has a free
+// slot (see PlaceQueuedTask), with g_image_directory telling which hosts
+// hold the image of context_hash. endpoint is left empty for this host.
+// Returns false when every host is full. Caller holds state.tasks_mutex.
+static bool PlaceQueuedTaskLocked(const AppState &state,
+                                  const std::string &group,
+                                  const std::string &context_hash,
+                                  bool local_free, std::string &endpoint) {
+  endpoint.clear();
+  std::map<std::string, int> busy;
+  for (const auto &task : state.tasks) {
+    if (task->is_running && !task->worker.empty())
+      busy[task->worker]++;
+  }
+  auto last = state.group_worker.find(group);
+  std::vector<PlacementHost> hosts(1 + state.docker_workers.size());
+  hosts[0].free = local_free ? 1 : 0;
+  hosts[0].holds_image =
+      !context_hash.empty() && g_image_directory.Holds("", context_hash);
+  for (size_t i = 0; i < state.docker_workers.size(); i++) {
+    const DockerWorker &worker = state.docker_workers[i];
+    PlacementHost &host = hosts[i + 1];
+    // A cluster also needs room for the run's pod
+    auto it = busy.find(worker.endpoint);
+    int running = it != busy.end() ? it->second : 0;
+    int cluster = g_clusters.FreeRuns(worker.endpoint, running);
+    host.free = worker.slots - running;
+    if (cluster >= 0)
+      host.free = std::min(host.free, cluster);
+    host.holds_image = !context_hash.empty() &&
+                       g_image_directory.Holds(worker.endpoint, context_hash);
+    host.last_of_group =
+        last != state.group_worker.end() && last->second == worker.endpoint;
+  }
+  int at = PlaceQueuedTask(hosts, !context_hash.empty());
+  if (at > 0)
+    endpoint = state.docker_workers[at - 1].endpoint;
+  return at >= 0;
+}
 
-  if (running_count >= state.max_concurrent_tasks) {
-    // Can't start more tasks - add to queue or reject
+// Create the task for a dequeued run and hand its process to the reactor;
+// worker is the Docker endpoint it was placed on (empty for this host).
+// Caller holds state.tasks_mutex.
+static void LaunchQueuedTaskLocked(AppState &state, const QueuedTask &job,
+                                   const std::string &worker,
+                                   HostLease run_lease) {
+  HeapScope _heap(kHeapTasks);
+  int task_id = state.next_task_id++;
+  auto task = std::make_shared<TaskInstance>(task_id, job.name, job.command);
+  task->task_type = job.task_type;
+  task->group = job.group;
+  task->api_key_id = job.api_key_id;
+  task->batch = job.batch;
+  task->retry = job.retry;
+  task->backup_of = job.backup_of;
+  task->queue_seq = job.seq;
+  task->expected_seconds =
+      ExpectedRunSecondsLocked(state, job.group, job.task_type);
+  task->worker = worker;
+  task->context_hash = job.context_hash;
+  task->gate_dir = job.gate_dir;
+  if (!task->gate_dir.empty())
+    CreateDirectoryRecursive(task->gate_dir);
+  task->workdir_mount = state.workdir_mount;
+  if (!IsClusterWorker(worker))
+    task->package_proxy = PackageProxySpec(
+        state.package_proxy, state.package_proxy_url, worker.empty());
+  task->tree_cpu_percent = state.tree_cpu_percent;
+  task->tree_memory_mb = state.tree_memory_mb;
+  task->pty = state.pty_capture;
+  task->background_builds = state.background_builds;
+  task->background = state.background_builds;
+  // The request comes through the stage gate directory, and the API client
+  // only reaches the local daemon
+  task->attach_exec = state.attach_phase_output && worker.empty() &&
+                      !task->gate_dir.empty();
+  // Only this host's size is known, so remote runs go unlimited
+  if (state.use_container_limits && worker.empty())
+    task->envelope = g_resource_envelopes.For(
+        EnvelopeKey(job.group, job.task_type), state.host_load.cpus,
+        state.host_load.mem_total >> 20);
+  task->classifier = CurrentLogClassifier();
+  task->spool = std::make_unique<LogSpool>();
+  std::string spool_path = TaskSpoolPath(state, task_id);
+  if (!task->spool->Open(spool_path)) {
     if (g_show_debug_console) {
-      ConsoleLog("[WARN] StartTask: at limit, cannot start new task");
+      ConsoleLog("[WARN] StartTask: cannot create log spool " + spool_path);
+    }
+    task->spool.reset();
+  }
+  if (state.record_task_streams && task->spool)
+    task->record_path =
+        spool_path.substr(0, spool_path.size() - strlen(".log")) + ".abrec";
+  if (state.share_log_rings) {
+    task->shared_log = std::make_unique<SharedLogRing>();
+    if (!task->shared_log->Create(task_id)) {
+      if (g_show_debug_console) {
+        ConsoleLog("[WARN] StartTask: cannot create shared log ring " +
+                   SharedLogRing::NameFor(task_id));
+      }
+      task->shared_log.reset();
     }
-    return;
   }
-
-  // Create new task
-  int task_id = state.next_task_id++;
-  auto task = std::make_shared<TaskInstance>(task_id, task_name, cmd);
-  task->log_output.push_back("[INFO] Task started: " + task_name);
-  task->log_output.push_back("[INFO] Command: " + cmd);
+  JournalRun entry;
+  entry.run = task_id;
+  entry.name = job.name;
+  entry.task_type = job.task_type;
+  entry.group = job.group;
+  entry.worker = worker;
+  entry.spool = task->spool ? task->spool->path() : std::string();
+  entry.started_ms = EpochMs();
+  g_run_journal.Started(entry);
+  PushTaskLog(*task, "[INFO] Task started: " + job.name);
+  PushTaskLog(*task, "[INFO] Command: " + job.command);
+  if (!worker.empty())
+    PushTaskLog(*task, "[INFO] Docker worker: " + worker);
+  if (task->envelope.pids != 0) {
+    char limits[96];
+    snprintf(limits, sizeof(limits),
+             "[INFO] Container limits: %.1f CPUs, %llu MiB, %d processes%s",
+             task->envelope.cpus,
+             (unsigned long long)task->envelope.memory_mib,
+             task->envelope.pids,
+             task->envelope.expected_mib != 0 ? "" : " (no history yet)");
+    PushTaskLog(*task, limits);
+  }
   if (g_show_debug_console) {
-    ConsoleLog("[INFO] StartTask: " + task_name);
-    ConsoleLog("[INFO] Cmd: " + cmd);
+    ConsoleLog("[INFO] StartTask: " + job.name);
+    ConsoleLog("[INFO] Cmd: " + job.command);
   }
-  task->is_running = true;
+  SetTaskRunning(*task, true);
   task->container_created = false; // Reset container creation flag
+  task->started_at = std::chrono::steady_clock::now();
+  task->last_output_ms = MonotonicMs();
+  task->run_lease = std::move(run_lease);
 
   // Add to tasks list
   state.tasks.push_back(task);
+  PublishTasksLocked(state);
+
+  // Hand the process to the shared reactor (no per-task thread)
+  LaunchTaskProcess(task);
+}
+
+// Mark the queued runs the daily API quota has no room for yet (see
+// QuotaAllowsStart); committed holds, per API key, the prompts the runs
+// already going are still expected to make. Runs expected to make none are
+// never deferred. Caller holds state.tasks_mutex.
+static void DeferForQuotaLocked(AppState &state,
+                                const std::map<uint64_t, int> &committed) {
+  QuotaPlan plan;
+  plan.reserve = state.api_quota_reserve_pct / 100.0;
+  plan.offpeak_s = state.api_offpeak_hours * 3600.0;
+  time_t now = time(nullptr);
+  std::map<uint64_t, ApiGovernor::Quota> quotas;
+  for (QueuedTask &job : state.task_queue) {
+    job.deferred = false;
+    int prompts = ExpectedRunPromptsLocked(state, job.task_type);
+    if (state.api_daily_quota <= 0 || prompts <= 0)
+      continue;
+    auto quota = quotas.find(job.api_key_id);
+    if (quota == quotas.end())
+      quota = quotas
+                  .emplace(job.api_key_id,
+                           g_api_governor.QuotaOf(job.api_key_id, now))
+                  .first;
+    // How long it can wait and still be done by its batch's deadline
+    double must_start_in_s = -1.0;
+    if (job.deadline != 0) {
+      double run = ExpectedRunSecondsLocked(state, job.group, job.task_type);
+      must_start_in_s = std::max(
+          0.0, difftime(job.deadline, now) - std::max(0.0, run));
+    }
+    auto it = committed.find(job.api_key_id);
+    job.deferred = !QuotaAllowsStart(
+        quota->second, plan, job.urgency, prompts,
+        it != committed.end() ? it->second : 0, must_start_in_s);
+  }
+}
+
+// Start queued runs while there are free slots, here or on a remote worker.
+// Safe to call from any thread; the render loop calls it every frame so runs
+// start as soon as a running task finishes or a host has room for more.
+static void DispatchQueuedTasks(AppState &state) {
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  state.scheduler_hold = nullptr;
+  ConfigureHostLeases(state);
+  if (state.task_queue.empty())
+    return;
+  if (LogShippingBacklogged()) {
+    state.scheduler_hold = "Log shipping backlog";
+    return;
+  }
+  int local_running = 0;
+  // Prompts the running runs are still expected to make, per API key
+  std::map<uint64_t, int> committed;
+  for (const auto &task : state.tasks) {
+    if (!task->is_running)
+      continue;
+    if (task->worker.empty())
+      local_running++;
+    committed[task->api_key_id] += std::max(
+        0, ExpectedRunPromptsLocked(state, task->task_type) -
+               task->prompt_starts);
+  }
+  std::vector<double> expected;
+  if (state.queue_order != QueueOrder::Fair)
+    expected = ExpectedQueueSecondsLocked(state, state.task_queue);
+  DeferForQuotaLocked(state, committed);
+  while (!state.task_queue.empty()) {
+    bool local_free;
+    if (state.adaptive_concurrency) {
+      state.scheduler_hold = AdaptiveHoldReasonLocked(state);
+      local_free = state.scheduler_hold == nullptr;
+    } else {
+      local_free = local_running < state.max_concurrent_tasks;
+    }
+    // This host's slot also has to be free across its other instances
+    HostLease run_lease;
+    if (local_free && !g_host_runs.TryAcquire(run_lease)) {
+      local_free = false;
+      state.scheduler_hold = "host-wide run slots in use";
+    }
+    if (!local_free && state.docker_workers.empty())
+      break;
+    size_t pick = PickQueuedTask(state.task_queue, state.group_last_dispatch,
+                                 state.queue_order, expected);
+    if (pick == state.task_queue.size()) {
+      state.scheduler_hold = "daily API quota saved for later";
+      break;
+    }
+    std::string worker;
+    const QueuedTask &next = state.task_queue[pick];
+    if (!PlaceQueuedTaskLocked(state, next.group, next.context_hash,
+                               local_free, worker))
+      break;
+    QueuedTask job = std::move(state.task_queue[pick]);
+    state.task_queue.erase(state.task_queue.begin() + pick);
+    if (!expected.empty())
+      expected.erase(expected.begin() + pick);
+    PublishQueueLocked(state);
+    state.group_last_dispatch[job.group] = ++state.dispatch_count;
+    state.group_worker[job.group] = worker;
+    if (!worker.empty())
+      run_lease.Release();
+    LaunchQueuedTaskLocked(state, job, worker, std::move(run_lease));
+    if (worker.empty()) {
+      local_running++;
+      state.host_load_fresh = false;
+    }
+    if (state.api_daily_quota > 0) {
+      committed[job.api_key_id] +=
+          ExpectedRunPromptsLocked(state, job.task_type);
+      DeferForQuotaLocked(state, committed);
+    }
+  }
+}
+
+// Queue a run; it starts as soon as a concurrency slot is free. Runs are
+// grouped by task directory (the current one unless given) for fairness.
+// Caller holds state.tasks_mutex
+static QueuedTask &EnqueueTaskLocked(AppState &state,
+                                     const std::string &task_name,
+                                     const std::string &cmd,
+                                     const std::string &task_type,
+                                     const std::string &gate_dir,
+                                     const std::string &task_dir,
+                                     uint64_t batch) {
+  QueuedTask job;
+  job.seq = state.next_queue_seq++;
+  job.name = task_name;
+  job.command = cmd;
+  job.task_type = task_type;
+  job.group = task_dir.empty() ? state.task_directory : task_dir;
+  job.gate_dir = gate_dir;
+  static const char kContextHash[] = "--context-hash ";
+  size_t hash_at = cmd.find(kContextHash);
+  if (hash_at != std::string::npos) {
+    hash_at += sizeof(kContextHash) - 1;
+    job.context_hash =
+        cmd.substr(hash_at, cmd.find(' ', hash_at) - hash_at);
+  }
+  job.api_key_id = ApiKeyId(state.api_key);
+  job.batch = batch;
+  auto it = state.run_batches.find(batch);
+  if (it != state.run_batches.end()) {
+    it->second.runs++;
+    job.urgency = it->second.urgency;
+    job.deadline = it->second.deadline;
+  }
+  job.priority = TaskTypePriority(task_type, job.urgency);
+  state.task_queue.push_back(std::move(job));
+  PublishQueueLocked(state);
+  if (g_show_debug_console) {
+    ConsoleLog("[INFO] Queued task: " + task_name + " (" +
+               std::to_string(state.task_queue.size()) + " waiting)");
+  }
+  return state.task_queue.back();
+}
+
+static void EnqueueTask(AppState &state, const std::string &task_name,
+                        const std::string &cmd, const std::string &task_type,
+                        const std::string &gate_dir = std::string(),
+                        const std::string &task_dir = std::string(),
+                        uint64_t batch = 0) {
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  EnqueueTaskLocked(state, task_name, cmd, task_type, gate_dir, task_dir,
+                    batch);
+}
 
-  // Launch worker thread
-  task->worker_thread = std::thread(ExecuteTaskThread, task);
-  task->worker_thread.detach(); // Detach so we don't need to join manually
+void StartTask(AppState &state, const std::string &task_name,
+               const std::string &cmd) {
+  EnqueueTask(state, task_name, cmd, std::string());
+  DispatchQueuedTasks(state);
 
   // Switch to logs tab
   state.switch_to_logs_tab = true;
 }
 
+// Tag of one run or batch: <task_type><kind><time>_<id>, lowercased. The
+// local time is for people browsing logs and images; the id from g_names
+// is what keeps it unique, so any number can be created at once.
+static std::string RunSuffix(const std::string &task_type, const char *kind) {
+  time_t now = time(nullptr);
+  std::stringstream ss;
+  ss << task_type << kind
+     << std::put_time(std::localtime(&now), "%Y%m%d_%H%M%S") << "_"
+     << g_names.Next();
+  std::string suffix = ss.str();
+  std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+  return suffix;
+}
+
+// Containers the first run of a batch of runs sharing an image starts for
+// the batch (the script's --fan-out): one per run, up to the runs that can
+// go at once, as the rest would only wait idle in the pool
+static int FanOutSize(const AppState &state, int runs) {
+  return std::min(runs, std::max(1, state.max_concurrent_tasks));
+}
+
+// Script mode index of a task type ("Feedback", "Verify", "Both", "Audit")
+static int TaskTypeMode(const std::string &task_type) {
+  if (task_type == "Verify")
+    return 1;
+  if (task_type == "Both")
+    return 2;
+  if (task_type == "Audit")
+    return 3;
+  return 0;
+}
+
+// Deadline of a batch queued now, from its Settings, or 0 for none
+static time_t BatchDeadline(const AppState &state) {
+  if (state.batch_deadline_hours <= 0)
+    return 0;
+  return time(nullptr) + (time_t)state.batch_deadline_hours * 3600;
+}
+
 // NEW: Start multiple tasks of the same type
 // Start tasks immediately but execute them asynchronously
 void StartMultipleTasks(AppState &state, const std::string &task_type,
                         int count) {
   // Determine mode for this task type without mutating UI state
-  int mode = 0;
-  if (task_type == "Feedback")
-    mode = 0;
-  else if (task_type == "Verify")
-    mode = 1;
-  else if (task_type == "Both")
-    mode = 2;
-  else if (task_type == "Audit")
-    mode = 3;
+  int mode = TaskTypeMode(task_type);
 
   std::string base_name = task_type;
-  if (!state.task_directory.empty()) {
-    size_t last_slash = state.task_directory.find_last_of("/\\");
-    std::string basename = (last_slash != std::string::npos)
-                               ? state.task_directory.substr(last_slash + 1)
-                               : state.task_directory;
-    base_name = basename + " - " + task_type;
-  }
+  if (!state.task_directory.empty())
+    base_name = TaskBaseName(state.task_directory) + " - " + task_type;
 
   if (g_show_debug_console) {
     ConsoleLog("[INFO] Preparing to start " + std::to_string(count) +
@@ -4157,2879 +6154,11346 @@ void StartMultipleTasks(AppState &state, const std::string &task_type,
   // Switch to logs tab immediately to show user that tasks are starting
   state.switch_to_logs_tab = true;
 
-  // Create all tasks in a background thread to avoid blocking the UI
-  // Use sequential creation to avoid race conditions in Docker image naming
-  std::thread([&state, task_type, count, mode, base_name]() {
-    for (int i = 0; i < count; i++) {
-      std::string task_name = base_name;
-      if (count > 1) {
-        task_name += " #" + std::to_string(i + 1);
-      }
-
-      // Generate unique suffix for this task to avoid Docker image conflicts
-      // Use timestamp + task number to ensure uniqueness even when created
-      // simultaneously
-      auto now = std::chrono::system_clock::now();
-      auto time_t = std::chrono::system_clock::to_time_t(now);
-      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    now.time_since_epoch()) %
-                1000;
-
-      std::stringstream ss;
-      ss << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S");
-      ss << "_" << std::setfill('0') << std::setw(3) << ms.count();
-      ss << "_" << std::to_string(i + 1);
-
-      std::string unique_suffix = task_type + "_task" + ss.str();
-      std::transform(unique_suffix.begin(), unique_suffix.end(),
-                     unique_suffix.begin(), ::tolower);
-
-      // Build command using override mode to avoid touching UI state
-      std::string cmd = BuildCommand(state, unique_suffix, mode);
-      if (g_show_debug_console) {
-        ConsoleLog("[INFO] Built command for [" + task_name + "]: " + cmd);
-      }
+  // One image tag for the whole batch when its runs share a build
+  std::string shared_image_suffix;
+  if (state.build_once_for_multiple && count > 1)
+    shared_image_suffix = RunSuffix(task_type, "_batch");
+
+  // Runs of the batch stop early once its stop rule is met
+  uint64_t batch = 0;
+  BatchPolicy policy;
+  policy.max_failures = state.batch_max_failures;
+  policy.target_passes = state.batch_target_passes;
+  policy.ci_half_width = state.batch_ci_pct / 100.0;
+  BatchUrgency urgency = (BatchUrgency)state.batch_urgency;
+  time_t deadline = BatchDeadline(state);
+  if ((count > 1 && policy.Active()) || urgency != BatchUrgency::Normal ||
+      deadline != 0) {
+    std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+    batch = state.next_batch_id++;
+    RunBatch &run_batch = state.run_batches[batch];
+    run_batch.name = base_name;
+    run_batch.policy = policy;
+    run_batch.urgency = urgency;
+    run_batch.deadline = deadline;
+    state.run_batch_count = (int)state.run_batches.size();
+  }
+
+  // Queue every run up front; the scheduler starts them as slots free up
+  for (int i = 0; i < count; i++) {
+    std::string task_name = base_name;
+    if (count > 1) {
+      task_name += " #" + std::to_string(i + 1);
+    }
 
-      StartTask(state, task_name, cmd);
+    // Suffix of this run's image, container and log directory
+    std::string unique_suffix = RunSuffix(task_type, "_task");
 
-      // Small delay between task creation to ensure proper sequencing
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // Build command using override mode to avoid touching UI state
+    std::string gate_dir = TaskStageGatePath(state, unique_suffix);
+    std::string cmd =
+        BuildCommand(state, unique_suffix, mode, gate_dir,
+                     shared_image_suffix, nullptr, std::string(), nullptr,
+                     FanOutSize(state, count));
+    if (g_show_debug_console) {
+      ConsoleLog("[INFO] Built command for [" + task_name + "]: " + cmd);
     }
-  }).detach();
+
+    EnqueueTask(state, task_name, cmd, task_type, gate_dir, std::string(),
+                batch);
+  }
+  DispatchQueuedTasks(state);
 }
 
-void StopAllTasks(AppState &state) {
-  std::lock_guard<std::mutex> lock(state.tasks_mutex);
+// Feedback phases in the order autobuild.sh runs them
+static const char *const kFeedbackPhases[] = {
+    "npm_install", "gemini_prompt1", "verification", "gemini_prompt2"};
 
-  // Immediately stop all tasks first
-  for (auto &task : state.tasks) {
-    if (task->is_running) {
-      task->should_stop = true;
-      // Terminate process immediately if we have a handle
-#ifdef _WIN32
-      if (task->process_handle) {
-        TerminateProcess(task->process_handle, 1);
-      }
-#else
-      // On Unix, send SIGTERM to the process
-      if (task->process_handle > 0) {
-        if (g_show_debug_console) {
-          ConsoleLog("[DEBUG][Mac/Linux] Sending SIGTERM to task PID: " +
-                     std::to_string(task->process_handle));
-        }
-        int result = kill(task->process_handle, SIGTERM);
-        if (result != 0 && g_show_debug_console) {
-          ConsoleLog("[ERROR][Mac/Linux] kill() failed: " +
-                     std::string(strerror(errno)));
-        }
-      }
-#endif
-    }
+// First phase the checkpoint in a feedback log directory does not record as
+// done ("done <phase>" lines), or "" when there is no checkpoint or every
+// phase finished
+static std::string CheckpointResumePoint(const std::string &log_dir) {
+  std::ifstream in(log_dir + "/checkpoint");
+  if (!in)
+    return "";
+  std::vector<std::string> done;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.compare(0, 5, "done ") == 0)
+      done.push_back(line.substr(5));
   }
+  for (const char *phase : kFeedbackPhases)
+    if (std::find(done.begin(), done.end(), phase) == done.end())
+      return phase;
+  return "";
+}
 
-  // Start Docker cleanup in a separate thread (non-blocking)
-  std::thread([&state]() {
-    // Only stop containers that match our task naming pattern
-    std::string kill_autobuild_cmd =
-        "docker kill $(docker ps -q --filter \"name=autobuild-*\") 2>/dev/null "
-        "|| true";
-
-#ifdef _WIN32
-    std::string bash = FindBash();
-    if (!bash.empty()) {
-      // Skip graceful stop, go straight to kill for immediate termination
-      std::string args = std::string("-lc \"export PATH=/c/Program\\ "
-                                     "Files/Docker/Docker/resources/bin:/"
-                                     "mingw64/bin:/usr/bin:$PATH && ") +
-                         kill_autobuild_cmd + "\"";
-      std::vector<std::string> output;
-      DWORD exit_code;
-      RunHiddenCaptureExe(bash, args, output, exit_code);
-    }
-#else
-    // Skip graceful stop, go straight to kill for immediate termination
-    std::vector<std::string> output;
-    int exit_code;
-    RunHiddenCaptureExe("bash",
-                        std::string("-c \"") + kill_autobuild_cmd + "\"",
-                        output, exit_code);
-#endif
-  }).detach(); // Detach so it runs independently
+// Queue a run that continues a finished, failed or stopped feedback run
+// from its checkpoint, in the container and log directory it left behind
+static void ResumeFeedbackTask(AppState &state, const TaskInstance &task,
+                               const std::string &log_dir) {
+  TaskValidation validation = ValidateTaskDirectory(task.group);
+  std::string unique_suffix = RunSuffix("Feedback", "_resume");
+  std::string gate_dir = TaskStageGatePath(state, unique_suffix);
+  std::string cmd = BuildCommand(state, unique_suffix, 0, gate_dir,
+                                 std::string(), &validation, log_dir);
+  EnqueueTask(state, task.name + " (resumed)", cmd, "Feedback", gate_dir,
+              task.group);
+  state.switch_to_logs_tab = true;
+  DispatchQueuedTasks(state);
 }
 
-void RemoveTask(AppState &state, int task_id) {
-  std::lock_guard<std::mutex> lock(state.tasks_mutex);
-  for (auto it = state.tasks.begin(); it != state.tasks.end(); ++it) {
-    if ((*it)->id == task_id) {
-      // Store the task pointer before any operations that might invalidate the
-      // iterator
-      auto task_ptr = *it;
+// Queue a fresh run of a task's task directory and mode under name, its
+// suffix of the given kind; resume_dir as for BuildCommand. Null for a
+// custom command, which has no mode to build it again from. Caller holds
+// state.tasks_mutex.
+static QueuedTask *QueueRunLikeLocked(AppState &state,
+                                      const TaskInstance &task,
+                                      const char *kind,
+                                      const std::string &name,
+                                      const std::string &resume_dir,
+                                      uint64_t batch) {
+  int mode = -1;
+  for (int m = 0; m < 4; m++) {
+    if (task.task_type == modes[m])
+      mode = m;
+  }
+  if (mode < 0)
+    return nullptr;
+  TaskValidation validation = ValidateTaskDirectory(task.group);
+  std::string unique_suffix = RunSuffix(task.task_type, kind);
+  std::string gate_dir = TaskStageGatePath(state, unique_suffix);
+  std::string cmd = BuildCommand(state, unique_suffix, mode, gate_dir,
+                                 std::string(), &validation, resume_dir);
+  return &EnqueueTaskLocked(state, name, cmd, task.task_type, gate_dir,
+                            task.group, batch);
+}
 
-      // If task is running, stop it first using the same logic as StopAllTasks
-      if (task_ptr->is_running) {
-        task_ptr->should_stop = true;
-        task_ptr->is_running = false;
+// Queue a run the stall watchdog ended again: a feedback run from the phase
+// its checkpoint stopped at when it has one (as Resume does), any other
+// from the start. Caller holds state.tasks_mutex.
+static void RequeueStalledRunLocked(AppState &state, TaskInstance &task) {
+  std::string resume_dir;
+  if (task.task_type == "Feedback") {
+    std::string log_dir;
+    {
+      std::lock_guard<std::mutex> lock(task.resources_mutex);
+      log_dir = task.log_dir;
+    }
+    if (!log_dir.empty() &&
+        !CheckpointResumePoint(ResolveStagedPath(log_dir)).empty())
+      resume_dir = log_dir;
+  }
+  int retry = task.retry + 1;
+  std::string name = task.name.substr(0, task.name.find(" (retry "));
+  name += " (retry " + std::to_string(retry) + ")";
+  QueuedTask *job = QueueRunLikeLocked(state, task, "_retry", name,
+                                       resume_dir, task.batch);
+  if (!job) {
+    PushTaskLog(task, "[WARN] Watchdog: a custom command is not queued "
+                      "again");
+    return;
+  }
+  job->retry = retry;
+  if (!resume_dir.empty())
+    name += ", resuming from its checkpoint";
+  PushTaskLog(task, "[INFO] Watchdog: queued again as " + name);
+}
 
-        // Terminate process immediately if we have a handle
-#ifdef _WIN32
-        if (task_ptr->process_handle) {
-          TerminateProcess(task_ptr->process_handle, 1);
-          CloseHandle(task_ptr->process_handle);
-          task_ptr->process_handle = NULL;
-        }
-#else
-        // On Unix, send SIGTERM to the process
-        if (task_ptr->process_handle > 0) {
-          if (g_show_debug_console) {
-            ConsoleLog(
-                "[DEBUG][Mac/Linux] Deleting task, sending SIGTERM to PID: " +
-                std::to_string(task_ptr->process_handle));
-          }
-          int result = kill(task_ptr->process_handle, SIGTERM);
-          if (result != 0 && g_show_debug_console) {
-            ConsoleLog("[ERROR][Mac/Linux] kill() failed: " +
-                       std::string(strerror(errno)));
-          }
-          task_ptr->process_handle = 0;
-        }
-#endif
+// A running run is a straggler once it has taken this many times what the
+// duration model expects, and at least kBackupMinSeconds
+static const double kBackupAfterFactor = 1.5;
+static const double kBackupMinSeconds = 120.0;
 
-        // Extract the data we need before creating the thread
-        std::string task_name = task_ptr->name;
-        size_t dash_pos = task_name.find(" - ");
-        std::string basename;
-        if (dash_pos != std::string::npos) {
-          basename = task_name.substr(0, dash_pos);
-        }
-
-        // Start Docker cleanup in a separate thread (non-blocking)
-        std::thread([basename]() {
-          // Use the extracted basename directly - no need to access the task
-          // object Try multiple container name patterns to ensure we catch the
-          // container
-          std::vector<std::string> kill_commands = {
-              "docker kill $(docker ps -q --filter \"name=autobuild-" +
-                  basename + "_from_task*\") 2>/dev/null || true",
-              "docker kill $(docker ps -q --filter \"name=" + basename +
-                  "_from_task*\") 2>/dev/null || true",
-              "docker kill $(docker ps -q --filter \"name=autobuild-" +
-                  basename + "*\") 2>/dev/null || true",
-              "docker kill $(docker ps -q --filter \"name=" + basename +
-                  "*\") 2>/dev/null || true"};
+static std::string FormatEta(double secs);
 
-#ifdef _WIN32
-          std::string bash = FindBash();
-          if (!bash.empty()) {
-            for (const auto &kill_cmd : kill_commands) {
-              std::string args =
-                  std::string("-lc \"export PATH=/c/Program\\ "
-                              "Files/Docker/Docker/resources/bin:/"
-                              "mingw64/bin:/usr/bin:$PATH && ") +
-                  kill_cmd + "\"";
-              std::vector<std::string> output;
-              DWORD exit_code;
-              RunHiddenCaptureExe(bash, args, output, exit_code);
-            }
-          }
-#else
-          for (const auto &kill_cmd : kill_commands) {
-            std::vector<std::string> output;
-            int exit_code;
-            RunHiddenCaptureExe("bash", std::string("-c \"") + kill_cmd + "\"",
-                                output, exit_code);
-          }
-#endif
-        }).detach();
-      }
+// Modes whose runs may run twice at once: audits and verify trials only
+// read the task directory, each in its own container, so a second copy
+// changes nothing but which one finishes first
+static bool BackupSafeMode(const std::string &task_type) {
+  return task_type == "Audit" || task_type == "Verify";
+}
 
-      // Wait for thread to finish if it's joinable
-      if (task_ptr->worker_thread.joinable()) {
-        task_ptr->worker_thread.join();
-      }
+// Speculative backups for the tail of a batch: once nothing is queued and
+// local slots are free, the running stragglers furthest past their
+// expected time get a second copy each, the slowest first. The first of
+// the two to finish is kept and the other stopped (see
+// SettleBackupRaceLocked); a backup counts toward the original's batch in
+// its place. Caller holds state.tasks_mutex.
+static void QueueBackupRunsLocked(AppState &state) {
+  if (!state.speculative_backups || !state.task_queue.empty())
+    return;
+  int local_running = 0;
+  for (const auto &task : state.tasks) {
+    if (task->is_running && task->worker.empty())
+      local_running++;
+  }
+  int free = TaskLimitLocked(state) - local_running;
+  if (free <= 0)
+    return;
+  auto now = std::chrono::steady_clock::now();
+  std::vector<std::pair<double, TaskInstance *>> stragglers;
+  for (const auto &task : state.tasks) {
+    if (!task->is_running || task->should_stop || task->backed_up ||
+        task->backup_of != 0 || task->stalled || task->orphan_live ||
+        !BackupSafeMode(task->task_type) || task->expected_seconds <= 0.0)
+      continue;
+    double elapsed =
+        std::chrono::duration<double>(now - task->started_at).count();
+    if (elapsed < kBackupMinSeconds ||
+        elapsed < task->expected_seconds * kBackupAfterFactor)
+      continue;
+    stragglers.emplace_back(elapsed / task->expected_seconds, task.get());
+  }
+  std::sort(stragglers.begin(), stragglers.end(),
+            [](const auto &a, const auto &b) { return a.first > b.first; });
+  for (const auto &straggler : stragglers) {
+    if (free-- <= 0)
+      break;
+    TaskInstance &task = *straggler.second;
+    QueuedTask *job = QueueRunLikeLocked(state, task, "_backup",
+                                         task.name + " (backup)",
+                                         std::string(), 0);
+    if (!job)
+      continue;
+    job->backup_of = task.id;
+    job->batch = task.batch; // counted once, by whichever run finishes
+    task.backed_up = true;
+    PushTaskLog(task, "[INFO] Running " +
+                          FormatEta(straggler.first * task.expected_seconds) +
+                          " against an expected " +
+                          FormatEta(task.expected_seconds) +
+                          "; a backup run is queued and the first to "
+                          "finish is kept");
+  }
+}
 
-      // Now safely erase the task from the vector
-      state.tasks.erase(it);
+// Process body of a synthetic load task (autobuild_main --synthetic-load):
+// prints load.lines_per_sec lines a second for load.seconds in 10 ms ticks,
+// inside one timed phase so the timeline has something to show. Returns the
+// exit code; 1 when stdout went away.
+static int RunSyntheticLoad(const SyntheticLoad &load) {
+  static const char *kLines[] = {
+      "#%lld [build 4/9] RUN npm ci --no-audit --no-fund",
+      "\033[32m[INFO]\033[0m step %lld: container autobuild-synthetic ready",
+      "npm WARN deprecated inflight@1.0.6: line %lld is not supported",
+      "\033[33m[WARN]\033[0m retrying fetch %lld (ECONNRESET)",
+      "\033[1;31mERROR\033[0m verify.sh: test_%lld failed (exit 1)",
+      "    at Object.<anonymous> (/workspace/src/index.test.js:%lld:17)",
+  };
+  const size_t kinds = sizeof(kLines) / sizeof(kLines[0]);
+  std::string long_line;
+  while (long_line.size() < kSyntheticLongLine)
+    long_line += "0123456789abcdef";
+  static char out_buf[1 << 16];
+  setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+  auto epoch_ms = []() {
+    return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  };
+  printf("[TIMING] begin synthetic %lld\n", epoch_ms());
+  auto start = std::chrono::steady_clock::now();
+  long long emitted = 0, extra = 0;
+  int bursts = 0;
+  char line[256];
+  for (;;) {
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    if (elapsed >= load.seconds)
       break;
+    if (load.burst_lines > 0 && load.burst_every_s > 0 &&
+        elapsed >= (double)(bursts + 1) * load.burst_every_s) {
+      bursts++;
+      extra += load.burst_lines;
+    }
+    long long due = (long long)(elapsed * load.lines_per_sec) + extra;
+    for (; emitted < due; emitted++) {
+      if ((emitted * 37) % 100 < load.long_line_pct) {
+        fputs("[LONG] ", stdout);
+        fputs(long_line.c_str(), stdout);
+        fputc('\n', stdout);
+      } else if (emitted % 50 == 49) {
+        // Progress bar redrawn in place; only the final state is kept
+        printf("Downloading layer %lld:  12%%\rDownloading layer %lld:  56%%"
+               "\rDownloading layer %lld: 100%%\n",
+               emitted, emitted, emitted);
+      } else {
+        snprintf(line, sizeof(line), kLines[emitted % kinds], emitted);
+        puts(line);
+      }
     }
+    if (fflush(stdout) != 0 || ferror(stdout))
+      return 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
+  printf("[TIMING] end synthetic %lld 0\n", epoch_ms());
+  printf("[SUCCESS] Synthetic load done: %lld lines in %d s\n", emitted,
+         load.seconds);
+  fflush(stdout);
+  return 0;
 }
 
-int GetRunningTaskCount(AppState &state) {
-  std::lock_guard<std::mutex> lock(state.tasks_mutex);
-  int count = 0;
-  for (const auto &task : state.tasks) {
-    if (task->is_running)
-      count++;
+// Command line that runs this executable as a synthetic load task
+static std::string SyntheticLoadCommand(const SyntheticLoad &load) {
+  return "\"" + GetExecutablePath() + "\" --synthetic-load" +
+         " --rate " + std::to_string(load.lines_per_sec) +
+         " --seconds " + std::to_string(load.seconds) +
+         " --burst " + std::to_string(load.burst_lines) +
+         " --burst-every " + std::to_string(load.burst_every_s) +
+         " --long-pct " + std::to_string(load.long_line_pct);
+}
+
+// Queue count synthetic load runs; they share one queue group of their own
+// so they do not skew fairness between real task directories
+static void StartSyntheticTasks(AppState &state, int count) {
+  std::string cmd = SyntheticLoadCommand(state.synthetic_load);
+  for (int i = 0; i < count; i++) {
+    EnqueueTask(state, "Synthetic #" + std::to_string(i + 1), cmd,
+                "Synthetic", std::string(), "synthetic");
   }
-  return count;
+  state.switch_to_logs_tab = true;
+  DispatchQueuedTasks(state);
 }
 
-// Helpers for Manage tab
-static std::vector<std::string> RunShellLines(const std::string &sh) {
-#ifdef _WIN32
-  std::string bash = FindBash();
-  std::vector<std::string> lines;
+// Process body of a replay task (autobuild_main --replay): writes a
+// StreamRecorder recording back to stdout at speed (see
+// ReplayStreamRecording), so the reactor, ingest and log windows see the
+// recorded run's bytes and pacing again. Markers in it (timings, rate
+// limits) are replayed as they were, old timestamps and all.
+static int RunReplay(const std::string &path, double speed) {
+  std::vector<RecordedChunk> chunks;
+  if (!ReadStreamRecording(path, chunks)) {
+    fprintf(stderr, "[ERROR] Cannot read recording %s\n", path.c_str());
+    return 2;
+  }
+  uint64_t total = 0;
+  for (const RecordedChunk &chunk : chunks)
+    total += chunk.bytes.size();
 #ifdef _WIN32
-  DWORD code = 0;
-#else
-  int code = 0;
-#endif
-  if (bash.empty()) {
-    lines.push_back(
-        "[ERROR] Bash not found. Install Git for Windows or MSYS2.");
-    return lines;
-  }
-  std::string args =
-      std::string(
-          "-lc \"export PATH=/c/Program\\ "
-          "Files/Docker/Docker/resources/bin:/mingw64/bin:/usr/bin:$PATH && ") +
-      sh + "\"";
-  RunHiddenCaptureExe(bash, args, lines, code);
-  return lines;
-#else
-  std::string cmd = sh;
-  std::vector<std::string> lines;
-  FILE *pipe = popen(cmd.c_str(), "r");
-  if (!pipe)
-    return lines;
-  char buffer[512];
-  while (fgets(buffer, sizeof(buffer), pipe)) {
-    std::string line(buffer);
-    if (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
-      line.pop_back();
-    if (!line.empty() && (line.back() == '\r'))
-      line.pop_back();
-    lines.push_back(line);
-  }
-  pclose(pipe);
-  return lines;
+  // The recorded line ends as they were, not with another CR added
+  _setmode(_fileno(stdout), _O_BINARY);
 #endif
+  return ReplayStreamRecording(chunks, speed, stdout) == total ? 0 : 1;
 }
 
-static std::string ExtractTimestamp(const std::string &container_name) {
-  size_t p = container_name.find_last_of('-');
-  if (p == std::string::npos || p + 1 >= container_name.size())
-    return "";
-  std::string t = container_name.substr(p + 1);
-  for (char c : t)
-    if (c < '0' || c > '9')
-      return "";
-  return t;
+// Queue count runs replaying state.replay_path, in a queue group of their
+// own like the synthetic ones
+static void StartReplayTasks(AppState &state, int count) {
+  std::string cmd = "\"" + GetExecutablePath() + "\" --replay \"" +
+                    state.replay_path + "\" --speed " +
+                    std::to_string(state.replay_speed);
+  for (int i = 0; i < count; i++) {
+    EnqueueTask(state, "Replay #" + std::to_string(i + 1), cmd, "Replay",
+                std::string(), "replay");
+  }
+  state.switch_to_logs_tab = true;
+  DispatchQueuedTasks(state);
 }
 
-static bool FindDirByName(const std::string &root, const std::string &needle,
-                          std::string &out, int depth = 3) {
-  if (depth < 0)
-    return false;
-  DIR *d = opendir(root.c_str());
-  if (!d)
-    return false;
-  struct dirent *e;
-  bool ok = false;
-  struct stat st{};
-  while (!ok && (e = readdir(d)) != NULL) {
-    if (e->d_name[0] == '.')
-      continue;
-    std::string name(e->d_name);
-    std::string p = root + "/" + name;
-    if (stat(p.c_str(), &st) != 0)
-      continue;
-    if (S_ISDIR(st.st_mode)) {
-      if (name == needle) {
-        out = p;
-        ok = true;
-        break;
-      }
-      if (FindDirByName(p, needle, out, depth - 1)) {
-        ok = true;
-        break;
+// Queue runs[mode] runs of each mode for every task in tasks that can run
+// it, all in one go; returns how many runs were queued. The runs of one task
+// and mode share an image build when build_once_for_multiple is set.
+// show_logs switches to the logs tab once something was queued.
+static int QueueTaskBatch(AppState &state,
+                          const std::vector<TaskValidation> &tasks,
+                          const int runs[4], bool show_logs = true) {
+  int queued = 0;
+  for (const auto &task : tasks) {
+    std::string base_name = TaskBaseName(task.task_dir);
+    for (int mode = 0; mode < 4; mode++) {
+      if (runs[mode] <= 0 || !TaskRunnable(task, mode))
+        continue;
+      std::string task_type = modes[mode];
+      std::string shared_image_suffix;
+      if (state.build_once_for_multiple && runs[mode] > 1)
+        shared_image_suffix = RunSuffix(task_type, "_batch");
+      for (int i = 0; i < runs[mode]; i++) {
+        std::string task_name = base_name + " - " + task_type;
+        if (runs[mode] > 1)
+          task_name += " #" + std::to_string(i + 1);
+        std::string unique_suffix = RunSuffix(task_type, "_task");
+        std::string gate_dir = TaskStageGatePath(state, unique_suffix);
+        std::string cmd = BuildCommand(
+            state, unique_suffix, mode, gate_dir, shared_image_suffix, &task,
+            std::string(), nullptr, FanOutSize(state, runs[mode]));
+        EnqueueTask(state, task_name, cmd, task_type, gate_dir,
+                    task.task_dir);
+        queued++;
       }
     }
   }
-  closedir(d);
-  return ok;
+  if (g_show_debug_console) {
+    ConsoleLog("[INFO] Queued " + std::to_string(queued) + " run(s) for " +
+               std::to_string(tasks.size()) + " task folder(s)");
+  }
+  if (queued > 0) {
+    state.switch_to_logs_tab = state.switch_to_logs_tab || show_logs;
+    DispatchQueuedTasks(state);
+  }
+  return queued;
 }
 
-static std::string FindLatestModePath(const std::string &root,
-                                      const std::string &mode) {
-  time_t best_time = 0;
-  std::string best_path;
-  DIR *root_dir = opendir(root.c_str());
-  if (!root_dir)
-    return "";
-  struct dirent *task_ent;
-  struct stat st{};
-  while ((task_ent = readdir(root_dir)) != NULL) {
-    if (task_ent->d_name[0] == '.')
-      continue;
-    std::string task_dir = root + "/" + task_ent->d_name;
-    if (!DirectoryExists(task_dir))
-      continue;
-    DIR *ts_dir = opendir(task_dir.c_str());
-    if (!ts_dir)
-      continue;
-    struct dirent *ts_ent;
-    while ((ts_ent = readdir(ts_dir)) != NULL) {
-      if (ts_ent->d_name[0] == '.')
-        continue;
-      std::string ts_path = task_dir + "/" + ts_ent->d_name;
-      if (!DirectoryExists(ts_path))
-        continue;
-      std::string candidate = ts_path + "/" + mode;
-      if (DirectoryExists(candidate)) {
-        if (stat(ts_path.c_str(), &st) == 0) {
-          if (st.st_mtime > best_time) {
-            best_time = st.st_mtime;
-            best_path = candidate;
-          }
-        }
+// Queue a prompt experiment: reps runs in mode of each of variants on every
+// task in tasks that can run it; returns how many runs were queued. Each
+// variant is a batch of its own under the Run Multiple stop rules, so its
+// pass rate shows as results come in and a variant that is clearly better
+// or worse stops early. The runs of one task share one image build whatever
+// their prompts, and are queued a round at a time with the variants taking
+// turns, so every variant sees the same tasks, slots and API load throughout
+// instead of one variant running before the next.
+static int QueuePromptMatrix(AppState &state,
+                             const std::vector<TaskValidation> &tasks,
+                             const std::vector<PromptVariant> &variants,
+                             int mode, int reps) {
+  std::vector<const TaskValidation *> ready;
+  for (const auto &task : tasks) {
+    if (TaskRunnable(task, mode))
+      ready.push_back(&task);
+  }
+  if (ready.empty() || variants.empty() || reps < 1)
+    return 0;
+  std::string task_type = modes[mode];
+
+  BatchPolicy policy;
+  policy.max_failures = state.batch_max_failures;
+  policy.target_passes = state.batch_target_passes;
+  policy.ci_half_width = state.batch_ci_pct / 100.0;
+  std::vector<uint64_t> batches;
+  time_t deadline = BatchDeadline(state);
+  {
+    std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+    for (const auto &variant : variants) {
+      uint64_t id = state.next_batch_id++;
+      RunBatch &batch = state.run_batches[id];
+      batch.name = "Matrix " + variant.name;
+      batch.policy = policy;
+      batch.urgency = (BatchUrgency)state.batch_urgency;
+      batch.deadline = deadline;
+      batches.push_back(id);
+    }
+    state.run_batch_count = (int)state.run_batches.size();
+  }
+  std::vector<std::string> images;
+  for (size_t t = 0; t < ready.size(); t++)
+    images.push_back(RunSuffix(task_type, "_matrix"));
+
+  int queued = 0;
+  for (int r = 0; r < reps; r++) {
+    for (size_t t = 0; t < ready.size(); t++) {
+      const TaskValidation &task = *ready[t];
+      for (size_t v = 0; v < variants.size(); v++) {
+        std::string task_name = TaskBaseName(task.task_dir) + " - " +
+                                variants[v].name + " #" +
+                                std::to_string(r + 1);
+        std::string unique_suffix = RunSuffix(task_type, "_task");
+        std::string gate_dir = TaskStageGatePath(state, unique_suffix);
+        std::string cmd =
+            BuildCommand(state, unique_suffix, mode, gate_dir, images[t],
+                         &task, std::string(), &variants[v],
+                         FanOutSize(state, reps * (int)variants.size()));
+        EnqueueTask(state, task_name, cmd, task_type, gate_dir,
+                    task.task_dir, batches[v]);
+        queued++;
       }
     }
-    closedir(ts_dir);
   }
-  closedir(root_dir);
-  return best_path;
+  if (g_show_debug_console) {
+    ConsoleLog("[INFO] Queued a prompt matrix of " +
+               std::to_string(variants.size()) + " variant(s) x " +
+               std::to_string(ready.size()) + " task(s) x " +
+               std::to_string(reps) + " run(s)");
+  }
+  state.switch_to_logs_tab = true;
+  DispatchQueuedTasks(state);
+  return queued;
 }
 
-static std::string GuessLogPathForContainer(const AppState &state,
-                                            const std::string &name) {
-  // Resolve a log root candidate by walking up a few directories if needed
-  auto resolve_root = [](const std::string &root) -> std::string {
-    if (DirectoryExists(root))
-      return root;
-    std::string prefix = "";
-    for (int i = 0; i < 4; i++) {
-      if (DirectoryExists(prefix + root))
-        return prefix + root;
-      prefix += "../";
-    }
-    return root; // fallback
-  };
-  // Prefer mode from container name
-  std::string mode;
-  if (name.find("-feedback-") != std::string::npos)
-    mode = "feedback";
-  else if (name.find("-verify-") != std::string::npos)
-    mode = "verify";
+// A run's container, by id, and the Docker endpoint it is on (empty: local)
+struct ContainerRef {
+  std::string endpoint;
+  std::string id;
+};
 
-  for (const auto &root : state.log_folder_paths) {
-    std::string r = resolve_root(root);
-    if (!mode.empty()) {
-      std::string p = FindLatestModePath(r, mode);
-      if (!p.empty())
-        return p;
-    } else {
-      std::string p1 = FindLatestModePath(r, "feedback");
-      std::string p2 = FindLatestModePath(r, "verify");
-      if (!p1.empty())
-        return p1;
-      if (!p2.empty())
-        return p2;
-    }
+// The container the task's script announced; false before it has one
+static bool TaskContainerRef(TaskInstance &task, ContainerRef &ref) {
+  std::lock_guard<std::mutex> lock(task.resources_mutex);
+  if (task.container_id.empty())
+    return false;
+  ref.endpoint = task.worker;
+  ref.id = task.container_id;
+  return true;
+}
+
+// How long teardown waits for stopped runs' processes to exit before it
+// kills their containers anyway (the reactor sends SIGKILL after
+// kReactorTermGraceMs)
+static const int kTeardownDeadlineMs = 2000;
+
+// The containers of a batch of stopped runs (see TeardownCoordinator), all
+// killed together: one Docker API request each for local ones (one docker
+// kill for all of them without the API), one docker kill per remote worker
+static void KillTeardownBatch(
+    const std::vector<std::shared_ptr<TaskInstance>> &batch) {
+  std::map<std::string, std::string> cli; // endpoint -> " id id ..."
+  bool local_up = DockerDaemonHealth().Available();
+  for (const auto &task : batch) {
+    ContainerRef c;
+    // A cluster run's pod goes with its Job, which its script deletes
+    if (!TaskContainerRef(*task, c) || (c.endpoint.empty() && !local_up) ||
+        IsClusterWorker(c.endpoint))
+      continue;
+    int status = 0;
+    JsonValue body;
+    if (c.endpoint.empty() &&
+        DockerApiCall("POST", "/containers/" + c.id + "/kill", status, body))
+      continue;
+    cli[c.endpoint] += " " + c.id;
   }
-  return "";
+  for (const auto &ids : cli)
+    RunShellLines(DockerWorkerPrefix(ids.first) + "docker kill" + ids.second +
+                  " >/dev/null 2>&1 || true");
 }
 
-static void RefreshDockerState(AppState &state) {
-  // Build temporary containers/images WITHOUT holding the lock
-  // This prevents UI freezing while Docker commands run
-  std::vector<AppState::DockerContainer> temp_containers;
-  std::vector<AppState::DockerImage> temp_images;
-  bool temp_unavailable = false;
-  bool temp_loaded = false;
-
-  // Check if Docker is available by running a simple ping command
-  auto ping_result = RunShellLines("docker info 2>&1");
-  bool docker_available = false;
-  for (const auto &ln : ping_result) {
-    // Check for common Docker unavailability errors
-    if (ln.find("error during connect") != std::string::npos ||
-        ln.find("Cannot connect to the Docker daemon") != std::string::npos ||
-        ln.find("Is the docker daemon running") != std::string::npos ||
-        ln.find("no puede encontrar") !=
-            std::string::npos || // Spanish: "cannot find"
-        ln.find("El sistema no puede encontrar") != std::string::npos) {
-      temp_unavailable = true;
-      temp_loaded = true;
-      // Update state quickly with lock
-      {
-        std::lock_guard<std::mutex> lock(state.docker_state_mutex);
-        state.containers.clear();
-        state.images.clear();
-        state.docker_unavailable = temp_unavailable;
-        state.docker_loaded = temp_loaded;
+// Stopped runs from StopAllTasks and RemoveTask
+static TeardownCoordinator<TaskInstance> g_teardown{
+    kTeardownDeadlineMs,
+    {[]() { HeapThread("Teardown", kHeapDocker); }, KillTeardownBatch,
+     WakeMainLoop}};
+
+// Journaled runs whose containers outlived the last instance (see
+// RestoreJournaledRuns)
+static ReattachWatcher<TaskInstance> g_reattach{
+    {[]() {
+       TRACE_THREAD("Reattach watcher");
+       HeapThread("Reattach watcher", kHeapTasks);
+     },
+     [](TaskInstance &task) {
+       FinishPhaseLogs(task);
+       task.orphan_live = false;
+       g_run_journal.Ended(task.id);
+       PushTaskLog(task, "[INFO] Container " + task.container +
+                             " has stopped");
+     },
+     WakeMainLoop}};
+
+// Run journal next to the settings file
+static std::string RunJournalPath() {
+  std::string config = GetConfigFilePath();
+  size_t slash = config.find_last_of("/\\");
+  return (slash == std::string::npos ? std::string()
+                                     : config.substr(0, slash + 1)) +
+         "run_journal.jsonl";
+}
+
+// High-water mark of g_names, next to the settings file
+static std::string NameMarkPath() {
+  std::string config = GetConfigFilePath();
+  size_t slash = config.find_last_of("/\\");
+  return (slash == std::string::npos ? std::string()
+                                     : config.substr(0, slash + 1)) +
+         "name_mark";
+}
+
+// Bring back, as tasks, the runs the journal says were in flight when the
+// last instance went away: their output so far (copied from the old spool
+// into the new one, and shown once the tab is opened), their phase logs
+// followed again from the start, and their containers watched by
+// g_reattach while they run. A feedback run can then continue through
+// Resume from its checkpoint once its container is done.
+static void RestoreJournaledRuns(AppState &state) {
+  HeapScope _heap(kHeapTasks);
+  std::vector<JournalRun> runs;
+  if (!g_run_journal.Open(RunJournalPath(), runs)) {
+    if (g_show_debug_console) {
+      ConsoleLog("[WARN] Cannot write the run journal " + RunJournalPath());
+    }
+    return;
+  }
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  for (const auto &run : runs) {
+    int task_id = state.next_task_id++;
+    auto task = std::make_shared<TaskInstance>(task_id, run.name,
+                                               std::string());
+    task->task_type = run.task_type;
+    task->group = run.group;
+    task->worker = run.worker;
+    task->container = run.container;
+    task->container_id = run.container_id;
+    task->log_dir = ResolveStagedPath(run.log_dir);
+    task->classifier = CurrentLogClassifier();
+    task->spool = std::make_unique<LogSpool>();
+    if (task->spool->Open(TaskSpoolPath(state, task_id))) {
+      std::ifstream old(run.spool, std::ios::binary);
+      LineSplitter splitter;
+      int64_t ms = MonotonicMs();
+      auto on_line = [&](std::string_view line) {
+        task->spool->Append(line, ms);
+      };
+      while (old) {
+        old.read(splitter.Prepare(kPipeReadChunk), kPipeReadChunk);
+        splitter.Commit((size_t)old.gcount());
+        splitter.Drain(on_line);
       }
-      return;
+      splitter.Finish(on_line);
+      task->log_evicted = true; // read back when its tab is opened
+    } else {
+      task->spool.reset();
+    }
+    long long elapsed_ms = std::max(0LL, EpochMs() - run.started_ms);
+    task->started_at = std::chrono::steady_clock::now() -
+                       std::chrono::milliseconds(elapsed_ms);
+    task->run_seconds = elapsed_ms / 1000.0;
+    task->exit_code = -1;
+    task->stats_recorded = true; // it never finished
+    task->summary_recorded = true;
+    PushTaskLog(*task, "[WARN] Reattached after a restart: the script of "
+                       "this run did not survive it");
+    for (const auto &path : run.phase_logs) {
+      if (std::shared_ptr<PhaseLog> log = AddPhaseLog(*task, path))
+        FollowPhaseLog(log);
     }
-    // If we see valid Docker info output, it's available
-    if (ln.find("Server Version") != std::string::npos ||
-        ln.find("Containers:") != std::string::npos) {
-      docker_available = true;
+    bool live = !run.container_id.empty() && !IsClusterWorker(run.worker);
+    if (live) {
+      // Recorded again under its new id until its container stops
+      JournalRun entry = run;
+      entry.run = task_id;
+      entry.phase_logs.clear(); // AddPhaseLog recorded them
+      g_run_journal.Started(entry);
+      PushTaskLog(*task, "[INFO] Following its phase logs while container " +
+                             run.container + " runs");
+      task->orphan_live = true;
+      g_reattach.Watch(task);
+    } else {
+      FinishPhaseLogs(*task);
+    }
+    state.tasks.push_back(task);
+  }
+  if (!runs.empty()) {
+    PublishTasksLocked(state);
+    if (g_show_debug_console) {
+      ConsoleLog("[INFO] Reattached " + std::to_string(runs.size()) +
+                 " run(s) from the run journal");
     }
   }
+}
 
-  // If Docker ping failed completely, mark as unavailable
-  if (!docker_available && !ping_result.empty()) {
-    temp_unavailable = true;
-    temp_loaded = true;
-    // Update state quickly with lock
-    {
-      std::lock_guard<std::mutex> lock(state.docker_state_mutex);
-      state.containers.clear();
-      state.images.clear();
-      state.docker_unavailable = temp_unavailable;
-      state.docker_loaded = temp_loaded;
+// Label of a run's teardown while it is in progress, or nullptr
+static const char *TeardownStageLabel(TeardownStage stage) {
+  switch (stage) {
+  case TeardownStage::Signalled:
+    return "Stopping process";
+  case TeardownStage::Exited:
+  case TeardownStage::Killing:
+    return "Killing container";
+  default:
+    return nullptr;
+  }
+}
+
+// Stop the running tasks match(task) picks. They are flagged first and the
+// reactor is woken once; it terminates all flagged process groups in a
+// single pass. Returns how many were stopped. Caller holds
+// state.tasks_mutex.
+template <typename Match>
+static size_t StopTasksLocked(AppState &state, Match match) {
+  std::vector<std::shared_ptr<TaskInstance>> stopping;
+  for (auto &task : state.tasks) {
+    if (task->is_running && task->teardown == TeardownStage::None &&
+        match(*task)) {
+      task->teardown = TeardownStage::Signalled;
+      task->should_stop = true;
+      stopping.push_back(task);
     }
-    return;
   }
+  if (stopping.empty())
+    return 0;
+  g_process_reactor.Wake();
 
-  // Get containers list (slow operation, no lock held)
-  auto cl = RunShellLines(
-      "docker ps -a --format "
-      "'{{.ID}}\t{{.Names}}\t{{.Image}}\t{{.Status}}\t{{.CreatedAt}}'");
-  for (const auto &ln : cl) {
-    if (ln.empty())
-      continue;
-    // Skip error lines
-    if (ln.find("error during connect") != std::string::npos ||
-        ln.find("Cannot connect") != std::string::npos)
-      continue;
-    std::stringstream ss(ln);
-    std::string id, name, image, status, created;
-    std::getline(ss, id, '\t');
-    std::getline(ss, name, '\t');
-    std::getline(ss, image, '\t');
-    std::getline(ss, status, '\t');
-    std::getline(ss, created, '\t');
-    AppState::DockerContainer dc;
-    dc.id = id;
-    dc.name = name;
-    dc.image = image;
-    dc.status = status;
-    dc.created = created;
-    dc.log_path = GuessLogPathForContainer(state, name);
-    temp_containers.push_back(dc);
-  }
+  // Once the scripts are gone their containers may still be running a
+  // prompt or a verification
+  g_teardown.Add(stopping);
+  return stopping.size();
+}
 
-  // Get images list (slow operation, no lock held)
-  auto il = RunShellLines(
-      "docker images --format '{{.Repository}}:{{.Tag}}\t{{.ID}}\t{{.Size}}'");
-  for (const auto &ln : il) {
-    if (ln.empty())
-      continue;
-    // Skip error lines
-    if (ln.find("error during connect") != std::string::npos ||
-        ln.find("Cannot connect") != std::string::npos)
-      continue;
-    std::stringstream ss(ln);
-    std::string repo, id, size;
-    std::getline(ss, repo, '\t');
-    std::getline(ss, id, '\t');
-    std::getline(ss, size, '\t');
-    temp_images.push_back(AppState::DockerImage{repo, id, size});
-  }
+void StopAllTasks(AppState &state) {
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
 
-  // Now update the state with a very brief lock
-  {
-    std::lock_guard<std::mutex> lock(state.docker_state_mutex);
-    state.containers = std::move(temp_containers);
-    state.images = std::move(temp_images);
-    state.docker_unavailable = false;
-    state.docker_loaded = true;
-  }
+  // Nothing queued should start once everything has been stopped
+  state.task_queue.clear();
+  PublishQueueLocked(state);
+
+  StopTasksLocked(state, [](const TaskInstance &) { return true; });
 }
 
-// Asynchronously refresh Docker state in background thread
-static void RefreshDockerStateAsync(AppState &state) {
-  // If already refreshing, don't start another refresh
-  if (state.docker_refreshing.load()) {
-    return;
+// A run that raced a backup finished first: stop the other one, or drop it
+// from the queue if it never started. Caller holds state.tasks_mutex.
+static void SettleBackupRaceLocked(AppState &state,
+                                   const TaskInstance &winner) {
+  auto is_rival = [&winner](const TaskInstance &t) {
+    return t.id != winner.id &&
+           (t.id == winner.backup_of || t.backup_of == winner.id);
+  };
+  auto &queue = state.task_queue;
+  size_t queued = queue.size();
+  queue.erase(std::remove_if(queue.begin(), queue.end(),
+                             [&winner](const QueuedTask &job) {
+                               return job.backup_of == winner.id;
+                             }),
+              queue.end());
+  if (queue.size() != queued)
+    PublishQueueLocked(state);
+  for (auto &task : state.tasks) {
+    if (task->is_running && is_rival(*task))
+      PushTaskLog(*task, "[INFO] " + winner.name +
+                             " finished first; stopping this copy");
   }
+  StopTasksLocked(state, is_rival);
+}
 
-  // Join previous thread if it exists
-  if (state.docker_refresh_thread.joinable()) {
-    state.docker_refresh_thread.join();
+// Count a finished run of a batch and, once the batch's stop rule is met,
+// drop its queued runs and stop its running ones. Runs stopped by hand say
+// nothing about the pass rate. Caller holds state.tasks_mutex.
+static void RecordBatchResultLocked(AppState &state, const TaskInstance &task) {
+  auto it = state.run_batches.find(task.batch);
+  if (it == state.run_batches.end() || task.should_stop)
+    return;
+  RunBatch &batch = it->second;
+  (task.exit_code == 0 ? batch.passed : batch.failed)++;
+  if (!batch.stop_reason.empty())
+    return;
+  batch.stop_reason =
+      BatchStopReason(batch.policy, batch.passed, batch.failed);
+  if (batch.stop_reason.empty())
+    return;
+  uint64_t id = task.batch;
+  size_t queued = state.task_queue.size();
+  state.task_queue.erase(std::remove_if(state.task_queue.begin(),
+                                        state.task_queue.end(),
+                                        [id](const QueuedTask &job) {
+                                          return job.batch == id;
+                                        }),
+                         state.task_queue.end());
+  batch.cancelled += (int)(queued - state.task_queue.size());
+  PublishQueueLocked(state);
+  batch.cancelled += (int)StopTasksLocked(
+      state, [id](const TaskInstance &t) { return t.batch == id; });
+  if (g_show_debug_console) {
+    ConsoleLog("[INFO] Batch " + batch.name + " stopped early (" +
+               batch.stop_reason + "), " + std::to_string(batch.cancelled) +
+               " run(s) cancelled");
   }
-
-  // Start new refresh thread
-  state.docker_refreshing.store(true);
-  state.docker_refresh_thread = std::thread([&state]() {
-    RefreshDockerState(state);
-    state.docker_refreshing.store(false);
-  });
 }
 
-static void OpenFolderExternal(const std::string &path) {
-#ifdef _WIN32
-  std::string p = path;
-  for (char &c : p)
-    if (c == '/')
-      c = '\\';
-  std::string cmd = std::string("explorer \"") + p + "\"";
-  std::vector<std::string> lines;
-#ifdef _WIN32
-  DWORD code = 0;
-#else
-  int code = 0;
-#endif
-  RunHiddenCapture(cmd, lines, code);
-#else
-  std::string cmd = std::string("xdg-open \"") + path + "\"";
-  std::vector<std::string> lines;
-  int code = 0;
-  RunHiddenCapture(cmd, lines, code);
-#endif
+// Forget batches none of whose runs is queued or shown any more. Caller
+// holds state.tasks_mutex.
+static void PruneRunBatchesLocked(AppState &state) {
+  for (auto it = state.run_batches.begin(); it != state.run_batches.end();) {
+    uint64_t id = it->first;
+    bool used =
+        std::any_of(state.task_queue.begin(), state.task_queue.end(),
+                    [id](const QueuedTask &job) { return job.batch == id; }) ||
+        std::any_of(state.tasks.begin(), state.tasks.end(),
+                    [id](const std::shared_ptr<TaskInstance> &t) {
+                      return t->batch == id;
+                    });
+    it = used ? std::next(it) : state.run_batches.erase(it);
+  }
+  state.run_batch_count = (int)state.run_batches.size();
 }
 
-std::string BuildCommand(const AppState &state,
-                         const std::string &unique_suffix,
-                         int selected_mode_override) {
-  std::string cmd;
+void RemoveTask(AppState &state, int task_id) {
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  for (auto it = state.tasks.begin(); it != state.tasks.end(); ++it) {
+    if ((*it)->id == task_id) {
+      // Store the task pointer before any operations that might invalidate the
+      // iterator
+      auto task_ptr = *it;
 
-  // Convert paths to Unix format on Windows
-#ifdef _WIN32
-  std::string task_dir_unix = state.task_directory.empty()
-                                  ? ""
-                                  : ConvertToUnixPath(state.task_directory);
-  std::string workdir_unix =
-      state.workdir.empty() ? "" : ConvertToUnixPath(state.workdir);
-  std::string output_dir_unix =
-      state.output_dir.empty() ? "" : ConvertToUnixPath(state.output_dir);
-#else
-  const std::string &task_dir_unix = state.task_directory;
-  const std::string &workdir_unix = state.workdir;
-  const std::string &output_dir_unix = state.output_dir;
-#endif
+      // If task is running, stop it first using the same logic as StopAllTasks
+      if (task_ptr->is_running) {
+        // Already handed to g_teardown when Stop All got to it first
+        bool first = task_ptr->teardown == TeardownStage::None;
+        if (first)
+          task_ptr->teardown = TeardownStage::Signalled;
+        task_ptr->should_stop = true;
+        SetTaskRunning(*task_ptr, false);
 
-  // Use bash from MSYS2 or Git Bash if available, with proper PATH
-#ifdef _WIN32
-  std::string bash = FindBash();
-  if (bash.empty())
-    return "cmd.exe /C echo ERROR: Bash not found. Install Git for Windows or "
-           "MSYS2.";
-#else
-  cmd = "bash autobuild/scripts/autobuild.sh";
-#endif
+        // The reactor terminates the process group and closes its handle
+        g_process_reactor.Wake();
+        if (first)
+          g_teardown.Add({task_ptr});
+      }
 
-  cmd += " ";
+      // Now safely erase the task from the vector
+      state.tasks.erase(it);
+      PublishTasksLocked(state);
+      break;
+    }
+  }
+}
 
-  // Build CLI args once
-  std::string args;
-  int _mode = (selected_mode_override >= 0) ? selected_mode_override
-                                            : state.selected_mode;
-  switch (_mode) {
-  case 0:
-    args += "feedback";
+// Turn a compacted task back into a tab: its output and phase logs are
+// read back from their files once the tab is drawn (see FaultInTaskLogs)
+static void ReopenTaskSummary(AppState &state, int task_id) {
+  HeapScope _heap(kHeapTasks);
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  auto found = std::find_if(
+      state.task_summaries.begin(), state.task_summaries.end(),
+      [task_id](const TaskSummary &summary) { return summary.id == task_id; });
+  if (found == state.task_summaries.end())
+    return;
+  TaskSummary summary = std::move(*found);
+  state.task_summaries.erase(found);
+  state.task_summary_count = (int)state.task_summaries.size();
+
+  auto task = std::make_shared<TaskInstance>(summary.id, summary.name,
+                                             std::string());
+  task->task_type = summary.task_type;
+  task->group = summary.group;
+  task->worker = summary.worker;
+  task->queue_seq = summary.queue_seq;
+  task->batch = summary.batch;
+  task->exit_code = summary.exit_code;
+  task->should_stop = summary.stopped;
+  task->run_seconds = summary.run_seconds;
+  task->started_at =
+      std::chrono::steady_clock::now() -
+      std::chrono::milliseconds(std::max(0LL, EpochMs() - summary.ended_ms) +
+                                (long long)(summary.run_seconds * 1000));
+  task->stats_recorded = true;
+  task->summary_recorded = true;
+  task->failure = std::move(summary.failure);
+  std::copy(std::begin(summary.severity_counts),
+            std::end(summary.severity_counts),
+            std::begin(task->severity_counts));
+  task->log_dir = ResolveStagedPath(summary.log_dir);
+  task->classifier = CurrentLogClassifier();
+  if (!summary.spool.empty()) {
+    task->spool = std::make_unique<LogSpool>();
+    if (task->spool->Reopen(ResolveStagedPath(summary.spool), MonotonicMs()))
+      task->log_evicted = true;
+    else
+      task->spool.reset();
+  }
+  if (!task->spool)
+    PushTaskLog(*task, "[WARN] The output of this run is no longer on disk");
+  for (const auto &path : summary.phase_logs) {
+    if (std::shared_ptr<PhaseLog> log = AddPhaseLog(*task, path)) {
+      log->finished = true;
+      log->evicted = true;
+    }
+  }
+  auto pos = std::find_if(state.tasks.begin(), state.tasks.end(),
+                          [task_id](const std::shared_ptr<TaskInstance> &t) {
+                            return t->id > task_id;
+                          });
+  state.tasks.insert(pos, task);
+  PublishTasksLocked(state);
+  state.select_task_tab = task_id;
+}
+
+int GetRunningTaskCount(AppState &) { return g_running_tasks.load(); }
+
+static int GetTaskLimit(AppState &state) {
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  return TaskLimitLocked(state) + RemoteSlotsLocked(state);
+}
+
+// Concurrent runs allowed in a pipeline stage (INT_MAX when unlimited)
+static int StageLimit(const AppState &state, TaskPhase phase) {
+  int limit = 0;
+  switch (phase) {
+  case TaskPhase::Build:
+    limit = state.max_image_builds;
     break;
-  case 1:
-    args += "verify";
+  case TaskPhase::Prompt:
+    limit = state.max_api_tasks;
     break;
-  case 2:
-    args += "both";
+  case TaskPhase::Verify:
+    limit = state.max_verify_tasks;
     break;
-  case 3:
-    args += "audit";
+  default:
     break;
   }
-#ifdef _WIN32
-  // Windows cmd.exe style: use backslash-escaped double quotes
-  if (!task_dir_unix.empty())
-    args += " --task \\\"" + task_dir_unix + "\\\"";
-  if (!state.api_key.empty())
-    args += " --api-key \\\"" + state.api_key + "\\\"";
-#else
-  // Unix shell style: use single quotes for paths/values with spaces
-  if (!task_dir_unix.empty())
-    args += " --task '" + task_dir_unix + "'";
-  if (!state.api_key.empty())
-    args += " --api-key '" + state.api_key + "'";
-#endif
+  return limit > 0 ? limit : INT_MAX;
+}
 
-  // NEW: Add --no-cache flag if enabled
-  if (state.use_docker_no_cache) {
-    args += " --no-cache";
+// Whether the build farm has yet to finish task_dir's image
+static bool BuildFarmPending(const std::string &task_dir) {
+  ImageBuildFarm::State farm = g_build_farm.StateOf(task_dir);
+  return farm == ImageBuildFarm::State::Queued ||
+         farm == ImageBuildFarm::State::Building;
+}
+
+// Hand the base puller the task directories of queued runs, queue order,
+// whether or not the image cache is on: every build starts from its base
+// image. Caller holds state.tasks_mutex.
+static void SchedulePullsLocked(AppState &state) {
+  std::vector<std::string> dirs;
+  std::set<std::string> seen;
+  for (const auto &job : state.task_queue)
+    if (!job.group.empty() && seen.insert(job.group).second)
+      dirs.push_back(job.group);
+  g_base_puller.Schedule(dirs);
+}
+
+// The selected task directory once it has validated with a Dockerfile,
+// while speculative builds are on; "" otherwise (render thread)
+static std::string SpeculativeBuildDir(const AppState &state) {
+  if (!state.speculative_build || !state.use_image_cache ||
+      state.task_directory.empty() ||
+      state.validation.task_dir != state.task_directory ||
+      !state.validation.has_dockerfile)
+    return "";
+  return state.task_directory;
+}
+
+// Hand the task directories of queued runs to the build farm, so their
+// images are built before the runs get a slot, and let it forget the ones
+// no run needs any more. Only with the image cache on, since that is how a
+// run finds the farm's image. The selected task directory goes in as a
+// speculative request (see SpeculativeBuildDir), which the farm drops, and
+// stops building, once another directory is selected. Caller holds
+// state.tasks_mutex.
+static void FeedBuildFarmLocked(AppState &state) {
+  std::vector<std::string> dirs;
+  std::string speculative = SpeculativeBuildDir(state);
+  if (state.use_image_cache) {
+    for (const auto &job : state.task_queue)
+      dirs.push_back(job.group);
+    for (const auto &task : state.tasks)
+      if (task->is_running)
+        dirs.push_back(task->group);
+    if (!speculative.empty())
+      dirs.push_back(speculative);
+  }
+  g_build_farm.Retain(dirs);
+  SchedulePullsLocked(state);
+  if (!state.use_image_cache)
+    return;
+  if (!speculative.empty() && g_build_farm.StateOf(speculative) ==
+                                  ImageBuildFarm::State::Unknown) {
+    TaskValidation task;
+    task.task_dir = speculative;
+    g_build_farm.Request(speculative,
+                         BuildCommand(state, "", 4, "", "", &task), true);
+  }
+  for (const auto &job : state.task_queue) {
+    if (job.group.empty() || g_build_farm.StateOf(job.group) !=
+                                 ImageBuildFarm::State::Unknown)
+      continue;
+    TaskValidation task;
+    task.task_dir = job.group;
+    g_build_farm.Request(job.group,
+                         BuildCommand(state, "", 4, "", "", &task));
   }
+}
 
-  // Add --debug flag if enabled
-  if (state.use_docker_debug) {
-    args += " --debug";
+// The host-wide pool a run entering phase leases from, if any: builds and
+// verifications of this host's runs, and prompts wherever they run, as they
+// share the API
+static HostLeasePool *HostStagePool(TaskPhase phase,
+                                    const TaskInstance &task) {
+  switch (phase) {
+  case TaskPhase::Build:
+    return task.worker.empty() ? &g_host_builds : nullptr;
+  case TaskPhase::Prompt:
+    return &g_host_prompts;
+  case TaskPhase::Verify:
+    return task.worker.empty() ? &g_host_verifications : nullptr;
+  default:
+    return nullptr;
   }
+}
 
-  if (!state.image_tag.empty()) {
-    std::string image_tag = state.image_tag;
-    if (state.auto_lowercase_names) {
-      std::transform(image_tag.begin(), image_tag.end(), image_tag.begin(),
-                     ::tolower);
-    }
-    // Add unique suffix to avoid conflicts between concurrent tasks
-    if (!unique_suffix.empty()) {
-      // Replace :latest with unique suffix
-      size_t colon_pos = image_tag.find(":latest");
-      if (colon_pos != std::string::npos) {
-        image_tag = image_tag.substr(0, colon_pos) + ":" + unique_suffix;
-      } else {
-        image_tag += ":" + unique_suffix;
-      }
-    }
-    // Ensure the final image name is unique to avoid conflicts with existing
-    // images
-    image_tag = GenerateUniqueImageName(image_tag);
-#ifdef _WIN32
-    args += " --image-tag \\\"" + image_tag + "\\\"";
-#else
-    args += " --image-tag '" + image_tag + "'";
-#endif
-  } else if (state.auto_lowercase_names && !state.task_directory.empty()) {
-    std::string task_dir = state.task_directory;
-    size_t last_slash = task_dir.find_last_of("/\\");
-    std::string basename = (last_slash != std::string::npos)
-                               ? task_dir.substr(last_slash + 1)
-                               : task_dir;
-    std::transform(basename.begin(), basename.end(), basename.begin(),
-                   ::tolower);
-    std::string auto_tag = "autobuild-" + basename;
-    if (!unique_suffix.empty()) {
-      auto_tag += ":" + unique_suffix;
-    } else {
-      auto_tag += ":latest";
+// Let runs waiting at a stage gate into their next stage while it is under
+// its limit, oldest task first. A waiting run no longer counts against the
+// stage it has just finished, so one task's image build can start while
+// another waits on its prompt. Caller holds state.tasks_mutex.
+static void ReleaseStageGatesLocked(AppState &state) {
+  // Builds and verifications load the Docker host they run on, so their
+  // limits apply per host; prompt runs share the API wherever they run
+  std::map<std::string, std::vector<int>> occupied_by_host;
+  auto occupied = [&](const TaskInstance &task, TaskPhase phase) -> int & {
+    std::vector<int> &counts = occupied_by_host[phase == TaskPhase::Prompt
+                                                    ? std::string()
+                                                    : task.worker];
+    counts.resize(kTaskPhaseCount);
+    return counts[(int)phase];
+  };
+  // Prompts in progress per API key, for the governor
+  std::map<uint64_t, int> prompting;
+  bool waiting = false;
+  for (const auto &task : state.tasks) {
+    if (!task->is_running)
+      continue;
+    if (task->gate_seq.load() != 0) {
+      // Done with the stage it was in, here and across the host
+      task->stage_lease.Release();
+      waiting = true;
+      continue;
     }
-    // Ensure the final image name is unique to avoid conflicts with existing
-    // images
-    auto_tag = GenerateUniqueImageName(auto_tag);
-#ifdef _WIN32
-    args += " --image-tag \\\"" + auto_tag + "\\\"";
-#else
-    args += " --image-tag '" + auto_tag + "'";
-#endif
+    TaskPhase phase = task->phase.load();
+    occupied(*task, phase)++;
+    if (phase == TaskPhase::Prompt)
+      prompting[task->api_key_id]++;
   }
-  if (!state.container_name.empty()) {
-    std::string container_name = state.container_name;
-    if (state.auto_lowercase_names) {
-      std::transform(container_name.begin(), container_name.end(),
-                     container_name.begin(), ::tolower);
-    }
-    // Add unique suffix to container name to avoid conflicts
-    if (!unique_suffix.empty()) {
-      container_name += "_from_" + unique_suffix;
-    }
+  if (!waiting)
+    return;
+  auto now = std::chrono::steady_clock::now();
+  // Build farm builds load this host like the runs' own builds
+  {
+    std::vector<int> &local = occupied_by_host[std::string()];
+    local.resize(kTaskPhaseCount);
+    local[(int)TaskPhase::Build] += g_build_farm.Building();
+  }
+
 #ifdef _WIN32
-    args += " --container-name \\\"" + container_name + "\\\"";
+  const char *sep = "\\";
 #else
-    args += " --container-name '" + container_name + "'";
+  const char *sep = "/";
 #endif
-  } else if (state.auto_lowercase_names && !state.task_directory.empty()) {
-    std::string task_dir = state.task_directory;
-    size_t last_slash = task_dir.find_last_of("/\\");
-    std::string basename = (last_slash != std::string::npos)
-                               ? task_dir.substr(last_slash + 1)
-                               : task_dir;
-    std::transform(basename.begin(), basename.end(), basename.begin(),
-                   ::tolower);
-    std::string auto_container = "autobuild-" + basename;
-    // Add unique suffix to container name to avoid conflicts
-    if (!unique_suffix.empty()) {
-      auto_container += "_from_" + unique_suffix;
+  for (auto &task : state.tasks) {
+    int seq = task->gate_seq.load();
+    if (seq == 0 || !task->is_running)
+      continue;
+    TaskPhase phase = task->gate_phase;
+    if (occupied(*task, phase) >= StageLimit(state, phase))
+      continue;
+    // The farm is building this run's image; the run would only wait on it
+    if (phase == TaskPhase::Build && task->worker.empty() &&
+        BuildFarmPending(task->group))
+      continue;
+    // The stage's host-wide slot, taken before the governor's token
+    HostLeasePool *pool = HostStagePool(phase, *task);
+    HostLease lease;
+    if (pool && !pool->TryAcquire(lease))
+      continue;
+    if (phase == TaskPhase::Prompt &&
+        !g_api_governor.TryStart(task->api_key_id,
+                                 prompting[task->api_key_id], now))
+      continue;
+    // Claim the request before the script can see the gate open and ask for
+    // its next one
+    if (!task->gate_seq.compare_exchange_strong(seq, 0))
+      continue;
+    std::string path = task->gate_dir + sep + std::to_string(seq) + "_" +
+                       kTaskStageNames[(int)phase];
+    if (!std::ofstream(path)) {
+      if (g_show_debug_console) {
+        ConsoleLog("[WARN] Cannot open stage gate " + path);
+      }
+      task->gate_seq = seq; // retry next frame
+      continue;
+    }
+    task->phase = phase;
+    task->last_output_ms = MonotonicMs(); // waiting here was no stall
+    task->stage_lease = std::move(lease);
+    occupied(*task, phase)++;
+    if (phase == TaskPhase::Prompt) {
+      prompting[task->api_key_id]++;
+      task->prompt_starts++;
     }
-#ifdef _WIN32
-    args += " --container-name \\\"" + auto_container + "\\\"";
-#else
-    args += " --container-name '" + auto_container + "'";
-#endif
   }
-#ifdef _WIN32
-  if (!workdir_unix.empty())
-    args += " --workdir \\\"" + workdir_unix + "\\\"";
-#else
-  if (!workdir_unix.empty())
-    args += " --workdir '" + workdir_unix + "'";
-#endif
+}
 
-  // Only pass --output-dir if user explicitly set one
-  // Otherwise, let the script use its default:
-  // $base_logs_dir/$task_name/$timestamp This ensures proper directory
-  // structure for the Logs Browser
-  if (!output_dir_unix.empty()) {
-    std::string final_output_dir = output_dir_unix;
-    // Make output directory unique for each task to avoid conflicts
-    if (!unique_suffix.empty()) {
-      final_output_dir += "_" + unique_suffix;
-    }
-#ifdef _WIN32
-    args += " --output-dir \\\"" + final_output_dir + "\\\"";
-#else
-    args += " --output-dir '" + final_output_dir + "'";
-#endif
+// Fold a finished run into the metrics endpoint's totals
+static void RecordRunMetrics(TaskInstance &task, double seconds) {
+  std::lock_guard<std::mutex> lock(g_metrics.mutex);
+  const char *result = task.should_stop   ? "stopped"
+                       : task.exit_code == 0 ? "pass"
+                                             : "fail";
+  g_metrics.results[result]++;
+  if (!task.should_stop && !task.task_type.empty()) {
+    AppMetrics::Total &run = g_metrics.run_seconds[task.task_type];
+    run.seconds += seconds;
+    run.count++;
+  }
+  std::lock_guard<std::mutex> timeline_lock(task.timeline_mutex);
+  for (const auto &phase : task.timeline) {
+    if (phase.end_ms == 0)
+      continue;
+    AppMetrics::Total &total = g_metrics.phase_seconds[phase.name];
+    total.seconds += (phase.end_ms - phase.start_ms) / 1000.0;
+    total.count++;
   }
+}
 
-  // Set AUTOBUILD_LOGS_ROOT environment variable to point script to
-  // user-accessible location This works better than --output-dir because it
-  // lets the script create the proper structure
-  std::string logs_root_for_env;
-  std::string default_log_root =
-      state.log_folder_paths.empty()
-          ? std::string()
-          : state.log_folder_paths[std::max(0, state.selected_log_folder)];
+// catalog.jsonl of the logs root log_dir (<root>/<task>/<run>/<mode>) is
+// in; "" when that root keeps no catalog (AUTOBUILD_CATALOG=0)
+static std::string CatalogFileFor(const std::string &log_dir) {
+  std::string root = log_dir;
+  for (int i = 0; i < 3; i++) {
+    while (!root.empty() && (root.back() == '/' || root.back() == '\\'))
+      root.pop_back();
+    size_t slash = root.find_last_of("/\\");
+    if (slash == std::string::npos)
+      return std::string();
+    root.resize(slash);
+  }
+  std::string path = root + "/catalog.jsonl";
+  return FileExists(path) ? path : std::string();
+}
 
-  if (default_log_root.empty()) {
-    // Fallback: use ResolveDefaultLogsPath logic
-#ifdef _WIN32
-    std::string exe_dir = GetExecutableDir();
-    if (exe_dir.find("Program Files") != std::string::npos) {
-      // MSI install: use APPDATA
-      const char *appdata = getenv("APPDATA");
-      if (appdata != nullptr) {
-        logs_root_for_env = std::string(appdata) + "\\Autobuild\\logs";
-      } else {
-        const char *userprofile = getenv("USERPROFILE");
-        if (userprofile != nullptr) {
-          logs_root_for_env =
-              std::string(userprofile) + "\\Documents\\Autobuild\\logs";
-        }
-      }
-    } else {
-      // Development: use relative to exe
-      logs_root_for_env = exe_dir + "/../autobuild/logs";
+// One write per line, like the script's appends, so they never interleave
+static void AppendCatalogLine(const std::string &path,
+                              const std::string &line) {
+  FILE *f = fopen(path.c_str(), "ab");
+  if (f) {
+    fwrite(line.data(), 1, line.size(), f);
+    fclose(f);
+  }
+}
+
+// Feed the peaks a finished local run's containers reached to
+// g_resource_envelopes and keep them in the run catalog as a "resources"
+// event, so later sessions size the task's next envelope from them too.
+// Stopped runs did not show their whole appetite and are left out.
+static void RecordResourcePeaks(TaskInstance &task) {
+  if (task.should_stop || !task.worker.empty() || task.task_type.empty())
+    return;
+  std::string log_dir;
+  float cpu_pct, mem_mib;
+  {
+    std::lock_guard<std::mutex> lock(task.resources_mutex);
+    if (task.resources.empty())
+      return;
+    log_dir = task.log_dir;
+    cpu_pct = task.resources.PeakCpuPct();
+    mem_mib = task.resources.PeakMemMib();
+  }
+  std::string key = EnvelopeKey(task.group, task.task_type);
+  g_resource_envelopes.Record(key, log_dir.empty() ? task.name : log_dir,
+                              cpu_pct, mem_mib);
+  std::string path = log_dir.empty() ? std::string() : CatalogFileFor(log_dir);
+  if (path.empty())
+    return;
+  JsonWriter json(true);
+  json.String("event", "resources")
+      .String("run", log_dir)
+      .String("key", key)
+      .Number("cpu_pct", (long long)(cpu_pct + 0.5f))
+      .Number("mem_mib", (long long)(mem_mib + 0.5f));
+  AppendCatalogLine(path, json.Finish());
+}
+
+// Append what the finished run's output says about its failure to the
+// catalog of the logs root its log directory is in, as a "summary" event
+// for that directory (the script writes its "start" and "end" events).
+// Passed runs whose output merely mentions errors, stopped runs and roots
+// without a catalog (AUTOBUILD_CATALOG=0) get none. Returns false while
+// the tail thread is still reading the run's phase logs.
+static bool RecordFailureSummary(TaskInstance &task) {
+  FailureSummary summary = task.failures.summary();
+  {
+    std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+    for (const auto &log : task.phase_logs)
+      if (!log->drained)
+        return false;
+    for (const auto &log : task.phase_logs)
+      summary.Merge(log->failures.summary());
+  }
+  std::string log_dir;
+  {
+    std::lock_guard<std::mutex> lock(task.resources_mutex);
+    log_dir = task.log_dir;
+  }
+  bool failed = task.exit_code != 0 || summary.failed_test_count > 0 ||
+                !summary.api_errors.empty();
+  if (!failed || task.should_stop || summary.Empty())
+    return true;
+  task.failure = summary;
+  if (log_dir.empty())
+    return true;
+  std::string path = CatalogFileFor(log_dir);
+  if (path.empty())
+    return true;
+  JsonWriter json(true);
+  json.String("event", "summary").String("run", log_dir);
+  summary.Write(json);
+  AppendCatalogLine(path, json.Finish());
+  return true;
+}
+
+// Fold the finished run's prompt phases into the metrics endpoint's Gemini
+// totals and keep them in the run catalog as one "api" event per phase:
+// how often the CLI ran and for how long (the script's [TIMING] markers),
+// and what its --debug output said about retries, rate limits, errors and
+// the size of the answers. Call once the phase logs are drained.
+static void RecordGeminiCalls(TaskInstance &task) {
+  std::map<std::string, GeminiCallStats> log_stats;
+  {
+    std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+    for (const auto &log : task.phase_logs) {
+      if (!log->prompt)
+        continue;
+      std::string phase = log->name.substr(0, log->name.rfind(".log"));
+      log_stats[phase].Merge(log->gemini.stats());
     }
-#elif defined(__APPLE__)
-    const char *home = getenv("HOME");
-    if (home) {
-      logs_root_for_env =
-          std::string(home) + "/Library/Application Support/Autobuild/logs";
+  }
+  std::vector<GeminiCallSummary> calls;
+  {
+    std::lock_guard<std::mutex> lock(task.timeline_mutex);
+    calls = SummarizeGeminiCalls(task.timeline, log_stats);
+  }
+  if (calls.empty())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(g_metrics.mutex);
+    for (const auto &call : calls) {
+      AppMetrics::GeminiTotal &total = g_metrics.gemini[call.phase];
+      total.calls += (uint64_t)call.calls;
+      total.seconds += call.ms / 1000.0;
+      total.stats.Merge(call.stats);
     }
-#else // Linux
-    const char *home = getenv("HOME");
-    if (home) {
-      logs_root_for_env = std::string(home) + "/.autobuild/logs";
+  }
+  std::string log_dir;
+  {
+    std::lock_guard<std::mutex> lock(task.resources_mutex);
+    log_dir = task.log_dir;
+  }
+  std::string path = log_dir.empty() ? std::string() : CatalogFileFor(log_dir);
+  if (path.empty())
+    return;
+  for (const auto &call : calls) {
+    JsonWriter json(true);
+    json.String("event", "api")
+        .String("run", log_dir)
+        .String("phase", call.phase)
+        .Number("calls", call.calls)
+        .Number("ms", call.ms)
+        .Number("max_ms", call.max_ms)
+        .Number("exit_code", call.exit_code)
+        .Number("retries", call.stats.retries)
+        .Number("throttled", call.stats.throttled)
+        .Number("errors", call.stats.errors)
+        .Number("response_bytes", (long long)call.stats.response_bytes);
+    AppendCatalogLine(path, json.Finish());
+  }
+}
+
+// Per-frame scheduler step on the render thread: refresh the host load
+// sample, fold finished runs into the per-type run time averages, record
+// their failure summaries, open stage gates, then start queued runs in free
+// slots
+// Replace the tasks that finished more than state.compact_after_minutes ago
+// with TaskSummary records, which free their log windows, phase logs and
+// process state and keep the tab bar and every walk over the task list
+// short. A tab drawn in the last frame stays, as does a run whose results
+// are not recorded yet. Render thread; caller holds state.tasks_mutex.
+static void CompactFinishedTasksLocked(AppState &state) {
+  if (state.compact_after_minutes <= 0)
+    return;
+  auto now = std::chrono::steady_clock::now();
+  auto grace = std::chrono::minutes(state.compact_after_minutes);
+  int visible_since = ImGui::GetFrameCount() - 1;
+  long long now_ms = EpochMs();
+  size_t before = state.tasks.size();
+  for (auto it = state.tasks.begin(); it != state.tasks.end();) {
+    TaskInstance &task = **it;
+    double secs = task.run_seconds;
+    TeardownStage teardown = task.teardown;
+    auto ended = task.started_at +
+                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::duration<double>(std::max(0.0, secs)));
+    if (task.is_running || secs < 0.0 || !task.stats_recorded ||
+        !task.summary_recorded || task.orphan_live ||
+        (teardown != TeardownStage::None && teardown != TeardownStage::Done) ||
+        now - ended < grace || task.last_viewed_frame >= visible_since) {
+      ++it;
+      continue;
     }
-#endif
-  } else {
-    logs_root_for_env = default_log_root;
+    TaskSummary summary;
+    summary.id = task.id;
+    summary.name = task.name;
+    summary.task_type = task.task_type;
+    summary.group = task.group;
+    summary.worker = task.worker;
+    summary.queue_seq = task.queue_seq;
+    summary.batch = task.batch;
+    summary.exit_code = task.exit_code;
+    summary.stopped = task.should_stop;
+    summary.run_seconds = secs;
+    summary.ended_ms =
+        now_ms - std::chrono::duration_cast<std::chrono::milliseconds>(
+                     now - ended)
+                     .count();
+    if (task.spool) {
+      task.spool->Flush();
+      summary.spool = task.spool->path();
+    }
+    {
+      std::lock_guard<std::mutex> lock(task.resources_mutex);
+      summary.log_dir = task.log_dir;
+    }
+    {
+      std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+      for (const auto &log : task.phase_logs)
+        summary.phase_logs.push_back(log->path);
+    }
+    summary.failure = task.failure;
+    std::copy(std::begin(task.severity_counts), std::end(task.severity_counts),
+              std::begin(summary.severity_counts));
+    state.task_summaries.push_back(std::move(summary));
+    it = state.tasks.erase(it);
   }
+  if (state.tasks.size() == before)
+    return;
+  while (state.task_summaries.size() > kMaxTaskSummaries)
+    state.task_summaries.pop_front();
+  state.task_summary_count = (int)state.task_summaries.size();
+  PublishTasksLocked(state);
+}
 
-#ifdef _WIN32
+// How often running tasks are checked for stalls, and how long a stalled
+// run's diagnostics may take before it is ended without them
+static const int64_t kStallCheckMs = 10000;
+static const int64_t kStallCaptureMs = 60000;
+
+// What a stalled run was doing, into its log ahead of the teardown that
+// removes its container: the processes in the container with their state
+// and CPU time, and the container's own state. Runs on the job pool; sets
+// stall_diagnosed when done.
+static void CaptureStallDiagnostics(const std::shared_ptr<TaskInstance> &task) {
+  std::string container;
   {
-    // Get the absolute path to the autobuild.sh script and convert to Unix
-    // format Use GetExecutableDir() instead of GetCurrentDirectoryA() to find
-    // script relative to exe
-    std::string exe_dir = GetExecutableDir();
+    std::lock_guard<std::mutex> lock(task->resources_mutex);
+    container = task->container;
+  }
+  if (container.empty() || IsClusterWorker(task->worker)) {
+    task->stall_diagnosed = true;
+    return;
+  }
+  g_jobs.Submit(
+      JobLane::Io, JobPriority::Normal,
+      [task, container](const CancelToken &) {
+        std::string env;
+        for (const auto &var : DockerWorkerEnvironment(task->worker)) {
+          size_t eq = var.find('=');
+          env += var.substr(0, eq + 1) + "'" + var.substr(eq + 1) + "' ";
+        }
+        const std::string commands[] = {
+            "docker top '" + container + "' -eo pid,stat,etime,time,args",
+            "docker inspect --format 'status {{.State.Status}}, started "
+            "{{.State.StartedAt}}, restarts {{.RestartCount}}' '" +
+                container + "'"};
+        for (const std::string &cmd : commands) {
+          for (const auto &line : RunShellLines(env + cmd + " 2>&1"))
+            PushTaskLog(*task, "[WATCHDOG] " + line);
+        }
+        task->stall_diagnosed = true;
+        WakeMainLoop();
+      });
+}
 
-    // Determine script path based on installation type
-    std::string script_path;
-    if (exe_dir.find("Program Files") != std::string::npos) {
-      // Script is installed inside bin directory:
-      // bin/autobuild/scripts/autobuild.sh
-      script_path = exe_dir + "/autobuild/scripts/autobuild.sh";
-    } else {
-      // Development: go up from build directory (native/build-gui-mingw) to
-      // project root
-      script_path = exe_dir + "/../../autobuild/scripts/autobuild.sh";
+// Mark the runs that went quiet for longer than their phase allows: no
+// output line in the task or its phase logs, and no container sample with
+// CPU use (output alone decides while a run has no samples). Runs waiting
+// at a stage gate or being stopped are left alone. A stalled run has its
+// diagnostics captured, and is then ended through the same teardown as
+// Stop; it is queued again while state.stall_retries allows. Caller holds
+// state.tasks_mutex.
+static void CheckStalledRunsLocked(AppState &state) {
+  static int64_t checked_ms = 0;
+  int64_t now = MonotonicMs();
+  if (now - checked_ms < kStallCheckMs)
+    return;
+  checked_ms = now;
+  bool ending = false;
+  for (auto &task : state.tasks) {
+    if (!task->is_running || task->teardown != TeardownStage::None ||
+        task->orphan_live || task->container_lost)
+      continue;
+    if (task->stalled) {
+      ending |= task->stall_diagnosed ||
+                now - task->stalled_ms >= kStallCaptureMs;
+      continue;
+    }
+    TaskPhase phase = task->phase;
+    int minutes = phase == TaskPhase::Prompt ? state.stall_prompt_minutes
+                                             : state.stall_minutes;
+    if (minutes <= 0 || task->gate_seq.load() != 0)
+      continue;
+    int64_t quiet_since =
+        std::max(task->last_output_ms.load(), task->last_busy_ms.load());
+    {
+      std::lock_guard<std::mutex> lock(task->phase_logs_mutex);
+      for (const auto &log : task->phase_logs)
+        quiet_since = std::max(quiet_since, log->last_line_ms.load());
     }
+    if (now - quiet_since < minutes * 60000LL)
+      continue;
+    task->stall_requeue = task->retry < state.stall_retries;
+    task->stalled_ms = now;
+    task->stalled = true;
+    PushTaskLog(*task, "[ERROR] Watchdog: no output" +
+                           std::string(task->cpu_sampled ? " and no CPU use"
+                                                         : "") +
+                           " for " + std::to_string(minutes) +
+                           " min in the " + TaskPhaseName(phase) +
+                           " phase; capturing diagnostics and ending the run");
+    if (g_show_debug_console)
+      ConsoleLog("[WARN] Watchdog: " + task->name + " stalled in the " +
+                 TaskPhaseName(phase) + " phase");
+    CaptureStallDiagnostics(task);
+  }
+  if (ending)
+    StopTasksLocked(state, [now](const TaskInstance &t) {
+      return t.stalled.load() && (t.stall_diagnosed.load() ||
+                                  now - t.stalled_ms >= kStallCaptureMs);
+    });
+}
 
-    // Convert Windows path to Unix format for bash
-    for (char &c : script_path) {
-      if (c == '\\')
-        c = '/';
+// The dispatcher's per-frame pass: samples host load, settles the runs that
+// ended (metrics, batches, backups, stall requeues, leases), then starts
+// queued runs. It stays here because it works on the GUI's TaskInstance
+// list; the policy it applies is in autobuild_engine (PickQueuedTask,
+// PlaceQueuedTask, AdaptiveHoldReason, the quota and the batch rules).
+static void ScheduleQueuedTasks(AppState &state) {
+  TRACE_ZONE("ScheduleQueuedTasks");
+  auto now = std::chrono::steady_clock::now();
+  bool resample = now - state.host_sampled_at >= kHostSampleInterval;
+  HostLoadSample sample;
+  if (resample) {
+    state.host_sampled_at = now;
+    SampleHostLoad(sample);
+    sample.containers = state.docker_containers;
+  }
+  {
+    std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+    if (resample) {
+      state.host_load = sample;
+      state.host_load_fresh = true;
+      // Docker is only asked while the scheduler has something to decide
+      bool busy = !state.task_queue.empty() ||
+                  std::any_of(state.tasks.begin(), state.tasks.end(),
+                              [](const std::shared_ptr<TaskInstance> &t) {
+                                return t->is_running.load();
+                              });
+      if (state.adaptive_concurrency && busy &&
+          now - state.docker_sampled_at >= kDockerSampleInterval) {
+        state.docker_sampled_at = now;
+        ProbeDockerContainers(state);
+      }
     }
-    // Convert C: to /c for MSYS2/Git Bash
-    if (script_path.length() >= 2 && script_path[1] == ':') {
-      script_path[0] = tolower(script_path[0]);
-      script_path = "/" + script_path.substr(0, 1) + script_path.substr(2);
+    for (auto &task : state.tasks) {
+      if (!task->summary_recorded && !task->is_running &&
+          task->run_seconds >= 0.0) {
+        task->summary_recorded = RecordFailureSummary(*task);
+        if (task->summary_recorded)
+          RecordGeminiCalls(*task);
+      }
+      if (!task->is_running) {
+        task->run_lease.Release();
+        task->stage_lease.Release();
+      }
+      if (task->stats_recorded || task->is_running)
+        continue;
+      double secs = task->run_seconds;
+      if (secs < 0.0)
+        continue;
+      task->stats_recorded = true;
+      if (task->queue_seq != 0)
+        g_submissions.Ended(task->queue_seq, task->exit_code);
+      if (!task->gate_dir.empty())
+        RemoveDirectoryRecursive(task->gate_dir);
+      RecordRunMetrics(*task, secs);
+      RecordResourcePeaks(*task);
+      if (task->stalled && task->stall_requeue)
+        RequeueStalledRunLocked(state, *task);
+      if (!task->should_stop && (task->backed_up || task->backup_of != 0))
+        SettleBackupRaceLocked(state, *task);
+      if (task->batch != 0)
+        RecordBatchResultLocked(state, *task);
+      if (task->should_stop || task->task_type.empty())
+        continue; // stopped runs say nothing about normal run time
+      SmoothTaskTypeEstimate(state.task_type_seconds, task->task_type, secs);
+      // Only runs whose prompts went through the stage gates were counted
+      if (task->gate_dir.empty())
+        continue;
+      SmoothTaskTypeEstimate(state.task_type_prompts, task->task_type,
+                             task->prompt_starts);
     }
+    CheckStalledRunsLocked(state);
+    QueueBackupRunsLocked(state);
+    CompactFinishedTasksLocked(state);
+    if (!state.run_batches.empty())
+      PruneRunBatchesLocked(state);
+    FeedBuildFarmLocked(state);
+    ReleaseStageGatesLocked(state);
+  }
+  DispatchQueuedTasks(state);
+}
 
-    if (g_show_debug_console) {
-      ConsoleLog("[DEBUG][Windows] Script path: " + script_path);
-      ConsoleLog("[DEBUG][Windows] Logs root: " + logs_root_for_env);
+// Expected start delay in seconds of every queued run, simulating the
+// dispatcher over the current slots with the expected run time of each run
+// (see ExpectedRunSecondsLocked). order receives queue indices in dispatch
+// order; delays follow the same order and are -1 until some run has
+// finished to base them on. durations, in the same order, receives each
+// run's expected seconds (-1 if unknown). Caller holds state.tasks_mutex.
+static std::vector<double>
+EstimateQueueStartsLocked(const AppState &state, std::vector<size_t> &order,
+                          std::vector<double> &durations) {
+  order.clear();
+  std::vector<double> expected =
+      ExpectedQueueSecondsLocked(state, state.task_queue);
+  std::vector<size_t> remaining(state.task_queue.size());
+  for (size_t i = 0; i < remaining.size(); i++)
+    remaining[i] = i;
+  std::map<std::string, uint64_t> last_dispatch = state.group_last_dispatch;
+  uint64_t dispatch_count = state.dispatch_count;
+  std::vector<QueuedTask> pending = state.task_queue;
+  std::vector<double> pending_expected = expected;
+  while (!pending.empty()) {
+    size_t pick = PickQueuedTask(pending, last_dispatch, state.queue_order,
+                                 pending_expected);
+    if (pick == pending.size()) {
+      // The deferred runs go last, once the quota has room again
+      for (QueuedTask &job : pending)
+        job.deferred = false;
+      continue;
     }
+    order.push_back(remaining[pick]);
+    last_dispatch[pending[pick].group] = ++dispatch_count;
+    pending.erase(pending.begin() + pick);
+    pending_expected.erase(pending_expected.begin() + pick);
+    remaining.erase(remaining.begin() + pick);
+  }
+  durations.clear();
+  for (size_t index : order)
+    durations.push_back(expected[index]);
+
+  std::vector<double> starts(order.size(), -1.0);
+  // Runs nothing is known about take the mean of the known ones
+  double fallback = 0.0;
+  int known = 0;
+  for (double seconds : expected) {
+    if (seconds >= 0.0) {
+      fallback += seconds;
+      known++;
+    }
+  }
+  for (const auto &task : state.tasks) {
+    if (task->is_running && task->expected_seconds >= 0.0) {
+      fallback += task->expected_seconds;
+      known++;
+    }
+  }
+  if (known == 0)
+    return starts;
+  fallback /= known;
+  auto or_fallback = [&](double seconds) {
+    return seconds >= 0.0 ? seconds : fallback;
+  };
 
-    // Convert logs root to Unix path for bash
-    std::string logs_root_unix = ConvertToUnixPath(logs_root_for_env);
-
-    std::string head =
-        "export PATH=/c/Program\\ "
-        "Files/Docker/Docker/resources/bin:/mingw64/bin:/usr/bin:$PATH; export "
-        "PYTHONUNBUFFERED=1 PYTHONIOENCODING=utf-8";
+  // When each slot frees up, soonest first
+  std::priority_queue<double, std::vector<double>, std::greater<double>>
+      free_at;
+  auto now = std::chrono::steady_clock::now();
+  int running_count = 0;
+  for (const auto &task : state.tasks) {
+    if (!task->is_running)
+      continue;
+    running_count++;
+    double elapsed =
+        std::chrono::duration<double>(now - task->started_at).count();
+    free_at.push(
+        std::max(0.0, or_fallback(task->expected_seconds) - elapsed));
+  }
+  int limit = TaskLimitLocked(state) + RemoteSlotsLocked(state);
+  for (int i = running_count; i < limit; i++)
+    free_at.push(0.0);
+  // With the limit lowered below the running count, the first finishers
+  // free no slot
+  for (int i = limit; i < running_count; i++)
+    free_at.pop();
+
+  for (size_t k = 0; k < order.size() && !free_at.empty(); k++) {
+    double t = free_at.top();
+    free_at.pop();
+    starts[k] = t;
+    free_at.push(t + or_fallback(durations[k]));
+  }
+  return starts;
+}
 
-    // Add AUTOBUILD_LOGS_ROOT if we have a logs root
-    if (!logs_root_unix.empty()) {
-      head += "; export AUTOBUILD_LOGS_ROOT='" + logs_root_unix + "'";
+// Codepoints beyond the baked ranges that log lines used, rasterized from
+// a system font on demand (see NoteLogGlyphs): at most this many are kept
+// in the atlas, the least recently seen going first, and the atlas is
+// rebuilt with new ones at most every kGlyphRebuildSeconds
+static const size_t kMaxDemandGlyphs = 2048;
+static const double kGlyphRebuildSeconds = 2.0;
+
+// Codepoints log lines used that the atlas had no glyph for, baked in from
+// a system font by the main loop (render thread only)
+static struct {
+  bool enabled = false; // some fallback font exists
+  std::unordered_map<ImWchar, int> seen; // codepoint: frame last seen
+  std::set<ImWchar> absent;              // no fallback font has it
+  bool missing = false; // seen has codepoints the atlas lacks
+  std::vector<ImWchar> building; // demand of the bake in progress
+  double built_at = -1e9;        // ImGui::GetTime of the last request
+} g_glyph_demand;
+
+// Note the codepoints of a log line beyond Latin-1 so the atlas can be
+// rebuilt with them; a codepoint already seen only has its frame renewed.
+// Outside the Basic Multilingual Plane there is no ImWchar for it.
+static void NoteLogGlyphs(std::string_view line) {
+  if (!g_glyph_demand.enabled)
+    return;
+  const char *p = line.data(), *end = p + line.size();
+  while (p < end && (unsigned char)*p < 0x80)
+    p++;
+  if (p == end)
+    return; // ASCII, like most lines
+  ImFont *font = ImGui::GetIO().Fonts->Fonts[0];
+  int frame = ImGui::GetFrameCount();
+  while (p < end) {
+    if ((unsigned char)*p < 0x80) {
+      p++;
+      continue;
     }
-    head += "; ";
-    // Use single quotes around the script path to handle spaces properly
-    std::string quoted_script_path = "'" + script_path + "'";
-
-    cmd = std::string("\"") + bash + "\" -lc \"" + head +
-          "if command -v stdbuf >/dev/null 2>&1; then stdbuf -oL -eL bash " +
-          quoted_script_path + " " + args + "; else bash " +
-          quoted_script_path + " " + args + "; fi\"";
+    unsigned int c = 0;
+    p += ImTextCharFromUtf8(&c, p, end);
+    if (c < 0x100 || c > IM_UNICODE_CODEPOINT_MAX)
+      continue;
+    auto it = g_glyph_demand.seen.find((ImWchar)c);
+    if (it != g_glyph_demand.seen.end()) {
+      it->second = frame;
+      continue;
+    }
+    if (g_glyph_demand.absent.count((ImWchar)c) ||
+        font->FindGlyphNoFallback((ImWchar)c))
+      continue;
+    g_glyph_demand.seen.emplace((ImWchar)c, frame);
+    g_glyph_demand.missing = true;
   }
-#else
-  // Mac/Linux: Find script relative to executable location
-  std::string exe_dir = GetExecutableDir();
-  std::string script_path = exe_dir + "/autobuild/scripts/autobuild.sh";
+}
 
-  // On macOS, check if we're in an app bundle and adjust path accordingly
-#ifdef __APPLE__
-  // Check if we're running from an app bundle
-  if (exe_dir.find(".app/Contents/MacOS") != std::string::npos) {
-    // We're in an app bundle, script should be in the bundle resources
-    size_t bundle_pos = exe_dir.find(".app/Contents/MacOS");
-    std::string bundle_path = exe_dir.substr(0, bundle_pos + 4); // Include .app
-    script_path =
-        bundle_path + "/Contents/Resources/autobuild/scripts/autobuild.sh";
+// The codepoints to bake next: the kMaxDemandGlyphs seen most recently,
+// the rest forgotten until a line uses them again
+static std::vector<ImWchar> TakeGlyphDemand() {
+  auto &seen = g_glyph_demand.seen;
+  std::vector<std::pair<int, ImWchar>> by_frame;
+  by_frame.reserve(seen.size());
+  for (const auto &entry : seen)
+    by_frame.emplace_back(entry.second, entry.first);
+  if (by_frame.size() > kMaxDemandGlyphs) {
+    std::nth_element(by_frame.begin(),
+                     by_frame.end() - kMaxDemandGlyphs, by_frame.end());
+    for (auto it = by_frame.begin(); it != by_frame.end() - kMaxDemandGlyphs;
+         ++it)
+      seen.erase(it->second);
+    by_frame.erase(by_frame.begin(), by_frame.end() - kMaxDemandGlyphs);
+  }
+  std::vector<ImWchar> demand;
+  demand.reserve(by_frame.size());
+  for (const auto &entry : by_frame)
+    demand.push_back(entry.second);
+  std::sort(demand.begin(), demand.end());
+  g_glyph_demand.building = demand;
+  g_glyph_demand.missing = false;
+  g_glyph_demand.built_at = ImGui::GetTime();
+  return demand;
+}
 
-    if (g_show_debug_console) {
-      ConsoleLog("[DEBUG][macOS] App bundle detected, trying script path: " +
-                 script_path);
-    }
+// Append one line to a render-thread log and its lowercase shadow; a line
+// the log folds into its last row adds nothing to the shadow
+static void AppendLogLine(LogArena &log, LogArena &log_lower,
+                          std::string_view line, uint8_t tag, int64_t ms,
+                          std::string &lower) {
+  if (!log.Append(line, tag, ms))
+    return;
+  NoteLogGlyphs(line);
+  lower.resize(line.size());
+  FoldAsciiLower(line.data(), &lower[0], line.size());
+  log_lower.Append(lower);
+}
 
-    // Fallback: try multiple possible locations if the bundle path doesn't
-    // exist
-    if (!FileExists(script_path)) {
-      // Try the original path first
-      script_path = exe_dir + "/autobuild/scripts/autobuild.sh";
-      if (g_show_debug_console) {
-        ConsoleLog("[DEBUG][macOS] Bundle path not found, trying fallback: " +
-                   script_path);
-      }
+// Move a ring's new lines into a render-thread log and its lowercase
+// shadow, counting them per severity. While the log is evicted the lines
+// are only counted; the file they are reloaded from has them. The lines
+// ingest kept out are counted too, and its markers shown but not counted.
+static uint64_t DrainLogRing(LogLineRing &ring, IngestThrottle &ingest,
+                             LogArena &log, LogArena &log_lower,
+                             uint64_t *severity_counts, std::string &lower,
+                             bool evicted) {
+  uint64_t drained = 0;
+  ring.Drain([&](std::string_view line, uint8_t tag, int64_t ms) {
+    if (tag == IngestThrottle::kMarkerTag) {
+      if (!evicted)
+        AppendLogLine(log, log_lower, line, (uint8_t)LogSeverity::None, ms,
+                      lower);
+      return;
+    }
+    if (!evicted)
+      AppendLogLine(log, log_lower, line, tag, ms, lower);
+    severity_counts[tag]++;
+    drained++;
+  });
+  return drained + ingest.Collect(severity_counts);
+}
 
-      // If still not found, try other common locations
-      if (!FileExists(script_path)) {
-        std::vector<std::string> fallback_paths = {
-            bundle_path + "/Contents/MacOS/autobuild/scripts/autobuild.sh",
-            bundle_path + "/Contents/Resources/autobuild.sh",
-            exe_dir + "/../Resources/autobuild/scripts/autobuild.sh",
-            exe_dir + "/../autobuild/scripts/autobuild.sh"};
+// Release the log windows of the tasks whose tabs were viewed longest ago
+// until all of them together fit in state.log_memory_mb. A task's own
+// window goes only if its spool has every line; phase logs can always be
+// read back from their files. Tabs drawn in the last frame are kept.
+// Each entry is a task and the memory its windows hold apart from the
+// shared line texts, which total includes once.
+static void EnforceLogBudget(
+    AppState &state,
+    std::vector<std::pair<std::shared_ptr<TaskInstance>, size_t>> &usage,
+    size_t total) {
+  size_t budget = (size_t)state.log_memory_mb * 1024 * 1024;
+  if (total <= budget)
+    return;
+  std::sort(usage.begin(), usage.end(), [](const auto &a, const auto &b) {
+    return a.first->last_viewed_frame < b.first->last_viewed_frame;
+  });
+  int visible_since = ImGui::GetFrameCount() - 1;
+  std::vector<std::shared_ptr<PhaseLog>> phase_logs;
+  for (auto &entry : usage) {
+    if (total <= budget)
+      break;
+    TaskInstance &task = *entry.first;
+    if (task.last_viewed_frame >= visible_since)
+      continue;
+    // The texts freed are those no other window still shows
+    size_t shared = g_line_pool.MemoryBytes();
+    if (task.spool && !task.log_evicted) {
+      total -= task.log_output.MemoryBytes() + task.log_lower.MemoryBytes();
+      task.log_output.Clear();
+      task.log_lower.Clear();
+      task.log_evicted = true;
+    }
+    {
+      std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+      phase_logs = task.phase_logs;
+    }
+    for (auto &log : phase_logs) {
+      if (log->evicted)
+        continue;
+      total -= log->log_output.MemoryBytes() + log->log_lower.MemoryBytes();
+      log->log_output.Clear();
+      log->log_lower.Clear();
+      log->evicted = true;
+    }
+    total -= shared - std::min(shared, g_line_pool.MemoryBytes());
+  }
+}
 
-        for (const auto &fallback_path : fallback_paths) {
-          if (FileExists(fallback_path)) {
-            script_path = fallback_path;
-            if (g_show_debug_console) {
-              ConsoleLog("[DEBUG][macOS] Found script at: " + script_path);
-            }
-            break;
-          }
-        }
-      }
+// Reload the log windows EnforceLogBudget released when the task's tab is
+// selected: the newest kTaskLogMaxLines lines of its spool and of each
+// phase log file. The rings are emptied first (their lines are in the
+// files); a line written while a window loads can be missing from it or
+// shown twice, never from the file itself.
+static void FaultInTaskLogs(TaskInstance &task) {
+  HeapScope _heap(kHeapLogs);
+  std::string lower;
+  if (task.log_evicted) {
+    ProfileZone _zone("Log fault-in");
+    uint64_t count = task.spool->LineCount();
+    DrainLogRing(task.log_ring, task.ingest, task.log_output,
+                 task.log_lower, task.severity_counts, lower, true);
+    uint64_t first = count > kTaskLogMaxLines ? count - kTaskLogMaxLines : 0;
+    std::vector<int64_t> times;
+    task.spool->LineTimes(first, count - first, times);
+    size_t n = 0;
+    task.spool->ReadLines(first, count - first, [&](std::string_view line) {
+      uint8_t tag = task.classifier
+                        ? (uint8_t)task.classifier->Classify(line)
+                        : (uint8_t)LogSeverity::None;
+      int64_t ms = n < times.size() ? times[n] : MonotonicMs();
+      n++;
+      AppendLogLine(task.log_output, task.log_lower, line, tag, ms, lower);
+    });
+    task.log_evicted = false;
+  }
+  std::vector<std::shared_ptr<PhaseLog>> phase_logs;
+  {
+    std::lock_guard<std::mutex> lock(task.phase_logs_mutex);
+    phase_logs = task.phase_logs;
+  }
+  for (auto &log : phase_logs) {
+    if (!log->evicted)
+      continue;
+    ProfileZone _zone("Log fault-in");
+    log->lines += DrainLogRing(log->ring, log->ingest, log->log_output,
+                               log->log_lower, log->severity_counts, lower,
+                               true);
+    // Read back through a splitter, so progress overwrites collapse the
+    // same way they did when the lines were tailed. The file keeps no read
+    // times, so the reloaded rows all carry the reload time.
+    std::ifstream file(ResolveStagedPath(log->path), std::ios::binary);
+    LineSplitter splitter;
+    int64_t ms = MonotonicMs();
+    auto on_line = [&](std::string_view line) {
+      uint8_t tag = log->classifier
+                        ? (uint8_t)log->classifier->Classify(line)
+                        : (uint8_t)LogSeverity::None;
+      AppendLogLine(log->log_output, log->log_lower, line, tag, ms, lower);
+    };
+    while (file) {
+      file.read(splitter.Prepare(kPipeReadChunk), kPipeReadChunk);
+      splitter.Commit((size_t)file.gcount());
+      splitter.Drain(on_line);
     }
+    splitter.Finish(on_line);
+    log->evicted = false;
   }
-#endif
+}
 
-  if (g_show_debug_console) {
-    ConsoleLog("[DEBUG][Mac/Linux] Executable dir: " + exe_dir);
-    ConsoleLog("[DEBUG][Mac/Linux] Script path: " + script_path);
-    ConsoleLog(std::string("[DEBUG][Mac/Linux] Script exists: ") +
-               (FileExists(script_path) ? "YES" : "NO"));
-    ConsoleLog("[DEBUG][Mac/Linux] Logs root: " + logs_root_for_env);
+// Move newly produced output lines of every task into its render-thread
+// scrollback. Called on the render thread whenever g_log_seq moved; lines
+// are copied into the task's LogArena, which trims itself to
+// kTaskLogMaxLines. Phase logs are drained the same way. The windows are
+// then held to the log memory budget.
+static void DrainTaskLogs(AppState &state) {
+  HeapScope _heap(kHeapLogs);
+  std::shared_ptr<const TaskList> tasks_view = TasksView(state);
+  const TaskList &tasks_snapshot = *tasks_view;
+  std::string lower;
+  std::vector<std::shared_ptr<PhaseLog>> phase_logs;
+  std::vector<std::pair<std::shared_ptr<TaskInstance>, size_t>> usage;
+  size_t total = 0;
+  for (auto &task : tasks_snapshot) {
+    DrainLogRing(task->log_ring, task->ingest, task->log_output,
+                 task->log_lower, task->severity_counts, lower,
+                 task->log_evicted);
+    size_t bytes =
+        task->log_output.MemoryBytes() + task->log_lower.MemoryBytes();
+    {
+      std::lock_guard<std::mutex> lock(task->phase_logs_mutex);
+      phase_logs = task->phase_logs;
+    }
+    for (auto &log : phase_logs) {
+      log->lines += DrainLogRing(log->ring, log->ingest, log->log_output,
+                                 log->log_lower, log->severity_counts, lower,
+                                 log->evicted);
+      bytes += log->log_output.MemoryBytes() + log->log_lower.MemoryBytes();
+    }
+    usage.emplace_back(task, bytes);
+    total += bytes;
   }
+  total += g_line_pool.MemoryBytes();
+  EnforceLogBudget(state, usage, total);
+}
 
-  // Verify script exists before proceeding
-  if (!FileExists(script_path)) {
-    std::string error_msg = "echo 'ERROR: autobuild.sh script not found. ";
-    error_msg += "Searched at: " + script_path;
-#ifdef __APPLE__
-    error_msg += " (macOS app bundle)";
+static std::string ExtractTimestamp(const std::string &container_name) {
+  size_t p = container_name.find_last_of('-');
+  if (p == std::string::npos || p + 1 >= container_name.size())
+    return "";
+  std::string t = container_name.substr(p + 1);
+  for (char c : t)
+    if (c < '0' || c > '9')
+      return "";
+  return t;
+}
+
+// "45s", "4m 12s" or "1h 05m"
+static std::string FormatDuration(long long secs) {
+  char buf[32];
+  if (secs >= 3600)
+    snprintf(buf, sizeof(buf), "%lldh %02lldm", secs / 3600, (secs / 60) % 60);
+  else if (secs >= 60)
+    snprintf(buf, sizeof(buf), "%lldm %02llds", secs / 60, secs % 60);
+  else
+    snprintf(buf, sizeof(buf), "%llds", secs);
+  return buf;
+}
+
+// A failure summary as tooltip lines, "" when it is empty
+static std::string FormatFailureSummary(const FailureSummary &summary) {
+  std::string text;
+  if (summary.failed_test_count > 0) {
+    text += "\nFailed tests (" + std::to_string(summary.failed_test_count) +
+            "):";
+    for (const auto &name : summary.failed_tests)
+      text += "\n  " + name;
+    if (summary.failed_test_count > (int)summary.failed_tests.size())
+      text += "\n  ...";
+  }
+  if (!summary.exit_codes.empty()) {
+    text += "\nReported exit codes:";
+    for (int code : summary.exit_codes)
+      text += " " + std::to_string(code);
+  }
+  for (const auto &error : summary.api_errors)
+    text += "\nAPI: " + error;
+  if (!summary.error_block.empty()) {
+    text += "\nFirst error:";
+    for (const auto &line : summary.error_block)
+      text += "\n  " + line;
+  }
+  return text;
+}
+
+// What the GUI learns from each catalog event: the container log index,
+// expected durations, run analytics and resource envelopes
+static void ApplyCatalogEvent(const std::string &key, std::string dir,
+                              const RunRecord &rec, const JsonValue &ev) {
+  std::string event = ev.GetString("event");
+  if (event == "start") {
+    if (!rec.container.empty()) {
+#ifdef _WIN32
+      dir = ConvertFromUnixPath(dir);
 #endif
-    error_msg += " Please ensure the script is properly installed.'";
-    return error_msg;
+      g_container_logs.Record(rec.container, dir);
+    }
+  } else if (event == "end") {
+    // Failed runs often stop early, so only passed ones set expectations
+    if (rec.exit_code == 0 && rec.verification != "failed" &&
+        rec.started > 0 && rec.ended > rec.started)
+      g_durations.Record(rec.task, rec.mode, dir,
+                         (double)(rec.ended - rec.started), rec.phases);
+    g_run_analytics.RecordRun(key, rec);
+  } else if (event == "summary") {
+    g_run_analytics.RecordFailure(key, rec);
+  } else if (event == "resources") {
+    g_resource_envelopes.Record(ev.GetString("key"), dir,
+                                (float)ev.GetNumber("cpu_pct"),
+                                (float)ev.GetNumber("mem_mib"));
   }
+}
 
-  // On macOS, ensure script is executable
-#ifdef __APPLE__
-  struct stat script_stat;
-  if (stat(script_path.c_str(), &script_stat) == 0) {
-    if (!(script_stat.st_mode & S_IXUSR)) {
-      if (g_show_debug_console) {
-        ConsoleLog("[DEBUG][macOS] Making script executable: " + script_path);
+static LogsIndexer g_logs_index{
+    {[]() { HeapThread("Logs indexer", kHeapLogs); }, ApplyCatalogEvent}};
+
+// docker_build.log files of a task's newest runs the Dockerfile linter
+// reads step timings from
+static const size_t kLintBuildLogs = 5;
+
+// Cache-busting instructions of a task's env/Dockerfile (see
+// LintDockerfile), priced by the BuildKit steps its newest runs under a
+// logs root reported
+struct DockerfileLint {
+  std::string task_dir;
+  uint64_t content_hash = 0; // TaskValidation::content_hash linted
+  std::string logs_root;
+  const void *catalog = nullptr; // run catalog the logs were picked with
+  std::shared_ptr<const DockerfileInfo> info;
+  std::vector<DockerfileFinding> findings;
+  int build_logs = 0; // logs the estimates come from
+};
+
+// Read the newest kLintBuildLogs build logs of the task under logs_root
+// (<root>/<task>/<run>/<mode>/docker_build.log) and lint its Dockerfile
+// with their timings; runs on the I/O lane
+static std::shared_ptr<const DockerfileLint>
+ComputeDockerfileLint(DockerfileLint lint) {
+  lint.info = AnalyzeDockerfile(lint.task_dir + "/env/Dockerfile");
+  if (!lint.info)
+    lint.info = AnalyzeDockerfile(lint.task_dir + "/env/dockerfile");
+  if (!lint.info || !lint.info->error.empty())
+    return std::make_shared<const DockerfileLint>(std::move(lint));
+
+  std::vector<std::pair<long long, std::string>> logs;
+  if (!lint.logs_root.empty()) {
+    std::string task = lint.logs_root + "/" + TaskBaseName(lint.task_dir);
+    for (const auto &run : LogsIndexer::List(task, false)) {
+      for (const auto &mode : LogsIndexer::List(task + "/" + run, false)) {
+        std::string path = task + "/" + run + "/" + mode + "/docker_build.log";
+        struct stat st{};
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+          logs.emplace_back((long long)st.st_mtime, path);
       }
-      chmod(script_path.c_str(),
-            script_stat.st_mode | S_IXUSR | S_IXGRP | S_IXOTH);
     }
   }
-#endif
-
-  // Set up PATH to include Docker and other essential tools
-  // macOS GUI apps don't inherit shell PATH, so we need to set it explicitly
-  // Include common Docker/tool locations for both Intel and Apple Silicon Macs
-  std::string path_setup = "export "
-                           "PATH=\"/usr/local/bin:/opt/homebrew/bin:/opt/local/"
-                           "bin:/usr/bin:/bin:/usr/sbin:/sbin";
-
-  // Add Docker Desktop's resources/bin directory if it exists
-  path_setup += ":/Applications/Docker.app/Contents/Resources/bin";
+  std::sort(logs.begin(), logs.end());
+  if (logs.size() > kLintBuildLogs)
+    logs.erase(logs.begin(), logs.end() - kLintBuildLogs);
+  std::vector<BuildStep> steps;
+  for (const auto &log : logs) {
+    std::ifstream in(log.second, std::ios::binary);
+    BuildStepParser parser;
+    std::string line;
+    uint64_t seq = 0;
+    while (std::getline(in, line)) {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      parser.Feed(line, 0, ++seq);
+    }
+    if (parser.steps().empty())
+      continue;
+    steps.insert(steps.end(), parser.steps().begin(), parser.steps().end());
+    lint.build_logs++;
+  }
+  lint.findings =
+      LintDockerfile(*lint.info, DockerfileStepSeconds(*lint.info, steps));
+  return std::make_shared<const DockerfileLint>(std::move(lint));
+}
 
-  // Preserve any existing PATH
-  path_setup += ":$PATH\"; ";
+// Lint of the validated task, redone on the I/O lane when its files, the
+// logs root or that root's run catalog change; the previous result (or
+// null) until then. Render thread.
+static std::shared_ptr<const DockerfileLint>
+SelectedDockerfileLint(const AppState &state) {
+  static std::shared_ptr<const DockerfileLint> current;
+  static DockerfileLint pending;
+  static CancelToken pending_token;
+  static bool computing = false;
+
+  DockerfileLint key;
+  key.task_dir = state.validation.task_dir;
+  key.content_hash = state.validation.content_hash;
+  if (!state.log_folder_paths.empty())
+    key.logs_root = state.log_folder_paths[std::max(
+        0, std::min(state.selected_log_folder,
+                    (int)state.log_folder_paths.size() - 1))];
+  std::shared_ptr<const LogsTreeSnapshot> logs =
+      g_logs_index.Get(key.logs_root);
+  if (logs && logs->root == key.logs_root)
+    key.catalog = logs->catalog.get();
+  auto same = [&key](const DockerfileLint &lint) {
+    return lint.task_dir == key.task_dir &&
+           lint.content_hash == key.content_hash &&
+           lint.logs_root == key.logs_root && lint.catalog == key.catalog;
+  };
+  if (key.task_dir.empty() || !state.validation.has_dockerfile)
+    return nullptr;
+  if ((current && same(*current)) || (computing && same(pending)))
+    return current && current->task_dir == key.task_dir ? current : nullptr;
+
+  pending_token.Cancel();
+  pending = key;
+  computing = true;
+  pending_token = g_jobs.Submit(
+      JobLane::Io, JobPriority::Housekeeping,
+      [key](const CancelToken &token) {
+        std::shared_ptr<const DockerfileLint> lint =
+            ComputeDockerfileLint(key);
+        g_jobs.Post([lint, token]() {
+          if (token.Cancelled())
+            return;
+          current = lint;
+          computing = false;
+        });
+        WakeMainLoop();
+      });
+  return current && current->task_dir == key.task_dir ? current : nullptr;
+}
 
-  // Verify Docker is accessible and log it
-  if (g_show_debug_console) {
-    ConsoleLog("[DEBUG][macOS] Using PATH: " + path_setup);
+#ifdef AUTOBUILD_HAVE_ZSTD
+// How often the archiver sweeps the logs roots, and the smallest log worth
+// compressing
+static const int kLogArchiveSweepMs = 60 * 60 * 1000;
+static const uint64_t kLogArchiveMinBytes = 64 * 1024;
+
+// Background archival of old runs: every *.log file under a logs root
+// (<root>/<task>/<run>/<mode>/) that was last written more than the
+// configured number of days ago is replaced by a seekable .zst archive. The
+// Logs Browser and the viewer read those transparently.
+class LogArchiver {
+public:
+  ~LogArchiver() { Stop(); }
+
+  // Start archiving under roots (days <= 0 turns it off); sweeps right away
+  // when the settings changed
+  void Configure(const std::vector<std::string> &roots, int days) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (roots == roots_ && days == days_)
+      return;
+    roots_ = roots;
+    days_ = days;
+    changed_ = true;
+    cv_.notify_one();
+    if (!thread_.joinable() && days > 0 && !stop_)
+      thread_ = std::thread([this]() {
+        HeapThread("Log archiver", kHeapLogs);
+        Run();
+      });
   }
 
-  // Set AUTOBUILD_LOGS_ROOT environment variable if we have a logs root
-  if (!logs_root_for_env.empty()) {
-    cmd = path_setup + "export AUTOBUILD_LOGS_ROOT='" + logs_root_for_env +
-          "'; bash '" + script_path + "' " + args;
-  } else {
-    cmd = path_setup + "bash '" + script_path + "' " + args;
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      cv_.notify_one();
+    }
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      changed_ = false;
+      std::vector<std::string> roots = roots_;
+      int days = days_;
+      lock.unlock();
+      if (days > 0) {
+        time_t cutoff = time(nullptr) - (time_t)days * 24 * 60 * 60;
+        for (const auto &root : roots)
+          Sweep(root, cutoff);
+      }
+      lock.lock();
+      cv_.wait_for(lock, std::chrono::milliseconds(kLogArchiveSweepMs),
+                   [this]() { return stop_ || changed_; });
+    }
   }
 
-  if (g_show_debug_console) {
-    ConsoleLog("[DEBUG][Mac/Linux] BuildCommand result: " + cmd);
+  void Sweep(const std::string &root, time_t cutoff) {
+    for (const auto &task : LogsIndexer::List(root, false)) {
+      std::string task_dir = root + "/" + task;
+      for (const auto &run : LogsIndexer::List(task_dir, false)) {
+        std::string run_dir = task_dir + "/" + run;
+        for (const auto &mode : LogsIndexer::List(run_dir, false)) {
+          std::string mode_dir = run_dir + "/" + mode;
+          bool archived = false;
+          for (const auto &name : LogsIndexer::List(mode_dir, true)) {
+            if (stop_)
+              return;
+            if (name.size() < 4 ||
+                name.compare(name.size() - 4, 4, ".log") != 0)
+              continue;
+            std::string path = mode_dir + "/" + name;
+            struct stat st{};
+            if (stat(path.c_str(), &st) != 0 || st.st_mtime > cutoff ||
+                (uint64_t)st.st_size < kLogArchiveMinBytes)
+              continue;
+            std::string archive = path + ".zst";
+            if (!CompressLogSeekable(path, archive, stop_))
+              continue;
+            // Keep exactly one copy if the original cannot be removed
+            if (remove(path.c_str()) != 0) {
+              remove(archive.c_str());
+              continue;
+            }
+            archived = true;
+            if (g_show_debug_console) {
+              ConsoleLog("[DEBUG] Archived log: " + archive);
+            }
+          }
+          if (archived)
+            g_logs_index.Touch(mode_dir);
+        }
+      }
+    }
   }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  std::vector<std::string> roots_;
+  int days_ = 0;
+  bool changed_ = false;
+  std::atomic<bool> stop_{false};
+};
+
+static LogArchiver g_log_archiver;
 #endif
 
-  return cmd;
+// Apply the archive setting to the current log folders (no-op without zstd)
+static void ConfigureLogArchive(const AppState &state) {
+#ifdef AUTOBUILD_HAVE_ZSTD
+  g_log_archiver.Configure(state.log_folder_paths, state.log_archive_days);
+#else
+  (void)state;
+#endif
 }
 
-static bool IsPromptValid(const std::string &prompt) {
-  // Check if prompt is not empty and contains non-whitespace characters
-  if (prompt.empty()) {
-    return false;
+// How often the catalog exporter looks for runs that finished
+static const int kCatalogExportMs = 60 * 1000;
+
+// Background export of every logs root's catalog.jsonl to catalog.parquet
+// next to it (see ExportRunCatalog), one row per finished run, for DuckDB,
+// pandas or Spark to query without parsing the JSON Lines
+class CatalogExporter {
+public:
+  ~CatalogExporter() { Stop(); }
+
+  // Export under roots while enabled; runs a pass right away when the
+  // settings changed
+  void Configure(const std::vector<std::string> &roots, bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (roots == roots_ && enabled == enabled_)
+      return;
+    roots_ = roots;
+    enabled_ = enabled;
+    changed_ = true;
+    cv_.notify_one();
+    if (!thread_.joinable() && enabled && !stop_)
+      thread_ = std::thread([this]() {
+        HeapThread("Catalog exporter", kHeapLogs);
+        Run();
+      });
   }
 
-  for (char c : prompt) {
-    if (!std::isspace(static_cast<unsigned char>(c))) {
-      return true;
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      cv_.notify_one();
+    }
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  // Why the last pass failed for some root; empty when it did not
+  std::string Error() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+  }
+
+private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      changed_ = false;
+      std::vector<std::string> roots = roots_;
+      bool enabled = enabled_;
+      lock.unlock();
+      std::string error;
+      for (size_t i = 0; enabled && i < roots.size() && !stop_; i++) {
+        std::string catalog = roots[i] + "/catalog.jsonl";
+        if (!FileExists(catalog))
+          continue;
+        std::string parquet = roots[i] + "/catalog.parquet";
+        CatalogExportResult result;
+        if (!ExportRunCatalog(catalog, parquet, EpochMs(), result)) {
+          error = result.error;
+        } else if (result.rows > 0 && g_show_debug_console) {
+          ConsoleLog("[DEBUG] Exported " + std::to_string(result.rows) +
+                     " runs to " + parquet);
+        }
+      }
+      lock.lock();
+      error_ = error;
+      cv_.wait_for(lock, std::chrono::milliseconds(kCatalogExportMs),
+                   [this]() { return stop_ || changed_; });
     }
   }
 
-  return false;
-}
-
-// Character-level diff highlighting helper
-struct CharDiff {
-  std::string text;
-  bool is_changed;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+  std::vector<std::string> roots_;
+  bool enabled_ = false;
+  bool changed_ = false;
+  std::string error_;
+  std::atomic<bool> stop_{false};
 };
 
-static std::vector<CharDiff> ComputeCharDiff(const std::string &old_str,
-                                             const std::string &new_str,
-                                             bool for_new_string = false) {
-  std::vector<CharDiff> result;
-
-  // Simple character-level diff - find common prefix and suffix
-  size_t common_prefix = 0;
-  while (common_prefix < old_str.length() && common_prefix < new_str.length() &&
-         old_str[common_prefix] == new_str[common_prefix]) {
-    common_prefix++;
-  }
+static CatalogExporter g_catalog_exporter;
 
-  size_t common_suffix = 0;
-  while (common_suffix < (old_str.length() - common_prefix) &&
-         common_suffix < (new_str.length() - common_prefix) &&
-         old_str[old_str.length() - 1 - common_suffix] ==
-             new_str[new_str.length() - 1 - common_suffix]) {
-    common_suffix++;
-  }
+static void ConfigureCatalogExport(const AppState &state) {
+  g_catalog_exporter.Configure(state.log_folder_paths, state.export_catalog);
+}
 
-  const std::string &target_str = for_new_string ? new_str : old_str;
+static LogStager g_log_stager{
+    {[]() { HeapThread("Log stager", kHeapLogs); }, WakeMainLoop,
+     [](const std::string &dir) { g_logs_index.Touch(dir); },
+     [](const std::string &dir) {
+       if (g_show_debug_console)
+         ConsoleLog("[DEBUG] Shipped and unstaged: " + dir);
+     }}};
 
-  // Add common prefix (unchanged)
-  if (common_prefix > 0) {
-    result.push_back({target_str.substr(0, common_prefix), false});
-  }
+static std::string StagedLogsRoot(const std::string &root) {
+  return g_log_stager.Stage(root);
+}
 
-  // Add middle part (changed)
-  size_t mid_start = common_prefix;
-  size_t mid_end = target_str.length() - common_suffix;
-  if (mid_start < mid_end) {
-    result.push_back({target_str.substr(mid_start, mid_end - mid_start), true});
-  }
+static std::string ResolveStagedPath(const std::string &path) {
+  return g_log_stager.Resolve(path);
+}
 
-  // Add common suffix (unchanged)
-  if (common_suffix > 0) {
-    result.push_back(
-        {target_str.substr(target_str.length() - common_suffix), false});
-  }
+static bool LogShippingBacklogged() { return g_log_stager.Backlogged(); }
+
+// Staging directory from the settings ("" = next to the settings file)
+static std::string LogStagingDir(const AppState &state) {
+  if (!state.log_staging_dir.empty())
+    return state.log_staging_dir;
+  std::string config = GetConfigFilePath();
+  size_t slash = config.find_last_of("/\\");
+  return (slash == std::string::npos ? std::string()
+                                     : config.substr(0, slash + 1)) +
+         "log_staging";
+}
 
-  return result;
+// Apply the staging settings; staged runs of earlier sessions are shipped
+// whatever they say
+static void ConfigureLogStaging(const AppState &state) {
+  LogStagingSettings settings;
+  settings.mode = state.log_staging;
+  settings.dir = LogStagingDir(state);
+  settings.backlog_limit = (uint64_t)state.log_staging_backlog_mb << 20;
+  settings.object_store = state.log_object_store;
+  settings.endpoint = state.log_object_store_endpoint;
+  settings.region = state.log_object_store_region;
+  g_log_stager.Configure(settings);
 }
 
-// Per-prompt history management functions
-static void PushToHistory(AppState::PromptHistory &history,
-                          const std::string &value) {
-  // Remove any redo history when making a new change
-  if (history.current_index < (int)history.history.size() - 1) {
-    history.history.erase(history.history.begin() + history.current_index + 1,
-                          history.history.end());
+// How long a reading of the package proxies serves scrapes
+static const int64_t kProxyStatsMs = 30000;
+
+// Request counts of the managed package proxies (see PackageProxySpec), per
+// Docker endpoint, from their request logs through docker exec. Read for
+// the metrics endpoint on its thread; a reading is reused for
+// kProxyStatsMs, so frequent scrapes do not run docker each time. An
+// endpoint without a proxy has no counts.
+class PackageProxyStats {
+public:
+  struct Host {
+    std::string endpoint; // "" for this host
+    std::vector<ProxyCacheCount> counts;
+  };
+
+  std::vector<Host> Read(const std::vector<std::string> &endpoints) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = MonotonicMs();
+    if (endpoints == endpoints_ && now - read_ms_ < kProxyStatsMs)
+      return hosts_;
+    hosts_.clear();
+    for (const auto &endpoint : endpoints) {
+      Host host;
+      host.endpoint = endpoint;
+      for (const auto &line : RunShellLines(
+               DockerWorkerPrefix(endpoint) +
+               "docker exec autobuild-package-proxy sh -c 'sort "
+               "/var/log/nginx/autobuild.log | uniq -c' 2>/dev/null")) {
+        ProxyCacheCount count;
+        if (ParseProxyCacheCount(line, count))
+          host.counts.push_back(std::move(count));
+      }
+      hosts_.push_back(std::move(host));
+    }
+    endpoints_ = endpoints;
+    read_ms_ = now;
+    return hosts_;
   }
 
-  // Add current state to history
-  history.history.push_back(value);
-  history.current_index++;
+private:
+  std::mutex mutex_;
+  std::vector<std::string> endpoints_;
+  std::vector<Host> hosts_;
+  int64_t read_ms_ = 0;
+};
 
-  // Limit history size
-  if (history.history.size() > (size_t)history.max_size) {
-    history.history.erase(history.history.begin());
-    history.current_index--;
+static PackageProxyStats g_proxy_stats;
+
+// Endpoints that run a managed package proxy under the current settings
+static std::vector<std::string> PackageProxyEndpoints(AppState &state) {
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  std::vector<std::string> endpoints;
+  if (state.package_proxy == 0)
+    return endpoints;
+  endpoints.push_back(std::string());
+  if (state.package_proxy == 1) {
+    for (const auto &worker : state.docker_workers) {
+      if (!IsClusterWorker(worker.endpoint))
+        endpoints.push_back(worker.endpoint);
+    }
   }
+  return endpoints;
 }
 
-static bool CanUndoPrompt(const AppState::PromptHistory &history) {
-  return history.current_index > 0;
+// Body of a metrics scrape; runs on the metrics server thread
+static std::string RenderAppMetrics(AppState &state) {
+  int running = g_running_tasks.load();
+  int queued = state.queued_tasks.load();
+  MetricsWriter out;
+  out.Family("autobuild_tasks_running", "gauge", "Runs in progress")
+      .Sample("", running);
+  out.Family("autobuild_tasks_queued", "gauge", "Runs waiting for a slot")
+      .Sample("", queued);
+  {
+    std::lock_guard<std::mutex> lock(g_metrics.mutex);
+    out.Family("autobuild_runs", "counter", "Finished runs by result");
+    for (const char *result : {"pass", "fail", "stopped"}) {
+      auto it = g_metrics.results.find(result);
+      out.Sample("_total", it != g_metrics.results.end() ? it->second : 0,
+                 MetricLabel("result", result));
+    }
+    out.Family("autobuild_run_duration_seconds", "summary",
+               "Wall time of finished runs by mode");
+    for (const auto &kv : g_metrics.run_seconds) {
+      std::string label = MetricLabel("mode", kv.first);
+      out.Sample("_sum", kv.second.seconds, label)
+          .Sample("_count", (double)kv.second.count, label);
+    }
+    out.Family("autobuild_phase_duration_seconds", "summary",
+               "Time spent in each timed phase of finished runs");
+    for (const auto &kv : g_metrics.phase_seconds) {
+      std::string label = MetricLabel("phase", kv.first);
+      out.Sample("_sum", kv.second.seconds, label)
+          .Sample("_count", (double)kv.second.count, label);
+    }
+    out.Family("autobuild_gemini_call_seconds", "summary",
+               "Wall time of Gemini CLI runs by prompt phase");
+    for (const auto &kv : g_metrics.gemini) {
+      std::string label = MetricLabel("phase", kv.first);
+      out.Sample("_sum", kv.second.seconds, label)
+          .Sample("_count", (double)kv.second.calls, label);
+    }
+    out.Family("autobuild_gemini_retries", "counter",
+               "API requests the Gemini CLI retried, by prompt phase");
+    for (const auto &kv : g_metrics.gemini)
+      out.Sample("_total", kv.second.stats.retries,
+                 MetricLabel("phase", kv.first));
+    out.Family("autobuild_gemini_throttled", "counter",
+               "Gemini API requests refused for rate or quota limits");
+    for (const auto &kv : g_metrics.gemini)
+      out.Sample("_total", kv.second.stats.throttled,
+                 MetricLabel("phase", kv.first));
+    out.Family("autobuild_gemini_errors", "counter",
+               "Gemini API errors the CLI gave up on, by prompt phase");
+    for (const auto &kv : g_metrics.gemini)
+      out.Sample("_total", kv.second.stats.errors,
+                 MetricLabel("phase", kv.first));
+    out.Family("autobuild_gemini_response_bytes", "counter",
+               "Output of prompt phases other than the CLI's logging");
+    for (const auto &kv : g_metrics.gemini)
+      out.Sample("_total", (double)kv.second.stats.response_bytes,
+                 MetricLabel("phase", kv.first));
+  }
+  out.Family("autobuild_log_lines", "counter", "Output lines ingested")
+      .Sample("_total", (double)g_metrics.lines.load());
+  out.Family("autobuild_log_lines_skipped", "counter",
+             "Output lines kept out of the log windows by the ingest rate")
+      .Sample("_total", (double)g_metrics.lines_skipped.load());
+  out.Family("autobuild_log_bytes", "counter", "Output bytes ingested")
+      .Sample("_total", (double)g_metrics.bytes.load());
+  out.Family("autobuild_docker_api_request_seconds", "summary",
+             "Docker Engine API request latency")
+      .Sample("_sum", DockerApiCallStats().us.load() / 1e6)
+      .Sample("_count", (double)DockerApiCallStats().calls.load());
+  out.Family("autobuild_docker_up", "gauge",
+             "Whether the Docker daemon answered its last health probe")
+      .Sample("",
+              DockerDaemonHealth().state() == DockerHealth::kUp ? 1.0 : 0.0);
+  out.Family("autobuild_docker_health_probes", "counter",
+             "Docker daemon health probes")
+      .Sample("_total", (double)DockerDaemonHealth().probes());
+  out.Family("autobuild_base_image_pulls", "gauge",
+             "Base images being pulled ahead of queued builds")
+      .Sample("", (double)g_base_puller.Pulling());
+  out.Family("autobuild_async_flows", "gauge",
+             "Coroutine flows in flight, such as attached phases streaming")
+      .Sample("", (double)g_async.InFlight());
+  out.Family("autobuild_base_images_pulled", "counter",
+             "Base images pulled ahead of queued builds")
+      .Sample("_total", (double)g_base_puller.Pulled());
+  out.Family("autobuild_image_cache_hits", "counter",
+             "Runs that reused a built or cached image")
+      .Sample("_total", (double)g_metrics.image_cache_hits.load());
+  out.Family("autobuild_image_cache_misses", "counter",
+             "Runs that had to build their image")
+      .Sample("_total", (double)g_metrics.image_cache_misses.load());
+  auto proxies = g_proxy_stats.Read(PackageProxyEndpoints(state));
+  if (!proxies.empty()) {
+    out.Family("autobuild_package_proxy_requests", "counter",
+               "Requests to the package proxies by registry and nginx "
+               "cache status");
+    std::map<std::string, std::pair<uint64_t, uint64_t>> hits; // of cached
+    for (const auto &host : proxies) {
+      std::string label = MetricLabel(
+          "host", host.endpoint.empty() ? "local" : host.endpoint);
+      for (const auto &count : host.counts) {
+        out.Sample("_total", (double)count.requests,
+                   label + "," + MetricLabel("registry", count.registry) +
+                       "," + MetricLabel("cache", count.status));
+        if (count.status == "-")
+          continue;
+        auto &ratio = hits[count.registry];
+        if (ProxyCacheHit(count.status))
+          ratio.first += count.requests;
+        ratio.second += count.requests;
+      }
+    }
+    out.Family("autobuild_package_proxy_hit_ratio", "gauge",
+               "Share of cacheable package proxy requests served from its "
+               "cache, over all hosts");
+    for (const auto &kv : hits)
+      out.Sample("", (double)kv.second.first / kv.second.second,
+                 MetricLabel("registry", kv.first));
+  }
+  out.Family("autobuild_ui_frame_seconds", "summary",
+             "Time to process and draw a UI frame")
+      .Sample("_sum", g_metrics.frame_us.load() / 1e6)
+      .Sample("_count", (double)g_metrics.frames.load());
+  return out.Finish();
 }
 
-static bool CanRedoPrompt(const AppState::PromptHistory &history) {
-  return history.current_index < (int)history.history.size() - 1;
+// Start, move or stop the metrics endpoint to match the settings
+static void ConfigureMetrics(AppState &state) {
+  if (state.metrics_port == g_metrics_server.port() &&
+      !state.metrics_status.empty())
+    return;
+  if (!g_metrics_server.Start(state.metrics_port, [&state]() {
+        return RenderAppMetrics(state);
+      })) {
+    state.metrics_status =
+        "Cannot listen on port " + std::to_string(state.metrics_port);
+  } else if (state.metrics_port > 0) {
+    state.metrics_status = "Serving http://<host>:" +
+                           std::to_string(state.metrics_port) + "/metrics";
+  } else {
+    state.metrics_status = "Off";
+  }
+  if (g_show_debug_console) {
+    ConsoleLog("[INFO] Metrics endpoint: " + state.metrics_status);
+  }
 }
 
-static void UndoPrompt(AppState &state, int prompt_index) {
-  AppState::PromptHistory *history = nullptr;
-  std::string *modified_prompt = nullptr;
-
-  if (prompt_index == 0) {
-    history = &state.prompt1_history;
-    modified_prompt = &state.prompt1_modified;
-  } else if (prompt_index == 1) {
-    history = &state.prompt2_history;
-    modified_prompt = &state.prompt2_modified;
-  } else if (prompt_index == 2) {
-    history = &state.audit_prompt_history;
-    modified_prompt = &state.audit_prompt_modified;
+// "state" event of the live dashboard, run on its server thread: a line with
+// the running and queued counts, then one per task with its phase timeline
+// as parallel arrays (epoch ms; an end of 0 is a phase still running)
+static std::string RenderDashboardState(const AppState &state) {
+  std::string out = JsonWriter(true)
+                        .Number("running", g_running_tasks.load())
+                        .Number("queued", state.queued_tasks.load())
+                        .Finish();
+  auto tasks = TasksView(state);
+  auto now = std::chrono::steady_clock::now();
+  for (const auto &task : *tasks) {
+    bool running = task->is_running.load();
+    double seconds = task->run_seconds.load();
+    long long ms =
+        running || seconds < 0
+            ? (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                  now - task->started_at)
+                  .count()
+            : (long long)(seconds * 1000.0);
+    JsonWriter json(true);
+    json.Number("id", task->id)
+        .String("name", task->name)
+        .String("type", task->task_type)
+        .String("phase", TaskPhaseName(task->phase))
+        .Bool("running", running)
+        .Number("exit", task->exit_code.load())
+        .Number("ms", ms);
+    {
+      std::lock_guard<std::mutex> lock(task->timeline_mutex);
+      json.BeginArray("steps");
+      for (const auto &phase : task->timeline)
+        json.Item(phase.name);
+      json.EndArray().BeginArray("start");
+      for (const auto &phase : task->timeline)
+        json.Item(phase.start_ms);
+      json.EndArray().BeginArray("end");
+      for (const auto &phase : task->timeline)
+        json.Item(phase.end_ms);
+      json.EndArray().BeginArray("exit_codes");
+      for (const auto &phase : task->timeline)
+        json.Item((long long)phase.exit_code);
+      json.EndArray();
+    }
+    out += json.Finish();
   }
+  return out;
+}
 
-  if (!history || !CanUndoPrompt(*history))
+// Start, move or stop the live dashboard to match the settings
+static void ConfigureDashboard(AppState &state) {
+  if (state.dashboard_port == g_dashboard.port() &&
+      !state.dashboard_status.empty())
     return;
+  if (!g_dashboard.Start(state.dashboard_port, [&state]() {
+        return RenderDashboardState(state);
+      })) {
+    state.dashboard_status =
+        "Cannot listen on port " + std::to_string(state.dashboard_port);
+  } else if (state.dashboard_port > 0) {
+    state.dashboard_status =
+        "Serving http://<host>:" + std::to_string(state.dashboard_port) + "/";
+  } else {
+    state.dashboard_status = "Off";
+  }
+  if (g_show_debug_console) {
+    ConsoleLog("[INFO] Live dashboard: " + state.dashboard_status);
+  }
+}
 
-  history->current_index--;
-  *modified_prompt = history->history[history->current_index];
+// Most runs one submission may queue
+static const int kMaxSubmittedRuns = 100;
+
+// Answer of the submission socket for run: where it is (queued, running,
+// passed, failed or stopped) and, once started, its task, phase and exit
+// code. active is set while the run has output to come. Caller holds
+// state.tasks_mutex.
+static std::string SubmittedRunStatusLocked(const AppState &state,
+                                            uint64_t run, bool &active) {
+  active = false;
+  JsonWriter json(true);
+  json.Bool("ok", true).Number("run", (long long)run);
+  for (const auto &job : state.task_queue) {
+    if (job.seq != run)
+      continue;
+    active = true;
+    return json.String("state", "queued")
+        .String("name", job.name)
+        .Finish();
+  }
+  for (const auto &task : state.tasks) {
+    if (task->queue_seq != run)
+      continue;
+    active = task->is_running.load();
+    int exit_code = task->exit_code.load();
+    const char *where = active              ? "running"
+                        : task->should_stop ? "stopped"
+                        : exit_code == 0    ? "passed"
+                                            : "failed";
+    json.String("state", where)
+        .String("name", task->name)
+        .Number("task", task->id)
+        .String("phase", TaskPhaseName(task->phase));
+    if (task->shared_log)
+      json.String("log_ring", task->shared_log->name());
+    if (!active)
+      json.Number("exit_code", exit_code);
+    return json.Finish();
+  }
+  for (const auto &summary : state.task_summaries) {
+    if (summary.queue_seq != run)
+      continue;
+    return json
+        .String("state", summary.stopped          ? "stopped"
+                         : summary.exit_code == 0 ? "passed"
+                                                  : "failed")
+        .String("name", summary.name)
+        .Number("task", summary.id)
+        .Number("exit_code", summary.exit_code)
+        .Finish();
+  }
+  return JsonWriter(true)
+      .Bool("ok", false)
+      .String("error", "unknown run " + std::to_string(run))
+      .Finish();
+}
 
-  state.prompts_modified =
-      (state.prompt1_modified != state.prompt1_original) ||
-      (state.prompt2_modified != state.prompt2_original) ||
-      (state.audit_prompt_modified != state.audit_prompt_original);
+// Answer a request to the submission socket (see SubmissionServer), on the
+// UI thread. Runs are known by their queue number, which "submit" answers
+// with.
+static std::string HandleSubmission(AppState &state, const JsonValue &request,
+                                    uint64_t &follow) {
+  auto error = [](const std::string &message) {
+    return JsonWriter(true)
+        .Bool("ok", false)
+        .String("error", message)
+        .Finish();
+  };
+  std::string op = request.GetString("op");
+  if (op == "submit") {
+    std::string task_dir = request.GetString("task");
+    std::string mode_name = request.GetString("mode");
+    std::transform(mode_name.begin(), mode_name.end(), mode_name.begin(),
+                   ::tolower);
+    int mode = -1;
+    for (int i = 0; i < 4; i++) {
+      std::string name = modes[i];
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+      if (name == mode_name)
+        mode = i;
+    }
+    int count = request.GetInt("runs", 1);
+    if (task_dir.empty() || !IsDirectory(task_dir))
+      return error("no task folder at \"" + task_dir + "\"");
+    if (mode < 0)
+      return error("mode is one of Feedback, Verify, Both or Audit");
+    if (count < 1 || count > kMaxSubmittedRuns)
+      return error("runs is 1 to " + std::to_string(kMaxSubmittedRuns));
+    TaskValidation task = ValidateTaskDirectory(task_dir);
+    if (!TaskRunnable(task, mode))
+      return error(task_dir + " cannot run " + modes[mode]);
+    uint64_t first;
+    {
+      std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+      first = state.next_queue_seq;
+    }
+    int runs[4] = {0, 0, 0, 0};
+    runs[mode] = count;
+    int queued = QueueTaskBatch(state, {task}, runs, false);
+    JsonWriter json(true);
+    json.Bool("ok", true).BeginArray("runs");
+    for (int i = 0; i < queued; i++)
+      json.Item((long long)(first + i));
+    return json.EndArray().Finish();
+  }
+
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  const JsonValue *run_value = request.Find("run");
+  uint64_t run = run_value && run_value->type == JsonValue::Number &&
+                         run_value->number > 0
+                     ? (uint64_t)run_value->number
+                     : 0;
+  if (op == "status" && !run_value) {
+    JsonWriter json(true);
+    json.Bool("ok", true).BeginArray("queued");
+    for (const auto &job : state.task_queue)
+      json.Item((long long)job.seq);
+    json.EndArray().BeginArray("running");
+    for (const auto &task : state.tasks)
+      if (task->is_running && task->queue_seq != 0)
+        json.Item((long long)task->queue_seq);
+    return json.EndArray().Finish();
+  }
+  if (op != "status" && op != "cancel" && op != "logs")
+    return error("op is one of submit, status, cancel or logs");
+  if (run == 0)
+    return error("run is the number submit answered with");
+  if (op == "cancel") {
+    size_t queued = state.task_queue.size();
+    state.task_queue.erase(std::remove_if(state.task_queue.begin(),
+                                          state.task_queue.end(),
+                                          [run](const QueuedTask &job) {
+                                            return job.seq == run;
+                                          }),
+                           state.task_queue.end());
+    if (state.task_queue.size() != queued)
+      PublishQueueLocked(state);
+    StopTasksLocked(state, [run](const TaskInstance &task) {
+      return task.queue_seq == run;
+    });
+  }
+  bool active;
+  std::string answer = SubmittedRunStatusLocked(state, run, active);
+  if (op == "logs" && active)
+    follow = run;
+  return answer;
+}
 
-  DevLog(state, "Undo Prompt " + std::to_string(prompt_index) +
-                    ": index=" + std::to_string(history->current_index));
+// Start, move or stop the submission socket to match the settings
+static void ConfigureSubmissions(AppState &state) {
+  if (state.submit_socket == g_submissions.path() &&
+      !state.submit_status.empty())
+    return;
+  if (!g_submissions.Start(state.submit_socket)) {
+    state.submit_status = "Cannot listen on " + state.submit_socket;
+  } else if (!state.submit_socket.empty()) {
+    state.submit_status = "Listening";
+  } else {
+    state.submit_status = "Off";
+  }
+  if (g_show_debug_console) {
+    ConsoleLog("[INFO] Submission socket: " + state.submit_status);
+  }
 }
 
-static void RedoPrompt(AppState &state, int prompt_index) {
-  AppState::PromptHistory *history = nullptr;
-  std::string *modified_prompt = nullptr;
+// Pass the text of a log file (plain or archived) to fn in blocks of up to
+// kLogSearchBlock bytes until fn returns false. Returns false if the file
+// could not be read.
+static const size_t kLogSearchBlock = 1024 * 1024;
 
-  if (prompt_index == 0) {
-    history = &state.prompt1_history;
-    modified_prompt = &state.prompt1_modified;
-  } else if (prompt_index == 1) {
-    history = &state.prompt2_history;
-    modified_prompt = &state.prompt2_modified;
-  } else if (prompt_index == 2) {
-    history = &state.audit_prompt_history;
-    modified_prompt = &state.audit_prompt_modified;
+static bool
+ForEachLogBlock(const std::string &path,
+                const std::function<bool(const char *, size_t)> &fn) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  bool ok = true;
+  if (LogFileView::IsArchivePath(path)) {
+#ifdef AUTOBUILD_HAVE_ZSTD
+    // Archives are small; read all of it and decompress frame by frame
+    std::string packed;
+    char buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      packed.append(buf, n);
+    std::vector<ZstdSeekFrame> frames;
+    ok = !ferror(f) &&
+         ParseZstdSeekTable(packed.data(), packed.size(), frames);
+    std::string text;
+    for (size_t i = 0; ok && i < frames.size(); i++) {
+      const ZstdSeekFrame &fr = frames[i];
+      text.resize((size_t)fr.d_size);
+      size_t got = ZSTD_decompress(&text[0], text.size(),
+                                   packed.data() + fr.c_offset,
+                                   (size_t)fr.c_size);
+      if (ZSTD_isError(got) || got != text.size()) {
+        ok = false;
+        break;
+      }
+      if (!fn(text.data(), text.size()))
+        break;
+    }
+#else
+    ok = false;
+#endif
+  } else {
+    std::vector<char> buf(kLogSearchBlock);
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), f)) > 0) {
+      if (!fn(buf.data(), n))
+        break;
+    }
+    ok = !ferror(f);
   }
+  fclose(f);
+  return ok;
+}
 
-  if (!history || !CanRedoPrompt(*history))
-    return;
+// How often the search index rescans the logs roots for new or changed
+// files, and caps on what one query reports
+static const int kLogSearchRescanMs = 30000;
+static const size_t kLogSearchMaxHits = 5000;
+static const size_t kLogSearchMaxHitsPerFile = 200;
+static const size_t kLogSearchHitText = 300; // characters kept per hit
+
+struct LogSearchHit {
+  std::string path;  // file to open
+  std::string label; // <task>/<run>/<mode>/<file> under its root
+  uint64_t line = 0; // 0-based
+  std::string text;  // the matching line, cut at kLogSearchHitText
+};
 
-  history->current_index++;
-  *modified_prompt = history->history[history->current_index];
+// Full-text search over every file under the logs roots. Each file gets a
+// trigram signature: a bitmap of the (lowercased) three-byte sequences it
+// contains, about two bits per distinct trigram, so a few GB of logs fit in
+// tens of MB. A query only reads the files whose signature has every
+// trigram of its query's substrings (plus files not indexed yet) and whose
+// name and age fit its task, mode, phase and since terms, and a worker pool
+// scans those in parallel and streams matching lines out as it finds
+// them. Signatures are kept up to date by a rescan every
+// kLogSearchRescanMs that re-indexes just the files whose size or mtime
+// changed. Verifying and indexing run on the job pool, one file per job:
+// query files as interactive jobs, indexing as housekeeping, so a search
+// never waits behind the background indexing.
+class LogSearchIndex {
+public:
+  ~LogSearchIndex() { Stop(); }
+
+  // Index the files under roots; starts the scanner on first use
+  void Configure(const std::vector<std::string> &roots) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (started_ && roots == roots_)
+      return;
+    roots_ = roots;
+    rescan_ = true;
+    scan_cv_.notify_one();
+    if (!started_ && !stop_) {
+      started_ = true;
+      scanner_ = std::thread([this]() {
+        HeapThread("Log search", kHeapSearch);
+        Scan();
+      });
+      unsigned n = std::thread::hardware_concurrency() / 2;
+      max_jobs_ = std::max(1u, std::min(4u, n));
+    }
+  }
 
-  state.prompts_modified =
-      (state.prompt1_modified != state.prompt1_original) ||
-      (state.prompt2_modified != state.prompt2_original) ||
-      (state.audit_prompt_modified != state.audit_prompt_original);
+  // Jobs already on the pool see stop_ and return; the pool's own Stop
+  // waits for them
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    scan_cv_.notify_all();
+    if (scanner_.joinable())
+      scanner_.join();
+  }
+
+  // Start a query, replacing the previous one; an empty query just clears
+  // the results
+  void Query(const LogQuery &query) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    query_ = query;
+    gen_++;
+    hits_.clear();
+    verify_.clear();
+    matched_files_ = 0;
+    truncated_ = false;
+    if (query.empty())
+      return;
+    NeedleTrigrams(query.Needles(), needle_grams_);
+    for (uint32_t id = 0; id < files_.size(); id++)
+      if (Candidate(files_[id]))
+        verify_.push_back(id);
+    Pump();
+  }
 
-  DevLog(state, "Redo Prompt " + std::to_string(prompt_index) +
-                    ": index=" + std::to_string(history->current_index));
-}
+  bool Searching() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !verify_.empty() || verifying_ > 0;
+  }
 
-static void InitializePromptHistory(AppState &state) {
-  if (state.prompt1_history.history.empty()) {
-    PushToHistory(state.prompt1_history, state.prompt1_modified);
-    DevLog(state, "Initialized Prompt1 history");
+  // Files known, and how many of them have a signature so far
+  void Progress(size_t &files, size_t &indexed, uint64_t &bytes) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files = live_files_;
+    indexed = indexed_files_;
+    bytes = indexed_bytes_;
   }
-  if (state.prompt2_history.history.empty()) {
-    PushToHistory(state.prompt2_history, state.prompt2_modified);
-    DevLog(state, "Initialized Prompt2 history");
+
+  size_t HitCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_.size();
   }
-  if (state.audit_prompt_history.history.empty()) {
-    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
-    DevLog(state, "Initialized Audit history");
+
+  size_t MatchedFiles() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return matched_files_;
   }
-}
 
-static void ClearCurrentPromptState(AppState &state, int prompt_index) {
-  AppState::PromptHistory *history = nullptr;
-  const char *name = "";
+  // True once kLogSearchMaxHits stopped the query early
+  bool Truncated() const { return truncated_; }
 
-  if (prompt_index == 0) {
-    history = &state.prompt1_history;
-    name = "Prompt1";
-  } else if (prompt_index == 1) {
-    history = &state.prompt2_history;
-    name = "Prompt2";
-  } else if (prompt_index == 2) {
-    history = &state.audit_prompt_history;
-    name = "Audit";
+  bool Hit(size_t i, LogSearchHit &out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (i >= hits_.size())
+      return false;
+    out = hits_[i];
+    return true;
   }
 
-  if (history && history->history.size() > 1) {
-    // Set flag to prevent auto-save from interfering
-    state.skip_next_history_push = true;
+private:
+  static const uint32_t kGramBits = 24; // a trigram as 3 bytes
+  static const int kMinSignatureLog2 = 13;
+
+  struct File {
+    std::string path;
+    std::string label;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t version = 0; // bumped whenever the file changes
+    bool gone = false;
+    bool indexed = false;
+    bool unreadable = false;
+    int bits_log2 = 0;
+    std::vector<uint64_t> signature; // 1 << bits_log2 bits
+  };
 
-    // Remove current state and go back to previous
-    history->history.pop_back();
-    history->current_index--;
+  // Bit of gram in a signature of 1 << bits_log2 bits; a full-size
+  // signature holds every trigram exactly
+  static uint32_t SignatureBit(uint32_t gram, int bits_log2) {
+    if (bits_log2 >= (int)kGramBits)
+      return gram;
+    return (uint32_t)(gram * 2654435761u) >> (32 - bits_log2);
+  }
+
+  // Trigrams of every needle, as a matching file holds them all
+  static void NeedleTrigrams(const std::vector<std::string> &needles,
+                             std::vector<uint32_t> &grams) {
+    grams.clear();
+    for (const auto &needle : needles) {
+      for (size_t i = 0; i + 3 <= needle.size(); i++)
+        grams.push_back(((uint32_t)(unsigned char)needle[i] << 16) |
+                        ((uint32_t)(unsigned char)needle[i + 1] << 8) |
+                        (uint32_t)(unsigned char)needle[i + 2]);
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+  }
+
+  // Whether f may hold lines of the current query (mutex_ held)
+  bool Candidate(const File &f) const {
+    if (f.gone || f.unreadable)
+      return false;
+    std::string label = f.label;
+    std::transform(label.begin(), label.end(), label.begin(), ::tolower);
+    if (!query_.MatchFile(label, f.mtime * 1000))
+      return false;
+    if (!f.indexed)
+      return true;
+    for (uint32_t g : needle_grams_) {
+      uint32_t bit = SignatureBit(g, f.bits_log2);
+      if (!(f.signature[bit >> 6] & (1ull << (bit & 63))))
+        return false;
+    }
+    return true;
+  }
 
-    // Update the current prompt to the previous state
-    if (history->current_index >= 0 &&
-        history->current_index < (int)history->history.size()) {
-      if (prompt_index == 0) {
-        state.prompt1_modified = history->history[history->current_index];
-      } else if (prompt_index == 1) {
-        state.prompt2_modified = history->history[history->current_index];
-      } else if (prompt_index == 2) {
-        state.audit_prompt_modified = history->history[history->current_index];
+  // Scanner thread: list every file under the roots, queue new and changed
+  // ones for indexing and forget removed ones
+  void Scan() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      rescan_ = false;
+      std::vector<std::string> roots = roots_;
+      lock.unlock();
+      struct Found {
+        std::string path, label;
+        uint64_t size;
+        int64_t mtime;
+      };
+      std::vector<Found> found;
+      for (const auto &root : roots) {
+        for (const auto &task : LogsIndexer::List(root, false)) {
+          std::string task_dir = root + "/" + task;
+          for (const auto &run : LogsIndexer::List(task_dir, false)) {
+            std::string run_dir = task_dir + "/" + run;
+            for (const auto &mode : LogsIndexer::List(run_dir, false)) {
+              std::string mode_dir = run_dir + "/" + mode;
+              for (const auto &name : LogsIndexer::List(mode_dir, true)) {
+                std::string path = mode_dir + "/" + name;
+                struct stat st{};
+                // Skip archives still being written
+                if ((name.size() > 4 &&
+                     name.compare(name.size() - 4, 4, ".tmp") == 0) ||
+                    stat(path.c_str(), &st) != 0)
+                  continue;
+                found.push_back({path,
+                                 task + "/" + run + "/" + mode + "/" + name,
+                                 (uint64_t)st.st_size,
+                                 (int64_t)st.st_mtime});
+              }
+            }
+          }
+        }
+        if (stop_)
+          return;
       }
+      lock.lock();
+      Apply(found);
+      scan_cv_.wait_for(lock, std::chrono::milliseconds(kLogSearchRescanMs),
+                        [this]() { return stop_ || rescan_; });
     }
-
-    // Update the modified flag
-    state.prompts_modified =
-        (state.prompt1_modified != state.prompt1_original) ||
-        (state.prompt2_modified != state.prompt2_original) ||
-        (state.audit_prompt_modified != state.audit_prompt_original);
-
-    DevLog(state,
-           std::string("Cleared current state from ") + name + " history");
   }
-}
 
-static void ClearAllPromptHistory(AppState &state, int prompt_index) {
-  AppState::PromptHistory *history = nullptr;
-  const char *name = "";
-
-  if (prompt_index == 0) {
-    history = &state.prompt1_history;
-    name = "Prompt1";
-  } else if (prompt_index == 1) {
-    history = &state.prompt2_history;
-    name = "Prompt2";
-  } else if (prompt_index == 2) {
-    history = &state.audit_prompt_history;
-    name = "Audit";
-  }
-
-  if (history) {
-    history->history.clear();
-    history->current_index = -1;
-    // Reset to original state
-    if (prompt_index == 0) {
-      state.prompt1_modified = state.prompt1_original;
-    } else if (prompt_index == 1) {
-      state.prompt2_modified = state.prompt2_original;
-    } else if (prompt_index == 2) {
-      state.audit_prompt_modified = state.audit_prompt_original;
+  // Merge a listing into files_ (mutex_ held)
+  template <typename FoundList> void Apply(const FoundList &found) {
+    std::vector<bool> seen(files_.size(), false);
+    for (const auto &e : found) {
+      auto it = by_path_.find(e.path);
+      uint32_t id;
+      if (it == by_path_.end()) {
+        id = (uint32_t)files_.size();
+        files_.emplace_back();
+        seen.push_back(true);
+        by_path_[e.path] = id;
+        live_files_++;
+      } else {
+        id = it->second;
+        seen[id] = true;
+        File &f = files_[id];
+        if (!f.gone && f.size == e.size && f.mtime == e.mtime)
+          continue;
+        if (f.gone)
+          live_files_++;
+        Forget(f);
+      }
+      File &f = files_[id];
+      f.path = e.path;
+      f.label = e.label;
+      f.size = e.size;
+      f.mtime = e.mtime;
+      f.gone = false;
+      f.version++;
+      index_.push_back(id);
+      // A running query also covers files that showed up since
+      if (it == by_path_.end() && !query_.empty() && Candidate(f))
+        verify_.push_back(id);
     }
-
-    // Update the modified flag
-    state.prompts_modified =
-        (state.prompt1_modified != state.prompt1_original) ||
-        (state.prompt2_modified != state.prompt2_original) ||
-        (state.audit_prompt_modified != state.audit_prompt_original);
-
-    // Re-initialize with original state
-    const std::string *original_value = nullptr;
-    if (prompt_index == 0)
-      original_value = &state.prompt1_original;
-    else if (prompt_index == 1)
-      original_value = &state.prompt2_original;
-    else if (prompt_index == 2)
-      original_value = &state.audit_prompt_original;
-
-    if (original_value) {
-      PushToHistory(*history, *original_value);
+    for (uint32_t id = 0; id < seen.size(); id++) {
+      File &f = files_[id];
+      if (!seen[id] && !f.gone) {
+        Forget(f);
+        f.gone = true;
+        f.version++;
+        live_files_--;
+      }
     }
-
-    DevLog(state, std::string("Cleared all ") + name + " history");
+    Pump();
   }
-}
-
-static void ClearAllHistory(AppState &state) {
-  DevLog(state, "Clearing all prompt history");
-
-  // Reset all prompts to original state
-  state.prompt1_modified = state.prompt1_original;
-  state.prompt2_modified = state.prompt2_original;
-  state.audit_prompt_modified = state.audit_prompt_original;
-
-  // Update the modified flag (should be false now since all are original)
-  state.prompts_modified =
-      (state.prompt1_modified != state.prompt1_original) ||
-      (state.prompt2_modified != state.prompt2_original) ||
-      (state.audit_prompt_modified != state.audit_prompt_original);
-
-  // Clear all history and re-initialize with original states
-  state.prompt1_history.history.clear();
-  state.prompt1_history.current_index = -1;
-  PushToHistory(state.prompt1_history, state.prompt1_original);
-
-  state.prompt2_history.history.clear();
-  state.prompt2_history.current_index = -1;
-  PushToHistory(state.prompt2_history, state.prompt2_original);
-
-  state.audit_prompt_history.history.clear();
-  state.audit_prompt_history.current_index = -1;
-  PushToHistory(state.audit_prompt_history, state.audit_prompt_original);
-
-  SavePrompts(state);
-}
-
-////////////////////////////////////////////////////////////
-//                                                       //
-//              UI RENDERING FUNCTIONS                   //
-//                                                       //
-////////////////////////////////////////////////////////////
 
-void RenderDiffView(AppState &state, const std::string &original,
-                    const std::string &modified, int prompt_index = -1) {
-  // Toolbar with view controls
-  if (ImGui::Button(state.diff_split_view ? "Unified View" : "Split View")) {
-    state.diff_split_view = !state.diff_split_view;
-  }
-  ImGui::SameLine();
-  if (ImGui::Checkbox("Wrap Lines", &state.diff_wrap_lines)) {
-    // Toggle handled by checkbox
+  void Forget(File &f) {
+    if (f.indexed) {
+      indexed_files_--;
+      indexed_bytes_ -= f.size;
+    }
+    f.indexed = false;
+    f.unreadable = false;
+    f.signature.clear();
+    f.signature.shrink_to_fit();
+  }
+
+  // Keep up to max_jobs_ verify and max_jobs_ index jobs on the pool
+  // while files are waiting (mutex_ held)
+  void Pump() {
+    while (!stop_ && verify_jobs_ < std::min(max_jobs_, verify_.size())) {
+      verify_jobs_++;
+      g_jobs.Submit(JobLane::Compute, JobPriority::Interactive,
+                    [this](const CancelToken &) { VerifyNext(); });
+    }
+    while (!stop_ && index_jobs_ < std::min(max_jobs_, index_.size())) {
+      index_jobs_++;
+      g_jobs.Submit(JobLane::Compute, JobPriority::Housekeeping,
+                    [this](const CancelToken &) { IndexNext(); });
+    }
   }
 
-  // Add undo/redo/clear buttons with Font Awesome icons if prompt_index is
-  // provided
-  if (prompt_index >= 0) {
-    const AppState::PromptHistory *history = nullptr;
-    if (prompt_index == 0)
-      history = &state.prompt1_history;
-    else if (prompt_index == 1)
-      history = &state.prompt2_history;
-    else if (prompt_index == 2)
-      history = &state.audit_prompt_history;
-
-    if (history) {
-      // Push buttons to the right (4 buttons now: undo, redo, clear current,
-      // clear all)
-      float button_width = 30.0f;
-      float available_width = ImGui::GetContentRegionAvail().x;
-      ImGui::SameLine(available_width -
-                      (button_width * 4 + ImGui::GetStyle().ItemSpacing.x * 3));
-
-      // Undo button with Font Awesome icon
-      {
-        ImGuiDisabledScope disable_undo(!CanUndoPrompt(*history));
-        if (ImGui::Button(ICON_FA_ROTATE_LEFT, ImVec2(button_width, 0))) {
-          DevLog(state, "Undo button clicked for prompt " +
-                            std::to_string(prompt_index));
-          UndoPrompt(state, prompt_index);
-        }
-      }
-      if (!CanUndoPrompt(*history) &&
-          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
-        ImGui::SetTooltip("No changes to undo");
-      } else if (ImGui::IsItemHovered()) {
-        ImGui::SetTooltip("Undo (Ctrl+Z)");
+  // Job: search the next candidate of the current query
+  void VerifyNext() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    verify_jobs_--;
+    if (stop_ || verify_.empty())
+      return;
+    uint32_t id = verify_.front();
+    verify_.pop_front();
+    if (!files_[id].gone) {
+      std::string path = files_[id].path;
+      std::string label = files_[id].label;
+      LogQuery query = query_;
+      uint64_t gen = gen_;
+      verifying_++;
+      lock.unlock();
+      Verify(path, label, query, gen);
+      lock.lock();
+      verifying_--;
+    }
+    Pump();
+  }
+
+  // Job: build the signature of the next file waiting for one
+  void IndexNext() {
+    // Exact trigram set of the file being indexed (2 MB, one per pool
+    // thread), and its members
+    static thread_local std::vector<uint64_t> seen;
+    std::vector<uint32_t> grams;
+    std::unique_lock<std::mutex> lock(mutex_);
+    index_jobs_--;
+    if (stop_ || index_.empty())
+      return;
+    uint32_t id = index_.front();
+    index_.pop_front();
+    File &target = files_[id];
+    if (target.gone || target.indexed) {
+      Pump();
+      return;
+    }
+    std::string path = target.path;
+    uint64_t version = target.version;
+    lock.unlock();
+    if (seen.empty())
+      seen.resize((size_t)1 << (kGramBits - 6));
+    bool ok = Collect(path, seen, grams);
+    int bits_log2 = kMinSignatureLog2;
+    while (bits_log2 < (int)kGramBits &&
+           ((size_t)1 << bits_log2) < grams.size() * 2)
+      bits_log2++;
+    std::vector<uint64_t> signature(((size_t)1 << bits_log2) / 64);
+    for (uint32_t g : grams) {
+      uint32_t bit = SignatureBit(g, bits_log2);
+      signature[bit >> 6] |= 1ull << (bit & 63);
+      seen[g >> 6] = 0;
+    }
+    lock.lock();
+    File &f = files_[id];
+    if (f.version == version && !f.gone) {
+      if (!ok) {
+        f.unreadable = true;
+      } else {
+        f.bits_log2 = bits_log2;
+        f.signature.swap(signature);
+        f.indexed = true;
+        indexed_files_++;
+        indexed_bytes_ += f.size;
       }
-
-      // Redo button with Font Awesome icon
-      ImGui::SameLine();
-      {
-        ImGuiDisabledScope disable_redo(!CanRedoPrompt(*history));
-        if (ImGui::Button(ICON_FA_ROTATE_RIGHT, ImVec2(button_width, 0))) {
-          DevLog(state, "Redo button clicked for prompt " +
-                            std::to_string(prompt_index));
-          RedoPrompt(state, prompt_index);
+    }
+    Pump();
+  }
+
+  // Trigrams of a file's lowercased text, one entry each; lines are
+  // indexed separately since a needle never spans a line break
+  bool Collect(const std::string &path, std::vector<uint64_t> &seen,
+               std::vector<uint32_t> &grams) {
+    grams.clear();
+    uint32_t gram = 0;
+    int have = 0;
+    return ForEachLogBlock(path, [&](const char *p, size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (c == '\n' || c == '\r') {
+          have = 0;
+          continue;
         }
-      }
-      if (!CanRedoPrompt(*history) &&
-          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
-        ImGui::SetTooltip("No changes to redo");
-      } else if (ImGui::IsItemHovered()) {
-        ImGui::SetTooltip("Redo (Ctrl+Y)");
-      }
-
-      // Clear Current State button with Font Awesome icon
-      ImGui::SameLine();
-      {
-        bool has_history =
-            history->history.size() > 1; // More than just current state
-        ImGuiDisabledScope disable_clear(!has_history);
-        if (ImGui::Button(ICON_FA_MINUS, ImVec2(button_width, 0))) {
-          DevLog(state, "Clear current state button clicked for prompt " +
-                            std::to_string(prompt_index));
-          ClearCurrentPromptState(state, prompt_index);
-          SavePrompts(state);
+        if (c >= 'A' && c <= 'Z')
+          c = (unsigned char)(c - 'A' + 'a');
+        gram = ((gram << 8) | c) & ((1u << kGramBits) - 1);
+        if (++have < 3)
+          continue;
+        uint64_t &word = seen[gram >> 6];
+        uint64_t bit = 1ull << (gram & 63);
+        if (!(word & bit)) {
+          word |= bit;
+          grams.push_back(gram);
         }
       }
-      if (history->history.size() <= 1 &&
-          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
-        ImGui::SetTooltip("No current state to clear");
-      } else if (ImGui::IsItemHovered()) {
-        ImGui::SetTooltip("Clear current state (go back one step)");
-      }
-
-      // Clear All History for this prompt button with Font Awesome icon
-      ImGui::SameLine();
-      {
-        bool has_history =
-            history->history.size() > 1; // More than just current state
-        ImGuiDisabledScope disable_clear(!has_history);
-        if (ImGui::Button(ICON_FA_TRASH, ImVec2(button_width, 0))) {
-          DevLog(state, "Clear all history button clicked for prompt " +
-                            std::to_string(prompt_index));
-          state.pending_clear_prompt_index = prompt_index;
-          state.show_confirm_clear_prompt_all_history = true;
+      return !stop_;
+    });
+  }
+
+  // Find the query's lines in one file and publish them while the query
+  // is still current. The longest needle finds candidate lines, which the
+  // whole query then tests; a query without one tests every line.
+  void Verify(const std::string &path, const std::string &label,
+              const LogQuery &query, uint64_t gen) {
+    static const std::string kNoNeedle;
+    const std::string &needle =
+        query.Needles().empty() ? kNoNeedle : query.Needles().front();
+    std::boyer_moore_horspool_searcher<std::string::const_iterator>
+        searcher(needle.begin(), needle.end());
+    std::shared_ptr<const LogClassifier> classifier;
+    if (query.UsesSeverity())
+      classifier = CurrentLogClassifier();
+    std::string text, lower;
+    std::vector<LogSearchHit> found;
+    uint64_t line_no = 0;
+    size_t file_hits = 0;
+    bool current = true;
+
+    // Search complete lines in text; a line cut by the block end waits
+    // for the next block
+    auto search = [&](bool last) {
+      size_t end = last ? text.size() : text.rfind('\n') + 1;
+      if (end == 0) // no line break yet (rfind gave npos)
+        return;
+      lower.resize(end);
+      FoldAsciiLower(text.data(), &lower[0], end);
+      size_t counted = 0;
+      auto it = lower.cbegin();
+      auto stop = lower.cbegin() + end;
+      while (file_hits < kLogSearchMaxHitsPerFile) {
+        it = std::search(it, stop, searcher);
+        if (it == stop)
+          break;
+        size_t off = (size_t)(it - lower.cbegin());
+        // From the line break before off (npos + 1 wraps to 0)
+        size_t begin = off == 0 ? 0 : text.rfind('\n', off - 1) + 1;
+        size_t line_end = text.find('\n', off);
+        if (line_end == std::string::npos || line_end > end)
+          line_end = end;
+        size_t len = line_end - begin;
+        if (len > 0 && text[begin + len - 1] == '\r')
+          len--;
+        LogQueryLine line;
+        line.lower = std::string_view(lower.data() + begin, len);
+        if (classifier)
+          line.severity =
+              classifier->Classify(std::string_view(text.data() + begin, len));
+        if (query.MatchLine(line)) {
+          line_no += (uint64_t)std::count(text.begin() + counted,
+                                          text.begin() + begin, '\n');
+          counted = begin;
+          LogSearchHit hit;
+          hit.path = path;
+          hit.label = label;
+          hit.line = line_no;
+          hit.text = text.substr(begin, std::min(len, kLogSearchHitText));
+          found.push_back(std::move(hit));
+          file_hits++;
         }
+        if (line_end >= end)
+          break;
+        it = lower.cbegin() + line_end + 1;
       }
-      if (history->history.size() <= 1 &&
-          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
-        ImGui::SetTooltip("No history to clear");
-      } else if (ImGui::IsItemHovered()) {
-        ImGui::SetTooltip(
-            "Clear all history for this prompt (reset to original)");
+      line_no += (uint64_t)std::count(text.begin() + counted,
+                                      text.begin() + end, '\n');
+      text.erase(0, end);
+      current = Publish(found, gen, file_hits);
+    };
+
+    ForEachLogBlock(path, [&](const char *p, size_t n) {
+      text.append(p, n);
+      search(false);
+      return current && !stop_ && file_hits < kLogSearchMaxHitsPerFile;
+    });
+    if (current && !text.empty() && file_hits < kLogSearchMaxHitsPerFile)
+      search(true);
+  }
+
+  // Append a file's new hits to the results; false once the query is
+  // stale or full
+  bool Publish(std::vector<LogSearchHit> &found, uint64_t gen,
+               size_t file_hits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (gen != gen_ || stop_)
+      return false;
+    if (found.empty())
+      return true;
+    if (file_hits == found.size())
+      matched_files_++; // first hits of this file
+    for (auto &hit : found) {
+      if (hits_.size() >= kLogSearchMaxHits) {
+        truncated_ = true;
+        verify_.clear();
+        found.clear();
+        return false;
       }
+      hits_.push_back(std::move(hit));
     }
+    found.clear();
+    return true;
   }
 
-  ImGui::Separator();
-
-  std::vector<std::string> original_lines;
-  std::vector<std::string> modified_lines;
-
-  auto trimEnd = [](std::string str) -> std::string {
-    size_t end = str.find_last_not_of(" \t\r\n");
-    return (end == std::string::npos) ? "" : str.substr(0, end + 1);
-  };
+  std::thread scanner_;
+
+  // Guarded by mutex_
+  mutable std::mutex mutex_;
+  std::condition_variable scan_cv_;
+  std::atomic<bool> stop_{false}; // also polled by long scans
+  bool started_ = false;
+  bool rescan_ = false;
+  std::vector<std::string> roots_;
+  std::vector<File> files_;
+  std::unordered_map<std::string, uint32_t> by_path_;
+  size_t live_files_ = 0, indexed_files_ = 0;
+  uint64_t indexed_bytes_ = 0;
+  std::deque<uint32_t> index_;  // files waiting for a signature
+  std::deque<uint32_t> verify_; // candidates of the current query
+  int verifying_ = 0;
+  size_t max_jobs_ = 1;
+  size_t verify_jobs_ = 0, index_jobs_ = 0; // on the pool
+  LogQuery query_;
+  std::vector<uint32_t> needle_grams_;
+  uint64_t gen_ = 0;
+  std::vector<LogSearchHit> hits_;
+  size_t matched_files_ = 0;
+  std::atomic<bool> truncated_{false};
+};
 
-  {
-    std::istringstream orig_stream(original);
-    std::string line;
-    while (std::getline(orig_stream, line)) {
-      original_lines.push_back(trimEnd(line));
-    }
-  }
+static LogSearchIndex g_log_search;
 
-  {
-    std::istringstream mod_stream(modified);
-    std::string line;
-    while (std::getline(mod_stream, line)) {
-      modified_lines.push_back(trimEnd(line));
+static bool FindDirByName(const std::string &root, const std::string &needle,
+                          std::string &out, int depth = 3) {
+  if (depth < 0)
+    return false;
+  DIR *d = opendir(root.c_str());
+  if (!d)
+    return false;
+  struct dirent *e;
+  bool ok = false;
+  struct stat st{};
+  while (!ok && (e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.')
+      continue;
+    std::string name(e->d_name);
+    std::string p = root + "/" + name;
+    if (stat(p.c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      if (name == needle) {
+        out = p;
+        ok = true;
+        break;
+      }
+      if (FindDirByName(p, needle, out, depth - 1)) {
+        ok = true;
+        break;
+      }
     }
   }
+  closedir(d);
+  return ok;
+}
 
-  struct DiffLine {
-    enum Type { UNCHANGED, ADDED, REMOVED, MODIFIED } type;
-    std::string orig_text;
-    std::string mod_text;
-    int orig_line_num;
-    int mod_line_num;
-  };
-
-  std::vector<DiffLine> diff_result;
-
-  size_t o = 0, m = 0;
-  int orig_line_num = 1, mod_line_num = 1;
-
-  while (o < original_lines.size() || m < modified_lines.size()) {
-    if (o >= original_lines.size()) {
-      diff_result.push_back(
-          {DiffLine::ADDED, "", modified_lines[m], -1, mod_line_num++});
-      m++;
-    } else if (m >= modified_lines.size()) {
-      diff_result.push_back(
-          {DiffLine::REMOVED, original_lines[o], "", orig_line_num++, -1});
-      o++;
-    } else if (original_lines[o] == modified_lines[m]) {
-      diff_result.push_back({DiffLine::UNCHANGED, original_lines[o],
-                             modified_lines[m], orig_line_num++,
-                             mod_line_num++});
-      o++;
-      m++;
-    } else {
-      bool found_match = false;
-
-      for (size_t look = m + 1; look < std::min(m + 5, modified_lines.size());
-           look++) {
-        if (original_lines[o] == modified_lines[look]) {
-          for (size_t add = m; add < look; add++) {
-            diff_result.push_back(
-                {DiffLine::ADDED, "", modified_lines[add], -1, mod_line_num++});
-          }
-          m = look;
-          found_match = true;
-          break;
-        }
-      }
-
-      if (!found_match) {
-        for (size_t look = o + 1; look < std::min(o + 5, original_lines.size());
-             look++) {
-          if (modified_lines[m] == original_lines[look]) {
-            for (size_t rem = o; rem < look; rem++) {
-              diff_result.push_back({DiffLine::REMOVED, original_lines[rem], "",
-                                     orig_line_num++, -1});
-            }
-            o = look;
-            found_match = true;
-            break;
+static std::string FindLatestModePath(const std::string &root,
+                                      const std::string &mode) {
+  time_t best_time = 0;
+  std::string best_path;
+  DIR *root_dir = opendir(root.c_str());
+  if (!root_dir)
+    return "";
+  struct dirent *task_ent;
+  struct stat st{};
+  while ((task_ent = readdir(root_dir)) != NULL) {
+    if (task_ent->d_name[0] == '.')
+      continue;
+    std::string task_dir = root + "/" + task_ent->d_name;
+    if (!DirectoryExists(task_dir))
+      continue;
+    DIR *ts_dir = opendir(task_dir.c_str());
+    if (!ts_dir)
+      continue;
+    struct dirent *ts_ent;
+    while ((ts_ent = readdir(ts_dir)) != NULL) {
+      if (ts_ent->d_name[0] == '.')
+        continue;
+      std::string ts_path = task_dir + "/" + ts_ent->d_name;
+      if (!DirectoryExists(ts_path))
+        continue;
+      std::string candidate = ts_path + "/" + mode;
+      if (DirectoryExists(candidate)) {
+        if (stat(ts_path.c_str(), &st) == 0) {
+          if (st.st_mtime > best_time) {
+            best_time = st.st_mtime;
+            best_path = candidate;
           }
         }
       }
-
-      if (!found_match) {
-        diff_result.push_back({DiffLine::MODIFIED, original_lines[o],
-                               modified_lines[m], orig_line_num++,
-                               mod_line_num++});
-        o++;
-        m++;
-      }
     }
+    closedir(ts_dir);
   }
+  closedir(root_dir);
+  return best_path;
+}
 
-  // Improved color scheme
-  ImVec4 color_added_bg = ImVec4(0.15f, 0.30f, 0.18f, 0.45f);
-  ImVec4 color_added_text = ImVec4(0.40f, 0.90f, 0.50f, 1.0f);
-  ImVec4 color_added_hl = ImVec4(0.20f, 0.45f, 0.25f, 0.65f);
-  ImVec4 color_removed_bg = ImVec4(0.40f, 0.15f, 0.15f, 0.45f);
-  ImVec4 color_removed_text = ImVec4(1.0f, 0.40f, 0.40f, 1.0f);
-  ImVec4 color_removed_hl = ImVec4(0.60f, 0.20f, 0.20f, 0.65f);
-  ImVec4 color_line_num = ImVec4(0.55f, 0.55f, 0.60f, 1.0f);
-  ImVec4 color_unchanged = ImVec4(0.88f, 0.88f, 0.88f, 1.0f);
-  ImVec4 color_header = ImVec4(0.75f, 0.80f, 0.95f, 1.0f);
+static std::string
+SearchLogPathForContainer(const std::vector<std::string> &log_roots,
+                          const std::string &name) {
+  // Resolve a log root candidate by walking up a few directories if needed
+  auto resolve_root = [](const std::string &root) -> std::string {
+    if (DirectoryExists(root))
+      return root;
+    std::string prefix = "";
+    for (int i = 0; i < 4; i++) {
+      if (DirectoryExists(prefix + root))
+        return prefix + root;
+      prefix += "../";
+    }
+    return root; // fallback
+  };
+  // Prefer mode from container name
+  std::string mode;
+  size_t mode_at = name.find("-feedback-");
+  if (mode_at != std::string::npos) {
+    mode = "feedback";
+  } else if ((mode_at = name.find("-verify-")) != std::string::npos) {
+    mode = "verify";
+  }
 
-  if (state.diff_split_view) {
-    // Split View Mode
-    ImGui::Columns(2, "DiffColumns", true);
+  for (const auto &root : log_roots) {
+    std::string r = resolve_root(root);
+    if (!mode.empty()) {
+      // autobuild.sh names containers <task>-<mode>-<timestamp> and logs to
+      // <root>/<task>/<timestamp>/<mode>
+      std::string exact = r + "/" + name.substr(0, mode_at) + "/" +
+                          name.substr(mode_at + mode.size() + 2) + "/" + mode;
+      if (DirectoryExists(exact))
+        return exact;
+      std::string p = FindLatestModePath(r, mode);
+      if (!p.empty())
+        return p;
+    } else {
+      std::string p1 = FindLatestModePath(r, "feedback");
+      std::string p2 = FindLatestModePath(r, "verify");
+      if (!p1.empty())
+        return p1;
+      if (!p2.empty())
+        return p2;
+    }
+  }
+  return "";
+}
 
-    ImGui::PushStyleColor(ImGuiCol_Text, color_header);
-    ImGui::Text("Original");
-    ImGui::PopStyleColor();
-    ImGui::NextColumn();
+static std::string GuessLogPathForContainer(
+    const std::vector<std::string> &log_roots, const std::string &name) {
+  std::string roots;
+  for (const auto &root : log_roots)
+    roots += root + "\n";
+  std::string dir;
+  if (g_container_logs.Lookup(name, roots, dir))
+    return dir;
+  dir = SearchLogPathForContainer(log_roots, name);
+  g_container_logs.Remember(name, roots, dir);
+  return dir;
+}
 
-    ImGui::PushStyleColor(ImGuiCol_Text, color_header);
-    ImGui::Text("Modified");
-    ImGui::PopStyleColor();
-    ImGui::NextColumn();
+static std::string GuessLogPathForContainer(const AppState &state,
+                                            const std::string &name) {
+  return GuessLogPathForContainer(state.log_folder_paths, name);
+}
 
-    ImGui::Separator();
-    ImGui::NextColumn();
-    ImGui::NextColumn();
+// One member of a log bundle: a file copied in as it is, a directory
+// walked recursively, or generated text such as the run's metadata
+struct BundleEntry {
+  std::string name; // path inside the archive
+  std::string path; // file or directory on disk; empty for text
+  std::string text;
+  // When set, builds the text on the export thread instead
+  std::function<std::string()> render = {};
+};
 
-    float start_y = ImGui::GetCursorPosY();
-    ImGui::BeginChild(
-        "OriginalDiffView", ImVec2(0, state.diff_editor_splitter_height), true,
-        state.diff_wrap_lines ? 0 : ImGuiWindowFlags_HorizontalScrollbar);
-
-    if (state.diff_wrap_lines)
-      ImGui::PushTextWrapPos(0.0f);
-
-    for (const auto &diff : diff_result) {
-      if (diff.type == DiffLine::UNCHANGED || diff.type == DiffLine::MODIFIED) {
-        ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
-        float line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.orig_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImVec2 line_size =
-            ImVec2(ImGui::GetContentRegionAvail().x, line_height);
-
-        if (diff.type == DiffLine::MODIFIED) {
-          ImGui::GetWindowDrawList()->AddRectFilled(
-              cursor_pos,
-              ImVec2(cursor_pos.x + line_size.x, cursor_pos.y + line_size.y),
-              ImGui::ColorConvertFloat4ToU32(color_removed_bg));
-        }
-
-        char line_num_buf[16];
-        snprintf(line_num_buf, sizeof(line_num_buf), "%4d", diff.orig_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
+// Compressed output of a bundle: zstd frames when built with zstd, the
+// plain tar stream otherwise
+class BundleSink {
+public:
+  ~BundleSink() { Close(); }
+
+  bool Open(const std::string &path) {
+    out_ = fopen(path.c_str(), "wb");
+#ifdef AUTOBUILD_HAVE_ZSTD
+    cctx_ = ZSTD_createCCtx();
+    if (cctx_)
+      ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, kArchiveLevel);
+    return out_ && cctx_;
+#else
+    return out_ != nullptr;
+#endif
+  }
 
-        if (diff.type == DiffLine::MODIFIED) {
-          auto char_diffs = ComputeCharDiff(diff.orig_text, diff.mod_text);
-          ImGui::Text("-");
-          ImGui::SameLine();
-          for (const auto &cd : char_diffs) {
-            if (cd.is_changed) {
-              ImGui::PushStyleColor(ImGuiCol_Text,
-                                    ImVec4(1.0f, 0.50f, 0.50f, 1.0f));
-              ImGui::SameLine(0, 0);
-              ImGui::Text("%s", cd.text.c_str());
-              ImGui::PopStyleColor();
-            } else {
-              ImGui::PushStyleColor(ImGuiCol_Text, color_removed_text);
-              ImGui::SameLine(0, 0);
-              ImGui::Text("%s", cd.text.c_str());
-              ImGui::PopStyleColor();
-            }
-          }
-        } else {
-          ImGui::PushStyleColor(ImGuiCol_Text, color_unchanged);
-          ImGui::Text(" %s", diff.orig_text.c_str());
-          ImGui::PopStyleColor();
-        }
-      } else if (diff.type == DiffLine::REMOVED) {
-        ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
-        float line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.orig_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImVec2 line_size =
-            ImVec2(ImGui::GetContentRegionAvail().x, line_height);
-        ImGui::GetWindowDrawList()->AddRectFilled(
-            cursor_pos,
-            ImVec2(cursor_pos.x + line_size.x, cursor_pos.y + line_size.y),
-            ImGui::ColorConvertFloat4ToU32(color_removed_bg));
-
-        char line_num_buf[16];
-        snprintf(line_num_buf, sizeof(line_num_buf), "%4d", diff.orig_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
-        ImGui::PushStyleColor(ImGuiCol_Text, color_removed_text);
-        ImGui::Text("-%s", diff.orig_text.c_str());
-        ImGui::PopStyleColor();
-      } else {
-        ImGui::Text("    ");
-      }
+  bool Write(const char *data, size_t size) {
+#ifdef AUTOBUILD_HAVE_ZSTD
+    ZSTD_inBuffer in = {data, size, 0};
+    while (in.pos < in.size) {
+      if (!Drain(ZSTD_compressStream2(cctx_, Out(), &in, ZSTD_e_continue)))
+        return false;
     }
+    return true;
+#else
+    return fwrite(data, 1, size, out_) == size;
+#endif
+  }
 
-    if (state.diff_wrap_lines)
-      ImGui::PopTextWrapPos();
-    ImGui::EndChild();
-    ImGui::NextColumn();
+  // Flush the compressor and close the file
+  bool Finish() {
+    if (!out_)
+      return false;
+    bool ok = true;
+#ifdef AUTOBUILD_HAVE_ZSTD
+    ZSTD_inBuffer in = {nullptr, 0, 0};
+    size_t left = 1;
+    while (ok && left != 0) {
+      left = ZSTD_compressStream2(cctx_, Out(), &in, ZSTD_e_end);
+      ok = Drain(left);
+    }
+#endif
+    ok = fflush(out_) == 0 && ok;
+    Close();
+    return ok;
+  }
 
-    ImGui::SetCursorPosY(start_y);
-    ImGui::BeginChild(
-        "ModifiedDiffView", ImVec2(0, state.diff_editor_splitter_height), true,
-        state.diff_wrap_lines ? 0 : ImGuiWindowFlags_HorizontalScrollbar);
-
-    if (state.diff_wrap_lines)
-      ImGui::PushTextWrapPos(0.0f);
-
-    for (const auto &diff : diff_result) {
-      if (diff.type == DiffLine::UNCHANGED || diff.type == DiffLine::MODIFIED) {
-        ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
-        float line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.mod_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImVec2 line_size =
-            ImVec2(ImGui::GetContentRegionAvail().x, line_height);
-
-        if (diff.type == DiffLine::MODIFIED) {
-          ImGui::GetWindowDrawList()->AddRectFilled(
-              cursor_pos,
-              ImVec2(cursor_pos.x + line_size.x, cursor_pos.y + line_size.y),
-              ImGui::ColorConvertFloat4ToU32(color_added_bg));
-        }
-
-        char line_num_buf[16];
-        snprintf(line_num_buf, sizeof(line_num_buf), "%4d", diff.mod_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
+  static const char *Extension() {
+#ifdef AUTOBUILD_HAVE_ZSTD
+    return ".tar.zst";
+#else
+    return ".tar";
+#endif
+  }
 
-        if (diff.type == DiffLine::MODIFIED) {
-          auto char_diffs = ComputeCharDiff(diff.orig_text, diff.mod_text,
-                                            true); // true = for new string
-          ImGui::Text("+");
-          ImGui::SameLine();
-          for (const auto &cd : char_diffs) {
-            if (cd.is_changed) {
-              ImGui::PushStyleColor(ImGuiCol_Text,
-                                    ImVec4(0.50f, 1.0f, 0.60f, 1.0f));
-              ImGui::SameLine(0, 0);
-              ImGui::Text("%s", cd.text.c_str());
-              ImGui::PopStyleColor();
-            } else {
-              ImGui::PushStyleColor(ImGuiCol_Text, color_added_text);
-              ImGui::SameLine(0, 0);
-              ImGui::Text("%s", cd.text.c_str());
-              ImGui::PopStyleColor();
-            }
-          }
-        } else {
-          ImGui::PushStyleColor(ImGuiCol_Text, color_unchanged);
-          ImGui::Text(" %s", diff.mod_text.c_str());
-          ImGui::PopStyleColor();
-        }
-      } else if (diff.type == DiffLine::ADDED) {
-        ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
-        float line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.mod_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImVec2 line_size =
-            ImVec2(ImGui::GetContentRegionAvail().x, line_height);
-        ImGui::GetWindowDrawList()->AddRectFilled(
-            cursor_pos,
-            ImVec2(cursor_pos.x + line_size.x, cursor_pos.y + line_size.y),
-            ImGui::ColorConvertFloat4ToU32(color_added_bg));
-
-        char line_num_buf[16];
-        snprintf(line_num_buf, sizeof(line_num_buf), "%4d", diff.mod_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
-        ImGui::PushStyleColor(ImGuiCol_Text, color_added_text);
-        ImGui::Text("+%s", diff.mod_text.c_str());
-        ImGui::PopStyleColor();
-      } else {
-        ImGui::Text("    ");
-      }
-    }
+private:
+  void Close() {
+#ifdef AUTOBUILD_HAVE_ZSTD
+    ZSTD_freeCCtx(cctx_);
+    cctx_ = nullptr;
+#endif
+    if (out_)
+      fclose(out_);
+    out_ = nullptr;
+  }
 
-    if (state.diff_wrap_lines)
-      ImGui::PopTextWrapPos();
-    ImGui::EndChild();
-    ImGui::Columns(1);
-  } else {
-    // Unified View Mode
-    ImGui::PushStyleColor(ImGuiCol_Text, color_header);
-    ImGui::Text("Unified Diff");
-    ImGui::PopStyleColor();
-    ImGui::Separator();
+#ifdef AUTOBUILD_HAVE_ZSTD
+  ZSTD_outBuffer *Out() {
+    packed_.resize(ZSTD_CStreamOutSize());
+    out_buf_ = {&packed_[0], packed_.size(), 0};
+    return &out_buf_;
+  }
+  // Write what the last compress call produced; false on either error
+  bool Drain(size_t ret) {
+    return !ZSTD_isError(ret) &&
+           fwrite(packed_.data(), 1, out_buf_.pos, out_) == out_buf_.pos;
+  }
 
-    ImGui::BeginChild(
-        "UnifiedDiffView", ImVec2(0, state.diff_editor_splitter_height), true,
-        state.diff_wrap_lines ? 0 : ImGuiWindowFlags_HorizontalScrollbar);
+  ZSTD_CCtx *cctx_ = nullptr;
+  std::string packed_;
+  ZSTD_outBuffer out_buf_ = {};
+#endif
+  FILE *out_ = nullptr;
+};
 
-    if (state.diff_wrap_lines)
-      ImGui::PushTextWrapPos(0.0f);
+// Background export of logs into a bundle, one at a time. The UI hands over
+// what goes in (the spool and phase logs of a task, or a run's folder, plus
+// metadata) and only polls Get(); a job on the pool's I/O lane lists
+// directories, streams every file through the compressor in kLogSearchBlock
+// pieces and writes the archive as <output>.part, renamed into place once
+// complete. A cancelled or failed export leaves nothing behind.
+class LogExporter {
+public:
+  struct Status {
+    bool active = false;
+    std::string output;  // the bundle being (or last) written
+    std::string message; // outcome of the last export; empty while active
+    uint64_t done = 0;   // bytes read so far
+    uint64_t total = 0;  // bytes to read, once the entries are listed
+  };
 
-    for (const auto &diff : diff_result) {
-      if (diff.type == DiffLine::UNCHANGED) {
-        char line_num_buf[32];
-        snprintf(line_num_buf, sizeof(line_num_buf), "%4d %4d",
-                 diff.orig_line_num, diff.mod_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
-        ImGui::PushStyleColor(ImGuiCol_Text, color_unchanged);
-        ImGui::Text("  %s", diff.orig_text.c_str());
-        ImGui::PopStyleColor();
-      } else if (diff.type == DiffLine::REMOVED) {
-        ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
-        float line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.orig_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImVec2 line_size =
-            ImVec2(ImGui::GetContentRegionAvail().x, line_height);
-        ImGui::GetWindowDrawList()->AddRectFilled(
-            cursor_pos,
-            ImVec2(cursor_pos.x + line_size.x, cursor_pos.y + line_size.y),
-            ImGui::ColorConvertFloat4ToU32(color_removed_bg));
-
-        char line_num_buf[32];
-        snprintf(line_num_buf, sizeof(line_num_buf), "%4d     ",
-                 diff.orig_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
-        ImGui::PushStyleColor(ImGuiCol_Text, color_removed_text);
-        ImGui::Text("- %s", diff.orig_text.c_str());
-        ImGui::PopStyleColor();
-      } else if (diff.type == DiffLine::ADDED) {
-        ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
-        float line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.mod_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImVec2 line_size =
-            ImVec2(ImGui::GetContentRegionAvail().x, line_height);
-        ImGui::GetWindowDrawList()->AddRectFilled(
-            cursor_pos,
-            ImVec2(cursor_pos.x + line_size.x, cursor_pos.y + line_size.y),
-            ImGui::ColorConvertFloat4ToU32(color_added_bg));
-
-        char line_num_buf[32];
-        snprintf(line_num_buf, sizeof(line_num_buf), "     %4d",
-                 diff.mod_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
-        ImGui::PushStyleColor(ImGuiCol_Text, color_added_text);
-        ImGui::Text("+ %s", diff.mod_text.c_str());
-        ImGui::PopStyleColor();
-      } else if (diff.type == DiffLine::MODIFIED) {
-        // Show removed line
-        ImVec2 cursor_pos = ImGui::GetCursorScreenPos();
-        float line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.orig_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImGui::GetWindowDrawList()->AddRectFilled(
-            cursor_pos,
-            ImVec2(cursor_pos.x + ImGui::GetContentRegionAvail().x,
-                   cursor_pos.y + line_height),
-            ImGui::ColorConvertFloat4ToU32(color_removed_bg));
-
-        char line_num_buf[32];
-        snprintf(line_num_buf, sizeof(line_num_buf), "%4d     ",
-                 diff.orig_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
+  ~LogExporter() { Stop(); }
+
+  // Start writing entries to output; false while another export runs
+  bool Start(const std::string &output, std::vector<BundleEntry> entries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_ || stop_)
+      return false;
+    active_ = true;
+    token_ = CancelToken();
+    output_ = output;
+    message_.clear();
+    done_ = 0;
+    total_ = 0;
+    // The job always runs, even when cancelled while queued, so active_
+    // is cleared; Write sees the cancel right away
+    g_jobs.Submit(JobLane::Io, JobPriority::Normal,
+                  [this, output, entries = std::move(entries),
+                   token = token_](const CancelToken &) mutable {
+                    std::string message = Write(output, entries, token);
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    message_ = message;
+                    active_ = false;
+                    WakeMainLoop();
+                  });
+    return true;
+  }
 
-        auto char_diffs_old = ComputeCharDiff(diff.orig_text, diff.mod_text);
-        ImGui::Text("-");
-        ImGui::SameLine();
-        for (const auto &cd : char_diffs_old) {
-          if (cd.is_changed) {
-            ImGui::PushStyleColor(ImGuiCol_Text,
-                                  ImVec4(1.0f, 0.50f, 0.50f, 1.0f));
-            ImGui::SameLine(0, 0);
-            ImGui::Text("%s", cd.text.c_str());
-            ImGui::PopStyleColor();
-          } else {
-            ImGui::PushStyleColor(ImGuiCol_Text, color_removed_text);
-            ImGui::SameLine(0, 0);
-            ImGui::Text("%s", cd.text.c_str());
-            ImGui::PopStyleColor();
-          }
-        }
+  void Cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    token_.Cancel();
+  }
 
-        // Show added line
-        cursor_pos = ImGui::GetCursorScreenPos();
-        line_height =
-            state.diff_wrap_lines
-                ? ImGui::CalcTextSize(diff.mod_text.c_str(), nullptr, false,
-                                      ImGui::GetContentRegionAvail().x)
-                      .y
-                : ImGui::GetTextLineHeight();
-        ImGui::GetWindowDrawList()->AddRectFilled(
-            cursor_pos,
-            ImVec2(cursor_pos.x + ImGui::GetContentRegionAvail().x,
-                   cursor_pos.y + line_height),
-            ImGui::ColorConvertFloat4ToU32(color_added_bg));
-
-        snprintf(line_num_buf, sizeof(line_num_buf), "     %4d",
-                 diff.mod_line_num);
-        ImGui::PushStyleColor(ImGuiCol_Text, color_line_num);
-        ImGui::Text("%s", line_num_buf);
-        ImGui::PopStyleColor();
-        ImGui::SameLine();
+  Status Get() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Status status;
+    status.active = active_;
+    status.output = output_;
+    status.message = message_;
+    status.done = done_;
+    status.total = total_;
+    return status;
+  }
 
-        auto char_diffs_new = ComputeCharDiff(diff.orig_text, diff.mod_text,
-                                              true); // true = for new string
-        ImGui::Text("+");
-        ImGui::SameLine();
-        for (const auto &cd : char_diffs_new) {
-          if (cd.is_changed) {
-            ImGui::PushStyleColor(ImGuiCol_Text,
-                                  ImVec4(0.50f, 1.0f, 0.60f, 1.0f));
-            ImGui::SameLine(0, 0);
-            ImGui::Text("%s", cd.text.c_str());
-            ImGui::PopStyleColor();
-          } else {
-            ImGui::PushStyleColor(ImGuiCol_Text, color_added_text);
-            ImGui::SameLine(0, 0);
-            ImGui::Text("%s", cd.text.c_str());
-            ImGui::PopStyleColor();
+  // A running export notices the cancel between pieces; the pool's own
+  // Stop waits for it
+  void Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    token_.Cancel();
+  }
+
+private:
+  struct Member {
+    std::string name;
+    std::string path;
+    const std::string *text = nullptr;
+    uint64_t size = 0;
+    long long mtime = 0;
+  };
+
+  // Files under dir, recursively, with names below prefix
+  static void ListTree(const std::string &dir, const std::string &prefix,
+                       std::vector<Member> &members) {
+    for (const auto &name : LogsIndexer::List(dir, true)) {
+      Member m;
+      m.name = prefix + "/" + name;
+      m.path = dir + "/" + name;
+      members.push_back(m);
+    }
+    for (const auto &name : LogsIndexer::List(dir, false))
+      ListTree(dir + "/" + name, prefix + "/" + name, members);
+  }
+
+  // Returns the message shown once the export is over
+  std::string Write(const std::string &output,
+                    const std::vector<BundleEntry> &entries,
+                    const CancelToken &token) {
+    std::vector<Member> members;
+    std::deque<std::string> rendered;
+    for (const auto &entry : entries) {
+      if (entry.path.empty()) {
+        Member m;
+        m.name = entry.name;
+        m.text = &entry.text;
+        if (entry.render) {
+          rendered.push_back(entry.render());
+          m.text = &rendered.back();
+        }
+        m.size = m.text->size();
+        m.mtime = (long long)time(nullptr);
+        members.push_back(m);
+      } else if (IsDirectory(entry.path)) {
+        ListTree(entry.path, entry.name, members);
+      } else {
+        Member m;
+        m.name = entry.name;
+        m.path = entry.path;
+        members.push_back(m);
+      }
+    }
+    // Sizes are fixed here; a file still growing is cut at this length
+    uint64_t total = 0;
+    for (auto &m : members) {
+      struct stat st{};
+      if (!m.text && stat(m.path.c_str(), &st) == 0) {
+        m.size = (uint64_t)st.st_size;
+        m.mtime = (long long)st.st_mtime;
+      }
+      total += m.size;
+    }
+    total_ = total;
+
+    std::string part = output + ".part";
+    BundleSink sink;
+    bool ok = sink.Open(part);
+    std::vector<char> buf(kLogSearchBlock);
+    char header[kTarBlock];
+    for (const auto &m : members) {
+      if (!ok || token.Cancelled())
+        break;
+      if (!TarFileHeader(m.name, m.size, m.mtime, header))
+        continue; // a name too long for ustar
+      ok = sink.Write(header, kTarBlock);
+      if (m.text) {
+        ok = ok && sink.Write(m.text->data(), m.text->size());
+        done_ += m.size;
+      } else {
+        FILE *f = fopen(m.path.c_str(), "rb");
+        uint64_t left = m.size;
+        while (ok && left > 0 && !token.Cancelled()) {
+          size_t n = f ? fread(buf.data(), 1,
+                               (size_t)std::min<uint64_t>(left, buf.size()), f)
+                       : 0;
+          if (n == 0) {
+            // Shrunk or unreadable: the header promised size bytes
+            n = (size_t)std::min<uint64_t>(left, buf.size());
+            memset(buf.data(), 0, n);
           }
+          ok = sink.Write(buf.data(), n);
+          left -= n;
+          done_ += n;
         }
+        if (f)
+          fclose(f);
       }
+      memset(header, 0, kTarBlock);
+      ok = ok && sink.Write(header, TarPadding(m.size));
     }
+    memset(header, 0, kTarBlock);
+    ok = ok && !token.Cancelled() && sink.Write(header, kTarBlock) &&
+         sink.Write(header, kTarBlock);
+    ok = ok && sink.Finish();
+    if (ok && rename(part.c_str(), output.c_str()) == 0)
+      return "Exported " + std::to_string(members.size()) + " files to " +
+             output;
+    remove(part.c_str());
+    return token.Cancelled() ? "Export cancelled" : "Export failed: " + output;
+  }
+
+  mutable std::mutex mutex_;
+  bool active_ = false;
+  bool stop_ = false;
+  CancelToken token_; // of the current export
+  std::string output_;
+  std::string message_;
+  std::atomic<uint64_t> done_{0};
+  std::atomic<uint64_t> total_{0};
+};
 
-    if (state.diff_wrap_lines)
-      ImGui::PopTextWrapPos();
-    ImGui::EndChild();
-  }
+static LogExporter g_log_exporter;
+
+// Where bundles go: <logs root>/exports/<name>_<timestamp><extension>
+static std::string LogBundlePath(const AppState &state,
+                                 const std::string &name) {
+  std::string root =
+      state.log_folder_paths.empty()
+          ? ResolveDefaultLogsPath()
+          : state.log_folder_paths[std::max(0, state.selected_log_folder)];
+  std::string dir = root + "/exports";
+  CreateDirectoryRecursive(dir);
+  std::string safe = name;
+  for (char &c : safe)
+    if (!isalnum((unsigned char)c) && c != '-' && c != '_' && c != '.')
+      c = '_';
+  auto time_t = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now());
+  std::stringstream ss;
+  ss << dir << "/" << safe << "_"
+     << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S")
+     << BundleSink::Extension();
+  return ss.str();
 }
 
-void RenderPromptEditor(AppState &state) {
-  if (!state.show_prompt_editor) {
-    if (state.last_logged_editor_open) {
-      DevLog(state, "RenderPromptEditor: Editor closed");
-      state.last_logged_editor_open = false;
-      state.last_logged_prompt_tab = -1;
-    }
-    return;
+// Progress of the running export with a cancel button, or the outcome of
+// the last one; shown wherever an export can be started
+static void RenderLogExportStatus() {
+  LogExporter::Status status = g_log_exporter.Get();
+  if (status.active) {
+    float fraction =
+        status.total > 0 ? (float)((double)status.done / status.total) : 0.0f;
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "%s / %s",
+             FormatDockerSize((double)status.done).c_str(),
+             FormatDockerSize((double)status.total).c_str());
+    ImGui::SetNextItemWidth(200);
+    ImGui::ProgressBar(fraction, ImVec2(200, 0), overlay);
+    if (ImGui::IsItemHovered())
+      ImGui::SetTooltip("Exporting %s", status.output.c_str());
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Cancel##export"))
+      g_log_exporter.Cancel();
+  } else if (!status.message.empty()) {
+    ImGui::TextDisabled("%s", status.message.c_str());
   }
+}
 
-  ImGuiStateTracker tracker(state);
+// Convert one /containers/json entry into a Manage tab row
+static AppState::DockerContainer DockerContainerFromApi(AppState &state,
+                                                        const JsonValue &c) {
+  AppState::DockerContainer dc;
+  dc.id = c.GetString("Id").substr(0, 12);
+  const JsonValue *names = c.Find("Names");
+  if (names && names->type == JsonValue::Array && !names->items.empty())
+    dc.name = names->items[0].str;
+  if (!dc.name.empty() && dc.name[0] == '/')
+    dc.name.erase(0, 1);
+  dc.image = c.GetString("Image");
+  dc.status = c.GetString("Status");
+  time_t created = (time_t)c.GetNumber("Created");
+  char buf[64] = "";
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S %z %Z",
+           std::localtime(&created));
+  dc.created = buf;
+  dc.log_path = GuessLogPathForContainer(state, dc.name);
+  return dc;
+}
 
-  // Only log when editor is first opened
-  if (!state.last_logged_editor_open) {
-    DevLog(state, "RenderPromptEditor: Editor window opened");
-    state.last_logged_editor_open = true;
+// Append one row per tag of an /images/json (or image inspect) entry,
+// mirroring the `docker images` listing
+static void AppendDockerImageRows(const JsonValue &img,
+                                  std::vector<AppState::DockerImage> &out) {
+  std::string id = ShortImageId(img.GetString("Id"));
+  double bytes = img.GetNumber("Size");
+  std::string size = FormatDockerSize(bytes);
+  const JsonValue *tags = img.Find("RepoTags");
+  if (!tags || tags->type != JsonValue::Array || tags->items.empty()) {
+    out.push_back(AppState::DockerImage{"<none>:<none>", id, size, bytes});
+    return;
   }
+  for (const auto &t : tags->items)
+    out.push_back(AppState::DockerImage{t.str, id, size, bytes});
+}
 
-  // Initialize history on first open
-  InitializePromptHistory(state);
+// The listed images grouped by ID, with every tag each is listed under;
+// only the one image when id is given (the listing has it, so the result
+// is never empty then)
+static std::vector<DockerImageRef>
+DockerImageRefs(const std::vector<AppState::DockerImage> &rows,
+                const std::string &id = std::string()) {
+  std::vector<DockerImageRef> refs;
+  for (const auto &row : rows) {
+    if (!id.empty() && row.id != id)
+      continue;
+    auto it = std::find_if(refs.begin(), refs.end(),
+                           [&row](const DockerImageRef &r) {
+                             return r.id == row.id;
+                           });
+    if (it == refs.end())
+      it = refs.insert(refs.end(), DockerImageRef{row.id, {}});
+    if (row.repo_tag != "<none>:<none>")
+      it->tags.push_back(row.repo_tag);
+  }
+  if (refs.empty() && !id.empty())
+    refs.push_back(DockerImageRef{id, {}});
+  return refs;
+}
 
-  ImGui::SetNextWindowSize(ImVec2(900, 700), ImGuiCond_FirstUseEver);
-  ImGuiWindowScope window("Prompt Editor", &state.show_prompt_editor, 0);
-  if (!window) {
-    DevLog(state, "RenderPromptEditor: Window scope returned false");
-    return;
-  }
+// Whether a Manage tab table has to be rebuilt for this snapshot; records
+// what it is about to be built from
+static bool DockerViewStale(AppState::DockerTableView &view,
+                            uint64_t version) {
+  if (view.built_version == version && view.built_sort == view.sort &&
+      view.built_filter == view.filter)
+    return false;
+  view.built_version = version;
+  view.built_sort = view.sort;
+  view.built_filter = view.filter;
+  return true;
+}
 
-  // Header with modification status and controls
-  ImGui::BeginChild("HeaderControls", ImVec2(0, 30), false,
-                    ImGuiWindowFlags_NoScrollbar |
-                        ImGuiWindowFlags_NoBackground);
-  int placeholders_far_right = 150;
-  // Status text on the left
-  ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 10.0f); // Move down 10 pixels
-  if (state.prompts_modified) {
-    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.6f, 0.0f, 1.0f));
-    ImGui::Text("Prompts have been modified");
-    placeholders_far_right = 115;
-    ImGui::PopStyleColor();
-  } else {
-    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.2f, 0.8f, 0.2f, 1.0f));
-    ImGui::Text("Using default prompts");
-    ImGui::PopStyleColor();
-  }
+// Case-insensitive substring match; an empty needle matches everything
+static bool ContainsFolded(const std::string &hay,
+                           const std::string &needle) {
+  return std::search(hay.begin(), hay.end(), needle.begin(), needle.end(),
+                     [](char a, char b) {
+                       return tolower((unsigned char)a) ==
+                              tolower((unsigned char)b);
+                     }) != hay.end();
+}
 
-  // Controls on the right
-  ImGui::SameLine();
-  float available_width = ImGui::GetContentRegionAvail().x;
-  ImGui::SetCursorPosX(
-      available_width -
-      placeholders_far_right); // Position controls on the right
-  ImGui::SetCursorPosY(ImGui::GetCursorPosY() -
-                       5.0f); // Reset Y position for controls
+// Sort orders of the containers table: listing order, name, image, status
+static const char *const kContainerSorts[] = {"Newest First", "Name",
+                                              "Image", "Status"};
+// Sort orders of the images table: listing order, repo:tag, size
+static const char *const kImageSorts[] = {"Listing Order", "Repository",
+                                          "Largest First"};
+
+static void RebuildContainerView(AppState::DockerTableView &view,
+                                 const AppState::DockerSnapshot &snap) {
+  const auto &list = snap.containers;
+  view.rows.clear();
+  for (uint32_t i = 0; i < list.size(); i++) {
+    const auto &c = list[i];
+    if (ContainsFolded(c.name, view.built_filter) ||
+        ContainsFolded(c.image, view.built_filter) ||
+        ContainsFolded(c.status, view.built_filter))
+      view.rows.push_back(i);
+  }
+  auto key = [&](uint32_t i) -> const std::string & {
+    return view.sort == 1   ? list[i].name
+           : view.sort == 2 ? list[i].image
+                            : list[i].status;
+  };
+  if (view.sort > 0)
+    std::stable_sort(view.rows.begin(), view.rows.end(),
+                     [&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+}
 
-  ImGui::Checkbox("Show Diff View", &state.show_diff_view);
+static void RebuildImageView(AppState::DockerTableView &view,
+                             const AppState::DockerSnapshot &snap) {
+  const auto &list = snap.images;
+  view.rows.clear();
+  for (uint32_t i = 0; i < list.size(); i++)
+    if (ContainsFolded(list[i].repo_tag, view.built_filter) ||
+        ContainsFolded(list[i].id, view.built_filter))
+      view.rows.push_back(i);
+  if (view.sort == 1)
+    std::stable_sort(view.rows.begin(), view.rows.end(),
+                     [&](uint32_t a, uint32_t b) {
+                       return list[a].repo_tag < list[b].repo_tag;
+                     });
+  else if (view.sort == 2)
+    std::stable_sort(view.rows.begin(), view.rows.end(),
+                     [&](uint32_t a, uint32_t b) {
+                       return list[a].bytes > list[b].bytes;
+                     });
+}
 
-  // Clear All History button
+// Filter box and sort combo above a Manage tab table, with the count of
+// rows shown
+static void RenderDockerViewControls(const char *id,
+                                     AppState::DockerTableView &view,
+                                     const char *const *sorts, int sort_count,
+                                     size_t total) {
+  ImGui::PushID(id);
+  ImGui::SetNextItemWidth(220.0f);
+  ImGui::InputTextWithHint("##filter", "Filter", view.filter,
+                           sizeof(view.filter));
   ImGui::SameLine();
-  ImGui::SetCursorPosY(ImGui::GetCursorPosY() -
-                       5.0f); // Reset Y position for controls
-  {
-    bool any_history = (state.prompt1_history.history.size() > 1) ||
-                       (state.prompt2_history.history.size() > 1) ||
-                       (state.audit_prompt_history.history.size() > 1);
-    ImGuiDisabledScope disable_clear(!any_history);
-    if (ImGui::Button(ICON_FA_TRASH " Clear All History")) {
-      DevLog(state, "Clear All History button clicked");
-      state.show_confirm_clear_all_history = true;
-    }
-  }
-  if ((state.prompt1_history.history.size() <= 1 &&
-       state.prompt2_history.history.size() <= 1 &&
-       state.audit_prompt_history.history.size() <= 1) &&
-      ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
-    ImGui::SetTooltip("No history to clear");
-  } else if (ImGui::IsItemHovered()) {
-    ImGui::SetTooltip("Clear history for all prompts");
+  ImGui::SetNextItemWidth(140.0f);
+  ImGui::Combo("##sort", &view.sort, sorts, sort_count);
+  if (view.filter[0]) {
+    ImGui::SameLine();
+    ImGui::TextDisabled("%zu of %zu", view.rows.size(), total);
   }
+  ImGui::PopID();
+}
 
-  ImGui::EndChild();
+// Swap in a new listing of the daemon. Caller holds
+// state.docker_state_mutex.
+static void
+PublishDockerStateLocked(AppState &state,
+                         std::vector<AppState::DockerContainer> containers,
+                         std::vector<AppState::DockerImage> images) {
+  auto snap = std::make_shared<AppState::DockerSnapshot>();
+  snap->version = state.docker_snapshot->version + 1;
+  snap->containers = std::move(containers);
+  snap->images = std::move(images);
+  state.docker_snapshot = std::move(snap);
+}
 
-  ImGui::Separator();
+// The listing as last published
+static std::shared_ptr<const AppState::DockerSnapshot>
+DockerStateView(AppState &state) {
+  std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+  return state.docker_snapshot;
+}
 
-  // Tab bar for different prompts
-  ImGuiTabBarScope tab_bar("PromptTabs");
-  if (tab_bar) {
-    // Prompt 1 Tab
-    {
-      ImGuiTabItemScope tab1("Prompt 1 (Feedback)");
-      if (tab1) {
-        if (state.last_logged_prompt_tab != 0) {
-          DevLog(state, "RenderPromptEditor: Switched to Prompt 1 tab");
-          state.last_logged_prompt_tab = 0;
-        }
-        state.selected_prompt_tab = 0;
-
-        if (state.show_diff_view) {
-          ImGui::Text("Diff View:");
-          ImGui::Separator();
-          RenderDiffView(state, state.prompt1_original, state.prompt1_modified,
-                         0);
-
-          // Resizable splitter between diff view and editor
-          float editor_height = ImGui::GetContentRegionAvail().y - 50;
-          Splitter("DiffEditorSplitter1", &state.diff_editor_splitter_height,
-                   &editor_height, 100.0f, 100.0f);
-        }
-
-        ImGui::Text("Editor:");
-
-        // Calculate available height for editor (leave space for buttons)
-        float available_height = state.show_diff_view
-                                     ? ImGui::GetContentRegionAvail().y - 50
-                                     : ImGui::GetContentRegionAvail().y - 50;
-        ImGui::BeginChild("Prompt1Editor", ImVec2(0, available_height), true);
-
-        char buffer[8192];
-        strncpy(buffer, state.prompt1_modified.c_str(), sizeof(buffer) - 1);
-        buffer[sizeof(buffer) - 1] = '\0';
-
-        if (ImGui::InputTextMultiline("##Prompt1", buffer, sizeof(buffer),
-                                      ImVec2(-1, -1),
-                                      ImGuiInputTextFlags_AllowTabInput)) {
-          state.prompt1_modified = buffer;
-          state.prompts_modified =
-              (state.prompt1_modified != state.prompt1_original) ||
-              (state.prompt2_modified != state.prompt2_original) ||
-              (state.audit_prompt_modified != state.audit_prompt_original);
-        }
-
-        // Push to history when user finishes editing (clicks away, etc.)
-        if (ImGui::IsItemDeactivatedAfterEdit() &&
-            !state.skip_next_history_push) {
-          PushToHistory(state.prompt1_history, state.prompt1_modified);
-          DevLog(state, "Pushed Prompt1 edit to history");
-        }
-        if (state.skip_next_history_push) {
-          state.skip_next_history_push = false; // Reset flag
-        }
-
-        ImGui::EndChild();
-      }
-    }
+// Fetch containers and images over the Engine API socket: three requests on
+// one connection instead of three CLI processes. Returns false when the
+// socket is unreachable so the caller can fall back to the CLI.
+static bool RefreshDockerStateApi(AppState &state) {
+  int status = 0;
+  JsonValue body;
+  if (!DockerApiCall("GET", "/_ping", status, body))
+    return false;
+  std::vector<AppState::DockerContainer> temp_containers;
+  std::vector<AppState::DockerImage> temp_images;
+  bool ok = status == 200;
+
+  if (ok) {
+    ok = DockerApiCall("GET", "/containers/json?all=1", status, body) &&
+         status == 200 && body.type == JsonValue::Array;
+  }
+  if (ok) {
+    for (const auto &c : body.items)
+      temp_containers.push_back(DockerContainerFromApi(state, c));
+    ok = DockerApiCall("GET", "/images/json", status, body) &&
+         status == 200 && body.type == JsonValue::Array;
+  }
+  if (ok) {
+    for (const auto &img : body.items)
+      AppendDockerImageRows(img, temp_images);
+  }
+
+  std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+  if (ok)
+    PublishDockerStateLocked(state, std::move(temp_containers),
+                             std::move(temp_images));
+  else
+    PublishDockerStateLocked(state, {}, {});
+  state.docker_unavailable = !ok;
+  state.docker_loaded = true;
+  return true;
+}
 
-    // Prompt 2 Tab
-    {
-      ImGuiTabItemScope tab2("Prompt 2 (Feedback Follow-up)");
-      if (tab2) {
-        if (state.last_logged_prompt_tab != 1) {
-          DevLog(state, "RenderPromptEditor: Switched to Prompt 2 tab");
-          DevLog(state, "  -> Prompt2 length=" +
-                            std::to_string(state.prompt2_modified.length()));
-          state.last_logged_prompt_tab = 1;
-        }
-        state.selected_prompt_tab = 1;
+static void RefreshDockerState(AppState &state) {
+  TRACE_ZONE("RefreshDockerState");
+  if (!DockerDaemonHealth().Available()) {
+    std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+    PublishDockerStateLocked(state, {}, {});
+    state.docker_unavailable = true;
+    state.docker_loaded = true;
+    return;
+  }
+  if (RefreshDockerStateApi(state))
+    return;
 
-        if (state.show_diff_view) {
-          ImGui::Text("Diff View:");
-          ImGui::Separator();
-          RenderDiffView(state, state.prompt2_original, state.prompt2_modified,
-                         1);
+  // Build temporary containers/images WITHOUT holding the lock
+  // This prevents UI freezing while Docker commands run
+  std::vector<AppState::DockerContainer> temp_containers;
+  std::vector<AppState::DockerImage> temp_images;
 
-          // Resizable splitter between diff view and editor
-          float editor_height = ImGui::GetContentRegionAvail().y - 50;
-          Splitter("DiffEditorSplitter2", &state.diff_editor_splitter_height,
-                   &editor_height, 100.0f, 100.0f);
+  // Get containers list (slow operation, no lock held)
+  auto cl = RunShellLines(
+      "docker ps -a --format "
+      "'{{.ID}}\t{{.Names}}\t{{.Image}}\t{{.Status}}\t{{.CreatedAt}}'");
+  for (const auto &ln : cl) {
+    if (ln.empty())
+      continue;
+    // Skip error lines
+    if (ln.find("error during connect") != std::string::npos ||
+        ln.find("Cannot connect") != std::string::npos)
+      continue;
+    std::stringstream ss(ln);
+    std::string id, name, image, status, created;
+    std::getline(ss, id, '\t');
+    std::getline(ss, name, '\t');
+    std::getline(ss, image, '\t');
+    std::getline(ss, status, '\t');
+    std::getline(ss, created, '\t');
+    AppState::DockerContainer dc;
+    dc.id = id;
+    dc.name = name;
+    dc.image = image;
+    dc.status = status;
+    dc.created = created;
+    dc.log_path = GuessLogPathForContainer(state, name);
+    temp_containers.push_back(dc);
+  }
 
-          ImGui::Separator();
-        }
+  // Get images list (slow operation, no lock held)
+  auto il = RunShellLines(
+      "docker images --format '{{.Repository}}:{{.Tag}}\t{{.ID}}\t{{.Size}}'");
+  for (const auto &ln : il) {
+    if (ln.empty())
+      continue;
+    // Skip error lines
+    if (ln.find("error during connect") != std::string::npos ||
+        ln.find("Cannot connect") != std::string::npos)
+      continue;
+    std::stringstream ss(ln);
+    std::string repo, id, size;
+    std::getline(ss, repo, '\t');
+    std::getline(ss, id, '\t');
+    std::getline(ss, size, '\t');
+    temp_images.push_back(
+        AppState::DockerImage{repo, id, size, ParseDockerSize(size)});
+  }
 
-        ImGui::Text("Editor:");
+  // Now update the state with a very brief lock
+  {
+    std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+    PublishDockerStateLocked(state, std::move(temp_containers),
+                             std::move(temp_images));
+    state.docker_unavailable = false;
+    state.docker_loaded = true;
+  }
+}
 
-        // Calculate available height for editor (leave space for buttons)
-        float available_height = state.show_diff_view
-                                     ? ImGui::GetContentRegionAvail().y - 50
-                                     : ImGui::GetContentRegionAvail().y - 50;
-        ImGui::BeginChild("Prompt2Editor", ImVec2(0, available_height), true);
+// Refresh Docker state on the job pool's I/O lane
+static void RefreshDockerStateAsync(AppState &state) {
+  // If already refreshing, don't start another refresh
+  if (state.docker_refreshing.exchange(true))
+    return;
+  g_jobs.Submit(JobLane::Io, JobPriority::Interactive,
+                [&state](const CancelToken &) {
+                  TRACE_ZONE("Docker refresh");
+                  RefreshDockerState(state);
+                  state.docker_refreshing.store(false);
+                  WakeMainLoop();
+                });
+}
 
-        char buffer[8192];
-        strncpy(buffer, state.prompt2_modified.c_str(), sizeof(buffer) - 1);
-        buffer[sizeof(buffer) - 1] = '\0';
+// Seconds each /events request stays open. Requests are chained with
+// since= so no event is lost between them; the window only bounds how long
+// shutdown waits for the watcher.
+static const int kDockerEventsWindow = 2;
+
+// Re-read one container after an event and publish the listing with it
+// patched in; a container the daemon no longer knows about is dropped
+static void ApplyContainerEvent(AppState &state, const std::string &id) {
+  std::string filters = "{\"id\":[\"" + id + "\"]}";
+  int status = 0;
+  JsonValue body;
+  if (!DockerApiCall("GET",
+                     "/containers/json?all=1&filters=" + UrlEncode(filters),
+                     status, body) ||
+      status != 200 || body.type != JsonValue::Array)
+    return;
+  std::vector<AppState::DockerContainer> fresh;
+  for (const auto &c : body.items)
+    fresh.push_back(DockerContainerFromApi(state, c));
+
+  std::string short_id = id.substr(0, 12);
+  std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+  std::vector<AppState::DockerContainer> list =
+      state.docker_snapshot->containers;
+  auto it = std::find_if(list.begin(), list.end(),
+                         [&](const AppState::DockerContainer &c) {
+                           return c.id == short_id;
+                         });
+  if (fresh.empty()) {
+    if (it == list.end())
+      return;
+    list.erase(it);
+  } else if (it != list.end()) {
+    *it = fresh[0];
+  } else {
+    // The CLI lists newest first
+    list.insert(list.begin(), fresh[0]);
+  }
+  PublishDockerStateLocked(state, std::move(list),
+                           state.docker_snapshot->images);
+}
 
-        if (ImGui::InputTextMultiline("##Prompt2", buffer, sizeof(buffer),
-                                      ImVec2(-1, -1),
-                                      ImGuiInputTextFlags_AllowTabInput)) {
-          DevLog(state, "RenderPromptEditor: Prompt2 modified by user");
-          state.prompt2_modified = buffer;
-          state.prompts_modified =
-              (state.prompt1_modified != state.prompt1_original) ||
-              (state.prompt2_modified != state.prompt2_original) ||
-              (state.audit_prompt_modified != state.audit_prompt_original);
-        }
+// Re-inspect one image (by ID or reference) and publish the listing with
+// its rows replaced; the rows go away once the image has been deleted
+static void ApplyImageEvent(AppState &state, const std::string &ref) {
+  int status = 0;
+  JsonValue body;
+  if (!DockerApiCall("GET", "/images/" + UrlEncode(ref, true) + "/json",
+                     status, body) ||
+      (status != 200 && status != 404))
+    return;
+  std::vector<AppState::DockerImage> rows;
+  std::string id = ShortImageId(ref);
+  if (status == 200) {
+    AppendDockerImageRows(body, rows);
+    id = ShortImageId(body.GetString("Id"));
+  }
+
+  std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+  std::vector<AppState::DockerImage> list = state.docker_snapshot->images;
+  auto first = std::find_if(
+      list.begin(), list.end(),
+      [&](const AppState::DockerImage &i) { return i.id == id; });
+  size_t at = first - list.begin();
+  list.erase(std::remove_if(list.begin(), list.end(),
+                            [&](const AppState::DockerImage &i) {
+                              return i.id == id || i.repo_tag == ref;
+                            }),
+             list.end());
+  at = std::min(at, list.size());
+  list.insert(list.begin() + at, rows.begin(), rows.end());
+  PublishDockerStateLocked(state, state.docker_snapshot->containers,
+                           std::move(list));
+}
 
-        // Push to history when user finishes editing
-        if (ImGui::IsItemDeactivatedAfterEdit() &&
-            !state.skip_next_history_push) {
-          PushToHistory(state.prompt2_history, state.prompt2_modified);
-          DevLog(state, "Pushed Prompt2 edit to history");
-        }
-        if (state.skip_next_history_push) {
-          state.skip_next_history_push = false; // Reset flag
-        }
+// A local run's container dying under it (its main process gone, killed,
+// or out of memory) ends the run at once. Otherwise the script notices only
+// when its next docker exec fails, or hangs in the one it is in, and keeps
+// its concurrency slot all that time. The open phase of the run's timeline
+// is closed as failed and the run goes through the same stop and teardown
+// as Stop, but is counted as failed (see LaunchTaskProcess).
+static void ApplyTaskContainerEvent(AppState &state, const std::string &action,
+                                    const std::string &id,
+                                    const JsonValue *attributes) {
+  std::string detail = attributes ? attributes->GetString(
+                                        action == "kill" ? "signal"
+                                                         : "exitCode")
+                                  : std::string();
+  std::string reason;
+  int exit_code = 137;
+  if (action == "die") {
+    reason = detail.empty() ? "exited" : "exited with code " + detail;
+    if (!detail.empty() && atoi(detail.c_str()) != 0)
+      exit_code = atoi(detail.c_str());
+  } else if (action == "oom") {
+    reason = "ran out of memory";
+  } else if (action == "kill") {
+    reason = detail.empty() ? "was killed" : "was killed (signal " + detail +
+                                                 ")";
+  } else {
+    return;
+  }
 
-        ImGui::EndChild();
-      }
+  std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+  bool any = false;
+  for (auto &task : state.tasks) {
+    // Runs on other endpoints are not on this daemon's stream, and runs
+    // being stopped go on to lose their container anyway
+    if (!task->is_running || task->teardown != TeardownStage::None ||
+        task->container_lost || !task->worker.empty())
+      continue;
+    {
+      std::lock_guard<std::mutex> tl(task->resources_mutex);
+      const std::string &own = task->container_id;
+      size_t n = std::min(own.size(), id.size());
+      if (n < 12 || own.compare(0, n, id, 0, n) != 0)
+        continue;
+      task->container_lost_reason = reason;
     }
-
-    // Audit Prompt Tab
     {
-      ImGuiTabItemScope tab3("Audit Prompt");
-      if (tab3) {
-        if (state.last_logged_prompt_tab != 2) {
-          DevLog(state, "RenderPromptEditor: Switched to Audit Prompt tab");
-          state.last_logged_prompt_tab = 2;
+      std::lock_guard<std::mutex> tl(task->timeline_mutex);
+      for (auto it = task->timeline.rbegin(); it != task->timeline.rend();
+           ++it) {
+        if (it->end_ms == 0) {
+          it->end_ms = std::max(EpochMs(), it->start_ms);
+          it->exit_code = exit_code;
+          break;
         }
-        state.selected_prompt_tab = 2;
-
-        if (state.show_diff_view) {
-          ImGui::Text("Diff View:");
-          ImGui::Separator();
-          RenderDiffView(state, state.audit_prompt_original,
-                         state.audit_prompt_modified, 2);
+      }
+    }
+    task->container_lost = true;
+    any = true;
+    if (g_show_debug_console)
+      ConsoleLog("[ERROR] Container of " + task->name + " " + reason +
+                 "; ending the run");
+  }
+  if (any)
+    StopTasksLocked(state, [](const TaskInstance &t) {
+      return t.container_lost.load();
+    });
+}
 
-          // Resizable splitter between diff view and editor
-          float editor_height = ImGui::GetContentRegionAvail().y - 50;
-          Splitter("DiffEditorSplitter3", &state.diff_editor_splitter_height,
-                   &editor_height, 100.0f, 100.0f);
+static void ApplyDockerEvent(AppState &state, const JsonValue &ev) {
+  std::string type = ev.GetString("Type");
+  std::string action = ev.GetString("Action");
+  const JsonValue *actor = ev.Find("Actor");
+  if (type == "container" && actor)
+    ApplyTaskContainerEvent(state, action, actor->GetString("ID"),
+                            actor->Find("Attributes"));
+  {
+    // Until the Manage tab has loaded a full listing there is nothing to
+    // patch; the first refresh picks everything up
+    std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+    if (!state.docker_loaded || state.docker_unavailable)
+      return;
+  }
+  std::string id;
+  if (actor)
+    id = actor->GetString("ID");
+  if (id.empty())
+    id = ev.GetString("id");
+  if (id.empty())
+    return;
+  if (type == "container" && action.rfind("exec_", 0) != 0)
+    ApplyContainerEvent(state, id);
+  else if (type == "image")
+    ApplyImageEvent(state, id);
+}
 
-          ImGui::Separator();
-        }
+// Watch the daemon's event stream and keep the Manage tab's lists current.
+// While the stream is live, actions in the tab skip their full refresh.
+static void DockerEventsLoop(AppState &state) {
+  TRACE_THREAD("Docker events");
+  HeapThread("Docker events", kHeapDocker);
+  DockerApiClient conn;
+  long long since = (long long)time(nullptr);
+  bool was_live = false;
+  std::string pending;
+  const std::string filters =
+      UrlEncode("{\"type\":[\"container\",\"image\"]}");
+  while (!state.docker_events_stop.load()) {
+    long long until = (long long)time(nullptr) + kDockerEventsWindow;
+    DockerApiClient::Response resp;
+    bool ok = conn.Request(
+        "GET",
+        "/events?since=" + std::to_string(since) +
+            "&until=" + std::to_string(until) + "&filters=" + filters,
+        resp, [&](const char *data, size_t n) {
+          pending.append(data, n);
+          size_t eol;
+          while ((eol = pending.find('\n')) != std::string::npos) {
+            JsonValue ev;
+            if (JsonParser(std::string_view(pending.data(), eol)).Parse(ev))
+              ApplyDockerEvent(state, ev);
+            pending.erase(0, eol + 1);
+          }
+        });
+    pending.clear();
+    bool live = ok && resp.status == 200;
+    if (live && !was_live)
+      DockerDaemonHealth().ReportUp(); // back before the backoff ran out
+    else if (!ok && was_live)
+      DockerDaemonHealth().ReportFailure();
+    if (live) {
+      // Events stamped with the boundary second may be seen twice; applying
+      // one again is harmless
+      since = until;
+    }
+    if (live && !was_live && state.docker_loaded) {
+      // Changes made while the stream was down were never seen
+      RefreshDockerStateApi(state);
+    }
+    was_live = live;
+    state.docker_events_live = live;
+    if (!live) {
+      since = (long long)time(nullptr);
+      for (int i = 0; i < 5 && !state.docker_events_stop.load(); ++i)
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+  }
+  state.docker_events_live = false;
+}
 
-        ImGui::Text("Editor:");
+static void StartDockerEvents(AppState &state) {
+  state.docker_events_stop = false;
+  state.docker_events_thread =
+      std::thread([&state]() { DockerEventsLoop(state); });
+}
 
-        // Calculate available height for editor (leave space for buttons)
-        float available_height = state.show_diff_view
-                                     ? ImGui::GetContentRegionAvail().y - 50
-                                     : ImGui::GetContentRegionAvail().y - 50;
-        ImGui::BeginChild("AuditPromptEditor", ImVec2(0, available_height),
-                          true);
+static void StopDockerEvents(AppState &state) {
+  state.docker_events_stop = true;
+  if (state.docker_events_thread.joinable())
+    state.docker_events_thread.join();
+}
 
-        char buffer[8192];
-        strncpy(buffer, state.audit_prompt_modified.c_str(),
-                sizeof(buffer) - 1);
-        buffer[sizeof(buffer) - 1] = '\0';
+// Called after an action in the Manage tab changed containers or images.
+// With the event stream live the change arrives on its own.
+static void RequestDockerRefresh(AppState &state) {
+  if (state.docker_events_live.load())
+    return;
+  RefreshDockerStateAsync(state);
+}
 
-        if (ImGui::InputTextMultiline("##AuditPrompt", buffer, sizeof(buffer),
-                                      ImVec2(-1, -1),
-                                      ImGuiInputTextFlags_AllowTabInput)) {
-          state.audit_prompt_modified = buffer;
-          state.prompts_modified =
-              (state.prompt1_modified != state.prompt1_original) ||
-              (state.prompt2_modified != state.prompt2_original) ||
-              (state.audit_prompt_modified != state.audit_prompt_original);
-        }
+// Publish the listing without a container that has been removed (matched
+// by name or short ID). Any thread.
+static void DropContainerFromDockerState(AppState &state,
+                                         const std::string &container) {
+  std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+  std::vector<AppState::DockerContainer> list =
+      state.docker_snapshot->containers;
+  auto end = std::remove_if(list.begin(), list.end(),
+                            [&](const AppState::DockerContainer &c) {
+                              return c.name == container || c.id == container;
+                            });
+  if (end == list.end())
+    return;
+  list.erase(end, list.end());
+  PublishDockerStateLocked(state, std::move(list),
+                           state.docker_snapshot->images);
+}
 
-        // Push to history when user finishes editing
-        if (ImGui::IsItemDeactivatedAfterEdit() &&
-            !state.skip_next_history_push) {
-          PushToHistory(state.audit_prompt_history,
-                        state.audit_prompt_modified);
-          DevLog(state, "Pushed Audit Prompt edit to history");
-        }
-        if (state.skip_next_history_push) {
-          state.skip_next_history_push = false; // Reset flag
-        }
+// Publish the listing without the rows of a deleted image. Any thread.
+static void DropImageFromDockerState(AppState &state, const std::string &id) {
+  std::lock_guard<TracedMutex> lock(state.docker_state_mutex);
+  std::vector<AppState::DockerImage> list = state.docker_snapshot->images;
+  auto end = std::remove_if(
+      list.begin(), list.end(),
+      [&](const AppState::DockerImage &i) { return i.id == id; });
+  if (end == list.end())
+    return;
+  list.erase(end, list.end());
+  PublishDockerStateLocked(state, state.docker_snapshot->containers,
+                           std::move(list));
+}
 
-        ImGui::EndChild();
-      }
-    }
-  }
+static DockerBulkOps g_docker_bulk{g_jobs};
+
+// Hooks of a Manage tab operation: every item removed leaves the published
+// listing at once, and failures land in the tab's error window
+static DockerBulkOps::Hooks DockerBulkHooks(AppState &state) {
+  AppState *st = &state;
+  DockerBulkOps::Hooks hooks;
+  hooks.finished = [st](const DockerBulkOps::Op &op,
+                        const std::string &errors) {
+    if (op.progress->done > op.progress->failed)
+      RequestDockerRefresh(*st);
+    if (errors.empty())
+      return;
+    if (op.kind == DockerBulkOps::Kind::Containers)
+      st->container_remove_error = errors;
+    else if (op.total > 1)
+      st->image_delete_error = "Bulk deletion errors:\n\n" + errors;
+    else
+      st->image_delete_error = errors;
+  };
+  return hooks;
+}
 
-  // Bottom buttons
-  ImGui::Separator();
+// Force-remove containers (names or IDs) with their anonymous volumes
+static void RemoveDockerContainers(AppState &state,
+                                   std::vector<std::string> names) {
+  DockerBulkOps::Hooks hooks = DockerBulkHooks(state);
+  AppState *st = &state;
+  hooks.removed = [st](const std::string &container) {
+    DropContainerFromDockerState(*st, container);
+  };
+  g_docker_bulk.RemoveContainers(std::move(names), std::move(hooks));
+}
 
-  // Validation check for all prompts
-  bool prompt1_valid = IsPromptValid(state.prompt1_modified);
-  bool prompt2_valid = IsPromptValid(state.prompt2_modified);
-  bool audit_valid = IsPromptValid(state.audit_prompt_modified);
-  bool all_valid = prompt1_valid && prompt2_valid && audit_valid;
+// Delete images, leaving alone those containers still use
+static void DeleteDockerImages(AppState &state,
+                               std::vector<DockerImageRef> images) {
+  DockerBulkOps::Hooks hooks = DockerBulkHooks(state);
+  AppState *st = &state;
+  hooks.removed = [st](const std::string &id) {
+    DropImageFromDockerState(*st, id);
+  };
+  g_docker_bulk.DeleteImages(std::move(images), std::move(hooks));
+}
 
-  // Show validation warnings if any prompt is invalid
-  if (!all_valid) {
-    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.3f, 0.3f, 1.0f));
-    ImGui::Text("Warning: ");
+// Progress of the Manage tab's running operations of one kind, each with a
+// Cancel button
+static void RenderDockerBulkOps(DockerBulkOps::Kind kind) {
+  for (const auto &op : g_docker_bulk.ops()) {
+    if (op.kind != kind)
+      continue;
+    ImGui::PushID((int)op.id);
+    const DockerBulkOps::Progress &p = *op.progress;
+    size_t done = p.done, failed = p.failed;
+    char overlay[96];
+    snprintf(overlay, sizeof(overlay), "%s %zu of %zu%s",
+             kind == DockerBulkOps::Kind::Images ? "Deleting image"
+                                                 : "Removing container",
+             std::min(done + 1, op.total), op.total,
+             p.cancelled ? " (stopping)" : "");
+    ImGui::ProgressBar(op.total ? (float)done / (float)op.total : 0.0f,
+                       ImVec2(-90.0f, 0), overlay);
     ImGui::SameLine();
-    ImGui::PopStyleColor();
-
-    if (!prompt1_valid)
-      ImGui::Text("Prompt 1 is empty or contains only whitespace. ");
-    if (!prompt2_valid) {
-      ImGui::SameLine();
-      ImGui::Text("Prompt 2 is empty or contains only whitespace. ");
-    }
-    if (!audit_valid) {
-      ImGui::SameLine();
-      ImGui::Text("Audit Prompt is empty or contains only whitespace. ");
+    {
+      ImGuiDisabledScope _stopping(p.cancelled);
+      if (ImGui::SmallButton("Cancel"))
+        g_docker_bulk.Cancel(op.id);
     }
-    ImGui::Spacing();
+    if (failed > 0)
+      ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.4f, 1.0f), "%zu failed so far",
+                         failed);
+    ImGui::PopID();
   }
+}
 
-  if (ImGui::Button("Reset to Default", ImVec2(150, 0))) {
-    DevLog(state, "RenderPromptEditor: Reset to Default clicked, tab=" +
-                      std::to_string(state.selected_prompt_tab));
-    if (state.selected_prompt_tab == 0) {
-      PushToHistory(state.prompt1_history, state.prompt1_modified);
-      state.prompt1_modified = state.prompt1_original;
-      PushToHistory(state.prompt1_history, state.prompt1_modified);
-    } else if (state.selected_prompt_tab == 1) {
-      PushToHistory(state.prompt2_history, state.prompt2_modified);
-      state.prompt2_modified = state.prompt2_original;
-      PushToHistory(state.prompt2_history, state.prompt2_modified);
-    } else if (state.selected_prompt_tab == 2) {
-      PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
-      state.audit_prompt_modified = state.audit_prompt_original;
-      PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+static DockerDiskAnalysis g_disk_analysis{g_jobs, g_image_layers,
+                                           WakeMainLoop};
+
+// Disk usage section of the Manage tab: totals, then one row per image
+// repository
+static void RenderDockerDiskUsage() {
+  ImGui::TextColored(ImVec4(0.6f, 0.8f, 1.0f, 1.0f), "Disk Usage");
+  ImGui::SameLine();
+  bool busy = g_disk_analysis.Busy();
+  {
+    ImGuiDisabledScope _busy(busy);
+    if (ImGui::Button(busy ? "Analyzing..." : "Analyze"))
+      g_disk_analysis.Start();
+  }
+  ImGui::SameLine();
+  ImGui::TextDisabled("(?)");
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip(
+        "Reads docker system df and the layers of every image.\nA layer "
+        "several images share is counted once, and \"freed\" is what\n"
+        "deleting those images would give back; the Docker GC counts the "
+        "same way.");
+  }
+  std::shared_ptr<const DockerDiskReport> report = g_disk_analysis.Report();
+  if (!report)
+    return;
+  ImGui::SameLine();
+  char when[32] = "";
+  strftime(when, sizeof(when), "%H:%M", std::localtime(&report->taken));
+  ImGui::TextDisabled("as of %s", when);
+  if (!report->error.empty()) {
+    ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.4f, 1.0f), "%s",
+                       report->error.c_str());
+    return;
+  }
+  ImGui::Text("Images: %s in layers, %s of it shared; %s reclaimable from "
+              "images no container uses",
+              FormatDockerSize(report->layer_bytes).c_str(),
+              FormatDockerSize(report->shared_bytes).c_str(),
+              FormatDockerSize(report->unused_image_bytes).c_str());
+  ImGui::Text("Containers: %s in writable layers, %s of it in stopped ones",
+              FormatDockerSize(report->container_bytes).c_str(),
+              FormatDockerSize(report->stopped_container_bytes).c_str());
+  ImGui::Text("Build cache: %s, %s reclaimable",
+              FormatDockerSize(report->cache_bytes).c_str(),
+              FormatDockerSize(report->cache_reclaimable).c_str());
+  if (report->repositories.empty())
+    return;
+  if (ImGui::BeginTable("##disk_repositories", 5,
+                        ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY |
+                            ImGuiTableFlags_BordersInnerV,
+                        ImVec2(0, 160))) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Repository");
+    ImGui::TableSetupColumn("Images");
+    ImGui::TableSetupColumn("Freed if deleted");
+    ImGui::TableSetupColumn("Shared");
+    ImGui::TableSetupColumn("Built on");
+    ImGui::TableHeadersRow();
+    ImGuiListClipper clipper;
+    clipper.Begin((int)report->repositories.size());
+    while (clipper.Step()) {
+      for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+        const DockerDiskReport::Repository &repo = report->repositories[r];
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(repo.name.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", repo.images);
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatDockerSize(repo.freed_bytes).c_str());
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatDockerSize(repo.shared_bytes).c_str());
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(repo.lineage.c_str());
+      }
     }
-    state.prompts_modified =
-        (state.prompt1_modified != state.prompt1_original) ||
-        (state.prompt2_modified != state.prompt2_original) ||
-        (state.audit_prompt_modified != state.audit_prompt_original);
-    SavePrompts(state);
+    ImGui::EndTable();
   }
+}
 
-  ImGui::SameLine();
-  if (ImGui::Button("Reset All to Default", ImVec2(150, 0))) {
-    DevLog(state, "RenderPromptEditor: Reset All to Default clicked");
-    PushToHistory(state.prompt1_history, state.prompt1_modified);
-    PushToHistory(state.prompt2_history, state.prompt2_modified);
-    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+static void OpenFolderExternal(const std::string &path) {
+#ifdef _WIN32
+  std::string p = path;
+  for (char &c : p)
+    if (c == '/')
+      c = '\\';
+  std::string cmd = std::string("explorer \"") + p + "\"";
+  std::vector<std::string> lines;
+#ifdef _WIN32
+  DWORD code = 0;
+#else
+  int code = 0;
+#endif
+  RunHiddenCapture(cmd, lines, code);
+#else
+  std::string cmd = std::string("xdg-open \"") + path + "\"";
+  std::vector<std::string> lines;
+  int code = 0;
+  RunHiddenCapture(cmd, lines, code);
+#endif
+}
 
-    state.prompt1_modified = state.prompt1_original;
-    state.prompt2_modified = state.prompt2_original;
-    state.audit_prompt_modified = state.audit_prompt_original;
+// Append the --prompt1-file, --prompt2-file and --audit-prompt-file
+// arguments of a run in mode: the prompts held here (Prompt 1 and Prompt 2
+// from variant, if given) composed into files under prompts.d/composed,
+// named by content hash, so the script need not read them back from
+// prompts.json. A prompt left empty, or a task prompt the script picks
+// itself, is still composed by the script.
+static void AppendPromptFileArgs(const AppState &state, int mode,
+                                 const std::string &task_dir,
+                                 const PromptVariant *variant,
+                                 std::string &args) {
+  if (mode == 1 || mode == 4)
+    return; // verify and build send no prompt
+  static const std::string prompts_path = GetPromptsFilePath();
+  static const std::string dir =
+      prompts_path.substr(0, prompts_path.size() - 5) + ".d/composed";
+  static const bool dir_ok = CreateDirectoryRecursive(dir);
+  if (!dir_ok)
+    return;
+  auto add = [&](const char *flag, const char *name, const std::string &text) {
+    std::string path = CachePromptFile(dir, name, text);
+    if (path.empty())
+      return;
+#ifdef _WIN32
+    args += std::string(" ") + flag + " \\\"" + ConvertToUnixPath(path) +
+            "\\\"";
+#else
+    args += std::string(" ") + flag + " '" + path + "'";
+#endif
+  };
+  if (mode == 3) {
+    if (!state.audit_prompt_modified.empty())
+      add("--audit-prompt-file", "audit_prompt",
+          ComposePromptText(state.audit_prompt_modified));
+    return;
+  }
+  const std::string &text1 =
+      variant ? variant->prompt1 : state.prompt1_modified;
+  const std::string &text2 =
+      variant ? variant->prompt2 : state.prompt2_modified;
+  std::string task_prompt = TaskPromptFile(task_dir), prompt1;
+  if (!text1.empty() && !task_prompt.empty() &&
+      ComposePrompt1Text(text1, task_prompt, prompt1))
+    add("--prompt1-file", "prompt1", prompt1);
+  if (!text2.empty())
+    add("--prompt2-file", "prompt2", ComposePromptText(text2));
+}
 
-    PushToHistory(state.prompt1_history, state.prompt1_modified);
-    PushToHistory(state.prompt2_history, state.prompt2_modified);
-    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+std::string BuildCommand(const AppState &state,
+                         const std::string &unique_suffix,
+                         int selected_mode_override,
+                         const std::string &stage_gate_dir,
+                         const std::string &shared_image_suffix,
+                         const TaskValidation *task,
+                         const std::string &resume_dir,
+                         const PromptVariant *prompts, int fan_out) {
+  std::string cmd;
+  const TaskValidation &validation = task ? *task : state.validation;
+  const std::string &task_directory =
+      task ? task->task_dir : state.task_directory;
 
-    state.prompts_modified = false;
-    SavePrompts(state);
+  // Convert paths to Unix format on Windows
+#ifdef _WIN32
+  std::string task_dir_unix =
+      task_directory.empty() ? "" : ConvertToUnixPath(task_directory);
+  std::string workdir_unix =
+      state.workdir.empty() ? "" : ConvertToUnixPath(state.workdir);
+  std::string output_dir_unix =
+      state.output_dir.empty() ? "" : ConvertToUnixPath(state.output_dir);
+  // Under WSL a task folder on a Windows drive is reached through 9P, which
+  // makes every docker build context and workspace copy slow; mirrored, the
+  // run works from a copy on the distro's filesystem, brought up to date
+  // with rsync before each run
+  const ExecBackend backend = CurrentExecBackend();
+  std::string task_mirror_source;
+  if (backend.wsl && state.wsl_mirror_tasks &&
+      task_dir_unix.compare(0, 5, "/mnt/") == 0) {
+    std::string base = task_dir_unix;
+    while (base.size() > 1 && base.back() == '/')
+      base.pop_back();
+    base = base.substr(base.find_last_of('/') + 1);
+    // Folders of the same name elsewhere get mirrors of their own
+    char key[24];
+    snprintf(key, sizeof(key), "%016llx",
+             (unsigned long long)Fnv1a(kFnvOffset, task_dir_unix.data(),
+                                       task_dir_unix.size()));
+    task_mirror_source = task_dir_unix;
+    task_dir_unix = std::string("$HOME/.autobuild/tasks/") + key + "/" + base;
   }
+#else
+  const std::string &task_dir_unix = task_directory;
+  const std::string &workdir_unix = state.workdir;
+  const std::string &output_dir_unix = state.output_dir;
+#endif
 
-  ImGui::SameLine();
+  // Use bash from MSYS2 or Git Bash if available, with proper PATH
+#ifdef _WIN32
+  std::string bash = backend.wsl ? FindWsl() : FindBash();
+  if (bash.empty())
+    return backend.wsl
+               ? "cmd.exe /C echo ERROR: wsl.exe not found. Install WSL2 or "
+                 "turn off Run in WSL."
+               : "cmd.exe /C echo ERROR: Bash not found. Install Git for "
+                 "Windows or MSYS2.";
+#else
+  cmd = "bash autobuild/scripts/autobuild.sh";
+#endif
 
-  // Disable Save button if any prompt is invalid
-  ImGuiDisabledScope disable_save(!all_valid);
-  if (ImGui::Button("Save", ImVec2(100, 0))) {
-    DevLog(state, "RenderPromptEditor: Save clicked");
-    PushToHistory(state.prompt1_history, state.prompt1_modified);
-    PushToHistory(state.prompt2_history, state.prompt2_modified);
-    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
-    SavePrompts(state);
+  cmd += " ";
+
+  // Build CLI args once
+  std::string args;
+  int _mode = (selected_mode_override >= 0) ? selected_mode_override
+                                            : state.selected_mode;
+  switch (_mode) {
+  case 0:
+    args += "feedback";
+    break;
+  case 1:
+    args += "verify";
+    break;
+  case 2:
+    args += "both";
+    // Feedback and verify at the same time, from one image build
+    if (state.parallel_both)
+      args += " --parallel";
+    break;
+  case 3:
+    args += "audit";
+    break;
+  case 4:
+    args += "build"; // the image alone, for the build farm
+    break;
   }
+  // A build needs no API key; keep it out of the build's command line
+  const bool send_key = _mode != 4 && !state.api_key.empty();
+#ifdef _WIN32
+  // Windows cmd.exe style: use backslash-escaped double quotes
+  if (!task_dir_unix.empty())
+    args += " --task \\\"" + task_dir_unix + "\\\"";
+  if (send_key)
+    args += " --api-key \\\"" + state.api_key + "\\\"";
+#else
+  // Unix shell style: use single quotes for paths/values with spaces
+  if (!task_dir_unix.empty())
+    args += " --task '" + task_dir_unix + "'";
+  if (send_key)
+    args += " --api-key '" + state.api_key + "'";
+#endif
 
-  if (!all_valid && ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
-    ImGui::SetTooltip("Cannot save: One or more prompts are empty");
+  // NEW: Add --no-cache flag if enabled
+  if (state.use_docker_no_cache) {
+    args += " --no-cache";
   }
 
-  ImGui::SameLine();
-  if (ImGui::Button("Close", ImVec2(100, 0))) {
-    DevLog(state, "RenderPromptEditor: Close clicked");
-    state.show_prompt_editor = false;
+  // Add --debug flag if enabled
+  if (state.use_docker_debug) {
+    args += " --debug";
   }
-}
 
-void RenderMainUI(AppState &state) {
-  // Critical safety check - ensure ImGui is in a valid state
-  if (!GImGui || !GImGui->CurrentWindow) {
-    if (state.dev_mode) {
-      DevLog(state, "CRITICAL: ImGui context or current window is null!");
-    }
-    if (g_show_debug_console) {
-      ConsoleLog("CRITICAL: ImGui context or current window is null!");
-    }
-    return;
+  // Runs of one batch share an image tag and build it once; otherwise each
+  // run tags its own image
+  const bool share_image = !shared_image_suffix.empty();
+  const std::string &image_suffix =
+      share_image ? shared_image_suffix : unique_suffix;
+  if (share_image) {
+    args += " --reuse-image";
+    // The first of them to reach setup starts all their containers
+    if (fan_out > 1)
+      args += " --fan-out " + std::to_string(fan_out);
   }
 
-  // Pre-emptive ID stack validation
-  if (g_show_debug_console && GImGui->CurrentWindow) {
-    int id_stack_size = GImGui->CurrentWindow->IDStack.Size;
-    if (id_stack_size < 1) {
-      ConsoleLog(
-          "PRE-EMPTIVE WARNING: IDStack size is " +
-          std::to_string(id_stack_size) +
-          " before rendering - this will likely cause assertion failure!");
+  // Skip the build when an image of the same env/ contents exists
+  if (state.use_image_cache) {
+    args += " --image-cache";
+    // Share those images with the other hosts through a registry
+    if (!state.image_registry.empty()) {
+#ifdef _WIN32
+      args += " --image-registry \\\"" + state.image_registry + "\\\"";
+#else
+      args += " --image-registry '" + state.image_registry + "'";
+#endif
     }
   }
 
-  ImGuiIO &io = ImGui::GetIO();
-  // Allow the SDL window to handle its own resizing by leaving some margin
-  ImGui::SetNextWindowPos(ImVec2(2, g_titlebar_height + 2));
-  ImVec2 _size = io.DisplaySize;
-  _size.x -= 4; // Leave margin for resize handles
-  _size.y = (_size.y > g_titlebar_height) ? (_size.y - g_titlebar_height - 4)
-                                          : _size.y;
-  // Always update window size to match SDL window size
-  ImGui::SetNextWindowSize(_size, ImGuiCond_Always);
-
-  // Set window style properties before the window begins
-  ImGui::PushStyleVar(ImGuiStyleVar_WindowRounding, 12.0f);
-  ImGui::PushStyleVar(ImGuiStyleVar_WindowBorderSize, 2.0f);
-  ImGui::PushStyleColor(ImGuiCol_Border,
-                        ImVec4(0.0f, 0.0f, 0.0f, 1.0f)); // Black border
-
-  // Add window fade-in animation
-  static bool window_first_frame = true;
-  if (window_first_frame) {
-    g_animation_manager.StartAnimation("window_fade", 0.5f);
-    window_first_frame = false;
+  // Key that cache by the files the Dockerfile reads, not all of env/
+  if (validation.task_dir == task_directory && !task_directory.empty() &&
+      validation.context_hash != 0) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             (unsigned long long)validation.context_hash);
+    args += std::string(" --context-hash ") + hash;
   }
+#ifndef _WIN32
+  // Send docker build only what the Dockerfile reads, from a cached tar
+  // this executable writes (see --context-tar in main)
+  std::string self = GetExecutablePath();
+  if (!self.empty())
+    args += " --context-tool '" + self + "'";
+#endif
 
-  float window_alpha = 1.0f;
-  if (g_animation_manager.IsAnimationPlaying("window_fade")) {
-    auto &anim = g_animation_manager.GetAnimation("window_fade");
-    anim.start_value = 0.0f;
-    anim.end_value = 1.0f;
-    window_alpha = anim.GetValue();
+  // Reuse the verification result of an identical workspace
+  if (state.use_verify_cache && (_mode == 0 || _mode == 1 || _mode == 2)) {
+    args += " --verify-cache";
   }
 
-  // Apply alpha to window background
-  ImVec4 bg_color = ImGui::GetStyle().Colors[ImGuiCol_WindowBg];
-  bg_color.w *= window_alpha;
-  ImGui::PushStyleColor(ImGuiCol_WindowBg, bg_color);
-
-  ImGuiWindowScope main_window_scope(
-      "Autobuild 2.0 - Verification Orchestrator", nullptr,
-      ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse |
-          ImGuiWindowFlags_NoBringToFrontOnFocus |
-          ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoResize);
-
-  // Pop the style variables immediately after window begins to avoid stack
-  // issues
-  ImGui::PopStyleColor(1); // Border color
-  ImGui::PopStyleVar(2);   // WindowRounding and WindowBorderSize
+  // Reuse the outcome of an audit of the same inputs
+  if (state.use_audit_cache && _mode == 3) {
+    args += " --audit-cache";
+    if (state.force_reaudit)
+      args += " --force-audit";
+  }
 
-  // Dev overlay is rendered at the end to stay on top
+  // Split the verification over containers cloned from the run's
+  if (state.verify_shards > 1 && (_mode == 0 || _mode == 1 || _mode == 2)) {
+    args += " --verify-shards " + std::to_string(state.verify_shards);
+  }
 
-  // Clear keyboard focus when drag begins to allow drag and drop to work
-  // properly
-  if (state.should_clear_focus) {
-    ImGui::SetKeyboardFocusHere(-1); // Clear focus from any active item
-    state.should_clear_focus = false;
+  // BuildKit builds share one layer cache across runs and workers
+  if (state.use_buildkit) {
+    args += " --buildkit";
+    if (!state.build_cache.empty()) {
+#ifdef _WIN32
+      args += " --build-cache \\\"" + state.build_cache + "\\\"";
+#else
+      args += " --build-cache '" + state.build_cache + "'";
+#endif
+    }
   }
 
-  // Periodically log stack sizes when dev mode enabled (every 60 frames)
-  static int frame_counter = 0;
-  if (state.dev_mode && (frame_counter % 60 == 0)) {
-    ImGuiContext &g = *GImGui;
-    ImGuiWindow *w = g.CurrentWindow;
-    std::stringstream ss;
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                  now.time_since_epoch()) %
-              1000;
+  // Package downloads land in volumes every task container shares; the
+  // list only holds the script's cache names, so it needs no quoting
+  if (_mode != 4 && state.use_cache_volumes && !state.cache_volumes.empty() &&
+      state.cache_volumes.find_first_not_of(
+          "abcdefghijklmnopqrstuvwxyz,") == std::string::npos) {
+    args += " --cache-volumes " + state.cache_volumes;
+  }
 
-    ss << "[" << std::put_time(std::localtime(&time_t), "%H:%M:%S") << "."
-       << std::setfill('0') << std::setw(3) << ms.count() << "] ";
-    ss << "IDStack=" << w->IDStack.Size << " ColorStack=" << g.ColorStack.Size
-       << " StyleVarStack=" << g.StyleVarStack.Size;
-    ss << " FontStack=" << g.FontStack.Size << " Windows=" << g.Windows.Size;
-    DevLog(state, ss.str());
+  // Runs are told which proxy to use once they are placed (see
+  // LaunchTaskProcess); the build farm only builds on this host
+  if (_mode == 4) {
+    std::string proxy = PackageProxySpec(state.package_proxy,
+                                         state.package_proxy_url, true);
+    if (!proxy.empty())
+      args += " --package-proxy " + proxy;
   }
-  frame_counter++;
 
-  // Clean up dummy IDs from previous frame at the start of new frame
-  CleanupImGuiIDStack(state);
+  // Install the Gemini CLI once per image rather than once per container
+  if (state.use_cli_layer) {
+    args += " --cli-layer";
+  }
 
-  // Track ID stack changes to identify root cause
-  TrackIDStackChanges(state);
+  // Start feedback and audit from the committed set-up container
+  if (state.use_checkpoint_image && (_mode == 0 || _mode == 2 || _mode == 3)) {
+    if (state.checkpoint_registry.empty()) {
+      args += " --checkpoint-image";
+    } else {
+#ifdef _WIN32
+      args += " --checkpoint-registry \\\"" + state.checkpoint_registry +
+              "\\\"";
+#else
+      args += " --checkpoint-registry '" + state.checkpoint_registry + "'";
+#endif
+    }
+  }
 
-  // Validate ImGui state for debugging
-  ValidateImGuiState(state);
-  FixImGuiIDStack(state);
+  // Take a pre-started container when one is warm for the image
+  if (state.container_pool_size > 0) {
+    args += " --container-pool " + std::to_string(state.container_pool_size);
+  }
 
-  // Don't clean up dummy IDs here - let them stay until the next frame
-  // CleanupImGuiIDStack(state);
+  // The layout was validated here (and is kept current by the watcher), so
+  // the script need not check it again; a build only reads env/
+  if (_mode != 4 && validation.task_dir == task_directory &&
+      !task_directory.empty() &&
+      validation.missing_items.empty())
+    args += " --validated";
+  if (!task_directory.empty())
+    AppendPromptFileArgs(state, _mode, task_directory, prompts, args);
 
-  // Track state changes for debugging
-  static int last_id_stack_size = -1;
-  if (state.dev_mode && GImGui && GImGui->CurrentWindow) {
-    int current_id_stack_size = GImGui->CurrentWindow->IDStack.Size;
-    if (last_id_stack_size != -1 &&
-        current_id_stack_size != last_id_stack_size) {
-      DevLog(state, "IDStack changed from " +
-                        std::to_string(last_id_stack_size) + " to " +
-                        std::to_string(current_id_stack_size));
+  // A batch run names its image and container after its own task
+  if (!task && !state.image_tag.empty()) {
+    std::string image_tag = state.image_tag;
+    if (state.auto_lowercase_names) {
+      std::transform(image_tag.begin(), image_tag.end(), image_tag.begin(),
+                     ::tolower);
     }
-    last_id_stack_size = current_id_stack_size;
-
-    // Console output for critical state issues
-    if (g_show_debug_console) {
-      if (current_id_stack_size < 1) {
-        ConsoleLog("WARNING: IDStack size is " +
-                   std::to_string(current_id_stack_size) +
-                   " - this may cause assertion failures!");
-      }
-      if (current_id_stack_size > 10) {
-        ConsoleLog("WARNING: IDStack size is " +
-                   std::to_string(current_id_stack_size) +
-                   " - unusually high, possible stack leak!");
+    // Add unique suffix to avoid conflicts between concurrent tasks
+    if (!image_suffix.empty()) {
+      // Replace :latest with unique suffix
+      size_t colon_pos = image_tag.find(":latest");
+      if (colon_pos != std::string::npos) {
+        image_tag = image_tag.substr(0, colon_pos) + ":" + image_suffix;
+      } else {
+        image_tag += ":" + image_suffix;
       }
+    }
+    // Ensure the final image name is unique to avoid conflicts with existing
+    // images (a shared tag is already unique to its batch)
+    if (!share_image)
+      image_tag = GenerateUniqueImageName(image_tag);
+#ifdef _WIN32
+    args += " --image-tag \\\"" + image_tag + "\\\"";
+#else
+    args += " --image-tag '" + image_tag + "'";
+#endif
+  } else if (state.auto_lowercase_names && !task_directory.empty()) {
+    std::string task_dir = task_directory;
+    size_t last_slash = task_dir.find_last_of("/\\");
+    std::string basename = (last_slash != std::string::npos)
+                               ? task_dir.substr(last_slash + 1)
+                               : task_dir;
+    std::transform(basename.begin(), basename.end(), basename.begin(),
+                   ::tolower);
+    std::string auto_tag = "autobuild-" + basename;
+    if (!image_suffix.empty()) {
+      auto_tag += ":" + image_suffix;
+    } else {
+      auto_tag += ":latest";
+    }
+    // Ensure the final image name is unique to avoid conflicts with existing
+    // images (a shared tag is already unique to its batch)
+    if (!share_image)
+      auto_tag = GenerateUniqueImageName(auto_tag);
+#ifdef _WIN32
+    args += " --image-tag \\\"" + auto_tag + "\\\"";
+#else
+    args += " --image-tag '" + auto_tag + "'";
+#endif
+  }
+  if (!task && !state.container_name.empty()) {
+    std::string container_name = state.container_name;
+    if (state.auto_lowercase_names) {
+      std::transform(container_name.begin(), container_name.end(),
+                     container_name.begin(), ::tolower);
+    }
+    // Add unique suffix to container name to avoid conflicts
+    if (!unique_suffix.empty()) {
+      container_name += "_from_" + unique_suffix;
+    }
+#ifdef _WIN32
+    args += " --container-name \\\"" + container_name + "\\\"";
+#else
+    args += " --container-name '" + container_name + "'";
+#endif
+  } else if (state.auto_lowercase_names && !task_directory.empty()) {
+    std::string task_dir = task_directory;
+    size_t last_slash = task_dir.find_last_of("/\\");
+    std::string basename = (last_slash != std::string::npos)
+                               ? task_dir.substr(last_slash + 1)
+                               : task_dir;
+    std::transform(basename.begin(), basename.end(), basename.begin(),
+                   ::tolower);
+    std::string auto_container = "autobuild-" + basename;
+    // Add unique suffix to container name to avoid conflicts
+    if (!unique_suffix.empty()) {
+      auto_container += "_from_" + unique_suffix;
+    }
+#ifdef _WIN32
+    args += " --container-name \\\"" + auto_container + "\\\"";
+#else
+    args += " --container-name '" + auto_container + "'";
+#endif
+  }
+  // Without an override, the WORKDIR the Dockerfile analysis resolved
+  // (stages, ARG and ENV included) rather than the script's first guess
+  const std::string &container_workdir =
+      !workdir_unix.empty() || _mode == 4 ||
+              validation.task_dir != task_directory
+          ? workdir_unix
+          : validation.workdir;
+#ifdef _WIN32
+  if (!container_workdir.empty())
+    args += " --workdir \\\"" + container_workdir + "\\\"";
+#else
+  if (!container_workdir.empty())
+    args += " --workdir '" + container_workdir + "'";
+#endif
 
-      // Check for other stack imbalances
-      ImGuiContext &g = *GImGui;
-      if (g.ColorStack.Size < 0) {
-        ConsoleLog("ERROR: ColorStack.Size < 0, PushStyleColor/PopStyleColor "
-                   "mismatch!");
-      }
-      if (g.StyleVarStack.Size < 0) {
-        ConsoleLog("ERROR: StyleVarStack.Size < 0, PushStyleVar/PopStyleVar "
-                   "mismatch!");
-      }
-      if (g.FontStack.Size < 0) {
-        ConsoleLog("ERROR: FontStack.Size < 0, PushFont/PopFont mismatch!");
+  // The script waits at each stage until the scheduler releases it there
+  if (!stage_gate_dir.empty()) {
+#ifdef _WIN32
+    args += " --stage-gate \\\"" + ConvertToUnixPath(stage_gate_dir) +
+            "\\\"";
+#else
+    args += " --stage-gate '" + stage_gate_dir + "'";
+#endif
+  }
+
+  // Continue a checkpointed feedback run in its container (see
+  // checkpoint in autobuild.sh)
+  if (_mode == 0 && !resume_dir.empty()) {
+#ifdef _WIN32
+    args += " --resume \\\"" + ConvertToUnixPath(resume_dir) + "\\\"";
+#else
+    args += " --resume '" + resume_dir + "'";
+#endif
+  }
+
+  // Only pass --output-dir if user explicitly set one
+  // Otherwise, let the script use its default:
+  // $base_logs_dir/$task_name/$timestamp This ensures proper directory
+  // structure for the Logs Browser
+  if (!output_dir_unix.empty()) {
+    std::string final_output_dir = output_dir_unix;
+    // Make output directory unique for each task to avoid conflicts
+    if (!unique_suffix.empty()) {
+      final_output_dir += "_" + unique_suffix;
+    }
+#ifdef _WIN32
+    args += " --output-dir \\\"" + final_output_dir + "\\\"";
+#else
+    args += " --output-dir '" + final_output_dir + "'";
+#endif
+  }
+
+  // Set AUTOBUILD_LOGS_ROOT environment variable to point script to
+  // user-accessible location This works better than --output-dir because it
+  // lets the script create the proper structure
+  std::string logs_root_for_env;
+  std::string default_log_root =
+      state.log_folder_paths.empty()
+          ? std::string()
+          : state.log_folder_paths[std::max(0, state.selected_log_folder)];
+
+  if (default_log_root.empty()) {
+    // Fallback: use ResolveDefaultLogsPath logic
+#ifdef _WIN32
+    std::string exe_dir = GetExecutableDir();
+    if (exe_dir.find("Program Files") != std::string::npos) {
+      // MSI install: use APPDATA
+      const char *appdata = getenv("APPDATA");
+      if (appdata != nullptr) {
+        logs_root_for_env = std::string(appdata) + "\\Autobuild\\logs";
+      } else {
+        const char *userprofile = getenv("USERPROFILE");
+        if (userprofile != nullptr) {
+          logs_root_for_env =
+              std::string(userprofile) + "\\Documents\\Autobuild\\logs";
+        }
       }
+    } else {
+      // Development: use relative to exe
+      logs_root_for_env = exe_dir + "/../autobuild/logs";
+    }
+#elif defined(__APPLE__)
+    const char *home = getenv("HOME");
+    if (home) {
+      logs_root_for_env =
+          std::string(home) + "/Library/Application Support/Autobuild/logs";
+    }
+#else // Linux
+    const char *home = getenv("HOME");
+    if (home) {
+      logs_root_for_env = std::string(home) + "/.autobuild/logs";
     }
+#endif
+  } else {
+    logs_root_for_env = default_log_root;
   }
+  // Runs write a network root's logs locally; g_log_stager ships them
+  logs_root_for_env = StagedLogsRoot(logs_root_for_env);
 
-  // Header
-  ImGui::PushFont(io.Fonts->Fonts[0]);
-  ImGui::PopFont();
+#ifdef _WIN32
+  {
+    // Get the absolute path to the autobuild.sh script and convert to Unix
+    // format Use GetExecutableDir() instead of GetCurrentDirectoryA() to find
+    // script relative to exe
+    std::string exe_dir = GetExecutableDir();
 
-  // Dev mode indicator
-  if (state.dev_mode) {
-    ImGui::SameLine();
-    ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "[DEV MODE]");
-    ImGui::Separator();
+    // Determine script path based on installation type
+    std::string script_path;
+    if (exe_dir.find("Program Files") != std::string::npos) {
+      // Script is installed inside bin directory:
+      // bin/autobuild/scripts/autobuild.sh
+      script_path = exe_dir + "/autobuild/scripts/autobuild.sh";
+    } else {
+      // Development: go up from build directory (native/build-gui-mingw) to
+      // project root
+      script_path = exe_dir + "/../../autobuild/scripts/autobuild.sh";
+    }
+
+    // Convert Windows path to Unix format for bash
+    for (char &c : script_path) {
+      if (c == '\\')
+        c = '/';
+    }
+    if (backend.wsl) {
+      script_path = ConvertToUnixPath(script_path); // /mnt/c/...
+    } else if (script_path.length() >= 2 && script_path[1] == ':') {
+      // Convert C: to /c for MSYS2/Git Bash
+      script_path[0] = tolower(script_path[0]);
+      script_path = "/" + script_path.substr(0, 1) + script_path.substr(2);
+    }
+
+    if (g_show_debug_console) {
+      ConsoleLog("[DEBUG][Windows] Script path: " + script_path);
+      ConsoleLog("[DEBUG][Windows] Logs root: " + logs_root_for_env);
+    }
+
+    // Convert logs root to Unix path for bash
+    std::string logs_root_unix = ConvertToUnixPath(logs_root_for_env);
+
+    // WSL brings its own docker (Docker Desktop's integration or a native
+    // daemon) on the distro's PATH
+    std::string head =
+        backend.wsl
+            ? "export PYTHONUNBUFFERED=1 PYTHONIOENCODING=utf-8"
+            : "export PATH=/c/Program\\ "
+              "Files/Docker/Docker/resources/bin:/mingw64/bin:/usr/bin:$PATH; "
+              "export PYTHONUNBUFFERED=1 PYTHONIOENCODING=utf-8";
+    // Phase logs are tailed from their files (LogTailer), so the script
+    // does not also copy them to stdout
+    head += "; export AUTOBUILD_PHASE_OUTPUT=file";
+
+    // Add AUTOBUILD_LOGS_ROOT if we have a logs root
+    if (!logs_root_unix.empty()) {
+      head += "; export AUTOBUILD_LOGS_ROOT='" + logs_root_unix + "'";
+    }
+    if (!task_mirror_source.empty()) {
+      // rsync copies only what changed since the last run; without it the
+      // mirror is copied afresh
+      const std::string mirror = "\\\"" + task_dir_unix + "\\\"";
+      head += "; mkdir -p \\\"$(dirname " + mirror + ")\\\" && "
+              "{ rsync -a --delete '" + task_mirror_source + "/' " + mirror +
+              "/ 2>/dev/null || { rm -rf " + mirror + " && cp -a '" +
+              task_mirror_source + "' " + mirror +
+              "; }; } || { echo '[ERROR] Could not mirror the task folder "
+              "into WSL'; exit 1; }";
+    }
+    head += "; ";
+    // Use single quotes around the script path to handle spaces properly
+    std::string quoted_script_path = "'" + script_path + "'";
+
+    cmd = std::string("\"") + bash + "\" " +
+          (backend.wsl ? WslArguments(backend) + " bash -lc \"" : "-lc \"") +
+          head +
+          "if command -v stdbuf >/dev/null 2>&1; then stdbuf -oL -eL bash " +
+          quoted_script_path + " " + args + "; else bash " +
+          quoted_script_path + " " + args + "; fi\"";
   }
+#else
+  // Mac/Linux: Find script relative to executable location
+  std::string exe_dir = GetExecutableDir();
+  std::string script_path = exe_dir + "/autobuild/scripts/autobuild.sh";
 
-  // Main content area
-  bool is_config_tab = false;
-  ImGuiTabBarScope _main_tabs("MainTabs");
-  if (_main_tabs) {
-    {
-      ImGuiTabItemScope _tab_config("Configuration");
-      if (_tab_config) {
-        is_config_tab = true;
-        ImGui::Spacing();
-        // Docker configuration (all modes are Docker-based now)
-        {
-          ImGui::TextColored(ImVec4(0.4f, 0.7f, 1.0f, 1.0f),
-                             "Docker Configuration");
-          ImGui::Spacing();
+  // On macOS, check if we're in an app bundle and adjust path accordingly
+#ifdef __APPLE__
+  // Check if we're running from an app bundle
+  if (exe_dir.find(".app/Contents/MacOS") != std::string::npos) {
+    // We're in an app bundle, script should be in the bundle resources
+    size_t bundle_pos = exe_dir.find(".app/Contents/MacOS");
+    std::string bundle_path = exe_dir.substr(0, bundle_pos + 4); // Include .app
+    script_path =
+        bundle_path + "/Contents/Resources/autobuild/scripts/autobuild.sh";
 
-          // Task directory with file browser hint
-          ImGui::Text("Task Directory:");
+    if (g_show_debug_console) {
+      ConsoleLog("[DEBUG][macOS] App bundle detected, trying script path: " +
+                 script_path);
+    }
+
+    // Fallback: try multiple possible locations if the bundle path doesn't
+    // exist
+    if (!FileExists(script_path)) {
+      // Try the original path first
+      script_path = exe_dir + "/autobuild/scripts/autobuild.sh";
+      if (g_show_debug_console) {
+        ConsoleLog("[DEBUG][macOS] Bundle path not found, trying fallback: " +
+                   script_path);
+      }
+
+      // If still not found, try other common locations
+      if (!FileExists(script_path)) {
+        std::vector<std::string> fallback_paths = {
+            bundle_path + "/Contents/MacOS/autobuild/scripts/autobuild.sh",
+            bundle_path + "/Contents/Resources/autobuild.sh",
+            exe_dir + "/../Resources/autobuild/scripts/autobuild.sh",
+            exe_dir + "/../autobuild/scripts/autobuild.sh"};
+
+        for (const auto &fallback_path : fallback_paths) {
+          if (FileExists(fallback_path)) {
+            script_path = fallback_path;
+            if (g_show_debug_console) {
+              ConsoleLog("[DEBUG][macOS] Found script at: " + script_path);
+            }
+            break;
+          }
+        }
+      }
+    }
+  }
+#endif
+
+  if (g_show_debug_console) {
+    ConsoleLog("[DEBUG][Mac/Linux] Executable dir: " + exe_dir);
+    ConsoleLog("[DEBUG][Mac/Linux] Script path: " + script_path);
+    ConsoleLog(std::string("[DEBUG][Mac/Linux] Script exists: ") +
+               (FileExists(script_path) ? "YES" : "NO"));
+    ConsoleLog("[DEBUG][Mac/Linux] Logs root: " + logs_root_for_env);
+  }
+
+  // Verify script exists before proceeding
+  if (!FileExists(script_path)) {
+    std::string error_msg = "echo 'ERROR: autobuild.sh script not found. ";
+    error_msg += "Searched at: " + script_path;
+#ifdef __APPLE__
+    error_msg += " (macOS app bundle)";
+#endif
+    error_msg += " Please ensure the script is properly installed.'";
+    return error_msg;
+  }
+
+  // On macOS, ensure script is executable
+#ifdef __APPLE__
+  struct stat script_stat;
+  if (stat(script_path.c_str(), &script_stat) == 0) {
+    if (!(script_stat.st_mode & S_IXUSR)) {
+      if (g_show_debug_console) {
+        ConsoleLog("[DEBUG][macOS] Making script executable: " + script_path);
+      }
+      chmod(script_path.c_str(),
+            script_stat.st_mode | S_IXUSR | S_IXGRP | S_IXOTH);
+    }
+  }
+#endif
+
+  // Set up PATH to include Docker and other essential tools
+  // macOS GUI apps don't inherit shell PATH, so we need to set it explicitly
+  // Include common Docker/tool locations for both Intel and Apple Silicon Macs
+  std::string path_setup = "export "
+                           "PATH=\"/usr/local/bin:/opt/homebrew/bin:/opt/local/"
+                           "bin:/usr/bin:/bin:/usr/sbin:/sbin";
+
+  // Add Docker Desktop's resources/bin directory if it exists
+  path_setup += ":/Applications/Docker.app/Contents/Resources/bin";
+
+  // Preserve any existing PATH
+  path_setup += ":$PATH\"; ";
+
+  // Phase logs are tailed from their files (LogTailer), so the script does
+  // not also copy them to stdout
+  path_setup += "export AUTOBUILD_PHASE_OUTPUT=file; ";
+
+  // Verify Docker is accessible and log it
+  if (g_show_debug_console) {
+    ConsoleLog("[DEBUG][macOS] Using PATH: " + path_setup);
+  }
+
+  // Set AUTOBUILD_LOGS_ROOT environment variable if we have a logs root
+  if (!logs_root_for_env.empty()) {
+    cmd = path_setup + "export AUTOBUILD_LOGS_ROOT='" + logs_root_for_env +
+          "'; bash '" + script_path + "' " + args;
+  } else {
+    cmd = path_setup + "bash '" + script_path + "' " + args;
+  }
+
+  if (g_show_debug_console) {
+    ConsoleLog("[DEBUG][Mac/Linux] BuildCommand result: " + cmd);
+  }
+#endif
+
+  return cmd;
+}
+
+static bool IsPromptValid(const std::string &prompt) {
+  // Check if prompt is not empty and contains non-whitespace characters
+  if (prompt.empty()) {
+    return false;
+  }
+
+  for (char c : prompt) {
+    if (!std::isspace(static_cast<unsigned char>(c))) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Per-prompt history management functions
+static void PushToHistory(PromptHistory &history, const std::string &value) {
+  history.Push(value);
+}
+
+static bool CanUndoPrompt(const PromptHistory &history) {
+  return history.CanUndo();
+}
+
+static bool CanRedoPrompt(const PromptHistory &history) {
+  return history.CanRedo();
+}
+
+static void UndoPrompt(AppState &state, int prompt_index) {
+  PromptHistory *history = nullptr;
+  std::string *modified_prompt = nullptr;
+
+  if (prompt_index == 0) {
+    history = &state.prompt1_history;
+    modified_prompt = &state.prompt1_modified;
+  } else if (prompt_index == 1) {
+    history = &state.prompt2_history;
+    modified_prompt = &state.prompt2_modified;
+  } else if (prompt_index == 2) {
+    history = &state.audit_prompt_history;
+    modified_prompt = &state.audit_prompt_modified;
+  }
+
+  if (!history || !CanUndoPrompt(*history))
+    return;
+
+  *modified_prompt = history->Undo();
+
+  UpdatePromptsModified(state);
+
+  DevLog("Undo Prompt " + std::to_string(prompt_index) +
+             ": index=" + std::to_string(history->index()));
+}
+
+static void RedoPrompt(AppState &state, int prompt_index) {
+  PromptHistory *history = nullptr;
+  std::string *modified_prompt = nullptr;
+
+  if (prompt_index == 0) {
+    history = &state.prompt1_history;
+    modified_prompt = &state.prompt1_modified;
+  } else if (prompt_index == 1) {
+    history = &state.prompt2_history;
+    modified_prompt = &state.prompt2_modified;
+  } else if (prompt_index == 2) {
+    history = &state.audit_prompt_history;
+    modified_prompt = &state.audit_prompt_modified;
+  }
+
+  if (!history || !CanRedoPrompt(*history))
+    return;
+
+  *modified_prompt = history->Redo();
+
+  UpdatePromptsModified(state);
+
+  DevLog("Redo Prompt " + std::to_string(prompt_index) +
+             ": index=" + std::to_string(history->index()));
+}
+
+static void InitializePromptHistory(AppState &state) {
+  if (state.prompt1_history.empty()) {
+    PushToHistory(state.prompt1_history, state.prompt1_modified);
+    DevLog("Initialized Prompt1 history");
+  }
+  if (state.prompt2_history.empty()) {
+    PushToHistory(state.prompt2_history, state.prompt2_modified);
+    DevLog("Initialized Prompt2 history");
+  }
+  if (state.audit_prompt_history.empty()) {
+    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+    DevLog("Initialized Audit history");
+  }
+}
+
+// Apply config and prompts files that were changed on disk by something
+// else, once per frame; the files were read and parsed on the watcher's
+// thread. Runs already started keep the settings and prompts they were
+// started with, since their commands were built then.
+static void ReloadChangedSettings(AppState &state) {
+  if (auto config = g_settings_watcher.Take(SettingsWatcher::kConfig)) {
+    ApplyConfig(state, *config);
+    if (state.log_folder_paths.empty())
+      state.log_folder_paths.push_back(ResolveDefaultLogsPath());
+    ConfigureLogArchive(state);
+    ConfigureCatalogExport(state);
+    ConfigureLogStaging(state);
+    ConfigureDockerGc(state);
+    g_build_farm.Configure(state.max_image_builds);
+    g_base_puller.Configure(state.max_image_pulls);
+    ConfigureApiGovernor(state);
+    g_log_ingest_rate = state.log_ingest_lines_per_sec;
+    ConfigureMetrics(state);
+    ConfigureDashboard(state);
+    ConfigureSubmissions(state);
+    ConsoleLog("[INFO] Reloaded settings from " + GetConfigFilePath());
+  }
+  if (auto prompts = g_settings_watcher.Take(SettingsWatcher::kPrompts)) {
+    ApplyPrompts(state, *prompts);
+    // A history that no longer matches the new text was dropped
+    InitializePromptHistory(state);
+    ConsoleLog("[INFO] Reloaded prompts from " + GetPromptsFilePath());
+  }
+}
+
+static void ClearCurrentPromptState(AppState &state, int prompt_index) {
+  PromptHistory *history = nullptr;
+  const char *name = "";
+
+  if (prompt_index == 0) {
+    history = &state.prompt1_history;
+    name = "Prompt1";
+  } else if (prompt_index == 1) {
+    history = &state.prompt2_history;
+    name = "Prompt2";
+  } else if (prompt_index == 2) {
+    history = &state.audit_prompt_history;
+    name = "Audit";
+  }
+
+  if (history && history->size() > 1) {
+    // Set flag to prevent auto-save from interfering
+    state.skip_next_history_push = true;
+
+    // Remove current state and go back to previous
+    history->DropNewest();
+
+    // Update the current prompt to the previous state
+    if (prompt_index == 0) {
+      state.prompt1_modified = history->current();
+    } else if (prompt_index == 1) {
+      state.prompt2_modified = history->current();
+    } else if (prompt_index == 2) {
+      state.audit_prompt_modified = history->current();
+    }
+
+    // Update the modified flag
+    UpdatePromptsModified(state);
+
+    DevLog(std::string("Cleared current state from ") + name + " history");
+  }
+}
+
+static void ClearAllPromptHistory(AppState &state, int prompt_index) {
+  PromptHistory *history = nullptr;
+  const char *name = "";
+
+  if (prompt_index == 0) {
+    history = &state.prompt1_history;
+    name = "Prompt1";
+  } else if (prompt_index == 1) {
+    history = &state.prompt2_history;
+    name = "Prompt2";
+  } else if (prompt_index == 2) {
+    history = &state.audit_prompt_history;
+    name = "Audit";
+  }
+
+  if (history) {
+    history->Clear();
+    // Reset to original state
+    if (prompt_index == 0) {
+      state.prompt1_modified = state.prompt1_original;
+    } else if (prompt_index == 1) {
+      state.prompt2_modified = state.prompt2_original;
+    } else if (prompt_index == 2) {
+      state.audit_prompt_modified = state.audit_prompt_original;
+    }
+
+    // Update the modified flag
+    UpdatePromptsModified(state);
+
+    // Re-initialize with original state
+    const std::string *original_value = nullptr;
+    if (prompt_index == 0)
+      original_value = &state.prompt1_original;
+    else if (prompt_index == 1)
+      original_value = &state.prompt2_original;
+    else if (prompt_index == 2)
+      original_value = &state.audit_prompt_original;
+
+    if (original_value) {
+      PushToHistory(*history, *original_value);
+    }
+
+    DevLog(std::string("Cleared all ") + name + " history");
+  }
+}
+
+static void ClearAllHistory(AppState &state) {
+  DevLog("Clearing all prompt history");
+
+  // Reset all prompts to original state
+  state.prompt1_modified = state.prompt1_original;
+  state.prompt2_modified = state.prompt2_original;
+  state.audit_prompt_modified = state.audit_prompt_original;
+
+  // Update the modified flag (should be false now since all are original)
+  UpdatePromptsModified(state);
+
+  // Clear all history and re-initialize with original states
+  state.prompt1_history.Clear();
+  PushToHistory(state.prompt1_history, state.prompt1_original);
+
+  state.prompt2_history.Clear();
+  PushToHistory(state.prompt2_history, state.prompt2_original);
+
+  state.audit_prompt_history.Clear();
+  PushToHistory(state.audit_prompt_history, state.audit_prompt_original);
+
+  SavePrompts(state);
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//              UI RENDERING FUNCTIONS                   //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Text color for a task log line's severity tag
+static ImVec4 LogLineColor(LogSeverity severity) {
+  switch (severity) {
+  case LogSeverity::Error:
+    return ImVec4(1.0f, 0.3f, 0.3f, 1.0f);
+  case LogSeverity::Success:
+    return ImVec4(0.3f, 1.0f, 0.3f, 1.0f);
+  case LogSeverity::Warning:
+    return ImVec4(1.0f, 0.9f, 0.3f, 1.0f);
+  case LogSeverity::Info:
+    return ImVec4(0.5f, 0.8f, 1.0f, 1.0f);
+  case LogSeverity::Stopped:
+    return ImVec4(1.0f, 0.5f, 0.0f, 1.0f);
+  default:
+    return ImVec4(0.9f, 0.9f, 0.9f, 1.0f);
+  }
+}
+
+// Line for a log sequence number that is known to still be in the log
+static std::string_view LogLineAt(const LogArena &log, uint64_t seq) {
+  return log[(size_t)(seq - (log.TotalAppended() - log.size()))];
+}
+
+// Syntax reminder shown on the query boxes (see LogQuery)
+static const char kLogQueryHelp[] =
+    "Words and \"quoted phrases\" match anywhere in a line; -word excludes.\n"
+    "sev:error,warning   severity of the line\n"
+    "phase:verify        read while that phase ran\n"
+    "task:name           task, run or file name\n"
+    "after:14:30 before:15:00 since:30m   when it was read\n"
+    "mode:feedback status:failed   runs in the Logs Browser";
+
+// Whether query matches the line at seq, a sequence number still in log.
+// line already holds the run's timeline and name; the line's text, tag and
+// (when the query needs it) read time are filled in here.
+static bool LogLineMatches(const LogQuery &query, const LogArena &log,
+                           const LogArena &log_lower, uint64_t seq,
+                           int64_t wall_offset_ms, LogQueryLine &line) {
+  if (query.empty())
+    return true;
+  size_t i = (size_t)(seq - (log.TotalAppended() - log.size()));
+  line.lower = log_lower[i];
+  line.severity = (LogSeverity)log.Tag(i);
+  line.ms = query.UsesTime() ? log.Time(i) + wall_offset_ms : 0;
+  return query.MatchLine(line);
+}
+
+// Bring a log view's row index up to date with the log. Only lines appended
+// since the last frame are filtered and measured. A query that refines the
+// last one (extending a search term, adding a term) narrows the existing
+// rows in place, keeping their measured heights; any other change of query,
+// wrap width or font size re-measures everything still in the log. The
+// query is compiled once per change of filter; task is the run the log
+// belongs to, for its phases and name (null for neither).
+static void UpdateLogViewLayout(LogViewLayout &layout, const LogArena &log,
+                                const LogArena &log_lower,
+                                const std::string &filter,
+                                TaskInstance *task, float wrap_width,
+                                float row_gap) {
+  float line_height = ImGui::GetTextLineHeight();
+  uint64_t end_seq = log.TotalAppended();
+  uint64_t first_seq = end_seq - log.size();
+
+  bool requery = layout.row_top.empty() || filter != layout.filter;
+  LogQuery query;
+  if (requery) {
+    layout.filter_error.clear();
+    query.Compile(filter, EpochMs(), &layout.filter_error);
+  }
+  if (layout.row_top.empty() || layout.wrap_width != wrap_width ||
+      layout.line_height != line_height || layout.row_gap != row_gap ||
+      (requery && !query.Refines(layout.query))) {
+    layout.wrap_width = wrap_width;
+    layout.line_height = line_height;
+    layout.row_gap = row_gap;
+    if (requery) {
+      layout.filter = filter;
+      layout.query = std::move(query);
+      requery = false;
+    }
+    layout.rows.clear();
+    layout.row_top.assign(1, 0.0f);
+    layout.next_seq = first_seq;
+  }
+
+  // Forget rows whose lines were trimmed or cleared from the log
+  while (!layout.rows.empty() && layout.rows.front() < first_seq) {
+    layout.rows.pop_front();
+    layout.row_top.pop_front();
+  }
+  if (layout.next_seq < first_seq)
+    layout.next_seq = first_seq;
+
+  // The run's context, copied once for the lines matched this frame
+  std::vector<PhaseTiming> phases;
+  LogQueryLine line;
+  std::string source;
+  const LogQuery &next = requery ? query : layout.query;
+  if (task && (requery || layout.next_seq < end_seq) && !next.empty()) {
+    if (next.UsesTime()) {
+      std::lock_guard<std::mutex> lock(task->timeline_mutex);
+      phases = task->timeline;
+      line.phases = &phases;
+    }
+    source = task->name;
+    std::transform(source.begin(), source.end(), source.begin(), ::tolower);
+    line.source = &source;
+  }
+  int64_t wall_offset_ms = EpochMs() - MonotonicMs();
+
+  if (requery) {
+    std::deque<uint64_t> rows;
+    std::deque<float> row_top(1, 0.0f);
+    for (size_t r = 0; r < layout.rows.size(); r++) {
+      if (!LogLineMatches(query, log, log_lower, layout.rows[r],
+                          wall_offset_ms, line))
+        continue;
+      rows.push_back(layout.rows[r]);
+      row_top.push_back(row_top.back() + layout.row_top[r + 1] -
+                        layout.row_top[r]);
+    }
+    layout.rows.swap(rows);
+    layout.row_top.swap(row_top);
+    layout.filter = filter;
+    layout.query = std::move(query);
+  }
+
+  for (uint64_t seq = layout.next_seq; seq < end_seq; seq++) {
+    if (!LogLineMatches(layout.query, log, log_lower, seq, wall_offset_ms,
+                        line))
+      continue;
+    std::string_view text = LogLineAt(log, seq);
+    float height = line_height;
+    if (wrap_width > 0.0f && !text.empty())
+      height = ImGui::CalcTextSize(text.data(), text.data() + text.size(),
+                                   false, wrap_width)
+                   .y;
+    layout.rows.push_back(seq);
+    layout.row_top.push_back(layout.row_top.back() + height + row_gap);
+  }
+  layout.next_seq = end_seq;
+}
+
+// Row index of the current search match, or -1 if there is none
+static int LogSearchCursorRow(const LogViewLayout &layout) {
+  if (!layout.has_cursor)
+    return -1;
+  auto it = std::lower_bound(layout.rows.begin(), layout.rows.end(),
+                             layout.cursor_seq);
+  if (it == layout.rows.end() || *it != layout.cursor_seq)
+    return -1;
+  return (int)(it - layout.rows.begin());
+}
+
+// Move the search cursor to the next (dir > 0) or previous match, wrapping
+// around at either end, and ask the view to scroll to it
+static void StepLogSearch(LogViewLayout &layout, int dir) {
+  if (layout.rows.empty())
+    return;
+  size_t n = layout.rows.size();
+  size_t r;
+  if (!layout.has_cursor) {
+    r = dir > 0 ? 0 : n - 1;
+  } else if (dir > 0) {
+    r = std::upper_bound(layout.rows.begin(), layout.rows.end(),
+                         layout.cursor_seq) -
+        layout.rows.begin();
+    if (r == n)
+      r = 0;
+  } else {
+    r = std::lower_bound(layout.rows.begin(), layout.rows.end(),
+                         layout.cursor_seq) -
+        layout.rows.begin();
+    r = r == 0 ? n - 1 : r - 1;
+  }
+  layout.has_cursor = true;
+  layout.cursor_seq = layout.rows[r];
+  layout.scroll_to_cursor = true;
+}
+
+// How a log view labels its rows with the time their line was read
+enum class LogTimeMode { Off, Relative, Absolute };
+
+// Time column options of a log view; rows read after more than gap_ms of
+// silence are marked (0 = never)
+struct LogTimeView {
+  LogTimeMode mode = LogTimeMode::Off;
+  int64_t gap_ms = 0;
+  int64_t wall_offset_ms = 0; // EpochMs() - MonotonicMs() this frame
+};
+
+// Local wall-clock time of epoch_ms as "14:02:03.456"
+static void FormatClockMs(char *out, size_t size, long long epoch_ms) {
+  time_t secs = (time_t)(epoch_ms / 1000);
+  struct tm tm_buf;
+#ifdef _WIN32
+  localtime_s(&tm_buf, &secs);
+#else
+  localtime_r(&secs, &tm_buf);
+#endif
+  snprintf(out, size, "%02d:%02d:%02d.%03lld", tm_buf.tm_hour, tm_buf.tm_min,
+           tm_buf.tm_sec, epoch_ms % 1000);
+}
+
+// Row i's read time as "+01:02:03.456" since the log's first line, or the
+// local wall-clock time
+static void FormatLogTime(char *out, size_t size, const LogArena &log,
+                          size_t i, const LogTimeView &times) {
+  int64_t ms = log.Time(i);
+  if (times.mode == LogTimeMode::Absolute) {
+    FormatClockMs(out, size, ms + times.wall_offset_ms);
+    return;
+  }
+  long long d = std::max<long long>(0, ms - log.FirstTime());
+  snprintf(out, size, "+%02lld:%02lld:%02lld.%03lld", d / 3600000,
+           d / 60000 % 60, d / 1000 % 60, d % 1000);
+}
+
+// Width the time column takes, label and gap included
+static float LogTimeColumnWidth(const LogTimeView &times) {
+  if (times.mode == LogTimeMode::Off)
+    return 0.0f;
+  return ImGui::CalcTextSize("+00:00:00.000").x +
+         ImGui::GetStyle().ItemSpacing.x * 2.0f;
+}
+
+// One log row, drawn from the layout's glyph run cache: the line is laid out
+// the first time it is drawn at the current wrap width and replayed after.
+// With a time column, the row's read time is drawn in front of it, and a
+// row that ended a silence longer than the gap threshold gets a rule above
+// it and its time in the warning color.
+static void RenderLogRow(const LogArena &log, LogViewLayout &layout, size_t r,
+                         bool is_cursor, const LogTimeView &times) {
+  size_t i = (size_t)(layout.rows[r] - (log.TotalAppended() - log.size()));
+  std::string_view line = log[i];
+  ImDrawList *draw = ImGui::GetWindowDrawList();
+  ImVec2 p = ImGui::GetCursorScreenPos();
+  float height = layout.row_top[r + 1] - layout.row_top[r] - layout.row_gap;
+  if (is_cursor) {
+    draw->AddRectFilled(
+        p, ImVec2(p.x + ImGui::GetContentRegionAvail().x, p.y + height),
+        ImGui::GetColorU32(ImGuiCol_TextSelectedBg));
+  }
+  float column = LogTimeColumnWidth(times);
+  if (column > 0.0f) {
+    char label[32];
+    FormatLogTime(label, sizeof(label), log, i, times);
+    int64_t quiet = i > 0 ? log.QuietBefore(i) : 0;
+    bool gap = times.gap_ms > 0 && quiet >= times.gap_ms;
+    ImU32 warn = ImGui::GetColorU32(LogLineColor(LogSeverity::Warning));
+    if (gap) {
+      float y = p.y - layout.row_gap * 0.5f;
+      draw->AddLine(ImVec2(p.x, y),
+                    ImVec2(p.x + ImGui::GetContentRegionAvail().x, y), warn);
+    }
+    draw->AddText(p, gap ? warn : ImGui::GetColorU32(ImGuiCol_TextDisabled),
+                  label);
+    if (gap && ImGui::IsMouseHoveringRect(p, ImVec2(p.x + column,
+                                                     p.y + height)))
+      ImGui::SetTooltip("No output for %s before this line",
+                        FormatDuration(quiet / 1000).c_str());
+    p.x += column;
+    ImGui::SetCursorScreenPos(p);
+  }
+  ImU32 color = ImGui::GetColorU32(LogLineColor((LogSeverity)log.Tag(i)));
+  ImVec2 size = layout.glyphs.Draw(draw, layout.rows[r], line, p,
+                                   layout.wrap_width, color);
+  uint32_t count = log.Count(i);
+  if (count > 1) {
+    // Repeat counter after the end of the row's last visual line
+    char badge[24];
+    snprintf(badge, sizeof(badge), "x%u", count);
+    float line_height = ImGui::GetTextLineHeight();
+    ImVec2 at(p.x + size.x + ImGui::GetStyle().ItemSpacing.x,
+              p.y + std::max(0.0f, size.y - line_height));
+    draw->AddText(at, ImGui::GetColorU32(ImGuiCol_TextDisabled), badge);
+  }
+  ImGui::Dummy(size);
+}
+
+// Unwrapped log rows read on demand: the clipper addresses any row by index
+// and only the visible lines are fetched through read_row(row, line) and
+// classified for color. cursor_row is highlighted; scroll_to_row (or -1)
+// brings a row into view.
+template <typename ReadRow>
+static void RenderMappedLogRows(uint64_t row_count, ReadRow &&read_row,
+                                const LogClassifier *classifier,
+                                int64_t cursor_row, int64_t scroll_to_row) {
+  if (scroll_to_row >= 0) {
+    float row_height =
+        ImGui::GetTextLineHeight() + ImGui::GetStyle().ItemSpacing.y;
+    ImGui::SetScrollY(ImGui::GetCursorPosY() + scroll_to_row * row_height -
+                      ImGui::GetWindowHeight() * 0.3f);
+  }
+  ImGuiListClipper clipper;
+  clipper.Begin((int)std::min<uint64_t>(row_count, INT_MAX));
+  while (clipper.Step()) {
+    for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; r++) {
+      std::string_view line;
+      if (!read_row((uint64_t)r, line)) {
+        ImGui::TextDisabled("(unavailable)");
+        continue;
+      }
+      if (r == cursor_row) {
+        ImVec2 p = ImGui::GetCursorScreenPos();
+        ImGui::GetWindowDrawList()->AddRectFilled(
+            p,
+            ImVec2(p.x + ImGui::GetContentRegionAvail().x,
+                   p.y + ImGui::GetTextLineHeight()),
+            ImGui::GetColorU32(ImGuiCol_TextSelectedBg));
+      }
+      LogSeverity severity =
+          classifier ? classifier->Classify(line) : LogSeverity::None;
+      ImGuiStyleColorScope _col(ImGuiCol_Text, LogLineColor(severity));
+      ImGui::TextUnformatted(line.data(), line.data() + line.size());
+    }
+  }
+}
+
+// Full task history straight from the spool file, paged in through the
+// spool's mapped window
+static void RenderTaskLogHistory(TaskInstance &task, bool auto_scroll) {
+  ImGuiChildScope _tasklog("TaskLogHistory", ImVec2(0, 0), true,
+                           ImGuiWindowFlags_HorizontalScrollbar);
+  ImGuiStyleVarScope _sv(ImGuiStyleVar_ItemSpacing, ImVec2(4, 2));
+
+  RenderMappedLogRows(
+      task.spool->LineCount(),
+      [&task](uint64_t r, std::string_view &line) {
+        return task.spool->ReadLine(r, line);
+      },
+      task.classifier.get(), -1, -1);
+
+  if (auto_scroll && task.is_running &&
+      ImGui::GetScrollY() >= ImGui::GetScrollMaxY() - 10.0f) {
+    ImGui::SetScrollHereY(1.0f);
+  }
+}
+
+// Live log viewer. Only the rows inside the scroll window are submitted, so
+// the cost per frame depends on the window height rather than the log size.
+// Unwrapped rows all have the same height and go through ImGuiListClipper;
+// wrapped rows are placed from the measured row offsets in layout. follow
+// keeps the view pinned to the newest line while it is scrolled to the end;
+// filter is a LogQuery over the lines of task's log.
+static void RenderLogArenaView(const char *id, const LogArena &log,
+                               const LogArena &log_lower,
+                               LogViewLayout &layout,
+                               const std::string &filter,
+                               TaskInstance *task, bool wrap_lines,
+                               bool follow, const LogTimeView &times) {
+  ProfileZone _zone("Log viewer");
+  ImGuiChildScope _tasklog(id, ImVec2(0, 0), true,
+                           wrap_lines ? 0
+                                      : ImGuiWindowFlags_HorizontalScrollbar);
+  ImGuiStyleVarScope _sv(ImGuiStyleVar_ItemSpacing, ImVec2(4, 2));
+
+  float row_gap = ImGui::GetStyle().ItemSpacing.y;
+  float wrap_width =
+      wrap_lines ? std::max(1.0f, ImGui::GetContentRegionAvail().x -
+                                      LogTimeColumnWidth(times))
+                 : 0.0f;
+  UpdateLogViewLayout(layout, log, log_lower, filter, task, wrap_width,
+                      row_gap);
+
+  int cursor_row = LogSearchCursorRow(layout);
+  if (cursor_row < 0)
+    layout.has_cursor = false;
+  float origin_y = ImGui::GetCursorPosY();
+  float base = layout.row_top.front();
+  bool jumped = false;
+  if (layout.scroll_to_cursor) {
+    layout.scroll_to_cursor = false;
+    if (cursor_row >= 0) {
+      ImGui::SetScrollY(origin_y + layout.row_top[cursor_row] - base -
+                        ImGui::GetWindowHeight() * 0.3f);
+      jumped = true;
+    }
+  }
+
+  if (!wrap_lines) {
+    ImGuiListClipper clipper;
+    clipper.Begin((int)layout.rows.size());
+    while (clipper.Step()) {
+      for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; r++)
+        RenderLogRow(log, layout, r, r == cursor_row, times);
+    }
+  } else if (!layout.rows.empty()) {
+    float view_top = ImGui::GetScrollY() - origin_y + base;
+    float view_bottom = view_top + ImGui::GetWindowHeight();
+
+    // First row whose bottom edge is below the top of the view
+    size_t r = std::upper_bound(layout.row_top.begin() + 1,
+                                layout.row_top.end(), view_top) -
+               (layout.row_top.begin() + 1);
+    for (; r < layout.rows.size() && layout.row_top[r] < view_bottom; r++) {
+      ImGui::SetCursorPosY(origin_y + layout.row_top[r] - base);
+      RenderLogRow(log, layout, r, (int)r == cursor_row, times);
+    }
+
+    // Reserve the full height so the scrollbar covers every row
+    ImGui::SetCursorPosY(origin_y + layout.row_top.back() - base - row_gap);
+    ImGui::Dummy(ImVec2(0.0f, 0.0f));
+  }
+
+  // Auto-scroll, unless a search jump just moved the view
+  if (follow && !jumped &&
+      ImGui::GetScrollY() >= ImGui::GetScrollMaxY() - 10.0f) {
+    ImGui::SetScrollHereY(1.0f);
+  }
+}
+
+static void RenderTaskLogView(TaskInstance &task, bool wrap_lines,
+                              bool auto_scroll, const LogTimeView &times) {
+  RenderLogArenaView("TaskLogArea", task.log_output, task.log_lower,
+                     task.log_view, task.log_search_filter, &task,
+                     wrap_lines, auto_scroll && task.is_running, times);
+}
+
+// The read time of every spooled line, for a log bundle: one
+// "line<TAB>clock time<TAB>ms since the first line" row per line of
+// output.log, numbered from 1. Runs on the export thread.
+static std::string FormatSpoolTimes(const LogSpool &spool,
+                                    long long wall_offset_ms) {
+  std::vector<int64_t> times;
+  spool.LineTimes(0, spool.LineCount(), times);
+  std::string out = "line\tclock\telapsed_ms\n";
+  out.reserve(out.size() + times.size() * 32);
+  char clock[32], row[96];
+  for (size_t i = 0; i < times.size(); i++) {
+    FormatClockMs(clock, sizeof(clock), times[i] + wall_offset_ms);
+    snprintf(row, sizeof(row), "%zu\t%s\t%lld\n", i + 1, clock,
+             (long long)(times[i] - times[0]));
+    out += row;
+  }
+  return out;
+}
+
+// The "All Tasks" view: the output of several tasks merged into one stream
+// by read time, a k-way merge over their log windows with a min-heap keyed
+// by each task's next unmerged row. Every frame only the rows that arrived
+// since the last one are merged and appended, so nothing already merged is
+// sorted again. The stream is rebuilt from the windows when the selection
+// or the query changes, a task goes away, or a task's window was reloaded
+// (its rows then come in with older times).
+class MergedTaskLog {
+public:
+  static constexpr size_t kMaxRows = 2 * kTaskLogMaxLines;
+
+  struct Row {
+    uint32_t source; // index into sources()
+    uint64_t seq;    // log sequence number within that task's window
+  };
+
+  struct Source {
+    std::weak_ptr<TaskInstance> task;
+    int id = 0;
+    std::string name;
+    std::string lower_name; // for task: terms
+    ImU32 color = 0;
+    uint64_t next_seq = 0; // first row not merged yet
+    int64_t last_ms = 0;   // time of the newest merged row
+  };
+
+  // Bring the stream up to date with the tasks' windows; filter is a
+  // LogQuery, where task: picks tasks by name
+  void Update(const TaskList &tasks, const std::string &filter) {
+    bool rebuild = filter != query_.text();
+    size_t shown = 0;
+    for (const auto &task : tasks) {
+      if (hidden_.count(task->id))
+        continue;
+      if (shown >= sources_.size() || sources_[shown].id != task->id ||
+          sources_[shown].task.expired())
+        rebuild = true;
+      shown++;
+    }
+    if (rebuild || shown != sources_.size() || !Merge()) {
+      sources_.clear();
+      rows_.clear();
+      if (filter != query_.text()) {
+        error_.clear();
+        query_.Compile(filter, EpochMs(), &error_);
+      }
+      for (const auto &task : tasks) {
+        if (hidden_.count(task->id))
+          continue;
+        Source s;
+        s.task = task;
+        s.id = task->id;
+        s.name = task->name;
+        s.lower_name = task->name;
+        std::transform(s.lower_name.begin(), s.lower_name.end(),
+                       s.lower_name.begin(), ::tolower);
+        s.color = TaskColor(task->id);
+        s.next_seq = task->log_output.TotalAppended() -
+                     task->log_output.size();
+        sources_.push_back(s);
+      }
+      Merge();
+    }
+  }
+
+  bool Hidden(int id) const { return hidden_.count(id) != 0; }
+  void SetHidden(int id, bool hidden) {
+    if (hidden)
+      hidden_.insert(id);
+    else
+      hidden_.erase(id);
+  }
+
+  const std::deque<Row> &rows() const { return rows_; }
+  const std::vector<Source> &sources() const { return sources_; }
+  // Why the query did not compile ("" when it did)
+  const std::string &error() const { return error_; }
+
+  // A tag color per task, spread around the hue circle
+  static ImU32 TaskColor(int id) {
+    float h = std::fmod(0.13f + 0.618034f * (float)id, 1.0f);
+    return ImColor::HSV(h, 0.55f, 0.95f);
+  }
+
+private:
+  // Merge every source's rows past next_seq. Returns false when a source's
+  // rows went back in time, which needs a rebuild.
+  bool Merge() {
+    // (time of the source's next row, source)
+    typedef std::pair<int64_t, uint32_t> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+    std::vector<std::shared_ptr<TaskInstance>> live(sources_.size());
+    // Each source's timeline, copied when the query has phase terms
+    std::vector<std::vector<PhaseTiming>> phases(sources_.size());
+    for (uint32_t s = 0; s < sources_.size(); s++) {
+      live[s] = sources_[s].task.lock();
+      if (!live[s])
+        continue;
+      if (query_.UsesTime()) {
+        std::lock_guard<std::mutex> lock(live[s]->timeline_mutex);
+        phases[s] = live[s]->timeline;
+      }
+      const LogArena &log = live[s]->log_output;
+      uint64_t first = log.TotalAppended() - log.size();
+      Source &src = sources_[s];
+      src.next_seq = std::max(src.next_seq, first);
+      if (src.next_seq >= log.TotalAppended())
+        continue;
+      int64_t ms = log.Time((size_t)(src.next_seq - first));
+      if (ms < src.last_ms)
+        return false;
+      heap.push({ms, s});
+    }
+    int64_t wall_offset_ms = EpochMs() - MonotonicMs();
+    while (!heap.empty()) {
+      Head head = heap.top();
+      heap.pop();
+      Source &src = sources_[head.second];
+      const TaskInstance *task = live[head.second].get();
+      const LogArena &log = task->log_output;
+      size_t i = (size_t)(src.next_seq - (log.TotalAppended() - log.size()));
+      LogQueryLine line;
+      line.phases = query_.UsesTime() ? &phases[head.second] : nullptr;
+      line.source = &src.lower_name;
+      if (LogLineMatches(query_, log, task->log_lower, src.next_seq,
+                         wall_offset_ms, line))
+        rows_.push_back({head.second, src.next_seq});
+      src.last_ms = head.first;
+      src.next_seq++;
+      if (src.next_seq < log.TotalAppended())
+        heap.push({log.TimeAfter(i, head.first), head.second});
+    }
+    while (rows_.size() > kMaxRows)
+      rows_.pop_front();
+    return true;
+  }
+
+  std::vector<Source> sources_;
+  std::deque<Row> rows_;
+  std::set<int> hidden_; // ids of the tasks left out
+  LogQuery query_;
+  std::string error_;
+};
+
+static MergedTaskLog g_merged_log;
+
+// The All Tasks tab: a toggle per task in its tag color, a filter, and the
+// merged stream, one unwrapped row per line through ImGuiListClipper
+static void RenderMergedTaskLog(AppState &state, const TaskList &tasks) {
+  ProfileZone _zone("Merged log");
+  ImGui::Text("Tasks:");
+  for (const auto &task : tasks) {
+    ImGui::SameLine();
+    bool shown = !g_merged_log.Hidden(task->id);
+    ImGuiStyleColorScope _col(ImGuiCol_Text, ImGui::ColorConvertU32ToFloat4(
+                                                 MergedTaskLog::TaskColor(
+                                                     task->id)));
+    if (ImGui::Checkbox(FrameText("%s##merged%d", task->name.c_str(),
+                                  task->id),
+                        &shown))
+      g_merged_log.SetHidden(task->id, !shown);
+  }
+  ImGui::Text("Filter:");
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(300);
+  static char filter_buf[256] = "";
+  ImGui::InputText("##mergedfilter", filter_buf, sizeof(filter_buf));
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip("%s", kLogQueryHelp);
+  ImGui::SameLine();
+  static bool follow = true;
+  ImGui::Checkbox("Auto-scroll##merged", &follow);
+
+  // Keep the windows in memory while they are shown here
+  for (const auto &task : tasks) {
+    if (g_merged_log.Hidden(task->id))
+      continue;
+    FaultInTaskLogs(*task);
+    task->last_viewed_frame = ImGui::GetFrameCount();
+  }
+  g_merged_log.Update(tasks, filter_buf);
+
+  const auto &rows = g_merged_log.rows();
+  const auto &sources = g_merged_log.sources();
+  ImGui::SameLine();
+  ImGui::TextDisabled("| %zu lines", rows.size());
+  if (!g_merged_log.error().empty()) {
+    ImGui::SameLine();
+    ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s",
+                       g_merged_log.error().c_str());
+  }
+
+  float name_width = 0.0f;
+  for (const auto &src : sources)
+    name_width = std::max(name_width, ImGui::CalcTextSize(src.name.c_str()).x);
+  name_width = std::min(name_width, 220.0f);
+  float time_width = ImGui::CalcTextSize("00:00:00.000").x;
+  float spacing = ImGui::GetStyle().ItemSpacing.x * 2.0f;
+  long long wall_offset = EpochMs() - MonotonicMs();
+  int64_t gap_ms = state.log_gap_seconds * 1000LL;
+
+  ImGuiChildScope _child("MergedLogArea", ImVec2(0, 0), true,
+                         ImGuiWindowFlags_HorizontalScrollbar);
+  ImGuiStyleVarScope _sv(ImGuiStyleVar_ItemSpacing, ImVec2(4, 2));
+  ImDrawList *draw = ImGui::GetWindowDrawList();
+  ImGuiListClipper clipper;
+  clipper.Begin((int)rows.size());
+  int64_t prev_ms = 0;
+  while (clipper.Step()) {
+    for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; r++) {
+      const MergedTaskLog::Row &row = rows[(size_t)r];
+      const MergedTaskLog::Source &src = sources[row.source];
+      std::shared_ptr<TaskInstance> task = src.task.lock();
+      ImVec2 p = ImGui::GetCursorScreenPos();
+      const LogArena *log = task ? &task->log_output : nullptr;
+      uint64_t first = log ? log->TotalAppended() - log->size() : 0;
+      if (!log || row.seq < first || row.seq >= log->TotalAppended()) {
+        ImGui::TextDisabled("(line no longer held in memory)");
+        continue;
+      }
+      size_t i = (size_t)(row.seq - first);
+      int64_t ms = log->Time(i);
+      // A silence across all the shown tasks, not just one of them
+      if (r > clipper.DisplayStart && gap_ms > 0 && ms - prev_ms >= gap_ms)
+        draw->AddLine(ImVec2(p.x, p.y - 1.0f),
+                      ImVec2(p.x + ImGui::GetContentRegionAvail().x,
+                             p.y - 1.0f),
+                      ImGui::GetColorU32(LogLineColor(LogSeverity::Warning)));
+      prev_ms = ms;
+      ImGui::PushClipRect(p, ImVec2(p.x + name_width, p.y + 1000.0f), true);
+      draw->AddText(p, src.color, src.name.c_str());
+      ImGui::PopClipRect();
+      char clock[32];
+      FormatClockMs(clock, sizeof(clock), ms + wall_offset);
+      draw->AddText(ImVec2(p.x + name_width + spacing, p.y),
+                    ImGui::GetColorU32(ImGuiCol_TextDisabled), clock);
+      ImGui::SetCursorScreenPos(
+          ImVec2(p.x + name_width + time_width + spacing * 2.0f, p.y));
+      std::string_view line = log->operator[](i);
+      ImGuiStyleColorScope _col(
+          ImGuiCol_Text, LogLineColor((LogSeverity)log->Tag(i)));
+      ImGui::TextUnformatted(line.data(), line.data() + line.size());
+      if (log->Count(i) > 1) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("x%u", log->Count(i));
+      }
+    }
+  }
+  if (follow && ImGui::GetScrollY() >= ImGui::GetScrollMaxY() - 10.0f)
+    ImGui::SetScrollHereY(1.0f);
+}
+
+// "350ms" or "4.2s" below ten seconds, FormatDuration above
+static std::string FormatPhaseMs(long long ms) {
+  char buf[32];
+  if (ms < 1000)
+    snprintf(buf, sizeof(buf), "%lldms", std::max(0LL, ms));
+  else if (ms < 10000)
+    snprintf(buf, sizeof(buf), "%.1fs", ms / 1000.0);
+  else
+    return FormatDuration(ms / 1000);
+  return buf;
+}
+
+// Time spent per phase name, longest first. Unfinished phases count up to
+// now_ms, or not at all when it is 0.
+static std::vector<std::pair<std::string, long long>>
+PhaseTotals(const std::vector<PhaseTiming> &phases, long long now_ms) {
+  std::map<std::string, long long> by_name;
+  for (const auto &phase : phases) {
+    long long end = phase.end_ms != 0 ? phase.end_ms : now_ms;
+    if (end != 0)
+      by_name[phase.name] += std::max(0LL, end - phase.start_ms);
+  }
+  std::vector<std::pair<std::string, long long>> totals(by_name.begin(),
+                                                        by_name.end());
+  std::stable_sort(totals.begin(), totals.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.second > b.second;
+                   });
+  return totals;
+}
+
+// Where the task's run spends its time: the slowest phases, then one row per
+// timed phase with a bar placed on the span of the whole timeline; hovering
+// a phase's time shows what passed runs of the task usually spent in it
+static void RenderTaskTimeline(TaskInstance &task) {
+  std::vector<PhaseTiming> timeline;
+  {
+    std::lock_guard<std::mutex> lock(task.timeline_mutex);
+    timeline = task.timeline;
+  }
+  ImGuiChildScope _timeline("TaskTimeline", ImVec2(0, 0), true);
+  if (timeline.empty()) {
+    ImGui::TextDisabled("No timed phases yet");
+    return;
+  }
+  bool running = task.is_running;
+  long long now = running ? EpochMs() : 0;
+  long long first = timeline.front().start_ms;
+  long long last = first;
+  for (const auto &phase : timeline) {
+    first = std::min(first, phase.start_ms);
+    last = std::max(last, phase.end_ms != 0 ? phase.end_ms
+                                            : std::max(now, phase.start_ms));
+  }
+  long long span = std::max(1LL, last - first);
+
+  auto totals = PhaseTotals(timeline, now);
+  ImGui::Text("Timed: %s over %zu phases", FormatPhaseMs(span).c_str(),
+              timeline.size());
+  for (size_t i = 0; i < totals.size() && i < 3; i++) {
+    ImGui::SameLine();
+    ImGui::TextDisabled("| %s %s (%d%%)", totals[i].first.c_str(),
+                        FormatPhaseMs(totals[i].second).c_str(),
+                        (int)(totals[i].second * 100 / span));
+  }
+  ImGui::Separator();
+
+  const float name_width = 190.0f;
+  const float offset_width = 80.0f;
+  const float time_width = 90.0f;
+  float line = ImGui::GetTextLineHeight();
+  std::string task_name = TaskBaseName(task.group);
+  ImGuiListClipper clipper;
+  clipper.Begin((int)timeline.size());
+  while (clipper.Step()) {
+    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+      const PhaseTiming &phase = timeline[i];
+      bool open = phase.end_ms == 0;
+      ImVec4 color = phase.exit_code != 0 ? LogLineColor(LogSeverity::Error)
+                     : open && running    ? ImVec4(1.0f, 0.8f, 0.3f, 1.0f)
+                                          : ImGui::GetStyleColorVec4(
+                                                ImGuiCol_Text);
+      float x = ImGui::GetCursorPosX();
+      ImGui::TextColored(color, "%s", phase.name.c_str());
+      ImGui::SameLine(x + name_width);
+      ImGui::TextDisabled("+%s",
+                          FormatPhaseMs(phase.start_ms - first).c_str());
+      ImGui::SameLine(x + name_width + offset_width);
+      long long end = open ? std::max(now, phase.start_ms) : phase.end_ms;
+      if (open && !running)
+        ImGui::TextDisabled("unfinished");
+      else
+        ImGui::Text("%s%s", FormatPhaseMs(end - phase.start_ms).c_str(),
+                    open ? "..." : "");
+      if (ImGui::IsItemHovered()) {
+        double usual = g_durations.ExpectedPhase(
+            task_name, CatalogMode(task.task_type), phase.name);
+        if (phase.exit_code != 0)
+          ImGui::SetTooltip("Exit code %d", phase.exit_code);
+        else if (usual >= 0.0)
+          ImGui::SetTooltip("Usually %s",
+                            FormatPhaseMs((long long)(usual * 1000)).c_str());
+      }
+      ImGui::SameLine(x + name_width + offset_width + time_width);
+      ImVec2 origin = ImGui::GetCursorScreenPos();
+      float width = std::max(20.0f, ImGui::GetContentRegionAvail().x);
+      float x0 = origin.x + width * (float)(phase.start_ms - first) / span;
+      float x1 = origin.x + width * (float)(end - first) / span;
+      ImGui::GetWindowDrawList()->AddRectFilled(
+          ImVec2(x0, origin.y + 2), ImVec2(std::max(x1, x0 + 2.0f),
+                                           origin.y + line - 2),
+          ImGui::GetColorU32(phase.exit_code != 0
+                                 ? ImVec4(0.8f, 0.3f, 0.3f, 1.0f)
+                                 : ImVec4(0.3f, 0.6f, 0.9f, 1.0f)));
+      ImGui::Dummy(ImVec2(width, line));
+    }
+  }
+}
+
+// Stage a step is grouped under in the Build Steps pane
+static std::string BuildStageLabel(const BuildStep &step) {
+  if (!step.stage.empty())
+    return step.stage;
+  return step.count > 0 ? "Dockerfile" : "Build";
+}
+
+// The BuildKit steps of the task's phase logs as a tree of builds, stages
+// and steps, with each step's duration drawn against the slowest step of
+// its build. Clicking a step shows its log with the search set to its #N.
+static void RenderTaskBuildSteps(
+    TaskInstance &task,
+    const std::vector<std::shared_ptr<PhaseLog>> &phase_logs) {
+  ImGuiChildScope _steps("TaskBuildSteps", ImVec2(0, 0), true);
+  bool running = task.is_running;
+  int64_t now = MonotonicMs();
+  const float state_width = 80.0f;
+  const float time_width = 80.0f;
+  const float bar_width = 140.0f;
+  float line = ImGui::GetTextLineHeight();
+  for (size_t l = 0; l < phase_logs.size(); l++) {
+    PhaseLog &log = *phase_logs[l];
+    std::vector<BuildStep> steps;
+    int builds;
+    {
+      std::lock_guard<std::mutex> lock(log.steps_mutex);
+      steps = log.build_steps.steps();
+      builds = log.build_steps.builds();
+    }
+    ImGui::PushID((int)l);
+    for (int b = 0; b < builds; b++) {
+      // Steps of this build by stage, stages in the order they started
+      std::vector<std::pair<std::string, std::vector<size_t>>> stages;
+      int64_t slowest = 1, total = 0;
+      size_t slowest_step = 0;
+      int cached = 0, failed = 0, steps_in_build = 0;
+      for (size_t i = 0; i < steps.size(); i++) {
+        const BuildStep &step = steps[i];
+        if (step.build != b)
+          continue;
+        std::string stage = BuildStageLabel(step);
+        auto it = std::find_if(stages.begin(), stages.end(),
+                               [&](const auto &s) { return s.first == stage; });
+        if (it == stages.end())
+          it = stages.insert(stages.end(), {stage, {}});
+        it->second.push_back(i);
+        int64_t ms = step.DurationMs(now);
+        if (ms > slowest || steps_in_build == 0) {
+          slowest = std::max<int64_t>(1, ms);
+          slowest_step = i;
+        }
+        total += ms;
+        steps_in_build++;
+        cached += step.state == BuildStep::Cached;
+        failed += step.state == BuildStep::Error;
+      }
+      if (steps_in_build == 0)
+        continue;
+      const char *header =
+          builds > 1 ? FrameText("%s - build %d###build", log.name.c_str(),
+                                 b + 1)
+                     : FrameConcat({log.name, "###build"});
+      ImGui::PushID(b);
+      bool open = ImGui::CollapsingHeader(
+          header, b == builds - 1 ? ImGuiTreeNodeFlags_DefaultOpen : 0);
+      ImGui::SameLine();
+      ImGui::TextDisabled("%d steps, %d cached%s | slowest: %s (%s)",
+                          steps_in_build, cached,
+                          failed > 0 ? ", failed" : "",
+                          steps[slowest_step].name.c_str(),
+                          FormatPhaseMs(slowest).c_str());
+      if (open) {
+        for (const auto &stage : stages) {
+          int64_t stage_ms = 0;
+          int stage_cached = 0;
+          for (size_t i : stage.second) {
+            stage_ms += steps[i].DurationMs(now);
+            stage_cached += steps[i].state == BuildStep::Cached;
+          }
+          const char *cached_text =
+              stage_cached > 0 ? FrameText(", %d cached", stage_cached) : "";
+          const char *label = FrameText(
+              "%s (%zu steps, %s%s)###%s", stage.first.c_str(),
+              stage.second.size(), FormatPhaseMs(stage_ms).c_str(),
+              cached_text, stage.first.c_str());
+          if (!ImGui::TreeNodeEx(label, ImGuiTreeNodeFlags_DefaultOpen))
+            continue;
+          for (size_t i : stage.second) {
+            const BuildStep &step = steps[i];
+            ImGui::PushID((int)i);
+            float x = ImGui::GetCursorPosX();
+            switch (step.state) {
+            case BuildStep::Running:
+              if (running)
+                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.3f, 1.0f), "RUNNING");
+              else
+                ImGui::TextDisabled("unfinished");
+              break;
+            case BuildStep::Done:
+              ImGui::Text("DONE");
+              break;
+            case BuildStep::Cached:
+              ImGui::TextColored(ImVec4(0.4f, 0.8f, 0.4f, 1.0f), "CACHED");
+              break;
+            case BuildStep::Error:
+              ImGui::TextColored(LogLineColor(LogSeverity::Error), "ERROR");
+              break;
+            case BuildStep::Canceled:
+              ImGui::TextDisabled("CANCELED");
+              break;
+            }
+            ImGui::SameLine(x + state_width);
+            int64_t ms = step.DurationMs(now);
+            if (step.state == BuildStep::Cached)
+              ImGui::TextDisabled("-");
+            else
+              ImGui::Text("%s%s", FormatPhaseMs(ms).c_str(),
+                          step.Finished() ? "" : "...");
+            ImGui::SameLine(x + state_width + time_width);
+            ImVec2 origin = ImGui::GetCursorScreenPos();
+            float x1 = origin.x + bar_width * (float)ms / (float)slowest;
+            ImGui::GetWindowDrawList()->AddRectFilled(
+                ImVec2(origin.x, origin.y + 2),
+                ImVec2(std::max(x1, origin.x + 2.0f), origin.y + line - 2),
+                ImGui::GetColorU32(step.state == BuildStep::Error
+                                       ? ImVec4(0.8f, 0.3f, 0.3f, 1.0f)
+                                       : ImVec4(0.3f, 0.6f, 0.9f, 1.0f)));
+            ImGui::Dummy(ImVec2(bar_width, line));
+            ImGui::SameLine(x + state_width + time_width + bar_width + 8.0f);
+            if (ImGui::Selectable(step.name.c_str())) {
+              task.select_pane = (int)l;
+              task.log_search_filter =
+                  "\"#" + std::to_string(step.id) + " \"";
+            }
+            if (ImGui::IsItemHovered()) {
+              std::string tip = "#" + std::to_string(step.id) + ", lines " +
+                                std::to_string(step.first_line) + "-" +
+                                std::to_string(step.last_line) + " (" +
+                                std::to_string(step.output_lines) +
+                                " of output)";
+              if (step.seconds >= 0.0)
+                tip += "\nBuildKit reported " + FormatPhaseMs(ms);
+              if (!step.error.empty())
+                tip += "\n" + step.error;
+              tip += "\nClick to show its lines in " + log.name;
+              ImGui::SetTooltip("%s", tip.c_str());
+            }
+            ImGui::PopID();
+          }
+          ImGui::TreePop();
+        }
+      }
+      ImGui::PopID();
+    }
+    ImGui::PopID();
+  }
+}
+
+// The task container's CPU, memory, network and disk use over the run, as
+// sampled by g_resource_sampler; I/O is plotted as MiB/s between samples
+static void RenderTaskResources(TaskInstance &task) {
+  std::string container;
+  ResourceSeries series;
+  {
+    std::lock_guard<std::mutex> lock(task.resources_mutex);
+    container = task.container;
+    series = task.resources;
+  }
+  ImGuiChildScope _resources("TaskResources", ImVec2(0, 0), true);
+  const std::vector<ResourceSample> &samples = series.samples();
+  ResourceSample last = series.Last();
+  const double mib = 1024.0 * 1024.0;
+  ImGui::Text("Container: %s", container.c_str());
+  ImGui::SameLine();
+  ImGui::TextDisabled("| sampled up to +%s",
+                      FormatDuration((long long)last.t).c_str());
+  ImGui::Text("CPU %.0f%% (peak %.0f%%)", last.cpu_pct, series.PeakCpuPct());
+  ImGui::SameLine();
+  ImGui::Text("| Memory %s (peak %s)",
+              FormatDockerSize(last.mem_mib * mib).c_str(),
+              FormatDockerSize(series.PeakMemMib() * mib).c_str());
+  ImGui::Text("Network in %s / out %s",
+              FormatDockerSize(last.net_rx_mib * mib).c_str(),
+              FormatDockerSize(last.net_tx_mib * mib).c_str());
+  ImGui::SameLine();
+  ImGui::Text("| Disk read %s / write %s",
+              FormatDockerSize(last.blk_read_mib * mib).c_str(),
+              FormatDockerSize(last.blk_write_mib * mib).c_str());
+  if (samples.size() < 2) {
+    ImGui::TextDisabled("Collecting samples...");
+    return;
+  }
+  ImGui::Separator();
+
+  std::vector<float> cpu, mem, net, disk;
+  float max_net = 0.0f, max_disk = 0.0f;
+  for (size_t i = 0; i < samples.size(); i++) {
+    const ResourceSample &a = samples[i > 0 ? i - 1 : 0];
+    const ResourceSample &b = samples[i];
+    float dt = std::max(0.001f, b.t - a.t);
+    cpu.push_back(b.cpu_pct);
+    mem.push_back(b.mem_mib);
+    // Counters restart with a new container; treat that as no traffic
+    net.push_back(std::max(0.0f, (b.net_rx_mib + b.net_tx_mib -
+                                  a.net_rx_mib - a.net_tx_mib) /
+                                     dt));
+    disk.push_back(std::max(0.0f, (b.blk_read_mib + b.blk_write_mib -
+                                   a.blk_read_mib - a.blk_write_mib) /
+                                      dt));
+    max_net = std::max(max_net, net.back());
+    max_disk = std::max(max_disk, disk.back());
+  }
+  float width = ImGui::GetContentRegionAvail().x;
+  float height =
+      std::max(50.0f, (ImGui::GetContentRegionAvail().y -
+                       4 * ImGui::GetStyle().ItemSpacing.y) /
+                          4);
+  char overlay[64];
+  snprintf(overlay, sizeof(overlay), "CPU %% (peak %.0f)",
+           series.PeakCpuPct());
+  ImGui::PlotLines("##cpu", cpu.data(), (int)cpu.size(), 0, overlay, 0.0f,
+                   std::max(100.0f, series.PeakCpuPct()),
+                   ImVec2(width, height));
+  snprintf(overlay, sizeof(overlay), "Memory MiB (peak %.0f)",
+           series.PeakMemMib());
+  ImGui::PlotLines("##mem", mem.data(), (int)mem.size(), 0, overlay, 0.0f,
+                   std::max(1.0f, series.PeakMemMib()), ImVec2(width, height));
+  snprintf(overlay, sizeof(overlay), "Network MiB/s (peak %.2f)", max_net);
+  ImGui::PlotLines("##net", net.data(), (int)net.size(), 0, overlay, 0.0f,
+                   std::max(0.01f, max_net), ImVec2(width, height));
+  snprintf(overlay, sizeof(overlay), "Disk MiB/s (peak %.2f)", max_disk);
+  ImGui::PlotLines("##disk", disk.data(), (int)disk.size(), 0, overlay, 0.0f,
+                   std::max(0.01f, max_disk), ImVec2(width, height));
+}
+
+// Compact "~1h 05m" / "~3m 20s" / "~40s" rendering of a delay
+static std::string FormatEta(double secs) {
+  int total = (int)(secs + 0.5);
+  char buf[32];
+  if (total >= 3600)
+    snprintf(buf, sizeof(buf), "~%dh %02dm", total / 3600, (total / 60) % 60);
+  else if (total >= 60)
+    snprintf(buf, sizeof(buf), "~%dm %02ds", total / 60, total % 60);
+  else
+    snprintf(buf, sizeof(buf), "~%ds", total);
+  return buf;
+}
+
+// Queued runs in dispatch order, with estimated start and run times and a
+// cancel button per run
+static void RenderTaskQueue(AppState &state) {
+  std::vector<QueuedTask> queue;
+  std::vector<size_t> order;
+  std::vector<double> starts;
+  std::vector<double> durations;
+  const char *hold = nullptr;
+  if (state.queued_tasks.load() == 0)
+    return;
+  {
+    std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+    if (state.task_queue.empty())
+      return;
+    starts = EstimateQueueStartsLocked(state, order, durations);
+    queue = state.task_queue;
+    hold = state.scheduler_hold;
+  }
+
+  if (!ImGui::CollapsingHeader(
+          FrameText("Queued (%zu)###task_queue", queue.size()),
+          ImGuiTreeNodeFlags_DefaultOpen))
+    return;
+
+  if (hold)
+    ImGui::TextDisabled("Waiting: %s", hold);
+
+  uint64_t cancel_seq = 0;
+  bool cancel = false;
+  float list_height =
+      std::min(8, (int)queue.size()) * ImGui::GetFrameHeightWithSpacing() +
+      ImGui::GetStyle().WindowPadding.y * 2;
+  {
+    ImGuiChildScope _queue("TaskQueueList", ImVec2(0, list_height), true);
+    for (size_t k = 0; k < order.size(); k++) {
+      const QueuedTask &job = queue[order[k]];
+      ImGui::PushID((int)job.seq);
+      ImGui::TextDisabled("%2d.", (int)k + 1);
+      ImGui::SameLine();
+      ImGui::TextUnformatted(job.name.c_str());
+      ImGui::SameLine();
+      if (job.deferred) {
+        ImGui::TextDisabled("(deferred for the API quota)");
+      } else if (starts[k] < 0.0) {
+        ImGui::TextDisabled("(waiting for a slot)");
+      } else if (starts[k] < 1.0) {
+        ImGui::TextDisabled("(next)");
+      } else {
+        ImGui::TextDisabled("(starts in %s)", FormatEta(starts[k]).c_str());
+      }
+      if (durations[k] >= 0.0) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("runs %s", FormatEta(durations[k]).c_str());
+      }
+      switch (g_build_farm.StateOf(job.group)) {
+      case ImageBuildFarm::State::Building:
+        ImGui::SameLine();
+        ImGui::TextDisabled("- image building");
+        break;
+      case ImageBuildFarm::State::Ready:
+        ImGui::SameLine();
+        ImGui::TextDisabled("- image ready");
+        break;
+      case ImageBuildFarm::State::Failed:
+        ImGui::SameLine();
+        ImGui::TextDisabled("- image build failed");
+        break;
+      default:
+        break;
+      }
+      ImGui::SameLine();
+      if (ImGui::SmallButton("Cancel")) {
+        cancel = true;
+        cancel_seq = job.seq;
+      }
+      ImGui::PopID();
+    }
+  }
+
+  if (cancel) {
+    std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+    auto &q = state.task_queue;
+    q.erase(std::remove_if(q.begin(), q.end(),
+                           [cancel_seq](const QueuedTask &job) {
+                             return job.seq == cancel_seq;
+                           }),
+            q.end());
+    PublishQueueLocked(state);
+  }
+  ImGui::Spacing();
+}
+
+// Progress of the Run Multiple batches that have a stop rule, a priority or
+// a deadline and of the variants of a prompt matrix: results so far, the
+// pass rate interval, when it is due and, once the rule was met, why and
+// how many runs it cancelled
+static void RenderRunBatches(AppState &state) {
+  if (state.run_batch_count.load() == 0)
+    return;
+  std::vector<RunBatch> batches;
+  {
+    std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+    for (const auto &entry : state.run_batches)
+      batches.push_back(entry.second);
+  }
+  for (const RunBatch &batch : batches) {
+    int done = batch.passed + batch.failed;
+    ImGui::Text("%s: %d passed, %d failed of %d", batch.name.c_str(),
+                batch.passed, batch.failed, batch.runs);
+    if (batch.urgency != BatchUrgency::Normal) {
+      ImGui::SameLine();
+      ImGui::TextDisabled(batch.urgency == BatchUrgency::High ? "[high]"
+                                                              : "[low]");
+    }
+    if (batch.deadline != 0 && done < batch.runs) {
+      double left = difftime(batch.deadline, time(nullptr));
+      ImGui::SameLine();
+      if (left > 0.0)
+        ImGui::TextDisabled("due in %s", FormatEta(left).c_str());
+      else
+        ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.3f, 1.0f),
+                           "past its deadline");
+    }
+    if (done > 0) {
+      double low, high;
+      PassRateInterval(batch.passed, done, low, high);
+      ImGui::SameLine();
+      ImGui::TextDisabled("(pass rate %.0f%%, 95%%: %.0f-%.0f%%)",
+                          100.0 * batch.passed / done, low * 100.0,
+                          high * 100.0);
+    }
+    if (!batch.stop_reason.empty()) {
+      ImGui::SameLine();
+      ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f),
+                         "stopped early: %s, %d run(s) cancelled",
+                         batch.stop_reason.c_str(), batch.cancelled);
+    }
+  }
+  ImGui::Spacing();
+}
+
+// Compacted tasks, newest first, each with a button that opens it again
+static void RenderTaskSummaries(AppState &state) {
+  if (state.task_summary_count.load() == 0)
+    return;
+  if (!ImGui::CollapsingHeader(
+          FrameText("Finished (%d)###task_summaries",
+                    (int)state.task_summary_count.load())))
+    return;
+  int count = state.task_summary_count.load();
+  int reopen = 0;
+  float list_height =
+      std::min(8, count) * ImGui::GetFrameHeightWithSpacing() +
+      ImGui::GetStyle().WindowPadding.y * 2;
+  {
+    ImGuiChildScope _list("TaskSummaryList", ImVec2(0, list_height), true);
+    ImGuiListClipper clipper;
+    clipper.Begin(count);
+    std::vector<TaskSummary> rows;
+    while (clipper.Step()) {
+      // Only the rows drawn are copied out
+      rows.clear();
+      {
+        std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+        const auto &all = state.task_summaries;
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+          if ((size_t)i < all.size())
+            rows.push_back(all[all.size() - 1 - i]);
+        }
+      }
+      for (const TaskSummary &summary : rows) {
+        ImGui::PushID(summary.id);
+        if (ImGui::SmallButton("Open"))
+          reopen = summary.id;
+        ImGui::SameLine();
+        if (summary.stopped)
+          ImGui::TextDisabled("[Stopped]");
+        else if (summary.exit_code == 0)
+          ImGui::TextColored(ImVec4(0.2f, 0.8f, 0.2f, 1.0f), "[Passed]");
+        else
+          ImGui::TextColored(LogLineColor(LogSeverity::Error), "[Failed]");
+        ImGui::SameLine();
+        ImGui::TextUnformatted(summary.name.c_str());
+        ImGui::SameLine();
+        ImGui::TextDisabled(
+            "%s", FormatDuration((long long)summary.run_seconds).c_str());
+        std::string headline = summary.failure.Headline();
+        if (!headline.empty()) {
+          ImGui::SameLine();
+          ImGui::TextDisabled("- %s", headline.c_str());
+        }
+        ImGui::PopID();
+      }
+    }
+  }
+  if (reopen != 0) {
+    ReopenTaskSummary(state, reopen);
+    state.switch_to_logs_tab = true;
+  }
+  ImGui::Spacing();
+}
+
+// Task tabs kept open next to the navigator; pinning another closes the
+// one pinned longest ago
+static const size_t kMaxPinnedTaskTabs = 8;
+
+// Give a task a tab in the Logs tab and bring it up
+static void PinTaskTab(AppState &state, int task_id) {
+  std::vector<int> &pinned = state.pinned_task_tabs;
+  if (std::find(pinned.begin(), pinned.end(), task_id) == pinned.end()) {
+    pinned.push_back(task_id);
+    if (pinned.size() > kMaxPinnedTaskTabs)
+      pinned.erase(pinned.begin());
+  }
+  state.select_task_tab = task_id;
+}
+
+// The task of a snapshot with this id, or null; tasks are kept in id order
+static std::shared_ptr<TaskInstance> FindTaskInView(const TaskList &tasks,
+                                                    int id) {
+  auto it = std::lower_bound(tasks.begin(), tasks.end(), id,
+                             [](const std::shared_ptr<TaskInstance> &t,
+                                int task_id) { return t->id < task_id; });
+  if (it == tasks.end() || (*it)->id != id)
+    return nullptr;
+  return *it;
+}
+
+// Where a task is, as the navigator shows and sorts it
+enum class TaskStatus : uint8_t { Creating, Running, Failed, Stopped, Passed };
+
+static TaskStatus StatusOfTask(const TaskInstance &task) {
+  if (task.is_running)
+    return task.container_created.load() ? TaskStatus::Running
+                                         : TaskStatus::Creating;
+  if (task.should_stop)
+    return TaskStatus::Stopped;
+  if (task.exit_code.load() != 0 || task.container_lost.load())
+    return TaskStatus::Failed;
+  return TaskStatus::Passed;
+}
+
+// Seconds a task has run so far, or ran for
+static double TaskSeconds(const TaskInstance &task,
+                          std::chrono::steady_clock::time_point now) {
+  double seconds = task.run_seconds.load();
+  if (seconds >= 0.0)
+    return seconds;
+  if (!task.is_running)
+    return 0.0;
+  return std::chrono::duration<double>(now - task.started_at).count();
+}
+
+// Every task of the snapshot in one sortable table, drawn through
+// ImGuiListClipper so that a batch of hundreds costs only the rows on
+// screen. The order is sorted again when the snapshot or the sort changes,
+// and once a second for the columns that move on their own (status,
+// duration, errors). Clicking a row pins the task's tab; its context menu
+// removes the task (into tasks_to_remove) unless it is still running.
+static void RenderTaskNavigator(AppState &state,
+                                const std::shared_ptr<const TaskList> &view,
+                                std::vector<int> &tasks_to_remove) {
+  enum Column { kId, kName, kStatus, kMode, kDuration, kErrors, kColumns };
+  struct Row {
+    TaskInstance *task;
+    TaskStatus status;
+    double seconds;
+    uint64_t errors;
+  };
+  // The rows in table order; view keeps the tasks they point to alive
+  static struct {
+    std::shared_ptr<const TaskList> view;
+    std::vector<Row> rows;
+    double sorted_at = -1e9;
+  } order;
+
+  const ImGuiTableFlags kFlags =
+      ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY |
+      ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_Resizable |
+      ImGuiTableFlags_Sortable | ImGuiTableFlags_SortTristate;
+  if (!ImGui::BeginTable("##task_navigator", kColumns, kFlags))
+    return;
+  ImGui::TableSetupScrollFreeze(0, 1);
+  ImGui::TableSetupColumn("#",
+                          ImGuiTableColumnFlags_DefaultSort |
+                              ImGuiTableColumnFlags_PreferSortDescending,
+                          0.0f, kId);
+  ImGui::TableSetupColumn("Task", ImGuiTableColumnFlags_WidthStretch, 0.0f,
+                          kName);
+  ImGui::TableSetupColumn("Status", 0, 0.0f, kStatus);
+  ImGui::TableSetupColumn("Mode", 0, 0.0f, kMode);
+  ImGui::TableSetupColumn("Duration", 0, 0.0f, kDuration);
+  ImGui::TableSetupColumn("Errors", 0, 0.0f, kErrors);
+  ImGui::TableHeadersRow();
+
+  ImGuiTableSortSpecs *specs = ImGui::TableGetSortSpecs();
+  double now_s = ImGui::GetTime();
+  bool resort = order.view != view || now_s - order.sorted_at >= 1.0;
+  if (specs && specs->SpecsDirty) {
+    resort = true;
+    specs->SpecsDirty = false;
+  }
+  if (resort) {
+    auto now = std::chrono::steady_clock::now();
+    order.view = view;
+    order.sorted_at = now_s;
+    order.rows.clear();
+    order.rows.reserve(view->size());
+    for (const auto &task : *view)
+      order.rows.push_back(
+          {task.get(), StatusOfTask(*task), TaskSeconds(*task, now),
+           task->severity_counts[(size_t)LogSeverity::Error]});
+    int column = kId;
+    bool descending = false;
+    if (specs && specs->SpecsCount > 0) {
+      column = (int)specs->Specs[0].ColumnUserID;
+      descending =
+          specs->Specs[0].SortDirection == ImGuiSortDirection_Descending;
+    }
+    // Ties keep id order, so rows do not trade places between sorts
+    auto less = [column](const Row &a, const Row &b) {
+      switch (column) {
+      case kName:
+        return a.task->name < b.task->name;
+      case kStatus:
+        return a.status < b.status;
+      case kMode:
+        return a.task->task_type < b.task->task_type;
+      case kDuration:
+        return a.seconds < b.seconds;
+      case kErrors:
+        return a.errors < b.errors;
+      default:
+        return a.task->id < b.task->id;
+      }
+    };
+    std::stable_sort(order.rows.begin(), order.rows.end(),
+                     [&](const Row &a, const Row &b) {
+                       return descending ? less(b, a) : less(a, b);
+                     });
+  }
+
+  static const char *const kStatusNames[] = {"Creating container", "Running",
+                                             "Failed", "Stopped", "Passed"};
+  ImGuiListClipper clipper;
+  clipper.Begin((int)order.rows.size());
+  while (clipper.Step()) {
+    for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+      const Row &row = order.rows[r];
+      TaskInstance &task = *row.task;
+      ImGui::PushID(task.id);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      bool pinned = std::find(state.pinned_task_tabs.begin(),
+                              state.pinned_task_tabs.end(),
+                              task.id) != state.pinned_task_tabs.end();
+      if (ImGui::Selectable(FrameText("%d", task.id), pinned,
+                            ImGuiSelectableFlags_SpanAllColumns))
+        PinTaskTab(state, task.id);
+      if (ImGui::BeginPopupContextItem("##task_row")) {
+        if (ImGui::MenuItem("Open tab"))
+          PinTaskTab(state, task.id);
+        if (ImGui::MenuItem("Remove")) {
+          if (task.is_running)
+            state.show_cannot_close_popup = true;
+          else
+            tasks_to_remove.push_back(task.id);
+        }
+        ImGui::EndPopup();
+      }
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(task.name.c_str());
+      ImGui::TableNextColumn();
+      const char *status = kStatusNames[(size_t)row.status];
+      switch (row.status) {
+      case TaskStatus::Running:
+        ImGui::TextColored(ImVec4(0.2f, 0.8f, 0.2f, 1.0f), "%s", status);
+        break;
+      case TaskStatus::Failed:
+        ImGui::TextColored(LogLineColor(LogSeverity::Error), "%s", status);
+        break;
+      default:
+        ImGui::TextDisabled("%s", status);
+        break;
+      }
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(task.task_type.c_str());
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(FormatDuration((long long)row.seconds).c_str());
+      ImGui::TableNextColumn();
+      if (row.errors > 0)
+        ImGui::TextColored(LogLineColor(LogSeverity::Error), "%llu",
+                           (unsigned long long)row.errors);
+      ImGui::PopID();
+    }
+  }
+  ImGui::EndTable();
+}
+
+// Diffs kept by CachedLineDiff (one per prompt tab is plenty)
+static const size_t kDiffCacheSize = 4;
+// Texts up to this size (both together) are diffed within the frame;
+// larger ones on the job pool
+static const size_t kDiffSyncBytes = 32 * 1024;
+
+// The diff of two texts, recomputed only when either text changes. Results
+// are keyed by content hash and the most recently used few are kept. A
+// large diff is computed as an interactive job while the previous diff is
+// returned (null when there is none yet); a newer pair of texts cancels the
+// job still pending for the older one.
+static std::shared_ptr<const LineDiff>
+CachedLineDiff(const std::string &original, const std::string &modified) {
+  struct Entry {
+    size_t orig_hash, mod_hash;
+    size_t orig_size, mod_size;
+    std::shared_ptr<const LineDiff> diff;
+
+    bool Same(const Entry &o) const {
+      return orig_hash == o.orig_hash && mod_hash == o.mod_hash &&
+             orig_size == o.orig_size && mod_size == o.mod_size;
+    }
+  };
+  static std::vector<Entry> cache; // most recently used first
+  static Entry pending = {};       // key of the diff on the pool
+  static CancelToken pending_token;
+  static bool computing = false;
+  auto insert = [](const Entry &e) {
+    cache.insert(cache.begin(), e);
+    if (cache.size() > kDiffCacheSize)
+      cache.pop_back();
+  };
+  std::hash<std::string_view> hash;
+  Entry key = {hash(original), hash(modified), original.size(),
+               modified.size(), nullptr};
+  for (size_t i = 0; i < cache.size(); i++) {
+    if (cache[i].Same(key)) {
+      std::rotate(cache.begin(), cache.begin() + i, cache.begin() + i + 1);
+      return cache.front().diff;
+    }
+  }
+  if (original.size() + modified.size() <= kDiffSyncBytes) {
+    key.diff =
+        std::make_shared<LineDiff>(ComputeLineDiff(original, modified));
+    insert(key);
+    return cache.front().diff;
+  }
+  if (!computing || !pending.Same(key)) {
+    pending_token.Cancel();
+    pending = key;
+    computing = true;
+    pending_token = g_jobs.Submit(
+        JobLane::Compute, JobPriority::Interactive,
+        [key, original, modified, insert](const CancelToken &token) {
+          auto diff = std::make_shared<const LineDiff>(
+              ComputeLineDiff(original, modified));
+          g_jobs.Post([key, diff, token, insert]() {
+            if (token.Cancelled())
+              return;
+            Entry e = key;
+            e.diff = diff;
+            insert(e);
+            computing = false;
+          });
+        });
+  }
+  return cache.empty() ? nullptr : cache.front().diff;
+}
+
+// Unchanged lines kept around each change, and the fewest hidden lines worth
+// a fold row
+static const int kDiffContextLines = 3;
+static const int kDiffMinFold = 4;
+
+// One visual row of the diff view: a line of the diff (part 1 and 2 are the
+// removed and added halves of a MODIFIED line in the unified view), or a
+// fold standing for `hidden` unchanged lines starting at `line`
+struct DiffRow {
+  int line;
+  int hidden;
+  int part;
+};
+
+// Per diff view: the rows for the current diff and fold state, and their
+// heights for the width they were laid out at. Only rebuilt when the diff,
+// the folds, the mode or the width change.
+struct DiffViewCache {
+  std::shared_ptr<const LineDiff> diff;
+  std::vector<int> expanded; // first hidden line of each opened fold
+  bool split = true;
+  bool rows_valid = false;
+  std::vector<DiffRow> rows;
+  float layout_width = -1.0f;
+  float layout_font = 0.0f;
+  bool layout_wrap = false;
+  std::vector<float> offsets; // top of each row, plus the total height
+  float content_width = 0.0f;
+  // Split view: the sides scroll together. A side that moved leaves its
+  // position for the other one, applied before that side is next drawn.
+  float scroll_y = 0.0f;
+  float pending_scroll = -1.0f;
+  int pending_side = 0;
+  int digits = 4; // of the gutter's line numbers
+  // Laid-out line text per side (the unified view uses the first), keyed by
+  // line index * 2 + (1 for the modified text); reset with the diff
+  GlyphRunCache glyphs[2];
+};
+
+static void BuildDiffRows(DiffViewCache &view) {
+  const std::vector<DiffLine> &lines = view.diff->lines;
+  view.rows.clear();
+  auto push = [&](int i) {
+    if (lines[i].skipped > 0) {
+      view.rows.push_back({i, lines[i].skipped, 0}); // a fold that stays
+    } else if (!view.split && lines[i].type == DiffLine::MODIFIED) {
+      view.rows.push_back({i, 0, 1});
+      view.rows.push_back({i, 0, 2});
+    } else {
+      view.rows.push_back({i, 0, 0});
+    }
+  };
+  int n = (int)lines.size();
+  bool fold = !view.diff->hunks.empty(); // an unchanged text stays visible
+  for (int i = 0; i < n;) {
+    if (lines[i].type != DiffLine::UNCHANGED) {
+      push(i++);
+      continue;
+    }
+    int j = i;
+    while (j < n && lines[j].type == DiffLine::UNCHANGED)
+      j++;
+    int head = i == 0 ? 0 : kDiffContextLines;
+    int tail = j == n ? 0 : kDiffContextLines;
+    int hidden = (j - i) - head - tail;
+    int first = i + head;
+    if (fold && hidden >= kDiffMinFold &&
+        std::find(view.expanded.begin(), view.expanded.end(), first) ==
+            view.expanded.end()) {
+      for (int k = i; k < first; k++)
+        push(k);
+      view.rows.push_back({first, hidden, 0});
+      for (int k = first + hidden; k < j; k++)
+        push(k);
+    } else {
+      for (int k = i; k < j; k++)
+        push(k);
+    }
+    i = j;
+  }
+  view.rows_valid = true;
+  view.layout_width = -1.0f;
+}
+
+// Walk text the way the diff view draws it: fn(begin, end, line) for each
+// visual line when wrapping at wrap_width (0: no wrapping). Returns the
+// number of lines.
+template <typename Fn>
+static int ForEachDiffTextLine(const char *begin, const char *end,
+                               float wrap_width, Fn fn) {
+  ImFont *font = ImGui::GetFont();
+  float scale = ImGui::GetFontSize() / font->FontSize;
+  int line = 0;
+  const char *s = begin;
+  do {
+    const char *eol =
+        wrap_width > 0.0f ? font->CalcWordWrapPositionA(scale, s, end,
+                                                        wrap_width)
+                          : end;
+    fn(s, eol, line++);
+    s = eol;
+    while (s < end && (*s == ' ' || *s == '\t'))
+      s++;
+  } while (s < end);
+  return line;
+}
+
+// The text a row shows on one side (0 original, 1 modified); null when the
+// line is not on that side
+static const std::string *DiffRowText(const DiffViewCache &view,
+                                      const DiffRow &row, int side,
+                                      const std::vector<DiffSpan> **spans) {
+  const DiffLine &line = view.diff->lines[row.line];
+  if (!view.split)
+    side = row.part == 1 ? 0
+           : row.part == 2 ? 1
+           : line.type == DiffLine::ADDED ? 1
+                                          : 0;
+  bool present = side == 0 ? line.type != DiffLine::ADDED
+                           : line.type != DiffLine::REMOVED;
+  if (!present)
+    return nullptr;
+  if (spans)
+    *spans = line.type != DiffLine::MODIFIED ? nullptr
+             : side == 0                     ? &line.orig_spans
+                                             : &line.mod_spans;
+  return side == 0 ? &line.orig_text : &line.mod_text;
+}
+
+// Row heights for wrapping at text_width (or the widest line without
+// wrapping)
+static void LayoutDiffRows(DiffViewCache &view, float text_width, bool wrap) {
+  float font = ImGui::GetFontSize();
+  if (view.layout_width == text_width && view.layout_wrap == wrap &&
+      view.layout_font == font)
+    return;
+  view.layout_width = text_width;
+  view.layout_wrap = wrap;
+  view.layout_font = font;
+  float line_h = ImGui::GetTextLineHeight();
+  view.offsets.assign(1, 0.0f);
+  view.content_width = 0.0f;
+  for (const auto &row : view.rows) {
+    int lines = 1;
+    if (row.hidden == 0) {
+      for (int side = 0; side < (view.split ? 2 : 1); side++) {
+        const std::string *text = DiffRowText(view, row, side, nullptr);
+        if (!text)
+          continue;
+        if (wrap) {
+          lines = std::max(lines, ForEachDiffTextLine(
+                                      text->data(), text->data() + text->size(),
+                                      text_width,
+                                      [](const char *, const char *, int) {}));
+        } else {
+          view.content_width = std::max(
+              view.content_width,
+              ImGui::CalcTextSize(text->data(), text->data() + text->size())
+                  .x);
+        }
+      }
+    }
+    view.offsets.push_back(view.offsets.back() + lines * line_h);
+  }
+}
+
+static DiffViewCache &GetDiffViewCache(int id,
+                                       std::shared_ptr<const LineDiff> diff,
+                                       bool split) {
+  static std::map<int, DiffViewCache> views;
+  DiffViewCache &view = views[id];
+  if (view.diff != diff) {
+    view.diff = std::move(diff);
+    view.expanded.clear();
+    view.rows_valid = false;
+    int last = 0;
+    for (const DiffLine &line : view.diff->lines)
+      last = std::max({last, line.orig_line_num + line.skipped,
+                       line.mod_line_num + line.skipped});
+    view.digits = std::max(4, (int)std::to_string(last).size());
+    for (GlyphRunCache &glyphs : view.glyphs)
+      glyphs.Reset();
+  }
+  if (view.split != split) {
+    view.split = split;
+    view.rows_valid = false;
+  }
+  if (!view.rows_valid)
+    BuildDiffRows(view);
+  return view;
+}
+
+// Colors of the diff view
+struct DiffPalette {
+  ImU32 added_bg, added_text, added_changed;
+  ImU32 removed_bg, removed_text, removed_changed;
+  ImU32 line_num, unchanged, fold_bg, fold_hover, fold_text;
+};
+
+// Draw the visible rows of one side of the view (side -1 is the unified
+// view) into the current child window, whose content is text_x of gutter
+// followed by text wrapped at wrap_width (0: not wrapped)
+static void RenderDiffRows(DiffViewCache &view, int side, float text_x,
+                           float wrap_width, const DiffPalette &colors) {
+  ImDrawList *draw = ImGui::GetWindowDrawList();
+  GlyphRunCache &glyphs = view.glyphs[side > 0 ? 1 : 0];
+  float row_w = std::max(ImGui::GetContentRegionAvail().x,
+                         text_x + view.content_width);
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  float top = ImGui::GetScrollY();
+  float bottom = top + ImGui::GetWindowHeight();
+  const std::vector<float> &offsets = view.offsets;
+  size_t first =
+      std::upper_bound(offsets.begin(), offsets.end(), top) - offsets.begin();
+  first = first > 0 ? first - 1 : 0;
+
+  for (size_t r = first; r < view.rows.size() && offsets[r] < bottom; r++) {
+    const DiffRow &row = view.rows[r];
+    ImVec2 pos(origin.x, origin.y + offsets[r]);
+    float h = offsets[r + 1] - offsets[r];
+    if (row.hidden > 0) {
+      ImGui::SetCursorScreenPos(pos);
+      ImGui::PushID(row.line);
+      bool open = ImGui::InvisibleButton("##fold", ImVec2(row_w, h));
+      bool hovered = ImGui::IsItemHovered();
+      ImGui::PopID();
+      bool skipped = view.diff->lines[row.line].skipped > 0;
+      draw->AddRectFilled(pos, ImVec2(pos.x + row_w, pos.y + h),
+                          hovered && !skipped ? colors.fold_hover
+                                              : colors.fold_bg);
+      char label[64];
+      snprintf(label, sizeof(label), "... %d unchanged lines", row.hidden);
+      draw->AddText(ImVec2(pos.x + text_x, pos.y), colors.fold_text, label);
+      if (hovered && skipped)
+        ImGui::SetTooltip("Left out of the comparison to keep it small");
+      if (open && !skipped) {
+        view.expanded.push_back(row.line);
+        view.rows_valid = false;
+      }
+      continue;
+    }
+
+    const DiffLine &line = view.diff->lines[row.line];
+    const std::vector<DiffSpan> *spans = nullptr;
+    const std::string *text =
+        DiffRowText(view, row, side < 0 ? 0 : side, &spans);
+    if (!text)
+      continue; // blank on this side
+    bool removed = side < 0 ? (row.part == 1 || line.type == DiffLine::REMOVED)
+                            : (side == 0 && line.type != DiffLine::UNCHANGED);
+    bool added = side < 0 ? (row.part == 2 || line.type == DiffLine::ADDED)
+                          : (side == 1 && line.type != DiffLine::UNCHANGED);
+    if (removed || added)
+      draw->AddRectFilled(pos, ImVec2(pos.x + row_w, pos.y + h),
+                          removed ? colors.removed_bg : colors.added_bg);
+
+    char gutter[32];
+    int digits = view.digits;
+    if (side >= 0)
+      snprintf(gutter, sizeof(gutter), "%*d %c", digits,
+               side == 0 ? line.orig_line_num : line.mod_line_num,
+               removed ? '-' : added ? '+' : ' ');
+    else if (removed)
+      snprintf(gutter, sizeof(gutter), "%*d %*s -", digits,
+               line.orig_line_num, digits, "");
+    else if (added)
+      snprintf(gutter, sizeof(gutter), "%*s %*d +", digits, "", digits,
+               line.mod_line_num);
+    else
+      snprintf(gutter, sizeof(gutter), "%*d %*d  ", digits,
+               line.orig_line_num, digits, line.mod_line_num);
+    draw->AddText(pos, colors.line_num, gutter);
+
+    ImU32 color = removed ? colors.removed_text
+                  : added ? colors.added_text
+                          : colors.unchanged;
+    ImU32 changed = removed ? colors.removed_changed : colors.added_changed;
+    uint64_t id = (uint64_t)row.line * 2 + (text == &line.mod_text ? 1 : 0);
+    ImVec2 at(pos.x + text_x, pos.y);
+    if (!spans) {
+      glyphs.Draw(draw, id, *text, at, wrap_width, color);
+      continue;
+    }
+    // Glyph offsets only increase, so the span walk never goes back
+    size_t span = 0;
+    glyphs.Draw(draw, id, *text, at, wrap_width, [&](uint32_t offset) {
+      while (span < spans->size() &&
+             offset >= (*spans)[span].start + (*spans)[span].length)
+        span++;
+      return span < spans->size() && offset >= (*spans)[span].start &&
+                     (*spans)[span].changed
+                 ? changed
+                 : color;
+    });
+  }
+  // Reserve the full content area for the scrollbars
+  ImGui::SetCursorScreenPos(origin);
+  ImGui::Dummy(ImVec2(text_x + view.content_width, offsets.back()));
+}
+
+// The panes of a diff view, split or unified and wrapped as the toolbar
+// set them, height tall; id keys the view's folds and scroll position
+static void RenderDiffPanes(AppState &state,
+                            std::shared_ptr<const LineDiff> diff, int id,
+                            float height, const char *orig_label,
+                            const char *mod_label) {
+  // Improved color scheme
+  ImVec4 color_added_bg = ImVec4(0.15f, 0.30f, 0.18f, 0.45f);
+  ImVec4 color_added_text = ImVec4(0.40f, 0.90f, 0.50f, 1.0f);
+  ImVec4 color_removed_bg = ImVec4(0.40f, 0.15f, 0.15f, 0.45f);
+  ImVec4 color_removed_text = ImVec4(1.0f, 0.40f, 0.40f, 1.0f);
+  ImVec4 color_removed_changed = ImVec4(1.0f, 0.50f, 0.50f, 1.0f);
+  ImVec4 color_added_changed = ImVec4(0.50f, 1.0f, 0.60f, 1.0f);
+  ImVec4 color_line_num = ImVec4(0.55f, 0.55f, 0.60f, 1.0f);
+  ImVec4 color_unchanged = ImVec4(0.88f, 0.88f, 0.88f, 1.0f);
+  ImVec4 color_header = ImVec4(0.75f, 0.80f, 0.95f, 1.0f);
+  ImVec4 color_fold_bg = ImVec4(0.30f, 0.35f, 0.45f, 0.25f);
+  ImVec4 color_fold_hover = ImVec4(0.30f, 0.35f, 0.45f, 0.50f);
+  auto u32 = [](const ImVec4 &c) { return ImGui::ColorConvertFloat4ToU32(c); };
+  DiffPalette colors = {u32(color_added_bg),     u32(color_added_text),
+                        u32(color_added_changed), u32(color_removed_bg),
+                        u32(color_removed_text),  u32(color_removed_changed),
+                        u32(color_line_num),      u32(color_unchanged),
+                        u32(color_fold_bg),       u32(color_fold_hover),
+                        u32(color_line_num)};
+
+  // Rows are laid out once per diff, fold state and width; each frame only
+  // draws the rows in view
+  DiffViewCache &view = GetDiffViewCache(id, diff, state.diff_split_view);
+  const ImGuiStyle &style = ImGui::GetStyle();
+  bool wrap = state.diff_wrap_lines;
+  std::string number(view.digits, '0');
+  float text_x = ImGui::CalcTextSize((state.diff_split_view
+                                          ? number + " + "
+                                          : number + " " + number + " + ")
+                                         .c_str())
+                     .x;
+  ImGuiWindowFlags child_flags =
+      wrap ? 0 : ImGuiWindowFlags_HorizontalScrollbar;
+
+  if (state.diff_split_view) {
+    // Split View Mode
+    ImGui::Columns(2, "DiffColumns", true);
+
+    ImGui::PushStyleColor(ImGuiCol_Text, color_header);
+    ImGui::Text("%s", orig_label);
+    ImGui::PopStyleColor();
+    ImGui::NextColumn();
+
+    ImGui::PushStyleColor(ImGuiCol_Text, color_header);
+    ImGui::Text("%s", mod_label);
+    ImGui::PopStyleColor();
+    ImGui::NextColumn();
+
+    ImGui::Separator();
+    ImGui::NextColumn();
+    ImGui::NextColumn();
+
+    float start_y = ImGui::GetCursorPosY();
+    float inner = ImGui::GetContentRegionAvail().x -
+                  style.WindowPadding.x * 2 - style.ScrollbarSize;
+    float wrap_width = std::max(1.0f, inner - text_x);
+    LayoutDiffRows(view, wrap ? wrap_width : 0.0f, wrap);
+    const char *names[2] = {"OriginalDiffView", "ModifiedDiffView"};
+    for (int side = 0; side < 2; side++) {
+      if (side == 1) {
+        ImGui::NextColumn();
+        ImGui::SetCursorPosY(start_y);
+      }
+      if (view.pending_scroll >= 0.0f && view.pending_side == side) {
+        ImGui::SetNextWindowScroll(ImVec2(-1.0f, view.pending_scroll));
+        view.pending_scroll = -1.0f;
+      }
+      ImGui::BeginChild(names[side], ImVec2(0, height), true, child_flags);
+      RenderDiffRows(view, side, text_x, wrap ? wrap_width : 0.0f, colors);
+      float y = ImGui::GetScrollY();
+      if (y != view.scroll_y) {
+        view.scroll_y = y;
+        view.pending_scroll = y;
+        view.pending_side = 1 - side;
+      }
+      ImGui::EndChild();
+    }
+    ImGui::Columns(1);
+  } else {
+    // Unified View Mode
+    ImGui::PushStyleColor(ImGuiCol_Text, color_header);
+    ImGui::Text("Unified Diff");
+    ImGui::PopStyleColor();
+    ImGui::Separator();
+
+    float inner = ImGui::GetContentRegionAvail().x -
+                  style.WindowPadding.x * 2 - style.ScrollbarSize;
+    float wrap_width = std::max(1.0f, inner - text_x);
+    LayoutDiffRows(view, wrap ? wrap_width : 0.0f, wrap);
+    ImGui::BeginChild("UnifiedDiffView", ImVec2(0, height), true,
+                      child_flags);
+    RenderDiffRows(view, -1, text_x, wrap ? wrap_width : 0.0f, colors);
+    ImGui::EndChild();
+  }
+}
+
+void RenderDiffView(AppState &state, const std::string &original,
+                    const std::string &modified, int prompt_index = -1) {
+  ProfileZone _zone("Diff view");
+  // Cached: only recomputed when either text changes
+  std::shared_ptr<const LineDiff> line_diff =
+      CachedLineDiff(original, modified);
+  if (!line_diff) {
+    ImGui::TextDisabled("Computing diff...");
+    return;
+  }
+
+  // Toolbar with view controls
+  if (ImGui::Button(state.diff_split_view ? "Unified View" : "Split View")) {
+    state.diff_split_view = !state.diff_split_view;
+  }
+  ImGui::SameLine();
+  if (ImGui::Checkbox("Wrap Lines", &state.diff_wrap_lines)) {
+    // Toggle handled by checkbox
+  }
+  ImGui::SameLine();
+  ImGui::TextDisabled("%zu changes: +%d -%d ~%d", line_diff->hunks.size(),
+                      line_diff->added, line_diff->removed,
+                      line_diff->modified);
+
+  // Add undo/redo/clear buttons with Font Awesome icons if prompt_index is
+  // provided
+  if (prompt_index >= 0) {
+    const PromptHistory *history = nullptr;
+    if (prompt_index == 0)
+      history = &state.prompt1_history;
+    else if (prompt_index == 1)
+      history = &state.prompt2_history;
+    else if (prompt_index == 2)
+      history = &state.audit_prompt_history;
+
+    if (history) {
+      // Push buttons to the right (4 buttons now: undo, redo, clear current,
+      // clear all)
+      float button_width = 30.0f;
+      float available_width = ImGui::GetContentRegionAvail().x;
+      ImGui::SameLine(available_width -
+                      (button_width * 4 + ImGui::GetStyle().ItemSpacing.x * 3));
+
+      // Undo button with Font Awesome icon
+      {
+        ImGuiDisabledScope disable_undo(!CanUndoPrompt(*history));
+        if (ImGui::Button(ICON_FA_ROTATE_LEFT, ImVec2(button_width, 0))) {
+          DevLog("Undo button clicked for prompt " +
+                     std::to_string(prompt_index));
+          UndoPrompt(state, prompt_index);
+        }
+      }
+      if (!CanUndoPrompt(*history) &&
+          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+        ImGui::SetTooltip("No changes to undo");
+      } else if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Undo (Ctrl+Z)");
+      }
+
+      // Redo button with Font Awesome icon
+      ImGui::SameLine();
+      {
+        ImGuiDisabledScope disable_redo(!CanRedoPrompt(*history));
+        if (ImGui::Button(ICON_FA_ROTATE_RIGHT, ImVec2(button_width, 0))) {
+          DevLog("Redo button clicked for prompt " +
+                     std::to_string(prompt_index));
+          RedoPrompt(state, prompt_index);
+        }
+      }
+      if (!CanRedoPrompt(*history) &&
+          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+        ImGui::SetTooltip("No changes to redo");
+      } else if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Redo (Ctrl+Y)");
+      }
+
+      // Clear Current State button with Font Awesome icon
+      ImGui::SameLine();
+      {
+        bool has_history =
+            history->size() > 1; // More than just current state
+        ImGuiDisabledScope disable_clear(!has_history);
+        if (ImGui::Button(ICON_FA_MINUS, ImVec2(button_width, 0))) {
+          DevLog("Clear current state button clicked for prompt " +
+                     std::to_string(prompt_index));
+          ClearCurrentPromptState(state, prompt_index);
+          SavePrompts(state);
+        }
+      }
+      if (history->size() <= 1 &&
+          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+        ImGui::SetTooltip("No current state to clear");
+      } else if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Clear current state (go back one step)");
+      }
+
+      // Clear All History for this prompt button with Font Awesome icon
+      ImGui::SameLine();
+      {
+        bool has_history =
+            history->size() > 1; // More than just current state
+        ImGuiDisabledScope disable_clear(!has_history);
+        if (ImGui::Button(ICON_FA_TRASH, ImVec2(button_width, 0))) {
+          DevLog("Clear all history button clicked for prompt " +
+                     std::to_string(prompt_index));
+          state.pending_clear_prompt_index = prompt_index;
+          state.show_confirm_clear_prompt_all_history = true;
+        }
+      }
+      if (history->size() <= 1 &&
+          ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+        ImGui::SetTooltip("No history to clear");
+      } else if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip(
+            "Clear all history for this prompt (reset to original)");
+      }
+    }
+  }
+
+  ImGui::Separator();
+  RenderDiffPanes(state, line_diff, prompt_index,
+                  state.diff_editor_splitter_height, "Original", "Modified");
+}
+
+static int PromptResizeCallback(ImGuiInputTextCallbackData *data) {
+  if (data->EventFlag == ImGuiInputTextFlags_CallbackResize) {
+    auto *text = static_cast<std::string *>(data->UserData);
+    text->resize((size_t)data->BufTextLen);
+    data->Buf = &(*text)[0];
+  }
+  return 0;
+}
+
+// A prompt editor bound straight to the prompt's string: ImGui edits the
+// string's own storage and grows it through the resize callback, so nothing
+// is copied per frame and a prompt has no length limit
+static bool InputPromptText(const char *label, std::string &text) {
+  return ImGui::InputTextMultiline(
+      label, &text[0], text.capacity() + 1, ImVec2(-1, -1),
+      ImGuiInputTextFlags_AllowTabInput | ImGuiInputTextFlags_CallbackResize,
+      PromptResizeCallback, &text);
+}
+
+void RenderPromptEditor(AppState &state) {
+  if (!state.show_prompt_editor) {
+    if (state.last_logged_editor_open) {
+      DevLog("RenderPromptEditor: Editor closed");
+      state.last_logged_editor_open = false;
+      state.last_logged_prompt_tab = -1;
+    }
+    return;
+  }
+
+  ImGuiStateTracker tracker(state);
+
+  // Only log when editor is first opened
+  if (!state.last_logged_editor_open) {
+    DevLog("RenderPromptEditor: Editor window opened");
+    state.last_logged_editor_open = true;
+  }
+
+  // Initialize history on first open
+  InitializePromptHistory(state);
+
+  ImGui::SetNextWindowSize(ImVec2(900, 700), ImGuiCond_FirstUseEver);
+  ImGuiWindowScope window("Prompt Editor", &state.show_prompt_editor, 0);
+  if (!window) {
+    DevLog("RenderPromptEditor: Window scope returned false");
+    return;
+  }
+
+  // Header with modification status and controls
+  ImGui::BeginChild("HeaderControls", ImVec2(0, 30), false,
+                    ImGuiWindowFlags_NoScrollbar |
+                        ImGuiWindowFlags_NoBackground);
+  int placeholders_far_right = 150;
+  // Status text on the left
+  ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 10.0f); // Move down 10 pixels
+  if (state.prompts_modified) {
+    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.6f, 0.0f, 1.0f));
+    ImGui::Text("Prompts have been modified");
+    placeholders_far_right = 115;
+    ImGui::PopStyleColor();
+  } else {
+    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.2f, 0.8f, 0.2f, 1.0f));
+    ImGui::Text("Using default prompts");
+    ImGui::PopStyleColor();
+  }
+
+  // Controls on the right
+  ImGui::SameLine();
+  float available_width = ImGui::GetContentRegionAvail().x;
+  ImGui::SetCursorPosX(
+      available_width -
+      placeholders_far_right); // Position controls on the right
+  ImGui::SetCursorPosY(ImGui::GetCursorPosY() -
+                       5.0f); // Reset Y position for controls
+
+  ImGui::Checkbox("Show Diff View", &state.show_diff_view);
+
+  // Clear All History button
+  ImGui::SameLine();
+  ImGui::SetCursorPosY(ImGui::GetCursorPosY() -
+                       5.0f); // Reset Y position for controls
+  {
+    bool any_history = (state.prompt1_history.size() > 1) ||
+                       (state.prompt2_history.size() > 1) ||
+                       (state.audit_prompt_history.size() > 1);
+    ImGuiDisabledScope disable_clear(!any_history);
+    if (ImGui::Button(ICON_FA_TRASH " Clear All History")) {
+      DevLog("Clear All History button clicked");
+      state.show_confirm_clear_all_history = true;
+    }
+  }
+  if ((state.prompt1_history.size() <= 1 &&
+       state.prompt2_history.size() <= 1 &&
+       state.audit_prompt_history.size() <= 1) &&
+      ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+    ImGui::SetTooltip("No history to clear");
+  } else if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("Clear history for all prompts");
+  }
+
+  ImGui::EndChild();
+
+  ImGui::Separator();
+
+  // Tab bar for different prompts
+  ImGuiTabBarScope tab_bar("PromptTabs");
+  if (tab_bar) {
+    // Prompt 1 Tab
+    {
+      ImGuiTabItemScope tab1("Prompt 1 (Feedback)");
+      if (tab1) {
+        if (state.last_logged_prompt_tab != 0) {
+          DevLog("RenderPromptEditor: Switched to Prompt 1 tab");
+          state.last_logged_prompt_tab = 0;
+        }
+        state.selected_prompt_tab = 0;
+
+        if (state.show_diff_view) {
+          ImGui::Text("Diff View:");
+          ImGui::Separator();
+          RenderDiffView(state, state.prompt1_original, state.prompt1_modified,
+                         0);
+
+          // Resizable splitter between diff view and editor
+          float editor_height = ImGui::GetContentRegionAvail().y - 50;
+          Splitter("DiffEditorSplitter1", &state.diff_editor_splitter_height,
+                   &editor_height, 100.0f, 100.0f);
+        }
+
+        ImGui::Text("Editor:");
+
+        // Calculate available height for editor (leave space for buttons)
+        float available_height = state.show_diff_view
+                                     ? ImGui::GetContentRegionAvail().y - 50
+                                     : ImGui::GetContentRegionAvail().y - 50;
+        ImGui::BeginChild("Prompt1Editor", ImVec2(0, available_height), true);
+
+        if (InputPromptText("##Prompt1", state.prompt1_modified))
+          UpdatePromptModified(state, 0);
+
+        // Push to history when user finishes editing (clicks away, etc.)
+        if (ImGui::IsItemDeactivatedAfterEdit() &&
+            !state.skip_next_history_push) {
+          PushToHistory(state.prompt1_history, state.prompt1_modified);
+          DevLog("Pushed Prompt1 edit to history");
+        }
+        if (state.skip_next_history_push) {
+          state.skip_next_history_push = false; // Reset flag
+        }
+
+        ImGui::EndChild();
+      }
+    }
+
+    // Prompt 2 Tab
+    {
+      ImGuiTabItemScope tab2("Prompt 2 (Feedback Follow-up)");
+      if (tab2) {
+        if (state.last_logged_prompt_tab != 1) {
+          DevLog("RenderPromptEditor: Switched to Prompt 2 tab");
+          DevLog("  -> Prompt2 length=" +
+                     std::to_string(state.prompt2_modified.length()));
+          state.last_logged_prompt_tab = 1;
+        }
+        state.selected_prompt_tab = 1;
+
+        if (state.show_diff_view) {
+          ImGui::Text("Diff View:");
+          ImGui::Separator();
+          RenderDiffView(state, state.prompt2_original, state.prompt2_modified,
+                         1);
+
+          // Resizable splitter between diff view and editor
+          float editor_height = ImGui::GetContentRegionAvail().y - 50;
+          Splitter("DiffEditorSplitter2", &state.diff_editor_splitter_height,
+                   &editor_height, 100.0f, 100.0f);
+
+          ImGui::Separator();
+        }
+
+        ImGui::Text("Editor:");
+
+        // Calculate available height for editor (leave space for buttons)
+        float available_height = state.show_diff_view
+                                     ? ImGui::GetContentRegionAvail().y - 50
+                                     : ImGui::GetContentRegionAvail().y - 50;
+        ImGui::BeginChild("Prompt2Editor", ImVec2(0, available_height), true);
+
+        if (InputPromptText("##Prompt2", state.prompt2_modified)) {
+          DevLog("RenderPromptEditor: Prompt2 modified by user");
+          UpdatePromptModified(state, 1);
+        }
+
+        // Push to history when user finishes editing
+        if (ImGui::IsItemDeactivatedAfterEdit() &&
+            !state.skip_next_history_push) {
+          PushToHistory(state.prompt2_history, state.prompt2_modified);
+          DevLog("Pushed Prompt2 edit to history");
+        }
+        if (state.skip_next_history_push) {
+          state.skip_next_history_push = false; // Reset flag
+        }
+
+        ImGui::EndChild();
+      }
+    }
+
+    // Audit Prompt Tab
+    {
+      ImGuiTabItemScope tab3("Audit Prompt");
+      if (tab3) {
+        if (state.last_logged_prompt_tab != 2) {
+          DevLog("RenderPromptEditor: Switched to Audit Prompt tab");
+          state.last_logged_prompt_tab = 2;
+        }
+        state.selected_prompt_tab = 2;
+
+        if (state.show_diff_view) {
+          ImGui::Text("Diff View:");
+          ImGui::Separator();
+          RenderDiffView(state, state.audit_prompt_original,
+                         state.audit_prompt_modified, 2);
+
+          // Resizable splitter between diff view and editor
+          float editor_height = ImGui::GetContentRegionAvail().y - 50;
+          Splitter("DiffEditorSplitter3", &state.diff_editor_splitter_height,
+                   &editor_height, 100.0f, 100.0f);
+
+          ImGui::Separator();
+        }
+
+        ImGui::Text("Editor:");
+
+        // Calculate available height for editor (leave space for buttons)
+        float available_height = state.show_diff_view
+                                     ? ImGui::GetContentRegionAvail().y - 50
+                                     : ImGui::GetContentRegionAvail().y - 50;
+        ImGui::BeginChild("AuditPromptEditor", ImVec2(0, available_height),
+                          true);
+
+        if (InputPromptText("##AuditPrompt", state.audit_prompt_modified))
+          UpdatePromptModified(state, 2);
+
+        // Push to history when user finishes editing
+        if (ImGui::IsItemDeactivatedAfterEdit() &&
+            !state.skip_next_history_push) {
+          PushToHistory(state.audit_prompt_history,
+                        state.audit_prompt_modified);
+          DevLog("Pushed Audit Prompt edit to history");
+        }
+        if (state.skip_next_history_push) {
+          state.skip_next_history_push = false; // Reset flag
+        }
+
+        ImGui::EndChild();
+      }
+    }
+  }
+
+  // Bottom buttons
+  ImGui::Separator();
+
+  // Validation check for all prompts
+  bool prompt1_valid = IsPromptValid(state.prompt1_modified);
+  bool prompt2_valid = IsPromptValid(state.prompt2_modified);
+  bool audit_valid = IsPromptValid(state.audit_prompt_modified);
+  bool all_valid = prompt1_valid && prompt2_valid && audit_valid;
+
+  // Show validation warnings if any prompt is invalid
+  if (!all_valid) {
+    ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.3f, 0.3f, 1.0f));
+    ImGui::Text("Warning: ");
+    ImGui::SameLine();
+    ImGui::PopStyleColor();
+
+    if (!prompt1_valid)
+      ImGui::Text("Prompt 1 is empty or contains only whitespace. ");
+    if (!prompt2_valid) {
+      ImGui::SameLine();
+      ImGui::Text("Prompt 2 is empty or contains only whitespace. ");
+    }
+    if (!audit_valid) {
+      ImGui::SameLine();
+      ImGui::Text("Audit Prompt is empty or contains only whitespace. ");
+    }
+    ImGui::Spacing();
+  }
+
+  if (ImGui::Button("Reset to Default", ImVec2(150, 0))) {
+    DevLog("RenderPromptEditor: Reset to Default clicked, tab=" +
+               std::to_string(state.selected_prompt_tab));
+    if (state.selected_prompt_tab == 0) {
+      PushToHistory(state.prompt1_history, state.prompt1_modified);
+      state.prompt1_modified = state.prompt1_original;
+      PushToHistory(state.prompt1_history, state.prompt1_modified);
+    } else if (state.selected_prompt_tab == 1) {
+      PushToHistory(state.prompt2_history, state.prompt2_modified);
+      state.prompt2_modified = state.prompt2_original;
+      PushToHistory(state.prompt2_history, state.prompt2_modified);
+    } else if (state.selected_prompt_tab == 2) {
+      PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+      state.audit_prompt_modified = state.audit_prompt_original;
+      PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+    }
+    UpdatePromptsModified(state);
+    SavePrompts(state);
+  }
+
+  ImGui::SameLine();
+  if (ImGui::Button("Reset All to Default", ImVec2(150, 0))) {
+    DevLog("RenderPromptEditor: Reset All to Default clicked");
+    PushToHistory(state.prompt1_history, state.prompt1_modified);
+    PushToHistory(state.prompt2_history, state.prompt2_modified);
+    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+
+    state.prompt1_modified = state.prompt1_original;
+    state.prompt2_modified = state.prompt2_original;
+    state.audit_prompt_modified = state.audit_prompt_original;
+
+    PushToHistory(state.prompt1_history, state.prompt1_modified);
+    PushToHistory(state.prompt2_history, state.prompt2_modified);
+    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+
+    UpdatePromptsModified(state);
+    SavePrompts(state);
+  }
+
+  ImGui::SameLine();
+
+  // Disable Save button if any prompt is invalid
+  ImGuiDisabledScope disable_save(!all_valid);
+  if (ImGui::Button("Save", ImVec2(100, 0))) {
+    DevLog("RenderPromptEditor: Save clicked");
+    PushToHistory(state.prompt1_history, state.prompt1_modified);
+    PushToHistory(state.prompt2_history, state.prompt2_modified);
+    PushToHistory(state.audit_prompt_history, state.audit_prompt_modified);
+    SavePrompts(state);
+  }
+
+  if (!all_valid && ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+    ImGui::SetTooltip("Cannot save: One or more prompts are empty");
+  }
+
+  ImGui::SameLine();
+  if (ImGui::Button("Close", ImVec2(100, 0))) {
+    DevLog("RenderPromptEditor: Close clicked");
+    state.show_prompt_editor = false;
+  }
+}
+
+// Show a log file in the built-in viewer, replacing any file already open.
+// The search term carries over to the new file.
+static void OpenLogFileViewer(AppState &state, const std::string &path) {
+  auto view = std::make_unique<LogFileView>();
+  if (!view->Open(path)) {
+    if (g_show_debug_console) {
+      ConsoleLog("[ERROR] Could not open log file: " + path);
+    }
+    return;
+  }
+  state.log_viewer = std::move(view);
+  state.log_viewer_classifier = CurrentLogClassifier();
+  state.log_viewer_cursor = -1;
+  state.log_viewer_line = -1;
+  state.log_viewer_scroll = false;
+  std::string needle = state.log_viewer_search;
+  std::transform(needle.begin(), needle.end(), needle.begin(), ::tolower);
+  state.log_viewer->Search(needle);
+}
+
+// Show line (0-based) of a log file in the viewer, unfiltered so the lines
+// around it are visible. The scroll waits until the line has been indexed.
+static void OpenLogFileViewerAt(AppState &state, const std::string &path,
+                                uint64_t line) {
+  if (!state.log_viewer_search.empty()) {
+    state.log_viewer_search.clear();
+    if (state.log_viewer)
+      state.log_viewer->Search("");
+  }
+  if (!state.log_viewer || state.log_viewer->path() != path)
+    OpenLogFileViewer(state, path);
+  if (!state.log_viewer)
+    return;
+  state.log_viewer_line = (int64_t)line;
+  state.log_viewer_scroll = true;
+}
+
+// Move the viewer's search cursor to the next (dir > 0) or previous match,
+// wrapping around at either end
+static void StepLogViewerSearch(AppState &state, int dir) {
+  int64_t n = (int64_t)state.log_viewer->MatchCount();
+  if (n == 0)
+    return;
+  int64_t &cursor = state.log_viewer_cursor;
+  if (cursor < 0 || cursor >= n)
+    cursor = dir > 0 ? 0 : n - 1;
+  else
+    cursor = (cursor + (dir > 0 ? 1 : n - 1)) % n;
+  state.log_viewer_scroll = true;
+}
+
+// Built-in log file viewer window. Rows come straight from the mapped file
+// through the same clipped row renderer as the task history, so a file of
+// any size costs only its visible lines per frame. A search shows just the
+// matching lines, like the task log.
+static void RenderLogFileViewer(AppState &state) {
+  if (!state.log_viewer)
+    return;
+  ProfileZone _zone("Log file viewer");
+  LogFileView &view = *state.log_viewer;
+  bool open = true;
+  std::string file_name = view.path();
+  size_t last_slash = file_name.find_last_of("/\\");
+  if (last_slash != std::string::npos)
+    file_name = file_name.substr(last_slash + 1);
+  std::string title = "Log Viewer - " + file_name + "###LogViewer";
+
+  ImGui::SetNextWindowSize(ImVec2(900, 600), ImGuiCond_FirstUseEver);
+  {
+    ImGuiWindowScope window(title.c_str(), &open, 0);
+    if (window) {
+      ImGui::TextDisabled("%s", view.path().c_str());
+      ImGui::Text("Lines: %llu", (unsigned long long)view.LineCount());
+      ImGui::SameLine();
+      ImGui::TextDisabled("|");
+      ImGui::SameLine();
+      ImGui::Text("%s", FormatDockerSize((double)view.Size()).c_str());
+      if (view.Archived()) {
+        ImGui::SameLine();
+        ImGui::TextDisabled(
+            "(archived, %s on disk)",
+            FormatDockerSize((double)view.FileSize()).c_str());
+      }
+      if (!view.Indexed()) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(indexing...)");
+      }
+
+      ImGui::Spacing();
+
+      // Search bar
+      bool search_changed = false;
+      ImGui::Text("Search:");
+      ImGui::SameLine();
+      ImGui::SetNextItemWidth(300);
+      char search_buf[256];
+      strncpy(search_buf, state.log_viewer_search.c_str(), sizeof(search_buf));
+      search_buf[sizeof(search_buf) - 1] = '\0';
+      if (ImGui::InputText("##viewer_search", search_buf,
+                           sizeof(search_buf))) {
+        state.log_viewer_search = search_buf;
+        search_changed = true;
+      }
+      // Enter jumps to the next match and keeps the box focused
+      if (ImGui::IsItemDeactivated() && ImGui::IsKeyPressed(ImGuiKey_Enter)) {
+        StepLogViewerSearch(state, 1);
+        ImGui::SetKeyboardFocusHere(-1);
+      }
+      ImGui::SameLine();
+      if (AnimatedButton("Clear", ImVec2(0, 0), "viewer_clear_search")) {
+        state.log_viewer_search.clear();
+        search_changed = true;
+      }
+      if (search_changed) {
+        std::string needle = state.log_viewer_search;
+        std::transform(needle.begin(), needle.end(), needle.begin(),
+                       ::tolower);
+        view.Search(needle);
+        state.log_viewer_cursor = -1;
+        state.log_viewer_line = -1;
+      }
+      bool filtered = !state.log_viewer_search.empty();
+      if (filtered) {
+        ImGui::SameLine();
+        if (AnimatedButton("Prev", ImVec2(0, 0), "viewer_search_prev")) {
+          StepLogViewerSearch(state, -1);
+        }
+        ImGui::SameLine();
+        if (AnimatedButton("Next", ImVec2(0, 0), "viewer_search_next")) {
+          StepLogViewerSearch(state, 1);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("%lld/%llu matches%s",
+                            (long long)(state.log_viewer_cursor + 1),
+                            (unsigned long long)view.MatchCount(),
+                            view.Searching() ? " (searching...)" : "");
+      }
+
+      ImGui::Spacing();
+      ImGui::Separator();
+      ImGui::Spacing();
+
+      ImGuiChildScope _lines("LogViewerLines", ImVec2(0, 0), true,
+                             ImGuiWindowFlags_HorizontalScrollbar);
+      ImGuiStyleVarScope _sv(ImGuiStyleVar_ItemSpacing, ImVec2(4, 2));
+      int64_t cursor =
+          filtered ? state.log_viewer_cursor : state.log_viewer_line;
+      uint64_t rows = filtered ? view.MatchCount() : view.LineCount();
+      // A jump to a line not indexed yet is kept until it is
+      bool scroll = state.log_viewer_scroll && cursor >= 0 &&
+                    (uint64_t)cursor < rows;
+      RenderMappedLogRows(
+          rows,
+          [&view, filtered](uint64_t r, std::string_view &line) {
+            uint64_t n = r;
+            if (filtered && !view.MatchLine(r, n))
+              return false;
+            return view.ReadLine(n, line);
+          },
+          state.log_viewer_classifier.get(), cursor, scroll ? cursor : -1);
+      if (scroll || filtered || cursor < 0 || view.Indexed())
+        state.log_viewer_scroll = false;
+    }
+  }
+
+  if (!open) {
+    state.log_viewer.reset();
+  }
+}
+
+// Search window over every file under the log folders. Results stream in
+// from the background index as they are found; clicking one opens the
+// viewer at that line.
+static void RenderLogSearch(AppState &state) {
+  if (!state.show_log_search)
+    return;
+  g_log_search.Configure(state.log_folder_paths);
+
+  ImGui::SetNextWindowSize(ImVec2(900, 500), ImGuiCond_FirstUseEver);
+  ImGuiWindowScope window("Search Logs", &state.show_log_search, 0);
+  if (!window)
+    return;
+
+  ImGui::Text("Search:");
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(400);
+  char query_buf[256];
+  strncpy(query_buf, state.log_search_query.c_str(), sizeof(query_buf));
+  query_buf[sizeof(query_buf) - 1] = '\0';
+  bool changed = false;
+  if (ImGui::IsWindowAppearing())
+    ImGui::SetKeyboardFocusHere();
+  if (ImGui::InputText("##log_search", query_buf, sizeof(query_buf))) {
+    state.log_search_query = query_buf;
+    changed = true;
+  }
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip("%s", kLogQueryHelp);
+  ImGui::SameLine();
+  if (AnimatedButton("Clear", ImVec2(0, 0), "log_search_clear")) {
+    state.log_search_query.clear();
+    changed = true;
+  }
+  static std::string query_error;
+  if (changed) {
+    LogQuery query;
+    query_error.clear();
+    query.Compile(state.log_search_query, EpochMs(), &query_error);
+    g_log_search.Query(query);
+  }
+  if (!query_error.empty()) {
+    ImGui::SameLine();
+    ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s",
+                       query_error.c_str());
+  }
+
+  size_t files = 0, indexed = 0;
+  uint64_t bytes = 0;
+  g_log_search.Progress(files, indexed, bytes);
+  ImGui::TextDisabled("Indexed %zu/%zu files (%s)", indexed, files,
+                      FormatDockerSize((double)bytes).c_str());
+  size_t hit_count = g_log_search.HitCount();
+  if (!state.log_search_query.empty()) {
+    ImGui::SameLine();
+    ImGui::TextDisabled("|");
+    ImGui::SameLine();
+    ImGui::Text("%zu matches in %zu files%s%s", hit_count,
+                g_log_search.MatchedFiles(),
+                g_log_search.Truncated() ? " (first results only)" : "",
+                g_log_search.Searching() ? " (searching...)" : "");
+  }
+
+  ImGui::Spacing();
+  ImGui::Separator();
+  ImGui::Spacing();
+
+  ImGuiChildScope _results("LogSearchResults", ImVec2(0, 0), true);
+  float line = ImGui::GetTextLineHeight();
+  ImGuiListClipper clipper;
+  clipper.Begin((int)hit_count);
+  LogSearchHit hit;
+  while (clipper.Step()) {
+    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+      if (!g_log_search.Hit((size_t)i, hit))
+        continue;
+      // Location on the left, the matching line after it; both clipped
+      ImGui::PushID(i);
+      bool viewing = state.log_viewer &&
+                     state.log_viewer->path() == hit.path &&
+                     state.log_viewer_line == (int64_t)hit.line;
+      if (ImGui::Selectable("##hit", viewing, 0,
+                            ImVec2(ImGui::GetContentRegionAvail().x,
+                                   line))) {
+        OpenLogFileViewerAt(state, hit.path, hit.line);
+      }
+      if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("%s", hit.path.c_str());
+      ImGui::PopID();
+      ImVec2 min = ImGui::GetItemRectMin();
+      ImVec2 max = ImGui::GetItemRectMax();
+      const char *where = FrameText("%s:%llu", hit.label.c_str(),
+                                    (unsigned long long)hit.line + 1);
+      float split = std::min(max.x, min.x + (max.x - min.x) * 0.4f);
+      {
+        ImGuiStyleColorScope _col(ImGuiCol_Text,
+                                  ImVec4(0.6f, 0.75f, 0.9f, 1.0f));
+        ImGui::RenderTextClipped(min, ImVec2(split - 8, max.y), where,
+                                 nullptr, nullptr);
+      }
+      ImGui::RenderTextClipped(ImVec2(split, min.y), max, hit.text.c_str(),
+                               hit.text.c_str() + hit.text.size(), nullptr);
+    }
+  }
+  if (hit_count == 0 && !state.log_search_query.empty() &&
+      !g_log_search.Searching()) {
+    ImGui::TextDisabled("No matches");
+  }
+}
+
+// Text of a prompt at step index of its history, leaving the history as is
+static std::string PromptHistoryText(const PromptHistory &history,
+                                     int index) {
+  PromptHistory copy = history;
+  while (copy.index() > index && copy.CanUndo())
+    copy.Undo();
+  while (copy.index() < index && copy.CanRedo())
+    copy.Redo();
+  return copy.current();
+}
+
+static void AddPromptVariant(AppState &state, const std::string &prompt1,
+                             const std::string &prompt2) {
+  PromptVariant variant;
+  variant.name = state.prompt_variant_name.empty()
+                     ? "v" + std::to_string(state.prompt_variants.size() + 1)
+                     : state.prompt_variant_name;
+  variant.prompt1 = prompt1;
+  variant.prompt2 = prompt2;
+  state.prompt_variants.push_back(std::move(variant));
+  state.prompt_variant_name.clear();
+  SavePrompts(state);
+}
+
+// Prompt matrix section of the batch import window: saving prompt variants
+// and queueing the picked ones on every ready task folder
+static void RenderPromptMatrix(AppState &state,
+                               const std::vector<TaskValidation> &tasks) {
+  if (!ImGui::CollapsingHeader("Prompt matrix"))
+    return;
+
+  char name_buf[128];
+  strncpy(name_buf, state.prompt_variant_name.c_str(), sizeof(name_buf) - 1);
+  name_buf[sizeof(name_buf) - 1] = '\0';
+  ImGui::SetNextItemWidth(160);
+  if (ImGui::InputTextWithHint("##variant_name", "Variant name", name_buf,
+                               sizeof(name_buf)))
+    state.prompt_variant_name = name_buf;
+  ImGui::SameLine();
+  if (AnimatedButton("Save current", ImVec2(110, 0), "variant_save"))
+    AddPromptVariant(state, state.prompt1_modified, state.prompt2_modified);
+  int steps = (int)state.prompt1_history.size();
+  if (steps > 1) {
+    state.prompt_variant_step =
+        std::max(0, std::min(state.prompt_variant_step, steps - 1));
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(160);
+    ImGui::SliderInt("##variant_step", &state.prompt_variant_step, 0,
+                     steps - 1, "Prompt 1 step %d");
+    ImGui::SameLine();
+    if (AnimatedButton("Save step", ImVec2(90, 0), "variant_save_step")) {
+      AddPromptVariant(state,
+                       PromptHistoryText(state.prompt1_history,
+                                         state.prompt_variant_step),
+                       state.prompt2_modified);
+    }
+  }
+  ImGui::SameLine();
+  ImGui::TextDisabled("(?)");
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip(
+        "Save Prompt 1 and Prompt 2 as they are in the prompt editor, or\n"
+        "Prompt 1 as it was at a step of its undo history with the current\n"
+        "Prompt 2, as a variant to try against the others.");
+  }
+
+  std::vector<PromptVariant> picked;
+  int remove = -1;
+  for (size_t i = 0; i < state.prompt_variants.size(); i++) {
+    PromptVariant &variant = state.prompt_variants[i];
+    ImGui::PushID((int)i);
+    if (ImGui::Checkbox(variant.name.c_str(), &variant.in_matrix))
+      SavePrompts(state);
+    ImGui::SameLine();
+    ImGui::TextDisabled("(%zu + %zu chars)", variant.prompt1.size(),
+                        variant.prompt2.size());
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Remove"))
+      remove = (int)i;
+    ImGui::PopID();
+    if (variant.in_matrix)
+      picked.push_back(variant);
+  }
+  if (remove >= 0) {
+    state.prompt_variants.erase(state.prompt_variants.begin() + remove);
+    SavePrompts(state);
+  }
+  if (state.prompt_variants.empty())
+    ImGui::TextDisabled("No prompt variants saved yet");
+
+  ImGui::Spacing();
+  if (ImGui::RadioButton("Feedback##matrix", state.matrix_mode == 0)) {
+    state.matrix_mode = 0;
+    SaveConfig(state);
+  }
+  ImGui::SameLine();
+  if (ImGui::RadioButton("Both##matrix", state.matrix_mode == 2)) {
+    state.matrix_mode = 2;
+    SaveConfig(state);
+  }
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(120);
+  if (ImGui::SliderInt("Runs per cell", &state.matrix_reps, 1, 20))
+    SaveConfig(state);
+  state.matrix_reps = std::max(1, std::min(state.matrix_reps, 20));
+  int ready = 0;
+  for (const auto &task : tasks) {
+    if (TaskRunnable(task, state.matrix_mode))
+      ready++;
+  }
+  int cells = (int)picked.size() * ready * state.matrix_reps;
+  {
+    ImGuiDisabledScope _dis(cells == 0 || state.api_key.empty());
+    if (AnimatedButton(FrameText("Queue %d matrix runs", cells),
+                       ImVec2(180, 0), "matrix_queue")) {
+      int queued = QueuePromptMatrix(state, tasks, picked, state.matrix_mode,
+                                     state.matrix_reps);
+      state.task_batch_status =
+          "Queued " + std::to_string(queued) + " matrix runs";
+    }
+  }
+  ImGui::SameLine();
+  ImGui::TextDisabled("%zu variant(s) x %d task(s) x %d", picked.size(),
+                      ready, state.matrix_reps);
+  ImGui::SameLine();
+  ImGui::TextDisabled("(?)");
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip(
+        "Each picked variant runs the given number of times on every ready\n"
+        "task folder. The runs of a task share one image build and take\n"
+        "turns between the variants, and each variant's pass rate shows in\n"
+        "the task list as results come in. The stop rules of Run Multiple\n"
+        "apply to each variant.");
+  }
+}
+
+// Batch import window: validates every task folder under a parent folder
+// and queues the ready ones, with a number of runs per task for each mode
+static void RenderTaskBatch(AppState &state) {
+  if (!state.show_task_batch)
+    return;
+
+  ImGui::SetNextWindowSize(ImVec2(760, 520), ImGuiCond_FirstUseEver);
+  ImGuiWindowScope window("Batch Import", &state.show_task_batch, 0);
+  if (!window)
+    return;
+
+  bool scan = false;
+  if (!state.pending_drop_file.empty() &&
+      state.drop_target == DropTarget::BatchDirectory) {
+    state.task_batch_root = state.pending_drop_file;
+    state.pending_drop_file.clear();
+    state.drop_target = DropTarget::None;
+    scan = true;
+  }
+
+  ImGui::Text("Parent folder:");
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 90);
+  char root_buf[512];
+  strncpy(root_buf, state.task_batch_root.c_str(), sizeof(root_buf) - 1);
+  root_buf[sizeof(root_buf) - 1] = '\0';
+  {
+    ImVec4 bg = (state.is_hovering_drop_zone &&
+                 state.drop_target == DropTarget::BatchDirectory)
+                    ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
+                    : ImVec4(0.20f, 0.25f, 0.29f, 1.0f);
+    ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
+    if (ImGui::InputText("##batch_root", root_buf, sizeof(root_buf)))
+      state.task_batch_root = root_buf;
+    if (ImGui::IsItemDeactivatedAfterEdit())
+      scan = true;
+    if (ImGui::IsItemHovered(
+            ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
+            ImGuiHoveredFlags_AllowWhenBlockedByPopup |
+            ImGuiHoveredFlags_AllowWhenOverlappedByItem |
+            ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
+      state.drop_target = DropTarget::BatchDirectory;
+    }
+  }
+  ImGui::SameLine();
+  if (AnimatedButton(ICON_FA_REFRESH " Scan", ImVec2(80, 0),
+                     "task_batch_scan"))
+    scan = true;
+  if (scan && !state.task_batch_root.empty()) {
+    g_task_batch.Scan(state.task_batch_root);
+    state.task_batch_status.clear();
+  }
+
+  ImGui::Spacing();
+  auto results = g_task_batch.Results();
+  if (g_task_batch.Scanning()) {
+    size_t done = 0, total = 0;
+    g_task_batch.Progress(done, total);
+    ImGui::TextDisabled("Validating %zu/%zu folders...", done, total);
+    return;
+  }
+  if (!results) {
+    ImGui::TextDisabled("Drop a folder holding task folders here, or type "
+                        "its path and press Scan");
+    return;
+  }
+
+  int ready[4] = {0, 0, 0, 0};
+  size_t incomplete = 0;
+  for (const auto &task : *results) {
+    for (int mode = 0; mode < 4; mode++) {
+      if (TaskRunnable(task, mode))
+        ready[mode]++;
+    }
+    if (!task.missing_items.empty())
+      incomplete++;
+  }
+  ImGui::Text("%zu task folders in %s (%zu incomplete)", results->size(),
+              g_task_batch.Parent().c_str(), incomplete);
+  ImGui::Spacing();
+
+  // Runs per task for each mode; the counts show what would be queued
+  int total_runs = 0;
+  for (int mode = 0; mode < 4; mode++) {
+    int &runs = state.task_batch_runs[mode];
+    ImGui::SetNextItemWidth(120);
+    ImGui::SliderInt(modes[mode], &runs, 0, 10);
+    runs = std::max(0, std::min(runs, 10));
+    ImGui::SameLine(220);
+    ImGui::TextDisabled("%d of %zu ready: %d runs", ready[mode],
+                        results->size(), ready[mode] * runs);
+    total_runs += ready[mode] * runs;
+  }
+
+  ImGui::Spacing();
+  {
+    ImGuiDisabledScope _dis(total_runs == 0 || state.api_key.empty());
+    if (AnimatedButton(FrameText("Queue %d runs", total_runs), ImVec2(160, 0),
+                       "task_batch_queue")) {
+      int queued = QueueTaskBatch(state, *results, state.task_batch_runs);
+      state.task_batch_status = "Queued " + std::to_string(queued) + " runs";
+    }
+  }
+  ImGui::SameLine();
+  if (state.api_key.empty()) {
+    ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Missing: API Key");
+  } else if (!state.task_batch_status.empty()) {
+    ImGui::TextDisabled("%s", state.task_batch_status.c_str());
+  }
+
+  ImGui::Spacing();
+  RenderPromptMatrix(state, *results);
+
+  ImGui::Spacing();
+  ImGui::Separator();
+  ImGui::Spacing();
+
+  // One row per folder: status, name and what is missing
+  ImGuiChildScope _list("TaskBatchList", ImVec2(0, 0), true);
+  ImGuiListClipper clipper;
+  clipper.Begin((int)results->size());
+  while (clipper.Step()) {
+    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+      const TaskValidation &task = (*results)[(size_t)i];
+      if (task.missing_items.empty()) {
+        ImGui::TextColored(ImVec4(0.4f, 1.0f, 0.4f, 1.0f), "[OK]");
+      } else if (TaskRunnable(task, 3)) {
+        ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "[!]");
+      } else {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "[X]");
+      }
+      ImGui::SameLine(50);
+      ImGui::TextUnformatted(TaskBaseName(task.task_dir).c_str());
+      if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("%s", task.task_dir.c_str());
+      if (!task.missing_items.empty()) {
+        std::string missing;
+        for (const auto &item : task.missing_items)
+          missing += (missing.empty() ? "" : ", ") + item;
+        ImGui::SameLine(300);
+        ImGui::TextDisabled("%s", missing.c_str());
+      }
+    }
+  }
+}
+
+// Pass rates, phase durations, failure signatures and cache hit rates of
+// the finished runs the Logs Browser has read (see RunAnalytics). The
+// report is rebuilt only after runs were recorded or the window changed,
+// so opening it over a long history costs a merge of daily aggregates.
+static void RenderRunAnalytics(AppState &state) {
+  if (!state.show_run_analytics)
+    return;
+
+  ImGui::SetNextWindowSize(ImVec2(920, 560), ImGuiCond_FirstUseEver);
+  ImGuiWindowScope window("Run Analytics", &state.show_run_analytics, 0);
+  if (!window)
+    return;
+
+  static const char *const kWindows[] = {"Last 24 hours", "Last 7 days",
+                                         "Last 30 days", "All runs"};
+  static const int kWindowDays[] = {1, 7, 30, 0};
+  static RunAnalytics::Report report;
+  static int report_window = -1;
+  static double report_at = 0.0;
+  ImGui::SetNextItemWidth(160);
+  ImGui::Combo("##analytics_window", &state.run_analytics_window, kWindows,
+               IM_ARRAYSIZE(kWindows));
+  state.run_analytics_window =
+      std::max(0, std::min(3, state.run_analytics_window));
+  // At most twice a second while runs keep finishing
+  double now = ImGui::GetTime();
+  if (report_window != state.run_analytics_window ||
+      (report.version != g_run_analytics.version() && now - report_at > 0.5)) {
+    report = g_run_analytics.Query(kWindowDays[state.run_analytics_window],
+                                   (long long)time(nullptr));
+    report_window = state.run_analytics_window;
+    report_at = now;
+  }
+  ImGui::SameLine();
+  if (report.runs == 0) {
+    ImGui::TextDisabled("No finished runs in the catalogs read so far");
+    return;
+  }
+  ImGui::Text("%d runs, %.1f%% passed, %s of run time", report.runs,
+              100.0 * report.passed / report.runs,
+              FormatDuration((long long)report.seconds).c_str());
+
+  // Where tuning pays off first
+  static const char *const kCacheNames[RunAnalytics::kCacheCount] = {
+      "Image", "Verify", "Audit"};
+  double phase_seconds = 0.0;
+  for (const auto &phase : report.phases)
+    phase_seconds += phase.seconds;
+  ImGui::Spacing();
+  if (!report.tasks.empty() && report.tasks.front().failed_seconds > 0.0) {
+    const RunAnalytics::TaskRow &task = report.tasks.front();
+    ImGui::BulletText("Most time lost to failed runs: %s (%s), %s in %d "
+                      "failed of %d",
+                      task.task.c_str(), task.mode.c_str(),
+                      FormatDuration((long long)task.failed_seconds).c_str(),
+                      task.runs - task.passed, task.runs);
+  }
+  if (!report.phases.empty() && phase_seconds > 0.0) {
+    const RunAnalytics::PhaseRow &phase = report.phases.front();
+    ImGui::BulletText("Most time spent in a phase: %s, %.0f%% of phase time "
+                      "(p50 %s, p95 %s)",
+                      phase.name.c_str(), 100.0 * phase.seconds / phase_seconds,
+                      FormatDuration((long long)phase.p50_s).c_str(),
+                      FormatDuration((long long)phase.p95_s).c_str());
+  }
+  int costliest = -1;
+  for (int i = 0; i < RunAnalytics::kCacheCount; i++)
+    if (report.caches[i].miss_seconds > 0.0 &&
+        (costliest < 0 || report.caches[i].miss_seconds >
+                              report.caches[costliest].miss_seconds))
+      costliest = i;
+  if (costliest >= 0) {
+    const RunAnalytics::CacheRow &cache = report.caches[costliest];
+    ImGui::BulletText(
+        "Costliest cache misses: %s cache, %s in %d misses",
+        kCacheNames[costliest],
+        FormatDuration((long long)cache.miss_seconds).c_str(),
+        cache.lookups - cache.hits);
+  }
+  if (!report.failures.empty()) {
+    const RunAnalytics::FailureRow &failure = report.failures.front();
+    ImGui::BulletText("Most frequent failure: %s (%d runs, %d tasks)",
+                      failure.signature.c_str(), failure.runs, failure.tasks);
+  }
+  ImGui::Spacing();
+
+  const ImGuiTableFlags kFlags = ImGuiTableFlags_RowBg |
+                                 ImGuiTableFlags_ScrollY |
+                                 ImGuiTableFlags_BordersInnerV |
+                                 ImGuiTableFlags_Resizable;
+  ImGuiTabBarScope tabs("##analytics_tabs");
+  if (!tabs)
+    return;
+  if (ImGuiTabItemScope tab{"Tasks"}) {
+    if (ImGui::BeginTable("##analytics_tasks", 7, kFlags)) {
+      ImGui::TableSetupScrollFreeze(0, 1);
+      ImGui::TableSetupColumn("Task", ImGuiTableColumnFlags_WidthStretch);
+      ImGui::TableSetupColumn("Mode");
+      ImGui::TableSetupColumn("Runs");
+      ImGui::TableSetupColumn("Passed");
+      ImGui::TableSetupColumn("p50");
+      ImGui::TableSetupColumn("p95");
+      ImGui::TableSetupColumn("Lost to failures");
+      ImGui::TableHeadersRow();
+      ImGuiListClipper clipper;
+      clipper.Begin((int)report.tasks.size());
+      while (clipper.Step()) {
+        for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+          const RunAnalytics::TaskRow &row = report.tasks[r];
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(row.task.c_str());
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(row.mode.c_str());
+          ImGui::TableNextColumn();
+          ImGui::Text("%d", row.runs);
+          ImGui::TableNextColumn();
+          ImGui::Text("%.0f%%", 100.0 * row.passed / row.runs);
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(FormatDuration((long long)row.p50_s).c_str());
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(FormatDuration((long long)row.p95_s).c_str());
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(
+              FormatDuration((long long)row.failed_seconds).c_str());
+        }
+      }
+      ImGui::EndTable();
+    }
+  }
+  if (ImGuiTabItemScope tab{"Phases"}) {
+    if (ImGui::BeginTable("##analytics_phases", 6, kFlags)) {
+      ImGui::TableSetupScrollFreeze(0, 1);
+      ImGui::TableSetupColumn("Phase", ImGuiTableColumnFlags_WidthStretch);
+      ImGui::TableSetupColumn("Runs");
+      ImGui::TableSetupColumn("p50");
+      ImGui::TableSetupColumn("p95");
+      ImGui::TableSetupColumn("Total");
+      ImGui::TableSetupColumn("Share");
+      ImGui::TableHeadersRow();
+      for (const auto &row : report.phases) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(row.name.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", row.runs);
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatDuration((long long)row.p50_s).c_str());
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatDuration((long long)row.p95_s).c_str());
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatDuration((long long)row.seconds).c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f%%", phase_seconds > 0.0
+                                  ? 100.0 * row.seconds / phase_seconds
+                                  : 0.0);
+      }
+      ImGui::EndTable();
+    }
+  }
+  if (ImGuiTabItemScope tab{"Failures"}) {
+    if (ImGui::BeginTable("##analytics_failures", 4, kFlags)) {
+      ImGui::TableSetupScrollFreeze(0, 1);
+      ImGui::TableSetupColumn("Signature", ImGuiTableColumnFlags_WidthStretch);
+      ImGui::TableSetupColumn("Runs");
+      ImGui::TableSetupColumn("Tasks");
+      ImGui::TableSetupColumn("Last seen");
+      ImGui::TableHeadersRow();
+      long long now_s = (long long)time(nullptr);
+      ImGuiListClipper clipper;
+      clipper.Begin((int)report.failures.size());
+      while (clipper.Step()) {
+        for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+          const RunAnalytics::FailureRow &row = report.failures[r];
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(row.signature.c_str());
+          ImGui::TableNextColumn();
+          ImGui::Text("%d", row.runs);
+          ImGui::TableNextColumn();
+          ImGui::Text("%d", row.tasks);
+          ImGui::TableNextColumn();
+          ImGui::Text("%s ago",
+                      FormatDuration(std::max(0LL, now_s - row.last)).c_str());
+        }
+      }
+      ImGui::EndTable();
+    }
+  }
+  if (ImGuiTabItemScope tab{"Caches"}) {
+    if (ImGui::BeginTable("##analytics_caches", 4, kFlags)) {
+      ImGui::TableSetupColumn("Cache", ImGuiTableColumnFlags_WidthStretch);
+      ImGui::TableSetupColumn("Lookups");
+      ImGui::TableSetupColumn("Hit rate");
+      ImGui::TableSetupColumn("Time in misses");
+      ImGui::TableHeadersRow();
+      for (int i = 0; i < RunAnalytics::kCacheCount; i++) {
+        const RunAnalytics::CacheRow &row = report.caches[i];
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(kCacheNames[i]);
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", row.lookups);
+        ImGui::TableNextColumn();
+        if (row.lookups > 0)
+          ImGui::Text("%.1f%%", 100.0 * row.hits / row.lookups);
+        else
+          ImGui::TextDisabled("-");
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(
+            FormatDuration((long long)row.miss_seconds).c_str());
+      }
+      ImGui::EndTable();
+    }
+    ImGui::TextDisabled(
+        "Time in misses is the image builds, verifications and audits a hit "
+        "would have skipped.");
+  }
+}
+
+// Diff view id of the Log Diff window (the prompt tabs use 0 to 2)
+static const int kLogDiffViewId = 100;
+
+// Run-to-run comparison of one log file, e.g. the verification.log of a
+// passed run against that of a failed one. ComputeLogDiff runs as an
+// interactive job whenever the runs, the file or the volatile-token
+// setting change, cancelling the comparison still going.
+static void RenderLogDiff(AppState &state) {
+  struct Job {
+    std::string key; // what the result or the running job compares
+    CancelToken token;
+    std::shared_ptr<std::atomic<int>> progress;
+    std::shared_ptr<const LogDiffResult> result;
+    bool running = false;
+  };
+  static Job job;
+  if (!state.show_log_diff) {
+    if (job.running || job.result) {
+      job.token.Cancel();
+      job = Job();
+    }
+    return;
+  }
+
+  ImGui::SetNextWindowSize(ImVec2(1000, 640), ImGuiCond_FirstUseEver);
+  ImGuiWindowScope window("Log Diff", &state.show_log_diff, 0);
+  if (!window)
+    return;
+
+  std::shared_ptr<const LogsTreeSnapshot> tree =
+      g_logs_index.Get(state.log_diff_root);
+  const LogsTreeSnapshot::Task *task = nullptr;
+  if (tree && tree->root == state.log_diff_root)
+    for (const auto &t : tree->tasks)
+      if (t.name == state.log_diff_task)
+        task = &t;
+  if (!task) {
+    ImGui::TextDisabled("Task %s is not in the logs index",
+                        state.log_diff_task.c_str());
+    return;
+  }
+  auto find_run = [task](const std::string &name) {
+    const LogsTreeSnapshot::Run *found = nullptr;
+    for (const auto &run : task->runs)
+      if (run.name == name)
+        found = &run;
+    return found;
+  };
+  auto run_label = [](const LogsTreeSnapshot::Run &run) {
+    if (run.status == RunStatus::Passed || run.status == RunStatus::Failed)
+      return FrameConcat({run.name, " (",
+                          run.status == RunStatus::Passed ? "passed"
+                                                          : "failed",
+                          ")"});
+    return FrameConcat({run.name});
+  };
+  auto run_combo = [&](const char *id, std::string &name) {
+    const LogsTreeSnapshot::Run *current = find_run(name);
+    ImGui::SetNextItemWidth(240);
+    ImGuiComboScope combo(id, current ? run_label(*current) : "Select run");
+    if (!combo)
+      return;
+    for (const auto &run : task->runs)
+      if (ImGui::Selectable(run_label(run), run.name == name))
+        name = run.name;
+  };
+
+  ImGui::Text("%s", state.log_diff_task.c_str());
+  ImGui::SameLine();
+  run_combo("##log_diff_a", state.log_diff_run_a);
+  ImGui::SameLine();
+  ImGui::TextUnformatted(ICON_FA_ARROW_RIGHT);
+  ImGui::SameLine();
+  run_combo("##log_diff_b", state.log_diff_run_b);
+  ImGui::SameLine();
+  // Files of the base run; archived ones are left out
+  const LogsTreeSnapshot::Run *run_a = find_run(state.log_diff_run_a);
+  {
+    ImGui::SetNextItemWidth(260);
+    ImGuiComboScope combo("##log_diff_file", state.log_diff_file.empty()
+                                                 ? "Select file"
+                                                 : state.log_diff_file.c_str());
+    if (combo && run_a) {
+      for (const auto &mode : run_a->modes) {
+        for (const auto &file : mode.files) {
+          if (LogFileView::IsArchivePath(file))
+            continue;
+          const char *path = FrameConcat({mode.name, "/", file});
+          if (ImGui::Selectable(path, state.log_diff_file == path))
+            state.log_diff_file = path;
+        }
+      }
+    }
+  }
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip("Archived (.zst) logs cannot be compared");
+  ImGui::SameLine();
+  ImGui::Checkbox("Ignore Timestamps and IDs",
+                  &state.log_diff_ignore_volatile);
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip("Lines differing only in times, dates, container ids, "
+                      "hashes or other long hex numbers count as the same");
+
+  std::string task_dir = state.log_diff_root + "/" + state.log_diff_task;
+  std::string path_a =
+      task_dir + "/" + state.log_diff_run_a + "/" + state.log_diff_file;
+  std::string path_b =
+      task_dir + "/" + state.log_diff_run_b + "/" + state.log_diff_file;
+  bool ready = !state.log_diff_file.empty() &&
+               !LogFileView::IsArchivePath(state.log_diff_file) && run_a &&
+               find_run(state.log_diff_run_b) &&
+               state.log_diff_run_a != state.log_diff_run_b;
+  std::string key = path_a + "\n" + path_b +
+                    (state.log_diff_ignore_volatile ? "\n1" : "\n0");
+  if (ready && key != job.key) {
+    job.token.Cancel();
+    job.key = key;
+    job.running = true;
+    job.progress = std::make_shared<std::atomic<int>>(0);
+    bool ignore = state.log_diff_ignore_volatile;
+    std::shared_ptr<std::atomic<int>> progress = job.progress;
+    job.token = g_jobs.Submit(
+        JobLane::Compute, JobPriority::Interactive,
+        [path_a, path_b, ignore, key, progress](const CancelToken &token) {
+          auto result = std::make_shared<LogDiffResult>();
+          ComputeLogDiff(path_a, path_b, ignore, token, *result,
+                         progress.get());
+          g_jobs.Post([key, result, token]() {
+            if (token.Cancelled() || job.key != key)
+              return;
+            job.result = result;
+            job.running = false;
+          });
+        });
+  }
+
+  // Toolbar with view controls, as in the prompt diff view
+  if (ImGui::Button(state.diff_split_view ? "Unified View" : "Split View"))
+    state.diff_split_view = !state.diff_split_view;
+  ImGui::SameLine();
+  ImGui::Checkbox("Wrap Lines", &state.diff_wrap_lines);
+  ImGui::SameLine();
+  if (!ready) {
+    ImGui::TextDisabled("Select two runs and a file to compare");
+    return;
+  }
+  if (job.running) {
+    ImGui::TextDisabled("Comparing... %d%%", job.progress->load() / 10);
+    return;
+  }
+  if (!job.result)
+    return;
+  const LogDiffResult &result = *job.result;
+  if (!result.error.empty()) {
+    ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s",
+                       result.error.c_str());
+    return;
+  }
+  const LineDiff &diff = result.diff;
+  ImGui::TextDisabled("%lld vs %lld lines, %zu changes: +%d -%d ~%d%s",
+                      result.orig_lines, result.mod_lines, diff.hunks.size(),
+                      diff.added, diff.removed, diff.modified,
+                      result.truncated ? " (stopped at the line limit)" : "");
+  ImGui::Separator();
+  RenderDiffPanes(state, std::shared_ptr<const LineDiff>(job.result, &diff),
+                  kLogDiffViewId,
+                  std::max(100.0f, ImGui::GetContentRegionAvail().y -
+                                       ImGui::GetTextLineHeightWithSpacing() *
+                                           2),
+                  state.log_diff_run_a.c_str(), state.log_diff_run_b.c_str());
+}
+
+// The Logs Browser's task and run lists under a LogQuery over the catalog:
+// indices of the tasks with a matching run and of those runs. Rebuilt only
+// when the snapshot or the query changes.
+struct LogsBrowserFilter {
+  std::shared_ptr<const LogsTreeSnapshot> tree;
+  std::string text;
+  LogQuery query;
+  std::string error;
+  std::vector<int> tasks;
+  std::vector<std::vector<int>> runs; // parallel to tasks
+};
+
+static void UpdateLogsBrowserFilter(
+    LogsBrowserFilter &filter,
+    const std::shared_ptr<const LogsTreeSnapshot> &tree,
+    const std::string &text) {
+  if (filter.tree == tree && filter.text == text)
+    return;
+  if (filter.text != text || filter.query.text() != text) {
+    filter.error.clear();
+    filter.query.Compile(text, EpochMs(), &filter.error);
+  }
+  filter.tree = tree;
+  filter.text = text;
+  filter.tasks.clear();
+  filter.runs.clear();
+  if (filter.query.empty())
+    return;
+  for (size_t t = 0; t < tree->tasks.size(); t++) {
+    const LogsTreeSnapshot::Task &task = tree->tasks[t];
+    std::vector<int> runs;
+    for (size_t r = 0; r < task.runs.size(); r++) {
+      const LogsTreeSnapshot::Run &run = task.runs[r];
+      LogQueryRun q;
+      q.name = task.name + "/" + run.name;
+      q.failure = run.failure;
+      static const char *const kStatus[] = {"", "running", "passed",
+                                            "failed"};
+      q.status = kStatus[(size_t)run.status];
+      for (const auto &mode : run.modes) {
+        q.modes.push_back(mode.name);
+        if (!tree->catalog)
+          continue;
+        auto rec = tree->catalog->find(q.name + "/" + mode.name);
+        if (rec == tree->catalog->end())
+          continue;
+        q.phases.insert(q.phases.end(), rec->second.phases.begin(),
+                        rec->second.phases.end());
+        if (rec->second.started > 0 &&
+            (q.started_ms == 0 || rec->second.started * 1000 < q.started_ms))
+          q.started_ms = rec->second.started * 1000;
+      }
+      for (auto *field : {&q.name, &q.failure})
+        std::transform(field->begin(), field->end(), field->begin(),
+                       ::tolower);
+      for (auto &mode : q.modes)
+        std::transform(mode.begin(), mode.end(), mode.begin(), ::tolower);
+      if (filter.query.MatchRun(q))
+        runs.push_back((int)r);
+    }
+    if (!runs.empty()) {
+      filter.tasks.push_back((int)t);
+      filter.runs.push_back(std::move(runs));
+    }
+  }
+}
+
+// One flat Logs Browser row: a selectable with its label (and an optional
+// colored status line) drawn clipped inside, followed by open and delete
+// buttons. Rows have a fixed height per column so lists can go through
+// ImGuiListClipper. Returns true when the row was clicked.
+static bool RenderLogsBrowserRow(AppState &state, const char *kind, int index,
+                                 const char *label, const char *status,
+                                 const ImVec4 &status_color, bool selected,
+                                 std::string_view path, bool is_file,
+                                 const char *delete_tip,
+                                 bool *hovered = nullptr,
+                                 bool markable = false) {
+  const ImGuiStyle &style = ImGui::GetStyle();
+  float line = ImGui::GetTextLineHeight();
+  float height = status ? line * 2 + 4 : line + 4;
+  float button_w =
+      ImGui::CalcTextSize(ICON_FA_FOLDER_OPEN).x + style.FramePadding.x * 2;
+  float label_w = ImGui::GetContentRegionAvail().x - button_w * 2 -
+                  style.ItemSpacing.x * 2;
+
+  ImGui::PushID(kind);
+  ImGui::PushID(index);
+  auto mark = markable ? state.logs_marked.find(path)
+                       : state.logs_marked.end();
+  bool marked = mark != state.logs_marked.end();
+  bool clicked =
+      ImGui::Selectable("##row", selected || marked, 0,
+                        ImVec2(std::max(1.0f, label_w), height));
+  // Ctrl+click marks the row for a bulk delete instead of selecting it
+  if (clicked && markable && ImGui::GetIO().KeyCtrl) {
+    if (marked)
+      state.logs_marked.erase(mark);
+    else
+      state.logs_marked.emplace(path);
+    clicked = false;
+  }
+  if (hovered)
+    *hovered = ImGui::IsItemHovered();
+  ImVec2 min = ImGui::GetItemRectMin();
+  ImVec2 max = ImGui::GetItemRectMax();
+  ImGui::RenderTextClipped(ImVec2(min.x + 4, min.y + 2),
+                           ImVec2(max.x - 4, min.y + 2 + line),
+                           label, nullptr, nullptr);
+  if (status && *status) {
+    ImGuiStyleColorScope _col(ImGuiCol_Text, status_color);
+    ImGui::RenderTextClipped(ImVec2(min.x + 4, min.y + 2 + line),
+                             ImVec2(max.x - 4, max.y), status, nullptr,
+                             nullptr);
+  }
+
+  ImGui::SameLine();
+  ImGui::SetCursorPosY(ImGui::GetCursorPosY() + (height - line) * 0.5f -
+                       style.FramePadding.y);
+  if (ImGui::SmallButton(is_file ? ICON_FA_ARROW_UP_RIGHT_FROM_SQUARE
+                                 : ICON_FA_FOLDER_OPEN)) {
+    OpenFolderExternal(std::string(path));
+  }
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip(is_file ? "Open file" : "Open folder");
+  ImGui::SameLine();
+  {
+    ImGuiStyleColorScope _btn(ImGuiCol_Button, ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
+    if (ImGui::SmallButton(ICON_FA_TRASH)) {
+      state.pending_delete_paths = {std::string(path)};
+      state.show_confirm_delete = true;
+    }
+  }
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip("%s", delete_tip);
+  ImGui::PopID();
+  ImGui::PopID();
+  return clicked;
+}
+
+// Bulk delete of the marked task and run folders, what g_trash is about to
+// purge (with Undo) or purging, and the last delete error
+static void RenderLogsDeletes(AppState &state) {
+  if (!state.logs_marked.empty()) {
+    const char *label = FrameText(ICON_FA_TRASH " Delete %zu Selected",
+                                  state.logs_marked.size());
+    {
+      ImGuiStyleColorScope _btn(ImGuiCol_Button,
+                                ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
+      if (ImGui::Button(label)) {
+        state.pending_delete_paths.assign(state.logs_marked.begin(),
+                                          state.logs_marked.end());
+        state.show_confirm_delete = true;
+      }
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear Selection"))
+      state.logs_marked.clear();
+    ImGui::SameLine();
+    ImGui::TextDisabled("(Ctrl+click task and run folders to select them)");
+  }
+  auto now = std::chrono::steady_clock::now();
+  uint64_t undo = 0;
+  for (const TrashBin::Item &item : g_trash.items()) {
+    ImGui::PushID((int)item.id);
+    if (!item.purging) {
+      int left = TrashBin::kUndoSeconds -
+                 (int)std::chrono::duration_cast<std::chrono::seconds>(
+                     now - item.at)
+                     .count();
+      ImGui::TextDisabled("Deleting %s in %ds", item.original.c_str(),
+                          std::max(0, left));
+      ImGui::SameLine();
+      if (ImGui::SmallButton("Undo"))
+        undo = item.id;
+    } else {
+      size_t total = item.total->load();
+      size_t removed = item.removed->load();
+      char overlay[64];
+      snprintf(overlay, sizeof(overlay), "%zu of %zu entries", removed,
+               total);
+      ImGui::ProgressBar(total > 0 ? (float)removed / total : 0.0f,
+                         ImVec2(200, 0), overlay);
+      ImGui::SameLine();
+      ImGui::TextDisabled("Purging %s", item.original.c_str());
+    }
+    ImGui::PopID();
+  }
+  if (undo != 0) {
+    std::string error;
+    for (const TrashBin::Item &item : g_trash.items()) {
+      if (item.id != undo)
+        continue;
+      std::string original = item.original;
+      if (g_trash.Undo(undo, error)) {
+        size_t slash = original.find_last_of("/\\");
+        if (slash != std::string::npos)
+          g_logs_index.Touch(original.substr(0, slash));
+      }
+      break;
+    }
+    state.delete_error = error;
+  }
+  if (!state.delete_error.empty())
+    ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s",
+                       state.delete_error.c_str());
+}
+
+// Dev mode Frame Profiler: frame time percentiles and history, a flame chart
+// of one frame's zones and the average cost per zone, with an export of the
+// kept frames as a Chrome trace next to the config file
+static void RenderFrameProfiler(AppState &state) {
+  if (!state.show_profiler)
+    return;
+  ImGui::SetNextWindowSize(ImVec2(720, 460), ImGuiCond_FirstUseEver);
+  ImGuiWindowScope window("Frame Profiler", &state.show_profiler,
+                          ImGuiWindowFlags_NoSavedSettings);
+  if (!window)
+    return;
+  FrameProfiler &prof = g_frame_profiler;
+  size_t count = prof.FrameCount();
+  ImGui::Text("Frames: %zu  p50 %.2f ms  p99 %.2f ms  max %.2f ms", count,
+              prof.FramePercentileMs(50), prof.FramePercentileMs(99),
+              prof.FramePercentileMs(100));
+#ifdef AUTOBUILD_GUI_OPENGL
+  if (g_gpu_timers.Samples(g_gpu_imgui_pass) > 0)
+    ImGui::Text("GPU draw: %.2f ms  mean %.2f ms  max %.2f ms",
+                g_gpu_timers.LastMs(g_gpu_imgui_pass),
+                g_gpu_timers.MeanMs(g_gpu_imgui_pass),
+                g_gpu_timers.MaxMs(g_gpu_imgui_pass));
+  else
+    ImGui::TextDisabled("GPU draw: no timings yet");
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip("GL_TIME_ELAPSED of ImGui's draw calls, read back a "
+                      "few frames late; mean and max since startup");
+#endif
+  ImGui::SameLine();
+  ImGui::Checkbox("Pause", &state.profiler_paused);
+  ImGui::SameLine();
+  if (ImGui::Button("Export Chrome Trace")) {
+    std::string config = GetConfigFilePath();
+    size_t slash = config.find_last_of("/\\");
+    std::string dir =
+        slash == std::string::npos ? std::string(".") : config.substr(0, slash);
+    char name[64];
+    time_t now = time(nullptr);
+    strftime(name, sizeof(name), "autobuild_trace_%Y%m%d_%H%M%S.json",
+             localtime(&now));
+    std::string path = dir + "/" + name;
+    state.profiler_status = prof.ExportChromeTrace(path)
+                                ? "Wrote " + path
+                                : "Cannot write " + path;
+  }
+  if (!state.profiler_status.empty())
+    ImGui::TextDisabled("%s", state.profiler_status.c_str());
+  if (count == 0) {
+    ImGui::TextDisabled("No frames recorded yet");
+    return;
+  }
+
+  // Frame history; clicking a bar shows that frame below
+  std::vector<float> totals(count);
+  float worst = 1.0f;
+  for (size_t i = 0; i < count; i++) {
+    totals[i] = prof.GetFrame(i).total_us / 1000.0f;
+    worst = std::max(worst, totals[i]);
+  }
+  ImGui::PlotHistogram("##frame_times", totals.data(), (int)count, 0,
+                       "frame ms", 0.0f, worst,
+                       ImVec2(ImGui::GetContentRegionAvail().x, 60));
+  if (ImGui::IsItemClicked()) {
+    ImVec2 min = ImGui::GetItemRectMin();
+    float width = std::max(1.0f, ImGui::GetItemRectSize().x);
+    int pick = (int)((ImGui::GetIO().MousePos.x - min.x) / width * count);
+    state.profiler_frame = std::max(0, std::min((int)count - 1, pick));
+    state.profiler_paused = true;
+  }
+  if (state.profiler_frame >= (int)count || !state.profiler_paused)
+    state.profiler_frame = -1;
+  size_t shown = state.profiler_frame >= 0 ? (size_t)state.profiler_frame
+                                           : count - 1;
+  const FrameProfiler::Frame &frame = prof.GetFrame(shown);
+
+  // Flame chart: one row per nesting depth, x spans the frame
+  int depth = 0;
+  for (const auto &zone : frame.zones)
+    depth = std::max(depth, zone.depth + 1);
+  ImGui::Text("Frame %zu: %.2f ms, %llu heap allocations", shown + 1,
+              frame.total_us / 1000.0, (unsigned long long)frame.allocs);
+  float row = ImGui::GetTextLineHeight() + 4.0f;
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  float width = std::max(1.0f, ImGui::GetContentRegionAvail().x);
+  double scale = width / (double)std::max<int64_t>(1, frame.total_us);
+  ImDrawList *draw = ImGui::GetWindowDrawList();
+  ImGui::InvisibleButton("##flame", ImVec2(width, row * std::max(1, depth)));
+  bool hovered = ImGui::IsItemHovered();
+  ImVec2 mouse = ImGui::GetIO().MousePos;
+  for (const auto &zone : frame.zones) {
+    ImVec2 a(origin.x + (float)(zone.start_us * scale),
+             origin.y + zone.depth * row);
+    ImVec2 b(std::max(a.x + 1.0f, origin.x + (float)(zone.end_us * scale)),
+             a.y + row - 1.0f);
+    // Color by name so a zone keeps its color from frame to frame
+    ImU32 hue = (ImU32)(ImHashStr(zone.name) % 360);
+    ImVec4 color;
+    ImGui::ColorConvertHSVtoRGB(hue / 360.0f, 0.45f, 0.75f, color.x, color.y,
+                                color.z);
+    color.w = 1.0f;
+    draw->AddRectFilled(a, b, ImGui::GetColorU32(color));
+    ImGui::RenderTextClipped(ImVec2(a.x + 3, a.y + 2), b, zone.name, nullptr,
+                             nullptr);
+    if (hovered && mouse.x >= a.x && mouse.x < b.x && mouse.y >= a.y &&
+        mouse.y < b.y) {
+      ImGui::SetTooltip("%s\n%.3f ms\n%llu heap allocations", zone.name,
+                        (zone.end_us - zone.start_us) / 1000.0,
+                        (unsigned long long)zone.allocs);
+    }
+  }
+
+  // Average and worst cost per zone over the kept frames
+  struct ZoneStats {
+    int64_t total_us = 0;
+    int64_t max_us = 0;
+    uint64_t allocs = 0;
+    int calls = 0;
+  };
+  std::map<std::string, ZoneStats> stats;
+  for (size_t i = 0; i < count; i++) {
+    std::map<const char *, std::pair<int64_t, uint64_t>> per_frame;
+    for (const auto &zone : prof.GetFrame(i).zones) {
+      per_frame[zone.name].first += zone.end_us - zone.start_us;
+      per_frame[zone.name].second += zone.allocs;
+    }
+    for (const auto &kv : per_frame) {
+      ZoneStats &st = stats[kv.first];
+      st.total_us += kv.second.first;
+      st.max_us = std::max(st.max_us, kv.second.first);
+      st.allocs += kv.second.second;
+      st.calls++;
+    }
+  }
+  ImGui::Separator();
+  if (ImGui::BeginTable("##zone_stats", 4,
+                        ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY |
+                            ImGuiTableFlags_BordersInnerV)) {
+    ImGui::TableSetupColumn("Zone");
+    ImGui::TableSetupColumn("Avg ms / frame");
+    ImGui::TableSetupColumn("Max ms");
+    ImGui::TableSetupColumn("Allocs / frame");
+    ImGui::TableHeadersRow();
+    for (const auto &kv : stats) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(kv.first.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", kv.second.total_us / 1000.0 / count);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", kv.second.max_us / 1000.0);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", (double)kv.second.allocs / count);
+    }
+    ImGui::EndTable();
+  }
+}
+
+// "+1.2MB" / "-340kB" for a change in live bytes
+static std::string FormatHeapDelta(int64_t bytes) {
+  return (bytes < 0 ? "-" : "+") +
+         FormatDockerSize((double)(bytes < 0 ? -bytes : bytes));
+}
+
+// Dev mode Heap window: allocations, bytes, live and peak heap per tag and
+// per thread slot, live object counts, and the growth of each since a
+// snapshot, e.g. to spot finished runs that are never freed over a batch
+static void RenderHeapStats(AppState &state) {
+  if (!state.show_heap)
+    return;
+  ImGui::SetNextWindowSize(ImVec2(640, 420), ImGuiCond_FirstUseEver);
+  ImGuiWindowScope window("Heap", &state.show_heap,
+                          ImGuiWindowFlags_NoSavedSettings);
+  if (!window)
+    return;
+  bool accounting = g_heap_accounting.load();
+  if (ImGui::Checkbox("Count bytes", &accounting))
+    g_heap_accounting = accounting;
+  if (ImGui::IsItemHovered())
+    ImGui::SetTooltip("Count allocations, bytes and live heap per tag and "
+                      "thread.\nBlocks made while this is off are never "
+                      "counted, so live\nstarts from zero when it is "
+                      "turned on.");
+  ImGui::SameLine();
+  if (ImGui::Button("Take Snapshot"))
+    g_heap_snapshot.Take();
+  const HeapSnapshot &snap = g_heap_snapshot;
+  if (snap.taken) {
+    ImGui::SameLine();
+    if (ImGui::Button("Clear Snapshot"))
+      g_heap_snapshot = HeapSnapshot();
+    ImGui::SameLine();
+    ImGui::TextDisabled(
+        "taken %s ago",
+        FormatDuration(std::chrono::duration_cast<std::chrono::seconds>(
+                           std::chrono::steady_clock::now() - snap.when)
+                           .count())
+            .c_str());
+  }
+  ImGui::Text("Live %s in %lld blocks, peak %s, %llu allocations",
+              FormatDockerSize((double)g_heap_total.live.load()).c_str(),
+              (long long)g_heap_total.blocks.load(),
+              FormatDockerSize((double)g_heap_total.peak.load()).c_str(),
+              (unsigned long long)g_heap_total.allocs.load());
+
+  // One table per grouping; the last two columns are the growth since the
+  // snapshot
+  auto table = [&](const char *id, const char *first, size_t rows,
+                   auto name_of, const HeapCounters *counters,
+                   const int64_t *snap_live, const int64_t *snap_blocks) {
+    int columns = snap.taken ? 8 : 6;
+    if (!ImGui::BeginTable(id, columns,
+                           ImGuiTableFlags_RowBg |
+                               ImGuiTableFlags_BordersInnerV |
+                               ImGuiTableFlags_SizingStretchProp))
+      return;
+    ImGui::TableSetupColumn(first);
+    ImGui::TableSetupColumn("Allocs");
+    ImGui::TableSetupColumn("Frees");
+    ImGui::TableSetupColumn("Allocated");
+    ImGui::TableSetupColumn("Live");
+    ImGui::TableSetupColumn("Peak");
+    if (snap.taken) {
+      ImGui::TableSetupColumn("Live growth");
+      ImGui::TableSetupColumn("Block growth");
+    }
+    ImGui::TableHeadersRow();
+    for (size_t i = 0; i < rows; i++) {
+      const char *name = name_of(i);
+      const HeapCounters &c = counters[i];
+      if (name == nullptr || c.allocs.load() == 0)
+        continue;
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(name);
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", (unsigned long long)c.allocs.load());
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", (unsigned long long)c.frees.load());
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(FormatDockerSize((double)c.bytes.load()).c_str());
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(FormatDockerSize((double)c.live.load()).c_str());
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(FormatDockerSize((double)c.peak.load()).c_str());
+      if (snap.taken) {
+        int64_t grew = c.live.load() - snap_live[i];
+        int64_t blocks = c.blocks.load() - snap_blocks[i];
+        ImGuiStyleColorScope _col(ImGuiCol_Text,
+                                  blocks > 0 ? ImVec4(1.0f, 0.6f, 0.3f, 1.0f)
+                                             : ImGui::GetStyle().Colors
+                                                   [ImGuiCol_Text]);
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatHeapDelta(grew).c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%+lld", (long long)blocks);
+      }
+    }
+    ImGui::EndTable();
+  };
+
+  ImGui::SeparatorText("By tag");
+  table("##heap_tags", "Tag", kHeapTagCount,
+        [](size_t i) { return kHeapTagNames[i]; }, g_heap_tags,
+        snap.tag_live, snap.tag_blocks);
+  ImGui::SeparatorText("By thread");
+  table("##heap_threads", "Thread", kHeapThreadSlots,
+        [](size_t i) -> const char * {
+          return i == 0 ? "unnamed" : g_heap_thread_names[i].load();
+        },
+        g_heap_threads, snap.thread_live, snap.thread_blocks);
+
+  ImGui::SeparatorText("Live objects");
+  for (size_t i = 0; i < kLiveObjectKinds; i++) {
+    long long live = (long long)g_live_objects[i].load();
+    if (snap.taken)
+      ImGui::Text("%s: %lld (%+lld)", kLiveObjectNames[i], live,
+                  live - (long long)snap.objects[i]);
+    else
+      ImGui::Text("%s: %lld", kLiveObjectNames[i], live);
+  }
+}
+
+void RenderMainUI(AppState &state) {
+  // Critical safety check - ensure ImGui is in a valid state
+  if (!GImGui || !GImGui->CurrentWindow) {
+    if (state.dev_mode) {
+      DevLog("CRITICAL: ImGui context or current window is null!");
+    }
+    if (g_show_debug_console) {
+      ConsoleLog("CRITICAL: ImGui context or current window is null!");
+    }
+    return;
+  }
+
+  // Pre-emptive ID stack validation
+  if (g_show_debug_console && GImGui->CurrentWindow) {
+    int id_stack_size = GImGui->CurrentWindow->IDStack.Size;
+    if (id_stack_size < 1) {
+      ConsoleLog(
+          "PRE-EMPTIVE WARNING: IDStack size is " +
+          std::to_string(id_stack_size) +
+          " before rendering - this will likely cause assertion failure!");
+    }
+  }
+
+  ImGuiIO &io = ImGui::GetIO();
+  // Allow the SDL window to handle its own resizing by leaving some margin
+  ImGui::SetNextWindowPos(ImVec2(2, g_titlebar_height + 2));
+  ImVec2 _size = io.DisplaySize;
+  _size.x -= 4; // Leave margin for resize handles
+  _size.y = (_size.y > g_titlebar_height) ? (_size.y - g_titlebar_height - 4)
+                                          : _size.y;
+  // Always update window size to match SDL window size
+  ImGui::SetNextWindowSize(_size, ImGuiCond_Always);
+
+  // Set window style properties before the window begins
+  ImGui::PushStyleVar(ImGuiStyleVar_WindowRounding, 12.0f);
+  ImGui::PushStyleVar(ImGuiStyleVar_WindowBorderSize, 2.0f);
+  ImGui::PushStyleColor(ImGuiCol_Border,
+                        ImVec4(0.0f, 0.0f, 0.0f, 1.0f)); // Black border
+
+  // Add window fade-in animation
+  static bool window_first_frame = true;
+  if (window_first_frame) {
+    g_animation_manager.StartAnimation(kWindowFadeAnim, 0.5f);
+    window_first_frame = false;
+  }
+
+  float window_alpha = 1.0f;
+  if (g_animation_manager.IsAnimationPlaying(kWindowFadeAnim)) {
+    auto &anim = g_animation_manager.GetAnimation(kWindowFadeAnim);
+    anim.start_value = 0.0f;
+    anim.end_value = 1.0f;
+    window_alpha = anim.GetValue();
+  }
+
+  // Apply alpha to window background
+  ImVec4 bg_color = ImGui::GetStyle().Colors[ImGuiCol_WindowBg];
+  bg_color.w *= window_alpha;
+  ImGui::PushStyleColor(ImGuiCol_WindowBg, bg_color);
+
+  ImGuiWindowScope main_window_scope(
+      "Autobuild 2.0 - Verification Orchestrator", nullptr,
+      ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse |
+          ImGuiWindowFlags_NoBringToFrontOnFocus |
+          ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoResize);
+
+  // Pop the style variables immediately after window begins to avoid stack
+  // issues
+  ImGui::PopStyleColor(1); // Border color
+  ImGui::PopStyleVar(2);   // WindowRounding and WindowBorderSize
+
+  // Dev overlay is rendered at the end to stay on top
+
+  // Clear keyboard focus when drag begins to allow drag and drop to work
+  // properly
+  if (state.should_clear_focus) {
+    ImGui::SetKeyboardFocusHere(-1); // Clear focus from any active item
+    state.should_clear_focus = false;
+  }
+
+  // Periodically log stack sizes when dev mode enabled (every 60 frames)
+  static int frame_counter = 0;
+  if (state.dev_mode && (frame_counter % 60 == 0)) {
+    ImGuiContext &g = *GImGui;
+    ImGuiWindow *w = g.CurrentWindow;
+    std::stringstream ss;
+    auto now = std::chrono::system_clock::now();
+    auto time_t = std::chrono::system_clock::to_time_t(now);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  now.time_since_epoch()) %
+              1000;
+
+    ss << "[" << std::put_time(std::localtime(&time_t), "%H:%M:%S") << "."
+       << std::setfill('0') << std::setw(3) << ms.count() << "] ";
+    ss << "IDStack=" << w->IDStack.Size << " ColorStack=" << g.ColorStack.Size
+       << " StyleVarStack=" << g.StyleVarStack.Size;
+    ss << " FontStack=" << g.FontStack.Size << " Windows=" << g.Windows.Size;
+    DevLog(ss.str());
+  }
+  frame_counter++;
+
+  // Clean up dummy IDs from previous frame at the start of new frame
+  CleanupImGuiIDStack(state);
+
+  // Track ID stack changes to identify root cause
+  TrackIDStackChanges(state);
+
+  // Validate ImGui state for debugging
+  ValidateImGuiState(state);
+  FixImGuiIDStack(state);
+
+  // Don't clean up dummy IDs here - let them stay until the next frame
+  // CleanupImGuiIDStack(state);
+
+  // Track state changes for debugging
+  static int last_id_stack_size = -1;
+  if (state.dev_mode && GImGui && GImGui->CurrentWindow) {
+    int current_id_stack_size = GImGui->CurrentWindow->IDStack.Size;
+    if (last_id_stack_size != -1 &&
+        current_id_stack_size != last_id_stack_size) {
+      DevLog("IDStack changed from " +
+                 std::to_string(last_id_stack_size) + " to " +
+                 std::to_string(current_id_stack_size));
+    }
+    last_id_stack_size = current_id_stack_size;
+
+    // Console output for critical state issues
+    if (g_show_debug_console) {
+      if (current_id_stack_size < 1) {
+        ConsoleLog("WARNING: IDStack size is " +
+                   std::to_string(current_id_stack_size) +
+                   " - this may cause assertion failures!");
+      }
+      if (current_id_stack_size > 10) {
+        ConsoleLog("WARNING: IDStack size is " +
+                   std::to_string(current_id_stack_size) +
+                   " - unusually high, possible stack leak!");
+      }
+
+      // Check for other stack imbalances
+      ImGuiContext &g = *GImGui;
+      if (g.ColorStack.Size < 0) {
+        ConsoleLog("ERROR: ColorStack.Size < 0, PushStyleColor/PopStyleColor "
+                   "mismatch!");
+      }
+      if (g.StyleVarStack.Size < 0) {
+        ConsoleLog("ERROR: StyleVarStack.Size < 0, PushStyleVar/PopStyleVar "
+                   "mismatch!");
+      }
+      if (g.FontStack.Size < 0) {
+        ConsoleLog("ERROR: FontStack.Size < 0, PushFont/PopFont mismatch!");
+      }
+    }
+  }
+
+  // Header
+  ImGui::PushFont(io.Fonts->Fonts[0]);
+  ImGui::PopFont();
+
+  // Dev mode indicator
+  if (state.dev_mode) {
+    ImGui::SameLine();
+    ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "[DEV MODE]");
+    ImGui::Separator();
+  }
+
+  // Main content area
+  bool is_config_tab = false;
+  ImGuiTabBarScope _main_tabs("MainTabs");
+  if (_main_tabs) {
+    {
+      ImGuiTabItemScope _tab_config("Configuration");
+      if (_tab_config) {
+        is_config_tab = true;
+        ImGui::Spacing();
+        // Docker configuration (all modes are Docker-based now)
+        {
+          ImGui::TextColored(ImVec4(0.4f, 0.7f, 1.0f, 1.0f),
+                             "Docker Configuration");
+          ImGui::Spacing();
+
+          // Task directory with file browser hint
+          ImGui::Text("Task Directory:");
+          ImGui::SameLine();
+          ImGui::TextDisabled("(?)");
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip(
+                "Drag and drop a folder from Windows Explorer here");
+          }
+
+          // Apply pending drop if available
+          if (!state.pending_drop_file.empty() &&
+              state.drop_target == DropTarget::TaskDirectory) {
+            state.task_directory = state.pending_drop_file;
+            state.pending_drop_file.clear();
+            state.drop_target = DropTarget::None;
+          }
+
+          char task_buf[512];
+          strncpy(task_buf, state.task_directory.c_str(), sizeof(task_buf) - 1);
+          task_buf[sizeof(task_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 60);
+
+          // Highlight input field when hovering for drop
+          {
+            ImVec4 bg = (state.is_hovering_drop_zone &&
+                         state.drop_target == DropTarget::TaskDirectory)
+                            ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
+                            : ImVec4(0.25f, 0.30f, 0.35f, 1.0f);
+            ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
+            if (ImGui::InputText("##task", task_buf, sizeof(task_buf))) {
+              state.task_directory = task_buf;
+            }
+            // Always check for hover to enable drag and drop (even when typing
+            // or overlapped)
+            if (ImGui::IsItemHovered(
+                    ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
+                    ImGuiHoveredFlags_AllowWhenBlockedByPopup |
+                    ImGuiHoveredFlags_AllowWhenOverlappedByItem |
+                    ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
+              state.drop_target = DropTarget::TaskDirectory;
+            }
+          }
+
+          // Show validation icon
+          ImGui::SameLine();
+          if (!state.task_directory.empty()) {
+            if (DirectoryExists(state.task_directory)) {
+              AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
+                                      false, "task_dir_ok");
+              if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Directory exists");
+              }
+            } else {
+              AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
+                                      true, "task_dir_error");
+              if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Directory does not exist!");
+              }
+            }
+          }
+
+          // Show validation results
+          if (!state.task_directory.empty()) {
+            ImGui::Spacing();
+            {
+              ImGuiChildScope _validation_child("ValidationResults",
+                                                ImVec2(0, 180), true);
+
+              // Show found items
+              if (!state.validation.found_items.empty()) {
+                ImGui::TextColored(ImVec4(0.4f, 1.0f, 0.4f, 1.0f), "Found:");
+                for (const auto &item : state.validation.found_items) {
+                  ImGui::TextUnformatted(item.c_str());
+                }
+              }
+
+              // Show missing items
+              if (!state.validation.missing_items.empty()) {
+                if (!state.validation.found_items.empty()) {
+                  ImGui::Spacing();
+                }
+                ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Missing:");
+                for (const auto &item : state.validation.missing_items) {
+                  ImGui::TextUnformatted(item.c_str());
+                }
+              }
+
+              // Overall status
+              if (state.validation.missing_items.empty() &&
+                  !state.validation.found_items.empty()) {
+                ImGui::Spacing();
+                ImGui::Separator();
+                ImGui::TextColored(ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
+                                   "[OK] Task directory is valid!");
+                if (!SpeculativeBuildDir(state).empty()) {
+                  switch (g_build_farm.StateOf(state.task_directory)) {
+                  case ImageBuildFarm::State::Queued:
+                    ImGui::TextDisabled("Image: waiting to pre-build");
+                    break;
+                  case ImageBuildFarm::State::Building:
+                    ImGui::TextDisabled("Image: pre-building");
+                    break;
+                  case ImageBuildFarm::State::Ready:
+                    ImGui::TextDisabled("Image: ready");
+                    break;
+                  case ImageBuildFarm::State::Failed:
+                    ImGui::TextDisabled("Image: pre-build failed (a run "
+                                        "builds it again)");
+                    break;
+                  default:
+                    break;
+                  }
+                }
+              } else if (!state.validation.missing_items.empty()) {
+                ImGui::Spacing();
+                ImGui::Separator();
+                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f),
+                                   "[Warning] Some required files are missing");
+              }
+
+              // Layer caching problems of env/Dockerfile, costliest first
+              std::shared_ptr<const DockerfileLint> lint =
+                  SelectedDockerfileLint(state);
+              if (lint && !lint->findings.empty()) {
+                ImGui::Spacing();
+                ImGui::Separator();
+                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f),
+                                   "Dockerfile caching (%d):",
+                                   (int)lint->findings.size());
+                ImGui::SameLine();
+                ImGui::TextDisabled("(?)");
+                if (ImGui::IsItemHovered()) {
+                  ImGui::SetTooltip(
+                      "Instructions that make docker build rerun steps it "
+                      "could take from its cache.\nEach estimate is what a "
+                      "build pays for the steps the finding reruns, as the "
+                      "newest\nbuild logs of this task timed them (%d "
+                      "read).",
+                      lint->build_logs);
+                }
+                for (size_t i = 0; i < lint->findings.size(); i++) {
+                  const DockerfileFinding &f = lint->findings[i];
+                  std::string cost =
+                      f.seconds >= 0.0
+                          ? "~" + FormatPhaseMs((long long)(f.seconds * 1000)) +
+                                " per build"
+                      : f.reruns.empty() ? "stale index"
+                                         : "not timed yet";
+                  ImGui::PushID((int)i);
+                  ImGui::TextDisabled("[%s]", cost.c_str());
+                  ImGui::SameLine();
+                  ImGui::TextWrapped("%s", f.message.c_str());
+                  if (ImGui::IsItemHovered()) {
+                    const DockerfileStage &stage =
+                        lint->info->stages[f.stage];
+                    std::string steps = stage.steps[f.step].text;
+                    for (int rerun : f.reruns) {
+                      if (rerun != f.step)
+                        steps += "\nreruns: " + stage.steps[rerun].text;
+                    }
+                    ImGui::SetTooltip("%s", steps.c_str());
+                  }
+                  ImGui::PopID();
+                }
+              }
+            }
+          }
+
+          ImGui::Spacing();
+
+          // API Key with show/hide button
+          ImGui::Text("Gemini API Key:");
+          ImGui::SameLine();
+
+          // Eye button to toggle visibility (disabled if no API key)
+          bool has_api_key = !state.api_key.empty();
+          if (!has_api_key) {
+            ImGuiStyleColorScope _c1(ImGuiCol_Button,
+                                     ImVec4(0.3f, 0.3f, 0.3f, 0.5f));
+            ImGuiStyleColorScope _c2(ImGuiCol_ButtonHovered,
+                                     ImVec4(0.3f, 0.3f, 0.3f, 0.5f));
+            ImGuiStyleColorScope _c3(ImGuiCol_ButtonActive,
+                                     ImVec4(0.3f, 0.3f, 0.3f, 0.5f));
+            ImGuiStyleColorScope _c4(ImGuiCol_Text,
+                                     ImVec4(0.5f, 0.5f, 0.5f, 0.6f));
+            ImGuiDisabledScope _dis;
+            if (ImGui::SmallButton(state.show_api_key ? "Hide" : "Show")) {
+              state.show_api_key = !state.show_api_key;
+            }
+          } else {
+            if (ImGui::SmallButton(state.show_api_key ? "Hide" : "Show")) {
+              state.show_api_key = !state.show_api_key;
+            }
+          }
+          ImGui::SameLine();
+          ImGui::TextDisabled("(?)");
+          if (ImGui::IsItemHovered()) {
+            std::string config_path = GetConfigFilePath();
+            ImGui::SetTooltip("API Key is automatically saved to:\n%s",
+                              config_path.c_str());
+          }
+
+          char key_buf[256];
+          strncpy(key_buf, state.api_key.c_str(), sizeof(key_buf) - 1);
+          key_buf[sizeof(key_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 240);
+
+          // Use password flag if not showing
+          ImGuiInputTextFlags flags =
+              state.show_api_key ? 0 : ImGuiInputTextFlags_Password;
+          if (ImGui::InputText("##apikey", key_buf, sizeof(key_buf), flags)) {
+            std::string new_api_key = key_buf;
+            // Only update and save if the API key actually changed
+            if (new_api_key != state.api_key) {
+              state.api_key = new_api_key;
+              SaveConfig(state); // Auto-save when API key changes
+            }
+          }
+
+          ImGui::Spacing();
+
+          // Optional fields (collapsible) with smooth animation
+          static bool advanced_options_open = false;
+          bool was_open = advanced_options_open;
+          if (ImGui::CollapsingHeader("Advanced Options",
+                                      &advanced_options_open)) {
+            // Start animation when opening
+            if (!was_open && advanced_options_open) {
+              g_animation_manager.StartAnimation(kAdvancedOptionsAnim, 0.3f);
+            }
+
+            // Get animation progress for smooth height transition
+            float anim_progress = 1.0f;
+            if (g_animation_manager.IsAnimationPlaying(kAdvancedOptionsAnim)) {
+              auto &anim =
+                  g_animation_manager.GetAnimation(kAdvancedOptionsAnim);
+              anim.start_value = 0.0f;
+              anim.end_value = 1.0f;
+              anim_progress = anim.GetValue();
+            }
+
+            // Apply alpha based on animation progress
+            ImVec4 text_color = ImGui::GetStyle().Colors[ImGuiCol_Text];
+            text_color.w *= anim_progress;
+            ImGui::PushStyleColor(ImGuiCol_Text, text_color);
+
+            ImGui::Indent();
+
+            ImGui::Text("Image Tag:");
+            char img_buf[256];
+            strncpy(img_buf, state.image_tag.c_str(), sizeof(img_buf) - 1);
+            img_buf[sizeof(img_buf) - 1] = '\0';
+            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 240);
+            if (ImGui::InputText("##imagetag", img_buf, sizeof(img_buf))) {
+              state.image_tag = img_buf;
+            }
+
+            ImGui::Text("Container Name:");
+            char cont_buf[256];
+            strncpy(cont_buf, state.container_name.c_str(),
+                    sizeof(cont_buf) - 1);
+            cont_buf[sizeof(cont_buf) - 1] = '\0';
+            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 240);
+            if (ImGui::InputText("##container", cont_buf, sizeof(cont_buf))) {
+              state.container_name = cont_buf;
+            }
+
+            ImGui::Text("Working Directory:");
+            ImGui::SameLine();
+            ImGui::TextDisabled("(?)");
+            if (ImGui::IsItemHovered()) {
+              ImGui::SetTooltip("Drag and drop a folder here");
+            }
+
+            // Apply pending drop for workdir
+            if (!state.pending_drop_file.empty() &&
+                state.drop_target == DropTarget::WorkingDirectory) {
+              state.workdir = state.pending_drop_file;
+              state.pending_drop_file.clear();
+              state.drop_target = DropTarget::None;
+            }
+
+            char work_buf[256];
+            strncpy(work_buf, state.workdir.c_str(), sizeof(work_buf) - 1);
+            work_buf[sizeof(work_buf) - 1] = '\0';
+            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 120);
+
+            {
+              ImVec4 bg = (state.is_hovering_drop_zone &&
+                           state.drop_target == DropTarget::WorkingDirectory)
+                              ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
+                              : ImVec4(0.20f, 0.25f, 0.29f, 1.0f);
+              ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
+              if (ImGui::InputText("##workdir", work_buf, sizeof(work_buf))) {
+                state.workdir = work_buf;
+              }
+              // Always check for hover to enable drag and drop (even when
+              // typing or overlapped)
+              if (ImGui::IsItemHovered(
+                      ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
+                      ImGuiHoveredFlags_AllowWhenBlockedByPopup |
+                      ImGuiHoveredFlags_AllowWhenOverlappedByItem |
+                      ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
+                state.drop_target = DropTarget::WorkingDirectory;
+              }
+            }
+
+            // Show validation icon
+            ImGui::SameLine();
+            if (!state.workdir.empty()) {
+              if (DirectoryExists(state.workdir)) {
+                AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
+                                        false, "workdir_ok");
+                if (ImGui::IsItemHovered()) {
+                  ImGui::SetTooltip("Directory exists");
+                }
+              } else {
+                AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
+                                        true, "workdir_error");
+                if (ImGui::IsItemHovered()) {
+                  ImGui::SetTooltip("Directory does not exist!");
+                }
+              }
+            }
+            ImGui::NewLine();
+            ImGui::Text("Output Directory:");
+            ImGui::SameLine();
+            ImGui::TextDisabled("(?)");
+            if (ImGui::IsItemHovered()) {
+              ImGui::SetTooltip("Drag and drop a folder here");
+            }
+
+            // Apply pending drop for output dir
+            if (!state.pending_drop_file.empty() &&
+                state.drop_target == DropTarget::OutputDirectory) {
+              state.output_dir = state.pending_drop_file;
+              state.pending_drop_file.clear();
+              state.drop_target = DropTarget::None;
+            }
+
+            char out_buf[256];
+            strncpy(out_buf, state.output_dir.c_str(), sizeof(out_buf) - 1);
+            out_buf[sizeof(out_buf) - 1] = '\0';
+            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 120);
+
+            {
+              ImVec4 bg = (state.is_hovering_drop_zone &&
+                           state.drop_target == DropTarget::OutputDirectory)
+                              ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
+                              : ImVec4(0.20f, 0.25f, 0.29f, 1.0f);
+              ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
+              if (ImGui::InputText("##outdir", out_buf, sizeof(out_buf))) {
+                state.output_dir = out_buf;
+              }
+              // Always check for hover to enable drag and drop (even when
+              // typing or overlapped)
+              if (ImGui::IsItemHovered(
+                      ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
+                      ImGuiHoveredFlags_AllowWhenBlockedByPopup |
+                      ImGuiHoveredFlags_AllowWhenOverlappedByItem |
+                      ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
+                state.drop_target = DropTarget::OutputDirectory;
+              }
+            }
+
+            // Show validation icon
+            ImGui::SameLine();
+            if (!state.output_dir.empty()) {
+              if (DirectoryExists(state.output_dir)) {
+                AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
+                                        false, "output_dir_ok");
+                if (ImGui::IsItemHovered()) {
+                  ImGui::SetTooltip("Directory exists");
+                }
+              } else {
+                AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
+                                        true, "output_dir_error");
+                if (ImGui::IsItemHovered()) {
+                  ImGui::SetTooltip("Directory does not exist!");
+                }
+              }
+            }
+
+            ImGui::Unindent();
+
+            // Pop text color animation
+            ImGui::PopStyleColor(1); // Text color
+          }
+        }
+
+        // Settings section (available for all modes)
+        ImGui::Spacing();
+        ImGui::Separator();
+        ImGui::Spacing();
+        ImGui::TextColored(ImVec4(0.8f, 0.6f, 1.0f, 1.0f), "Settings");
+        ImGui::Spacing();
+
+        ImGui::Text("Log Folder Paths:");
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("Manage multiple log directories. Select one to "
+                            "view logs from that location.");
+        }
+
+        // Display list of log paths
+        ImGui::BeginChild("LogPathsList", ImVec2(0, 100), true);
+        for (int i = 0; i < (int)state.log_folder_paths.size(); i++) {
+          ImGuiIDScope _row(i);
+
+          // Radio button for selection
+          if (ImGui::RadioButton("##select", state.selected_log_folder == i)) {
+            state.selected_log_folder = i;
+            SaveConfig(state);
+          }
+          ImGui::SameLine();
+
+          // Display path
+          ImGui::TextWrapped("%s", state.log_folder_paths[i].c_str());
+          ImGui::SameLine();
+
+          // Delete button
+          {
+            ImGuiStyleColorScope _btn(ImGuiCol_Button,
+                                      ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
+            if (ImGui::SmallButton("Delete")) {
+              state.log_folder_paths.erase(state.log_folder_paths.begin() + i);
+              if (state.selected_log_folder >=
+                  (int)state.log_folder_paths.size()) {
+                state.selected_log_folder =
+                    (int)state.log_folder_paths.size() - 1;
+              }
+              if (state.selected_log_folder < 0)
+                state.selected_log_folder = 0;
+              SaveConfig(state);
+              ConfigureLogArchive(state);
+              ConfigureCatalogExport(state);
+              ConfigureDockerGc(state);
+            }
+          }
+        }
+        ImGui::EndChild();
+
+        // Add new log path
+        ImGui::Spacing();
+        ImGui::Text("Add New Log Path:");
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("Drag and drop a folder here or type the path");
+        }
+
+        // Apply pending drop for new log path
+        if (!state.pending_drop_file.empty() &&
+            state.drop_target == DropTarget::NewLogPath) {
+          state.new_log_path_input = state.pending_drop_file;
+          state.pending_drop_file.clear();
+          state.drop_target = DropTarget::None;
+        }
+
+        char new_path_buf[512];
+        strncpy(new_path_buf, state.new_log_path_input.c_str(),
+                sizeof(new_path_buf) - 1);
+        new_path_buf[sizeof(new_path_buf) - 1] = '\0';
+        ImGui::SetNextItemWidth(-200);
+
+        // Highlight input field when hovering for drop
+        {
+          ImVec4 bg = (state.is_hovering_drop_zone &&
+                       state.drop_target == DropTarget::NewLogPath)
+                          ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
+                          : ImVec4(0.20f, 0.25f, 0.29f, 1.0f);
+          ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
+          if (ImGui::InputText("##newlogpath", new_path_buf,
+                               sizeof(new_path_buf))) {
+            state.new_log_path_input = new_path_buf;
+          }
+          // Always check for hover to enable drag and drop (even when typing or
+          // overlapped)
+          if (ImGui::IsItemHovered(
+                  ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
+                  ImGuiHoveredFlags_AllowWhenBlockedByPopup |
+                  ImGuiHoveredFlags_AllowWhenOverlappedByItem |
+                  ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
+            state.drop_target = DropTarget::NewLogPath;
+          }
+        }
+
+        ImGui::SameLine();
+
+        // Show validation icon
+        if (!state.new_log_path_input.empty()) {
+          if (DirectoryExists(state.new_log_path_input)) {
+            AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
+                                    false, "log_path_ok");
+            if (ImGui::IsItemHovered()) {
+              ImGui::SetTooltip("Directory exists");
+            }
+          } else {
+            AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f), true,
+                                    "log_path_error");
+            if (ImGui::IsItemHovered()) {
+              ImGui::SetTooltip("Directory does not exist!");
+            }
+          }
+          ImGui::SameLine();
+        }
+
+        if (AnimatedButton("Add Path", ImVec2(0, 0), "add_path")) {
+          if (!state.new_log_path_input.empty()) {
+            // Only add if directory exists
+            if (DirectoryExists(state.new_log_path_input)) {
+              state.log_folder_paths.push_back(state.new_log_path_input);
+              state.new_log_path_input.clear();
+              SaveConfig(state);
+              ConfigureLogArchive(state);
+              ConfigureCatalogExport(state);
+              ConfigureDockerGc(state);
+            }
+          }
+        }
+
+        // Memory the live log views of all tasks share
+        ImGui::Spacing();
+        ImGui::Text("Log Memory (MB):");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("##logmemorymb", &state.log_memory_mb, 0);
+        state.log_memory_mb =
+            std::max(16, std::min(16384, state.log_memory_mb));
+        if (ImGui::IsItemDeactivatedAfterEdit())
+          SaveConfig(state);
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Memory the log views of all tasks may hold together. Past it, "
+              "the logs\nof the tabs viewed longest ago are dropped from "
+              "memory and read back\nfrom their files on disk when the tab "
+              "is selected again.");
+        }
+        ImGui::Text("Log Lines per Second:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("##logingestrate", &state.log_ingest_lines_per_sec, 0);
+        state.log_ingest_lines_per_sec =
+            std::max(0, std::min(1000000, state.log_ingest_lines_per_sec));
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+          g_log_ingest_rate = state.log_ingest_lines_per_sec;
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Output lines a second each log view shows in full (0 = no "
+              "limit). Past it\na view samples the output, keeping 1 line "
+              "in %d and every warning and\nerror, and past %d times it only "
+              "marks how many lines it skipped.\nThe log files on disk "
+              "always have every line.",
+              IngestThrottle::kSampleEvery, IngestThrottle::kSummaryFactor);
+        }
+
+        // Compaction of finished tasks
+        ImGui::Spacing();
+        ImGui::Text("Compact Finished Tasks After (min):");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("##compactafter", &state.compact_after_minutes, 0);
+        state.compact_after_minutes =
+            std::max(0, std::min(10080, state.compact_after_minutes));
+        if (ImGui::IsItemDeactivatedAfterEdit())
+          SaveConfig(state);
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Minutes after a run ends before its tab is folded into the "
+              "Finished list\n(0 = never). The list keeps its result, run "
+              "time and failure; Open\nbrings the tab back with its logs "
+              "read from disk.");
+        }
+
+        // Stall marker of the log views' time column
+        ImGui::Spacing();
+        ImGui::Text("Mark Output Gaps Over (s):");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("##loggapseconds", &state.log_gap_seconds, 0);
+        state.log_gap_seconds =
+            std::max(0, std::min(86400, state.log_gap_seconds));
+        if (ImGui::IsItemDeactivatedAfterEdit())
+          SaveConfig(state);
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "With the time column on, a line read after this long "
+              "without any output\ngets a rule above it and its time in "
+              "the warning color. 0 turns the\nmarker off.");
+        }
+
+#ifdef AUTOBUILD_HAVE_ZSTD
+        // Archive old run logs
+        ImGui::Spacing();
+        ImGui::Text("Archive Logs Older Than (days):");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("##logarchivedays", &state.log_archive_days, 0,
+                             90, state.log_archive_days == 0 ? "Off" : "%d")) {
+          SaveConfig(state);
+          ConfigureLogArchive(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Compresses run logs not written for this many days into "
+              "seekable .zst\narchives in the background (checked hourly). "
+              "The Logs Browser and\nthe viewer open them in place; `zstd -d` "
+              "restores the plain file.");
+        }
+#endif
+
+        // Columnar copy of the run catalog for analytics tools
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Export Run Catalog to Parquet",
+                            &state.export_catalog)) {
+          SaveConfig(state);
+          ConfigureCatalogExport(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Keeps catalog.parquet next to each logs root's catalog.jsonl: "
+              "a row per run\nwith its result, durations, phases, failure and "
+              "API stats, appended a\nminute after the run ends. Query it "
+              "with DuckDB, pandas or Spark, e.g.\n  SELECT task, "
+              "avg(duration_s) FROM 'catalog.parquet' GROUP BY task");
+        }
+        if (state.export_catalog) {
+          std::string export_error = g_catalog_exporter.Error();
+          if (!export_error.empty())
+            ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f),
+                               "Retrying: %s", export_error.c_str());
+        }
+
+        // Write-behind staging of network logs roots
+        ImGui::Spacing();
+        ImGui::Text("Stage Logs Locally:");
+        ImGui::SameLine();
+        int staging = (int)state.log_staging;
+        ImGui::SetNextItemWidth(200);
+        if (ImGui::Combo("##logstaging", &staging,
+                         "Off\0Network folders\0Every folder\0")) {
+          state.log_staging = (LogStaging)staging;
+          SaveConfig(state);
+          ConfigureLogStaging(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Runs write their logs to a local staging folder and the GUI "
+              "ships them to\nthe logs folder in the background, in large "
+              "writes, retrying when it is\nunreachable. Network folders "
+              "stages NFS and SMB shares only (every folder\nwhen an object "
+              "store is set). The Logs Browser sees a run once its files "
+              "are\nshipped, a few seconds behind; staged copies are removed "
+              "a while after\nthe run ends.");
+        }
+        if (state.log_staging != LogStaging::Off) {
+          auto text_setting = [&state](const char *label, const char *id,
+                                       const char *hint, std::string &value,
+                                       float width) {
+            ImGui::Text("%s", label);
+            ImGui::SameLine();
+            char buf[512];
+            strncpy(buf, value.c_str(), sizeof(buf) - 1);
+            buf[sizeof(buf) - 1] = '\0';
+            ImGui::SetNextItemWidth(width);
+            if (ImGui::InputTextWithHint(id, hint, buf, sizeof(buf)))
+              value = buf;
+            if (ImGui::IsItemDeactivatedAfterEdit()) {
+              SaveConfig(state);
+              ConfigureLogStaging(state);
+            }
+          };
+          text_setting("Staging Folder:", "##logstagingdir",
+                       LogStagingDir(state).c_str(), state.log_staging_dir,
+                       300);
+          ImGui::Text("Hold Launches Over (MB):");
+          ImGui::SameLine();
+          ImGui::SetNextItemWidth(100);
+          ImGui::InputInt("##logstagingbacklog", &state.log_staging_backlog_mb,
+                          0);
+          state.log_staging_backlog_mb =
+              std::max(0, std::min(1 << 20, state.log_staging_backlog_mb));
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
+            ConfigureLogStaging(state);
+          }
+          ImGui::SameLine();
+          ImGui::TextDisabled("(?)");
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip(
+                "Queued runs wait while more than this much of the staged "
+                "logs is not\nshipped yet (0 = never).");
+          }
+          text_setting("Object Store:", "##logobjectstore",
+                       "s3://bucket/prefix",
+                       state.log_object_store, 300);
+          ImGui::SameLine();
+          ImGui::TextDisabled("(?)");
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip(
+                "Also uploads every run to an S3-compatible store, its logs "
+                "as multipart\nuploads that go up while the run writes them. "
+                "Uses curl 7.75 or later\nand the AWS_ACCESS_KEY_ID, "
+                "AWS_SECRET_ACCESS_KEY and AWS_SESSION_TOKEN\nthe GUI was "
+                "started with.");
+          }
+          if (!state.log_object_store.empty()) {
+            text_setting("Endpoint:", "##logobjectendpoint",
+                         "AWS (e.g. https://minio.local:9000)",
+                         state.log_object_store_endpoint, 300);
+            text_setting("Region:", "##logobjectregion",
+                         "AWS_REGION or us-east-1",
+                         state.log_object_store_region, 150);
+          }
+          LogStager::Status staging_status = g_log_stager.GetStatus();
+          if (staging_status.roots > 0) {
+            std::string text = "Staged folders: " +
+                               std::to_string(staging_status.roots) +
+                               ", not shipped: " +
+                               FormatDockerSize((double)staging_status.backlog);
+            ImGui::TextDisabled("%s", text.c_str());
+          }
+          if (!staging_status.error.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f),
+                               "Retrying: %s", staging_status.error.c_str());
+          }
+        }
+
+        // OpenMetrics endpoint for fleet monitoring
+        ImGui::Spacing();
+        ImGui::Text("Metrics Port:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("##metricsport", &state.metrics_port, 0);
+        state.metrics_port = std::max(0, std::min(65535, state.metrics_port));
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+          SaveConfig(state);
+          ConfigureMetrics(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("%s", state.metrics_status.c_str());
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Serves Prometheus/OpenMetrics text at /metrics on all\n"
+              "interfaces: running and queued runs, results, run and\n"
+              "phase durations, log lines and bytes, Docker API latency,\n"
+              "image cache hits and UI frame time. 0 turns it off.");
+        }
+
+        // Live dashboard for watching runs from other machines
+        ImGui::Text("Dashboard Port:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("##dashboardport", &state.dashboard_port, 0);
+        state.dashboard_port =
+            std::max(0, std::min(65535, state.dashboard_port));
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+          SaveConfig(state);
+          ConfigureDashboard(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("%s", state.dashboard_status.c_str());
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Serves a live web page on all interfaces with every task's\n"
+              "state, phase timeline and output as it is read (streamed\n"
+              "over Server-Sent Events); no login, so only open it on a\n"
+              "trusted network. 0 turns it off.");
+        }
+
+        // Local socket other programs submit runs through
+        ImGui::Text("Submission Socket:");
+        ImGui::SameLine();
+        char submit_buf[256];
+        strncpy(submit_buf, state.submit_socket.c_str(),
+                sizeof(submit_buf) - 1);
+        submit_buf[sizeof(submit_buf) - 1] = '\0';
+        ImGui::SetNextItemWidth(260);
+        if (ImGui::InputTextWithHint("##submitsocket", "off", submit_buf,
+                                     sizeof(submit_buf))) {
+          state.submit_socket = submit_buf;
+        }
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+          SaveConfig(state);
+          ConfigureSubmissions(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("%s", state.submit_status.c_str());
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Path of a Unix socket, only open to you, that CI jobs and\n"
+              "scripts hand runs to, so they share this instance's queue,\n"
+              "image cache and containers. One JSON object per line:\n"
+              "  {\"op\": \"submit\", \"task\": \"/abs/dir\", "
+              "\"mode\": \"Verify\", \"runs\": 1}\n"
+              "  {\"op\": \"status\" | \"cancel\" | \"logs\", "
+              "\"run\": <n>}\n"
+              "answered one per line; logs then streams the run's output.");
+        }
+        if (ImGui::Checkbox("Shared-memory log rings",
+                            &state.share_log_rings)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Publishes the output of each run started from now on in a\n"
+              "shared-memory segment only you can open,\n"
+              "autobuild-<pid>-<task id> (its name is in the socket's status\n"
+              "answer), which other programs follow without reading log\n"
+              "files, e.g. autobuild_cli --follow-log <name>. SharedLogRing\n"
+              "in autobuild_engine.h describes the reader protocol.");
+        }
+
+        // Auto-lowercase image/container names option
+        ImGui::Spacing();
+        ImGui::Separator();
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Auto-convert image/container names to lowercase",
+                            &state.auto_lowercase_names)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "When enabled, automatically converts image tags and container "
+              "names to lowercase to avoid Docker errors like:\n'invalid tag: "
+              "repository name must be lowercase'");
+        }
+
+        // NEW: Docker no-cache option
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Always use --no-cache for Docker builds",
+                            &state.use_docker_no_cache)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Forces Docker to rebuild images from scratch without using "
+              "cached layers. Ensures fresh builds every time an image is "
+              "built.\nWith BuildKit the base image is pulled again, while "
+              "npm, pip and yarn\ndownloads still come from the build's "
+              "cache mounts.");
+        }
+
+        // BuildKit builds with a shared layer cache
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Build with BuildKit and a shared layer cache",
+                            &state.use_buildkit)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Builds images with docker buildx, adds cache mounts for npm, "
+              "pip and yarn\nand imports/exports the layer cache, so a task "
+              "built on one worker is\nwarm on all of them. Falls back to "
+              "docker build without buildx.");
+        }
+        if (state.use_buildkit) {
+          ImGui::Text("Build Cache:");
+          ImGui::SameLine();
+          char cache_buf[512];
+          strncpy(cache_buf, state.build_cache.c_str(), sizeof(cache_buf) - 1);
+          cache_buf[sizeof(cache_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(300);
+          if (ImGui::InputTextWithHint("##buildcache",
+                                       "~/.cache/autobuild/buildkit",
+                                       cache_buf, sizeof(cache_buf))) {
+            state.build_cache = cache_buf;
+          }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
+          }
           ImGui::SameLine();
           ImGui::TextDisabled("(?)");
           if (ImGui::IsItemHovered()) {
             ImGui::SetTooltip(
-                "Drag and drop a folder from Windows Explorer here");
+                "A directory on this machine, or a registry repository "
+                "(e.g. registry.local/autobuild-cache)\nthat every worker "
+                "can reach. \"off\" builds without a shared cache.");
           }
+        }
 
-          // Apply pending drop if available
-          if (!state.pending_drop_file.empty() &&
-              state.drop_target == DropTarget::TaskDirectory) {
-            state.task_directory = state.pending_drop_file;
-            state.pending_drop_file.clear();
-            state.drop_target = DropTarget::None;
-            // Validate immediately after drop
-            state.validation = ValidateTaskDirectory(state.task_directory);
+        // Package caches shared between task containers
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Share package caches between containers",
+                            &state.use_cache_volumes)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Mounts named Docker volumes for the npm cache (npx and npm "
+              "install -g),\npip's cache and apt's archives into every task "
+              "container, so only the\nfirst run downloads packages. "
+              "Volumes are trimmed past\nAUTOBUILD_CACHE_VOLUME_MB "
+              "(default 4096) megabytes.");
+        }
+        if (state.use_cache_volumes) {
+          ImGui::Text("Caches:");
+          ImGui::SameLine();
+          char volumes_buf[64];
+          strncpy(volumes_buf, state.cache_volumes.c_str(),
+                  sizeof(volumes_buf) - 1);
+          volumes_buf[sizeof(volumes_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(200);
+          if (ImGui::InputTextWithHint("##cachevolumes", "npm,pip,apt",
+                                       volumes_buf, sizeof(volumes_buf),
+                                       ImGuiInputTextFlags_CharsNoBlank)) {
+            state.cache_volumes = volumes_buf;
           }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
+          }
+        }
 
-          char task_buf[512];
-          strncpy(task_buf, state.task_directory.c_str(), sizeof(task_buf) - 1);
-          task_buf[sizeof(task_buf) - 1] = '\0';
-          ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 60);
-
-          // Highlight input field when hovering for drop
-          {
-            ImVec4 bg = (state.is_hovering_drop_zone &&
-                         state.drop_target == DropTarget::TaskDirectory)
-                            ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
-                            : ImVec4(0.25f, 0.30f, 0.35f, 1.0f);
-            ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
-            if (ImGui::InputText("##task", task_buf, sizeof(task_buf))) {
-              state.task_directory = task_buf;
-              // Validate on text change
-              state.validation = ValidateTaskDirectory(state.task_directory);
-            }
-            // Always check for hover to enable drag and drop (even when typing
-            // or overlapped)
-            if (ImGui::IsItemHovered(
-                    ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
-                    ImGuiHoveredFlags_AllowWhenBlockedByPopup |
-                    ImGuiHoveredFlags_AllowWhenOverlappedByItem |
-                    ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
-              state.drop_target = DropTarget::TaskDirectory;
-            }
+        // Pull-through cache the package managers download through
+        ImGui::Text("Package Proxy:");
+        ImGui::SameLine();
+        int proxy = state.package_proxy;
+        ImGui::SetNextItemWidth(200);
+        if (ImGui::Combo("##packageproxy", &proxy,
+                         "Off\0One per Docker host\0Fleet-wide\0")) {
+          // Read with the workers by the metrics endpoint's thread
+          std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+          state.package_proxy = proxy;
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Runs a caching proxy (nginx, container "
+              "autobuild-package-proxy) that image builds\nand task "
+              "containers download npm, PyPI and apt packages through, "
+              "including\nnpm install -g and npx --yes. One per Docker host "
+              "starts it on every worker;\nfleet-wide starts it on this "
+              "host only, published on the port of the URL\nbelow, which "
+              "the workers are given. Hit rates are in the metrics "
+              "endpoint.\nThe cache is capped at AUTOBUILD_PROXY_CACHE_MB "
+              "(default 20480) megabytes.");
+        }
+        if (state.package_proxy == 2) {
+          ImGui::Text("Proxy URL:");
+          ImGui::SameLine();
+          char proxy_buf[256];
+          strncpy(proxy_buf, state.package_proxy_url.c_str(),
+                  sizeof(proxy_buf) - 1);
+          proxy_buf[sizeof(proxy_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(300);
+          if (ImGui::InputTextWithHint("##packageproxyurl",
+                                       "http://buildhost:3142", proxy_buf,
+                                       sizeof(proxy_buf),
+                                       ImGuiInputTextFlags_CharsNoBlank)) {
+            state.package_proxy_url = proxy_buf;
+          }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
+          }
+          if (!state.package_proxy_url.empty() &&
+              PackageProxySpec(2, state.package_proxy_url, false).empty()) {
+            ImGui::SameLine();
+            ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f),
+                               "needs an http:// URL");
           }
+        }
 
-          // Show validation icon
+        // Workdir storage
+        ImGui::Text("Workdir:");
+        ImGui::SameLine();
+        bool tmpfs = state.workdir_mount.compare(0, 5, "tmpfs") == 0;
+        int storage = tmpfs ? 1 : state.workdir_mount == "volume" ? 2 : 0;
+        ImGui::SetNextItemWidth(200);
+        if (ImGui::Combo("##workdirmount", &storage,
+                         "Container filesystem\0tmpfs (memory)\0"
+                         "Docker volume\0")) {
+          state.workdir_mount = storage == 1   ? "tmpfs:4g"
+                                : storage == 2 ? "volume"
+                                               : "";
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Where run containers keep their workdir. Builds and tests in "
+              "the\ncontainer's filesystem are slow on Docker Desktop; a "
+              "tmpfs of the\ngiven size or a volume on Docker's own disk is "
+              "faster. The image's\nfiles are copied in, and the final "
+              "workdir is saved to workdir.tar.gz\nin the run's logs. A "
+              "workdir_mount file in a task folder (tmpfs:<size>,\n"
+              "volume, volume:<host dir> or overlay) overrides this.");
+        }
+        if (state.workdir_mount.compare(0, 6, "tmpfs:") == 0) {
           ImGui::SameLine();
-          if (!state.task_directory.empty()) {
-            if (DirectoryExists(state.task_directory)) {
-              AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
-                                      false, "task_dir_ok");
-              if (ImGui::IsItemHovered()) {
-                ImGui::SetTooltip("Directory exists");
-              }
-            } else {
-              AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
-                                      true, "task_dir_error");
-              if (ImGui::IsItemHovered()) {
-                ImGui::SetTooltip("Directory does not exist!");
-              }
-            }
+          char size_buf[16];
+          strncpy(size_buf, state.workdir_mount.c_str() + 6,
+                  sizeof(size_buf) - 1);
+          size_buf[sizeof(size_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(60);
+          if (ImGui::InputTextWithHint("##tmpfssize", "4g", size_buf,
+                                       sizeof(size_buf),
+                                       ImGuiInputTextFlags_CharsNoBlank)) {
+            state.workdir_mount = std::string("tmpfs:") + size_buf;
+          }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
           }
+        }
 
-          // Show validation results
-          if (!state.task_directory.empty()) {
-            ImGui::Spacing();
-            {
-              ImGuiChildScope _validation_child("ValidationResults",
-                                                ImVec2(0, 180), true);
+        if (ImGui::Checkbox("Read phase output from the Docker API",
+                            &state.attach_phase_output)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Runs the install and verification commands of local runs "
+              "through the\nDocker API and reads their output straight into "
+              "the log view and\nlog file, instead of through docker exec "
+              "and the script. stderr is\nalso kept in <phase>.stderr.log. "
+              "Any exec the API cannot start\nfalls back to docker exec.");
+        }
+        if (ImGui::Checkbox("Capture output through a terminal",
+                            &state.pty_capture)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Runs start on a %dx%d pseudo-terminal instead of pipes, so "
+              "the Gemini CLI\nand build tools print as they go rather than "
+              "in buffered blocks, and\nkeep their progress output. stdout "
+              "and stderr share the terminal.\nWindows needs 10 (1809) or "
+              "later; older systems keep using pipes.",
+              kPtyColumns, kPtyRows);
+        }
+#ifdef _WIN32
+        if (ImGui::Checkbox("Run in WSL", &state.use_wsl)) {
+          SetExecBackend(state.use_wsl, state.wsl_distro);
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Runs the script and the Manage tab's helpers in a WSL2 "
+              "distro instead of\nGit Bash / MSYS2: docker, rsync and the "
+              "script run as Linux processes,\nand task folders can live on "
+              "the distro's filesystem (\\\\wsl.localhost\\...).\nThe "
+              "distro needs docker on its PATH, such as Docker Desktop's "
+              "WSL\nintegration. Runs already started keep their backend.");
+        }
+        if (state.use_wsl) {
+          ImGui::Indent();
+          ImGui::Text("Distro:");
+          ImGui::SameLine();
+          char distro_buf[128];
+          strncpy(distro_buf, state.wsl_distro.c_str(),
+                  sizeof(distro_buf) - 1);
+          distro_buf[sizeof(distro_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(200);
+          if (ImGui::InputTextWithHint("##wsldistro", "the default distro",
+                                       distro_buf, sizeof(distro_buf))) {
+            state.wsl_distro = distro_buf;
+          }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SetExecBackend(state.use_wsl, state.wsl_distro);
+            SaveConfig(state);
+          }
+          if (ImGui::Checkbox("Mirror task folders into WSL",
+                              &state.wsl_mirror_tasks)) {
+            SaveConfig(state);
+          }
+          ImGui::SameLine();
+          ImGui::TextDisabled("(?)");
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip(
+                "A task folder on a Windows drive is synced with rsync "
+                "into\n~/.autobuild/tasks in the distro before each run, "
+                "and the run\nworks from that copy, away from the slow "
+                "/mnt file share.\nEdits made inside the mirror are "
+                "overwritten by the next run.");
+          }
+          ImGui::Unindent();
+        }
+#endif
 
-              // Show found items
-              if (!state.validation.found_items.empty()) {
-                ImGui::TextColored(ImVec4(0.4f, 1.0f, 0.4f, 1.0f), "Found:");
-                for (const auto &item : state.validation.found_items) {
-                  ImGui::TextUnformatted(item.c_str());
-                }
-              }
+        // Content-addressed image cache
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Reuse images when env/ is unchanged",
+                            &state.use_image_cache)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Labels each built image with a hash of the task's env/ "
+              "directory and\nreuses it while the Dockerfile and build "
+              "context stay the same.\nThe 10 most recently used images are "
+              "kept (AUTOBUILD_IMAGE_CACHE_SIZE).\nQueued runs have their "
+              "images built ahead of their start, once per\ndistinct env/ "
+              "and up to the image build limit at a time.");
+        }
+        {
+          ImGuiDisabledScope _cache_off(!state.use_image_cache);
+          ImGui::Indent();
+          if (ImGui::Checkbox("Pre-build the selected task's image",
+                              &state.speculative_build)) {
+            SaveConfig(state);
+          }
+          ImGui::SameLine();
+          ImGui::TextDisabled("(?)");
+          if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+            ImGui::SetTooltip(
+                "Starts building the image of a task folder as soon as it "
+                "validates,\nwhile the farm has no other build to do, so "
+                "the first run finds it\nin the cache. Selecting another "
+                "folder stops the build.");
+          }
+          ImGui::Text("Image Registry:");
+          ImGui::SameLine();
+          char registry_buf[512];
+          strncpy(registry_buf, state.image_registry.c_str(),
+                  sizeof(registry_buf) - 1);
+          registry_buf[sizeof(registry_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(300);
+          if (ImGui::InputTextWithHint("##imageregistry", "none",
+                                       registry_buf, sizeof(registry_buf))) {
+            state.image_registry = registry_buf;
+          }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
+          }
+          ImGui::SameLine();
+          ImGui::TextDisabled("(?)");
+          if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+            ImGui::SetTooltip(
+                "A registry repository every worker can reach (e.g. "
+                "registry.local/autobuild-images).\nImages are pushed there "
+                "by env hash once built and pulled, by digest, on\nany "
+                "other host, and runs go to a host that already holds "
+                "their image.");
+          }
+          ImGui::Unindent();
+        }
 
-              // Show missing items
-              if (!state.validation.missing_items.empty()) {
-                if (!state.validation.found_items.empty()) {
-                  ImGui::Spacing();
-                }
-                ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Missing:");
-                for (const auto &item : state.validation.missing_items) {
-                  ImGui::TextUnformatted(item.c_str());
-                }
-              }
+        // Verification results memoized by workspace content
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Reuse verification of an unchanged workspace",
+                            &state.use_verify_cache)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Stores each verification's result and log under a hash of "
+              "the image, the\nworkdir as the prompts left it, the verify/ "
+              "files and the command, and\nreuses them when a run reaches "
+              "the same hash. Only the workdir is hashed,\nso leave this "
+              "off for verify steps that look outside it. Reused results\n"
+              "are marked in the run's log and in the Logs Browser.");
+        }
 
-              // Overall status
-              if (state.validation.missing_items.empty() &&
-                  !state.validation.found_items.empty()) {
-                ImGui::Spacing();
-                ImGui::Separator();
-                ImGui::TextColored(ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
-                                   "[OK] Task directory is valid!");
-              } else if (!state.validation.missing_items.empty()) {
-                ImGui::Spacing();
-                ImGui::Separator();
-                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f),
-                                   "[Warning] Some required files are missing");
-              }
-            }
-          }
+        // Audit outcomes memoized by their inputs
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Reuse audits of unchanged inputs",
+                            &state.use_audit_cache)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Stores each audit's answer and verdict under a hash of the "
+              "audit prompt,\nthe task prompt, verify/, the Dockerfile and "
+              "the Gemini CLI version, and\nreturns them for an audit of the "
+              "same hash without building, starting a\ncontainer or calling "
+              "the API. \"Force\" next to the Audit row runs it anyway.");
+        }
 
-          ImGui::Spacing();
+        // Verification split over cloned containers
+        ImGui::Text("Verification Shards:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("##verifyshards", &state.verify_shards, 0, 16,
+                             state.verify_shards < 2 ? "Off" : "%d")) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Runs the verification of a task whose verify/ has shard.sh "
+              "(called as\n\"bash shard.sh <index> <count>\") or tests.list "
+              "(one test per line, passed\nto the verification command) in "
+              "this many containers at once, cloned\nfrom the run's "
+              "container after the prompts. The shards' logs are merged\n"
+              "into verification.log; it passes when every shard passes.");
+        }
 
-          // API Key with show/hide button
-          ImGui::Text("Gemini API Key:");
-          ImGui::SameLine();
+        // Gemini CLI baked into a cached layer
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Preinstall Gemini CLI in a cached image layer",
+                            &state.use_cli_layer)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Builds a layer on top of each task image with the pinned "
+              "Gemini CLI\ninstalled and the npx cache warmed, once per "
+              "image, instead of\nrunning npm install in every container.");
+        }
 
-          // Eye button to toggle visibility (disabled if no API key)
-          bool has_api_key = !state.api_key.empty();
-          if (!has_api_key) {
-            ImGuiStyleColorScope _c1(ImGuiCol_Button,
-                                     ImVec4(0.3f, 0.3f, 0.3f, 0.5f));
-            ImGuiStyleColorScope _c2(ImGuiCol_ButtonHovered,
-                                     ImVec4(0.3f, 0.3f, 0.3f, 0.5f));
-            ImGuiStyleColorScope _c3(ImGuiCol_ButtonActive,
-                                     ImVec4(0.3f, 0.3f, 0.3f, 0.5f));
-            ImGuiStyleColorScope _c4(ImGuiCol_Text,
-                                     ImVec4(0.5f, 0.5f, 0.5f, 0.6f));
-            ImGuiDisabledScope _dis;
-            if (ImGui::SmallButton(state.show_api_key ? "Hide" : "Show")) {
-              state.show_api_key = !state.show_api_key;
-            }
-          } else {
-            if (ImGui::SmallButton(state.show_api_key ? "Hide" : "Show")) {
-              state.show_api_key = !state.show_api_key;
-            }
+        // Post-install checkpoint images
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Start runs from a checkpoint image",
+                            &state.use_checkpoint_image)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Commits the container of a feedback or audit run once the "
+              "Gemini CLI is\ninstalled and the prompts and verify files are "
+              "copied in, tagged by env/,\nCLI version and those files. Later "
+              "runs of the same task start from it\nand go straight to the "
+              "prompt phase, across restarts too.");
+        }
+        if (state.use_checkpoint_image) {
+          ImGui::Text("Checkpoint Registry:");
+          ImGui::SameLine();
+          char registry_buf[512];
+          strncpy(registry_buf, state.checkpoint_registry.c_str(),
+                  sizeof(registry_buf) - 1);
+          registry_buf[sizeof(registry_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(300);
+          if (ImGui::InputTextWithHint("##checkpointregistry",
+                                       "local images only", registry_buf,
+                                       sizeof(registry_buf))) {
+            state.checkpoint_registry = registry_buf;
+          }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
           }
           ImGui::SameLine();
           ImGui::TextDisabled("(?)");
           if (ImGui::IsItemHovered()) {
-            std::string config_path = GetConfigFilePath();
-            ImGui::SetTooltip("API Key is automatically saved to:\n%s",
-                              config_path.c_str());
+            ImGui::SetTooltip(
+                "A registry repository (e.g. registry.local/autobuild-ckpt) "
+                "that checkpoint\nimages are pulled from and pushed to, so "
+                "every host reaching it shares them.");
           }
+        }
 
-          char key_buf[256];
-          strncpy(key_buf, state.api_key.c_str(), sizeof(key_buf) - 1);
-          key_buf[sizeof(key_buf) - 1] = '\0';
-          ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 240);
+        // Warm container pool
+        ImGui::Spacing();
+        ImGui::Text("Warm Containers per Image:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("##containerpool", &state.container_pool_size, 0,
+                             8,
+                             state.container_pool_size == 0 ? "Off" : "%d")) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Keeps this many idle containers started for each shared or "
+              "cached image.\nA run takes one instead of starting its own "
+              "and a replacement is\nstarted in the background. Idle "
+              "containers are removed after an hour.");
+        }
 
-          // Use password flag if not showing
-          ImGuiInputTextFlags flags =
-              state.show_api_key ? 0 : ImGuiInputTextFlags_Password;
-          if (ImGui::InputText("##apikey", key_buf, sizeof(key_buf), flags)) {
-            std::string new_api_key = key_buf;
-            // Only update and save if the API key actually changed
-            if (new_api_key != state.api_key) {
-              state.api_key = new_api_key;
-              SaveConfig(state); // Auto-save when API key changes
-            }
+        // Cleanup of the containers and images finished runs leave behind
+        ImGui::Spacing();
+        ImGui::Text("Docker Cleanup:");
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Removes the containers and images of finished runs in the "
+              "background\n(every 15 minutes). Warm pool containers, runs "
+              "in progress and\nanything under 30 minutes old are kept. "
+              "Each removal is recorded,\nwith its log run, in "
+              "docker_gc.jsonl next to the settings file.");
+        }
+        ImGui::Text("Keep Runs per Task:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        bool gc_changed = ImGui::SliderInt(
+            "##dockergckeep", &state.docker_gc_keep, 0, 100,
+            state.docker_gc_keep == 0 ? "All" : "%d");
+        ImGui::Text("Remove Runs Older Than (hours):");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        gc_changed |= ImGui::SliderInt(
+            "##dockergcttl", &state.docker_gc_ttl_hours, 0, 720,
+            state.docker_gc_ttl_hours == 0 ? "Off" : "%d");
+        ImGui::Text("Trim Images Above (GB):");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("##dockergcdisk", &state.docker_gc_disk_gb, 0);
+        state.docker_gc_disk_gb =
+            std::max(0, std::min(100000, state.docker_gc_disk_gb));
+        gc_changed |= ImGui::IsItemDeactivatedAfterEdit();
+        if (gc_changed) {
+          SaveConfig(state);
+          ConfigureDockerGc(state);
+        }
+        if (state.docker_gc_keep > 0 || state.docker_gc_ttl_hours > 0 ||
+            state.docker_gc_disk_gb > 0) {
+          if (ImGui::Button("Clean Up Now")) {
+            ConfigureDockerGc(state);
+            g_docker_gc.SweepNow();
           }
-
-          ImGui::Spacing();
-
-          // Optional fields (collapsible) with smooth animation
-          static bool advanced_options_open = false;
-          bool was_open = advanced_options_open;
-          if (ImGui::CollapsingHeader("Advanced Options",
-                                      &advanced_options_open)) {
-            // Start animation when opening
-            if (!was_open && advanced_options_open) {
-              g_animation_manager.StartAnimation("advanced_options", 0.3f);
-            }
-
-            // Get animation progress for smooth height transition
-            float anim_progress = 1.0f;
-            if (g_animation_manager.IsAnimationPlaying("advanced_options")) {
-              auto &anim = g_animation_manager.GetAnimation("advanced_options");
-              anim.start_value = 0.0f;
-              anim.end_value = 1.0f;
-              anim_progress = anim.GetValue();
-            }
-
-            // Apply alpha based on animation progress
-            ImVec4 text_color = ImGui::GetStyle().Colors[ImGuiCol_Text];
-            text_color.w *= anim_progress;
-            ImGui::PushStyleColor(ImGuiCol_Text, text_color);
-
-            ImGui::Indent();
-
-            ImGui::Text("Image Tag:");
-            char img_buf[256];
-            strncpy(img_buf, state.image_tag.c_str(), sizeof(img_buf) - 1);
-            img_buf[sizeof(img_buf) - 1] = '\0';
-            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 240);
-            if (ImGui::InputText("##imagetag", img_buf, sizeof(img_buf))) {
-              state.image_tag = img_buf;
-            }
-
-            ImGui::Text("Container Name:");
-            char cont_buf[256];
-            strncpy(cont_buf, state.container_name.c_str(),
-                    sizeof(cont_buf) - 1);
-            cont_buf[sizeof(cont_buf) - 1] = '\0';
-            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 240);
-            if (ImGui::InputText("##container", cont_buf, sizeof(cont_buf))) {
-              state.container_name = cont_buf;
-            }
-
-            ImGui::Text("Working Directory:");
-            ImGui::SameLine();
-            ImGui::TextDisabled("(?)");
-            if (ImGui::IsItemHovered()) {
-              ImGui::SetTooltip("Drag and drop a folder here");
-            }
-
-            // Apply pending drop for workdir
-            if (!state.pending_drop_file.empty() &&
-                state.drop_target == DropTarget::WorkingDirectory) {
-              state.workdir = state.pending_drop_file;
-              state.pending_drop_file.clear();
-              state.drop_target = DropTarget::None;
-            }
-
-            char work_buf[256];
-            strncpy(work_buf, state.workdir.c_str(), sizeof(work_buf) - 1);
-            work_buf[sizeof(work_buf) - 1] = '\0';
-            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 120);
-
-            {
-              ImVec4 bg = (state.is_hovering_drop_zone &&
-                           state.drop_target == DropTarget::WorkingDirectory)
-                              ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
-                              : ImVec4(0.20f, 0.25f, 0.29f, 1.0f);
-              ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
-              if (ImGui::InputText("##workdir", work_buf, sizeof(work_buf))) {
-                state.workdir = work_buf;
-              }
-              // Always check for hover to enable drag and drop (even when
-              // typing or overlapped)
-              if (ImGui::IsItemHovered(
-                      ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
-                      ImGuiHoveredFlags_AllowWhenBlockedByPopup |
-                      ImGuiHoveredFlags_AllowWhenOverlappedByItem |
-                      ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
-                state.drop_target = DropTarget::WorkingDirectory;
-              }
-            }
-
-            // Show validation icon
-            ImGui::SameLine();
-            if (!state.workdir.empty()) {
-              if (DirectoryExists(state.workdir)) {
-                AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
-                                        false, "workdir_ok");
-                if (ImGui::IsItemHovered()) {
-                  ImGui::SetTooltip("Directory exists");
-                }
-              } else {
-                AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
-                                        true, "workdir_error");
-                if (ImGui::IsItemHovered()) {
-                  ImGui::SetTooltip("Directory does not exist!");
-                }
-              }
-            }
-            ImGui::NewLine();
-            ImGui::Text("Output Directory:");
+          std::string gc_status = g_docker_gc.Status();
+          if (!gc_status.empty()) {
             ImGui::SameLine();
-            ImGui::TextDisabled("(?)");
-            if (ImGui::IsItemHovered()) {
-              ImGui::SetTooltip("Drag and drop a folder here");
-            }
-
-            // Apply pending drop for output dir
-            if (!state.pending_drop_file.empty() &&
-                state.drop_target == DropTarget::OutputDirectory) {
-              state.output_dir = state.pending_drop_file;
-              state.pending_drop_file.clear();
-              state.drop_target = DropTarget::None;
-            }
+            ImGui::TextDisabled("%s", gc_status.c_str());
+          }
+        }
 
-            char out_buf[256];
-            strncpy(out_buf, state.output_dir.c_str(), sizeof(out_buf) - 1);
-            out_buf[sizeof(out_buf) - 1] = '\0';
-            ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x - 120);
+        // Shared image for runs started together
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Build once for multiple runs",
+                            &state.build_once_for_multiple)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "When several runs of a task are started together, build the "
+              "image once\nand start every run's container from it, pinned "
+              "to its content ID.");
+        }
 
-            {
-              ImVec4 bg = (state.is_hovering_drop_zone &&
-                           state.drop_target == DropTarget::OutputDirectory)
-                              ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
-                              : ImVec4(0.20f, 0.25f, 0.29f, 1.0f);
-              ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
-              if (ImGui::InputText("##outdir", out_buf, sizeof(out_buf))) {
-                state.output_dir = out_buf;
-              }
-              // Always check for hover to enable drag and drop (even when
-              // typing or overlapped)
-              if (ImGui::IsItemHovered(
-                      ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
-                      ImGuiHoveredFlags_AllowWhenBlockedByPopup |
-                      ImGuiHoveredFlags_AllowWhenOverlappedByItem |
-                      ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
-                state.drop_target = DropTarget::OutputDirectory;
-              }
-            }
+        // Both mode's two pipelines side by side
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Run Both mode in parallel",
+                            &state.parallel_both)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Both mode builds the image once, then runs feedback and verify "
+              "at the\nsame time, each in a fresh container, instead of one "
+              "after the other.\nA Both run then takes as long as the slower "
+              "of the two.");
+        }
 
-            // Show validation icon
-            ImGui::SameLine();
-            if (!state.output_dir.empty()) {
-              if (DirectoryExists(state.output_dir)) {
-                AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
-                                        false, "output_dir_ok");
-                if (ImGui::IsItemHovered()) {
-                  ImGui::SetTooltip("Directory exists");
-                }
-              } else {
-                AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
-                                        true, "output_dir_error");
-                if (ImGui::IsItemHovered()) {
-                  ImGui::SetTooltip("Directory does not exist!");
-                }
-              }
-            }
+        // NEW: Docker debug option
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Enable Docker build debug mode",
+                            &state.use_docker_debug)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Enables verbose Docker build output with --progress=plain.\n"
+              "Shows detailed build steps and command output for debugging.\n"
+              "Useful for troubleshooting build issues.");
+        }
 
-            ImGui::Unindent();
+        // NEW: Max concurrent tasks setting
+        ImGui::Spacing();
+        ImGui::Text("Maximum Concurrent Tasks:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        {
+          ImGuiDisabledScope _fixed_limit(state.adaptive_concurrency);
+          if (ImGui::SliderInt("##maxconcurrent", &state.max_concurrent_tasks,
+                               1, 20)) {
+            SaveConfig(state);
+          }
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Maximum number of audits/builds that can run simultaneously "
+              "(1-20)\n\nWARNING: High values (>10) may:\n- Overload your "
+              "system\n- Cause Docker resource conflicts\n- Slow down all "
+              "tasks\n- Use excessive memory/CPU");
+        }
 
-            // Pop text color animation
-            ImGui::PopStyleColor(1); // Text color
+        // Show warning for high values
+        if (!state.adaptive_concurrency && state.max_concurrent_tasks > 10) {
+          ImGui::SameLine();
+          ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), "[WARNING]");
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("High concurrent task limit! This may overload "
+                              "your system and cause performance issues.");
           }
         }
 
-        // Settings section (available for all modes)
-        ImGui::Spacing();
-        ImGui::Separator();
-        ImGui::Spacing();
-        ImGui::TextColored(ImVec4(0.8f, 0.6f, 1.0f, 1.0f), "Settings");
+        // Queue order
         ImGui::Spacing();
-
-        ImGui::Text("Log Folder Paths:");
+        ImGui::Text("Queue Order:");
+        ImGui::SameLine();
+        int queue_order = (int)state.queue_order;
+        ImGui::SetNextItemWidth(200);
+        if (ImGui::Combo("##queueorder", &queue_order,
+                         "Fair (task folders take turns)\0Shortest first\0"
+                         "Longest first\0")) {
+          std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+          state.queue_order = (QueueOrder)queue_order;
+          SaveConfig(state);
+        }
         ImGui::SameLine();
         ImGui::TextDisabled("(?)");
         if (ImGui::IsItemHovered()) {
-          ImGui::SetTooltip("Manage multiple log directories. Select one to "
-                            "view logs from that location.");
+          ImGui::SetTooltip(
+              "Which queued run starts when a slot frees up.\n\nFair lets "
+              "verification go first and task folders take turns.\n"
+              "Shortest and longest first go by how long passed runs of the "
+              "same\ntask and mode took (from the run catalog). Longest "
+              "first keeps a\nlong audit queued last from holding up the "
+              "end of a batch.");
         }
 
-        // Display list of log paths
-        ImGui::BeginChild("LogPathsList", ImVec2(0, 100), true);
-        for (int i = 0; i < (int)state.log_folder_paths.size(); i++) {
-
-          // Radio button for selection
-          if (ImGui::RadioButton("##select", state.selected_log_folder == i)) {
-            state.selected_log_folder = i;
-            SaveConfig(state);
+        // Adaptive concurrency
+        ImGui::Spacing();
+        if (ImGui::Checkbox("Adapt to host load",
+                            &state.adaptive_concurrency)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Start queued runs while the host has room instead of using a "
+              "fixed limit.\n\nRuns hold while CPU load is at the core count, "
+              "free memory is low\nor Docker is running many containers. "
+              "Image builds, container setup\nand verification share the "
+              "build budget; Gemini prompt runs use\nthe prompt budget.");
+        }
+        if (ImGui::Checkbox("Limit container resources",
+                            &state.use_container_limits)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Give each local run's containers CPU, memory and process "
+              "limits.\n\nLimits are 1.5x the peaks the task's last runs of "
+              "the same type\nreached, or half the host without history. "
+              "Runs also hold while\nthe running ones are expected to fill "
+              "host memory.");
+        }
+        if (ImGui::Checkbox("Background priority for builds",
+                            &state.background_builds)) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Run each run's processes below normal priority in every "
+              "phase but its\nGemini prompts, so image builds, installs and "
+              "verification under full\nload leave the GUI responsive "
+              "(nice and I/O priority on Linux, nice\non macOS, a "
+              "below-normal job on Windows). Applies to runs started\n"
+              "from now on; containers are limited separately.");
+        }
+        ImGui::SameLine();
+        if (ImGui::Checkbox("Raise GUI priority", &state.raise_gui_priority)) {
+          ApplyGuiThreadPriority(state);
+          SaveConfig(state);
+        }
+        if (state.gui_priority_denied) {
+          ImGui::SameLine();
+          ImGui::TextDisabled("(not permitted)");
+          if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("The OS refused a higher priority for the GUI "
+                              "thread; on Linux\nthat takes CAP_SYS_NICE or "
+                              "an RLIMIT_NICE allowance.");
+        }
+#ifdef _WIN32
+        ImGui::Text("Process Tree:");
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(120);
+        if (ImGui::SliderInt("##treecpu", &state.tree_cpu_percent, 0, 100,
+                             state.tree_cpu_percent == 0 ? "CPU: no cap"
+                                                         : "CPU: %d%%")) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(120);
+        if (ImGui::InputInt("MiB##treemem", &state.tree_memory_mb, 256,
+                            1024)) {
+          state.tree_memory_mb = std::max(0, state.tree_memory_mb);
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Each run's process tree (bash, the Docker CLI and anything "
+              "they start)\nlives in a job object. Stopping a run ends the "
+              "whole tree at once.\n\nOptionally cap the tree's CPU share of "
+              "the machine and its committed\nmemory (0 MiB = no limit). "
+              "Containers are limited separately.");
+        }
+#endif
+        if (state.adaptive_concurrency) {
+          HostLoadSample host;
+          int build_budget = 0;
+          {
+            std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+            host = state.host_load;
+            build_budget = AdaptiveBuildBudget(state);
           }
+          ImGui::Text("Build Budget:");
           ImGui::SameLine();
-
-          // Display path
-          ImGui::TextWrapped("%s", state.log_folder_paths[i].c_str());
+          ImGui::SetNextItemWidth(100);
+          if (ImGui::SliderInt("##maxbuild", &state.max_build_tasks, 0, 64,
+                               state.max_build_tasks == 0 ? "Auto" : "%d")) {
+            SaveConfig(state);
+          }
           ImGui::SameLine();
-
-          // Delete button
-          {
-            ImGuiStyleColorScope _btn(ImGuiCol_Button,
-                                      ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
-            if (ImGui::SmallButton(
-                    (std::string("Delete##") + std::to_string(i)).c_str())) {
-              state.log_folder_paths.erase(state.log_folder_paths.begin() + i);
-              if (state.selected_log_folder >=
-                  (int)state.log_folder_paths.size()) {
-                state.selected_log_folder =
-                    (int)state.log_folder_paths.size() - 1;
-              }
-              if (state.selected_log_folder < 0)
-                state.selected_log_folder = 0;
-              SaveConfig(state);
-            }
+          ImGui::TextDisabled("(%d)", build_budget);
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Concurrent builds, container setups and "
+                              "verifications.\nAuto allows one per %d cores.",
+                              kCoresPerBuild);
           }
+          const char *load_text =
+              host.load >= 0.0 ? FrameText(", load %.1f", host.load) : "";
+          const char *mem_text =
+              host.mem_total != 0
+                  ? FrameText(", %.1f / %.1f GiB free",
+                              host.mem_available / double(1ull << 30),
+                              host.mem_total / double(1ull << 30))
+                  : "";
+          const char *containers_text =
+              host.containers >= 0
+                  ? FrameText(", %d containers", host.containers)
+                  : "";
+          ImGui::TextDisabled("Host: %d cores%s%s%s", host.cpus, load_text,
+                              mem_text, containers_text);
         }
-        ImGui::EndChild();
 
-        // Add new log path
+        // Pipeline stage limits, enforced where the script waits between
+        // stages
         ImGui::Spacing();
-        ImGui::Text("Add New Log Path:");
+        ImGui::Text("Stage Limits:");
         ImGui::SameLine();
         ImGui::TextDisabled("(?)");
         if (ImGui::IsItemHovered()) {
-          ImGui::SetTooltip("Drag and drop a folder here or type the path");
+          ImGui::SetTooltip(
+              "Each run waits before a stage until fewer than this many runs "
+              "are in it,\nso one run's image build can overlap another's "
+              "prompt.");
         }
-
-        // Apply pending drop for new log path
-        if (!state.pending_drop_file.empty() &&
-            state.drop_target == DropTarget::NewLogPath) {
-          state.new_log_path_input = state.pending_drop_file;
-          state.pending_drop_file.clear();
-          state.drop_target = DropTarget::None;
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Image builds##stage_build",
+                             &state.max_image_builds, 0, 64,
+                             state.max_image_builds == 0 ? "No limit" : "%d")) {
+          g_build_farm.Configure(state.max_image_builds);
+          SaveConfig(state);
         }
-
-        char new_path_buf[512];
-        strncpy(new_path_buf, state.new_log_path_input.c_str(),
-                sizeof(new_path_buf) - 1);
-        new_path_buf[sizeof(new_path_buf) - 1] = '\0';
-        ImGui::SetNextItemWidth(-200);
-
-        // Highlight input field when hovering for drop
-        {
-          ImVec4 bg = (state.is_hovering_drop_zone &&
-                       state.drop_target == DropTarget::NewLogPath)
-                          ? ImVec4(0.3f, 0.5f, 0.7f, 1.0f)
-                          : ImVec4(0.20f, 0.25f, 0.29f, 1.0f);
-          ImGuiStyleColorScope _bg(ImGuiCol_FrameBg, bg);
-          if (ImGui::InputText("##newlogpath", new_path_buf,
-                               sizeof(new_path_buf))) {
-            state.new_log_path_input = new_path_buf;
-          }
-          // Always check for hover to enable drag and drop (even when typing or
-          // overlapped)
-          if (ImGui::IsItemHovered(
-                  ImGuiHoveredFlags_AllowWhenBlockedByActiveItem |
-                  ImGuiHoveredFlags_AllowWhenBlockedByPopup |
-                  ImGuiHoveredFlags_AllowWhenOverlappedByItem |
-                  ImGuiHoveredFlags_AllowWhenOverlappedByWindow)) {
-            state.drop_target = DropTarget::NewLogPath;
-          }
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Base image pulls##stage_pull",
+                             &state.max_image_pulls, 0, 16,
+                             state.max_image_pulls == 0 ? "Default" : "%d")) {
+          g_base_puller.Configure(state.max_image_pulls);
+          SaveConfig(state);
         }
-
         ImGui::SameLine();
-
-        // Show validation icon
-        if (!state.new_log_path_input.empty()) {
-          if (DirectoryExists(state.new_log_path_input)) {
-            AnimatedStatusIndicator("[OK]", ImVec4(0.4f, 1.0f, 0.4f, 1.0f),
-                                    false, "log_path_ok");
-            if (ImGui::IsItemHovered()) {
-              ImGui::SetTooltip("Directory exists");
-            }
-          } else {
-            AnimatedStatusIndicator("[X]", ImVec4(1.0f, 0.4f, 0.4f, 1.0f), true,
-                                    "log_path_error");
-            if (ImGui::IsItemHovered()) {
-              ImGui::SetTooltip("Directory does not exist!");
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("The FROM images of queued tasks are pulled this "
+                            "many at a time,\nfirst task first, so builds "
+                            "find them local.");
+        }
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Prompt runs##stage_prompt", &state.max_api_tasks,
+                             1, 64)) {
+          ConfigureApiGovernor(state);
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("Concurrent Gemini prompt runs. These mostly "
+                            "wait on the API,\nso keep this within your "
+                            "API rate limits rather than your cores.");
+        }
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Prompts per minute##api_rate",
+                             &state.api_prompts_per_min, 0, 600,
+                             state.api_prompts_per_min == 0 ? "No limit"
+                                                            : "%d")) {
+          ConfigureApiGovernor(state);
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Prompt starts allowed per minute on one API key, as a token "
+              "bucket.\nA rate-limited prompt (429) is retried in its "
+              "container after the API's\nRetry-After or a jittered "
+              "backoff, and halves the prompts the key may\nrun at once; "
+              "each clean prompt widens that again.");
+        }
+        {
+          ApiGovernor::Status pace = g_api_governor.StatusOf(
+              ApiKeyId(state.api_key), std::chrono::steady_clock::now());
+          if (pace.rate_limits > 0) {
+            ImGui::TextDisabled("API key: %.1f prompts at once, %llu rate "
+                                "limit(s)",
+                                pace.window,
+                                (unsigned long long)pace.rate_limits);
+            if (pace.paused_s > 0.0) {
+              ImGui::SameLine();
+              ImGui::TextDisabled("- paused %.0fs", pace.paused_s);
             }
           }
-          ImGui::SameLine();
         }
-
-        if (AnimatedButton("Add Path", ImVec2(0, 0), "add_path")) {
-          if (!state.new_log_path_input.empty()) {
-            // Only add if directory exists
-            if (DirectoryExists(state.new_log_path_input)) {
-              state.log_folder_paths.push_back(state.new_log_path_input);
-              state.new_log_path_input.clear();
-              SaveConfig(state);
-            }
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputInt("Prompts per day##api_quota", &state.api_daily_quota,
+                        0);
+        state.api_daily_quota =
+            std::max(0, std::min(1000000, state.api_daily_quota));
+        if (ImGui::IsItemDeactivatedAfterEdit()) {
+          ConfigureApiGovernor(state);
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Daily prompt quota of one API key (0 = none). Low priority "
+              "batches then\nwait for the off-peak hours before the quota "
+              "resets, when what is left\nwould go to waste, and Normal "
+              "ones leave the reserve for High ones.\nOnly this instance's "
+              "prompts are counted.");
+        }
+        if (state.api_daily_quota > 0) {
+          bool quota_changed = false;
+          ImGui::SetNextItemWidth(100);
+          quota_changed |= ImGui::SliderInt("Resets at (UTC hour)##api_quota",
+                                            &state.api_quota_reset_utc, 0, 23);
+          ImGui::SetNextItemWidth(100);
+          quota_changed |=
+              ImGui::SliderInt("Reserve for High##api_quota",
+                               &state.api_quota_reserve_pct, 0, 90, "%d%%");
+          ImGui::SetNextItemWidth(100);
+          quota_changed |= ImGui::SliderInt("Off-peak hours##api_quota",
+                                            &state.api_offpeak_hours, 1, 24);
+          if (quota_changed) {
+            ConfigureApiGovernor(state);
+            SaveConfig(state);
           }
+          ApiGovernor::Quota quota =
+              g_api_governor.QuotaOf(ApiKeyId(state.api_key), time(nullptr));
+          ImGui::TextDisabled("API key today: %d of %d prompts, resets in %s",
+                              quota.used, quota.limit,
+                              FormatEta(quota.reset_in_s).c_str());
         }
-
-        // Auto-lowercase image/container names option
-        ImGui::Spacing();
-        ImGui::Separator();
-        ImGui::Spacing();
-        if (ImGui::Checkbox("Auto-convert image/container names to lowercase",
-                            &state.auto_lowercase_names)) {
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Verifications##stage_verify",
+                             &state.max_verify_tasks, 0, 64,
+                             state.max_verify_tasks == 0 ? "No limit" : "%d")) {
           SaveConfig(state);
         }
+
+        // Slots shared with the other instances on this host
+        ImGui::Text("Host Leases:");
+        ImGui::SameLine();
+        {
+          char lease_buf[512];
+          strncpy(lease_buf, state.host_lease_dir.c_str(),
+                  sizeof(lease_buf) - 1);
+          lease_buf[sizeof(lease_buf) - 1] = '\0';
+          ImGui::SetNextItemWidth(300);
+          if (ImGui::InputTextWithHint("##hostleasedir",
+                                       "off: this instance's limits only",
+                                       lease_buf, sizeof(lease_buf))) {
+            std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+            state.host_lease_dir = lease_buf;
+          }
+          if (ImGui::IsItemDeactivatedAfterEdit()) {
+            SaveConfig(state);
+          }
+        }
         ImGui::SameLine();
         ImGui::TextDisabled("(?)");
         if (ImGui::IsItemHovered()) {
           ImGui::SetTooltip(
-              "When enabled, automatically converts image tags and container "
-              "names to lowercase to avoid Docker errors like:\n'invalid tag: "
-              "repository name must be lowercase'");
+              "A directory every GUI and headless runner on this host names "
+              "(/tmp/autobuild-leases,\nsay). Runs, image builds, prompts "
+              "and verifications then lease slots from it,\nso together "
+              "they stay within one set of limits. limits.json in it sets "
+              "them for\nthe host, as {\"runs\": 6, \"build\": 2, "
+              "\"prompt\": 8, \"verify\": 3}; the limits above\napply "
+              "where it sets none. A slot comes free when its process "
+              "exits, however it exits.");
+        }
+        if (!state.host_lease_dir.empty()) {
+          ImGui::TextDisabled(
+              "Leased across the host: runs %d/%d, builds %d/%d, prompts "
+              "%d/%d, verifications %d/%d (0 = no limit)",
+              g_host_runs.Leased(), g_host_runs.Capacity(),
+              g_host_builds.Leased(), g_host_builds.Capacity(),
+              g_host_prompts.Leased(), g_host_prompts.Capacity(),
+              g_host_verifications.Leased(), g_host_verifications.Capacity());
         }
 
-        // NEW: Docker no-cache option
+        // Runs that went quiet are ended and queued again
         ImGui::Spacing();
-        if (ImGui::Checkbox("Always use --no-cache for Docker builds",
-                            &state.use_docker_no_cache)) {
-          SaveConfig(state);
-        }
+        ImGui::Text("Stall Watchdog (min):");
         ImGui::SameLine();
         ImGui::TextDisabled("(?)");
         if (ImGui::IsItemHovered()) {
           ImGui::SetTooltip(
-              "Forces Docker to rebuild images from scratch without using "
-              "cached layers. Ensures fresh builds every time.");
+              "A run that prints nothing and uses no CPU in its container "
+              "for this long is\nstalled (a prompt on a dead connection, a "
+              "hung docker exec): what runs in its\ncontainer goes into "
+              "its log, the run is ended and, up to Retries times, queued\n"
+              "again. A feedback run with a checkpoint resumes from it. "
+              "Prompts have their\nown limit; time waiting for a stage slot "
+              "does not count. Off never ends a run.");
+        }
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Build/Verify##stall_minutes",
+                             &state.stall_minutes, 0, 240,
+                             state.stall_minutes == 0 ? "Off" : "%d")) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Prompts##stall_prompt_minutes",
+                             &state.stall_prompt_minutes, 0, 240,
+                             state.stall_prompt_minutes == 0 ? "Off" : "%d")) {
+          SaveConfig(state);
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(100);
+        if (ImGui::SliderInt("Retries##stall_retries", &state.stall_retries, 0,
+                             5)) {
+          SaveConfig(state);
         }
 
-        // NEW: Docker debug option
+        // Second copies of the slowest audits and verify trials at the tail
+        // of a batch
         ImGui::Spacing();
-        if (ImGui::Checkbox("Enable Docker build debug mode",
-                            &state.use_docker_debug)) {
+        if (ImGui::Checkbox("Speculative Backups",
+                            &state.speculative_backups)) {
           SaveConfig(state);
         }
         ImGui::SameLine();
         ImGui::TextDisabled("(?)");
         if (ImGui::IsItemHovered()) {
           ImGui::SetTooltip(
-              "Enables verbose Docker build output with --progress=plain.\n"
-              "Shows detailed build steps and command output for debugging.\n"
-              "Useful for troubleshooting build issues.");
+              "Once nothing is queued and local slots are free, an audit or "
+              "verify run that has\ntaken 1.5x its expected time (and at "
+              "least 2 minutes) gets a second copy.\nThe first of the two "
+              "to finish is kept and the other is stopped.");
         }
 
-        // NEW: Max concurrent tasks setting
+        // Remote Docker hosts that take runs beyond this host's limit
         ImGui::Spacing();
-        ImGui::Text("Maximum Concurrent Tasks:");
+        ImGui::Text("Docker Workers:");
         ImGui::SameLine();
-        ImGui::SetNextItemWidth(100);
-        if (ImGui::SliderInt("##maxconcurrent", &state.max_concurrent_tasks, 1,
-                             20)) {
-          SaveConfig(state);
+        ImGui::TextDisabled("(?)");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip(
+              "Remote Docker hosts for queued runs, as a DOCKER_HOST URL\n"
+              "(tcp://host:2376, ssh://user@host) or a Docker context name.\n"
+              "Runs that do not fit here go to the worker with the most free\n"
+              "slots; a task folder stays on the worker that last ran it\n"
+              "while it has room, since its image is cached there.\n\n"
+              "k8s://<context>/<namespace> runs each run as a Kubernetes Job\n"
+              "(kubectl must reach the cluster). Its slots are a cap; runs\n"
+              "start as the cluster's nodes have room for their pods.");
+        }
+        {
+          std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+          std::map<std::string, int> busy;
+          for (const auto &task : state.tasks) {
+            if (task->is_running && !task->worker.empty())
+              busy[task->worker]++;
+          }
+          int remove = -1;
+          for (int i = 0; i < (int)state.docker_workers.size(); i++) {
+            DockerWorker &worker = state.docker_workers[i];
+            ImGui::PushID(i);
+            const bool cluster = IsClusterWorker(worker.endpoint);
+            ImGui::SetNextItemWidth(100);
+            if (ImGui::SliderInt("##worker_slots", &worker.slots, 1,
+                                 cluster ? kClusterWorkerMaxSlots
+                                         : kDockerWorkerMaxSlots,
+                                 "%d slots")) {
+              SaveConfig(state);
+            }
+            ImGui::SameLine();
+            ImGui::Text("%s", worker.endpoint.c_str());
+            ImGui::SameLine();
+            bool read_ok = false;
+            int fit = 0;
+            double cpus = 0.0, requested = 0.0;
+            if (cluster && g_clusters.Describe(worker.endpoint, read_ok, fit,
+                                               cpus, requested)) {
+              if (read_ok)
+                ImGui::TextDisabled("(%d running, room for %d more; "
+                                    "%.0f of %.0f CPUs requested)",
+                                    busy[worker.endpoint], fit, requested,
+                                    cpus);
+              else
+                ImGui::TextDisabled("(%d running; cluster not readable)",
+                                    busy[worker.endpoint]);
+            } else {
+              ImGui::TextDisabled("(%d running)", busy[worker.endpoint]);
+            }
+            ImGui::SameLine();
+            {
+              ImGuiStyleColorScope _btn(ImGuiCol_Button,
+                                        ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
+              if (ImGui::SmallButton("Delete"))
+                remove = i;
+            }
+            ImGui::PopID();
+          }
+          if (remove >= 0) {
+            state.docker_workers.erase(state.docker_workers.begin() + remove);
+            SaveConfig(state);
+          }
         }
+        char worker_buf[256];
+        strncpy(worker_buf, state.new_worker_input.c_str(),
+                sizeof(worker_buf) - 1);
+        worker_buf[sizeof(worker_buf) - 1] = '\0';
+        ImGui::SetNextItemWidth(100);
+        ImGui::SliderInt("##new_worker_slots", &state.new_worker_slots, 1,
+                         IsClusterWorker(state.new_worker_input)
+                             ? kClusterWorkerMaxSlots
+                             : kDockerWorkerMaxSlots,
+                         "%d slots");
         ImGui::SameLine();
-        ImGui::TextDisabled("(?)");
-        if (ImGui::IsItemHovered()) {
-          ImGui::SetTooltip(
-              "Maximum number of audits/builds that can run simultaneously "
-              "(1-20)\n\nWARNING: High values (>10) may:\n- Overload your "
-              "system\n- Cause Docker resource conflicts\n- Slow down all "
-              "tasks\n- Use excessive memory/CPU");
+        ImGui::SetNextItemWidth(-120);
+        if (ImGui::InputTextWithHint("##new_worker", "ssh://user@host",
+                                     worker_buf, sizeof(worker_buf))) {
+          state.new_worker_input = worker_buf;
         }
-
-        // Show warning for high values
-        if (state.max_concurrent_tasks > 10) {
-          ImGui::SameLine();
-          ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), "[WARNING]");
-          if (ImGui::IsItemHovered()) {
-            ImGui::SetTooltip("High concurrent task limit! This may overload "
-                              "your system and cause performance issues.");
+        ImGui::SameLine();
+        if (AnimatedButton("Add Worker", ImVec2(0, 0), "add_worker") &&
+            !state.new_worker_input.empty()) {
+          std::lock_guard<TracedMutex> lock(state.tasks_mutex);
+          bool known = false;
+          for (const auto &worker : state.docker_workers)
+            known = known || worker.endpoint == state.new_worker_input;
+          if (!known) {
+            DockerWorker worker;
+            worker.endpoint = state.new_worker_input;
+            worker.slots = state.new_worker_slots;
+            state.docker_workers.push_back(worker);
+            SaveConfig(state);
           }
+          state.new_worker_input.clear();
         }
 
         // Individual task counters are now in the main execution area
@@ -7048,6 +17512,7 @@ void RenderMainUI(AppState &state) {
   {
     ImGuiTabItemScope _tab_manage("Manage", nullptr, manage_tab_flags);
     if (_tab_manage) {
+      ProfileZone _zone("Manage tab");
       bool is_refreshing = state.docker_refreshing.load();
 
       if (!state.docker_loaded) {
@@ -7076,8 +17541,7 @@ void RenderMainUI(AppState &state) {
                        button_pos.y + ImGui::GetStyle().FramePadding.y - 5));
             ImGui::TextUnformatted("Refreshing...");
           } else {
-            if (ImGui::Button(
-                    (std::string(ICON_FA_REFRESH " ") + "Refresh").c_str())) {
+            if (ImGui::Button(ICON_FA_REFRESH " Refresh")) {
               RefreshDockerStateAsync(state);
             }
           }
@@ -7118,8 +17582,7 @@ void RenderMainUI(AppState &state) {
                        button_pos.y + ImGui::GetStyle().FramePadding.y - 5));
             ImGui::TextUnformatted("Refreshing...");
           } else {
-            if (ImGui::Button(
-                    (std::string(ICON_FA_REFRESH " ") + "Refresh").c_str())) {
+            if (ImGui::Button(ICON_FA_REFRESH " Refresh")) {
               RefreshDockerStateAsync(state);
             }
           }
@@ -7163,14 +17626,11 @@ void RenderMainUI(AppState &state) {
       } else {
         // Docker is available - show containers and images
 
-        // Create thread-safe snapshots of containers and images
-        std::vector<AppState::DockerContainer> containers_snapshot;
-        std::vector<AppState::DockerImage> images_snapshot;
-        {
-          std::lock_guard<std::mutex> lock(state.docker_state_mutex);
-          containers_snapshot = state.containers;
-          images_snapshot = state.images;
-        }
+        // The published listing; held for the frame, copied never
+        std::shared_ptr<const AppState::DockerSnapshot> snap =
+            DockerStateView(state);
+        const auto &containers_snapshot = snap->containers;
+        const auto &images_snapshot = snap->images;
 
         // Containers list
         if (state.docker_loaded) {
@@ -7184,15 +17644,30 @@ void RenderMainUI(AppState &state) {
           ImGui::SameLine();
           ImGuiStyleColorScope _btn(ImGuiCol_Button,
                                     ImVec4(0.9f, 0.3f, 0.2f, 1.0f));
+          ImGuiDisabledScope _busy(
+              g_docker_bulk.Busy(DockerBulkOps::Kind::Containers));
           if (ImGui::Button("Remove All Containers")) {
-            for (const auto &c : containers_snapshot) {
-              std::string sh = std::string("docker rm -f \"") + c.name +
-                               "\" >/dev/null 2>&1 || true";
-              RunShellLines(sh);
-            }
-            RefreshDockerStateAsync(state);
+            std::vector<std::string> names;
+            for (const auto &c : containers_snapshot)
+              names.push_back(c.name);
+            RemoveDockerContainers(state, std::move(names));
           }
         }
+        RenderDockerBulkOps(DockerBulkOps::Kind::Containers);
+        if (!state.container_remove_error.empty()) {
+          ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.4f, 1.0f), "%s",
+                             state.container_remove_error.c_str());
+          ImGui::SameLine();
+          if (ImGui::SmallButton("Dismiss##container_errors"))
+            state.container_remove_error.clear();
+        }
+        AppState::DockerTableView &cview = state.container_view;
+        if (state.docker_loaded && !containers_snapshot.empty())
+          RenderDockerViewControls("containers", cview, kContainerSorts,
+                                   IM_ARRAYSIZE(kContainerSorts),
+                                   containers_snapshot.size());
+        if (DockerViewStale(cview, snap->version))
+          RebuildContainerView(cview, *snap);
 
         {
           // Apply disabled style if not yet loaded
@@ -7219,60 +17694,59 @@ void RenderMainUI(AppState &state) {
             ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f),
                                "No containers found");
           } else {
-            // Show containers list
-            for (size_t i = 0; i < containers_snapshot.size(); ++i) {
-              const auto &c = containers_snapshot[i];
-
-              // Get available width before creating columns
-              float available_width = ImGui::GetContentRegionAvail().x;
-
-              // Use columns for proper layout with scrollable text
-              ImGui::Columns(3, nullptr, false);
-
-              // Text column (scrollable if too long) - reserve space for
-              // buttons
-              ImGui::SetColumnWidth(0, available_width - 160.0f);
-              ImGui::SetColumnWidth(1,
-                                    90.0f); // Fixed width for Open Logs button
-              ImGui::SetColumnWidth(2, 80.0f); // Fixed width for Delete button
-
-              ImGui::BeginChild(
-                  ("##container_text_" + std::to_string(i)).c_str(),
-                  ImVec2(0, ImGui::GetTextLineHeight() +
-                                ImGui::GetStyle().FramePadding.y * 6 - 2),
-                  false, ImGuiWindowFlags_HorizontalScrollbar);
-
-              // Build the full container info string
-              std::string container_info =
-                  c.name + " | " + c.image + " | " + c.status;
-              ImGui::TextUnformatted(container_info.c_str());
-              ImGui::EndChild();
-              ImGui::NextColumn();
-
-              // Open Logs column
-              if (!c.log_path.empty()) {
-                if (ImGui::SmallButton(
-                        (std::string("Open Logs##") + std::to_string(i))
-                            .c_str())) {
-                  OpenFolderExternal(c.log_path);
+            // Show the rows in view; IDs are listing indices so a button
+            // keeps its identity while the filter or order changes
+            ImGuiListClipper clipper;
+            clipper.Begin((int)cview.rows.size());
+            while (clipper.Step()) {
+              for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+                size_t i = cview.rows[r];
+                const auto &c = containers_snapshot[i];
+
+                // Get available width before creating columns
+                float available_width = ImGui::GetContentRegionAvail().x;
+
+                // Use columns for proper layout with scrollable text
+                ImGui::Columns(3, nullptr, false);
+
+                // Text column (scrollable if too long) - reserve space for
+                // buttons
+                ImGui::SetColumnWidth(0, available_width - 160.0f);
+                // Fixed widths for the Open Logs and Delete buttons
+                ImGui::SetColumnWidth(1, 90.0f);
+                ImGui::SetColumnWidth(2, 80.0f);
+                ImGui::PushID((int)i);
+
+                ImGui::BeginChild(
+                    "##container_text",
+                    ImVec2(0, ImGui::GetTextLineHeight() +
+                                  ImGui::GetStyle().FramePadding.y * 6 - 2),
+                    false, ImGuiWindowFlags_HorizontalScrollbar);
+                ImGui::Text("%s | %s | %s", c.name.c_str(), c.image.c_str(),
+                            c.status.c_str());
+                ImGui::EndChild();
+                ImGui::NextColumn();
+
+                // Open Logs column
+                if (!c.log_path.empty()) {
+                  if (ImGui::SmallButton("Open Logs")) {
+                    OpenFolderExternal(c.log_path);
+                  }
+                } else {
+                  ImGui::TextDisabled("(no log)");
                 }
-              } else {
-                ImGui::TextDisabled("(no log)");
-              }
-              ImGui::NextColumn();
-
-              // Delete column
-              if (ImGui::SmallButton(
-                      (std::string("Delete##") + std::to_string(i)).c_str())) {
-                std::string sh = std::string("docker rm -f \"") + c.name +
-                                 "\" >/dev/null 2>&1 || true";
-                RunShellLines(sh);
-                RefreshDockerStateAsync(state);
-              }
-              ImGui::NextColumn();
+                ImGui::NextColumn();
 
-              ImGui::Columns(1);
-              ImGui::Separator();
+                // Delete column
+                if (ImGui::SmallButton("Delete")) {
+                  RemoveDockerContainers(state, {c.name});
+                }
+                ImGui::NextColumn();
+                ImGui::PopID();
+
+                ImGui::Columns(1);
+                ImGui::Separator();
+              }
             }
           }
         }
@@ -7293,32 +17767,19 @@ void RenderMainUI(AppState &state) {
           ImGui::SameLine();
           ImGuiStyleColorScope _btn(ImGuiCol_Button,
                                     ImVec4(0.9f, 0.3f, 0.2f, 1.0f));
-          if (ImGui::Button("Remove All Images")) {
-            std::string all_errors;
-            bool any_success = false;
-
-            for (const auto &img : images_snapshot) {
-              std::string error_msg;
-              if (SafeDeleteImage(img.id, error_msg)) {
-                any_success = true;
-              } else {
-                if (!all_errors.empty())
-                  all_errors += "\n\n";
-                all_errors += "Image " + img.repo_tag + " (" + img.id + "):\n" +
-                              error_msg;
-              }
-            }
-
-            if (any_success) {
-              RefreshDockerStateAsync(state);
-            }
-
-            if (!all_errors.empty()) {
-              state.image_delete_error =
-                  "Bulk deletion errors:\n\n" + all_errors;
-            }
-          }
+          ImGuiDisabledScope _busy(
+              g_docker_bulk.Busy(DockerBulkOps::Kind::Images));
+          if (ImGui::Button("Remove All Images"))
+            DeleteDockerImages(state, DockerImageRefs(images_snapshot));
         }
+        RenderDockerBulkOps(DockerBulkOps::Kind::Images);
+        AppState::DockerTableView &iview = state.image_view;
+        if (state.docker_loaded && !images_snapshot.empty())
+          RenderDockerViewControls("images", iview, kImageSorts,
+                                   IM_ARRAYSIZE(kImageSorts),
+                                   images_snapshot.size());
+        if (DockerViewStale(iview, snap->version))
+          RebuildImageView(iview, *snap);
 
         {
           // Apply disabled style if not yet loaded
@@ -7344,48 +17805,48 @@ void RenderMainUI(AppState &state) {
             ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f),
                                "No images found");
           } else {
-            // Show images list
-            for (size_t i = 0; i < images_snapshot.size(); ++i) {
-              const auto &img = images_snapshot[i];
-
-              // Get available width before creating columns
-              float available_width = ImGui::GetContentRegionAvail().x;
-
-              // Use columns for proper layout with scrollable text
-              ImGui::Columns(2, nullptr, false);
-
-              // Text column (scrollable if too long) - reserve space for button
-              ImGui::SetColumnWidth(0, available_width - 80.0f);
-              ImGui::SetColumnWidth(1, 80.0f); // Fixed width for Delete button
-
-              ImGui::BeginChild(
-                  ("##image_text_" + std::to_string(i)).c_str(),
-                  ImVec2(0, ImGui::GetTextLineHeight() +
-                                ImGui::GetStyle().FramePadding.y * 6 - 2),
-                  false, ImGuiWindowFlags_HorizontalScrollbar);
-
-              // Build the full image info string
-              std::string image_info =
-                  img.repo_tag + " | " + img.id + " | " + img.size;
-              ImGui::TextUnformatted(image_info.c_str());
-              ImGui::EndChild();
-              ImGui::NextColumn();
-
-              // Delete column
-              if (ImGui::SmallButton(
-                      (std::string("Delete##") + std::to_string(i)).c_str())) {
-                std::string error_msg;
-                if (SafeDeleteImage(img.id, error_msg)) {
-                  RefreshDockerStateAsync(state);
-                } else {
-                  // Store error message and show error window
-                  state.image_delete_error = error_msg;
+            // Show the rows in view, as for containers
+            ImGuiListClipper clipper;
+            clipper.Begin((int)iview.rows.size());
+            while (clipper.Step()) {
+              for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r) {
+                size_t i = iview.rows[r];
+                const auto &img = images_snapshot[i];
+
+                // Get available width before creating columns
+                float available_width = ImGui::GetContentRegionAvail().x;
+
+                // Use columns for proper layout with scrollable text
+                ImGui::Columns(2, nullptr, false);
+
+                // Text column (scrollable if too long) - reserve space for
+                // the fixed-width Delete button
+                ImGui::SetColumnWidth(0, available_width - 80.0f);
+                ImGui::SetColumnWidth(1, 80.0f);
+                ImGui::PushID((int)i);
+
+                ImGui::BeginChild(
+                    "##image_text",
+                    ImVec2(0, ImGui::GetTextLineHeight() +
+                                  ImGui::GetStyle().FramePadding.y * 6 - 2),
+                    false, ImGuiWindowFlags_HorizontalScrollbar);
+                ImGui::Text("%s | %s | %s", img.repo_tag.c_str(),
+                            img.id.c_str(), img.size.c_str());
+                ImGui::EndChild();
+                ImGui::NextColumn();
+
+                // Delete column
+                if (ImGui::SmallButton("Delete")) {
+                  // Failures show in the error window once it is done
+                  DeleteDockerImages(state,
+                                     DockerImageRefs(images_snapshot, img.id));
                 }
-              }
-              ImGui::NextColumn();
+                ImGui::NextColumn();
+                ImGui::PopID();
 
-              ImGui::Columns(1);
-              ImGui::Separator();
+                ImGui::Columns(1);
+                ImGui::Separator();
+              }
             }
           }
         }
@@ -7394,15 +17855,42 @@ void RenderMainUI(AppState &state) {
           ImGui::PopStyleColor();
         }
 
+        ImGui::Spacing();
+        RenderDockerDiskUsage();
+
         // Error popup for image deletion moved to global scope (after TabBar)
 
       } // end else (Docker is available)
 
       // Logs Browser - always available regardless of Docker status
+      ProfileZone _browser_zone("Logs Browser");
       ImGui::Spacing();
       ImGui::Separator();
       ImGui::Spacing();
       ImGui::TextColored(ImVec4(0.9f, 0.7f, 0.5f, 1.0f), "Logs Browser");
+      ImGui::SameLine();
+      if (AnimatedButton(ICON_FA_SEARCH " Search All Logs",
+                         ImVec2(0, 0), "logs_search_open")) {
+        state.show_log_search = true;
+        ImGui::SetWindowFocus("Search Logs");
+      }
+      ImGui::SameLine();
+      if (AnimatedButton(ICON_FA_DATABASE " Run Analytics", ImVec2(0, 0),
+                         "run_analytics_open")) {
+        state.show_run_analytics = true;
+        ImGui::SetWindowFocus("Run Analytics");
+      }
+      ImGui::SameLine();
+      ImGui::SetNextItemWidth(300);
+      char filter_buf[256];
+      strncpy(filter_buf, state.logs_browser_query.c_str(),
+              sizeof(filter_buf));
+      filter_buf[sizeof(filter_buf) - 1] = '\0';
+      if (ImGui::InputTextWithHint("##logs_filter", "Filter runs",
+                                   filter_buf, sizeof(filter_buf)))
+        state.logs_browser_query = filter_buf;
+      if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("%s", kLogQueryHelp);
 
       // Determine current logs root
       std::string logs_root =
@@ -7410,210 +17898,130 @@ void RenderMainUI(AppState &state) {
               ? std::string()
               : state.log_folder_paths[std::max(0, state.selected_log_folder)];
 
+      // The tree comes from the background indexer; until its first scan of
+      // this root lands, show a placeholder instead of touching the disk
+      std::shared_ptr<const LogsTreeSnapshot> logs_tree =
+          g_logs_index.Get(logs_root);
+      bool logs_indexed = logs_tree && logs_tree->root == logs_root;
+
       // If logs root doesn't exist but is configured, try to create it
-      if (!logs_root.empty() && !DirectoryExists(logs_root)) {
+      if (!logs_root.empty() && logs_indexed && !logs_tree->exists) {
         if (CreateDirectoryRecursive(logs_root)) {
           if (g_show_debug_console) {
             ConsoleLog("[DEBUG] Created logs directory: " + logs_root);
           }
+          g_logs_index.Touch(logs_root);
         }
       }
 
-      if (!logs_root.empty() && DirectoryExists(logs_root)) {
+      if (!logs_root.empty() && !logs_indexed) {
+        ImGui::TextDisabled("Indexing logs...");
+      } else if (!logs_root.empty() && logs_tree->exists) {
+        const auto &log_tasks = logs_tree->tasks;
+        static LogsBrowserFilter filter;
+        UpdateLogsBrowserFilter(filter, logs_tree, state.logs_browser_query);
+        if (!filter.error.empty()) {
+          ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s",
+                             filter.error.c_str());
+        }
+        bool filtered = !filter.query.empty();
+        // Runs of the selected task the filter lets through (all of them
+        // when no filter is set)
+        const std::vector<int> *shown_runs = nullptr;
+        if (filtered) {
+          auto it = std::find(filter.tasks.begin(), filter.tasks.end(),
+                              state.selected_task_index);
+          static const std::vector<int> kNone;
+          shown_runs = it == filter.tasks.end()
+                           ? &kNone
+                           : &filter.runs[it - filter.tasks.begin()];
+        }
+        const LogsTreeSnapshot::Task *selected_task =
+            (state.selected_task_index >= 0 &&
+             state.selected_task_index < (int)log_tasks.size())
+                ? &log_tasks[state.selected_task_index]
+                : nullptr;
+        const LogsTreeSnapshot::Run *selected_run =
+            (selected_task && state.selected_run_index >= 0 &&
+             state.selected_run_index < (int)selected_task->runs.size())
+                ? &selected_task->runs[state.selected_run_index]
+                : nullptr;
+        std::string task_dir =
+            selected_task ? logs_root + "/" + selected_task->name : "";
+        std::string run_dir_for_files =
+            selected_run ? task_dir + "/" + selected_run->name : "";
+
         // Column 1: tasks list with action buttons
         ImGui::BeginChild("logs_tasks",
                           ImVec2(ImGui::GetContentRegionAvail().x * 0.25f, 220),
                           true);
-        DIR *d = opendir(logs_root.c_str());
-        if (d) {
-          int idx = 0;
-          struct dirent *e;
-          std::vector<std::string> task_names;
-          while ((e = readdir(d)) != NULL) {
-            if (e->d_name[0] == '.')
-              continue;
-            std::string task_dir = logs_root + "/" + e->d_name;
-            if (!DirectoryExists(task_dir))
-              continue;
-            task_names.push_back(e->d_name);
-          }
-          closedir(d);
-
-          for (size_t i = 0; i < task_names.size(); i++) {
-            bool selected = (state.selected_task_index == (int)i);
-            std::string task_dir = logs_root + "/" + task_names[i];
-
-            float item_height = ImGui::GetTextLineHeight() * 2 + 10;
-            float start_y = ImGui::GetCursorPosY();
-            float button_size = ImGui::CalcTextSize(ICON_FA_FOLDER_OPEN).x +
-                                ImGui::GetStyle().FramePadding.x * 2;
-            float buttons_width =
-                button_size * 2 + ImGui::GetStyle().ItemSpacing.x + 5;
-
-            // Text with wrapping in a child for proper overflow
-            ImGui::BeginChild(
-                ("task_item_" + std::to_string(i)).c_str(),
-                ImVec2(ImGui::GetContentRegionAvail().x - buttons_width,
-                       item_height),
-                false);
-            if (ImGui::Selectable(("##task_sel_" + std::to_string(i)).c_str(),
-                                  selected, 0,
-                                  ImVec2(0, ImGui::GetTextLineHeight() * 2))) {
-              state.selected_task_index = i;
-              state.selected_run_index = -1;
-            }
-            ImGui::SameLine(0, 0);
-            ImGui::SetCursorPosX(5);
-            ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 5);
-            ImGui::PushTextWrapPos(ImGui::GetContentRegionAvail().x - 5);
-            ImGui::Text("%s", task_names[i].c_str());
-            ImGui::PopTextWrapPos();
-            ImGui::EndChild();
-
-            // Action buttons (positioned absolutely on the right)
-            ImGui::SameLine();
-            ImGui::SetCursorPosY(
-                start_y + (item_height - ImGui::GetTextLineHeight()) * 0.5f);
-            if (ImGui::SmallButton(
-                    (ICON_FA_FOLDER_OPEN "##open_task_" + std::to_string(i))
-                        .c_str())) {
-              OpenFolderExternal(task_dir);
-            }
-            if (ImGui::IsItemHovered())
-              ImGui::SetTooltip("Open folder");
-
-            ImGui::SameLine();
-            ImGui::SetCursorPosY(
-                start_y +
-                (item_height - ImGui::GetTextLineHeight() - 2) * 0.5f);
-            {
-              ImGuiStyleColorScope _btn(ImGuiCol_Button,
-                                        ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
-              if (ImGui::SmallButton(
-                      (ICON_FA_TRASH "##del_task_" + std::to_string(i))
-                          .c_str())) {
-                state.pending_delete_path = task_dir;
-                state.show_confirm_delete = true;
+        {
+          ImGuiListClipper clipper;
+          clipper.Begin(filtered ? (int)filter.tasks.size()
+                                 : (int)log_tasks.size());
+          while (clipper.Step()) {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd;
+                 row++) {
+              int i = filtered ? filter.tasks[row] : row;
+              const std::string &name = log_tasks[i].name;
+              if (RenderLogsBrowserRow(state, "task", i, name.c_str(), nullptr,
+                                       ImVec4(), state.selected_task_index == i,
+                                       FrameConcat({logs_root, "/", name}),
+                                       false,
+                                       "Delete task folder", nullptr, true)) {
+                state.selected_task_index = i;
+                state.selected_run_index = -1;
               }
             }
-            if (ImGui::IsItemHovered())
-              ImGui::SetTooltip("Delete task folder");
-
-            // Move to next line after buttons
-            ImGui::SetCursorPosY(start_y + item_height);
           }
         }
         ImGui::EndChild();
         ImGui::SameLine();
 
-        // Column 2: runs list (timestamps) with action buttons
+        // Column 2: runs list (timestamps) with result from the catalog
         ImGui::BeginChild("logs_runs",
                           ImVec2(ImGui::GetContentRegionAvail().x * 0.30f, 220),
                           true);
-        std::string selected_task_name;
-        int run_count = 0;
-        int current_task_idx = 0;
-        DIR *d2 = opendir(logs_root.c_str());
-        if (d2) {
-          struct dirent *e;
-          while ((e = readdir(d2)) != NULL) {
-            if (e->d_name[0] == '.')
-              continue;
-            std::string task_dir = logs_root + "/" + e->d_name;
-            if (!DirectoryExists(task_dir))
-              continue;
-            if (current_task_idx == state.selected_task_index) {
-              selected_task_name = e->d_name;
-              break;
-            }
-            current_task_idx++;
-          }
-          closedir(d2);
-        }
-        if (!selected_task_name.empty()) {
-          std::string task_dir = logs_root + "/" + selected_task_name;
-          DIR *d3 = opendir(task_dir.c_str());
-          if (d3) {
-            int idx = 0;
-            struct dirent *e;
-            std::vector<std::string> run_names;
-            while ((e = readdir(d3)) != NULL) {
-              if (e->d_name[0] == '.')
-                continue;
-              std::string run_dir = task_dir + "/" + e->d_name;
-              if (!DirectoryExists(run_dir))
-                continue;
-              run_names.push_back(e->d_name);
-            }
-            closedir(d3);
-
-            for (size_t i = 0; i < run_names.size(); i++) {
-              bool selected = (state.selected_run_index == (int)i);
-              std::string run_dir = task_dir + "/" + run_names[i];
-
-              float item_height = ImGui::GetTextLineHeight() * 2 + 5;
-              float start_y = ImGui::GetCursorPosY();
-              float button_size = ImGui::CalcTextSize(ICON_FA_FOLDER_OPEN).x +
-                                  ImGui::GetStyle().FramePadding.x * 2;
-              float buttons_width =
-                  button_size * 2 + ImGui::GetStyle().ItemSpacing.x + 5;
-
-              // Text with wrapping
-              ImGui::BeginChild(
-                  ("run_item_" + std::to_string(i)).c_str(),
-                  ImVec2(ImGui::GetContentRegionAvail().x - buttons_width,
-                         item_height),
-                  false);
-              if (ImGui::Selectable(
-                      ("##run_sel_" + std::to_string(i)).c_str(), selected, 0,
-                      ImVec2(0, ImGui::GetTextLineHeight() * 2))) {
-                state.selected_run_index = i;
-              }
-              ImGui::SameLine(0, 0);
-              ImGui::SetCursorPosX(5);
-              ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 5);
-              ImGui::PushTextWrapPos(ImGui::GetContentRegionAvail().x - 5);
-              ImGui::Text("%s", run_names[i].c_str());
-              ImGui::PopTextWrapPos();
-              ImGui::EndChild();
-
-              // Action buttons (positioned absolutely on the right)
-              ImGui::SameLine();
-              ImGui::SetCursorPosY(
-                  start_y + (item_height - ImGui::GetTextLineHeight()) * 0.5f);
-              if (ImGui::SmallButton(
-                      (ICON_FA_FOLDER_OPEN "##open_run_" + std::to_string(i))
-                          .c_str())) {
-                OpenFolderExternal(run_dir);
+        int run_count = selected_task ? (int)selected_task->runs.size() : 0;
+        if (selected_task && shown_runs)
+          run_count = (int)shown_runs->size();
+        if (selected_task) {
+          ImGuiListClipper clipper;
+          clipper.Begin(run_count);
+          while (clipper.Step()) {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd;
+                 row++) {
+              int i = shown_runs ? (*shown_runs)[row] : row;
+              const LogsTreeSnapshot::Run &run = selected_task->runs[i];
+              const char *status = "";
+              ImVec4 status_color(0.5f, 0.7f, 1.0f, 1.0f);
+              if (run.status == RunStatus::Running) {
+                status = "running";
+              } else if (run.status != RunStatus::Unknown) {
+                bool passed = run.status == RunStatus::Passed;
+                status = FrameText("%s, %s", passed ? "passed" : "failed",
+                                   FormatDuration(run.seconds).c_str());
+                status_color = passed ? ImVec4(0.4f, 0.9f, 0.4f, 1.0f)
+                                      : ImVec4(1.0f, 0.4f, 0.4f, 1.0f);
               }
-              if (ImGui::IsItemHovered())
-                ImGui::SetTooltip("Open folder");
-
-              ImGui::SameLine();
-              ImGui::SetCursorPosY(
-                  start_y + (item_height - ImGui::GetTextLineHeight()) * 0.5f);
-              {
-                ImGuiStyleColorScope _btn(ImGuiCol_Button,
-                                          ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
-                if (ImGui::SmallButton(
-                        (ICON_FA_TRASH "##del_run_" + std::to_string(i))
-                            .c_str())) {
-                  state.pending_delete_path = run_dir;
-                  state.show_confirm_delete = true;
-                }
+              bool hovered = false;
+              if (RenderLogsBrowserRow(state, "run", i, run.name.c_str(),
+                                       status, status_color,
+                                       state.selected_run_index == i,
+                                       FrameConcat({task_dir, "/", run.name}),
+                                       false,
+                                       "Delete run folder", &hovered, true)) {
+                state.selected_run_index = i;
               }
-              if (ImGui::IsItemHovered())
-                ImGui::SetTooltip("Delete run folder");
-
-              // Move to next line after buttons
-              ImGui::SetCursorPosY(start_y + item_height);
-
-              run_count++;
+              if (hovered && !run.failure.empty())
+                ImGui::SetTooltip("%s", run.failure.c_str());
             }
+          }
 
-            if (run_count == 0) {
-              ImGui::TextDisabled("No logs available for this task");
-            }
+          if (run_count == 0) {
+            ImGui::TextDisabled(filtered
+                                    ? "No runs of this task match the filter"
+                                    : "No logs available for this task");
           }
         } else {
           ImGui::TextDisabled("Select a task to see runs");
@@ -7625,87 +18033,78 @@ void RenderMainUI(AppState &state) {
         ImGui::BeginChild("logs_subdirs",
                           ImVec2(ImGui::GetContentRegionAvail().x * 0.28f, 220),
                           true);
-        std::string run_dir_for_files;
-        if (!selected_task_name.empty() && state.selected_run_index >= 0) {
-          // Recompute selected run name
-          std::string run_name;
-          int idx = 0;
-          std::string task_dir = logs_root + "/" + selected_task_name;
-          DIR *d4 = opendir(task_dir.c_str());
-          if (d4) {
-            struct dirent *e;
-            while ((e = readdir(d4)) != NULL) {
-              if (e->d_name[0] == '.')
-                continue;
-              std::string run_dir = task_dir + "/" + e->d_name;
-              if (!DirectoryExists(run_dir))
-                continue;
-              if (idx == state.selected_run_index) {
-                run_name = e->d_name;
-                break;
+        if (selected_run) {
+          int subdir_count = (int)selected_run->modes.size();
+          for (int i = 0; i < subdir_count; i++) {
+            const auto &mode = selected_run->modes[i];
+            bool hovered = false;
+            RenderLogsBrowserRow(
+                state, "subdir", i,
+                FrameConcat({ICON_FA_FOLDER " ", mode.name}), nullptr,
+                ImVec4(), false,
+                FrameConcat({run_dir_for_files, "/", mode.name}), false,
+                "Delete folder", &hovered);
+            auto rec = hovered ? logs_tree->catalog->find(std::string_view(
+                                     FrameConcat({selected_task->name, "/",
+                                                  selected_run->name, "/",
+                                                  mode.name})))
+                               : logs_tree->catalog->end();
+            if (rec != logs_tree->catalog->end()) {
+              const RunRecord &rr = rec->second;
+              std::string tip = "Container: " + rr.container;
+              if (rr.ended == 0) {
+                tip += "\nIn progress";
+              } else {
+                tip += "\nExit code: " + std::to_string(rr.exit_code);
+                if (!rr.verification.empty())
+                  tip += "\nVerification: " + rr.verification;
+                if (!rr.verify_cached.empty())
+                  tip += " (reused from the verify cache, key " +
+                         rr.verify_cached + ")";
+                if (!rr.audit.empty())
+                  tip += "\nAudit: " + rr.audit;
+                if (!rr.audit_cached.empty())
+                  tip += " (reused from the audit cache, key " +
+                         rr.audit_cached + ")";
+                tip += "\nDuration: " +
+                       FormatDuration(std::max(0LL, rr.ended - rr.started));
+                if (!rr.image.empty())
+                  tip += "\nImage: " + ShortImageId(rr.image);
+                auto totals = PhaseTotals(rr.phases, 0);
+                if (!totals.empty())
+                  tip += "\nSlowest phases:";
+                for (size_t p = 0; p < totals.size() && p < 5; p++)
+                  tip += "\n  " + totals[p].first + "  " +
+                         FormatPhaseMs(totals[p].second);
+                if (!rr.gemini.empty())
+                  tip += "\nGemini calls:";
+                for (const auto &call : rr.gemini) {
+                  char line[192];
+                  snprintf(line, sizeof(line),
+                           "\n  %s  %dx, %s (slowest %s), %d retried, "
+                           "%d throttled, %d errors, %s out",
+                           call.phase.c_str(), call.calls,
+                           FormatPhaseMs(call.ms).c_str(),
+                           FormatPhaseMs(call.max_ms).c_str(),
+                           call.stats.retries, call.stats.throttled,
+                           call.stats.errors,
+                           FormatDockerSize((double)call.stats.response_bytes)
+                               .c_str());
+                  tip += line;
+                }
+                tip += FormatFailureSummary(rr.failure);
               }
-              idx++;
+              ImGui::SetTooltip("%s", tip.c_str());
             }
-            closedir(d4);
           }
-          std::string run_dir =
-              run_name.empty() ? std::string() : (task_dir + "/" + run_name);
-          if (!run_dir.empty()) {
-            run_dir_for_files = run_dir;
-
-            // List subdirectories (audit, feedback, verify)
-            DIR *d5 = opendir(run_dir.c_str());
-            if (d5) {
-              struct dirent *subdir_entry;
-              int subdir_count = 0;
-              while ((subdir_entry = readdir(d5)) != NULL) {
-                if (subdir_entry->d_name[0] == '.')
-                  continue;
-                std::string subdir_path = run_dir + "/" + subdir_entry->d_name;
-                if (!DirectoryExists(subdir_path))
-                  continue;
-
-                ImGui::Text(ICON_FA_FOLDER " %s", subdir_entry->d_name);
-                ImGui::SameLine();
-                float x_pos = ImGui::GetContentRegionAvail().x - 85;
-                if (x_pos > 0)
-                  ImGui::SetCursorPosX(ImGui::GetCursorPosX() + x_pos);
-
-                if (ImGui::SmallButton((ICON_FA_FOLDER_OPEN "##open_subdir_" +
-                                        std::to_string(subdir_count))
-                                           .c_str())) {
-                  OpenFolderExternal(subdir_path);
-                }
-                if (ImGui::IsItemHovered())
-                  ImGui::SetTooltip("Open folder");
-
-                ImGui::SameLine();
-                {
-                  ImGuiStyleColorScope _btn(ImGuiCol_Button,
-                                            ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
-                  if (ImGui::SmallButton((ICON_FA_TRASH "##del_subdir_" +
-                                          std::to_string(subdir_count))
-                                             .c_str())) {
-                    state.pending_delete_path = subdir_path;
-                    state.show_confirm_delete = true;
-                  }
-                }
-                if (ImGui::IsItemHovered())
-                  ImGui::SetTooltip("Delete folder");
 
-                subdir_count++;
-              }
-              closedir(d5);
-
-              if (subdir_count == 0) {
-                ImGui::TextDisabled("No subdirectories in this run");
-              }
-            }
+          if (subdir_count == 0) {
+            ImGui::TextDisabled("No subdirectories in this run");
           }
         } else {
-          if (!selected_task_name.empty() && run_count == 0) {
+          if (selected_task && run_count == 0) {
             ImGui::TextDisabled("No logs available");
-          } else if (!selected_task_name.empty()) {
+          } else if (selected_task) {
             ImGui::TextDisabled("Select a run");
           } else {
             ImGui::TextDisabled("Select a task and run");
@@ -7714,103 +18113,128 @@ void RenderMainUI(AppState &state) {
         ImGui::EndChild();
         ImGui::SameLine();
 
-        // Column 4: specific files list with actions
+        // Column 4: files of every subdirectory of the run, flattened
         ImGui::BeginChild("logs_files", ImVec2(0, 220), true);
-        if (!run_dir_for_files.empty()) {
-          // List all files in subdirectories
-          DIR *d6 = opendir(run_dir_for_files.c_str());
-          if (d6) {
-            struct dirent *subdir_entry;
-            int file_total = 0;
-            while ((subdir_entry = readdir(d6)) != NULL) {
-              if (subdir_entry->d_name[0] == '.')
-                continue;
-              std::string subdir_path =
-                  run_dir_for_files + "/" + subdir_entry->d_name;
-              if (!DirectoryExists(subdir_path))
-                continue;
-
-              // List files in this subdirectory
-              DIR *d7 = opendir(subdir_path.c_str());
-              if (d7) {
-                struct dirent *file_entry;
-                while ((file_entry = readdir(d7)) != NULL) {
-                  if (file_entry->d_name[0] == '.')
-                    continue;
-                  std::string file_path =
-                      subdir_path + "/" + file_entry->d_name;
-
-                  // Check if it's a file (not directory)
-                  struct stat file_stat;
-                  if (stat(file_path.c_str(), &file_stat) == 0 &&
-                      S_ISREG(file_stat.st_mode)) {
-                    // Text with wrapping
-                    ImGui::BeginChild(
-                        ("file_item_" + std::to_string(file_total)).c_str(),
-                        ImVec2(ImGui::GetContentRegionAvail().x,
-                               ImGui::GetTextLineHeight() + 5),
-                        false);
-                    ImGui::PushTextWrapPos(ImGui::GetContentRegionAvail().x -
-                                           85);
-                    ImGui::Text(ICON_FA_FILE " %s", file_entry->d_name);
-                    ImGui::PopTextWrapPos();
-                    ImGui::EndChild();
-
-                    ImGui::SameLine();
-                    float x_pos = ImGui::GetContentRegionAvail().x - 85;
-                    if (x_pos > 0)
-                      ImGui::SetCursorPosX(ImGui::GetCursorPosX() + x_pos);
-                    ImGui::SetCursorPosY(ImGui::GetCursorPosY() -
-                                         ImGui::GetTextLineHeight() - 2);
-
-                    if (ImGui::SmallButton((ICON_FA_ARROW_UP_RIGHT_FROM_SQUARE
-                                            "##open_file_" +
-                                            std::to_string(file_total))
-                                               .c_str())) {
-                      OpenFolderExternal(file_path);
-                    }
-                    if (ImGui::IsItemHovered())
-                      ImGui::SetTooltip("Open file");
-
-                    ImGui::SameLine();
-                    {
-                      ImGuiStyleColorScope _btn(ImGuiCol_Button,
-                                                ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
-                      if (ImGui::SmallButton((ICON_FA_TRASH "##del_file_" +
-                                              std::to_string(file_total))
-                                                 .c_str())) {
-                        state.pending_delete_path = file_path;
-                        state.show_confirm_delete = true;
-                      }
-                    }
-                    if (ImGui::IsItemHovered())
-                      ImGui::SetTooltip("Delete file");
-
-                    file_total++;
+        if (selected_run) {
+          std::vector<std::pair<int, int>> files; // mode index, file index
+          for (int m = 0; m < (int)selected_run->modes.size(); m++)
+            for (int f = 0; f < (int)selected_run->modes[m].files.size(); f++)
+              files.emplace_back(m, f);
+
+          ImGuiListClipper clipper;
+          clipper.Begin((int)files.size());
+          while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+              const auto &mode = selected_run->modes[files[i].first];
+              const std::string &file_name = mode.files[files[i].second];
+              // Final size of the file as recorded when the run ended
+              const char *file_label =
+                  FrameConcat({ICON_FA_FILE " ", file_name});
+              auto rec = logs_tree->catalog->find(std::string_view(
+                  FrameConcat({selected_task->name, "/", selected_run->name,
+                               "/", mode.name})));
+              // (the catalog keeps the name it had before archiving)
+              std::string_view logged_name = file_name;
+              if (LogFileView::IsArchivePath(file_name))
+                logged_name.remove_suffix(4);
+              if (rec != logs_tree->catalog->end()) {
+                for (const auto &f : rec->second.files) {
+                  if (f.first == logged_name) {
+                    file_label = FrameText(
+                        ICON_FA_FILE " %s (%s)", file_name.c_str(),
+                        FormatDockerSize((double)f.second).c_str());
+                    break;
                   }
                 }
-                closedir(d7);
+              }
+              // Clicking a file shows it in the built-in viewer
+              const char *file_path = FrameConcat(
+                  {run_dir_for_files, "/", mode.name, "/", file_name});
+              bool viewing = state.log_viewer &&
+                             state.log_viewer->path() == file_path;
+              if (RenderLogsBrowserRow(state, "file", i, file_label, nullptr,
+                                       ImVec4(), viewing, file_path, true,
+                                       "Delete file") &&
+                  !viewing) {
+                OpenLogFileViewer(state, file_path);
               }
             }
-            closedir(d6);
+          }
 
-            if (file_total == 0) {
-              ImGui::TextDisabled("No files found in this run");
-            }
+          if (files.empty()) {
+            ImGui::TextDisabled("No files found in this run");
           }
         } else {
-          if (!selected_task_name.empty() && run_count == 0) {
+          if (selected_task && run_count == 0) {
             ImGui::TextDisabled("No files to display");
-          } else if (!selected_task_name.empty() &&
-                     state.selected_run_index >= 0) {
-            ImGui::TextDisabled("Loading files...");
-          } else if (!selected_task_name.empty()) {
+          } else if (selected_task) {
             ImGui::TextDisabled("Select a run to see files");
           } else {
             ImGui::TextDisabled("Select a task and run to see files");
           }
         }
         ImGui::EndChild();
+
+        // Bundle the selected run's folder with its catalog records
+        if (selected_run) {
+          if (AnimatedButton(ICON_FA_DOWNLOAD " Bundle Run", ImVec2(0, 0),
+                             "logs_bundle_run")) {
+            JsonWriter meta;
+            meta.String("task", selected_task->name)
+                .String("run", selected_run->name);
+            for (const auto &mode : selected_run->modes) {
+              auto rec = logs_tree->catalog->find(selected_task->name + "/" +
+                                                  selected_run->name + "/" +
+                                                  mode.name);
+              if (rec == logs_tree->catalog->end())
+                continue;
+              const RunRecord &rr = rec->second;
+              std::string key = mode.name + "_";
+              meta.String((key + "container").c_str(), rr.container)
+                  .String((key + "image").c_str(), rr.image)
+                  .String((key + "verification").c_str(), rr.verification)
+                  .Number((key + "started").c_str(), rr.started)
+                  .Number((key + "ended").c_str(), rr.ended)
+                  .Number((key + "exit_code").c_str(), rr.exit_code);
+            }
+            std::string name = selected_task->name + "_" + selected_run->name;
+            std::vector<BundleEntry> entries;
+            entries.push_back({name, run_dir_for_files, ""});
+            entries.push_back({name + "/run.json", "", meta.Finish()});
+            g_log_exporter.Start(LogBundlePath(state, name),
+                                 std::move(entries));
+          }
+          if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Write every file of this run and its catalog "
+                              "records into one %s archive under "
+                              "<logs root>/exports, in the background",
+                              BundleSink::Extension());
+          ImGui::SameLine();
+          // Compare a file of this run with the same file of the run
+          // before it (or the one viewed, when it belongs to this run)
+          if (AnimatedButton(ICON_FA_FILE_CODE " Compare Runs", ImVec2(0, 0),
+                             "logs_compare_runs")) {
+            state.show_log_diff = true;
+            state.log_diff_root = logs_root;
+            state.log_diff_task = selected_task->name;
+            int index = (int)(selected_run - selected_task->runs.data());
+            state.log_diff_run_b = selected_run->name;
+            state.log_diff_run_a =
+                selected_task->runs[index > 0 ? index - 1 : index].name;
+            std::string prefix = run_dir_for_files + "/";
+            if (state.log_viewer && !state.log_viewer->Archived() &&
+                state.log_viewer->path().compare(0, prefix.size(), prefix) ==
+                    0)
+              state.log_diff_file =
+                  state.log_viewer->path().substr(prefix.size());
+          }
+          if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Diff a log of this run against the same log "
+                              "of another run, however large");
+          ImGui::SameLine();
+          RenderLogExportStatus();
+        }
+        RenderLogsDeletes(state);
       } else {
         // Show helpful message if logs directory doesn't exist
         if (!logs_root.empty()) {
@@ -7823,6 +18247,7 @@ void RenderMainUI(AppState &state) {
               if (g_show_debug_console) {
                 ConsoleLog("[INFO] Created logs directory: " + logs_root);
               }
+              g_logs_index.Touch(logs_root);
             } else {
               if (g_show_debug_console) {
                 ConsoleLog("[ERROR] Failed to create logs directory: " +
@@ -7855,50 +18280,89 @@ void RenderMainUI(AppState &state) {
   {
     ImGuiTabItemScope _tab_logs("Task Logs", nullptr, logs_tab_flags);
     if (_tab_logs) {
+      ProfileZone _zone("Task Logs tab");
       state.show_logs = true;
       ImGui::Spacing();
 
       // Get tasks snapshot
-      std::vector<std::shared_ptr<TaskInstance>> tasks_snapshot;
-      {
-        std::lock_guard<std::mutex> lock(state.tasks_mutex);
-        tasks_snapshot = state.tasks;
-      }
+      std::shared_ptr<const TaskList> tasks_view = TasksView(state);
+      const TaskList &tasks_snapshot = *tasks_view;
+      bool queue_empty = state.queued_tasks.load() == 0;
+
+      // Runs waiting for a slot
+      RenderTaskQueue(state);
+      RenderRunBatches(state);
+      RenderTaskSummaries(state);
 
       if (tasks_snapshot.empty()) {
-        ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f),
-                           "No tasks running. Start a task to see logs here.");
+        if (queue_empty) {
+          ImGui::TextColored(
+              ImVec4(0.7f, 0.7f, 0.7f, 1.0f),
+              "No tasks running. Start a task to see logs here.");
+        }
       } else {
-        // Create tabs for each task with close buttons
+        // The navigator lists every task; only the pinned ones get a tab,
+        // which unpins when closed
         std::vector<int> tasks_to_remove;
+        if (state.select_task_tab != 0)
+          PinTaskTab(state, state.select_task_tab);
+        TaskList tabbed;
+        std::vector<int> &pinned = state.pinned_task_tabs;
+        for (size_t k = 0; k < pinned.size();) {
+          if (auto task = FindTaskInView(tasks_snapshot, pinned[k])) {
+            tabbed.push_back(std::move(task));
+            k++;
+          } else {
+            pinned.erase(pinned.begin() + k); // removed or compacted
+          }
+        }
         ImGuiTabBarScope _task_tabs("TaskTabs",
                                     ImGuiTabBarFlags_Reorderable |
                                         ImGuiTabBarFlags_FittingPolicyScroll);
         if (_task_tabs) {
+          // Every task's output interleaved by time
+          {
+            ImGuiTabItemScope _tab_all("All Tasks", nullptr,
+                                       ImGuiTabItemFlags_Leading);
+            if (_tab_all)
+              RenderMergedTaskLog(state, tasks_snapshot);
+          }
+          {
+            ImGuiTabItemScope _tab_list(
+                FrameText("Tasks (%zu)###task_navigator",
+                          tasks_snapshot.size()),
+                nullptr, ImGuiTabItemFlags_Leading);
+            if (_tab_list)
+              RenderTaskNavigator(state, tasks_view, tasks_to_remove);
+          }
 
-          for (size_t idx = 0; idx < tasks_snapshot.size(); idx++) {
-            auto &task = tasks_snapshot[idx];
+          for (auto &task : tabbed) {
 
             // Tab title with status indicator (use an ID suffix instead of
             // PushID/PopID)
-            std::string tab_title = task->name;
-            if (task->is_running) {
-              if (task->container_created.load()) {
-                tab_title += " [Running]";
-              } else {
-                tab_title += " [Creating Container...]";
-              }
-            } else {
-              tab_title += " [Stopped]";
-            }
+            const char *status = "[Stopped]";
+            if (task->is_running)
+              status = task->container_created.load()
+                           ? "[Running]"
+                           : "[Creating Container...]";
 
             bool tab_open = true;
-            std::string tab_label = tab_title + "##" + std::to_string(task->id);
-            ImGuiTabItemScope _tab_task(tab_label.c_str(), &tab_open);
+            const char *tab_label = FrameText("%s %s##%d", task->name.c_str(),
+                                              status, task->id);
+            ImGuiTabItemFlags tab_flags = 0;
+            if (state.select_task_tab == task->id) {
+              tab_flags = ImGuiTabItemFlags_SetSelected;
+              state.select_task_tab = 0;
+            }
+            ImGuiTabItemScope _tab_task(tab_label, &tab_open, tab_flags);
             if (_tab_task) {
               // Use ImGuiStateTracker to monitor ID stack
               ImGuiStateTracker tracker(state);
 
+              // Bring back what the log memory budget released
+              FaultInTaskLogs(*task);
+              task->last_viewed_frame = ImGui::GetFrameCount();
+
               ImGui::Spacing();
 
               // Task controls - always show Manage button
@@ -7906,10 +18370,8 @@ void RenderMainUI(AppState &state) {
                                         ImVec4(0.2f, 0.6f, 0.8f, 1.0f));
               if (g_fonts_loaded && g_font_awesome_solid) {
                 ImGui::PushFont(g_font_awesome_solid);
-                if (AnimatedButton(
-                        (std::string(ICON_FA_COG " ") + "Go to Manage Tab")
-                            .c_str(),
-                        ImVec2(0, 0), "manage_tab")) {
+                if (AnimatedButton(ICON_FA_COG " Go to Manage Tab",
+                                   ImVec2(0, 0), "manage_tab")) {
                   state.switch_to_manage_tab = true;
                 }
                 ImGui::PopFont();
@@ -7941,16 +18403,29 @@ void RenderMainUI(AppState &state) {
                 ImGui::Spacing();
                 ImGui::Text("Progress:");
                 ImGui::SameLine();
-                // Simulate progress based on time running (for demo purposes)
+                // Elapsed against the expected run time; a slow animation
+                // while nothing is known about the run
                 static float progress_time = 0.0f;
                 progress_time += g_animation_manager.delta_time;
-                float progress = std::fmod(progress_time * 0.1f,
-                                           1.0f); // Slow progress simulation
+                float progress = std::fmod(progress_time * 0.1f, 1.0f);
+                std::string eta = "Processing";
+                if (task->expected_seconds > 0.0) {
+                  double elapsed = std::chrono::duration<double>(
+                                       std::chrono::steady_clock::now() -
+                                       task->started_at)
+                                       .count();
+                  progress = (float)std::min(
+                      0.99, elapsed / task->expected_seconds);
+                  eta = elapsed < task->expected_seconds
+                            ? "ETA " + FormatEta(task->expected_seconds -
+                                                 elapsed)
+                            : "Longer than usual";
+                }
 
                 // Ensure progress bar is always visible with minimum width
                 ImVec2 progress_size =
                     ImVec2(200, 20); // Fixed height for better visibility
-                AnimatedProgressBar(progress, progress_size, "Processing",
+                AnimatedProgressBar(progress, progress_size, eta.c_str(),
                                     "task_progress");
               } else {
                 ImGui::SameLine();
@@ -7979,39 +18454,233 @@ void RenderMainUI(AppState &state) {
                                     "task_progress_complete");
               }
 
+              // A feedback run that ended before its last phase can pick up
+              // where its checkpoint says it stopped
+              if (!task->is_running && !task->orphan_live &&
+                  task->task_type == "Feedback") {
+                std::string log_dir;
+                {
+                  std::lock_guard<std::mutex> lock(task->resources_mutex);
+                  log_dir = task->log_dir;
+                }
+                if (!task->resume_checked && !log_dir.empty()) {
+                  task->resume_phase =
+                      CheckpointResumePoint(ResolveStagedPath(log_dir));
+                  task->resume_checked = true;
+                }
+                if (!task->resume_phase.empty()) {
+                  ImGui::SameLine();
+                  if (AnimatedButton("Resume", ImVec2(0, 0), "resume_task")) {
+                    ResumeFeedbackTask(state, *task, log_dir);
+                    task->resume_phase.clear();
+                  }
+                  if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip(
+                        "Continue this run in its container from %s, the "
+                        "first phase its checkpoint does not record as done",
+                        task->resume_phase.c_str());
+                }
+              }
+
               ImGui::SameLine();
               if (AnimatedButton("Clear Logs", ImVec2(0, 0), "clear_logs")) {
-                std::lock_guard<std::mutex> lock(task->log_mutex);
-                task->log_output.clear();
+                task->log_output.Clear();
+                task->log_lower.Clear();
+                std::fill(std::begin(task->severity_counts),
+                          std::end(task->severity_counts), 0);
               }
+              // Time column of the log views: 0 off, 1 since the first
+              // line, 2 clock time
+              static int log_time_mode = 0;
+              LogTimeView log_times;
+              log_times.mode = (LogTimeMode)log_time_mode;
+              log_times.gap_ms = state.log_gap_seconds * 1000LL;
+              log_times.wall_offset_ms = EpochMs() - MonotonicMs();
               ImGui::SameLine();
               if (AnimatedButton("Copy All", ImVec2(0, 0), "copy_all")) {
                 std::string all_logs;
-                {
-                  std::lock_guard<std::mutex> lock(task->log_mutex);
-                  for (const auto &line : task->log_output) {
-                    all_logs += line + "\n";
+                char label[32];
+                for (size_t i = 0; i < task->log_output.size(); i++) {
+                  std::string_view line = task->log_output[i];
+                  if (log_times.mode != LogTimeMode::Off)
+                    FormatLogTime(label, sizeof(label), task->log_output, i,
+                                  log_times);
+                  for (uint32_t n = task->log_output.Count(i); n > 0; n--) {
+                    if (log_times.mode != LogTimeMode::Off) {
+                      all_logs += label;
+                      all_logs += ' ';
+                    }
+                    all_logs.append(line.data(), line.size());
+                    all_logs += '\n';
                   }
                 }
                 ImGui::SetClipboardText(all_logs.c_str());
               }
+              ImGui::SameLine();
+              if (AnimatedButton("Export", ImVec2(0, 0), "export_logs")) {
+                // The spool holds every line, so nothing is copied here
+                std::vector<BundleEntry> entries;
+                if (task->spool) {
+                  entries.push_back({"output.log", task->spool->path(), ""});
+                  // Built on the export thread; the task keeps the spool
+                  std::shared_ptr<TaskInstance> owner = task;
+                  long long offset = log_times.wall_offset_ms;
+                  BundleEntry times{"output.times.tsv", "", ""};
+                  times.render = [owner, offset] {
+                    return FormatSpoolTimes(*owner->spool, offset);
+                  };
+                  entries.push_back(std::move(times));
+                }
+                JsonWriter meta;
+                meta.String("name", task->name)
+                    .String("type", task->task_type)
+                    .String("task_dir", task->group)
+                    .String("worker", task->worker)
+                    .Bool("running", task->is_running.load())
+                    .Number("exit_code", task->exit_code.load())
+                    .Number("run_ms",
+                            (long long)(task->run_seconds.load() * 1000.0));
+                {
+                  std::lock_guard<std::mutex> lock(task->resources_mutex);
+                  meta.String("container", task->container)
+                      .String("container_id", task->container_id)
+                      .String("image_id", task->image_id)
+                      .String("log_dir", task->log_dir);
+                  if (!task->log_dir.empty())
+                    entries.push_back({"logs", task->log_dir, ""});
+                }
+                entries.push_back({"run.json", "", meta.Finish()});
+                g_log_exporter.Start(LogBundlePath(state, task->name),
+                                     std::move(entries));
+              }
+              if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Write the full output, the phase logs and "
+                                  "the run's metadata into one archive under "
+                                  "<logs root>/exports, in the background");
+              ImGui::SameLine();
+              RenderLogExportStatus();
 
               ImGui::SameLine();
               static bool auto_scroll = true;
               ImGui::Checkbox("Auto-scroll", &auto_scroll);
+              ImGui::SameLine();
+              static bool wrap_lines = true;
+              ImGui::Checkbox("Wrap", &wrap_lines);
+              ImGui::SameLine();
+              ImGui::SetNextItemWidth(100);
+              ImGui::Combo("##logtimes", &log_time_mode,
+                           "No times\0Elapsed\0Clock\0");
+              if (ImGui::IsItemHovered())
+                ImGui::SetTooltip(
+                    "Show when each line was read: time since the first "
+                    "line,\nor the clock time. Lines that follow more than "
+                    "%d s without\noutput get a rule above them (see "
+                    "Settings).",
+                    state.log_gap_seconds);
+              static bool show_history = false;
+              if (task->spool) {
+                // The live view keeps the latest lines; the spool file has
+                // every line, including ones trimmed or dropped from RAM
+                ImGui::SameLine();
+                ImGui::Checkbox("Full history", &show_history);
+                if (ImGui::IsItemHovered()) {
+                  unsigned long long spooled = task->spool->LineCount();
+                  ImGui::SetTooltip("%llu lines in %s", spooled,
+                                    task->spool->path().c_str());
+                }
+              }
 
               ImGui::SameLine();
               ImGui::TextDisabled("|");
               ImGui::SameLine();
-              int log_count = 0;
-              {
-                std::lock_guard<std::mutex> lock(task->log_mutex);
-                log_count = (int)task->log_output.size();
-              }
+              int log_count = (int)task->log_output.size();
               ImGui::Text("Lines: %d", log_count);
+              uint64_t errors =
+                  task->severity_counts[(size_t)LogSeverity::Error];
+              uint64_t warnings =
+                  task->severity_counts[(size_t)LogSeverity::Warning];
+              if (errors > 0) {
+                ImGui::SameLine();
+                ImGui::TextColored(LogLineColor(LogSeverity::Error),
+                                   "Errors: %llu", (unsigned long long)errors);
+              }
+              if (warnings > 0) {
+                ImGui::SameLine();
+                ImGui::TextColored(LogLineColor(LogSeverity::Warning),
+                                   "Warnings: %llu",
+                                   (unsigned long long)warnings);
+              }
+              uint64_t dropped = task->log_ring.Dropped();
+              if (dropped > 0) {
+                ImGui::SameLine();
+                ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f),
+                                   "(%llu dropped)",
+                                   (unsigned long long)dropped);
+              }
+              uint64_t skipped = task->ingest.Skipped();
+              if (skipped > 0) {
+                ImGui::SameLine();
+                if (task->ingest.Overloaded(MonotonicMs()))
+                  ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f),
+                                     "(sampling, %llu skipped)",
+                                     (unsigned long long)skipped);
+                else
+                  ImGui::TextDisabled("(%llu skipped)",
+                                      (unsigned long long)skipped);
+                if (ImGui::IsItemHovered())
+                  ImGui::SetTooltip("Lines over the Log Lines per Second "
+                                    "setting left out of this view;\nthe "
+                                    "log file has them.");
+              }
+              if (!task->failure.Empty()) {
+                ImGui::SameLine();
+                ImGui::TextDisabled("|");
+                ImGui::SameLine();
+                std::string headline = task->failure.Headline();
+                if (headline.size() > 80)
+                  headline = headline.substr(0, 77) + "...";
+                ImGui::TextColored(LogLineColor(LogSeverity::Error),
+                                   "Failure: %s", headline.c_str());
+                if (ImGui::IsItemHovered())
+                  ImGui::SetTooltip(
+                      "%s",
+                      FormatFailureSummary(task->failure).substr(1).c_str());
+              }
 
               ImGui::Spacing();
 
+              // Phase logs followed for this task; the search bar works on
+              // the pane being shown
+              std::vector<std::shared_ptr<PhaseLog>> phase_logs;
+              {
+                std::lock_guard<std::mutex> lock(task->phase_logs_mutex);
+                phase_logs = task->phase_logs;
+              }
+              bool has_timeline;
+              {
+                std::lock_guard<std::mutex> lock(task->timeline_mutex);
+                has_timeline = !task->timeline.empty();
+              }
+              bool has_resources;
+              {
+                std::lock_guard<std::mutex> lock(task->resources_mutex);
+                has_resources = !task->resources.empty();
+              }
+              bool has_steps = false;
+              for (const auto &log : phase_logs) {
+                std::lock_guard<std::mutex> lock(log->steps_mutex);
+                has_steps = has_steps || !log->build_steps.steps().empty();
+              }
+              if (task->phase_pane >= (int)phase_logs.size() ||
+                  (task->phase_pane == kTimelinePane && !has_timeline) ||
+                  (task->phase_pane == kResourcesPane && !has_resources) ||
+                  (task->phase_pane == kBuildStepsPane && !has_steps))
+                task->phase_pane = -1;
+              LogViewLayout &search_view =
+                  task->phase_pane >= 0
+                      ? phase_logs[task->phase_pane]->log_view
+                      : task->log_view;
+
               // Search bar
               ImGui::Text("Search:");
               ImGui::SameLine();
@@ -8024,99 +18693,129 @@ void RenderMainUI(AppState &state) {
                                    sizeof(search_buf))) {
                 task->log_search_filter = search_buf;
               }
+              if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("%s", kLogQueryHelp);
+              // Enter jumps to the next match and keeps the box focused
+              if (ImGui::IsItemDeactivated() &&
+                  ImGui::IsKeyPressed(ImGuiKey_Enter)) {
+                StepLogSearch(search_view, 1);
+                ImGui::SetKeyboardFocusHere(-1);
+              }
               ImGui::SameLine();
               if (AnimatedButton("Clear", ImVec2(0, 0), "clear_search")) {
                 task->log_search_filter.clear();
               }
-
-              // Copy logs
-              std::vector<std::string> log_copy;
-              {
-                std::lock_guard<std::mutex> lock(task->log_mutex);
-                log_copy = task->log_output;
+              if (!task->log_search_filter.empty()) {
+                ImGui::SameLine();
+                if (AnimatedButton("Prev", ImVec2(0, 0), "search_prev")) {
+                  StepLogSearch(search_view, -1);
+                }
+                ImGui::SameLine();
+                if (AnimatedButton("Next", ImVec2(0, 0), "search_next")) {
+                  StepLogSearch(search_view, 1);
+                }
+                ImGui::SameLine();
+                int cursor_row = LogSearchCursorRow(search_view);
+                ImGui::TextDisabled("%d/%d matches", cursor_row + 1,
+                                    (int)search_view.rows.size());
+                if (!search_view.filter_error.empty()) {
+                  ImGui::SameLine();
+                  ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s",
+                                     search_view.filter_error.c_str());
+                }
               }
 
               ImGui::Spacing();
               ImGui::Separator();
               ImGui::Spacing();
 
-              // Log viewer
-              {
-                ImGuiChildScope _tasklog("TaskLogArea", ImVec2(0, 0), true,
-                                         ImGuiWindowFlags_HorizontalScrollbar);
-                ImGuiStyleVarScope _sv(ImGuiStyleVar_ItemSpacing, ImVec2(4, 2));
-                ImGuiTextWrapScope _tw(ImGui::GetContentRegionAvail().x);
-
-                for (size_t i = 0; i < log_copy.size(); i++) {
-                  const auto &line = log_copy[i];
-
-                  // Apply search filter
-                  if (!task->log_search_filter.empty()) {
-                    std::string line_lower = line;
-                    std::string filter_lower = task->log_search_filter;
-                    std::transform(line_lower.begin(), line_lower.end(),
-                                   line_lower.begin(), ::tolower);
-                    std::transform(filter_lower.begin(), filter_lower.end(),
-                                   filter_lower.begin(), ::tolower);
-                    if (line_lower.find(filter_lower) == std::string::npos) {
-                      continue;
-                    }
-                  }
-
-                  // Color coding
-                  ImVec4 color = ImVec4(0.9f, 0.9f, 0.9f, 1.0f);
-
-                  if (line.find("[ERROR]") != std::string::npos ||
-                      line.find("error:") != std::string::npos ||
-                      line.find("Error") != std::string::npos ||
-                      line.find("failed") != std::string::npos) {
-                    color = ImVec4(1.0f, 0.3f, 0.3f, 1.0f);
-                  } else if (line.find("[SUCCESS]") != std::string::npos ||
-                             line.find("success") != std::string::npos ||
-                             line.find("Passed") != std::string::npos) {
-                    color = ImVec4(0.3f, 1.0f, 0.3f, 1.0f);
-                  } else if (line.find("[WARN]") != std::string::npos ||
-                             line.find("warning:") != std::string::npos) {
-                    color = ImVec4(1.0f, 0.9f, 0.3f, 1.0f);
-                  } else if (line.find("[INFO]") != std::string::npos) {
-                    color = ImVec4(0.5f, 0.8f, 1.0f, 1.0f);
-                  } else if (line.find("[STOPPED]") != std::string::npos) {
-                    color = ImVec4(1.0f, 0.5f, 0.0f, 1.0f);
+              // One pane for the script output, one for the phase timeline,
+              // one for container resource use, one for the image build's
+              // steps and one per phase log, e.g. "docker_build.log (1520)"
+              if ((!phase_logs.empty() || has_timeline || has_resources) &&
+                  ImGui::BeginTabBar("##phase_panes")) {
+                if (ImGui::BeginTabItem("Output")) {
+                  task->phase_pane = -1;
+                  ImGui::EndTabItem();
+                }
+                if (has_timeline && ImGui::BeginTabItem("Timeline")) {
+                  task->phase_pane = kTimelinePane;
+                  ImGui::EndTabItem();
+                }
+                if (has_resources && ImGui::BeginTabItem("Resources")) {
+                  task->phase_pane = kResourcesPane;
+                  ImGui::EndTabItem();
+                }
+                if (has_steps && ImGui::BeginTabItem("Build Steps")) {
+                  task->phase_pane = kBuildStepsPane;
+                  ImGui::EndTabItem();
+                }
+                for (size_t i = 0; i < phase_logs.size(); i++) {
+                  const PhaseLog &log = *phase_logs[i];
+                  const char *label =
+                      FrameText("%s (%llu)###phase_%zu", log.name.c_str(),
+                                (unsigned long long)log.lines, i);
+                  if (ImGui::BeginTabItem(
+                          label, nullptr,
+                          task->select_pane == (int)i
+                              ? ImGuiTabItemFlags_SetSelected
+                              : 0)) {
+                    task->phase_pane = (int)i;
+                    ImGui::EndTabItem();
                   }
-
-                  ImGui::PushStyleColor(ImGuiCol_Text, color);
-                  ImGui::TextWrapped("%s", line.c_str());
-                  ImGui::PopStyleColor();
+                  if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("%s", log.path.c_str());
                 }
+                ImGui::EndTabBar();
+              }
+              task->select_pane = -1;
 
-                // Auto-scroll
-                if (auto_scroll && task->is_running &&
-                    ImGui::GetScrollY() >= ImGui::GetScrollMaxY() - 10.0f) {
-                  ImGui::SetScrollHereY(1.0f);
+              // Log viewer
+              if (task->phase_pane >= 0) {
+                PhaseLog &log = *phase_logs[task->phase_pane];
+                uint64_t errors =
+                    log.severity_counts[(size_t)LogSeverity::Error];
+                uint64_t warnings =
+                    log.severity_counts[(size_t)LogSeverity::Warning];
+                ImGui::Text("Lines: %llu", (unsigned long long)log.lines);
+                if (errors > 0) {
+                  ImGui::SameLine();
+                  ImGui::TextColored(LogLineColor(LogSeverity::Error),
+                                     "Errors: %llu",
+                                     (unsigned long long)errors);
                 }
+                if (warnings > 0) {
+                  ImGui::SameLine();
+                  ImGui::TextColored(LogLineColor(LogSeverity::Warning),
+                                     "Warnings: %llu",
+                                     (unsigned long long)warnings);
+                }
+                RenderLogArenaView("PhaseLogArea", log.log_output,
+                                   log.log_lower, log.log_view,
+                                   task->log_search_filter, task.get(),
+                                   wrap_lines, auto_scroll && !log.finished,
+                                   log_times);
+              } else if (task->phase_pane == kTimelinePane) {
+                RenderTaskTimeline(*task);
+              } else if (task->phase_pane == kResourcesPane) {
+                RenderTaskResources(*task);
+              } else if (task->phase_pane == kBuildStepsPane) {
+                RenderTaskBuildSteps(*task, phase_logs);
+              } else if (show_history && task->spool) {
+                RenderTaskLogHistory(*task, auto_scroll);
+              } else {
+                RenderTaskLogView(*task, wrap_lines, auto_scroll, log_times);
               }
             }
 
-            // Check if tab was closed
+            // A closed tab is only unpinned; the task stays in the navigator
             if (!tab_open) {
-              // Guardrail: Prevent closing tab if task is still running
-              if (task->is_running) {
-                // Show a message and prevent closing
-                if (g_show_debug_console) {
-                  ConsoleLog("[DEBUG] Task " + task->name +
-                             " is running, preventing tab closure");
-                }
-                state.show_cannot_close_popup = true;
-                // Reset tab_open to prevent closing
-                tab_open = true;
-              } else {
-                // Mark for removal (RemoveTask will handle stopping if needed)
-                tasks_to_remove.push_back(task->id);
+              pinned.erase(std::remove(pinned.begin(), pinned.end(), task->id),
+                           pinned.end());
 
-                // Force ID stack validation and fix when tab is closed
-                ValidateImGuiState(state);
-                FixImGuiIDStack(state);
-              }
+              // Force ID stack validation and fix when tab is closed
+              ValidateImGuiState(state);
+              FixImGuiIDStack(state);
             }
 
             // No PopID needed (we used a unique label instead)
@@ -8170,16 +18869,13 @@ void RenderMainUI(AppState &state) {
 
       // Get running task count and total task count
       int running_count = GetRunningTaskCount(state);
-      int total_task_count = 0;
-      {
-        std::lock_guard<std::mutex> lock(state.tasks_mutex);
-        total_task_count = state.tasks.size();
-      }
+      std::shared_ptr<const TaskList> tasks_view = TasksView(state);
+      int total_task_count = (int)tasks_view->size();
 
       ImGui::TextColored(ImVec4(0.4f, 0.7f, 1.0f, 1.0f), "Active Processes");
       ImGui::SameLine();
       ImGui::Text("(%d running / %d max)", running_count,
-                  state.max_concurrent_tasks);
+                  GetTaskLimit(state));
 
       ImGui::Spacing();
 
@@ -8188,75 +18884,51 @@ void RenderMainUI(AppState &state) {
         // Check if any tasks are still creating containers
         int creating_containers = 0;
         int ready_to_stop = 0;
-        {
-          std::lock_guard<std::mutex> lock(state.tasks_mutex);
-          for (const auto &task : state.tasks) {
-            if (task->is_running) {
-              if (task->container_created.load()) {
-                ready_to_stop++;
-              } else {
-                creating_containers++;
-              }
+        for (const auto &task : *tasks_view) {
+          if (task->is_running) {
+            if (task->container_created.load()) {
+              ready_to_stop++;
+            } else {
+              creating_containers++;
             }
           }
         }
 
-        if (creating_containers > 0 && ready_to_stop == 0) {
-          // All tasks are still creating containers
-          ImGuiDisabledScope _dis;
-          ImGui::Button("Stop All Tasks (Creating Containers...)");
-          ImGui::SameLine();
-          ImGui::TextColored(ImVec4(0.8f, 0.6f, 0.0f, 1.0f),
-                             "All tasks creating containers...");
-        } else if (creating_containers > 0 && ready_to_stop > 0) {
-          // Some tasks ready, some still creating
-          ImGuiStyleColorScope _btn(ImGuiCol_Button,
-                                    ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
-          if (g_fonts_loaded && g_font_awesome_solid) {
-            ImGui::PushFont(g_font_awesome_solid);
-            if (ImGui::Button((std::string(ICON_FA_STOP " ") + "Stop All Tasks")
-                                  .c_str())) {
-              StopAllTasks(state);
-            }
-            ImGui::PopFont();
-          } else {
-            if (ImGui::Button("Stop All Tasks")) {
-              StopAllTasks(state);
-            }
+        // Runs are stopped by process group and container id, so even one
+        // still creating its container can be stopped
+        ImGuiStyleColorScope _btn(ImGuiCol_Button,
+                                  ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
+        if (g_fonts_loaded && g_font_awesome_solid) {
+          ImGui::PushFont(g_font_awesome_solid);
+          if (ImGui::Button(ICON_FA_STOP " Stop All Tasks")) {
+            StopAllTasks(state);
+          }
+          ImGui::PopFont();
+        } else {
+          if (ImGui::Button("Stop All Tasks")) {
+            StopAllTasks(state);
           }
+        }
+        if (creating_containers > 0) {
           ImGui::SameLine();
           ImGui::TextColored(ImVec4(0.8f, 0.6f, 0.0f, 1.0f),
                              "(%d creating containers, %d ready)",
                              creating_containers, ready_to_stop);
-        } else {
-          // All tasks ready to stop
-          ImGuiStyleColorScope _btn(ImGuiCol_Button,
-                                    ImVec4(0.8f, 0.2f, 0.2f, 1.0f));
-          if (g_fonts_loaded && g_font_awesome_solid) {
-            ImGui::PushFont(g_font_awesome_solid);
-            if (ImGui::Button((std::string(ICON_FA_STOP " ") + "Stop All Tasks")
-                                  .c_str())) {
-              StopAllTasks(state);
-            }
-            ImGui::PopFont();
-          } else {
-            if (ImGui::Button("Stop All Tasks")) {
-              StopAllTasks(state);
-            }
-          }
         }
       }
+      int tearing_down = g_teardown.Pending();
+      if (tearing_down > 0) {
+        AnimatedLoadingSpinner("", 6.0f, "teardown_spinner", 0.5f);
+        ImGui::SameLine();
+        ImGui::TextDisabled("Shutting down %d run(s)", tearing_down);
+      }
 
       ImGui::Spacing();
       ImGui::Separator();
       ImGui::Spacing();
 
       // Tasks list
-      std::vector<std::shared_ptr<TaskInstance>> tasks_snapshot;
-      {
-        std::lock_guard<std::mutex> lock(state.tasks_mutex);
-        tasks_snapshot = state.tasks;
-      }
+      const TaskList &tasks_snapshot = *tasks_view;
 
       if (tasks_snapshot.empty()) {
         ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f),
@@ -8267,7 +18939,11 @@ void RenderMainUI(AppState &state) {
         for (auto &task : tasks_snapshot) {
 
           // Status indicator
-          if (task->is_running) {
+          const char *teardown = TeardownStageLabel(task->teardown);
+          if (teardown) {
+            AnimatedLoadingSpinner(teardown, 6.0f, "teardown_task_spinner",
+                                   0.5f);
+          } else if (task->is_running) {
             if (task->container_created.load()) {
               AnimatedStatusIndicator("[Running]",
                                       ImVec4(0.3f, 1.0f, 0.3f, 1.0f), true,
@@ -8290,15 +18966,21 @@ void RenderMainUI(AppState &state) {
           // Always show Manage button to redirect to Manage tab for deletion
           ImGuiStyleColorScope _btn(ImGuiCol_Button,
                                     ImVec4(0.2f, 0.6f, 0.8f, 1.0f));
-          if (AnimatedButton(
-                  (std::string("Manage##") + std::to_string(task->id)).c_str(),
-                  ImVec2(0, 0),
-                  ("manage_proc_" + std::to_string(task->id)).c_str())) {
+          if (AnimatedButton(FrameText("Manage##%d", task->id), ImVec2(0, 0),
+                             FrameText("manage_proc_%d", task->id))) {
             state.switch_to_manage_tab = true;
           }
 
-          // Show command
+          // Show phase and command
           ImGui::Indent();
+          if (task->is_running && task->gate_seq.load() != 0) {
+            ImGui::TextDisabled("Phase: waiting for a %s slot",
+                                kTaskStageNames[(int)task->gate_phase.load()]);
+          } else if (task->is_running) {
+            ImGui::TextDisabled("Phase: %s", TaskPhaseName(task->phase));
+          }
+          if (!task->worker.empty())
+            ImGui::TextDisabled("Docker worker: %s", task->worker.c_str());
           ImGui::TextDisabled("Command: %s", task->command.c_str());
           ImGui::Unindent();
 
@@ -8342,7 +19024,7 @@ void RenderMainUI(AppState &state) {
       ImGui::Spacing();
 
       if (ImGui::Button("Open Prompt Editor", ImVec2(200, 40))) {
-        DevLog(state, "Main UI: Open Prompt Editor button clicked");
+        DevLog("Main UI: Open Prompt Editor button clicked");
         state.show_prompt_editor = true;
       }
 
@@ -8466,7 +19148,7 @@ void RenderMainUI(AppState &state) {
       ImGui::Text("Technology Stack:");
       ImGui::BulletText("C99 (core library)");
       ImGui::BulletText("x86_64 Assembly (performance)");
-      ImGui::BulletText("C++17 (GUI)");
+      ImGui::BulletText("C++20 (GUI)");
       ImGui::BulletText("SDL2 + Dear ImGui (interface)");
       ImGui::BulletText("OpenGL 4.1 (animation)");
       ImGui::BulletText("GLM (math library)");
@@ -8594,8 +19276,17 @@ void RenderMainUI(AppState &state) {
                              ImGuiWindowFlags_NoResize |
                                  ImGuiWindowFlags_NoMove)) {
     ImGui::SetWindowSize(ImVec2(400, 0));
-    ImGui::TextWrapped("Delete this logs directory?\n%s",
-                       state.pending_delete_path.c_str());
+    if (state.pending_delete_paths.size() == 1) {
+      ImGui::TextWrapped("Delete this logs directory?\n%s",
+                         state.pending_delete_paths[0].c_str());
+    } else {
+      ImGui::TextWrapped("Delete these %zu logs directories?",
+                         state.pending_delete_paths.size());
+      for (const auto &path : state.pending_delete_paths)
+        ImGui::BulletText("%s", path.c_str());
+    }
+    ImGui::TextDisabled("They can be restored for %d seconds.",
+                        TrashBin::kUndoSeconds);
     ImGui::Spacing();
     ImGui::Separator();
     ImGui::Spacing();
@@ -8612,8 +19303,36 @@ void RenderMainUI(AppState &state) {
       bool confirmed = AnimatedButton("Yes, Delete", ImVec2(button_width, 0),
                                       "confirm_delete");
       if (confirmed) {
-        RemoveDirectoryRecursive(state.pending_delete_path);
-        state.pending_delete_path.clear();
+        std::string logs_root =
+            state.log_folder_paths.empty()
+                ? std::string()
+                : state.log_folder_paths[std::max(0,
+                                                  state.selected_log_folder)];
+        // Sorted, so a folder inside another one marked goes with it
+        std::vector<std::string> targets = state.pending_delete_paths;
+        std::sort(targets.begin(), targets.end());
+        std::string outer;
+        state.delete_error.clear();
+        for (const std::string &target : targets) {
+          if (!outer.empty() && target.rfind(outer + "/", 0) == 0)
+            continue;
+          outer = target;
+          // Release a file the viewer has mapped before moving it
+          if (state.log_viewer &&
+              (state.log_viewer->path() == target ||
+               state.log_viewer->path().rfind(target + "/", 0) == 0))
+            state.log_viewer.reset();
+          std::string error;
+          if (!g_trash.Trash(logs_root, target, error)) {
+            state.delete_error = error;
+            continue;
+          }
+          size_t slash = target.find_last_of("/\\");
+          if (slash != std::string::npos)
+            g_logs_index.Touch(target.substr(0, slash));
+        }
+        state.logs_marked.clear();
+        state.pending_delete_paths.clear();
         state.show_confirm_delete = false;
         ImGui::CloseCurrentPopup();
       }
@@ -8622,7 +19341,7 @@ void RenderMainUI(AppState &state) {
     bool cancelled =
         AnimatedButton("Cancel", ImVec2(button_width, 0), "cancel_delete");
     if (cancelled) {
-      state.pending_delete_path.clear();
+      state.pending_delete_paths.clear();
       state.show_confirm_delete = false;
       ImGui::CloseCurrentPopup();
     }
@@ -8729,7 +19448,7 @@ void RenderMainUI(AppState &state) {
 
     bool can_execute = !state.is_running;
     bool is_valid = true;
-    std::string status_message = "Ready";
+    const char *status_message = "Ready";
     ImVec4 status_color = ImVec4(0.4f, 0.8f, 0.4f, 1.0f); // Green
 
     // All modes are Docker modes now (feedback, verify, both, audit)
@@ -8774,8 +19493,9 @@ void RenderMainUI(AppState &state) {
 
     // NEW: Individual task counters and execution
     int running_count = GetRunningTaskCount(state);
-    bool at_limit = (running_count >= state.max_concurrent_tasks);
-    int available_slots = state.max_concurrent_tasks - running_count;
+    int task_limit = GetTaskLimit(state);
+    bool at_limit = (running_count >= task_limit);
+    int available_slots = std::max(0, task_limit - running_count);
 
     // Task counters section
     ImGui::Text("Task Counts:");
@@ -8784,7 +19504,7 @@ void RenderMainUI(AppState &state) {
     if (ImGui::IsItemHovered()) {
       ImGui::SetTooltip(
           "Set how many of each task type to run when clicking the buttons "
-          "below\n\nSliders automatically limit to available concurrent slots");
+          "below\n\nRuns beyond the free concurrent slots wait in the queue");
     }
 
     // Show warning if at limit
@@ -8792,15 +19512,15 @@ void RenderMainUI(AppState &state) {
       ImGui::SameLine();
       ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "[AT LIMIT]");
       if (ImGui::IsItemHovered()) {
-        ImGui::SetTooltip("Maximum concurrent tasks reached! Stop some tasks "
-                          "to start new ones.");
+        ImGui::SetTooltip("Maximum concurrent tasks reached. New runs are "
+                          "queued until a slot frees up.");
       }
     } else if (available_slots < 3) {
       ImGui::SameLine();
       ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), "[WARNING]");
       if (ImGui::IsItemHovered()) {
         ImGui::SetTooltip(
-            "Only %d concurrent slots available. Consider stopping some tasks.",
+            "Only %d concurrent slots available. Extra runs will be queued.",
             available_slots);
       }
     }
@@ -8819,10 +19539,9 @@ void RenderMainUI(AppState &state) {
       ImGui::SameLine();
       ImGui::SetNextItemWidth(counter_width);
 
-      // Calculate max value for slider (don't exceed available slots)
-      int max_slider = std::min(10, available_slots);
-      if (max_slider < 1)
-        max_slider = 1; // At least 1
+      // Runs past the free slots are queued, so the slider is not tied to
+      // the concurrency limit
+      const int max_slider = 10;
 
       // Clamp current value to valid range
       if (count > max_slider)
@@ -8830,8 +19549,8 @@ void RenderMainUI(AppState &state) {
       if (count < 1)
         count = 1; // Ensure minimum of 1
 
-      if (ImGui::SliderInt(("##" + std::string(name) + "_count").c_str(),
-                           &count, 1, max_slider)) {
+      if (ImGui::SliderInt(FrameText("##%s_count", name), &count, 1,
+                           max_slider)) {
         SaveConfig(state);
       }
       ImGui::SameLine();
@@ -8840,9 +19559,9 @@ void RenderMainUI(AppState &state) {
       if (available_slots == 0) {
         ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "[FULL]");
         if (ImGui::IsItemHovered()) {
-          ImGui::SetTooltip("All %d concurrent slots are occupied. Stop some "
-                            "tasks to free up slots.",
-                            state.max_concurrent_tasks);
+          ImGui::SetTooltip("All %d concurrent slots are occupied. New runs "
+                            "will wait in the queue.",
+                            task_limit);
         }
         ImGui::SameLine();
       } else if (available_slots < 3) {
@@ -8850,7 +19569,7 @@ void RenderMainUI(AppState &state) {
                            available_slots);
         if (ImGui::IsItemHovered()) {
           ImGui::SetTooltip("%d concurrent slots available out of %d total",
-                            available_slots, state.max_concurrent_tasks);
+                            available_slots, task_limit);
         }
         ImGui::SameLine();
       } else {
@@ -8870,96 +19589,927 @@ void RenderMainUI(AppState &state) {
       if (state.task_directory.empty() ||
           !DirectoryExists(state.task_directory))
         row_can_execute = false;
-      else if (!state.validation.has_env_dir ||
-               !state.validation.has_dockerfile)
-        row_can_execute = false;
-      else if (mode != 3 && (!state.validation.has_verify_dir ||
-                             !state.validation.has_verify_sh ||
-                             !state.validation.has_prompt))
+      else if (!TaskRunnable(state.validation, mode))
         row_can_execute = false;
       else if (state.api_key.empty())
         row_can_execute = false;
 
-      // Disable button if this row can't execute or if trying to run more than
-      // available slots
-      bool should_disable = !row_can_execute || (count > available_slots);
+      // Disable button if this row can't execute; runs over the limit queue
+      bool should_disable = !row_can_execute;
+
+      if (should_disable) {
+        ImGui::BeginDisabled();
+      }
+      // Add unique ID to prevent conflicts
+      ImGui::PushID(FrameConcat({task_type, "_button"}));
+      if (AnimatedButton(FrameText("Run (%d)", count),
+                         ImVec2(button_width, slider_height),
+                         FrameConcat({task_type, "_run"}))) {
+        state.selected_mode = mode;
+        StartMultipleTasks(state, task_type, count);
+      }
+      ImGui::PopID();
+      if (should_disable) {
+        ImGui::EndDisabled();
+      }
+    };
+
+    // Row 1: Feedback
+    CreateTaskRow("Feedback", state.feedback_count, 0, "Feedback");
+
+    // Row 2: Verify
+    CreateTaskRow("Verify", state.verify_count, 1, "Verify");
+
+    // Row 3: Both
+    CreateTaskRow("Both", state.both_count, 2, "Both");
+
+    // Row 4: Audit
+    CreateTaskRow("Audit", state.audit_count, 3, "Audit");
+    if (state.use_audit_cache) {
+      ImGui::SameLine();
+      ImGui::Checkbox("Force##reaudit", &state.force_reaudit);
+      if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip(
+            "Run the audit even when the audit cache holds the outcome of "
+            "the same\nprompts, verify/ and Dockerfile, and store the new "
+            "outcome. Also for\nsampling the audit more than once.");
+      }
+    }
+
+    // Early stop rules for batches of more than one run
+    ImGui::Spacing();
+    ImGui::Text("Stop a batch after:");
+    ImGui::SameLine();
+    ImGui::TextDisabled("(?)");
+    if (ImGui::IsItemHovered()) {
+      ImGui::SetTooltip(
+          "Ends a batch of runs early once its outcome is known: after this "
+          "many\nfailed runs, once this many passed, or once the 95%% "
+          "interval on its\npass rate is within this many points either "
+          "side (0 = rule off).\nIts queued runs are dropped and its "
+          "running ones stopped.");
+    }
+    bool policy_changed = false;
+    auto PolicyInput = [&](const char *label, const char *id, int &value,
+                           int max_value) {
+      ImGui::SameLine();
+      ImGui::TextUnformatted(label);
+      ImGui::SameLine();
+      ImGui::SetNextItemWidth(counter_width);
+      ImGui::InputInt(id, &value, 0);
+      value = std::max(0, std::min(max_value, value));
+      policy_changed |= ImGui::IsItemDeactivatedAfterEdit();
+    };
+    PolicyInput("failures", "##batchfailures", state.batch_max_failures, 100);
+    PolicyInput("passes", "##batchpasses", state.batch_target_passes, 100);
+    PolicyInput("pass rate +/-%", "##batchci", state.batch_ci_pct, 50);
+    ImGui::Text("Batch priority:");
+    ImGui::SameLine();
+    ImGui::TextDisabled("(?)");
+    if (ImGui::IsItemHovered()) {
+      ImGui::SetTooltip(
+          "How the next runs queued spend the daily API quota (see "
+          "Prompts per day):\nHigh runs go first and may use the reserve, "
+          "Low ones wait for the\noff-peak hours unless that would miss "
+          "the deadline. Runs with a\ndeadline go ahead of others of the "
+          "same priority (0 = no deadline).");
+    }
+    ImGui::SameLine();
+    static const char *kUrgencies[] = {"Low", "Normal", "High"};
+    ImGui::SetNextItemWidth(90);
+    policy_changed |= ImGui::Combo("##batchurgency", &state.batch_urgency,
+                                   kUrgencies, IM_ARRAYSIZE(kUrgencies));
+    PolicyInput("deadline (h)", "##batchdeadline", state.batch_deadline_hours,
+                168);
+    if (policy_changed)
+      SaveConfig(state);
+
+    // Dev mode: fake runs for stress testing the log pipeline and UI
+    if (state.dev_mode && ImGui::TreeNode("Synthetic Load")) {
+      SyntheticLoad &load = state.synthetic_load;
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Runs##synthetic", &state.synthetic_count, 1, 30);
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Lines/s##synthetic", &load.lines_per_sec, 10,
+                       kSyntheticMaxRate, "%d",
+                       ImGuiSliderFlags_Logarithmic);
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Seconds##synthetic", &load.seconds, 5, 600);
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Burst lines##synthetic", &load.burst_lines, 0,
+                       100000, "%d", ImGuiSliderFlags_Logarithmic);
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Burst every (s)##synthetic", &load.burst_every_s, 1,
+                       60);
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Long lines (%)##synthetic", &load.long_line_pct, 0,
+                       100);
+      if (AnimatedButton(FrameText("Run Synthetic (%d)", state.synthetic_count),
+                         ImVec2(0, 0), "synthetic_run")) {
+        StartSyntheticTasks(state, state.synthetic_count);
+      }
+      if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Queue fake runs that print build-like output at "
+                          "the set rate, through the normal task path");
+      }
+      ImGui::Separator();
+      ImGui::Checkbox("Record run output##replay", &state.record_task_streams);
+      if (ImGui::IsItemHovered()) {
+        ImGui::SetTooltip("Save the raw output of runs started from now on, "
+                          "with its timing, as task_*.abrec next to their "
+                          "spool files");
+      }
+      char replay_buf[1024];
+      strncpy(replay_buf, state.replay_path.c_str(), sizeof(replay_buf) - 1);
+      replay_buf[sizeof(replay_buf) - 1] = '\0';
+      ImGui::SetNextItemWidth(400);
+      if (ImGui::InputText("Recording##replay", replay_buf,
+                           sizeof(replay_buf)))
+        state.replay_path = replay_buf;
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Speed (0 = max)##replay", &state.replay_speed, 0, 100,
+                       "%dx");
+      ImGui::SetNextItemWidth(200);
+      ImGui::SliderInt("Runs##replay", &state.replay_count, 1, 30);
+      ImGui::BeginDisabled(state.replay_path.empty());
+      if (AnimatedButton(FrameText("Replay (%d)", state.replay_count),
+                         ImVec2(0, 0), "replay_run")) {
+        StartReplayTasks(state, state.replay_count);
+      }
+      ImGui::EndDisabled();
+      if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+        ImGui::SetTooltip("Queue runs that play the recording back through "
+                          "the normal task path");
+      }
+      ImGui::TreePop();
+    }
+
+    ImGui::Spacing();
+    if (AnimatedButton(ICON_FA_FOLDER_OPEN " Batch Import...", ImVec2(0, 0),
+                       "task_batch_open")) {
+      state.show_task_batch = true;
+      ImGui::SetWindowFocus("Batch Import");
+    }
+    if (ImGui::IsItemHovered()) {
+      ImGui::SetTooltip("Validate every task folder under a parent folder "
+                        "and queue the valid ones");
+    }
+
+    ImGui::Spacing();
+    ImGui::Separator();
+    ImGui::Spacing();
+
+    // Status message with animation
+    if (at_limit) {
+      status_message =
+          FrameText("At maximum concurrent tasks (%d)", task_limit);
+      status_color = ImVec4(1.0f, 0.6f, 0.0f, 1.0f);
+    } else if (running_count > 0) {
+      status_message = FrameText("Ready (%d running)", running_count);
+      status_color = ImVec4(0.4f, 0.8f, 1.0f, 1.0f);
+    }
+
+    // Determine if status should pulse (for warnings/errors)
+    bool should_pulse = (status_color.x > 0.8f ||
+                         status_color.y < 0.5f); // Red or orange colors
+    AnimatedStatusIndicator(status_message, status_color, should_pulse,
+                            "main_status");
+  }
+
+  // Pop window background color
+  ImGui::PopStyleColor(1); // WindowBg
+
+  // Render Prompt Editor window if open
+  RenderPromptEditor(state);
+
+  // Render the log file viewer if a file is open in it
+  RenderLogFileViewer(state);
+  RenderLogSearch(state);
+  RenderTaskBatch(state);
+  RenderRunAnalytics(state);
+  RenderLogDiff(state);
+
+  // Render dev overlay last so it remains visible on top
+  if (state.dev_mode) {
+    RenderFrameProfiler(state);
+    RenderHeapStats(state);
+    RenderDevOverlay(state, io);
+  }
+
+  // main_window_scope dtor calls ImGui::End()
+}
+
+////////////////////////////////////////////////////////////
+//                                                       //
+//              MAIN FUNCTION & APPLICATION              //
+//                                                       //
+////////////////////////////////////////////////////////////
+
+// Frame pacing: instead of drawing at the display rate all the time, the
+// main loop waits up to FrameWaitMs for an event before each frame. Input
+// and WakeMainLoop end the wait early; the timeout still refreshes progress
+// that other threads only publish by polling.
+static const int kTaskFrameMs = 33;       // spinners and timers of tasks
+static const int kTextInputFrameMs = 400; // text cursor blink
+static const int kIdleFrameMs = 1000;
+// Frames drawn after each event so hover and layout changes settle
+static const int kSettleFrames = 3;
+
+static int FrameWaitMs(AppState &state) {
+  if (g_animation_manager.AnyPlaying())
+    return 0;
+  if (state.is_running || g_running_tasks.load() > 0 ||
+      g_teardown.Pending() > 0)
+    return kTaskFrameMs;
+  if (ImGui::GetIO().WantTextInput)
+    return kTextInputFrameMs;
+  return kIdleFrameMs;
+}
+
+// Time from entering main() to the first presented frame that startup aims
+// for; --startup-trace reports each phase against it
+static const double kStartupBudgetMs = 150.0;
+
+// Startup phases for --startup-trace: each Mark closes the phase running
+// since the previous one. Work moved off the startup path (fonts, prompts,
+// Docker and logs prefetch) is reported as it completes.
+class StartupTrace {
+public:
+  void Mark(const char *phase) {
+    auto now = std::chrono::steady_clock::now();
+    phases_.push_back({phase, Ms(last_, now)});
+    last_ = now;
+  }
+
+  // Time since main() started
+  double Elapsed() const {
+    return Ms(start_, std::chrono::steady_clock::now());
+  }
+
+  void Print() const {
+    printf("Startup trace (budget %.0f ms):\n", kStartupBudgetMs);
+    double total = 0.0;
+    for (const auto &phase : phases_) {
+      total += phase.ms;
+      printf("  %-22s %8.1f ms  (at %.1f ms)\n", phase.name, phase.ms, total);
+    }
+    printf("  first frame at %.1f ms%s\n", total,
+           total > kStartupBudgetMs ? "  [over budget]" : "");
+    fflush(stdout);
+  }
+
+private:
+  struct Phase {
+    const char *name;
+    double ms;
+  };
+  static double Ms(std::chrono::steady_clock::time_point from,
+                   std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+  }
+
+  std::chrono::steady_clock::time_point start_ =
+      std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point last_ = start_;
+  std::vector<Phase> phases_;
+};
+
+// Tell the splash (opengl_animation.cpp) that the first frame is on screen
+// so it can close: it started this process with the write end of a pipe in
+// AUTOBUILD_READY_FD (a handle in AUTOBUILD_READY_HANDLE on Windows). The
+// pipe is closed right away so task processes do not inherit it.
+static void SignalSplashReady() {
+#ifdef _WIN32
+  const char *value = getenv("AUTOBUILD_READY_HANDLE");
+  if (!value)
+    return;
+  HANDLE pipe = (HANDLE)(uintptr_t)strtoull(value, nullptr, 16);
+  DWORD written = 0;
+  WriteFile(pipe, "1", 1, &written, NULL);
+  CloseHandle(pipe);
+  SetEnvironmentVariableA("AUTOBUILD_READY_HANDLE", NULL);
+#else
+  const char *value = getenv("AUTOBUILD_READY_FD");
+  if (!value)
+    return;
+  int fd = atoi(value);
+  if (fd > 2) {
+    // The splash may be gone already (skipped by the user); that must not
+    // raise SIGPIPE here
+    void (*previous)(int) = signal(SIGPIPE, SIG_IGN);
+    ssize_t n = write(fd, "1", 1);
+    (void)n;
+    signal(SIGPIPE, previous);
+    close(fd);
+  }
+  unsetenv("AUTOBUILD_READY_FD");
+#endif
+}
+
+// The full font atlas: the default font with the Font Awesome solid and
+// regular icons merged in. Runs on a background thread at startup (the
+// atlas is built and converted to RGBA here, touching no ImGui context), so
+// the first frames draw with the bare default font and text icon fallbacks.
+struct AppFonts {
+  ImFontAtlas *atlas = nullptr;
+  ImFont *solid = nullptr;
+  ImFont *regular = nullptr;
+  bool loaded = false; // both icon fonts found
+  bool from_cache = false;
+  double build_ms = 0.0;
+};
+
+// Pixel size of every font, and the scale glyphs are rasterized at (the UI
+// is not DPI-scaled yet; a scaled bake gets its own cache key)
+static const float kFontPixelSize = 13.0f;
+static const float kFontRasterScale = 1.0f;
+
+// Every icon the GUI draws, the only Font Awesome glyphs baked: the whole
+// private use range is some 1,400 glyphs per font, which the atlas and its
+// texture mostly carried for nothing. An ICON_FA_ used anywhere else must
+// be listed here.
+static const char kAppIcons[] =
+    ICON_FA_ARROW_RIGHT ICON_FA_ARROW_UP_RIGHT_FROM_SQUARE ICON_FA_CIRCLE
+    ICON_FA_COG ICON_FA_CUBE ICON_FA_DATABASE ICON_FA_DOWNLOAD ICON_FA_FILE
+    ICON_FA_FILE_CODE ICON_FA_FOLDER ICON_FA_FOLDER_OPEN ICON_FA_INFO
+    ICON_FA_MINUS ICON_FA_REFRESH ICON_FA_ROTATE_LEFT ICON_FA_ROTATE_RIGHT
+    ICON_FA_RUNNING ICON_FA_SEARCH ICON_FA_SPINNER ICON_FA_STOP
+    ICON_FA_STOPPED ICON_FA_TRASH ICON_FA_WINDOW_MAXIMIZE
+    ICON_FA_WINDOW_MINIMIZE ICON_FA_WINDOW_RESTORE;
+
+// Baked atlas cache: the atlas texture (8-bit alpha) plus each font's
+// metrics and glyph table, so later launches skip rasterization. The key
+// covers everything that changes the bake: the font files' contents, the
+// pixel size and raster scale, and the ImGui version and glyph layout.
+static const uint32_t kFontCacheMagic = 0x41464241; // "ABFA"
+
+static std::string GetFontCachePath() {
+#ifdef _WIN32
+  char *appdata = getenv("LOCALAPPDATA");
+  if (appdata) {
+    std::string dir = std::string(appdata) + "\\Autobuild";
+    CreateDirectoryRecursive(dir);
+    return dir + "\\font_atlas.cache";
+  }
+  return "font_atlas.cache";
+#else
+  const char *cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if ((cache && *cache) || home) {
+    std::string dir = (cache && *cache) ? std::string(cache)
+                                        : std::string(home) + "/.cache";
+    dir += "/autobuild";
+    CreateDirectoryRecursive(dir);
+    return dir + "/font_atlas.cache";
+  }
+  return "font_atlas.cache";
+#endif
+}
+
+// Key of a bake from the given font files (an empty path: not found)
+static uint64_t FontCacheKey(const std::vector<std::string> &paths) {
+  uint64_t h = kFnvOffset;
+  const float sizes[2] = {kFontPixelSize, kFontRasterScale};
+  const uint32_t layout[4] = {kFontCacheMagic, (uint32_t)IMGUI_VERSION_NUM,
+                              (uint32_t)sizeof(ImFontGlyph),
+                              (uint32_t)sizeof(ImWchar)};
+  h = Fnv1a(h, sizes, sizeof(sizes));
+  h = Fnv1a(h, layout, sizeof(layout));
+  h = Fnv1a(h, kAppIcons, sizeof(kAppIcons));
+  std::vector<char> buf(64 * 1024);
+  for (const auto &path : paths) {
+    h = Fnv1a(h, path.c_str(), path.size() + 1);
+    FILE *f = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+    if (!f)
+      continue;
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), f)) > 0)
+      h = Fnv1a(h, buf.data(), n);
+    fclose(f);
+  }
+  return h;
+}
+
+template <typename T>
+static void PutCacheBytes(std::string &out, const T *values, size_t n = 1) {
+  out.append((const char *)values, sizeof(T) * n);
+}
+
+// Serialize a built atlas for SaveFontCache / LoadFontCache
+static std::string SerializeFontAtlas(const AppFonts &fonts, uint64_t key) {
+  const ImFontAtlas *atlas = fonts.atlas;
+  std::string out;
+  int32_t header[5] = {atlas->TexWidth, atlas->TexHeight, atlas->Fonts.Size,
+                       (int32_t)atlas->Fonts.index_from_ptr(
+                           atlas->Fonts.find(fonts.solid)),
+                       (int32_t)atlas->Fonts.index_from_ptr(
+                           atlas->Fonts.find(fonts.regular))};
+  uint8_t loaded = fonts.loaded ? 1 : 0;
+  PutCacheBytes(out, &kFontCacheMagic);
+  PutCacheBytes(out, &key);
+  PutCacheBytes(out, header, 5);
+  PutCacheBytes(out, &loaded);
+  PutCacheBytes(out, &atlas->TexUvScale);
+  PutCacheBytes(out, &atlas->TexUvWhitePixel);
+  PutCacheBytes(out, atlas->TexUvLines, IM_ARRAYSIZE(atlas->TexUvLines));
+  for (const ImFont *font : atlas->Fonts) {
+    float metrics[3] = {font->FontSize, font->Ascent, font->Descent};
+    ImWchar chars[2] = {font->FallbackChar, font->EllipsisChar};
+    int32_t glyphs = font->Glyphs.Size;
+    char name[40] = {};
+    if (font->ConfigData)
+      memcpy(name, font->ConfigData->Name, sizeof(name) - 1);
+    PutCacheBytes(out, metrics, 3);
+    PutCacheBytes(out, chars, 2);
+    PutCacheBytes(out, name, sizeof(name));
+    PutCacheBytes(out, &glyphs);
+    PutCacheBytes(out, font->Glyphs.Data, (size_t)glyphs);
+  }
+  PutCacheBytes(out, atlas->TexPixelsAlpha8,
+                (size_t)atlas->TexWidth * atlas->TexHeight);
+  return out;
+}
+
+// Rebuild the atlas from a cache file written for key; false (and fonts
+// untouched) when the file is missing, stale or damaged
+static bool LoadFontCache(const std::string &path, uint64_t key,
+                          AppFonts &fonts) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  std::string in((std::istreambuf_iterator<char>(file)),
+                 std::istreambuf_iterator<char>());
+  size_t pos = 0;
+  auto get = [&](auto *values, size_t n = 1) {
+    size_t bytes = sizeof(*values) * n;
+    if (in.size() - pos < bytes)
+      return false;
+    memcpy((void *)values, in.data() + pos, bytes);
+    pos += bytes;
+    return true;
+  };
+  uint32_t magic = 0;
+  uint64_t stored_key = 0;
+  int32_t header[5] = {};
+  uint8_t loaded = 0;
+  if (!get(&magic) || magic != kFontCacheMagic || !get(&stored_key) ||
+      stored_key != key || !get(header, 5) || !get(&loaded))
+    return false;
+  int32_t width = header[0], height = header[1], count = header[2];
+  if (width <= 0 || height <= 0 || width > 16384 || height > 16384 ||
+      count <= 0 || header[3] < 0 || header[3] >= count || header[4] < 0 ||
+      header[4] >= count)
+    return false;
+
+  ImFontAtlas *atlas = IM_NEW(ImFontAtlas)();
+  bool ok = get(&atlas->TexUvScale) && get(&atlas->TexUvWhitePixel) &&
+            get(atlas->TexUvLines, IM_ARRAYSIZE(atlas->TexUvLines));
+  for (int32_t i = 0; ok && i < count; i++) {
+    ImFont *font = IM_NEW(ImFont)();
+    atlas->Fonts.push_back(font);
+    float metrics[3];
+    ImWchar chars[2];
+    ImFontConfig config;
+    int32_t glyphs = 0;
+    ok = get(metrics, 3) && get(chars, 2) &&
+         get(config.Name, sizeof(config.Name)) && get(&glyphs) &&
+         glyphs > 0 && glyphs < 0xFFFF;
+    if (!ok)
+      break;
+    font->Glyphs.resize(glyphs);
+    ok = get(font->Glyphs.Data, (size_t)glyphs);
+    font->FontSize = metrics[0];
+    font->Ascent = metrics[1];
+    font->Descent = metrics[2];
+    font->FallbackChar = chars[0];
+    font->EllipsisChar = chars[1];
+    font->ContainerAtlas = atlas;
+    config.Name[sizeof(config.Name) - 1] = '\0';
+    config.FontDataOwnedByAtlas = false;
+    config.SizePixels = metrics[0];
+    config.DstFont = font;
+    atlas->ConfigData.push_back(config);
+  }
+  if (ok) {
+    atlas->TexWidth = width;
+    atlas->TexHeight = height;
+    atlas->TexPixelsAlpha8 = (unsigned char *)IM_ALLOC((size_t)width * height);
+    ok = get(atlas->TexPixelsAlpha8, (size_t)width * height) &&
+         pos == in.size();
+  }
+  if (!ok) {
+    IM_DELETE(atlas);
+    return false;
+  }
+  for (int i = 0; i < atlas->Fonts.Size; i++) {
+    ImFont *font = atlas->Fonts[i];
+    font->ConfigData = &atlas->ConfigData[i];
+    font->ConfigDataCount = 1;
+    font->BuildLookupTable();
+  }
+  atlas->TexReady = true;
+  fonts.atlas = atlas;
+  fonts.solid = atlas->Fonts[header[3]];
+  fonts.regular = atlas->Fonts[header[4]];
+  fonts.loaded = loaded != 0;
+  fonts.from_cache = true;
+  return true;
+}
+
+// System fonts the glyphs log lines need are taken from, in order: the
+// first one that has a glyph provides it. Emoji beyond the 16-bit range are
+// not covered, as ImGui here keeps 16-bit characters.
+static const std::vector<std::string> &FallbackFontPaths() {
+  static const std::vector<std::string> paths = [] {
+    const char *candidates[] = {
+#ifdef _WIN32
+        "C:\\Windows\\Fonts\\segoeui.ttf",
+        "C:\\Windows\\Fonts\\msyh.ttc",
+        "C:\\Windows\\Fonts\\seguisym.ttf",
+#elif defined(__APPLE__)
+        "/System/Library/Fonts/Supplemental/Arial Unicode.ttf",
+        "/Library/Fonts/Arial Unicode.ttf",
+        "/System/Library/Fonts/Hiragino Sans GB.ttc",
+#else
+        "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf",
+        "/usr/share/fonts/TTF/DejaVuSans.ttf",
+        "/usr/share/fonts/opentype/noto/NotoSansCJK-Regular.ttc",
+        "/usr/share/fonts/noto-cjk/NotoSansCJK-Regular.ttc",
+        "/usr/share/fonts/google-noto-cjk/NotoSansCJK-Regular.ttc",
+        "/usr/share/fonts/truetype/noto/NotoSansSymbols2-Regular.ttf",
+#endif
+    };
+    std::vector<std::string> found;
+    for (const char *path : candidates) {
+      if (FileExists(path))
+        found.push_back(path);
+    }
+    return found;
+  }();
+  return paths;
+}
+
+// Bake the fonts. demand adds those codepoints from the fallback fonts; a
+// bake with demand is neither loaded from nor saved to the cache, which
+// holds the plain one every launch starts with.
+static AppFonts BuildAppFonts(bool show_debug_info,
+                              std::vector<ImWchar> demand) {
+  auto start = std::chrono::steady_clock::now();
+  AppFonts fonts;
+  fonts.atlas = IM_NEW(ImFontAtlas)();
+  ImFontAtlas *atlas = fonts.atlas;
+
+  // Default font first (required for proper text rendering), with proper
+  // glyph ranges
+  ImFontConfig default_config;
+  default_config.GlyphRanges = atlas->GetGlyphRangesDefault();
+  atlas->AddFontDefault(&default_config);
+
+  // The glyphs log lines asked for, merged into the default font from
+  // whichever fallback font has each (one a font lacks is skipped there);
+  // demand is sorted, each codepoint a range of its own
+  ImVector<ImWchar> demand_ranges;
+  if (!demand.empty()) {
+    for (ImWchar c : demand) {
+      demand_ranges.push_back(c);
+      demand_ranges.push_back(c);
+    }
+    demand_ranges.push_back(0);
+    for (const std::string &path : FallbackFontPaths()) {
+      ImFontConfig fallback_config;
+      fallback_config.MergeMode = true;
+      fallback_config.GlyphRanges = demand_ranges.Data;
+      atlas->AddFontFromFileTTF(path.c_str(), kFontPixelSize,
+                                &fallback_config);
+    }
+  }
+
+  // Load Font Awesome fonts with error handling
+  // Use smaller font size to match ImGui default (around 13px)
+  // Try multiple possible paths for font files, including macOS app bundle
+  std::string exe_dir_for_fonts = GetExecutableDir();
+  std::vector<std::string> possible_solid_paths = {
+      "resources/fonts/fa-solid-900.ttf",
+      "./resources/fonts/fa-solid-900.ttf",
+      "../resources/fonts/fa-solid-900.ttf",
+      "../../resources/fonts/fa-solid-900.ttf",
+      exe_dir_for_fonts + "/resources/fonts/fa-solid-900.ttf",
+      exe_dir_for_fonts + "/../Resources/fonts/fa-solid-900.ttf",
+      exe_dir_for_fonts + "/../Resources/fa-solid-900.ttf"};
+
+  std::vector<std::string> possible_regular_paths = {
+      "resources/fonts/fa-regular-400.ttf",
+      "./resources/fonts/fa-regular-400.ttf",
+      "../resources/fonts/fa-regular-400.ttf",
+      "../../resources/fonts/fa-regular-400.ttf",
+      exe_dir_for_fonts + "/resources/fonts/fa-regular-400.ttf",
+      exe_dir_for_fonts + "/../Resources/fonts/fa-regular-400.ttf",
+      exe_dir_for_fonts + "/../Resources/fa-regular-400.ttf"};
+
+  std::string solid_font_path = "";
+  std::string regular_font_path = "";
+
+  // Find the correct path for solid font
+  for (const auto &path : possible_solid_paths) {
+    FILE *test = fopen(path.c_str(), "rb");
+    if (test) {
+      solid_font_path = path;
+      fclose(test);
+      if (show_debug_info)
+        printf("Found solid font at: %s\n", path.c_str());
+      break;
+    }
+  }
+
+  // Find the correct path for regular font
+  for (const auto &path : possible_regular_paths) {
+    FILE *test = fopen(path.c_str(), "rb");
+    if (test) {
+      regular_font_path = path;
+      fclose(test);
+      if (show_debug_info)
+        printf("Found regular font at: %s\n", path.c_str());
+      break;
+    }
+  }
+
+  // Log if fonts not found
+  if (solid_font_path.empty()) {
+    ConsoleLog("[WARN] Font Awesome Solid font not found, using fallback");
+  }
+  if (regular_font_path.empty()) {
+    ConsoleLog("[WARN] Font Awesome Regular font not found, using fallback");
+  }
+
+  // A bake of the same files is loaded as is; only a new key rasterizes
+  std::string cache_path = GetFontCachePath();
+  uint64_t cache_key = FontCacheKey({solid_font_path, regular_font_path});
+  if (demand.empty() && LoadFontCache(cache_path, cache_key, fonts)) {
+    IM_DELETE(atlas);
+    unsigned char *pixels = nullptr;
+    int width = 0, height = 0;
+    fonts.atlas->GetTexDataAsRGBA32(&pixels, &width, &height);
+    fonts.build_ms = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    if (show_debug_info)
+      printf("Font atlas loaded from cache: %s\n", cache_path.c_str());
+    return fonts;
+  }
+
+  // Load Font Awesome fonts with proper glyph ranges
+  // Fix for FontAwesome 6 blurriness: disable MergeMode and use larger font
+  // size
+  ImVector<ImWchar> icon_ranges;
+  {
+    ImFontGlyphRangesBuilder icons;
+    icons.AddText(kAppIcons);
+    icons.BuildRanges(&icon_ranges);
+  }
+
+  ImFontConfig solid_config;
+  solid_config.MergeMode = true;
+  solid_config.GlyphRanges = icon_ranges.Data;
+  solid_config.GlyphMinAdvanceX =
+      13.0f; // Set minimum advance for better rendering
 
-      if (should_disable) {
-        ImGui::BeginDisabled();
-      }
-      // Add unique ID to prevent conflicts
-      ImGui::PushID((std::string(task_type) + "_button").c_str());
-      if (AnimatedButton(("Run (" + std::to_string(count) + ")").c_str(),
-                         ImVec2(button_width, slider_height),
-                         (std::string(task_type) + "_run").c_str())) {
-        state.selected_mode = mode;
-        StartMultipleTasks(state, task_type, count);
-      }
-      ImGui::PopID();
-      if (should_disable) {
-        ImGui::EndDisabled();
-      }
-    };
+  ImFontConfig regular_config;
+  regular_config.MergeMode = true;
+  regular_config.GlyphRanges = icon_ranges.Data;
+  regular_config.GlyphMinAdvanceX =
+      13.0f; // Set minimum advance for better rendering
 
-    // Row 1: Feedback
-    CreateTaskRow("Feedback", state.feedback_count, 0, "Feedback");
+  // Use larger font size to prevent blurriness
+  if (!solid_font_path.empty()) {
+    fonts.solid = atlas->AddFontFromFileTTF(solid_font_path.c_str(),
+                                            kFontPixelSize, &solid_config);
+  }
+  if (!fonts.solid) {
+    // Fallback to default font
+    fonts.solid = atlas->Fonts[0];
+    if (show_debug_info)
+      printf("Using fallback for solid font\n");
+  }
 
-    // Row 2: Verify
-    CreateTaskRow("Verify", state.verify_count, 1, "Verify");
+  if (!regular_font_path.empty()) {
+    fonts.regular = atlas->AddFontFromFileTTF(regular_font_path.c_str(),
+                                              kFontPixelSize, &regular_config);
+  }
+  if (!fonts.regular) {
+    // Fallback to default font
+    fonts.regular = atlas->Fonts[0];
+    if (show_debug_info)
+      printf("Using fallback for regular font\n");
+  }
 
-    // Row 3: Both
-    CreateTaskRow("Both", state.both_count, 2, "Both");
+  // Check if both fonts loaded successfully
+  fonts.loaded = (fonts.solid != nullptr && fonts.regular != nullptr);
 
-    // Row 4: Audit
-    CreateTaskRow("Audit", state.audit_count, 3, "Audit");
+  if (fonts.loaded) {
+    if (show_debug_info)
+      printf("Font Awesome fonts loaded successfully\n");
+  } else {
+    if (show_debug_info)
+      printf("Font Awesome fonts failed to load, using fallback text\n");
+    // Ensure we have valid font pointers even if loading failed
+    if (!fonts.solid)
+      fonts.solid = atlas->Fonts[0];
+    if (!fonts.regular)
+      fonts.regular = atlas->Fonts[0];
+  }
+
+  // Build the atlas and its RGBA texture data now, off the main thread
+  unsigned char *pixels = nullptr;
+  int width = 0, height = 0;
+  atlas->GetTexDataAsRGBA32(&pixels, &width, &height);
+  if (atlas->TexPixelsAlpha8 && demand.empty())
+    g_file_saver.Submit(cache_path, SerializeFontAtlas(fonts, cache_key));
+  fonts.build_ms = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return fonts;
+}
 
-    ImGui::Spacing();
-    ImGui::Separator();
-    ImGui::Spacing();
+// The ImGui renderer backend: SDL_Renderer by default, or an OpenGL 3.3
+// core context with AUTOBUILD_GUI_OPENGL. main() goes through these so the
+// frame loop is the same for both.
+struct GuiRenderer {
+#ifdef AUTOBUILD_GUI_OPENGL
+  SDL_GLContext gl_context = nullptr;
+#else
+  SDL_Renderer *renderer = nullptr;
+#endif
+};
 
-    // Status message with animation
-    if (at_limit) {
-      status_message = "At maximum concurrent tasks (" +
-                       std::to_string(state.max_concurrent_tasks) + ")";
-      status_color = ImVec4(1.0f, 0.6f, 0.0f, 1.0f);
-    } else if (running_count > 0) {
-      status_message = "Ready (" + std::to_string(running_count) + " running)";
-      status_color = ImVec4(0.4f, 0.8f, 1.0f, 1.0f);
-    }
+// Window flags and, for OpenGL, the context attributes; call before
+// SDL_CreateWindow
+static Uint32 GuiRendererWindowFlags() {
+#ifdef AUTOBUILD_GUI_OPENGL
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS,
+#ifdef __APPLE__
+                      SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG
+#else
+                      0
+#endif
+  );
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
+                      SDL_GL_CONTEXT_PROFILE_CORE);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+  SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
+  SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 0);
+  return SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI;
+#else
+  return 0;
+#endif
+}
 
-    // Determine if status should pulse (for warnings/errors)
-    bool should_pulse = (status_color.x > 0.8f ||
-                         status_color.y < 0.5f); // Red or orange colors
-    AnimatedStatusIndicator(status_message.c_str(), status_color, should_pulse,
-                            "main_status");
+// Creates the renderer and initializes both ImGui backends. Returns false
+// (with the error printed) if the renderer could not be created.
+static bool CreateGuiRenderer(SDL_Window *window, GuiRenderer &out) {
+#ifdef AUTOBUILD_GUI_OPENGL
+  out.gl_context = SDL_GL_CreateContext(window);
+  if (!out.gl_context) {
+    fprintf(stderr, "SDL_GL_CreateContext Error: %s\n", SDL_GetError());
+    return false;
+  }
+  SDL_GL_MakeCurrent(window, out.gl_context);
+  if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
+    fprintf(stderr, "Failed to load OpenGL functions\n");
+    SDL_GL_DeleteContext(out.gl_context);
+    out.gl_context = nullptr;
+    return false;
+  }
+  SDL_GL_SetSwapInterval(1);
+  g_gpu_imgui_pass = g_gpu_timers.AddPass("imgui");
+  g_gpu_timers.Init();
+  ImGui_ImplSDL2_InitForOpenGL(window, out.gl_context);
+  ImGui_ImplOpenGL3_Init("#version 330 core");
+#else
+  out.renderer = SDL_CreateRenderer(
+      window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  if (!out.renderer) {
+    fprintf(stderr, "SDL_CreateRenderer Error: %s\n", SDL_GetError());
+    return false;
   }
+  ImGui_ImplSDL2_InitForSDLRenderer(window, out.renderer);
+  ImGui_ImplSDLRenderer2_Init(out.renderer);
+#endif
+  return true;
+}
 
-  // Pop window background color
-  ImGui::PopStyleColor(1); // WindowBg
+static void GuiRendererNewFrame() {
+#ifdef AUTOBUILD_GUI_OPENGL
+  ImGui_ImplOpenGL3_NewFrame();
+#else
+  ImGui_ImplSDLRenderer2_NewFrame();
+#endif
+}
 
-  // Render Prompt Editor window if open
-  RenderPromptEditor(state);
+// Drops the font texture so the next NewFrame uploads the current atlas
+static void GuiRendererDestroyFontsTexture() {
+#ifdef AUTOBUILD_GUI_OPENGL
+  ImGui_ImplOpenGL3_DestroyFontsTexture();
+#else
+  ImGui_ImplSDLRenderer2_DestroyFontsTexture();
+#endif
+}
 
-  // Render dev overlay last so it remains visible on top
-  if (state.dev_mode) {
-    RenderDevOverlay(state, io);
-  }
+// Keeps the SDL_Renderer viewport in step with the window; the OpenGL
+// backend sets its viewport from the draw data every frame
+static void GuiRendererResize(GuiRenderer &r, int width, int height) {
+#ifdef AUTOBUILD_GUI_OPENGL
+  (void)r;
+  (void)width;
+  (void)height;
+#else
+  SDL_RenderSetViewport(r.renderer, NULL);
+  SDL_RenderSetLogicalSize(r.renderer, width, height);
+#endif
+}
 
-  // main_window_scope dtor calls ImGui::End()
+// Clears to the window background, draws ImGui's draw data and presents
+static void GuiRendererPresent(SDL_Window *window, GuiRenderer &r) {
+#ifdef AUTOBUILD_GUI_OPENGL
+  (void)r;
+  glClearColor(28 / 255.0f, 34 / 255.0f, 40 / 255.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  g_gpu_timers.BeginFrame();
+  g_gpu_timers.Begin(g_gpu_imgui_pass);
+  ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+  g_gpu_timers.End(g_gpu_imgui_pass);
+  SDL_GL_SwapWindow(window);
+#else
+  (void)window;
+  SDL_SetRenderDrawColor(r.renderer, 28, 34, 40, 255);
+  SDL_RenderClear(r.renderer);
+  ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
+  SDL_RenderPresent(r.renderer);
+#endif
 }
 
-////////////////////////////////////////////////////////////
-//                                                       //
-//              MAIN FUNCTION & APPLICATION              //
-//                                                       //
-////////////////////////////////////////////////////////////
+// Shuts down the renderer backend and destroys the renderer or context;
+// the SDL2 platform backend is shut down by the caller
+static void DestroyGuiRenderer(GuiRenderer &r) {
+#ifdef AUTOBUILD_GUI_OPENGL
+  ImGui_ImplOpenGL3_Shutdown();
+  g_gpu_timers.Destroy();
+  SDL_GL_DeleteContext(r.gl_context);
+  r.gl_context = nullptr;
+#else
+  ImGui_ImplSDLRenderer2_Shutdown();
+  SDL_DestroyRenderer(r.renderer);
+  r.renderer = nullptr;
+#endif
+}
 
 int main(int argc, char **argv) {
+  StartupTrace startup;
+
+  // Writing a build context archive for autobuild.sh (see CONTEXT_TOOL)
+  if (argc == 4 && strcmp(argv[1], "--context-tar") == 0) {
+    std::string tar = CacheDockerContextTar(argv[2], argv[3]);
+    if (tar.empty())
+      return 1;
+    printf("%s\n", tar.c_str());
+    return 0;
+  }
+
+  // Running as a synthetic load task's process (see StartSyntheticTasks)
+  if (argc > 1 && strcmp(argv[1], "--synthetic-load") == 0) {
+    SyntheticLoad load;
+    for (int i = 2; i + 1 < argc; i += 2) {
+      int value = atoi(argv[i + 1]);
+      if (strcmp(argv[i], "--rate") == 0)
+        load.lines_per_sec = std::max(1, std::min(value, kSyntheticMaxRate));
+      else if (strcmp(argv[i], "--seconds") == 0)
+        load.seconds = std::max(1, value);
+      else if (strcmp(argv[i], "--burst") == 0)
+        load.burst_lines = std::max(0, value);
+      else if (strcmp(argv[i], "--burst-every") == 0)
+        load.burst_every_s = std::max(1, value);
+      else if (strcmp(argv[i], "--long-pct") == 0)
+        load.long_line_pct = std::max(0, std::min(value, 100));
+    }
+    return RunSyntheticLoad(load);
+  }
+
+  // Running as a replay task's process (see StartReplayTasks)
+  if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+    double speed = 1.0;
+    for (int i = 3; i + 1 < argc; i += 2) {
+      if (strcmp(argv[i], "--speed") == 0)
+        speed = std::max(0.0, atof(argv[i + 1]));
+    }
+    return RunReplay(argv[2], speed);
+  }
 
   // Parse command line arguments
   bool show_debug_info = false;
   bool show_help = false;
   bool disable_assertions = false;
+  bool startup_trace = false;
 
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "-d") == 0) {
@@ -8969,6 +20519,8 @@ int main(int argc, char **argv) {
     } else if (strcmp(argv[i], "--no-assert") == 0 ||
                strcmp(argv[i], "-n") == 0) {
       disable_assertions = true;
+    } else if (strcmp(argv[i], "--startup-trace") == 0) {
+      startup_trace = true;
     }
   }
 
@@ -8979,6 +20531,7 @@ int main(int argc, char **argv) {
     printf("  --debug, -d    Show debug information and issues in console\n");
     printf("  --no-assert, -n  Disable ImGui assertions (prevents dialog "
            "boxes)\n");
+    printf("  --startup-trace  Print how long each startup phase took\n");
     printf("  --help, -h     Show this help message\n");
     printf("\nDebug mode will:\n");
     printf("  - Show ImGui state information in console\n");
@@ -8995,10 +20548,28 @@ int main(int argc, char **argv) {
     fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
     return 1;
   }
+  g_wake_event = SDL_RegisterEvents(1);
+  g_jobs.SetWake(WakeMainLoop);
+  {
+    ProcessReactor::Hooks hooks;
+    hooks.thread_start = []() {
+      TRACE_THREAD("Process reactor");
+      HeapThread("Process reactor", kHeapTasks);
+    };
+    // One wakeup for all the lines of the previous pass
+    hooks.before_wait = [posted = (uint64_t)0]() mutable {
+      WakeForNewLogs(posted);
+    };
+    hooks.log = ConsoleLog;
+    hooks.debug = &g_show_debug_console;
+    hooks.jobs = &g_jobs;
+    g_process_reactor.SetHooks(std::move(hooks));
+  }
+  startup.Mark("SDL init");
 
   SDL_Window *window = SDL_CreateWindow(
       "Autobuild", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1280, 720,
-      SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+      SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | GuiRendererWindowFlags());
   if (!window) {
     fprintf(stderr, "SDL_CreateWindow Error: %s\n", SDL_GetError());
     SDL_Quit();
@@ -9008,6 +20579,7 @@ int main(int argc, char **argv) {
   // Set window size constraints
   SDL_SetWindowMinimumSize(window, 800, 600);
   SDL_SetWindowMaximumSize(window, 2560, 1440);
+  startup.Mark("window");
 
   // Cross-platform custom title bar: remove OS title bar and draw our own
   TitleBarState titlebar;
@@ -9040,148 +20612,37 @@ int main(int argc, char **argv) {
 
   // Optionally set an app window icon here (see docs)
 
-  SDL_Renderer *renderer = SDL_CreateRenderer(
-      window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-  if (!renderer) {
-    fprintf(stderr, "SDL_CreateRenderer Error: %s\n", SDL_GetError());
-    SDL_DestroyWindow(window);
-    SDL_Quit();
-    return 1;
-  }
-
   // Setup Dear ImGui context
   IMGUI_CHECKVERSION();
+  HeapThread("Render", kHeapUi);
+  ImGui::SetAllocatorFunctions(CountedImGuiAlloc, CountedImGuiFree);
   ImGui::CreateContext();
   ImGuiIO &io = ImGui::GetIO();
   io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
 
   // Setup Platform/Renderer backends
-  ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
-  ImGui_ImplSDLRenderer2_Init(renderer);
+  GuiRenderer renderer;
+  if (!CreateGuiRenderer(window, renderer)) {
+    ImGui::DestroyContext();
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 1;
+  }
+  startup.Mark("renderer + ImGui init");
 
-  // Load default font first (required for proper text rendering)
-  // Ensure default font loads with proper glyph ranges
+  // Only the built-in font for the first frames; the icon fonts are built
+  // on a background thread and swapped in once ready (see BuildAppFonts)
   ImFontConfig default_config;
   default_config.GlyphRanges = io.Fonts->GetGlyphRangesDefault();
   io.Fonts->AddFontDefault(&default_config);
-
-  // Load Font Awesome fonts with error handling
-  // Use smaller font size to match ImGui default (around 13px)
-  // Try multiple possible paths for font files, including macOS app bundle
-  std::string exe_dir_for_fonts = GetExecutableDir();
-  std::vector<std::string> possible_solid_paths = {
-      "resources/fonts/fa-solid-900.ttf",
-      "./resources/fonts/fa-solid-900.ttf",
-      "../resources/fonts/fa-solid-900.ttf",
-      "../../resources/fonts/fa-solid-900.ttf",
-      exe_dir_for_fonts + "/resources/fonts/fa-solid-900.ttf",
-      exe_dir_for_fonts + "/../Resources/fonts/fa-solid-900.ttf",
-      exe_dir_for_fonts + "/../Resources/fa-solid-900.ttf"};
-
-  std::vector<std::string> possible_regular_paths = {
-      "resources/fonts/fa-regular-400.ttf",
-      "./resources/fonts/fa-regular-400.ttf",
-      "../resources/fonts/fa-regular-400.ttf",
-      "../../resources/fonts/fa-regular-400.ttf",
-      exe_dir_for_fonts + "/resources/fonts/fa-regular-400.ttf",
-      exe_dir_for_fonts + "/../Resources/fonts/fa-regular-400.ttf",
-      exe_dir_for_fonts + "/../Resources/fa-regular-400.ttf"};
-
-  std::string solid_font_path = "";
-  std::string regular_font_path = "";
-
-  // Find the correct path for solid font
-  for (const auto &path : possible_solid_paths) {
-    FILE *test = fopen(path.c_str(), "rb");
-    if (test) {
-      solid_font_path = path;
-      fclose(test);
-      if (show_debug_info)
-        printf("Found solid font at: %s\n", path.c_str());
-      break;
-    }
-  }
-
-  // Find the correct path for regular font
-  for (const auto &path : possible_regular_paths) {
-    FILE *test = fopen(path.c_str(), "rb");
-    if (test) {
-      regular_font_path = path;
-      fclose(test);
-      if (show_debug_info)
-        printf("Found regular font at: %s\n", path.c_str());
-      break;
-    }
-  }
-
-  // Log if fonts not found
-  if (solid_font_path.empty()) {
-    ConsoleLog("[WARN] Font Awesome Solid font not found, using fallback");
-  }
-  if (regular_font_path.empty()) {
-    ConsoleLog("[WARN] Font Awesome Regular font not found, using fallback");
-  }
-
-  // Load Font Awesome fonts with proper glyph ranges
-  // Fix for FontAwesome 6 blurriness: disable MergeMode and use larger font
-  // size
-  static const ImWchar icon_ranges[] = {0xf000, 0xf8ff, // Font Awesome range
-                                        0};
-
-  ImFontConfig solid_config;
-  solid_config.MergeMode = true;
-  solid_config.GlyphRanges = icon_ranges;
-  solid_config.GlyphMinAdvanceX =
-      13.0f; // Set minimum advance for better rendering
-
-  ImFontConfig regular_config;
-  regular_config.MergeMode = true;
-  regular_config.GlyphRanges = icon_ranges;
-  regular_config.GlyphMinAdvanceX =
-      13.0f; // Set minimum advance for better rendering
-
-  // Use larger font size to prevent blurriness
-  if (!solid_font_path.empty()) {
-    g_font_awesome_solid = io.Fonts->AddFontFromFileTTF(solid_font_path.c_str(),
-                                                        13.0f, &solid_config);
-  }
-  if (!g_font_awesome_solid) {
-    // Fallback to default font
-    g_font_awesome_solid = io.Fonts->Fonts[0];
-    if (show_debug_info)
-      printf("Using fallback for solid font\n");
-  }
-
-  if (!regular_font_path.empty()) {
-    g_font_awesome_regular = io.Fonts->AddFontFromFileTTF(
-        regular_font_path.c_str(), 13.0f, &regular_config);
-  }
-  if (!g_font_awesome_regular) {
-    // Fallback to default font
-    g_font_awesome_regular = io.Fonts->Fonts[0];
-    if (show_debug_info)
-      printf("Using fallback for regular font\n");
-  }
-
-  // Check if both fonts loaded successfully
-  g_fonts_loaded =
-      (g_font_awesome_solid != nullptr && g_font_awesome_regular != nullptr);
-
-  if (g_fonts_loaded) {
-    if (show_debug_info)
-      printf("Font Awesome fonts loaded successfully\n");
-  } else {
-    if (show_debug_info)
-      printf("Font Awesome fonts failed to load, using fallback text\n");
-    // Ensure we have valid font pointers even if loading failed
-    if (!g_font_awesome_solid)
-      g_font_awesome_solid = io.Fonts->Fonts[0];
-    if (!g_font_awesome_regular)
-      g_font_awesome_regular = io.Fonts->Fonts[0];
-  }
-
-  // Build font atlas
   io.Fonts->Build();
+  g_font_awesome_solid = io.Fonts->Fonts[0];
+  g_font_awesome_regular = io.Fonts->Fonts[0];
+  std::future<AppFonts> fonts_future =
+      std::async(std::launch::async, BuildAppFonts, show_debug_info,
+                 std::vector<ImWchar>());
+  g_glyph_demand.enabled = !FallbackFontPaths().empty();
+  startup.Mark("fonts (default)");
 
   // Set modern style
   SetModernStyle();
@@ -9216,18 +20677,66 @@ int main(int argc, char **argv) {
 
   // Load configuration from file
   LoadConfig(state);
-
-  // Load prompts from file
-  LoadPrompts(state);
+  // Before anything can queue a run and be handed a name
+  if (!g_names.Open(NameMarkPath()) && g_show_debug_console)
+    ConsoleLog("[WARN] Cannot write the name mark " + NameMarkPath());
+  ConfigureLogArchive(state);
+  ConfigureCatalogExport(state);
+  ConfigureLogStaging(state);
+  ConfigureDockerGc(state);
+  g_build_farm.Configure(state.max_image_builds);
+  g_base_puller.Configure(state.max_image_pulls);
+  ConfigureApiGovernor(state);
+  g_log_ingest_rate = state.log_ingest_lines_per_sec;
+  ConfigureMetrics(state);
+  ConfigureDashboard(state);
+  ConfigureSubmissions(state);
+  // Log rings a crashed instance left behind
+  SharedLogRing::RemoveStale();
+  RestoreJournaledRuns(state);
+  if (state.raise_gui_priority)
+    ApplyGuiThreadPriority(state);
+  startup.Mark("config");
+
+  // Prompts, Docker and the logs index are started once the first frame is
+  // on screen (see below); the prompts only matter from the second frame on
+  // and the rest runs on background threads
+  bool first_frame = true;
 
   // Main loop
   bool running = true;
+  int settle_frames = kSettleFrames;
+  uint64_t drained_log_seq = 0;
   while (running) {
+    // Wait for something to happen unless there is something to animate
+    SDL_Event event;
+    int wait_ms = settle_frames > 0 ? 0 : FrameWaitMs(state);
+    bool have_event = wait_ms == 0 ? SDL_PollEvent(&event) != 0
+                                   : SDL_WaitEventTimeout(&event, wait_ms) != 0;
+    if (have_event)
+      settle_frames = kSettleFrames;
+    else if (settle_frames > 0)
+      settle_frames--;
+
+    // Dev mode profiles every frame from here to the present
+    g_frame_profiler.SetEnabled(state.dev_mode && !state.profiler_paused);
+    g_frame_profiler.BeginFrame();
+    auto frame_start = std::chrono::steady_clock::now();
+
     // Update animations
-    g_animation_manager.Update();
+    {
+      TRACE_ZONE("Animations");
+      ProfileZone _zone("Animations");
+      g_animation_manager.Update();
+    }
+
+    int events_zone = g_frame_profiler.Push("Events");
+    for (; have_event; have_event = SDL_PollEvent(&event) != 0) {
+      if (event.type == g_wake_event) {
+        g_wake_pending = false;
+        continue;
+      }
 
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
       // Handle debugging shortcuts BEFORE ImGui processes the event
       if (event.type == SDL_KEYDOWN) {
         if ((event.key.keysym.mod & KMOD_CTRL) &&
@@ -9239,9 +20748,10 @@ int main(int argc, char **argv) {
             state.show_style_editor = false;
             state.show_demo = false;
             state.show_debug_console = false;
+            state.show_profiler = false;
           }
-          DevLog(state, std::string("dev_mode toggled: ") +
-                            (state.dev_mode ? "ON" : "OFF"));
+          DevLog(std::string("dev_mode toggled: ") +
+                     (state.dev_mode ? "ON" : "OFF"));
           continue;
         }
         if (state.dev_mode && (event.key.keysym.mod & KMOD_CTRL) &&
@@ -9250,8 +20760,8 @@ int main(int argc, char **argv) {
           state.show_metrics = new_value;
           if (new_value)
             state.bring_front_metrics = true;
-          DevLog(state, std::string("metrics window toggled: ") +
-                            (state.show_metrics ? "ON" : "OFF"));
+          DevLog(std::string("metrics window toggled: ") +
+                     (state.show_metrics ? "ON" : "OFF"));
           continue;
         }
         if (state.dev_mode && (event.key.keysym.mod & KMOD_CTRL) &&
@@ -9260,8 +20770,8 @@ int main(int argc, char **argv) {
           state.show_style_editor = new_value;
           if (new_value)
             state.bring_front_style = true;
-          DevLog(state, std::string("style editor toggled: ") +
-                            (state.show_style_editor ? "ON" : "OFF"));
+          DevLog(std::string("style editor toggled: ") +
+                     (state.show_style_editor ? "ON" : "OFF"));
           continue;
         }
         if (state.dev_mode && (event.key.keysym.mod & KMOD_CTRL) &&
@@ -9270,15 +20780,15 @@ int main(int argc, char **argv) {
           state.show_demo = new_value;
           if (new_value)
             state.bring_front_demo = true;
-          DevLog(state, std::string("demo window toggled: ") +
-                            (state.show_demo ? "ON" : "OFF"));
+          DevLog(std::string("demo window toggled: ") +
+                     (state.show_demo ? "ON" : "OFF"));
           continue;
         }
         if (state.dev_mode && (event.key.keysym.mod & KMOD_CTRL) &&
             event.key.keysym.sym == SDLK_c) {
           state.show_debug_console = !state.show_debug_console;
-          DevLog(state, std::string("debug console toggled: ") +
-                            (state.show_debug_console ? "ON" : "OFF"));
+          DevLog(std::string("debug console toggled: ") +
+                     (state.show_debug_console ? "ON" : "OFF"));
           continue;
         }
       }
@@ -9300,8 +20810,7 @@ int main(int argc, char **argv) {
         int new_height = event.window.data2;
 
         // Update the renderer viewport to match the new window size
-        SDL_RenderSetViewport(renderer, NULL);
-        SDL_RenderSetLogicalSize(renderer, new_width, new_height);
+        GuiRendererResize(renderer, new_width, new_height);
       }
 
       // Handle file drop events from OS
@@ -9324,14 +20833,74 @@ int main(int argc, char **argv) {
         state.is_hovering_drop_zone = false;
       }
     }
+    g_frame_profiler.Pop(events_zone);
+
+    // Results of background jobs
+    g_jobs.RunCompletions();
+    // Pull new task output into the render-thread log views, only when
+    // some arrived
+    uint64_t log_seq = g_log_seq.load(std::memory_order_acquire);
+    if (log_seq != drained_log_seq) {
+      TRACE_ZONE("Drain logs");
+      ProfileZone _zone("Drain logs");
+      drained_log_seq = log_seq;
+      DrainTaskLogs(state);
+    }
+    // Validation runs in the background and lands here when it changed
+    {
+      ProfileZone _zone("Scheduler");
+      g_task_validator.Poll(state.task_directory, state.validation);
+      g_trash.Poll();
+      ReloadChangedSettings(state);
+      g_submissions.Poll(
+          [&state](const JsonValue &request, uint64_t &follow) {
+            return HandleSubmission(state, request, follow);
+          });
+      ScheduleQueuedTasks(state);
+    }
+
+    // Swap in the full font atlas once its thread is done; the backend
+    // uploads the new texture in NewFrame
+    if (fonts_future.valid() &&
+        fonts_future.wait_for(std::chrono::seconds(0)) ==
+            std::future_status::ready) {
+      AppFonts fonts = fonts_future.get();
+      GuiRendererDestroyFontsTexture();
+      ImFontAtlas *bare = io.Fonts;
+      io.Fonts = fonts.atlas; // owned by the context from here on
+      IM_DELETE(bare);
+      g_font_awesome_solid = fonts.solid;
+      g_font_awesome_regular = fonts.regular;
+      g_fonts_loaded = fonts.loaded;
+      if (startup_trace && g_glyph_demand.building.empty())
+        printf("  fonts (background)     %8.1f ms  (ready at %.1f ms%s)\n",
+               fonts.build_ms, startup.Elapsed(),
+               fonts.from_cache ? ", cached" : "");
+      // What no fallback font could give stays a fallback box for good
+      for (ImWchar c : g_glyph_demand.building)
+        if (!io.Fonts->Fonts[0]->FindGlyphNoFallback(c)) {
+          g_glyph_demand.seen.erase(c);
+          g_glyph_demand.absent.insert(c);
+        }
+      g_glyph_demand.building.clear();
+    }
+    // Bake the glyphs log lines were missing into a new atlas, swapped in
+    // above like the first one
+    if (!fonts_future.valid() && g_glyph_demand.missing &&
+        ImGui::GetTime() - g_glyph_demand.built_at >= kGlyphRebuildSeconds)
+      fonts_future = std::async(std::launch::async, BuildAppFonts,
+                                show_debug_info, TakeGlyphDemand());
 
     // Start the Dear ImGui frame
-    ImGui_ImplSDLRenderer2_NewFrame();
+    GuiRendererNewFrame();
     ImGui_ImplSDL2_NewFrame();
+    g_frame_arena.Reset(); // last frame's labels have been drawn
     ImGui::NewFrame();
 
     // Render UI with error handling
+    int ui_zone = g_frame_profiler.Push("UI");
     try {
+      TRACE_ZONE("RenderMainUI");
       RenderMainUI(state);
 
       // Render debug windows
@@ -9392,7 +20961,7 @@ int main(int argc, char **argv) {
       std::string error_msg =
           "EXCEPTION in RenderMainUI: " + std::string(e.what());
       if (state.dev_mode) {
-        DevLog(state, error_msg);
+        DevLog(error_msg);
       }
       if (g_show_debug_console) {
         ConsoleLog("CRITICAL: " + error_msg);
@@ -9400,7 +20969,7 @@ int main(int argc, char **argv) {
     } catch (...) {
       std::string error_msg = "UNKNOWN EXCEPTION in RenderMainUI";
       if (state.dev_mode) {
-        DevLog(state, error_msg);
+        DevLog(error_msg);
       }
       if (g_show_debug_console) {
         ConsoleLog("CRITICAL: " + error_msg);
@@ -9411,34 +20980,102 @@ int main(int argc, char **argv) {
     if (RenderCustomTitleBarSimple(window, titlebar)) {
       running = false;
     }
+    g_frame_profiler.Pop(ui_zone);
 
     // Rendering
-    ImGui::Render();
-    SDL_SetRenderDrawColor(renderer, 28, 34, 40, 255);
-    SDL_RenderClear(renderer);
-    ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
-    SDL_RenderPresent(renderer);
+    {
+      TRACE_ZONE("Render");
+      ProfileZone _zone("Render");
+      ImGui::Render();
+      GuiRendererPresent(window, renderer);
+    }
+    if (first_frame) {
+      first_frame = false;
+      startup.Mark("first frame");
+      SignalSplashReady();
+      if (startup_trace)
+        startup.Print();
+      auto deferred_start = std::chrono::steady_clock::now();
+      LoadPrompts(state);
+      // From here on, edits to the settings files made elsewhere are picked
+      // up without a restart
+      g_settings_watcher.Watch(GetConfigFilePath(), GetPromptsFilePath());
+      // Follow Docker events so the Manage tab stays current without
+      // refreshes, and load its first listing in the background so the tab
+      // is ready before it is opened
+      StartDockerEvents(state);
+      RefreshDockerStateAsync(state);
+      // Start indexing the selected logs root ahead of the Logs tab
+      if (!state.log_folder_paths.empty())
+        g_logs_index.Get(state.log_folder_paths[std::max(
+            0, std::min(state.selected_log_folder,
+                        (int)state.log_folder_paths.size() - 1))]);
+      if (startup_trace) {
+        printf("  prompts, Docker, logs  %8.1f ms  (after the first frame)\n",
+               std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - deferred_start)
+                   .count());
+        fflush(stdout);
+      }
+    }
+    g_frame_profiler.EndFrame();
+    TRACE_FRAME();
+    g_metrics.frames++;
+    g_metrics.frame_us +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - frame_start)
+            .count();
   }
 
-  // Save configuration before exit
+  // Save configuration before exit, and write everything still pending
   SaveConfig(state);
+  g_file_saver.Stop();
+  g_metrics_server.Stop();
+  g_dashboard.Stop();
+  g_submissions.Stop();
+  g_resource_sampler.Stop();
 
   // Wait for command thread to finish if still running
   if (state.command_thread.joinable()) {
     state.command_thread.join();
   }
 
-  // Wait for Docker refresh thread to finish if still running
-  if (state.docker_refresh_thread.joinable()) {
-    state.docker_refresh_thread.join();
-  }
+  StopDockerEvents(state);
+  g_logs_index.Stop();
+  g_task_validator.Stop();
+  g_settings_watcher.Stop();
+  g_task_batch.Stop();
+  g_reattach.Stop();
+  g_log_tail.Stop();
+  g_log_search.Stop();
+  g_build_farm.Stop();
+  g_base_puller.Stop();
+  g_teardown.Stop();
+  g_docker_gc.Stop();
+#ifdef _WIN32
+  StopBashPool();
+#endif
+#ifdef AUTOBUILD_HAVE_ZSTD
+  g_log_archiver.Stop();
+#endif
+  g_log_stager.Stop();
+  g_catalog_exporter.Stop();
+  g_log_exporter.Stop();
+  // Phases still streaming are left to the script, as they would be if
+  // the app had been killed
+  g_async.Stop();
+  // Let the running jobs finish (the owners above have cancelled theirs)
+  // and drop the queued ones, before anything they use goes away
+  g_jobs.Stop();
+  state.log_viewer.reset();
+  // Runs still going stay in the journal for the next start
+  g_run_journal.Close();
 
   // Cleanup
-  ImGui_ImplSDLRenderer2_Shutdown();
+  DestroyGuiRenderer(renderer);
   ImGui_ImplSDL2_Shutdown();
   ImGui::DestroyContext();
 
-  SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
   SDL_Quit();
 
@@ -0,0 +1,652 @@
+// Discrete-event simulator of the run scheduler, for capacity planning:
+// replays the finished runs of one or more run catalogs (a logs root's
+// catalog.jsonl) through the dispatcher's own queue order and host
+// placement (PickQueuedTask, PlaceQueuedTask) and the Gemini API governor
+// (ApiGovernor) from autobuild_engine, and reports makespan, slot
+// utilization and queueing delay for every combination of the settings
+// given. It needs no Docker, SDL or display.
+//
+// Usage:
+//   autobuild_sim [--slots <n,...>] [--workers <n,...>] [--worker-slots <n>]
+//                 [--order fair|shortest|longest,...] [--cache-hit <p,...>]
+//                 [--api-rpm <n,...>] [--api-running <n>] [--host-mem <GiB>]
+//                 [--arrivals recorded|batch] [--seed <n>]
+//                 <catalog.jsonl | logs root>...
+//
+//   --slots         this host's concurrency limit (max_concurrent_tasks,
+//                   default 3)
+//   --workers       remote Docker workers (default 0), each with
+//                   --worker-slots slots (default: as this host)
+//   --order         the queue order (queue_order, default fair)
+//   --cache-hit     the chance an image build is a cache hit, from 0 to 1
+//                   ("recorded", the default, keeps the builds that
+//                   happened); a host that built a task's image before
+//                   always has it, which is what placement by image wins
+//   --api-rpm       prompt starts per minute (api_prompts_per_min, default
+//                   0 for no limit) and --api-running prompts at once
+//                   (max_api_tasks, default 8), all runs on one API key
+//   --host-mem      memory of every host; a host only takes a run while
+//                   the recorded memory peaks of its runs fit (default: no
+//                   limit)
+//   --arrivals      "recorded" (the default) queues each run when it was
+//                   started originally; "batch" queues them all at once
+//
+// Options taking a list run the simulation once per combination. A run is
+// replayed as its timed phases in order, with the untimed stretches between
+// them kept: its image build (build_image) goes when it is a cache hit, and
+// each prompt phase (gemini_*) waits for the governor. Queue order by
+// expected time uses a DurationModel fed from the same catalogs, as the GUI
+// does. What is not modelled: the adaptive scheduler's host load figures,
+// rate limits reported by the API, and runs that failed to start.
+
+#include "autobuild_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+// A stretch of a replayed run
+struct Segment {
+  enum Kind : uint8_t { Work, Build, Prompt };
+  Kind kind = Work;
+  double seconds = 0.0;
+};
+
+// A finished run of the catalogs, as the simulator replays it
+struct SimRun {
+  std::string task;
+  std::string mode;
+  std::string task_type; // Feedback / Verify / Audit
+  double arrival = 0.0;  // seconds after the first run of the catalogs
+  std::vector<Segment> segments;
+  double build_seconds = 0.0; // of its task's builds, for a cache miss
+  bool built = false;         // it built its image when it ran
+  double mem_mib = 0.0;
+};
+
+struct SimConfig {
+  int slots = 3;
+  int workers = 0;
+  int worker_slots = 0; // 0: as slots
+  QueueOrder order = QueueOrder::Fair;
+  double cache_hit = -1.0; // -1: as recorded
+  int api_rpm = 0;
+  int api_running = 8;
+  double host_mem_gib = 0.0;
+  bool batch = false;
+  unsigned seed = 1;
+};
+
+struct SimResult {
+  double makespan = 0.0;
+  double utilization = 0.0; // busy slot time over all slot time
+  double wait_mean = 0.0, wait_p50 = 0.0, wait_p95 = 0.0, wait_max = 0.0;
+  double api_wait_mean = 0.0; // per run, waiting for the governor
+  int builds = 0;
+};
+
+// Seconds between two polls of the governor by a waiting prompt; the GUI
+// asks every frame
+const double kApiPollSeconds = 0.5;
+
+const char *QueueOrderName(QueueOrder order) {
+  return order == QueueOrder::ShortestFirst  ? "shortest"
+         : order == QueueOrder::LongestFirst ? "longest"
+                                             : "fair";
+}
+
+std::string TaskTypeOfMode(const std::string &mode) {
+  if (mode == "feedback")
+    return "Feedback";
+  if (mode == "verify")
+    return "Verify";
+  if (mode == "audit")
+    return "Audit";
+  return "";
+}
+
+// Fold a catalog into records by run key; false if it cannot be read
+bool ReadCatalog(const std::string &path,
+                 std::map<std::string, RunRecord> &records) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    JsonValue ev;
+    if (!JsonParser(line).Parse(ev))
+      continue;
+    std::string key = RunCatalogKey(ev.GetString("run"));
+    if (!key.empty())
+      ApplyRunEvent(records[path + "|" + key], ev);
+  }
+  return true;
+}
+
+// The finished runs of records as segments, arrivals relative to the
+// earliest; durations learns the passed runs, as the GUI's does
+std::vector<SimRun> BuildRuns(const std::map<std::string, RunRecord> &records,
+                              DurationModel &durations) {
+  std::vector<SimRun> runs;
+  std::map<std::string, std::pair<double, int>> builds; // task: sum, count
+  long long first = 0;
+  for (const auto &kv : records) {
+    const RunRecord &rec = kv.second;
+    std::string type = TaskTypeOfMode(rec.mode);
+    if (type.empty() || rec.started <= 0 || rec.ended <= rec.started)
+      continue;
+    if (rec.exit_code == 0 && rec.verification != "failed")
+      durations.Record(rec.task, rec.mode, kv.first,
+                       (double)(rec.ended - rec.started), rec.phases);
+    SimRun run;
+    run.task = rec.task;
+    run.mode = rec.mode;
+    run.task_type = type;
+    run.arrival = (double)rec.started;
+    run.mem_mib = rec.mem_peak_mib;
+    std::vector<PhaseTiming> phases = rec.phases;
+    std::sort(phases.begin(), phases.end(),
+              [](const PhaseTiming &a, const PhaseTiming &b) {
+                return a.start_ms < b.start_ms;
+              });
+    long long cursor = rec.started;
+    for (const auto &phase : phases) {
+      if (phase.start_ms > cursor)
+        run.segments.push_back(
+            {Segment::Work, (phase.start_ms - cursor) / 1000.0});
+      long long start = std::max(phase.start_ms, cursor);
+      long long end = std::min(std::max(phase.end_ms, start), rec.ended);
+      Segment segment;
+      segment.seconds = (end - start) / 1000.0;
+      if (phase.name == "build_image") {
+        segment.kind = Segment::Build;
+        run.built = true;
+        auto &b = builds[rec.task];
+        b.first += segment.seconds;
+        b.second++;
+      } else if (phase.name.rfind("gemini_", 0) == 0) {
+        segment.kind = Segment::Prompt;
+      }
+      run.segments.push_back(segment);
+      cursor = std::max(cursor, end);
+    }
+    if (rec.ended > cursor)
+      run.segments.push_back({Segment::Work, (rec.ended - cursor) / 1000.0});
+    if (first == 0 || rec.started < first)
+      first = rec.started;
+    runs.push_back(std::move(run));
+  }
+  // A miss of a run that was a hit takes its task's typical build, else
+  // the typical build of any task
+  double all_sum = 0.0;
+  int all_count = 0;
+  for (const auto &kv : builds) {
+    all_sum += kv.second.first;
+    all_count += kv.second.second;
+  }
+  for (auto &run : runs) {
+    run.arrival = (run.arrival - first) / 1000.0;
+    auto it = builds.find(run.task);
+    if (it != builds.end())
+      run.build_seconds = it->second.first / it->second.second;
+    else if (all_count > 0)
+      run.build_seconds = all_sum / all_count;
+  }
+  std::sort(runs.begin(), runs.end(), [](const SimRun &a, const SimRun &b) {
+    return a.arrival < b.arrival;
+  });
+  return runs;
+}
+
+class Simulation {
+public:
+  Simulation(const std::vector<SimRun> &runs, const DurationModel &durations,
+             const SimConfig &config)
+      : runs_(runs), durations_(durations), config_(config),
+        rng_(config.seed) {
+    hosts_.resize(1 + std::max(0, config.workers));
+    for (size_t i = 0; i < hosts_.size(); i++)
+      hosts_[i].slots = i == 0 || config.worker_slots <= 0
+                            ? config.slots
+                            : config.worker_slots;
+    governor_.Configure(config.api_rpm, config.api_running);
+    state_.resize(runs.size());
+  }
+
+  SimResult Run() {
+    for (size_t i = 0; i < runs_.size(); i++)
+      Schedule(config_.batch ? 0.0 : runs_[i].arrival, Event::Arrive, i);
+    while (!events_.empty()) {
+      double now = events_.top().time;
+      // Everything due at this instant, then one dispatch as the GUI's
+      // frame would
+      while (!events_.empty() && events_.top().time <= now) {
+        Event ev = events_.top();
+        events_.pop();
+        Advance(ev.time);
+        Handle(ev);
+      }
+      Dispatch();
+    }
+    return Report();
+  }
+
+private:
+  struct Event {
+    enum Kind : uint8_t { Arrive, SegmentEnd, ApiPoll };
+    double time;
+    uint64_t seq;
+    Kind kind;
+    size_t run;
+    bool operator>(const Event &o) const {
+      return time != o.time ? time > o.time : seq > o.seq;
+    }
+  };
+  struct Host {
+    int slots = 0;
+    int running = 0;
+    double mem_mib = 0.0;
+    std::set<std::string> images; // tasks whose image it has built
+  };
+  struct RunState {
+    double queued = 0.0, started = 0.0, api_wait = 0.0, api_since = 0.0;
+    size_t segment = 0;
+    int host = -1;
+    bool hit = false;         // its build is a cache hit
+    bool api_waiting = false; // refused by the governor since api_since
+  };
+
+  void Schedule(double time, Event::Kind kind, size_t run) {
+    events_.push({time, next_seq_++, kind, run});
+  }
+
+  // Integrates busy slots up to time
+  void Advance(double time) {
+    int running = 0;
+    for (const Host &host : hosts_)
+      running += host.running;
+    busy_ += running * (time - now_);
+    now_ = time;
+  }
+
+  ApiGovernor::Clock::time_point Clock() const {
+    return ApiGovernor::Clock::time_point() +
+           std::chrono::duration_cast<ApiGovernor::Clock::duration>(
+               std::chrono::duration<double>(now_));
+  }
+
+  void Handle(const Event &ev) {
+    RunState &st = state_[ev.run];
+    switch (ev.kind) {
+    case Event::Arrive: {
+      QueuedTask job;
+      job.seq = ev.run;
+      job.name = runs_[ev.run].task + "/" + runs_[ev.run].mode;
+      job.task_type = runs_[ev.run].task_type;
+      job.group = runs_[ev.run].task;
+      job.priority = TaskTypePriority(job.task_type);
+      queue_.push_back(job);
+      expected_.push_back(
+          durations_.Expected(runs_[ev.run].task, runs_[ev.run].mode));
+      st.queued = now_;
+      break;
+    }
+    case Event::SegmentEnd: {
+      if (runs_[ev.run].segments[st.segment].kind == Segment::Prompt) {
+        prompts_running_--;
+        governor_.Succeeded(kApiKey);
+      }
+      st.segment++;
+      BeginSegment(ev.run);
+      break;
+    }
+    case Event::ApiPoll:
+      BeginSegment(ev.run);
+      break;
+    }
+  }
+
+  // What each host can take of run, hosts[0] being this one
+  std::vector<PlacementHost> Placement(const SimRun &run) const {
+    std::vector<PlacementHost> hosts(hosts_.size());
+    double limit = config_.host_mem_gib * 1024.0;
+    auto last = group_host_.find(run.task);
+    for (size_t i = 0; i < hosts_.size(); i++) {
+      const Host &host = hosts_[i];
+      hosts[i].free = host.slots - host.running;
+      if (limit > 0.0 && host.running > 0 &&
+          host.mem_mib + run.mem_mib > limit)
+        hosts[i].free = 0;
+      hosts[i].holds_image = host.images.count(run.task) != 0;
+      hosts[i].last_of_group =
+          last != group_host_.end() && last->second == (int)i;
+    }
+    return hosts;
+  }
+
+  // DispatchQueuedTasks over the simulated hosts
+  void Dispatch() {
+    while (!queue_.empty()) {
+      size_t pick = PickQueuedTask(
+          queue_, group_last_dispatch_, config_.order,
+          config_.order == QueueOrder::Fair ? std::vector<double>()
+                                            : expected_);
+      size_t run = (size_t)queue_[pick].seq;
+      int at = PlaceQueuedTask(Placement(runs_[run]), true);
+      if (at < 0)
+        return;
+      queue_.erase(queue_.begin() + pick);
+      expected_.erase(expected_.begin() + pick);
+      group_last_dispatch_[runs_[run].task] = ++dispatch_count_;
+      group_host_[runs_[run].task] = at;
+      Start(run, at);
+    }
+  }
+
+  void Start(size_t run, int at) {
+    Host &host = hosts_[at];
+    RunState &st = state_[run];
+    const SimRun &r = runs_[run];
+    host.running++;
+    host.mem_mib += r.mem_mib;
+    st.host = at;
+    st.started = now_;
+    if (host.images.count(r.task))
+      st.hit = true;
+    else if (config_.cache_hit < 0.0)
+      st.hit = !r.built;
+    else
+      st.hit = std::uniform_real_distribution<double>(0.0, 1.0)(rng_) <
+               config_.cache_hit;
+    if (!st.hit) {
+      builds_++;
+      host.images.insert(r.task);
+    }
+    BeginSegment(run);
+  }
+
+  void BeginSegment(size_t run) {
+    RunState &st = state_[run];
+    const SimRun &r = runs_[run];
+    if (st.segment >= r.segments.size()) {
+      Host &host = hosts_[st.host];
+      host.running--;
+      host.mem_mib -= r.mem_mib;
+      end_ = std::max(end_, now_);
+      waits_.push_back(st.started - st.queued);
+      return;
+    }
+    const Segment &segment = r.segments[st.segment];
+    double seconds = segment.seconds;
+    if (segment.kind == Segment::Build) {
+      seconds = st.hit ? 0.0 : seconds;
+    } else if (segment.kind == Segment::Prompt) {
+      if (!governor_.TryStart(kApiKey, prompts_running_, Clock())) {
+        if (!st.api_waiting)
+          st.api_since = now_;
+        st.api_waiting = true;
+        Schedule(now_ + kApiPollSeconds, Event::ApiPoll, run);
+        return;
+      }
+      if (st.api_waiting)
+        st.api_wait += now_ - st.api_since;
+      st.api_waiting = false;
+      prompts_running_++;
+    }
+    // A hit whose run never built pays nothing; a miss whose run built
+    // nothing pays its task's typical build before the rest
+    if (st.segment == 0 && !st.hit && !r.built)
+      seconds += r.build_seconds;
+    Schedule(now_ + seconds, Event::SegmentEnd, run);
+  }
+
+  SimResult Report() const {
+    SimResult result;
+    double first = 0.0;
+    bool any = false;
+    for (size_t i = 0; i < runs_.size(); i++) {
+      if (!any || state_[i].queued < first)
+        first = state_[i].queued;
+      any = true;
+    }
+    result.makespan = end_ - first;
+    int slots = 0;
+    for (const Host &host : hosts_)
+      slots += host.slots;
+    if (result.makespan > 0.0 && slots > 0)
+      result.utilization = busy_ / (slots * result.makespan);
+    std::vector<double> waits = waits_;
+    std::sort(waits.begin(), waits.end());
+    if (!waits.empty()) {
+      double sum = 0.0;
+      for (double w : waits)
+        sum += w;
+      result.wait_mean = sum / waits.size();
+      result.wait_p50 = waits[(waits.size() - 1) / 2];
+      result.wait_p95 = waits[(size_t)((waits.size() - 1) * 0.95)];
+      result.wait_max = waits.back();
+    }
+    double api = 0.0;
+    for (const RunState &st : state_)
+      api += st.api_wait;
+    if (!state_.empty())
+      result.api_wait_mean = api / state_.size();
+    result.builds = builds_;
+    return result;
+  }
+
+  static constexpr uint64_t kApiKey = 1;
+
+  const std::vector<SimRun> &runs_;
+  const DurationModel &durations_;
+  SimConfig config_;
+  std::mt19937 rng_;
+  ApiGovernor governor_;
+  std::vector<Host> hosts_;
+  std::vector<RunState> state_;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+  uint64_t next_seq_ = 0;
+  std::vector<QueuedTask> queue_;
+  std::vector<double> expected_; // per queue index
+  std::map<std::string, uint64_t> group_last_dispatch_;
+  std::map<std::string, int> group_host_;
+  uint64_t dispatch_count_ = 0;
+  int prompts_running_ = 0;
+  int builds_ = 0;
+  double now_ = 0.0, busy_ = 0.0, end_ = 0.0;
+  std::vector<double> waits_;
+};
+
+// "1,2,4" as numbers; false if any is not one
+template <typename T> bool ParseList(const char *text, std::vector<T> &out) {
+  out.clear();
+  std::string s = text;
+  size_t start = 0;
+  while (start <= s.size()) {
+    size_t comma = s.find(',', start);
+    std::string item = s.substr(start, comma - start);
+    char *end = nullptr;
+    double value = strtod(item.c_str(), &end);
+    if (item.empty() || *end != '\0')
+      return false;
+    out.push_back((T)value);
+    if (comma == std::string::npos)
+      break;
+    start = comma + 1;
+  }
+  return !out.empty();
+}
+
+bool ParseOrders(const char *text, std::vector<QueueOrder> &out) {
+  out.clear();
+  std::string s = text;
+  size_t start = 0;
+  for (;;) {
+    size_t comma = s.find(',', start);
+    std::string item = s.substr(start, comma - start);
+    if (item == "fair")
+      out.push_back(QueueOrder::Fair);
+    else if (item == "shortest")
+      out.push_back(QueueOrder::ShortestFirst);
+    else if (item == "longest")
+      out.push_back(QueueOrder::LongestFirst);
+    else
+      return false;
+    if (comma == std::string::npos)
+      return true;
+    start = comma + 1;
+  }
+}
+
+// Cache-hit chances, "recorded" standing for -1
+bool ParseHits(const char *text, std::vector<double> &out) {
+  out.clear();
+  std::string s = text;
+  size_t start = 0;
+  for (;;) {
+    size_t comma = s.find(',', start);
+    std::string item = s.substr(start, comma - start);
+    std::vector<double> value;
+    if (item == "recorded")
+      out.push_back(-1.0);
+    else if (ParseList(item.c_str(), value) && value.size() == 1)
+      out.push_back(value[0]);
+    else
+      return false;
+    if (comma == std::string::npos)
+      return true;
+    start = comma + 1;
+  }
+}
+
+// "42s", "12m 5s", "1h 3m"
+std::string Duration(double seconds) {
+  char buf[32];
+  long long s = (long long)std::llround(seconds);
+  if (s < 60)
+    snprintf(buf, sizeof(buf), "%llds", s);
+  else if (s < 3600)
+    snprintf(buf, sizeof(buf), "%lldm %llds", s / 60, s % 60);
+  else
+    snprintf(buf, sizeof(buf), "%lldh %lldm", s / 3600, s % 3600 / 60);
+  return buf;
+}
+
+void Usage() {
+  fprintf(stderr,
+          "Usage: autobuild_sim [--slots <n,...>] [--workers <n,...>] "
+          "[--worker-slots <n>] [--order fair|shortest|longest,...] "
+          "[--cache-hit <p,...>] [--api-rpm <n,...>] [--api-running <n>] "
+          "[--host-mem <GiB>] [--arrivals recorded|batch] [--seed <n>] "
+          "<catalog.jsonl | logs root>...\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  SimConfig base;
+  std::vector<int> slots = {base.slots}, workers = {base.workers};
+  std::vector<int> rpms = {base.api_rpm};
+  std::vector<double> hits = {base.cache_hit};
+  std::vector<QueueOrder> orders = {base.order};
+  std::vector<std::string> catalogs;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    bool ok = true;
+    if (arg == "--slots" && has_value) {
+      ok = ParseList(argv[++i], slots);
+    } else if (arg == "--workers" && has_value) {
+      ok = ParseList(argv[++i], workers);
+    } else if (arg == "--worker-slots" && has_value) {
+      base.worker_slots = atoi(argv[++i]);
+    } else if (arg == "--order" && has_value) {
+      ok = ParseOrders(argv[++i], orders);
+    } else if (arg == "--cache-hit" && has_value) {
+      ok = ParseHits(argv[++i], hits);
+    } else if (arg == "--api-rpm" && has_value) {
+      ok = ParseList(argv[++i], rpms);
+    } else if (arg == "--api-running" && has_value) {
+      base.api_running = atoi(argv[++i]);
+    } else if (arg == "--host-mem" && has_value) {
+      base.host_mem_gib = atof(argv[++i]);
+    } else if (arg == "--arrivals" && has_value) {
+      std::string mode = argv[++i];
+      ok = mode == "recorded" || mode == "batch";
+      base.batch = mode == "batch";
+    } else if (arg == "--seed" && has_value) {
+      base.seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+    } else if (arg[0] != '-') {
+      catalogs.push_back(IsDirectory(arg) ? arg + "/catalog.jsonl" : arg);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      Usage();
+      return 2;
+    }
+  }
+  if (catalogs.empty()) {
+    Usage();
+    return 2;
+  }
+
+  std::map<std::string, RunRecord> records;
+  for (const auto &path : catalogs) {
+    if (!ReadCatalog(path, records)) {
+      fprintf(stderr, "Cannot read %s\n", path.c_str());
+      return 2;
+    }
+  }
+  DurationModel durations;
+  std::vector<SimRun> runs = BuildRuns(records, durations);
+  if (runs.empty()) {
+    fprintf(stderr, "No finished runs in the catalogs\n");
+    return 1;
+  }
+  int built = 0;
+  for (const auto &run : runs)
+    built += run.built;
+  printf("%zu runs, %d of them built their image; arrivals %s\n\n",
+         runs.size(), built, base.batch ? "all at once" : "as recorded");
+
+  printf("%5s %7s %8s %9s %7s | %10s %5s %9s %9s %9s %8s %6s\n", "slots",
+         "workers", "order", "cache-hit", "api-rpm", "makespan", "util",
+         "wait avg", "wait p95", "wait max", "api wait", "builds");
+  for (int s : slots)
+    for (int w : workers)
+      for (QueueOrder order : orders)
+        for (double hit : hits)
+          for (int rpm : rpms) {
+            SimConfig config = base;
+            config.slots = std::max(1, s);
+            config.workers = std::max(0, w);
+            config.order = order;
+            config.cache_hit = hit < 0.0 ? -1.0 : std::min(1.0, hit);
+            config.api_rpm = std::max(0, rpm);
+            SimResult r = Simulation(runs, durations, config).Run();
+            char hit_text[16];
+            if (config.cache_hit < 0.0)
+              snprintf(hit_text, sizeof(hit_text), "recorded");
+            else
+              snprintf(hit_text, sizeof(hit_text), "%.2f", config.cache_hit);
+            printf("%5d %7d %8s %9s %7d | %10s %4.0f%% %9s %9s %9s %8s %6d\n",
+                   config.slots, config.workers, QueueOrderName(order),
+                   hit_text, config.api_rpm, Duration(r.makespan).c_str(),
+                   r.utilization * 100.0, Duration(r.wait_mean).c_str(),
+                   Duration(r.wait_p95).c_str(), Duration(r.wait_max).c_str(),
+                   Duration(r.api_wait_mean).c_str(), r.builds);
+          }
+  return 0;
+}
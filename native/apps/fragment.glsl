@@ -1,7 +1,15 @@
 #version 330 core
 
-out vec3 color;
+// Wireframe from filled triangles: a fragment is on an edge where one of
+// its barycentric coordinates is within about a pixel of zero, so lines
+// come out anti-aliased without polygon mode or MSAA
+in vec3 vBary;
+out vec4 color;
 
 void main() {
-	color = vec3(1,1,1);
+	vec3 edge = smoothstep(vec3(0.0), fwidth(vBary) * 1.5, vBary);
+	float line = 1.0 - min(min(edge.x, edge.y), edge.z);
+	if (line <= 0.0)
+		discard;
+	color = vec4(1.0, 1.0, 1.0, line);
 }
@@ -0,0 +1,139 @@
+// The glm/test/perf kernels (matrix multiply, divide, transpose, inverse,
+// matrix * vector and vector * matrix) as a Google Benchmark suite, so they
+// get repetitions, median/stddev aggregates and JSON output. CMake builds it
+// twice: autobuild_glm_bench with GLM_FORCE_PURE (scalar) and
+// autobuild_glm_bench_simd with AUTOBUILD_GLM_SIMD_DEFINITIONS. The
+// benchmark names are the same in both, so either JSON report can be
+// compared against a baseline of the same configuration with
+// bench_compare.py, or the two against each other.
+
+#include <glm/glm.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <vector>
+
+// Inputs per iteration; about 1 MiB of dmat4, so the working set is cached
+// and the kernels, not memory, are timed
+static const size_t kSamples = 4096;
+
+template <typename Mat> static std::vector<Mat> Inputs() {
+  typedef typename Mat::value_type T;
+  std::vector<Mat> in(kSamples);
+  for (size_t i = 0; i < kSamples; ++i) {
+    // Diagonally dominant, so every input is invertible and divisible
+    Mat m(static_cast<T>(4) + static_cast<T>(i % 17));
+    for (int c = 0; c < Mat::length(); ++c)
+      for (int r = 0; r < Mat::col_type::length(); ++r)
+        if (c != r)
+          m[c][r] = static_cast<T>(0.01) * static_cast<T>((i + c * 3 + r) % 11);
+    in[i] = m;
+  }
+  return in;
+}
+
+template <typename Mat> static Mat Transform() {
+  typedef typename Mat::value_type T;
+  Mat m(static_cast<T>(2));
+  m[0][Mat::col_type::length() - 1] = static_cast<T>(0.5);
+  return m;
+}
+
+template <typename Mat> static void BM_MatMul(benchmark::State &state) {
+  std::vector<Mat> in = Inputs<Mat>(), out(kSamples);
+  const Mat m = Transform<Mat>();
+  for (auto _ : state) {
+    for (size_t i = 0; i < kSamples; ++i)
+      out[i] = m * in[i];
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)kSamples);
+}
+BENCHMARK_TEMPLATE(BM_MatMul, glm::mat2);
+BENCHMARK_TEMPLATE(BM_MatMul, glm::mat3);
+BENCHMARK_TEMPLATE(BM_MatMul, glm::mat4);
+BENCHMARK_TEMPLATE(BM_MatMul, glm::dmat4);
+
+template <typename Mat> static void BM_MatDiv(benchmark::State &state) {
+  std::vector<Mat> in = Inputs<Mat>(), out(kSamples);
+  const Mat m = Transform<Mat>();
+  for (auto _ : state) {
+    for (size_t i = 0; i < kSamples; ++i)
+      out[i] = m / in[i];
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)kSamples);
+}
+BENCHMARK_TEMPLATE(BM_MatDiv, glm::mat2);
+BENCHMARK_TEMPLATE(BM_MatDiv, glm::mat3);
+BENCHMARK_TEMPLATE(BM_MatDiv, glm::mat4);
+BENCHMARK_TEMPLATE(BM_MatDiv, glm::dmat4);
+
+template <typename Mat> static void BM_MatTranspose(benchmark::State &state) {
+  std::vector<Mat> in = Inputs<Mat>(), out(kSamples);
+  for (auto _ : state) {
+    for (size_t i = 0; i < kSamples; ++i)
+      out[i] = glm::transpose(in[i]);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)kSamples);
+}
+BENCHMARK_TEMPLATE(BM_MatTranspose, glm::mat2);
+BENCHMARK_TEMPLATE(BM_MatTranspose, glm::mat3);
+BENCHMARK_TEMPLATE(BM_MatTranspose, glm::mat4);
+BENCHMARK_TEMPLATE(BM_MatTranspose, glm::dmat4);
+
+template <typename Mat> static void BM_MatInverse(benchmark::State &state) {
+  std::vector<Mat> in = Inputs<Mat>(), out(kSamples);
+  for (auto _ : state) {
+    for (size_t i = 0; i < kSamples; ++i)
+      out[i] = glm::inverse(in[i]);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)kSamples);
+}
+BENCHMARK_TEMPLATE(BM_MatInverse, glm::mat2);
+BENCHMARK_TEMPLATE(BM_MatInverse, glm::mat3);
+BENCHMARK_TEMPLATE(BM_MatInverse, glm::mat4);
+BENCHMARK_TEMPLATE(BM_MatInverse, glm::dmat4);
+
+template <typename Mat> static void BM_MatMulVec(benchmark::State &state) {
+  typedef typename Mat::col_type Vec;
+  typedef typename Mat::value_type T;
+  std::vector<Vec> in(kSamples), out(kSamples);
+  for (size_t i = 0; i < kSamples; ++i)
+    in[i] = Vec(static_cast<T>(i % 97) * static_cast<T>(0.1));
+  const Mat m = Transform<Mat>();
+  for (auto _ : state) {
+    for (size_t i = 0; i < kSamples; ++i)
+      out[i] = m * in[i];
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)kSamples);
+}
+BENCHMARK_TEMPLATE(BM_MatMulVec, glm::mat2);
+BENCHMARK_TEMPLATE(BM_MatMulVec, glm::mat3);
+BENCHMARK_TEMPLATE(BM_MatMulVec, glm::mat4);
+BENCHMARK_TEMPLATE(BM_MatMulVec, glm::dmat4);
+
+template <typename Mat> static void BM_VecMulMat(benchmark::State &state) {
+  typedef typename Mat::row_type Vec;
+  typedef typename Mat::value_type T;
+  std::vector<Vec> in(kSamples), out(kSamples);
+  for (size_t i = 0; i < kSamples; ++i)
+    in[i] = Vec(static_cast<T>(i % 97) * static_cast<T>(0.1));
+  const Mat m = Transform<Mat>();
+  for (auto _ : state) {
+    for (size_t i = 0; i < kSamples; ++i)
+      out[i] = in[i] * m;
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * (int64_t)kSamples);
+}
+BENCHMARK_TEMPLATE(BM_VecMulMat, glm::mat2);
+BENCHMARK_TEMPLATE(BM_VecMulMat, glm::mat3);
+BENCHMARK_TEMPLATE(BM_VecMulMat, glm::mat4);
+BENCHMARK_TEMPLATE(BM_VecMulMat, glm::dmat4);
+
+BENCHMARK_MAIN();
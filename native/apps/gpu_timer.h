@@ -0,0 +1,132 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+// GPU time per render pass from GL_TIME_ELAPSED queries, shared by the
+// splash and the OpenGL backend of autobuild_main. Needs a current 3.3
+// context loaded with glad.
+//
+// Every pass has a ring of kDepth queries. A frame's query is only read
+// once GL_QUERY_RESULT_AVAILABLE says it is done, kDepth - 1 frames later
+// at the earliest, so reading back never waits for the GPU. A pass whose
+// next query is still in flight (the GPU is more than kDepth frames
+// behind) goes untimed for that frame instead.
+
+#include <glad/glad.h>
+
+class GpuPassTimers {
+public:
+    static constexpr int kMaxPasses = 4;
+    static constexpr int kDepth = 3;
+
+    // Registers a pass before Init and returns its id for Begin/End, or -1
+    // when all kMaxPasses are taken
+    int AddPass(const char* name) {
+        if (pass_count_ >= kMaxPasses || ready_)
+            return -1;
+        passes_[pass_count_].name = name;
+        return pass_count_++;
+    }
+
+    void Init() {
+        for (int p = 0; p < pass_count_; p++)
+            glGenQueries(kDepth, passes_[p].queries);
+        ready_ = true;
+    }
+
+    void Destroy() {
+        if (!ready_)
+            return;
+        for (int p = 0; p < pass_count_; p++) {
+            glDeleteQueries(kDepth, passes_[p].queries);
+            for (bool& pending : passes_[p].pending)
+                pending = false;
+        }
+        active_ = -1;
+        ready_ = false;
+    }
+
+    // Collects whatever finished since the last frame and moves on to the
+    // next ring slot; call once per frame before any Begin
+    void BeginFrame() {
+        if (!ready_)
+            return;
+        for (int p = 0; p < pass_count_; p++) {
+            Pass& pass = passes_[p];
+            // Oldest first, so the latest result is the newest one read
+            for (int i = 1; i <= kDepth; i++) {
+                int slot = (frame_ + i) % kDepth;
+                if (!pass.pending[slot])
+                    continue;
+                GLint available = 0;
+                glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    continue;
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &ns);
+                pass.pending[slot] = false;
+                pass.last_ms = ns / 1e6;
+                pass.total_ms += pass.last_ms;
+                pass.max_ms = pass.max_ms > pass.last_ms ? pass.max_ms : pass.last_ms;
+                pass.samples++;
+            }
+        }
+        frame_ = (frame_ + 1) % kDepth;
+    }
+
+    // Only one pass can be timed at a time: GL_TIME_ELAPSED queries do not
+    // nest
+    void Begin(int pass) {
+        if (!ready_ || pass < 0 || passes_[pass].pending[frame_])
+            return;
+        glBeginQuery(GL_TIME_ELAPSED, passes_[pass].queries[frame_]);
+        active_ = pass;
+    }
+
+    void End(int pass) {
+        if (active_ != pass || pass < 0)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        passes_[pass].pending[frame_] = true;
+        active_ = -1;
+    }
+
+    bool Ready() const { return ready_; }
+    int PassCount() const { return pass_count_; }
+    const char* Name(int pass) const { return passes_[pass].name; }
+    // Newest result in milliseconds, or -1 before the first one arrives
+    double LastMs(int pass) const { return passes_[pass].last_ms; }
+
+    // Mean and worst result since the last ResetStats, and how many there
+    // were
+    double MeanMs(int pass) const {
+        const Pass& p = passes_[pass];
+        return p.samples ? p.total_ms / p.samples : 0.0;
+    }
+    double MaxMs(int pass) const { return passes_[pass].max_ms; }
+    int Samples(int pass) const { return passes_[pass].samples; }
+    void ResetStats() {
+        for (int p = 0; p < pass_count_; p++) {
+            passes_[p].total_ms = 0.0;
+            passes_[p].max_ms = 0.0;
+            passes_[p].samples = 0;
+        }
+    }
+
+private:
+    struct Pass {
+        const char* name = "";
+        GLuint queries[kDepth] = {};
+        bool pending[kDepth] = {};
+        double last_ms = -1.0;
+        double total_ms = 0.0;
+        double max_ms = 0.0;
+        int samples = 0;
+    };
+    Pass passes_[kMaxPasses];
+    int pass_count_ = 0;
+    int frame_ = 0;
+    int active_ = -1;
+    bool ready_ = false;
+};
+
+#endif // GPU_TIMER_H
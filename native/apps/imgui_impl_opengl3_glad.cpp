@@ -0,0 +1,9 @@
+// Builds ImGui's OpenGL 3 backend against glad, the loader already in the
+// tree for the splash, instead of the backend's bundled gl3w loader. Only
+// compiled with AUTOBUILD_GUI_OPENGL; glad is loaded by CreateGuiRenderer
+// in autobuild_gui.cpp before the backend is initialized.
+
+#include <glad/glad.h>
+
+#define IMGUI_IMPL_OPENGL_LOADER_CUSTOM
+#include "imgui_impl_opengl3.cpp"
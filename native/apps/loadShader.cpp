@@ -1,47 +1,201 @@
 #include "loadShader.h"
 #include <SDL.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string>
 #include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+// Program binaries are cached per driver (glGetProgramBinary), so GLSL is
+// only compiled on the first launch after a shader or driver change. A
+// binary the driver rejects falls back to compiling from source.
+static const uint32_t kProgramCacheMagic = 0x48534241; // "ABSH"
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+static uint64_t HashBytes(uint64_t h, const void* data, size_t n){
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < n; i++) {
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
+static uint64_t HashString(uint64_t h, const char* s){
+	if (!s)
+		s = "";
+	// Include the terminator so "ab"+"c" and "a"+"bc" differ
+	return HashBytes(h, s, strlen(s) + 1);
+}
+
+static void MakeDirectory(const std::string& path){
+	for (size_t i = 1; i <= path.size(); i++) {
+		if (i < path.size() && path[i] != '/' && path[i] != '\\')
+			continue;
+		std::string part = path.substr(0, i);
+#ifdef _WIN32
+		_mkdir(part.c_str());
+#else
+		mkdir(part.c_str(), 0755);
+#endif
+	}
+}
+
+// Same cache root as the main app's font atlas cache
+std::string AutobuildCacheDir(){
+#ifdef _WIN32
+	const char* appdata = getenv("LOCALAPPDATA");
+	if (!appdata || !*appdata)
+		return "";
+	std::string dir = std::string(appdata) + "\\Autobuild";
+#else
+	const char* cache = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	std::string dir;
+	if (cache && *cache)
+		dir = cache;
+	else if (home && *home)
+		dir = std::string(home) + "/.cache";
+	else
+		return "";
+	dir += "/autobuild";
+#endif
+	MakeDirectory(dir);
+	return dir;
+}
+
+static std::string ProgramCacheDir(){
+	std::string dir = AutobuildCacheDir();
+	if (dir.empty())
+		return "";
+#ifdef _WIN32
+	dir += "\\shaders";
+#else
+	dir += "/shaders";
+#endif
+	MakeDirectory(dir);
+	return dir;
+}
+
+static bool ProgramBinarySupported(){
+	if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+static uint64_t ProgramCacheKey(const char* vertex_source, const char* fragment_source){
+	uint64_t h = 14695981039346656037ull;
+	h = HashBytes(h, &kProgramCacheMagic, sizeof(kProgramCacheMagic));
+	h = HashString(h, vertex_source);
+	h = HashString(h, fragment_source);
+	h = HashString(h, (const char*)glGetString(GL_VENDOR));
+	h = HashString(h, (const char*)glGetString(GL_RENDERER));
+	h = HashString(h, (const char*)glGetString(GL_VERSION));
+	return h;
+}
+
+static std::string ProgramCachePath(uint64_t key){
+	std::string dir = ProgramCacheDir();
+	if (dir.empty())
+		return "";
+	char name[40];
+	snprintf(name, sizeof(name), "program_%016llx.bin", (unsigned long long)key);
+#ifdef _WIN32
+	return dir + "\\" + name;
+#else
+	return dir + "/" + name;
+#endif
+}
+
+// File layout: magic, key, binary format, length, then the driver's bytes
+struct ProgramCacheHeader {
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint64_t length;
+};
+
+static GLuint LoadCachedProgram(const std::string& path, uint64_t key){
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
 		return 0;
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == kProgramCacheMagic && header.key == key &&
+		header.length > 0 && header.length < (64u << 20);
+	if (ok) {
+		binary.resize((size_t)header.length);
+		ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
 	}
+	fclose(file);
+	if (!ok)
+		return 0;
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, (GLenum)header.format, binary.data(), (GLsizei)binary.size());
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE) {
+		// Usually a driver update that kept the version string
+		glDeleteProgram(ProgramID);
+		return 0;
 	}
+	return ProgramID;
+}
+
+static void SaveCachedProgram(const std::string& path, uint64_t key, GLuint ProgramID){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(ProgramID, length, &written, &format, binary.data());
+	if (written <= 0)
+		return;
+
+	ProgramCacheHeader header = {kProgramCacheMagic, (uint32_t)format, key, (uint64_t)written};
+	// Write beside the target and rename, so a crash never leaves a torn file
+	std::string tmp = path + ".tmp";
+	FILE* file = fopen(tmp.c_str(), "wb");
+	if (!file)
+		return;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(binary.data(), 1, written, file) == (size_t)written;
+	ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+	if (ok)
+		remove(path.c_str());
+#endif
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+		remove(tmp.c_str());
+}
+
+static GLuint CompileProgram(const char* vertex_source, const char* fragment_source,
+	const char* vertex_name, const char* fragment_name, bool retrievable){
+
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
 	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
+	printf("Compiling shader : %s\n", vertex_name);
+	glShaderSource(VertexShaderID, 1, &vertex_source , NULL);
 	glCompileShader(VertexShaderID);
 
 	// Check Vertex Shader
@@ -54,9 +208,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	}
 
 	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+	printf("Compiling shader : %s\n", fragment_name);
+	glShaderSource(FragmentShaderID, 1, &fragment_source , NULL);
 	glCompileShader(FragmentShaderID);
 
 	// Check Fragment Shader
@@ -73,6 +226,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (retrievable)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -92,3 +247,59 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
 	return ProgramID;
 }
+
+GLuint LinkProgramCached(const char* vertex_source, const char* fragment_source,
+	const char* vertex_name, const char* fragment_name){
+	bool cacheable = ProgramBinarySupported();
+	uint64_t key = 0;
+	std::string path;
+	if (cacheable) {
+		key = ProgramCacheKey(vertex_source, fragment_source);
+		path = ProgramCachePath(key);
+		if (!path.empty()) {
+			GLuint ProgramID = LoadCachedProgram(path, key);
+			if (ProgramID) {
+				printf("Loaded cached program for %s and %s\n", vertex_name, fragment_name);
+				return ProgramID;
+			}
+		}
+	}
+
+	GLuint ProgramID = CompileProgram(vertex_source, fragment_source,
+		vertex_name, fragment_name, cacheable && !path.empty());
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result == GL_TRUE && !path.empty())
+		SaveCachedProgram(path, key, ProgramID);
+	return ProgramID;
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+
+	// Read the Vertex Shader code from the file
+	std::string VertexShaderCode;
+	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
+	if(VertexShaderStream.is_open()){
+		std::stringstream sstr;
+		sstr << VertexShaderStream.rdbuf();
+		VertexShaderCode = sstr.str();
+		VertexShaderStream.close();
+	}else{
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
+		getchar();
+		return 0;
+	}
+
+	// Read the Fragment Shader code from the file
+	std::string FragmentShaderCode;
+	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
+	if(FragmentShaderStream.is_open()){
+		std::stringstream sstr;
+		sstr << FragmentShaderStream.rdbuf();
+		FragmentShaderCode = sstr.str();
+		FragmentShaderStream.close();
+	}
+
+	return LinkProgramCached(VertexShaderCode.c_str(), FragmentShaderCode.c_str(),
+		vertex_file_path, fragment_file_path);
+}
@@ -2,7 +2,18 @@
 #define LOAD_SHADER_H
 
 #include <glad/glad.h>
+#include <string>
 
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path);
 
+// Link a program from GLSL sources, reusing the driver binary cached by an
+// earlier run when the sources and the GL vendor/renderer/version match.
+// The names are only used in log output.
+GLuint LinkProgramCached(const char * vertex_source, const char * fragment_source,
+	const char * vertex_name, const char * fragment_name);
+
+// Per-user cache directory of autobuild (created when missing), or "" when
+// there is none. Holds the program binaries and the splash's render mode.
+std::string AutobuildCacheDir();
+
 #endif // LOAD_SHADER_H
@@ -1,7 +1,5 @@
-#include <vector>
-#include <cmath>
 #include <random>
-#include <algorithm>
+#include <cstddef>
 #include "mesh.h"
 #include <SDL.h>
 #include <iostream>
@@ -18,91 +16,49 @@ constexpr double PI = 3.14159265358979323846;
 static std::random_device rd;
 static std::mt19937 gen(rd());
 
-Mesh::Mesh() : currentShape(ShapeType::CUBE) {
-    glGenVertexArrays(1, &VertexArrayID);
-    glBindVertexArray(VertexArrayID);
-    createCube();
-}
-
-Mesh::Mesh(ShapeType shape) : currentShape(shape) {
-    glGenVertexArrays(1, &VertexArrayID);
-    glBindVertexArray(VertexArrayID);
-    setShape(shape);
-}
-
-Mesh::~Mesh() {
-    cleanup();
-}
-
-void Mesh::cleanup() {
-    if (vertexbuffer) {
-        glDeleteBuffers(1, &vertexbuffer);
-        vertexbuffer = 0;
-    }
-    if (elementbuffer) {
-        glDeleteBuffers(1, &elementbuffer);
-        elementbuffer = 0;
-    }
-    if (VertexArrayID) {
-        glDeleteVertexArrays(1, &VertexArrayID);
-        VertexArrayID = 0;
-    }
+// All shape geometry is computed at compile time and uploaded straight from
+// these read-only tables: no trig, no heap allocation at runtime. The
+// standard library's math functions are not constexpr in C++17, so the few
+// needed are evaluated here (Taylor series and Newton iteration, accurate
+// well past float precision).
+namespace {
+
+constexpr double ConstSqrt(double x) {
+    if (x <= 0.0)
+        return 0.0;
+    double r = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64; i++)
+        r = 0.5 * (r + x / r);
+    return r;
 }
 
-void Mesh::setShape(ShapeType shape) {
-    currentShape = shape;
-    cleanup();
-    
-    glGenVertexArrays(1, &VertexArrayID);
-    glBindVertexArray(VertexArrayID);
-    
-    switch (shape) {
-        case ShapeType::CUBE:
-            createCube();
-            break;
-        case ShapeType::TETRAHEDRON:
-            createTetrahedron();
-            break;
-        case ShapeType::OCTAHEDRON:
-            createOctahedron();
-            break;
-        case ShapeType::ICOSAHEDRON:
-            createIcosahedron();
-            break;
-        case ShapeType::TORUS:
-            createTorus();
-            break;
-        case ShapeType::SPHERE:
-            createSphere();
-            break;
-        case ShapeType::PYRAMID:
-            createPyramid();
-            break;
-        case ShapeType::DIAMOND:
-            createDiamond();
-            break;
+constexpr double ConstSin(double x) {
+    while (x > PI)
+        x -= 2.0 * PI;
+    while (x < -PI)
+        x += 2.0 * PI;
+    double term = x, sum = x;
+    for (int n = 1; n < 14; n++) {
+        term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+        sum += term;
     }
+    return sum;
 }
 
-ShapeType Mesh::getRandomShape() {
-    static std::uniform_int_distribution<> dis(0, 7);
-    return static_cast<ShapeType>(dis(gen));
+constexpr double ConstCos(double x) {
+    return ConstSin(x + PI / 2.0);
 }
 
-void Mesh::setupBuffers(const std::vector<GLfloat>& vertices, const std::vector<GLuint>& indices) {
-    glGenBuffers(1, &vertexbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
-
-    glGenBuffers(1, &elementbuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
-
-    vertex_size = indices.size();
-}
+template <size_t Vertices, size_t Indices>
+struct MeshTable {
+    static constexpr size_t kVertexCount = Vertices;
+    static constexpr size_t kIndexCount = Indices;
+    GLfloat vertices[Vertices * 3] = {};
+    GLuint indices[Indices] = {};
+};
 
-void Mesh::createCube() {
-    std::vector<GLfloat> vertices = {
+constexpr MeshTable<8, 36> kCube = {
+    {
         // Front face
         0.5f, -0.5f, 0.5f,
         -0.5f, -0.5f, 0.5f,
@@ -113,49 +69,42 @@ void Mesh::createCube() {
         -0.5f, -0.5f, -0.5f,
         0.5f, 0.5f, -0.5f,
         -0.5f, 0.5f, -0.5f
-    };
-
-    std::vector<GLuint> indices = {
+    },
+    {
         0, 2, 3, 0, 3, 1,  // Front
         2, 6, 7, 2, 7, 3,  // Top
         6, 4, 5, 6, 5, 7,  // Back
         4, 0, 1, 4, 1, 5,  // Bottom
         1, 3, 7, 1, 7, 5,  // Left
         4, 6, 2, 4, 2, 0   // Right
-    };
-
-    setupBuffers(vertices, indices);
-}
+    }
+};
 
-void Mesh::createTetrahedron() {
-    std::vector<GLfloat> vertices = {
+constexpr MeshTable<4, 12> kTetrahedron = {
+    {
         0.0f, 0.5f, 0.0f,      // Top
         0.5f, -0.5f, 0.5f,     // Front right
         -0.5f, -0.5f, 0.5f,    // Front left
         0.0f, -0.5f, -0.5f     // Back
-    };
-
-    std::vector<GLuint> indices = {
+    },
+    {
         0, 1, 2,  // Front face
         0, 2, 3,  // Left face
         0, 3, 1,  // Right face
         1, 3, 2   // Bottom face
-    };
-
-    setupBuffers(vertices, indices);
-}
+    }
+};
 
-void Mesh::createOctahedron() {
-    std::vector<GLfloat> vertices = {
+constexpr MeshTable<6, 24> kOctahedron = {
+    {
         0.0f, 0.5f, 0.0f,      // Top
         0.5f, 0.0f, 0.0f,      // Right
         0.0f, 0.0f, 0.5f,      // Front
         -0.5f, 0.0f, 0.0f,     // Left
         0.0f, 0.0f, -0.5f,     // Back
         0.0f, -0.5f, 0.0f      // Bottom
-    };
-
-    std::vector<GLuint> indices = {
+    },
+    {
         0, 1, 2,  // Top front right
         0, 2, 3,  // Top front left
         0, 3, 4,  // Top back left
@@ -164,140 +113,118 @@ void Mesh::createOctahedron() {
         5, 3, 2,  // Bottom front left
         5, 4, 3,  // Bottom back left
         5, 1, 4   // Bottom back right
-    };
-
-    setupBuffers(vertices, indices);
-}
-
-void Mesh::createIcosahedron() {
-    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f; // Golden ratio
-    
-    std::vector<GLfloat> vertices = {
-        -1.0f,  t, 0.0f,   1.0f,  t, 0.0f,   -1.0f, -t, 0.0f,   1.0f, -t, 0.0f,
-         0.0f, -1.0f,  t,   0.0f,  1.0f,  t,    0.0f, -1.0f, -t,   0.0f,  1.0f, -t,
-          t, 0.0f, -1.0f,    t, 0.0f,  1.0f,   -t, 0.0f, -1.0f,   -t, 0.0f,  1.0f
-    };
-
-    // Normalize vertices
-    for (size_t i = 0; i < vertices.size(); i += 3) {
-        float length = std::sqrt(vertices[i]*vertices[i] + vertices[i+1]*vertices[i+1] + vertices[i+2]*vertices[i+2]);
-        vertices[i] /= length;
-        vertices[i+1] /= length;
-        vertices[i+2] /= length;
     }
-
-    std::vector<GLuint> indices = {
+};
+
+// Vertices of (+-1, +-t, 0) and its cyclic permutations, t the golden
+// ratio, normalized onto the unit sphere
+constexpr MeshTable<12, 60> MakeIcosahedron() {
+    const double t = (1.0 + ConstSqrt(5.0)) / 2.0;
+    const double corners[36] = {
+        -1.0,  t, 0.0,   1.0,  t, 0.0,   -1.0, -t, 0.0,   1.0, -t, 0.0,
+         0.0, -1.0,  t,   0.0,  1.0,  t,    0.0, -1.0, -t,   0.0,  1.0, -t,
+          t, 0.0, -1.0,    t, 0.0,  1.0,   -t, 0.0, -1.0,   -t, 0.0,  1.0
+    };
+    const GLuint faces[60] = {
         0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
         1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
         3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
         4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1
     };
-
-    setupBuffers(vertices, indices);
+    MeshTable<12, 60> mesh;
+    const double length = ConstSqrt(1.0 + t * t);
+    for (size_t i = 0; i < 36; i++)
+        mesh.vertices[i] = (GLfloat)(corners[i] / length);
+    for (size_t i = 0; i < 60; i++)
+        mesh.indices[i] = faces[i];
+    return mesh;
 }
 
-void Mesh::createTorus(int segments, int rings, float outerRadius, float innerRadius) {
-    std::vector<GLfloat> vertices;
-    std::vector<GLuint> indices;
-
-    for (int i = 0; i <= rings; i++) {
-        float v = (float)i / rings * 2.0f * PI;
-        float cosV = cos(v);
-        float sinV = sin(v);
-
-        for (int j = 0; j <= segments; j++) {
-            float u = (float)j / segments * 2.0f * PI;
-            float cosU = cos(u);
-            float sinU = sin(u);
-
-            float x = (outerRadius + innerRadius * cosU) * cosV;
-            float y = (outerRadius + innerRadius * cosU) * sinV;
-            float z = innerRadius * sinU;
-
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-        }
-    }
-
+// Index a (Segments + 1) x (Rings + 1) vertex grid as two triangles per cell
+template <size_t Vertices, size_t Indices>
+constexpr void GridIndices(MeshTable<Vertices, Indices>& mesh, int segments, int rings) {
+    size_t k = 0;
     for (int i = 0; i < rings; i++) {
         for (int j = 0; j < segments; j++) {
-            int first = i * (segments + 1) + j;
-            int second = first + segments + 1;
+            GLuint first = i * (segments + 1) + j;
+            GLuint second = first + segments + 1;
 
-            indices.push_back(first);
-            indices.push_back(second);
-            indices.push_back(first + 1);
+            mesh.indices[k++] = first;
+            mesh.indices[k++] = second;
+            mesh.indices[k++] = first + 1;
 
-            indices.push_back(second);
-            indices.push_back(second + 1);
-            indices.push_back(first + 1);
+            mesh.indices[k++] = second;
+            mesh.indices[k++] = second + 1;
+            mesh.indices[k++] = first + 1;
         }
     }
-
-    setupBuffers(vertices, indices);
 }
 
-void Mesh::createSphere(int segments, int rings) {
-    std::vector<GLfloat> vertices;
-    std::vector<GLuint> indices;
-
-    for (int i = 0; i <= rings; i++) {
-        float v = (float)i / rings * PI;
-        float cosV = cos(v);
-        float sinV = sin(v);
-
-        for (int j = 0; j <= segments; j++) {
-            float u = (float)j / segments * 2.0f * PI;
-            float cosU = cos(u);
-            float sinU = sin(u);
-
-            vertices.push_back(cosU * sinV);
-            vertices.push_back(cosV);
-            vertices.push_back(sinU * sinV);
+template <int Segments, int Rings>
+constexpr MeshTable<(Segments + 1) * (Rings + 1), Segments * Rings * 6>
+MakeTorus(double outerRadius, double innerRadius) {
+    MeshTable<(Segments + 1) * (Rings + 1), Segments * Rings * 6> mesh;
+    size_t k = 0;
+    for (int i = 0; i <= Rings; i++) {
+        double v = (double)i / Rings * 2.0 * PI;
+        double cosV = ConstCos(v);
+        double sinV = ConstSin(v);
+
+        for (int j = 0; j <= Segments; j++) {
+            double u = (double)j / Segments * 2.0 * PI;
+            double cosU = ConstCos(u);
+            double sinU = ConstSin(u);
+
+            mesh.vertices[k++] = (GLfloat)((outerRadius + innerRadius * cosU) * cosV);
+            mesh.vertices[k++] = (GLfloat)((outerRadius + innerRadius * cosU) * sinV);
+            mesh.vertices[k++] = (GLfloat)(innerRadius * sinU);
         }
     }
+    GridIndices(mesh, Segments, Rings);
+    return mesh;
+}
 
-    for (int i = 0; i < rings; i++) {
-        for (int j = 0; j < segments; j++) {
-            int first = i * (segments + 1) + j;
-            int second = first + segments + 1;
-
-            indices.push_back(first);
-            indices.push_back(second);
-            indices.push_back(first + 1);
-
-            indices.push_back(second);
-            indices.push_back(second + 1);
-            indices.push_back(first + 1);
+template <int Segments, int Rings>
+constexpr MeshTable<(Segments + 1) * (Rings + 1), Segments * Rings * 6>
+MakeSphere() {
+    MeshTable<(Segments + 1) * (Rings + 1), Segments * Rings * 6> mesh;
+    size_t k = 0;
+    for (int i = 0; i <= Rings; i++) {
+        double v = (double)i / Rings * PI;
+        double cosV = ConstCos(v);
+        double sinV = ConstSin(v);
+
+        for (int j = 0; j <= Segments; j++) {
+            double u = (double)j / Segments * 2.0 * PI;
+
+            mesh.vertices[k++] = (GLfloat)(ConstCos(u) * sinV);
+            mesh.vertices[k++] = (GLfloat)cosV;
+            mesh.vertices[k++] = (GLfloat)(ConstSin(u) * sinV);
         }
     }
-
-    setupBuffers(vertices, indices);
+    GridIndices(mesh, Segments, Rings);
+    return mesh;
 }
 
-void Mesh::createPyramid() {
-    std::vector<GLfloat> vertices = {
+constexpr MeshTable<5, 18> kPyramid = {
+    {
         0.0f, 0.5f, 0.0f,      // Top
         0.5f, -0.5f, 0.5f,     // Front right
         -0.5f, -0.5f, 0.5f,    // Front left
         0.5f, -0.5f, -0.5f,    // Back right
         -0.5f, -0.5f, -0.5f    // Back left
-    };
-
-    std::vector<GLuint> indices = {
+    },
+    {
         0, 1, 2,  // Front face
         0, 2, 4,  // Left face
         0, 4, 3,  // Back face
         0, 3, 1,  // Right face
         1, 3, 4, 1, 4, 2  // Bottom face (two triangles)
-    };
-
-    setupBuffers(vertices, indices);
-}
+    }
+};
 
-void Mesh::createDiamond() {
-    std::vector<GLfloat> vertices = {
+constexpr MeshTable<10, 60> kDiamond = {
+    {
         0.0f, 0.5f, 0.0f,      // Top point
         0.3f, 0.2f, 0.0f,      // Upper right
         0.0f, 0.2f, 0.3f,      // Upper front
@@ -308,30 +235,164 @@ void Mesh::createDiamond() {
         -0.3f, -0.2f, 0.0f,    // Lower left
         0.0f, -0.2f, -0.3f,    // Lower back
         0.0f, -0.5f, 0.0f      // Bottom point
-    };
-
-    std::vector<GLuint> indices = {
+    },
+    {
         // Top pyramid
         0, 1, 2,  0, 2, 3,  0, 3, 4,  0, 4, 1,
         // Middle band
         1, 5, 6,  1, 6, 2,  2, 6, 7,  2, 7, 3,  3, 7, 8,  3, 8, 4,  4, 8, 5,  4, 5, 1,
         // Bottom pyramid
         9, 6, 5,  9, 7, 6,  9, 8, 7,  9, 5, 8
-    };
+    }
+};
+
+// Every shape concatenated in ShapeType order and expanded to one vertex
+// per triangle corner, each carrying x, y, z and its barycentric
+// coordinates, (1, 0, 0) to (0, 0, 1) around the triangle. The wireframe
+// shader draws the edges where one of them nears zero, so the corners of
+// neighbouring triangles cannot be shared. Also each shape's vertex range.
+template <size_t Vertices>
+struct PackedShapes {
+    static constexpr int kFloatsPerVertex = 6;
+    GLfloat vertices[Vertices * kFloatsPerVertex] = {};
+    GLint first[Mesh::kShapeCount] = {};
+    GLsizei count[Mesh::kShapeCount] = {};
+};
+
+template <size_t Packed, size_t V, size_t I>
+constexpr void AppendShape(PackedShapes<Packed>& packed, const MeshTable<V, I>& shape, int slot,
+                           size_t& vertexCount) {
+    static_assert(I % 3 == 0, "triangles only");
+    packed.first[slot] = (GLint)vertexCount;
+    packed.count[slot] = (GLsizei)I;
+    for (size_t i = 0; i < I; i++) {
+        GLfloat* out = packed.vertices + (vertexCount + i) * PackedShapes<Packed>::kFloatsPerVertex;
+        for (size_t c = 0; c < 3; c++) {
+            out[c] = shape.vertices[shape.indices[i] * 3 + c];
+            out[3 + c] = i % 3 == c ? 1.0f : 0.0f;
+        }
+    }
+    vertexCount += I;
+}
 
-    setupBuffers(vertices, indices);
+template <typename... Tables>
+constexpr PackedShapes<(Tables::kIndexCount + ...)> PackShapes(const Tables&... tables) {
+    static_assert(sizeof...(Tables) == Mesh::kShapeCount, "one table per ShapeType");
+    PackedShapes<(Tables::kIndexCount + ...)> packed;
+    size_t vertexCount = 0;
+    int slot = 0;
+    (AppendShape(packed, tables, slot++, vertexCount), ...);
+    return packed;
 }
 
-void Mesh::draw() {
-    // Ensure our VAO is bound (core profile requires a VAO for vertex attrib state)
+constexpr auto kShapes = PackShapes(kCube, kTetrahedron, kOctahedron, MakeIcosahedron(),
+                                    MakeTorus<16, 8>(0.5, 0.3), MakeSphere<16, 8>(),
+                                    kPyramid, kDiamond);
+
+} // namespace
+
+Mesh::Mesh() : currentShape(ShapeType::CUBE) {
+    createAllShapes();
+}
+
+Mesh::Mesh(ShapeType shape) : currentShape(shape) {
+    createAllShapes();
+}
+
+Mesh::~Mesh() {
+    cleanup();
+}
+
+void Mesh::cleanup() {
+    if (vertexbuffer) {
+        glDeleteBuffers(1, &vertexbuffer);
+        vertexbuffer = 0;
+    }
+    if (instancebuffer) {
+        glDeleteBuffers(1, &instancebuffer);
+        instancebuffer = 0;
+    }
+    if (VertexArrayID) {
+        glDeleteVertexArrays(1, &VertexArrayID);
+        VertexArrayID = 0;
+    }
+}
+
+// Upload the compile-time shape tables into one vertex buffer: positions
+// at attribute location 0, barycentrics at location 6
+void Mesh::createAllShapes() {
+    glGenVertexArrays(1, &VertexArrayID);
     glBindVertexArray(VertexArrayID);
 
-    glEnableVertexAttribArray(0);
+    glGenBuffers(1, &vertexbuffer);
     glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-    glDrawElements(GL_TRIANGLES, vertex_size, GL_UNSIGNED_INT, 0);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(kShapes.vertices), kShapes.vertices, GL_STATIC_DRAW);
+    const GLsizei stride = kShapes.kFloatsPerVertex * sizeof(GLfloat);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(GLfloat)));
+
+    // Instance attributes advance once per instance; they are only enabled
+    // while drawInstanced runs. The buffer is sized on first upload.
+    glGenBuffers(1, &instancebuffer);
+    for (int i = 1; i <= 5; i++)
+        glVertexAttribDivisor(i, 1);
+
+    glBindVertexArray(0);
+}
+
+// Shape switches only pick another range of the shared buffers
+void Mesh::setShape(ShapeType shape) {
+    currentShape = shape;
+}
 
-    glDisableVertexAttribArray(0);
-}
\ No newline at end of file
+ShapeType Mesh::getRandomShape() {
+    static std::uniform_int_distribution<> dis(0, kShapeCount - 1);
+    return static_cast<ShapeType>(dis(gen));
+}
+
+void Mesh::draw() {
+    int shape = static_cast<int>(currentShape);
+    glBindVertexArray(VertexArrayID);
+    glDrawArrays(GL_TRIANGLES, kShapes.first[shape], kShapes.count[shape]);
+    glBindVertexArray(0);
+}
+
+void Mesh::uploadInstances(const MeshInstance* instances, GLsizei count) {
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    if (count > instanceCapacity) {
+        instanceCapacity = count;
+        glBufferData(GL_ARRAY_BUFFER, count * sizeof(MeshInstance), instances, GL_STREAM_DRAW);
+    } else {
+        // Orphan the old storage so the driver need not wait on last frame
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(MeshInstance), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(MeshInstance), instances);
+    }
+}
+
+void Mesh::drawInstanced(ShapeType shape, GLsizei first, GLsizei count) {
+    if (count <= 0)
+        return;
+    int index = static_cast<int>(shape);
+    glBindVertexArray(VertexArrayID);
+
+    // No base-instance draws in GL 3.3, so point the instance attributes at
+    // the first instance of this batch instead
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    size_t base = (size_t)first * sizeof(MeshInstance);
+    for (int column = 0; column < 4; column++) {
+        glEnableVertexAttribArray(1 + column);
+        glVertexAttribPointer(1 + column, 4, GL_FLOAT, GL_FALSE, sizeof(MeshInstance),
+                              (void*)(base + column * 4 * sizeof(GLfloat)));
+    }
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(MeshInstance),
+                          (void*)(base + offsetof(MeshInstance, color)));
+
+    glDrawArraysInstanced(GL_TRIANGLES, kShapes.first[index], kShapes.count[index], count);
+
+    for (int i = 1; i <= 5; i++)
+        glDisableVertexAttribArray(i);
+    glBindVertexArray(0);
+}
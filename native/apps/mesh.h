@@ -2,7 +2,6 @@
 #define MESH_H
 
 #include <glad/glad.h>
-#include <vector>
 
 enum class ShapeType {
     CUBE,
@@ -15,6 +14,18 @@ enum class ShapeType {
     DIAMOND
 };
 
+// Per-instance attributes for Mesh::drawInstanced: a column-major model
+// matrix (attribute locations 1-4) and an RGBA color (location 5)
+struct MeshInstance {
+    GLfloat model[16];
+    GLfloat color[4];
+};
+
+// Every ShapeType is generated at compile time and packed into one shared
+// vertex buffer; a shape is just a range of it, so switching shapes costs
+// nothing. Vertices carry their position (attribute location 0) and the
+// barycentric coordinates of their triangle corner (location 6), for
+// shaders that draw the wireframe from filled triangles.
 class Mesh {
 	public:
 		Mesh();
@@ -24,24 +35,24 @@ class Mesh {
 		void setShape(ShapeType shape);
 		ShapeType getCurrentShape() const { return currentShape; }
 		
+		// Replace the per-instance buffer contents for this frame
+		void uploadInstances(const MeshInstance* instances, GLsizei count);
+		// Draw instances [first, first + count) of the last upload as shape,
+		// in a single glDrawArraysInstanced call
+		void drawInstanced(ShapeType shape, GLsizei first, GLsizei count);
+		
 		// Static method to get random shape
 		static ShapeType getRandomShape();
 		
-	private:
-		void createCube();
-		void createTetrahedron();
-		void createOctahedron();
-		void createIcosahedron();
-		void createTorus(int segments = 16, int rings = 8, float outerRadius = 0.5f, float innerRadius = 0.3f);
-		void createSphere(int segments = 16, int rings = 8);
-		void createPyramid();
-		void createDiamond();
+		static const int kShapeCount = 8;
 		
+	private:
+		void createAllShapes();
 		void cleanup();
-		void setupBuffers(const std::vector<GLfloat>& vertices, const std::vector<GLuint>& indices);
 		
-		GLuint VertexArrayID, vertexbuffer, elementbuffer;
-		GLuint vertex_size;
+		GLuint VertexArrayID = 0, vertexbuffer = 0;
+		GLuint instancebuffer = 0;
+		GLsizei instanceCapacity = 0;
 		ShapeType currentShape;
 };
 
@@ -6,20 +6,29 @@
 #include <glm/gtc/type_ptr.hpp>
 #include "mesh.h"
 #include "loadShader.h"
+#include "splash_transforms.h"
+#include "gpu_timer.h"
 
 #include <vector>
 #include <string>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <random>
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #endif
 
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
-#include <unistd.h>
 #endif
 
 // Animation globals
@@ -30,16 +39,72 @@ Uint32 g_last_frame_time = 0;
 bool g_animation_running = true;
 ShapeType g_current_shape = ShapeType::CUBE;
 
+// Random-shapes field (--shapes N): N spinning shapes of mixed types drawn
+// with one instanced call per shape type instead of one draw per shape
+struct FieldShape {
+    ShapeType shape;
+    glm::vec3 position;
+    glm::vec3 axis;
+    float speed; // degrees per second
+    float scale;
+    glm::vec4 color;
+};
+int g_field_count = 0;
+std::vector<FieldShape> g_field;        // sorted by shape
+std::vector<MeshInstance> g_field_instances;
+GLsizei g_field_batch[Mesh::kShapeCount] = {};
+GLuint g_field_program = 0;
+GLint g_field_loc_view = -1;
+GLint g_field_loc_projection = -1;
+float g_field_time = 0.0f;
+
+// How the splash is drawn. A software GL (llvmpipe, GDI Generic, ...) or a
+// remote session (RDP, VNC, forwarded X) turns the wireframe into
+// seconds of CPU, so those get the text band alone or no splash at all.
+// A renderer found to be software is remembered in the cache directory, so
+// later launches never ask it for the expensive context.
+enum class SplashMode { Full, Simple, Skip };
+SplashMode g_splash_mode = SplashMode::Full;
+
+// Frame statistics (--frame-stats): CPU time of RenderFrame and GPU time of
+// its mesh and text passes, logged once a second, to tell CPU-bound jank
+// from GPU-bound jank
+bool g_frame_stats = false;
+GpuPassTimers g_gpu_timers;
+int g_gpu_mesh_pass = -1;
+int g_gpu_text_pass = -1;
+struct CpuFrameStats {
+    int frames = 0;
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+    Uint32 since = 0;
+};
+CpuFrameStats g_cpu_frame_stats;
+
+// Uniform locations of the mesh shader, resolved once after linking
+GLint g_loc_model = -1;
+GLint g_loc_view = -1;
+GLint g_loc_projection = -1;
+
 // Text overlay globals
 GLuint g_text_program = 0;
 GLuint g_text_vao = 0;
 GLuint g_text_vbo = 0;
 GLuint g_text_texture = 0;
+GLint g_text_loc_time = -1;      // the only uniform that changes per frame
+GLsizei g_text_vertex_count = 0; // vertices in g_text_vbo
+int g_text_layout_w = 0;         // screen size the VBO was laid out for
+int g_text_layout_h = 0;
+
+// Size the projection matrix was last set for
+int g_projection_w = 0;
+int g_projection_h = 0;
 
 // Forward declarations for text overlay
 static bool InitializeTextOverlay();
 static void DestroyTextOverlay();
 static void RenderNeonTextTop(int screen_width, int screen_height, const char* text, float time_seconds, int top_band_px);
+static void LayoutNeonTextTop(int screen_width, int screen_height, const char* text, int top_band_px);
 
 // A tiny 5x7 bitmap font for uppercase letters and space, packed into a single-channel texture
 // Each glyph cell is 6x8 (including 1px spacing), we'll pack characters we need: " INITIALIZING AUTOBUILD"
@@ -118,20 +183,6 @@ static bool BuildTextAtlas(std::vector<uint8_t>& atlas) {
     return true;
 }
 
-static GLuint CompileShader(GLenum type, const char* src) {
-    GLuint s = glCreateShader(type);
-    glShaderSource(s, 1, &src, nullptr);
-    glCompileShader(s);
-    GLint ok = 0; glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
-    if (!ok) {
-        GLint len = 0; glGetShaderiv(s, GL_INFO_LOG_LENGTH, &len);
-        std::vector<char> log(len + 1);
-        glGetShaderInfoLog(s, len, nullptr, log.data());
-        printf("Text shader compile error: %s\n", log.data());
-    }
-    return s;
-}
-
 static bool InitializeTextOverlay() {
     // Build atlas
     std::vector<uint8_t> atlas;
@@ -176,21 +227,26 @@ static bool InitializeTextOverlay() {
         }
     )";
 
-    GLuint v = CompileShader(GL_VERTEX_SHADER, vs);
-    GLuint f = CompileShader(GL_FRAGMENT_SHADER, fs);
-    g_text_program = glCreateProgram();
-    glAttachShader(g_text_program, v);
-    glAttachShader(g_text_program, f);
-    glLinkProgram(g_text_program);
-    glDeleteShader(v);
-    glDeleteShader(f);
+    g_text_program = LinkProgramCached(vs, fs, "text overlay vertex", "text overlay fragment");
 
-    // Fullscreen quad VBO/VAO (we will set coords per draw)
+    // Constant uniforms are set once; uTime is the only per-frame update
+    glUseProgram(g_text_program);
+    glUniform1i(glGetUniformLocation(g_text_program, "uAtlas"), 0);
+    glUniform3f(glGetUniformLocation(g_text_program, "uNeonBase"), 0.0f, 0.9f, 1.0f);
+    glUniform1f(glGetUniformLocation(g_text_program, "uGlow"), 1.0f);
+    g_text_loc_time = glGetUniformLocation(g_text_program, "uTime");
+    glUseProgram(0);
+
+    // The atlas is the only texture the splash samples; it stays bound
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, g_text_texture);
+
+    // Glyph quad VBO/VAO, filled by LayoutNeonTextTop when the size changes
     glGenVertexArrays(1, &g_text_vao);
     glGenBuffers(1, &g_text_vbo);
     glBindVertexArray(g_text_vao);
     glBindBuffer(GL_ARRAY_BUFFER, g_text_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 24, nullptr, GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 24, nullptr, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
@@ -207,8 +263,9 @@ static void DestroyTextOverlay() {
     if (g_text_program) { glDeleteProgram(g_text_program); g_text_program = 0; }
 }
 
-static void RenderNeonTextTop(int screen_width, int screen_height, const char* text, float time_seconds, int top_band_px) {
-    if (!g_text_program || !g_text_texture) return;
+// Build the glyph quads for text at this screen size into g_text_vbo. Only
+// called when the size changes; every other frame reuses the buffer.
+static void LayoutNeonTextTop(int screen_width, int screen_height, const char* text, int top_band_px) {
 
     // Prepare text (uppercase only)
     // Use text as provided (mixed case supported); trim to ASCII we have glyphs for
@@ -271,31 +328,212 @@ static void RenderNeonTextTop(int screen_width, int screen_height, const char* t
         pen_x += (kGlyphW * scale) + (1 * scale); // advance with kerning
     }
 
-    // Render with blending, no depth
-    GLboolean depth_enabled = glIsEnabled(GL_DEPTH_TEST);
-    GLboolean blend_enabled = glIsEnabled(GL_BLEND);
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindBuffer(GL_ARRAY_BUFFER, g_text_vbo);
+    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), verts.data(), GL_STATIC_DRAW);
+    g_text_vertex_count = (GLsizei)(verts.size() / 4);
+    g_text_layout_w = screen_width;
+    g_text_layout_h = screen_height;
+}
 
-    glUseProgram(g_text_program);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, g_text_texture);
-    GLint loc = glGetUniformLocation(g_text_program, "uAtlas");
-    glUniform1i(loc, 0);
-    glUniform3f(glGetUniformLocation(g_text_program, "uNeonBase"), 0.0f, 0.9f, 1.0f);
-    glUniform1f(glGetUniformLocation(g_text_program, "uTime"), time_seconds);
-    glUniform1f(glGetUniformLocation(g_text_program, "uGlow"), 1.0f);
+static void RenderNeonTextTop(int screen_width, int screen_height, const char* text, float time_seconds, int top_band_px) {
+    if (!g_text_program || !g_text_texture) return;
+    if (screen_width != g_text_layout_w || screen_height != g_text_layout_h)
+        LayoutNeonTextTop(screen_width, screen_height, text, top_band_px);
 
+    glUseProgram(g_text_program);
+    glUniform1f(g_text_loc_time, time_seconds);
     glBindVertexArray(g_text_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, g_text_vbo);
-    // Resize buffer if needed
-    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), verts.data(), GL_DYNAMIC_DRAW);
-    glDrawArrays(GL_TRIANGLES, 0, (GLint)(verts.size() / 4));
+    g_gpu_timers.Begin(g_gpu_text_pass);
+    glDrawArrays(GL_TRIANGLES, 0, g_text_vertex_count);
+    g_gpu_timers.End(g_gpu_text_pass);
     glBindVertexArray(0);
+}
+
+// Lay out the field on a jittered grid in front of the camera and build the
+// instanced shader. Called once at init when --shapes is given.
+static bool InitializeShapeField(int count) {
+    const char* vs = R"(
+        #version 330 core
+        layout(location=0) in vec3 aPos;
+        layout(location=1) in mat4 aModel;
+        layout(location=5) in vec4 aColor;
+        layout(location=6) in vec3 aBary;
+        uniform mat4 view;
+        uniform mat4 projection;
+        out vec4 vColor;
+        out vec3 vBary;
+        void main(){ vColor = aColor; vBary = aBary; gl_Position = projection * view * aModel * vec4(aPos, 1.0); }
+    )";
+    const char* fs = R"(
+        #version 330 core
+        in vec4 vColor; in vec3 vBary; out vec4 FragColor;
+        void main(){
+            vec3 edge = smoothstep(vec3(0.0), fwidth(vBary) * 1.5, vBary);
+            float line = 1.0 - min(min(edge.x, edge.y), edge.z);
+            if (line <= 0.0) discard;
+            FragColor = vec4(vColor.rgb, vColor.a * line);
+        }
+    )";
+    g_field_program = LinkProgramCached(vs, fs, "shape field vertex", "shape field fragment");
+    GLint linked = GL_FALSE;
+    glGetProgramiv(g_field_program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        printf("Failed to link the shape field shader\n");
+        return false;
+    }
+    g_field_loc_view = glGetUniformLocation(g_field_program, "view");
+    g_field_loc_projection = glGetUniformLocation(g_field_program, "projection");
+    glm::mat4 view = SplashView();
+    glUseProgram(g_field_program);
+    glUniformMatrix4fv(g_field_loc_view, 1, GL_FALSE, glm::value_ptr(view));
+    glUseProgram(0);
 
-    if (depth_enabled) glEnable(GL_DEPTH_TEST);
-    if (!blend_enabled) glDisable(GL_BLEND);
+    std::mt19937 rng(SDL_GetTicks());
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int columns = std::max(1, (int)std::ceil(std::sqrt((float)count * 4.0f / 3.0f)));
+    int rows = (count + columns - 1) / columns;
+    float cell = 4.4f / (float)columns;
+    g_field.clear();
+    for (int i = 0; i < count; i++) {
+        FieldShape f;
+        f.shape = Mesh::getRandomShape();
+        int cx = i % columns;
+        int cy = i / columns;
+        f.position = glm::vec3(-2.2f + cell * (cx + 0.25f + 0.5f * unit(rng)),
+                               -1.65f + (3.3f / rows) * (cy + 0.25f + 0.5f * unit(rng)),
+                               -1.5f * unit(rng));
+        f.axis = glm::normalize(glm::vec3(unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f) + glm::vec3(0.0f, 0.01f, 0.0f));
+        f.speed = 30.0f + 90.0f * unit(rng);
+        f.scale = std::min(cell, 3.3f / rows) * 0.45f;
+        float hue = unit(rng);
+        f.color = glm::vec4(0.5f + 0.5f * std::cos(6.2831853f * hue),
+                            0.5f + 0.5f * std::cos(6.2831853f * (hue - 0.333f)),
+                            0.5f + 0.5f * std::cos(6.2831853f * (hue - 0.667f)), 1.0f);
+        g_field.push_back(f);
+    }
+    // Contiguous per-shape runs, so each shape type is a single draw
+    std::stable_sort(g_field.begin(), g_field.end(),
+                     [](const FieldShape& a, const FieldShape& b) { return a.shape < b.shape; });
+    for (const FieldShape& f : g_field)
+        g_field_batch[static_cast<int>(f.shape)]++;
+    g_field_instances.resize(g_field.size());
+    printf("Shape field: %d shapes in %d instanced draws\n", count,
+           (int)std::count_if(g_field_batch, g_field_batch + Mesh::kShapeCount,
+                              [](GLsizei n) { return n > 0; }));
+    return true;
+}
+
+static void RenderShapeField(float delta_time) {
+    g_field_time += delta_time;
+    for (size_t i = 0; i < g_field.size(); i++) {
+        const FieldShape& f = g_field[i];
+        glm::mat4 model = SplashFieldModel(f.position, f.axis, f.speed * g_field_time, f.scale);
+        MeshInstance& instance = g_field_instances[i];
+        memcpy(instance.model, glm::value_ptr(model), sizeof(instance.model));
+        memcpy(instance.color, glm::value_ptr(f.color), sizeof(instance.color));
+    }
+    g_spinning_mesh->uploadInstances(g_field_instances.data(), (GLsizei)g_field_instances.size());
+    GLsizei first = 0;
+    for (int shape = 0; shape < Mesh::kShapeCount; shape++) {
+        g_spinning_mesh->drawInstanced(static_cast<ShapeType>(shape), first, g_field_batch[shape]);
+        first += g_field_batch[shape];
+    }
+}
+
+static const char* SplashModeName(SplashMode mode) {
+    return mode == SplashMode::Full ? "full" : mode == SplashMode::Simple ? "simple" : "skip";
+}
+
+static bool ParseSplashMode(const char* name, SplashMode& mode) {
+    for (SplashMode m : {SplashMode::Full, SplashMode::Simple, SplashMode::Skip}) {
+        if (strcmp(name, SplashModeName(m)) == 0) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string SplashModePath() {
+    std::string dir = AutobuildCacheDir();
+    if (dir.empty())
+        return "";
+#ifdef _WIN32
+    return dir + "\\splash_mode";
+#else
+    return dir + "/splash_mode";
+#endif
+}
+
+// The mode an earlier launch picked for this machine, Full if none
+static SplashMode LoadSplashMode() {
+    SplashMode mode = SplashMode::Full;
+    std::string path = SplashModePath();
+    FILE* file = path.empty() ? nullptr : fopen(path.c_str(), "r");
+    if (!file)
+        return mode;
+    char name[16] = {};
+    if (fscanf(file, "%15s", name) == 1)
+        ParseSplashMode(name, mode);
+    fclose(file);
+    return mode;
+}
+
+// The mode, and the renderer it was picked for (for whoever reads the file)
+static void SaveSplashMode(SplashMode mode, const char* renderer) {
+    std::string path = SplashModePath();
+    FILE* file = path.empty() ? nullptr : fopen(path.c_str(), "w");
+    if (!file)
+        return;
+    fprintf(file, "%s\n%s\n", SplashModeName(mode), renderer ? renderer : "");
+    fclose(file);
+    printf("Splash mode %s saved for %s\n", SplashModeName(mode), renderer ? renderer : "this machine");
+}
+
+// GL_RENDERER strings of CPU rasterizers
+static bool SoftwareRenderer(const char* renderer) {
+    static const char* const kSoftware[] = {
+        "llvmpipe", "softpipe", "swrast", "swiftshader", "software rasterizer",
+        "gdi generic", "basic render driver", "apple software renderer",
+    };
+    std::string name(renderer ? renderer : "");
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    for (const char* software : kSoftware)
+        if (name.find(software) != std::string::npos)
+            return true;
+    return false;
+}
+
+// Whether this process draws to a remote desktop, with what gave it away.
+// Such sessions are not remembered: the next launch may be local.
+static bool RemoteSession(const char*& why) {
+#ifdef _WIN32
+    if (GetSystemMetrics(SM_REMOTESESSION) != 0) {
+        why = "remote desktop session";
+        return true;
+    }
+#else
+    if (getenv("XRDP_SESSION")) {
+        why = "xrdp session";
+        return true;
+    }
+    if (getenv("VNCDESKTOP")) {
+        why = "VNC desktop";
+        return true;
+    }
+    if (getenv("SSH_CONNECTION") || getenv("SSH_CLIENT")) {
+        why = "ssh session";
+        return true;
+    }
+    // A display on another host (":0" and "unix:0" are local)
+    const char* display = getenv("DISPLAY");
+    if (display && *display && *display != ':' && strncmp(display, "unix:", 5) != 0) {
+        why = "remote X display";
+        return true;
+    }
+#endif
+    return false;
 }
 
 bool InitializeOpenGL(SDL_Window* window) {
@@ -313,10 +551,12 @@ bool InitializeOpenGL(SDL_Window* window) {
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 #endif
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
-    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
+    // The wireframe shaders anti-alias their own edges and draw no
+    // surfaces, so neither mode needs depth, stencil or MSAA
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 0);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 0);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 0);
     
     // Create OpenGL context
     SDL_GLContext gl_context = SDL_GL_CreateContext(window);
@@ -334,9 +574,12 @@ bool InitializeOpenGL(SDL_Window* window) {
         gl_context = SDL_GL_CreateContext(window);
         if (!gl_context) {
             printf("Failed to create fallback OpenGL context: %s\n", SDL_GetError());
+            SaveSplashMode(SplashMode::Skip, nullptr);
             return false;
         }
         printf("Successfully created OpenGL 2.1 context\n");
+        // The splash shaders need GLSL 3.30: not worth retrying next time
+        SaveSplashMode(SplashMode::Skip, (const char*)glGetString(GL_RENDERER));
 #else
         return false;
 #endif
@@ -354,16 +597,34 @@ bool InitializeOpenGL(SDL_Window* window) {
     printf("OpenGL Vendor: %s\n", glGetString(GL_VENDOR));
     printf("OpenGL Renderer: %s\n", glGetString(GL_RENDERER));
     printf("OpenGL Shading Language Version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
-    
-    // Enable depth testing
-    glEnable(GL_DEPTH_TEST);
-    
-    // Enable multisampling if available
-    GLint samples;
-    glGetIntegerv(GL_SAMPLES, &samples);
-    if (samples > 0) {
-        glEnable(GL_MULTISAMPLE);
-        printf("Multisampling enabled with %d samples\n", samples);
+
+    // A software renderer gets the text band from now on; one that turned
+    // out to be hardware after all gets the full splash from the next launch
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    bool software = SoftwareRenderer(renderer);
+    if (software && g_splash_mode == SplashMode::Full) {
+        g_splash_mode = SplashMode::Simple;
+        SaveSplashMode(SplashMode::Simple, renderer);
+    } else if (!software && g_splash_mode == SplashMode::Simple) {
+        SaveSplashMode(SplashMode::Full, renderer);
+    }
+    if (g_frame_stats) {
+        g_gpu_mesh_pass = g_gpu_timers.AddPass("mesh");
+        g_gpu_text_pass = g_gpu_timers.AddPass("text");
+        g_gpu_timers.Init();
+    }
+
+    // Everything drawn is blended, the wireframe edges and the text alike
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if (g_splash_mode == SplashMode::Simple) {
+        if (!InitializeTextOverlay()) {
+            printf("Failed to initialize text overlay\n");
+            SDL_GL_DeleteContext(gl_context);
+            return false;
+        }
+        printf("OpenGL splash initialized (text only, %s)\n", software ? "software renderer" : "saved mode");
+        return true;
     }
     
     // Create random spinning shape
@@ -496,6 +757,20 @@ bool InitializeOpenGL(SDL_Window* window) {
     }
     
     printf("Shaders loaded successfully from %s and %s\n", vertex_path, fragment_path);
+
+    // Resolve uniforms once; the view matrix never changes
+    g_loc_model = glGetUniformLocation(g_shader_program, "model");
+    g_loc_view = glGetUniformLocation(g_shader_program, "view");
+    g_loc_projection = glGetUniformLocation(g_shader_program, "projection");
+    glm::mat4 view = SplashView();
+    glUseProgram(g_shader_program);
+    glUniformMatrix4fv(g_loc_view, 1, GL_FALSE, glm::value_ptr(view));
+    glUseProgram(0);
+    
+    if (g_field_count > 0 && !InitializeShapeField(g_field_count)) {
+        // Fall back to the single spinning shape
+        g_field_count = 0;
+    }
     
     // Initialize text overlay (neon top band)
     if (!InitializeTextOverlay()) {
@@ -511,7 +786,21 @@ bool InitializeOpenGL(SDL_Window* window) {
     return true;
 }
 
+// The text band alone over a cleared screen
+static void RenderSimpleFrame(int screen_width, int screen_height) {
+    glViewport(0, 0, screen_width, screen_height);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    const int top_band_px = std::max(36, int(screen_height * 0.12f));
+    RenderNeonTextTop(screen_width, screen_height, "Initializing Autobuild", SDL_GetTicks() / 1000.0f, top_band_px);
+}
+
 void RenderFrame(int screen_width, int screen_height) {
+    g_gpu_timers.BeginFrame();
+    if (g_splash_mode == SplashMode::Simple) {
+        RenderSimpleFrame(screen_width, screen_height);
+        return;
+    }
     if (!g_spinning_mesh || g_shader_program == 0) return;
     
     // Calculate delta time
@@ -530,44 +819,35 @@ void RenderFrame(int screen_width, int screen_height) {
 
     // Set viewport for 3D content (exclude top band)
     glViewport(0, 0, screen_width, viewport_height);
-    glEnable(GL_DEPTH_TEST);
     
     // Clear the screen with a dark background
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-    
-    // Create transformation matrices
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::rotate(model, glm::radians(g_rotation_angle), glm::vec3(0.5f, 1.0f, 0.0f));
+    glClear(GL_COLOR_BUFFER_BIT);
     
-    glm::mat4 view = glm::mat4(1.0f);
-    view = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
-    
-    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 
-                                           float(screen_width) / float(viewport_height), 
-                                           0.1f, 100.0f);
-    
-    // Use shader program
-    glUseProgram(g_shader_program);
+    // Use shader program (one of the two for the whole run)
+    bool field = g_field_count > 0;
+    glUseProgram(field ? g_field_program : g_shader_program);
     
-    // Set uniforms
-    int modelLoc = glGetUniformLocation(g_shader_program, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    
-    int viewLoc = glGetUniformLocation(g_shader_program, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    
-    int projectionLoc = glGetUniformLocation(g_shader_program, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-    
-    // Set wireframe mode
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    
-    // Draw the mesh
-    g_spinning_mesh->draw();
+    // The projection follows the window size and the view matrix was set
+    // at init; only model transforms change every frame
+    if (screen_width != g_projection_w || viewport_height != g_projection_h) {
+        glm::mat4 projection = SplashProjection(screen_width, viewport_height);
+        glUniformMatrix4fv(field ? g_field_loc_projection : g_loc_projection, 1, GL_FALSE,
+                           glm::value_ptr(projection));
+        g_projection_w = screen_width;
+        g_projection_h = viewport_height;
+    }
     
-    // Reset polygon mode
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    // Filled triangles; the shaders keep only the pixels on their edges
+    g_gpu_timers.Begin(g_gpu_mesh_pass);
+    if (field) {
+        RenderShapeField(delta_time);
+    } else {
+        glm::mat4 model = SplashShapeModel(g_rotation_angle);
+        glUniformMatrix4fv(g_loc_model, 1, GL_FALSE, glm::value_ptr(model));
+        g_spinning_mesh->draw();
+    }
+    g_gpu_timers.End(g_gpu_mesh_pass);
 
     // Render neon text overlay in top band after 3D
     // Use full-screen viewport for 2D overlay so NDC mapping is correct
@@ -585,15 +865,267 @@ void CleanupOpenGL() {
         glDeleteProgram(g_shader_program);
         g_shader_program = 0;
     }
+    if (g_field_program != 0) {
+        glDeleteProgram(g_field_program);
+        g_field_program = 0;
+    }
+    g_gpu_timers.Destroy();
     DestroyTextOverlay();
 }
 
+// Prints the frame statistics gathered since the last call and starts over
+static void LogFrameStats() {
+    CpuFrameStats& cpu = g_cpu_frame_stats;
+    if (cpu.frames == 0)
+        return;
+    printf("Frames: %d, CPU %.2f ms avg %.2f ms max", cpu.frames, cpu.total_ms / cpu.frames, cpu.max_ms);
+    for (int pass = 0; pass < g_gpu_timers.PassCount(); pass++) {
+        if (g_gpu_timers.Samples(pass) == 0)
+            printf(", GPU %s -", g_gpu_timers.Name(pass));
+        else
+            printf(", GPU %s %.2f ms avg %.2f ms max", g_gpu_timers.Name(pass),
+                   g_gpu_timers.MeanMs(pass), g_gpu_timers.MaxMs(pass));
+    }
+    printf("\n");
+    g_gpu_timers.ResetStats();
+    cpu = CpuFrameStats();
+    cpu.since = SDL_GetTicks();
+}
+
+// Adds one frame's CPU time, logging once a second
+static void RecordFrameStats(double cpu_ms) {
+    CpuFrameStats& cpu = g_cpu_frame_stats;
+    cpu.frames++;
+    cpu.total_ms += cpu_ms;
+    cpu.max_ms = std::max(cpu.max_ms, cpu_ms);
+    if (SDL_GetTicks() - cpu.since >= 1000)
+        LogFrameStats();
+}
+
+// Ready handshake with autobuild_main. The splash starts the main app right
+// away and passes it the write end of a pipe (AUTOBUILD_READY_FD, or
+// AUTOBUILD_READY_HANDLE on Windows); the main app writes one byte once its
+// first frame is on screen. The pipe also reaches EOF if the main app exits
+// or fails to start. Without a pipe (macOS `open`) the splash just runs for
+// kSplashMaxMs.
+struct MainAppLaunch {
+    bool launched = false;
+#ifdef _WIN32
+    HANDLE ready = NULL;
+#else
+    int ready = -1;
+#endif
+};
+
+// The splash never stays up longer than this
+static const Uint32 kSplashMaxMs = 5000;
+
+#ifndef _WIN32
+// Directory holding this executable, or "" if unknown
+static std::string SplashExecutableDir() {
+    char path[1024];
+#ifdef __APPLE__
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) != 0)
+        return "";
+#else
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (n <= 0)
+        return "";
+    path[n] = '\0';
+#endif
+    char* last_slash = strrchr(path, '/');
+    if (!last_slash)
+        return "";
+    *last_slash = '\0';
+    return path;
+}
+
+// fork/exec the first of candidates that runs, with the pipe's write end
+// as AUTOBUILD_READY_FD. A candidate without a slash is looked up in PATH.
+static bool SpawnWithReadyPipe(const std::vector<std::string>& candidates, MainAppLaunch& launch) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Own session, so the main app outlives the splash
+        setsid();
+        setenv("AUTOBUILD_READY_FD", std::to_string(fds[1]).c_str(), 1);
+        for (const auto& exe : candidates)
+            execlp(exe.c_str(), exe.c_str(), (char*)nullptr);
+        _exit(127); // EOF on the pipe tells the splash
+    }
+    close(fds[1]);
+    launch.ready = fds[0];
+    launch.launched = true;
+    return true;
+}
+#endif
+
+static void LaunchMainApp(MainAppLaunch& launch) {
+#ifdef _WIN32
+    // Use CreateProcess to launch the main GUI application, handing it an
+    // inheritable pipe handle through the environment
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
+    HANDLE ready_read = NULL, ready_write = NULL;
+    bool have_pipe = CreatePipe(&ready_read, &ready_write, &sa, 0) != 0;
+    if (have_pipe) {
+        SetHandleInformation(ready_read, HANDLE_FLAG_INHERIT, 0);
+        char value[32];
+        snprintf(value, sizeof(value), "%llx", (unsigned long long)(uintptr_t)ready_write);
+        SetEnvironmentVariableA("AUTOBUILD_READY_HANDLE", value);
+    }
+
+    STARTUPINFOA si = { sizeof(si) };
+    PROCESS_INFORMATION pi = { 0 };
+    si.dwFlags = STARTF_USESHOWWINDOW;
+    si.wShowWindow = SW_SHOW; // Show the window for the main GUI
+
+    char cmdLine[] = "autobuild_main.exe";
+    if (CreateProcessA(NULL, cmdLine, NULL, NULL, have_pipe ? TRUE : FALSE,
+                      0, NULL, NULL, &si, &pi)) {
+        CloseHandle(pi.hProcess);
+        CloseHandle(pi.hThread);
+        launch.launched = true;
+        printf("Main application launched successfully\n");
+    } else {
+        printf("Failed to launch main application. Error: %lu\n", GetLastError());
+    }
+    if (have_pipe) {
+        SetEnvironmentVariableA("AUTOBUILD_READY_HANDLE", NULL);
+        CloseHandle(ready_write);
+        if (launch.launched)
+            launch.ready = ready_read;
+        else
+            CloseHandle(ready_read);
+    }
+#elif defined(__APPLE__)
+    // On macOS, find and launch the main application
+    printf("Launching main application on macOS...\n");
+    // First try to find the main app in the same directory as this animation
+    std::string dir_path = SplashExecutableDir();
+    if (dir_path.empty()) {
+        // Fallback if we can't get executable path
+        launch.launched = system("open -a autobuild_main >/dev/null 2>&1") == 0;
+        return;
+    }
+    std::string main_app_path = dir_path + "/autobuild_main";
+    printf("Looking for main app at: %s\n", main_app_path.c_str());
+    if (access(main_app_path.c_str(), X_OK) == 0) {
+        // Found it: start it directly so it can report when it is ready
+        printf("Found main app executable, launching...\n");
+        if (SpawnWithReadyPipe({main_app_path}, launch))
+            return;
+    }
+    // Try as app bundle
+    std::string bundle_path = dir_path + "/autobuild_main.app";
+    printf("Looking for main app bundle at: %s\n", bundle_path.c_str());
+    std::string launch_cmd;
+    if (access(bundle_path.c_str(), F_OK) == 0) {
+        printf("Found main app bundle, launching...\n");
+        launch_cmd = "open \"" + bundle_path + "\"";
+    } else {
+        // Fallback: try system PATH
+        printf("Main app not found locally, trying system PATH...\n");
+        launch_cmd = "open -a autobuild_main >/dev/null 2>&1";
+    }
+    printf("Launch command: %s\n", launch_cmd.c_str());
+    launch.launched = system(launch_cmd.c_str()) == 0;
+#else
+    // Linux/Unix: rely on PATH first, then next to this executable, then
+    // the working directory
+    std::vector<std::string> candidates = { "autobuild_main" };
+    std::string dir_path = SplashExecutableDir();
+    if (!dir_path.empty())
+        candidates.push_back(dir_path + "/autobuild_main");
+    candidates.push_back("./autobuild_main");
+    if (!SpawnWithReadyPipe(candidates, launch))
+        printf("Failed to launch main application\n");
+#endif
+}
+
+// True once the main app reported its first frame, or can no longer do so
+// (exited, failed to start)
+static bool MainAppReady(const MainAppLaunch& launch) {
+    if (!launch.launched)
+        return true;
+#ifdef _WIN32
+    if (launch.ready == NULL)
+        return false;
+    DWORD available = 0;
+    if (!PeekNamedPipe(launch.ready, NULL, 0, NULL, &available, NULL))
+        return true; // broken pipe: the main app is gone
+    return available > 0;
+#else
+    if (launch.ready < 0)
+        return false;
+    struct pollfd pfd = { launch.ready, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+#endif
+}
+
+static void CloseMainAppLaunch(MainAppLaunch& launch) {
+#ifdef _WIN32
+    if (launch.ready != NULL)
+        CloseHandle(launch.ready);
+    launch.ready = NULL;
+#else
+    if (launch.ready >= 0)
+        close(launch.ready);
+    launch.ready = -1;
+#endif
+}
+
 int main(int argc, char* argv[]) {
     printf("Starting Autobuild OpenGL Animation...\n");
+
+    // --shapes N: a field of N random spinning shapes instead of one
+    // --splash full|simple|skip: this mode, whatever was detected or saved
+    // --frame-stats: log CPU and GPU frame times once a second
+    bool forced = false;
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--frame-stats") == 0)
+            g_frame_stats = true;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--shapes") == 0)
+            g_field_count = std::max(0, std::min(atoi(argv[i + 1]), 4096));
+        if (strcmp(argv[i], "--splash") == 0)
+            forced = ParseSplashMode(argv[i + 1], g_splash_mode);
+    }
+
+    // Start the main application first; the splash only covers its startup
+    MainAppLaunch launch;
+    LaunchMainApp(launch);
+
+    // Nothing to show on a remote desktop, or where it was not worth it
+    const char* remote = nullptr;
+    if (!forced) {
+        if (RemoteSession(remote))
+            g_splash_mode = SplashMode::Skip;
+        else
+            g_splash_mode = LoadSplashMode();
+        // Mesa's switch for a CPU rasterizer: no need to ask the driver
+        const char* software = getenv("LIBGL_ALWAYS_SOFTWARE");
+        if (g_splash_mode == SplashMode::Full && software && strcmp(software, "0") != 0)
+            g_splash_mode = SplashMode::Simple;
+    }
+    if (g_splash_mode == SplashMode::Skip) {
+        printf("Skipping the splash (%s)\n", remote ? remote : forced ? "--splash skip" : "saved mode");
+        CloseMainAppLaunch(launch);
+        return 0;
+    }
     
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         printf("SDL failed initialization: %s\n", SDL_GetError());
+        CloseMainAppLaunch(launch);
         return -1;
     }
     
@@ -613,6 +1145,7 @@ int main(int argc, char* argv[]) {
     
     if (!window) {
         printf("Failed to create window: %s\n", SDL_GetError());
+        CloseMainAppLaunch(launch);
         SDL_Quit();
         return -1;
     }
@@ -623,6 +1156,7 @@ int main(int argc, char* argv[]) {
     printf("Initializing OpenGL...\n");
     if (!InitializeOpenGL(window)) {
         printf("Failed to initialize OpenGL animation\n");
+        CloseMainAppLaunch(launch);
         SDL_DestroyWindow(window);
         SDL_Quit();
         return -1;
@@ -630,18 +1164,19 @@ int main(int argc, char* argv[]) {
     
     printf("OpenGL initialized successfully\n");
     
-    // Animation duration (5 seconds)
+    // Run until the main app has painted its first frame, at most
+    // kSplashMaxMs
     Uint32 animation_start = SDL_GetTicks();
-    Uint32 animation_duration = 5000; // 5 seconds
+    g_cpu_frame_stats.since = animation_start;
     
-    printf("Starting animation loop (duration: %d ms)...\n", animation_duration);
+    printf("Starting animation loop (at most %u ms)...\n", (unsigned)kSplashMaxMs);
     
     // Main animation loop
     while (g_animation_running) {
         Uint32 current_time = SDL_GetTicks();
         
-        // Check if animation time is up
-        if (current_time - animation_start >= animation_duration) {
+        // Done once the main window is up, or when time is up
+        if (MainAppReady(launch) || current_time - animation_start >= kSplashMaxMs) {
             g_animation_running = false;
             break;
         }
@@ -666,87 +1201,25 @@ int main(int argc, char* argv[]) {
         }
         
         // Render frame
+        Uint64 frame_start = SDL_GetPerformanceCounter();
         RenderFrame(screen_width, screen_height);
+        if (g_frame_stats)
+            RecordFrameStats((SDL_GetPerformanceCounter() - frame_start) * 1000.0 / SDL_GetPerformanceFrequency());
         SDL_GL_SwapWindow(window);
         
-        // Cap frame rate
-        SDL_Delay(16); // ~60 FPS
+        // Cap frame rate; the text band pulses slowly enough for ~30 FPS
+        SDL_Delay(g_splash_mode == SplashMode::Simple ? 33 : 16);
     }
     
+    printf("Animation done after %u ms\n", (unsigned)(SDL_GetTicks() - animation_start));
+    if (g_frame_stats)
+        LogFrameStats();
+
     // Cleanup
+    CloseMainAppLaunch(launch);
     CleanupOpenGL();
     SDL_DestroyWindow(window);
     SDL_Quit();
     
-    printf("Animation complete, launching main application...\n");
-    
-    // Launch the main application
-    #ifdef _WIN32
-        // Use CreateProcess to launch the main GUI application
-        STARTUPINFOA si = { sizeof(si) };
-        PROCESS_INFORMATION pi = { 0 };
-        si.dwFlags = STARTF_USESHOWWINDOW;
-        si.wShowWindow = SW_SHOW; // Show the window for the main GUI
-        
-        char cmdLine[] = "autobuild_main.exe";
-        if (CreateProcessA(NULL, cmdLine, NULL, NULL, FALSE, 
-                          0, NULL, NULL, &si, &pi)) {
-            CloseHandle(pi.hProcess);
-            CloseHandle(pi.hThread);
-            printf("Main application launched successfully\n");
-        } else {
-            printf("Failed to launch main application. Error: %lu\n", GetLastError());
-        }
-    #elif defined(__APPLE__)
-        // On macOS, find and launch the main application
-        printf("Launching main application on macOS...\n");
-        // First try to find the main app in the same directory as this animation
-        char exe_path[1024];
-        uint32_t size = sizeof(exe_path);
-        if (_NSGetExecutablePath(exe_path, &size) == 0) {
-            printf("Animation executable path: %s\n", exe_path);
-            // Get directory containing this executable
-            char* last_slash = strrchr(exe_path, '/');
-            if (last_slash) {
-                *last_slash = '\0';
-                std::string dir_path = exe_path;
-                
-                // Try to find autobuild_main in the same directory
-                std::string main_app_path = dir_path + "/autobuild_main";
-                printf("Looking for main app at: %s\n", main_app_path.c_str());
-                if (access(main_app_path.c_str(), X_OK) == 0) {
-                    // Found it, launch it
-                    printf("Found main app executable, launching...\n");
-                    std::string launch_cmd = "open \"" + main_app_path + "\"";
-                    printf("Launch command: %s\n", launch_cmd.c_str());
-                    system(launch_cmd.c_str());
-                } else {
-                    // Try as app bundle
-                    std::string bundle_path = dir_path + "/autobuild_main.app";
-                    printf("Looking for main app bundle at: %s\n", bundle_path.c_str());
-                    if (access(bundle_path.c_str(), F_OK) == 0) {
-                        printf("Found main app bundle, launching...\n");
-                        std::string launch_cmd = "open \"" + bundle_path + "\"";
-                        printf("Launch command: %s\n", launch_cmd.c_str());
-                        system(launch_cmd.c_str());
-                    } else {
-                        // Fallback: try system PATH
-                        printf("Main app not found locally, trying system PATH...\n");
-                        system("open -a autobuild_main >/dev/null 2>&1");
-                    }
-                }
-            }
-        } else {
-            // Fallback if we can't get executable path
-            system("open -a autobuild_main >/dev/null 2>&1");
-        }
-    #else
-        // Linux/Unix: rely on PATH first, then local fallback
-        int rc = system("autobuild_main &");
-        if (rc != 0) {
-            system("./autobuild_main &");
-        }
-    #endif
-    
     return 0;
 }
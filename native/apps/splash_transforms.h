@@ -0,0 +1,33 @@
+#ifndef SPLASH_TRANSFORMS_H
+#define SPLASH_TRANSFORMS_H
+
+// Per-frame transform math of the splash animation, shared with
+// autobuild_bench so the benchmark times exactly what a frame computes.
+// With AUTOBUILD_GLM_SIMD these compile to glm's SSE/NEON code path.
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Camera three units back from the origin; constant for the whole run
+inline glm::mat4 SplashView() {
+    return glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
+}
+
+inline glm::mat4 SplashProjection(int width, int height) {
+    return glm::perspective(glm::radians(60.0f), float(width) / float(height), 0.1f, 100.0f);
+}
+
+// The single spinning shape
+inline glm::mat4 SplashShapeModel(float angle_degrees) {
+    return glm::rotate(glm::mat4(1.0f), glm::radians(angle_degrees), glm::vec3(0.5f, 1.0f, 0.0f));
+}
+
+// One shape of the --shapes field
+inline glm::mat4 SplashFieldModel(const glm::vec3& position, const glm::vec3& axis,
+                                  float angle_degrees, float scale) {
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::rotate(model, glm::radians(angle_degrees), axis);
+    return glm::scale(model, glm::vec3(scale));
+}
+
+#endif // SPLASH_TRANSFORMS_H
@@ -1,11 +1,14 @@
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
+layout (location = 6) in vec3 aBary;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+out vec3 vBary;
 
 void main() {
+	vBary = aBary;
 	gl_Position = projection * view * model * vec4(aPos, 1.0);
 }
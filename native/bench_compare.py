@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""
+Compare two Google Benchmark JSON reports and flag regressions.
+
+    bench_compare.py BASELINE.json CURRENT.json [--threshold 0.10]
+
+Reports come from --benchmark_out=FILE --benchmark_out_format=json. With
+--benchmark_repetitions the median aggregate of each benchmark is compared
+(or --aggregate mean); without repetitions, the mean of its runs is used.
+A benchmark is a regression when it got slower than the baseline by more
+than the threshold (a fraction: 0.10 is 10%). Exits 1 if any benchmark
+regressed, 0 otherwise.
+
+The `glm_bench_report` build target writes glm_bench_scalar.json and
+glm_bench_simd.json into the build directory; copying them into
+AUTOBUILD_GLM_BENCH_BASELINE_DIR makes them the baseline that
+`glm_bench_check` compares against. Baselines are only meaningful on the
+machine they were recorded on.
+"""
+
+import argparse
+import json
+import sys
+
+UNIT_NS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load_times(path, metric, aggregate):
+    """Map benchmark name -> time in ns, plus the report's context"""
+    with open(path, "r", encoding="utf-8") as f:
+        report = json.load(f)
+    aggregated = {}
+    runs = {}
+    for b in report.get("benchmarks", []):
+        if b.get("error_occurred"):
+            continue
+        name = b.get("run_name", b["name"])
+        ns = b[metric] * UNIT_NS.get(b.get("time_unit", "ns"), 1.0)
+        if b.get("run_type") == "aggregate":
+            if b.get("aggregate_name") == aggregate:
+                aggregated[name] = ns
+        else:
+            runs.setdefault(name, []).append(ns)
+    times = {name: sum(v) / len(v) for name, v in runs.items()}
+    times.update(aggregated)
+    return times, report.get("context", {})
+
+
+def format_ns(ns):
+    for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+        if ns >= scale:
+            return "%.2f %s" % (ns / scale, unit)
+    return "%.1f ns" % ns
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Flag benchmark regressions against a baseline report")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="allowed slowdown as a fraction (default 0.10)")
+    parser.add_argument("--metric", choices=("real_time", "cpu_time"),
+                        default="real_time")
+    parser.add_argument("--aggregate", choices=("median", "mean"),
+                        default="median")
+    args = parser.parse_args()
+
+    try:
+        base, base_ctx = load_times(args.baseline, args.metric, args.aggregate)
+        cur, cur_ctx = load_times(args.current, args.metric, args.aggregate)
+    except (OSError, ValueError, KeyError) as e:
+        print("bench_compare: %s" % e, file=sys.stderr)
+        return 2
+
+    for key in ("host_name", "num_cpus", "library_build_type"):
+        if base_ctx.get(key) != cur_ctx.get(key):
+            print("note: %s differs (baseline %s, current %s)"
+                  % (key, base_ctx.get(key), cur_ctx.get(key)))
+
+    width = max([len(n) for n in cur] + [9])
+    print("%-*s %12s %12s %9s" % (width, "benchmark", "baseline", "current",
+                                  "change"))
+    regressions = []
+    for name in sorted(cur):
+        if name not in base:
+            print("%-*s %12s %12s %9s" % (width, name, "-",
+                                          format_ns(cur[name]), "new"))
+            continue
+        change = cur[name] / base[name] - 1.0 if base[name] > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions.append(name)
+        elif change < -args.threshold:
+            flag = "  faster"
+        print("%-*s %12s %12s %+8.1f%%%s" % (width, name,
+                                            format_ns(base[name]),
+                                            format_ns(cur[name]),
+                                            change * 100.0, flag))
+    for name in sorted(set(base) - set(cur)):
+        print("%-*s %12s %12s %9s" % (width, name, format_ns(base[name]), "-",
+                                      "missing"))
+
+    if regressions:
+        print("%d benchmark(s) slower than the baseline by more than %.0f%%"
+              % (len(regressions), args.threshold * 100.0))
+        return 1
+    print("no regressions beyond %.0f%%" % (args.threshold * 100.0))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -27,7 +27,10 @@ $backend_files = @(
     "backends/imgui_impl_sdl2.cpp",
     "backends/imgui_impl_sdl2.h",
     "backends/imgui_impl_sdlrenderer2.cpp",
-    "backends/imgui_impl_sdlrenderer2.h"
+    "backends/imgui_impl_sdlrenderer2.h",
+    "backends/imgui_impl_opengl3.cpp",
+    "backends/imgui_impl_opengl3.h",
+    "backends/imgui_impl_opengl3_loader.h"
 )
 
 foreach ($file in $files) {
@@ -26,5 +26,10 @@ curl -L "https://raw.githubusercontent.com/ocornut/imgui/$IMGUI_VERSION/backends
 curl -L "https://raw.githubusercontent.com/ocornut/imgui/$IMGUI_VERSION/backends/imgui_impl_sdlrenderer2.cpp" -o "$IMGUI_DIR/imgui_impl_sdlrenderer2.cpp"
 curl -L "https://raw.githubusercontent.com/ocornut/imgui/$IMGUI_VERSION/backends/imgui_impl_sdlrenderer2.h" -o "$IMGUI_DIR/imgui_impl_sdlrenderer2.h"
 
+# OpenGL 3 backend (AUTOBUILD_GUI_OPENGL)
+curl -L "https://raw.githubusercontent.com/ocornut/imgui/$IMGUI_VERSION/backends/imgui_impl_opengl3.cpp" -o "$IMGUI_DIR/imgui_impl_opengl3.cpp"
+curl -L "https://raw.githubusercontent.com/ocornut/imgui/$IMGUI_VERSION/backends/imgui_impl_opengl3.h" -o "$IMGUI_DIR/imgui_impl_opengl3.h"
+curl -L "https://raw.githubusercontent.com/ocornut/imgui/$IMGUI_VERSION/backends/imgui_impl_opengl3_loader.h" -o "$IMGUI_DIR/imgui_impl_opengl3_loader.h"
+
 echo "Dear ImGui downloaded successfully to $IMGUI_DIR"
 
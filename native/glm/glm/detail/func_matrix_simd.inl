@@ -121,119 +121,162 @@ namespace glm {
 	}
 #endif // CXX11
 
+namespace detail
+{
+	// The adjugate of m and, in lane 0 of det, its determinant, both negated
+	// (the signs cancel in inverse()); shared by inverse() and determinant()
+	template<qualifier Q>
+	GLM_FUNC_QUALIFIER void neon_mat4_cofactors(mat<4, 4, float, Q> const& m,
+		float32x4_t& r0, float32x4_t& r1, float32x4_t& r2, float32x4_t& r3, float32x4_t& det)
+	{
+		float32x4_t const& m0 = m[0].data;
+		float32x4_t const& m1 = m[1].data;
+		float32x4_t const& m2 = m[2].data;
+		float32x4_t const& m3 = m[3].data;
+
+		// m[2][2] * m[3][3] - m[3][2] * m[2][3];
+		// m[2][2] * m[3][3] - m[3][2] * m[2][3];
+		// m[1][2] * m[3][3] - m[3][2] * m[1][3];
+		// m[1][2] * m[2][3] - m[2][2] * m[1][3];
+
+		float32x4_t Fac0;
+		{
+			float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 2), neon::dup_lane(m1, 2));
+			float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 3), 3, m2, 3);
+			float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 2), 3, m2, 2);
+			float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 3), neon::dup_lane(m1, 3));
+			Fac0 = w0 * w1 -  w2 * w3;
+		}
+
+		// m[2][1] * m[3][3] - m[3][1] * m[2][3];
+		// m[2][1] * m[3][3] - m[3][1] * m[2][3];
+		// m[1][1] * m[3][3] - m[3][1] * m[1][3];
+		// m[1][1] * m[2][3] - m[2][1] * m[1][3];
+
+		float32x4_t Fac1;
+		{
+			float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 1), neon::dup_lane(m1, 1));
+			float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 3), 3, m2, 3);
+			float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 1), 3, m2, 1);
+			float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 3), neon::dup_lane(m1, 3));
+			Fac1 = w0 * w1 - w2 * w3;
+		}
+
+		// m[2][1] * m[3][2] - m[3][1] * m[2][2];
+		// m[2][1] * m[3][2] - m[3][1] * m[2][2];
+		// m[1][1] * m[3][2] - m[3][1] * m[1][2];
+		// m[1][1] * m[2][2] - m[2][1] * m[1][2];
+
+		float32x4_t Fac2;
+		{
+			float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 1), neon::dup_lane(m1, 1));
+			float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 2), 3, m2, 2);
+			float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 1), 3, m2, 1);
+			float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 2), neon::dup_lane(m1, 2));
+			Fac2 = w0 * w1 - w2 * w3;
+		}
+
+		// m[2][0] * m[3][3] - m[3][0] * m[2][3];
+		// m[2][0] * m[3][3] - m[3][0] * m[2][3];
+		// m[1][0] * m[3][3] - m[3][0] * m[1][3];
+		// m[1][0] * m[2][3] - m[2][0] * m[1][3];
+
+		float32x4_t Fac3;
+		{
+			float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 0), neon::dup_lane(m1, 0));
+			float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 3), 3, m2, 3);
+			float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 0), 3, m2, 0);
+			float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 3), neon::dup_lane(m1, 3));
+			Fac3 = w0 * w1 - w2 * w3;
+		}
+
+		// m[2][0] * m[3][2] - m[3][0] * m[2][2];
+		// m[2][0] * m[3][2] - m[3][0] * m[2][2];
+		// m[1][0] * m[3][2] - m[3][0] * m[1][2];
+		// m[1][0] * m[2][2] - m[2][0] * m[1][2];
+
+		float32x4_t Fac4;
+		{
+			float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 0), neon::dup_lane(m1, 0));
+			float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 2), 3, m2, 2);
+			float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 0), 3, m2, 0);
+			float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 2), neon::dup_lane(m1, 2));
+			Fac4 = w0 * w1 - w2 * w3;
+		}
+
+		// m[2][0] * m[3][1] - m[3][0] * m[2][1];
+		// m[2][0] * m[3][1] - m[3][0] * m[2][1];
+		// m[1][0] * m[3][1] - m[3][0] * m[1][1];
+		// m[1][0] * m[2][1] - m[2][0] * m[1][1];
+
+		float32x4_t Fac5;
+		{
+			float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 0), neon::dup_lane(m1, 0));
+			float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 1), 3, m2, 1);
+			float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 0), 3, m2, 0);
+			float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 1), neon::dup_lane(m1, 1));
+			Fac5 = w0 * w1 - w2 * w3;
+		}
+
+		float32x4_t Vec0 = neon::copy_lane(neon::dupq_lane(m0, 0), 0, m1, 0); // (m[1][0], m[0][0], m[0][0], m[0][0]);
+		float32x4_t Vec1 = neon::copy_lane(neon::dupq_lane(m0, 1), 0, m1, 1); // (m[1][1], m[0][1], m[0][1], m[0][1]);
+		float32x4_t Vec2 = neon::copy_lane(neon::dupq_lane(m0, 2), 0, m1, 2); // (m[1][2], m[0][2], m[0][2], m[0][2]);
+		float32x4_t Vec3 = neon::copy_lane(neon::dupq_lane(m0, 3), 0, m1, 3); // (m[1][3], m[0][3], m[0][3], m[0][3]);
+
+		float32x4_t Inv0 = Vec1 * Fac0 - Vec2 * Fac1 + Vec3 * Fac2;
+		float32x4_t Inv1 = Vec0 * Fac0 - Vec2 * Fac3 + Vec3 * Fac4;
+		float32x4_t Inv2 = Vec0 * Fac1 - Vec1 * Fac3 + Vec3 * Fac5;
+		float32x4_t Inv3 = Vec0 * Fac2 - Vec1 * Fac4 + Vec2 * Fac5;
+
+		r0 = float32x4_t{-1, +1, -1, +1} * Inv0;
+		r1 = float32x4_t{+1, -1, +1, -1} * Inv1;
+		r2 = float32x4_t{-1, +1, -1, +1} * Inv2;
+		r3 = float32x4_t{+1, -1, +1, -1} * Inv3;
+
+		det = neon::mul_lane(r0, m0, 0);
+		det = neon::madd_lane(det, r1, m0, 1);
+		det = neon::madd_lane(det, r2, m0, 2);
+		det = neon::madd_lane(det, r3, m0, 3);
+
+	}
+
+	template<qualifier Q>
+	struct compute_transpose<4, 4, float, Q, true>
+	{
+		GLM_FUNC_QUALIFIER static mat<4, 4, float, Q> call(mat<4, 4, float, Q> const& m)
+		{
+			// t01 = {(m[0][0], m[1][0], m[0][2], m[1][2]), (m[0][1], m[1][1], m[0][3], m[1][3])}
+			// and t23 likewise for columns 2 and 3
+			float32x4x2_t const t01 = vtrnq_f32(m[0].data, m[1].data);
+			float32x4x2_t const t23 = vtrnq_f32(m[2].data, m[3].data);
+
+			mat<4, 4, float, Q> Result;
+			Result[0].data = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+			Result[1].data = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+			Result[2].data = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+			Result[3].data = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+			return Result;
+		}
+	};
+
+	template<qualifier Q>
+	struct compute_determinant<4, 4, float, Q, true>
+	{
+		GLM_FUNC_QUALIFIER static float call(mat<4, 4, float, Q> const& m)
+		{
+			float32x4_t r0, r1, r2, r3, det;
+			neon_mat4_cofactors(m, r0, r1, r2, r3, det);
+			return -vgetq_lane_f32(det, 0);
+		}
+	};
+
 	template<qualifier Q>
-	struct detail::compute_inverse<4, 4, float, Q, true>
+	struct compute_inverse<4, 4, float, Q, true>
 	{
 		GLM_FUNC_QUALIFIER static mat<4, 4, float, Q> call(mat<4, 4, float, Q> const& m)
 		{
-			float32x4_t const& m0 = m[0].data;
-			float32x4_t const& m1 = m[1].data;
-			float32x4_t const& m2 = m[2].data;
-			float32x4_t const& m3 = m[3].data;
-
-			// m[2][2] * m[3][3] - m[3][2] * m[2][3];
-			// m[2][2] * m[3][3] - m[3][2] * m[2][3];
-			// m[1][2] * m[3][3] - m[3][2] * m[1][3];
-			// m[1][2] * m[2][3] - m[2][2] * m[1][3];
-
-			float32x4_t Fac0;
-			{
-				float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 2), neon::dup_lane(m1, 2));
-				float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 3), 3, m2, 3);
-				float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 2), 3, m2, 2);
-				float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 3), neon::dup_lane(m1, 3));
-				Fac0 = w0 * w1 -  w2 * w3;
-			}
-
-			// m[2][1] * m[3][3] - m[3][1] * m[2][3];
-			// m[2][1] * m[3][3] - m[3][1] * m[2][3];
-			// m[1][1] * m[3][3] - m[3][1] * m[1][3];
-			// m[1][1] * m[2][3] - m[2][1] * m[1][3];
-
-			float32x4_t Fac1;
-			{
-				float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 1), neon::dup_lane(m1, 1));
-				float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 3), 3, m2, 3);
-				float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 1), 3, m2, 1);
-				float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 3), neon::dup_lane(m1, 3));
-				Fac1 = w0 * w1 - w2 * w3;
-			}
-
-			// m[2][1] * m[3][2] - m[3][1] * m[2][2];
-			// m[2][1] * m[3][2] - m[3][1] * m[2][2];
-			// m[1][1] * m[3][2] - m[3][1] * m[1][2];
-			// m[1][1] * m[2][2] - m[2][1] * m[1][2];
-
-			float32x4_t Fac2;
-			{
-				float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 1), neon::dup_lane(m1, 1));
-				float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 2), 3, m2, 2);
-				float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 1), 3, m2, 1);
-				float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 2), neon::dup_lane(m1, 2));
-				Fac2 = w0 * w1 - w2 * w3;
-			}
-
-			// m[2][0] * m[3][3] - m[3][0] * m[2][3];
-			// m[2][0] * m[3][3] - m[3][0] * m[2][3];
-			// m[1][0] * m[3][3] - m[3][0] * m[1][3];
-			// m[1][0] * m[2][3] - m[2][0] * m[1][3];
-
-			float32x4_t Fac3;
-			{
-				float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 0), neon::dup_lane(m1, 0));
-				float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 3), 3, m2, 3);
-				float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 0), 3, m2, 0);
-				float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 3), neon::dup_lane(m1, 3));
-				Fac3 = w0 * w1 - w2 * w3;
-			}
-
-			// m[2][0] * m[3][2] - m[3][0] * m[2][2];
-			// m[2][0] * m[3][2] - m[3][0] * m[2][2];
-			// m[1][0] * m[3][2] - m[3][0] * m[1][2];
-			// m[1][0] * m[2][2] - m[2][0] * m[1][2];
-
-			float32x4_t Fac4;
-			{
-				float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 0), neon::dup_lane(m1, 0));
-				float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 2), 3, m2, 2);
-				float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 0), 3, m2, 0);
-				float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 2), neon::dup_lane(m1, 2));
-				Fac4 = w0 * w1 - w2 * w3;
-			}
-
-			// m[2][0] * m[3][1] - m[3][0] * m[2][1];
-			// m[2][0] * m[3][1] - m[3][0] * m[2][1];
-			// m[1][0] * m[3][1] - m[3][0] * m[1][1];
-			// m[1][0] * m[2][1] - m[2][0] * m[1][1];
-
-			float32x4_t Fac5;
-			{
-				float32x4_t w0 = vcombine_f32(neon::dup_lane(m2, 0), neon::dup_lane(m1, 0));
-				float32x4_t w1 = neon::copy_lane(neon::dupq_lane(m3, 1), 3, m2, 1);
-				float32x4_t w2 = neon::copy_lane(neon::dupq_lane(m3, 0), 3, m2, 0);
-				float32x4_t w3 = vcombine_f32(neon::dup_lane(m2, 1), neon::dup_lane(m1, 1));
-				Fac5 = w0 * w1 - w2 * w3;
-			}
-
-			float32x4_t Vec0 = neon::copy_lane(neon::dupq_lane(m0, 0), 0, m1, 0); // (m[1][0], m[0][0], m[0][0], m[0][0]);
-			float32x4_t Vec1 = neon::copy_lane(neon::dupq_lane(m0, 1), 0, m1, 1); // (m[1][1], m[0][1], m[0][1], m[0][1]);
-			float32x4_t Vec2 = neon::copy_lane(neon::dupq_lane(m0, 2), 0, m1, 2); // (m[1][2], m[0][2], m[0][2], m[0][2]);
-			float32x4_t Vec3 = neon::copy_lane(neon::dupq_lane(m0, 3), 0, m1, 3); // (m[1][3], m[0][3], m[0][3], m[0][3]);
-
-			float32x4_t Inv0 = Vec1 * Fac0 - Vec2 * Fac1 + Vec3 * Fac2;
-			float32x4_t Inv1 = Vec0 * Fac0 - Vec2 * Fac3 + Vec3 * Fac4;
-			float32x4_t Inv2 = Vec0 * Fac1 - Vec1 * Fac3 + Vec3 * Fac5;
-			float32x4_t Inv3 = Vec0 * Fac2 - Vec1 * Fac4 + Vec2 * Fac5;
-
-			float32x4_t r0 = float32x4_t{-1, +1, -1, +1} * Inv0;
-			float32x4_t r1 = float32x4_t{+1, -1, +1, -1} * Inv1;
-			float32x4_t r2 = float32x4_t{-1, +1, -1, +1} * Inv2;
-			float32x4_t r3 = float32x4_t{+1, -1, +1, -1} * Inv3;
-
-			float32x4_t det = neon::mul_lane(r0, m0, 0);
-			det = neon::madd_lane(det, r1, m0, 1);
-			det = neon::madd_lane(det, r2, m0, 2);
-			det = neon::madd_lane(det, r3, m0, 3);
+			float32x4_t r0, r1, r2, r3, det;
+			neon_mat4_cofactors(m, r0, r1, r2, r3, det);
 
 			float32x4_t rdet = vdupq_n_f32(1 / vgetq_lane_f32(det, 0));
 
@@ -245,5 +288,6 @@ namespace glm {
 			return r;
 		}
 	};
+}//namespace detail
 }//namespace glm
 #endif
@@ -0,0 +1,49 @@
+# Training workload for AUTOBUILD_PGO (see CMakeLists.txt), run as
+#   cmake -DBENCH=<autobuild_bench> -DPGO_DIR=<dir> [-DLOAD=<autobuild_main>]
+#         [-DPROFDATA=<llvm-profdata>] -P pgo_train.cmake
+# The synthetic load generator's output stands in for a real run's log in
+# the log benchmarks; the frame benchmark lays out that text in ImGui.
+
+if(NOT BENCH OR NOT PGO_DIR)
+  message(FATAL_ERROR "pgo_train.cmake needs -DBENCH and -DPGO_DIR")
+endif()
+
+# A fresh profile: counts from an older build no longer match its code
+file(REMOVE_RECURSE "${PGO_DIR}")
+file(MAKE_DIRECTORY "${PGO_DIR}")
+
+if(LOAD)
+  set(_log "${PGO_DIR}/synthetic_load.log")
+  execute_process(
+    COMMAND "${LOAD}" --synthetic-load --rate 20000 --seconds 3
+      --burst 20000 --burst-every 1 --long-pct 1
+    OUTPUT_FILE "${_log}"
+    RESULT_VARIABLE _result)
+  if(NOT _result EQUAL 0)
+    message(FATAL_ERROR "Synthetic load run failed: ${_result}")
+  endif()
+  set(ENV{AUTOBUILD_BENCH_LOG} "${_log}")
+endif()
+
+# The hot paths: log ingestion and text kernels, ANSI stripping, line
+# classification, diffing, JSON and the ImGui log frame
+set(_filter "LogIngest|LineSplitter|StripAnsi|LogSpool|AsyncLogger|Classify")
+string(APPEND _filter "|LineDiff|Json|FindLineBreaks|FindJsonEscapes")
+string(APPEND _filter "|FoldAsciiLower|FindAnyOf|ImGuiLogFrame")
+execute_process(
+  COMMAND "${BENCH}" --benchmark_filter=${_filter} --benchmark_min_time=0.2
+  RESULT_VARIABLE _result)
+if(NOT _result EQUAL 0)
+  message(FATAL_ERROR "Training benchmarks failed: ${_result}")
+endif()
+
+if(PROFDATA)
+  file(GLOB _raw "${PGO_DIR}/*.profraw")
+  execute_process(
+    COMMAND "${PROFDATA}" merge -output=${PGO_DIR}/default.profdata ${_raw}
+    RESULT_VARIABLE _result)
+  if(NOT _result EQUAL 0)
+    message(FATAL_ERROR "llvm-profdata merge failed: ${_result}")
+  endif()
+endif()
+message(STATUS "PGO profile written to ${PGO_DIR}")
@@ -57,8 +57,13 @@ echo 5. Starting animation...
 cd build-gui-mingw
 autobuild_gui.exe
 
+echo.
+echo    Now a field of 200 random shapes, drawn with one instanced call per shape type...
+autobuild_gui.exe --shapes 200
+
 echo.
 echo 6. Test completed!
 echo.
-echo If you saw a single shape rotating for 5 seconds, the random shape system is working!
+echo If you saw a single shape rotating for 5 seconds, then a field of colored
+echo shapes spinning independently, the random shape system is working!
 echo Each time you run this, you should see a different random shape selected.